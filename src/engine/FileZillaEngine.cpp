@@ -48,6 +48,21 @@ int CFileZillaEngine::CacheLookup(const CServerPath& path, CDirectoryListing& li
 	return impl_->CacheLookup(path, listing);
 }
 
+int CFileZillaEngine::CacheLookupMany(std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings)
+{
+	return impl_->CacheLookupMany(paths, listings);
+}
+
+int CFileZillaEngine::CacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings)
+{
+	return impl_->CacheLookupMany(server, paths, listings);
+}
+
+int CFileZillaEngine::CacheLookupTree(CServerPath const& path, std::wstring const& needle, std::vector<CDirectoryListing>& listings)
+{
+	return impl_->CacheLookupTree(path, needle, listings);
+}
+
 int CFileZillaEngine::Cancel()
 {
 	return impl_->Cancel();
@@ -58,6 +73,11 @@ bool CFileZillaEngine::IsBusy() const
 	return impl_->IsBusy();
 }
 
+unsigned int CFileZillaEngine::GetEngineId() const
+{
+	return impl_->GetEngineId();
+}
+
 bool CFileZillaEngine::IsConnected() const
 {
 	return impl_->IsConnected();
@@ -0,0 +1,138 @@
+#include <filezilla.h>
+
+#include "activeports.h"
+
+#include <libfilezilla/util.hpp>
+
+namespace {
+// Somewhat above the usual duration of TIME_WAIT
+fz::duration const cooldown = fz::duration::from_seconds(120);
+
+// Listeners not taken by then have most likely been opened for nothing
+fz::duration const listener_expiry = fz::duration::from_seconds(30);
+}
+
+int CActivePortAllocator::Acquire(int low, int high)
+{
+	if (low > high) {
+		low = high;
+	}
+	if (low <= 0 || high >= 65536) {
+		return 0;
+	}
+
+	fz::scoped_lock l(mutex_);
+
+	// Starting at a random port on first use, after that continue where the
+	// previous search left off.
+	if (next_ < low || next_ > high) {
+		next_ = static_cast<int>(fz::random_number(low, high));
+	}
+
+	auto const now = fz::monotonic_clock::now();
+
+	int fallback{};
+	fz::monotonic_clock fallbackTime;
+
+	int const count = high - low + 1;
+	for (int i = 0; i < count; ++i) {
+		int const port = next_++;
+		if (next_ > high) {
+			next_ = low;
+		}
+
+		if (used_.count(port)) {
+			continue;
+		}
+
+		auto it = released_.find(port);
+		if (it != released_.end()) {
+			if (now - it->second < cooldown) {
+				if (!fallback || it->second < fallbackTime) {
+					fallback = port;
+					fallbackTime = it->second;
+				}
+				continue;
+			}
+			released_.erase(it);
+		}
+
+		used_.insert(port);
+		return port;
+	}
+
+	// All free ports have been used recently, take the one that has been
+	// released the longest time ago.
+	if (fallback) {
+		released_.erase(fallback);
+		used_.insert(fallback);
+	}
+	return fallback;
+}
+
+void CActivePortAllocator::Release(int port)
+{
+	if (!port) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+	used_.erase(port);
+	released_[port] = fz::monotonic_clock::now();
+
+	// Keep this bounded
+	if (released_.size() > 4096) {
+		auto const now = fz::monotonic_clock::now();
+		for (auto it = released_.begin(); it != released_.end();) {
+			if (now - it->second >= cooldown) {
+				it = released_.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+}
+
+void CActivePortAllocator::StoreListener(std::unique_ptr<fz::listen_socket> && socket, int port)
+{
+	if (!socket) {
+		Release(port);
+		return;
+	}
+
+	listener old;
+	{
+		fz::scoped_lock l(mutex_);
+		auto & current = listeners_[socket->address_family()];
+		old = std::move(current);
+		current.socket_ = std::move(socket);
+		current.port_ = port;
+		current.time_ = fz::monotonic_clock::now();
+	}
+	old.socket_.reset();
+	Release(old.port_);
+}
+
+std::unique_ptr<fz::listen_socket> CActivePortAllocator::TakeListener(fz::address_type family, int low, int high, int & port)
+{
+	listener taken;
+	{
+		fz::scoped_lock l(mutex_);
+		auto it = listeners_.find(family);
+		if (it == listeners_.end()) {
+			return nullptr;
+		}
+		taken = std::move(it->second);
+		listeners_.erase(it);
+	}
+
+	if (taken.port_ < low || taken.port_ > high || fz::monotonic_clock::now() - taken.time_ >= listener_expiry) {
+		taken.socket_.reset();
+		Release(taken.port_);
+		return nullptr;
+	}
+
+	port = taken.port_;
+	return std::move(taken.socket_);
+}
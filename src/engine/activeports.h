@@ -0,0 +1,58 @@
+#ifndef FILEZILLA_ENGINE_ACTIVEPORTS_HEADER
+#define FILEZILLA_ENGINE_ACTIVEPORTS_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/socket.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <map>
+#include <memory>
+#include <set>
+
+// Hands out the ports for active mode data connections within the limited
+// port range, shared by all engines. Ports are not given out again while
+// in use and, if possible, not for a while after being released as they
+// are likely to still be in TIME_WAIT.
+//
+// Also holds a listener opened ahead of time for the next transfer, so that
+// it does not need to wait for binding a port.
+class CActivePortAllocator final
+{
+public:
+	CActivePortAllocator() = default;
+
+	CActivePortAllocator(CActivePortAllocator const&) = delete;
+	CActivePortAllocator& operator=(CActivePortAllocator const&) = delete;
+
+	// Returns the port to try next, 0 if all ports in the range are in use.
+	// Pass it to Release afterwards, also if it could not be bound. It then
+	// gets skipped for a while as well.
+	int Acquire(int low, int high);
+	void Release(int port);
+
+	// Takes ownership of a listener for a port obtained through Acquire.
+	// Any previous listener for the same address family gets closed.
+	void StoreListener(std::unique_ptr<fz::listen_socket> && socket, int port);
+
+	// Returns a stored listener if there is one within the range. The caller
+	// needs to set its event handler. port is set to the port to release
+	// once done.
+	std::unique_ptr<fz::listen_socket> TakeListener(fz::address_type family, int low, int high, int & port);
+
+private:
+	fz::mutex mutex_;
+
+	std::set<int> used_;
+	std::map<int, fz::monotonic_clock> released_;
+	int next_{};
+
+	struct listener final
+	{
+		std::unique_ptr<fz::listen_socket> socket_;
+		int port_{};
+		fz::monotonic_clock time_;
+	};
+	std::map<fz::address_type, listener> listeners_;
+};
+
+#endif
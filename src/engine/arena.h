@@ -0,0 +1,111 @@
+#ifndef FILEZILLA_ENGINE_ARENA_HEADER
+#define FILEZILLA_ENGINE_ARENA_HEADER
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Simple bump allocator. Individual allocations are never freed, instead
+// the whole arena is rewound at once. Rewinding keeps the blocks for
+// reuse, release() frees them.
+// Objects placed into the arena need to be destroyed by their owner.
+class CArena final
+{
+public:
+	explicit CArena(size_t blockSize = 64 * 1024)
+		: blockSize_(blockSize)
+	{}
+
+	CArena(CArena const&) = delete;
+	CArena& operator=(CArena const&) = delete;
+
+	// align must be a power of two not larger than alignof(std::max_align_t)
+	void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+	{
+		while (current_ < blocks_.size()) {
+			auto & b = blocks_[current_];
+			size_t const offset = (pos_ + align - 1) & ~(align - 1);
+			if (offset <= b.size && size <= b.size - offset) {
+				pos_ = offset + size;
+				return b.data.get() + offset;
+			}
+			++current_;
+			pos_ = 0;
+		}
+
+		size_t const s = std::max(blockSize_, size);
+		blocks_.push_back(block{std::unique_ptr<char[]>(new char[s]), s});
+		current_ = blocks_.size() - 1;
+		pos_ = size;
+		return blocks_.back().data.get();
+	}
+
+	template<typename T>
+	T* allocate_array(size_t n)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+	}
+
+	void rewind()
+	{
+		current_ = 0;
+		pos_ = 0;
+	}
+
+	void release()
+	{
+		blocks_.clear();
+		rewind();
+	}
+
+private:
+	struct block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size{};
+	};
+
+	std::vector<block> blocks_;
+	size_t current_{};
+	size_t pos_{};
+	size_t const blockSize_;
+};
+
+// Allocator for standard containers on top of a CArena. Deallocation is
+// a no-op, memory is reclaimed by rewinding the arena.
+template<typename T>
+class CArenaAllocator final
+{
+public:
+	typedef T value_type;
+
+	explicit CArenaAllocator(CArena & arena) noexcept
+		: arena_(&arena)
+	{}
+
+	template<typename U>
+	CArenaAllocator(CArenaAllocator<U> const& other) noexcept
+		: arena_(other.arena_)
+	{}
+
+	T* allocate(size_t n)
+	{
+		return arena_->allocate_array<T>(n);
+	}
+
+	void deallocate(T*, size_t) noexcept {}
+
+	template<typename U>
+	bool operator==(CArenaAllocator<U> const& other) const noexcept { return arena_ == other.arena_; }
+
+	template<typename U>
+	bool operator!=(CArenaAllocator<U> const& other) const noexcept { return arena_ != other.arena_; }
+
+private:
+	template<typename U> friend class CArenaAllocator;
+
+	CArena* arena_;
+};
+
+#endif
@@ -134,11 +134,55 @@ bool CRenameCommand::valid() const
 
 CChmodCommand::CChmodCommand(CServerPath const& path, std::wstring const& file, std::wstring const& permission)
 	: m_path(path)
-	, m_file(file)
-	, m_permission(permission)
+	, m_files{{file, permission}}
+{}
+
+CChmodCommand::CChmodCommand(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files)
+	: m_path(path)
+	, m_files(std::move(files))
 {}
 
 bool CChmodCommand::valid() const
 {
-	return !GetPath().empty() && !GetFile().empty() && !GetPermission().empty();
+	if (GetPath().empty() || m_files.empty()) {
+		return false;
+	}
+	for (auto const& file : m_files) {
+		if (file.first.empty() || file.second.empty()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CBatchCommand::CanBatch(CCommand const& command)
+{
+	switch (command.GetId()) {
+	case Command::mkdir:
+	case Command::rename:
+	case Command::chmod:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void CBatchCommand::Add(std::unique_ptr<CCommand> && command)
+{
+	if (command) {
+		commands_.emplace_back(std::move(command));
+	}
+}
+
+bool CBatchCommand::valid() const
+{
+	if (commands_.empty()) {
+		return false;
+	}
+	for (auto const& command : commands_) {
+		if (!CanBatch(*command) || !command->valid()) {
+			return false;
+		}
+	}
+	return true;
 }
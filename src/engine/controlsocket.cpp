@@ -1,11 +1,13 @@
 #include <filezilla.h>
 #include "controlsocket.h"
 #include "directorycache.h"
+#include "dns_cache.h"
 #include "engineprivate.h"
 #include "local_path.h"
 #include "lookup.h"
 #include "logging_private.h"
 #include "proxy.h"
+#include "resume_journal.h"
 #include "servercapabilities.h"
 #include "sizeformatting_base.h"
 
@@ -14,6 +16,8 @@
 #include <libfilezilla/local_filesys.hpp>
 #include <libfilezilla/rate_limited_layer.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 #include <string.h>
 
@@ -37,6 +41,7 @@ CControlSocket::CControlSocket(CFileZillaEnginePrivate & engine)
 	, opLockManager_(engine.opLockManager_)
 	, logger_(engine.GetLogger())
 {
+	engine_.GetMetrics().ConnectionOpened();
 }
 
 CControlSocket::~CControlSocket()
@@ -44,6 +49,8 @@ CControlSocket::~CControlSocket()
 	remove_handler();
 
 	DoClose();
+
+	engine_.GetMetrics().ConnectionClosed();
 }
 
 int CControlSocket::Disconnect()
@@ -362,9 +369,17 @@ int CControlSocket::CheckOverwriteFile()
 	auto & data = static_cast<CFileTransferOpData &>(*operations_.back());
 
 	if (data.download_) {
+		// Segments always write into the file the queue prepared for them
+		if (data.transferSettings_.segmentOffset >= 0) {
+			return FZ_REPLY_OK;
+		}
 		if (fz::local_filesys::get_file_type(fz::to_native(data.localFile_), true) != fz::local_filesys::file) {
 			return FZ_REPLY_OK;
 		}
+
+		// Whatever happens to the file now, the journal of an earlier
+		// segmented download no longer describes it.
+		CResumeJournal::Remove(data.localFile_);
 	}
 
 	CDirentry entry;
@@ -438,6 +453,64 @@ void SleepOpData::operator()(fz::event_base const&)
 	controlSocket_.ResetOperation(FZ_REPLY_OK);
 }
 
+BatchOpData::BatchOpData(CControlSocket & controlSocket, CBatchCommand const& command)
+	: COpData(Command::batch, L"BatchOpData")
+	, controlSocket_(controlSocket)
+	, commands_(command.GetCommands())
+{
+	controlSocket_.batchListings_ = true;
+}
+
+int BatchOpData::Send()
+{
+	if (next_ >= commands_.size()) {
+		if (failed_) {
+			controlSocket_.log(logmsg::error, _("%u of %u operations failed"), static_cast<unsigned int>(failed_), static_cast<unsigned int>(commands_.size()));
+			return FZ_REPLY_ERROR;
+		}
+		return FZ_REPLY_OK;
+	}
+
+	CCommand const& command = *commands_[next_++];
+	switch (command.GetId()) {
+	case Command::mkdir:
+		controlSocket_.Mkdir(static_cast<CMkdirCommand const&>(command).GetPath());
+		break;
+	case Command::rename:
+		controlSocket_.Rename(static_cast<CRenameCommand const&>(command));
+		break;
+	case Command::chmod:
+		controlSocket_.Chmod(static_cast<CChmodCommand const&>(command));
+		break;
+	default:
+		controlSocket_.log(logmsg::debug_warning, L"Command %d cannot be part of a batch", static_cast<int>(command.GetId()));
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	return FZ_REPLY_CONTINUE;
+}
+
+int BatchOpData::SubcommandResult(int prevResult, COpData const&)
+{
+	if (prevResult != FZ_REPLY_OK) {
+		++failed_;
+	}
+	return FZ_REPLY_CONTINUE;
+}
+
+int BatchOpData::Reset(int result)
+{
+	controlSocket_.batchListings_ = false;
+
+	auto paths = std::move(controlSocket_.batchedListings_);
+	controlSocket_.batchedListings_.clear();
+	for (auto const& path : paths) {
+		controlSocket_.SendDirectoryListingNotification(path, false);
+	}
+
+	return result;
+}
+
 CFileTransferOpData::CFileTransferOpData(wchar_t const* name, bool is_download, std::wstring const& local_file, std::wstring const& remote_file, CServerPath const& remote_path, CFileTransferCommand::t_transferSettings const& settings)
 	: COpData(Command::transfer, name)
 	, localFile_(local_file), remoteFile_(remote_file), remotePath_(remote_path)
@@ -467,9 +540,13 @@ std::wstring CControlSocket::ConvToLocal(char const* buffer, size_t len)
 	}
 
 	if (currentServer_.GetEncodingType() == ENCODING_CUSTOM) {
-		ret = engine_.GetEncodingConverter().toLocal(currentServer_.GetCustomEncoding(), buffer, len);
-		if (!ret.empty()) {
-			return ret;
+		fz::scoped_lock l(customConverterMutex_);
+		auto * converter = GetCustomConverter(l);
+		if (converter) {
+			ret = converter->toLocal(buffer, len);
+			if (!ret.empty()) {
+				return ret;
+			}
 		}
 	}
 
@@ -498,9 +575,13 @@ std::string CControlSocket::ConvToServer(std::wstring const& str, bool force_utf
 	}
 
 	if (currentServer_.GetEncodingType() == ENCODING_CUSTOM) {
-		ret = engine_.GetEncodingConverter().toServer(currentServer_.GetCustomEncoding(), str.c_str(), str.size());
-		if (!ret.empty()) {
-			return ret;
+		fz::scoped_lock l(customConverterMutex_);
+		auto * converter = GetCustomConverter(l);
+		if (converter) {
+			ret = converter->toServer(str.c_str(), str.size());
+			if (!ret.empty()) {
+				return ret;
+			}
 		}
 	}
 
@@ -508,6 +589,16 @@ std::string CControlSocket::ConvToServer(std::wstring const& str, bool force_utf
 	return ret;
 }
 
+CustomEncodingConverterBase::converter* CControlSocket::GetCustomConverter(fz::scoped_lock &)
+{
+	// The server of a control socket does not change
+	if (!customConverterOpened_) {
+		customConverterOpened_ = true;
+		customConverter_ = engine_.GetEncodingConverter().Open(currentServer_.GetCustomEncoding());
+	}
+	return customConverter_.get();
+}
+
 void CControlSocket::OnTimer(fz::timer_id)
 {
 	m_timer = 0; // It's a one-shot timer, no need to stop it
@@ -628,12 +719,23 @@ int CControlSocket::ParseSubcommandResult(int prevResult, COpData const& opData)
 
 OpLock CControlSocket::Lock(locking_reason reason, CServerPath const& path, bool inclusive)
 {
-	return opLockManager_.Lock(this, reason, path, inclusive);
+	OpLock lock = opLockManager_.Lock(this, reason, path, inclusive);
+	engine_.Trace(lock.waiting() ? trace_event::lock_wait : trace_event::lock_acquired, static_cast<int64_t>(reason));
+	return lock;
 }
 
 void CControlSocket::OnObtainLock()
 {
 	if (opLockManager_.ObtainWaiting(this)) {
+		engine_.Trace(trace_event::lock_acquired, -1);
+		SendNextCommand();
+	}
+}
+
+void CControlSocket::OnListingStored()
+{
+	// A waiting list operation checks the cache before trying its lock again
+	if (!operations_.empty() && operations_.back()->opId == Command::list && opLockManager_.Waiting(this)) {
 		SendNextCommand();
 	}
 }
@@ -761,9 +863,23 @@ void CRealControlSocket::OnSocketEvent(fz::socket_event_source*, fz::socket_even
 	case fz::socket_event_flag::connection:
 		if (error) {
 			log(logmsg::status, _("Connection attempt failed with \"%s\"."), fz::socket_error_description(error));
-			OnSocketError(error);
+			if (cached_address_layer_ && (!proxy_layer_ || socket_->get_state() != fz::socket_state::connected)) {
+				// The cached address may be stale, try again with a fresh lookup
+				engine_.GetContext().GetDnsCache().Invalidate(lookupHost_);
+				int res = DoConnect(std::wstring(connectHost_), connectPort_);
+				if (res != FZ_REPLY_WOULDBLOCK) {
+					DoClose(res);
+				}
+			}
+			else {
+				OnSocketError(error);
+			}
 		}
 		else {
+			if (!lookupHost_.empty()) {
+				engine_.GetContext().GetDnsCache().Store(lookupHost_, socket_->peer_ip());
+			}
+			engine_.Trace(trace_event::connected);
 			OnConnect();
 		}
 		break;
@@ -854,9 +970,35 @@ int CRealControlSocket::DoConnect(std::wstring const& host, unsigned int port)
 	}
 
 	ResetSocket();
+	connectHost_ = host;
+	connectPort_ = port;
+	directConnect_ = false;
+	lookupHost_.clear();
+
 	socket_ = std::make_unique<fz::socket>(engine_.GetThreadPool(), nullptr);
-	ratelimit_layer_ = std::make_unique<fz::rate_limited_layer>(this, *socket_, &engine_.GetRateLimiter());
-	active_layer_ = ratelimit_layer_.get();
+
+	// Hosts with several uplinks can tie sites or engines to one of them
+	sourceAddress_ = fz::to_utf8(currentServer_.GetSourceAddress());
+	if (sourceAddress_.empty()) {
+		sourceAddress_ = engine_.GetSourceAddress();
+	}
+	fz::address_type const sourceFamily = fz::get_address_type(sourceAddress_);
+	if (!sourceAddress_.empty()) {
+		log(logmsg::debug_info, L"Binding source address to %s", sourceAddress_);
+		socket_->bind(sourceAddress_);
+	}
+
+	rate_limiter_ = engine_.GetContext().GetRateLimiter(currentServer_);
+	if (rate_limiter_) {
+		ratelimit_layer_ = std::make_unique<fz::rate_limited_layer>(this, *socket_, rate_limiter_.get());
+		active_layer_ = ratelimit_layer_.get();
+	}
+	else {
+		socket_->set_event_handler(this);
+		active_layer_ = socket_.get();
+	}
+
+	fz::native_string const native_host = fz::to_native(ConvertDomainName(host));
 
 	const int proxy_type = engine_.GetOptions().GetOptionVal(OPTION_PROXY_TYPE);
 	if (proxy_type > static_cast<int>(ProxyType::NONE) && proxy_type < static_cast<int>(ProxyType::count) && !currentServer_.GetBypassProxy()) {
@@ -864,23 +1006,53 @@ int CRealControlSocket::DoConnect(std::wstring const& host, unsigned int port)
 
 		fz::native_string proxy_host = fz::to_native(engine_.GetOptions().GetOption(OPTION_PROXY_HOST));
 
+		if (fz::get_address_type(proxy_host) == fz::address_type::unknown) {
+			// Each connection through the proxy would otherwise wait for the
+			// resolver before the handshake can even start.
+			lookupHost_ = proxy_host;
+			std::string address = engine_.GetContext().GetDnsCache().Get(proxy_host);
+			if (sourceFamily != fz::address_type::unknown && fz::get_address_type(address) != sourceFamily) {
+				address.clear();
+			}
+			if (!address.empty()) {
+				log(logmsg::debug_info, L"Using cached address %s of proxy %s", address, proxy_host);
+				cached_address_layer_ = std::make_unique<CCachedAddressLayer>(this, *active_layer_, address);
+				active_layer_ = cached_address_layer_.get();
+			}
+			else {
+				log(logmsg::status, _("Resolving address of %s"), proxy_host);
+			}
+		}
+
 		proxy_layer_ = std::make_unique<CProxySocket>(this, *active_layer_, this, static_cast<ProxyType>(proxy_type),
 			proxy_host, engine_.GetOptions().GetOptionVal(OPTION_PROXY_PORT),
 			engine_.GetOptions().GetOption(OPTION_PROXY_USER),
 			engine_.GetOptions().GetOption(OPTION_PROXY_PASS));
 		active_layer_ = proxy_layer_.get();
-
-		if (fz::get_address_type(proxy_host) == fz::address_type::unknown) {
-			log(logmsg::status, _("Resolving address of %s"), proxy_host);
-		}
 	}
 	else {
+		directConnect_ = true;
 		if (fz::get_address_type(host) == fz::address_type::unknown) {
-			log(logmsg::status, _("Resolving address of %s"), host);
+			lookupHost_ = native_host;
+			std::string address = engine_.GetContext().GetDnsCache().Get(native_host);
+			if (sourceFamily != fz::address_type::unknown && fz::get_address_type(address) != sourceFamily) {
+				// Cannot be reached from the source address
+				address.clear();
+			}
+			if (!address.empty()) {
+				log(logmsg::debug_info, L"Using cached address %s of %s", address, host);
+				cached_address_layer_ = std::make_unique<CCachedAddressLayer>(this, *active_layer_, address);
+				active_layer_ = cached_address_layer_.get();
+			}
+			else {
+				log(logmsg::status, _("Resolving address of %s"), host);
+			}
 		}
 	}
 
-	int res = active_layer_->connect(fz::to_native(ConvertDomainName(host)), port);
+	// The address family of the server only matters without proxy, the proxy is
+	// resolved and connected to by the proxy layer.
+	int res = active_layer_->connect(native_host, port, directConnect_ ? sourceFamily : fz::address_type::unknown);
 
 	if (res) {
 		log(logmsg::error, _("Could not connect to server: %s"), fz::socket_error_description(res));
@@ -904,8 +1076,10 @@ void CRealControlSocket::ResetSocket()
 
 	// Destroy in reverse order
 	proxy_layer_.reset();
+	cached_address_layer_.reset();
 	ratelimit_layer_.reset();
 	socket_.reset();
+	rate_limiter_.reset();
 
 	send_buffer_.clear();
 }
@@ -1130,6 +1304,21 @@ void CControlSocket::Chmod(CChmodCommand const&)
 	Push(std::make_unique<CNotSupportedOpData>());
 }
 
+void CControlSocket::FileHash(CFileHashCommand const&)
+{
+	Push(std::make_unique<CNotSupportedOpData>());
+}
+
+void CControlSocket::Copy(CCopyCommand const&)
+{
+	Push(std::make_unique<CNotSupportedOpData>());
+}
+
+void CControlSocket::Fxp(CFxpCommand const&)
+{
+	Push(std::make_unique<CNotSupportedOpData>());
+}
+
 void CControlSocket::Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry)
 {
 	Push(std::make_unique<LookupOpData>(*this, path, file, entry));
@@ -1142,9 +1331,10 @@ void CControlSocket::Lookup(CServerPath const& path, std::vector<std::wstring> c
 
 void CControlSocket::operator()(fz::event_base const& ev)
 {
-	fz::dispatch<fz::timer_event, CObtainLockEvent>(ev, this,
+	fz::dispatch<fz::timer_event, CObtainLockEvent, CListingStoredEvent>(ev, this,
 		&CControlSocket::OnTimer,
-		&CControlSocket::OnObtainLock);
+		&CControlSocket::OnObtainLock,
+		&CControlSocket::OnListingStored);
 }
 
 void CControlSocket::SetActive(CFileZillaEngine::_direction direction)
@@ -1159,9 +1349,31 @@ void CControlSocket::SendDirectoryListingNotification(CServerPath const& path, b
 		return;
 	}
 
+	if (batchListings_ && !failed) {
+		if (std::find(batchedListings_.begin(), batchedListings_.end(), path) == batchedListings_.end()) {
+			batchedListings_.push_back(path);
+		}
+		return;
+	}
+
 	engine_.AddNotification(new CDirectoryListingNotification(path, operations_.size() == 1 && operations_.back()->opId == Command::list, failed));
 }
 
+void CControlSocket::SendDirectoryListingProgress(CServerPath const& path, std::vector<fz::shared_value<CDirentry>> && entries)
+{
+	if (!currentServer_ || entries.empty()) {
+		return;
+	}
+
+	// Only of interest to the user while navigating, not while listing
+	// as part of other operations.
+	if (operations_.size() != 1 || operations_.back()->opId != Command::list) {
+		return;
+	}
+
+	engine_.AddNotification(new CDirectoryListingProgressNotification(path, std::move(entries)));
+}
+
 void CControlSocket::CallSetAsyncRequestReply(CAsyncRequestNotification *pNotification)
 {
 	if (operations_.empty() || !operations_.back()->waitForAsyncRequest) {
@@ -1175,6 +1387,11 @@ void CControlSocket::CallSetAsyncRequestReply(CAsyncRequestNotification *pNotifi
 	SetAsyncRequestReply(pNotification);
 }
 
+void CControlSocket::Batch(CBatchCommand const& command)
+{
+	Push(std::make_unique<BatchOpData>(*this, command));
+}
+
 void CControlSocket::Sleep(fz::duration const& delay)
 {
 	Push(std::make_unique<SleepOpData>(*this, delay));
@@ -4,9 +4,11 @@
 #include "logging_private.h"
 
 #include <libfilezilla/buffer.hpp>
+#include <libfilezilla/mutex.hpp>
 #include <libfilezilla/socket.hpp>
 
 #include <directorylisting.h>
+#include <engine_context.h>
 
 #include "oplock_manager.h"
 #include "server.h"
@@ -120,6 +122,25 @@ private:
 	CControlSocket & controlSocket_;
 };
 
+// Runs the commands of a CBatchCommand one after another. Directory
+// listing notifications are held back until the end, once per path.
+class BatchOpData final : public COpData
+{
+public:
+	BatchOpData(CControlSocket & controlSocket, CBatchCommand const& command);
+
+	virtual int Send() override;
+	virtual int ParseResponse() override { return FZ_REPLY_INTERNALERROR; }
+	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
+	virtual int Reset(int result) override;
+
+private:
+	CControlSocket & controlSocket_;
+	std::vector<std::shared_ptr<CCommand const>> const commands_;
+	size_t next_{};
+	size_t failed_{};
+};
+
 class CFileTransferOpData : public COpData
 {
 public:
@@ -219,6 +240,10 @@ public:
 	virtual void Mkdir(CServerPath const& path);
 	virtual void Rename(CRenameCommand const& command);
 	virtual void Chmod(CChmodCommand const& command);
+	virtual void FileHash(CFileHashCommand const& command);
+	virtual void Copy(CCopyCommand const& command);
+	virtual void Fxp(CFxpCommand const& command);
+	void Batch(CBatchCommand const& command);
 	void Sleep(fz::duration const& delay);
 
 	virtual bool Connected() const = 0;
@@ -259,8 +284,10 @@ public:
 	int SendNextCommand();
 
 	template<typename ...Args>
-	void log(Args&& ... args) {
-		logger_.log(std::forward<Args>(args)...);
+	void log(logmsg::type t, Args&& ... args) {
+		if (logmsg::compiled_in(t)) {
+			logger_.log(t, std::forward<Args>(args)...);
+		}
 	}
 	template<typename ...Args>
 	void log_raw(Args&& ... args) {
@@ -274,12 +301,14 @@ protected:
 	virtual void Lookup(CServerPath const& path, std::vector<std::wstring> const& files);
 
 	friend class SleepOpData;
+	friend class BatchOpData;
 	friend class LookupOpData;
 	friend class LookupManyOpData;
 	friend class CProtocolOpData<CControlSocket>;
 
 	virtual bool SetAsyncRequestReply(CAsyncRequestNotification *pNotification) = 0;
 	void SendDirectoryListingNotification(CServerPath const& path, bool failed);
+	void SendDirectoryListingProgress(CServerPath const& path, std::vector<fz::shared_value<CDirentry>> && entries);
 
 	fz::duration GetTimezoneOffset() const;
 
@@ -314,6 +343,13 @@ protected:
 
 	bool m_useUTF8{};
 
+	// For servers with a custom encoding, opened on first use. Conversions
+	// also happen on the input threads, hence the mutex.
+	CustomEncodingConverterBase::converter* GetCustomConverter(fz::scoped_lock &);
+	fz::mutex customConverterMutex_{false};
+	std::unique_ptr<CustomEncodingConverterBase::converter> customConverter_;
+	bool customConverterOpened_{};
+
 	// Timeout data
 	fz::timer_id m_timer{};
 	fz::monotonic_clock m_lastActivity;
@@ -323,18 +359,25 @@ protected:
 	bool m_invalidateCurrentPath{};
 	ServerHandle handle_;
 
+	// Set while a batch is running, see BatchOpData
+	bool batchListings_{};
+	std::vector<CServerPath> batchedListings_;
+
 	fz::logger_interface& logger_;
 
 	virtual void operator()(fz::event_base const& ev);
 
 	void OnTimer(fz::timer_id id);
 	void OnObtainLock();
+	void OnListingStored();
 };
 
+class CCachedAddressLayer;
 class CProxySocket;
 
 namespace fz {
 class rate_limited_layer;
+class rate_limiter;
 }
 
 class CRealControlSocket : public CControlSocket
@@ -365,11 +408,28 @@ protected:
 		return Send(reinterpret_cast<unsigned char const*>(buffer), len);
 	}
 
+	// Only set if speed limits were enabled when connecting. Without it,
+	// limits enabled later only apply once the engine reconnects.
+	std::shared_ptr<fz::rate_limiter> rate_limiter_;
+
 	std::unique_ptr<fz::socket> socket_;
 	std::unique_ptr<fz::rate_limited_layer> ratelimit_layer_;
+	std::unique_ptr<CCachedAddressLayer> cached_address_layer_;
 	std::unique_ptr<CProxySocket> proxy_layer_;
 	fz::socket_layer* active_layer_{};
 
+	// Target of the last DoConnect
+	std::wstring connectHost_;
+	unsigned int connectPort_{};
+	bool directConnect_{};
+
+	// Name resolved locally when connecting, either the server or the proxy.
+	// The connected address gets cached under it.
+	fz::native_string lookupHost_;
+
+	// Local address the connection is bound to, empty if chosen by the system
+	std::string sourceAddress_;
+
 	fz::buffer send_buffer_;
 };
 
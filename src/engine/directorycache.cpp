@@ -1,112 +1,377 @@
 #include <filezilla.h>
 #include "directorycache.h"
+#include "persistent.h"
 
-#include <assert.h>
+#include <libfilezilla/encode.hpp>
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/hash.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/util.hpp>
 
-CDirectoryCache::CDirectoryCache()
+#include <algorithm>
+
+#include <stdio.h>
+
+namespace {
+// Rough estimate of the memory held by a single entry of a cached listing,
+// including its slot in the listing and the find maps built on demand.
+// Permissions and owner/group are not counted, they are pooled by the
+// parser and shared between the entries.
+int64_t EntryCost(CDirentry const& entry)
 {
+	int64_t cost = sizeof(CDirentry) + sizeof(fz::shared_value<CDirentry>) + 2 * sizeof(void*);
+	cost += entry.name.capacity() * sizeof(wchar_t);
+	if (entry.target) {
+		cost += sizeof(std::wstring) + entry.target->capacity() * sizeof(wchar_t);
+	}
+	cost += 2 * (sizeof(std::wstring) + sizeof(size_t) + 2 * sizeof(void*) + entry.name.size() * sizeof(wchar_t));
+	return cost;
 }
 
-CDirectoryCache::~CDirectoryCache()
+int64_t ListingCost(CDirectoryListing const& listing)
 {
-	for (auto & serverEntry : m_serverList) {
-		for (auto & cacheEntry : serverEntry.cacheList) {
-#ifndef NDEBUG
-			m_totalFileCount -= cacheEntry.listing.size();
-#endif
-			tLruList::iterator* lruIt = (tLruList::iterator*)cacheEntry.lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
-			}
-		}
+	int64_t cost = 256;
+	for (size_t i = 0; i < listing.size(); ++i) {
+		cost += EntryCost(listing[i]);
 	}
-#ifndef NDEBUG
-	assert(m_totalFileCount == 0);
-#endif
+	return cost;
 }
 
-void CDirectoryCache::Store(CDirectoryListing const& listing, CServer const& server)
+// Number of entries per shard considered for eviction, from both the
+// least recently used and the most expensive end.
+size_t const prune_candidates = 8;
+
+// Patches of a cached listing beyond which they get merged into it, looking
+// up a name scans the added entries.
+size_t const max_patches = 1024;
+
+// Persistent cache file format, all integers big-endian:
+//   "FZDC", version, server identity, number of listings
+//   per listing: list time in milliseconds since the epoch, safe path, flags, number of entries
+//   per entry: name, size, permissions, owner/group, flags, target, accuracy, time
+// Strings are UTF-8 with a 32 bit length prefix.
+char const persistent_magic[] = "FZDC";
+uint32_t const persistent_version = 2;
+int64_t const persistent_max_file_size = 512 * 1024 * 1024;
+int64_t const persistent_max_age = fz::duration::from_days(2).get_milliseconds();
+
+fz::native_string PersistentFile(std::wstring const& dir, std::string const& identity)
 {
-	fz::scoped_lock lock(mutex_);
+	return fz::to_native(dir + fz::hex_encode<std::wstring>(fz::sha256(identity)) + L".fzdc");
+}
 
-	tServerIter sit = CreateServerEntry(server);
-	assert(sit != m_serverList.end());
+// Shared listing file format, written by whichever instance listed the
+// directory last:
+//   "FZDS", version, server identity, list time in milliseconds since the epoch,
+//   the listing as in the persistent cache file
+char const shared_magic[] = "FZDS";
+uint32_t const shared_version = 1;
 
-	m_totalFileCount += listing.size();
+// A directory whose shared file got checked is not checked again in this
+// interval, lookup misses would otherwise read the disk every time.
+fz::duration const shared_recheck_interval = fz::duration::from_seconds(30);
 
-	tCacheIter cit;
-	bool unused;
-	if (Lookup(cit, sit, listing.path, true, unused)) {
-		auto & entry = const_cast<CCacheEntry&>(*cit);
-		entry.modificationTime = fz::monotonic_clock::now();
+fz::native_string SharedFile(std::wstring const& dir, std::string const& identity, CServerPath const& path)
+{
+	return fz::to_native(dir + fz::hex_encode<std::wstring>(fz::sha256(identity + '\n' + fz::to_utf8(path.GetSafePath()))) + L".fzds");
+}
 
-		m_totalFileCount -= cit->listing.size();
-		entry.listing = listing;
+int64_t WallClockMilliseconds()
+{
+	return (fz::datetime::now() - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds();
+}
 
-		return;
+void WriteListing(PersistentWriter & w, CDirectoryListing const& listing)
+{
+	w.str(listing.path.GetSafePath());
+	w.u32(static_cast<uint32_t>(listing.m_flags));
+	w.u32(static_cast<uint32_t>(listing.size()));
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		w.str(entry.name);
+		w.i64(entry.size);
+		w.str(*entry.permissions);
+		w.str(*entry.ownerGroup);
+		w.u32(static_cast<uint32_t>(entry.flags));
+		w.u8(entry.target ? 1 : 0);
+		if (entry.target) {
+			w.str(*entry.target);
+		}
+		if (entry.has_date()) {
+			w.u8(static_cast<uint8_t>(entry.time.get_accuracy()));
+			w.i64(static_cast<int64_t>(entry.time.get_time_t()));
+		}
+		else {
+			w.u8(0);
+		}
 	}
+}
 
-	cit = sit->cacheList.emplace_hint(cit, listing);
+bool ReadListing(PersistentReader & r, CDirectoryListing & listing, CStringPool & pool, bool trusted = false)
+{
+	if (!listing.path.SetSafePath(r.wstr())) {
+		return false;
+	}
+	int const flags = static_cast<int>(r.u32());
+	uint32_t const count = r.u32();
+	if (r.error()) {
+		return false;
+	}
 
-	UpdateLru(sit, cit);
+	std::vector<fz::shared_value<CDirentry>> entries;
+	for (uint32_t i = 0; i < count && !r.error(); ++i) {
+		CDirentry entry;
+		entry.name = r.wstr();
+		entry.size = r.i64();
+		entry.permissions = pool.get(r.wstr());
+		entry.ownerGroup = pool.get(r.wstr());
+		entry.flags = static_cast<int>(r.u32());
+		if (r.u8()) {
+			entry.target = fz::sparse_optional<std::wstring>(r.wstr());
+		}
+		uint8_t const accuracy = r.u8();
+		if (accuracy) {
+			entry.time = fz::datetime(static_cast<time_t>(r.i64()), static_cast<fz::datetime::accuracy>(accuracy));
+		}
+		entries.emplace_back(std::move(entry));
+	}
+	if (r.error()) {
+		return false;
+	}
+
+	// Never trust the restored listing without listing it again
+	listing.m_flags = trusted ? flags : (flags | CDirectoryListing::unsure_unknown);
+	listing.Assign(std::move(entries));
+
+	return true;
+}
+}
+
+CDirectoryCache::CDirectoryCache()
+{
+}
+
+CDirectoryCache::~CDirectoryCache()
+{
+	if (!persistentDir_.empty()) {
+		SavePersistent();
+	}
+}
+
+void CDirectoryCache::Store(CDirectoryListing const& listing, CServer const& server)
+{
+	{
+		size_t const hash = server.Hash();
+		LoadPersistent(server, hash);
+
+		Shard& shard = GetShard(hash, listing.path);
+		fz::scoped_lock lock(shard.mutex_);
+
+		CServerEntry& sit = CreateServerEntry(shard, server, hash);
+
+		int64_t const cost = ListingCost(listing);
+
+		auto cit = sit.cacheList.find(listing.path);
+		if (cit != sit.cacheList.end()) {
+			CCacheEntry & entry = cit->second;
+			UpdateLru(shard, entry);
+			entry.modificationTime = fz::monotonic_clock::now();
+			entry.ClearPatches();
+			entry.listing = listing;
+			entry.names = CNameFilter();
+			entry.names.add(listing);
+			SetCost(shard, entry, cost);
+		}
+		else {
+			InsertEntry(shard, sit, listing, cost);
+		}
+	}
 
 	Prune();
+
+	if (!sharedDir_.empty()) {
+		StoreShared(server, listing);
+	}
+
+	if (storeHandler_) {
+		storeHandler_(server, listing);
+	}
 }
 
 bool CDirectoryCache::Lookup(CDirectoryListing &listing, CServer const& server, const CServerPath &path, bool allowUnsureEntries, bool& is_outdated)
 {
-	fz::scoped_lock lock(mutex_);
+	LoadShared(server, path);
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
-	tCacheIter iter;
-	if (Lookup(iter, sit, path, allowUnsureEntries, is_outdated)) {
-		listing = iter->listing;
+	CCacheEntry* entry = Lookup(shard, *sit, path, allowUnsureEntries, is_outdated);
+	if (entry) {
+		entry->Compact();
+		listing = entry->listing;
 		return true;
 	}
 
 	return false;
 }
 
-bool CDirectoryCache::Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
+size_t CDirectoryCache::LookupMany(std::vector<CDirectoryListing> & listings, CServer const& server, std::vector<CServerPath> const& paths, bool allowUnsureEntries)
 {
-	CCacheEntry dummy;
-	dummy.listing.path = path;
-	cacheIter = sit->cacheList.lower_bound(dummy);
+	listings.clear();
+	listings.resize(paths.size());
 
-	if (cacheIter != sit->cacheList.end()) {
-		CCacheEntry const& entry = *cacheIter;
+	for (auto const& path : paths) {
+		LoadShared(server, path);
+	}
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
 
-		if (entry.listing.path == path) {
-			UpdateLru(sit, cacheIter);
+	// The listings of a server are spread over the shards, each shard
+	// gets locked once for all of its paths.
+	std::vector<Shard*> pathShards;
+	pathShards.reserve(paths.size());
+	for (auto const& path : paths) {
+		pathShards.push_back(&GetShard(hash, path));
+	}
 
-			if (!allowUnsureEntries && entry.listing.get_unsure_flags()) {
-				return false;
+	size_t found{};
+	for (auto & shard : shards_) {
+		if (std::find(pathShards.cbegin(), pathShards.cend(), &shard) == pathShards.cend()) {
+			continue;
+		}
+
+		fz::scoped_lock lock(shard.mutex_);
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		if (!sit) {
+			continue;
+		}
+
+		for (size_t i = 0; i < paths.size(); ++i) {
+			if (pathShards[i] != &shard) {
+				continue;
+			}
+			bool is_outdated = false;
+			CCacheEntry* entry = Lookup(shard, *sit, paths[i], allowUnsureEntries, is_outdated);
+			if (entry) {
+				entry->Compact();
+				listings[i] = entry->listing;
+				++found;
 			}
+		}
+	}
+
+	return found;
+}
 
-			is_outdated = (fz::monotonic_clock::now() - entry.listing.m_firstListTime) > ttl_;
-			return true;
+bool CDirectoryCache::LookupTree(std::vector<CDirectoryListing> & listings, CServer const& server, CServerPath const& path, std::wstring const& needle)
+{
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	std::wstring const lowerNeedle = fz::str_tolower(needle);
+
+	std::vector<CDirectoryListing> found;
+	std::vector<CServerPath> dirs{path};
+	while (!dirs.empty()) {
+		CServerPath const current = std::move(dirs.back());
+		dirs.pop_back();
+
+		// Shared listings are loaded without holding the lock, it is taken
+		// for one directory at a time.
+		LoadShared(server, current);
+
+		Shard& shard = GetShard(hash, current);
+		fz::scoped_lock lock(shard.mutex_);
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		if (!sit) {
+			return false;
+		}
+
+		bool is_outdated = false;
+		CCacheEntry* entry = Lookup(shard, *sit, current, false, is_outdated);
+		if (!entry || is_outdated || entry->listing.failed()) {
+			return false;
+		}
+
+		entry->Compact();
+		auto const& listing = entry->listing;
+		if (listing.has_dirs()) {
+			for (size_t i = 0; i < listing.size(); ++i) {
+				CDirentry const& dirent = listing[i];
+				if (!dirent.is_dir()) {
+					continue;
+				}
+				if (dirent.is_link()) {
+					// Listed under the path of their target, which is unknown
+					return false;
+				}
+
+				CServerPath sub = current;
+				if (!sub.AddSegment(dirent.name)) {
+					return false;
+				}
+				dirs.emplace_back(std::move(sub));
+			}
+		}
+
+		if (lowerNeedle.empty() || entry->names.may_contain(lowerNeedle)) {
+			found.push_back(listing);
 		}
 	}
 
-	return false;
+	listings.insert(listings.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+	return true;
+}
+
+CDirectoryCache::CCacheEntry* CDirectoryCache::Lookup(Shard& shard, CServerEntry& sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated)
+{
+	fz::duration const ttl = fz::duration::from_milliseconds(ttl_);
+
+	CCacheEntry* entry{};
+	auto cacheIter = sit.cacheList.find(path);
+	if (cacheIter != sit.cacheList.end()) {
+		entry = &cacheIter->second;
+	}
+	if (!entry) {
+		return nullptr;
+	}
+
+	UpdateLru(shard, *entry);
+
+	if (!allowUnsureEntries && entry->listing.get_unsure_flags()) {
+		return nullptr;
+	}
+
+	is_outdated = (fz::monotonic_clock::now() - entry->listing.m_firstListTime) > ttl;
+	return entry;
 }
 
 bool CDirectoryCache::DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated)
 {
-	fz::scoped_lock lock(mutex_);
+	LoadShared(server, path);
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
-	tCacheIter iter;
-	if (Lookup(iter, sit, path, true, is_outdated)) {
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, is_outdated);
+	if (iter) {
 		hasUnsureEntries = iter->listing.get_unsure_flags();
 		return true;
 	}
@@ -116,19 +381,25 @@ bool CDirectoryCache::DoesExist(CServer const& server, CServerPath const& path,
 
 std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const& server, CServerPath const& path, std::wstring const& filename, LookupFlags flags)
 {
+	LoadShared(server, path);
+
 	LookupResults results{};
 	CDirentry entry;
 
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return {results, entry};
 	}
 
-	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, outdated);
+	if (!iter) {
 		return {results, entry};
 	}
 
@@ -142,17 +413,16 @@ std::tuple<LookupResults, CDirentry> CDirectoryCache::LookupFile(CServer const&
 	results |= LookupResults::direxists;
 
 	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
 
-	size_t i = listing.FindFile_CmpCase(filename);
+	size_t i = cacheEntry.FindCase(filename);
 	if (i != std::string::npos) {
-		entry = listing[i];
+		entry = cacheEntry.Entry(i);
 		results |= LookupResults::found | LookupResults::matchedcase;
 	}
 	else if (server.GetCaseSensitivity() != CaseSensitivity::yes || (flags & LookupFlags::force_caseinsensitive)) {
-		i = listing.FindFile_CmpNoCase(filename);
-		if (i != std::string::npos) {
-			entry = listing[i];
+		auto const ids = cacheEntry.FindNoCase(filename);
+		if (!ids.empty()) {
+			entry = cacheEntry.Entry(ids.front());
 			results |= LookupResults::found;
 		}
 	}
@@ -164,16 +434,22 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 {
 	std::vector<std::tuple<LookupResults, CDirentry>> ret;
 
-	fz::scoped_lock lock(mutex_);
+	LoadShared(server, path);
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
+
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return ret;
 	}
 
-	tCacheIter iter;
 	bool outdated{};
-	if (!Lookup(iter, sit, path, true, outdated)) {
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, outdated);
+	if (!iter) {
 		return ret;
 	}
 
@@ -189,22 +465,21 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 	results |= LookupResults::direxists;
 
 	CCacheEntry const& cacheEntry = *iter;
-	CDirectoryListing const& listing = cacheEntry.listing;
 
 	ret.reserve(filenames.size());
 
 	for (auto const& filename : filenames) {
 		CDirentry entry;
 		LookupResults fileresults = results;
-		size_t i = listing.FindFile_CmpCase(filename);
+		size_t i = cacheEntry.FindCase(filename);
 		if (i != std::string::npos) {
-			entry = listing[i];
+			entry = cacheEntry.Entry(i);
 			fileresults |= LookupResults::found | LookupResults::matchedcase;
 		}
 		else if (server.GetCaseSensitivity() != CaseSensitivity::yes || (flags & LookupFlags::force_caseinsensitive)) {
-			i = listing.FindFile_CmpNoCase(filename);
-			if (i != std::string::npos) {
-				entry = listing[i];
+			auto const ids = cacheEntry.FindNoCase(filename);
+			if (!ids.empty()) {
+				entry = cacheEntry.Entry(ids.front());
 				fileresults |= LookupResults::found;
 			}
 		}
@@ -216,34 +491,39 @@ std::vector<std::tuple<LookupResults, CDirentry>> CDirectoryCache::LookupFiles(C
 
 bool CDirectoryCache::LookupFile(CDirentry &entry, CServer const& server, CServerPath const& path, std::wstring const& filename, bool &dirDidExist, bool &matchedCase)
 {
-	fz::scoped_lock lock(mutex_);
+	LoadShared(server, path);
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		dirDidExist = false;
 		return false;
 	}
 
-	tCacheIter iter;
 	bool unused;
-	if (!Lookup(iter, sit, path, true, unused)) {
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, unused);
+	if (!iter) {
 		dirDidExist = false;
 		return false;
 	}
 	dirDidExist = true;
 
 	const CCacheEntry &cacheEntry = *iter;
-	const CDirectoryListing &listing = cacheEntry.listing;
 
-	size_t i = listing.FindFile_CmpCase(filename);
+	size_t i = cacheEntry.FindCase(filename);
 	if (i != std::string::npos) {
-		entry = listing[i];
+		entry = cacheEntry.Entry(i);
 		matchedCase = true;
 		return true;
 	}
-	i = listing.FindFile_CmpNoCase(filename);
-	if (i != std::string::npos) {
-		entry = listing[i];
+	auto const ids = cacheEntry.FindNoCase(filename);
+	if (!ids.empty()) {
+		entry = cacheEntry.Entry(ids.front());
 		matchedCase = false;
 		return true;
 	}
@@ -253,10 +533,14 @@ bool CDirectoryCache::LookupFile(CDirentry &entry, CServer const& server, CServe
 
 bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
@@ -264,8 +548,8 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 	bool dir{};
 
 	auto const now = fz::monotonic_clock::now();
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
+	for (auto iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
+		auto & entry = iter->second;
 
 		if (cmpCase) {
 			if (path != entry.listing.path) {
@@ -278,35 +562,41 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 			}
 		}
 
-		UpdateLru(sit, iter);
+		UpdateLru(shard, entry);
 
-		for (unsigned int i = 0; i < entry.listing.size(); i++) {
-			bool same;
-			if (cmpCase) {
-				same = filename == entry.listing[i].name;
-			}
-			else {
-				same = !fz::stricmp(filename, entry.listing[i].name);
+		for (size_t id : entry.FindNoCase(filename)) {
+			if (cmpCase && entry.Entry(id).name != filename) {
+				continue;
 			}
-			if (same) {
-				if (entry.listing[i].is_dir()) {
-					dir = true;
-				}
-				entry.listing.get(i).flags |= CDirentry::flag_unsure;
+			CDirentry & dirent = entry.ModifyEntry(id);
+			if (dirent.is_dir()) {
+				dir = true;
 			}
+			dirent.flags |= CDirentry::flag_unsure;
 		}
 		entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
 		entry.modificationTime = now;
+		entry.Compact(max_patches);
 	}
 
+	lock.unlock();
+
 	if (dir) {
 		CServerPath child = path;
 		if (child.ChangePath(filename)) {
-			for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-				auto & entry = const_cast<CCacheEntry&>(*iter);
-				if (path.IsParentOf(entry.listing.path, !cmpCase, true)) {
-					entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
-					entry.modificationTime = now;
+			// The listings below it may be in any shard
+			for (auto & other : shards_) {
+				fz::scoped_lock otherLock(other.mutex_);
+				CServerEntry* osit = FindServerEntry(other, server, hash);
+				if (!osit) {
+					continue;
+				}
+				for (auto iter = osit->cacheList.begin(); iter != osit->cacheList.end(); ++iter) {
+					auto & entry = iter->second;
+					if (path.IsParentOf(entry.listing.path, !cmpCase, true)) {
+						entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
+						entry.modificationTime = now;
+					}
 				}
 			}
 		}
@@ -317,37 +607,41 @@ bool CDirectoryCache::InvalidateFile(CServer const& server, CServerPath const& p
 
 bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path, std::wstring const& filename, bool mayCreate, Filetype type, int64_t size, std::wstring const& ownerGroup)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
 	bool updated = false;
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
+	for (auto iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
+		auto & entry = iter->second;
 		if (path.CmpNoCase(entry.listing.path)) {
 			continue;
 		}
 
-		UpdateLru(sit, iter);
+		UpdateLru(shard, entry);
 
 		bool matchCase = false;
-		size_t i;
-		for (i = 0; i < entry.listing.size(); ++i) {
-			if (!fz::stricmp(filename, entry.listing[i].name)) {
-				entry.listing.get(i).flags |= CDirentry::flag_unsure;
-				if (entry.listing[i].name == filename) {
-					matchCase = true;
-					break;
-				}
+		size_t i{};
+		for (size_t id : entry.FindNoCase(filename)) {
+			i = id;
+			CDirentry & dirent = entry.ModifyEntry(id);
+			dirent.flags |= CDirentry::flag_unsure;
+			if (dirent.name == filename) {
+				matchCase = true;
+				break;
 			}
 		}
 
 		if (matchCase) {
-			Filetype old_type = entry.listing[i].is_dir() ? dir : file;
+			Filetype old_type = entry.Entry(i).is_dir() ? dir : file;
 			if (type != old_type) {
 				entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 			}
@@ -382,14 +676,15 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 				entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 				break;
 			}
-			entry.listing.Append(std::move(direntry));
-
-			++m_totalFileCount;
+			SetCost(shard, entry, entry.cost + EntryCost(direntry));
+			entry.names.add(direntry.name);
+			entry.AddEntry(std::move(direntry));
 		}
 		else {
 			entry.listing.m_flags |= CDirectoryListing::unsure_unknown;
 		}
 		entry.modificationTime = fz::monotonic_clock::now();
+		entry.Compact(max_patches);
 
 		updated = true;
 	}
@@ -399,49 +694,45 @@ bool CDirectoryCache::UpdateFile(CServer const& server, CServerPath const& path,
 
 bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path, std::wstring const& filename)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
+
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
+	for (auto iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ++iter) {
+		auto & entry = iter->second;
 		if (path.CmpNoCase(entry.listing.path)) {
 			continue;
 		}
 
-		UpdateLru(sit, iter);
+		UpdateLru(shard, entry);
 
-		bool matchCase = false;
-		for (size_t i = 0; i < entry.listing.size(); ++i) {
-			if (entry.listing[i].name == filename) {
-				matchCase = true;
+		size_t const i = entry.FindCase(filename);
+		if (i != std::wstring::npos) {
+			CDirentry const& dirent = entry.Entry(i);
+			SetCost(shard, entry, entry.cost - EntryCost(dirent));
+			if (dirent.is_dir()) {
+				entry.listing.m_flags |= CDirectoryListing::unsure_dir_removed;
 			}
-		}
-
-		if (matchCase) {
-			size_t i;
-			for (i = 0; i < entry.listing.size(); ++i) {
-				if (entry.listing[i].name == filename) {
-					break;
-				}
+			else {
+				entry.listing.m_flags |= CDirectoryListing::unsure_file_removed;
 			}
-			assert(i != entry.listing.size());
-
-			entry.listing.RemoveEntry(i); // This does set m_hasUnsureEntries
-			--m_totalFileCount;
+			entry.RemoveEntry(i);
 		}
 		else {
-			for (size_t i = 0; i < entry.listing.size(); ++i) {
-				if (!fz::stricmp(filename, entry.listing[i].name)) {
-					entry.listing.get(i).flags |= CDirentry::flag_unsure;
-				}
+			for (size_t id : entry.FindNoCase(filename)) {
+				entry.ModifyEntry(id).flags |= CDirentry::flag_unsure;
 			}
 			entry.listing.m_flags |= CDirectoryListing::unsure_invalid;
 		}
 		entry.modificationTime = fz::monotonic_clock::now();
+		entry.Compact(max_patches);
 	}
 
 	return true;
@@ -449,40 +740,45 @@ bool CDirectoryCache::RemoveFile(CServer const& server, CServerPath const& path,
 
 void CDirectoryCache::InvalidateServer(CServer const& server)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	for (auto & shard : shards_) {
+		fz::scoped_lock lock(shard.mutex_);
 
-	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (!iter->server.SameContent(server)) {
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		if (!sit) {
 			continue;
 		}
 
-		for (tCacheIter cit = iter->cacheList.begin(); cit != iter->cacheList.end(); ++cit) {
-			tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
-			}
+		for (auto & cacheEntry : sit->cacheList) {
+			shard.lru.erase(cacheEntry.second.lruIt);
+			shard.byCost.erase(cacheEntry.second.costIt);
 
-			m_totalFileCount -= cit->listing.size();
+			m_totalCost -= cacheEntry.second.cost;
+			--m_totalEntryCount;
 		}
 
-		m_serverList.erase(iter);
-		break;
+		EraseServerEntry(shard, *sit);
 	}
 }
 
 bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& server, CServerPath const& path)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return false;
 	}
 
-	tCacheIter iter;
 	bool unused;
-	if (Lookup(iter, sit, path, true, unused)) {
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, unused);
+	if (iter) {
 		time = iter->modificationTime;
 		return true;
 	}
@@ -492,35 +788,42 @@ bool CDirectoryCache::GetChangeTime(fz::monotonic_clock& time, CServer const& se
 
 void CDirectoryCache::RemoveDir(CServer const& server, CServerPath const& path, std::wstring const& filename, CServerPath const&)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
 
 	// TODO: This is not 100% foolproof and may not work properly
 	// Perhaps just throw away the complete cache?
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
-	}
-
 	CServerPath absolutePath = path;
 	if (!absolutePath.AddSegment(filename)) {
 		absolutePath.clear();
 	}
 
-	for (tCacheIter iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ) {
-		auto & entry = const_cast<CCacheEntry&>(*iter);
-		// Delete exact matches and subdirs
-		if (!absolutePath.empty() && (entry.listing.path == absolutePath || absolutePath.IsParentOf(entry.listing.path, true))) {
-			m_totalFileCount -= entry.listing.size();
-			tLruList::iterator* lruIt = (tLruList::iterator*)iter->lruIt;
-			if (lruIt) {
-				m_leastRecentlyUsedList.erase(*lruIt);
-				delete lruIt;
+	// The subdirs may be in any shard
+	for (auto & shard : shards_) {
+		if (absolutePath.empty()) {
+			break;
+		}
+
+		fz::scoped_lock lock(shard.mutex_);
+
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		if (!sit) {
+			continue;
+		}
+
+		for (auto iter = sit->cacheList.begin(); iter != sit->cacheList.end(); ) {
+			auto & entry = iter->second;
+			// Delete exact matches and subdirs
+			if (entry.listing.path == absolutePath || absolutePath.IsParentOf(entry.listing.path, true)) {
+				EraseEntry(shard, *sit, iter++);
+			}
+			else {
+				++iter;
 			}
-			sit->cacheList.erase(iter++);
 		}
-		else {
-			++iter;
+		if (sit->cacheList.empty()) {
+			EraseServerEntry(shard, *sit);
 		}
 	}
 
@@ -529,169 +832,839 @@ void CDirectoryCache::RemoveDir(CServer const& server, CServerPath const& path,
 
 void CDirectoryCache::Rename(CServer const& server, CServerPath const& pathFrom, std::wstring const& fileFrom, CServerPath const& pathTo, std::wstring const& fileTo)
 {
-	fz::scoped_lock lock(mutex_);
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
-		return;
+	if (pathFrom == pathTo) {
+		RemoveFile(server, pathFrom, fileTo);
 	}
 
-	tCacheIter iter;
-	bool is_outdated = false;
-	bool found = Lookup(iter, sit, pathFrom, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
-		if (pathFrom == pathTo) {
-			RemoveFile(server, pathFrom, fileTo);
-			size_t i;
-			for (i = 0; i < listing.size(); ++i) {
-				if (listing[i].name == fileFrom) {
-					break;
-				}
-			}
-			if (i != listing.size()) {
-				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					RemoveDir(server, pathFrom, fileTo, CServerPath());
-					UpdateFile(server, pathFrom, fileTo, true, dir);
-				}
-				else {
-					listing.get(i).name = fileTo;
-					listing.get(i).flags |= CDirentry::flag_unsure;
-					listing.m_flags |= CDirectoryListing::unsure_unknown;
-					listing.ClearFindMap();
+	// The other updates may lock other shards, they are made once the lock
+	// of the source directory is released.
+	bool known{};
+	bool found{};
+	bool isDir{};
+	{
+		Shard& shard = GetShard(hash, pathFrom);
+		fz::scoped_lock lock(shard.mutex_);
+
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		bool is_outdated = false;
+		CCacheEntry* iter = sit ? Lookup(shard, *sit, pathFrom, true, is_outdated) : nullptr;
+		if (iter) {
+			known = true;
+			size_t const i = iter->FindCase(fileFrom);
+			if (i != std::wstring::npos) {
+				found = true;
+				isDir = iter->Entry(i).is_dir();
+				if (!isDir && pathFrom == pathTo) {
+					// Renamed entries move to the end of the listing
+					CDirentry renamed = iter->Entry(i);
+					renamed.name = fileTo;
+					renamed.flags |= CDirentry::flag_unsure;
+					SetCost(shard, *iter, iter->cost - EntryCost(iter->Entry(i)) + EntryCost(renamed));
+					iter->RemoveEntry(i);
+					iter->AddEntry(std::move(renamed));
+					iter->names.add(fileTo);
+					iter->listing.m_flags |= CDirectoryListing::unsure_unknown;
+					iter->Compact(max_patches);
 				}
 			}
-			return;
 		}
-		else {
-			size_t i;
-			for (i = 0; i < listing.size(); ++i) {
-				if (listing[i].name == fileFrom) {
-					break;
-				}
-			}
-			if (i != listing.size()) {
-				if (listing[i].is_dir()) {
-					RemoveDir(server, pathFrom, fileFrom, CServerPath());
-					UpdateFile(server, pathTo, fileTo, true, dir);
-				}
-				else {
-					RemoveFile(server, pathFrom, fileFrom);
-					UpdateFile(server, pathTo, fileTo, true, file);
-				}
+	}
+
+	if (!known) {
+		// We know nothing, be on the safe side and invalidate everything.
+		InvalidateServer(server);
+	}
+	else if (!found) {
+		return;
+	}
+	else if (pathFrom == pathTo) {
+		if (isDir) {
+			RemoveDir(server, pathFrom, fileFrom, CServerPath());
+			RemoveDir(server, pathFrom, fileTo, CServerPath());
+			UpdateFile(server, pathFrom, fileTo, true, dir);
+		}
+	}
+	else if (isDir) {
+		RemoveDir(server, pathFrom, fileFrom, CServerPath());
+		UpdateFile(server, pathTo, fileTo, true, dir);
+	}
+	else {
+		RemoveFile(server, pathFrom, fileFrom);
+		UpdateFile(server, pathTo, fileTo, true, file);
+	}
+}
+
+void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup)
+{
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
+
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
+		return;
+	}
+
+	bool is_outdated = false;
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, is_outdated);
+	if (iter) {
+		size_t const i = iter->FindCase(filename);
+		if (i != std::wstring::npos) {
+			if (!iter->Entry(i).is_dir()) {
+				iter->ModifyEntry(i).ownerGroup.get() = ownerGroup;
+				iter->Compact(max_patches);
 			}
 			return;
 		}
 	}
+	lock.unlock();
 
 	// We know nothing, be on the safe side and invalidate everything.
 	InvalidateServer(server);
 }
 
-void CDirectoryCache::UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup)
+void CDirectoryCache::UpdatePermissions(CServer const& server, CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> const& files)
 {
-	fz::scoped_lock lock(mutex_);
+	if (files.empty()) {
+		return;
+	}
 
-	tServerIter sit = GetServerEntry(server);
-	if (sit == m_serverList.end()) {
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
+
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
 		return;
 	}
 
-	tCacheIter iter;
 	bool is_outdated = false;
-	bool found = Lookup(iter, sit, path, true, is_outdated);
-	if (found) {
-		auto & listing = const_cast<CDirectoryListing&>(iter->listing);
-		size_t i;
-		for (i = 0; i < listing.size(); ++i) {
-			if (listing[i].name == filename) {
-				break;
-			}
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, is_outdated);
+	if (!iter) {
+		return;
+	}
+
+	for (auto const& [filename, permissions] : files) {
+		size_t const i = iter->FindCase(filename);
+		if (i == std::wstring::npos) {
+			// Could be a case insensitive match, don't guess which
+			iter->listing.m_flags |= CDirectoryListing::unsure_invalid;
+			continue;
+		}
+
+		CDirentry & dirent = iter->ModifyEntry(i);
+		dirent.permissions.get() = permissions;
+		dirent.flags |= CDirentry::flag_unsure;
+		iter->listing.m_flags |= dirent.is_dir() ? CDirectoryListing::unsure_dir_changed : CDirectoryListing::unsure_file_changed;
+	}
+	iter->Compact(max_patches);
+}
+
+void CDirectoryCache::ShiftTimes(CServer const& server, fz::duration const& span)
+{
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	for (auto & shard : shards_) {
+		fz::scoped_lock lock(shard.mutex_);
+
+		CServerEntry* sit = FindServerEntry(shard, server, hash);
+		if (!sit) {
+			continue;
 		}
-		if (i != listing.size()) {
-			if (!listing[i].is_dir()) {
-				listing.get(i).ownerGroup.get() = ownerGroup;
-				listing.ClearFindMap();
+
+		for (auto & cacheEntry : sit->cacheList) {
+			CCacheEntry & entry = cacheEntry.second;
+			entry.Compact();
+
+			size_t const count = entry.listing.size();
+			for (size_t i = 0; i < count; ++i) {
+				if (entry.listing[i].has_date()) {
+					entry.listing.get(i).time += span;
+				}
 			}
-			return;
 		}
 	}
+}
 
-	// We know nothing, be on the safe side and invalidate everything.
-	InvalidateServer(server);
+bool CDirectoryCache::UpdateFileTime(CServer const& server, CServerPath const& path, std::wstring const& filename, fz::datetime const& time)
+{
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+	fz::scoped_lock lock(shard.mutex_);
+
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (!sit) {
+		return false;
+	}
+
+	bool is_outdated = false;
+	CCacheEntry* iter = Lookup(shard, *sit, path, true, is_outdated);
+	if (!iter) {
+		return false;
+	}
+
+	size_t const i = iter->FindCase(filename);
+	if (i == std::wstring::npos || iter->Entry(i).is_dir()) {
+		return false;
+	}
+
+	iter->ModifyEntry(i).time = time;
+	iter->Compact(max_patches);
+	return true;
 }
 
+void CDirectoryCache::CCacheEntry::Compact(size_t maxPatches)
+{
+	if (changed.size() + removed.size() + added.size() <= maxPatches) {
+		return;
+	}
+
+	size_t const n = listing.size();
+	std::vector<fz::shared_value<CDirentry>> entries;
+	entries.reserve(n + added.size() - removed.size());
+
+	// Changed entries are never in removed
+	auto changedIt = changed.begin();
+	auto removedIt = removed.begin();
+	for (size_t id = 0; id < n + added.size(); ++id) {
+		if (removedIt != removed.end() && *removedIt == id) {
+			++removedIt;
+		}
+		else if (id >= n) {
+			entries.push_back(std::move(added[id - n]));
+		}
+		else if (changedIt != changed.end() && changedIt->first == id) {
+			entries.push_back(std::move(changedIt->second));
+			++changedIt;
+		}
+		else {
+			entries.push_back(listing.GetShared(id));
+		}
+	}
 
-CDirectoryCache::tServerIter CDirectoryCache::CreateServerEntry(CServer const& server)
+	listing.Assign(std::move(entries));
+	ClearPatches();
+}
+
+void CDirectoryCache::CCacheEntry::ClearPatches()
+{
+	changed.clear();
+	removed.clear();
+	added.clear();
+}
+
+CDirentry const& CDirectoryCache::CCacheEntry::Entry(size_t id) const
+{
+	size_t const n = listing.size();
+	if (id >= n) {
+		return *added[id - n];
+	}
+
+	auto it = changed.find(id);
+	if (it != changed.end()) {
+		return *it->second;
+	}
+	return listing[id];
+}
+
+CDirentry& CDirectoryCache::CCacheEntry::ModifyEntry(size_t id)
+{
+	size_t const n = listing.size();
+	if (id >= n) {
+		return added[id - n].get();
+	}
+
+	auto it = changed.find(id);
+	if (it == changed.end()) {
+		// Copies only this entry once modified
+		it = changed.emplace(id, listing.GetShared(id)).first;
+	}
+	return it->second.get();
+}
+
+void CDirectoryCache::CCacheEntry::RemoveEntry(size_t id)
+{
+	changed.erase(id);
+	removed.insert(id);
+}
+
+void CDirectoryCache::CCacheEntry::AddEntry(CDirentry && entry)
 {
-	for (tServerIter iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			return iter;
+	added.emplace_back(std::move(entry));
+}
+
+size_t CDirectoryCache::CCacheEntry::FindCase(std::wstring const& name) const
+{
+	size_t i = listing.FindFile_CmpCase(name);
+	if (i != std::wstring::npos && removed.find(i) != removed.end()) {
+		// There might be a second entry with the same name
+		i = std::wstring::npos;
+		for (size_t id : listing.FindFiles_CmpNoCase(name)) {
+			if (listing[id].name == name && removed.find(id) == removed.end()) {
+				i = id;
+				break;
+			}
 		}
 	}
-	m_serverList.emplace_back(server);
+	if (i != std::wstring::npos) {
+		return i;
+	}
 
-	return --m_serverList.end();
+	size_t const n = listing.size();
+	for (size_t j = 0; j < added.size(); ++j) {
+		if (added[j]->name == name && removed.find(n + j) == removed.end()) {
+			return n + j;
+		}
+	}
+
+	return std::wstring::npos;
 }
 
-CDirectoryCache::tServerIter CDirectoryCache::GetServerEntry(CServer const& server)
+std::vector<size_t> CDirectoryCache::CCacheEntry::FindNoCase(std::wstring const& name) const
 {
-	tServerIter iter;
-	for (iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		if (iter->server.SameContent(server)) {
-			break;
+	std::vector<size_t> ids = listing.FindFiles_CmpNoCase(name);
+	if (!removed.empty()) {
+		ids.erase(std::remove_if(ids.begin(), ids.end(), [this](size_t id) { return removed.find(id) != removed.end(); }), ids.end());
+	}
+
+	size_t const n = listing.size();
+	for (size_t j = 0; j < added.size(); ++j) {
+		if (!fz::stricmp(added[j]->name, name) && removed.find(n + j) == removed.end()) {
+			ids.push_back(n + j);
 		}
 	}
 
-	return iter;
+	return ids;
+}
+
+size_t CDirectoryCache::CNameFilter::trigram_bit(wchar_t a, wchar_t b, wchar_t c)
+{
+	uint64_t h = static_cast<uint64_t>(a) * 0x9e3779b97f4a7c15ull;
+	h = (h ^ static_cast<uint64_t>(b)) * 0xff51afd7ed558ccdull;
+	h = (h ^ static_cast<uint64_t>(c)) * 0xc4ceb9fe1a85ec53ull;
+	return static_cast<size_t>(h >> 53); // 2048 bits
 }
 
-void CDirectoryCache::UpdateLru(tServerIter const& sit, tCacheIter const& cit)
+void CDirectoryCache::CNameFilter::add(std::wstring const& name)
 {
-	tLruList::iterator* lruIt = (tLruList::iterator*)cit->lruIt;
-	if (lruIt) {
-		m_leastRecentlyUsedList.splice(m_leastRecentlyUsedList.end(), m_leastRecentlyUsedList, *lruIt);
-		**lruIt = std::make_pair(sit, cit);
+	if (name.size() < 3) {
+		return;
 	}
-	else {
-		auto & entry = const_cast<CCacheEntry&>(*cit);
-		entry.lruIt = (void*)new tLruList::iterator(m_leastRecentlyUsedList.emplace(m_leastRecentlyUsedList.end(), sit, cit));
+
+	std::wstring const lower = fz::str_tolower(name);
+	for (size_t i = 2; i < lower.size(); ++i) {
+		size_t const bit = trigram_bit(lower[i - 2], lower[i - 1], lower[i]);
+		bits_[bit / 64] |= uint64_t(1) << (bit % 64);
 	}
 }
 
-void CDirectoryCache::Prune()
+void CDirectoryCache::CNameFilter::add(CDirectoryListing const& listing)
 {
-	while ((m_leastRecentlyUsedList.size() > 50000) ||
-		(m_totalFileCount > 1000000 && m_leastRecentlyUsedList.size() > 1000) ||
-		(m_totalFileCount > 5000000 && m_leastRecentlyUsedList.size() > 100))
-	{
-		tFullEntryPosition pos = m_leastRecentlyUsedList.front();
-		tLruList::iterator* lruIt = (tLruList::iterator*)pos.second->lruIt;
-		delete lruIt;
+	for (size_t i = 0; i < listing.size(); ++i) {
+		add(listing[i].name);
+	}
+}
 
-		m_totalFileCount -= pos.second->listing.size();
+bool CDirectoryCache::CNameFilter::may_contain(std::wstring const& needle) const
+{
+	// Shorter needles match anything
+	for (size_t i = 2; i < needle.size(); ++i) {
+		size_t const bit = trigram_bit(needle[i - 2], needle[i - 1], needle[i]);
+		if (!(bits_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+CDirectoryCache::CServerEntry& CDirectoryCache::CreateServerEntry(Shard& shard, CServer const& server, size_t hash)
+{
+	CServerEntry* sit = FindServerEntry(shard, server, hash);
+	if (sit) {
+		return *sit;
+	}
+
+	return shard.servers.emplace(hash, CServerEntry(server, hash))->second;
+}
+
+CDirectoryCache::Shard& CDirectoryCache::GetShard(size_t hash, CServerPath const& path)
+{
+	// Paths differing only in case go into the same shard, as the server
+	// may consider them the same directory.
+	size_t const pathHash = std::hash<std::wstring>()(fz::str_tolower(path.GetPath()));
+	return shards_[(hash ^ (pathHash * 0x9e3779b97f4a7c15ull)) % shard_count];
+}
 
-		pos.first->cacheList.erase(pos.second);
-		if (pos.first->cacheList.empty()) {
-			m_serverList.erase(pos.first);
+CDirectoryCache::CServerEntry* CDirectoryCache::FindServerEntry(Shard& shard, CServer const& server, size_t hash)
+{
+	auto range = shard.servers.equal_range(hash);
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (iter->second.server.SameContent(server)) {
+			return &iter->second;
 		}
+	}
 
-		m_leastRecentlyUsedList.pop_front();
+	return nullptr;
+}
+
+void CDirectoryCache::EraseServerEntry(Shard& shard, CServerEntry& sit)
+{
+	auto range = shard.servers.equal_range(sit.hash);
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (&iter->second == &sit) {
+			shard.servers.erase(iter);
+			return;
+		}
 	}
 }
 
-void CDirectoryCache::SetTtl(fz::duration const& ttl)
+void CDirectoryCache::UpdateLru(Shard& shard, CCacheEntry& entry)
+{
+	shard.lru.splice(shard.lru.end(), shard.lru, entry.lruIt);
+	entry.lruIt->stamp = ++lruClock_;
+}
+
+void CDirectoryCache::EraseEntry(Shard& shard, CServerEntry& sit, tCacheIter const& cit)
 {
-	fz::scoped_lock lock(mutex_);
+	shard.lru.erase(cit->second.lruIt);
+	shard.byCost.erase(cit->second.costIt);
+
+	m_totalCost -= cit->second.cost;
+	--m_totalEntryCount;
+
+	sit.cacheList.erase(cit);
+}
+
+CDirectoryCache::CCacheEntry& CDirectoryCache::InsertEntry(Shard& shard, CServerEntry& sit, CDirectoryListing const& listing, int64_t cost)
+{
+	auto cit = sit.cacheList.emplace(listing.path, CCacheEntry(listing)).first;
+	++m_totalEntryCount;
+
+	CCacheEntry & entry = cit->second;
+	entry.lruIt = shard.lru.insert(shard.lru.end(), LruEntry{&sit, &entry, ++lruClock_});
+	entry.cost = cost;
+	entry.costIt = shard.byCost.emplace(cost, &entry);
+	m_totalCost += cost;
+
+	return entry;
+}
+
+void CDirectoryCache::SetCost(Shard& shard, CCacheEntry& entry, int64_t cost)
+{
+	m_totalCost += cost - entry.cost;
+	entry.cost = cost;
+
+	shard.byCost.erase(entry.costIt);
+	entry.costIt = shard.byCost.emplace(cost, &entry);
+}
+
+bool CDirectoryCache::NeedsPruning() const
+{
+	return m_totalCost > m_memoryBudget && m_totalEntryCount > 1;
+}
+
+void CDirectoryCache::Prune()
+{
+	while (NeedsPruning()) {
+		// Of the candidates in each shard, evict the one with the highest
+		// product of age and size. A single huge listing thus goes before
+		// many small ones that are in use.
+		Shard* victimShard{};
+		CServer victimServer;
+		size_t victimHash{};
+		CServerPath victimPath;
+		double victimScore{-1};
+
+		uint64_t const now = lruClock_;
+		for (auto & shard : shards_) {
+			fz::scoped_lock lock(shard.mutex_);
+
+			auto const consider = [&](LruEntry const& pos) {
+				double const score = static_cast<double>(now - pos.stamp + 1) * static_cast<double>(pos.entry->cost);
+				if (score > victimScore) {
+					victimScore = score;
+					victimShard = &shard;
+					victimServer = pos.server->server;
+					victimHash = pos.server->hash;
+					victimPath = pos.entry->listing.path;
+				}
+			};
+
+			size_t n = 0;
+			for (auto it = shard.lru.cbegin(); it != shard.lru.cend() && n < prune_candidates; ++it, ++n) {
+				consider(*it);
+			}
+			n = 0;
+			for (auto it = shard.byCost.crbegin(); it != shard.byCost.crend() && n < prune_candidates; ++it, ++n) {
+				consider(*it->second->lruIt);
+			}
+		}
+		if (!victimShard) {
+			break;
+		}
 
+		// The shard has been unlocked in the meantime, look the entry up again.
+		fz::scoped_lock lock(victimShard->mutex_);
+		CServerEntry* sit = FindServerEntry(*victimShard, victimServer, victimHash);
+		if (!sit) {
+			continue;
+		}
+		auto cit = sit->cacheList.find(victimPath);
+		if (cit != sit->cacheList.end()) {
+			EraseEntry(*victimShard, *sit, cit);
+		}
+		if (sit->cacheList.empty()) {
+			EraseServerEntry(*victimShard, *sit);
+		}
+	}
+}
+
+void CDirectoryCache::SetTtl(fz::duration const& ttl)
+{
 	if (ttl < fz::duration::from_seconds(30)) {
-		ttl_ = fz::duration::from_seconds(30);
+		ttl_ = fz::duration::from_seconds(30).get_milliseconds();
 	}
 	else if (ttl > fz::duration::from_days(1)) {
-		ttl_ = fz::duration::from_days(1);
+		ttl_ = fz::duration::from_days(1).get_milliseconds();
 	}
 	else {
-		ttl_ = ttl;
+		ttl_ = ttl.get_milliseconds();
+	}
+}
+
+void CDirectoryCache::SetMemoryBudget(int64_t bytes)
+{
+	m_memoryBudget = std::max(bytes, int64_t(1024 * 1024));
+	Prune();
+}
+
+void CDirectoryCache::SetPersistentDirectory(std::wstring const& dir)
+{
+	persistentDir_ = dir;
+	if (!persistentDir_.empty() && persistentDir_.back() != fz::local_filesys::path_separator) {
+		persistentDir_ += fz::local_filesys::path_separator;
+	}
+}
+
+void CDirectoryCache::SetSharedDirectory(std::wstring const& dir)
+{
+	sharedDir_ = dir;
+	if (!sharedDir_.empty()) {
+		if (sharedDir_.back() != fz::local_filesys::path_separator) {
+			sharedDir_ += fz::local_filesys::path_separator;
+		}
+		fz::mkdir(fz::to_native(sharedDir_), true, true);
+	}
+}
+
+void CDirectoryCache::SetStoreHandler(std::function<void(CServer const&, CDirectoryListing const&)> const& handler)
+{
+	storeHandler_ = handler;
+}
+
+void CDirectoryCache::LoadPersistent(CServer const& server, size_t hash)
+{
+	if (persistentDir_.empty()) {
+		return;
+	}
+
+	// The server gets claimed under the lock, the file is read after
+	// releasing it. The per-server mutex is held by the loading thread
+	// until the listings are inserted.
+	std::shared_ptr<fz::mutex> loading;
+	bool claimed{};
+	{
+		fz::scoped_lock persistentLock(persistentMutex_);
+
+		auto range = persistentLoaded_.equal_range(hash);
+		for (auto iter = range.first; iter != range.second; ++iter) {
+			if (iter->second.server.SameContent(server)) {
+				loading = iter->second.loading;
+				break;
+			}
+		}
+		if (!loading) {
+			loading = std::make_shared<fz::mutex>();
+			loading->lock();
+			claimed = true;
+			persistentLoaded_.emplace(hash, persistent_state{server, loading});
+		}
+	}
+
+	if (!claimed) {
+		// Wait for a concurrent load of the same server to finish
+		fz::scoped_lock loadLock(*loading);
+		return;
+	}
+
+	ReadPersistent(server, hash);
+	loading->unlock();
+}
+
+void CDirectoryCache::ReadPersistent(CServer const& server, size_t hash)
+{
+	std::string const identity = ServerIdentity(server);
+	fz::file f(PersistentFile(persistentDir_, identity), fz::file::reading);
+	if (!f.opened()) {
+		return;
+	}
+
+	int64_t const size = f.size();
+	if (size <= 0 || size > persistent_max_file_size) {
+		return;
 	}
+
+	std::string data;
+	data.resize(static_cast<size_t>(size));
+	if (f.read(&data[0], size) != size) {
+		return;
+	}
+
+	PersistentReader r(data);
+	std::string const magic = r.str();
+	if (magic != persistent_magic || r.u32() != persistent_version || r.str() != identity) {
+		return;
+	}
+
+	uint32_t const count = r.u32();
+
+	CStringPool pool;
+	auto const now = fz::monotonic_clock::now();
+	int64_t const wallNow = WallClockMilliseconds();
+	for (uint32_t i = 0; i < count && !r.error() && m_totalCost < m_memoryBudget; ++i) {
+		int64_t const listed = r.i64();
+		CDirectoryListing listing;
+		if (!ReadListing(r, listing, pool)) {
+			break;
+		}
+
+		// Carry the age of the listing over to the monotonic clock. Listings
+		// older than the longest TTL are equally outdated.
+		int64_t const age = std::min(std::max(int64_t(0), wallNow - listed), persistent_max_age);
+		listing.m_firstListTime = now - fz::duration::from_milliseconds(age);
+
+		Shard& shard = GetShard(hash, listing.path);
+		fz::scoped_lock lock(shard.mutex_);
+		CServerEntry& sit = CreateServerEntry(shard, server, hash);
+		if (sit.cacheList.find(listing.path) == sit.cacheList.end()) {
+			InsertEntry(shard, sit, listing, ListingCost(listing)).modificationTime = now;
+		}
+	}
+}
+
+void CDirectoryCache::SavePersistent()
+{
+	fz::mkdir(fz::to_native(persistentDir_), true, true);
+
+	// The listings of a server are spread over the shards, they are
+	// collected into one file per server.
+	struct collected final
+	{
+		uint32_t count{};
+		PersistentWriter listings;
+	};
+	std::map<std::string, collected> servers;
+
+	auto const now = fz::monotonic_clock::now();
+	int64_t const wallNow = WallClockMilliseconds();
+	for (auto & shard : shards_) {
+		fz::scoped_lock lock(shard.mutex_);
+
+		for (auto & server : shard.servers) {
+			auto & c = servers[ServerIdentity(server.second.server)];
+			for (auto & cacheEntry : server.second.cacheList) {
+				cacheEntry.second.Compact();
+				auto const& listing = cacheEntry.second.listing;
+				int64_t age = persistent_max_age;
+				if (listing.m_firstListTime) {
+					age = std::min((now - listing.m_firstListTime).get_milliseconds(), persistent_max_age);
+				}
+				c.listings.i64(wallNow - age);
+				WriteListing(c.listings, listing);
+				++c.count;
+			}
+		}
+	}
+
+	std::set<std::string> saved;
+	for (auto const& [identity, c] : servers) {
+		PersistentWriter w;
+		w.str(std::string(persistent_magic));
+		w.u32(persistent_version);
+		w.str(identity);
+		w.u32(c.count);
+		w.data_ += c.listings.data_;
+
+		fz::file f(PersistentFile(persistentDir_, identity), fz::file::writing, fz::file::empty);
+		if (f.opened() && f.write(w.data_.c_str(), static_cast<int64_t>(w.data_.size())) == static_cast<int64_t>(w.data_.size())) {
+			saved.insert(identity);
+		}
+	}
+
+	// Whatever got invalidated during this session must not come back
+	fz::scoped_lock persistentLock(persistentMutex_);
+	for (auto const& loaded : persistentLoaded_) {
+		std::string const identity = ServerIdentity(loaded.second.server);
+		if (saved.find(identity) == saved.end()) {
+			fz::remove_file(PersistentFile(persistentDir_, identity));
+		}
+	}
+}
+
+void CDirectoryCache::StoreShared(CServer const& server, CDirectoryListing const& listing)
+{
+	// Per-file updates are not shared, neither are listings that are not
+	// entirely trusted.
+	if (listing.failed() || listing.get_unsure_flags()) {
+		return;
+	}
+
+	std::string const identity = ServerIdentity(server);
+
+	fz::duration const age = fz::monotonic_clock::now() - listing.m_firstListTime;
+
+	PersistentWriter w;
+	w.str(std::string(shared_magic));
+	w.u32(shared_version);
+	w.str(identity);
+	w.i64(WallClockMilliseconds() - age.get_milliseconds());
+	WriteListing(w, listing);
+
+	// Replaced in one go, readers never see a partially written file. The
+	// temporary file is unique as other instances might write it as well.
+	auto const name = SharedFile(sharedDir_, identity, listing.path);
+	auto const tmp = name + fz::to_native(fz::sprintf(L".%d.tmp", fz::random_number(0, 0x7fffffff)));
+	{
+		fz::file f(tmp, fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.write(w.data_.c_str(), static_cast<int64_t>(w.data_.size())) != static_cast<int64_t>(w.data_.size())) {
+			f.close();
+			fz::remove_file(tmp);
+			return;
+		}
+	}
+
+#ifdef FZ_WINDOWS
+	bool const renamed = MoveFileExW(tmp.c_str(), name.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool const renamed = rename(tmp.c_str(), name.c_str()) == 0;
+#endif
+	if (!renamed) {
+		fz::remove_file(tmp);
+	}
+}
+
+void CDirectoryCache::LoadShared(CServer const& server, CServerPath const& path)
+{
+	if (sharedDir_.empty()) {
+		return;
+	}
+
+	size_t const hash = server.Hash();
+	LoadPersistent(server, hash);
+
+	Shard& shard = GetShard(hash, path);
+
+	// Another instance may have listed it more recently than the cached
+	// listing got stored.
+	fz::monotonic_clock cached;
+	{
+		fz::scoped_lock lock(shard.mutex_);
+		auto const now = fz::monotonic_clock::now();
+		CServerEntry& sit = CreateServerEntry(shard, server, hash);
+		auto cit = sit.cacheList.find(path);
+		if (cit != sit.cacheList.end()) {
+			cached = cit->second.listing.m_firstListTime;
+			if (cached && (now - cached) <= fz::duration::from_milliseconds(ttl_)) {
+				return;
+			}
+		}
+
+		auto & checked = sit.sharedChecked[path];
+		if (checked && (now - checked) < shared_recheck_interval) {
+			return;
+		}
+		checked = now;
+	}
+
+	// Reading and parsing the file is done without holding the lock
+	std::string const identity = ServerIdentity(server);
+
+	fz::file f(SharedFile(sharedDir_, identity, path), fz::file::reading);
+	if (!f.opened()) {
+		return;
+	}
+
+	int64_t const size = f.size();
+	if (size <= 0 || size > persistent_max_file_size) {
+		return;
+	}
+
+	std::string data;
+	data.resize(static_cast<size_t>(size));
+	if (f.read(&data[0], size) != size) {
+		return;
+	}
+	f.close();
+
+	PersistentReader r(data);
+	std::string const magic = r.str();
+	if (magic != shared_magic || r.u32() != shared_version || r.str() != identity) {
+		return;
+	}
+
+	// Carry the age of the listing over to the monotonic clock
+	int64_t const listed = r.i64();
+	fz::duration const age = fz::duration::from_milliseconds(std::max(int64_t(0), WallClockMilliseconds() - listed));
+	if (r.error() || age > fz::duration::from_milliseconds(ttl_)) {
+		return;
+	}
+	auto const listTime = fz::monotonic_clock::now() - age;
+	if (cached && listTime <= cached) {
+		return;
+	}
+
+	CStringPool pool;
+	CDirectoryListing listing;
+	if (!ReadListing(r, listing, pool, true) || listing.path != path) {
+		return;
+	}
+	listing.m_firstListTime = listTime;
+
+	int64_t const cost = ListingCost(listing);
+
+	{
+		fz::scoped_lock lock(shard.mutex_);
+
+		CServerEntry& sit = CreateServerEntry(shard, server, hash);
+		auto cit = sit.cacheList.find(path);
+		if (cit != sit.cacheList.end()) {
+			// Might have been stored while the lock was not held
+			CCacheEntry & entry = cit->second;
+			if (entry.listing.m_firstListTime && listTime <= entry.listing.m_firstListTime) {
+				return;
+			}
+			UpdateLru(shard, entry);
+			entry.modificationTime = fz::monotonic_clock::now();
+			entry.ClearPatches();
+			entry.listing = std::move(listing);
+			entry.names = CNameFilter();
+			entry.names.add(entry.listing);
+			SetCost(shard, entry, cost);
+		}
+		else {
+			InsertEntry(shard, sit, listing, cost);
+		}
+	}
+
+	Prune();
 }
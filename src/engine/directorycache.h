@@ -18,8 +18,14 @@ version.
 
 #include <libfilezilla/mutex.hpp>
 
+#include <array>
+#include <atomic>
+#include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <set>
+#include <unordered_map>
 
 enum class LookupFlags
 {
@@ -90,6 +96,17 @@ public:
 	void Store(CDirectoryListing const& listing, CServer const& server);
 	bool GetChangeTime(fz::monotonic_clock& time, CServer const& server, CServerPath const& path);
 	bool Lookup(CDirectoryListing &listing, CServer const&server, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
+
+	// Looks up several listings, locking each shard only once. listings
+	// gets one element per path, those not in the cache are left empty
+	// with an empty path. Returns the number of listings found.
+	size_t LookupMany(std::vector<CDirectoryListing> & listings, CServer const& server, std::vector<CServerPath> const& paths, bool allowUnsureEntries);
+
+	// Appends the cached listings of path and of all directories below it.
+	// Fails unless the whole tree is cached with none of its listings being
+	// outdated or unsure. If needle is not empty, listings that cannot have
+	// a name containing it, ignoring case, are left out.
+	bool LookupTree(std::vector<CDirectoryListing> & listings, CServer const& server, CServerPath const& path, std::wstring const& needle);
 	bool DoesExist(CServer const& server, CServerPath const& path, int &hasUnsureEntries, bool &is_outdated);
 	bool LookupFile(CDirentry &entry, CServer const& server, CServerPath const& path, std::wstring const& filename, bool &dirDidExist, bool &matchedCase);
 	bool InvalidateFile(CServer const& server, CServerPath const& path, std::wstring const& filename);
@@ -100,10 +117,72 @@ public:
 	void Rename(CServer const& server, CServerPath const& pathFrom, std::wstring const& fileFrom, CServerPath const& pathTo, std::wstring const& fileTo);
 	void UpdateOwnerGroup(CServer const& server, CServerPath const& path, std::wstring const& filename, std::wstring& ownerGroup);
 
+	// Sets the permissions of several files in one directory under a single
+	// lock, each given as pair of filename and permission string. The
+	// entries are marked unsure, the server may report them differently.
+	void UpdatePermissions(CServer const& server, CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> const& files);
+
+	// Sets the time of a cached file ahead of the server confirming it, e.g.
+	// for deferred timestamp changes. Does nothing if the file is not cached.
+	bool UpdateFileTime(CServer const& server, CServerPath const& path, std::wstring const& filename, fz::datetime const& time);
+
+	// Adds span to the time of each cached entry of the server, e.g. once its
+	// timezone offset got detected.
+	void ShiftTimes(CServer const& server, fz::duration const& span);
+
 	void SetTtl(fz::duration const& ttl);
 
+	// Limit for the estimated memory used by all cached listings
+	void SetMemoryBudget(int64_t bytes);
+
+	// If set, cached listings are saved to one file per server in this
+	// directory on destruction. They are loaded again on first use of the
+	// server, flagged as unsure and outdated until listed again.
+	// Must be called before the cache is first used.
+	void SetPersistentDirectory(std::wstring const& dir);
+
+	// If set, each stored listing is also written to this directory, one file
+	// per server and path. Directories not in the cache are looked up there,
+	// which lets several instances on the same machine share their listings.
+	// Listings keep their age, the TTL applies to them as usual.
+	// Must be called before the cache is first used.
+	void SetSharedDirectory(std::wstring const& dir);
+
+	// Called after each stored listing, outside of any cache lock.
+	// Must be set before the cache is first used.
+	void SetStoreHandler(std::function<void(CServer const&, CDirectoryListing const&)> const& handler);
+
 protected:
 
+	class CServerEntry;
+	class CCacheEntry;
+
+	// Bloom filter over the trigrams of the lowercased names of a listing.
+	// Names only ever get added, removed names merely cause false positives.
+	class CNameFilter final
+	{
+	public:
+		void add(std::wstring const& name);
+		void add(CDirectoryListing const& listing);
+
+		// Needle has to be lowercase
+		bool may_contain(std::wstring const& needle) const;
+
+	private:
+		static size_t trigram_bit(wchar_t a, wchar_t b, wchar_t c);
+
+		std::array<uint64_t, 32> bits_{};
+	};
+
+	struct LruEntry final
+	{
+		CServerEntry* server{};
+		CCacheEntry* entry{};
+		uint64_t stamp{};
+	};
+	typedef std::list<LruEntry> tLruList;
+	typedef std::multimap<int64_t, CCacheEntry*> tCostMap;
+
 	class CCacheEntry final
 	{
 	public:
@@ -114,58 +193,139 @@ protected:
 		explicit CCacheEntry(CDirectoryListing const& l)
 			: listing(l)
 			, modificationTime(fz::monotonic_clock::now())
-		{}
+		{
+			names.add(listing);
+		}
 
 		CDirectoryListing listing;
 		fz::monotonic_clock modificationTime;
 
+		CNameFilter names;
+
 		CCacheEntry& operator=(CCacheEntry const& a) = default;
 		CCacheEntry& operator=(CCacheEntry && a) noexcept = default;
 
-		void* lruIt{}; // void* to break cyclic declaration dependency
+		tLruList::iterator lruIt{};
 
-		bool operator<(CCacheEntry const& op) const noexcept {
-			return listing.path < op.listing.path;
-		}
+		// Per-file updates get collected here rather than applied to the
+		// listing, whose entries would be copied in full if a copy of it
+		// has been handed out. Entries are identified by their index in the
+		// listing, those in added follow after the last one.
+		// Compact merges all of it into the listing.
+		std::map<size_t, fz::shared_value<CDirentry>> changed;
+		std::set<size_t> removed;
+		std::vector<fz::shared_value<CDirentry>> added;
+
+		// Merges the patches into the listing if there are more than maxPatches
+		void Compact(size_t maxPatches = 0);
+		void ClearPatches();
+
+		CDirentry const& Entry(size_t id) const;
+
+		// The name of the returned entry must not be changed
+		CDirentry& ModifyEntry(size_t id);
+		void RemoveEntry(size_t id);
+		void AddEntry(CDirentry && entry);
+
+		// Like the find functions of CDirectoryListing, but including the patches
+		size_t FindCase(std::wstring const& name) const;
+		std::vector<size_t> FindNoCase(std::wstring const& name) const;
+
+		// Estimated memory footprint of the listing
+		int64_t cost{};
+		tCostMap::iterator costIt{};
 	};
 
+	typedef std::unordered_map<CServerPath, CCacheEntry> tCacheList;
+	typedef tCacheList::iterator tCacheIter;
+
 	class CServerEntry final
 	{
 	public:
 		CServerEntry() {}
-		explicit CServerEntry(CServer const& s)
+		CServerEntry(CServer const& s, size_t h)
 			: server(s)
+			, hash(h)
 		{}
 
 		CServer server;
-		std::set<CCacheEntry> cacheList;
+		size_t hash{};
+		tCacheList cacheList;
+
+		// When LoadShared last looked for the shared file of a directory
+		std::unordered_map<CServerPath, fz::monotonic_clock> sharedChecked;
 	};
 
-	typedef std::list<CServerEntry>::iterator tServerIter;
+	// Listings are distributed over the shards by the hash of their server
+	// and path, so that the directories of a single busy server do not all
+	// contend for one lock. Each shard holds an entry for every server with
+	// listings in it. Each shard has its own lock and its own LRU list.
+	// Entries in the LRU lists are stamped from a global counter so that
+	// pruning can find the globally least recently used entry by looking at
+	// the front of each list.
+	//
+	// At most one shard lock is held at any time. Operations on all of the
+	// directories of a server lock the shards one after another.
+	struct Shard final
+	{
+		fz::mutex mutex_;
+		std::unordered_multimap<size_t, CServerEntry> servers;
+		tLruList lru;
+		tCostMap byCost;
+	};
+
+	static constexpr size_t shard_count = 16;
+
+	Shard& GetShard(size_t hash, CServerPath const& path);
 
-	tServerIter CreateServerEntry(const CServer& server);
-	tServerIter GetServerEntry(const CServer& server);
+	CServerEntry& CreateServerEntry(Shard& shard, CServer const& server, size_t hash);
+	CServerEntry* FindServerEntry(Shard& shard, CServer const& server, size_t hash);
+	void EraseServerEntry(Shard& shard, CServerEntry& sit);
 
-	typedef std::set<CCacheEntry>::iterator tCacheIter;
-	typedef std::set<CCacheEntry>::const_iterator tCacheConstIter;
+	CCacheEntry* Lookup(Shard& shard, CServerEntry& sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
 
-	bool Lookup(tCacheIter &cacheIter, tServerIter &sit, CServerPath const& path, bool allowUnsureEntries, bool& is_outdated);
+	void UpdateLru(Shard& shard, CCacheEntry& entry);
+	void EraseEntry(Shard& shard, CServerEntry& sit, tCacheIter const& cit);
+	void SetCost(Shard& shard, CCacheEntry& entry, int64_t cost);
+	CCacheEntry& InsertEntry(Shard& shard, CServerEntry& sit, CDirectoryListing const& listing, int64_t cost);
 
-	fz::mutex mutex_;
+	// Reads the persistent cache of the server on its first use. Must be
+	// called without holding any shard lock.
+	void LoadPersistent(CServer const& server, size_t hash);
+	void ReadPersistent(CServer const& server, size_t hash);
+	void SavePersistent();
+	std::wstring persistentDir_;
+
+	// The servers for which the persistent cache was read, by their hash.
+	// Loading holds the per-server mutex, not persistentMutex_.
+	struct persistent_state final
+	{
+		CServer server;
+		std::shared_ptr<fz::mutex> loading;
+	};
+	fz::mutex persistentMutex_;
+	std::unordered_multimap<size_t, persistent_state> persistentLoaded_;
 
-	std::list<CServerEntry> m_serverList;
+	void StoreShared(CServer const& server, CDirectoryListing const& listing);
+	// Replaces the cached listing if the shared one is more recent. Must be
+	// called without holding any shard lock.
+	void LoadShared(CServer const& server, CServerPath const& path);
+	std::wstring sharedDir_;
 
-	void UpdateLru(tServerIter const& sit, tCacheIter const& cit);
+	std::function<void(CServer const&, CDirectoryListing const&)> storeHandler_;
 
+	// Must be called without holding any shard lock
 	void Prune();
+	bool NeedsPruning() const;
 
-	typedef std::pair<tServerIter, tCacheIter> tFullEntryPosition;
-	typedef std::list<tFullEntryPosition> tLruList;
-	tLruList m_leastRecentlyUsedList;
+	std::array<Shard, shard_count> shards_;
 
-	int64_t m_totalFileCount{};
+	std::atomic<int64_t> m_totalCost{};
+	std::atomic<int64_t> m_totalEntryCount{};
+	std::atomic<int64_t> m_memoryBudget{256 * 1024 * 1024};
+	std::atomic<uint64_t> lruClock_{};
 
-	fz::duration ttl_{fz::duration::from_seconds(600)};
+	std::atomic<int64_t> ttl_{fz::duration::from_seconds(600).get_milliseconds()};
 };
 
 #endif
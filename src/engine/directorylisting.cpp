@@ -3,6 +3,8 @@
 #include <libfilezilla/format.hpp>
 
 #include <algorithm>
+#include <cwctype>
+#include <limits>
 
 void CDirentry::clear()
 {
@@ -64,11 +66,19 @@ CDirentry& CDirectoryListing::get(size_t index)
 {
 	// Commented out, too heavy speed penalty
 	// assert(index < m_entryCount);
+	m_columns.reset();
 	return m_entries.get()[index].get();
 }
 
+fz::shared_value<CDirentry> const& CDirectoryListing::GetShared(size_t index) const
+{
+	return (*m_entries)[index];
+}
+
 void CDirectoryListing::Assign(std::vector<fz::shared_value<CDirentry>> && entries)
 {
+	// Detach first, the old entries might otherwise get copied just to be replaced
+	m_entries.clear();
 	std::vector<fz::shared_value<CDirentry>> & own_entries = m_entries.get();
 	own_entries = std::move(entries);
 
@@ -88,6 +98,7 @@ void CDirectoryListing::Assign(std::vector<fz::shared_value<CDirentry>> && entri
 
 	m_searchmap_case.clear();
 	m_searchmap_nocase.clear();
+	m_columns.reset();
 }
 
 bool CDirectoryListing::RemoveEntry(size_t index)
@@ -98,6 +109,7 @@ bool CDirectoryListing::RemoveEntry(size_t index)
 
 	m_searchmap_case.clear();
 	m_searchmap_nocase.clear();
+	m_columns.reset();
 
 	std::vector<fz::shared_value<CDirentry> >& entries = m_entries.get();
 	std::vector<fz::shared_value<CDirentry> >::iterator iter = entries.begin() + index;
@@ -120,82 +132,227 @@ void CDirectoryListing::GetFilenames(std::vector<std::wstring> &names) const
 	}
 }
 
-size_t CDirectoryListing::FindFile_CmpCase(std::wstring const& name) const
+namespace {
+uint32_t name_hash(std::wstring const& name, bool nocase)
 {
-	if (!m_entries || m_entries->empty()) {
-		return std::string::npos;
+	// FNV-1a over the characters, folded the same way as fz::str_tolower
+	uint32_t h = 2166136261u;
+	for (auto c : name) {
+		h ^= static_cast<uint32_t>(nocase ? std::towlower(c) : c);
+		h *= 16777619u;
 	}
+	return h;
+}
 
-	if (!m_searchmap_case) {
-		m_searchmap_case.get();
+bool name_equal(std::wstring const& a, std::wstring const& b, bool nocase)
+{
+	if (a.size() != b.size()) {
+		return false;
 	}
+	if (!nocase) {
+		return a == b;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i] != b[i] && std::towlower(a[i]) != std::towlower(b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+}
 
-	// Search map
-	auto iter = m_searchmap_case->find(name);
-	if (iter != m_searchmap_case->end()) {
-		return iter->second;
+void CDirentryNameIndex::insert(uint32_t index, uint32_t hash)
+{
+	size_t const mask = slots_.size() - 1;
+	size_t pos = hash & mask;
+	while (slots_[pos].index != empty) {
+		pos = (pos + 1) & mask;
 	}
+	slots_[pos].index = index;
+	slots_[pos].hash = hash;
+}
 
-	size_t i = m_searchmap_case->size();
-	if (i == m_entries->size()) {
-		return std::string::npos;
+void CDirentryNameIndex::reserve(size_t count)
+{
+	if (slots_.size() >= count * 2) {
+		return;
 	}
 
-	auto & searchmap_case = m_searchmap_case.get();
+	// At most half full once all entries are indexed. Entries may
+	// have been appended since the last lookup.
+	size_t capacity = 16;
+	while (capacity < count * 2) {
+		capacity *= 2;
+	}
+	std::vector<slot> old(capacity);
+	old.swap(slots_);
+
+	// Reinsert in index order to keep equal names ordered, see find
+	old.erase(std::remove_if(old.begin(), old.end(), [](slot const& s) { return s.index == empty; }), old.end());
+	std::sort(old.begin(), old.end(), [](slot const& lhs, slot const& rhs) { return lhs.index < rhs.index; });
+	for (auto const& s : old) {
+		insert(s.index, s.hash);
+	}
+}
 
-	// Build map if not yet complete
-	std::vector<fz::shared_value<CDirentry> >::const_iterator entry_iter = m_entries->begin() + i;
-	for (; entry_iter != m_entries->end(); ++entry_iter, ++i) {
-		std::wstring const& entry_name = (*entry_iter)->name;
-		searchmap_case.emplace(entry_name, i);
+size_t CDirentryNameIndex::find(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase)
+{
+	if (entries.size() >= empty) {
+		// Cannot be indexed, not that such a listing would ever occur
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (name_equal(entries[i]->name, name, nocase)) {
+				return i;
+			}
+		}
+		return std::wstring::npos;
+	}
+
+	reserve(entries.size());
+
+	size_t const index = find_indexed(entries, name, nocase);
+	if (index != std::wstring::npos) {
+		return index;
+	}
 
-		if (entry_name == name) {
-			return i;
+	// Index more entries if not yet complete
+	uint32_t const hash = name_hash(name, nocase);
+	for (; indexed_ < entries.size(); ++indexed_) {
+		std::wstring const& entry_name = entries[indexed_]->name;
+		uint32_t const entry_hash = name_hash(entry_name, nocase);
+		insert(static_cast<uint32_t>(indexed_), entry_hash);
+
+		if (entry_hash == hash && name_equal(entry_name, name, nocase)) {
+			return indexed_++;
 		}
 	}
 
-	// Map is complete, item not in it
-	return std::string::npos;
+	// Index is complete, item not in it
+	return std::wstring::npos;
 }
 
-size_t CDirectoryListing::FindFile_CmpNoCase(std::wstring const& name) const
+void CDirentryNameIndex::find_all(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase, std::vector<size_t> & out)
 {
-	if (!m_entries || m_entries->empty()) {
-		return std::string::npos;
+	if (entries.size() >= empty) {
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (name_equal(entries[i]->name, name, nocase)) {
+				out.push_back(i);
+			}
+		}
+		return;
 	}
 
-	if (!m_searchmap_nocase) {
-		m_searchmap_nocase.get();
+	reserve(entries.size());
+	for (; indexed_ < entries.size(); ++indexed_) {
+		insert(static_cast<uint32_t>(indexed_), name_hash(entries[indexed_]->name, nocase));
 	}
 
-	std::wstring lwr = fz::str_tolower(name);
+	find_all_indexed(entries, name, nocase, out);
+}
+
+size_t CDirentryNameIndex::find_indexed(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase) const
+{
+	if (slots_.empty()) {
+		return std::wstring::npos;
+	}
+
+	uint32_t const hash = name_hash(name, nocase);
+
+	// Without removals, equal names appear in the order they got inserted
+	// in along the probe sequence, so the first match has the lowest index.
+	size_t const mask = slots_.size() - 1;
+	for (size_t pos = hash & mask; slots_[pos].index != empty; pos = (pos + 1) & mask) {
+		if (slots_[pos].hash == hash && name_equal(entries[slots_[pos].index]->name, name, nocase)) {
+			return slots_[pos].index;
+		}
+	}
+
+	return std::wstring::npos;
+}
+
+void CDirentryNameIndex::find_all_indexed(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase, std::vector<size_t> & out) const
+{
+	if (slots_.empty()) {
+		return;
+	}
 
-	// Search map
-	auto iter = m_searchmap_nocase->find(lwr);
-	if (iter != m_searchmap_nocase->end()) {
-		return iter->second;
+	uint32_t const hash = name_hash(name, nocase);
+	size_t const mask = slots_.size() - 1;
+	size_t const start = out.size();
+	for (size_t pos = hash & mask; slots_[pos].index != empty; pos = (pos + 1) & mask) {
+		if (slots_[pos].hash == hash && name_equal(entries[slots_[pos].index]->name, name, nocase)) {
+			out.push_back(slots_[pos].index);
+		}
 	}
+	std::sort(out.begin() + start, out.end());
+}
 
-	size_t i = m_searchmap_nocase->size();
-	if (i == m_entries->size()) {
+size_t CDirectoryListing::FindFile_CmpCase(std::wstring const& name) const
+{
+	if (!m_entries || m_entries->empty()) {
 		return std::string::npos;
 	}
 
-	auto& searchmap_nocase = m_searchmap_nocase.get();
+	// A complete index is read through the const reference, which keeps it
+	// shared with the copies of the listing
+	if (m_searchmap_case && m_searchmap_case->complete(m_entries->size())) {
+		return m_searchmap_case->find_indexed(*m_entries, name, false);
+	}
+	return m_searchmap_case.get().find(*m_entries, name, false);
+}
 
-	// Build map if not yet complete
-	std::vector<fz::shared_value<CDirentry> >::const_iterator entry_iter = m_entries->begin() + i;
-	for (; entry_iter != m_entries->end(); ++entry_iter, ++i) {
-		std::wstring entry_lrw = fz::str_tolower((*entry_iter)->name);
-		searchmap_nocase.emplace(entry_lrw, i);
+size_t CDirectoryListing::FindFile_CmpNoCase(std::wstring const& name) const
+{
+	if (!m_entries || m_entries->empty()) {
+		return std::string::npos;
+	}
+
+	if (m_searchmap_nocase && m_searchmap_nocase->complete(m_entries->size())) {
+		return m_searchmap_nocase->find_indexed(*m_entries, name, true);
+	}
+	return m_searchmap_nocase.get().find(*m_entries, name, true);
+}
 
-		if (entry_lrw == lwr) {
-			return i;
+CDirectoryListing::columns const& CDirectoryListing::GetColumns() const
+{
+	if (!m_columns) {
+		auto c = std::make_shared<columns>();
+		size_t const count = size();
+		c->size.reserve(count);
+		c->time.reserve(count);
+		c->flags.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			CDirentry const& entry = *(*m_entries)[i];
+			c->size.push_back(entry.size);
+			c->time.push_back(time_key(entry.time));
+			c->flags.push_back(static_cast<uint8_t>(entry.flags));
 		}
+		m_columns = std::move(c);
 	}
+	return *m_columns;
+}
 
-	// Map is complete, item not in it
-	return std::string::npos;
+int64_t CDirectoryListing::time_key(fz::datetime const& time)
+{
+	// Empty times sort first, equal times by their accuracy
+	if (time.empty()) {
+		return std::numeric_limits<int64_t>::min();
+	}
+	int64_t const ms = (time - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds();
+	return ms * 8 + static_cast<int>(time.get_accuracy());
+}
+
+std::vector<size_t> CDirectoryListing::FindFiles_CmpNoCase(std::wstring const& name) const
+{
+	std::vector<size_t> ret;
+	if (m_entries && !m_entries->empty()) {
+		if (m_searchmap_nocase && m_searchmap_nocase->complete(m_entries->size())) {
+			m_searchmap_nocase->find_all_indexed(*m_entries, name, true, ret);
+		}
+		else {
+			m_searchmap_nocase.get().find_all(*m_entries, name, true, ret);
+		}
+	}
+	return ret;
 }
 
 void CDirectoryListing::ClearFindMap()
@@ -206,11 +363,35 @@ void CDirectoryListing::ClearFindMap()
 
 	m_searchmap_case.clear();
 	m_searchmap_nocase.clear();
+	m_columns.reset();
 }
 
 void CDirectoryListing::Append(CDirentry&& entry)
 {
 	m_entries.get().emplace_back(entry);
+	m_columns.reset();
+}
+
+void CDirectoryListing::Append(std::vector<fz::shared_value<CDirentry>> const& entries)
+{
+	std::vector<fz::shared_value<CDirentry>> & own_entries = m_entries.get();
+	own_entries.insert(own_entries.end(), entries.cbegin(), entries.cend());
+
+	for (auto const& entry : entries) {
+		if (entry->is_dir()) {
+			m_flags |= listing_has_dirs;
+		}
+		if (!entry->permissions->empty()) {
+			m_flags |= listing_has_perms;
+		}
+		if (!entry->ownerGroup->empty()) {
+			m_flags |= listing_has_usergroup;
+		}
+	}
+
+	m_searchmap_case.clear();
+	m_searchmap_nocase.clear();
+	m_columns.reset();
 }
 
 bool CheckInclusion(const CDirectoryListing& listing1, const CDirectoryListing& listing2)
@@ -246,3 +427,15 @@ bool CheckInclusion(const CDirectoryListing& listing1, const CDirectoryListing&
 
 	return true;
 }
+
+fz::shared_value<std::wstring> const& CStringPool::get(std::wstring_view const& v)
+{
+	auto it = pool_.find(v);
+	if (it == pool_.end()) {
+		fz::shared_value<std::wstring> value;
+		value.get() = v;
+		std::wstring_view const key = *value;
+		it = pool_.emplace(key, std::move(value)).first;
+	}
+	return it->second;
+}
@@ -3,15 +3,26 @@
 #include "controlsocket.h"
 
 #include <libfilezilla/format.hpp>
+#include <libfilezilla/thread_pool.hpp>
 
 #include <algorithm>
 #include <vector>
 #include <limits>
+#include <new>
 
 #include <assert.h>
 #include <string.h>
 
-std::map<std::wstring, int> CDirectoryListingParser::m_MonthNamesMap;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FZ_LISTING_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define FZ_LISTING_NEON 1
+#include <arm_neon.h>
+#endif
 
 //#define LISTDEBUG_MVS
 //#define LISTDEBUG
@@ -23,26 +34,393 @@ static char const data[][150]={
 #endif
 
 namespace {
-struct ObjectCache
+// Received listing data is placed in buffers of this size
+int const listing_buffer_size = 256 * 1024;
+
+// If less space is left in the last buffer, a new one is started
+int const min_listing_read = 4096;
+
+size_t const max_free_listing_buffers = 2;
+
+// The encoding is decided from this many bytes at the start of the listing
+int const encoding_sample_size = 4096;
+
+// Month names get looked up for every date field of every line. The table
+// is generated at compile time: an open-addressing hash over the names
+// above and the combinations of name and number some servers send, e.g.
+// "jan01", folded to lowercase ASCII.
+struct month_name final
 {
-	fz::shared_value<std::wstring> const& get(std::wstring const& v)
-	{
-		auto it = std::lower_bound(cache.begin(), cache.end(), v);
+	wchar_t const* name;
+	int month;
+};
+
+constexpr month_name month_names[] = {
+	//English month names
+	{ L"jan", 1 },
+	{ L"feb", 2 },
+	{ L"mar", 3 },
+	{ L"apr", 4 },
+	{ L"may", 5 },
+	{ L"jun", 6 },
+	{ L"june", 6 },
+	{ L"jul", 7 },
+	{ L"july", 7 },
+	{ L"aug", 8 },
+	{ L"sep", 9 },
+	{ L"sept", 9 },
+	{ L"oct", 10 },
+	{ L"nov", 11 },
+	{ L"dec", 12 },
+
+	//Numerical values for the month
+	{ L"1", 1 },
+	{ L"01", 1 },
+	{ L"2", 2 },
+	{ L"02", 2 },
+	{ L"3", 3 },
+	{ L"03", 3 },
+	{ L"4", 4 },
+	{ L"04", 4 },
+	{ L"5", 5 },
+	{ L"05", 5 },
+	{ L"6", 6 },
+	{ L"06", 6 },
+	{ L"7", 7 },
+	{ L"07", 7 },
+	{ L"8", 8 },
+	{ L"08", 8 },
+	{ L"9", 9 },
+	{ L"09", 9 },
+	{ L"10", 10 },
+	{ L"11", 11 },
+	{ L"12", 12 },
+
+	//German month names
+	{ L"mrz", 3 },
+	{ L"m\xe4r", 3 },
+	{ L"m\xe4rz", 3 },
+	{ L"mai", 5 },
+	{ L"juni", 6 },
+	{ L"juli", 7 },
+	{ L"okt", 10 },
+	{ L"dez", 12 },
+
+	//Austrian month names
+	{ L"j\xe4n", 1 },
+
+	//French month names
+	{ L"janv", 1 },
+	{ L"f\xe9" L"b", 1 },
+	{ L"f\xe9v", 2 },
+	{ L"fev", 2 },
+	{ L"f\xe9vr", 2 },
+	{ L"fevr", 2 },
+	{ L"mars", 3 },
+	{ L"mrs", 3 },
+	{ L"avr", 4 },
+	{ L"avril", 4 },
+	{ L"juin", 6 },
+	{ L"juil", 7 },
+	{ L"jui", 7 },
+	{ L"ao\xfb", 8 },
+	{ L"ao\xfbt", 8 },
+	{ L"aout", 8 },
+	{ L"d\xe9" L"c", 12 },
+	{ L"dec", 12 },
+
+	//Italian month names
+	{ L"gen", 1 },
+	{ L"mag", 5 },
+	{ L"giu", 6 },
+	{ L"lug", 7 },
+	{ L"ago", 8 },
+	{ L"set", 9 },
+	{ L"ott", 10 },
+	{ L"dic", 12 },
+
+	//Spanish month names
+	{ L"ene", 1 },
+	{ L"fbro", 2 },
+	{ L"mzo", 3 },
+	{ L"ab", 4 },
+	{ L"abr", 4 },
+	{ L"agto", 8 },
+	{ L"sbre", 9 },
+	{ L"obre", 9 },
+	{ L"nbre", 9 },
+	{ L"dbre", 9 },
+
+	//Polish month names
+	{ L"sty", 1 },
+	{ L"lut", 2 },
+	{ L"kwi", 4 },
+	{ L"maj", 5 },
+	{ L"cze", 6 },
+	{ L"lip", 7 },
+	{ L"sie", 8 },
+	{ L"wrz", 9 },
+	{ L"pa\x9f", 10 },
+	{ L"pa\xbc", 10 }, // ISO-8859-2
+	{ L"paz", 10 }, // ASCII
+	{ L"pa\xc5\xba", 10 }, // UTF-8
+	{ L"pa\x017a", 10 }, // some servers send this
+	{ L"lis", 11 },
+	{ L"gru", 12 },
+
+	//Russian month names
+	{ L"\xff\xed\xe2", 1 },
+	{ L"\xf4\xe5\xe2", 2 },
+	{ L"\xec\xe0\xf0", 3 },
+	{ L"\xe0\xef\xf0", 4 },
+	{ L"\xec\xe0\xe9", 5 },
+	{ L"\xe8\xfe\xed", 6 },
+	{ L"\xe8\xfe\xeb", 7 },
+	{ L"\xe0\xe2\xe3", 8 },
+	{ L"\xf1\xe5\xed", 9 },
+	{ L"\xee\xea\xf2", 10 },
+	{ L"\xed\xee\xff", 11 },
+	{ L"\xe4\xe5\xea", 12 },
+
+	//Dutch month names
+	{ L"mrt", 3 },
+	{ L"mei", 5 },
+
+	//Portuguese month names
+	{ L"out", 10 },
+
+	//Finnish month names
+	{ L"tammi", 1 },
+	{ L"helmi", 2 },
+	{ L"maalis", 3 },
+	{ L"huhti", 4 },
+	{ L"touko", 5 },
+	{ L"kes\xe4", 6 },
+	{ L"hein\xe4", 7 },
+	{ L"elo", 8 },
+	{ L"syys", 9 },
+	{ L"loka", 10 },
+	{ L"marras", 11 },
+	{ L"joulu", 12 },
+
+	//Slovenian month names
+	{ L"avg", 8 },
+
+	//Icelandic
+	{ L"ma\x00ed", 5 },
+	{ L"j\x00fan", 6 },
+	{ L"j\x00fal", 7 },
+	{ L"\x00e1g", 8 },
+	{ L"n\x00f3v", 11 },
+	{ L"des", 12 },
+
+	//Lithuanian
+	{ L"sau", 1 },
+	{ L"vas", 2 },
+	{ L"kov", 3 },
+	{ L"bal", 4 },
+	{ L"geg", 5 },
+	{ L"bir", 6 },
+	{ L"lie", 7 },
+	{ L"rgp", 8 },
+	{ L"rgs", 9 },
+	{ L"spa", 10 },
+	{ L"lap", 11 },
+	{ L"grd", 12 },
+
+	// Hungarian
+	{ L"szept", 9 },
+
+	//There are more languages and thus month
+	//names, but as long as nobody reports a
+	//problem, I won't add them, there are way
+	//too many languages
+};
+constexpr size_t month_names_count = sizeof(month_names) / sizeof(*month_names);
+
+constexpr size_t month_table_size = 4096;
+
+struct month_slot final
+{
+	uint16_t name{};
+	uint8_t name_len{};
+	uint8_t suffix_len{};
+	char suffix[2]{};
+	int8_t month{}; // 0 if unused
+};
+
+struct month_table final
+{
+	month_slot slots[month_table_size]{};
+	size_t max_probes{};
+};
+
+constexpr size_t month_name_length(wchar_t const* name)
+{
+	size_t len{};
+	while (name[len]) {
+		++len;
+	}
+	return len;
+}
+
+constexpr wchar_t month_slot_char(month_slot const& slot, size_t i)
+{
+	return (i < slot.name_len) ? month_names[slot.name].name[i] : static_cast<wchar_t>(slot.suffix[i - slot.name_len]);
+}
+
+constexpr uint32_t month_hash_init = 2166136261u;
+
+constexpr uint32_t month_hash_step(uint32_t hash, wchar_t c)
+{
+	return (hash ^ static_cast<uint32_t>(c)) * 16777619u;
+}
+
+constexpr size_t month_slot_hash(month_slot const& slot)
+{
+	uint32_t hash = month_hash_init;
+	for (size_t i = 0; i < slot.name_len + slot.suffix_len; ++i) {
+		hash = month_hash_step(hash, month_slot_char(slot, i));
+	}
+	return hash % month_table_size;
+}
 
-		if (it == cache.end() || !(*it == v)) {
-			it = cache.emplace(it, v);
+constexpr bool month_slot_equal(month_slot const& a, month_slot const& b)
+{
+	if (a.name_len + a.suffix_len != b.name_len + b.suffix_len) {
+		return false;
+	}
+	for (size_t i = 0; i < a.name_len + a.suffix_len; ++i) {
+		if (month_slot_char(a, i) != month_slot_char(b, i)) {
+			return false;
 		}
-		return *it;
 	}
+	return true;
+}
 
-	// Vector coupled with binary search and sorted insertion is fastest
-	// alternative as we expect a relatively low amount of inserts.
-	// Note that we cannot use set, as it it cannot search based on a different type.
-	std::vector<fz::shared_value<std::wstring>> cache;
-};
+constexpr bool month_name_less(size_t a, size_t b)
+{
+	wchar_t const* x = month_names[a].name;
+	wchar_t const* y = month_names[b].name;
+	while (*x && *x == *y) {
+		++x;
+		++y;
+	}
+	return *x < *y;
+}
+
+constexpr void month_table_insert(month_table & table, month_slot const& slot)
+{
+	size_t pos = month_slot_hash(slot);
+	for (size_t probes = 1; ; ++probes, pos = (pos + 1) % month_table_size) {
+		auto & existing = table.slots[pos];
+		if (!existing.month) {
+			existing = slot;
+			table.max_probes = std::max(table.max_probes, probes);
+			return;
+		}
+		if (month_slot_equal(existing, slot)) {
+			// Plain names take precedence over combinations. Between
+			// combinations, the one of the greater name wins.
+			if (slot.suffix_len && (!existing.suffix_len || !month_name_less(existing.name, slot.name))) {
+				return;
+			}
+			existing = slot;
+			return;
+		}
+	}
+}
+
+constexpr month_slot make_month_slot(size_t name, int suffix)
+{
+	month_slot slot;
+	slot.name = static_cast<uint16_t>(name);
+	slot.name_len = static_cast<uint8_t>(month_name_length(month_names[name].name));
+	slot.month = static_cast<int8_t>(month_names[name].month);
+	if (suffix >= 10) {
+		slot.suffix[slot.suffix_len++] = static_cast<char>('0' + suffix / 10);
+	}
+	if (suffix >= 0) {
+		slot.suffix[slot.suffix_len++] = static_cast<char>('0' + suffix % 10);
+	}
+	return slot;
+}
+
+constexpr month_slot make_month_slot_padded(size_t name, int suffix)
+{
+	month_slot slot = make_month_slot(name, suffix);
+	if (suffix < 10) {
+		slot.suffix[1] = slot.suffix[0];
+		slot.suffix[0] = '0';
+		slot.suffix_len = 2;
+	}
+	return slot;
+}
+
+constexpr month_table make_month_table()
+{
+	month_table table;
+	for (size_t i = 0; i < month_names_count; ++i) {
+		month_table_insert(table, make_month_slot(i, -1));
+	}
+	for (size_t i = 0; i < month_names_count; ++i) {
+		// January could be 1 or 0, depends how the server counts
+		int const month = month_names[i].month;
+		month_table_insert(table, make_month_slot_padded(i, month));
+		month_table_insert(table, make_month_slot_padded(i, month - 1));
+		month_table_insert(table, make_month_slot(i, month % 10));
+		month_table_insert(table, make_month_slot(i, (month - 1) % 10));
+	}
+	return table;
+}
 
+constexpr month_table month_lookup_table = make_month_table();
+static_assert(month_lookup_table.max_probes <= 4, "Month name table too crowded");
 
-ObjectCache objcache;
+// Returns the offset of the first CR, LF or NUL in [p, p + len), or len if there is none.
+// Large listings spend most of their time here, so scan 16 bytes at a time where possible.
+int FindLineBreak(char const* p, int len)
+{
+	int i = 0;
+#ifdef FZ_LISTING_SSE2
+	__m128i const cr = _mm_set1_epi8('\r');
+	__m128i const lf = _mm_set1_epi8('\n');
+	__m128i const nul = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16) {
+		__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+		__m128i const m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)), _mm_cmpeq_epi8(v, nul));
+		unsigned int const mask = static_cast<unsigned int>(_mm_movemask_epi8(m));
+		if (mask) {
+#ifdef _MSC_VER
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return i + static_cast<int>(bit);
+#else
+			return i + __builtin_ctz(mask);
+#endif
+		}
+	}
+#elif defined(FZ_LISTING_NEON)
+	uint8x16_t const cr = vdupq_n_u8('\r');
+	uint8x16_t const lf = vdupq_n_u8('\n');
+	uint8x16_t const nul = vdupq_n_u8(0);
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const*>(p + i));
+		uint8x16_t const m = vorrq_u8(vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf)), vceqq_u8(v, nul));
+		if (vmaxvq_u8(m)) {
+			// Found in this block, the scalar loop below locates it
+			break;
+		}
+	}
+#endif
+	for (; i < len; ++i) {
+		char const c = p[i];
+		if (c == '\n' || c == '\r' || !c) {
+			break;
+		}
+	}
+	return i;
+}
 }
 
 class CToken final
@@ -101,6 +479,16 @@ public:
 		}
 	}
 
+	std::wstring_view GetView() const
+	{
+		if (!m_pToken || !m_len) {
+			return std::wstring_view();
+		}
+		else {
+			return std::wstring_view(m_pToken, m_len);
+		}
+	}
+
 	bool IsNumeric(t_numberBase base = decimal)
 	{
 		switch (base)
@@ -301,12 +689,17 @@ protected:
 	unsigned char flags_{};
 };
 
+// Lines and their tokens live in one of the parser's arenas, the line
+// itself does not own the text it refers to.
 class CLine final
 {
 public:
-	CLine(std::wstring && line, size_t trailing_whitespace = std::string::npos)
-		: trailing_whitespace_(trailing_whitespace)
+	CLine(std::wstring_view line, CArena & arena, size_t trailing_whitespace = std::string::npos)
+		: m_Tokens(CArenaAllocator<CToken>(arena))
+		, m_LineEndTokens(CArenaAllocator<CToken>(arena))
+		, trailing_whitespace_(trailing_whitespace)
 		, line_(line)
+		, arena_(arena)
 	{
 		m_Tokens.reserve(10);
 		m_LineEndTokens.reserve(10);
@@ -328,7 +721,7 @@ public:
 		size_t start = m_parsePos;
 		while (m_parsePos < line_.size()) {
 			if (line_[m_parsePos] == ' ' || line_[m_parsePos] == '\t') {
-				m_Tokens.emplace_back(line_.c_str() + start, m_parsePos - start);
+				m_Tokens.emplace_back(line_.data() + start, m_parsePos - start);
 
 				while (m_parsePos < line_.size() && (line_[m_parsePos] == ' ' || line_[m_parsePos] == '\t')) {
 					++m_parsePos;
@@ -343,7 +736,7 @@ public:
 			++m_parsePos;
 		}
 		if (m_parsePos != start) {
-			m_Tokens.emplace_back(line_.c_str() + start, m_parsePos - start);
+			m_Tokens.emplace_back(line_.data() + start, m_parsePos - start);
 		}
 
 		if (m_Tokens.size() > n) {
@@ -367,11 +760,11 @@ public:
 			}
 			wchar_t const* p = ref.GetToken() + ref.size() + 1;
 
-			if (static_cast<size_t>(p - line_.c_str()) >= line_.size()) {
+			if (static_cast<size_t>(p - line_.data()) >= line_.size()) {
 				return CToken();
 			}
 
-			auto newLen = line_.size() - (p - line_.c_str());
+			auto newLen = line_.size() - (p - line_.data());
 			return CToken(p, newLen);
 		}
 
@@ -397,15 +790,17 @@ public:
 		for (unsigned int i = static_cast<unsigned int>(m_LineEndTokens.size()); i <= n; ++i) {
 			CToken const& refToken = m_Tokens[i];
 			const wchar_t* p = refToken.GetToken();
-			if ((p - line_.c_str()) + trailing_whitespace_ >= line_.size()) {
+			if ((p - line_.data()) + trailing_whitespace_ >= line_.size()) {
 				return CToken();
 			}
-			auto newLen = line_.size() - (p - line_.c_str()) - trailing_whitespace_;
+			auto newLen = line_.size() - (p - line_.data()) - trailing_whitespace_;
 			m_LineEndTokens.emplace_back(p, newLen);
 		}
 		return m_LineEndTokens[n];
 	}
 
+	std::wstring_view text() const { return line_; }
+
 	bool GetToken(unsigned int n, CToken & token, bool to_end = false, bool include_whitespace = false)
 	{
 		if (to_end) {
@@ -417,248 +812,46 @@ public:
 		return token.operator bool();
 	}
 
+	// The result is placed in the arena of pLine
 	CLine *Concat(CLine const* pLine) const
 	{
-		std::wstring n;
-		n.reserve(line_.size() + pLine->line_.size() + 1);
-		n = line_;
-		n += ' ';
-		n += pLine->line_;
-		return new CLine(std::move(n), pLine->trailing_whitespace_);
+		size_t const len = line_.size() + pLine->line_.size() + 1;
+		wchar_t* n = pLine->arena_.allocate_array<wchar_t>(len);
+		std::copy(line_.cbegin(), line_.cend(), n);
+		n[line_.size()] = ' ';
+		std::copy(pLine->line_.cbegin(), pLine->line_.cend(), n + line_.size() + 1);
+
+		return Create(std::wstring_view(n, len), pLine->arena_, pLine->trailing_whitespace_);
+	}
+
+	static CLine* Create(std::wstring_view line, CArena & arena, size_t trailing_whitespace = std::string::npos)
+	{
+		void* p = arena.allocate(sizeof(CLine), alignof(CLine));
+		return new (p) CLine(line, arena, trailing_whitespace);
+	}
+
+	static void Destroy(CLine* line)
+	{
+		if (line) {
+			line->~CLine();
+		}
 	}
 
 protected:
-	std::vector<CToken> m_Tokens;
-	std::vector<CToken> m_LineEndTokens;
+	std::vector<CToken, CArenaAllocator<CToken>> m_Tokens;
+	std::vector<CToken, CArenaAllocator<CToken>> m_LineEndTokens;
 	size_t m_parsePos{};
 	size_t trailing_whitespace_;
-	std::wstring const line_;
+	std::wstring_view const line_;
+	CArena & arena_;
 };
 
 CDirectoryListingParser::CDirectoryListingParser(CControlSocket* pControlSocket, const CServer& server, listingEncoding::type encoding)
 	: m_pControlSocket(pControlSocket)
 	, m_server(server)
+	, logger_(pControlSocket ? &pControlSocket->logger() : nullptr)
 	, m_listingEncoding(encoding)
 {
-	if (m_MonthNamesMap.empty()) {
-		//Fill the month names map
-
-		//English month names
-		m_MonthNamesMap[L"jan"] = 1;
-		m_MonthNamesMap[L"feb"] = 2;
-		m_MonthNamesMap[L"mar"] = 3;
-		m_MonthNamesMap[L"apr"] = 4;
-		m_MonthNamesMap[L"may"] = 5;
-		m_MonthNamesMap[L"jun"] = 6;
-		m_MonthNamesMap[L"june"] = 6;
-		m_MonthNamesMap[L"jul"] = 7;
-		m_MonthNamesMap[L"july"] = 7;
-		m_MonthNamesMap[L"aug"] = 8;
-		m_MonthNamesMap[L"sep"] = 9;
-		m_MonthNamesMap[L"sept"] = 9;
-		m_MonthNamesMap[L"oct"] = 10;
-		m_MonthNamesMap[L"nov"] = 11;
-		m_MonthNamesMap[L"dec"] = 12;
-
-		//Numerical values for the month
-		m_MonthNamesMap[L"1"] = 1;
-		m_MonthNamesMap[L"01"] = 1;
-		m_MonthNamesMap[L"2"] = 2;
-		m_MonthNamesMap[L"02"] = 2;
-		m_MonthNamesMap[L"3"] = 3;
-		m_MonthNamesMap[L"03"] = 3;
-		m_MonthNamesMap[L"4"] = 4;
-		m_MonthNamesMap[L"04"] = 4;
-		m_MonthNamesMap[L"5"] = 5;
-		m_MonthNamesMap[L"05"] = 5;
-		m_MonthNamesMap[L"6"] = 6;
-		m_MonthNamesMap[L"06"] = 6;
-		m_MonthNamesMap[L"7"] = 7;
-		m_MonthNamesMap[L"07"] = 7;
-		m_MonthNamesMap[L"8"] = 8;
-		m_MonthNamesMap[L"08"] = 8;
-		m_MonthNamesMap[L"9"] = 9;
-		m_MonthNamesMap[L"09"] = 9;
-		m_MonthNamesMap[L"10"] = 10;
-		m_MonthNamesMap[L"11"] = 11;
-		m_MonthNamesMap[L"12"] = 12;
-
-		//German month names
-		m_MonthNamesMap[L"mrz"] = 3;
-		m_MonthNamesMap[L"m\xe4r"] = 3;
-		m_MonthNamesMap[L"m\xe4rz"] = 3;
-		m_MonthNamesMap[L"mai"] = 5;
-		m_MonthNamesMap[L"juni"] = 6;
-		m_MonthNamesMap[L"juli"] = 7;
-		m_MonthNamesMap[L"okt"] = 10;
-		m_MonthNamesMap[L"dez"] = 12;
-
-		//Austrian month names
-		m_MonthNamesMap[L"j\xe4n"] = 1;
-
-		//French month names
-		m_MonthNamesMap[L"janv"] = 1;
-		m_MonthNamesMap[L"f\xe9" L"b"] = 1;
-		m_MonthNamesMap[L"f\xe9v"] = 2;
-		m_MonthNamesMap[L"fev"] = 2;
-		m_MonthNamesMap[L"f\xe9vr"] = 2;
-		m_MonthNamesMap[L"fevr"] = 2;
-		m_MonthNamesMap[L"mars"] = 3;
-		m_MonthNamesMap[L"mrs"] = 3;
-		m_MonthNamesMap[L"avr"] = 4;
-		m_MonthNamesMap[L"avril"] = 4;
-		m_MonthNamesMap[L"juin"] = 6;
-		m_MonthNamesMap[L"juil"] = 7;
-		m_MonthNamesMap[L"jui"] = 7;
-		m_MonthNamesMap[L"ao\xfb"] = 8;
-		m_MonthNamesMap[L"ao\xfbt"] = 8;
-		m_MonthNamesMap[L"aout"] = 8;
-		m_MonthNamesMap[L"d\xe9" L"c"] = 12;
-		m_MonthNamesMap[L"dec"] = 12;
-
-		//Italian month names
-		m_MonthNamesMap[L"gen"] = 1;
-		m_MonthNamesMap[L"mag"] = 5;
-		m_MonthNamesMap[L"giu"] = 6;
-		m_MonthNamesMap[L"lug"] = 7;
-		m_MonthNamesMap[L"ago"] = 8;
-		m_MonthNamesMap[L"set"] = 9;
-		m_MonthNamesMap[L"ott"] = 10;
-		m_MonthNamesMap[L"dic"] = 12;
-
-		//Spanish month names
-		m_MonthNamesMap[L"ene"] = 1;
-		m_MonthNamesMap[L"fbro"] = 2;
-		m_MonthNamesMap[L"mzo"] = 3;
-		m_MonthNamesMap[L"ab"] = 4;
-		m_MonthNamesMap[L"abr"] = 4;
-		m_MonthNamesMap[L"agto"] = 8;
-		m_MonthNamesMap[L"sbre"] = 9;
-		m_MonthNamesMap[L"obre"] = 9;
-		m_MonthNamesMap[L"nbre"] = 9;
-		m_MonthNamesMap[L"dbre"] = 9;
-
-		//Polish month names
-		m_MonthNamesMap[L"sty"] = 1;
-		m_MonthNamesMap[L"lut"] = 2;
-		m_MonthNamesMap[L"kwi"] = 4;
-		m_MonthNamesMap[L"maj"] = 5;
-		m_MonthNamesMap[L"cze"] = 6;
-		m_MonthNamesMap[L"lip"] = 7;
-		m_MonthNamesMap[L"sie"] = 8;
-		m_MonthNamesMap[L"wrz"] = 9;
-		m_MonthNamesMap[L"pa\x9f"] = 10;
-		m_MonthNamesMap[L"pa\xbc"] = 10; // ISO-8859-2
-		m_MonthNamesMap[L"paz"] = 10; // ASCII
-		m_MonthNamesMap[L"pa\xc5\xba"] = 10; // UTF-8
-		m_MonthNamesMap[L"pa\x017a"] = 10; // some servers send this
-		m_MonthNamesMap[L"lis"] = 11;
-		m_MonthNamesMap[L"gru"] = 12;
-
-		//Russian month names
-		m_MonthNamesMap[L"\xff\xed\xe2"] = 1;
-		m_MonthNamesMap[L"\xf4\xe5\xe2"] = 2;
-		m_MonthNamesMap[L"\xec\xe0\xf0"] = 3;
-		m_MonthNamesMap[L"\xe0\xef\xf0"] = 4;
-		m_MonthNamesMap[L"\xec\xe0\xe9"] = 5;
-		m_MonthNamesMap[L"\xe8\xfe\xed"] = 6;
-		m_MonthNamesMap[L"\xe8\xfe\xeb"] = 7;
-		m_MonthNamesMap[L"\xe0\xe2\xe3"] = 8;
-		m_MonthNamesMap[L"\xf1\xe5\xed"] = 9;
-		m_MonthNamesMap[L"\xee\xea\xf2"] = 10;
-		m_MonthNamesMap[L"\xed\xee\xff"] = 11;
-		m_MonthNamesMap[L"\xe4\xe5\xea"] = 12;
-
-		//Dutch month names
-		m_MonthNamesMap[L"mrt"] = 3;
-		m_MonthNamesMap[L"mei"] = 5;
-
-		//Portuguese month names
-		m_MonthNamesMap[L"out"] = 10;
-
-		//Finnish month names
-		m_MonthNamesMap[L"tammi"] = 1;
-		m_MonthNamesMap[L"helmi"] = 2;
-		m_MonthNamesMap[L"maalis"] = 3;
-		m_MonthNamesMap[L"huhti"] = 4;
-		m_MonthNamesMap[L"touko"] = 5;
-		m_MonthNamesMap[L"kes\xe4"] = 6;
-		m_MonthNamesMap[L"hein\xe4"] = 7;
-		m_MonthNamesMap[L"elo"] = 8;
-		m_MonthNamesMap[L"syys"] = 9;
-		m_MonthNamesMap[L"loka"] = 10;
-		m_MonthNamesMap[L"marras"] = 11;
-		m_MonthNamesMap[L"joulu"] = 12;
-
-		//Slovenian month names
-		m_MonthNamesMap[L"avg"] = 8;
-
-		//Icelandic
-		m_MonthNamesMap[L"ma\x00ed"] = 5;
-		m_MonthNamesMap[L"j\x00fan"] = 6;
-		m_MonthNamesMap[L"j\x00fal"] = 7;
-		m_MonthNamesMap[L"\x00e1g"] = 8;
-		m_MonthNamesMap[L"n\x00f3v"] = 11;
-		m_MonthNamesMap[L"des"] = 12;
-
-		//Lithuanian
-		m_MonthNamesMap[L"sau"] = 1;
-		m_MonthNamesMap[L"vas"] = 2;
-		m_MonthNamesMap[L"kov"] = 3;
-		m_MonthNamesMap[L"bal"] = 4;
-		m_MonthNamesMap[L"geg"] = 5;
-		m_MonthNamesMap[L"bir"] = 6;
-		m_MonthNamesMap[L"lie"] = 7;
-		m_MonthNamesMap[L"rgp"] = 8;
-		m_MonthNamesMap[L"rgs"] = 9;
-		m_MonthNamesMap[L"spa"] = 10;
-		m_MonthNamesMap[L"lap"] = 11;
-		m_MonthNamesMap[L"grd"] = 12;
-
-		// Hungarian
-		m_MonthNamesMap[L"szept"] = 9;
-
-		//There are more languages and thus month
-		//names, but as long as nobody reports a
-		//problem, I won't add them, there are way
-		//too many languages
-
-		// Some servers send a combination of month name and number,
-		// Add corresponding numbers to the month names.
-		std::map<std::wstring, int> combo;
-		for (auto iter = m_MonthNamesMap.begin(); iter != m_MonthNamesMap.end(); ++iter) {
-			// January could be 1 or 0, depends how the server counts
-			combo[fz::sprintf(L"%s%02d", iter->first, iter->second)] = iter->second;
-			combo[fz::sprintf(L"%s%02d", iter->first, iter->second - 1)] = iter->second;
-			if (iter->second < 10) {
-				combo[fz::sprintf(L"%s%d", iter->first, iter->second)] = iter->second;
-			}
-			else {
-				combo[fz::sprintf(L"%s%d", iter->first, iter->second % 10)] = iter->second;
-			}
-			if (iter->second <= 10) {
-				combo[fz::sprintf(L"%s%d", iter->first, iter->second - 1)] = iter->second;
-			}
-			else {
-				combo[fz::sprintf(L"%s%d", iter->first, (iter->second - 1) % 10)] = iter->second;
-			}
-		}
-		m_MonthNamesMap.insert(combo.begin(), combo.end());
-
-		m_MonthNamesMap[L"1"] = 1;
-		m_MonthNamesMap[L"2"] = 2;
-		m_MonthNamesMap[L"3"] = 3;
-		m_MonthNamesMap[L"4"] = 4;
-		m_MonthNamesMap[L"5"] = 5;
-		m_MonthNamesMap[L"6"] = 6;
-		m_MonthNamesMap[L"7"] = 7;
-		m_MonthNamesMap[L"8"] = 8;
-		m_MonthNamesMap[L"9"] = 9;
-		m_MonthNamesMap[L"10"] = 10;
-		m_MonthNamesMap[L"11"] = 11;
-		m_MonthNamesMap[L"12"] = 12;
-	}
-
 #ifdef LISTDEBUG
 	for (unsigned int i = 0; data[i][0]; ++i) {
 		unsigned int len = (unsigned int)strlen(data[i]);
@@ -670,46 +863,73 @@ CDirectoryListingParser::CDirectoryListingParser(CControlSocket* pControlSocket,
 #endif
 }
 
+struct CDirectoryListingParser::PipelineJob final
+{
+	std::unique_ptr<CDirectoryListingParser> parser;
+	fz::async_task task;
+	std::vector<fz::shared_value<CDirentry>> entries;
+	size_t parsedLines{};
+	std::vector<unparsed_line> unparsed;
+	bool failed{};
+	std::atomic<bool> done{};
+};
+
 CDirectoryListingParser::~CDirectoryListingParser()
 {
-	for (auto iter = m_DataList.begin(); iter != m_DataList.end(); ++iter) {
-		delete [] iter->p;
+	CancelPipelineJobs();
+
+	for (auto & data : m_DataList) {
+		delete [] data.p;
+	}
+	delete [] fillBuffer_;
+	for (auto * p : freeBuffers_) {
+		delete [] p;
+	}
+
+	CLine::Destroy(m_prevLine);
+}
+
+void CDirectoryListingParser::ReleaseBuffer(t_list & data)
+{
+	if (data.capacity == listing_buffer_size && freeBuffers_.size() < max_free_listing_buffers) {
+		freeBuffers_.push_back(data.p);
 	}
+	else {
+		delete [] data.p;
+	}
+	data.p = nullptr;
+}
 
-	delete m_prevLine;
+CArena& CDirectoryListingParser::NextLineArena()
+{
+	// Use the arena not holding the previous line, nothing else in it is alive.
+	currentArena_ = m_prevLine ? 1 - prevLineArena_ : 0;
+	CArena & arena = arenas_[currentArena_];
+	arena.rewind();
+	return arena;
 }
 
 bool CDirectoryListingParser::ParseData(bool partial)
 {
-	DeduceEncoding();
+	if (!DeduceEncoding(partial)) {
+		// Not enough data yet
+		return true;
+	}
 
 	bool error = false;
 	CLine *pLine = GetLine(partial, error);
 	while (pLine) {
-		bool res = ParseLine(*pLine, m_server.GetType(), false);
-		if (!res) {
-			if (m_prevLine) {
-				CLine* pConcatenatedLine = m_prevLine->Concat(pLine);
-				res = ParseLine(*pConcatenatedLine, m_server.GetType(), true);
-				delete pConcatenatedLine;
-				delete m_prevLine;
-
-				if (res) {
-					delete pLine;
-					m_prevLine = nullptr;
-				}
-				else {
-					m_prevLine = pLine;
-				}
+		if (pipelineJob_) {
+			if (ParseLine(*pLine, m_server.GetType(), false)) {
+				++parsedLines_;
 			}
 			else {
-				m_prevLine = pLine;
+				unparsed_.push_back({parsedLines_, entries_.size(), std::wstring(pLine->text())});
 			}
+			CLine::Destroy(pLine);
 		}
 		else {
-			delete m_prevLine;
-			m_prevLine = nullptr;
-			delete pLine;
+			ParseNextLine(pLine);
 		}
 		pLine = GetLine(partial, error);
 	};
@@ -717,13 +937,44 @@ bool CDirectoryListingParser::ParseData(bool partial)
 	return !error;
 }
 
+void CDirectoryListingParser::ParseNextLine(CLine* pLine)
+{
+	bool res = ParseLine(*pLine, m_server.GetType(), false);
+	if (!res) {
+		if (m_prevLine) {
+			CLine* pConcatenatedLine = m_prevLine->Concat(pLine);
+			res = ParseLine(*pConcatenatedLine, m_server.GetType(), true);
+			CLine::Destroy(pConcatenatedLine);
+			CLine::Destroy(m_prevLine);
+
+			if (res) {
+				CLine::Destroy(pLine);
+				m_prevLine = nullptr;
+			}
+			else {
+				m_prevLine = pLine;
+				prevLineArena_ = currentArena_;
+			}
+		}
+		else {
+			m_prevLine = pLine;
+			prevLineArena_ = currentArena_;
+		}
+	}
+	else {
+		CLine::Destroy(m_prevLine);
+		m_prevLine = nullptr;
+		CLine::Destroy(pLine);
+	}
+}
+
 CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
 {
 	CDirectoryListing listing;
 	listing.path = path;
 	listing.m_firstListTime = fz::monotonic_clock::now();
 
-	if (!ParseData(false)) {
+	if (!CollectPipelineJobs(true) || !ParseData(false)) {
 		listing.m_flags |= CDirectoryListing::listing_failed;
 		return listing;
 	}
@@ -746,95 +997,99 @@ CDirectoryListing CDirectoryListingParser::Parse(const CServerPath &path)
 	return listing;
 }
 
+int CDirectoryListingParser::ParseAs(listingFormat::type format, CLine &line, CDirentry &entry)
+{
+	switch (format) {
+	case listingFormat::zvm:
+		return ParseAsZVM(line, entry) ? 1 : 0;
+	case listingFormat::hpnonstop:
+		return ParseAsHPNonstop(line, entry) ? 1 : 0;
+	case listingFormat::mlsd:
+		return ParseAsMlsd(line, entry);
+	case listingFormat::unix_ls:
+		return ParseAsUnix(line, entry, true) ? 1 : 0; // Common 'ls -l'
+	case listingFormat::dos:
+		return ParseAsDos(line, entry) ? 1 : 0;
+	case listingFormat::eplf:
+		return ParseAsEplf(line, entry) ? 1 : 0;
+	case listingFormat::vms:
+		return ParseAsVms(line, entry) ? 1 : 0;
+	case listingFormat::other:
+		return ParseOther(line, entry) ? 1 : 0;
+	case listingFormat::ibm:
+		return ParseAsIbm(line, entry) ? 1 : 0;
+	case listingFormat::wfftp:
+		return ParseAsWfFtp(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs:
+		return ParseAsIBM_MVS(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_pds:
+		return ParseAsIBM_MVS_PDS(line, entry) ? 1 : 0;
+	case listingFormat::os9:
+		return ParseAsOS9(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_migrated:
+		return ParseAsIBM_MVS_Migrated(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_pds2:
+		return ParseAsIBM_MVS_PDS2(line, entry) ? 1 : 0;
+	case listingFormat::ibm_mvs_tape:
+		return ParseAsIBM_MVS_Tape(line, entry) ? 1 : 0;
+	case listingFormat::unix_nodate:
+		return ParseAsUnix(line, entry, false) ? 1 : 0; // 'ls -l' but without the date/time
+	default:
+		break;
+	}
+	return 0;
+}
+
 bool CDirectoryListingParser::ParseLine(CLine &line, ServerType const serverType, bool concatenated, CDirentry const* override)
 {
 	fz::shared_value<CDirentry> refEntry;
 	CDirentry & entry = refEntry.get();
 
-	bool res;
-	int ires;
-
-	if (serverType == ZVM) {
-		res = ParseAsZVM(line, entry);
-		if (res) {
-			goto done;
+	// Listings rarely mix formats, try the last successful one first.
+	// This changes the precedence between formats: while locked, a line the
+	// locked format accepts is parsed as such, even if a format earlier in
+	// the probe order would accept it as well. Only lines the locked format
+	// rejects get probed in the usual order.
+	int res = 0;
+	if (m_format != listingFormat::unknown) {
+		res = ParseAs(m_format, line, entry);
+	}
+	for (int i = listingFormat::unknown + 1; !res && i < listingFormat::count; ++i) {
+		auto const format = static_cast<listingFormat::type>(i);
+		if (format == m_format) {
+			continue;
 		}
-	}
-	else if (serverType == HPNONSTOP) {
-		res = ParseAsHPNonstop(line, entry);
-		if (res) {
-			goto done;
+		if (format == listingFormat::zvm && serverType != ZVM) {
+			continue;
 		}
-	}
-
-	ires = ParseAsMlsd(line, entry);
-	if (ires == 1) {
-		goto done;
-	}
-	else if (ires == 2) {
-		goto skip;
-	}
-	res = ParseAsUnix(line, entry, true); // Common 'ls -l'
-	if (res) {
-		goto done;
-	}
-	res = ParseAsDos(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsEplf(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsVms(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseOther(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsIbm(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsWfFtp(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsIBM_MVS(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsIBM_MVS_PDS(line, entry);
-	if (res) {
-		goto done;
-	}
-	res = ParseAsOS9(line, entry);
-	if (res) {
-		goto done;
-	}
-#ifndef LISTDEBUG_MVS
-	if (serverType == MVS)
-#endif //LISTDEBUG_MVS
-	{
-		res = ParseAsIBM_MVS_Migrated(line, entry);
-		if (res) {
-			goto done;
+		if (format == listingFormat::hpnonstop && serverType != HPNONSTOP) {
+			continue;
 		}
-		res = ParseAsIBM_MVS_PDS2(line, entry);
-		if (res) {
-			goto done;
+#ifndef LISTDEBUG_MVS
+		if ((format == listingFormat::ibm_mvs_migrated || format == listingFormat::ibm_mvs_pds2 || format == listingFormat::ibm_mvs_tape) && serverType != MVS) {
+			continue;
 		}
-		res = ParseAsIBM_MVS_Tape(line, entry);
+#endif //LISTDEBUG_MVS
+
+		res = ParseAs(format, line, entry);
 		if (res) {
-			goto done;
+			if (m_format == listingFormat::unknown && !m_mixedFormats) {
+				m_format = format;
+			}
+			else {
+				// Listing mixes formats. Go back to probing all formats in
+				// order for each line so that their precedence is retained.
+				m_format = listingFormat::unknown;
+				m_mixedFormats = true;
+			}
 		}
 	}
-	res = ParseAsUnix(line, entry, false); // 'ls -l' but without the date/time
-	if (res) {
+	if (res == 1) {
 		goto done;
 	}
+	else if (res == 2) {
+		goto skip;
+	}
 
 	// Some servers just send a list of filenames. If a line could not be parsed,
 	// check if it's a filename. If that's the case, store it for later, else clear
@@ -928,7 +1183,7 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 		return false;
 	}
 
-	std::wstring permissions = permissionToken.GetString();
+	std::wstring_view permissions = permissionToken.GetView();
 
 	entry.flags = 0;
 
@@ -942,12 +1197,14 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 
 	// Check for netware servers, which split the permissions into two parts
 	bool netware = false;
+	std::wstring netwarePermissions;
 	if (permissionToken.size() == 1) {
 		CToken cont_perm = line.GetToken(++index);
 		if (!cont_perm) {
 			return false;
 		}
-		permissions += L" " + cont_perm.GetString();
+		netwarePermissions = permissionToken.GetString() + L" " + cont_perm.GetString();
+		permissions = netwarePermissions;
 		netware = true;
 	}
 
@@ -966,11 +1223,12 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 
 	// Repeat until numOwnerGroup is 0 since not all servers send every possible field
 	int startindex = index;
+	std::wstring ownerGroup;
 	do {
 		// Reset index
 		index = startindex;
 
-		std::wstring ownerGroup;
+		ownerGroup.clear();
 		for (int i = 0; i < numOwnerGroup; ++i) {
 			CToken ownerGroupToken = line.GetToken(++index);
 			if (!ownerGroupToken) {
@@ -979,7 +1237,7 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 			if (i) {
 				ownerGroup += L" ";
 			}
-			ownerGroup += ownerGroupToken.GetString();
+			ownerGroup += ownerGroupToken.GetView();
 		}
 
 
@@ -1044,8 +1302,8 @@ bool CDirectoryListingParser::ParseAsUnix(CLine &line, CDirentry &entry, bool ex
 
 		entry.time += m_timezoneOffset;
 
-		entry.permissions = objcache.get(permissions);
-		entry.ownerGroup = objcache.get(ownerGroup);
+		entry.permissions = stringPool_.get(permissions);
+		entry.ownerGroup = stringPool_.get(ownerGroup);
 		return true;
 	}
 	while (numOwnerGroup--);
@@ -1339,7 +1597,7 @@ bool CDirectoryListingParser::ParseShortDate(CToken &token, CDirentry &entry, bo
 		// Seems to be monthname-dd-yy
 
 		// Check month name
-		std::wstring const dateMonth = token.GetString().substr(0, pos);
+		std::wstring_view const dateMonth = token.GetView().substr(0, pos);
 		if (!GetMonthFromName(dateMonth, month)) {
 			return false;
 		}
@@ -1427,7 +1685,7 @@ bool CDirectoryListingParser::ParseShortDate(CToken &token, CDirentry &entry, bo
 	if (gotYear || gotDay) {
 		// Month field in yyyy-mm-dd or dd-mm-yyyy
 		// Check month name
-		std::wstring dateMonth = token.GetString().substr(pos + 1, pos2 - pos - 1);
+		std::wstring_view const dateMonth = token.GetView().substr(pos + 1, pos2 - pos - 1);
 		if (!GetMonthFromName(dateMonth, month)) {
 			return false;
 		}
@@ -1542,7 +1800,7 @@ bool CDirectoryListingParser::ParseAsDos(CLine &line, CDirentry &entry)
 	entry.name = token.GetString();
 
 	entry.target.clear();
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -1657,8 +1915,8 @@ bool CDirectoryListingParser::ParseAsEplf(CLine &line, CDirentry &entry)
 		fact += len + 1;
 	}
 
-	entry.permissions = objcache.get(permissions);
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.permissions = stringPool_.get(permissions);
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	return true;
 }
 
@@ -1821,8 +2079,8 @@ bool CDirectoryListingParser::ParseAsVms(CLine &line, CDirentry &entry)
 			ownerGroup += token.GetString();
 		}
 	}
-	entry.permissions = objcache.get(permissions);
-	entry.ownerGroup = objcache.get(ownerGroup);
+	entry.permissions = stringPool_.get(permissions);
+	entry.ownerGroup = stringPool_.get(ownerGroup);
 
 	entry.time += m_timezoneOffset;
 
@@ -1874,8 +2132,8 @@ bool CDirectoryListingParser::ParseAsIbm(CLine &line, CDirentry &entry)
 		entry.flags |= CDirentry::flag_dir;
 	}
 
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(ownerGroupToken.GetView());
+	entry.permissions = stringPool_.get(std::wstring_view());
 
 	entry.time += m_timezoneOffset;
 
@@ -1949,8 +2207,8 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 		entry.name = token.GetString();
 		entry.target.clear();
 
-		entry.permissions = objcache.get(firstToken.GetString());
-		entry.ownerGroup = objcache.get(ownerGroup);
+		entry.permissions = stringPool_.get(firstToken.GetView());
+		entry.ownerGroup = stringPool_.get(ownerGroup);
 	}
 	else {
 		// Possible conflict with multiline VMS listings
@@ -1962,9 +2220,8 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 		entry.size = firstToken.GetNumber();
 
 		// Get date
-		std::wstring dateMonth = token.GetString();
 		int month = 0;
-		if (!GetMonthFromName(dateMonth, month)) {
+		if (!GetMonthFromName(token.GetView(), month)) {
 			// OS/2 or nortel.VxWorks
 			int skippedCount = 0;
 			do {
@@ -2070,7 +2327,7 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 			}
 		}
 		entry.target.clear();
-		entry.ownerGroup = objcache.get(std::wstring());
+		entry.ownerGroup = stringPool_.get(std::wstring_view());
 		entry.permissions = entry.ownerGroup;
 		entry.time += m_timezoneOffset;
 	}
@@ -2078,18 +2335,82 @@ bool CDirectoryListingParser::ParseOther(CLine &line, CDirentry &entry)
 	return true;
 }
 
+char* CDirectoryListingParser::GetBuffer(int & len)
+{
+	if (!m_DataList.empty()) {
+		auto & back = m_DataList.back();
+		if (back.capacity - back.len >= min_listing_read) {
+			len = back.capacity - back.len;
+			return back.p + back.len;
+		}
+	}
+
+	if (!fillBuffer_) {
+		if (!freeBuffers_.empty()) {
+			fillBuffer_ = freeBuffers_.back();
+			freeBuffers_.pop_back();
+		}
+		else {
+			fillBuffer_ = new char[listing_buffer_size];
+		}
+	}
+	len = listing_buffer_size;
+	return fillBuffer_;
+}
+
+bool CDirectoryListingParser::AddData(int len)
+{
+	assert(len > 0);
+
+	// Only non-empty buffers go into the chain
+	if (fillBuffer_) {
+		m_DataList.emplace_back(fillBuffer_, 0, listing_buffer_size);
+		fillBuffer_ = nullptr;
+	}
+
+	auto & back = m_DataList.back();
+	assert(back.capacity - back.len >= len);
+	ConvertEncoding(back.p + back.len, len);
+	back.len += len;
+
+	return OnData(len);
+}
+
 bool CDirectoryListingParser::AddData(char *pData, int len)
 {
 	ConvertEncoding(pData, len);
 
-	m_DataList.emplace_back(pData, len);
+	m_DataList.emplace_back(pData, len, len);
+
+	return OnData(len);
+}
+
+bool CDirectoryListingParser::OnData(int len)
+{
 	m_totalData += len;
 
+	if (pool_) {
+		pipelineData_ += len;
+		if (pipelineData_ >= 1024 * 1024) {
+			DispatchPipelineJob();
+		}
+		if (!CollectPipelineJobs(false)) {
+			return false;
+		}
+		SendProgress();
+		return true;
+	}
+
 	if (m_totalData < 512) {
 		return true;
 	}
 
-	return ParseData(true);
+	if (!ParseData(true)) {
+		return false;
+	}
+
+	SendProgress();
+	return true;
 }
 
 bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time)
@@ -2101,12 +2422,181 @@ bool CDirectoryListingParser::AddLine(std::wstring && line, std::wstring && name
 	CDirentry override;
 	override.name = std::move(name);
 	override.time = time;
-	CLine l(std::move(line));
+	CLine l(line, NextLineArena());
 	ParseLine(l, m_server.GetType(), true, &override);
 
+	SendProgress();
+	return true;
+}
+
+void CDirectoryListingParser::AddEntry(CDirentry && entry, std::wstring_view const& permissions, std::wstring_view const& ownerGroup)
+{
+	if (entry.name == L"." || entry.name == L"..") {
+		return;
+	}
+
+	entry.permissions = stringPool_.get(permissions);
+	entry.ownerGroup = stringPool_.get(ownerGroup);
+
+	auto const timezoneOffset = m_server.GetTimezoneOffset();
+	if (timezoneOffset) {
+		entry.time += fz::duration::from_minutes(timezoneOffset);
+	}
+
+	entries_.emplace_back(std::move(entry));
+
+	SendProgress();
+}
+
+void CDirectoryListingParser::DispatchPipelineJob()
+{
+	// In pipelined mode nothing gets parsed here before Parse is called,
+	// m_currentOffset only marks what previous jobs have taken from the
+	// first buffer.
+
+	// Decided once from the start of the listing, the jobs only get
+	// converted data. Has to come first, converting affects line breaks.
+	DeduceEncoding(false);
+
+	// Everything up to the last line break can be parsed on its own
+	size_t cut{};
+	size_t remaining = pipelineData_;
+	for (auto it = m_DataList.crbegin(); it != m_DataList.crend() && !cut; ++it) {
+		int const start = (it + 1 == m_DataList.crend()) ? m_currentOffset : 0;
+		remaining -= it->len - start;
+		for (int i = it->len - 1; i >= start; --i) {
+			if (it->p[i] == '\n' || it->p[i] == '\r') {
+				cut = remaining + (i - start) + 1;
+				break;
+			}
+		}
+	}
+	if (!cut) {
+		return;
+	}
+
+	char* buffer = new char[cut];
+	size_t pos{};
+	while (pos < cut) {
+		auto & front = m_DataList.front();
+		size_t const avail = static_cast<size_t>(front.len - m_currentOffset);
+		size_t const copy = std::min(avail, cut - pos);
+		memcpy(buffer + pos, front.p + m_currentOffset, copy);
+		pos += copy;
+		if (copy == avail) {
+			ReleaseBuffer(front);
+			m_DataList.pop_front();
+			m_currentOffset = 0;
+		}
+		else {
+			m_currentOffset += static_cast<int>(copy);
+		}
+	}
+	pipelineData_ -= cut;
+
+	auto job = std::make_unique<PipelineJob>();
+	job->parser = std::make_unique<CDirectoryListingParser>(nullptr, m_server, m_listingEncoding);
+	job->parser->SetTimezoneOffset(m_timezoneOffset);
+	job->parser->logger_ = logger_;
+	job->parser->pipelineJob_ = true;
+	job->parser->m_DataList.emplace_back(buffer, static_cast<int>(cut), static_cast<int>(cut));
+
+	PipelineJob* p = job.get();
+	auto const run = [p]() {
+		p->failed = !p->parser->ParseData(false);
+		p->entries = std::move(p->parser->entries_);
+		p->parsedLines = p->parser->parsedLines_;
+		p->unparsed = std::move(p->parser->unparsed_);
+		p->parser.reset();
+		p->done = true;
+	};
+	job->task = pool_->spawn(run);
+	if (!job->task) {
+		run();
+	}
+	jobs_.emplace_back(std::move(job));
+}
+
+bool CDirectoryListingParser::CollectPipelineJobs(bool wait)
+{
+	// Merge results in order of the data they were given
+	while (!jobs_.empty()) {
+		auto & job = *jobs_.front();
+		if (!job.done) {
+			if (!wait) {
+				break;
+			}
+			job.task.join();
+		}
+
+		size_t parsed{};
+		size_t merged{};
+		auto const merge = [&](size_t parsedBefore, size_t entriesBefore) {
+			if (parsedBefore > parsed) {
+				// As after any line that parsed on its own
+				CLine::Destroy(m_prevLine);
+				m_prevLine = nullptr;
+				m_maybeMultilineVms = false;
+				m_fileList.clear();
+				m_fileListOnly = false;
+			}
+			entries_.insert(entries_.end(), std::make_move_iterator(job.entries.begin() + merged), std::make_move_iterator(job.entries.begin() + entriesBefore));
+			parsed = parsedBefore;
+			merged = entriesBefore;
+		};
+		for (auto const& line : job.unparsed) {
+			merge(line.parsedBefore, line.entriesBefore);
+
+			CArena & arena = NextLineArena();
+			wchar_t* text = arena.allocate_array<wchar_t>(line.text.size());
+			std::copy(line.text.cbegin(), line.text.cend(), text);
+			ParseNextLine(CLine::Create(std::wstring_view(text, line.text.size()), arena));
+		}
+		merge(job.parsedLines, job.entries.size());
+
+		bool const failed = job.failed;
+		jobs_.pop_front();
+
+		if (failed) {
+			CancelPipelineJobs();
+			return false;
+		}
+	}
+
 	return true;
 }
 
+void CDirectoryListingParser::CancelPipelineJobs()
+{
+	for (auto & job : jobs_) {
+		job->task.join();
+	}
+	jobs_.clear();
+}
+
+void CDirectoryListingParser::SendProgress()
+{
+	if (!m_pControlSocket || progressPath_.empty()) {
+		return;
+	}
+
+	// Batches grow with the listing, this keeps the number of notifications,
+	// and the work spent merging them in the UI, logarithmic in the size of
+	// huge listings.
+	if (!progressBatch_) {
+		progressBatch_ = 256;
+	}
+	if (entries_.size() < progressSent_ + progressBatch_) {
+		return;
+	}
+
+	std::vector<fz::shared_value<CDirentry>> batch(entries_.cbegin() + progressSent_, entries_.cend());
+	progressSent_ = entries_.size();
+	progressBatch_ = std::min(progressBatch_ * 2, size_t(64 * 1024));
+
+	m_pControlSocket->SendDirectoryListingProgress(progressPath_, std::move(batch));
+}
+
 CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 {
 	while (!m_DataList.empty()) {
@@ -2119,7 +2609,7 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 		{
 			++m_currentOffset;
 			if (m_currentOffset >= len) {
-				delete [] iter->p;
+				ReleaseBuffer(*iter);
 				++iter;
 				m_currentOffset = 0;
 				if (iter == m_DataList.end()) {
@@ -2137,33 +2627,35 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 		int reslen = 0;
 
 		int currentOffset = m_currentOffset;
-		while (iter->p[currentOffset] != '\n' && iter->p[currentOffset] != '\r' && iter->p[currentOffset]) {
-			++reslen;
+		while (true) {
+			int const found = FindLineBreak(iter->p + currentOffset, len - currentOffset);
+			reslen += found;
+			currentOffset += found;
+			if (currentOffset < len) {
+				break;
+			}
 
-			++currentOffset;
-			if (currentOffset >= len) {
-				++iter;
-				if (iter == m_DataList.end()) {
-					if (reslen > 10000) {
-						if (m_pControlSocket) {
-							m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
-						}
-						error = true;
-						return nullptr;
-					}
-					if (breakAtEnd) {
-						return nullptr;
+			++iter;
+			if (iter == m_DataList.end()) {
+				if (reslen > 10000) {
+					if (logger_) {
+						logger_->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
 					}
-					break;
+					error = true;
+					return nullptr;
 				}
-				len = iter->len;
-				currentOffset = 0;
+				if (breakAtEnd) {
+					return nullptr;
+				}
+				break;
 			}
+			len = iter->len;
+			currentOffset = 0;
 		}
 
 		if (reslen > 10000) {
-			if (m_pControlSocket) {
-				m_pControlSocket->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
+			if (logger_) {
+				logger_->log(logmsg::error, _("Received a line exceeding 10000 characters, aborting."));
 			}
 			error = true;
 			return nullptr;
@@ -2171,8 +2663,9 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 		m_currentOffset = currentOffset;
 
 		// Reslen is now the length of the line, including any terminating whitespace
+		CArena & arena = NextLineArena();
 		int const buflen = reslen;
-		char *res = new char[buflen + 1];
+		char *res = arena.allocate_array<char>(buflen + 1);
 		res[buflen] = 0;
 
 		int respos = 0;
@@ -2189,7 +2682,7 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 			respos += i->len - startpos;
 			startpos = 0;
 
-			delete [] i->p;
+			ReleaseBuffer(*i);
 			++i;
 		};
 
@@ -2201,7 +2694,7 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 			}
 			memcpy(&res[respos], &iter->p[startpos], copylen);
 			if (reslen >= iter->len) {
-				delete [] iter->p;
+				ReleaseBuffer(*iter);
 				m_DataList.erase(m_DataList.begin(), ++iter);
 			}
 			else {
@@ -2226,15 +2719,16 @@ CLine *CDirectoryListingParser::GetLine(bool breakAtEnd, bool &error)
 				}
 			}
 		}
-		delete [] res;
-
 		// Strip BOM
-		if (buffer[0] == 0xfeff) {
-			buffer = buffer.substr(1);
+		std::wstring_view view = buffer;
+		if (!view.empty() && view[0] == 0xfeff) {
+			view.remove_prefix(1);
 		}
 
-		if (!buffer.empty()) {
-			return new CLine(std::move(buffer));
+		if (!view.empty()) {
+			wchar_t* text = arena.allocate_array<wchar_t>(view.size());
+			std::copy(view.cbegin(), view.cend(), text);
+			return CLine::Create(std::wstring_view(text, view.size()), arena);
 		}
 	}
 
@@ -2284,7 +2778,7 @@ bool CDirectoryListingParser::ParseAsWfFtp(CLine &line, CDirentry &entry)
 	if (!ParseTime(token, entry))
 		return false;
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -2323,7 +2817,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS(CLine &line, CDirentry &entry)
 			return false;
 
 		entry.size = -1;
-		entry.ownerGroup = objcache.get(std::wstring());
+		entry.ownerGroup = stringPool_.get(std::wstring_view());
 		entry.permissions = entry.ownerGroup;
 
 		return true;
@@ -2382,7 +2876,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS(CLine &line, CDirentry &entry)
 
 	entry.name = token.GetString();
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 
 	return true;
@@ -2445,7 +2939,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_PDS(CLine &line, CDirentry &entry)
 	if (!line.GetToken(index++, token, true))
 		return false;
 
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.time += m_timezoneOffset;
 
@@ -2476,7 +2970,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_Migrated(CLine &line, CDirentry &en
 
 	entry.flags = 0;
 	entry.size = -1;
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 
 	return true;
@@ -2493,7 +2987,7 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_PDS2(CLine &line, CDirentry &entry)
 	entry.name = token.GetString();
 
 	entry.flags = 0;
-	entry.ownerGroup = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
 	entry.permissions = entry.ownerGroup;
 	entry.size = -1;
 
@@ -2587,8 +3081,8 @@ bool CDirectoryListingParser::ParseAsIBM_MVS_Tape(CLine &line, CDirentry &entry)
 
 	entry.name = token.GetString();
 	entry.flags = 0;
-	entry.ownerGroup = objcache.get(std::wstring());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(std::wstring_view());
+	entry.permissions = stringPool_.get(std::wstring_view());
 	entry.size = -1;
 
 	if (line.GetToken(index++, token)) {
@@ -2850,8 +3344,8 @@ int CDirectoryListingParser::ParseAsMlsd(CLine &line, CDirentry &entry)
 	}
 
 	entry.name = nameToken.GetString();
-	entry.ownerGroup = objcache.get(ownerGroup);
-	entry.permissions = objcache.get(permissions);
+	entry.ownerGroup = stringPool_.get(ownerGroup);
+	entry.permissions = stringPool_.get(permissions);
 
 	return 1;
 }
@@ -2916,27 +3410,42 @@ bool CDirectoryListingParser::ParseAsOS9(CLine &line, CDirentry &entry)
 		return false;
 
 	entry.name = token.GetString();
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(permToken.GetString());
+	entry.ownerGroup = stringPool_.get(ownerGroupToken.GetView());
+	entry.permissions = stringPool_.get(permToken.GetView());
 
 	return true;
 }
 
 void CDirectoryListingParser::Reset()
 {
+	CancelPipelineJobs();
+	pipelineData_ = 0;
+
 	for (auto & item : m_DataList) {
-		delete [] item.p;
+		ReleaseBuffer(item);
 	}
 	m_DataList.clear();
+	if (fillBuffer_) {
+		t_list fill(fillBuffer_, 0, listing_buffer_size);
+		ReleaseBuffer(fill);
+		fillBuffer_ = nullptr;
+	}
 
-	delete m_prevLine;
+	CLine::Destroy(m_prevLine);
 	m_prevLine = nullptr;
+	arenas_[0].release();
+	arenas_[1].release();
 
 	entries_.clear();
+	stringPool_.clear();
 	m_fileList.clear();
 	m_currentOffset = 0;
 	m_fileListOnly = true;
 	m_maybeMultilineVms = false;
+	m_format = listingFormat::unknown;
+	m_mixedFormats = false;
+	progressSent_ = 0;
+	progressBatch_ = 0;
 }
 
 bool CDirectoryListingParser::ParseAsZVM(CLine &line, CDirentry &entry)
@@ -3012,8 +3521,8 @@ bool CDirectoryListingParser::ParseAsZVM(CLine &line, CDirentry &entry)
 	if (line.GetToken(++index, token))
 		return false;
 
-	entry.ownerGroup = objcache.get(ownerGroupToken.GetString());
-	entry.permissions = objcache.get(std::wstring());
+	entry.ownerGroup = stringPool_.get(ownerGroupToken.GetView());
+	entry.permissions = stringPool_.get(std::wstring_view());
 	entry.target.clear();
 	entry.time += m_timezoneOffset;
 
@@ -3080,22 +3589,44 @@ bool CDirectoryListingParser::ParseAsHPNonstop(CLine &line, CDirentry &entry)
 	if (line.GetToken(++index, token))
 		return false;
 
-	entry.permissions = objcache.get(permToken.GetString());
-	entry.ownerGroup = objcache.get(ownerGroup);
+	entry.permissions = stringPool_.get(permToken.GetView());
+	entry.ownerGroup = stringPool_.get(ownerGroup);
 
 	return true;
 }
 
-bool CDirectoryListingParser::GetMonthFromName(const std::wstring& name, int &month)
+bool CDirectoryListingParser::GetMonthFromName(std::wstring_view name, int &month)
 {
-	std::wstring lower = fz::str_tolower_ascii(name);
-	auto iter = m_MonthNamesMap.find(lower);
-	if (iter == m_MonthNamesMap.end())
-		return false;
+	auto const fold = [](wchar_t c) -> wchar_t {
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	};
 
-	month = iter->second;
+	uint32_t hash = month_hash_init;
+	for (auto const c : name) {
+		hash = month_hash_step(hash, fold(c));
+	}
 
-	return true;
+	size_t pos = hash % month_table_size;
+	for (size_t i = 0; i < month_lookup_table.max_probes; ++i, pos = (pos + 1) % month_table_size) {
+		auto const& slot = month_lookup_table.slots[pos];
+		if (!slot.month) {
+			return false;
+		}
+		if (static_cast<size_t>(slot.name_len + slot.suffix_len) != name.size()) {
+			continue;
+		}
+
+		size_t j = 0;
+		while (j < name.size() && fold(name[j]) == month_slot_char(slot, j)) {
+			++j;
+		}
+		if (j == name.size()) {
+			month = slot.month;
+			return true;
+		}
+	}
+
+	return false;
 }
 
 char const ebcdic_table[256] = {
@@ -3128,20 +3659,47 @@ void CDirectoryListingParser::ConvertEncoding(char *pData, int len)
 	}
 }
 
-void CDirectoryListingParser::DeduceEncoding()
+bool CDirectoryListingParser::DeduceEncoding(bool partial)
 {
 	if (m_listingEncoding != listingEncoding::unknown) {
-		return;
+		return true;
 	}
 
-	int count[256];
+	int available{};
+	for (size_t j = 0; j < m_DataList.size() && available < encoding_sample_size; ++j) {
+		available += m_DataList[j].len - (j ? 0 : m_currentOffset);
+	}
+	if (partial && available < encoding_sample_size) {
+		return false;
+	}
+
+	// Four tables, so that runs of the same byte do not wait on each
+	// other's increments.
+	int counts[4][256]{};
 
-	memset(&count, 0, sizeof(int)*256);
+	int remaining = encoding_sample_size;
+	for (size_t j = 0; j < m_DataList.size() && remaining > 0; ++j) {
+		auto const& data = m_DataList[j];
+		int const start = j ? 0 : m_currentOffset;
+		int const len = std::min(data.len - start, remaining);
+		unsigned char const* p = reinterpret_cast<unsigned char const*>(data.p + start);
 
-	for (auto const& data : m_DataList) {
-		for (int i = 0; i < data.len; ++i) {
-			++count[static_cast<unsigned char>(data.p[i])];
+		int i = 0;
+		for (; i + 4 <= len; i += 4) {
+			++counts[0][p[i]];
+			++counts[1][p[i + 1]];
+			++counts[2][p[i + 2]];
+			++counts[3][p[i + 3]];
 		}
+		for (; i < len; ++i) {
+			++counts[0][p[i]];
+		}
+		remaining -= len;
+	}
+
+	int count[256];
+	for (int i = 0; i < 256; ++i) {
+		count[i] = counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
 	}
 
 	int count_normal = 0;
@@ -3191,4 +3749,6 @@ void CDirectoryListingParser::DeduceEncoding()
 	else {
 		m_listingEncoding = listingEncoding::normal;
 	}
+
+	return true;
 }
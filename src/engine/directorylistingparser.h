@@ -35,9 +35,18 @@
 #include <directorylisting.h>
 #include <server.h>
 
+#include "arena.h"
+
+#include <atomic>
 #include <deque>
+#include <memory>
 #include <vector>
 
+namespace fz {
+class logger_interface;
+class thread_pool;
+}
+
 class CLine;
 class CToken;
 class CControlSocket;
@@ -52,6 +61,34 @@ namespace listingEncoding
 	};
 }
 
+namespace listingFormat
+{
+	// In the order they are probed
+	enum type
+	{
+		unknown,
+		zvm,
+		hpnonstop,
+		mlsd,
+		unix_ls,
+		dos,
+		eplf,
+		vms,
+		other,
+		ibm,
+		wfftp,
+		ibm_mvs,
+		ibm_mvs_pds,
+		os9,
+		ibm_mvs_migrated,
+		ibm_mvs_pds2,
+		ibm_mvs_tape,
+		unix_nodate,
+
+		count
+	};
+}
+
 
 class CDirectoryListingParser final
 {
@@ -64,22 +101,76 @@ public:
 
 	CDirectoryListing Parse(const CServerPath &path);
 
+	// Returns where to place received data, len is set to the available
+	// space. Pass the amount actually placed there to AddData. The returned
+	// pointer is only valid until the next call of any other function.
+	char* GetBuffer(int & len);
+	bool AddData(int len);
+
+	// Takes ownership of the passed buffer
 	bool AddData(char *pData, int len);
 	bool AddLine(std::wstring && line, std::wstring && name, fz::datetime const& time);
 
+	// Adds an entry that needs no parsing, e.g. one built from SFTP attributes
+	void AddEntry(CDirentry && entry, std::wstring_view const& permissions, std::wstring_view const& ownerGroup);
+
 	void Reset();
 
 	void SetTimezoneOffset(fz::duration const& span) { m_timezoneOffset = span; }
 
 	void SetServer(const CServer& server) { m_server = server; };
 
+	// If set, batches of parsed entries are sent as progress notifications
+	// through the control socket while the listing is received.
+	void SetProgressPath(CServerPath const& path) { progressPath_ = path; }
+
+	// Parses complete chunks of received data as jobs on the pool while
+	// more data is being received. Only suitable for listings where each
+	// line stands on its own, such as MLSD, and that need no conversion
+	// through the control socket's character set.
+	void EnablePipelining(fz::thread_pool & pool) { pool_ = &pool; }
+
 protected:
 	CLine *GetLine(bool breakAtEnd, bool& error);
 
+	// Rewinds and returns the arena to place the next line into
+	CArena& NextLineArena();
+
 	bool ParseData(bool partial);
 
+	// Parses a line on its own and, failing that, as continuation of the
+	// previous line that did not parse either
+	void ParseNextLine(CLine* pLine);
+
+	// Called after len bytes got appended to m_DataList
+	bool OnData(int len);
+
+	void SendProgress();
+
+	struct PipelineJob;
+	void DispatchPipelineJob();
+	bool CollectPipelineJobs(bool wait);
+	void CancelPipelineJobs();
+
+	// A pipeline job does not know the lines preceding its data. Lines that
+	// do not parse on their own are left to the fallbacks of the parser
+	// merging the job, along with their position among the parsed lines.
+	struct unparsed_line final
+	{
+		size_t parsedBefore{};
+		size_t entriesBefore{};
+		std::wstring text;
+	};
+	bool pipelineJob_{};
+	size_t parsedLines_{};
+	std::vector<unparsed_line> unparsed_;
+
 	bool ParseLine(CLine &line, ServerType const serverType, bool concatenated, CDirentry const* override = nullptr);
 
+	// Returns 0 if the line is not in the given format, 1 on success
+	// and 2 if the line is valid but does not describe an entry.
+	int ParseAs(listingFormat::type format, CLine &line, CDirentry &entry);
+
 	bool ParseAsUnix(CLine &line, CDirentry &entry, bool expect_date);
 	bool ParseAsDos(CLine &line, CDirentry &entry);
 	bool ParseAsEplf(CLine &line, CDirentry &entry);
@@ -111,41 +202,75 @@ protected:
 	// Parse file sizes given like this: 123.4M
 	bool ParseComplexFileSize(CToken& token, int64_t& size, int blocksize = -1);
 
-	bool GetMonthFromName(std::wstring const& name, int &month);
+	bool GetMonthFromName(std::wstring_view name, int &month);
 
-	void DeduceEncoding();
+	// Decides between ASCII and EBCDIC from a sample at the start of the
+	// listing. Returns false if partial and the sample is not complete yet.
+	bool DeduceEncoding(bool partial);
 	void ConvertEncoding(char *pData, int len);
 
 	CControlSocket* m_pControlSocket;
 
-	static std::map<std::wstring, int> m_MonthNamesMap;
-
+	// Received data is kept in a chain of large buffers, which get filled
+	// in place and recycled once parsed.
 	struct t_list
 	{
 		t_list() = default;
-		t_list(char* s, int l)
-			: p(s), len(l)
+		t_list(char* s, int l, int c)
+			: p(s), len(l), capacity(c)
 		{}
 
 		char *p;
 		int len;
+		int capacity;
 	};
 
+	void ReleaseBuffer(t_list & data);
+
 	int m_currentOffset{};
 
 	std::deque<t_list> m_DataList;
+
+	// Taken by GetBuffer, not yet holding any data
+	char* fillBuffer_{};
+	std::vector<char*> freeBuffers_;
 	std::vector<fz::shared_value<CDirentry>> entries_;
+
+	// Shared by the entries of the listing being parsed
+	CStringPool stringPool_;
 	int64_t m_totalData{};
 
 	CLine *m_prevLine{};
 
+	// Lines alternate between two arenas, so that the arena not holding
+	// m_prevLine can be rewound for each new line.
+	CArena arenas_[2];
+	int currentArena_{};
+	int prevLineArena_{};
+
 	CServer m_server;
 
+	// Unlike the control socket, also used by pipeline jobs
+	fz::logger_interface* logger_{};
+
+	fz::thread_pool* pool_{};
+	std::deque<std::unique_ptr<PipelineJob>> jobs_;
+	size_t pipelineData_{};
+
+	CServerPath progressPath_;
+	size_t progressSent_{};
+	size_t progressBatch_{};
+
 	bool m_fileListOnly{true};
 	std::vector<std::wstring> m_fileList;
 
 	bool m_maybeMultilineVms{};
 
+	// Format of the last parsed line, tried first for the next one and
+	// thus taking precedence over all other formats, see ParseLine.
+	listingFormat::type m_format{listingFormat::unknown};
+	bool m_mixedFormats{};
+
 	fz::duration m_timezoneOffset;
 
 	listingEncoding::type m_listingEncoding;
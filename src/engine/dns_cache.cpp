@@ -0,0 +1,76 @@
+#include <filezilla.h>
+#include "dns_cache.h"
+
+namespace {
+// Short enough to follow DNS based failover of most services
+fz::duration const max_entry_age = fz::duration::from_seconds(60);
+
+size_t const max_entries = 256;
+}
+
+std::string CDnsCache::Get(fz::native_string const& host)
+{
+	fz::scoped_lock lock(mutex_);
+
+	auto it = entries_.find(host);
+	if (it == entries_.end()) {
+		return std::string();
+	}
+
+	if (fz::monotonic_clock::now() - it->second.time_ >= max_entry_age) {
+		entries_.erase(it);
+		return std::string();
+	}
+
+	return it->second.address_;
+}
+
+void CDnsCache::Store(fz::native_string const& host, std::string const& address)
+{
+	if (host.empty() || address.empty() || fz::get_address_type(host) != fz::address_type::unknown) {
+		return;
+	}
+
+	fz::scoped_lock lock(mutex_);
+
+	auto const now = fz::monotonic_clock::now();
+
+	auto it = entries_.find(host);
+	if (it == entries_.end()) {
+		if (entries_.size() >= max_entries) {
+			auto oldest = entries_.begin();
+			for (auto cur = entries_.begin(); cur != entries_.end(); ++cur) {
+				if (cur->second.time_ < oldest->second.time_) {
+					oldest = cur;
+				}
+			}
+			entries_.erase(oldest);
+		}
+		it = entries_.emplace(host, entry()).first;
+	}
+	else if (it->second.address_ == address) {
+		// Do not extend the lifetime of an entry merely by using it
+		return;
+	}
+
+	it->second.address_ = address;
+	it->second.time_ = now;
+}
+
+void CDnsCache::Invalidate(fz::native_string const& host)
+{
+	fz::scoped_lock lock(mutex_);
+	entries_.erase(host);
+}
+
+CCachedAddressLayer::CCachedAddressLayer(fz::event_handler* handler, fz::socket_interface & next_layer, std::string const& address)
+	: fz::socket_layer(handler, next_layer, true)
+	, address_(address)
+{
+}
+
+int CCachedAddressLayer::connect(fz::native_string const& host, unsigned int port, fz::address_type family)
+{
+	host_ = host;
+	return next_layer_.connect(fz::to_native(address_), port, family);
+}
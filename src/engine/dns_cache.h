@@ -0,0 +1,61 @@
+#ifndef FILEZILLA_ENGINE_DNS_CACHE_HEADER
+#define FILEZILLA_ENGINE_DNS_CACHE_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/socket.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <map>
+#include <string>
+
+// Remembers the address each host name last resolved to, shared by all
+// engines. When a queue opens many connections to the same server, only the
+// first one has to wait for the resolver.
+//
+// The system resolver does not expose record TTLs, so entries are kept for a
+// short fixed time only and dropped as soon as connecting to them fails.
+class CDnsCache final
+{
+public:
+	CDnsCache() = default;
+
+	CDnsCache(CDnsCache const&) = delete;
+	CDnsCache& operator=(CDnsCache const&) = delete;
+
+	// Returns an empty string if there is no usable address
+	std::string Get(fz::native_string const& host);
+
+	void Store(fz::native_string const& host, std::string const& address);
+
+	void Invalidate(fz::native_string const& host);
+
+protected:
+	struct entry
+	{
+		std::string address_;
+		fz::monotonic_clock time_;
+	};
+
+	fz::mutex mutex_;
+
+	std::map<fz::native_string, entry> entries_;
+};
+
+// Connects the next layer to a cached address while reporting the original
+// host name as peer host to the layers above, so that TLS still uses it for
+// SNI and certificate verification.
+class CCachedAddressLayer final : public fz::socket_layer
+{
+public:
+	CCachedAddressLayer(fz::event_handler* handler, fz::socket_interface & next_layer, std::string const& address);
+
+	virtual int connect(fz::native_string const& host, unsigned int port, fz::address_type family = fz::address_type::unknown) override;
+
+	virtual fz::native_string peer_host() const override { return host_; }
+
+private:
+	std::string const address_;
+	fz::native_string host_;
+};
+
+#endif
@@ -1,17 +1,170 @@
 #include <filezilla.h>
 #include "engine_context.h"
 
+#include "activeports.h"
 #include "directorycache.h"
+#include "dns_cache.h"
+#include "engine_metrics.h"
+#include "external_ip_cache.h"
 #include "logging_private.h"
 #include "oplock_manager.h"
 #include "option_change_event_handler.h"
 #include "pathcache.h"
+#include "proxy.h"
+#include "servercapabilities.h"
+#include "server.h"
+#include "sftp/process_pool.h"
+#include "speedlimit_schedule.h"
+#include "tls_session_cache.h"
+#include "trace_log.h"
+#if ENABLE_STORJ
+#include "storj/worker_pool.h"
+#endif
 
+#include <libfilezilla/event_handler.hpp>
 #include <libfilezilla/event_loop.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/mutex.hpp>
 #include <libfilezilla/rate_limiter.hpp>
 #include <libfilezilla/thread_pool.hpp>
 #include <libfilezilla/tls_system_trust_store.hpp>
 
+#include <atomic>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+struct pin_event_type;
+typedef fz::simple_event<pin_event_type> CPinEvent;
+
+struct unpin_event_type;
+typedef fz::simple_event<unpin_event_type> CUnpinEvent;
+
+// Binds the thread running its event loop to one CPU. The loops run on
+// threads of the pool, which get reused once a loop is gone, so the
+// thread's previous affinity is restored before destruction.
+class CThreadPinner final : public fz::event_handler
+{
+public:
+	CThreadPinner(fz::event_loop & loop, unsigned int cpu)
+		: fz::event_handler(loop)
+		, cpu_(cpu)
+	{
+		send_event<CPinEvent>();
+	}
+
+	virtual ~CThreadPinner()
+	{
+		fz::scoped_lock lock(mutex_);
+		send_event<CUnpinEvent>();
+		while (!unpinned_) {
+			cond_.wait(lock);
+		}
+		lock.unlock();
+
+		remove_handler();
+	}
+
+private:
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		fz::dispatch<CPinEvent, CUnpinEvent>(ev, this,
+			&CThreadPinner::OnPin,
+			&CThreadPinner::OnUnpin);
+	}
+
+	void OnPin()
+	{
+#ifdef FZ_WINDOWS
+		previous_ = SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu_);
+#elif defined(__linux__)
+		pinned_ = !pthread_getaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+		if (pinned_) {
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu_, &set);
+			pinned_ = !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+#endif
+	}
+
+	void OnUnpin()
+	{
+#ifdef FZ_WINDOWS
+		if (previous_) {
+			SetThreadAffinityMask(GetCurrentThread(), previous_);
+		}
+#elif defined(__linux__)
+		if (pinned_) {
+			pthread_setaffinity_np(pthread_self(), sizeof(previous_), &previous_);
+		}
+#endif
+		fz::scoped_lock lock(mutex_);
+		unpinned_ = true;
+		cond_.signal(lock);
+	}
+
+	unsigned int const cpu_;
+
+#ifdef FZ_WINDOWS
+	DWORD_PTR previous_{};
+#elif defined(__linux__)
+	cpu_set_t previous_;
+	bool pinned_{};
+#endif
+
+	fz::mutex mutex_;
+	fz::condition cond_;
+	bool unpinned_{};
+};
+
+// Fires shortly after the start of the next minute, the step of speed limit schedules
+class CMinuteTimer final : public fz::event_handler
+{
+public:
+	CMinuteTimer(fz::event_loop & loop, std::function<void()> && cb)
+		: fz::event_handler(loop)
+		, cb_(std::move(cb))
+	{}
+
+	virtual ~CMinuteTimer()
+	{
+		remove_handler();
+	}
+
+	void Arm()
+	{
+		int64_t const ms = (fz::datetime::now() - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds() % 60000;
+		stop_timer(timer_);
+		timer_ = add_timer(fz::duration::from_milliseconds(60000 - ms + 100), true);
+	}
+
+	void Disarm()
+	{
+		stop_timer(timer_);
+		timer_ = 0;
+	}
+
+private:
+	virtual void operator()(fz::event_base const& ev) override
+	{
+		if (ev.derived_type() == fz::timer_event::type()) {
+			cb_();
+		}
+	}
+
+	std::function<void()> const cb_;
+	fz::timer_id timer_{};
+};
+}
+
 class CFileZillaEngineContext::Impl final : private COptionChangeEventHandler
 {
 public:
@@ -21,33 +174,110 @@ public:
 		, tlsSystemTrustStore_(pool_)
 	{
 		directory_cache_.SetTtl(fz::duration::from_seconds(options.GetOptionVal(OPTION_CACHE_TTL)));
+		directory_cache_.SetMemoryBudget(static_cast<int64_t>(options.GetOptionVal(OPTION_CACHE_MEMORY_BUDGET)) * 1024 * 1024);
+		if (options.GetOptionVal(OPTION_CACHE_PERSISTENT)) {
+			directory_cache_.SetPersistentDirectory(options.GetOption(OPTION_CACHE_PERSISTENT_DIR));
+		}
+		// Listings stored by one instance spare the others listing them again
+		if (options.GetOptionVal(OPTION_CACHE_SHARED) && !options.GetOption(OPTION_CACHE_PERSISTENT_DIR).empty()) {
+			directory_cache_.SetSharedDirectory(options.GetOption(OPTION_CACHE_PERSISTENT_DIR) + fz::local_filesys::path_separator + L"shared");
+		}
+		// Spares the FEAT, SYST and timezone detection round trips when
+		// logging in to known servers again.
+		int const capabilitiesTtl = options.GetOptionVal(OPTION_CAPABILITIES_TTL);
+		if (capabilitiesTtl > 0 && !options.GetOption(OPTION_CACHE_PERSISTENT_DIR).empty()) {
+			CServerCapabilities::SetPersistentDirectory(options.GetOption(OPTION_CACHE_PERSISTENT_DIR), fz::duration::from_seconds(capabilitiesTtl));
+		}
+		// Concurrent listings of the same directory wait on the list lock of
+		// the first one, hand them the result as soon as it is there.
+		// Listed directories exist, which spares creating them.
+		directory_cache_.SetStoreHandler([this](CServer const& server, CDirectoryListing const& listing) {
+			opLockManager_.ListingStored(server, listing.path);
+			if (!listing.failed()) {
+				path_cache_.StoreExisting(server, listing.path);
+			}
+		});
 		rate_limit_mgr_.add(&rate_limiter_);
 
+		// Busy engines, e.g. during TLS transfers, each keep one thread
+		// busy. Spreading them over several loops lets them use more cores.
+		unsigned int const cpus = std::max(1u, std::thread::hardware_concurrency());
+		size_t loops = static_cast<size_t>(options.GetOptionVal(OPTION_ENGINE_EVENT_LOOPS));
+		if (!loops) {
+			loops = cpus;
+		}
+		for (size_t i = 1; i < loops; ++i) {
+			engine_loops_.push_back(std::make_unique<fz::event_loop>(pool_));
+		}
+		if (options.GetOptionVal(OPTION_ENGINE_CPU_AFFINITY)) {
+			unsigned int const maxcpus = std::min(cpus, 64u);
+			for (size_t i = 0; i < loops; ++i) {
+				pinners_.push_back(std::make_unique<CThreadPinner>(i ? *engine_loops_[i - 1] : loop_, static_cast<unsigned int>(i % maxcpus)));
+			}
+		}
+
+		traceLog_.SetFile(fz::to_native(options.GetOption(OPTION_LOGGING_TRACEFILE)));
+
 		RegisterOption(OPTION_SPEEDLIMIT_ENABLE);
 		RegisterOption(OPTION_SPEEDLIMIT_INBOUND);
 		RegisterOption(OPTION_SPEEDLIMIT_OUTBOUND);
 		RegisterOption(OPTION_SPEEDLIMIT_BURSTTOLERANCE);
+		RegisterOption(OPTION_SPEEDLIMIT_SCHEDULE);
+		RegisterOption(OPTION_LOGGING_TRACEFILE);
 
+		schedule_.Parse(options.GetOption(OPTION_SPEEDLIMIT_SCHEDULE));
 		UpdateRateLimit();
 	}
 
 	~Impl()
 	{
 		UnregisterAllOptions();
+		CServerCapabilities::SavePersistent();
 	}
 
 	virtual void OnOptionsChanged(changed_options_t const& options) override;
 	void UpdateRateLimit();
+	std::shared_ptr<fz::rate_limiter> GetServerRateLimiter(CServer const& server);
 
 	COptionsBase& options_;
 	fz::thread_pool pool_;
 	fz::event_loop loop_{pool_};
+
+	// Loops for engines besides loop_
+	std::vector<std::unique_ptr<fz::event_loop>> engine_loops_;
+	std::vector<std::unique_ptr<CThreadPinner>> pinners_;
+	std::atomic<size_t> next_engine_loop_{};
+	std::atomic<size_t> next_source_address_slot_{};
+
 	fz::rate_limit_manager rate_limit_mgr_;
 	fz::rate_limiter rate_limiter_;
+
+	// Updates of the global limits come from both the option changes and the schedule
+	fz::mutex rateLimitMutex_{false};
+	CSpeedLimitSchedule schedule_;
+	CMinuteTimer scheduleTimer_{loop_, [this]() { UpdateRateLimit(); }};
+
+	// Owned by the connections using them
+	fz::mutex serverRateLimitersMutex_{false};
+	std::map<std::wstring, std::weak_ptr<fz::rate_limiter>> serverRateLimiters_;
+
+	// Needed by the caches below
+	CEngineMetrics metrics_;
+
 	CDirectoryCache directory_cache_;
-	CPathCache path_cache_;
+	CPathCache path_cache_{metrics_};
 	OpLockManager opLockManager_;
 	fz::tls_system_trust_store tlsSystemTrustStore_;
+	CTlsSessionCache tlsSessionCache_;
+	CDnsCache dnsCache_;
+	CProxyHandshakeCache proxyHandshakeCache_;
+	CTraceLog traceLog_{pool_};
+	CActivePortAllocator activePortAllocator_;
+	CSftpProcessPool sftpProcessPool_{loop_, pool_};
+	CExternalIPCache externalIPCache_{loop_, pool_};
+#if ENABLE_STORJ
+	CStorjWorkerPool storjWorkerPool_{loop_};
+#endif
 };
 
 void CFileZillaEngineContext::Impl::UpdateRateLimit()
@@ -65,25 +295,107 @@ void CFileZillaEngineContext::Impl::UpdateRateLimit()
 	}
 	rate_limit_mgr_.set_burst_tolerance(tolerance);
 
+	fz::scoped_lock l(rateLimitMutex_);
+
 	fz::rate::type limits[2]{fz::rate::unlimited, fz::rate::unlimited};
-	if (options_.GetOptionVal(OPTION_SPEEDLIMIT_ENABLE)) {
-		auto const inbound = options_.GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
+	bool const enabled = options_.GetOptionVal(OPTION_SPEEDLIMIT_ENABLE) != 0;
+	if (enabled) {
+		int inbound = options_.GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
+		int outbound = options_.GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
+		schedule_.GetLimits(fz::datetime::now(), inbound, outbound);
 		if (inbound > 0) {
-			limits[0] = inbound * 1024;
+			limits[0] = static_cast<fz::rate::type>(inbound) * 1024;
 		}
-		auto const outbound = options_.GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
 		if (outbound > 0) {
-			limits[1] = outbound * 1024;
+			limits[1] = static_cast<fz::rate::type>(outbound) * 1024;
 		}
 	}
 	rate_limiter_.set_limits(limits[0], limits[1]);
+
+	if (enabled && !schedule_.empty()) {
+		scheduleTimer_.Arm();
+	}
+	else {
+		scheduleTimer_.Disarm();
+	}
 }
 
-void CFileZillaEngineContext::Impl::OnOptionsChanged(changed_options_t const&)
+std::shared_ptr<fz::rate_limiter> CFileZillaEngineContext::Impl::GetServerRateLimiter(CServer const& server)
 {
+	// Limits of a site apply even with the global speed limits turned off
+	int const inbound = server.GetInboundSpeedLimit();
+	int const outbound = server.GetOutboundSpeedLimit();
+	if (!inbound && !outbound && !options_.GetOptionVal(OPTION_SPEEDLIMIT_ENABLE)) {
+		return nullptr;
+	}
+
+	fz::scoped_lock l(serverRateLimitersMutex_);
+
+	for (auto it = serverRateLimiters_.begin(); it != serverRateLimiters_.end(); ) {
+		if (it->second.expired()) {
+			it = serverRateLimiters_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	auto & weak = serverRateLimiters_[server.Format(ServerFormat::with_optional_port)];
+	auto limiter = weak.lock();
+	if (!limiter) {
+		// Without limits of its own it merely shares the global rate fairly between servers
+		limiter = std::make_shared<fz::rate_limiter>();
+		rate_limiter_.add(limiter.get());
+		weak = limiter;
+	}
+	// The most recently connected site settings apply to all connections to the server
+	limiter->set_limits(inbound ? static_cast<fz::rate::type>(inbound) * 1024 : fz::rate::unlimited,
+		outbound ? static_cast<fz::rate::type>(outbound) * 1024 : fz::rate::unlimited);
+	return limiter;
+}
+
+void CFileZillaEngineContext::Impl::OnOptionsChanged(changed_options_t const& options)
+{
+	if (options.test(OPTION_LOGGING_TRACEFILE)) {
+		traceLog_.SetFile(fz::to_native(options_.GetOption(OPTION_LOGGING_TRACEFILE)));
+	}
+	if (options.test(OPTION_SPEEDLIMIT_SCHEDULE)) {
+		fz::scoped_lock l(rateLimitMutex_);
+		schedule_.Parse(options_.GetOption(OPTION_SPEEDLIMIT_SCHEDULE));
+	}
 	UpdateRateLimit();
 }
 
+namespace {
+class default_converter final : public CustomEncodingConverterBase::converter
+{
+public:
+	default_converter(CustomEncodingConverterBase const& base, std::wstring const& encoding)
+		: base_(base)
+		, encoding_(encoding)
+	{}
+
+	virtual std::wstring toLocal(char const* buffer, size_t len) override
+	{
+		return base_.toLocal(encoding_, buffer, len);
+	}
+
+	virtual std::string toServer(wchar_t const* buffer, size_t len) override
+	{
+		return base_.toServer(encoding_, buffer, len);
+	}
+
+private:
+	CustomEncodingConverterBase const& base_;
+	std::wstring const encoding_;
+};
+}
+
+std::unique_ptr<CustomEncodingConverterBase::converter> CustomEncodingConverterBase::Open(std::wstring const& encoding) const
+{
+	return std::make_unique<default_converter>(*this, encoding);
+}
+
 CFileZillaEngineContext::CFileZillaEngineContext(COptionsBase & options, CustomEncodingConverterBase const& customEncodingConverter)
 : options_(options)
 , customEncodingConverter_(customEncodingConverter)
@@ -105,11 +417,50 @@ fz::event_loop& CFileZillaEngineContext::GetEventLoop()
 	return impl_->loop_;
 }
 
+fz::event_loop& CFileZillaEngineContext::GetEngineEventLoop()
+{
+	size_t const i = impl_->next_engine_loop_++ % (impl_->engine_loops_.size() + 1);
+	return i ? *impl_->engine_loops_[i - 1] : impl_->loop_;
+}
+
+size_t CFileZillaEngineContext::GetSourceAddressSlot()
+{
+	return impl_->next_source_address_slot_++;
+}
+
+std::string CFileZillaEngineContext::GetSourceAddress(size_t slot)
+{
+	// Looked up on every connection, changes apply without restarting the engines
+	auto const addresses = fz::strtok(options_.GetOption(OPTION_SOURCE_ADDRESSES), L" \t,;");
+	if (addresses.empty()) {
+		return std::string();
+	}
+	return fz::to_utf8(addresses[slot % addresses.size()]);
+}
+
 fz::rate_limiter& CFileZillaEngineContext::GetRateLimiter()
 {
 	return impl_->rate_limiter_;
 }
 
+std::shared_ptr<fz::rate_limiter> CFileZillaEngineContext::GetRateLimiter(CServer const& server)
+{
+	return impl_->GetServerRateLimiter(server);
+}
+
+bool CFileZillaEngineContext::LimitsUploads(CServer const& server)
+{
+	if (server.GetOutboundSpeedLimit()) {
+		return true;
+	}
+	if (!impl_->options_.GetOptionVal(OPTION_SPEEDLIMIT_ENABLE)) {
+		return false;
+	}
+
+	fz::scoped_lock l(impl_->rateLimitMutex_);
+	return impl_->options_.GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND) > 0 || !impl_->schedule_.empty();
+}
+
 CDirectoryCache& CFileZillaEngineContext::GetDirectoryCache()
 {
 	return impl_->directory_cache_;
@@ -129,3 +480,50 @@ fz::tls_system_trust_store& CFileZillaEngineContext::GetTlsSystemTrustStore()
 {
 	return impl_->tlsSystemTrustStore_;
 }
+
+CTlsSessionCache& CFileZillaEngineContext::GetTlsSessionCache()
+{
+	return impl_->tlsSessionCache_;
+}
+
+CDnsCache& CFileZillaEngineContext::GetDnsCache()
+{
+	return impl_->dnsCache_;
+}
+
+CExternalIPCache& CFileZillaEngineContext::GetExternalIPCache()
+{
+	return impl_->externalIPCache_;
+}
+
+CProxyHandshakeCache& CFileZillaEngineContext::GetProxyHandshakeCache()
+{
+	return impl_->proxyHandshakeCache_;
+}
+
+CActivePortAllocator& CFileZillaEngineContext::GetActivePortAllocator()
+{
+	return impl_->activePortAllocator_;
+}
+
+CSftpProcessPool& CFileZillaEngineContext::GetSftpProcessPool()
+{
+	return impl_->sftpProcessPool_;
+}
+
+CTraceLog& CFileZillaEngineContext::GetTraceLog()
+{
+	return impl_->traceLog_;
+}
+
+CEngineMetrics& CFileZillaEngineContext::GetMetrics()
+{
+	return impl_->metrics_;
+}
+
+#if ENABLE_STORJ
+CStorjWorkerPool& CFileZillaEngineContext::GetStorjWorkerPool()
+{
+	return impl_->storjWorkerPool_;
+}
+#endif
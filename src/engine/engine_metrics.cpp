@@ -0,0 +1,94 @@
+#include <filezilla.h>
+
+#include "engine_metrics.h"
+
+CEngineMetrics::snapshot CEngineMetrics::Get() const
+{
+	snapshot ret;
+	ret.commands = commands_.load(std::memory_order_relaxed);
+	ret.failed_commands = failed_commands_.load(std::memory_order_relaxed);
+	ret.bytes_transferred = bytes_.load(std::memory_order_relaxed);
+	ret.cache_hits = cache_hits_.load(std::memory_order_relaxed);
+	ret.cache_misses = cache_misses_.load(std::memory_order_relaxed);
+	ret.path_cache_hits = path_cache_hits_.load(std::memory_order_relaxed);
+	ret.path_cache_misses = path_cache_misses_.load(std::memory_order_relaxed);
+	ret.path_cache_evictions = path_cache_evictions_.load(std::memory_order_relaxed);
+	ret.lock_waits = lock_waits_.load(std::memory_order_relaxed);
+	ret.lock_wait_ms = lock_wait_ms_.load(std::memory_order_relaxed);
+	ret.connections = connections_.load(std::memory_order_relaxed);
+	return ret;
+}
+
+void CEngineMetrics::AddCommand(bool failed)
+{
+	commands_.fetch_add(1, std::memory_order_relaxed);
+	if (failed) {
+		failed_commands_.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void CEngineMetrics::AddCacheLookup(bool hit)
+{
+	(hit ? cache_hits_ : cache_misses_).fetch_add(1, std::memory_order_relaxed);
+}
+
+void CEngineMetrics::AddPathCacheLookup(bool hit)
+{
+	(hit ? path_cache_hits_ : path_cache_misses_).fetch_add(1, std::memory_order_relaxed);
+}
+
+void CEngineMetrics::AddLockWait(fz::duration const& wait)
+{
+	lock_waits_.fetch_add(1, std::memory_order_relaxed);
+	lock_wait_ms_.fetch_add(wait.get_milliseconds(), std::memory_order_relaxed);
+}
+
+namespace {
+fz::duration const slow_operation_threshold = fz::duration::from_seconds(1);
+size_t const max_slow_operations = 50;
+}
+
+std::shared_ptr<engine_counters> CEngineMetrics::AddEngine(unsigned int engine_id)
+{
+	auto counters = std::make_shared<engine_counters>(engine_id);
+
+	fz::scoped_lock l(mutex_);
+	engines_.push_back(counters);
+	return counters;
+}
+
+void CEngineMetrics::RemoveEngine(std::shared_ptr<engine_counters> const& counters)
+{
+	fz::scoped_lock l(mutex_);
+	for (size_t i = 0; i < engines_.size(); ++i) {
+		if (engines_[i] == counters) {
+			engines_.erase(engines_.begin() + i);
+			break;
+		}
+	}
+}
+
+std::vector<std::shared_ptr<engine_counters const>> CEngineMetrics::GetEngines() const
+{
+	fz::scoped_lock l(mutex_);
+	return std::vector<std::shared_ptr<engine_counters const>>(engines_.begin(), engines_.end());
+}
+
+void CEngineMetrics::AddSlowOperation(slow_operation const& op)
+{
+	if (op.duration < slow_operation_threshold) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+	slow_operations_.push_back(op);
+	if (slow_operations_.size() > max_slow_operations) {
+		slow_operations_.pop_front();
+	}
+}
+
+std::vector<slow_operation> CEngineMetrics::GetSlowOperations() const
+{
+	fz::scoped_lock l(mutex_);
+	return std::vector<slow_operation>(slow_operations_.begin(), slow_operations_.end());
+}
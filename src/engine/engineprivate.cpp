@@ -37,11 +37,12 @@ unsigned int get_next_engine_id()
 }
 
 CFileZillaEnginePrivate::CFileZillaEnginePrivate(CFileZillaEngineContext& context, CFileZillaEngine& parent, EngineNotificationHandler& notificationHandler)
-	: event_handler(context.GetEventLoop())
+	: event_handler(context.GetEngineEventLoop())
 	, transfer_status_(*this)
 	, opLockManager_(context.GetOpLockManager())
 	, notification_handler_(notificationHandler)
 	, m_engine_id(get_next_engine_id())
+	, sourceAddressSlot_(context.GetSourceAddressSlot())
 	, m_options(context.GetOptions())
 	, rate_limiter_(context.GetRateLimiter())
 	, directory_cache_(context.GetDirectoryCache())
@@ -50,6 +51,8 @@ CFileZillaEnginePrivate::CFileZillaEnginePrivate(CFileZillaEngineContext& contex
 	, thread_pool_(context.GetThreadPool())
 	, encoding_converter_(context.GetCustomEncodingConverter())
 	, context_(context)
+	, trace_log_(context.GetTraceLog())
+	, metrics_(context.GetMetrics())
 {
 	{
 		fz::scoped_lock lock(global_mutex_);
@@ -67,6 +70,8 @@ CFileZillaEnginePrivate::CFileZillaEnginePrivate(CFileZillaEngineContext& contex
 	RegisterOption(OPTION_LOGGING_SHOW_DETAILED_LOGS);
 	RegisterOption(OPTION_LOGGING_DEBUGLEVEL);
 	RegisterOption(OPTION_LOGGING_RAWLISTING);
+
+	counters_ = metrics_.AddEngine(m_engine_id);
 }
 
 bool CFileZillaEnginePrivate::ShouldQueueLogsFromOptions() const
@@ -109,12 +114,17 @@ CFileZillaEnginePrivate::~CFileZillaEnginePrivate()
 	for (auto & notification : m_NotificationList) {
 		delete notification;
 	}
+	for (auto & notification : drained_notifications_) {
+		delete notification;
+	}
 
 	// Remove ourself from the engine list
 	{
 		fz::scoped_lock lock(global_mutex_);
 		erase_unordered(m_engineList, this);
 	}
+
+	metrics_.RemoveEngine(counters_);
 }
 
 void CFileZillaEnginePrivate::OnEngineEvent(EngineNotificationType type)
@@ -144,6 +154,7 @@ bool CFileZillaEnginePrivate::IsConnected() const
 void CFileZillaEnginePrivate::AddNotification(fz::scoped_lock& lock, CNotification *pNotification)
 {
 	m_NotificationList.push_back(pNotification);
+	counters_->pending_notifications.fetch_add(1, std::memory_order_relaxed);
 
 	if (m_maySendNotificationEvent) {
 		m_maySendNotificationEvent = false;
@@ -166,6 +177,7 @@ void CFileZillaEnginePrivate::AddLogNotification(CLogmsgNotification *pNotificat
 		queue_logs_ = false;
 
 		m_NotificationList.insert(m_NotificationList.end(), queued_logs_.begin(), queued_logs_.end());
+		counters_->pending_notifications.fetch_add(queued_logs_.size(), std::memory_order_relaxed);
 		queued_logs_.clear();
 		AddNotification(lock, pNotification);
 	}
@@ -186,6 +198,7 @@ void CFileZillaEnginePrivate::SendQueuedLogs(bool reset_flag)
 	{
 		fz::scoped_lock lock(notification_mutex_);
 		m_NotificationList.insert(m_NotificationList.end(), queued_logs_.begin(), queued_logs_.end());
+		counters_->pending_notifications.fetch_add(queued_logs_.size(), std::memory_order_relaxed);
 		queued_logs_.clear();
 
 		if (reset_flag) {
@@ -258,6 +271,7 @@ int CFileZillaEnginePrivate::ResetOperation(int nErrorCode)
 		notification->commandId = currentCommand_->GetId();
 		AddNotification(notification);
 
+		Trace(trace_event::command_end, nErrorCode);
 		currentCommand_.reset();
 	}
 
@@ -343,6 +357,12 @@ int CFileZillaEnginePrivate::List(CListCommand const& command)
 				CDirectoryListing *pListing = new CDirectoryListing;
 				bool is_outdated = false;
 				bool found = directory_cache_.Lookup(*pListing, server, path, true, is_outdated);
+				if (found && !is_outdated) {
+					Trace(trace_event::cache_hit, static_cast<int64_t>(pListing->size()));
+				}
+				else {
+					Trace(trace_event::cache_miss);
+				}
 				if (found && !is_outdated) {
 					if (pListing->get_unsure_flags()) {
 						flags |= LIST_FLAG_REFRESH;
@@ -420,6 +440,30 @@ int CFileZillaEnginePrivate::Chmod(CChmodCommand const& command)
 	return FZ_REPLY_CONTINUE;
 }
 
+int CFileZillaEnginePrivate::FileHash(CFileHashCommand const& command)
+{
+	controlSocket_->FileHash(command);
+	return FZ_REPLY_CONTINUE;
+}
+
+int CFileZillaEnginePrivate::Copy(CCopyCommand const& command)
+{
+	controlSocket_->Copy(command);
+	return FZ_REPLY_CONTINUE;
+}
+
+int CFileZillaEnginePrivate::Fxp(CFxpCommand const& command)
+{
+	controlSocket_->Fxp(command);
+	return FZ_REPLY_CONTINUE;
+}
+
+int CFileZillaEnginePrivate::Batch(CBatchCommand const& command)
+{
+	controlSocket_->Batch(command);
+	return FZ_REPLY_CONTINUE;
+}
+
 void CFileZillaEnginePrivate::RegisterFailedLoginAttempt(const CServer& server, bool critical)
 {
 	fz::scoped_lock lock(global_mutex_);
@@ -607,6 +651,15 @@ void CFileZillaEnginePrivate::OnCommandEvent()
 {
 	fz::scoped_lock lock(mutex_);
 
+	if (command_queued_) {
+		int64_t const lag = (fz::monotonic_clock::now() - command_queued_).get_microseconds();
+		command_queued_ = fz::monotonic_clock();
+		counters_->loop_lag_us.store(lag, std::memory_order_relaxed);
+		if (lag > counters_->max_loop_lag_us.load(std::memory_order_relaxed)) {
+			counters_->max_loop_lag_us.store(lag, std::memory_order_relaxed);
+		}
+	}
+
 	if (currentCommand_) {
 		CCommand & command = *currentCommand_;
 		Command id = command.GetId();
@@ -645,6 +698,18 @@ void CFileZillaEnginePrivate::OnCommandEvent()
 			case Command::chmod:
 				res = Chmod(static_cast<CChmodCommand const&>(command));
 				break;
+			case Command::filehash:
+				res = FileHash(static_cast<CFileHashCommand const&>(command));
+				break;
+			case Command::copy:
+				res = Copy(static_cast<CCopyCommand const&>(command));
+				break;
+			case Command::batch:
+				res = Batch(static_cast<CBatchCommand const&>(command));
+				break;
+			case Command::fxp:
+				res = Fxp(static_cast<CFxpCommand const&>(command));
+				break;
 			case Command::httprequest:
 				{
 					auto * http_socket = dynamic_cast<CHttpControlSocket*>(controlSocket_.get());
@@ -658,6 +723,19 @@ void CFileZillaEnginePrivate::OnCommandEvent()
 					}
 				}
 				break;
+			case Command::uploadbatch:
+				{
+					auto * sftp_socket = dynamic_cast<CSftpControlSocket*>(controlSocket_.get());
+					if (sftp_socket) {
+						sftp_socket->UploadBatch(static_cast<CUploadBatchCommand const&>(command));
+						res = FZ_REPLY_CONTINUE;
+					}
+					else {
+						logger_->log(logmsg::error, _("Command not supported by this protocol"));
+						res = FZ_REPLY_NOTSUPPORTED;
+					}
+				}
+				break;
 			default:
 				res = FZ_REPLY_SYNTAXERROR;
 			}
@@ -689,6 +767,7 @@ void CFileZillaEnginePrivate::DoCancel()
 
 		controlSocket_.reset();
 
+		Trace(trace_event::command_end, FZ_REPLY_DISCONNECTED | FZ_REPLY_CANCELED);
 		currentCommand_.reset();
 
 		stop_timer(m_retryTimer);
@@ -750,6 +829,8 @@ int CFileZillaEnginePrivate::Execute(CCommand const& command)
 	}
 
 	currentCommand_.reset(command.Clone());
+	++operation_id_;
+	Trace(trace_event::command_start, static_cast<int64_t>(command.GetId()));
 	send_event<CCommandEvent>();
 
 	return FZ_REPLY_WOULDBLOCK;
@@ -757,14 +838,21 @@ int CFileZillaEnginePrivate::Execute(CCommand const& command)
 
 std::unique_ptr<CNotification> CFileZillaEnginePrivate::GetNextNotification()
 {
-	fz::scoped_lock lock(notification_mutex_);
+	if (drained_notifications_.empty()) {
+		// Take all pending notifications at once so that the lock isn't
+		// contended by the engine threads for every single one of them.
+		fz::scoped_lock lock(notification_mutex_);
 
-	if (m_NotificationList.empty()) {
-		m_maySendNotificationEvent = true;
-		return nullptr;
+		if (m_NotificationList.empty()) {
+			m_maySendNotificationEvent = true;
+			return nullptr;
+		}
+		drained_notifications_.swap(m_NotificationList);
 	}
-	std::unique_ptr<CNotification> pNotification(m_NotificationList.front());
-	m_NotificationList.pop_front();
+
+	std::unique_ptr<CNotification> pNotification(drained_notifications_.front());
+	drained_notifications_.pop_front();
+	counters_->pending_notifications.fetch_sub(1, std::memory_order_relaxed);
 
 	return pNotification;
 }
@@ -832,6 +920,59 @@ int CFileZillaEnginePrivate::CacheLookup(const CServerPath& path, CDirectoryList
 
 	bool is_outdated = false;
 	if (!directory_cache_.Lookup(listing, controlSocket_->GetCurrentServer(), path, true, is_outdated)) {
+		Trace(trace_event::cache_miss);
+		return FZ_REPLY_ERROR;
+	}
+	Trace(trace_event::cache_hit, static_cast<int64_t>(listing.size()));
+
+	return FZ_REPLY_OK;
+}
+
+int CFileZillaEnginePrivate::CacheLookupMany(std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings)
+{
+	fz::scoped_lock lock(mutex_);
+
+	if (!IsConnected()) {
+		return FZ_REPLY_ERROR;
+	}
+
+	assert(controlSocket_->GetCurrentServer());
+
+	return DoCacheLookupMany(controlSocket_->GetCurrentServer(), paths, listings);
+}
+
+int CFileZillaEnginePrivate::CacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings)
+{
+	fz::scoped_lock lock(mutex_);
+	return DoCacheLookupMany(server, paths, listings);
+}
+
+int CFileZillaEnginePrivate::DoCacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings)
+{
+	size_t const found = directory_cache_.LookupMany(listings, server, paths, true);
+	for (auto const& listing : listings) {
+		if (listing.path.empty()) {
+			Trace(trace_event::cache_miss);
+		}
+		else {
+			Trace(trace_event::cache_hit, static_cast<int64_t>(listing.size()));
+		}
+	}
+
+	return found ? FZ_REPLY_OK : FZ_REPLY_ERROR;
+}
+
+int CFileZillaEnginePrivate::CacheLookupTree(CServerPath const& path, std::wstring const& needle, std::vector<CDirectoryListing>& listings)
+{
+	fz::scoped_lock lock(mutex_);
+
+	if (!IsConnected()) {
+		return FZ_REPLY_ERROR;
+	}
+
+	assert(controlSocket_->GetCurrentServer());
+
+	if (!directory_cache_.LookupTree(listings, controlSocket_->GetCurrentServer(), path, needle)) {
 		return FZ_REPLY_ERROR;
 	}
 
@@ -849,6 +990,95 @@ int CFileZillaEnginePrivate::Cancel()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+void CFileZillaEnginePrivate::RecordMetrics(trace_event::type event, int64_t value)
+{
+	switch (event) {
+	case trace_event::command_start:
+		command_start_ = fz::monotonic_clock::now();
+		command_queued_ = command_start_;
+		connected_ = fz::monotonic_clock();
+		command_lock_wait_ = fz::duration();
+		break;
+	case trace_event::connected:
+		connected_ = fz::monotonic_clock::now();
+		break;
+	case trace_event::command_end:
+		metrics_.AddCommand((value & FZ_REPLY_ERROR) == FZ_REPLY_ERROR);
+		if (command_start_ && currentCommand_) {
+			auto const now = fz::monotonic_clock::now();
+			Command const id = currentCommand_->GetId();
+
+			// Time spent waiting for locks is not attributed to the command
+			fz::duration busy = now - command_start_ - command_lock_wait_;
+			AddPhaseTime(engine_phase::lock_wait, command_lock_wait_);
+			switch (id) {
+			case Command::connect:
+				// Not all protocols report when the connection is established,
+				// all of it counts as connecting then.
+				if (connected_ && connected_ >= command_start_) {
+					fz::duration const login = std::min(now - connected_, busy);
+					AddPhaseTime(engine_phase::connect, busy - login);
+					AddPhaseTime(engine_phase::login, login);
+				}
+				else {
+					AddPhaseTime(engine_phase::connect, busy);
+				}
+				break;
+			case Command::list:
+				AddPhaseTime(engine_phase::list, busy);
+				break;
+			case Command::transfer:
+				AddPhaseTime(engine_phase::transfer, busy);
+				break;
+			default:
+				AddPhaseTime(engine_phase::other, busy);
+				break;
+			}
+
+			slow_operation op;
+			op.engine_id = m_engine_id;
+			op.command = id;
+			op.reply = static_cast<int>(value);
+			op.duration = now - command_start_;
+			op.time = fz::datetime::now();
+			metrics_.AddSlowOperation(op);
+
+			command_start_ = fz::monotonic_clock();
+		}
+		break;
+	case trace_event::bytes_transferred:
+		metrics_.AddBytes(value);
+		break;
+	case trace_event::cache_hit:
+	case trace_event::cache_miss:
+		metrics_.AddCacheLookup(event == trace_event::cache_hit);
+		break;
+	case trace_event::lock_wait:
+		lock_wait_start_ = fz::monotonic_clock::now();
+		break;
+	case trace_event::lock_acquired:
+		// -1 if acquired after waiting
+		if (value == -1 && lock_wait_start_) {
+			fz::duration const wait = fz::monotonic_clock::now() - lock_wait_start_;
+			metrics_.AddLockWait(wait);
+			if (command_start_) {
+				command_lock_wait_ += wait;
+			}
+			lock_wait_start_ = fz::monotonic_clock();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void CFileZillaEnginePrivate::AddPhaseTime(engine_phase phase, fz::duration const& d)
+{
+	if (d) {
+		counters_->phase_us[static_cast<size_t>(phase)].fetch_add(d.get_microseconds(), std::memory_order_relaxed);
+	}
+}
+
 void CFileZillaEnginePrivate::OnOptionsChanged(changed_options_t const&)
 {
 	bool queue_logs = ShouldQueueLogsFromOptions();
@@ -918,6 +1148,8 @@ void CTransferStatusManager::Update(int64_t transferredBytes)
 {
 	CNotification* notification = nullptr;
 
+	engine_.Trace(trace_event::bytes_transferred, transferredBytes);
+
 	{
 		int64_t oldOffset = currentOffset_.fetch_add(transferredBytes);
 		if (!oldOffset) {
@@ -960,6 +1192,22 @@ CTransferStatus CTransferStatusManager::Get(bool &changed)
 	return status_;
 }
 
+int64_t CTransferStatusManager::Rate()
+{
+	fz::scoped_lock lock(mutex_);
+	if (!status_ || status_.started.empty()) {
+		return -1;
+	}
+
+	int64_t const elapsed = (fz::datetime::now() - status_.started).get_milliseconds();
+	if (elapsed < 1000) {
+		return -1;
+	}
+
+	int64_t const transferred = status_.currentOffset + currentOffset_ - status_.startOffset;
+	return transferred * 1000 / elapsed;
+}
+
 bool CTransferStatusManager::empty()
 {
 	fz::scoped_lock lock(mutex_);
@@ -7,8 +7,10 @@
 #include <libfilezilla/time.hpp>
 
 #include "engine_context.h"
+#include "engine_metrics.h"
 #include "FileZillaEngine.h"
 #include "option_change_event_handler.h"
+#include "trace_log.h"
 
 #include <atomic>
 #include <list>
@@ -42,6 +44,10 @@ public:
 	void SetMadeProgress();
 	void Update(int64_t transferredBytes);
 
+	// Average in bytes per second since the start of the transfer, -1 if
+	// unknown or if the transfer has not been going on long enough.
+	int64_t Rate();
+
 	CTransferStatus Get(bool &changed);
 
 protected:
@@ -74,6 +80,9 @@ public:
 	CTransferStatus GetTransferStatus(bool &changed);
 
 	int CacheLookup(CServerPath const& path, CDirectoryListing& listing);
+	int CacheLookupMany(std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings);
+	int CacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings);
+	int CacheLookupTree(CServerPath const& path, std::wstring const& needle, std::vector<CDirectoryListing>& listings);
 
 	static bool IsActive(CFileZillaEngine::_direction direction);
 	void SetActive(int direction);
@@ -90,6 +99,7 @@ public:
 	CPathCache& GetPathCache() { return path_cache_; }
 	fz::thread_pool& GetThreadPool() { return thread_pool_; }
 	CFileZillaEngineContext& GetContext() { return context_; }
+	std::string GetSourceAddress() { return context_.GetSourceAddress(sourceAddressSlot_); }
 	CFileZillaEngine& GetParent() { return parent_; }
 
 	// If deleting or renaming a directory, it could be possible that another
@@ -103,6 +113,17 @@ public:
 
 	unsigned int GetEngineId() const { return m_engine_id; }
 
+	CEngineMetrics& GetMetrics() { return metrics_; }
+
+	// Records an event in the metrics and, if enabled, in the trace log,
+	// tagged with the current operation
+	void Trace(trace_event::type event, int64_t value = 0) {
+		RecordMetrics(event, value);
+		if (trace_log_.enabled()) {
+			trace_log_.Record(m_engine_id, operation_id_, event, value);
+		}
+	}
+
 	CTransferStatusManager transfer_status_;
 
 	CustomEncodingConverterBase const& GetEncodingConverter() const { return encoding_converter_; }
@@ -121,6 +142,7 @@ protected:
 
 	int CheckCommandPreconditions(CCommand const& command, bool checkBusy);
 
+	int DoCacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings);
 
 	bool CheckAsyncRequestReplyPreconditions(std::unique_ptr<CAsyncRequestNotification> const& reply);
 	void OnSetAsyncRequestReplyEvent(std::unique_ptr<CAsyncRequestNotification> const& reply);
@@ -136,6 +158,10 @@ protected:
 	int Mkdir(CMkdirCommand const& command);
 	int Rename(CRenameCommand const& command);
 	int Chmod(CChmodCommand const& command);
+	int FileHash(CFileHashCommand const& command);
+	int Copy(CCopyCommand const& command);
+	int Fxp(CFxpCommand const& command);
+	int Batch(CBatchCommand const& command);
 
 	void DoCancel();
 
@@ -159,6 +185,7 @@ protected:
 	EngineNotificationHandler& notification_handler_;
 
 	unsigned int const m_engine_id;
+	size_t const sourceAddressSlot_;
 
 	static std::vector<CFileZillaEnginePrivate*> m_engineList;
 
@@ -169,12 +196,19 @@ protected:
 
 	std::unique_ptr<CCommand> currentCommand_;
 
+	// Incremented for each command executed, identifies the operation in the trace log
+	std::atomic<unsigned int> operation_id_{};
+
 	// Protect access to these with notification_mutex_
 	std::deque<CNotification*> m_NotificationList;
 	bool m_maySendNotificationEvent{true};
 	bool queue_logs_{true};
 	std::vector<CLogmsgNotification*> queued_logs_;
 
+	// Notifications taken from m_NotificationList in one go, only accessed
+	// by the thread calling GetNextNotification
+	std::deque<CNotification*> drained_notifications_;
+
 
 	std::atomic<unsigned int> asyncRequestCounter_{};
 
@@ -211,6 +245,21 @@ protected:
 	CustomEncodingConverterBase const& encoding_converter_;
 
 	CFileZillaEngineContext& context_;
+
+	CTraceLog& trace_log_;
+
+	void RecordMetrics(trace_event::type event, int64_t value);
+
+	CEngineMetrics& metrics_;
+	fz::monotonic_clock lock_wait_start_;
+
+	// For the per-phase breakdown of the current command
+	void AddPhaseTime(engine_phase phase, fz::duration const& d);
+	std::shared_ptr<engine_counters> counters_;
+	fz::monotonic_clock command_start_;
+	fz::monotonic_clock command_queued_;
+	fz::monotonic_clock connected_;
+	fz::duration command_lock_wait_;
 };
 
 struct async_request_reply_event_type{};
@@ -0,0 +1,149 @@
+#include <filezilla.h>
+
+#include "external_ip_cache.h"
+#include "externalipresolver.h"
+
+#include <algorithm>
+
+#include <libfilezilla/iputils.hpp>
+
+namespace {
+// External addresses rarely change, but do after a reconnect of the uplink
+fz::duration const refresh_after = fz::duration::from_minutes(10);
+
+// Afterwards the resolver gets asked again, the result of a refresh can
+// hardly be worse than an address this old.
+fz::duration const max_age = fz::duration::from_hours(1);
+
+fz::duration const failure_ttl = fz::duration::from_minutes(1);
+
+struct start_event_type;
+typedef fz::simple_event<start_event_type> start_event;
+}
+
+CExternalIPCache::CExternalIPCache(fz::event_loop & loop, fz::thread_pool & pool)
+	: fz::event_handler(loop)
+	, pool_(pool)
+{
+}
+
+CExternalIPCache::~CExternalIPCache()
+{
+	remove_handler();
+	resolver_.reset();
+}
+
+CExternalIPCache::result CExternalIPCache::Get(std::wstring const& resolver, fz::event_handler & handler, std::string & ip)
+{
+	fz::scoped_lock l(mutex_);
+
+	auto const now = fz::monotonic_clock::now();
+	bool const known = !time_.empty() && resolver_address_ == resolver;
+	if (known) {
+		auto const age = now - time_;
+		if (failed_) {
+			if (age < failure_ttl) {
+				return result::failed;
+			}
+		}
+		else if (age < max_age) {
+			if (age >= refresh_after && pending_.empty() && (attempt_.empty() || now - attempt_ >= failure_ttl)) {
+				pending_ = resolver;
+				send_event<start_event>();
+			}
+			ip = ip_;
+			return result::ok;
+		}
+	}
+
+	if (std::find(waiters_.cbegin(), waiters_.cend(), &handler) == waiters_.cend()) {
+		waiters_.push_back(&handler);
+	}
+	if (pending_.empty()) {
+		pending_ = resolver;
+		send_event<start_event>();
+	}
+	else if (pending_ != resolver) {
+		// The setting got changed, the new resolver gets asked next
+		pending_ = resolver;
+	}
+
+	return result::pending;
+}
+
+void CExternalIPCache::Unsubscribe(fz::event_handler & handler)
+{
+	fz::scoped_lock l(mutex_);
+	waiters_.erase(std::remove(waiters_.begin(), waiters_.end(), &handler), waiters_.end());
+}
+
+void CExternalIPCache::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<start_event, CExternalIPResolveEvent>(ev, this,
+		&CExternalIPCache::OnStart,
+		&CExternalIPCache::OnResolved);
+}
+
+void CExternalIPCache::OnStart()
+{
+	if (resolver_) {
+		return;
+	}
+
+	{
+		fz::scoped_lock l(mutex_);
+		requested_ = pending_;
+		attempt_ = fz::monotonic_clock::now();
+	}
+	if (requested_.empty()) {
+		return;
+	}
+
+	resolver_ = std::make_unique<CExternalIPResolver>(pool_, *this);
+	resolver_->GetExternalIP(requested_, fz::address_type::ipv4);
+	if (resolver_->Done()) {
+		OnResolved();
+	}
+}
+
+void CExternalIPCache::OnResolved()
+{
+	if (!resolver_ || !resolver_->Done()) {
+		return;
+	}
+
+	bool const successful = resolver_->Successful();
+	std::string const ip = resolver_->GetIP();
+	resolver_.reset();
+	Finish(successful, ip);
+}
+
+void CExternalIPCache::Finish(bool successful, std::string const& ip)
+{
+	std::vector<fz::event_handler*> waiters;
+	{
+		fz::scoped_lock l(mutex_);
+
+		// A refresh failing keeps the older address until it gets too old
+		bool const keep = !successful && !failed_ && !time_.empty() && resolver_address_ == requested_ && fz::monotonic_clock::now() - time_ < max_age;
+		if (!keep) {
+			failed_ = !successful;
+			ip_ = ip;
+			time_ = fz::monotonic_clock::now();
+			resolver_address_ = requested_;
+		}
+
+		if (pending_ != requested_) {
+			// The resolver got changed in the meantime, ask the new one
+			send_event<start_event>();
+			return;
+		}
+		pending_.clear();
+
+		std::swap(waiters, waiters_);
+	}
+
+	for (auto * handler : waiters) {
+		handler->send_event<CExternalIPResolveEvent>();
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef FILEZILLA_ENGINE_EXTERNAL_IP_CACHE_HEADER
+#define FILEZILLA_ENGINE_EXTERNAL_IP_CACHE_HEADER
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class CExternalIPResolver;
+
+// The external IP address for active mode, shared by all engines. Engines
+// asking at the same time wait for a single request to the resolver. Once
+// known, the address is handed out right away, an old one gets refreshed in
+// the background while still being used.
+//
+// Failures are remembered as well for a short while, transfers fall back to
+// the local address until then instead of each waiting for the resolver.
+class CExternalIPCache final : public fz::event_handler
+{
+public:
+	enum class result
+	{
+		ok,
+		failed,
+
+		// The handler gets a CExternalIPResolveEvent once there is a result
+		pending
+	};
+
+	CExternalIPCache(fz::event_loop & loop, fz::thread_pool & pool);
+	virtual ~CExternalIPCache();
+
+	result Get(std::wstring const& resolver, fz::event_handler & handler, std::string & ip);
+
+	// Must be called before a handler waiting for a result goes away
+	void Unsubscribe(fz::event_handler & handler);
+
+private:
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnStart();
+	void OnResolved();
+	void Finish(bool successful, std::string const& ip);
+
+	fz::thread_pool & pool_;
+
+	fz::mutex mutex_;
+
+	// Only touched on the event loop
+	std::unique_ptr<CExternalIPResolver> resolver_;
+
+	// Resolver address to ask, of the request in flight, and of the cached
+	// result
+	std::wstring pending_;
+	std::wstring requested_;
+	std::wstring resolver_address_;
+
+	std::string ip_;
+	fz::monotonic_clock time_;
+	bool failed_{};
+
+	// Start of the last request, a failing refresh only gets retried so often
+	fz::monotonic_clock attempt_;
+
+	std::vector<fz::event_handler*> waiters_;
+};
+
+#endif
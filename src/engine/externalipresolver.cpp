@@ -7,12 +7,6 @@
 
 #include <regex>
 
-namespace {
-fz::mutex s_sync;
-std::string ip;
-bool checked = false;
-}
-
 CExternalIPResolver::CExternalIPResolver(fz::thread_pool & pool, fz::event_handler & handler)
 	: fz::event_handler(handler.event_loop_)
 	, thread_pool_(pool)
@@ -25,21 +19,8 @@ CExternalIPResolver::~CExternalIPResolver()
 	remove_handler();
 }
 
-void CExternalIPResolver::GetExternalIP(std::wstring const& address, fz::address_type protocol, bool force)
+void CExternalIPResolver::GetExternalIP(std::wstring const& address, fz::address_type protocol)
 {
-	{
-		fz::scoped_lock l(s_sync);
-		if (checked) {
-			if (force) {
-				checked = false;
-			}
-			else {
-				m_done = true;
-				return;
-			}
-		}
-	}
-
 	m_address = address;
 	m_protocol = protocol;
 
@@ -204,12 +185,8 @@ void CExternalIPResolver::Close(bool successful)
 
 	m_done = true;
 
-	{
-		fz::scoped_lock l(s_sync);
-		if (!successful) {
-			ip.clear();
-		}
-		checked = true;
+	if (!successful) {
+		m_ip.clear();
 	}
 
 	if (m_handler) {
@@ -369,8 +346,7 @@ void CExternalIPResolver::OnData(unsigned char* buffer, size_t len)
 			return;
 		}
 
-		fz::scoped_lock l(s_sync);
-		ip = m_data;
+		m_ip = m_data;
 	}
 	else {
 		// Validate ip address
@@ -385,8 +361,7 @@ void CExternalIPResolver::OnData(unsigned char* buffer, size_t len)
 			return;
 		}
 
-		fz::scoped_lock l(s_sync);
-		ip = m[2];
+		m_ip = m[2];
 	}
 
 	Close(true);
@@ -504,12 +479,10 @@ void CExternalIPResolver::OnChunkedData()
 
 bool CExternalIPResolver::Successful() const
 {
-	fz::scoped_lock l(s_sync);
-	return !ip.empty();
+	return !m_ip.empty();
 }
 
 std::string CExternalIPResolver::GetIP() const
 {
-	fz::scoped_lock l(s_sync);
-	return ip;
+	return m_ip;
 }
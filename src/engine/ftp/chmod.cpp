@@ -2,6 +2,7 @@
 
 #include "chmod.h"
 #include "../directorycache.h"
+#include "../servercapabilities.h"
 
 enum chmodStates
 {
@@ -10,17 +11,47 @@ enum chmodStates
 	chmod_chmod
 };
 
+namespace {
+// Maximum number of SITE CHMOD commands in flight
+size_t const pipeline_depth = 8;
+
+// Changed files are written to the directory cache in batches of this size
+size_t const cache_batch = 100;
+}
+
+CFtpChmodOpData::CFtpChmodOpData(CFtpControlSocket & controlSocket, CChmodCommand const& command)
+	: COpData(Command::chmod, L"CFtpChmodOpData")
+	, CFtpOpData(controlSocket)
+	, path_(command.GetPath())
+	, files_(command.GetFiles().rbegin(), command.GetFiles().rend())
+{}
+
 int CFtpChmodOpData::Send()
 {
 	if (opState == chmod_init) {
-		log(logmsg::status, _("Setting permissions of '%s' to '%s'"), command_.GetPath().FormatFilename(command_.GetFile()), command_.GetPermission());
+		if (files_.size() == 1) {
+			log(logmsg::status, _("Setting permissions of '%s' to '%s'"), path_.FormatFilename(files_.back().first), files_.back().second);
+		}
+		else {
+			log(logmsg::status, _("Setting permissions of %d files in '%s'"), files_.size(), path_.GetPath());
+		}
 
-		controlSocket_.ChangeDir(command_.GetPath());
+		controlSocket_.ChangeDir(path_);
 		opState = chmod_waitcwd;
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == chmod_chmod) {
-		return controlSocket_.SendCommand(L"SITE CHMOD " + command_.GetPermission() + L" " + command_.GetPath().FormatFilename(command_.GetFile(), !useAbsolute_));
+		// The replies to pipelined commands arrive in order
+		while (inFlight_ < window_ && inFlight_ < files_.size()) {
+			auto const& [file, permission] = files_[files_.size() - 1 - inFlight_];
+			int res = controlSocket_.SendCommand(L"SITE CHMOD " + permission + L" " + path_.FormatFilename(file, !useAbsolute_));
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				return res;
+			}
+			++inFlight_;
+		}
+
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
 	return FZ_REPLY_INTERNALERROR;
@@ -28,14 +59,58 @@ int CFtpChmodOpData::Send()
 
 int CFtpChmodOpData::ParseResponse()
 {
+	if (!inFlight_) {
+		log(logmsg::debug_warning, L"Reply received without pending SITE CHMOD command");
+		return FZ_REPLY_INTERNALERROR;
+	}
+
 	int code = controlSocket_.GetReplyCode();
+	if (code == 1) {
+		// Preliminary reply, the final one follows
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	--inFlight_;
+
 	if (code != 2 && code != 3) {
-		return FZ_REPLY_ERROR;
+		if (window_ > 1) {
+			// Could be the server not coping with pipelined commands. Stop
+			// pipelining and try again once the other files are done.
+			retry_.push_back(std::move(files_.back()));
+			window_ = 1;
+		}
+		else {
+			chmodFailed_ = true;
+		}
+	}
+	else {
+		if (retrying_) {
+			log(logmsg::debug_info, L"Changing permissions failed while pipelining commands but succeeded on its own, no longer pipelining commands to this server");
+			CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+		}
+		else if (window_ == 1 && retry_.empty() && files_.size() > 1 && CServerCapabilities::GetCapability(currentServer_, command_pipelining) != no) {
+			window_ = pipeline_depth;
+		}
+
+		changed_.push_back(std::move(files_.back()));
+		if (changed_.size() >= cache_batch) {
+			engine_.GetDirectoryCache().UpdatePermissions(currentServer_, path_, changed_);
+			changed_.clear();
+		}
+	}
+
+	files_.pop_back();
+
+	if (files_.empty() && !retry_.empty()) {
+		files_.swap(retry_);
+		retrying_ = true;
 	}
 
-	engine_.GetDirectoryCache().UpdateFile(currentServer_, command_.GetPath(), command_.GetFile(), false, CDirectoryCache::unknown);
+	if (!files_.empty()) {
+		return FZ_REPLY_CONTINUE;
+	}
 
-	return FZ_REPLY_OK;
+	return chmodFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
 }
 
 int CFtpChmodOpData::SubcommandResult(int prevResult, COpData const&)
@@ -52,3 +127,16 @@ int CFtpChmodOpData::SubcommandResult(int prevResult, COpData const&)
 		return FZ_REPLY_INTERNALERROR;
 	}
 }
+
+int CFtpChmodOpData::Reset(int result)
+{
+	if (inFlight_ > 1 && (result & FZ_REPLY_DISCONNECTED)) {
+		log(logmsg::debug_info, L"Connection lost with several commands in flight, no longer pipelining commands to this server");
+		CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+	}
+
+	engine_.GetDirectoryCache().UpdatePermissions(currentServer_, path_, changed_);
+	changed_.clear();
+
+	return result;
+}
@@ -6,18 +6,37 @@
 class CFtpChmodOpData final : public COpData, public CFtpOpData
 {
 public:
-	CFtpChmodOpData(CFtpControlSocket & controlSocket, CChmodCommand const& command)
-	    : COpData(Command::chmod, L"CFtpChmodOpData")
-		, CFtpOpData(controlSocket)
-		, command_(command)
-	{}
+	CFtpChmodOpData(CFtpControlSocket & controlSocket, CChmodCommand const& command);
 
 	virtual int Send() override;
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const&) override;
+	virtual int Reset(int result) override;
 
-	CChmodCommand command_;
+	CServerPath const path_;
+
+	// Pairs of filename and permission, processed from the back
+	std::vector<std::pair<std::wstring, std::wstring>> files_;
 	bool useAbsolute_{};
+
+	// Set to true if changing the permissions of at least one file failed
+	bool chmodFailed_{};
+
+	// Number of SITE CHMOD commands sent but not yet replied to, they are
+	// for the last files in files_.
+	size_t inFlight_{};
+
+	// Commands to keep in flight. Starts out at 1 until the server has
+	// replied to the first command.
+	size_t window_{1};
+
+	// Files that failed while pipelining, retried one after another once
+	// the others are done.
+	std::vector<std::pair<std::wstring, std::wstring>> retry_;
+	bool retrying_{};
+
+	// Files changed but not yet updated in the directory cache
+	std::vector<std::pair<std::wstring, std::wstring>> changed_;
 };
 
 #endif
@@ -130,6 +130,9 @@ int CFtpChangeDirOpData::ParseResponse()
 			if (tryMkdOnFail_) {
 				tryMkdOnFail_ = false;
 
+				// Whatever was known about it is outdated
+				engine_.GetPathCache().InvalidatePath(currentServer_, path_);
+
 				controlSocket_.Mkdir(path_);
 				return FZ_REPLY_CONTINUE;
 			}
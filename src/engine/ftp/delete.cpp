@@ -2,6 +2,7 @@
 
 #include "delete.h"
 #include "../directorycache.h"
+#include "../servercapabilities.h"
 
 enum rmdStates
 {
@@ -10,6 +11,11 @@ enum rmdStates
 	del_del
 };
 
+namespace {
+// Maximum number of DELE commands in flight
+size_t const pipeline_depth = 8;
+}
+
 int CFtpDeleteOpData::Send()
 {
 	if (opState == del_init) {
@@ -18,21 +24,31 @@ int CFtpDeleteOpData::Send()
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == del_del) {
-		std::wstring const& file = files_.back();
-		if (file.empty()) {
-			log(logmsg::debug_info, L"Empty filename");
-			return FZ_REPLY_INTERNALERROR;
+		// The replies to pipelined commands arrive in order, files_ is
+		// processed from the back.
+		while (inFlight_ < window_ && inFlight_ < files_.size()) {
+			std::wstring const& file = files_[files_.size() - 1 - inFlight_];
+			if (file.empty()) {
+				log(logmsg::debug_info, L"Empty filename");
+				return FZ_REPLY_INTERNALERROR;
+			}
+
+			std::wstring filename = path_.FormatFilename(file, omitPath_);
+			if (filename.empty()) {
+				log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
+				return FZ_REPLY_ERROR;
+			}
+
+			engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+
+			int res = controlSocket_.SendCommand(L"DELE " + filename);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				return res;
+			}
+			++inFlight_;
 		}
 
-		std::wstring filename = path_.FormatFilename(file, omitPath_);
-		if (filename.empty()) {
-			log(logmsg::error, _("Filename cannot be constructed for directory %s and filename %s"), path_.GetPath(), file);
-			return FZ_REPLY_ERROR;
-		}
-
-		engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
-
-		return controlSocket_.SendCommand(L"DELE " + filename);
+		return FZ_REPLY_WOULDBLOCK;
 	}
 
 	log(logmsg::debug_warning, L"Unkown op state %d", opState);
@@ -41,12 +57,39 @@ int CFtpDeleteOpData::Send()
 
 int CFtpDeleteOpData::ParseResponse()
 {
+	if (!inFlight_) {
+		log(logmsg::debug_warning, L"Reply received without pending DELE command");
+		return FZ_REPLY_INTERNALERROR;
+	}
+
 	int code = controlSocket_.GetReplyCode();
+	if (code == 1) {
+		// Preliminary reply, the final one follows
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	--inFlight_;
+	std::wstring const& file = files_.back();
+
 	if (code != 2 && code != 3) {
-		deleteFailed_ = true;
+		if (window_ > 1) {
+			// Could be the server not coping with pipelined commands. Stop
+			// pipelining and try again once the other files are done.
+			retry_.push_back(file);
+			window_ = 1;
+		}
+		else {
+			deleteFailed_ = true;
+		}
 	}
 	else {
-		std::wstring const& file = files_.back();
+		if (retrying_) {
+			log(logmsg::debug_info, L"Deletion failed while pipelining commands but succeeded on its own, no longer pipelining commands to this server");
+			CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+		}
+		else if (window_ == 1 && retry_.empty() && CServerCapabilities::GetCapability(currentServer_, command_pipelining) != no) {
+			window_ = pipeline_depth;
+		}
 
 		engine_.GetDirectoryCache().RemoveFile(currentServer_, path_, file);
 
@@ -63,6 +106,11 @@ int CFtpDeleteOpData::ParseResponse()
 
 	files_.pop_back();
 
+	if (files_.empty() && !retry_.empty()) {
+		files_.swap(retry_);
+		retrying_ = true;
+	}
+
 	if (!files_.empty()) {
 		return FZ_REPLY_CONTINUE;
 	}
@@ -89,6 +137,11 @@ int CFtpDeleteOpData::SubcommandResult(int prevResult, COpData const&)
 
 int CFtpDeleteOpData::Reset(int result)
 {
+	if (inFlight_ > 1 && (result & FZ_REPLY_DISCONNECTED)) {
+		log(logmsg::debug_info, L"Connection lost with several commands in flight, no longer pipelining commands to this server");
+		CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+	}
+
 	if (needSendListing_ && !(result & FZ_REPLY_DISCONNECTED)) {
 		controlSocket_.SendDirectoryListingNotification(path_, false);
 	}
@@ -30,6 +30,19 @@ public:
 
 	// Set to true if deletion of at least one file failed
 	bool deleteFailed_{};
+
+	// Number of DELE commands sent but not yet replied to. The files
+	// they are for are the last ones in files_.
+	size_t inFlight_{};
+
+	// Commands to keep in flight. Starts out at 1 until the server
+	// has replied to the first command.
+	size_t window_{1};
+
+	// Files that could not be deleted while pipelining, retried one
+	// after another once the others are done.
+	std::vector<std::wstring> retry_;
+	bool retrying_{};
 };
 
 #endif
@@ -0,0 +1,181 @@
+#include <filezilla.h>
+
+#include "filehash.h"
+#include "servercapabilities.h"
+
+#include <libfilezilla/string.hpp>
+
+#include <algorithm>
+
+enum filehashStates
+{
+	filehash_init,
+	filehash_opts,
+	filehash_hash
+};
+
+namespace {
+// In order of preference
+wchar_t const* const hash_algorithms[] = { L"SHA-512", L"SHA-256", L"SHA-1", L"MD5", L"CRC32" };
+
+size_t hex_length(std::wstring const& algorithm)
+{
+	if (algorithm == L"SHA-512") {
+		return 128;
+	}
+	else if (algorithm == L"SHA-256") {
+		return 64;
+	}
+	else if (algorithm == L"SHA-1") {
+		return 40;
+	}
+	else if (algorithm == L"MD5") {
+		return 32;
+	}
+	return 8;
+}
+
+// Some servers drop leading zeros of the CRC, other hashes have to be complete
+bool valid_length(std::wstring const& algorithm, size_t length)
+{
+	size_t const expected = hex_length(algorithm);
+	return length == expected || (algorithm == L"CRC32" && length && length < expected);
+}
+
+bool is_hex(std::wstring const& token)
+{
+	for (auto const& c : token) {
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) {
+			return false;
+		}
+	}
+	return !token.empty();
+}
+}
+
+int CFtpFileHashOpData::Send()
+{
+	switch (opState)
+	{
+	case filehash_init:
+		{
+			log(logmsg::status, _("Retrieving checksum of '%s'"), command_.path_.FormatFilename(command_.file_));
+
+			std::wstring algorithms;
+			if (CServerCapabilities::GetCapability(currentServer_, hash_command, &algorithms) == yes) {
+				// Semicolon separated, the currently selected one is marked with an asterisk
+				std::wstring selected;
+				std::vector<std::wstring> offered;
+				for (auto algorithm : fz::strtok(fz::str_toupper_ascii(algorithms), L";")) {
+					fz::trim(algorithm);
+					if (!algorithm.empty() && algorithm.back() == '*') {
+						algorithm.pop_back();
+						selected = algorithm;
+					}
+					offered.push_back(algorithm);
+				}
+
+				for (auto const* algorithm : hash_algorithms) {
+					if (std::find(offered.cbegin(), offered.cend(), algorithm) != offered.cend()) {
+						algorithm_ = algorithm;
+						break;
+					}
+				}
+
+				hashCommand_ = L"HASH";
+				if (algorithm_.empty() || algorithm_ == selected) {
+					algorithm_ = selected;
+					opState = filehash_hash;
+				}
+				else {
+					opState = filehash_opts;
+				}
+			}
+			else if (CServerCapabilities::GetCapability(currentServer_, xsha1_command) == yes) {
+				hashCommand_ = L"XSHA1";
+				algorithm_ = L"SHA-1";
+				opState = filehash_hash;
+			}
+			else if (CServerCapabilities::GetCapability(currentServer_, xmd5_command) == yes) {
+				hashCommand_ = L"XMD5";
+				algorithm_ = L"MD5";
+				opState = filehash_hash;
+			}
+			else if (CServerCapabilities::GetCapability(currentServer_, xcrc_command) == yes) {
+				hashCommand_ = L"XCRC";
+				algorithm_ = L"CRC32";
+				opState = filehash_hash;
+			}
+			else {
+				log(logmsg::error, _("Server does not support retrieving checksums of files"));
+				return FZ_REPLY_NOTSUPPORTED;
+			}
+			return FZ_REPLY_CONTINUE;
+		}
+	case filehash_opts:
+		return controlSocket_.SendCommand(L"OPTS HASH " + algorithm_);
+	case filehash_hash:
+		return controlSocket_.SendCommand(hashCommand_ + L" " + command_.path_.FormatFilename(command_.file_));
+	default:
+		log(logmsg::debug_warning, L"unknown op state: %d", opState);
+		break;
+	}
+
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpFileHashOpData::ParseResponse()
+{
+	int const code = controlSocket_.GetReplyCode();
+
+	if (opState == filehash_opts) {
+		if (code != 2) {
+			// Stick with whatever the server had selected
+			algorithm_.clear();
+		}
+		opState = filehash_hash;
+		return FZ_REPLY_CONTINUE;
+	}
+
+	if (code != 2) {
+		return FZ_REPLY_ERROR;
+	}
+
+	// HASH replies with "213 <algorithm> <range> <hash> <file>", the older
+	// commands with the bare hash, some also with the filename.
+	auto const& response = controlSocket_.m_Response;
+	auto tokens = fz::strtok(response.size() > 3 ? std::wstring_view(response).substr(3) : std::wstring_view(), L" ");
+	std::wstring hash;
+	if (hashCommand_ == L"HASH") {
+		if (tokens.size() < 3) {
+			log(logmsg::error, _("Could not parse checksum from server reply"));
+			return FZ_REPLY_ERROR;
+		}
+		algorithm_ = fz::str_toupper_ascii(tokens[0]);
+		hash = tokens[2];
+	}
+	else {
+		for (auto const& token : tokens) {
+			if (is_hex(token) && valid_length(algorithm_, token.size())) {
+				hash = token;
+				break;
+			}
+		}
+	}
+
+	if (!is_hex(hash) || !valid_length(algorithm_, hash.size()) ||
+		std::find(std::cbegin(hash_algorithms), std::cend(hash_algorithms), algorithm_) == std::cend(hash_algorithms))
+	{
+		log(logmsg::error, _("Could not parse checksum from server reply"));
+		return FZ_REPLY_ERROR;
+	}
+
+	// Restore the leading zeros of a CRC
+	if (hash.size() < hex_length(algorithm_)) {
+		hash = std::wstring(hex_length(algorithm_) - hash.size(), '0') + hash;
+	}
+
+	engine_.AddNotification(new CFileHashNotification(command_.path_, command_.file_, algorithm_, fz::to_utf8(fz::str_tolower_ascii(hash))));
+
+	return FZ_REPLY_OK;
+}
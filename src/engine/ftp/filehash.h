@@ -0,0 +1,27 @@
+#ifndef FILEZILLA_ENGINE_FTP_FILEHASH_HEADER
+#define FILEZILLA_ENGINE_FTP_FILEHASH_HEADER
+
+#include "ftpcontrolsocket.h"
+
+// Retrieves the checksum of a file through HASH or, as fallback, the
+// older XSHA1, XMD5 and XCRC commands.
+class CFtpFileHashOpData final : public COpData, public CFtpOpData
+{
+public:
+	CFtpFileHashOpData(CFtpControlSocket & controlSocket, CFileHashCommand const& command)
+		: COpData(Command::filehash, L"CFtpFileHashOpData")
+		, CFtpOpData(controlSocket)
+		, command_(command)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	CFileHashCommand const command_;
+
+	// Name of the algorithm, the command used to get the hash
+	std::wstring algorithm_;
+	std::wstring hashCommand_;
+};
+
+#endif
@@ -8,6 +8,8 @@
 #include <libfilezilla/file.hpp>
 #include <libfilezilla/local_filesys.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 
 CFtpFileTransferOpData::CFtpFileTransferOpData(CFtpControlSocket& controlSocket, bool is_download, std::wstring const& local_file, std::wstring const& remote_file, CServerPath const& remote_path, CFileTransferCommand::t_transferSettings const& settings)
@@ -77,7 +79,23 @@ int CFtpFileTransferOpData::Send()
 				// Potentially racy
 				bool didExist = fz::local_filesys::get_file_type(fz::to_native(localFile_)) != fz::local_filesys::unknown;
 
-				if (resume_) {
+				if (transferSettings_.segmentOffset >= 0) {
+					// The queue has already created the local file at its full size
+					if (!pFile->open(fz::to_native(localFile_), fz::file::writing, fz::file::existing)) {
+						log(logmsg::error, _("Failed to open \"%s\" for writing"), localFile_);
+						return FZ_REPLY_ERROR;
+					}
+					if (pFile->seek(transferSettings_.segmentOffset, fz::file::begin) != transferSettings_.segmentOffset) {
+						log(logmsg::error, _("Could not seek to offset %d within file"), transferSettings_.segmentOffset);
+						return FZ_REPLY_ERROR;
+					}
+					fileDidExist_ = true;
+					localFileSize_ = pFile->size();
+					resumeOffset = transferSettings_.segmentOffset;
+
+					engine_.transfer_status_.Init(transferSettings_.segmentSize, 0, false);
+				}
+				else if (resume_) {
 					if (!pFile->open(fz::to_native(localFile_), fz::file::writing, fz::file::existing)) {
 						log(logmsg::error, _("Failed to open \"%s\" for appending/writing"), localFile_);
 						return FZ_REPLY_ERROR;
@@ -113,21 +131,22 @@ int CFtpFileTransferOpData::Send()
 					localFileSize_ = 0;
 				}
 
-				resumeOffset = resume_ ? localFileSize_ : 0;
+				if (transferSettings_.segmentOffset < 0) {
+					resumeOffset = resume_ ? localFileSize_ : 0;
 
-				engine_.transfer_status_.Init(remoteFileSize_, startOffset, false);
+					engine_.transfer_status_.Init(remoteFileSize_, startOffset, false);
+				}
 
-				if (engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
+				if (transferSettings_.segmentOffset < 0 && engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
 					// Try to preallocate the file in order to reduce fragmentation
 					int64_t sizeToPreallocate = remoteFileSize_ - startOffset;
 					if (sizeToPreallocate > 0) {
 						log(logmsg::debug_info, L"Preallocating %d bytes for the file \"%s\"", sizeToPreallocate, localFile_);
 						auto oldPos = pFile->seek(0, fz::file::current);
 						if (oldPos >= 0) {
-							if (pFile->seek(sizeToPreallocate, fz::file::end) == remoteFileSize_) {
-								if (!pFile->truncate()) {
-									log(logmsg::debug_warning, L"Could not preallocate the file");
-								}
+							bool const sparse = binary && engine_.GetOptions().GetOptionVal(OPTION_SPARSE_DOWNLOADS) != 0;
+							if (!CIOThread::Preallocate(*pFile, remoteFileSize_, sparse)) {
+								log(logmsg::debug_warning, L"Could not preallocate the file");
 							}
 							if (pFile->seek(oldPos, fz::file::begin) != oldPos) {
 								log(logmsg::error, _("Could not seek to offset %d within file"), oldPos);
@@ -161,12 +180,7 @@ int CFtpFileTransferOpData::Send()
 							if (engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) &&
 								CServerCapabilities::GetCapability(currentServer_, mfmt_command) == yes)
 							{
-								fz::datetime mtime = fz::local_filesys::get_modification_time(fz::to_native(localFile_));
-								if (!mtime.empty()) {
-									fileTime_ = mtime;
-									opState = filetransfer_mfmt;
-									return FZ_REPLY_CONTINUE;
-								}
+								DeferMfmt();
 							}
 							return FZ_REPLY_OK;
 						}
@@ -195,19 +209,76 @@ int CFtpFileTransferOpData::Send()
 
 				auto len = pFile->size();
 				engine_.transfer_status_.Init(len, startOffset, false);
+
+#ifdef ZEROCOPY_UPLOADS
+				// Without TLS, proxy and upload limits nothing needs to see the
+				// data, it can go straight from the file to the socket.
+				if (!binary) {
+					log(logmsg::debug_verbose, L"Not using sendfile, ASCII mode");
+				}
+				else if (controlSocket_.m_protectDataChannel) {
+					log(logmsg::debug_verbose, L"Not using sendfile, data connection is protected");
+				}
+				else if (controlSocket_.proxy_layer_) {
+					log(logmsg::debug_verbose, L"Not using sendfile, connected through a proxy");
+				}
+				else if (engine_.GetContext().LimitsUploads(currentServer_)) {
+					log(logmsg::debug_verbose, L"Not using sendfile, uploads are speed limited");
+				}
+				else {
+					zeroCopyOffset_ = startOffset;
+					pFile.reset();
+				}
+#endif
 			}
-			ioThread_ = std::make_unique<CIOThread>();
-			if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary)) {
-				// CIOThread will delete pFile
-				ioThread_.reset();
-				log(logmsg::error, _("Could not spawn IO thread"));
-				return FZ_REPLY_ERROR;
+
+			if (pFile) {
+				// Small files do not need the full ring
+				int const bufferSize = engine_.GetOptions().GetOptionVal(OPTION_IOTHREAD_BUFFERSIZE) * 1024;
+				int bufferCount = engine_.GetOptions().GetOptionVal(OPTION_IOTHREAD_BUFFERCOUNT);
+				int64_t const fileSize = download_ ? remoteFileSize_ : localFileSize_;
+				if (fileSize >= 0 && bufferSize > 0) {
+					bufferCount = static_cast<int>(std::min(static_cast<int64_t>(bufferCount), fileSize / bufferSize + 2));
+				}
+				// Preallocated downloads of known size can be written through a mapping of the file
+				int64_t mapSize = -1;
+				if (download_ && binary && remoteFileSize_ > 0 && transferSettings_.segmentOffset < 0 && engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
+					mapSize = remoteFileSize_;
+				}
+
+				ioThread_ = std::make_unique<CIOThread>(bufferCount, bufferSize);
+				ioThread_->SetKeepSize(download_ && transferSettings_.segmentOffset >= 0);
+				if (download_) {
+					ioThread_->SetSparse(engine_.GetOptions().GetOptionVal(OPTION_SPARSE_DOWNLOADS) != 0);
+					ioThread_->SetSyncInterval(static_cast<int64_t>(engine_.GetOptions().GetOptionVal(OPTION_DOWNLOAD_SYNC_INTERVAL)) * 1024 * 1024);
+				}
+				if (!ioThread_->Create(engine_.GetThreadPool(), std::move(pFile), !download_, binary, mapSize)) {
+					// CIOThread will delete pFile
+					ioThread_.reset();
+					log(logmsg::error, _("Could not spawn IO thread"));
+					return FZ_REPLY_ERROR;
+				}
+				if (download_ && transferSettings_.segmentOffset >= 0) {
+					ioThread_->SetJournal(localFile_, localFileSize_, transferSettings_.segmentOffset, transferSettings_.segmentSize);
+				}
 			}
 		}
 
 		controlSocket_.m_pTransferSocket = std::make_unique<CTransferSocket>(engine_, controlSocket_, download_ ? TransferMode::download : TransferMode::upload);
 		controlSocket_.m_pTransferSocket->m_binaryMode = transferSettings_.binary;
 		controlSocket_.m_pTransferSocket->SetIOThread(ioThread_.get());
+		if (download_ && transferSettings_.segmentOffset >= 0) {
+			controlSocket_.m_pTransferSocket->SetDownloadLimit(transferSettings_.segmentSize);
+		}
+#ifdef ZEROCOPY_UPLOADS
+		if (!download_ && !ioThread_) {
+			if (!controlSocket_.m_pTransferSocket->SetZeroCopySource(fz::to_native(localFile_), zeroCopyOffset_)) {
+				log(logmsg::error, _("Failed to open \"%s\" for reading"), localFile_);
+				return FZ_REPLY_ERROR;
+			}
+			log(logmsg::debug_info, L"Using sendfile for upload");
+		}
+#endif
 
 		if (download_) {
 			cmd = L"RETR ";
@@ -229,16 +300,6 @@ int CFtpFileTransferOpData::Send()
 		opState = filetransfer_waittransfer;
 		controlSocket_.Transfer(cmd, this);
 		return FZ_REPLY_CONTINUE;
-	case filetransfer_mfmt:
-	{
-		cmd = L"MFMT ";
-		fz::datetime t = fileTime_;
-		t -= fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
-		cmd += t.format(L"%Y%m%d%H%M%S ", fz::datetime::utc);
-		cmd += remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_);
-
-		break;
-	}
 	default:
 		log(logmsg::debug_warning, L"Unhandled opState: %d", opState);
 		return FZ_REPLY_ERROR;
@@ -251,6 +312,24 @@ int CFtpFileTransferOpData::Send()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+void CFtpFileTransferOpData::DeferMfmt()
+{
+	fz::datetime const mtime = fz::local_filesys::get_modification_time(fz::to_native(localFile_));
+	if (mtime.empty()) {
+		return;
+	}
+	mfmtTime_ = mtime;
+
+	fz::datetime t = mtime;
+	t -= fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
+
+	// The working directory may have changed by the time it gets sent
+	controlSocket_.DeferCommand(L"MFMT " + t.format(L"%Y%m%d%H%M%S ", fz::datetime::utc) + remotePath_.FormatFilename(remoteFile_), remotePath_, remoteFile_);
+
+	// Assume it is going to work, the reply does not get waited for
+	engine_.GetDirectoryCache().UpdateFileTime(currentServer_, remotePath_, remoteFile_, mtime);
+}
+
 int CFtpFileTransferOpData::TestResumeCapability()
 {
 	log(logmsg::debug_verbose, L"CFtpFileTransferOpData::TestResumeCapability()");
@@ -355,6 +434,18 @@ int CFtpFileTransferOpData::ParseResponse()
 		if (response.substr(0, 4) == L"213 " && response.size() > 16) {
 			fileTime_ = fz::datetime(response.substr(4), fz::datetime::utc);
 			if (!fileTime_.empty()) {
+				if (CServerCapabilities::GetCapability(currentServer_, timezone_offset) == unknown) {
+					// Compared with the listed time, the reply tells the timezone
+					// offset of the server without sending MDTM after a listing
+					CDirentry entry;
+					bool dirDidExist;
+					bool matchedCase;
+					if (engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase) &&
+						matchedCase && !entry.is_dir() && entry.has_time())
+					{
+						controlSocket_.LearnTimezoneOffset(entry, fileTime_);
+					}
+				}
 				fileTime_ += fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
 			}
 		}
@@ -367,8 +458,6 @@ int CFtpFileTransferOpData::ParseResponse()
 		}
 
 		break;
-	case filetransfer_mfmt:
-		return FZ_REPLY_OK;
 	default:
 		log(logmsg::debug_warning, L"Unknown op state");
 		return FZ_REPLY_INTERNALERROR;
@@ -498,12 +587,7 @@ int CFtpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			if (!download_ &&
 				CServerCapabilities::GetCapability(currentServer_, mfmt_command) == yes)
 			{
-				fz::datetime mtime = fz::local_filesys::get_modification_time(fz::to_native(localFile_));
-				if (!mtime.empty()) {
-					fileTime_ = mtime;
-					opState = filetransfer_mfmt;
-					return FZ_REPLY_CONTINUE;
-				}
+				DeferMfmt();
 			}
 			else if (download_ && !fileTime_.empty()) {
 				ioThread_.reset();
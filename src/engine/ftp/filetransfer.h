@@ -4,6 +4,7 @@
 #include "ftpcontrolsocket.h"
 
 #include "iothread.h"
+#include "transfersocket.h"
 
 enum filetransferStates
 {
@@ -15,8 +16,7 @@ enum filetransferStates
 	filetransfer_resumetest,
 	filetransfer_transfer,
 	filetransfer_waittransfer,
-	filetransfer_waitresumetest,
-	filetransfer_mfmt
+	filetransfer_waitresumetest
 };
 
 class CFtpFileTransferOpData final : public CFileTransferOpData, public CFtpTransferOpData, public CFtpOpData
@@ -30,8 +30,18 @@ public:
 
 	int TestResumeCapability();
 
+	// Queues the MFMT for the uploaded file with the control socket rather
+	// than waiting for its reply before the next file.
+	void DeferMfmt();
+
 	std::unique_ptr<CIOThread> ioThread_;
 	bool fileDidExist_{true};
+
+	// Start offset for uploads bypassing the IO thread
+	int64_t zeroCopyOffset_{};
+
+	// Modification time queued through DeferMfmt
+	fz::datetime mfmtTime_;
 };
 
 #endif
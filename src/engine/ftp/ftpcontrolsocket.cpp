@@ -6,12 +6,16 @@
 #include "../directorycache.h"
 #include "directorylistingparser.h"
 #include "engineprivate.h"
+#include "external_ip_cache.h"
 #include "externalipresolver.h"
+#include "filehash.h"
 #include "filetransfer.h"
+#include "fxp.h"
 #include "ftpcontrolsocket.h"
 #include "iothread.h"
 #include "list.h"
 #include "logon.h"
+#include "lookup.h"
 #include "mkd.h"
 #include "pathcache.h"
 #include "proxy.h"
@@ -20,6 +24,7 @@
 #include "rename.h"
 #include "rmd.h"
 #include "servercapabilities.h"
+#include "tls_session_cache.h"
 #include "transfersocket.h"
 
 #include <libfilezilla/file.hpp>
@@ -32,6 +37,15 @@
 
 #include <assert.h>
 
+namespace {
+// How long the connection needs to be idle before deferred commands get
+// sent, short enough not to leave them hanging at the end of a queue.
+fz::duration const deferred_command_delay = fz::duration::from_seconds(1);
+
+// Sent before the next upload once that many have accumulated
+size_t const max_deferred_commands = 50;
+}
+
 CFtpControlSocket::CFtpControlSocket(CFileZillaEnginePrivate & engine)
 	: CRealControlSocket(engine)
 {
@@ -46,7 +60,7 @@ CFtpControlSocket::~CFtpControlSocket()
 
 void CFtpControlSocket::OnReceive()
 {
-	log(logmsg::debug_verbose, L"CFtpControlSocket::OnReceive()");
+	FZ_LOG_IF_ENABLED(logger(), logmsg::debug_verbose, L"CFtpControlSocket::OnReceive()");
 
 	size_t const max = 65536;
 
@@ -176,6 +190,7 @@ void CFtpControlSocket::ParseLine(std::wstring line)
 void CFtpControlSocket::OnConnect()
 {
 	m_lastTypeBinary = -1;
+	m_lastModeZ = 0;
 	m_sentRestartOffset = false;
 	m_protectDataChannel = false;
 
@@ -188,7 +203,8 @@ void CFtpControlSocket::OnConnect()
 			tls_layer_ = std::make_unique<fz::tls_layer>(event_loop_, this, *active_layer_, &engine_.GetContext().GetTlsSystemTrustStore(), logger_);
 			active_layer_ = tls_layer_.get();
 
-			if (!tls_layer_->client_handshake(this)) {
+			auto const session = engine_.GetContext().GetTlsSessionCache().Get(currentServer_.GetHost(), currentServer_.GetPort());
+			if (!tls_layer_->client_handshake(this, session, tls_layer_->peer_host())) {
 				DoClose();
 			}
 
@@ -196,10 +212,12 @@ void CFtpControlSocket::OnConnect()
 		}
 		else {
 			log(logmsg::status, _("TLS connection established, waiting for welcome message..."));
+			engine_.GetContext().GetTlsSessionCache().Store(currentServer_.GetHost(), currentServer_.GetPort(), *tls_layer_);
 		}
 	}
 	else if ((currentServer_.GetProtocol() == FTPES || currentServer_.GetProtocol() == FTP) && tls_layer_) {
 		log(logmsg::status, _("TLS connection established."));
+		engine_.GetContext().GetTlsSessionCache().Store(currentServer_.GetHost(), currentServer_.GetPort(), *tls_layer_);
 		SendNextCommand();
 		return;
 	}
@@ -216,6 +234,8 @@ void CFtpControlSocket::ParseResponse()
 		return;
 	}
 
+	engine_.Trace(trace_event::reply_received, fz::to_integral<int64_t>(std::wstring_view(m_Response).substr(0, 3)));
+
 	if (m_Response[0] != '1') {
 		if (m_pendingReplies > 0) {
 			--m_pendingReplies;
@@ -224,10 +244,25 @@ void CFtpControlSocket::ParseResponse()
 			log(logmsg::debug_warning, L"Unexpected reply, no reply was pending.");
 			return;
 		}
+
+		if (preparedPassive_ && preparedPassive_->reply_.empty()) {
+			if (preparedPassive_->before_ > 0) {
+				--preparedPassive_->before_;
+			}
+			else if (GetReplyCode() == 2) {
+				// The operation that sent it is done by now, the reply
+				// itself gets skipped below.
+				preparedPassive_->reply_ = m_Response;
+				preparedPassive_->time_ = fz::monotonic_clock::now();
+			}
+			else {
+				preparedPassive_.reset();
+			}
+		}
 	}
 
 	if (m_repliesToSkip) {
-		log(logmsg::debug_info, L"Skipping reply after cancelled operation or keepalive command.");
+		log(logmsg::debug_info, L"Skipping reply after cancelled operation, keepalive or deferred command.");
 		if (m_Response[0] != '1') {
 			--m_repliesToSkip;
 		}
@@ -305,6 +340,7 @@ int CFtpControlSocket::SendCommand(std::wstring const& str, bool maskArgs, bool
 	bool res = CRealControlSocket::Send(buffer.c_str(), buffer.size());
 	if (res) {
 		++m_pendingReplies;
+		engine_.Trace(trace_event::command_sent, static_cast<int64_t>(buffer.size()));
 	}
 
 	if (measureRTT) {
@@ -324,7 +360,10 @@ int CFtpControlSocket::ResetOperation(int nErrorCode)
  	log(logmsg::debug_verbose, L"CFtpControlSocket::ResetOperation(%d)", nErrorCode);
 
 	m_pTransferSocket.reset();
-	m_pIPResolver.reset();
+	if (waitingForExternalIP_) {
+		engine_.GetContext().GetExternalIPCache().Unsubscribe(*this);
+		waitingForExternalIP_ = false;
+	}
 
 	m_repliesToSkip = m_pendingReplies;
 
@@ -458,6 +497,9 @@ void CFtpControlSocket::TransferEnd()
 		break;
 	case rawtransfer_waitfinish:
 		data.opState = rawtransfer_waittransfer;
+		if (reason == TransferEndReason::successful) {
+			data.PreparePassive();
+		}
 		break;
 	case rawtransfer_waitsocket:
 		ResetOperation((reason == TransferEndReason::successful) ? FZ_REPLY_OK : FZ_REPLY_ERROR);
@@ -589,6 +631,51 @@ void CFtpControlSocket::Chmod(CChmodCommand const& command)
 	Push(std::make_unique<CFtpChmodOpData>(*this, command));
 }
 
+void CFtpControlSocket::FileHash(CFileHashCommand const& command)
+{
+	Push(std::make_unique<CFtpFileHashOpData>(*this, command));
+}
+
+void CFtpControlSocket::Fxp(CFxpCommand const& command)
+{
+	Push(std::make_unique<CFtpFxpOpData>(*this, command));
+}
+
+void CFtpControlSocket::Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry)
+{
+	Push(std::make_unique<CFtpLookupOpData>(*this, path, file, entry));
+}
+
+bool CFtpControlSocket::LearnTimezoneOffset(CDirentry const& entry, fz::datetime const& utc)
+{
+	if (CServerCapabilities::GetCapability(currentServer_, timezone_offset) != unknown) {
+		return false;
+	}
+
+	assert(entry.has_date());
+	fz::datetime listTime = entry.time;
+	listTime -= fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
+
+	int serveroffset = static_cast<int>((utc - listTime).get_seconds());
+	if (!entry.has_seconds()) {
+		// Round offset to full minutes
+		if (serveroffset < 0) {
+			serveroffset -= 59;
+		}
+		serveroffset -= serveroffset % 60;
+	}
+
+	log(logmsg::status, L"Timezone offset of server is %d seconds.", -serveroffset);
+
+	// Shared with other engines and, through the persisted capabilities,
+	// later sessions.
+	CServerCapabilities::SetCapability(currentServer_, timezone_offset, yes, serveroffset);
+
+	engine_.GetDirectoryCache().ShiftTimes(currentServer_, fz::duration::from_seconds(serveroffset));
+
+	return true;
+}
+
 int CFtpControlSocket::GetExternalIPAddress(std::string& address)
 {
 	// Local IP should work. Only a complete moron would use IPv6
@@ -613,39 +700,36 @@ int CFtpControlSocket::GetExternalIPAddress(std::string& address)
 			log(logmsg::debug_warning, _("No external IP address set, trying default."));
 		}
 		else if (mode == 2) {
-			if (!m_pIPResolver) {
-				std::string localAddress = socket_->local_ip(true);
-
-				if (!localAddress.empty() && localAddress == fz::to_string(engine_.GetOptions().GetOption(OPTION_LASTRESOLVEDIP))) {
-					log(logmsg::debug_verbose, L"Using cached external IP address");
+			std::string localAddress = socket_->local_ip(true);
 
-					address = localAddress;
-					return FZ_REPLY_OK;
-				}
+			if (!waitingForExternalIP_ && !localAddress.empty() && localAddress == fz::to_string(engine_.GetOptions().GetOption(OPTION_LASTRESOLVEDIP))) {
+				log(logmsg::debug_verbose, L"Using cached external IP address");
 
-				std::wstring resolverAddress = engine_.GetOptions().GetOption(OPTION_EXTERNALIPRESOLVER);
+				address = localAddress;
+				return FZ_REPLY_OK;
+			}
 
-				log(logmsg::debug_info, _("Retrieving external IP address from %s"), resolverAddress);
+			std::wstring resolverAddress = engine_.GetOptions().GetOption(OPTION_EXTERNALIPRESOLVER);
 
-				m_pIPResolver = std::make_unique<CExternalIPResolver>(engine_.GetThreadPool(), *this);
-				m_pIPResolver->GetExternalIP(resolverAddress, fz::address_type::ipv4);
-				if (!m_pIPResolver->Done()) {
-					log(logmsg::debug_verbose, L"Waiting for resolver thread");
-					return FZ_REPLY_WOULDBLOCK;
+			// Shared by all engines, only the very first lookup gets waited for
+			auto const res = engine_.GetContext().GetExternalIPCache().Get(resolverAddress, *this, address);
+			if (res == CExternalIPCache::result::pending) {
+				if (!waitingForExternalIP_) {
+					log(logmsg::debug_info, _("Retrieving external IP address from %s"), resolverAddress);
+					waitingForExternalIP_ = true;
 				}
+				return FZ_REPLY_WOULDBLOCK;
 			}
-			if (!m_pIPResolver->Successful()) {
-				m_pIPResolver.reset();
+			waitingForExternalIP_ = false;
 
+			if (res == CExternalIPCache::result::failed) {
 				log(logmsg::debug_warning, _("Failed to retrieve external IP address, using local address"));
 			}
 			else {
 				log(logmsg::debug_info, L"Got external IP address");
-				address = m_pIPResolver->GetIP();
-
-				engine_.GetOptions().SetOption(OPTION_LASTRESOLVEDIP, fz::to_wstring(address));
-
-				m_pIPResolver.reset();
+				if (fz::to_wstring(address) != engine_.GetOptions().GetOption(OPTION_LASTRESOLVEDIP)) {
+					engine_.GetOptions().SetOption(OPTION_LASTRESOLVEDIP, fz::to_wstring(address));
+				}
 
 				return FZ_REPLY_OK;
 			}
@@ -665,7 +749,7 @@ getLocalIP:
 void CFtpControlSocket::OnExternalIPAddress()
 {
 	log(logmsg::debug_verbose, L"CFtpControlSocket::OnExternalIPAddress()");
-	if (!m_pIPResolver) {
+	if (!waitingForExternalIP_) {
 		log(logmsg::debug_info, L"Ignoring event");
 		return;
 	}
@@ -687,6 +771,15 @@ void CFtpControlSocket::Transfer(std::wstring const& cmd, CFtpTransferOpData* ol
 	Push(std::move(pData));
 }
 
+bool CFtpControlSocket::CanUseModeZ() const
+{
+#if HAVE_ZLIB
+	return currentServer_.GetExtraParameter("modez") == L"1" && CServerCapabilities::GetCapability(currentServer_, mode_z_support) == yes;
+#else
+	return false;
+#endif
+}
+
 void CFtpControlSocket::Connect(CServer const& server, Credentials const& credentials)
 {
 	if (!operations_.empty()) {
@@ -702,6 +795,17 @@ void CFtpControlSocket::Connect(CServer const& server, Credentials const& creden
 
 void CFtpControlSocket::OnTimer(fz::timer_id id)
 {
+	if (id && id == deferredTimer_) {
+		deferredTimer_ = 0;
+		if (operations_.empty()) {
+			SendDeferredCommands();
+		}
+		else {
+			deferredTimer_ = add_timer(deferred_command_delay, true);
+		}
+		return;
+	}
+
 	if (id != m_idleTimer) {
 		CControlSocket::OnTimer(id);
 		return;
@@ -743,6 +847,47 @@ void CFtpControlSocket::OnTimer(fz::timer_id id)
 	}
 }
 
+void CFtpControlSocket::DeferCommand(std::wstring const& cmd, CServerPath const& path, std::wstring const& file)
+{
+	deferredCommands_.push_back({cmd, path, file});
+	if (!deferredTimer_) {
+		deferredTimer_ = add_timer(deferred_command_delay, true);
+	}
+}
+
+void CFtpControlSocket::SendDeferredCommands()
+{
+	stop_timer(deferredTimer_);
+	deferredTimer_ = 0;
+
+	if (deferredCommands_.empty() || !active_layer_) {
+		return;
+	}
+
+	log(logmsg::debug_info, L"Sending %d deferred commands", deferredCommands_.size());
+	for (auto const& deferred : deferredCommands_) {
+		if (SendCommand(deferred.cmd_, false, false) == FZ_REPLY_WOULDBLOCK) {
+			++m_repliesToSkip;
+		}
+	}
+	deferredCommands_.clear();
+
+	if (m_repliesToSkip) {
+		SetWait(true);
+	}
+}
+
+void CFtpControlSocket::UpdateCache(COpData const& data, CServerPath const& serverPath, std::wstring const& remoteFile, int64_t fileSize)
+{
+	CRealControlSocket::UpdateCache(data, serverPath, remoteFile, fileSize);
+
+	// A newly created entry only exists now
+	auto const& transfer = static_cast<CFtpFileTransferOpData const&>(data);
+	if (!transfer.mfmtTime_.empty()) {
+		engine_.GetDirectoryCache().UpdateFileTime(currentServer_, serverPath, remoteFile, transfer.mfmtTime_);
+	}
+}
+
 void CFtpControlSocket::StartKeepaliveTimer()
 {
 	if (!engine_.GetOptions().GetOptionVal(OPTION_FTP_SENDKEEPALIVE)) {
@@ -790,9 +935,25 @@ void CFtpControlSocket::operator()(fz::event_base const& ev)
 void CFtpControlSocket::ResetSocket()
 {
 	receiveBuffer_.clear();
-	tls_layer_.reset();
+	if (tls_layer_) {
+		// With TLS 1.3 the session ticket arrives after the handshake
+		engine_.GetContext().GetTlsSessionCache().Store(currentServer_.GetHost(), currentServer_.GetPort(), *tls_layer_);
+		tls_layer_.reset();
+	}
 	m_pendingReplies = 0;
 	m_repliesToSkip = 0;
+	preparedPassive_.reset();
+	if (!deferredCommands_.empty()) {
+		log(logmsg::debug_info, L"Dropping %d deferred commands", deferredCommands_.size());
+		for (auto const& deferred : deferredCommands_) {
+			if (!deferred.file_.empty()) {
+				engine_.GetDirectoryCache().InvalidateFile(currentServer_, deferred.path_, deferred.file_);
+			}
+		}
+		deferredCommands_.clear();
+	}
+	stop_timer(deferredTimer_);
+	deferredTimer_ = 0;
 	CRealControlSocket::ResetSocket();
 }
 
@@ -807,6 +968,13 @@ void CFtpControlSocket::OnVerifyCert(fz::tls_layer* source, fz::tls_session_info
 
 void CFtpControlSocket::Push(std::unique_ptr<COpData> && pNewOpData)
 {
+	if (operations_.empty() && !deferredCommands_.empty()) {
+		bool const upload = pNewOpData->opId == Command::transfer && !static_cast<CFtpFileTransferOpData &>(*pNewOpData).download_;
+		if (!upload || deferredCommands_.size() >= max_deferred_commands) {
+			SendDeferredCommands();
+		}
+	}
+
 	CRealControlSocket::Push(std::move(pNewOpData));
 	if (operations_.size() == 1 && operations_.back()->opId != Command::connect) {
 		if (!active_layer_) {
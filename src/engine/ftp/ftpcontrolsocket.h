@@ -6,6 +6,7 @@
 #include "externalipresolver.h"
 #include "rtt.h"
 
+#include <optional>
 #include <regex>
 
 namespace PrivCommand {
@@ -52,6 +53,9 @@ protected:
 	virtual void Mkdir(CServerPath const& path) override;
 	virtual void Rename(CRenameCommand const& command) override;
 	virtual void Chmod(CChmodCommand const& command) override;
+	virtual void FileHash(CFileHashCommand const& command) override;
+	virtual void Fxp(CFxpCommand const& command) override;
+	virtual void Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry = nullptr) override;
 	void Transfer(std::wstring const& cmd, CFtpTransferOpData* oldData);
 
 	void TransferEnd();
@@ -78,8 +82,25 @@ protected:
 
 	int GetExternalIPAddress(std::string& address);
 
+	// Derives the timezone offset of the server from a file as listed by
+	// LIST and its time in UTC, e.g. from an MDTM reply. Corrects the cached
+	// listings, they have been stored with the times as listed. Returns
+	// false if the offset is known already.
+	bool LearnTimezoneOffset(CDirentry const& entry, fz::datetime const& utc);
+
 	void StartKeepaliveTimer();
 
+	// For commands whose reply does not matter to any operation, e.g. setting
+	// timestamps after uploads. They are sent in one go once the connection
+	// is idle, before the next operation other than an upload, or once
+	// enough of them have accumulated. Their replies are skipped.
+	// If given, the cached information of the file assumes the command to
+	// succeed and gets invalidated if the command is dropped instead.
+	void DeferCommand(std::wstring const& cmd, CServerPath const& path = CServerPath(), std::wstring const& file = std::wstring());
+	void SendDeferredCommands();
+
+	virtual void UpdateCache(COpData const& data, CServerPath const& serverPath, std::wstring const& remoteFile, int64_t fileSize) override;
+
 	std::wstring m_Response;
 	std::wstring m_MultilineResponseCode;
 	std::vector<std::wstring> m_MultilineResponseLines;
@@ -95,21 +116,56 @@ protected:
 
 	int m_pendingReplies{1};
 
-	std::unique_ptr<CExternalIPResolver> m_pIPResolver;
+	// Set while waiting for CExternalIPCache
+	bool waitingForExternalIP_{};
 
 	std::unique_ptr<fz::tls_layer> tls_layer_;
 	bool m_protectDataChannel{};
 
 	int m_lastTypeBinary{-1};
 
+	// 1 if MODE Z is in effect, 0 for MODE S, -1 if unknown
+	int m_lastModeZ{-1};
+
+	// MODE Z has been enabled for the site and is offered by the server
+	bool CanUseModeZ() const;
+
 	// Used by keepalive code so that we're not using keep alive
 	// till the end of time. Stop after a couple of minutes.
 	fz::monotonic_clock m_lastCommandCompletionTime;
 
 	fz::timer_id m_idleTimer{};
 
+	struct deferred_command final
+	{
+		std::wstring cmd_;
+		CServerPath path_;
+		std::wstring file_;
+	};
+	std::vector<deferred_command> deferredCommands_;
+	fz::timer_id deferredTimer_{};
+
+	// Passive mode command sent ahead of the next transfer
+	struct prepared_passive final
+	{
+		std::wstring cmd_;
+
+		// Empty until received
+		std::wstring reply_;
+		fz::monotonic_clock time_;
+
+		// Number of replies still to come before the one to cmd_
+		int before_{};
+	};
+	std::optional<prepared_passive> preparedPassive_;
+	void ClearPreparedPassive() { preparedPassive_.reset(); }
+
 	CLatencyMeasurement m_rtt;
 
+	// Throughput of the last data transfer in bytes per second, -1 if unknown.
+	// Used to size the socket buffers of the next data connection.
+	int64_t transferRate_{-1};
+
 	virtual void operator()(fz::event_base const& ev) override;
 
 	void OnExternalIPAddress();
@@ -121,9 +177,12 @@ protected:
 	friend class CFtpChangeDirOpData;
 	friend class CFtpChmodOpData;
 	friend class CFtpDeleteOpData;
+	friend class CFtpFileHashOpData;
 	friend class CFtpFileTransferOpData;
+	friend class CFtpFxpOpData;
 	friend class CFtpListOpData;
 	friend class CFtpLogonOpData;
+	friend class CFtpLookupOpData;
 	friend class CFtpMkdirOpData;
 	friend class CFtpRawCommandOpData;
 	friend class CFtpRawTransferOpData;
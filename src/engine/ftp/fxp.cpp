@@ -0,0 +1,134 @@
+#include <filezilla.h>
+
+#include "../directorycache.h"
+#include "fxp.h"
+#include "rawtransfer.h"
+
+enum fxpStates
+{
+	fxp_init,
+	fxp_type,
+	fxp_mode,
+	fxp_port_pasv,
+	fxp_transfer,
+	fxp_waitfinish
+};
+
+int CFtpFxpOpData::Send()
+{
+	switch (opState)
+	{
+	case fxp_init:
+		log(logmsg::status, command_.store_ ? _("Receiving \"%s\" directly from the other server") : _("Sending \"%s\" directly to the other server"), command_.path_.FormatFilename(command_.file_));
+
+		// The servers would have to negotiate TLS between themselves, and a
+		// proxy or IPv6 connection leaves us without an address PORT can take.
+		if (controlSocket_.m_protectDataChannel || controlSocket_.proxy_layer_ ||
+			controlSocket_.socket_->address_family() == fz::address_type::ipv6)
+		{
+			log(logmsg::status, _("Server-to-server transfers are not possible over this connection"));
+			return FZ_REPLY_NOTSUPPORTED;
+		}
+
+		if (controlSocket_.m_lastTypeBinary == (command_.binary_ ? 1 : 0)) {
+			opState = controlSocket_.m_lastModeZ ? fxp_mode : fxp_port_pasv;
+		}
+		else {
+			opState = fxp_type;
+		}
+		return FZ_REPLY_CONTINUE;
+	case fxp_type:
+		controlSocket_.m_lastTypeBinary = -1;
+		return controlSocket_.SendCommand(command_.binary_ ? L"TYPE I" : L"TYPE A");
+	case fxp_mode:
+		// The other server knows nothing about compression negotiated with us
+		controlSocket_.m_lastModeZ = -1;
+		return controlSocket_.SendCommand(L"MODE S");
+	case fxp_port_pasv:
+		// Any prepared passive mode reply was for a connection from us
+		controlSocket_.ClearPreparedPassive();
+		if (command_.passive()) {
+			return controlSocket_.SendCommand(L"PASV");
+		}
+		return controlSocket_.SendCommand(L"PORT " + command_.address_);
+	case fxp_transfer:
+		return controlSocket_.SendCommand((command_.store_ ? L"STOR " : L"RETR ") + command_.path_.FormatFilename(command_.file_));
+	case fxp_waitfinish:
+		// No data passes through us, the connection stays silent until the
+		// server reports the end of the transfer. Once the other half of the
+		// transfer is done, the queue gives this one the regular timeout to
+		// follow before cancelling it.
+		controlSocket_.SetWait(false);
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	log(logmsg::debug_warning, L"Unknown op state %d", opState);
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpFxpOpData::ParseResponse()
+{
+	int const code = controlSocket_.GetReplyCode();
+
+	switch (opState)
+	{
+	case fxp_type:
+		if (code != 2 && code != 3) {
+			return FZ_REPLY_ERROR;
+		}
+		controlSocket_.m_lastTypeBinary = command_.binary_ ? 1 : 0;
+		opState = controlSocket_.m_lastModeZ ? fxp_mode : fxp_port_pasv;
+		return FZ_REPLY_CONTINUE;
+	case fxp_mode:
+		if (code != 2) {
+			return FZ_REPLY_ERROR;
+		}
+		controlSocket_.m_lastModeZ = 0;
+		opState = fxp_port_pasv;
+		return FZ_REPLY_CONTINUE;
+	case fxp_port_pasv:
+		if (code != 2 && code != 3) {
+			log(logmsg::status, _("Server refused to take part in a server-to-server transfer"));
+			return FZ_REPLY_NOTSUPPORTED;
+		}
+		if (command_.passive()) {
+			// An unroutable address in the reply gets replaced by the address
+			// of the server, the other server could not reach it either.
+			CFtpRawTransferOpData pasv(controlSocket_);
+			pasv.bTriedActive = true;
+			if (!pasv.ParsePasvResponse(controlSocket_.m_Response) || !pasv.port_) {
+				log(logmsg::error, _("Could not parse passive mode reply"));
+				return FZ_REPLY_NOTSUPPORTED;
+			}
+
+			std::wstring address = pasv.host_;
+			fz::replace_substrings(address, L".", L",");
+			address += fz::sprintf(L",%d,%d", pasv.port_ / 256, pasv.port_ % 256);
+			engine_.AddNotification(new CFxpAddressNotification(address));
+		}
+		opState = fxp_transfer;
+		return FZ_REPLY_CONTINUE;
+	case fxp_transfer:
+		if (command_.store_) {
+			// Whatever happens, the listing no longer is accurate
+			engine_.GetDirectoryCache().InvalidateFile(currentServer_, command_.path_, command_.file_);
+		}
+		if (code == 1) {
+			opState = fxp_waitfinish;
+			return FZ_REPLY_CONTINUE;
+		}
+		if (code == 2) {
+			// A few broken servers omit the 1yz reply
+			return FZ_REPLY_OK;
+		}
+		return FZ_REPLY_ERROR;
+	case fxp_waitfinish:
+		if (code != 2 && code != 3) {
+			return FZ_REPLY_ERROR;
+		}
+		return FZ_REPLY_OK;
+	}
+
+	log(logmsg::debug_warning, L"Unknown op state %d", opState);
+	return FZ_REPLY_INTERNALERROR;
+}
@@ -0,0 +1,25 @@
+#ifndef FILEZILLA_ENGINE_FTP_FXP_HEADER
+#define FILEZILLA_ENGINE_FTP_FXP_HEADER
+
+#include "ftpcontrolsocket.h"
+
+// One half of a server-to-server transfer. The passive side sends PASV and
+// announces the address from the reply, the active side sends PORT with
+// that address. Then each sends its transfer command and waits for the
+// server to report the end of the transfer.
+class CFtpFxpOpData final : public COpData, public CFtpOpData
+{
+public:
+	CFtpFxpOpData(CFtpControlSocket & controlSocket, CFxpCommand const& command)
+		: COpData(Command::fxp, L"CFtpFxpOpData")
+		, CFtpOpData(controlSocket)
+		, command_(command)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	CFxpCommand const command_;
+};
+
+#endif
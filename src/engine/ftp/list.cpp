@@ -102,6 +102,16 @@ int CFtpListOpData::Send()
 
 		opState = list_waittransfer;
 		if (CServerCapabilities::GetCapability(currentServer_, mlsd_command) == yes) {
+			listing_parser_->SetProgressPath(currentPath_);
+
+			// MLSD lines are independent of each other, so big listings can be
+			// parsed in chunks on the thread pool while still being received.
+			// Raw listing logging and custom charsets need the control socket.
+			if (encoding == listingEncoding::normal && currentServer_.GetEncodingType() != ENCODING_CUSTOM &&
+				!controlSocket_.logger().should_log(logmsg::listing))
+			{
+				listing_parser_->EnablePipelining(engine_.GetThreadPool());
+			}
 			controlSocket_.Transfer(L"MLSD", this);
 		}
 		else {
@@ -118,6 +128,11 @@ int CFtpListOpData::Send()
 				}
 			}
 
+			// While checking for LIST -a support the first listing might get discarded
+			if (!viewHiddenCheck_) {
+				listing_parser_->SetProgressPath(currentPath_);
+			}
+
 			if (viewHidden_) {
 				controlSocket_.Transfer(L"LIST -a", this);
 			}
@@ -147,51 +162,33 @@ int CFtpListOpData::ParseResponse()
 
 	std::wstring const& response = controlSocket_.m_Response;
 
-	// First condition prevents problems with concurrent MDTM
-	if (CServerCapabilities::GetCapability(currentServer_, timezone_offset) == unknown &&
-	    response.substr(0, 4) == L"213 " && response.size() > 16)
-	{
+	if (response.substr(0, 4) == L"213 " && response.size() > 16) {
 		fz::datetime date(response.substr(4), fz::datetime::utc);
 		if (!date.empty()) {
-			assert(directoryListing_[mdtm_index_].has_date());
-			fz::datetime listTime = directoryListing_[mdtm_index_].time;
-			listTime -= fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
-
-			int serveroffset = static_cast<int>((date - listTime).get_seconds());
-			if (!directoryListing_[mdtm_index_].has_seconds()) {
-				// Round offset to full minutes
-				if (serveroffset < 0) {
-					serveroffset -= 59;
+			if (!controlSocket_.LearnTimezoneOffset(directoryListing_[mdtm_index_], date)) {
+				// A concurrent MDTM got there first, possibly before the
+				// listing got stored.
+				fz::duration const span = controlSocket_.GetTimezoneOffset();
+				size_t const count = directoryListing_.size();
+				for (size_t i = 0; i < count; ++i) {
+					if (directoryListing_[i].has_date()) {
+						directoryListing_.get(i).time += span;
+					}
 				}
-				serveroffset -= serveroffset % 60;
-			}
-
-			log(logmsg::status, L"Timezone offset of server is %d seconds.", -serveroffset);
-
-			fz::duration span = fz::duration::from_seconds(serveroffset);
-			size_t const count = directoryListing_.size();
-			for (size_t i = 0; i < count; ++i) {
-				CDirentry& entry = directoryListing_.get(i);
-				entry.time += span;
+				engine_.GetDirectoryCache().Store(directoryListing_, currentServer_);
 			}
 
-			// TODO: Correct cached listings
-
-			CServerCapabilities::SetCapability(currentServer_, timezone_offset, yes, serveroffset);
-		}
-		else {
-			CServerCapabilities::SetCapability(currentServer_, mdtm_command, no);
-			CServerCapabilities::SetCapability(currentServer_, timezone_offset, no);
+			// The listing has already been handed out with the times as listed
+			controlSocket_.SendDirectoryListingNotification(currentPath_, false);
+			return FZ_REPLY_OK;
 		}
+		CServerCapabilities::SetCapability(currentServer_, mdtm_command, no);
 	}
-	else {
+
+	if (CServerCapabilities::GetCapability(currentServer_, timezone_offset) == unknown) {
 		CServerCapabilities::SetCapability(currentServer_, timezone_offset, no);
 	}
 
-	engine_.GetDirectoryCache().Store(directoryListing_, currentServer_);
-
-	controlSocket_.SendDirectoryListingNotification(currentPath_, false);
-
 	return FZ_REPLY_OK;
 }
 
@@ -363,6 +360,11 @@ int CFtpListOpData::CheckTimezoneDetection(CDirectoryListing& listing)
 			size_t const count = listing.size();
 			for (size_t i = 0; i < count; ++i) {
 				if (!listing[i].is_dir() && listing[i].has_time()) {
+					// The listing does not wait for the MDTM reply, the
+					// cached times get corrected once it is there.
+					engine_.GetDirectoryCache().Store(listing, currentServer_);
+					controlSocket_.SendDirectoryListingNotification(currentPath_, false);
+
 					opState = list_mdtm;
 					directoryListing_ = listing;
 					mdtm_index_ = i;
@@ -3,6 +3,7 @@
 #include "logon.h"
 #include "../proxy.h"
 #include "../servercapabilities.h"
+#include "../tls_session_cache.h"
 
 #include <libfilezilla/tls_layer.hpp>
 
@@ -36,9 +37,42 @@ CFtpLogonOpData::CFtpLogonOpData(CFtpControlSocket& controlSocket)
 	else if (encoding == ENCODING_UTF8) {
 		controlSocket_.m_useUTF8 = true;
 	}
+
+	// With SYST and FEAT known from earlier sessions, the commands after
+	// login can be sent without waiting for each reply.
+	pipeline_ = CServerCapabilities::GetCapability(currentServer_, command_pipelining) != no &&
+		CServerCapabilities::GetCapability(currentServer_, syst_command) != unknown &&
+		CServerCapabilities::GetCapability(currentServer_, feat_command) != unknown;
 }
 
 int CFtpLogonOpData::Send()
+{
+	if (!pipeline_ || opState <= LOGON_LOGON) {
+		return SendState();
+	}
+
+	// Everything after login is decided by known capabilities,
+	// send all remaining commands at once. Their replies arrive in order.
+	customCommandIndex = 0;
+	for (;;) {
+		int res = SendState();
+		if (res != FZ_REPLY_WOULDBLOCK) {
+			return res;
+		}
+		inFlight_.push_back(opState);
+
+		if (opState == LOGON_CUSTOMCOMMANDS && ++customCommandIndex < currentServer_.GetPostLoginCommands().size()) {
+			continue;
+		}
+		if (NextState() == FZ_REPLY_OK) {
+			break;
+		}
+	}
+
+	return FZ_REPLY_WOULDBLOCK;
+}
+
+int CFtpLogonOpData::SendState()
 {
 	switch (opState)
 	{
@@ -243,6 +277,15 @@ int CFtpLogonOpData::ParseResponse()
 	int code = controlSocket_.GetReplyCode();
 	std::wstring const& response = controlSocket_.m_Response;
 
+	bool const pipelined = !inFlight_.empty();
+	if (pipelined) {
+		if (code == 1) {
+			return FZ_REPLY_WOULDBLOCK;
+		}
+		opState = inFlight_.front();
+		inFlight_.pop_front();
+	}
+
 	if (opState == LOGON_WELCOME) {
 		if (code != 2 && code != 3) {
 			return FZ_REPLY_DISCONNECTED | (code == 5 ? FZ_REPLY_CRITICALERROR : FZ_REPLY_ERROR);
@@ -274,7 +317,8 @@ int CFtpLogonOpData::ParseResponse()
 			controlSocket_.tls_layer_ = std::make_unique<fz::tls_layer>(controlSocket_.event_loop_, &controlSocket_, *controlSocket_.active_layer_, &engine_.GetContext().GetTlsSystemTrustStore(), controlSocket_.logger_);
 			controlSocket_.active_layer_ = controlSocket_.tls_layer_.get();
 
-			if (!controlSocket_.tls_layer_->client_handshake(&controlSocket_)) {
+			auto const session = engine_.GetContext().GetTlsSessionCache().Get(currentServer_.GetHost(), currentServer_.GetPort());
+			if (!controlSocket_.tls_layer_->client_handshake(&controlSocket_, session, controlSocket_.tls_layer_->peer_host())) {
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
 
@@ -417,19 +461,49 @@ int CFtpLogonOpData::ParseResponse()
 			controlSocket_.m_protectDataChannel = true;
 		}
 	}
-	else if (opState == LOGON_CUSTOMCOMMANDS) {
+	else if (opState == LOGON_CUSTOMCOMMANDS && !pipelined) {
 		++customCommandIndex;
 		if (customCommandIndex < currentServer_.GetPostLoginCommands().size()) {
 			return FZ_REPLY_CONTINUE;
 		}
 	}
 
+	if (pipelined) {
+		if (!inFlight_.empty()) {
+			return FZ_REPLY_WOULDBLOCK;
+		}
+		LoggedIn();
+		return FZ_REPLY_OK;
+	}
+
+	int res = NextState();
+	if (res == FZ_REPLY_OK) {
+		LoggedIn();
+	}
+	return res;
+}
+
+void CFtpLogonOpData::LoggedIn()
+{
+	log(logmsg::status, _("Logged in"));
+	log(logmsg::debug_info, L"Measured latency of %d ms", controlSocket_.m_rtt.GetLatency());
+}
+
+int CFtpLogonOpData::Reset(int result)
+{
+	if (!inFlight_.empty() && result != FZ_REPLY_OK) {
+		log(logmsg::debug_info, L"Logon failed with pipelined commands in flight, no longer pipelining commands to this server");
+		CServerCapabilities::SetCapability(currentServer_, command_pipelining, no);
+	}
+	return result;
+}
+
+int CFtpLogonOpData::NextState()
+{
 	for (;;) {
 		++opState;
 
 		if (opState == LOGON_DONE) {
-			log(logmsg::status, _("Logged in"));
-			log(logmsg::debug_info, L"Measured latency of %d ms", controlSocket_.m_rtt.GetLatency());
 			return FZ_REPLY_OK;
 		}
 
@@ -847,4 +921,16 @@ void CFtpLogonOpData::ParseFeat(std::wstring line)
 	else if (HasFeature(up, L"EPSV")) {
 		CServerCapabilities::SetCapability(currentServer_, epsv_command, yes);
 	}
+	else if (HasFeature(up, L"HASH")) {
+		CServerCapabilities::SetCapability(currentServer_, hash_command, yes, line.size() > 5 ? line.substr(5) : std::wstring());
+	}
+	else if (HasFeature(up, L"XSHA1")) {
+		CServerCapabilities::SetCapability(currentServer_, xsha1_command, yes);
+	}
+	else if (HasFeature(up, L"XMD5")) {
+		CServerCapabilities::SetCapability(currentServer_, xmd5_command, yes);
+	}
+	else if (HasFeature(up, L"XCRC")) {
+		CServerCapabilities::SetCapability(currentServer_, xcrc_command, yes);
+	}
 }
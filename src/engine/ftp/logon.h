@@ -49,6 +49,7 @@ public:
 
 	virtual int Send() override;
 	virtual int ParseResponse() override;
+	virtual int Reset(int result) override;
 
 	void ParseFeat(std::wstring line);
 
@@ -60,6 +61,14 @@ private:
 
 	bool PrepareLoginSequence();
 
+	int SendState();
+
+	// Advances opState to the next command that needs to be sent. Returns
+	// FZ_REPLY_OK once there is none left.
+	int NextState();
+
+	void LoggedIn();
+
 	std::wstring host_;
 	unsigned int port_{};
 
@@ -70,6 +79,11 @@ private:
 	std::deque<t_loginCommand> loginSequence;
 
 	int ftp_proxy_type_{};
+
+	// If set, the commands after login are sent in one go. inFlight_ holds
+	// the states of those not yet replied to, in order.
+	bool pipeline_{};
+	std::deque<int> inFlight_;
 };
 
 #endif
@@ -0,0 +1,202 @@
+#include <filezilla.h>
+
+#include "../directorycache.h"
+#include "directorylistingparser.h"
+#include "../lookup.h"
+#include "lookup.h"
+#include "servercapabilities.h"
+
+enum lookupStates
+{
+	lookup_init = 0,
+	lookup_mlst,
+	lookup_stat,
+	lookup_fallback
+};
+
+namespace {
+// STAT takes the rest of the line as argument but some servers pass it on
+// to ls, which would interpret whitespace and leading dashes.
+bool stat_safe(std::wstring const& file)
+{
+	return !file.empty() && file[0] != '-' && file.find_first_of(L" \t") == std::wstring::npos;
+}
+
+// Some servers prefix every line of a multi-line reply with the code
+std::wstring strip_code(std::wstring const& line)
+{
+	if (line.size() > 3 && line[3] == '-' &&
+		line[0] >= '0' && line[0] <= '9' &&
+		line[1] >= '0' && line[1] <= '9' &&
+		line[2] >= '0' && line[2] <= '9')
+	{
+		return line.substr(4);
+	}
+	return line;
+}
+}
+
+CFtpLookupOpData::CFtpLookupOpData(CFtpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry * entry)
+	: COpData(Command::lookup, L"CFtpLookupOpData")
+	, CFtpOpData(controlSocket)
+	, path_(path)
+	, file_(file)
+	, entry_(entry)
+{
+	if (!entry) {
+		internal_entry_ = std::make_unique<CDirentry>();
+		entry_ = internal_entry_.get();
+	}
+	entry_->clear();
+}
+
+int CFtpLookupOpData::Send()
+{
+	switch (opState) {
+	case lookup_init:
+		{
+			if (path_.empty() || file_.empty()) {
+				return FZ_REPLY_INTERNALERROR;
+			}
+
+			auto [results, entry] = engine_.GetDirectoryCache().LookupFile(currentServer_, path_, file_, LookupFlags{});
+			if (results & LookupResults::found) {
+				if (entry && !entry.is_unsure()) {
+					*entry_ = std::move(entry);
+					log(logmsg::debug_info, L"Found valid entry for '%s'", file_);
+					return FZ_REPLY_OK;
+				}
+			}
+			else if (results & LookupResults::direxists) {
+				log(logmsg::debug_info, L"'%s' does not appear to exist", file_);
+				return FZ_REPLY_ERROR_NOTFOUND;
+			}
+
+			if (CServerCapabilities::GetCapability(currentServer_, mlsd_command) == yes) {
+				opState = lookup_mlst;
+			}
+			else if (stat_safe(file_)) {
+				opState = lookup_stat;
+			}
+			else {
+				return Fallback();
+			}
+			return FZ_REPLY_CONTINUE;
+		}
+	case lookup_mlst:
+		return controlSocket_.SendCommand(L"MLST " + path_.FormatFilename(file_));
+	case lookup_stat:
+		return controlSocket_.SendCommand(L"STAT " + path_.FormatFilename(file_));
+	default:
+		log(logmsg::debug_warning, L"Unknown op state: %d", opState);
+		break;
+	}
+
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpLookupOpData::ParseResponse()
+{
+	switch (opState) {
+	case lookup_mlst:
+		return ParseMlst();
+	case lookup_stat:
+		return ParseStat();
+	default:
+		log(logmsg::debug_warning, L"Unknown op state: %d", opState);
+		break;
+	}
+
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CFtpLookupOpData::ParseMlst()
+{
+	if (controlSocket_.m_Response.substr(0, 3) == L"550") {
+		engine_.GetDirectoryCache().RemoveFile(currentServer_, path_, file_);
+		return FZ_REPLY_ERROR_NOTFOUND;
+	}
+	if (controlSocket_.GetReplyCode() != 2) {
+		return Fallback();
+	}
+
+	// The facts are on the lines in between, each starting with a space
+	auto const& lines = controlSocket_.m_MultilineResponseLines;
+	for (size_t i = 1; i < lines.size(); ++i) {
+		std::wstring line = lines[i];
+		if (line.empty() || line[0] != ' ') {
+			continue;
+		}
+		line = line.substr(1);
+
+		CDirectoryListingParser parser(&controlSocket_, currentServer_);
+		parser.SetTimezoneOffset(controlSocket_.GetTimezoneOffset());
+		parser.AddLine(std::move(line), std::wstring(file_), fz::datetime());
+
+		CDirectoryListing const listing = parser.Parse(path_);
+		if (listing.size() == 1) {
+			return Found(CDirentry(listing[0]));
+		}
+	}
+
+	return Fallback();
+}
+
+int CFtpLookupOpData::ParseStat()
+{
+	if (controlSocket_.GetReplyCode() != 2) {
+		return Fallback();
+	}
+
+	CDirectoryListingParser parser(&controlSocket_, currentServer_);
+	parser.SetTimezoneOffset(controlSocket_.GetTimezoneOffset());
+
+	// The first line only announces the status
+	auto const& lines = controlSocket_.m_MultilineResponseLines;
+	for (size_t i = 1; i < lines.size(); ++i) {
+		parser.AddLine(strip_code(lines[i]), std::wstring(), fz::datetime());
+	}
+
+	// On a directory STAT lists its contents instead, only a sole entry
+	// carrying the name asked for is trusted. Anything else, including an
+	// empty reply, is left to the full listing.
+	CDirectoryListing const listing = parser.Parse(path_);
+	if (listing.size() == 1) {
+		auto const& name = listing[0].name;
+		if (name == file_ || name == path_.FormatFilename(file_)) {
+			CDirentry entry = listing[0];
+			entry.name = file_;
+			return Found(std::move(entry));
+		}
+	}
+
+	return Fallback();
+}
+
+int CFtpLookupOpData::Found(CDirentry && entry)
+{
+	log(logmsg::debug_info, L"Server returned entry for '%s'", file_);
+
+	engine_.GetDirectoryCache().UpdateFile(currentServer_, path_, file_, true, entry.is_dir() ? CDirectoryCache::dir : CDirectoryCache::file, entry.size);
+	*entry_ = std::move(entry);
+	return FZ_REPLY_OK;
+}
+
+int CFtpLookupOpData::Fallback()
+{
+	log(logmsg::debug_info, L"Could not look up '%s' directly, listing the directory", file_);
+
+	opState = lookup_fallback;
+	controlSocket_.Push(std::make_unique<LookupOpData>(controlSocket_, path_, file_, entry_));
+	return FZ_REPLY_CONTINUE;
+}
+
+int CFtpLookupOpData::SubcommandResult(int prevResult, COpData const&)
+{
+	if (opState == lookup_fallback) {
+		return prevResult;
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CFtpLookupOpData::SubcommandResult()");
+	return FZ_REPLY_INTERNALERROR;
+}
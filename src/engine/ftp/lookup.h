@@ -0,0 +1,31 @@
+#ifndef FILEZILLA_ENGINE_FTP_LOOKUP_HEADER
+#define FILEZILLA_ENGINE_FTP_LOOKUP_HEADER
+
+#include "ftpcontrolsocket.h"
+
+// Looks up a single file. If the directory cache cannot answer, the file
+// is queried through MLST or STAT instead of listing the whole directory.
+// Falls back to the generic LookupOpData if neither gives an answer.
+class CFtpLookupOpData final : public COpData, public CFtpOpData
+{
+public:
+	CFtpLookupOpData(CFtpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry * entry);
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
+
+private:
+	int ParseMlst();
+	int ParseStat();
+	int Found(CDirentry && entry);
+	int Fallback();
+
+	CServerPath const path_;
+	std::wstring const file_;
+
+	CDirentry * entry_;
+	std::unique_ptr<CDirentry> internal_entry_;
+};
+
+#endif
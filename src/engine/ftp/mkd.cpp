@@ -1,6 +1,7 @@
 #include <filezilla.h>
 
 #include "../directorycache.h"
+#include "../pathcache.h"
 #include "mkd.h"
 
 enum mkdStates
@@ -47,6 +48,11 @@ int CFtpMkdirOpData::Send()
 			}
 		}
 
+		if (engine_.GetPathCache().Exists(currentServer_, path_)) {
+			log(logmsg::debug_info, L"Directory is known to exist");
+			return FZ_REPLY_OK;
+		}
+
 		if (!path_.HasParent()) {
 			opState = mkd_tryfull;
 		}
@@ -54,6 +60,17 @@ int CFtpMkdirOpData::Send()
 			currentMkdPath_ = path_.GetParent();
 			segments_.push_back(path_.GetLastSegment());
 
+			// Directories created before, possibly by another engine, need not
+			// be searched for again. Start right below the deepest one known.
+			CServerPath const existing = engine_.GetPathCache().GetExisting(currentServer_, currentMkdPath_);
+			if (!existing.empty() && !(currentPath_.IsParentOf(path_, false) && existing.IsParentOf(currentPath_, false))) {
+				while (currentMkdPath_ != existing) {
+					segments_.push_back(currentMkdPath_.GetLastSegment());
+					currentMkdPath_ = currentMkdPath_.GetParent();
+				}
+				commonParent_ = existing;
+			}
+
 			if (currentMkdPath_ == currentPath_) {
 				opState = mkd_mkdsub;
 			}
@@ -143,6 +160,9 @@ int CFtpMkdirOpData::ParseResponse()
 
 			currentMkdPath_.AddSegment(segments_.back());
 			segments_.pop_back();
+			if (result == FZ_REPLY_OK) {
+				engine_.GetPathCache().StoreExisting(currentServer_, currentMkdPath_);
+			}
 
 			if (segments_.empty() || result != FZ_REPLY_OK) {
 				return result;
@@ -166,6 +186,7 @@ int CFtpMkdirOpData::ParseResponse()
 			return FZ_REPLY_ERROR;
 		}
 		else {
+			engine_.GetPathCache().StoreExisting(currentServer_, path_);
 			return FZ_REPLY_OK;
 		}
 		break;
@@ -0,0 +1,247 @@
+#include <filezilla.h>
+
+#if HAVE_ZLIB
+
+#include "modezlayer.h"
+
+#include <algorithm>
+
+#include <errno.h>
+
+namespace {
+size_t const modez_chunk_size = 64 * 1024;
+
+// Writes are refused once this much compressed data waits for the next layer
+size_t const modez_max_pending = 256 * 1024;
+}
+
+CModeZLayer::CModeZLayer(fz::event_loop & loop, fz::event_handler* handler, fz::socket_interface & next_layer, int level)
+	: fz::event_handler(loop)
+	, fz::socket_layer(handler, next_layer, false)
+	, level_(level)
+{
+	next_layer_.set_event_handler(this);
+}
+
+CModeZLayer::~CModeZLayer()
+{
+	remove_handler();
+	next_layer_.set_event_handler(nullptr);
+
+	if (inflating_) {
+		inflateEnd(&inflate_);
+	}
+	if (deflating_) {
+		deflateEnd(&deflate_);
+	}
+}
+
+bool CModeZLayer::InitInflate()
+{
+	if (!inflating_) {
+		if (inflateInit(&inflate_) != Z_OK) {
+			return false;
+		}
+		inflating_ = true;
+	}
+	return true;
+}
+
+bool CModeZLayer::InitDeflate()
+{
+	if (!deflating_) {
+		if (deflateInit(&deflate_, level_) != Z_OK) {
+			return false;
+		}
+		deflating_ = true;
+	}
+	return true;
+}
+
+int CModeZLayer::read(void *buffer, unsigned int size, int& error)
+{
+	if (!InitInflate()) {
+		error = ENOMEM;
+		return -1;
+	}
+
+	inflate_.next_out = static_cast<Bytef*>(buffer);
+	inflate_.avail_out = size;
+
+	for (;;) {
+		// With the output space used up, inflate may still hold output even
+		// if all input has been consumed.
+		if ((!receiveBuffer_.empty() || inflatePending_) && !inflateDone_) {
+			Bytef none{};
+			inflate_.next_in = receiveBuffer_.empty() ? &none : receiveBuffer_.get();
+			inflate_.avail_in = static_cast<uInt>(receiveBuffer_.size());
+			int res = ::inflate(&inflate_, Z_NO_FLUSH);
+			receiveBuffer_.consume(receiveBuffer_.size() - inflate_.avail_in);
+			inflatePending_ = !inflate_.avail_out;
+
+			if (res == Z_STREAM_END) {
+				inflateDone_ = true;
+				inflatePending_ = false;
+			}
+			else if (res != Z_OK && res != Z_BUF_ERROR) {
+				error = EPROTO;
+				return -1;
+			}
+
+			unsigned int const produced = size - inflate_.avail_out;
+			if (produced) {
+				return static_cast<int>(produced);
+			}
+		}
+		if (inflateDone_) {
+			receiveBuffer_.clear();
+		}
+
+		int read = next_layer_.read(receiveBuffer_.get(modez_chunk_size), static_cast<unsigned int>(modez_chunk_size), error);
+		if (read < 0) {
+			return -1;
+		}
+		if (!read) {
+			if (!inflateDone_) {
+				// Closed before the end of the compressed stream and nothing is
+				// left in inflate, data is missing
+				error = ECONNABORTED;
+				return -1;
+			}
+			return 0;
+		}
+		if (!inflateDone_) {
+			receiveBuffer_.add(static_cast<size_t>(read));
+		}
+	}
+}
+
+int CModeZLayer::write(void const* buffer, unsigned int size, int& error)
+{
+	if (shuttingDown_) {
+		error = EINVAL;
+		return -1;
+	}
+
+	if (!InitDeflate()) {
+		error = ENOMEM;
+		return -1;
+	}
+
+	int res = SendPending();
+	if (res && res != EAGAIN) {
+		error = res;
+		return -1;
+	}
+	if (sendBuffer_.size() >= modez_max_pending) {
+		// The next layer returned EAGAIN, its write event will reach us
+		error = EAGAIN;
+		return -1;
+	}
+
+	deflate_.next_in = static_cast<Bytef*>(const_cast<void*>(buffer));
+	deflate_.avail_in = size;
+	while (deflate_.avail_in) {
+		deflate_.next_out = sendBuffer_.get(modez_chunk_size);
+		deflate_.avail_out = static_cast<uInt>(modez_chunk_size);
+		if (::deflate(&deflate_, Z_NO_FLUSH) == Z_STREAM_ERROR) {
+			error = EINVAL;
+			return -1;
+		}
+		sendBuffer_.add(modez_chunk_size - deflate_.avail_out);
+	}
+
+	res = SendPending();
+	if (res && res != EAGAIN) {
+		error = res;
+		return -1;
+	}
+
+	return static_cast<int>(size);
+}
+
+int CModeZLayer::SendPending()
+{
+	while (!sendBuffer_.empty()) {
+		int error;
+		size_t const len = std::min(sendBuffer_.size(), modez_chunk_size);
+		int written = next_layer_.write(sendBuffer_.get(), static_cast<unsigned int>(len), error);
+		if (written < 0) {
+			return error;
+		}
+		if (!written) {
+			return ECONNABORTED;
+		}
+		sendBuffer_.consume(static_cast<size_t>(written));
+	}
+
+	return 0;
+}
+
+int CModeZLayer::shutdown()
+{
+	if (!shuttingDown_) {
+		shuttingDown_ = true;
+
+		// An empty upload still needs a complete stream, whereas a listing or
+		// download has nothing to terminate.
+		if (deflating_ || !inflating_) {
+			if (!InitDeflate()) {
+				return ENOMEM;
+			}
+
+			deflate_.avail_in = 0;
+			int res;
+			do {
+				deflate_.next_out = sendBuffer_.get(modez_chunk_size);
+				deflate_.avail_out = static_cast<uInt>(modez_chunk_size);
+				res = ::deflate(&deflate_, Z_FINISH);
+				sendBuffer_.add(modez_chunk_size - deflate_.avail_out);
+			} while (res == Z_OK);
+
+			if (res != Z_STREAM_END) {
+				return EINVAL;
+			}
+			deflateDone_ = true;
+		}
+	}
+	else if (deflating_ && !deflateDone_) {
+		return EINVAL;
+	}
+
+	int res = SendPending();
+	if (res) {
+		// Continued once the next layer signals it can be written to
+		return res;
+	}
+
+	return next_layer_.shutdown();
+}
+
+void CModeZLayer::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<fz::socket_event, fz::hostaddress_event>(ev, this,
+		&CModeZLayer::OnSocketEvent,
+		&CModeZLayer::forward_hostaddress_event);
+}
+
+void CModeZLayer::OnSocketEvent(fz::socket_event_source* source, fz::socket_event_flag t, int error)
+{
+	if (t == fz::socket_event_flag::write && !error && !sendBuffer_.empty()) {
+		int res = SendPending();
+		if (res == EAGAIN) {
+			return;
+		}
+		if (!res && shuttingDown_) {
+			res = next_layer_.shutdown();
+			if (res == EAGAIN) {
+				return;
+			}
+		}
+		error = res;
+	}
+
+	forward_socket_event(source, t, error);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef FILEZILLA_ENGINE_FTP_MODEZLAYER_HEADER
+#define FILEZILLA_ENGINE_FTP_MODEZLAYER_HEADER
+
+#include <libfilezilla/buffer.hpp>
+#include <libfilezilla/socket.hpp>
+
+#include <zlib.h>
+
+// Deflate compression of the data connection as negotiated through MODE Z.
+//
+// Goes on top of the layer stack so that data gets compressed before it is
+// encrypted. Reads inflate the received data, writes deflate into a buffer
+// that is sent as the next layer accepts it. Shutting down terminates the
+// deflate stream.
+class CModeZLayer final : protected fz::event_handler, public fz::socket_layer
+{
+public:
+	CModeZLayer(fz::event_loop & loop, fz::event_handler* handler, fz::socket_interface & next_layer, int level = Z_DEFAULT_COMPRESSION);
+	virtual ~CModeZLayer();
+
+	virtual int read(void *buffer, unsigned int size, int& error) override;
+	virtual int write(void const* buffer, unsigned int size, int& error) override;
+
+	virtual int shutdown() override;
+
+private:
+	bool InitInflate();
+	bool InitDeflate();
+
+	// Returns 0 once all compressed data has been passed to the next layer
+	int SendPending();
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnSocketEvent(fz::socket_event_source* source, fz::socket_event_flag t, int error);
+
+	int const level_;
+
+	z_stream inflate_{};
+	z_stream deflate_{};
+	bool inflating_{};
+	bool deflating_{};
+
+	// Set once the peer's stream has ended, anything after it is discarded
+	bool inflateDone_{};
+
+	// Set if the last inflate call used up all output space
+	bool inflatePending_{};
+
+	// Set once the own stream has been terminated
+	bool deflateDone_{};
+
+	bool shuttingDown_{};
+
+	fz::buffer receiveBuffer_;
+	fz::buffer sendBuffer_;
+};
+
+#endif
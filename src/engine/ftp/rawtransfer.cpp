@@ -20,10 +20,12 @@ int CFtpRawTransferOpData::Send()
 	switch (opState)
 	{
 	case rawtransfer_init:
+		modeZ_ = pOldData->resumeOffset <= 0 && controlSocket_.m_pTransferSocket->Compressible() && controlSocket_.CanUseModeZ();
+
 		if ((pOldData->binary && controlSocket_.m_lastTypeBinary == 1) ||
 			(!pOldData->binary && controlSocket_.m_lastTypeBinary == 0))
 		{
-			opState = rawtransfer_port_pasv;
+			opState = StateAfterType();
 		}
 		else {
 			opState = rawtransfer_type;
@@ -64,11 +66,27 @@ int CFtpRawTransferOpData::Send()
 		}
 		measureRTT = true;
 		break;
+	case rawtransfer_mode:
+		controlSocket_.m_lastModeZ = -1;
+		cmd = modeZ_ ? L"MODE Z" : L"MODE S";
+		break;
 	case rawtransfer_port_pasv:
+		controlSocket_.m_pTransferSocket->SetModeZ(modeZ_);
 		if (bPasv) {
+			if (UsePreparedPassive()) {
+				if (pOldData->resumeOffset > 0 || controlSocket_.m_sentRestartOffset) {
+					opState = rawtransfer_rest;
+				}
+				else {
+					opState = rawtransfer_transfer;
+				}
+				return FZ_REPLY_CONTINUE;
+			}
 			cmd = GetPassiveCommand();
 		}
 		else {
+			// PORT closes the listener of any earlier passive mode reply
+			controlSocket_.ClearPreparedPassive();
 			std::string address;
 			int res = controlSocket_.GetExternalIPAddress(address);
 			if (res == FZ_REPLY_WOULDBLOCK) {
@@ -151,10 +169,26 @@ int CFtpRawTransferOpData::ParseResponse()
 			error = true;
 		}
 		else {
-			opState = rawtransfer_port_pasv;
+			opState = StateAfterType();
 			controlSocket_.m_lastTypeBinary = pOldData->binary ? 1 : 0;
 		}
 		break;
+	case rawtransfer_mode:
+		if (code == 2) {
+			controlSocket_.m_lastModeZ = modeZ_ ? 1 : 0;
+			opState = rawtransfer_port_pasv;
+		}
+		else if (modeZ_) {
+			// Server advertised MODE Z but refuses it, don't try again
+			log(logmsg::debug_warning, L"MODE Z rejected, transferring uncompressed");
+			CServerCapabilities::SetCapability(currentServer_, mode_z_support, no);
+			modeZ_ = false;
+			opState = StateAfterType();
+		}
+		else {
+			error = true;
+		}
+		break;
 	case rawtransfer_port_pasv:
 		if (code != 2 && code != 3) {
 			if (!engine_.GetOptions().GetOptionVal(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -178,10 +212,10 @@ int CFtpRawTransferOpData::ParseResponse()
 		if (bPasv) {
 			bool parsed;
 			if (GetPassiveCommand() == L"EPSV") {
-				parsed = ParseEpsvResponse();
+				parsed = ParseEpsvResponse(controlSocket_.m_Response);
 			}
 			else {
-				parsed = ParsePasvResponse();
+				parsed = ParsePasvResponse(controlSocket_.m_Response);
 			}
 			if (!parsed) {
 				if (!engine_.GetOptions().GetOptionVal(OPTION_ALLOW_TRANSFERMODEFALLBACK)) {
@@ -252,7 +286,11 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waitfinish:
-		if (code != 2 && code != 3) {
+		if (code == 4 && SegmentComplete()) {
+			// Server noticed the data connection being closed at the end of the segment
+			opState = rawtransfer_waitsocket;
+		}
+		else if (code != 2 && code != 3) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -263,7 +301,10 @@ int CFtpRawTransferOpData::ParseResponse()
 		}
 		break;
 	case rawtransfer_waittransfer:
-		if (code != 2 && code != 3) {
+		if (code == 4 && SegmentComplete() && pOldData->transferEndReason == TransferEndReason::successful) {
+			return FZ_REPLY_OK;
+		}
+		else if (code != 2 && code != 3) {
 			if (pOldData->transferEndReason == TransferEndReason::successful) {
 				pOldData->transferEndReason = TransferEndReason::transfer_command_failure;
 			}
@@ -293,19 +334,32 @@ int CFtpRawTransferOpData::ParseResponse()
 	return FZ_REPLY_CONTINUE;
 }
 
-bool CFtpRawTransferOpData::ParseEpsvResponse()
+int CFtpRawTransferOpData::StateAfterType() const
+{
+	if (controlSocket_.m_lastModeZ != (modeZ_ ? 1 : 0)) {
+		return rawtransfer_mode;
+	}
+	return rawtransfer_port_pasv;
+}
+
+bool CFtpRawTransferOpData::SegmentComplete() const
 {
-	size_t pos = controlSocket_.m_Response.find(L"(|||");
+	return controlSocket_.m_pTransferSocket && controlSocket_.m_pTransferSocket->DownloadLimitReached();
+}
+
+bool CFtpRawTransferOpData::ParseEpsvResponse(std::wstring const& response)
+{
+	size_t pos = response.find(L"(|||");
 	if (pos == std::wstring::npos) {
 		return false;
 	}
 
-	size_t pos2 = controlSocket_.m_Response.find(L"|)", pos + 4);
+	size_t pos2 = response.find(L"|)", pos + 4);
 	if (pos2 == std::wstring::npos || pos2 == pos + 4) {
 		return false;
 	}
 
-	std::wstring number = controlSocket_.m_Response.substr(pos + 4, pos2 - pos - 4);
+	std::wstring number = response.substr(pos + 4, pos2 - pos - 4);
 	auto port = fz::to_integral<unsigned int>(number);
 
 	if (port == 0 || port > 65535) {
@@ -323,7 +377,7 @@ bool CFtpRawTransferOpData::ParseEpsvResponse()
 	return true;
 }
 
-bool CFtpRawTransferOpData::ParsePasvResponse()
+bool CFtpRawTransferOpData::ParsePasvResponse(std::wstring const& response)
 {
 	// Validate ip address
 	if (!controlSocket_.m_pasvReplyRegex) {
@@ -334,7 +388,7 @@ bool CFtpRawTransferOpData::ParsePasvResponse()
 	}
 
 	std::wsmatch m;
-	if (!std::regex_search(controlSocket_.m_Response, m, *controlSocket_.m_pasvReplyRegex)) {
+	if (!std::regex_search(response, m, *controlSocket_.m_pasvReplyRegex)) {
 		return false;
 	}
 
@@ -390,6 +444,49 @@ bool CFtpRawTransferOpData::ParsePasvResponse()
 	return true;
 }
 
+void CFtpRawTransferOpData::PreparePassive()
+{
+	if (!bPasv || !engine_.GetOptions().GetOptionVal(OPTION_FTP_PREPARE_PASSIVE) ||
+		CServerCapabilities::GetCapability(currentServer_, command_pipelining) == no)
+	{
+		return;
+	}
+
+	// The reply comes after the one to the transfer command and gets
+	// picked up by CFtpControlSocket::ParseResponse
+	std::wstring const cmd = GetPassiveCommand();
+	int const before = controlSocket_.m_pendingReplies;
+	if (controlSocket_.SendCommand(cmd, false, false) == FZ_REPLY_WOULDBLOCK) {
+		controlSocket_.preparedPassive_ = CFtpControlSocket::prepared_passive{cmd, std::wstring(), fz::monotonic_clock(), before};
+	}
+}
+
+bool CFtpRawTransferOpData::UsePreparedPassive()
+{
+	auto & prepared = controlSocket_.preparedPassive_;
+	if (!prepared || prepared->reply_.empty()) {
+		return false;
+	}
+
+	std::wstring const cmd = prepared->cmd_;
+	std::wstring const reply = prepared->reply_;
+	bool const fresh = (fz::monotonic_clock::now() - prepared->time_) < fz::duration::from_seconds(10);
+	prepared.reset();
+
+	if (!fresh) {
+		return false;
+	}
+
+	bool const parsed = (cmd == L"EPSV") ? ParseEpsvResponse(reply) : ParsePasvResponse(reply);
+	if (!parsed) {
+		return false;
+	}
+
+	log(logmsg::debug_info, L"Using passive mode reply obtained during the previous transfer");
+	bTriedPasv = true;
+	return true;
+}
+
 std::wstring CFtpRawTransferOpData::GetPassiveCommand()
 {
 	std::wstring ret = L"PASV";
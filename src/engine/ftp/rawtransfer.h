@@ -7,6 +7,7 @@ enum rawtransferStates
 {
 	rawtransfer_init = 0,
 	rawtransfer_type,
+	rawtransfer_mode,
 	rawtransfer_port_pasv,
 	rawtransfer_rest,
 	rawtransfer_transfer,
@@ -29,8 +30,21 @@ public:
 	virtual int ParseResponse() override;
 
 	std::wstring GetPassiveCommand();
-	bool ParsePasvResponse();
-	bool ParseEpsvResponse();
+	bool ParsePasvResponse(std::wstring const& response);
+	bool ParseEpsvResponse(std::wstring const& response);
+
+	// Sends the passive mode command for the next transfer while still
+	// waiting for the reply to this one, see OPTION_FTP_PREPARE_PASSIVE.
+	void PreparePassive();
+
+	// Takes the reply to an earlier PreparePassive if still fresh
+	bool UsePreparedPassive();
+
+	// True once a segmented download has received all of its data
+	bool SegmentComplete() const;
+
+	// State following TYPE, depending on whether MODE needs to be changed
+	int StateAfterType() const;
 
 	std::wstring cmd_;
 
@@ -40,6 +54,8 @@ public:
 	bool bTriedPasv{};
 	bool bTriedActive{};
 
+	bool modeZ_{};
+
 	std::wstring host_;
 	int port_{};
 };
@@ -1,8 +1,12 @@
 #include <filezilla.h>
+#include "activeports.h"
 #include "directorylistingparser.h"
 #include "engineprivate.h"
 #include "ftp/ftpcontrolsocket.h"
 #include "iothread.h"
+#if HAVE_ZLIB
+#include "modezlayer.h"
+#endif
 #include "optionsbase.h"
 #include "proxy.h"
 #include "servercapabilities.h"
@@ -14,6 +18,27 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
+#ifdef __linux__
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef ZEROCOPY_UPLOADS
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+namespace {
+size_t const zerocopy_chunk_size = 1024 * 1024;
+size_t const zerocopy_fallback_size = 64 * 1024;
+}
+#endif
+
 CTransferSocket::CTransferSocket(CFileZillaEnginePrivate & engine, CFtpControlSocket & controlSocket, TransferMode transferMode)
 : fz::event_handler(controlSocket.event_loop_)
 , engine_(engine)
@@ -38,6 +63,12 @@ CTransferSocket::~CTransferSocket()
 			ioThread_->SetEventHandler(nullptr);
 		}
 	}
+
+#ifdef ZEROCOPY_UPLOADS
+	if (zeroCopyFd_ != -1) {
+		close(zeroCopyFd_);
+	}
+#endif
 }
 
 void CTransferSocket::ResetSocket()
@@ -46,10 +77,19 @@ void CTransferSocket::ResetSocket()
 
 	active_layer_ = nullptr;
 
+#if HAVE_ZLIB
+	modez_layer_.reset();
+#endif
 	tls_layer_.reset();
 	proxy_layer_.reset();
 	ratelimit_layer_.reset();
 	socket_.reset();
+	rate_limiter_.reset();
+
+	if (activePort_) {
+		engine_.GetContext().GetActivePortAllocator().Release(activePort_);
+		activePort_ = 0;
+	}
 }
 
 std::wstring CTransferSocket::SetupActiveTransfer(std::string const& ip)
@@ -165,6 +205,8 @@ void CTransferSocket::OnAccept(int error)
 	}
 	socketServer_.reset();
 
+	PrepareNextListener();
+
 	if (!InitLayers(true)) {
 		TransferEnd(TransferEndReason::transfer_failure);
 		return;
@@ -185,6 +227,8 @@ void CTransferSocket::OnConnect()
 		return;
 	}
 
+	SetCongestionControl(*socket_);
+
 	if (tls_layer_) {
 		// Re-enable Nagle algorithm
 		socket_->set_flags(fz::socket::flag_nodelay, false);
@@ -204,10 +248,10 @@ void CTransferSocket::OnConnect()
 
 void CTransferSocket::OnReceive()
 {
-	controlSocket_.log(logmsg::debug_debug, L"CTransferSocket::OnReceive(), m_transferMode=%d", m_transferMode);
+	FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"CTransferSocket::OnReceive(), m_transferMode=%d", m_transferMode);
 
 	if (!m_bActive) {
-		controlSocket_.log(logmsg::debug_verbose, L"Postponing receive, m_bActive was false.");
+		FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_verbose, L"Postponing receive, m_bActive was false.");
 		m_postponedReceive = true;
 		return;
 	}
@@ -215,11 +259,11 @@ void CTransferSocket::OnReceive()
 	if (m_transferEndReason == TransferEndReason::none) {
 		if (m_transferMode == TransferMode::list) {
 			for (;;) {
-				char *pBuffer = new char[4096];
+				int len;
+				char *pBuffer = m_pDirectoryListingParser->GetBuffer(len);
 				int error;
-				int numread = active_layer_->read(pBuffer, 4096, error);
+				int numread = active_layer_->read(pBuffer, len, error);
 				if (numread < 0) {
-					delete [] pBuffer;
 					if (error != EAGAIN) {
 						controlSocket_.log(logmsg::error, L"Could not read from transfer socket: %s", fz::socket_error_description(error));
 						TransferEnd(TransferEndReason::transfer_failure);
@@ -228,7 +272,7 @@ void CTransferSocket::OnReceive()
 				}
 
 				if (numread > 0) {
-					if (!m_pDirectoryListingParser->AddData(pBuffer, numread)) {
+					if (!m_pDirectoryListingParser->AddData(numread)) {
 						TransferEnd(TransferEndReason::transfer_failure);
 						return;
 					}
@@ -241,7 +285,6 @@ void CTransferSocket::OnReceive()
 					engine_.transfer_status_.Update(numread);
 				}
 				else {
-					delete [] pBuffer;
 					TransferEnd(TransferEndReason::successful);
 					return;
 				}
@@ -260,7 +303,11 @@ void CTransferSocket::OnReceive()
 					return;
 				}
 
-				numread = active_layer_->read(m_pTransferBuffer, m_transferBufferLen, error);
+				int toRead = m_transferBufferLen;
+				if (downloadLimit_ >= 0 && downloadLimit_ < toRead) {
+					toRead = static_cast<int>(downloadLimit_);
+				}
+				numread = active_layer_->read(m_pTransferBuffer, toRead, error);
 				if (numread <= 0) {
 					break;
 				}
@@ -274,6 +321,16 @@ void CTransferSocket::OnReceive()
 
 				m_pTransferBuffer += numread;
 				m_transferBufferLen -= numread;
+
+				if (downloadLimit_ >= 0) {
+					downloadLimit_ -= numread;
+					if (!downloadLimit_) {
+						controlSocket_.log(logmsg::debug_info, L"Received the entire segment, closing data connection");
+						downloadLimitReached_ = true;
+						FinalizeWrite();
+						return;
+					}
+				}
 			}
 
 			if (numread < 0) {
@@ -283,6 +340,11 @@ void CTransferSocket::OnReceive()
 				}
 			}
 			else if (!numread) {
+				if (downloadLimit_ > 0) {
+					controlSocket_.log(logmsg::error, _("Data connection closed before the entire segment was received"));
+					TransferEnd(TransferEndReason::transfer_failure);
+					return;
+				}
 				FinalizeWrite();
 			}
 			else {
@@ -351,12 +413,12 @@ void CTransferSocket::OnReceive()
 void CTransferSocket::OnSend()
 {
 	if (!active_layer_) {
-		controlSocket_.log(logmsg::debug_verbose, L"OnSend called without backend. Ignoring event.");
+		FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_verbose, L"OnSend called without backend. Ignoring event.");
 		return;
 	}
 
 	if (!m_bActive) {
-		controlSocket_.log(logmsg::debug_verbose, L"Postponing send");
+		FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_verbose, L"Postponing send");
 		m_postponedSend = true;
 		return;
 	}
@@ -365,6 +427,13 @@ void CTransferSocket::OnSend()
 		return;
 	}
 
+#ifdef ZEROCOPY_UPLOADS
+	if (zeroCopyFd_ != -1) {
+		OnSendZeroCopy();
+		return;
+	}
+#endif
+
 	int error;
 	int written;
 
@@ -383,7 +452,7 @@ void CTransferSocket::OnSend()
 
 		controlSocket_.SetActive(CFileZillaEngine::send);
 		if (m_madeProgress == 1) {
-			controlSocket_.log(logmsg::debug_debug, L"Made progress in CTransferSocket::OnSend()");
+			FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"Made progress in CTransferSocket::OnSend()");
 			m_madeProgress = 2;
 			engine_.transfer_status_.SetMadeProgress();
 		}
@@ -396,7 +465,7 @@ void CTransferSocket::OnSend()
 	if (written < 0) {
 		if (error == EAGAIN) {
 			if (!m_madeProgress) {
-				controlSocket_.log(logmsg::debug_debug, L"First EAGAIN in CTransferSocket::OnSend()");
+				FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"First EAGAIN in CTransferSocket::OnSend()");
 				m_madeProgress = 1;
 				engine_.transfer_status_.SetMadeProgress();
 			}
@@ -411,6 +480,91 @@ void CTransferSocket::OnSend()
 	}
 }
 
+#ifdef ZEROCOPY_UPLOADS
+bool CTransferSocket::SetZeroCopySource(fz::native_string const& file, int64_t offset)
+{
+	assert(zeroCopyFd_ == -1);
+	zeroCopyFd_ = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (zeroCopyFd_ == -1) {
+		return false;
+	}
+	zeroCopyOffset_ = offset;
+	return true;
+}
+
+void CTransferSocket::OnSendZeroCopy()
+{
+	int const fd = socket_->get_descriptor();
+
+	for (int i = 0; i < 100; ++i) {
+		ssize_t sent = -1;
+		int error{};
+		if (useSendfile_) {
+			off_t offset = static_cast<off_t>(zeroCopyOffset_);
+			sent = sendfile(fd, zeroCopyFd_, &offset, zerocopy_chunk_size);
+			if (sent < 0) {
+				error = errno;
+				if (error == EINVAL || error == ENOSYS) {
+					controlSocket_.log(logmsg::debug_info, L"sendfile not supported for this file, falling back to regular reads");
+					useSendfile_ = false;
+				}
+			}
+		}
+
+		if (!useSendfile_ || (sent < 0 && error == EAGAIN)) {
+			// Write through the socket layer. Either as fallback, or a single
+			// byte so that the socket waits for writability and signals it.
+			size_t const len = useSendfile_ ? 1 : zerocopy_fallback_size;
+			zeroCopyFallbackBuffer_.resize(zerocopy_fallback_size);
+			ssize_t const r = pread(zeroCopyFd_, zeroCopyFallbackBuffer_.data(), len, static_cast<off_t>(zeroCopyOffset_));
+			if (r < 0) {
+				controlSocket_.log(logmsg::error, _("Can't read from file"));
+				TransferEnd(TransferEndReason::transfer_failure);
+				return;
+			}
+			sent = r ? active_layer_->write(zeroCopyFallbackBuffer_.data(), static_cast<unsigned int>(r), error) : 0;
+		}
+
+		if (sent < 0) {
+			if (error == EAGAIN) {
+				if (!m_madeProgress) {
+					FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"First EAGAIN in CTransferSocket::OnSendZeroCopy()");
+					m_madeProgress = 1;
+					engine_.transfer_status_.SetMadeProgress();
+				}
+			}
+			else {
+				controlSocket_.log(logmsg::error, L"Could not write to transfer socket: %s", fz::socket_error_description(error));
+				TransferEnd(TransferEndReason::transfer_failure);
+			}
+			return;
+		}
+
+		if (!sent) {
+			int res = active_layer_->shutdown();
+			if (res && res != EAGAIN) {
+				TransferEnd(TransferEndReason::transfer_failure);
+				return;
+			}
+			TransferEnd(TransferEndReason::successful);
+			return;
+		}
+
+		zeroCopyOffset_ += sent;
+
+		controlSocket_.SetActive(CFileZillaEngine::send);
+		if (m_madeProgress == 1) {
+			FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"Made progress in CTransferSocket::OnSendZeroCopy()");
+			m_madeProgress = 2;
+			engine_.transfer_status_.SetMadeProgress();
+		}
+		engine_.transfer_status_.Update(sent);
+	}
+
+	send_event<fz::socket_event>(active_layer_, fz::socket_event_flag::write, 0);
+}
+#endif
+
 void CTransferSocket::OnSocketError(int error)
 {
 	controlSocket_.log(logmsg::debug_verbose, L"CTransferSocket::OnSocketError(%d)", error);
@@ -439,10 +593,16 @@ bool CTransferSocket::SetupPassiveTransfer(std::wstring const& host, int port)
 	// 2) we are using a proxy.
 	//
 	// In case destination IPs of control and data connection are different, do not bind to the
-	// same source.
+	// same source. Unless a source address has been configured, it does not matter where the
+	// data connection goes then.
 
 	std::string bindAddress;
-	if (controlSocket_.proxy_layer_) {
+	if (!controlSocket_.sourceAddress_.empty()) {
+		bindAddress = controlSocket_.sourceAddress_;
+		controlSocket_.log(logmsg::debug_info, L"Binding data connection source IP to configured source address %s", bindAddress);
+		socket_->bind(bindAddress);
+	}
+	else if (controlSocket_.proxy_layer_) {
 		bindAddress = controlSocket_.socket_->local_ip();
 		controlSocket_.log(logmsg::debug_info, L"Binding data connection source IP to control connection source IP %s", bindAddress);
 		socket_->bind(bindAddress);
@@ -474,11 +634,22 @@ bool CTransferSocket::SetupPassiveTransfer(std::wstring const& host, int port)
 
 bool CTransferSocket::InitLayers(bool active)
 {
-	ratelimit_layer_ = std::make_unique<fz::rate_limited_layer>(nullptr, *socket_, &engine_.GetRateLimiter());
-	active_layer_ = ratelimit_layer_.get();
+	rate_limiter_ = controlSocket_.rate_limiter_;
+	if (rate_limiter_) {
+		ratelimit_layer_ = std::make_unique<fz::rate_limited_layer>(nullptr, *socket_, rate_limiter_.get());
+		active_layer_ = ratelimit_layer_.get();
+	}
+	else {
+		active_layer_ = socket_.get();
+	}
 
 	if (controlSocket_.proxy_layer_ && !active) {
-		fz::native_string proxy_host = controlSocket_.proxy_layer_->next().peer_host();
+		// Connect to the very proxy address the control connection uses,
+		// spares looking up its name once more.
+		fz::native_string proxy_host = fz::to_native(controlSocket_.socket_->peer_ip());
+		if (proxy_host.empty()) {
+			proxy_host = controlSocket_.proxy_layer_->next().peer_host();
+		}
 		int error;
 		int proxy_port = controlSocket_.proxy_layer_->next().peer_port(error);
 
@@ -503,11 +674,31 @@ bool CTransferSocket::InitLayers(bool active)
 		}
 	}
 
+	if (modeZ_) {
+#if HAVE_ZLIB
+		modez_layer_ = std::make_unique<CModeZLayer>(controlSocket_.event_loop_, nullptr, *active_layer_);
+		active_layer_ = modez_layer_.get();
+#else
+		return false;
+#endif
+	}
+
 	active_layer_->set_event_handler(this);
 
 	return true;
 }
 
+bool CTransferSocket::Compressible() const
+{
+	if (m_transferMode == TransferMode::list) {
+		return true;
+	}
+	if (m_transferMode == TransferMode::download || m_transferMode == TransferMode::upload) {
+		return !m_binaryMode && downloadLimit_ < 0;
+	}
+	return false;
+}
+
 void CTransferSocket::SetActive()
 {
 	if (m_transferEndReason != TransferEndReason::none) {
@@ -538,7 +729,15 @@ void CTransferSocket::TransferEnd(TransferEndReason reason)
 	}
 	m_transferEndReason = reason;
 
-	if (reason != TransferEndReason::successful) {
+	if (reason == TransferEndReason::successful) {
+		int64_t const rate = engine_.transfer_status_.Rate();
+		if (rate > 0) {
+			controlSocket_.transferRate_ = rate;
+		}
+	}
+
+	if (reason != TransferEndReason::successful || downloadLimitReached_) {
+		// Closing without reading the rest makes the server abort the transfer
 		ResetSocket();
 	}
 	else {
@@ -551,6 +750,9 @@ void CTransferSocket::TransferEnd(TransferEndReason reason)
 std::unique_ptr<fz::listen_socket> CTransferSocket::CreateSocketServer(int port)
 {
 	auto socket = std::make_unique<fz::listen_socket>(engine_.GetThreadPool(), this);
+	if (!controlSocket_.sourceAddress_.empty()) {
+		socket->bind(controlSocket_.sourceAddress_);
+	}
 	int res = socket->listen(controlSocket_.socket_->address_family(), port);
 	if (res) {
 		controlSocket_.log(logmsg::debug_verbose, L"Could not listen on port %d: %s", port, fz::socket_error_description(res));
@@ -570,9 +772,9 @@ std::unique_ptr<fz::listen_socket> CTransferSocket::CreateSocketServer()
 		return CreateSocketServer(0);
 	}
 
-	// Try out all ports in the port range.
-	// Upon first call, we try to use a random port fist, after that
-	// increase the port step by step
+	// Try out all ports in the port range. The allocator is shared by all
+	// engines, it avoids ports other transfers are using and, for a while,
+	// ports that have been used recently.
 
 	// Windows only: I think there's a bug in the socket implementation of
 	// Windows: Even if using SO_REUSEADDR, using the same local address
@@ -580,35 +782,70 @@ std::unique_ptr<fz::listen_socket> CTransferSocket::CreateSocketServer()
 	// connection attempts. This may cause problems if transferring lots of
 	// files with a narrow port range.
 
-	static int start = 0;
-
 	int low = engine_.GetOptions().GetOptionVal(OPTION_LIMITPORTS_LOW);
 	int high = engine_.GetOptions().GetOptionVal(OPTION_LIMITPORTS_HIGH);
 	if (low > high) {
 		low = high;
 	}
 
-	if (start < low || start > high) {
-		start = static_cast<decltype(start)>(fz::random_number(low, high));
-		assert(start >= low && start <= high);
-	}
+	auto & allocator = engine_.GetContext().GetActivePortAllocator();
 
-	std::unique_ptr<fz::listen_socket> server;
+	int port{};
+	std::unique_ptr<fz::listen_socket> server = allocator.TakeListener(controlSocket_.socket_->address_family(), low, high, port);
+	if (server) {
+		controlSocket_.log(logmsg::debug_verbose, L"Using listener prepared on port %d", port);
+		server->set_event_handler(this);
+		activePort_ = port;
+		return server;
+	}
 
 	int count = high - low + 1;
 	while (count--) {
-		server = CreateSocketServer(start++);
-		if (server) {
+		port = allocator.Acquire(low, high);
+		if (!port) {
 			break;
 		}
-		if (start > high) {
-			start = low;
+		server = CreateSocketServer(port);
+		if (server) {
+			activePort_ = port;
+			break;
 		}
+		allocator.Release(port);
 	}
 
 	return server;
 }
 
+void CTransferSocket::PrepareNextListener()
+{
+	if (!engine_.GetOptions().GetOptionVal(OPTION_LIMITPORTS) || !engine_.GetOptions().GetOptionVal(OPTION_ACTIVE_PRELISTEN)) {
+		return;
+	}
+
+	int low = engine_.GetOptions().GetOptionVal(OPTION_LIMITPORTS_LOW);
+	int high = engine_.GetOptions().GetOptionVal(OPTION_LIMITPORTS_HIGH);
+	if (low > high) {
+		low = high;
+	}
+
+	auto & allocator = engine_.GetContext().GetActivePortAllocator();
+	int const port = allocator.Acquire(low, high);
+	if (!port) {
+		return;
+	}
+
+	// Nobody is listening for its events until a transfer takes it
+	auto socket = std::make_unique<fz::listen_socket>(engine_.GetThreadPool(), nullptr);
+	int res = socket->listen(controlSocket_.socket_->address_family(), port);
+	if (res) {
+		controlSocket_.log(logmsg::debug_verbose, L"Could not listen on port %d: %s", port, fz::socket_error_description(res));
+		allocator.Release(port);
+		return;
+	}
+	SetSocketBufferSizes(*socket);
+	allocator.StoreListener(std::move(socket), port);
+}
+
 bool CTransferSocket::CheckGetNextWriteBuffer()
 {
 	if (!m_transferBufferLen) {
@@ -629,7 +866,8 @@ bool CTransferSocket::CheckGetNextWriteBuffer()
 			return false;
 		}
 
-		m_transferBufferLen = BUFFERSIZE;
+		m_transferBufferLen = res;
+		m_transferBufferSize = res;
 	}
 
 	return true;
@@ -678,8 +916,9 @@ void CTransferSocket::OnIOThreadEvent()
 
 void CTransferSocket::FinalizeWrite()
 {
-	bool res = ioThread_->Finalize(BUFFERSIZE - m_transferBufferLen);
-	m_transferBufferLen = BUFFERSIZE;
+	bool res = ioThread_->Finalize(m_transferBufferSize - m_transferBufferLen);
+	m_transferBufferLen = 0;
+	m_transferBufferSize = 0;
 
 	if (m_transferEndReason != TransferEndReason::none) {
 		return;
@@ -721,6 +960,24 @@ void CTransferSocket::TriggerPostponedEvents()
 
 void CTransferSocket::SetSocketBufferSizes(fz::socket_base& socket)
 {
+	if (engine_.GetOptions().GetOptionVal(OPTION_SOCKET_BUFFER_AUTOTUNE)) {
+		// Twice the bandwidth-delay product, as the rate measured last time
+		// may itself have been limited by the buffers. Without measurements,
+		// the system's own tuning applies.
+		int const latency = controlSocket_.m_rtt.GetLatency();
+		int64_t const rate = controlSocket_.transferRate_;
+		if (latency > 0 && rate > 0) {
+			int64_t size = rate * latency / 1000 * 2;
+			size = std::clamp(size, int64_t(64 * 1024), int64_t(64 * 1024 * 1024));
+#if FZ_WINDOWS
+			socket.set_buffer_sizes(static_cast<int>(size), -1);
+#else
+			socket.set_buffer_sizes(static_cast<int>(size), static_cast<int>(size));
+#endif
+		}
+		return;
+	}
+
 	const int size_read = engine_.GetOptions().GetOptionVal(OPTION_SOCKET_BUFFERSIZE_RECV);
 #if FZ_WINDOWS
 	const int size_write = -1;
@@ -730,6 +987,27 @@ void CTransferSocket::SetSocketBufferSizes(fz::socket_base& socket)
 	socket.set_buffer_sizes(size_read, size_write);
 }
 
+void CTransferSocket::SetCongestionControl(fz::socket & socket)
+{
+#if defined(__linux__) && defined(TCP_CONGESTION)
+	std::string const algorithm = fz::to_utf8(engine_.GetOptions().GetOption(OPTION_TCP_CONGESTION_CONTROL));
+	if (algorithm.empty()) {
+		return;
+	}
+
+	int const fd = socket.get_descriptor();
+	if (fd == -1) {
+		return;
+	}
+	if (setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, algorithm.c_str(), static_cast<socklen_t>(algorithm.size())) != 0) {
+		// E.g. module not loaded or not allowed for unprivileged processes
+		controlSocket_.log(logmsg::debug_warning, L"Could not set congestion control to %s: %s", algorithm, fz::socket_error_description(errno));
+	}
+#else
+	(void)socket;
+#endif
+}
+
 void CTransferSocket::operator()(fz::event_base const& ev)
 {
 	fz::dispatch<fz::socket_event, CIOThreadEvent, fz::timer_event>(ev, this,
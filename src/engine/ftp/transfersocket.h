@@ -4,6 +4,11 @@
 #include "iothread.h"
 #include "controlsocket.h"
 
+#ifdef __linux__
+// Plain uploads can be sent straight from the file to the socket
+#define ZEROCOPY_UPLOADS 1
+#endif
+
 class CFileZillaEnginePrivate;
 class CFtpControlSocket;
 class CDirectoryListingParser;
@@ -17,8 +22,10 @@ enum class TransferMode
 };
 
 class CIOThread;
+class CModeZLayer;
 
 namespace fz {
+class rate_limiter;
 class tls_layer;
 }
 
@@ -41,6 +48,26 @@ public:
 
 	void SetIOThread(CIOThread* ioThread) { ioThread_ = ioThread; }
 
+	// Downloads end successfully after the given number of bytes, closing
+	// the data connection. Used for segmented downloads.
+	void SetDownloadLimit(int64_t limit) { downloadLimit_ = limit; }
+	bool DownloadLimitReached() const { return downloadLimitReached_; }
+
+	// Whether the data is worth compressing with MODE Z: listings and text
+	// transfers of whole files
+	bool Compressible() const;
+
+	// Adds a deflate layer on top of the other layers once the data
+	// connection gets established. Call after the server has accepted MODE Z.
+	void SetModeZ(bool modeZ) { modeZ_ = modeZ; }
+
+#ifdef ZEROCOPY_UPLOADS
+	// Uploads the file starting at the given offset using sendfile instead
+	// of reading it through a CIOThread. Only to be used on data connections
+	// without TLS, proxy and speed limits.
+	bool SetZeroCopySource(fz::native_string const& file, int64_t offset);
+#endif
+
 protected:
 	bool CheckGetNextWriteBuffer();
 	bool CheckGetNextReadBuffer();
@@ -57,6 +84,9 @@ protected:
 	void OnAccept(int error);
 	void OnReceive();
 	void OnSend();
+#ifdef ZEROCOPY_UPLOADS
+	void OnSendZeroCopy();
+#endif
 	void OnSocketError(int error);
 	void OnTimer(fz::timer_id);
 
@@ -65,6 +95,7 @@ protected:
 	std::unique_ptr<fz::listen_socket> CreateSocketServer(int port);
 
 	void SetSocketBufferSizes(fz::socket_base & socket);
+	void SetCongestionControl(fz::socket & socket);
 
 	virtual void operator()(fz::event_base const& ev);
 	void OnIOThreadEvent();
@@ -72,6 +103,12 @@ protected:
 	// Will be set only while creating active mode connections
 	std::unique_ptr<fz::listen_socket> socketServer_;
 
+	// Port from CActivePortAllocator in use by this socket, 0 if none
+	int activePort_{};
+
+	// Leaves a listener for the next active mode transfer with CActivePortAllocator
+	void PrepareNextListener();
+
 	CFileZillaEnginePrivate & engine_;
 	CFtpControlSocket & controlSocket_;
 
@@ -82,18 +119,30 @@ protected:
 
 	char *m_pTransferBuffer{};
 	int m_transferBufferLen{};
+	int m_transferBufferSize{};
+
+	int64_t downloadLimit_{-1};
+	bool downloadLimitReached_{};
 
 	bool m_postponedReceive{};
 	bool m_postponedSend{};
 	void TriggerPostponedEvents();
 
+	// That of the control connection, if any
+	std::shared_ptr<fz::rate_limiter> rate_limiter_;
+
 	std::unique_ptr<fz::socket> socket_;
 	std::unique_ptr<fz::rate_limited_layer> ratelimit_layer_;
 	std::unique_ptr<CProxySocket> proxy_layer_;
 	std::unique_ptr<fz::tls_layer> tls_layer_;
+#if HAVE_ZLIB
+	std::unique_ptr<CModeZLayer> modez_layer_;
+#endif
 
 	fz::socket_layer* active_layer_{};
 
+	bool modeZ_{};
+
 
 	// Needed for the madeProgress field in CTransferStatus
 	// Initially 0, 2 if made progress
@@ -101,6 +150,13 @@ protected:
 	int m_madeProgress{};
 
 	CIOThread* ioThread_{};
+
+#ifdef ZEROCOPY_UPLOADS
+	int zeroCopyFd_{-1};
+	int64_t zeroCopyOffset_{};
+	bool useSendfile_{true};
+	std::vector<char> zeroCopyFallbackBuffer_;
+#endif
 };
 
 #endif
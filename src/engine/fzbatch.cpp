@@ -0,0 +1,674 @@
+// Runs the transfers of a queue file exported from FileZilla without the
+// graphical interface, e.g. from cron jobs or build pipelines.
+//
+// Usage: fzbatch [-n engines] [-o action] [-t] [-v] [-s sitemanager.xml site] queue.xml
+//   -n  Number of engines transferring in parallel, 1 to 10, default 2.
+//   -o  What to do with existing target files: overwrite (default), newer,
+//       size, resume or skip. Overwrite actions stored in the queue file
+//       take precedence.
+//   -t  Trust unknown host keys and certificates, and allow connections
+//       falling back to plaintext. Without it, only certificates trusted by
+//       the system and host keys already known to fzsftp are accepted.
+//   -v  Copy the engine log to stderr.
+//   -s  Use the server and credentials of the given Site Manager entry for
+//       all files in the queue. Sites are given by their path, such as
+//       "Folder/Site".
+//
+// Progress is written to stdout, one JSON object per line:
+//   {"event":"start","id":1,"engine":0,"download":true,"local":"...","remote":"..."}
+//   {"event":"progress","id":1,"bytes":1048576,"total":4194304}
+//   {"event":"done","id":1,"result":"ok","code":0,"bytes":4194304,"ms":1234}
+//   {"event":"summary","files":1,"ok":1,"failed":0,"bytes":4194304,"ms":1300}
+// Files are numbered in the order of the queue file, starting at 1. code is
+// the FZ_REPLY_* value of the failed operation.
+//
+// Exits with 0 if all files got transferred, 2 if some failed and 1 if the
+// queue could not be run at all.
+//
+// Passwords protected with a master password cannot be decrypted here, use
+// -s with a site having a stored password instead.
+
+#include <filezilla.h>
+
+#include "engine_context.h"
+#include "headless_options.h"
+#include "xmlutils.h"
+
+#include <libfilezilla/encode.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct site final
+{
+	CServer server;
+	Credentials credentials;
+};
+
+struct job final
+{
+	size_t site{};
+	std::wstring localFile;
+	CServerPath remotePath;
+	std::wstring remoteFile;
+	bool download{};
+	bool ascii{};
+	CFileExistsNotification::OverwriteAction overwriteAction{CFileExistsNotification::unknown};
+
+	bool started{};
+	fz::monotonic_clock start;
+};
+
+size_t const npos = static_cast<size_t>(-1);
+
+// Mirrors GetServer in the interface's xmlfunctions.cpp
+bool load_site(pugi::xml_node node, site & s, std::wstring & error)
+{
+	std::wstring const host = GetTextElement(node, "Host");
+	int const port = GetTextElementInt(node, "Port");
+	if (host.empty() || port < 1 || port > 65535 || !s.server.SetHost(host, port)) {
+		error = L"Invalid host or port";
+		return false;
+	}
+
+	int const protocol = GetTextElementInt(node, "Protocol");
+	if (protocol < 0 || protocol > ServerProtocol::MAX_VALUE) {
+		error = L"Invalid protocol";
+		return false;
+	}
+	s.server.SetProtocol(static_cast<ServerProtocol>(protocol));
+
+	int const type = GetTextElementInt(node, "Type");
+	if (type < 0 || type >= SERVERTYPE_MAX) {
+		error = L"Invalid server type";
+		return false;
+	}
+	s.server.SetType(static_cast<ServerType>(type));
+
+	int const logonType = GetTextElementInt(node, "Logontype");
+	if (logonType < 0 || logonType >= static_cast<int>(LogonType::count) || logonType == static_cast<int>(LogonType::ask)) {
+		error = L"Logon type requires user interaction";
+		return false;
+	}
+	s.credentials.logonType_ = static_cast<LogonType>(logonType);
+
+	if (s.credentials.logonType_ != LogonType::anonymous) {
+		s.server.SetUser(GetTextElement(node, "User"));
+
+		if (s.credentials.logonType_ == LogonType::normal || s.credentials.logonType_ == LogonType::account) {
+			auto passElement = node.child("Pass");
+			if (passElement) {
+				std::wstring const encoding = GetTextAttribute(passElement, "encoding");
+				if (encoding == L"base64") {
+					s.credentials.SetPass(fz::to_wstring_from_utf8(fz::base64_decode_s(passElement.child_value())));
+				}
+				else if (encoding.empty()) {
+					s.credentials.SetPass(GetTextElement(passElement));
+				}
+				else {
+					error = L"Password is protected by a master password";
+					return false;
+				}
+			}
+			s.credentials.account_ = GetTextElement(node, "Account");
+		}
+		else if (s.credentials.logonType_ == LogonType::key) {
+			s.credentials.keyFile_ = GetTextElement(node, "Keyfile");
+		}
+	}
+
+	if (!s.server.SetTimezoneOffset(GetTextElementInt(node, "TimezoneOffset"))) {
+		error = L"Invalid timezone offset";
+		return false;
+	}
+
+	std::string_view const pasvMode = node.child_value("PasvMode");
+	if (pasvMode == "MODE_PASSIVE") {
+		s.server.SetPasvMode(MODE_PASSIVE);
+	}
+	else if (pasvMode == "MODE_ACTIVE") {
+		s.server.SetPasvMode(MODE_ACTIVE);
+	}
+
+	std::string_view const encodingType = node.child_value("EncodingType");
+	if (encodingType == "UTF-8") {
+		s.server.SetEncodingType(ENCODING_UTF8);
+	}
+	else if (encodingType == "Custom") {
+		s.server.SetEncodingType(ENCODING_CUSTOM, GetTextElement(node, "CustomEncoding"));
+	}
+
+	s.server.SetBypassProxy(GetTextElementBool(node, "BypassProxy"));
+
+	return true;
+}
+
+// Site paths as shown by the Site Manager, e.g. "Folder/Site". The "0/"
+// prefix of site paths given to the interface on the command line is
+// accepted as well.
+pugi::xml_node find_site(pugi::xml_node servers, std::wstring path)
+{
+	if (fz::starts_with(path, std::wstring(L"0/"))) {
+		path = path.substr(2);
+	}
+
+	auto segments = fz::strtok(path, L"/");
+	pugi::xml_node node = servers;
+	for (size_t i = 0; node && i < segments.size(); ++i) {
+		bool const last = i + 1 == segments.size();
+		pugi::xml_node found;
+		for (auto child = node.first_child(); child && !found; child = child.next_sibling()) {
+			if (last && !strcmp(child.name(), "Server") && GetTextElement(child, "Name") == segments[i]) {
+				found = child;
+			}
+			else if (!last && !strcmp(child.name(), "Folder") && GetTextElement_Trimmed(child) == segments[i]) {
+				found = child;
+			}
+		}
+		node = found;
+	}
+	return segments.empty() ? pugi::xml_node() : node;
+}
+
+std::string json_string(std::wstring const& s)
+{
+	std::string ret = "\"";
+	for (unsigned char const c : fz::to_utf8(s)) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+			ret += static_cast<char>(c);
+		}
+		else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			ret += buf;
+		}
+		else {
+			ret += static_cast<char>(c);
+		}
+	}
+	ret += '"';
+	return ret;
+}
+
+class batch final : public EngineNotificationHandler
+{
+public:
+	batch(size_t engines, bool trust, bool verbose, CFileExistsNotification::OverwriteAction overwriteAction)
+		: context_(options_, converter_)
+		, trust_(trust)
+		, verbose_(verbose)
+		, overwriteAction_(overwriteAction)
+	{
+		workers_.resize(engines);
+		for (auto & w : workers_) {
+			w.engine = std::make_unique<CFileZillaEngine>(context_, *this);
+		}
+	}
+
+	~batch()
+	{
+		// Engines need to go before the context
+		workers_.clear();
+	}
+
+	bool Load(std::wstring const& queueFile, std::wstring const& siteManagerFile, std::wstring const& sitePath);
+	size_t Run();
+
+private:
+	enum class state
+	{
+		idle,
+		disconnecting,
+		connecting,
+		transferring
+	};
+
+	struct worker final
+	{
+		std::unique_ptr<CFileZillaEngine> engine;
+		size_t site{npos};
+		size_t job{npos};
+		state state_{state::idle};
+		fz::monotonic_clock lastProgress;
+	};
+
+	virtual void OnEngineEvent(CFileZillaEngine*) override
+	{
+		fz::scoped_lock l(mutex_);
+		signalled_ = true;
+		cond_.signal(l);
+	}
+
+	size_t NextJob(size_t site) const;
+	void Dispatch(worker & w);
+	void Connect(worker & w);
+	void StartTransfer(worker & w);
+	void OnReply(worker & w, int reply);
+	void Finish(worker & w, int reply);
+
+	void ProcessNotifications(worker & w);
+	void OnAsyncRequest(worker & w, std::unique_ptr<CAsyncRequestNotification> && request);
+
+	CHeadlessOptions options_;
+	CHeadlessEncodingConverter converter_;
+	CFileZillaEngineContext context_;
+
+	std::vector<worker> workers_;
+	std::vector<site> sites_;
+	std::vector<job> jobs_;
+	std::vector<bool> failedSites_;
+
+	size_t done_{};
+	size_t failed_{};
+	int64_t bytes_{};
+
+	bool const trust_;
+	bool const verbose_;
+	CFileExistsNotification::OverwriteAction const overwriteAction_;
+
+	fz::mutex mutex_;
+	fz::condition cond_;
+	bool signalled_{};
+};
+
+bool batch::Load(std::wstring const& queueFile, std::wstring const& siteManagerFile, std::wstring const& sitePath)
+{
+	std::wstring error;
+
+	site override;
+	if (!siteManagerFile.empty()) {
+		pugi::xml_document document;
+		if (!document.load_file(fz::to_native(siteManagerFile).c_str())) {
+			fprintf(stderr, "Could not load %s\n", fz::to_string(siteManagerFile).c_str());
+			return false;
+		}
+		auto node = find_site(document.child("FileZilla3").child("Servers"), sitePath);
+		if (!node) {
+			fprintf(stderr, "Site %s not found\n", fz::to_string(sitePath).c_str());
+			return false;
+		}
+		if (!load_site(node, override, error)) {
+			fprintf(stderr, "Site %s: %s\n", fz::to_string(sitePath).c_str(), fz::to_string(error).c_str());
+			return false;
+		}
+	}
+
+	pugi::xml_document document;
+	if (!document.load_file(fz::to_native(queueFile).c_str())) {
+		fprintf(stderr, "Could not load %s\n", fz::to_string(queueFile).c_str());
+		return false;
+	}
+
+	auto queue = document.child("FileZilla3").child("Queue");
+	for (auto server = queue.child("Server"); server; server = server.next_sibling("Server")) {
+		site s;
+		if (!siteManagerFile.empty()) {
+			s = override;
+		}
+		else if (!load_site(server, s, error)) {
+			fprintf(stderr, "Skipping server %s: %s\n", fz::to_string(GetTextElement(server, "Host")).c_str(), fz::to_string(error).c_str());
+			continue;
+		}
+
+		size_t const index = sites_.size();
+		bool used{};
+		for (auto file = server.child("File"); file; file = file.next_sibling("File")) {
+			job j;
+			j.site = index;
+			j.localFile = GetTextElement(file, "LocalFile");
+			j.remoteFile = GetTextElement(file, "RemoteFile");
+			if (j.localFile.empty() || j.remoteFile.empty() || !j.remotePath.SetSafePath(GetTextElement(file, "RemotePath"))) {
+				fprintf(stderr, "Skipping invalid queue item\n");
+				continue;
+			}
+			j.download = GetTextElementBool(file, "Download");
+			j.ascii = GetTextElementInt(file, "DataType", 1) == 0;
+
+			int const action = GetTextElementInt(file, "OverwriteAction", -1);
+			if (action > CFileExistsNotification::ask && action < CFileExistsNotification::rename) {
+				j.overwriteAction = static_cast<CFileExistsNotification::OverwriteAction>(action);
+			}
+
+			jobs_.push_back(std::move(j));
+			used = true;
+		}
+		if (used) {
+			sites_.push_back(std::move(s));
+		}
+	}
+	failedSites_.resize(sites_.size());
+
+	if (jobs_.empty()) {
+		fprintf(stderr, "Nothing to transfer in %s\n", fz::to_string(queueFile).c_str());
+		return false;
+	}
+	return true;
+}
+
+size_t batch::Run()
+{
+	auto const start = fz::monotonic_clock::now();
+
+	while (done_ < jobs_.size()) {
+		for (auto & w : workers_) {
+			ProcessNotifications(w);
+			Dispatch(w);
+		}
+
+		fz::scoped_lock l(mutex_);
+		if (!signalled_) {
+			cond_.wait(l, fz::duration::from_seconds(1));
+		}
+		signalled_ = false;
+	}
+
+	for (auto & w : workers_) {
+		if (w.engine->IsConnected()) {
+			w.engine->Execute(CDisconnectCommand());
+		}
+	}
+
+	printf("{\"event\":\"summary\",\"files\":%zu,\"ok\":%zu,\"failed\":%zu,\"bytes\":%lld,\"ms\":%lld}\n",
+		jobs_.size(), jobs_.size() - failed_, failed_, static_cast<long long>(bytes_),
+		static_cast<long long>((fz::monotonic_clock::now() - start).get_milliseconds()));
+	fflush(stdout);
+
+	return failed_;
+}
+
+size_t batch::NextJob(size_t site) const
+{
+	// Prefer files on the server the engine is already connected to
+	size_t first = npos;
+	for (size_t i = 0; i < jobs_.size(); ++i) {
+		if (jobs_[i].started) {
+			continue;
+		}
+		if (jobs_[i].site == site) {
+			return i;
+		}
+		if (first == npos) {
+			first = i;
+		}
+	}
+	return first;
+}
+
+void batch::Dispatch(worker & w)
+{
+	while (w.state_ == state::idle) {
+		size_t const index = NextJob(w.site);
+		if (index == npos) {
+			return;
+		}
+
+		auto & j = jobs_[index];
+		j.started = true;
+		j.start = fz::monotonic_clock::now();
+		w.job = index;
+
+		printf("{\"event\":\"start\",\"id\":%zu,\"engine\":%zu,\"download\":%s,\"local\":%s,\"remote\":%s}\n",
+			index + 1, static_cast<size_t>(&w - workers_.data()), j.download ? "true" : "false",
+			json_string(j.localFile).c_str(), json_string(j.remotePath.FormatFilename(j.remoteFile)).c_str());
+		fflush(stdout);
+
+		if (failedSites_[j.site]) {
+			Finish(w, FZ_REPLY_CRITICALERROR);
+		}
+		else if (w.site == j.site && w.engine->IsConnected()) {
+			StartTransfer(w);
+		}
+		else if (w.engine->IsConnected()) {
+			w.state_ = state::disconnecting;
+			int const res = w.engine->Execute(CDisconnectCommand());
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				OnReply(w, res);
+			}
+		}
+		else {
+			Connect(w);
+		}
+	}
+}
+
+void batch::Connect(worker & w)
+{
+	auto const& s = sites_[jobs_[w.job].site];
+	w.site = npos;
+	w.state_ = state::connecting;
+	int const res = w.engine->Execute(CConnectCommand(s.server, ServerHandle(), s.credentials));
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		OnReply(w, res);
+	}
+}
+
+void batch::StartTransfer(worker & w)
+{
+	auto const& j = jobs_[w.job];
+
+	CFileTransferCommand::t_transferSettings settings;
+	settings.binary = !j.ascii;
+
+	w.state_ = state::transferring;
+	w.lastProgress = fz::monotonic_clock::now();
+	int const res = w.engine->Execute(CFileTransferCommand(j.localFile, j.remotePath, j.remoteFile, j.download, settings));
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		OnReply(w, res);
+	}
+}
+
+void batch::OnReply(worker & w, int reply)
+{
+	switch (w.state_) {
+	case state::disconnecting:
+		Connect(w);
+		break;
+	case state::connecting:
+		if (reply == FZ_REPLY_OK) {
+			w.site = jobs_[w.job].site;
+			StartTransfer(w);
+		}
+		else {
+			// No point in trying the other files of the server if the
+			// login got rejected.
+			if ((reply & FZ_REPLY_CRITICALERROR) == FZ_REPLY_CRITICALERROR || (reply & FZ_REPLY_PASSWORDFAILED)) {
+				failedSites_[jobs_[w.job].site] = true;
+			}
+			Finish(w, reply);
+		}
+		break;
+	case state::transferring:
+		if (reply & FZ_REPLY_DISCONNECTED) {
+			w.site = npos;
+		}
+		Finish(w, reply);
+		break;
+	default:
+		break;
+	}
+}
+
+void batch::Finish(worker & w, int reply)
+{
+	auto const& j = jobs_[w.job];
+
+	int64_t size{};
+	if (reply == FZ_REPLY_OK) {
+		size = fz::local_filesys::get_size(fz::to_native(j.localFile));
+		if (size > 0) {
+			bytes_ += size;
+		}
+	}
+	else {
+		++failed_;
+	}
+	++done_;
+
+	printf("{\"event\":\"done\",\"id\":%zu,\"result\":\"%s\",\"code\":%d,\"bytes\":%lld,\"ms\":%lld}\n",
+		w.job + 1, reply == FZ_REPLY_OK ? "ok" : "failed", reply, static_cast<long long>(std::max(size, int64_t())),
+		static_cast<long long>((fz::monotonic_clock::now() - j.start).get_milliseconds()));
+	fflush(stdout);
+
+	w.job = npos;
+	w.state_ = state::idle;
+}
+
+void batch::ProcessNotifications(worker & w)
+{
+	while (auto notification = w.engine->GetNextNotification()) {
+		switch (notification->GetID()) {
+		case nId_logmsg:
+			if (verbose_) {
+				auto const& msg = static_cast<CLogmsgNotification const&>(*notification);
+				fprintf(stderr, "%u: %s\n", w.engine->GetEngineId(), fz::to_string(msg.msg).c_str());
+			}
+			break;
+		case nId_operation:
+			OnReply(w, static_cast<COperationNotification const&>(*notification).nReplyCode);
+			break;
+		case nId_asyncrequest:
+			OnAsyncRequest(w, std::unique_ptr<CAsyncRequestNotification>(static_cast<CAsyncRequestNotification*>(notification.release())));
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (w.state_ == state::transferring) {
+		auto const now = fz::monotonic_clock::now();
+		if ((now - w.lastProgress).get_seconds() >= 1) {
+			w.lastProgress = now;
+			bool changed{};
+			CTransferStatus const status = w.engine->GetTransferStatus(changed);
+			if (changed && !status.empty()) {
+				printf("{\"event\":\"progress\",\"id\":%zu,\"bytes\":%lld,\"total\":%lld}\n",
+					w.job + 1, static_cast<long long>(status.currentOffset), static_cast<long long>(status.totalSize));
+				fflush(stdout);
+			}
+		}
+	}
+}
+
+void batch::OnAsyncRequest(worker & w, std::unique_ptr<CAsyncRequestNotification> && request)
+{
+	switch (request->GetRequestID()) {
+	case reqId_fileexists:
+		{
+			auto & r = static_cast<CFileExistsNotification&>(*request);
+			r.overwriteAction = overwriteAction_;
+			if (w.job != npos && jobs_[w.job].overwriteAction != CFileExistsNotification::unknown) {
+				r.overwriteAction = jobs_[w.job].overwriteAction;
+			}
+		}
+		break;
+	case reqId_interactiveLogin:
+		// Nobody to ask, the login fails.
+		static_cast<CInteractiveLoginNotification&>(*request).passwordSet = false;
+		break;
+	case reqId_hostkey:
+	case reqId_hostkeyChanged:
+		{
+			auto & r = static_cast<CHostKeyNotification&>(*request);
+			r.m_trust = trust_;
+			if (!trust_) {
+				fprintf(stderr, "Rejecting %s host key of %s:%d, fingerprint %s\n", request->GetRequestID() == reqId_hostkey ? "unknown" : "changed",
+					fz::to_string(r.GetHost()).c_str(), r.GetPort(), fz::to_string(r.hostKeyFingerprintSHA256).c_str());
+			}
+		}
+		break;
+	case reqId_certificate:
+		{
+			auto & r = static_cast<CCertificateNotification&>(*request);
+			r.trusted_ = trust_ || (r.info_.system_trust() && !r.info_.mismatched_hostname());
+			if (!r.trusted_) {
+				fprintf(stderr, "Rejecting untrusted certificate of %s:%u\n", fz::to_string(r.info_.get_host()).c_str(), r.info_.get_port());
+			}
+		}
+		break;
+	case reqId_insecure_connection:
+		static_cast<CInsecureConnectionNotification&>(*request).allow_ = trust_;
+		break;
+	default:
+		break;
+	}
+
+	w.engine->SetAsyncRequestReply(std::move(request));
+}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t engines = 2;
+	bool trust{};
+	bool verbose{};
+	auto overwriteAction = CFileExistsNotification::overwrite;
+	std::wstring queueFile;
+	std::wstring siteManagerFile;
+	std::wstring sitePath;
+
+	bool usage{};
+	for (int i = 1; i < argc && !usage; ++i) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			engines = fz::to_integral<size_t>(std::string_view(argv[++i]));
+			usage = engines < 1 || engines > 10;
+		}
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			std::string_view const action = argv[++i];
+			if (action == "overwrite") {
+				overwriteAction = CFileExistsNotification::overwrite;
+			}
+			else if (action == "newer") {
+				overwriteAction = CFileExistsNotification::overwriteNewer;
+			}
+			else if (action == "size") {
+				overwriteAction = CFileExistsNotification::overwriteSize;
+			}
+			else if (action == "resume") {
+				overwriteAction = CFileExistsNotification::resume;
+			}
+			else if (action == "skip") {
+				overwriteAction = CFileExistsNotification::skip;
+			}
+			else {
+				usage = true;
+			}
+		}
+		else if (!strcmp(argv[i], "-t")) {
+			trust = true;
+		}
+		else if (!strcmp(argv[i], "-v")) {
+			verbose = true;
+		}
+		else if (!strcmp(argv[i], "-s") && i + 2 < argc) {
+			siteManagerFile = fz::to_wstring(argv[++i]);
+			sitePath = fz::to_wstring(argv[++i]);
+		}
+		else if (argv[i][0] != '-' && queueFile.empty()) {
+			queueFile = fz::to_wstring(argv[i]);
+		}
+		else {
+			usage = true;
+		}
+	}
+	if (usage || queueFile.empty()) {
+		fprintf(stderr, "Usage: %s [-n engines] [-o overwrite|newer|size|resume|skip] [-t] [-v] [-s sitemanager.xml site] queue.xml\n", argv[0]);
+		return 1;
+	}
+
+	batch b(engines, trust, verbose, overwriteAction);
+	if (!b.Load(queueFile, siteManagerFile, sitePath)) {
+		return 1;
+	}
+	return b.Run() ? 2 : 0;
+}
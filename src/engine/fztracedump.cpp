@@ -0,0 +1,245 @@
+// Reads trace files written by CTraceLog, see trace_log.h for the format.
+//
+// Usage: fztracedump [-s] tracefile
+//   Without -s, prints a timeline of all events.
+//   With -s, prints latency histograms for operations, command replies
+//   and lock waits, as well as cache and transfer totals.
+//
+// Deliberately only depends on the standard library so it can be built
+// anywhere the trace files end up.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct record
+{
+	uint64_t time{}; // microseconds
+	uint32_t engine{};
+	uint32_t operation{};
+	uint16_t type{};
+	int64_t value{};
+};
+
+uint64_t read_le(unsigned char const* p, size_t bytes)
+{
+	uint64_t v{};
+	for (size_t i = 0; i < bytes; ++i) {
+		v |= static_cast<uint64_t>(p[i]) << (i * 8);
+	}
+	return v;
+}
+
+char const* event_name(uint16_t type)
+{
+	switch (type) {
+	case 1:
+		return "command_start";
+	case 2:
+		return "command_end";
+	case 3:
+		return "command_sent";
+	case 4:
+		return "reply_received";
+	case 5:
+		return "bytes_transferred";
+	case 6:
+		return "lock_wait";
+	case 7:
+		return "lock_acquired";
+	case 8:
+		return "cache_hit";
+	case 9:
+		return "cache_miss";
+	case 10:
+		return "connected";
+	default:
+		return "unknown";
+	}
+}
+
+// Power-of-two buckets in microseconds
+class histogram final
+{
+public:
+	void add(uint64_t us)
+	{
+		size_t bucket = 0;
+		while (bucket + 1 < buckets_.size() && (uint64_t(1) << bucket) <= us) {
+			++bucket;
+		}
+		++buckets_[bucket];
+		++count_;
+		sum_ += us;
+		if (us > max_) {
+			max_ = us;
+		}
+	}
+
+	void print(char const* title) const
+	{
+		std::printf("%s: %llu samples", title, static_cast<unsigned long long>(count_));
+		if (!count_) {
+			std::printf("\n\n");
+			return;
+		}
+		std::printf(", avg %.3f ms, max %.3f ms\n", sum_ / 1000.0 / count_, max_ / 1000.0);
+
+		uint64_t largest{};
+		for (auto const& b : buckets_) {
+			if (b > largest) {
+				largest = b;
+			}
+		}
+		for (size_t i = 0; i < buckets_.size(); ++i) {
+			if (!buckets_[i]) {
+				continue;
+			}
+			uint64_t const upper = uint64_t(1) << i;
+			std::string const bar(static_cast<size_t>((buckets_[i] * 50 + largest - 1) / largest), '#');
+			std::printf("  < %12.3f ms %10llu %s\n", upper / 1000.0, static_cast<unsigned long long>(buckets_[i]), bar.c_str());
+		}
+		std::printf("\n");
+	}
+
+private:
+	std::vector<uint64_t> buckets_ = std::vector<uint64_t>(40);
+	uint64_t count_{};
+	uint64_t max_{};
+	double sum_{};
+};
+
+void print_timeline(std::vector<record> const& records)
+{
+	for (auto const& r : records) {
+		std::printf("%14.3f %6u %8u %-18s %lld\n", r.time / 1000.0, r.engine, r.operation, event_name(r.type), static_cast<long long>(r.value));
+	}
+}
+
+void print_summary(std::vector<record> const& records)
+{
+	histogram operations;
+	histogram replies;
+	histogram locks;
+
+	std::map<std::pair<uint32_t, uint32_t>, uint64_t> operation_start;
+	std::map<uint32_t, std::vector<uint64_t>> commands_sent; // Per engine, FTP can pipeline
+	std::map<uint32_t, uint64_t> lock_wait;
+
+	uint64_t cache_hits{};
+	uint64_t cache_misses{};
+	int64_t bytes{};
+
+	for (auto const& r : records) {
+		switch (r.type) {
+		case 1:
+			operation_start[{r.engine, r.operation}] = r.time;
+			break;
+		case 2: {
+			auto it = operation_start.find({r.engine, r.operation});
+			if (it != operation_start.end()) {
+				operations.add(r.time - it->second);
+				operation_start.erase(it);
+			}
+			break;
+		}
+		case 3:
+			commands_sent[r.engine].push_back(r.time);
+			break;
+		case 4: {
+			auto & sent = commands_sent[r.engine];
+			// Preliminary FTP replies do not complete a command
+			if (!sent.empty() && (r.value < 100 || r.value >= 200)) {
+				replies.add(r.time - sent.front());
+				sent.erase(sent.begin());
+			}
+			break;
+		}
+		case 5:
+			bytes += r.value;
+			break;
+		case 6:
+			lock_wait[r.engine] = r.time;
+			break;
+		case 7: {
+			auto it = lock_wait.find(r.engine);
+			if (it != lock_wait.end()) {
+				locks.add(r.time - it->second);
+				lock_wait.erase(it);
+			}
+			break;
+		}
+		case 8:
+			++cache_hits;
+			break;
+		case 9:
+			++cache_misses;
+			break;
+		}
+	}
+
+	operations.print("Operation duration");
+	replies.print("Command reply latency");
+	locks.print("Lock wait");
+
+	std::printf("Directory cache: %llu hits, %llu misses\n", static_cast<unsigned long long>(cache_hits), static_cast<unsigned long long>(cache_misses));
+	std::printf("Bytes transferred: %lld\n", static_cast<long long>(bytes));
+	if (!records.empty()) {
+		std::printf("Trace duration: %.3f s\n", records.back().time / 1000000.0);
+	}
+}
+}
+
+int main(int argc, char* argv[])
+{
+	bool summary = false;
+	char const* file = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-s")) {
+			summary = true;
+		}
+		else {
+			file = argv[i];
+		}
+	}
+	if (!file) {
+		std::fprintf(stderr, "Usage: %s [-s] tracefile\n", argv[0]);
+		return 1;
+	}
+
+	std::ifstream in(file, std::ios::binary);
+	unsigned char header[16];
+	if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, "FZTRACE1", 8)) {
+		std::fprintf(stderr, "%s is not a trace file\n", file);
+		return 1;
+	}
+	std::printf("Trace started at %llu ms since the epoch\n", static_cast<unsigned long long>(read_le(header + 8, 8)));
+
+	std::vector<record> records;
+	unsigned char buf[32];
+	while (in.read(reinterpret_cast<char*>(buf), sizeof(buf))) {
+		record r;
+		r.time = read_le(buf, 8);
+		r.engine = static_cast<uint32_t>(read_le(buf + 8, 4));
+		r.operation = static_cast<uint32_t>(read_le(buf + 12, 4));
+		r.type = static_cast<uint16_t>(read_le(buf + 16, 2));
+		r.value = static_cast<int64_t>(read_le(buf + 24, 8));
+		records.push_back(r);
+	}
+
+	if (summary) {
+		print_summary(records);
+	}
+	else {
+		print_timeline(records);
+	}
+
+	return 0;
+}
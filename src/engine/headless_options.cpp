@@ -0,0 +1,154 @@
+#include <filezilla.h>
+
+#include "headless_options.h"
+
+#include <stdlib.h>
+
+namespace {
+// Same defaults as the interface, see interface/Options.cpp
+wchar_t const* const defaults[] = {
+	L"1", // Use Pasv mode
+	L"0", // Limit local ports
+	L"6000", // Limit ports low
+	L"7000", // Limit ports high
+	L"0", // Limit ports offset
+	L"0", // External IP mode
+	L"", // External IP
+	L"http://ip.filezilla-project.org/ip.php", // External address resolver
+	L"", // Last resolved IP
+	L"1", // No external ip on local conn
+	L"0", // Pasv reply fallback mode
+	L"20", // Timeout
+	L"0", // Logging Debug Level
+	L"0", // Logging Raw Listing
+	L"", // fzsftp executable
+	L"", // fzstorj executable
+	L"1", // Allow transfermode fallback
+	L"2", // Reconnect count
+	L"5", // Reconnect delay
+	L"0", // Enable speed limits
+	L"1000", // Speedlimit inbound
+	L"100", // Speedlimit outbound
+	L"0", // Speedlimit burst tolerance
+	L"0", // Preallocate space
+	L"0", // View hidden files
+	L"0", // Preserve timestamps
+	L"4194304", // Socket recv buffer size (v2)
+	L"262144", // Socket send buffer size (v2)
+	L"0", // FTP Keep-alive commands
+	L"0", // FTP Proxy type
+	L"", // FTP Proxy host
+	L"", // FTP Proxy user
+	L"", // FTP Proxy password
+	L"", // FTP Proxy login sequence
+	L"", // SFTP keyfiles
+	L"", // SFTP compression
+	L"64", // SFTP max window
+	L"32", // SFTP max list window
+	L"0", // SFTP connection sharing
+	L"4", // Storj chunk size
+	L"0", // Proxy type
+	L"", // Proxy host
+	L"0", // Proxy port
+	L"", // Proxy user
+	L"", // Proxy password
+	L"", // Logging file
+	L"10", // Logging filesize limit
+	L"0", // Logging show detailed logs
+	L"", // Logging trace file
+	L"0", // Size format
+	L"1", // Size thousands separator
+	L"1", // Size decimal places
+	L"15", // TCP Keepalive Interval
+	L"600", // Cache TTL
+	L"256", // Cache memory budget
+	L"0", // Persistent directory cache
+	L"", // Persistent directory cache dir
+	L"256", // IO buffer size
+	L"8", // IO buffer count
+	L"1", // HTTP keep-alive
+	L"0", // HTTP pipelining
+	L"1", // Engine event loops
+	L"0", // Engine CPU affinity
+	L"604800", // Capability cache TTL
+	L"0", // Active mode pre-listen
+	L"0", // FTP prepare passive
+	L"0", // Shared directory cache
+	L"0", // Socket buffer autotuning
+	L"", // TCP congestion control
+	L"", // Speedlimit schedule
+	L"", // Source addresses
+	L"2", // SFTP process pool
+	L"0", // Sparse downloads
+	L"0", // Download sync interval
+	L"0", // SFTP archive uploads
+};
+static_assert(sizeof(defaults) / sizeof(*defaults) == OPTIONS_ENGINE_NUM, "Engine option without default");
+}
+
+CHeadlessOptions::CHeadlessOptions()
+{
+	for (auto const& v : defaults) {
+		values_.emplace_back(v);
+	}
+
+	char const* env = getenv("FZ_FZSFTP");
+	if (env && *env) {
+		values_[OPTION_FZSFTP_EXECUTABLE] = fz::to_wstring(env);
+	}
+	env = getenv("FZ_FZSTORJ");
+	if (env && *env) {
+		values_[OPTION_FZSTORJ_EXECUTABLE] = fz::to_wstring(env);
+	}
+
+	for (size_t i = 0; i < values_.size(); ++i) {
+		numbers_[i] = fz::to_integral<int>(values_[i]);
+	}
+}
+
+int CHeadlessOptions::GetOptionVal(unsigned int nID)
+{
+	return nID < OPTIONS_ENGINE_NUM ? numbers_[nID].load(std::memory_order_relaxed) : 0;
+}
+
+std::wstring CHeadlessOptions::GetOption(unsigned int nID)
+{
+	fz::scoped_lock l(mutex_);
+	return nID < values_.size() ? values_[nID] : std::wstring();
+}
+
+pugi::xml_document CHeadlessOptions::GetOptionXml(unsigned int)
+{
+	return pugi::xml_document();
+}
+
+bool CHeadlessOptions::SetOption(unsigned int nID, int value)
+{
+	return SetOption(nID, fz::to_wstring(value));
+}
+
+bool CHeadlessOptions::SetOption(unsigned int nID, std::wstring_view const& value)
+{
+	fz::scoped_lock l(mutex_);
+	if (nID >= values_.size()) {
+		return false;
+	}
+	values_[nID] = value;
+	numbers_[nID] = fz::to_integral<int>(value);
+	return true;
+}
+
+bool CHeadlessOptions::SetOptionXml(unsigned int, pugi::xml_node const&)
+{
+	return false;
+}
+
+std::wstring CHeadlessEncodingConverter::toLocal(std::wstring const&, char const* buffer, size_t len) const
+{
+	return fz::to_wstring(std::string(buffer, len));
+}
+
+std::string CHeadlessEncodingConverter::toServer(std::wstring const&, wchar_t const* buffer, size_t len) const
+{
+	return fz::to_string(std::wstring(buffer, len));
+}
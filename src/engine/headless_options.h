@@ -0,0 +1,48 @@
+#ifndef FILEZILLA_ENGINE_HEADLESS_OPTIONS_HEADER
+#define FILEZILLA_ENGINE_HEADLESS_OPTIONS_HEADER
+
+#include "engine_context.h"
+
+#include <libfilezilla/mutex.hpp>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Options for running engines without the interface, e.g. in fzbatch and the
+// transfer benchmark. Starts out with the same defaults as the interface,
+// nothing gets persisted.
+//
+// The fzsftp and fzstorj executables are taken from the FZ_FZSFTP and
+// FZ_FZSTORJ environment variables, like the interface does.
+class CHeadlessOptions final : public COptionsBase
+{
+public:
+	CHeadlessOptions();
+
+	virtual int GetOptionVal(unsigned int nID) override;
+	virtual std::wstring GetOption(unsigned int nID) override;
+	virtual pugi::xml_document GetOptionXml(unsigned int nID) override;
+
+	virtual bool SetOption(unsigned int nID, int value) override;
+	virtual bool SetOption(unsigned int nID, std::wstring_view const& value) override;
+	virtual bool SetOptionXml(unsigned int nID, pugi::xml_node const& value) override;
+
+private:
+	fz::mutex mutex_;
+	std::vector<std::wstring> values_;
+
+	// Parsed values, read without taking the mutex
+	std::atomic<int> numbers_[OPTIONS_ENGINE_NUM]{};
+};
+
+// Custom charsets require iconv which the interface brings along, falls
+// back to the locale.
+class CHeadlessEncodingConverter final : public CustomEncodingConverterBase
+{
+public:
+	virtual std::wstring toLocal(std::wstring const& encoding, char const* buffer, size_t len) const override;
+	virtual std::string toServer(std::wstring const& encoding, wchar_t const* buffer, size_t len) const override;
+};
+
+#endif
@@ -1,12 +1,43 @@
 #include <filezilla.h>
 
 #include "filetransfer.h"
+#include "resume_journal.h"
 
 #include <libfilezilla/local_filesys.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 #include <string.h>
 
+namespace {
+// Connections dropped by overloaded servers and CDNs are resumed this often
+int const max_resumes = 5;
+
+// How often segments update the resume journal
+fz::duration const journal_interval = fz::duration::from_seconds(2);
+
+// Parses the "bytes first-last/complete" Content-Range of a partial response
+bool ParseContentRange(std::string const& value, int64_t & first, int64_t & last)
+{
+	std::string_view v = value;
+	if (v.substr(0, 6) != "bytes ") {
+		return false;
+	}
+	v.remove_prefix(6);
+
+	size_t const dash = v.find('-');
+	size_t const slash = v.find('/');
+	if (dash == std::string_view::npos || slash == std::string_view::npos || slash < dash) {
+		return false;
+	}
+
+	first = fz::to_integral<int64_t>(v.substr(0, dash), -1);
+	last = fz::to_integral<int64_t>(v.substr(dash + 1, slash - dash - 1), -1);
+	return first >= 0 && last >= first;
+}
+}
+
 enum filetransferStates
 {
 	filetransfer_init = 0,
@@ -33,6 +64,11 @@ CHttpFileTransferOpData::CHttpFileTransferOpData(CHttpControlSocket & controlSoc
 	rr_.request_.verb_ = verb;
 }
 
+CHttpFileTransferOpData::~CHttpFileTransferOpData()
+{
+	UpdateJournal();
+}
+
 
 int CHttpFileTransferOpData::Send()
 {
@@ -67,13 +103,17 @@ int CHttpFileTransferOpData::Send()
 		opState = filetransfer_transfer;
 		return FZ_REPLY_CONTINUE;
 	case filetransfer_transfer:
-		if (resume_) {
+		if (transferSettings_.segmentOffset >= 0) {
+			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-%d", transferSettings_.segmentOffset, transferSettings_.segmentOffset + transferSettings_.segmentSize - 1);
+		}
+		else if (resume_) {
 			rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-", localFileSize_);
 		}
 
 		rr_.response_ = HttpResponse();
 		rr_.response_.on_header_ = [this](auto const&) { return this->OnHeader(); };
 		rr_.response_.on_data_ = [this](auto data, auto len) { return this->OnData(data, len); };
+		rr_.response_.on_resume_ = [this]() { return this->OnResume(); };
 
 		opState = filetransfer_waittransfer;
 		controlSocket_.Request(make_simple_rr(&rr_));
@@ -106,6 +146,17 @@ int CHttpFileTransferOpData::OpenFile()
 	}
 
 	assert(download_);
+	if (transferSettings_.segmentOffset >= 0) {
+		// The queue has already created the local file at its full size
+		if (file_.seek(transferSettings_.segmentOffset, fz::file::begin) != transferSettings_.segmentOffset) {
+			log(logmsg::error, _("Could not seek to offset %d within file"), transferSettings_.segmentOffset);
+			return FZ_REPLY_ERROR;
+		}
+		resume_ = false;
+		localFileSize_ = fz::local_filesys::get_size(fz::to_native(localFile_));
+		return FZ_REPLY_OK;
+	}
+
 	int64_t end = file_.seek(0, fz::file::end);
 	if (end < 0) {
 		log(logmsg::error, _("Could not seek to the end of the file"));
@@ -180,6 +231,25 @@ int CHttpFileTransferOpData::OnHeader()
 		return FZ_REPLY_OK;
 	}
 
+	if ((transferSettings_.segmentOffset >= 0 || resuming_) && rr_.response_.code_ != 206) {
+		log(logmsg::error, _("Server does not support downloading parts of a file"));
+		return FZ_REPLY_ERROR;
+	}
+
+	if (rr_.response_.code_ == 206 && file_.opened()) {
+		// Nothing of this response has been written yet, the part has to
+		// start where the file is positioned and, for a segment, end with it.
+		int64_t const start = file_.seek(0, fz::file::current);
+		int64_t first{};
+		int64_t last{};
+		if (!ParseContentRange(rr_.response_.get_header("Content-Range"), first, last) || first != start ||
+			(transferSettings_.segmentOffset >= 0 && last != transferSettings_.segmentOffset + transferSettings_.segmentSize - 1))
+		{
+			log(logmsg::error, _("Server sent a different part of the file than requested"));
+			return FZ_REPLY_ERROR;
+		}
+	}
+
 	// Check if the server disallowed resume
 	if (resume_ && rr_.response_.code_ != 206) {
 		assert(file_.opened());
@@ -224,6 +294,18 @@ int CHttpFileTransferOpData::OnData(unsigned char const* data, unsigned int len)
 			log(logmsg::error, _("Failed to write to file %s"), localFile_);
 			return FZ_REPLY_ERROR;
 		}
+		received_ += write;
+
+		if (transferSettings_.segmentOffset >= 0) {
+			auto const now = fz::monotonic_clock::now();
+			if (journalTime_.empty()) {
+				journalTime_ = now;
+			}
+			else if (now - journalTime_ >= journal_interval) {
+				journalTime_ = now;
+				UpdateJournal();
+			}
+		}
 	}
 
 	engine_.transfer_status_.Update(len);
@@ -231,6 +313,50 @@ int CHttpFileTransferOpData::OnData(unsigned char const* data, unsigned int len)
 	return FZ_REPLY_CONTINUE;
 }
 
+bool CHttpFileTransferOpData::OnResume()
+{
+	// Give up if the server keeps dropping the connection before sending anything
+	if (localFile_.empty() || !received_ || resumeCount_ >= max_resumes) {
+		return false;
+	}
+
+	if (rr_.response_.code_ != 206 && fz::str_tolower_ascii(rr_.response_.get_header("Accept-Ranges")) != "bytes") {
+		return false;
+	}
+
+	// Everything received has been written, continue right where the file ends
+	int64_t const offset = file_.seek(0, fz::file::current);
+	if (offset < 0) {
+		return false;
+	}
+
+	if (transferSettings_.segmentOffset >= 0) {
+		rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-%d", offset, transferSettings_.segmentOffset + transferSettings_.segmentSize - 1);
+	}
+	else {
+		rr_.request_.headers_["Range"] = fz::sprintf("bytes=%d-", offset);
+	}
+
+	++resumeCount_;
+	resuming_ = true;
+	received_ = 0;
+	return true;
+}
+
+void CHttpFileTransferOpData::UpdateJournal()
+{
+	if (!file_.opened() || transferSettings_.segmentOffset < 0) {
+		return;
+	}
+
+	int64_t const pos = file_.seek(0, fz::file::current);
+	int64_t const written = std::min(pos - transferSettings_.segmentOffset, transferSettings_.segmentSize);
+	if (written > journalWritten_) {
+		journalWritten_ = written;
+		CResumeJournal::AddRange(localFile_, localFileSize_, transferSettings_.segmentOffset, transferSettings_.segmentOffset + written);
+	}
+}
+
 int CHttpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 {
 	if (opState == filetransfer_transfer) {
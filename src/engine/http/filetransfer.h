@@ -12,6 +12,7 @@ class CHttpFileTransferOpData final : public CFileTransferOpData, public CHttpOp
 public:
 	CHttpFileTransferOpData(CHttpControlSocket & controlSocket, bool is_download, std::wstring const& local_file, std::wstring const& remote_file, CServerPath const& remote_path, CFileTransferCommand::t_transferSettings const& settings);
 	CHttpFileTransferOpData(CHttpControlSocket & controlSocket, fz::uri const& uri, std::string const& verb, std::string const& body);
+	virtual ~CHttpFileTransferOpData();
 
 	virtual int Send() override;
 	virtual int ParseResponse() override { return FZ_REPLY_INTERNALERROR; }
@@ -23,10 +24,25 @@ private:
 	int OnHeader();
 	int OnData(unsigned char const* data, unsigned int len);
 
+	// Asks for the remainder of the range after the connection got lost
+	bool OnResume();
+
+	// Segments record how far they got in the resume journal of the file
+	void UpdateJournal();
+
 	HttpRequestResponse rr_;
 	fz::file file_;
 
 	int redirectCount_{};
+
+	int resumeCount_{};
+	bool resuming_{};
+
+	// Received since the last resume
+	int64_t received_{};
+
+	int64_t journalWritten_{};
+	fz::monotonic_clock journalTime_;
 };
 
 #endif
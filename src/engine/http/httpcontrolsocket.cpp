@@ -2,21 +2,33 @@
 
 #include "connect.h"
 #include "controlsocket.h"
+#include "dns_cache.h"
 #include "engineprivate.h"
 #include "filetransfer.h"
 #include "httpcontrolsocket.h"
 #include "internalconnect.h"
+#include "iothread.h"
+#include "proxy.h"
 #include "request.h"
+#include "tls_session_cache.h"
 
 #include <libfilezilla/file.hpp>
 #include <libfilezilla/iputils.hpp>
 #include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/rate_limited_layer.hpp>
 #include <libfilezilla/tls_layer.hpp>
 #include <libfilezilla/uri.hpp>
 
 #include <assert.h>
 #include <string.h>
 
+namespace {
+size_t const max_pooled_connections = 4;
+
+// Most servers close idle connections after somewhere between 5 and 60 seconds
+fz::duration const max_pooled_idle = fz::duration::from_seconds(15);
+}
+
 int simple_body::data_request(unsigned char* data, unsigned int & len)
 {
 	len = static_cast<unsigned int>(std::min(static_cast<size_t>(len), body_.size() - written_));
@@ -84,6 +96,132 @@ int file_body::rewind()
 }
 
 
+iothread_body::iothread_body(CFileZillaEnginePrivate & engine, fz::event_handler & handler, std::wstring const& file, uint64_t start, uint64_t size)
+	: engine_(engine)
+	, handler_(handler)
+	, file_(file)
+	, start_(start)
+	, size_(size)
+{
+}
+
+iothread_body::~iothread_body()
+{
+	Stop();
+}
+
+void iothread_body::Stop()
+{
+	if (ioThread_) {
+		ioThread_->SetEventHandler(nullptr);
+		ioThread_.reset();
+	}
+	buffer_ = nullptr;
+	bufferLen_ = 0;
+}
+
+int iothread_body::Start()
+{
+	auto file = std::make_unique<fz::file>();
+	if (!file->open(fz::to_native(file_), fz::file::reading, fz::file::existing)) {
+		engine_.GetLogger().log(logmsg::error, _("Failed to open \"%s\" for reading"), file_);
+		return FZ_REPLY_ERROR;
+	}
+
+	int64_t s = static_cast<int64_t>(start_);
+	if (file->seek(s, fz::file::begin) != s) {
+		if (!start_) {
+			engine_.GetLogger().log(logmsg::error, _("Could not seek to the beginning of the file"));
+		}
+		else {
+			engine_.GetLogger().log(logmsg::error, _("Could not seek to offset %d within file"), start_);
+		}
+		return FZ_REPLY_ERROR;
+	}
+
+	// Small files do not need the full ring
+	int const bufferSize = engine_.GetOptions().GetOptionVal(OPTION_IOTHREAD_BUFFERSIZE) * 1024;
+	int bufferCount = engine_.GetOptions().GetOptionVal(OPTION_IOTHREAD_BUFFERCOUNT);
+	if (bufferSize > 0) {
+		bufferCount = static_cast<int>(std::min(static_cast<uint64_t>(bufferCount), size_ / bufferSize + 2));
+	}
+
+	ioThread_ = std::make_unique<CIOThread>(bufferCount, bufferSize);
+	ioThread_->SetEventHandler(&handler_);
+	if (!ioThread_->Create(engine_.GetThreadPool(), std::move(file), true, true)) {
+		ioThread_.reset();
+		engine_.GetLogger().log(logmsg::error, _("Could not spawn IO thread"));
+		return FZ_REPLY_ERROR;
+	}
+
+	return FZ_REPLY_CONTINUE;
+}
+
+int iothread_body::data_request(unsigned char* data, unsigned int & len)
+{
+	assert(size_ >= written_);
+	assert(len > 0);
+	len = static_cast<unsigned int>(std::min(static_cast<uint64_t>(len), size_ - written_));
+	if (!len) {
+		return FZ_REPLY_CONTINUE;
+	}
+
+	if (!ioThread_) {
+		int res = Start();
+		if (res != FZ_REPLY_CONTINUE) {
+			len = 0;
+			return res;
+		}
+	}
+
+	if (!bufferLen_) {
+		int res = ioThread_->GetNextReadBuffer(&buffer_);
+		if (res == IO_Again) {
+			len = 0;
+			return FZ_REPLY_WOULDBLOCK;
+		}
+		else if (res == IO_Error) {
+			len = 0;
+			engine_.GetLogger().log(logmsg::error, _("Reading from local file failed"));
+			return FZ_REPLY_ERROR;
+		}
+		else if (res == IO_Success) {
+			// File got shorter than announced in Content-Length
+			len = 0;
+			return FZ_REPLY_ERROR;
+		}
+		bufferLen_ = static_cast<unsigned int>(res);
+	}
+
+	len = std::min(len, bufferLen_);
+	memcpy(data, buffer_, len);
+	buffer_ += len;
+	bufferLen_ -= len;
+
+	if (progress_callback_) {
+		progress_callback_(len);
+	}
+
+	written_ += len;
+	return FZ_REPLY_CONTINUE;
+}
+
+int iothread_body::rewind()
+{
+	if (progress_callback_) {
+		progress_callback_(-static_cast<int64_t>(written_));
+	}
+
+	// The ring only reads forward, start over if anything has been consumed
+	if (written_) {
+		written_ = 0;
+		Stop();
+	}
+
+	return FZ_REPLY_CONTINUE;
+}
+
+
 int HttpRequest::reset()
 {
 	flags_ = 0;
@@ -244,6 +382,21 @@ void CHttpControlSocket::OnReceive()
 	}
 }
 
+void CHttpControlSocket::operator()(fz::event_base const& ev)
+{
+	if (!fz::dispatch<CIOThreadEvent>(ev, this, &CHttpControlSocket::OnIOThreadEvent)) {
+		CRealControlSocket::operator()(ev);
+	}
+}
+
+void CHttpControlSocket::OnIOThreadEvent()
+{
+	// A request body has data available again
+	if (!operations_.empty() && operations_.back()->opId == PrivCommand::http_request && (operations_.back()->opState & request_send_mask)) {
+		SendNextCommand();
+	}
+}
+
 void CHttpControlSocket::OnConnect()
 {
 	if (operations_.empty() || operations_.back()->opId != PrivCommand::http_connect) {
@@ -262,12 +415,24 @@ void CHttpControlSocket::OnConnect()
 			tls_layer_ = std::make_unique<fz::tls_layer>(event_loop_, this, *active_layer_, &engine_.GetContext().GetTlsSystemTrustStore(), logger_);
 			active_layer_ = tls_layer_.get();
 
-			if (!tls_layer_->client_handshake(&data)) {
+			// Only HTTP/1.1 is spoken. Announcing it keeps servers that
+			// prefer HTTP/2 from guessing the protocol.
+			tls_layer_->set_alpn(std::string_view("http/1.1"));
+
+			auto const session = engine_.GetContext().GetTlsSessionCache().Get(connected_host_, connected_port_);
+			if (!tls_layer_->client_handshake(&data, session, tls_layer_->peer_host())) {
 				DoClose();
 			}
 		}
 		else {
 			log(logmsg::status, _("TLS connection established, sending HTTP request"));
+			std::string const alpn = tls_layer_->get_alpn();
+			if (!alpn.empty() && alpn != "http/1.1") {
+				log(logmsg::error, _("Server negotiated unsupported protocol %s"), alpn);
+				DoClose();
+				return;
+			}
+			engine_.GetContext().GetTlsSessionCache().Store(connected_host_, connected_port_, *tls_layer_);
 			ResetOperation(FZ_REPLY_OK);
 		}
 	}
@@ -339,6 +504,13 @@ int CHttpControlSocket::InternalConnect(std::wstring const& host, unsigned short
 		if (!allowDisconnect) {
 			return FZ_REPLY_WOULDBLOCK;
 		}
+
+		ParkConnection();
+	}
+
+	if (UnparkConnection(host, port, tls)) {
+		log(logmsg::debug_verbose, L"Reusing a pooled connection");
+		return FZ_REPLY_OK;
 	}
 
 	ResetSocket();
@@ -370,11 +542,113 @@ void CHttpControlSocket::ResetSocket()
 
 	active_layer_ = nullptr;
 
-	tls_layer_.reset();
+	if (tls_layer_) {
+		// With TLS 1.3 the session ticket arrives after the handshake
+		engine_.GetContext().GetTlsSessionCache().Store(connected_host_, connected_port_, *tls_layer_);
+		tls_layer_.reset();
+	}
+
+	completed_responses_ = 0;
 
 	CRealControlSocket::ResetSocket();
 }
 
+int CHttpControlSocket::DoClose(int nErrorCode)
+{
+	pool_.clear();
+	return CRealControlSocket::DoClose(nErrorCode);
+}
+
+void CHttpControlSocket::ParkConnection()
+{
+	if (!active_layer_ || send_buffer_ || (tls_layer_ && tls_layer_->get_state() != fz::socket_state::connected)) {
+		ResetSocket();
+		return;
+	}
+
+	if (pool_.size() >= max_pooled_connections) {
+		auto oldest = pool_.begin();
+		for (auto it = pool_.begin(); it != pool_.end(); ++it) {
+			if (it->idle_since_ < oldest->idle_since_) {
+				oldest = it;
+			}
+		}
+		pool_.erase(oldest);
+	}
+
+	log(logmsg::debug_verbose, L"Keeping connection to %s:%u for later use", connected_host_, connected_port_);
+
+	// Events of idle connections are of no interest, whether the connection
+	// is still usable is checked when taking it out of the pool.
+	active_layer_->set_event_handler(nullptr);
+
+	pooled_connection c;
+	c.host_ = connected_host_;
+	c.port_ = connected_port_;
+	c.tls_ = connected_tls_;
+	c.idle_since_ = fz::monotonic_clock::now();
+	c.rate_limiter_ = std::move(rate_limiter_);
+	c.socket_ = std::move(socket_);
+	c.ratelimit_layer_ = std::move(ratelimit_layer_);
+	c.cached_address_layer_ = std::move(cached_address_layer_);
+	c.proxy_layer_ = std::move(proxy_layer_);
+	c.tls_layer_ = std::move(tls_layer_);
+	c.active_layer_ = active_layer_;
+	pool_.push_back(std::move(c));
+
+	ResetSocket();
+}
+
+bool CHttpControlSocket::UnparkConnection(std::wstring const& host, unsigned short port, bool tls)
+{
+	auto const now = fz::monotonic_clock::now();
+	for (size_t i = 0; i < pool_.size(); ) {
+		auto & c = pool_[i];
+		if (now - c.idle_since_ >= max_pooled_idle) {
+			pool_.erase(pool_.begin() + i);
+			continue;
+		}
+		if (c.host_ != host || c.port_ != port || c.tls_ != tls) {
+			++i;
+			continue;
+		}
+
+		pooled_connection pooled = std::move(c);
+		pool_.erase(pool_.begin() + i);
+
+		// Nothing may be readable on an idle connection, else the server has
+		// closed it or sent something unexpected.
+		uint8_t buffer;
+		int error{};
+		int read = pooled.active_layer_->read(&buffer, 1, error);
+		if (read != -1 || error != EAGAIN) {
+			log(logmsg::debug_verbose, L"Pooled connection to %s:%u is no longer usable", host, port);
+			return false;
+		}
+
+		ResetSocket();
+		rate_limiter_ = std::move(pooled.rate_limiter_);
+		socket_ = std::move(pooled.socket_);
+		ratelimit_layer_ = std::move(pooled.ratelimit_layer_);
+		cached_address_layer_ = std::move(pooled.cached_address_layer_);
+		proxy_layer_ = std::move(pooled.proxy_layer_);
+		tls_layer_ = std::move(pooled.tls_layer_);
+		active_layer_ = pooled.active_layer_;
+		active_layer_->set_event_handler(this);
+
+		connected_host_ = host;
+		connected_port_ = port;
+		connected_tls_ = tls;
+
+		// It has been used before
+		completed_responses_ = 1;
+
+		return true;
+	}
+
+	return false;
+}
+
 int CHttpControlSocket::Disconnect()
 {
 	DoClose();
@@ -21,7 +21,9 @@ public:
 
 	// data_request must write up to len bytes into the provided buffer,
 	// and update len with the amount written.
-	// Must return FZ_REPLY_CONTINUE or FZ_REPLY_ERROR
+	// Must return FZ_REPLY_CONTINUE, FZ_REPLY_WOULDBLOCK or FZ_REPLY_ERROR.
+	// After FZ_REPLY_WOULDBLOCK the body has to send a CIOThreadEvent to the
+	// control socket once data is available.
 	virtual int data_request(unsigned char* data, unsigned int & len) = 0;
 
 	// reset() must return FZ_REPLY_CONTINUE or FZ_REPLY_ERROR
@@ -80,6 +82,41 @@ protected:
 	fz::logger_interface & logger_;
 };
 
+class CIOThread;
+
+// Like file_body, but the file is read ahead by a CIOThread so that slow
+// local storage does not stall the event loop shared with other engines.
+class iothread_body final : public request_body
+{
+public:
+	iothread_body(CFileZillaEnginePrivate & engine, fz::event_handler & handler, std::wstring const& file, uint64_t start, uint64_t size);
+	virtual ~iothread_body();
+
+	virtual uint64_t size() const override { return size_; }
+
+	virtual int data_request(unsigned char* data, unsigned int & len) override;
+
+	virtual int rewind() override;
+
+	std::function<void(int64_t)> progress_callback_;
+
+private:
+	int Start();
+	void Stop();
+
+	CFileZillaEnginePrivate & engine_;
+	fz::event_handler & handler_;
+	std::wstring const file_;
+
+	uint64_t start_{};
+	uint64_t written_{};
+	uint64_t size_{};
+
+	std::unique_ptr<CIOThread> ioThread_;
+	char* buffer_{};
+	unsigned int bufferLen_{};
+};
+
 #define HEADER_NAME_CONTENT_LENGTH "Content-Length"
 #define HEADER_NAME_CONTENT_TYPE "Content-Type"
 class WithHeaders
@@ -185,6 +222,11 @@ public:
 	// Called if !success && got_body
 	std::function<int(unsigned char const* data, unsigned int len)> on_error_data_;
 
+	// Called if the connection got lost in the middle of the body. Return
+	// true to have the request repeated on a new connection, after adjusting
+	// it to only ask for the remainder, e.g. through a Range header.
+	std::function<bool()> on_resume_;
+
 	bool success() const {
 		return code_ >= 200 && code_ < 300;
 	}
@@ -281,7 +323,11 @@ protected:
 	virtual void OnReceive() override;
 	virtual int OnSend() override;
 
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnIOThreadEvent();
+
 	virtual void ResetSocket() override;
+	virtual int DoClose(int nErrorCode = FZ_REPLY_DISCONNECTED | FZ_REPLY_ERROR) override;
 
 	friend class CProtocolOpData<CHttpControlSocket>;
 	friend class CHttpFileTransferOpData;
@@ -289,10 +335,40 @@ protected:
 	friend class CHttpRequestOpData;
 
 private:
+	// Moves the idle current connection into the keep-alive pool
+	void ParkConnection();
+
+	// Makes a pooled connection to the given target the current one
+	bool UnparkConnection(std::wstring const& host, unsigned short port, bool tls);
+
 	std::wstring connected_host_;
 	unsigned short connected_port_{};
 	bool connected_tls_{};
 
+	// Responses received on the current connection
+	int completed_responses_{};
+
+	// Idle persistent connections to other targets than the current one,
+	// so that requests alternating between a few hosts do not have to
+	// reconnect each time.
+	struct pooled_connection
+	{
+		std::wstring host_;
+		unsigned short port_{};
+		bool tls_{};
+		fz::monotonic_clock idle_since_;
+
+		// Destroyed in reverse order
+		std::shared_ptr<fz::rate_limiter> rate_limiter_;
+		std::unique_ptr<fz::socket> socket_;
+		std::unique_ptr<fz::rate_limited_layer> ratelimit_layer_;
+		std::unique_ptr<CCachedAddressLayer> cached_address_layer_;
+		std::unique_ptr<CProxySocket> proxy_layer_;
+		std::unique_ptr<fz::tls_layer> tls_layer_;
+		fz::socket_layer* active_layer_{};
+	};
+	std::vector<pooled_connection> pool_;
+
 	static RequestThrottler throttler_;
 };
 
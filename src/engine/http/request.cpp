@@ -7,6 +7,16 @@
 #include <assert.h>
 #include <string.h>
 
+namespace {
+// A request that gets lost with a failing connection may or may not have
+// been processed by the server, only requests that are safe to repeat get
+// sent before the response to the previous one.
+bool idempotent(HttpRequest const& req)
+{
+	return req.verb_ == "GET" || req.verb_ == "HEAD";
+}
+}
+
 CHttpRequestOpData::CHttpRequestOpData(CHttpControlSocket & controlSocket, std::shared_ptr<HttpRequestResponseInterface> const& request)
 	: COpData(PrivCommand::http_request, L"CHttpRequestOpData")
 	, CHttpOpData(controlSocket)
@@ -42,6 +52,9 @@ void CHttpRequestOpData::AddRequest(std::shared_ptr<HttpRequestResponseInterface
 			else if (requests_.back() && !(requests_.back()->request().keep_alive() || requests_.back()->response().keep_alive())) {
 				wait = true;
 			}
+			else if (!CanPipeline(requests_.back() ? &requests_.back()->request() : nullptr, rr->request())) {
+				wait = true;
+			}
 		}
 		if (wait) {
 			opState |= request_send_wait_for_read;
@@ -58,6 +71,17 @@ void CHttpRequestOpData::AddRequest(std::shared_ptr<HttpRequestResponseInterface
 	requests_.push_back(rr);
 }
 
+bool CHttpRequestOpData::CanPipeline(HttpRequest const* previous, HttpRequest const& next) const
+{
+	if (!engine_.GetOptions().GetOptionVal(OPTION_HTTP_PIPELINING)) {
+		return false;
+	}
+
+	// Without the previous request its response header has already arrived,
+	// all that is still outstanding is the body.
+	return (!previous || idempotent(*previous)) && idempotent(next);
+}
+
 int CHttpRequestOpData::Send()
 {
 	if (opState & request_init) {
@@ -100,8 +124,7 @@ int CHttpRequestOpData::Send()
 		}
 		req.headers_["Host"] = host_header;
 		auto pos = req.headers_.find("Connection");
-		if (pos == req.headers_.end()) {
-			// TODO: consider making keep-alive the default
+		if (pos == req.headers_.end() && !engine_.GetOptions().GetOptionVal(OPTION_HTTP_KEEPALIVE)) {
 			req.headers_["Connection"] = "close";
 		}
 		req.headers_["User-Agent"] = fz::replaced_substrings(PACKAGE_STRING, " ", "/");
@@ -202,6 +225,10 @@ int CHttpRequestOpData::Send()
 							opState |= request_send_wait_for_read;
 							log(logmsg::debug_info, L"Request did not ask for keep-alive. Waiting for response to finish before sending next request a new connection.");
 						}
+						else if (!CanPipeline(&req, requests_[send_pos_]->request())) {
+							opState |= request_send_wait_for_read;
+							log(logmsg::debug_info, L"Not pipelining next request. Waiting for response to finish before sending it.");
+						}
 						else {
 							opState |= request_init;
 						}
@@ -280,6 +307,10 @@ int CHttpRequestOpData::Send()
 						opState |= request_send_wait_for_read;
 						log(logmsg::debug_info, L"Request did not ask for keep-alive. Waiting for response to finish before sending next request a new connection.");
 					}
+					else if (!CanPipeline(&req, requests_[send_pos_]->request())) {
+						opState |= request_send_wait_for_read;
+						log(logmsg::debug_info, L"Not pipelining next request. Waiting for response to finish before sending it.");
+					}
 					else {
 						opState |= request_init;
 					}
@@ -386,6 +417,12 @@ int CHttpRequestOpData::OnReceive()
 		int read = controlSocket_.active_layer_->read(recv_buffer_.get(recv_size), recv_size, error);
 		if (read <= -1) {
 			if (error != EAGAIN) {
+				if (CanRetryOnNewConnection()) {
+					return RetryOnNewConnection();
+				}
+				if (CanResumeOnNewConnection()) {
+					return ResumeOnNewConnection();
+				}
 				log(logmsg::error, _("Could not read from socket: %s"), fz::socket_error_description(error));
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
@@ -396,6 +433,12 @@ int CHttpRequestOpData::OnReceive()
 		controlSocket_.SetActive(CFileZillaEngine::recv);
 
 		bool const eof = read == 0;
+		if (eof && CanRetryOnNewConnection()) {
+			return RetryOnNewConnection();
+		}
+		if (eof && recv_buffer_.empty() && CanResumeOnNewConnection()) {
+			return ResumeOnNewConnection();
+		}
 
 		while (!requests_.empty()) {
 			assert(!requests_.empty());
@@ -407,6 +450,7 @@ int CHttpRequestOpData::OnReceive()
 
 			if (res == FZ_REPLY_OK) {
 				log(logmsg::debug_info, L"Finished a response");
+				++controlSocket_.completed_responses_;
 				requests_.pop_front();
 				--send_pos_;
 
@@ -438,6 +482,11 @@ int CHttpRequestOpData::OnReceive()
 					opState = request_init | request_reading;
 					return FZ_REPLY_CONTINUE;
 				}
+
+				if (!send_pos_ && (opState & request_send_wait_for_read)) {
+					// Next request goes out on the same connection
+					return FZ_REPLY_CONTINUE;
+				}
 			}
 			else if (res != FZ_REPLY_CONTINUE) {
 				return res;
@@ -453,6 +502,64 @@ int CHttpRequestOpData::OnReceive()
 	return FZ_REPLY_WOULDBLOCK;
 }
 
+bool CHttpRequestOpData::CanRetryOnNewConnection() const
+{
+	// Servers may close idle persistent connections at any time. If that
+	// happens just as a request goes out, nothing of it got processed.
+	if (!controlSocket_.completed_responses_ || !recv_buffer_.empty() || requests_.empty() || !requests_.front()) {
+		return false;
+	}
+
+	auto & front = *requests_.front();
+	return (front.request().flags_ & HttpRequest::flag_sent_header) && !front.response().got_code() && idempotent(front.request());
+}
+
+int CHttpRequestOpData::RetryOnNewConnection()
+{
+	log(logmsg::status, _("Server closed the persistent connection, repeating request on a new connection"));
+
+	controlSocket_.ResetSocket();
+	read_state_ = read_state();
+	send_pos_ = 0;
+	opState = request_init | request_reading;
+
+	return FZ_REPLY_CONTINUE;
+}
+
+bool CHttpRequestOpData::CanResumeOnNewConnection()
+{
+	if (requests_.empty() || !requests_.front()) {
+		return false;
+	}
+
+	// Only bodies of known length are cut off cleanly between reads
+	auto & front = *requests_.front();
+	auto & response = front.response();
+	if (!response.got_header() || response.got_body() || !response.on_resume_ || !idempotent(front.request())) {
+		return false;
+	}
+	if (read_state_.transfer_encoding_ != identity || read_state_.responseContentLength_ == -1 ||
+		read_state_.receivedData_ >= read_state_.responseContentLength_)
+	{
+		return false;
+	}
+
+	return response.on_resume_();
+}
+
+int CHttpRequestOpData::ResumeOnNewConnection()
+{
+	log(logmsg::status, _("Connection lost while receiving data, resuming on a new connection"));
+
+	controlSocket_.ResetSocket();
+	recv_buffer_.clear();
+	read_state_ = read_state();
+	send_pos_ = 0;
+	opState = request_init | request_reading;
+
+	return FZ_REPLY_CONTINUE;
+}
+
 int CHttpRequestOpData::ParseHeader()
 {
 	log(logmsg::debug_verbose, L"CHttpRequestOpData::ParseHeader()");
@@ -707,7 +814,7 @@ int CHttpRequestOpData::ParseChunkedData()
 			if (i) {
 				// The chunk data has to end with CRLF. If i is nonzero,
 				// it didn't end with just CRLF.
-				log(logmsg::debug_debug, L"%u characters preceeding line-ending with value %s", i, fz::hex_encode<std::string>(std::string(recv_buffer_.get(), recv_buffer_.get() + recv_buffer_.size())));
+				FZ_LOG_IF_ENABLED(controlSocket_.logger(), logmsg::debug_debug, L"%u characters preceeding line-ending with value %s", i, fz::hex_encode<std::string>(std::string(recv_buffer_.get(), recv_buffer_.get() + recv_buffer_.size())));
 				log(logmsg::error, _("Malformed chunk data: %s"), _("Chunk data improperly terminated"));
 				return FZ_REPLY_ERROR;
 			}
@@ -36,6 +36,17 @@ public:
 	int OnReceive();
 
 private:
+	// Whether next may be sent before the response to previous has been
+	// received. previous is null if only its response body is outstanding.
+	bool CanPipeline(HttpRequest const* previous, HttpRequest const& next) const;
+
+	bool CanRetryOnNewConnection() const;
+	int RetryOnNewConnection();
+
+	// Not const, the response gets to prepare the request for resuming
+	bool CanResumeOnNewConnection();
+	int ResumeOnNewConnection();
+
 	int ParseReceiveBuffer(bool eof);
 	int ParseHeader();
 	int ProcessCompleteHeader();
@@ -1,17 +1,179 @@
 #include <filezilla.h>
 
 #include "iothread.h"
+#include "resume_journal.h"
 
 #include <libfilezilla/file.hpp>
 
+#include <algorithm>
+#include <limits>
+
 #include <assert.h>
+#include <string.h>
+#ifdef FZ_WINDOWS
+#include <winioctl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef IOTHREAD_MAPPED_WRITES
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__)
+#define FZ_IOTHREAD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define FZ_IOTHREAD_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace {
+#ifndef FZ_WINDOWS
+// Returns the offset of the first CR or LF in [p, p + len), or len if there
+// is none. ASCII mode conversion copies whole runs of bytes in between.
+size_t FindLineEnding(char const* p, size_t len)
+{
+	size_t i = 0;
+#ifdef FZ_IOTHREAD_SSE2
+	__m128i const cr = _mm_set1_epi8('\r');
+	__m128i const lf = _mm_set1_epi8('\n');
+	for (; i + 16 <= len; i += 16) {
+		__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + i));
+		unsigned int const mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(FZ_IOTHREAD_NEON)
+	uint8x16_t const cr = vdupq_n_u8('\r');
+	uint8x16_t const lf = vdupq_n_u8('\n');
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t const v = vld1q_u8(reinterpret_cast<uint8_t const*>(p + i));
+		if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf)))) {
+			// Found in this block, the scalar loop below locates it
+			break;
+		}
+	}
+#endif
+	for (; i < len; ++i) {
+		if (p[i] == '\n' || p[i] == '\r') {
+			break;
+		}
+	}
+	return i;
+}
+#endif
+
+// How often segments update the resume journal
+fz::duration const journal_interval = fz::duration::from_seconds(2);
+
+// Sparse writes only leave holes for whole blocks of zeros of this size,
+// the block size of most file systems.
+size_t const sparse_block = 4096;
+
+bool IsZero(char const* p, size_t len)
+{
+	return !len || (!*p && !memcmp(p, p + 1, len - 1));
+}
+
+#ifdef FZ_WINDOWS
+// Unlike on other systems, skipping over a range past the end of a file
+// only leaves a hole if the file is marked as sparse.
+bool SetSparseFile(HANDLE h)
+{
+	DWORD bytes{};
+	return DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes, nullptr) != 0;
+}
+#endif
+
+bool PunchHole(fz::file & file, int64_t offset, int64_t len)
+{
+#ifdef FZ_WINDOWS
+	FILE_ZERO_DATA_INFORMATION info{};
+	info.FileOffset.QuadPart = offset;
+	info.BeyondFinalZero.QuadPart = offset + len;
+	DWORD bytes{};
+	return DeviceIoControl(file.fd(), FSCTL_SET_ZERO_DATA, &info, sizeof(info), nullptr, 0, &bytes, nullptr) != 0;
+#elif defined(__linux__)
+	return !fallocate(file.fd(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+#else
+	(void)file;
+	(void)offset;
+	(void)len;
+	return false;
+#endif
+}
+
+size_t GetPageSize()
+{
+#ifdef FZ_WINDOWS
+	SYSTEM_INFO info{};
+	GetSystemInfo(&info);
+	size_t const size = info.dwPageSize;
+#else
+	long const size = sysconf(_SC_PAGESIZE);
+#endif
+	return (size > 0) ? static_cast<size_t>(size) : 4096;
+}
+
+#ifdef IOTHREAD_MAPPED_WRITES
+// Mapping offsets need to be multiples of this
+int64_t GetMappingGranularity()
+{
+#ifdef FZ_WINDOWS
+	SYSTEM_INFO info{};
+	GetSystemInfo(&info);
+	if (info.dwAllocationGranularity) {
+		return info.dwAllocationGranularity;
+	}
+#endif
+	return static_cast<int64_t>(GetPageSize());
+}
+#endif
 
-CIOThread::CIOThread()
+char* AllocateAligned(size_t size, size_t alignment)
 {
-	m_buffers[0] = new char[BUFFERSIZE*BUFFERCOUNT];
-	for (unsigned int i = 0; i < BUFFERCOUNT; ++i) {
-		m_buffers[i] = m_buffers[0] + BUFFERSIZE * i;
-		m_bufferLens[i] = 0;
+#ifdef FZ_WINDOWS
+	return static_cast<char*>(_aligned_malloc(size, alignment));
+#else
+	void* p{};
+	if (posix_memalign(&p, alignment, size)) {
+		return nullptr;
+	}
+	return static_cast<char*>(p);
+#endif
+}
+
+void FreeAligned(char* p)
+{
+#ifdef FZ_WINDOWS
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+}
+
+CIOThread::CIOThread(int bufferCount, int bufferSize)
+{
+	size_t const pageSize = GetPageSize();
+
+	m_bufferCount = std::max(2, bufferCount);
+	m_bufferSize = static_cast<int>(((std::max(bufferSize, 1) + pageSize - 1) / pageSize) * pageSize);
+
+	// Create fails if this did
+	m_memory = AllocateAligned(static_cast<size_t>(m_bufferSize) * m_bufferCount, pageSize);
+	if (!m_memory) {
+		return;
+	}
+
+	m_buffers.resize(m_bufferCount);
+	m_bufferLens.resize(m_bufferCount);
+	for (int i = 0; i < m_bufferCount; ++i) {
+		m_buffers[i] = m_memory + static_cast<size_t>(m_bufferSize) * i;
 	}
 }
 
@@ -21,15 +183,26 @@ CIOThread::~CIOThread()
 
 	Close();
 
-	delete [] m_buffers[0];
+	FreeAligned(m_memory);
 }
 
 void CIOThread::Close()
 {
 	if (m_pFile) {
+#ifdef IOTHREAD_MAPPED_WRITES
+		// Data in an incomplete buffer is lost, same as with the regular buffers
+		m_mappedCur = 0;
+		LeaveMapping();
+#endif
+
+		if (!m_journalFile.empty()) {
+			UpdateJournal();
+			m_journalFile.clear();
+		}
+
 		// The file might have been preallocated and the transfer stopped before being completed
 		// so always truncate the file to the actually written size before closing it.
-		if (!m_read) {
+		if (!m_read && !m_keepSize) {
 			m_pFile->truncate();
 		}
 
@@ -37,18 +210,35 @@ void CIOThread::Close()
 	}
 }
 
-bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary)
+bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, int64_t mapSize)
 {
 	assert(pFile);
 
+	if (!m_memory) {
+		return false;
+	}
+
 	Close();
 
 	m_pFile = std::move(pFile);
 	m_read = read;
 	m_binary = binary;
+	m_written = 0;
+	m_unsynced = 0;
 
+	m_sparse = m_sparse && !read && binary;
 	if (read) {
-		m_curAppBuf = BUFFERCOUNT - 1;
+		m_syncInterval = 0;
+	}
+	bool const threadWrites = m_sparse || m_syncInterval > 0;
+#ifdef FZ_WINDOWS
+	if (m_sparse) {
+		SetSparseFile(m_pFile->fd());
+	}
+#endif
+
+	if (read) {
+		m_curAppBuf = m_bufferCount - 1;
 		m_curThreadBuf = 0;
 	}
 	else {
@@ -60,6 +250,25 @@ bool CIOThread::Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile
 	size_ = m_pFile->size();
 #endif
 
+#ifdef IOTHREAD_MAPPED_WRITES
+	if (!read && binary && mapSize > 0 && !threadWrites) {
+		MapFile(mapSize);
+	}
+#else
+	(void)mapSize;
+	(void)threadWrites;
+#endif
+
+#ifdef IOTHREAD_URING
+	bool ring = binary && !threadWrites;
+#ifdef IOTHREAD_MAPPED_WRITES
+	ring = ring && !m_mapping;
+#endif
+	if (ring && StartRing(pool)) {
+		return true;
+	}
+#endif
+
 	m_running = true;
 
 	thread_ = pool.spawn([this]() { entry(); });
@@ -78,7 +287,7 @@ void CIOThread::entry()
 		while (m_running) {
 
 			l.unlock();
-			auto len = ReadFromFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			auto len = ReadFromFile(m_buffers[m_curThreadBuf], m_bufferSize);
 			l.lock();
 
 			if (m_appWaiting) {
@@ -103,7 +312,7 @@ void CIOThread::entry()
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			++m_curThreadBuf %= m_bufferCount;
 			if (m_curThreadBuf == m_curAppBuf) {
 				if (!m_running) {
 					break;
@@ -138,13 +347,22 @@ void CIOThread::entry()
 			}
 
 			l.unlock();
-			bool writeSuccessful = WriteToFile(m_buffers[m_curThreadBuf], BUFFERSIZE);
+			bool writeSuccessful = WriteToFile(m_buffers[m_curThreadBuf], m_bufferSize);
+			if (writeSuccessful && m_syncInterval > 0) {
+				m_unsynced += m_bufferSize;
+				if (m_unsynced >= m_syncInterval) {
+					writeSuccessful = Sync();
+				}
+			}
 			l.lock();
 
 			if (!writeSuccessful) {
 				m_error = true;
 				m_running = false;
 			}
+			else {
+				m_written += m_bufferSize;
+			}
 
 			if (m_appWaiting) {
 				if (!m_evtHandler) {
@@ -159,26 +377,53 @@ void CIOThread::entry()
 				break;
 			}
 
-			++m_curThreadBuf %= BUFFERCOUNT;
+			++m_curThreadBuf %= m_bufferCount;
 		}
 	}
 }
 
 int CIOThread::GetNextWriteBuffer(char** pBuffer)
 {
+	if (!m_journalFile.empty()) {
+		auto const now = fz::monotonic_clock::now();
+		if (now - m_journalTime >= journal_interval) {
+			m_journalTime = now;
+			UpdateJournal();
+		}
+	}
+
 	fz::scoped_lock l(m_mutex);
 
 	if (m_error) {
 		return IO_Error;
 	}
 
+#ifdef IOTHREAD_MAPPED_WRITES
+	if (m_mapping) {
+		m_mappedUsed += m_mappedCur;
+		int64_t const remaining = m_mappedSize - m_mappedUsed;
+		if (remaining > 0) {
+			m_mappedCur = std::min(remaining, static_cast<int64_t>(m_bufferSize));
+			*pBuffer = m_mapping + m_mappingSkip + m_mappedUsed;
+			return static_cast<int>(m_mappedCur);
+		}
+
+		// More data than expected, continue through the buffers after the mapped range
+		m_mappedCur = 0;
+		if (!LeaveMapping()) {
+			m_error = true;
+			return IO_Error;
+		}
+	}
+#endif
+
 	if (m_curAppBuf == -1) {
 		m_curAppBuf = 0;
 		*pBuffer = m_buffers[0];
-		return IO_Success;
+		return m_bufferSize;
 	}
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
+	int newBuf = (m_curAppBuf + 1) % m_bufferCount;
 	if (newBuf == m_curThreadBuf) {
 		m_appWaiting = true;
 		return IO_Again;
@@ -189,10 +434,21 @@ int CIOThread::GetNextWriteBuffer(char** pBuffer)
 		m_threadWaiting = false;
 	}
 
+	int const filled = m_curAppBuf;
 	m_curAppBuf = newBuf;
 	*pBuffer = m_buffers[newBuf];
 
-	return IO_Success;
+#ifdef IOTHREAD_URING
+	if (m_ring) {
+		CIOUringOp* op = PrepareRingOp(filled, static_cast<unsigned int>(m_bufferSize));
+		l.unlock();
+		SubmitRing(&op, 1);
+	}
+#else
+	(void)filled;
+#endif
+
+	return m_bufferSize;
 }
 
 bool CIOThread::Finalize(int len)
@@ -201,6 +457,13 @@ bool CIOThread::Finalize(int len)
 
 	Destroy();
 
+#ifdef IOTHREAD_MAPPED_WRITES
+	if (m_mapping) {
+		m_mappedCur = len;
+		return LeaveMapping();
+	}
+#endif
+
 	if (m_curAppBuf == -1) {
 		return true;
 	}
@@ -210,12 +473,14 @@ bool CIOThread::Finalize(int len)
 	}
 
 	if (!len) {
-		return true;
+		return SyncIfNeeded();
 	}
 
 	if (!WriteToFile(m_buffers[m_curAppBuf], len)) {
 		return false;
 	}
+	m_written += len;
+	m_unsynced += len;
 
 #ifndef FZ_WINDOWS
 	if (!m_binary && m_wasCarriageReturn) {
@@ -228,14 +493,14 @@ bool CIOThread::Finalize(int len)
 
 	m_curAppBuf = -1;
 
-	return true;
+	return SyncIfNeeded();
 }
 
 int CIOThread::GetNextReadBuffer(char** pBuffer)
 {
 	assert(m_read);
 
-	int newBuf = (m_curAppBuf + 1) % BUFFERCOUNT;
+	int newBuf = (m_curAppBuf + 1) % m_bufferCount;
 
 	fz::scoped_lock l(m_mutex);
 
@@ -258,9 +523,22 @@ int CIOThread::GetNextReadBuffer(char** pBuffer)
 	}
 
 	*pBuffer = m_buffers[newBuf];
+	int const freed = m_curAppBuf;
 	m_curAppBuf = newBuf;
+	int const len = static_cast<int>(m_bufferLens[newBuf]);
+
+#ifdef IOTHREAD_URING
+	// The buffer given back can be filled again
+	if (m_ring && m_running) {
+		CIOUringOp* op = PrepareRingOp(freed, static_cast<unsigned int>(m_bufferSize));
+		l.unlock();
+		SubmitRing(&op, 1);
+	}
+#else
+	(void)freed;
+#endif
 
-	return m_bufferLens[newBuf];
+	return len;
 }
 
 void CIOThread::Destroy()
@@ -274,9 +552,27 @@ void CIOThread::Destroy()
 				m_condition.signal(l);
 			}
 		}
+
+#ifdef IOTHREAD_URING
+		while (m_ringPending) {
+			m_threadWaiting = true;
+			m_condition.wait(l);
+		}
+#endif
 	}
 
 	thread_.join();
+
+#ifdef IOTHREAD_URING
+	if (m_ring) {
+		// Operations on the ring use explicit offsets, regular writes and
+		// truncation continue where it left off.
+		if (!m_read && m_pFile) {
+			m_pFile->seek(m_ringOffset, fz::file::begin);
+		}
+		m_ring.reset();
+	}
+#endif
 }
 
 int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
@@ -315,7 +611,19 @@ int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
 	char* w = pBuffer;
 
 	// Convert all stand-alone LFs into CRLF pairs.
+	// The output never overtakes the input as it is read from the upper half.
 	while (r != end) {
+		size_t const run = FindLineEnding(r, end - r);
+		if (run) {
+			memmove(w, r, run);
+			w += run;
+			r += run;
+			m_wasCarriageReturn = false;
+			if (r == end) {
+				break;
+			}
+		}
+
 		char c = *r++;
 		if (c == '\n') {
 			if (!m_wasCarriageReturn) {
@@ -323,11 +631,8 @@ int64_t CIOThread::ReadFromFile(char* pBuffer, int64_t maxLen)
 			}
 			m_wasCarriageReturn = false;
 		}
-		else if (c == '\r') {
-			m_wasCarriageReturn = true;
-		}
 		else {
-			m_wasCarriageReturn = false;
+			m_wasCarriageReturn = true;
 		}
 
 		*w++ = c;
@@ -348,7 +653,7 @@ bool CIOThread::WriteToFile(char* pBuffer, int64_t len)
 #ifndef FZ_WINDOWS
 	if (m_binary) {
 #endif
-		return DoWrite(pBuffer, len);
+		return m_sparse ? WriteSparse(pBuffer, len) : DoWrite(pBuffer, len);
 #ifndef FZ_WINDOWS
 	}
 	else {
@@ -365,31 +670,29 @@ bool CIOThread::WriteToFile(char* pBuffer, int64_t len)
 		}
 
 		// Skip forward to end of buffer or first CR
-		const char* r = pBuffer;
+		const char* r = static_cast<const char*>(memchr(pBuffer, '\r', len));
 		const char* const end = pBuffer + len;
-		while (r != end && *r != '\r') {
-			++r;
-		}
 
-		if (r != end) {
+		if (r) {
 			// Now we gotta move data and also handle additional CRs.
-			m_wasCarriageReturn = true;
-
-			char* w = const_cast<char*>(r++);
-			for (; r != end; ++r) {
-				if (*r == '\r') {
-					m_wasCarriageReturn = true;
-				}
-				else if (*r == '\n') {
-					m_wasCarriageReturn = false;
-					*(w++) = *r;
-				}
-				else {
-					if (m_wasCarriageReturn) {
-						m_wasCarriageReturn = false;
+			// A pending CR has been skipped in this buffer, so there is always
+			// room to put it back in front of the run following it.
+			char* w = const_cast<char*>(r);
+			while (r != end) {
+				// *r is a CR
+				m_wasCarriageReturn = true;
+				++r;
+
+				auto const* cr = static_cast<const char*>(memchr(r, '\r', end - r));
+				size_t const run = (cr ? cr : end) - r;
+				if (run) {
+					if (*r != '\n') {
 						*(w++) = '\r';
 					}
-					*(w++) = *r;
+					m_wasCarriageReturn = false;
+					memmove(w, r, run);
+					w += run;
+					r += run;
 				}
 			}
 			len = w - pBuffer;
@@ -416,6 +719,390 @@ bool CIOThread::DoWrite(char const* pBuffer, int64_t len)
 	return false;
 }
 
+bool CIOThread::WriteSparse(char const* pBuffer, int64_t len)
+{
+	char const* const end = pBuffer + len;
+	char const* data = pBuffer;
+	char const* p = pBuffer;
+	while (end - p >= static_cast<int64_t>(sparse_block)) {
+		if (!IsZero(p, sparse_block)) {
+			p += sparse_block;
+			continue;
+		}
+
+		char const* zeros = p + sparse_block;
+		while (end - zeros >= static_cast<int64_t>(sparse_block) && IsZero(zeros, sparse_block)) {
+			zeros += sparse_block;
+		}
+
+		if (p != data && !DoWrite(data, p - data)) {
+			return false;
+		}
+		if (!SkipZeros(p, zeros - p)) {
+			return false;
+		}
+		data = p = zeros;
+	}
+
+	if (end != data) {
+		return DoWrite(data, end - data);
+	}
+	return true;
+}
+
+bool CIOThread::SkipZeros(char const* pBuffer, int64_t len)
+{
+	int64_t const offset = m_pFile->seek(0, fz::file::current);
+	if (offset < 0) {
+		return DoWrite(pBuffer, len);
+	}
+
+	// Segments write into ranges that may still hold the data of an earlier
+	// attempt. Anywhere else, the file has only been extended so far.
+	if (m_keepSize && !PunchHole(*m_pFile, offset, len)) {
+		return DoWrite(pBuffer, len);
+	}
+
+	if (m_pFile->seek(offset + len, fz::file::begin) != offset + len) {
+		fz::scoped_lock locker(m_mutex);
+		m_error_description = fz::to_wstring(GetSystemErrorDescription(GetSystemErrorCode()));
+		return false;
+	}
+
+	return true;
+}
+
+bool CIOThread::Sync()
+{
+	m_unsynced = 0;
+
+#ifdef FZ_WINDOWS
+	bool const res = FlushFileBuffers(m_pFile->fd()) != 0;
+#elif defined(__linux__)
+	bool const res = !fdatasync(m_pFile->fd());
+#else
+	bool const res = !fsync(m_pFile->fd());
+#endif
+	if (!res) {
+		auto const error = fz::to_wstring(GetSystemErrorDescription(GetSystemErrorCode()));
+		fz::scoped_lock locker(m_mutex);
+		m_error_description = error;
+	}
+
+	return res;
+}
+
+bool CIOThread::SyncIfNeeded()
+{
+	if (m_syncInterval <= 0 || !m_unsynced) {
+		return true;
+	}
+	return Sync();
+}
+
+bool CIOThread::Preallocate(fz::file& file, int64_t size, bool sparse)
+{
+	int64_t const current = file.size();
+	if (current < 0) {
+		return false;
+	}
+	if (size <= current) {
+		return true;
+	}
+
+	bool allocated{};
+#ifdef FZ_WINDOWS
+	if (sparse) {
+		SetSparseFile(file.fd());
+	}
+	else {
+		// Reserves the clusters. SetFileValidData would also spare zeroing
+		// them, but it needs a privilege and exposes what they held before.
+		FILE_ALLOCATION_INFO info{};
+		info.AllocationSize.QuadPart = size;
+		SetFileInformationByHandle(file.fd(), FileAllocationInfo, &info, sizeof(info));
+	}
+#elif defined(__linux__)
+	if (!sparse) {
+		// Unlike posix_fallocate, fails instead of writing zeros if the file
+		// system does not support it.
+		allocated = !fallocate(file.fd(), 0, current, size - current);
+	}
+#else
+	(void)sparse;
+#endif
+
+	if (!allocated) {
+		if (file.seek(size, fz::file::begin) != size || !file.truncate()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#ifdef IOTHREAD_MAPPED_WRITES
+bool CIOThread::MapFile(int64_t size)
+{
+	int64_t const offset = m_pFile->seek(0, fz::file::current);
+	if (offset < 0 || size <= offset || m_pFile->size() < size) {
+		return false;
+	}
+
+	int64_t const start = offset - offset % GetMappingGranularity();
+	int64_t const len = size - start;
+	if (static_cast<uint64_t>(len) > std::numeric_limits<size_t>::max()) {
+		return false;
+	}
+
+#ifdef FZ_WINDOWS
+	HANDLE h = CreateFileMapping(m_pFile->fd(), nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	if (!h) {
+		return false;
+	}
+	void* p = MapViewOfFile(h, FILE_MAP_WRITE, static_cast<DWORD>(start >> 32), static_cast<DWORD>(start), static_cast<size_t>(len));
+	if (!p) {
+		CloseHandle(h);
+		return false;
+	}
+	m_mappingHandle = h;
+#else
+	// Preallocation only set the size, the file may well be sparse. Reserve
+	// the blocks so that running out of space cannot fault on a mapped page.
+	if (posix_fallocate(m_pFile->fd(), offset, size - offset)) {
+		return false;
+	}
+	void* p = mmap(nullptr, static_cast<size_t>(len), PROT_READ | PROT_WRITE, MAP_SHARED, m_pFile->fd(), static_cast<off_t>(start));
+	if (p == MAP_FAILED) {
+		return false;
+	}
+#endif
+
+	m_mapping = static_cast<char*>(p);
+	m_mappingLen = static_cast<size_t>(len);
+	m_mappingSkip = static_cast<size_t>(offset - start);
+	m_mappingOffset = offset;
+	m_mappedSize = size - offset;
+	m_mappedUsed = 0;
+	m_mappedCur = 0;
+
+	return true;
+}
+
+bool CIOThread::LeaveMapping()
+{
+	if (!m_mapping) {
+		return true;
+	}
+
+	m_mappedUsed += m_mappedCur;
+	m_mappedCur = 0;
+
+#ifdef FZ_WINDOWS
+	UnmapViewOfFile(m_mapping);
+	CloseHandle(static_cast<HANDLE>(m_mappingHandle));
+	m_mappingHandle = nullptr;
+#else
+	munmap(m_mapping, m_mappingLen);
+#endif
+	m_mapping = nullptr;
+
+	int64_t const pos = m_mappingOffset + m_mappedUsed;
+	if (m_pFile->seek(pos, fz::file::begin) != pos) {
+		m_error_description = fz::to_wstring(GetSystemErrorDescription(GetSystemErrorCode()));
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+#ifdef IOTHREAD_URING
+bool CIOThread::StartRing(fz::thread_pool& pool)
+{
+	m_ring = CIOUring::Get(pool);
+	if (!m_ring) {
+		return false;
+	}
+
+	m_ringOffset = m_pFile->seek(0, fz::file::current);
+	if (m_ringOffset < 0) {
+		m_ring.reset();
+		return false;
+	}
+
+	m_ringOps.assign(m_bufferCount, CIOUringOp{});
+	for (auto & op : m_ringOps) {
+		op.client_ = this;
+		op.fd_ = m_pFile->fd();
+		op.write_ = !m_read;
+	}
+	m_ringStates.assign(m_bufferCount, ring_state::idle);
+	m_ringPending = 0;
+
+	m_running = true;
+
+	if (m_read) {
+		// All but the buffer nominally held by the application
+		std::vector<CIOUringOp*> ops;
+		fz::scoped_lock l(m_mutex);
+		for (int i = 0; i < m_bufferCount - 1; ++i) {
+			ops.push_back(PrepareRingOp(i, static_cast<unsigned int>(m_bufferSize)));
+		}
+		l.unlock();
+		SubmitRing(ops.data(), ops.size());
+	}
+
+	return true;
+}
+
+CIOUringOp* CIOThread::PrepareRingOp(int buffer, unsigned int len)
+{
+	auto & op = m_ringOps[buffer];
+	op.offset_ = static_cast<uint64_t>(m_ringOffset);
+	op.iov_.iov_base = m_buffers[buffer];
+	op.iov_.iov_len = len;
+	m_ringOffset += len;
+
+	m_bufferLens[buffer] = 0;
+	m_ringStates[buffer] = ring_state::pending;
+	++m_ringPending;
+
+	return &op;
+}
+
+void CIOThread::SubmitRing(CIOUringOp ** ops, size_t count)
+{
+	size_t const submitted = m_ring->Submit(ops, count);
+	if (submitted == count) {
+		return;
+	}
+
+	fz::scoped_lock l(m_mutex);
+	for (size_t i = submitted; i < count; ++i) {
+		m_ringStates[ops[i] - m_ringOps.data()] = ring_state::failed;
+		--m_ringPending;
+	}
+	m_error = true;
+	if (m_error_description.empty()) {
+		m_error_description = _("Could not submit file I/O request");
+	}
+	AdvanceRing();
+	WakeApp();
+	if (!m_ringPending && m_threadWaiting) {
+		m_threadWaiting = false;
+		m_condition.signal(l);
+	}
+}
+
+void CIOThread::AdvanceRing()
+{
+	while (m_ringStates[m_curThreadBuf] == ring_state::done) {
+		if (m_read && !m_bufferLens[m_curThreadBuf]) {
+			// EOF, same as with the thread the empty buffer is not handed out
+			m_running = false;
+			return;
+		}
+		if (!m_read) {
+			m_written += m_bufferSize;
+		}
+		m_ringStates[m_curThreadBuf] = ring_state::idle;
+		++m_curThreadBuf %= m_bufferCount;
+	}
+
+	if (m_ringStates[m_curThreadBuf] == ring_state::failed) {
+		m_running = false;
+	}
+}
+
+void CIOThread::WakeApp()
+{
+	if (m_appWaiting && m_evtHandler) {
+		m_appWaiting = false;
+		m_evtHandler->send_event<CIOThreadEvent>();
+	}
+}
+
+void CIOThread::OnIOComplete(CIOUringOp & op, int res)
+{
+	int const buffer = static_cast<int>(&op - m_ringOps.data());
+	bool again{};
+
+	fz::scoped_lock l(m_mutex);
+
+	if (res < 0 || (!res && !m_read)) {
+		m_error = true;
+		if (m_error_description.empty()) {
+			m_error_description = fz::to_wstring(GetSystemErrorDescription(res < 0 ? -res : ENOSPC));
+		}
+		m_ringStates[buffer] = ring_state::failed;
+	}
+	else {
+		size_t const n = static_cast<size_t>(res);
+		if (m_read) {
+			m_bufferLens[buffer] += static_cast<unsigned int>(n);
+		}
+		if (n && n < op.iov_.iov_len && !m_error) {
+			// Continue with the rest, a short read without error most likely
+			// is followed by an empty one at EOF.
+			op.iov_.iov_base = static_cast<char*>(op.iov_.iov_base) + n;
+			op.iov_.iov_len -= n;
+			op.offset_ += n;
+			again = true;
+		}
+		else {
+			m_ringStates[buffer] = ring_state::done;
+		}
+	}
+
+	if (again) {
+		l.unlock();
+		CIOUringOp* p = &op;
+		SubmitRing(&p, 1);
+		return;
+	}
+
+	--m_ringPending;
+	AdvanceRing();
+	WakeApp();
+	if (!m_ringPending && m_threadWaiting) {
+		m_threadWaiting = false;
+		m_condition.signal(l);
+	}
+}
+#endif
+
+void CIOThread::SetJournal(std::wstring const& localFile, int64_t fileSize, int64_t offset, int64_t size)
+{
+	// Only binary data ends up at the same offsets as on the server
+	if (m_read || !m_binary) {
+		return;
+	}
+
+	m_journalFile = localFile;
+	m_journalFileSize = fileSize;
+	m_journalOffset = offset;
+	m_journalSize = size;
+	m_journalWritten = 0;
+	m_journalTime = fz::monotonic_clock::now();
+}
+
+void CIOThread::UpdateJournal()
+{
+	int64_t written;
+	{
+		fz::scoped_lock l(m_mutex);
+		written = std::min(m_written, m_journalSize);
+	}
+
+	// Not synced to disk, the data is as safe as the file contents after
+	// the application has been interrupted.
+	if (written > m_journalWritten) {
+		m_journalWritten = written;
+		CResumeJournal::AddRange(m_journalFile, m_journalFileSize, m_journalOffset, m_journalOffset + written);
+	}
+}
+
 std::wstring CIOThread::GetError()
 {
 	fz::scoped_lock locker(m_mutex);
@@ -1,10 +1,18 @@
 #ifndef FILEZILLA_ENGINE_IOTHREAD_HEADER
 #define FILEZILLA_ENGINE_IOTHREAD_HEADER
 
+#include "iouring.h"
+
 #include <libfilezilla/event.hpp>
 #include <libfilezilla/event_handler.hpp>
 #include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <vector>
 
+// Default size and count of the buffers in the ring. The actual values
+// can be chosen per transfer, see OPTION_IOTHREAD_BUFFERSIZE and
+// OPTION_IOTHREAD_BUFFERCOUNT.
 #define BUFFERCOUNT 8
 #define BUFFERSIZE 256*1024
 
@@ -13,6 +21,18 @@
 // skewing results
 //#define SIMULATE_IO
 
+#if defined(FZ_WINDOWS) || defined(__linux__)
+// Binary downloads into preallocated files can be written through a
+// memory mapping of the target file.
+#define IOTHREAD_MAPPED_WRITES 1
+#endif
+
+#if defined(ENABLE_IOURING) && !defined(SIMULATE_IO)
+// Binary transfers submit their reads and writes to an io_uring shared by
+// all transfers instead of each running a thread of its own.
+#define IOTHREAD_URING 1
+#endif
+
 struct io_thread_event_type{};
 typedef fz::simple_event<io_thread_event_type> CIOThreadEvent;
 
@@ -28,14 +48,53 @@ class file;
 }
 
 class CIOThread final
+#ifdef IOTHREAD_URING
+	: private CIOUringClient
+#endif
 {
 public:
-	CIOThread();
+	// The buffer size gets rounded up to a multiple of the page size.
+	// All buffers are page-aligned.
+	explicit CIOThread(int bufferCount = BUFFERCOUNT, int bufferSize = BUFFERSIZE);
 	~CIOThread();
 
-	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary);
+	int GetBufferSize() const { return m_bufferSize; }
+	int GetBufferCount() const { return m_bufferCount; }
+
+	// If writing in binary mode and mapSize is the known final size of the
+	// already preallocated file, the remainder of the file is memory-mapped.
+	// GetNextWriteBuffer then hands out pointers into the mapping. Should the
+	// file turn out to be larger, the regular buffers take over.
+	//
+	// Fails if the buffers could not be allocated.
+	bool Create(fz::thread_pool& pool, std::unique_ptr<fz::file> && pFile, bool read, bool binary, int64_t mapSize = -1);
 	void Destroy(); // Only call that might be blocking
 
+	// Written files are normally truncated to the written size when closed.
+	// Segmented downloads write into the middle of a file and keep its size.
+	void SetKeepSize(bool keep) { m_keepSize = keep; }
+
+	// Binary writes leave whole blocks of zeros as holes in the file, e.g.
+	// for disk images. Call before Create.
+	void SetSparse(bool sparse) { m_sparse = sparse; }
+
+	// Flushes the written data to disk each time that many bytes have been
+	// written and once finalized, instead of leaving it to the system. Call
+	// before Create.
+	//
+	// Sparse and synced writes go through the thread, neither through a
+	// mapping of the file nor through io_uring.
+	void SetSyncInterval(int64_t bytes) { m_syncInterval = bytes; }
+
+	// Reserves the space for a file about to be written and extends it to
+	// the given size, without writing to it. A file to be written sparsely
+	// only gets extended. Moves the file position.
+	static bool Preallocate(fz::file& file, int64_t size, bool sparse);
+
+	// Segments record how far they got in the resume journal of the file,
+	// every few seconds and when closed. Call after Create.
+	void SetJournal(std::wstring const& localFile, int64_t fileSize, int64_t offset, int64_t size);
+
 	// Call before first call to one of the GetNext*Buffer functions
 	// This handler will receive the CIOThreadEvent events. The events
 	// get triggerd iff a buffer is available after a call to the
@@ -52,9 +111,10 @@ public:
 	// Gets next write buffer
 	// Return value: IO_Again if it would block
 	//               IO_Error on error
-	//               IO_Success else
+	//               size of the buffer else
 	int GetNextWriteBuffer(char** pBuffer);
 
+	// len is the amount of data in the last write buffer
 	bool Finalize(int len);
 
 	std::wstring GetError();
@@ -64,18 +124,60 @@ private:
 
 	void entry();
 
+	void UpdateJournal();
+
 	int64_t ReadFromFile(char* pBuffer, int64_t maxLen);
 	bool WriteToFile(char* pBuffer, int64_t len);
 	bool DoWrite(char const* pBuffer, int64_t len);
 
+	bool WriteSparse(char const* pBuffer, int64_t len);
+
+	// Leaves a hole instead of writing the zeros at pBuffer
+	bool SkipZeros(char const* pBuffer, int64_t len);
+
+	bool Sync();
+	bool SyncIfNeeded();
+
+#ifdef IOTHREAD_MAPPED_WRITES
+	bool MapFile(int64_t size);
+
+	// Unmaps the file and positions it after the data handed back so far
+	bool LeaveMapping();
+#endif
+
+#ifdef IOTHREAD_URING
+	bool StartRing(fz::thread_pool& pool);
+
+	// Called with m_mutex held, submit the operation after unlocking
+	CIOUringOp* PrepareRingOp(int buffer, unsigned int len);
+	void SubmitRing(CIOUringOp ** ops, size_t count);
+
+	// Moves m_curThreadBuf past the buffers done in order
+	void AdvanceRing();
+	void WakeApp();
+
+	virtual void OnIOComplete(CIOUringOp & op, int res) override;
+#endif
+
 	fz::event_handler* m_evtHandler{};
 
 	bool m_read{};
 	bool m_binary{};
+	bool m_keepSize{};
+	bool m_sparse{};
+	int64_t m_syncInterval{};
+
+	// Written since the last sync, only touched by the thread and once it is done
+	int64_t m_unsynced{};
+
 	std::unique_ptr<fz::file> m_pFile;
 
-	char* m_buffers[BUFFERCOUNT];
-	unsigned int m_bufferLens[BUFFERCOUNT];
+	int m_bufferCount{};
+	int m_bufferSize{};
+
+	char* m_memory{};
+	std::vector<char*> m_buffers;
+	std::vector<unsigned int> m_bufferLens;
 
 	fz::mutex m_mutex{false};
 	fz::condition m_condition;
@@ -92,10 +194,52 @@ private:
 
 	std::wstring m_error_description;
 
+	// Bytes that have made it into the file, in order
+	int64_t m_written{};
+
+	std::wstring m_journalFile;
+	int64_t m_journalFileSize{};
+	int64_t m_journalOffset{};
+	int64_t m_journalSize{};
+	int64_t m_journalWritten{};
+	fz::monotonic_clock m_journalTime;
+
 #ifdef SIMULATE_IO
 	int64_t size_{};
 #endif
 
+#ifdef IOTHREAD_MAPPED_WRITES
+	char* m_mapping{};
+	size_t m_mappingLen{};
+	void* m_mappingHandle{};
+
+	// Start of the handed out data relative to m_mapping and in the file
+	size_t m_mappingSkip{};
+	int64_t m_mappingOffset{};
+
+	int64_t m_mappedSize{};
+	int64_t m_mappedUsed{};
+	int64_t m_mappedCur{};
+#endif
+
+#ifdef IOTHREAD_URING
+	enum class ring_state : char
+	{
+		idle,
+		pending,
+		done,
+		failed
+	};
+
+	std::shared_ptr<CIOUring> m_ring;
+	std::vector<CIOUringOp> m_ringOps;
+	std::vector<ring_state> m_ringStates;
+
+	// File offset of the next buffer to submit
+	int64_t m_ringOffset{};
+	int m_ringPending{};
+#endif
+
 	fz::async_task thread_;
 };
 
@@ -0,0 +1,252 @@
+#include <filezilla.h>
+
+#include "iouring.h"
+
+#ifdef ENABLE_IOURING
+
+#include <linux/io_uring.h>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+// Each active transfer has at most OPTION_IOTHREAD_BUFFERCOUNT operations
+// in flight, the completion queue is twice as large.
+unsigned int const ring_entries = 256;
+
+int setup(unsigned int entries, io_uring_params & params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int enter(int fd, unsigned int submit, unsigned int min_complete, unsigned int flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, nullptr, 0));
+}
+
+fz::mutex instance_mutex;
+std::weak_ptr<CIOUring> instance;
+bool unavailable{};
+
+thread_local bool on_completion_thread{};
+}
+
+std::shared_ptr<CIOUring> CIOUring::Get(fz::thread_pool & pool)
+{
+	fz::scoped_lock l(instance_mutex);
+
+	auto ret = instance.lock();
+	if (!ret && !unavailable) {
+		ret.reset(new CIOUring);
+		if (!ret->Init(pool)) {
+			// No point in trying again for every transfer
+			unavailable = true;
+			ret.reset();
+		}
+		instance = ret;
+	}
+	return ret;
+}
+
+bool CIOUring::Init(fz::thread_pool & pool)
+{
+	io_uring_params params{};
+	fd_ = setup(ring_entries, params);
+	if (fd_ < 0) {
+		return false;
+	}
+
+	sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool const single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+	}
+
+	void* p = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	sqRing_ = p;
+
+	if (single) {
+		cqRing_ = sqRing_;
+	}
+	else {
+		p = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+		cqRing_ = p;
+	}
+
+	sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+	p = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	sqes_ = p;
+
+	char* sq = static_cast<char*>(sqRing_);
+	sqHead_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+	sqTail_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	sqMask_ = *reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	sqArray_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+	sqEntries_ = params.sq_entries;
+
+	char* cq = static_cast<char*>(cqRing_);
+	cqHead_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	cqTail_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	cqMask_ = *reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	cqes_ = cq + params.cq_off.cqes;
+	cqEntries_ = params.cq_entries;
+
+	thread_ = pool.spawn([this]() { entry(); });
+	return thread_.operator bool();
+}
+
+CIOUring::~CIOUring()
+{
+	if (thread_) {
+		// A no-op without operation tells the completion thread to quit
+		fz::scoped_lock l(mutex_);
+		unsigned int const tail = *sqTail_;
+		unsigned int const index = tail & sqMask_;
+		auto & sqe = static_cast<io_uring_sqe*>(sqes_)[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_NOP;
+		sqArray_[index] = index;
+		__atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+		while (!Enter(1)) {
+			// Cannot leave the thread running on freed memory
+			l.unlock();
+			std::this_thread::yield();
+			l.lock();
+		}
+	}
+	thread_.join();
+
+	if (sqes_) {
+		munmap(sqes_, sqesSize_);
+	}
+	if (cqRing_ && cqRing_ != sqRing_) {
+		munmap(cqRing_, cqRingSize_);
+	}
+	if (sqRing_) {
+		munmap(sqRing_, sqRingSize_);
+	}
+	if (fd_ != -1) {
+		close(fd_);
+	}
+}
+
+unsigned int CIOUring::Enter(unsigned int submit)
+{
+	unsigned int done{};
+	while (done < submit) {
+		int const res = enter(fd_, submit - done, 0, 0);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EBUSY) {
+				std::this_thread::yield();
+				continue;
+			}
+			break;
+		}
+		done += static_cast<unsigned int>(res);
+	}
+	return done;
+}
+
+size_t CIOUring::Submit(CIOUringOp * const* ops, size_t count)
+{
+	count = std::min(count, static_cast<size_t>(sqEntries_));
+	if (!count) {
+		return 0;
+	}
+
+	fz::scoped_lock l(mutex_);
+
+	// Keep the completion queue from overflowing. The completion thread
+	// itself only ever resubmits what just completed.
+	if (!on_completion_thread) {
+		while (inflight_ + count > cqEntries_) {
+			++waiters_;
+			condition_.wait(l);
+			--waiters_;
+		}
+	}
+
+	unsigned int const tail = *sqTail_;
+	for (size_t i = 0; i < count; ++i) {
+		CIOUringOp & op = *ops[i];
+		unsigned int const index = (tail + i) & sqMask_;
+		auto & sqe = static_cast<io_uring_sqe*>(sqes_)[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = op.write_ ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe.fd = op.fd_;
+		sqe.off = op.offset_;
+		sqe.addr = reinterpret_cast<uint64_t>(&op.iov_);
+		sqe.len = 1;
+		sqe.user_data = reinterpret_cast<uint64_t>(&op);
+		sqArray_[index] = index;
+	}
+	__atomic_store_n(sqTail_, tail + static_cast<unsigned int>(count), __ATOMIC_RELEASE);
+
+	unsigned int const submitted = Enter(static_cast<unsigned int>(count));
+	if (submitted < count) {
+		// The kernel consumes entries in order and only while being
+		// entered, take back the ones it did not get to.
+		__atomic_store_n(sqTail_, tail + submitted, __ATOMIC_RELEASE);
+	}
+
+	inflight_ += submitted;
+	return submitted;
+}
+
+void CIOUring::entry()
+{
+	on_completion_thread = true;
+
+	bool quit{};
+	while (!quit) {
+		unsigned int head = *cqHead_;
+		unsigned int const tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			enter(fd_, 0, 1, IORING_ENTER_GETEVENTS);
+			continue;
+		}
+
+		for (; head != tail; ++head) {
+			auto const& cqe = static_cast<io_uring_cqe const*>(cqes_)[head & cqMask_];
+			auto * op = reinterpret_cast<CIOUringOp*>(cqe.user_data);
+			int const res = cqe.res;
+			__atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+
+			if (!op) {
+				quit = true;
+				continue;
+			}
+
+			{
+				fz::scoped_lock l(mutex_);
+				--inflight_;
+				if (waiters_) {
+					condition_.signal(l);
+				}
+			}
+			op->client_->OnIOComplete(*op, res);
+		}
+	}
+
+	on_completion_thread = false;
+}
+
+#endif
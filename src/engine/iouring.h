@@ -0,0 +1,96 @@
+#ifndef FILEZILLA_ENGINE_IOURING_HEADER
+#define FILEZILLA_ENGINE_IOURING_HEADER
+
+#if defined(__linux__) && HAVE_LINUX_IO_URING_H
+#define ENABLE_IOURING 1
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <memory>
+#include <thread>
+
+#include <sys/uio.h>
+
+struct CIOUringOp;
+
+class CIOUringClient
+{
+public:
+	virtual ~CIOUringClient() = default;
+
+	// Called on the completion thread. res is the number of bytes
+	// transferred or a negative errno value.
+	virtual void OnIOComplete(CIOUringOp & op, int res) = 0;
+};
+
+struct CIOUringOp final
+{
+	CIOUringClient* client_{};
+	int fd_{-1};
+	bool write_{};
+	uint64_t offset_{};
+	iovec iov_{};
+};
+
+// One io_uring instance shared by the file reads and writes of all
+// transfers. A single thread waits for and dispatches the completions,
+// regardless of how many transfers are active.
+class CIOUring final
+{
+public:
+	// Returns nullptr if io_uring is not available, e.g. with older kernels or
+	// if forbidden by a seccomp policy. The instance lives as long as anyone
+	// is holding on to it.
+	static std::shared_ptr<CIOUring> Get(fz::thread_pool & pool);
+
+	~CIOUring();
+
+	CIOUring(CIOUring const&) = delete;
+	CIOUring& operator=(CIOUring const&) = delete;
+
+	// Submits the operations to the kernel in one go. The operations need
+	// to remain valid until their completion has been delivered. Returns
+	// how many got submitted, in order. There is no completion for the
+	// remaining ones.
+	size_t Submit(CIOUringOp * const* ops, size_t count);
+
+private:
+	CIOUring() = default;
+
+	bool Init(fz::thread_pool & pool);
+	unsigned int Enter(unsigned int submit);
+	void entry();
+
+	int fd_{-1};
+
+	void* sqRing_{};
+	size_t sqRingSize_{};
+	void* cqRing_{};
+	size_t cqRingSize_{};
+	void* sqes_{};
+	size_t sqesSize_{};
+
+	unsigned int* sqHead_{};
+	unsigned int* sqTail_{};
+	unsigned int sqMask_{};
+	unsigned int* sqArray_{};
+	unsigned int sqEntries_{};
+
+	unsigned int* cqHead_{};
+	unsigned int* cqTail_{};
+	unsigned int cqMask_{};
+	void* cqes_{};
+	unsigned int cqEntries_{};
+
+	fz::mutex mutex_{false};
+	fz::condition condition_;
+	unsigned int inflight_{};
+	unsigned int waiters_{};
+
+	fz::async_task thread_;
+};
+
+#endif
+
+#endif
@@ -4,6 +4,8 @@
 
 #include <libfilezilla/util.hpp>
 
+#include <algorithm>
+
 #include <errno.h>
 
 #ifndef FZ_WINDOWS
@@ -26,6 +28,14 @@ fz::native_string CLogging::m_file;
 int CLogging::m_refcount = 0;
 fz::mutex CLogging::mutex_(false);
 
+bool CLogging::m_log_open = false;
+std::string CLogging::m_pending;
+unsigned int CLogging::m_dropped = 0;
+std::wstring CLogging::m_write_error;
+bool CLogging::m_quit_writer = false;
+fz::condition CLogging::m_writer_condition;
+fz::async_task CLogging::m_writer;
+
 
 namespace {
 struct logging_options_changed_event_type;
@@ -84,6 +94,18 @@ CLogging::~CLogging()
 	m_refcount--;
 
 	if (!m_refcount) {
+		// Let the writer flush what's left
+		m_quit_writer = true;
+		m_writer_condition.signal(l);
+		l.unlock();
+		m_writer.join();
+		l.lock();
+
+		m_quit_writer = false;
+		m_log_open = false;
+		m_pending.clear();
+		m_dropped = 0;
+		m_write_error.clear();
 #ifdef FZ_WINDOWS
 		if (m_log_fd != INVALID_HANDLE_VALUE) {
 			CloseHandle(m_log_fd);
@@ -151,6 +173,20 @@ bool CLogging::InitLogFile(fz::scoped_lock& l)
 	}
 	m_max_size *= 1024 * 1024;
 
+	// From now on only the writer accesses m_log_fd until the last instance is gone
+	m_writer = engine_.GetThreadPool().spawn([]() { WriterLoop(); });
+	if (!m_writer) {
+#ifdef FZ_WINDOWS
+		CloseHandle(m_log_fd);
+		m_log_fd = INVALID_HANDLE_VALUE;
+#else
+		close(m_log_fd);
+		m_log_fd = -1;
+#endif
+		return false;
+	}
+	m_log_open = true;
+
 	return true;
 }
 
@@ -163,15 +199,18 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 			return;
 		}
 	}
-#ifdef FZ_WINDOWS
-	if (m_log_fd == INVALID_HANDLE_VALUE) {
+
+	if (!m_write_error.empty()) {
+		std::wstring error;
+		error.swap(m_write_error);
+		l.unlock(); // Avoid recursion
+		log(logmsg::error, L"%s", error);
 		return;
 	}
-#else
-	if (m_log_fd == -1) {
+
+	if (!m_log_open) {
 		return;
 	}
-#endif
 
 	std::string const out = fz::sprintf("%s %u %u %s %s"
 #ifdef FZ_WINDOWS
@@ -181,6 +220,68 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 #endif
 		now.format("%Y-%m-%d %H:%M:%S", fz::datetime::local), m_pid, engine_.GetEngineId(), m_prefixes[fz::bitscan_reverse(nMessageType)], fz::to_utf8(msg));
 
+	// Never block on a slow disk, rather drop the message
+	if (m_pending.size() + out.size() > max_pending_size) {
+		++m_dropped;
+		return;
+	}
+
+	bool const idle = m_pending.empty();
+	m_pending += out;
+	if (idle) {
+		m_writer_condition.signal(l);
+	}
+}
+
+void CLogging::WriterLoop()
+{
+	// Written outside the lock, keeps its capacity between batches
+	std::string data;
+
+	fz::scoped_lock l(mutex_);
+	while (true) {
+		if (m_pending.empty() && !m_dropped) {
+			if (m_quit_writer) {
+				break;
+			}
+			m_writer_condition.wait(l);
+			continue;
+		}
+
+		// Everything that got logged meanwhile goes into a single write
+		data.swap(m_pending);
+		unsigned int const dropped = m_dropped;
+		m_dropped = 0;
+		l.unlock();
+
+		if (dropped) {
+			data += fz::sprintf("%s %u %u %s %s"
+#ifdef FZ_WINDOWS
+				"\r\n",
+#else
+				"\n",
+#endif
+				fz::datetime::now().format("%Y-%m-%d %H:%M:%S", fz::datetime::local), m_pid, 0, m_prefixes[fz::bitscan_reverse(logmsg::error)],
+				fz::to_utf8(fz::sprintf(_("%u messages could not be written to the log file in time and got dropped."), dropped)));
+		}
+
+		std::wstring error = WriteLogFile(data);
+		data.clear();
+
+		l.lock();
+		if (!error.empty()) {
+			// LogToFile reports the error
+			m_log_open = false;
+			m_pending.clear();
+			m_dropped = 0;
+			m_write_error = std::move(error);
+			break;
+		}
+	}
+}
+
+std::wstring CLogging::WriteLogFile(std::string const& data)
+{
 #ifdef FZ_WINDOWS
 	if (m_max_size) {
 		LARGE_INTEGER size;
@@ -193,9 +294,7 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 			HANDLE hMutex = ::CreateMutexW(nullptr, true, L"FileZilla 3 Logrotate Mutex");
 			if (!hMutex) {
 				DWORD err = GetLastError();
-				l.unlock();
-				log(logmsg::error, _("Could not create logging mutex: %s"), GetSystemErrorDescription(err));
-				return;
+				return fz::sprintf(_("Could not create logging mutex: %s"), GetSystemErrorDescription(err));
 			}
 
 			HANDLE hFile = CreateFileW(m_file.c_str(), FILE_APPEND_DATA, FILE_SHARE_DELETE | FILE_SHARE_WRITE | FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
@@ -206,9 +305,7 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 				ReleaseMutex(hMutex);
 				CloseHandle(hMutex);
 
-				l.unlock(); // Avoid recursion
-				log(logmsg::error, _("Could not open log file: %s"), GetSystemErrorDescription(err));
-				return;
+				return fz::sprintf(_("Could not open log file: %s"), GetSystemErrorDescription(err));
 			}
 
 			DWORD err{};
@@ -250,21 +347,18 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 			}
 
 			if (err) {
-				l.unlock(); // Avoid recursion
-				log(logmsg::error, _("Could not open log file: %s"), GetSystemErrorDescription(err));
-				return;
+				return fz::sprintf(_("Could not open log file: %s"), GetSystemErrorDescription(err));
 			}
 		}
 	}
-	DWORD len = static_cast<DWORD>(out.size());
+	DWORD len = static_cast<DWORD>(data.size());
 	DWORD written;
-	BOOL res = WriteFile(m_log_fd, out.c_str(), len, &written, nullptr);
+	BOOL res = WriteFile(m_log_fd, data.c_str(), len, &written, nullptr);
 	if (!res || written != len) {
 		DWORD err = GetLastError();
 		CloseHandle(m_log_fd);
 		m_log_fd = INVALID_HANDLE_VALUE;
-		l.unlock(); // Avoid recursion
-		log(logmsg::error, _("Could not write to log file: %s"), GetSystemErrorDescription(err));
+		return fz::sprintf(_("Could not write to log file: %s"), GetSystemErrorDescription(err));
 	}
 #else
 	if (m_max_size) {
@@ -288,9 +382,7 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 				close(m_log_fd);
 				m_log_fd = -1;
 
-				l.unlock(); // Avoid recursion
-				log(logmsg::error, _("Could not open log file: %s"), GetSystemErrorDescription(err));
-				return;
+				return fz::sprintf(_("Could not open log file: %s"), GetSystemErrorDescription(err));
 			}
 			struct stat buf2;
 			rc = fstat(fd, &buf2);
@@ -314,9 +406,7 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 			m_log_fd = open(m_file.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
 			if (m_log_fd == -1) {
 				int err = errno;
-				l.unlock(); // Avoid recursion
-				log(logmsg::error, _("Could not open log file: %s"), GetSystemErrorDescription(err));
-				return;
+				return fz::sprintf(_("Could not open log file: %s"), GetSystemErrorDescription(err));
 			}
 
 			if (!rc) {
@@ -325,22 +415,23 @@ void CLogging::LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz:
 			}
 		}
 	}
-	size_t written = write(m_log_fd, out.c_str(), out.size());
-	if (written != out.size()) {
+	size_t written = write(m_log_fd, data.c_str(), data.size());
+	if (written != data.size()) {
 		int err = errno;
 		close(m_log_fd);
 		m_log_fd = -1;
 
-		l.unlock(); // Avoid recursion
-		log(logmsg::error, _("Could not write to log file: %s"), GetSystemErrorDescription(err));
+		return fz::sprintf(_("Could not write to log file: %s"), GetSystemErrorDescription(err));
 	}
 #endif
+
+	return std::wstring();
 }
 
 void CLogging::UpdateLogLevel(COptionsBase & options)
 {
 	logmsg::type enabled{};
-	switch (options.GetOptionVal(OPTION_LOGGING_DEBUGLEVEL)) {
+	switch (std::min(options.GetOptionVal(OPTION_LOGGING_DEBUGLEVEL), FZ_MAX_DEBUG_LOGLEVEL)) {
 	case 1:
 		enabled = logmsg::debug_warning;
 		break;
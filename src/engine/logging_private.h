@@ -4,8 +4,36 @@
 #include "engineprivate.h"
 #include <libfilezilla/format.hpp>
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
 #include <utility>
 
+// Debug messages above this level, counted like OPTION_LOGGING_DEBUGLEVEL,
+// are removed at compile time. -DFZ_MAX_DEBUG_LOGLEVEL=2 for example only
+// keeps debug_warning and debug_info messages.
+#ifndef FZ_MAX_DEBUG_LOGLEVEL
+#define FZ_MAX_DEBUG_LOGLEVEL 4
+#endif
+
+namespace logmsg {
+constexpr bool compiled_in(type t)
+{
+	return (FZ_MAX_DEBUG_LOGLEVEL >= 4 || !(t & debug_debug)) &&
+		(FZ_MAX_DEBUG_LOGLEVEL >= 3 || !(t & debug_verbose)) &&
+		(FZ_MAX_DEBUG_LOGLEVEL >= 2 || !(t & debug_info)) &&
+		(FZ_MAX_DEBUG_LOGLEVEL >= 1 || !(t & debug_warning));
+}
+}
+
+// Unlike calling log directly, this checks the level before the arguments
+// get evaluated. Use it for messages on hot paths, such as for every
+// socket event.
+#define FZ_LOG_IF_ENABLED(logger, t, ...) \
+	do { \
+		if (logmsg::compiled_in(t) && (logger).should_log(t)) { \
+			(logger).log(t, __VA_ARGS__); \
+		} \
+	} while (false)
+
 class CLoggingOptionsChanged;
 
 class CLogging : public fz::logger_interface
@@ -20,7 +48,7 @@ public:
 	virtual void do_log(logmsg::type t, std::wstring&& msg) override final {
 		auto now = fz::datetime::now();
 		LogToFile(t, msg, now);
-		engine_.AddLogNotification(new CLogmsgNotification(t, msg, now));
+		engine_.AddLogNotification(new CLogmsgNotification(t, std::move(msg), now));
 	}
 	
 	void UpdateLogLevel(COptionsBase & options);
@@ -29,8 +57,15 @@ private:
 	CFileZillaEnginePrivate & engine_;
 
 	bool InitLogFile(fz::scoped_lock& l);
+
+	// Formats the message and hands it to the writer
 	void LogToFile(logmsg::type nMessageType, std::wstring const& msg, fz::datetime const& now);
 
+	// The writer runs on the thread pool and writes all pending messages at
+	// once. Returns a description of the error if writing fails.
+	static void WriterLoop();
+	static std::wstring WriteLogFile(std::string const& data);
+
 	static bool m_logfile_initialized;
 #ifdef FZ_WINDOWS
 	static HANDLE m_log_fd;
@@ -46,6 +81,18 @@ private:
 
 	static fz::mutex mutex_;
 
+	// Protected by mutex_
+	static bool m_log_open;
+	static std::string m_pending;
+	static unsigned int m_dropped;
+	static std::wstring m_write_error;
+	static bool m_quit_writer;
+	static fz::condition m_writer_condition;
+	static fz::async_task m_writer;
+
+	// Messages get dropped if the writer falls behind by this much
+	static constexpr size_t max_pending_size = 8 * 1024 * 1024;
+
 	std::unique_ptr<CLoggingOptionsChanged> optionChangeHandler_;
 };
 
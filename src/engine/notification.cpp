@@ -5,6 +5,11 @@ CDirectoryListingNotification::CDirectoryListingNotification(CServerPath const&
 {
 }
 
+CDirectoryListingProgressNotification::CDirectoryListingProgressNotification(CServerPath const& path, std::vector<fz::shared_value<CDirentry>> && entries)
+	: path_(path), entries_(std::move(entries))
+{
+}
+
 RequestId CFileExistsNotification::GetRequestID() const
 {
 	return reqId_fileexists;
@@ -3,6 +3,8 @@
 #include "controlsocket.h"
 #include "oplock_manager.h"
 
+#include <algorithm>
+
 #include <assert.h>
 
 OpLock::OpLock(OpLockManager * mgr, size_t socket, size_t lock)
@@ -57,6 +59,30 @@ bool OpLock::waiting() const
 	return false;
 }
 
+namespace {
+template<typename Lock>
+bool conflicts(Lock const& held, Lock const& lock)
+{
+	if (held.path == lock.path || (held.inclusive && held.path.IsParentOf(lock.path, false))) {
+		return true;
+	}
+	return lock.inclusive && lock.path.IsParentOf(held.path, false);
+}
+
+template<typename Refs, typename Ref>
+void erase_ref(Refs & refs, Ref const& ref)
+{
+	for (auto it = refs.begin(); it != refs.end(); ++it) {
+		if (it->socket_ == ref.socket_ && it->lock_ == ref.lock_) {
+			*it = refs.back();
+			refs.pop_back();
+			return;
+		}
+	}
+	assert(false);
+}
+}
+
 OpLock OpLockManager::Lock(CControlSocket * socket, locking_reason reason, CServerPath const& path, bool inclusive)
 {
 	fz::scoped_lock l(mtx_);
@@ -69,32 +95,19 @@ OpLock OpLockManager::Lock(CControlSocket * socket, locking_reason reason, CServ
 	info.inclusive = inclusive;
 	info.path = path;
 
-	for (auto const& other_sli : socket_locks_) {
-		if (other_sli.control_socket_ == socket || other_sli.server_ != sli.server_) {
-			continue;
-		}
-
-		for (auto const& lock : other_sli.locks_) {
-			if (reason != lock.reason || lock.waiting || lock.released) {
-				continue;
-			}
-			if (lock.path == path || (lock.inclusive && lock.path.IsParentOf(path, false))) {
-				info.waiting = true;
-				break;
-			}
-			if (inclusive && path.IsParentOf(lock.path, false)) {
-				info.waiting = true;
-				break;
-			}
-		}
-		if (info.waiting) {
-			break;
-		}
-	}
+	table_key const key{sli.server_, reason};
+	info.waiting = HasConflict(key, socket_index, info);
 
 	sli.locks_.push_back(info);
+	lock_ref const ref{socket_index, sli.locks_.size() - 1};
+
+	path_node* node = find(key, path, true);
+	(info.waiting ? node->waiting_ : node->held_).push_back(ref);
+	for (; node; node = node->parent_) {
+		++(info.waiting ? node->subtree_waiting_ : node->subtree_held_);
+	}
 
-	return OpLock(this, socket_index, sli.locks_.size() - 1);
+	return OpLock(this, ref.socket_, ref.lock_);
 }
 
 void OpLockManager::Unlock(OpLock & lock)
@@ -103,11 +116,11 @@ void OpLockManager::Unlock(OpLock & lock)
 	assert(lock.socket_ < socket_locks_.size());
 	assert(lock.lock_ < socket_locks_[lock.socket_].locks_.size());
 
-	bool was_waiting = false;
-
 	auto & sli = socket_locks_[lock.socket_];
 
-	was_waiting = sli.locks_[lock.lock_].waiting;
+	lock_info const released = sli.locks_[lock.lock_];
+	table_key const key{sli.server_, released.reason};
+	Remove(key, lock_ref{lock.socket_, lock.lock_}, released);
 
 	if (lock.lock_ + 1 == sli.locks_.size()) {
 		sli.locks_.pop_back();
@@ -133,21 +146,211 @@ void OpLockManager::Unlock(OpLock & lock)
 
 	lock.mgr_ = nullptr;
 
-	if (!was_waiting) {
-		Wakeup();
+	if (!released.waiting) {
+		Wakeup(key, released);
+	}
+}
+
+OpLockManager::path_node* OpLockManager::find(table_key const& key, CServerPath const& path, bool create)
+{
+	path_node* node;
+	if (create) {
+		node = &tables_[key];
+	}
+	else {
+		auto it = tables_.find(key);
+		if (it == tables_.end()) {
+			return nullptr;
+		}
+		node = &it->second;
+	}
+
+	for (auto const* segment : path.GetSegments()) {
+		if (create) {
+			auto & child = node->children_[*segment];
+			if (!child) {
+				child = std::make_unique<path_node>();
+				child->parent_ = node;
+			}
+			node = child.get();
+		}
+		else {
+			auto child = node->children_.find(*segment);
+			if (child == node->children_.end()) {
+				return nullptr;
+			}
+			node = child->second.get();
+		}
+	}
+
+	return node;
+}
+
+void OpLockManager::Remove(table_key const& key, lock_ref const& ref, lock_info const& info)
+{
+	if (info.released) {
+		// Already gone from the table
+		return;
+	}
+
+	path_node* node = find(key, info.path, false);
+	assert(node);
+	if (!node) {
+		return;
+	}
+
+	erase_ref(info.waiting ? node->waiting_ : node->held_, ref);
+	for (path_node* n = node; n; n = n->parent_) {
+		--(info.waiting ? n->subtree_waiting_ : n->subtree_held_);
+	}
+
+	// Prune nodes no longer leading to any lock
+	auto const segments = info.path.GetSegments();
+	size_t depth = segments.size();
+	while (node->parent_ && !node->subtree_held_ && !node->subtree_waiting_) {
+		path_node* parent = node->parent_;
+		parent->children_.erase(*segments[--depth]);
+		node = parent;
+	}
+	if (!node->parent_ && !node->subtree_held_ && !node->subtree_waiting_) {
+		tables_.erase(key);
+	}
+}
+
+bool OpLockManager::HasConflict(table_key const& key, size_t socket, lock_info const& lock) const
+{
+	auto it = tables_.find(key);
+	if (it == tables_.end()) {
+		return false;
+	}
+
+	auto const check = [&](path_node const& node) {
+		for (auto const& ref : node.held_) {
+			if (ref.socket_ != socket && conflicts(get(ref), lock)) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// Ancestors and the node of the path itself
+	path_node const* node = &it->second;
+	auto const segments = lock.path.GetSegments();
+	for (size_t i = 0; ; ++i) {
+		if (node->subtree_held_ && check(*node)) {
+			return true;
+		}
+		if (i == segments.size()) {
+			break;
+		}
+		auto child = node->children_.find(*segments[i]);
+		if (child == node->children_.end()) {
+			return false;
+		}
+		node = child->second.get();
+	}
+
+	if (!lock.inclusive) {
+		return false;
+	}
+
+	// Everything below
+	std::vector<path_node const*> pending;
+	pending.push_back(node);
+	while (!pending.empty()) {
+		node = pending.back();
+		pending.pop_back();
+		for (auto const& child : node->children_) {
+			if (!child.second->subtree_held_) {
+				continue;
+			}
+			if (check(*child.second)) {
+				return true;
+			}
+			pending.push_back(child.second.get());
+		}
 	}
+
+	return false;
 }
 
-void OpLockManager::Wakeup()
+void OpLockManager::Wakeup(table_key const& key, lock_info const& released)
 {
-	for (auto & sli : socket_locks_) {
-		for (auto & lock : sli.locks_) {
-			if (lock.waiting) {
-				sli.control_socket_->send_event<CObtainLockEvent>();
-				break;
+	auto it = tables_.find(key);
+	if (it == tables_.end()) {
+		return;
+	}
+
+	std::vector<size_t> sockets;
+	auto const notify = [&](path_node const& node) {
+		for (auto const& ref : node.waiting_) {
+			if (conflicts(released, get(ref))) {
+				sockets.push_back(ref.socket_);
+			}
+		}
+	};
+
+	// Waiting locks on the ancestors, on the path itself and, if the released lock
+	// was inclusive, below it.
+	path_node const* node = &it->second;
+	auto const segments = released.path.GetSegments();
+	bool found = true;
+	for (size_t i = 0; ; ++i) {
+		if (node->subtree_waiting_) {
+			notify(*node);
+		}
+		if (i == segments.size()) {
+			break;
+		}
+		auto child = node->children_.find(*segments[i]);
+		if (child == node->children_.end()) {
+			found = false;
+			break;
+		}
+		node = child->second.get();
+	}
+
+	if (found && released.inclusive) {
+		std::vector<path_node const*> pending;
+		pending.push_back(node);
+		while (!pending.empty()) {
+			node = pending.back();
+			pending.pop_back();
+			for (auto const& child : node->children_) {
+				if (child.second->subtree_waiting_) {
+					notify(*child.second);
+					pending.push_back(child.second.get());
+				}
 			}
 		}
 	}
+
+	// Wake up in order of the sockets, earlier sockets get to obtain their locks first
+	std::sort(sockets.begin(), sockets.end());
+	sockets.erase(std::unique(sockets.begin(), sockets.end()), sockets.end());
+	for (auto socket : sockets) {
+		socket_locks_[socket].control_socket_->send_event<CObtainLockEvent>();
+	}
+}
+
+void OpLockManager::ListingStored(CServer const& server, CServerPath const& path)
+{
+	fz::scoped_lock l(mtx_);
+
+	path_node const* node = find(table_key{server, locking_reason::list}, path, false);
+	if (!node || node->waiting_.empty()) {
+		return;
+	}
+
+	std::vector<size_t> sockets;
+	for (auto const& ref : node->waiting_) {
+		sockets.push_back(ref.socket_);
+	}
+	std::sort(sockets.begin(), sockets.end());
+	sockets.erase(std::unique(sockets.begin(), sockets.end()), sockets.end());
+	for (auto socket : sockets) {
+		socket_locks_[socket].control_socket_->send_event<CListingStoredEvent>();
+	}
 }
 
 bool OpLockManager::ObtainWaiting(CControlSocket * socket)
@@ -155,11 +358,11 @@ bool OpLockManager::ObtainWaiting(CControlSocket * socket)
 	bool obtained = false;
 
 	fz::scoped_lock l(mtx_);
-	for (auto & sli : socket_locks_) {
-		if (sli.control_socket_ == socket) {
-			for (auto & lock : sli.locks_) {
-				if (lock.waiting) {
-					obtained |= ObtainWaiting(sli, lock);
+	for (size_t i = 0; i < socket_locks_.size(); ++i) {
+		if (socket_locks_[i].control_socket_ == socket) {
+			for (size_t j = 0; j < socket_locks_[i].locks_.size(); ++j) {
+				if (socket_locks_[i].locks_[j].waiting) {
+					obtained |= ObtainWaiting(lock_ref{i, j});
 				}
 			}
 		}
@@ -168,23 +371,22 @@ bool OpLockManager::ObtainWaiting(CControlSocket * socket)
 	return obtained;
 }
 
-bool OpLockManager::ObtainWaiting(socket_lock_info const& sli, lock_info& lock)
+bool OpLockManager::ObtainWaiting(lock_ref const& ref)
 {
-	for (auto const& other_sli : socket_locks_) {
-		if (&other_sli == &sli) {
-			continue;
-		}
+	auto & lock = get(ref);
+	table_key const key{socket_locks_[ref.socket_].server_, lock.reason};
+	if (HasConflict(key, ref.socket_, lock)) {
+		return false;
+	}
 
-		for (auto const& other_lock : other_sli.locks_) {
-			if (lock.reason != other_lock.reason || other_lock.waiting || other_lock.released) {
-				continue;
-			}
-			if (other_lock.path == lock.path || (other_lock.inclusive && other_lock.path.IsParentOf(lock.path, false))) {
-				return false;
-			}
-			if (lock.inclusive && lock.path.IsParentOf(other_lock.path, false)) {
-				return false;
-			}
+	path_node* node = find(key, lock.path, false);
+	assert(node);
+	if (node) {
+		erase_ref(node->waiting_, ref);
+		node->held_.push_back(ref);
+		for (; node; node = node->parent_) {
+			--node->subtree_waiting_;
+			++node->subtree_held_;
 		}
 	}
 
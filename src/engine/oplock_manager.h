@@ -6,12 +6,16 @@
 #include <libfilezilla/event.hpp>
 #include <libfilezilla/mutex.hpp>
 
+#include <map>
 #include <memory>
 #include <vector>
 
 struct obtain_lock_event_type;
 typedef fz::simple_event<obtain_lock_event_type> CObtainLockEvent;
 
+struct listing_stored_event_type;
+typedef fz::simple_event<listing_stored_event_type> CListingStoredEvent;
+
 enum class locking_reason
 {
 	unknown = -1,
@@ -62,6 +66,11 @@ public:
 
 	bool ObtainWaiting(CControlSocket * socket);
 
+	// Lets sockets waiting for a list lock on exactly this path check the
+	// directory cache again, so they can all use the new listing at once
+	// instead of taking the lock one after another.
+	void ListingStored(CServer const& server, CServerPath const& path);
+
 private:
 	friend class OpLock;
 
@@ -82,17 +91,66 @@ private:
 		std::vector<lock_info> locks_;
 	};
 
+	struct lock_ref
+	{
+		size_t socket_;
+		size_t lock_;
+	};
+
+	// Locks of one server and reason, arranged by the segments of their
+	// paths. Conflict checks and wakeups only need to visit the ancestors
+	// and, for inclusive locks, the subtree of a path. Segments are
+	// only used to narrow down the candidates, the actual checks still
+	// compare the full paths.
+	struct path_node
+	{
+		path_node* parent_{};
+		std::map<std::wstring, std::unique_ptr<path_node>> children_;
+
+		std::vector<lock_ref> held_;
+		std::vector<lock_ref> waiting_;
+
+		// Including the locks in this node
+		size_t subtree_held_{};
+		size_t subtree_waiting_{};
+	};
+
+	struct table_key
+	{
+		CServer server_;
+		locking_reason reason_;
+
+		bool operator<(table_key const& op) const {
+			if (reason_ != op.reason_) {
+				return reason_ < op.reason_;
+			}
+			return server_ < op.server_;
+		}
+	};
+
 	void Unlock(OpLock & lock);
 
-	void Wakeup();
-	bool ObtainWaiting(socket_lock_info const& sli, lock_info& lock);
+	bool ObtainWaiting(lock_ref const& ref);
 
 	bool Waiting(OpLock const& lock) const;
 
 	size_t get_or_create(CControlSocket * socket);
 
+	lock_info const& get(lock_ref const& ref) const { return socket_locks_[ref.socket_].locks_[ref.lock_]; }
+	lock_info& get(lock_ref const& ref) { return socket_locks_[ref.socket_].locks_[ref.lock_]; }
+
+	path_node* find(table_key const& key, CServerPath const& path, bool create);
+	void Remove(table_key const& key, lock_ref const& ref, lock_info const& info);
+
+	bool HasConflict(table_key const& key, size_t socket, lock_info const& lock) const;
+
+	// Notifies sockets with waiting locks the released lock might have blocked
+	void Wakeup(table_key const& key, lock_info const& released);
+
 	std::vector<socket_lock_info> socket_locks_;
 
+	std::map<table_key, path_node> tables_;
+
 	mutable fz::mutex mtx_{false};
 };
 
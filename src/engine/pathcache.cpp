@@ -1,9 +1,11 @@
 #include <filezilla.h>
+#include "engine_metrics.h"
 #include "pathcache.h"
 
 #include <assert.h>
 
-CPathCache::CPathCache()
+CPathCache::CPathCache(CEngineMetrics & metrics)
+	: metrics_(metrics)
 {
 }
 
@@ -11,6 +13,18 @@ CPathCache::~CPathCache()
 {
 }
 
+void CPathCache::SetMaxEntries(size_t maxEntries)
+{
+	fz::scoped_lock lock(mutex_);
+	maxEntries_ = maxEntries ? maxEntries : 1;
+}
+
+void CPathCache::tServerCache::Erase(std::unordered_map<CSourcePath, tEntry, SourcePathHash>::iterator it)
+{
+	lru.erase(it->second.lru);
+	entries.erase(it);
+}
+
 void CPathCache::Store(CServer const& server, CServerPath const& target, CServerPath const& source, std::wstring const& subdir)
 {
 	fz::scoped_lock lock(mutex_);
@@ -28,50 +42,61 @@ void CPathCache::Store(CServer const& server, CServerPath const& target, CServer
 	sourcePath.source = source;
 	sourcePath.subdir = subdir;
 
-	serverCache[sourcePath] = target;
+	auto it = serverCache.entries.find(sourcePath);
+	if (it != serverCache.entries.end()) {
+		it->second.target = target;
+		serverCache.lru.splice(serverCache.lru.begin(), serverCache.lru, it->second.lru);
+	}
+	else {
+		serverCache.lru.push_front(sourcePath);
+		serverCache.entries.emplace(std::move(sourcePath), tEntry{target, serverCache.lru.begin()});
+
+		while (serverCache.entries.size() > maxEntries_) {
+			serverCache.Erase(serverCache.entries.find(serverCache.lru.back()));
+			metrics_.AddPathCacheEviction();
+		}
+	}
+
+	StoreExisting(m_existing[server], target);
 }
 
 CServerPath CPathCache::Lookup(CServer const& server, CServerPath const& source, std::wstring const& subdir)
 {
 	fz::scoped_lock lock(mutex_);
 
-	const tCacheConstIterator iter = m_cache.find(server);
-	if (iter == m_cache.end()) {
-		return CServerPath();
-	}
-
-	CServerPath result = Lookup(iter->second, source, subdir);
+	CServerPath result;
 
-#ifndef NDEBUG
-	if (result.empty()) {
-		m_misses++;
-	}
-	else {
-		m_hits++;
+	tCacheIterator const iter = m_cache.find(server);
+	if (iter != m_cache.end()) {
+		result = Lookup(iter->second, source, subdir);
 	}
-#endif
+
+	metrics_.AddPathCacheLookup(!result.empty());
 
 	return result;
 }
 
-CServerPath CPathCache::Lookup(tServerCache const& serverCache, CServerPath const& source, std::wstring const& subdir)
+CServerPath CPathCache::Lookup(tServerCache & serverCache, CServerPath const& source, std::wstring const& subdir)
 {
 	CSourcePath sourcePath;
 	sourcePath.source = source;
 	sourcePath.subdir = subdir;
 
-	tServerCacheConstIterator serverIter = serverCache.find(sourcePath);
-	if (serverIter == serverCache.end()) {
+	auto const it = serverCache.entries.find(sourcePath);
+	if (it == serverCache.entries.end()) {
 		return CServerPath();
 	}
 
-	return serverIter->second;
+	serverCache.lru.splice(serverCache.lru.begin(), serverCache.lru, it->second.lru);
+	return it->second.target;
 }
 
 void CPathCache::InvalidateServer(CServer const& server)
 {
 	fz::scoped_lock lock(mutex_);
 
+	m_existing.erase(server);
+
 	tCacheIterator iter = m_cache.find(server);
 	if (iter == m_cache.end()) {
 		return;
@@ -84,10 +109,22 @@ void CPathCache::InvalidatePath(CServer const& server, CServerPath const& path,
 {
 	fz::scoped_lock lock(mutex_);
 
+	CServerPath gone;
 	tCacheIterator iter = m_cache.find(server);
 	if (iter != m_cache.end()) {
+		gone = Lookup(iter->second, path, subdir);
 		InvalidatePath(iter->second, path, subdir);
 	}
+
+	if (gone.empty()) {
+		gone = path;
+		if (!subdir.empty() && !gone.AddSegment(subdir)) {
+			gone.clear();
+		}
+	}
+	if (!gone.empty()) {
+		InvalidateExisting(server, gone);
+	}
 }
 
 void CPathCache::InvalidatePath(tServerCache & serverCache, CServerPath const& path, std::wstring const& subdir)
@@ -98,10 +135,10 @@ void CPathCache::InvalidatePath(tServerCache & serverCache, CServerPath const& p
 	sourcePath.subdir = subdir;
 
 	CServerPath target;
-	tServerCacheIterator serverIter = serverCache.find(sourcePath);
-	if (serverIter != serverCache.end()) {
-		target = serverIter->second;
-		serverCache.erase(serverIter);
+	auto it = serverCache.entries.find(sourcePath);
+	if (it != serverCache.entries.end()) {
+		target = it->second.target;
+		serverCache.Erase(it);
 	}
 
 	if (target.empty() && !subdir.empty()) {
@@ -113,15 +150,14 @@ void CPathCache::InvalidatePath(tServerCache & serverCache, CServerPath const& p
 
 	if (!target.empty()) {
 		// Unfortunately O(n), don't know of a faster way.
-		for (serverIter = serverCache.begin(); serverIter != serverCache.end(); ) {
-			if (serverIter->second == target || target.IsParentOf(serverIter->second, false)) {
-				serverCache.erase(serverIter++);
-			}
-			else if (serverIter->first.source == target || target.IsParentOf(serverIter->first.source, false)) {
-				serverCache.erase(serverIter++);
+		for (it = serverCache.entries.begin(); it != serverCache.entries.end(); ) {
+			if (it->second.target == target || target.IsParentOf(it->second.target, false) ||
+				it->first.source == target || target.IsParentOf(it->first.source, false))
+			{
+				serverCache.Erase(it++);
 			}
 			else {
-				++serverIter;
+				++it;
 			}
 		}
 	}
@@ -131,4 +167,78 @@ void CPathCache::Clear()
 {
 	fz::scoped_lock lock(mutex_);
 	m_cache.clear();
+	m_existing.clear();
+}
+
+void CPathCache::StoreExisting(CServer const& server, CServerPath const& path)
+{
+	if (path.empty()) {
+		return;
+	}
+
+	fz::scoped_lock lock(mutex_);
+	StoreExisting(m_existing[server], path);
+}
+
+void CPathCache::StoreExisting(tExisting & existing, CServerPath const& path)
+{
+	// Parents need to stay known as long as their children are, which an LRU
+	// cannot guarantee. Forgetting everything is safe, directories merely
+	// get created or listed again.
+	if (existing.size() >= maxEntries_) {
+		metrics_.AddPathCacheEviction(existing.size());
+		existing.clear();
+	}
+
+	// Stop at the first parent already known, its parents are known as well
+	CServerPath current = path;
+	while (!current.empty() && existing.insert(current).second && current.HasParent()) {
+		current = current.GetParent();
+	}
+}
+
+bool CPathCache::Exists(CServer const& server, CServerPath const& path)
+{
+	fz::scoped_lock lock(mutex_);
+
+	auto const iter = m_existing.find(server);
+	return iter != m_existing.end() && iter->second.find(path) != iter->second.end();
+}
+
+CServerPath CPathCache::GetExisting(CServer const& server, CServerPath const& path)
+{
+	fz::scoped_lock lock(mutex_);
+
+	auto const iter = m_existing.find(server);
+	if (iter == m_existing.end()) {
+		return CServerPath();
+	}
+
+	CServerPath current = path;
+	while (!current.empty() && iter->second.find(current) == iter->second.end()) {
+		current = current.HasParent() ? current.GetParent() : CServerPath();
+	}
+	return current;
+}
+
+void CPathCache::InvalidateExisting(CServer const& server, CServerPath const& path)
+{
+	auto const iter = m_existing.find(server);
+	if (iter == m_existing.end()) {
+		return;
+	}
+
+	auto & existing = iter->second;
+	if (existing.find(path) == existing.end()) {
+		// Nothing below it can be known either
+		return;
+	}
+	for (auto it = existing.begin(); it != existing.end(); ) {
+		if (*it == path || path.IsParentOf(*it, false)) {
+			it = existing.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
 }
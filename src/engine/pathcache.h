@@ -6,12 +6,27 @@
 
 #include <libfilezilla/mutex.hpp>
 
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+
+class CEngineMetrics;
+
+// Each server keeps at most a bounded number of paths, the least recently
+// used ones get evicted first. Recursive operations over huge trees would
+// otherwise make it grow without limit.
 class CPathCache final
 {
 public:
-	CPathCache();
+	explicit CPathCache(CEngineMetrics & metrics);
 	~CPathCache();
 
+	// Per server, applies to the resolved paths and the existing directories
+	// each. Defaults to max_entries_per_server.
+	void SetMaxEntries(size_t maxEntries);
+
+	static size_t const max_entries_per_server = 100000;
+
 	CPathCache(CPathCache const&) = delete;
 	CPathCache& operator=(CPathCache const&) = delete;
 
@@ -28,6 +43,15 @@ public:
 
 	void Clear();
 
+	// Directories known to exist because they got listed, changed into or
+	// created. Knowing a directory implies knowing all its parents.
+	// Invalidating a path forgets it and everything below.
+	void StoreExisting(CServer const& server, CServerPath const& path);
+	bool Exists(CServer const& server, CServerPath const& path);
+
+	// Returns the deepest of path and its parents known to exist, empty if there is none
+	CServerPath GetExisting(CServer const& server, CServerPath const& path);
+
 protected:
 	class CSourcePath
 	{
@@ -35,29 +59,53 @@ protected:
 		CServerPath source;
 		std::wstring subdir;
 
-		bool operator<(CSourcePath const& op) const
+		bool operator==(CSourcePath const& op) const
+		{
+			return source == op.source && subdir == op.subdir;
+		}
+	};
+
+	struct SourcePathHash final
+	{
+		size_t operator()(CSourcePath const& p) const noexcept
 		{
-			return std::tie(subdir, source) < std::tie(op.subdir, op.source);
+			size_t const h = p.source.Hash();
+			return h ^ (std::hash<std::wstring>()(p.subdir) + 0x9e3779b9 + (h << 6) + (h >> 2));
 		}
 	};
 
 	fz::mutex mutex_;
 
-	typedef std::map<CSourcePath, CServerPath> tServerCache;
-	typedef tServerCache::iterator tServerCacheIterator;
-	typedef tServerCache::const_iterator tServerCacheConstIterator;
-	typedef std::map<CServer, tServerCache> tCache;
+	CEngineMetrics & metrics_;
+	size_t maxEntries_{max_entries_per_server};
+
+	struct tEntry final
+	{
+		CServerPath target;
+		std::list<CSourcePath>::iterator lru;
+	};
+
+	struct tServerCache final
+	{
+		std::unordered_map<CSourcePath, tEntry, SourcePathHash> entries;
+
+		// Most recently used first
+		std::list<CSourcePath> lru;
+
+		void Erase(std::unordered_map<CSourcePath, tEntry, SourcePathHash>::iterator it);
+	};
+	typedef std::unordered_map<CServer, tServerCache> tCache;
 	tCache m_cache;
 	typedef tCache::iterator tCacheIterator;
-	typedef tCache::const_iterator tCacheConstIterator;
 
-	CServerPath Lookup(tServerCache const& serverCache, CServerPath const& source, std::wstring const& subdir);
+	CServerPath Lookup(tServerCache & serverCache, CServerPath const& source, std::wstring const& subdir);
 	void InvalidatePath(tServerCache & serverCache, CServerPath const& path, std::wstring const& subdir = std::wstring());
 
-#ifndef NDEBUG
-	int m_hits{};
-	int m_misses{};
-#endif
+	typedef std::unordered_set<CServerPath> tExisting;
+	std::unordered_map<CServer, tExisting> m_existing;
+
+	void StoreExisting(tExisting & existing, CServerPath const& path);
+	void InvalidateExisting(CServer const& server, CServerPath const& path);
 };
 
 #endif
@@ -0,0 +1,17 @@
+#include <filezilla.h>
+#include "persistent.h"
+
+#include <libfilezilla/format.hpp>
+
+std::string ServerIdentity(CServer const& server)
+{
+	std::wstring id = fz::sprintf(L"%d\n%s\n%d\n%s\n%d\n%d\n%s\n%d", static_cast<int>(server.GetProtocol()), server.GetHost(), server.GetPort(), server.GetUser(),
+		server.GetTimezoneOffset(), static_cast<int>(server.GetEncodingType()), server.GetCustomEncoding(), server.GetBypassProxy() ? 1 : 0);
+	for (auto const& command : server.GetPostLoginCommands()) {
+		id += L"\nc" + command;
+	}
+	for (auto const& param : server.GetExtraParameters()) {
+		id += L"\np" + fz::to_wstring_from_utf8(param.first) + L"=" + param.second;
+	}
+	return fz::to_utf8(id);
+}
@@ -0,0 +1,108 @@
+#ifndef FILEZILLA_ENGINE_PERSISTENT_HEADER
+#define FILEZILLA_ENGINE_PERSISTENT_HEADER
+
+#include <libfilezilla/string.hpp>
+
+#include <server.h>
+
+#include <string>
+
+// Helpers for the caches kept on disk across sessions. Integers are
+// big-endian, strings are UTF-8 with a 32 bit length prefix.
+
+// Everything CServer::SameContent compares
+std::string ServerIdentity(CServer const& server);
+
+class PersistentWriter final
+{
+public:
+	void u8(uint8_t v)
+	{
+		data_ += static_cast<char>(v);
+	}
+
+	void u32(uint32_t v)
+	{
+		for (int i = 3; i >= 0; --i) {
+			u8(static_cast<uint8_t>(v >> (i * 8)));
+		}
+	}
+
+	void i64(int64_t v)
+	{
+		u32(static_cast<uint32_t>(static_cast<uint64_t>(v) >> 32));
+		u32(static_cast<uint32_t>(v));
+	}
+
+	void str(std::string const& v)
+	{
+		u32(static_cast<uint32_t>(v.size()));
+		data_ += v;
+	}
+
+	void str(std::wstring const& v)
+	{
+		str(fz::to_utf8(v));
+	}
+
+	std::string data_;
+};
+
+class PersistentReader final
+{
+public:
+	explicit PersistentReader(std::string const& data)
+		: data_(data)
+	{}
+
+	uint8_t u8()
+	{
+		if (pos_ >= data_.size()) {
+			error_ = true;
+			return 0;
+		}
+		return static_cast<uint8_t>(data_[pos_++]);
+	}
+
+	uint32_t u32()
+	{
+		uint32_t ret{};
+		for (int i = 0; i < 4; ++i) {
+			ret = (ret << 8) | u8();
+		}
+		return ret;
+	}
+
+	int64_t i64()
+	{
+		uint64_t ret = u32();
+		ret = (ret << 32) | u32();
+		return static_cast<int64_t>(ret);
+	}
+
+	std::string str()
+	{
+		uint32_t const len = u32();
+		if (data_.size() - pos_ < len) {
+			error_ = true;
+			return std::string();
+		}
+		std::string ret = data_.substr(pos_, len);
+		pos_ += len;
+		return ret;
+	}
+
+	std::wstring wstr()
+	{
+		return fz::to_wstring_from_utf8(str());
+	}
+
+	bool error() const { return error_; }
+
+private:
+	std::string const& data_;
+	size_t pos_{};
+	bool error_{};
+};
+
+#endif
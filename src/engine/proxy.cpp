@@ -34,8 +34,36 @@ CProxySocket::CProxySocket(fz::event_handler* pEvtHandler, fz::socket_interface
 	next_layer_.set_event_handler(this);
 }
 
+int CProxyHandshakeCache::GetSocks5Method(fz::native_string const& host, unsigned int port, std::string const& user)
+{
+	fz::scoped_lock l(mutex_);
+	auto const it = methods_.find(std::make_tuple(host, port, user));
+	return (it != methods_.cend()) ? it->second : -1;
+}
+
+void CProxyHandshakeCache::StoreSocks5Method(fz::native_string const& host, unsigned int port, std::string const& user, int method)
+{
+	fz::scoped_lock l(mutex_);
+	if (methods_.size() >= 64) {
+		// Only ever a handful of proxies are in use, this is garbage
+		methods_.clear();
+	}
+	methods_[std::make_tuple(host, port, user)] = method;
+}
+
+void CProxyHandshakeCache::Invalidate(fz::native_string const& host, unsigned int port, std::string const& user)
+{
+	fz::scoped_lock l(mutex_);
+	methods_.erase(std::make_tuple(host, port, user));
+}
+
 CProxySocket::~CProxySocket()
 {
+	if (pipelined_ && state_ != fz::socket_state::connected && state_ != fz::socket_state::shutting_down && state_ != fz::socket_state::shut_down) {
+		// Maybe the proxy did not like it, do not try again
+		m_pOwner->GetEngine().GetContext().GetProxyHandshakeCache().Invalidate(proxy_host_, proxy_port_, user_);
+	}
+
 	remove_handler();
 	next_layer_.set_event_handler(nullptr);
 }
@@ -156,18 +184,35 @@ int CProxySocket::connect(fz::native_string const& host, unsigned int port, fz::
 			return EINVAL;
 		}
 
-		unsigned char* out = sendBuffer_.get(4);
-		out[0] = 5; // Protocol version
-		if (!user_.empty()) {
-			out[1] = 2; // # auth methods supported
-			out[2] = 0; // Method: No auth
-			out[3] = 2; // Method: Username and password
-			sendBuffer_.add(4);
-		}
-		else {
+		int const method = m_pOwner->GetEngine().GetContext().GetProxyHandshakeCache().GetSocks5Method(proxy_host_, proxy_port_, user_);
+		if (method == 0 || (method == 2 && !user_.empty())) {
+			unsigned char* out = sendBuffer_.get(3);
+			out[0] = 5; // Protocol version
 			out[1] = 1; // # auth methods supported
-			out[2] = 0; // Method: No auth
+			out[2] = static_cast<unsigned char>(method);
 			sendBuffer_.add(3);
+			if (method == 2) {
+				AppendSocks5Auth();
+			}
+			AppendSocks5Request();
+			pipelined_ = true;
+			socks5Method_ = method;
+			m_pOwner->log(logmsg::debug_info, L"Sending SOCKS5 handshake without waiting for the replies");
+		}
+		else {
+			unsigned char* out = sendBuffer_.get(4);
+			out[0] = 5; // Protocol version
+			if (!user_.empty()) {
+				out[1] = 2; // # auth methods supported
+				out[2] = 0; // Method: No auth
+				out[3] = 2; // Method: Username and password
+				sendBuffer_.add(4);
+			}
+			else {
+				out[1] = 1; // # auth methods supported
+				out[2] = 0; // Method: No auth
+				sendBuffer_.add(3);
+			}
 		}
 
 		m_handshakeState = socks5_method;
@@ -265,6 +310,7 @@ void CProxySocket::OnReceive()
 		}
 		receiveBuffer_.add(read);
 
+		parse:
 		switch (m_handshakeState) {
 		case http_wait:
 			{
@@ -353,7 +399,7 @@ void CProxySocket::OnReceive()
 		case socks5_method:
 		case socks5_auth:
 		case socks5_request:
-			if (sendBuffer_) {
+			if (sendBuffer_ && !pipelined_) {
 				m_pOwner->log(logmsg::error, _("Proxy sent data while we haven't sent out request yet"));
 				state_ = fz::socket_state::failed;
 				if (event_handler_) {
@@ -393,6 +439,15 @@ void CProxySocket::OnReceive()
 						goto loop;
 					}
 					char const method = receiveBuffer_[1];
+					if (pipelined_ && method != socks5Method_) {
+						m_pOwner->log(logmsg::error, _("No supported SOCKS5 auth method"));
+						state_ = fz::socket_state::failed;
+						if (event_handler_) {
+							event_handler_->send_event<fz::socket_event>(this, fz::socket_event_flag::connection, ECONNABORTED);
+						}
+						return;
+					}
+					socks5Method_ = method;
 					switch (method)
 					{
 					case 0:
@@ -512,6 +567,9 @@ void CProxySocket::OnReceive()
 				}
 
 				// We're done
+				if (!pipelined_) {
+					m_pOwner->GetEngine().GetContext().GetProxyHandshakeCache().StoreSocks5Method(proxy_host_, proxy_port_, user_, socks5Method_);
+				}
 				state_ = fz::socket_state::connected;
 				if (event_handler_) {
 					event_handler_->send_event<fz::socket_event>(this, fz::socket_event_flag::connection, 0);
@@ -523,72 +581,21 @@ void CProxySocket::OnReceive()
 				break;
 			}
 
+			if (pipelined_) {
+				// The next reply may already be here, nothing left to send
+				if (receiveBuffer_) {
+					goto parse;
+				}
+				break;
+			}
+
 			switch (m_handshakeState)
 			{
 			case socks5_auth:
-				{
-					auto ulen = static_cast<unsigned char>(std::min(user_.size(), size_t(255)));
-					auto plen = static_cast<unsigned char>(std::min(pass_.size(), size_t(255)));
-					unsigned char* out = sendBuffer_.get(ulen + plen + 3);
-					out[0] = 1;
-					out[1] = ulen;
-					memcpy(out + 2, user_.c_str(), ulen);
-					out[ulen + 2] = plen;
-					memcpy(out + ulen + 3, pass_.c_str(), plen);
-					sendBuffer_.add(ulen + plen + 3);
-				}
+				AppendSocks5Auth();
 				break;
 			case socks5_request:
-				{
-					std::string host = fz::to_utf8(host_);
-					size_t addrlen = std::max(host.size(), size_t(16));
-
-					unsigned char * out = sendBuffer_.get(7 + addrlen);
-					out[0] = 5;
-					out[1] = 1; // CONNECT
-					out[2] = 0; // Reserved
-
-					auto const type = fz::get_address_type(host);
-					if (type == fz::address_type::ipv6) {
-						auto ipv6 = fz::get_ipv6_long_form(host);
-						addrlen = 16;
-						for (auto i = 0; i < 16; ++i) {
-							out[4 + i] = (fz::hex_char_to_int(ipv6[i * 2 + i / 2]) << 4) + fz::hex_char_to_int(ipv6[i * 2 + 1 + i / 2]);
-						}
-
-						out[3] = 4; // IPv6
-					}
-					else if (type == fz::address_type::ipv4) {
-						int i = 0;
-						memset(out + 4, 0, 4);
-						for (auto p = host.c_str(); *p && i < 4; ++p) {
-							auto const& c = *p;
-							if (c == '.') {
-								++i;
-								continue;
-							}
-							out[i + 4] *= 10;
-							out[i + 4] += c - '0';
-						}
-
-						addrlen = 4;
-
-						out[3] = 1; // IPv4
-					}
-					else {
-						out[3] = 3; // Domain name
-
-						auto hlen = static_cast<unsigned char>(std::min(host.size(), size_t(255)));
-						out[4] = hlen;
-						memcpy(out + 5, host.c_str(), hlen);
-						addrlen = hlen + 1;
-					}
-
-					out[addrlen + 4] = (port_ >> 8) & 0xFF; // Port in network order
-					out[addrlen + 5] = port_ & 0xFF;
-
-					sendBuffer_.add(6 + addrlen);
-				}
+				AppendSocks5Request();
 				break;
 			default:
 				assert(false);
@@ -609,6 +616,71 @@ void CProxySocket::OnReceive()
 	}
 }
 
+void CProxySocket::AppendSocks5Auth()
+{
+	auto ulen = static_cast<unsigned char>(std::min(user_.size(), size_t(255)));
+	auto plen = static_cast<unsigned char>(std::min(pass_.size(), size_t(255)));
+	unsigned char* out = sendBuffer_.get(ulen + plen + 3);
+	out[0] = 1;
+	out[1] = ulen;
+	memcpy(out + 2, user_.c_str(), ulen);
+	out[ulen + 2] = plen;
+	memcpy(out + ulen + 3, pass_.c_str(), plen);
+	sendBuffer_.add(ulen + plen + 3);
+}
+
+void CProxySocket::AppendSocks5Request()
+{
+	std::string host = fz::to_utf8(host_);
+	size_t addrlen = std::max(host.size(), size_t(16));
+
+	unsigned char * out = sendBuffer_.get(7 + addrlen);
+	out[0] = 5;
+	out[1] = 1; // CONNECT
+	out[2] = 0; // Reserved
+
+	auto const type = fz::get_address_type(host);
+	if (type == fz::address_type::ipv6) {
+		auto ipv6 = fz::get_ipv6_long_form(host);
+		addrlen = 16;
+		for (auto i = 0; i < 16; ++i) {
+			out[4 + i] = (fz::hex_char_to_int(ipv6[i * 2 + i / 2]) << 4) + fz::hex_char_to_int(ipv6[i * 2 + 1 + i / 2]);
+		}
+
+		out[3] = 4; // IPv6
+	}
+	else if (type == fz::address_type::ipv4) {
+		int i = 0;
+		memset(out + 4, 0, 4);
+		for (auto p = host.c_str(); *p && i < 4; ++p) {
+			auto const& c = *p;
+			if (c == '.') {
+				++i;
+				continue;
+			}
+			out[i + 4] *= 10;
+			out[i + 4] += c - '0';
+		}
+
+		addrlen = 4;
+
+		out[3] = 1; // IPv4
+	}
+	else {
+		out[3] = 3; // Domain name
+
+		auto hlen = static_cast<unsigned char>(std::min(host.size(), size_t(255)));
+		out[4] = hlen;
+		memcpy(out + 5, host.c_str(), hlen);
+		addrlen = hlen + 1;
+	}
+
+	out[addrlen + 4] = (port_ >> 8) & 0xFF; // Port in network order
+	out[addrlen + 5] = port_ & 0xFF;
+
+	sendBuffer_.add(6 + addrlen);
+}
+
 void CProxySocket::OnSend()
 {
 	m_can_write = true;
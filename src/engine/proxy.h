@@ -2,8 +2,13 @@
 #define FILEZILLA_ENGINE_PROXY_HEADER
 
 #include <libfilezilla/buffer.hpp>
+#include <libfilezilla/mutex.hpp>
 #include <libfilezilla/socket.hpp>
 
+#include <map>
+#include <string>
+#include <tuple>
+
 enum class ProxyType {
 	NONE,
 	HTTP,
@@ -13,6 +18,34 @@ enum class ProxyType {
 	count
 };
 
+// Remembers which authentication method SOCKS5 proxies picked, shared by
+// all engines. Once a proxy has accepted a connection, later connections to
+// it send method selection, credentials and the request in one go instead of
+// waiting for each reply in turn, one round trip instead of up to three.
+//
+// Proxies that do not cope with this simply fail the connection, the entry
+// gets dropped then and the next attempt waits for each reply again.
+class CProxyHandshakeCache final
+{
+public:
+	CProxyHandshakeCache() = default;
+
+	CProxyHandshakeCache(CProxyHandshakeCache const&) = delete;
+	CProxyHandshakeCache& operator=(CProxyHandshakeCache const&) = delete;
+
+	// Returns -1 if unknown
+	int GetSocks5Method(fz::native_string const& host, unsigned int port, std::string const& user);
+
+	void StoreSocks5Method(fz::native_string const& host, unsigned int port, std::string const& user, int method);
+
+	void Invalidate(fz::native_string const& host, unsigned int port, std::string const& user);
+
+private:
+	fz::mutex mutex_;
+
+	std::map<std::tuple<fz::native_string, unsigned int, std::string>, int> methods_;
+};
+
 class CControlSocket;
 class CProxySocket final : protected fz::event_handler, public fz::socket_layer
 {
@@ -65,6 +98,13 @@ protected:
 	void OnReceive();
 	void OnSend();
 
+	void AppendSocks5Auth();
+	void AppendSocks5Request();
+
+	// Set if the whole SOCKS5 handshake got sent upfront
+	bool pipelined_{};
+	int socks5Method_{-1};
+
 	bool m_can_write{};
 	bool m_can_read{};
 };
@@ -0,0 +1,174 @@
+#include <filezilla.h>
+
+#include "resume_journal.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/string.hpp>
+
+#include <algorithm>
+
+#ifndef FZ_WINDOWS
+#include <stdio.h>
+#endif
+
+namespace {
+char const journal_magic[] = "FileZilla resume journal 1";
+
+// Keeps a journal from becoming arbitrarily large through garbage
+int64_t const journal_max_file_size = 1024 * 1024;
+
+fz::mutex mutex;
+
+void merge(CResumeJournal::ranges & r)
+{
+	std::sort(r.begin(), r.end());
+
+	size_t out{};
+	for (size_t i = 0; i < r.size(); ++i) {
+		if (out && r[i].first <= r[out - 1].second) {
+			r[out - 1].second = std::max(r[out - 1].second, r[i].second);
+		}
+		else {
+			r[out++] = r[i];
+		}
+	}
+	r.resize(out);
+}
+
+bool read(std::wstring const& localFile, int64_t fileSize, CResumeJournal::ranges & done)
+{
+	done.clear();
+
+	if (fileSize <= 0 || fz::local_filesys::get_size(fz::to_native(localFile)) != fileSize) {
+		return false;
+	}
+
+	fz::file f(fz::to_native(CResumeJournal::GetJournalFile(localFile)), fz::file::reading);
+	if (!f.opened()) {
+		return false;
+	}
+
+	int64_t const size = f.size();
+	if (size <= 0 || size > journal_max_file_size) {
+		return false;
+	}
+
+	std::string data;
+	data.resize(static_cast<size_t>(size));
+	if (f.read(&data[0], size) != size) {
+		return false;
+	}
+
+	auto lines = fz::strtok(data, "\r\n");
+	if (lines.size() < 2 || lines[0] != journal_magic || fz::to_integral<int64_t>(lines[1], -1) != fileSize) {
+		return false;
+	}
+
+	for (size_t i = 2; i < lines.size(); ++i) {
+		auto const tokens = fz::strtok(lines[i], " ");
+		if (tokens.size() != 2) {
+			return false;
+		}
+		int64_t const begin = fz::to_integral<int64_t>(tokens[0], -1);
+		int64_t const end = fz::to_integral<int64_t>(tokens[1], -1);
+		if (begin < 0 || end <= begin || end > fileSize) {
+			return false;
+		}
+		done.emplace_back(begin, end);
+	}
+	merge(done);
+
+	return true;
+}
+
+bool write(std::wstring const& localFile, int64_t fileSize, CResumeJournal::ranges const& done)
+{
+	std::string data = std::string(journal_magic) + "\n" + std::to_string(fileSize) + "\n";
+	for (auto const& range : done) {
+		data += std::to_string(range.first) + " " + std::to_string(range.second) + "\n";
+	}
+
+	// Replaced in one go, an interruption must not leave a truncated journal behind
+	std::wstring const journal = CResumeJournal::GetJournalFile(localFile);
+	std::wstring const tmp = journal + L".tmp";
+	{
+		fz::file f(fz::to_native(tmp), fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.write(data.data(), static_cast<int64_t>(data.size())) != static_cast<int64_t>(data.size())) {
+			f.close();
+			fz::remove_file(fz::to_native(tmp));
+			return false;
+		}
+	}
+
+#ifdef FZ_WINDOWS
+	bool const renamed = MoveFileExW(tmp.c_str(), journal.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool const renamed = rename(fz::to_native(tmp).c_str(), fz::to_native(journal).c_str()) == 0;
+#endif
+	if (!renamed) {
+		fz::remove_file(fz::to_native(tmp));
+	}
+	return renamed;
+}
+}
+
+std::wstring CResumeJournal::GetJournalFile(std::wstring const& localFile)
+{
+	return localFile + L".fzjournal";
+}
+
+bool CResumeJournal::Load(std::wstring const& localFile, int64_t fileSize, ranges & done)
+{
+	fz::scoped_lock l(mutex);
+	return read(localFile, fileSize, done);
+}
+
+void CResumeJournal::AddRange(std::wstring const& localFile, int64_t fileSize, int64_t begin, int64_t end)
+{
+	if (begin < 0 || end <= begin || end > fileSize) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex);
+
+	// A missing or unusable journal starts over, whatever it contained is
+	// downloaded again anyhow.
+	ranges done;
+	read(localFile, fileSize, done);
+
+	done.emplace_back(begin, end);
+	merge(done);
+
+	if (done.size() == 1 && done[0].first == 0 && done[0].second == fileSize) {
+		fz::remove_file(fz::to_native(GetJournalFile(localFile)));
+	}
+	else {
+		write(localFile, fileSize, done);
+	}
+}
+
+void CResumeJournal::Remove(std::wstring const& localFile)
+{
+	fz::scoped_lock l(mutex);
+	fz::remove_file(fz::to_native(GetJournalFile(localFile)));
+}
+
+CResumeJournal::ranges CResumeJournal::GetMissing(ranges const& done, int64_t fileSize)
+{
+	ranges ret;
+
+	int64_t pos{};
+	for (auto const& range : done) {
+		if (range.first > pos) {
+			ret.emplace_back(pos, range.first);
+		}
+		pos = std::max(pos, range.second);
+	}
+	if (pos < fileSize) {
+		ret.emplace_back(pos, fileSize);
+	}
+
+	return ret;
+}
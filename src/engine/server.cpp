@@ -3,6 +3,8 @@
 #include <libfilezilla/format.hpp>
 #include <libfilezilla/uri.hpp>
 
+#include <algorithm>
+
 #include <assert.h>
 
 struct t_protocolInfo
@@ -103,7 +105,10 @@ std::wstring CServer::GetUser() const
 
 bool CServer::operator==(const CServer &op) const
 {
-	if (m_protocol != op.m_protocol) {
+	if (hash_ != op.hash_) {
+		return false;
+	}
+	else if (m_protocol != op.m_protocol) {
 		return false;
 	}
 	else if (m_type != op.m_type) {
@@ -149,6 +154,12 @@ bool CServer::operator==(const CServer &op) const
 
 bool CServer::operator<(const CServer &op) const
 {
+	// Only used for containers, there is no meaningful order to preserve.
+	// Ordering by the hash first lets most comparisons finish early.
+	if (hash_ != op.hash_) {
+		return hash_ < op.hash_;
+	}
+
 	if (m_protocol < op.m_protocol) {
 		return true;
 	}
@@ -239,6 +250,11 @@ bool CServer::operator!=(const CServer &op) const
 	return !(*this == op);
 }
 
+CServer::CServer()
+{
+	UpdateHash();
+}
+
 CServer::CServer(ServerProtocol protocol, ServerType type, std::wstring const& host, unsigned int port)
 {
 	m_protocol = protocol;
@@ -250,6 +266,19 @@ CServer::CServer(ServerProtocol protocol, ServerType type, std::wstring const& h
 	else {
 		m_port = GetDefaultPort(protocol);
 	}
+	UpdateHash();
+}
+
+void CServer::UpdateHash()
+{
+	size_t ret = std::hash<std::wstring>()(m_host);
+	auto const combine = [&ret](size_t v) {
+		ret ^= v + 0x9e3779b9 + (ret << 6) + (ret >> 2);
+	};
+	combine(std::hash<std::wstring>()(m_user));
+	combine(static_cast<size_t>(m_port));
+	combine(static_cast<size_t>(m_protocol));
+	hash_ = ret;
 }
 
 void CServer::SetType(ServerType type)
@@ -266,6 +295,7 @@ void CServer::SetProtocol(ServerProtocol serverProtocol)
 	}
 
 	m_protocol = serverProtocol;
+	UpdateHash();
 
 	// Clear out parameters not supported by the current protocol
 	std::map<std::string, std::wstring, std::less<>> oldParams;
@@ -291,6 +321,7 @@ bool CServer::SetHost(std::wstring const& host, unsigned int port)
 	if (m_protocol == UNKNOWN) {
 		m_protocol = GetProtocolFromPort(m_port);
 	}
+	UpdateHash();
 
 	return true;
 }
@@ -298,6 +329,7 @@ bool CServer::SetHost(std::wstring const& host, unsigned int port)
 void CServer::SetUser(std::wstring const& user)
 {
 	m_user = user;
+	UpdateHash();
 }
 
 bool CServer::SetTimezoneOffset(int minutes)
@@ -336,6 +368,17 @@ int CServer::MaximumMultipleConnections() const
 	return m_maximumMultipleConnections;
 }
 
+void CServer::SetSpeedLimits(int inbound, int outbound)
+{
+	m_speedLimits[0] = std::max(0, inbound);
+	m_speedLimits[1] = std::max(0, outbound);
+}
+
+void CServer::SetSourceAddress(std::wstring const& address)
+{
+	m_sourceAddress = address;
+}
+
 std::wstring CServer::Format(ServerFormat formatType) const
 {
 	return Format(formatType, Credentials());
@@ -574,7 +617,7 @@ bool CServer::ProtocolHasFeature(ServerProtocol const protocol, ProtocolFeature
 		}
 		break;
 	case ProtocolFeature::DirectoryRename:
-		if (protocol != AZURE_FILE) {
+		if (protocol != AZURE_FILE && protocol != STORJ) {
 			return true;
 		}
 		break;
@@ -604,6 +647,36 @@ bool CServer::ProtocolHasFeature(ServerProtocol const protocol, ProtocolFeature
 			return true;
 		}
 		break;
+	case ProtocolFeature::SegmentedDownload:
+		if (protocol == FTP || protocol == FTPS || protocol == FTPES || protocol == INSECURE_FTP ||
+			protocol == SFTP || protocol == HTTP || protocol == HTTPS) {
+			return true;
+		}
+		break;
+	case ProtocolFeature::UploadBatch:
+		if (protocol == SFTP) {
+			return true;
+		}
+		break;
+	case ProtocolFeature::FileHash:
+		if (protocol == FTP || protocol == FTPS || protocol == FTPES || protocol == INSECURE_FTP ||
+			protocol == SFTP) {
+			return true;
+		}
+		break;
+	case ProtocolFeature::ServerCopy:
+		if (protocol == SFTP) {
+			return true;
+		}
+		break;
+	case ProtocolFeature::ServerToServer:
+		if (protocol == FTP || protocol == FTPS || protocol == FTPES || protocol == INSECURE_FTP) {
+			return true;
+		}
+		break;
+	case ProtocolFeature::SourceAddress:
+		// fzsftp and fzstorj make their own connections
+		return protocol != SFTP && protocol != STORJ;
 	case ProtocolFeature::Security:
 		return protocol != HTTP && protocol != INSECURE_FTP && protocol != INSECURE_WEBDAV;
 	}
@@ -874,6 +947,18 @@ std::vector<ParameterTraits> const& ExtraServerParameterTraits(ServerProtocol pr
 			}();
 			return ret;
 		}
+	case FTP:
+	case FTPS:
+	case FTPES:
+	case INSECURE_FTP:
+		{
+			static std::vector<ParameterTraits> ret = []() {
+				std::vector<ParameterTraits> ret;
+				ret.emplace_back(ParameterTraits{"modez", ParameterSection::custom, ParameterTraits::optional, std::wstring(), std::wstring()});
+				return ret;
+			}();
+			return ret;
+		}
 	case GOOGLE_DRIVE:
 	case ONEDRIVE:
 	{
@@ -942,6 +1027,10 @@ bool CServer::SameResource(CServer const& other) const
 	// We include post-login commands as it may be used for things like the HOST command.
 	// We include proxy parameters as a hostname may resolve to different servers depending on whether a proxy is used.
 
+	if (hash_ != other.hash_) {
+		return false;
+	}
+
 	auto l = std::tie(m_protocol, m_host, m_port, m_user, m_postLoginCommands, m_bypassProxy, extraParameters_);
 	auto r = std::tie(other.m_protocol, other.m_host, other.m_port, other.m_user, other.m_postLoginCommands, other.m_bypassProxy, other.extraParameters_);
 
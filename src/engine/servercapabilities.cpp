@@ -1,9 +1,32 @@
 #include <filezilla.h>
 #include "servercapabilities.h"
+#include "persistent.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <vector>
 
 #include <assert.h>
 
-std::map<CServer, CCapabilities> CServerCapabilities::m_serverMap;
+namespace {
+// Persistent file format:
+//   "FZSC", version, number of servers
+//   per server: identity, time of last change in milliseconds since the epoch,
+//   number of capabilities
+//   per capability: name, capability, option, number
+char const persistent_magic[] = "FZSC";
+uint32_t const persistent_version = 1;
+int64_t const persistent_max_file_size = 16 * 1024 * 1024;
+wchar_t const persistent_name[] = L"capabilities.fzsc";
+
+fz::datetime const epoch(0, fz::datetime::milliseconds);
+}
+
+std::unordered_map<CServer, CCapabilities> CServerCapabilities::m_serverMap;
+std::unordered_map<std::string, CCapabilities> CServerCapabilities::persisted_;
+std::wstring CServerCapabilities::persistentDir_;
+fz::duration CServerCapabilities::persistentTtl_;
 fz::mutex CServerCapabilities::m_(false);
 
 capabilities CCapabilities::GetCapability(capabilityNames name, std::wstring* pOption) const
@@ -42,6 +65,7 @@ void CCapabilities::SetCapability(capabilityNames name, capabilities cap, std::w
 	tcap.number = 0;
 
 	m_capabilityMap[name] = tcap;
+	lastChanged_ = fz::datetime::now();
 }
 
 void CCapabilities::SetCapability(capabilityNames name, capabilities cap, int option)
@@ -53,58 +77,186 @@ void CCapabilities::SetCapability(capabilityNames name, capabilities cap, int op
 	tcap.number = option;
 
 	m_capabilityMap[name] = tcap;
+	lastChanged_ = fz::datetime::now();
+}
+
+void CCapabilities::Write(PersistentWriter & w) const
+{
+	w.i64((lastChanged_ - epoch).get_milliseconds());
+	w.u32(static_cast<uint32_t>(m_capabilityMap.size()));
+	for (auto const& cap : m_capabilityMap) {
+		w.u32(static_cast<uint32_t>(cap.first));
+		w.u8(static_cast<uint8_t>(cap.second.cap));
+		w.str(cap.second.option);
+		w.i64(cap.second.number);
+	}
+}
+
+bool CCapabilities::Read(PersistentReader & r)
+{
+	lastChanged_ = epoch + fz::duration::from_milliseconds(r.i64());
+	uint32_t const count = r.u32();
+	for (uint32_t i = 0; i < count && !r.error(); ++i) {
+		uint32_t const name = r.u32();
+		uint8_t const cap = r.u8();
+		t_cap tcap;
+		tcap.option = r.wstr();
+		tcap.number = static_cast<int>(r.i64());
+		if (name > auth_ssl_command || cap > no) {
+			return false;
+		}
+		tcap.cap = static_cast<capabilities>(cap);
+		m_capabilityMap[static_cast<capabilityNames>(name)] = tcap;
+	}
+	return !r.error();
+}
+
+CCapabilities* CServerCapabilities::Find(CServer const& server, bool create)
+{
+	auto const iter = m_serverMap.find(server);
+	if (iter != m_serverMap.end()) {
+		return &iter->second;
+	}
+
+	if (!persisted_.empty()) {
+		auto const pit = persisted_.find(ServerIdentity(server));
+		if (pit != persisted_.end()) {
+			CCapabilities & capabilities = m_serverMap[server];
+			capabilities = std::move(pit->second);
+			persisted_.erase(pit);
+			return &capabilities;
+		}
+	}
+
+	if (!create) {
+		return nullptr;
+	}
+	return &m_serverMap[server];
 }
 
 capabilities CServerCapabilities::GetCapability(const CServer& server, capabilityNames name, std::wstring* pOption)
 {
 	fz::scoped_lock l(m_);
 
-	const std::map<CServer, CCapabilities>::const_iterator iter = m_serverMap.find(server);
-	if (iter == m_serverMap.end()) {
+	CCapabilities const* capabilities = Find(server, false);
+	if (!capabilities) {
 		return unknown;
 	}
 
-	return iter->second.GetCapability(name, pOption);
+	return capabilities->GetCapability(name, pOption);
 }
 
 capabilities CServerCapabilities::GetCapability(const CServer& server, capabilityNames name, int* pOption)
 {
 	fz::scoped_lock l(m_);
 
-	const std::map<CServer, CCapabilities>::const_iterator iter = m_serverMap.find(server);
-	if (iter == m_serverMap.end()) {
+	CCapabilities const* capabilities = Find(server, false);
+	if (!capabilities) {
 		return unknown;
 	}
 
-	return iter->second.GetCapability(name, pOption);
+	return capabilities->GetCapability(name, pOption);
 }
 
 void CServerCapabilities::SetCapability(const CServer& server, capabilityNames name, capabilities cap, std::wstring const& option)
 {
 	fz::scoped_lock l(m_);
 
-	const std::map<CServer, CCapabilities>::iterator iter = m_serverMap.find(server);
-	if (iter == m_serverMap.end()) {
-		CCapabilities capabilities;
-		capabilities.SetCapability(name, cap, option);
-		m_serverMap[server] = capabilities;
+	Find(server, true)->SetCapability(name, cap, option);
+}
+
+void CServerCapabilities::SetCapability(const CServer& server, capabilityNames name, capabilities cap, int option)
+{
+	fz::scoped_lock l(m_);
+
+	Find(server, true)->SetCapability(name, cap, option);
+}
+
+void CServerCapabilities::SetPersistentDirectory(std::wstring const& dir, fz::duration const& ttl)
+{
+	fz::scoped_lock l(m_);
+
+	persistentDir_ = dir;
+	if (!persistentDir_.empty() && persistentDir_.back() != fz::local_filesys::path_separator) {
+		persistentDir_ += fz::local_filesys::path_separator;
+	}
+	persistentTtl_ = ttl;
+	persisted_.clear();
+
+	fz::file f(fz::to_native(persistentDir_ + persistent_name), fz::file::reading);
+	if (!f.opened()) {
 		return;
 	}
 
-	iter->second.SetCapability(name, cap, option);
+	int64_t const size = f.size();
+	if (size <= 0 || size > persistent_max_file_size) {
+		return;
+	}
+
+	std::string data;
+	data.resize(static_cast<size_t>(size));
+	if (f.read(&data[0], size) != size) {
+		return;
+	}
+
+	PersistentReader r(data);
+	if (r.str() != persistent_magic || r.u32() != persistent_version) {
+		return;
+	}
+
+	auto const now = fz::datetime::now();
+	uint32_t const count = r.u32();
+	for (uint32_t i = 0; i < count && !r.error(); ++i) {
+		std::string identity = r.str();
+		CCapabilities capabilities;
+		if (!capabilities.Read(r)) {
+			break;
+		}
+		if (now - capabilities.LastChanged() < persistentTtl_) {
+			persisted_[std::move(identity)] = std::move(capabilities);
+		}
+	}
 }
 
-void CServerCapabilities::SetCapability(const CServer& server, capabilityNames name, capabilities cap, int option)
+void CServerCapabilities::SavePersistent()
 {
 	fz::scoped_lock l(m_);
 
-	const std::map<CServer, CCapabilities>::iterator iter = m_serverMap.find(server);
-	if (iter == m_serverMap.end()) {
-		CCapabilities capabilities;
-		capabilities.SetCapability(name, cap, option);
-		m_serverMap[server] = capabilities;
+	if (persistentDir_.empty()) {
 		return;
 	}
 
-	iter->second.SetCapability(name, cap, option);
+	auto const now = fz::datetime::now();
+	auto const fresh = [&](CCapabilities const& capabilities) {
+		return !capabilities.LastChanged().empty() && now - capabilities.LastChanged() < persistentTtl_;
+	};
+
+	std::vector<std::pair<std::string, CCapabilities const*>> servers;
+	for (auto const& server : m_serverMap) {
+		if (fresh(server.second)) {
+			servers.emplace_back(ServerIdentity(server.first), &server.second);
+		}
+	}
+	for (auto const& server : persisted_) {
+		if (fresh(server.second)) {
+			servers.emplace_back(server.first, &server.second);
+		}
+	}
+
+	PersistentWriter w;
+	w.str(std::string(persistent_magic));
+	w.u32(persistent_version);
+	w.u32(static_cast<uint32_t>(servers.size()));
+	for (auto const& server : servers) {
+		w.str(server.first);
+		server.second->Write(w);
+	}
+
+	fz::mkdir(fz::to_native(persistentDir_), true, true);
+	fz::native_string const file = fz::to_native(persistentDir_ + persistent_name);
+	fz::file f(file, fz::file::writing, fz::file::empty);
+	if (!f.opened() || f.write(w.data_.c_str(), static_cast<int64_t>(w.data_.size())) != static_cast<int64_t>(w.data_.size())) {
+		f.close();
+		fz::remove_file(file);
+	}
 }
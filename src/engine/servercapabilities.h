@@ -2,10 +2,15 @@
 #define FILEZILLA_ENGINE_SERVERCAPABILITIES_HEADER
 
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
 
 #include <server.h>
 
 #include <map>
+#include <unordered_map>
+
+class PersistentReader;
+class PersistentWriter;
 
 enum capabilities
 {
@@ -34,6 +39,11 @@ enum capabilityNames
 	list_hidden_support, // LIST -a command
 	rest_stream, // supports REST+STOR in addition to APPE
 	epsv_command,
+	command_pipelining, // set to 'no' if the server mishandles several commands in flight
+	hash_command, // HASH command, option is the list of algorithms from the FEAT reply
+	xsha1_command,
+	xmd5_command,
+	xcrc_command,
 
 	// Server timezone offset. If using FTP, LIST details are unspecified and
 	// can return different times than the UTC based times using the MLST or
@@ -55,6 +65,12 @@ public:
 	void SetCapability(capabilityNames name, capabilities cap, std::wstring const& option = std::wstring());
 	void SetCapability(capabilityNames name, capabilities cap, int option);
 
+	// When something was last learned about the server
+	fz::datetime const& LastChanged() const { return lastChanged_; }
+
+	void Write(PersistentWriter & w) const;
+	bool Read(PersistentReader & r);
+
 protected:
 	struct t_cap
 	{
@@ -63,6 +79,8 @@ protected:
 		int number{};
 	};
 	std::map<capabilityNames, t_cap> m_capabilityMap;
+
+	fz::datetime lastChanged_;
 };
 
 class CServerCapabilities final
@@ -75,8 +93,23 @@ public:
 	static void SetCapability(const CServer& server, capabilityNames name, capabilities cap, std::wstring const& option = std::wstring());
 	static void SetCapability(const CServer& server, capabilityNames name, capabilities cap, int option);
 
+	// Loads the capabilities learned in earlier sessions from the given
+	// directory, SavePersistent writes them back. Those not updated within
+	// the ttl are discarded, so that changes of the server take effect
+	// eventually.
+	static void SetPersistentDirectory(std::wstring const& dir, fz::duration const& ttl);
+	static void SavePersistent();
+
 protected:
-	static std::map<CServer, CCapabilities> m_serverMap;
+	static CCapabilities* Find(CServer const& server, bool create);
+
+	static std::unordered_map<CServer, CCapabilities> m_serverMap;
+
+	// Loaded from the persistent file, keyed by server identity. Moved to
+	// m_serverMap on first use of the server.
+	static std::unordered_map<std::string, CCapabilities> persisted_;
+	static std::wstring persistentDir_;
+	static fz::duration persistentTtl_;
 
 	static fz::mutex m_;
 };
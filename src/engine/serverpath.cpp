@@ -30,17 +30,111 @@ static const CServerTypeTraits traits[SERVERTYPE_MAX] = {
 	{ L"/\\", false,    0,    0,    false, 0, 0,   true,  false } // DOS with forwardslashes
 };
 
+namespace {
+typedef std::shared_ptr<CServerPathSegment const> segment_ptr;
+
+size_t combine_hash(size_t seed, size_t v)
+{
+	return seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+segment_ptr push_segment(segment_ptr const& parent, std::wstring && name)
+{
+	return std::make_shared<CServerPathSegment const>(parent, std::move(name));
+}
+
+// The last segment of the chain ending in s that has the given depth
+segment_ptr ancestor(segment_ptr const& s, size_t depth)
+{
+	if (!depth || !s) {
+		return segment_ptr();
+	}
+	if (s->depth_ <= depth) {
+		return s;
+	}
+
+	CServerPathSegment const* p = s.get();
+	while (p->parent_->depth_ > depth) {
+		p = p->parent_.get();
+	}
+	return p->parent_;
+}
+
+CServerPathSegment const* ancestor(CServerPathSegment const* s, size_t depth)
+{
+	while (s && s->depth_ > depth) {
+		s = s->parent_.get();
+	}
+	return s;
+}
+
+// From the first to the last segment
+std::vector<CServerPathSegment const*> chain(segment_ptr const& last)
+{
+	std::vector<CServerPathSegment const*> ret(last ? last->depth_ : 0);
+	CServerPathSegment const* s = last.get();
+	for (size_t i = ret.size(); i-- > 0; s = s->parent_.get()) {
+		ret[i] = s;
+	}
+	return ret;
+}
+
+// Both chains must have the same depth. Stops as soon as both share
+// their remaining segments.
+bool chains_equal(CServerPathSegment const* a, CServerPathSegment const* b, bool cmpNoCase)
+{
+	while (a != b) {
+		if (cmpNoCase) {
+			if (fz::stricmp(a->name_, b->name_)) {
+				return false;
+			}
+		}
+		else if (a->hash_ != b->hash_ || a->name_ != b->name_) {
+			return false;
+		}
+		a = a->parent_.get();
+		b = b->parent_.get();
+	}
+	return true;
+}
+
+// Compares the segments of chains with the same depth from the first one
+// on, the first differing segment decides.
+template<typename Cmp>
+int compare_chains(CServerPathSegment const* a, CServerPathSegment const* b, Cmp const& cmp)
+{
+	int res = 0;
+	while (a != b) {
+		int const c = cmp(a->name_, b->name_);
+		if (c) {
+			res = c;
+		}
+		a = a->parent_.get();
+		b = b->parent_.get();
+	}
+	return res;
+}
+}
+
+CServerPathSegment::CServerPathSegment(std::shared_ptr<CServerPathSegment const> const& parent, std::wstring && name)
+	: parent_(parent)
+	, name_(std::move(name))
+	, depth_(parent ? parent->depth_ + 1 : 1)
+	, hash_(combine_hash(parent ? parent->hash_ : 0, std::hash<std::wstring>()(name_)))
+{
+}
+
 bool CServerPathData::operator==(CServerPathData const& cmp) const
 {
 	if (m_prefix != cmp.m_prefix) {
 		return false;
 	}
 
-	if (m_segments != cmp.m_segments) {
+	if (SegmentCount() != cmp.SegmentCount()) {
 		return false;
 	}
 
-	return true;
+	return chains_equal(m_last.get(), cmp.m_last.get(), false);
 }
 
 CServerPath::CServerPath()
@@ -149,13 +243,14 @@ std::wstring CServerPath::GetPath() const
 	if (traits[m_type].left_enclosure != 0) {
 		path += traits[m_type].left_enclosure;
 	}
-	if (data.m_segments.empty() && (!traits[m_type].has_root || !data.m_prefix || traits[m_type].separator_after_prefix)) {
+	if (!data.m_last && (!traits[m_type].has_root || !data.m_prefix || traits[m_type].separator_after_prefix)) {
 		path += traits[m_type].separators[0];
 	}
 
-	for (auto iter = data.m_segments.cbegin(); iter != data.m_segments.cend(); ++iter) {
-		std::wstring const& segment = *iter;
-		if (iter != data.m_segments.cbegin()) {
+	auto const segments = chain(data.m_last);
+	for (auto iter = segments.cbegin(); iter != segments.cend(); ++iter) {
+		std::wstring const& segment = (*iter)->name_;
+		if (iter != segments.cbegin()) {
 			path += traits[m_type].separators[0];
 		}
 		else if (traits[m_type].has_root) {
@@ -184,7 +279,7 @@ std::wstring CServerPath::GetPath() const
 
 	// DOS is strange.
 	// C: is current working dir on drive C, C:\ the drive root.
-	if ((m_type == DOS || m_type == DOS_FWD_SLASHES) && data.m_segments.size() == 1) {
+	if ((m_type == DOS || m_type == DOS_FWD_SLASHES) && data.SegmentCount() == 1) {
 		path += traits[m_type].separators[0];
 	}
 
@@ -198,10 +293,10 @@ bool CServerPath::HasParent() const
 	}
 
 	if (!traits[m_type].has_root) {
-		return m_data->m_segments.size() > 1;
+		return m_data->SegmentCount() > 1;
 	}
 
-	return !m_data->m_segments.empty();
+	return m_data->SegmentCount() != 0;
 }
 
 CServerPath CServerPath::GetParent() const
@@ -218,7 +313,7 @@ CServerPath& CServerPath::MakeParent()
 	}
 	else {
 		CServerPathData& data = m_data.get();
-		data.m_segments.pop_back();
+		data.m_last = data.m_last->parent_;
 
 		if (m_type == MVS) {
 			data.m_prefix = fz::sparse_optional<std::wstring>(L".");
@@ -234,13 +329,7 @@ std::wstring CServerPath::GetFirstSegment() const
 		return std::wstring();
 	}
 
-	CServerPathData const& data = *m_data;
-	if (!data.m_segments.empty()) {
-		return data.m_segments.front();
-	}
-	else {
-		return std::wstring();
-	}
+	return ancestor(m_data->m_last.get(), 1)->name_;
 }
 
 std::wstring CServerPath::GetLastSegment() const
@@ -249,13 +338,7 @@ std::wstring CServerPath::GetLastSegment() const
 		return std::wstring();
 	}
 
-	CServerPathData const& data = *m_data;
-	if (!data.m_segments.empty()) {
-		return data.m_segments.back();
-	}
-	else {
-		return std::wstring();
-	}
+	return m_data->m_last->name_;
 }
 
 // libc sprintf can be so slow at times...
@@ -291,8 +374,9 @@ std::wstring CServerPath::GetSafePath() const
 
 	auto const& data = *m_data;
 	len += data.m_prefix ? data.m_prefix->size() : 0;
-	for (auto const& segment : data.m_segments) {
-		len += segment.size() + 2 + INTLENGTH;
+	auto const segments = chain(data.m_last);
+	for (auto const* segment : segments) {
+		len += segment->name_.size() + 2 + INTLENGTH;
 	}
 
 	std::wstring safepath;
@@ -310,12 +394,12 @@ std::wstring CServerPath::GetSafePath() const
 		t += data.m_prefix->size();
 	}
 
-	for (auto const& segment : data.m_segments) {
+	for (auto const* segment : segments) {
 		*(t++) = ' ';
-		t = fast_sprint_number(t, segment.size());
+		t = fast_sprint_number(t, segment->name_.size());
 		*(t++) = ' ';
-		tstrcpy(t, segment.c_str());
-		t += segment.size();
+		tstrcpy(t, segment->name_.c_str());
+		t += segment->name_.size();
 	}
 	safepath.resize(t - start);
 	safepath.shrink_to_fit();
@@ -337,7 +421,7 @@ bool CServerPath::DoSetSafePath(std::wstring const& path)
 {
 	CServerPathData& data = m_data.get();
 	data.m_prefix.clear();
-	data.m_segments.clear();
+	data.m_last.reset();
 
 	// Optimized for speed, avoid expensive wxString functions
 	// Before the optimization this function was responsible for
@@ -423,7 +507,7 @@ bool CServerPath::DoSetSafePath(std::wstring const& path)
 		if (segment_len > end - p) {
 			return false;
 		}
-		data.m_segments.emplace_back(p, p + segment_len);
+		data.m_last = push_segment(data.m_last, std::wstring(p, p + segment_len));
 
 		p += segment_len + 1;
 	}
@@ -486,30 +570,12 @@ bool CServerPath::IsSubdirOf(CServerPath const& path, bool cmpNoCase, bool allow
 		return false;
 	}
 
-	auto iter1 = ld.m_segments.cbegin();
-	auto iter2 = rd.m_segments.cbegin();
-	while (iter1 != ld.m_segments.cend()) {
-		if (iter2 == rd.m_segments.cend()) {
-			return true;
-		}
-		if (cmpNoCase) {
-			if (fz::stricmp(*iter1, *iter2)) {
-				return false;
-			}
-		}
-		else if (*iter1 != *iter2) {
-			return false;
-		}
-
-		++iter1;
-		++iter2;
-	}
-
-	if (allowEqual && iter2 == rd.m_segments.cend()) {
-		return true;
+	size_t const depth = rd.SegmentCount();
+	if (ld.SegmentCount() < depth || (ld.SegmentCount() == depth && !allowEqual)) {
+		return false;
 	}
 
-	return false;
+	return chains_equal(ancestor(ld.m_last.get(), depth), rd.m_last.get(), cmpNoCase);
 }
 
 bool CServerPath::IsParentOf(CServerPath const& path, bool cmpNoCase, bool allowEqual) const
@@ -591,13 +657,13 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 				}
 				dir = dir.substr(pos1 + 1);
 
-				data.m_segments.clear();
+				data.m_last.reset();
 			}
 
-			if (!Segmentize(dir, data.m_segments)) {
+			if (!Segmentize(dir, data.m_last)) {
 				return false;
 			}
-			if (data.m_segments.empty() && was_empty) {
+			if (!data.m_last && was_empty) {
 				return false;
 			}
 		}
@@ -616,16 +682,14 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 			}
 
 			if (is_absolute) {
-				data.m_segments.clear();
+				data.m_last.reset();
 			}
 			else if (IsSeparator(dir[0])) {
 				// Drive-relative path
-				if (data.m_segments.empty()) {
+				if (!data.m_last) {
 					return false;
 				}
-				std::wstring first = data.m_segments.front();
-				data.m_segments.clear();
-				data.m_segments.push_back(first);
+				data.m_last = ancestor(data.m_last, 1);
 				dir = dir.substr(1);
 			}
 			// else: Any other relative path
@@ -634,10 +698,10 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 				return false;
 			}
 
-			if (!Segmentize(dir, data.m_segments)) {
+			if (!Segmentize(dir, data.m_last)) {
 				return false;
 			}
-			if (data.m_segments.empty() && was_empty) {
+			if (!data.m_last && was_empty) {
 				return false;
 			}
 		}
@@ -673,7 +737,7 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 
 			dir = dir.substr(1, dir.size() - 2);
 
-			data.m_segments.clear();
+			data.m_last.reset();
 		}
 		else if (dir.back() == traits[m_type].right_enclosure) {
 			return false;
@@ -723,23 +787,23 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 			}
 		}
 
-		if (!Segmentize(dir, data.m_segments)) {
+		if (!Segmentize(dir, data.m_last)) {
 			return false;
 		}
 		break;
 	case HPNONSTOP:
 		if (dir[0] == '\\') {
-			data.m_segments.clear();
+			data.m_last.reset();
 		}
 
 		if (isFile && !ExtractFile(dir, file)) {
 			return false;
 		}
 
-		if (!Segmentize(dir, data.m_segments)) {
+		if (!Segmentize(dir, data.m_last)) {
 			return false;
 		}
-		if (data.m_segments.empty() && was_empty) {
+		if (!data.m_last && was_empty) {
 			return false;
 		}
 
@@ -759,14 +823,14 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 				data.m_prefix = fz::sparse_optional<std::wstring>(dir.substr(0, colon2 + 1));
 				dir = dir.substr(colon2 + 1);
 
-				data.m_segments.clear();
+				data.m_last.reset();
 			}
 
 			if (isFile && !ExtractFile(dir, file)) {
 				return false;
 			}
 
-			if (!Segmentize(dir, data.m_segments)) {
+			if (!Segmentize(dir, data.m_last)) {
 				return false;
 			}
 		}
@@ -774,7 +838,7 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 	case CYGWIN:
 		{
 			if (IsSeparator(dir[0])) {
-				data.m_segments.clear();
+				data.m_last.reset();
 				data.m_prefix.clear();
 			}
 			else if (was_empty) {
@@ -789,7 +853,7 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 				return false;
 			}
 
-			if (!Segmentize(dir, data.m_segments)) {
+			if (!Segmentize(dir, data.m_last)) {
 				return false;
 			}
 		}
@@ -797,7 +861,7 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 	default:
 		{
 			if (IsSeparator(dir[0])) {
-				data.m_segments.clear();
+				data.m_last.reset();
 			}
 			else if (was_empty) {
 				return false;
@@ -807,14 +871,14 @@ bool CServerPath::DoChangePath(std::wstring &subdir, bool isFile)
 				return false;
 			}
 
-			if (!Segmentize(dir, data.m_segments)) {
+			if (!Segmentize(dir, data.m_last)) {
 				return false;
 			}
 		}
 		break;
 	}
 
-	if (!traits[m_type].has_root && data.m_segments.empty()) {
+	if (!traits[m_type].has_root && !data.m_last) {
 		return false;
 	}
 
@@ -878,22 +942,15 @@ bool CServerPath::operator<(CServerPath const& op) const
 		return true;
 	}
 
-	tConstSegmentIter iter1, iter2;
-	for (iter1 = ld.m_segments.cbegin(), iter2 = rd.m_segments.cbegin(); iter1 != ld.m_segments.cend(); ++iter1, ++iter2) {
-		if (iter2 == rd.m_segments.cend()) {
-			return false;
-		}
-
-		const int cmp = std::wcscmp(iter1->c_str(), iter2->c_str());
-		if (cmp < 0) {
-			return true;
-		}
-		if (cmp > 0) {
-			return false;
-		}
+	size_t const depth = std::min(ld.SegmentCount(), rd.SegmentCount());
+	int const cmp = compare_chains(ancestor(ld.m_last.get(), depth), ancestor(rd.m_last.get(), depth), [](std::wstring const& lhs, std::wstring const& rhs) {
+		return std::wcscmp(lhs.c_str(), rhs.c_str());
+	});
+	if (cmp) {
+		return cmp < 0;
 	}
 
-	return iter2 != rd.m_segments.cend();
+	return ld.SegmentCount() < rd.SegmentCount();
 }
 
 std::wstring CServerPath::FormatFilename(std::wstring const& filename, bool omitPath) const
@@ -913,7 +970,7 @@ std::wstring CServerPath::FormatFilename(std::wstring const& filename, bool omit
 
 	switch (m_type) {
 		case VXWORKS:
-			if (!result.empty() && !IsSeparator(result.back()) && !m_data->m_segments.empty()) {
+			if (!result.empty() && !IsSeparator(result.back()) && m_data->m_last) {
 				result += traits[m_type].separators[0];
 			}
 			break;
@@ -960,23 +1017,16 @@ int CServerPath::CmpNoCase(CServerPath const& op) const
 		return 1;
 	}
 
-	if (ld.m_segments.size() > rd.m_segments.size()) {
+	if (ld.SegmentCount() > rd.SegmentCount()) {
 		return 1;
 	}
-	else if (ld.m_segments.size() < rd.m_segments.size()) {
+	else if (ld.SegmentCount() < rd.SegmentCount()) {
 		return -1;
 	}
 
-	auto iter = ld.m_segments.cbegin();
-	auto iter2 = rd.m_segments.cbegin();
-	while (iter != ld.m_segments.cend()) {
-		int res = fz::stricmp(*(iter++), *(iter2++));
-		if (res) {
-			return res;
-		}
-	}
-
-	return 0;
+	return compare_chains(ld.m_last.get(), rd.m_last.get(), [](std::wstring const& lhs, std::wstring const& rhs) {
+		return fz::stricmp(lhs, rhs);
+	});
 }
 
 bool CServerPath::AddSegment(std::wstring const& segment)
@@ -986,7 +1036,8 @@ bool CServerPath::AddSegment(std::wstring const& segment)
 	}
 
 	// TODO: Check for invalid characters
-	m_data.get().m_segments.push_back(segment);
+	CServerPathData& data = m_data.get();
+	data.m_last = push_segment(data.m_last, std::wstring(segment));
 
 	return true;
 }
@@ -1032,8 +1083,10 @@ CServerPath CServerPath::GetCommonParent(CServerPath const& path) const
 
 	CServerPathData& parentData = parent.m_data.get();
 
-	auto last = ld.m_segments.cend();
-	auto last2 = rd.m_segments.cend();
+	auto const segments = chain(ld.m_last);
+	auto const segments2 = chain(rd.m_last);
+	size_t last = segments.size();
+	size_t last2 = segments2.size();
 	if (traits[m_type].prefixmode == 1) {
 		if (!ld.m_prefix) {
 			--last;
@@ -1047,24 +1100,20 @@ CServerPath CServerPath::GetCommonParent(CServerPath const& path) const
 		parentData.m_prefix = ld.m_prefix;
 	}
 
-	auto iter = ld.m_segments.cbegin();
-	auto iter2 = rd.m_segments.cbegin();
-	while (iter != last && iter2 != last2) {
-		if (*iter != *iter2) {
-			if (!traits[m_type].has_root && parentData.m_segments.empty()) {
+	size_t i = 0;
+	while (i < last && i < last2) {
+		if (segments[i] != segments2[i] && segments[i]->name_ != segments2[i]->name_) {
+			if (!traits[m_type].has_root && !i) {
 				return CServerPath();
 			}
-			else {
-				return parent;
-			}
+			break;
 		}
-
-		parentData.m_segments.push_back(*iter);
-
-		++iter;
-		++iter2;
+		++i;
 	}
 
+	// The common parent shares the segments of this path
+	parentData.m_last = ancestor(ld.m_last, i);
+
 	return parent;
 }
 
@@ -1080,15 +1129,15 @@ std::wstring CServerPath::FormatSubdir(std::wstring const& subdir) const
 	return res;
 }
 
-bool CServerPath::SegmentizeAddSegment(std::wstring & segment, tSegmentList& segments, bool& append)
+bool CServerPath::SegmentizeAddSegment(std::wstring & segment, tSegmentPtr& last, bool& append)
 {
 	if (traits[m_type].has_dots) {
 		if (segment == L".") {
 			return true;
 		}
 		else if (segment == L"..") {
-			if (!segments.empty()) {
-				segments.pop_back();
+			if (last) {
+				last = last->parent_;
 			}
 			return true;
 		}
@@ -1101,10 +1150,10 @@ bool CServerPath::SegmentizeAddSegment(std::wstring & segment, tSegmentList& seg
 	}
 
 	if (append) {
-		segments.back() += segment;
+		last = push_segment(last->parent_, last->name_ + segment);
 	}
 	else {
-		segments.push_back(std::move(segment));
+		last = push_segment(last, std::move(segment));
 	}
 
 	append = append_next;
@@ -1112,7 +1161,7 @@ bool CServerPath::SegmentizeAddSegment(std::wstring & segment, tSegmentList& seg
 	return true;
 }
 
-bool CServerPath::Segmentize(std::wstring const& str, tSegmentList& segments)
+bool CServerPath::Segmentize(std::wstring const& str, tSegmentPtr& last)
 {
 	bool append = false;
 	size_t start = 0;
@@ -1131,14 +1180,14 @@ bool CServerPath::Segmentize(std::wstring const& str, tSegmentList& segments)
 		std::wstring segment = str.substr(start, pos - start);
 		start = pos + 1;
 
-		if (!SegmentizeAddSegment(segment, segments, append)) {
+		if (!SegmentizeAddSegment(segment, last, append)) {
 			return false;
 		}
 	}
 
 	if (start < str.size()) {
 		std::wstring segment = str.substr(start);
-		if (!SegmentizeAddSegment(segment, segments, append)) {
+		if (!SegmentizeAddSegment(segment, last, append)) {
 			return false;
 		}
 	}
@@ -1180,7 +1229,41 @@ void CServerPath::EscapeSeparators(ServerType type, std::wstring& subdir)
 
 size_t CServerPath::SegmentCount() const
 {
-	return empty() ? 0 : m_data->m_segments.size();
+	return empty() ? 0 : m_data->SegmentCount();
+}
+
+std::wstring const& CServerPath::GetSegment(size_t index) const
+{
+	return ancestor(m_data->m_last.get(), index + 1)->name_;
+}
+
+std::vector<std::wstring const*> CServerPath::GetSegments() const
+{
+	std::vector<std::wstring const*> ret;
+	if (!empty()) {
+		auto const segments = chain(m_data->m_last);
+		ret.reserve(segments.size());
+		for (auto const* s : segments) {
+			ret.push_back(&s->name_);
+		}
+	}
+	return ret;
+}
+
+size_t CServerPath::Hash() const
+{
+	if (empty()) {
+		return 0;
+	}
+
+	size_t ret = static_cast<size_t>(m_type);
+	if (m_data->m_prefix) {
+		ret = combine_hash(ret, std::hash<std::wstring>()(*m_data->m_prefix));
+	}
+	if (m_data->m_last) {
+		ret = combine_hash(ret, m_data->m_last->hash_);
+	}
+	return ret;
 }
 
 bool CServerPath::IsSeparator(wchar_t c) const
@@ -1202,3 +1285,42 @@ CServerPath CServerPath::GetChanged(CServerPath const& oldPath, CServerPath cons
 	}
 	return ret;
 }
+
+CServerPath CServerPathInterner::Intern(CServerPath const& path)
+{
+	if (path.empty() || !path.m_data->m_last) {
+		return path;
+	}
+
+	segment_ptr const& last = path.m_data->m_last;
+
+	// Parents of interned segments are interned as well
+	auto it = segments_.find(std::make_pair(last->parent_.get(), last->name_));
+	if (it != segments_.end() && it->second == last) {
+		return path;
+	}
+
+	std::vector<segment_ptr> original(last->depth_);
+	segment_ptr s = last;
+	for (size_t i = original.size(); i-- > 0; s = s->parent_) {
+		original[i] = s;
+	}
+
+	segment_ptr interned;
+	for (auto const& segment : original) {
+		auto & entry = segments_[std::make_pair(interned.get(), segment->name_)];
+		if (!entry) {
+			if (segment->parent_ == interned) {
+				entry = segment;
+			}
+			else {
+				entry = push_segment(interned, std::wstring(segment->name_));
+			}
+		}
+		interned = entry;
+	}
+
+	CServerPath ret(path);
+	ret.m_data.get().m_last = interned;
+	return ret;
+}
@@ -3,6 +3,8 @@
 #include "chmod.h"
 #include "../directorycache.h"
 
+#include <algorithm>
+
 enum chmodStates
 {
 	chmod_init,
@@ -10,20 +12,57 @@ enum chmodStates
 	chmod_chmod
 };
 
+namespace {
+// Keeps the command line to fzsftp at a sensible length
+size_t const max_batch_files = 1000;
+
+bool IsNumeric(std::wstring const& permission)
+{
+	return !permission.empty() && permission.find_first_not_of(L"01234567") == std::wstring::npos;
+}
+}
+
+CSftpChmodOpData::CSftpChmodOpData(CSftpControlSocket & controlSocket, CChmodCommand const& command)
+	: COpData(Command::chmod, L"CSftpChmodOpData")
+	, CSftpOpData(controlSocket)
+	, path_(command.GetPath())
+	, files_(command.GetFiles())
+{
+	if (files_.size() > 1) {
+		batch_ = std::all_of(files_.cbegin(), files_.cend(), [](auto const& file) { return IsNumeric(file.second); });
+	}
+}
+
 int CSftpChmodOpData::Send()
 {
 	if (opState == chmod_init) {
-		log(logmsg::status, _("Setting permissions of '%s' to '%s'"), command_.GetPath().FormatFilename(command_.GetFile()), command_.GetPermission());
-		controlSocket_.ChangeDir(command_.GetPath());
+		if (files_.size() == 1) {
+			log(logmsg::status, _("Setting permissions of '%s' to '%s'"), path_.FormatFilename(files_.front().first), files_.front().second);
+		}
+		else {
+			log(logmsg::status, _("Setting permissions of %d files in '%s'"), files_.size(), path_.GetPath());
+		}
+		controlSocket_.ChangeDir(path_);
 		opState = chmod_waitcwd;
 		return FZ_REPLY_CONTINUE;
 	}
 	else if (opState == chmod_chmod) {
-		engine_.GetDirectoryCache().UpdateFile(currentServer_, command_.GetPath(), command_.GetFile(), false, CDirectoryCache::unknown);
+		if (batch_) {
+			batch_end_ = std::min(files_.size(), sent_ + max_batch_files);
 
-		std::wstring quotedFilename = controlSocket_.QuoteFilename(command_.GetPath().FormatFilename(command_.GetFile(), !useAbsolute_));
+			std::wstring cmd = L"mchmod " + controlSocket_.QuoteFilename(path_.GetPath());
+			for (size_t i = sent_; i < batch_end_; ++i) {
+				cmd += L" " + files_[i].second + L" " + controlSocket_.QuoteFilename(files_[i].first);
+			}
+			return controlSocket_.SendCommand(cmd, fz::sprintf(L"mchmod %s (%d files)", controlSocket_.QuoteFilename(path_.GetPath()), batch_end_ - sent_));
+		}
+
+		batch_end_ = sent_ + 1;
+
+		auto const& [file, permission] = files_[sent_];
+		std::wstring quotedFilename = controlSocket_.QuoteFilename(path_.FormatFilename(file, !useAbsolute_));
 
-		return controlSocket_.SendCommand(L"chmod " + command_.GetPermission() + L" " + quotedFilename);
+		return controlSocket_.SendCommand(L"chmod " + permission + L" " + quotedFilename);
 	}
 
 	return FZ_REPLY_INTERNALERROR;
@@ -31,7 +70,24 @@ int CSftpChmodOpData::Send()
 
 int CSftpChmodOpData::ParseResponse()
 {
-	return controlSocket_.result_;
+	auto & cache = engine_.GetDirectoryCache();
+	if (controlSocket_.result_ == FZ_REPLY_OK) {
+		cache.UpdatePermissions(currentServer_, path_, std::vector<std::pair<std::wstring, std::wstring>>(files_.cbegin() + sent_, files_.cbegin() + batch_end_));
+	}
+	else {
+		// Not known which of the batch went through
+		chmodFailed_ = true;
+		for (size_t i = sent_; i < batch_end_; ++i) {
+			cache.UpdateFile(currentServer_, path_, files_[i].first, false, CDirectoryCache::unknown);
+		}
+	}
+
+	sent_ = batch_end_;
+	if (sent_ < files_.size()) {
+		return FZ_REPLY_CONTINUE;
+	}
+
+	return chmodFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
 }
 
 int CSftpChmodOpData::SubcommandResult(int prevResult, COpData const&)
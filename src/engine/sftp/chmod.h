@@ -6,19 +6,27 @@
 class CSftpChmodOpData final : public COpData, public CSftpOpData
 {
 public:
-	CSftpChmodOpData(CSftpControlSocket & controlSocket, CChmodCommand const& command)
-		: COpData(Command::chmod, L"CSftpChmodOpData")
-		, CSftpOpData(controlSocket)
-		, command_(command)
-	{}
+	CSftpChmodOpData(CSftpControlSocket & controlSocket, CChmodCommand const& command);
 
 	virtual int Send() override;
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int, COpData const&) override;
 
 private:
-	CChmodCommand command_;
+	CServerPath const path_;
+
+	// Pairs of filename and permission
+	std::vector<std::pair<std::wstring, std::wstring>> const files_;
 	bool useAbsolute_{};
+
+	// If set, fzsftp changes the files in batches with many requests in
+	// flight. Requires numeric permissions.
+	bool batch_{};
+
+	size_t sent_{};
+	size_t batch_end_{};
+
+	bool chmodFailed_{};
 };
 
 #endif
@@ -3,7 +3,9 @@
 #include "connect.h"
 #include "event.h"
 #include "input_thread.h"
+#include "process_pool.h"
 #include "proxy.h"
+#include "shared_block.h"
 
 #include <libfilezilla/local_filesys.hpp>
 #include <libfilezilla/process.hpp>
@@ -35,24 +37,60 @@ int CSftpConnectOpData::Send()
 
 			keyfile_ = keyfiles_.cbegin();
 
-			auto executable = fz::to_native(engine_.GetOptions().GetOption(OPTION_FZSFTP_EXECUTABLE));
-			if (executable.empty()) {
-				executable = fzT("fzsftp");
+			CSftpProcessPool::spec s;
+			s.executable_ = fz::to_native(engine_.GetOptions().GetOption(OPTION_FZSFTP_EXECUTABLE));
+			if (s.executable_.empty()) {
+				s.executable_ = fzT("fzsftp");
 			}
-			log(logmsg::debug_verbose, L"Going to execute %s", executable);
+			log(logmsg::debug_verbose, L"Going to execute %s", s.executable_);
 
-			std::vector<fz::native_string> args = { fzT("-v") };
+			s.args_ = { fzT("-v"), fzT("--framed") };
 			if (engine_.GetOptions().GetOptionVal(OPTION_SFTP_COMPRESSION)) {
-				args.push_back(fzT("-C"));
+				s.args_.push_back(fzT("-C"));
 			}
-			engine_.GetRateLimiter().add(&controlSocket_);
-			controlSocket_.process_ = std::make_unique<fz::process>();
-			if (!controlSocket_.process_->spawn(executable, args)) {
+			// Download request window adapts to the bandwidth-delay product up to this limit
+			s.args_.push_back(fzT("--window"));
+			s.args_.push_back(fz::to_native(std::to_wstring(engine_.GetOptions().GetOptionVal(OPTION_SFTP_MAX_WINDOW))));
+			// Likewise the number of outstanding directory read requests grows up to this limit
+			s.args_.push_back(fzT("--list-window"));
+			s.args_.push_back(fz::to_native(std::to_wstring(engine_.GetOptions().GetOptionVal(OPTION_SFTP_MAX_LIST_WINDOW))));
+			if (engine_.GetOptions().GetOptionVal(OPTION_SFTP_CONNECTION_SHARING)) {
+				// The first session to a site becomes the upstream, later ones skip key exchange and authentication
+				s.args_.push_back(fzT("-share"));
+			}
+			// Quota and transfer progress go through shared memory rather than the pipes
+			s.shm_ = true;
+
+			// The key files are handed over when starting the process, their
+			// replies follow the startup reply.
+			for (auto const& keyfile : keyfiles_) {
+				std::string const cmd = controlSocket_.ConvToServer(L"keyfile \"" + keyfile + L"\"\n");
+				if (cmd.empty()) {
+					log(logmsg::error, _("Could not convert command to server encoding"));
+					return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+				}
+				s.setup_ += cmd;
+			}
+
+			auto helper = engine_.GetContext().GetSftpProcessPool().Lease(s, static_cast<size_t>(engine_.GetOptions().GetOptionVal(OPTION_SFTP_PROCESS_POOL)));
+			if (!helper) {
 				log(logmsg::debug_warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
-
-			controlSocket_.input_thread_ = std::make_unique<CSftpInputThread>(controlSocket_, *controlSocket_.process_);
+			controlSocket_.process_ = std::move(helper.process_);
+			controlSocket_.sharing_ = engine_.GetOptions().GetOptionVal(OPTION_SFTP_CONNECTION_SHARING) != 0;
+			controlSocket_.shared_block_ = std::move(helper.shared_block_);
+			if (!controlSocket_.shared_block_) {
+				log(logmsg::debug_info, L"Shared memory not available, exchanging quota through the pipes");
+			}
+			controlSocket_.rate_limiter_ = engine_.GetContext().GetRateLimiter(currentServer_);
+			if (controlSocket_.rate_limiter_) {
+				controlSocket_.rate_limiter_->add(&controlSocket_);
+			}
+			else {
+				engine_.GetRateLimiter().add(&controlSocket_);
+			}
+			controlSocket_.input_thread_ = std::make_unique<CSftpInputThread>(controlSocket_, *controlSocket_.process_, true);
 			if (!controlSocket_.input_thread_->spawn(engine_.GetThreadPool())) {
 				log(logmsg::debug_warning, L"Thread creation failed");
 				controlSocket_.input_thread_.reset();
@@ -97,7 +135,10 @@ int CSftpConnectOpData::Send()
 		}
 		break;
 	case connect_keys:
-		return controlSocket_.SendCommand(L"keyfile \"" + *(keyfile_++) + L"\"");
+		// Already sent when starting the process, only the reply is outstanding
+		controlSocket_.log_raw(logmsg::command, L"keyfile \"" + *keyfile_ + L"\"");
+		controlSocket_.SetWait(true);
+		return FZ_REPLY_WOULDBLOCK;
 	case connect_open:
 		{
 			std::wstring user = (controlSocket_.credentials_.logonType_ == LogonType::anonymous) ? L"anonymous" : currentServer_.GetUser();
@@ -124,29 +165,29 @@ int CSftpConnectOpData::ParseResponse()
 			log(logmsg::error, _("fzsftp belongs to a different version of FileZilla"));
 			return FZ_REPLY_INTERNALERROR | FZ_REPLY_DISCONNECTED;
 		}
-		if (engine_.GetOptions().GetOptionVal(OPTION_PROXY_TYPE) && !currentServer_.GetBypassProxy()) {
-			opState = connect_proxy;
-		}
-		else if (keyfile_ != keyfiles_.cend()) {
-			opState = connect_keys;
-		}
-		else {
-			opState = connect_open;
-		}
-		break;
-	case connect_proxy:
 		if (keyfile_ != keyfiles_.cend()) {
 			opState = connect_keys;
 		}
+		else if (engine_.GetOptions().GetOptionVal(OPTION_PROXY_TYPE) && !currentServer_.GetBypassProxy()) {
+			opState = connect_proxy;
+		}
 		else {
 			opState = connect_open;
 		}
 		break;
 	case connect_keys:
-		if (keyfile_ == keyfiles_.cend()) {
-			opState = connect_open;
+		if (++keyfile_ == keyfiles_.cend()) {
+			if (engine_.GetOptions().GetOptionVal(OPTION_PROXY_TYPE) && !currentServer_.GetBypassProxy()) {
+				opState = connect_proxy;
+			}
+			else {
+				opState = connect_open;
+			}
 		}
 		break;
+	case connect_proxy:
+		opState = connect_open;
+		break;
 	case connect_open:
 		engine_.AddNotification(new CSftpEncryptionNotification(controlSocket_.m_sftpEncryptionDetails));
 		return FZ_REPLY_OK;
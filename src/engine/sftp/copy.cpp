@@ -0,0 +1,28 @@
+#include <filezilla.h>
+
+#include "../directorycache.h"
+#include "copy.h"
+
+int CSftpCopyOpData::Send()
+{
+	log(logmsg::status, _("Copying '%s' to '%s'"), command_.fromPath_.FormatFilename(command_.fromFile_), command_.toPath_.FormatFilename(command_.toFile_));
+
+	std::wstring fromQuoted = controlSocket_.QuoteFilename(command_.fromPath_.FormatFilename(command_.fromFile_));
+	std::wstring toQuoted = controlSocket_.QuoteFilename(command_.toPath_.FormatFilename(command_.toFile_));
+
+	return controlSocket_.SendCommand(L"copy " + fromQuoted + L" " + toQuoted);
+}
+
+int CSftpCopyOpData::ParseResponse()
+{
+	// Even a failed copy may have created or truncated the target
+	engine_.GetDirectoryCache().InvalidateFile(currentServer_, command_.toPath_, command_.toFile_);
+
+	if (controlSocket_.result_ != FZ_REPLY_OK) {
+		return controlSocket_.result_;
+	}
+
+	controlSocket_.SendDirectoryListingNotification(command_.toPath_, false);
+
+	return FZ_REPLY_OK;
+}
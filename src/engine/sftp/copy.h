@@ -0,0 +1,22 @@
+#ifndef FILEZILLA_ENGINE_SFTP_COPY_HEADER
+#define FILEZILLA_ENGINE_SFTP_COPY_HEADER
+
+#include "sftpcontrolsocket.h"
+
+// Copies a file on the server through the copy-data extension
+class CSftpCopyOpData final : public COpData, public CSftpOpData
+{
+public:
+	CSftpCopyOpData(CSftpControlSocket & controlSocket, CCopyCommand const& command)
+		: COpData(Command::copy, L"CSftpCopyOpData")
+		, CSftpOpData(controlSocket)
+		, command_(command)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	CCopyCommand const command_;
+};
+
+#endif
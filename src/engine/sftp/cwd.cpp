@@ -117,6 +117,9 @@ int CSftpChangeDirOpData::ParseResponse()
 			// Create remote directory if part of a file upload
 			if (tryMkdOnFail_) {
 				tryMkdOnFail_ = false;
+
+				// Whatever was known about it is outdated
+				engine_.GetPathCache().InvalidatePath(currentServer_, path_);
 				controlSocket_.Mkdir(path_);
 				return FZ_REPLY_CONTINUE;
 			}
@@ -1,7 +1,7 @@
 #ifndef FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 #define FILEZILLA_ENGINE_SFTP_EVENT_HEADER
 
-#define FZSFTP_PROTOCOL_VERSION 9
+#define FZSFTP_PROTOCOL_VERSION 11
 
 enum class sftpEvent {
 	Unknown = -1,
@@ -31,6 +31,7 @@ enum class sftpEvent {
 	MacClientToServer,
 	MacServerToClient,
 	Hostkey,
+	ListentryAttrs,
 
 	count
 };
@@ -41,18 +42,32 @@ struct sftp_message
 	std::wstring text[2];
 };
 
-struct sftp_event_type;
-typedef fz::simple_event<sftp_event_type, sftp_message> CSftpEvent;
-
 struct sftp_list_message
 {
 	mutable std::wstring text;
 	mutable std::wstring name;
 	uint64_t mtime;
+
+	// Only for sftpEvent::ListentryAttrs, text is still the longname
+	bool has_attrs{};
+	uint32_t attr_flags{};
+	uint64_t size{};
+	uint32_t uid{};
+	uint32_t gid{};
+	uint32_t permissions{};
+};
+
+// Consecutive messages read from fzsftp in one go. Only one of the vectors
+// is used per batch, the input thread starts a new batch whenever the kind
+// of message changes so that the order is preserved.
+struct sftp_message_batch
+{
+	mutable std::vector<sftp_message> messages;
+	mutable std::vector<sftp_list_message> list_entries;
 };
 
-struct sftp_list_event_type;
-typedef fz::simple_event<sftp_list_event_type, sftp_list_message> CSftpListEvent;
+struct sftp_batch_event_type;
+typedef fz::simple_event<sftp_batch_event_type, sftp_message_batch> CSftpBatchEvent;
 
 struct terminate_event_type;
 typedef fz::simple_event<terminate_event_type, std::wstring> CTerminateEvent;
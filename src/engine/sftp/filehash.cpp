@@ -0,0 +1,31 @@
+#include <filezilla.h>
+
+#include "filehash.h"
+
+#include <libfilezilla/string.hpp>
+
+int CSftpFileHashOpData::Send()
+{
+	log(logmsg::status, _("Retrieving checksum of '%s'"), command_.path_.FormatFilename(command_.file_));
+
+	std::wstring quotedFilename = controlSocket_.QuoteFilename(command_.path_.FormatFilename(command_.file_));
+	return controlSocket_.SendCommand(L"checkfile " + quotedFilename);
+}
+
+int CSftpFileHashOpData::ParseResponse()
+{
+	if (controlSocket_.result_ != FZ_REPLY_OK) {
+		return controlSocket_.result_;
+	}
+
+	// fzsftp replies with the algorithm and the hash in hex
+	auto const tokens = fz::strtok(controlSocket_.response_, L" ");
+	if (tokens.size() != 2) {
+		log(logmsg::error, _("Could not parse checksum from server reply"));
+		return FZ_REPLY_ERROR;
+	}
+
+	engine_.AddNotification(new CFileHashNotification(command_.path_, command_.file_, tokens[0], fz::to_utf8(tokens[1])));
+
+	return FZ_REPLY_OK;
+}
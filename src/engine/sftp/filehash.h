@@ -0,0 +1,22 @@
+#ifndef FILEZILLA_ENGINE_SFTP_FILEHASH_HEADER
+#define FILEZILLA_ENGINE_SFTP_FILEHASH_HEADER
+
+#include "sftpcontrolsocket.h"
+
+// Retrieves the checksum of a file through the check-file extension
+class CSftpFileHashOpData final : public COpData, public CSftpOpData
+{
+public:
+	CSftpFileHashOpData(CSftpControlSocket & controlSocket, CFileHashCommand const& command)
+		: COpData(Command::filehash, L"CSftpFileHashOpData")
+		, CSftpOpData(controlSocket)
+		, command_(command)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	CFileHashCommand const command_;
+};
+
+#endif
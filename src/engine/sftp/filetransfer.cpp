@@ -2,6 +2,7 @@
 
 #include "../directorycache.h"
 #include "filetransfer.h"
+#include "multistat.h"
 
 #include <libfilezilla/local_filesys.hpp>
 
@@ -11,7 +12,7 @@ enum filetransferStates
 {
 	filetransfer_init = 0,
 	filetransfer_waitcwd,
-	filetransfer_waitlist,
+	filetransfer_waitlookup,
 	filetransfer_mtime,
 	filetransfer_transfer,
 	filetransfer_chmtime
@@ -62,7 +63,26 @@ int CSftpFileTransferOpData::Send()
 			cmd = "re";
 			logstr = L"re";
 		}
-		if (download_) {
+		if (download_ && transferSettings_.segmentOffset >= 0) {
+			// The queue has already created the local file at its full size
+			engine_.transfer_status_.Init(transferSettings_.segmentSize, 0, false);
+			std::wstring range = fz::sprintf(L"getrange %d %d ", transferSettings_.segmentOffset, transferSettings_.segmentSize);
+			cmd = fz::to_utf8(range);
+			logstr = range;
+
+			std::string remoteFile = controlSocket_.ConvToServer(controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_)));
+			if (remoteFile.empty()) {
+				log(logmsg::error, _("Could not convert command to server encoding"));
+				return FZ_REPLY_ERROR;
+			}
+			cmd += remoteFile + " ";
+			logstr += controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_)) + L" ";
+
+			std::wstring localFile = controlSocket_.QuoteFilename(localFile_);
+			cmd += fz::to_utf8(localFile);
+			logstr += localFile;
+		}
+		else if (download_) {
 			if (!resume_) {
 				controlSocket_.CreateLocalDir(localFile_);
 			}
@@ -101,6 +121,7 @@ int CSftpFileTransferOpData::Send()
 			logstr += controlSocket_.QuoteFilename(remotePath_.FormatFilename(remoteFile_, !tryAbsolutePath_));
 		}
 		engine_.transfer_status_.SetStartTime();
+		controlSocket_.StartSharedBlockTimer();
 		transferInitiated_ = true;
 		controlSocket_.SetWait(true);
 
@@ -135,6 +156,9 @@ int CSftpFileTransferOpData::Send()
 int CSftpFileTransferOpData::ParseResponse()
 {
 	if (opState == filetransfer_transfer) {
+		// Pick up progress fzsftp reported after the last timer tick
+		controlSocket_.PollSharedBlock();
+
 		if (controlSocket_.result_ == FZ_REPLY_OK && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS)) {
 			if (download_) {
 				if (!fileTime_.empty()) {
@@ -194,7 +218,7 @@ int CSftpFileTransferOpData::ParseResponse()
 	return FZ_REPLY_INTERNALERROR;
 }
 
-int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
+int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const& previousOperation)
 {
 	if (opState == filetransfer_waitcwd) {
 		if (prevResult == FZ_REPLY_OK) {
@@ -204,7 +228,7 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
 			if (!found) {
 				if (!dirDidExist) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else if (download_ && engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS)) {
 					opState = filetransfer_mtime;
@@ -215,7 +239,7 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			}
 			else {
 				if (entry.is_unsure()) {
-					opState = filetransfer_waitlist;
+					opState = filetransfer_waitlookup;
 				}
 				else {
 					if (matchedCase) {
@@ -238,8 +262,9 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 					}
 				}
 			}
-			if (opState == filetransfer_waitlist) {
-				controlSocket_.List(CServerPath(), L"", LIST_FLAG_REFRESH);
+			if (opState == filetransfer_waitlookup) {
+				// Stat the file instead of listing the whole directory
+				controlSocket_.Lookup(currentPath_, std::vector<std::wstring>{remoteFile_});
 				return FZ_REPLY_CONTINUE;
 			}
 			else if (opState == filetransfer_transfer) {
@@ -254,17 +279,11 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 			opState = filetransfer_mtime;
 		}
 	}
-	else if (opState == filetransfer_waitlist) {
+	else if (opState == filetransfer_waitlookup) {
 		if (prevResult == FZ_REPLY_OK) {
-			CDirentry entry;
-			bool dirDidExist;
-			bool matchedCase;
-			bool found = engine_.GetDirectoryCache().LookupFile(entry, currentServer_, tryAbsolutePath_ ? remotePath_ : currentPath_, remoteFile_, dirDidExist, matchedCase);
-			if (!found) {
-				if (!dirDidExist) {
-					opState = filetransfer_mtime;
-				}
-				else if (download_ &&
+			auto const& [results, entry] = static_cast<CSftpLookupManyOpData const&>(previousOperation).entries().front();
+			if (!(results & LookupResults::found)) {
+				if (download_ &&
 					engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS))
 				{
 					opState = filetransfer_mtime;
@@ -274,7 +293,7 @@ int CSftpFileTransferOpData::SubcommandResult(int prevResult, COpData const&)
 				}
 			}
 			else {
-				if (matchedCase && !entry.is_unsure()) {
+				if ((results & LookupResults::matchedcase) && !entry.is_unsure()) {
 					remoteFileSize_ = entry.size;
 					if (entry.has_date()) {
 						fileTime_ = entry.time;
@@ -6,9 +6,30 @@
 
 #include <libfilezilla/process.hpp>
 
-CSftpInputThread::CSftpInputThread(CSftpControlSocket& owner, fz::process& proc)
+#include <algorithm>
+
+#include <string.h>
+
+namespace {
+size_t const read_size = 64 * 1024;
+
+// Sanity limit for the size of a single field in framed mode
+uint32_t const max_field_size = 16 * 1024 * 1024;
+
+// Longer lines get truncated
+size_t const max_line_size = 4095;
+
+// Messages are sent to the owner once the process has nothing more to read,
+// or once that many have accumulated
+size_t const max_batch = 256;
+
+size_t const max_pooled = 4;
+}
+
+CSftpInputThread::CSftpInputThread(CSftpControlSocket& owner, fz::process& proc, bool framed)
 	: process_(proc)
 	, owner_(owner)
+	, framed_(framed)
 {
 }
 
@@ -27,6 +48,10 @@ bool CSftpInputThread::spawn(fz::thread_pool & pool)
 
 uint64_t CSftpInputThread::ReadUInt(std::wstring &error)
 {
+	if (framing_active_) {
+		return ReadBinaryUInt(8, error);
+	}
+
 	uint64_t ret{};
 
 	while (true) {
@@ -60,45 +85,103 @@ uint64_t CSftpInputThread::ReadUInt(std::wstring &error)
 	return 0;
 }
 
-std::wstring CSftpInputThread::ReadLine(std::wstring &error)
+uint64_t CSftpInputThread::ReadBinaryUInt(size_t bytes, std::wstring &error)
 {
-	int len = 0;
-	const int buffersize = 4096;
-	char buffer[buffersize];
-
-	while (true) {
+	uint64_t ret{};
+	while (bytes) {
 		if (!readFromProcess(error, true)) {
-			return std::wstring();
+			return 0;
 		}
 
 		auto const* p = recv_buffer_.get();
-		size_t i;
-		for (i = 0; i < recv_buffer_.size(); ++i) {
-			unsigned char const c = p[i];
+		size_t const avail = std::min(bytes, recv_buffer_.size());
+		for (size_t i = 0; i < avail; ++i) {
+			ret = (ret << 8) | p[i];
+		}
+		recv_buffer_.consume(avail);
+		bytes -= avail;
+	}
 
-			if (c == '\n') {
-				recv_buffer_.consume(i + 1);
+	return ret;
+}
 
-				while (len && buffer[len - 1] == '\r') {
-					--len;
-				}
+std::wstring CSftpInputThread::ReadField(std::wstring &error)
+{
+	uint32_t len = static_cast<uint32_t>(ReadBinaryUInt(4, error));
+	if (!error.empty()) {
+		return std::wstring();
+	}
+	if (len > max_field_size) {
+		error = L"Field too large";
+		return std::wstring();
+	}
 
-				std::wstring const line = owner_.ConvToLocal(buffer, len);
-				if (len && line.empty()) {
-					error = L"Failed to convert reply to local character set.";
-				}
+	std::string field;
+	while (field.size() < len) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
 
-				return line;
+		size_t const avail = std::min(static_cast<size_t>(len) - field.size(), recv_buffer_.size());
+		if (field.empty() && avail == len) {
+			// Common case, the whole field is already in the buffer
+			std::wstring const ret = owner_.ConvToLocal(reinterpret_cast<char const*>(recv_buffer_.get()), len);
+			recv_buffer_.consume(len);
+			if (len && ret.empty()) {
+				error = L"Failed to convert reply to local character set.";
 			}
+			return ret;
+		}
+		field.append(reinterpret_cast<char const*>(recv_buffer_.get()), avail);
+		recv_buffer_.consume(avail);
+	}
 
-			if (len >= buffersize - 1) {
-				// Cap string length
+	std::wstring const ret = owner_.ConvToLocal(field.c_str(), field.size());
+	if (len && ret.empty()) {
+		error = L"Failed to convert reply to local character set.";
+	}
+	return ret;
+}
+
+std::wstring CSftpInputThread::ReadLine(std::wstring &error)
+{
+	if (framing_active_) {
+		return ReadField(error);
+	}
+
+	line_.clear();
+	while (true) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
+
+		char const* p = reinterpret_cast<char const*>(recv_buffer_.get());
+		size_t const size = recv_buffer_.size();
+		char const* nl = static_cast<char const*>(memchr(p, '\n', size));
+		size_t const len = nl ? static_cast<size_t>(nl - p) : size;
+
+		if (!nl || !line_.empty()) {
+			line_.append(p, std::min(len, max_line_size - std::min(max_line_size, line_.size())));
+			if (!nl) {
+				recv_buffer_.clear();
 				continue;
 			}
+			p = line_.c_str();
+		}
 
-			buffer[len++] = c;
+		// Common case, the line is used straight from the buffer
+		size_t n = nl && line_.empty() ? std::min(len, max_line_size) : line_.size();
+		while (n && p[n - 1] == '\r') {
+			--n;
 		}
-		recv_buffer_.clear();
+
+		std::wstring const line = owner_.ConvToLocal(p, n);
+		recv_buffer_.consume(len + 1);
+		if (n && line.empty()) {
+			error = L"Failed to convert reply to local character set.";
+		}
+
+		return line;
 	}
 
 	return std::wstring();
@@ -107,7 +190,10 @@ std::wstring CSftpInputThread::ReadLine(std::wstring &error)
 bool CSftpInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 {
 	if (recv_buffer_.empty()) {
-		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(1024)), 1024);
+		// Don't hold back completed messages while waiting for the process
+		flush();
+
+		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(read_size)), read_size);
 		if (read > 0) {
 			recv_buffer_.add(read);
 		}
@@ -167,36 +253,94 @@ void CSftpInputThread::processEvent(sftpEvent eventType, std::wstring & error)
 		lines = 2;
 		break;
 	case sftpEvent::Listentry:
+	case sftpEvent::ListentryAttrs:
 		{
-			auto msg = new CSftpListEvent;
-			auto & message = std::get<0>(msg->v_);
+			if (eventType == sftpEvent::ListentryAttrs && !framing_active_) {
+				error = L"Listing entry with attributes outside framed mode";
+				return;
+			}
+
+			sftp_list_message message;
 			message.text = ReadLine(error);
+			if (eventType == sftpEvent::ListentryAttrs) {
+				message.has_attrs = true;
+				message.attr_flags = static_cast<uint32_t>(ReadBinaryUInt(4, error));
+				message.size = ReadBinaryUInt(8, error);
+				message.uid = static_cast<uint32_t>(ReadBinaryUInt(4, error));
+				message.gid = static_cast<uint32_t>(ReadBinaryUInt(4, error));
+				message.permissions = static_cast<uint32_t>(ReadBinaryUInt(4, error));
+			}
 			message.mtime = ReadUInt(error);
 			message.name = ReadLine(error);
 
 			if (error.empty()) {
-				owner_.send_event(msg);
-			}
-			else {
-				delete msg;
+				batch(true).list_entries.push_back(std::move(message));
+				if (++pending_count_ >= max_batch) {
+					flush();
+				}
 			}
 		}
 		return;
 	};
 
-	auto msg = new CSftpEvent;
-	auto & message = std::get<0>(msg->v_);
+	sftp_message message;
 	message.type = eventType;
 	for (int i = 0; i < lines && error.empty(); ++i) {
 		message.text[i] = ReadLine(error);
 	}
 
 	if (!error.empty()) {
-		delete msg;
 		return;
 	}
 
-	owner_.send_event(msg);
+	batch(false).messages.push_back(std::move(message));
+	if (++pending_count_ >= max_batch) {
+		flush();
+	}
+}
+
+sftp_message_batch & CSftpInputThread::batch(bool list)
+{
+	if (pending_) {
+		auto & b = std::get<0>(pending_->v_);
+		if ((list ? b.messages : b.list_entries).empty()) {
+			return b;
+		}
+		flush();
+	}
+
+	pending_ = std::make_unique<CSftpBatchEvent>();
+	auto & b = std::get<0>(pending_->v_);
+
+	fz::scoped_lock l(pool_mutex_);
+	if (!pool_.empty()) {
+		b.messages.swap(pool_.back().messages);
+		b.list_entries.swap(pool_.back().list_entries);
+		pool_.pop_back();
+	}
+
+	return b;
+}
+
+void CSftpInputThread::flush()
+{
+	if (pending_) {
+		owner_.send_event(pending_.release());
+		pending_count_ = 0;
+	}
+}
+
+void CSftpInputThread::recycle(sftp_message_batch const& batch)
+{
+	batch.messages.clear();
+	batch.list_entries.clear();
+
+	fz::scoped_lock l(pool_mutex_);
+	if (pool_.size() < max_pooled) {
+		pool_.emplace_back();
+		pool_.back().messages.swap(batch.messages);
+		pool_.back().list_entries.swap(batch.list_entries);
+	}
 }
 
 void CSftpInputThread::entry()
@@ -220,7 +364,11 @@ void CSftpInputThread::entry()
 		sftpEvent eventType = static_cast<sftpEvent>(readType);
 
 		processEvent(eventType, error);
+
+		// The initial reply is always plain text
+		framing_active_ = framed_;
 	}
 
+	flush();
 	owner_.send_event<CTerminateEvent>(error);
 }
@@ -3,9 +3,14 @@
 
 class CSftpControlSocket;
 
+#include "event.h"
+
 #include <libfilezilla/buffer.hpp>
+#include <libfilezilla/mutex.hpp>
 #include <libfilezilla/thread_pool.hpp>
 
+#include <memory>
+
 namespace fz {
 class process;
 }
@@ -13,27 +18,51 @@ class process;
 class CSftpInputThread final
 {
 public:
-	CSftpInputThread(CSftpControlSocket & owner, fz::process& proc);
+	// If framed is set, all messages after the initial reply are expected
+	// to use the length-prefixed binary framing requested through --framed.
+	CSftpInputThread(CSftpControlSocket & owner, fz::process& proc, bool framed);
 	~CSftpInputThread();
 
 	bool spawn(fz::thread_pool & pool);
 
+	// Hands the storage of a processed batch back to be used for later ones
+	void recycle(sftp_message_batch const& batch);
+
 protected:
 
 	bool readFromProcess(std::wstring & error, bool eof_is_error);
 	std::wstring ReadLine(std::wstring & error);
 	uint64_t ReadUInt(std::wstring & error);
 
+	std::wstring ReadField(std::wstring & error);
+	uint64_t ReadBinaryUInt(size_t bytes, std::wstring & error);
+
 	void entry();
 
 	void processEvent(sftpEvent eventType, std::wstring & error);
 
+	sftp_message_batch & batch(bool list);
+	void flush();
+
 	fz::process& process_;
 	CSftpControlSocket& owner_;
 
 	fz::async_task thread_;
 
 	fz::buffer recv_buffer_;
+
+	// Partial line if a line spans multiple reads
+	std::string line_;
+
+	// Messages not yet sent to the owner
+	std::unique_ptr<CSftpBatchEvent> pending_;
+	size_t pending_count_{};
+
+	fz::mutex pool_mutex_;
+	std::vector<sftp_message_batch> pool_;
+
+	bool const framed_{};
+	bool framing_active_{};
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include <filezilla.h>
 
 #include "../directorycache.h"
+#include "event.h"
 #include "list.h"
 
 #include <assert.h>
@@ -61,6 +62,7 @@ int CSftpListOpData::Send()
 	}
 	else if (opState == list_list) {
 		listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, listingEncoding::unknown);
+		listing_parser_->SetProgressPath(currentPath_);
 		return controlSocket_.SendCommand(L"ls");
 	}
 
@@ -117,31 +119,166 @@ int CSftpListOpData::SubcommandResult(int prevResult, COpData const&)
 	return FZ_REPLY_CONTINUE;
 }
 
-int CSftpListOpData::ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name)
+int CSftpListOpData::ParseEntry(sftp_list_message const& message)
 {
 	if (opState != list_list) {
-		controlSocket_.log_raw(logmsg::listing, entry);
+		controlSocket_.log_raw(logmsg::listing, message.text);
 		log(logmsg::debug_warning, L"CSftpListOpData::ParseEntry called at improper time: %d", opState);
 		return FZ_REPLY_INTERNALERROR;
 	}
 
-	if (entry.size() > 65536 || name.size() > 65536) {
+	if (message.text.size() > 65536 || message.name.size() > 65536) {
 		log(fz::logmsg::error, _("Received too long response line from server, closing connection."));
 		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 	}
 
 
 	if (!listing_parser_) {
-		controlSocket_.log_raw(logmsg::listing, entry);
+		controlSocket_.log_raw(logmsg::listing, message.text);
 		log(logmsg::debug_warning, L"listing_parser_ is null");
 		return FZ_REPLY_INTERNALERROR;
 	}
 
-	fz::datetime time;
-	if (mtime) {
-		time = fz::datetime(static_cast<time_t>(mtime), fz::datetime::seconds);
+	if (message.has_attrs) {
+		controlSocket_.log_raw(logmsg::listing, message.text);
 	}
-	listing_parser_->AddLine(std::move(entry), std::move(name), time);
+	AddSftpListEntry(*listing_parser_, message);
 
 	return FZ_REPLY_WOULDBLOCK;
 }
+
+namespace {
+uint32_t const attr_size = 0x1;
+uint32_t const attr_uidgid = 0x2;
+
+bool ParseNumber(std::wstring_view const& s, uint64_t & value)
+{
+	if (s.empty()) {
+		return false;
+	}
+	value = 0;
+	for (auto const c : s) {
+		if (c < '0' || c > '9') {
+			return false;
+		}
+		value = value * 10 + (c - '0');
+	}
+	return true;
+}
+
+// Owner and group names are only found in the longname. They are taken
+// from it if it starts like ls -l output: permissions, link count, owner,
+// group and the size matching the attributes.
+bool OwnerGroupFromLongname(std::wstring_view const& longname, uint64_t size, std::wstring & ownerGroup)
+{
+	std::wstring_view tokens[5];
+	size_t pos{};
+	for (auto & token : tokens) {
+		pos = longname.find_first_not_of(' ', pos);
+		if (pos == std::wstring_view::npos) {
+			return false;
+		}
+		size_t const end = longname.find(' ', pos);
+		if (end == std::wstring_view::npos) {
+			return false;
+		}
+		token = longname.substr(pos, end - pos);
+		pos = end;
+	}
+
+	uint64_t value;
+	if (tokens[0].size() < 10 || !ParseNumber(tokens[1], value) || !ParseNumber(tokens[4], value) || value != size) {
+		return false;
+	}
+
+	ownerGroup.assign(tokens[2]);
+	ownerGroup += ' ';
+	ownerGroup.append(tokens[3]);
+	return true;
+}
+
+// Same format as in ls -l
+void FormatPermissions(uint32_t mode, wchar_t (&permissions)[10])
+{
+	switch (mode & 0170000) {
+	case 0040000:
+		permissions[0] = 'd';
+		break;
+	case 0120000:
+		permissions[0] = 'l';
+		break;
+	case 0020000:
+		permissions[0] = 'c';
+		break;
+	case 0060000:
+		permissions[0] = 'b';
+		break;
+	case 0010000:
+		permissions[0] = 'p';
+		break;
+	case 0140000:
+		permissions[0] = 's';
+		break;
+	default:
+		permissions[0] = '-';
+		break;
+	}
+
+	for (int i = 0; i < 9; ++i) {
+		permissions[i + 1] = (mode & (0400 >> i)) ? L"rwxrwxrwx"[i] : '-';
+	}
+	if (mode & 04000) {
+		permissions[3] = (mode & 0100) ? 's' : 'S';
+	}
+	if (mode & 02000) {
+		permissions[6] = (mode & 010) ? 's' : 'S';
+	}
+	if (mode & 01000) {
+		permissions[9] = (mode & 01) ? 't' : 'T';
+	}
+}
+}
+
+void AddSftpListEntry(CDirectoryListingParser & parser, sftp_list_message const& message)
+{
+	fz::datetime time;
+	if (message.mtime) {
+		time = fz::datetime(static_cast<time_t>(message.mtime), fz::datetime::seconds);
+	}
+
+	if (!message.has_attrs) {
+		parser.AddLine(std::wstring(message.text), std::wstring(message.name), time);
+		return;
+	}
+
+	CDirentry entry;
+	entry.name = message.name;
+	entry.time = time;
+	entry.size = (message.attr_flags & attr_size) ? static_cast<int64_t>(message.size) : -1;
+
+	entry.flags = 0;
+	uint32_t const type = message.permissions & 0170000;
+	if (type == 0040000) {
+		entry.flags |= CDirentry::flag_dir;
+	}
+	else if (type == 0120000) {
+		// Like in parsed listings, links count as directories until followed
+		entry.flags |= CDirentry::flag_dir | CDirentry::flag_link;
+
+		std::wstring const marker = entry.name + L" -> ";
+		size_t const pos = message.text.rfind(marker);
+		if (pos != std::wstring::npos) {
+			entry.target = fz::sparse_optional<std::wstring>(message.text.substr(pos + marker.size()));
+		}
+	}
+
+	wchar_t permissions[10];
+	FormatPermissions(message.permissions, permissions);
+
+	std::wstring ownerGroup;
+	if (!OwnerGroupFromLongname(message.text, message.size, ownerGroup) && (message.attr_flags & attr_uidgid)) {
+		ownerGroup = fz::sprintf(L"%u %u", message.uid, message.gid);
+	}
+
+	parser.AddEntry(std::move(entry), std::wstring_view(permissions, 10), ownerGroup);
+}
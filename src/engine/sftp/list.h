@@ -19,7 +19,7 @@ public:
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
-	int ParseEntry(std::wstring && entry, uint64_t mtime, std::wstring && name);
+	int ParseEntry(sftp_list_message const& message);
 
 private:
 	std::unique_ptr<CDirectoryListingParser> listing_parser_;
@@ -39,4 +39,9 @@ private:
 	fz::monotonic_clock time_before_locking_;
 };
 
+// Hands an entry received from fzsftp to the parser. Entries with
+// attributes are taken as they are, only owner, group and link target
+// come from the longname.
+void AddSftpListEntry(CDirectoryListingParser & parser, sftp_list_message const& message);
+
 #endif
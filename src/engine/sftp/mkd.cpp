@@ -1,6 +1,7 @@
 #include <filezilla.h>
 
 #include "../directorycache.h"
+#include "../pathcache.h"
 #include "mkd.h"
 
 enum mkdStates
@@ -47,6 +48,11 @@ int CSftpMkdirOpData::Send()
 			}
 		}
 
+		if (engine_.GetPathCache().Exists(currentServer_, path_)) {
+			log(logmsg::debug_info, L"Directory is known to exist");
+			return FZ_REPLY_OK;
+		}
+
 		if (!path_.HasParent()) {
 			opState = mkd_tryfull;
 		}
@@ -54,6 +60,17 @@ int CSftpMkdirOpData::Send()
 			currentMkdPath_ = path_.GetParent();
 			segments_.push_back(path_.GetLastSegment());
 
+			// Directories created before, possibly by another engine, need not
+			// be searched for again. Start right below the deepest one known.
+			CServerPath const existing = engine_.GetPathCache().GetExisting(currentServer_, currentMkdPath_);
+			if (!existing.empty() && !(currentPath_.IsParentOf(path_, false) && existing.IsParentOf(currentPath_, false))) {
+				while (currentMkdPath_ != existing) {
+					segments_.push_back(currentMkdPath_.GetLastSegment());
+					currentMkdPath_ = currentMkdPath_.GetParent();
+				}
+				commonParent_ = existing;
+			}
+
 			if (currentMkdPath_ == currentPath_) {
 				opState = mkd_mkdsub;
 			}
@@ -109,6 +126,7 @@ int CSftpMkdirOpData::ParseResponse()
 
 			currentMkdPath_.AddSegment(segments_.back());
 			segments_.pop_back();
+			engine_.GetPathCache().StoreExisting(currentServer_, currentMkdPath_);
 
 			if (segments_.empty()) {
 				return FZ_REPLY_OK;
@@ -131,7 +149,11 @@ int CSftpMkdirOpData::ParseResponse()
 		}
 		return FZ_REPLY_CONTINUE;
 	case mkd_tryfull:
-		return successful ? FZ_REPLY_OK : FZ_REPLY_ERROR;
+		if (successful) {
+			engine_.GetPathCache().StoreExisting(currentServer_, path_);
+			return FZ_REPLY_OK;
+		}
+		return FZ_REPLY_ERROR;
 	default:
 		log(logmsg::debug_warning, L"unknown op state: %d", opState);
 	}
@@ -0,0 +1,170 @@
+#include <filezilla.h>
+
+#include "event.h"
+#include "list.h"
+#include "multistat.h"
+
+enum multistatStates
+{
+	multistat_init = 0,
+	multistat_stat
+};
+
+namespace {
+// Keeps the command line to fzsftp at a sensible length
+size_t const max_batch_files = 1000;
+}
+
+int CSftpLookupManyOpData::Send()
+{
+	if (opState == multistat_init) {
+		if (path_.empty() || files_.empty()) {
+			return FZ_REPLY_INTERNALERROR;
+		}
+
+		log(logmsg::debug_info, L"Looking for %d items in '%s'", files_.size(), path_.GetPath());
+
+		entries_ = engine_.GetDirectoryCache().LookupFiles(currentServer_, path_, files_, LookupFlags{});
+		if (entries_.empty()) {
+			entries_.resize(files_.size());
+		}
+
+		for (size_t i = 0; i < files_.size(); ++i) {
+			auto const& [results, entry] = entries_[i];
+			if (!(results & LookupResults::direxists)) {
+				// Directory not cached or outdated
+				pending_.push_back(i);
+			}
+			else if ((results & LookupResults::found) && (!entry || entry.is_unsure())) {
+				log(logmsg::debug_info, L"Found unsure entry for '%s': %d", entry.name, entry.flags);
+				pending_.push_back(i);
+			}
+		}
+
+		if (pending_.empty()) {
+			return FZ_REPLY_OK;
+		}
+
+		log(logmsg::debug_info, L"%d items not in cache, querying server", pending_.size());
+		opState = multistat_stat;
+	}
+
+	if (opState == multistat_stat) {
+		batch_end_ = std::min(pending_.size(), sent_ + max_batch_files);
+
+		std::wstring cmd = L"mstat " + controlSocket_.QuoteFilename(path_.GetPath());
+		for (size_t i = sent_; i < batch_end_; ++i) {
+			cmd += L" " + controlSocket_.QuoteFilename(files_[pending_[i]]);
+		}
+
+		listing_parser_ = std::make_unique<CDirectoryListingParser>(&controlSocket_, currentServer_, listingEncoding::unknown);
+		return controlSocket_.SendCommand(cmd, fz::sprintf(L"mstat %s (%d files)", controlSocket_.QuoteFilename(path_.GetPath()), batch_end_ - sent_));
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CSftpLookupManyOpData::Send()");
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CSftpLookupManyOpData::ParseEntry(sftp_list_message const& message)
+{
+	if (opState != multistat_stat || !listing_parser_) {
+		log(logmsg::debug_warning, L"CSftpLookupManyOpData::ParseEntry called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	if (message.text.size() > 65536 || message.name.size() > 65536) {
+		log(fz::logmsg::error, _("Received too long response line from server, closing connection."));
+		return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
+	}
+
+	AddSftpListEntry(*listing_parser_, message);
+
+	return FZ_REPLY_WOULDBLOCK;
+}
+
+int CSftpLookupManyOpData::ParseResponse()
+{
+	if (opState != multistat_stat || !listing_parser_) {
+		log(logmsg::debug_warning, L"CSftpLookupManyOpData::ParseResponse called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	if (controlSocket_.result_ != FZ_REPLY_OK) {
+		// Either the directory itself could not be resolved, or a file
+		// could not be stat'ed for a reason other than not existing
+		return FZ_REPLY_ERROR;
+	}
+
+	// Only holds the files that exist, in no particular order
+	CDirectoryListing const found = listing_parser_->Parse(path_);
+	listing_parser_.reset();
+
+	// Same results as from the cache after listing the directory, the cache
+	// gets to know them as well.
+	bool updated{};
+	for (size_t i = sent_; i < batch_end_; ++i) {
+		size_t const index = pending_[i];
+		LookupResults results = LookupResults::direxists | LookupResults::found | LookupResults::matchedcase;
+		size_t pos = found.FindFile_CmpCase(files_[index]);
+		if (pos == std::string::npos) {
+			results = LookupResults::direxists | LookupResults::found;
+			pos = found.FindFile_CmpNoCase(files_[index]);
+		}
+		if (pos != std::string::npos) {
+			CDirentry const& entry = found[pos];
+			entries_[index] = { results, entry };
+			updated |= engine_.GetDirectoryCache().UpdateFile(currentServer_, path_, entry.name, true, entry.is_dir() ? CDirectoryCache::dir : CDirectoryCache::file, entry.size);
+		}
+		else {
+			entries_[index] = { LookupResults::direxists, CDirentry() };
+			updated |= engine_.GetDirectoryCache().RemoveFile(currentServer_, path_, files_[index]);
+		}
+	}
+	if (updated) {
+		controlSocket_.SendDirectoryListingNotification(path_, false);
+	}
+
+	sent_ = batch_end_;
+	if (sent_ < pending_.size()) {
+		return FZ_REPLY_CONTINUE;
+	}
+
+	return FZ_REPLY_OK;
+}
+
+CSftpLookupOpData::CSftpLookupOpData(CSftpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry * entry)
+	: CSftpLookupManyOpData(controlSocket, path, std::vector<std::wstring>{file}, L"CSftpLookupOpData")
+	, entry_(entry)
+{
+	if (!entry) {
+		internal_entry_ = std::make_unique<CDirentry>();
+		entry_ = internal_entry_.get();
+	}
+	entry_->clear();
+}
+
+int CSftpLookupOpData::Send()
+{
+	return Result(CSftpLookupManyOpData::Send());
+}
+
+int CSftpLookupOpData::ParseResponse()
+{
+	return Result(CSftpLookupManyOpData::ParseResponse());
+}
+
+int CSftpLookupOpData::Result(int res)
+{
+	if (res != FZ_REPLY_OK) {
+		return res;
+	}
+
+	auto const& [results, entry] = entries().front();
+	if (results & LookupResults::found) {
+		*entry_ = entry;
+		return FZ_REPLY_OK;
+	}
+
+	log(logmsg::debug_info, L"'%s' does not appear to exist", files_.front());
+	return FZ_REPLY_ERROR_NOTFOUND;
+}
@@ -0,0 +1,65 @@
+#ifndef FILEZILLA_ENGINE_SFTP_MULTISTAT_HEADER
+#define FILEZILLA_ENGINE_SFTP_MULTISTAT_HEADER
+
+#include "directorycache.h"
+#include "directorylistingparser.h"
+#include "sftpcontrolsocket.h"
+
+// Looks up many files in one directory. Files the directory cache cannot
+// answer for are stat'ed by fzsftp with many requests in flight, rather
+// than listing the whole directory or stat'ing each file in turn.
+//
+// The entries have the same form as those of LookupManyOpData, and the
+// results of the stat's go into the directory cache.
+class CSftpLookupManyOpData : public COpData, public CSftpOpData
+{
+public:
+	CSftpLookupManyOpData(CSftpControlSocket & controlSocket, CServerPath const& path, std::vector<std::wstring> const& files)
+		: CSftpLookupManyOpData(controlSocket, path, files, L"CSftpLookupManyOpData")
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+	int ParseEntry(sftp_list_message const& message);
+
+	std::vector<std::tuple<LookupResults, CDirentry>> const& entries() const { return entries_; }
+
+protected:
+	CSftpLookupManyOpData(CSftpControlSocket & controlSocket, CServerPath const& path, std::vector<std::wstring> const& files, wchar_t const* name)
+		: COpData(Command::lookup, name)
+		, CSftpOpData(controlSocket)
+		, path_(path)
+		, files_(files)
+	{}
+
+	CServerPath const path_;
+	std::vector<std::wstring> const files_;
+	std::vector<std::tuple<LookupResults, CDirentry>> entries_;
+
+	// Indexes into files_ not answered from the cache
+	std::vector<size_t> pending_;
+	size_t sent_{};
+	size_t batch_end_{};
+
+	std::unique_ptr<CDirectoryListingParser> listing_parser_;
+};
+
+// Looks up a single file the same way, a single stat instead of listing
+// the whole directory.
+class CSftpLookupOpData final : public CSftpLookupManyOpData
+{
+public:
+	CSftpLookupOpData(CSftpControlSocket & controlSocket, CServerPath const& path, std::wstring const& file, CDirentry * entry);
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+
+private:
+	int Result(int res);
+
+	CDirentry * entry_;
+	std::unique_ptr<CDirentry> internal_entry_;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include <filezilla.h>
+
+#include "process_pool.h"
+#include "shared_block.h"
+
+#include <libfilezilla/process.hpp>
+
+namespace {
+// Spares nobody needed for that long are stopped again
+fz::duration const max_idle_time = fz::duration::from_minutes(5);
+}
+
+bool CSftpProcessPool::spec::operator==(spec const& op) const
+{
+	return executable_ == op.executable_ && args_ == op.args_ && setup_ == op.setup_ && shm_ == op.shm_;
+}
+
+CSftpProcessPool::helper::helper() = default;
+CSftpProcessPool::helper::helper(helper &&) = default;
+CSftpProcessPool::helper& CSftpProcessPool::helper::operator=(helper &&) = default;
+
+CSftpProcessPool::helper::~helper()
+{
+	if (process_) {
+		process_->kill();
+	}
+}
+
+CSftpProcessPool::CSftpProcessPool(fz::event_loop & loop, fz::thread_pool & pool)
+	: fz::event_handler(loop)
+	, pool_(pool)
+{
+}
+
+CSftpProcessPool::~CSftpProcessPool()
+{
+	remove_handler();
+
+	{
+		fz::scoped_lock l(mutex_);
+		quit_ = true;
+	}
+	task_.join();
+}
+
+CSftpProcessPool::helper CSftpProcessPool::Lease(spec const& s, size_t count)
+{
+	helper ret;
+
+	{
+		fz::scoped_lock l(mutex_);
+
+		if (spec_ != s) {
+			// The settings have changed, the spares are of no use anymore
+			idle_.clear();
+			spec_ = s;
+		}
+		count_ = count;
+
+		if (!idle_.empty()) {
+			ret = std::move(idle_.front().helper_);
+			idle_.erase(idle_.begin());
+		}
+
+		if (idle_.size() < count_ && !refilling_) {
+			// The previous task has nothing left to do but to return
+			task_.join();
+			refilling_ = true;
+			task_ = pool_.spawn([this]() { Refill(); });
+			if (!task_) {
+				refilling_ = false;
+			}
+		}
+
+		if (count_ && !timer_) {
+			timer_ = add_timer(fz::duration::from_minutes(1), false);
+		}
+	}
+
+	if (!ret) {
+		ret = Spawn(s);
+	}
+	return ret;
+}
+
+CSftpProcessPool::helper CSftpProcessPool::Spawn(spec const& s)
+{
+	helper ret;
+
+	auto args = s.args_;
+	if (s.shm_) {
+		ret.shared_block_ = std::make_unique<CSftpSharedBlock>();
+		if (ret.shared_block_->create()) {
+			args.push_back(fzT("--shm"));
+			args.push_back(ret.shared_block_->name());
+		}
+		else {
+			ret.shared_block_.reset();
+		}
+	}
+
+	auto process = std::make_unique<fz::process>();
+	if (!process->spawn(s.executable_, args)) {
+		return helper();
+	}
+	if (!s.setup_.empty() && !process->write(s.setup_)) {
+		process->kill();
+		return helper();
+	}
+	ret.process_ = std::move(process);
+
+	return ret;
+}
+
+void CSftpProcessPool::Linger(std::unique_ptr<fz::process> && process)
+{
+	if (!process) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+
+	helper h;
+	h.process_ = std::move(process);
+	lingering_.push_back(std::move(h));
+
+	if (!timer_) {
+		timer_ = add_timer(fz::duration::from_minutes(1), false);
+	}
+}
+
+void CSftpProcessPool::Refill()
+{
+	fz::scoped_lock l(mutex_);
+	while (!quit_ && idle_.size() < count_) {
+		spec const s = spec_;
+
+		l.unlock();
+		helper h = Spawn(s);
+		l.lock();
+
+		if (!h) {
+			break;
+		}
+		if (s == spec_) {
+			idle_.push_back({std::move(h), fz::monotonic_clock::now()});
+		}
+	}
+	refilling_ = false;
+}
+
+void CSftpProcessPool::operator()(fz::event_base const& ev)
+{
+	fz::dispatch<fz::timer_event>(ev, this, &CSftpProcessPool::OnTimer);
+}
+
+void CSftpProcessPool::OnTimer(fz::timer_id)
+{
+	fz::scoped_lock l(mutex_);
+
+	auto const now = fz::monotonic_clock::now();
+	for (auto it = idle_.begin(); it != idle_.end(); ) {
+		if (now - it->since_ >= max_idle_time) {
+			it = idle_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	// Lingering processes do not read their input, writing to one only
+	// fails once it has exited. Dropping it reaps it.
+	for (auto it = lingering_.begin(); it != lingering_.end(); ) {
+		if (!it->process_->write("\n")) {
+			it = lingering_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	if (idle_.empty() && !refilling_) {
+		// Nothing gets started again until the next connection
+		count_ = 0;
+		if (lingering_.empty()) {
+			stop_timer(timer_);
+			timer_ = 0;
+		}
+	}
+}
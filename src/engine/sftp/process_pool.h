@@ -0,0 +1,102 @@
+#ifndef FILEZILLA_ENGINE_SFTP_PROCESS_POOL_HEADER
+#define FILEZILLA_ENGINE_SFTP_PROCESS_POOL_HEADER
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/string.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace fz {
+class process;
+}
+
+class CSftpSharedBlock;
+
+// fzsftp processes started ahead of time. When the queue opens several
+// connections at once, starting the process and handing it the key files
+// is then paid for once in the background instead of by every connection.
+//
+// Helpers are keyed by everything that went into starting them. Their
+// output is left unread, the connection taking one over receives the
+// startup reply followed by the replies to the setup commands.
+class CSftpProcessPool final : public fz::event_handler
+{
+public:
+	struct spec final
+	{
+		bool operator==(spec const& op) const;
+		bool operator!=(spec const& op) const { return !(*this == op); }
+
+		fz::native_string executable_;
+		std::vector<fz::native_string> args_;
+
+		// Written right after starting, e.g. the keyfile commands
+		std::string setup_;
+
+		// Whether to pass a shared block through --shm
+		bool shm_{};
+	};
+
+	struct helper final
+	{
+		helper();
+		helper(helper &&);
+		helper& operator=(helper &&);
+		~helper();
+
+		explicit operator bool() const { return static_cast<bool>(process_); }
+
+		std::unique_ptr<fz::process> process_;
+
+		// Only if requested and available
+		std::unique_ptr<CSftpSharedBlock> shared_block_;
+	};
+
+	CSftpProcessPool(fz::event_loop & loop, fz::thread_pool & pool);
+	virtual ~CSftpProcessPool();
+
+	// Returns a started helper. Afterwards, up to count helpers with the
+	// same spec get started in the background for the next callers.
+	helper Lease(spec const& s, size_t count);
+
+	// Starts a helper right away
+	static helper Spawn(spec const& s);
+
+	// Takes over a connection's fzsftp that got told to linger. Other
+	// fzsftp processes may still share its connection to the server, it
+	// exits after the last of them. Until then it is kept here rather
+	// than by the engine that started it.
+	void Linger(std::unique_ptr<fz::process> && process);
+
+private:
+	struct idle_helper final
+	{
+		helper helper_;
+		fz::monotonic_clock since_;
+	};
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnTimer(fz::timer_id);
+
+	void Refill();
+
+	fz::thread_pool & pool_;
+
+	fz::mutex mutex_;
+	spec spec_;
+	size_t count_{};
+	std::vector<idle_helper> idle_;
+	std::vector<helper> lingering_;
+	bool quit_{};
+
+	fz::async_task task_;
+	bool refilling_{};
+
+	fz::timer_id timer_{};
+};
+
+#endif
@@ -2,22 +2,28 @@
 
 #include "chmod.h"
 #include "connect.h"
+#include "copy.h"
 #include "cwd.h"
 #include "delete.h"
 #include "../directorycache.h"
 #include "directorylistingparser.h"
 #include "engineprivate.h"
 #include "event.h"
+#include "filehash.h"
 #include "filetransfer.h"
 #include "list.h"
 #include "input_thread.h"
 #include "mkd.h"
+#include "multistat.h"
 #include "pathcache.h"
+#include "process_pool.h"
 #include "proxy.h"
 #include "rename.h"
 #include "rmd.h"
 #include "servercapabilities.h"
 #include "sftpcontrolsocket.h"
+#include "shared_block.h"
+#include "uploadbatch.h"
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/process.hpp>
@@ -55,6 +61,29 @@ void CSftpControlSocket::Connect(CServer const& server, Credentials const& crede
 	Push(std::make_unique<CSftpConnectOpData>(*this));
 }
 
+void CSftpControlSocket::OnSftpBatchEvent(sftp_message_batch const& batch)
+{
+	// Handling a message can close the connection, the remainder of the
+	// batch belongs to the old process then.
+	auto * const thread = input_thread_.get();
+	for (auto const& message : batch.messages) {
+		if (!thread || input_thread_.get() != thread) {
+			return;
+		}
+		OnSftpEvent(message);
+	}
+	for (auto const& message : batch.list_entries) {
+		if (!thread || input_thread_.get() != thread) {
+			return;
+		}
+		OnSftpListEvent(message);
+	}
+
+	if (thread && input_thread_.get() == thread) {
+		thread->recycle(batch);
+	}
+}
+
 void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 {
 	if (!currentServer_) {
@@ -105,29 +134,7 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 		SetActive(CFileZillaEngine::send);
 		break;
 	case sftpEvent::Transfer:
-		{
-			auto value = fz::to_integral<int64_t>(message.text[0]);
-
-			bool tmp;
-			CTransferStatus status = engine_.transfer_status_.Get(tmp);
-			if (!status.empty() && !status.madeProgress) {
-				if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
-					auto & data = static_cast<CSftpFileTransferOpData &>(*operations_.back());
-					if (data.download_) {
-						if (value > 0) {
-							engine_.transfer_status_.SetMadeProgress();
-						}
-					}
-					else {
-						if (status.currentOffset > status.startOffset + 65565) {
-							engine_.transfer_status_.SetMadeProgress();
-						}
-					}
-				}
-			}
-
-			engine_.transfer_status_.Update(value);
-		}
+		UpdateTransferProgress(fz::to_integral<int64_t>(message.text[0]));
 		break;
 	case sftpEvent::AskHostkey:
 	case sftpEvent::AskHostkeyChanged:
@@ -257,6 +264,29 @@ void CSftpControlSocket::OnSftpEvent(sftp_message const& message)
 	}
 }
 
+void CSftpControlSocket::UpdateTransferProgress(int64_t value)
+{
+	bool tmp;
+	CTransferStatus status = engine_.transfer_status_.Get(tmp);
+	if (!status.empty() && !status.madeProgress) {
+		if (!operations_.empty() && operations_.back()->opId == Command::transfer) {
+			auto & data = static_cast<CSftpFileTransferOpData &>(*operations_.back());
+			if (data.download_) {
+				if (value > 0) {
+					engine_.transfer_status_.SetMadeProgress();
+				}
+			}
+			else {
+				if (status.currentOffset > status.startOffset + 65565) {
+					engine_.transfer_status_.SetMadeProgress();
+				}
+			}
+		}
+	}
+
+	engine_.transfer_status_.Update(value);
+}
+
 void CSftpControlSocket::OnSftpListEvent(sftp_list_message const& message)
 {
 	if (!currentServer_) {
@@ -267,12 +297,19 @@ void CSftpControlSocket::OnSftpListEvent(sftp_list_message const& message)
 		return;
 	}
 
-	if (operations_.empty() || operations_.back()->opId != Command::list) {
+	if (!operations_.empty() && operations_.back()->opId == Command::lookup) {
+		// Only the mstat based lookups get listing entries
+		int res = static_cast<CSftpLookupManyOpData&>(*operations_.back()).ParseEntry(message);
+		if (res != FZ_REPLY_WOULDBLOCK) {
+			ResetOperation(res);
+		}
+	}
+	else if (operations_.empty() || operations_.back()->opId != Command::list) {
 		log(logmsg::debug_warning, L"sftpEvent::Listentry outside list operation, ignoring.");
 		return;
 	}
 	else {
-		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(std::move(message.text), message.mtime, std::move(message.name));
+		int res = static_cast<CSftpListOpData&>(*operations_.back()).ParseEntry(message);
 		if (res != FZ_REPLY_WOULDBLOCK) {
 			ResetOperation(res);
 		}
@@ -307,6 +344,7 @@ int CSftpControlSocket::SendCommand(std::wstring const& cmd, std::wstring const&
 		return FZ_REPLY_INTERNALERROR;
 	}
 
+	engine_.Trace(trace_event::command_sent, static_cast<int64_t>(cmd.size()));
 	return AddToStream(cmd + L"\n");
 }
 
@@ -449,6 +487,7 @@ void CSftpControlSocket::ProcessReply(int result, std::wstring const& reply)
 	}
 
 	response_ = reply;
+	engine_.Trace(trace_event::reply_received, result);
 
 	auto & data = *operations_.back();
 	log(logmsg::debug_verbose, L"%s::ParseResponse() in state %d", data.name_, data.opState);
@@ -482,10 +521,18 @@ void CSftpControlSocket::FileTransfer(std::wstring const& localFile, CServerPath
 int CSftpControlSocket::DoClose(int nErrorCode)
 {
 	remove_bucket();
+	rate_limiter_.reset();
 
+	// If idle, a shared fzsftp is not killed but told to linger. It then
+	// closes its output, which ends the input thread.
+	bool linger{};
 	if (process_) {
-		process_->kill();
+		linger = sharing_ && input_thread_ && operations_.empty() && process_->write("linger\n");
+		if (!linger) {
+			process_->kill();
+		}
 	}
+	sharing_ = false;
 
 	if (input_thread_) {
 		input_thread_.reset();
@@ -494,7 +541,7 @@ int CSftpControlSocket::DoClose(int nErrorCode)
 			if (ev.first != this) {
 				return false;
 			}
-			else if (ev.second->derived_type() == CSftpEvent::type() || ev.second->derived_type() == CTerminateEvent::type()) {
+			else if (ev.second->derived_type() == CSftpBatchEvent::type() || ev.second->derived_type() == CTerminateEvent::type()) {
 				return true;
 			}
 			return false;
@@ -502,8 +549,16 @@ int CSftpControlSocket::DoClose(int nErrorCode)
 
 		event_loop_.filter_events(threadEventsFilter);
 	}
+	if (linger) {
+		log(logmsg::debug_info, L"Leaving shared connection to the remaining downstreams");
+		engine_.GetContext().GetSftpProcessPool().Linger(std::move(process_));
+	}
 	process_.reset();
 
+	stop_timer(shared_block_timer_);
+	shared_block_timer_ = 0;
+	shared_block_.reset();
+
 	m_sftpEncryptionDetails = CSftpEncryptionNotification();
 
 	return CControlSocket::DoClose(nErrorCode);
@@ -556,6 +611,31 @@ void CSftpControlSocket::Chmod(CChmodCommand const& command)
 	Push(std::make_unique<CSftpChmodOpData>(*this, command));
 }
 
+void CSftpControlSocket::FileHash(CFileHashCommand const& command)
+{
+	Push(std::make_unique<CSftpFileHashOpData>(*this, command));
+}
+
+void CSftpControlSocket::Copy(CCopyCommand const& command)
+{
+	Push(std::make_unique<CSftpCopyOpData>(*this, command));
+}
+
+void CSftpControlSocket::Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry)
+{
+	Push(std::make_unique<CSftpLookupOpData>(*this, path, file, entry));
+}
+
+void CSftpControlSocket::Lookup(CServerPath const& path, std::vector<std::wstring> const& files)
+{
+	Push(std::make_unique<CSftpLookupManyOpData>(*this, path, files));
+}
+
+void CSftpControlSocket::UploadBatch(CUploadBatchCommand const& command)
+{
+	Push(std::make_unique<CSftpUploadBatchOpData>(*this, command));
+}
+
 void CSftpControlSocket::Rename(CRenameCommand const& command)
 {
 	Push(std::make_unique<CSftpRenameOpData>(*this, command));
@@ -573,6 +653,22 @@ void CSftpControlSocket::OnQuotaRequest(fz::direction::type const d)
 	}
 
 	size_t bytes = available(d);
+	if (shared_block_ && shared_block_->attached()) {
+		int const limit = engine_.GetOptions().GetOptionVal(OPTION_SPEEDLIMIT_INBOUND + static_cast<int>(d));
+		bool wake{};
+		if (bytes == fz::rate::unlimited) {
+			wake = shared_block_->grant(d, bytes, limit);
+		}
+		else if (bytes > 0) {
+			wake = shared_block_->grant(d, bytes, limit);
+			consume(d, bytes);
+		}
+		if (wake) {
+			AddToStream(std::string("-w\n"));
+		}
+		return;
+	}
+
 	if (bytes == fz::rate::unlimited) {
 		AddToStream(fz::sprintf("-%d-\n", d));
 	}
@@ -589,11 +685,61 @@ void CSftpControlSocket::OnQuotaRequest(fz::direction::type const d)
 	}
 }
 
+void CSftpControlSocket::StartSharedBlockTimer()
+{
+	if (shared_block_ && !shared_block_timer_) {
+		shared_block_timer_ = add_timer(fz::duration::from_milliseconds(100), false);
+	}
+}
+
+void CSftpControlSocket::PollSharedBlock()
+{
+	if (!shared_block_ || !shared_block_->attached()) {
+		return;
+	}
+
+	int64_t const transferred = shared_block_->take_transferred();
+	if (transferred) {
+		UpdateTransferProgress(transferred);
+	}
+
+	for (auto const d : { fz::direction::inbound, fz::direction::outbound }) {
+		if (shared_block_->wanted(d)) {
+			// Normally already handled through the notification fzsftp
+			// sends when it runs dry, this catches refills the bucket
+			// could not satisfy at that time.
+			OnQuotaRequest(d);
+		}
+		else if (shared_block_->unlimited(d) && available(d) != fz::rate::unlimited) {
+			// A speed limit got enabled
+			shared_block_->revoke_unlimited(d);
+		}
+	}
+}
+
+void CSftpControlSocket::OnTimer(fz::timer_id id)
+{
+	if (id != shared_block_timer_) {
+		CControlSocket::OnTimer(id);
+		return;
+	}
+
+	PollSharedBlock();
+
+	if (operations_.empty() || (operations_.back()->opId != Command::transfer && operations_.back()->opId != Command::uploadbatch)) {
+		stop_timer(shared_block_timer_);
+		shared_block_timer_ = 0;
+	}
+}
+
 void CSftpControlSocket::operator()(fz::event_base const& ev)
 {
-	if (fz::dispatch<CSftpEvent, CSftpListEvent, CTerminateEvent, SftpRateAvailableEvent>(ev, this,
-		&CSftpControlSocket::OnSftpEvent,
-		&CSftpControlSocket::OnSftpListEvent,
+	if (fz::dispatch<fz::timer_event>(ev, this, &CSftpControlSocket::OnTimer)) {
+		return;
+	}
+
+	if (fz::dispatch<CSftpBatchEvent, CTerminateEvent, SftpRateAvailableEvent>(ev, this,
+		&CSftpControlSocket::OnSftpBatchEvent,
 		&CSftpControlSocket::OnTerminate,
 		&CSftpControlSocket::OnQuotaRequest)) {
 		return;
@@ -10,8 +10,10 @@ class process;
 }
 
 class CSftpInputThread;
+class CSftpSharedBlock;
 struct sftp_message;
 struct sftp_list_message;
+struct sftp_message_batch;
 
 class CSftpControlSocket final : public CControlSocket, public fz::bucket
 {
@@ -30,6 +32,11 @@ public:
 	virtual void Mkdir(CServerPath const& path) override;
 	virtual void Rename(CRenameCommand const& command) override;
 	virtual void Chmod(CChmodCommand const& command) override;
+	virtual void FileHash(CFileHashCommand const& command) override;
+	virtual void Copy(CCopyCommand const& command) override;
+	virtual void Lookup(CServerPath const& path, std::wstring const& file, CDirentry * entry = nullptr) override;
+	virtual void Lookup(CServerPath const& path, std::vector<std::wstring> const& files) override;
+	void UploadBatch(CUploadBatchCommand const& command);
 	virtual void Cancel() override;
 
 	virtual bool Connected() const override { return input_thread_.operator bool(); }
@@ -54,10 +61,31 @@ protected:
 	virtual void wakeup(fz::direction::type const d) override;
 	void OnQuotaRequest(fz::direction::type const d);
 
+	void UpdateTransferProgress(int64_t value);
+
+	// While a transfer is running, periodically collects progress from the
+	// shared block and refills quota fzsftp is waiting for
+	void StartSharedBlockTimer();
+	void PollSharedBlock();
+
 	std::unique_ptr<fz::process> process_;
 	std::unique_ptr<CSftpInputThread> input_thread_;
 
+	// fzsftp got started with -share and may be the upstream of other
+	// connections to the same server
+	bool sharing_{};
+
+	// The limiter of the server if it has one, the bucket is added to the
+	// global limiter otherwise
+	std::shared_ptr<fz::rate_limiter> rate_limiter_;
+
+	// Only set if fzsftp was started with --shm
+	std::unique_ptr<CSftpSharedBlock> shared_block_;
+	fz::timer_id shared_block_timer_{};
+
 	virtual void operator()(fz::event_base const& ev) override;
+	void OnTimer(fz::timer_id id);
+	void OnSftpBatchEvent(sftp_message_batch const& batch);
 	void OnSftpEvent(sftp_message const& message);
 	void OnSftpListEvent(sftp_list_message const& message);
 	void OnTerminate(std::wstring const& error);
@@ -70,16 +98,24 @@ protected:
 	int result_{};
 	std::wstring response_;
 
+	// Set once the server did not run tar for a tput command
+	bool archiveUnavailable_{};
+
 	friend class CProtocolOpData<CSftpControlSocket>;
 	friend class CSftpChangeDirOpData;
 	friend class CSftpChmodOpData;
 	friend class CSftpConnectOpData;
+	friend class CSftpCopyOpData;
 	friend class CSftpDeleteOpData;
+	friend class CSftpFileHashOpData;
 	friend class CSftpFileTransferOpData;
 	friend class CSftpListOpData;
+	friend class CSftpLookupManyOpData;
+	friend class CSftpLookupOpData;
 	friend class CSftpMkdirOpData;
 	friend class CSftpRemoveDirOpData;
 	friend class CSftpRenameOpData;
+	friend class CSftpUploadBatchOpData;
 };
 
 typedef CProtocolOpData<CSftpControlSocket> CSftpOpData;
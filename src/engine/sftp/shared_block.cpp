@@ -0,0 +1,200 @@
+#include <filezilla.h>
+
+#include "shared_block.h"
+
+#include <libfilezilla/encode.hpp>
+#include <libfilezilla/util.hpp>
+
+#include <atomic>
+#include <limits>
+
+#ifndef FZ_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Must match struct fzsftp_shared_block in src/putty/fzsftp.c. Index 0 of
+// the arrays is inbound (receive), index 1 outbound (send).
+struct CSftpSharedBlock::layout
+{
+	uint32_t magic;
+	uint32_t attached;
+
+	// Bytes fzsftp may still transfer, -1 if unlimited
+	int64_t available[2];
+	int32_t limit[2];
+
+	// Set by fzsftp when it runs out of quota, cleared by the engine on refill
+	int32_t wanted[2];
+
+	// Bytes written to the local file (downloads) or acknowledged by the
+	// server (uploads), added to by fzsftp and taken by the engine
+	int64_t transferred;
+};
+
+namespace {
+uint32_t const shared_block_magic = 0x465a5351; // "FZSQ"
+size_t const shared_block_size = 64;
+
+static_assert(sizeof(std::atomic<int64_t>) == sizeof(int64_t), "Unexpected atomic layout");
+static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t), "Unexpected atomic layout");
+static_assert(std::atomic<int64_t>::is_always_lock_free, "Shared counters need lock-free atomics");
+
+template<typename T>
+std::atomic<T>& atomic(T & v)
+{
+	return *reinterpret_cast<std::atomic<T>*>(&v);
+}
+
+template<typename T>
+std::atomic<T> const& atomic(T const& v)
+{
+	return *reinterpret_cast<std::atomic<T> const*>(&v);
+}
+}
+
+CSftpSharedBlock::~CSftpSharedBlock()
+{
+	close();
+}
+
+bool CSftpSharedBlock::create()
+{
+	static_assert(sizeof(layout) <= shared_block_size, "Shared block too small");
+
+	close();
+
+	// Short enough for the 31 character limit some platforms impose on POSIX names
+	std::string const id = fz::hex_encode<std::string>(fz::random_bytes(8));
+
+#ifdef FZ_WINDOWS
+	name_ = fz::to_native(L"Local\\FileZilla-fzsftp-" + fz::to_wstring(id));
+	HANDLE h = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(shared_block_size), name_.c_str());
+	if (!h) {
+		name_.clear();
+		return false;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(h);
+		name_.clear();
+		return false;
+	}
+	void* p = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, shared_block_size);
+	if (!p) {
+		CloseHandle(h);
+		name_.clear();
+		return false;
+	}
+	mapping_ = h;
+#else
+	name_ = "/fzsftp-" + id;
+	int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		name_.clear();
+		return false;
+	}
+	if (ftruncate(fd, static_cast<off_t>(shared_block_size)) != 0) {
+		::close(fd);
+		shm_unlink(name_.c_str());
+		name_.clear();
+		return false;
+	}
+	void* p = mmap(nullptr, shared_block_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(name_.c_str());
+		name_.clear();
+		return false;
+	}
+#endif
+
+	// Freshly created mappings are zero-filled: no quota, nothing wanted
+	block_ = static_cast<layout*>(p);
+	atomic(block_->magic).store(shared_block_magic, std::memory_order_release);
+
+	return true;
+}
+
+void CSftpSharedBlock::close()
+{
+	if (!block_) {
+		return;
+	}
+
+#ifdef FZ_WINDOWS
+	UnmapViewOfFile(block_);
+	CloseHandle(static_cast<HANDLE>(mapping_));
+	mapping_ = nullptr;
+#else
+	munmap(block_, shared_block_size);
+	// fzsftp unlinks the name as soon as it has opened the block, this is
+	// for the case it never got that far.
+	shm_unlink(name_.c_str());
+#endif
+	block_ = nullptr;
+	name_.clear();
+}
+
+bool CSftpSharedBlock::attached() const
+{
+	return block_ && atomic(block_->attached).load(std::memory_order_acquire) != 0;
+}
+
+bool CSftpSharedBlock::grant(fz::direction::type d, size_t bytes, int limit)
+{
+	if (!block_) {
+		return false;
+	}
+
+	atomic(block_->limit[d]).store(limit, std::memory_order_relaxed);
+
+	auto & available = atomic(block_->available[d]);
+	if (bytes == fz::rate::unlimited) {
+		available.store(-1, std::memory_order_release);
+	}
+	else {
+		int64_t const add = (bytes > static_cast<size_t>(std::numeric_limits<int64_t>::max() / 2)) ? std::numeric_limits<int64_t>::max() / 2 : static_cast<int64_t>(bytes);
+
+		// fzsftp only ever decreases a non-negative value, replace -1 outright
+		int64_t cur = available.load(std::memory_order_relaxed);
+		int64_t next;
+		do {
+			next = (cur < 0) ? add : cur + add;
+		} while (!available.compare_exchange_weak(cur, next, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// fzsftp sets wanted before checking the quota one last time. Either it
+	// sees what got added above, or this sees wanted set.
+	return atomic(block_->wanted[d]).exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+void CSftpSharedBlock::revoke_unlimited(fz::direction::type d)
+{
+	if (!block_) {
+		return;
+	}
+
+	int64_t expected = -1;
+	atomic(block_->available[d]).compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+}
+
+bool CSftpSharedBlock::unlimited(fz::direction::type d) const
+{
+	return block_ && atomic(block_->available[d]).load(std::memory_order_acquire) < 0;
+}
+
+bool CSftpSharedBlock::wanted(fz::direction::type d) const
+{
+	return block_ && atomic(block_->wanted[d]).load(std::memory_order_acquire) != 0;
+}
+
+int64_t CSftpSharedBlock::take_transferred()
+{
+	if (!block_) {
+		return 0;
+	}
+
+	return atomic(block_->transferred).exchange(0, std::memory_order_acq_rel);
+}
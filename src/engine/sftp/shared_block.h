@@ -0,0 +1,69 @@
+#ifndef FILEZILLA_ENGINE_SFTP_SHAREDBLOCK_HEADER
+#define FILEZILLA_ENGINE_SFTP_SHAREDBLOCK_HEADER
+
+#include <libfilezilla/rate_limiter.hpp>
+#include <libfilezilla/string.hpp>
+
+#include <stdint.h>
+
+// Small block of shared memory between the engine and fzsftp.
+//
+// The rate limiter grants quota to fzsftp by adding to a counter in the
+// block and fzsftp reports transfer progress through another counter, so
+// neither needs a message on the stdio pipes for each refill or progress
+// update. fzsftp only notifies the engine when it has run out of quota.
+//
+// The layout must match the one in src/putty/fzsftp.c
+class CSftpSharedBlock final
+{
+public:
+	CSftpSharedBlock() = default;
+	~CSftpSharedBlock();
+
+	CSftpSharedBlock(CSftpSharedBlock const&) = delete;
+	CSftpSharedBlock& operator=(CSftpSharedBlock const&) = delete;
+
+	// Creates and maps a new block. Returns false if shared memory is
+	// not available, in which case the pipe protocol has to be used.
+	bool create();
+
+	// Passed to fzsftp through --shm
+	fz::native_string const& name() const { return name_; }
+
+	// Set by fzsftp once it has mapped the block. Until then, and if it
+	// never does, quota has to be granted through the pipe.
+	bool attached() const;
+
+	// Adds bytes to the quota in the given direction. If bytes is
+	// fz::rate::unlimited, the direction becomes unlimited.
+	//
+	// Returns true if fzsftp had run out of quota. It then blocks on its
+	// input and has to be sent a wakeup.
+	bool grant(fz::direction::type d, size_t bytes, int limit);
+
+	// Turns an unlimited direction back into a limited one with no quota,
+	// so that fzsftp asks for more the next time it wants to transfer.
+	void revoke_unlimited(fz::direction::type d);
+
+	bool unlimited(fz::direction::type d) const;
+
+	// Whether fzsftp has run out of quota and is waiting for more
+	bool wanted(fz::direction::type d) const;
+
+	// Returns and resets the number of bytes transferred since the last call
+	int64_t take_transferred();
+
+private:
+	struct layout;
+
+	void close();
+
+	layout* block_{};
+	fz::native_string name_;
+
+#ifdef FZ_WINDOWS
+	void* mapping_{};
+#endif
+};
+
+#endif
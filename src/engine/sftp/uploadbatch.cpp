@@ -0,0 +1,195 @@
+#include <filezilla.h>
+
+#include "../directorycache.h"
+#include "uploadbatch.h"
+
+#include <libfilezilla/local_filesys.hpp>
+
+enum uploadBatchStates
+{
+	uploadbatch_init = 0,
+	uploadbatch_lookup,
+	uploadbatch_mkdir,
+	uploadbatch_send,
+	uploadbatch_transfer
+};
+
+int CSftpUploadBatchOpData::Send()
+{
+	if (opState == uploadbatch_init) {
+		if (remotePath_.GetType() == DEFAULT) {
+			remotePath_.SetType(currentServer_.GetType());
+		}
+
+		log(logmsg::status, _("Starting upload of %d files to %s"), files_.size(), remotePath_.GetPath());
+
+		// One mstat tells whether the directory exists, and the cache learns
+		// about the files which are about to be overwritten.
+		std::vector<std::wstring> names;
+		for (auto const& file : files_) {
+			names.push_back(file.remoteFile);
+		}
+		opState = uploadbatch_lookup;
+		controlSocket_.Lookup(remotePath_, names);
+		return FZ_REPLY_CONTINUE;
+	}
+	else if (opState == uploadbatch_send) {
+		bool const preserveTimes = engine_.GetOptions().GetOptionVal(OPTION_PRESERVE_TIMESTAMPS) != 0;
+
+		// tar only takes plain names of limited length into the directory
+		archive_ = engine_.GetOptions().GetOptionVal(OPTION_SFTP_ARCHIVE_UPLOADS) != 0 && !controlSocket_.archiveUnavailable_;
+		for (size_t i = 0; archive_ && i < files_.size(); ++i) {
+			std::wstring const& name = files_[i].remoteFile;
+			std::string const converted = controlSocket_.ConvToServer(name);
+			if (name == L"." || name == L".." || converted.empty() || converted.size() > 100 || converted.find('/') != std::string::npos) {
+				archive_ = false;
+			}
+		}
+
+		// Same as for single transfers, local filenames are passed as UTF-8
+		// and remote filenames in server encoding.
+		std::string cmd = archive_ ? "tput" : "mput";
+		std::wstring logstr = archive_ ? L"tput" : L"mput";
+
+		if (archive_) {
+			std::wstring const dir = controlSocket_.QuoteFilename(remotePath_.GetPath());
+			std::string const convertedDir = controlSocket_.ConvToServer(dir);
+			if (convertedDir.empty()) {
+				log(logmsg::error, _("Could not convert command to server encoding"));
+				return FZ_REPLY_ERROR;
+			}
+			cmd += " " + convertedDir;
+			logstr += L" " + dir;
+		}
+
+		sizes_.clear();
+		int64_t totalSize{};
+		for (auto const& file : files_) {
+			int64_t size{-1};
+			fz::datetime time;
+			bool isLink;
+			if (fz::local_filesys::get_file_info(fz::to_native(file.localFile), isLink, &size, &time, nullptr) != fz::local_filesys::file) {
+				size = -1;
+			}
+			sizes_.push_back(size);
+			if (size > 0) {
+				totalSize += size;
+			}
+
+			std::wstring seconds = L"0";
+			if (preserveTimes && !time.empty()) {
+				time -= fz::duration::from_minutes(currentServer_.GetTimezoneOffset());
+				seconds = fz::to_wstring(time.get_time_t());
+			}
+
+			std::wstring const localFile = controlSocket_.QuoteFilename(file.localFile);
+			std::wstring const remoteFile = controlSocket_.QuoteFilename(archive_ ? file.remoteFile : remotePath_.FormatFilename(file.remoteFile));
+			std::string const convertedRemote = controlSocket_.ConvToServer(remoteFile);
+			if (convertedRemote.empty()) {
+				log(logmsg::error, _("Could not convert command to server encoding"));
+				return FZ_REPLY_ERROR;
+			}
+
+			cmd += " " + fz::to_utf8(seconds) + " " + fz::to_utf8(localFile) + " " + convertedRemote;
+			logstr += L" " + seconds + L" " + localFile + L" " + remoteFile;
+		}
+
+		engine_.transfer_status_.Init(totalSize, 0, false);
+		engine_.transfer_status_.SetStartTime();
+		controlSocket_.StartSharedBlockTimer();
+		controlSocket_.SetWait(true);
+
+		opState = uploadbatch_transfer;
+
+		controlSocket_.log_raw(logmsg::command, logstr);
+		return controlSocket_.AddToStream(cmd + "\r\n");
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CSftpUploadBatchOpData::Send()");
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CSftpUploadBatchOpData::ParseResponse()
+{
+	if (opState != uploadbatch_transfer) {
+		log(logmsg::debug_warning, L"CSftpUploadBatchOpData::ParseResponse called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	controlSocket_.PollSharedBlock();
+
+	if (controlSocket_.result_ == FZ_REPLY_OK && !controlSocket_.response_.empty()) {
+		// Result of a single file: mput <index> OK|failed, or the same with tput
+		auto const tokens = fz::strtok_view(controlSocket_.response_, ' ');
+		if (tokens.size() != 3 || tokens[0] != (archive_ ? L"tput" : L"mput")) {
+			log(logmsg::debug_warning, L"Unexpected reply during batch upload");
+			return FZ_REPLY_WOULDBLOCK;
+		}
+		size_t const index = fz::to_integral<size_t>(tokens[1], files_.size());
+		if (index >= files_.size()) {
+			log(logmsg::debug_warning, L"Invalid file index in batch upload reply");
+			return FZ_REPLY_WOULDBLOCK;
+		}
+
+		bool const succeeded = tokens[2] == L"OK";
+		auto const& file = files_[index];
+		bool updated = engine_.GetDirectoryCache().UpdateFile(currentServer_, remotePath_, file.remoteFile, true, CDirectoryCache::file, succeeded ? sizes_[index] : -1);
+		if (updated) {
+			controlSocket_.SendDirectoryListingNotification(remotePath_, false);
+		}
+
+		if (succeeded) {
+			log(logmsg::status, _("Uploaded %s"), remotePath_.FormatFilename(file.remoteFile));
+		}
+		else {
+			log(logmsg::error, _("Upload of %s failed"), remotePath_.FormatFilename(file.remoteFile));
+			failed_ = true;
+		}
+		++done_;
+
+		engine_.AddNotification(new CUploadBatchNotification(index, succeeded));
+		return FZ_REPLY_WOULDBLOCK;
+	}
+
+	// The Done for the whole batch
+	if (archive_ && !done_ && controlSocket_.result_ != FZ_REPLY_OK) {
+		// tar did not get to run, nothing has been uploaded
+		log(logmsg::status, _("Server does not run tar for archive uploads, uploading the files separately"));
+		controlSocket_.archiveUnavailable_ = true;
+		opState = uploadbatch_send;
+		return FZ_REPLY_CONTINUE;
+	}
+
+	if (done_ < files_.size()) {
+		log(logmsg::debug_info, L"%d files of the batch have not been uploaded", files_.size() - done_);
+	}
+	if (controlSocket_.result_ == FZ_REPLY_OK && !failed_ && done_ == files_.size()) {
+		log(logmsg::status, _("Upload of %d files successful"), files_.size());
+		return FZ_REPLY_OK;
+	}
+
+	return FZ_REPLY_ERROR;
+}
+
+int CSftpUploadBatchOpData::SubcommandResult(int prevResult, COpData const&)
+{
+	if (opState == uploadbatch_lookup) {
+		if (prevResult != FZ_REPLY_OK) {
+			// The directory could not be resolved, create it first
+			log(logmsg::debug_info, L"Could not look up the files in %s, trying to create the directory", remotePath_.GetPath());
+			opState = uploadbatch_mkdir;
+			controlSocket_.Mkdir(remotePath_);
+			return FZ_REPLY_CONTINUE;
+		}
+		opState = uploadbatch_send;
+		return FZ_REPLY_CONTINUE;
+	}
+	else if (opState == uploadbatch_mkdir) {
+		// If it still does not exist, the uploads themselves fail
+		opState = uploadbatch_send;
+		return FZ_REPLY_CONTINUE;
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CSftpUploadBatchOpData::SubcommandResult()");
+	return FZ_REPLY_INTERNALERROR;
+}
@@ -0,0 +1,42 @@
+#ifndef FILEZILLA_ENGINE_SFTP_UPLOADBATCH_HEADER
+#define FILEZILLA_ENGINE_SFTP_UPLOADBATCH_HEADER
+
+#include "sftpcontrolsocket.h"
+
+// Uploads many small files through a single mput command. fzsftp keeps
+// several files in flight, so the round trips of opening, closing and
+// setting the modification time of one file overlap with the others.
+// A batched lookup first checks the directory, which gets created if it
+// cannot be resolved.
+//
+// With OPTION_SFTP_ARCHIVE_UPLOADS, the tput command is used instead: the
+// files are streamed as a tar archive to tar run on the server, without
+// any round trips per file. If the server does not run it, the batch is
+// sent through mput and so are later ones on the connection.
+class CSftpUploadBatchOpData final : public COpData, public CSftpOpData
+{
+public:
+	CSftpUploadBatchOpData(CSftpControlSocket & controlSocket, CUploadBatchCommand const& command)
+		: COpData(Command::uploadbatch, L"CSftpUploadBatchOpData")
+		, CSftpOpData(controlSocket)
+		, remotePath_(command.remotePath_)
+		, files_(command.files_)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
+
+private:
+	CServerPath remotePath_;
+	std::vector<CUploadBatchCommand::file> const files_;
+
+	// Local file sizes, -1 if unknown
+	std::vector<int64_t> sizes_;
+
+	size_t done_{};
+	bool failed_{};
+	bool archive_{};
+};
+
+#endif
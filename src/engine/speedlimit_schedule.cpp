@@ -0,0 +1,128 @@
+#include <filezilla.h>
+
+#include "speedlimit_schedule.h"
+
+#include <libfilezilla/string.hpp>
+
+namespace {
+wchar_t const* const day_names[] = { L"sun", L"mon", L"tue", L"wed", L"thu", L"fri", L"sat" };
+
+int parse_day(std::wstring const& name)
+{
+	for (int i = 0; i < 7; ++i) {
+		if (name == day_names[i]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// "mon-fri" or "sat,sun", also mixed
+int parse_days(std::wstring const& days)
+{
+	int ret{};
+	for (auto const& token : fz::strtok(days, L",")) {
+		size_t const pos = token.find('-');
+		int const first = parse_day(token.substr(0, pos));
+		int const last = (pos == std::wstring::npos) ? first : parse_day(token.substr(pos + 1));
+		if (first < 0 || last < 0) {
+			return 0;
+		}
+		for (int day = first; ; day = (day + 1) % 7) {
+			ret |= 1 << day;
+			if (day == last) {
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
+// HH:MM in minutes since midnight, 24:00 is allowed as end of day
+int parse_time(std::wstring const& time)
+{
+	size_t const pos = time.find(':');
+	if (pos == std::wstring::npos || pos == 0 || time.size() - pos != 3) {
+		return -1;
+	}
+	int const hours = fz::to_integral<int>(time.substr(0, pos), -1);
+	int const minutes = fz::to_integral<int>(time.substr(pos + 1), -1);
+	if (hours < 0 || minutes < 0 || minutes > 59 || hours * 60 + minutes > 24 * 60) {
+		return -1;
+	}
+	return hours * 60 + minutes;
+}
+}
+
+bool CSpeedLimitSchedule::Parse(std::wstring const& schedule)
+{
+	entries_.clear();
+
+	for (auto const& part : fz::strtok(fz::str_tolower_ascii(schedule), L";")) {
+		auto tokens = fz::strtok(part, L" \t");
+		if (tokens.empty()) {
+			continue;
+		}
+		if (tokens.size() < 2 || tokens.size() > 3) {
+			entries_.clear();
+			return false;
+		}
+
+		entry e;
+		if (tokens.size() == 3) {
+			e.days_ = parse_days(tokens[0]);
+			tokens.erase(tokens.begin());
+		}
+
+		size_t const dash = tokens[0].find('-');
+		size_t const slash = tokens[1].find('/');
+		if (dash == std::wstring::npos || slash == std::wstring::npos) {
+			entries_.clear();
+			return false;
+		}
+		e.begin_ = parse_time(tokens[0].substr(0, dash));
+		e.end_ = parse_time(tokens[0].substr(dash + 1));
+		e.inbound_ = fz::to_integral<int>(tokens[1].substr(0, slash), -1);
+		e.outbound_ = fz::to_integral<int>(tokens[1].substr(slash + 1), -1);
+
+		if (!e.days_ || e.begin_ < 0 || e.end_ < 0 || e.begin_ == e.end_ || e.begin_ == 24 * 60 ||
+			e.inbound_ < 0 || e.outbound_ < 0)
+		{
+			entries_.clear();
+			return false;
+		}
+		entries_.push_back(e);
+	}
+
+	return true;
+}
+
+bool CSpeedLimitSchedule::GetLimits(fz::datetime const& t, int & inbound, int & outbound) const
+{
+	if (entries_.empty() || t.empty()) {
+		return false;
+	}
+
+	tm const local = t.get_tm(fz::datetime::local);
+	int const day = local.tm_wday;
+	int const previousDay = (day + 6) % 7;
+	int const minute = local.tm_hour * 60 + local.tm_min;
+
+	for (auto const& e : entries_) {
+		bool match;
+		if (e.begin_ < e.end_) {
+			match = (e.days_ & (1 << day)) && minute >= e.begin_ && minute < e.end_;
+		}
+		else {
+			match = ((e.days_ & (1 << day)) && minute >= e.begin_) ||
+				((e.days_ & (1 << previousDay)) && minute < e.end_);
+		}
+		if (match) {
+			inbound = e.inbound_;
+			outbound = e.outbound_;
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -4,6 +4,7 @@
 #include "event.h"
 #include "input_thread.h"
 #include "proxy.h"
+#include "worker_pool.h"
 
 #include <libfilezilla/process.hpp>
 #include <libfilezilla/uri.hpp>
@@ -20,16 +21,32 @@ int CStorjConnectOpData::Send()
 			if (executable.empty()) {
 				executable = fzT("fzstorj");
 			}
+
+			// Everything fzstorj gets told while connecting
+			controlSocket_.workerKey_ = fz::sprintf(L"%s\n%d\n%s\n%s\n%s", fz::to_wstring(executable),
+				engine_.GetOptions().GetOptionVal(OPTION_STORJ_CHUNK_SIZE), currentServer_.Format(ServerFormat::with_optional_port),
+				currentServer_.GetUser(), controlSocket_.credentials_.GetPass());
+
+			auto worker = engine_.GetContext().GetStorjWorkerPool().Lease(controlSocket_.workerKey_, controlSocket_);
+			if (worker) {
+				log(logmsg::debug_info, L"Reusing running fzstorj process");
+				controlSocket_.process_ = std::move(worker.process_);
+				controlSocket_.input_thread_ = std::move(worker.input_thread_);
+				return FZ_REPLY_OK;
+			}
+
 			log(logmsg::debug_verbose, L"Going to execute %s", executable);
 
-			std::vector<fz::native_string> args;
+			std::vector<fz::native_string> args = { fzT("--framed") };
+			args.push_back(fzT("--chunk-size"));
+			args.push_back(fz::to_native(std::to_wstring(engine_.GetOptions().GetOptionVal(OPTION_STORJ_CHUNK_SIZE))));
 			controlSocket_.process_ = std::make_unique<fz::process>();
 			if (!controlSocket_.process_->spawn(executable, args)) {
 				log(logmsg::debug_warning, L"Could not create process");
 				return FZ_REPLY_ERROR | FZ_REPLY_DISCONNECTED;
 			}
 
-			controlSocket_.input_thread_ = std::make_unique<CStorjInputThread>(controlSocket_, *controlSocket_.process_);
+			controlSocket_.input_thread_ = std::make_unique<CStorjInputThread>(controlSocket_, *controlSocket_.process_, true);
 			if (!controlSocket_.input_thread_->spawn(engine_.GetThreadPool())) {
 				log(logmsg::debug_warning, L"Thread creation failed");
 				controlSocket_.input_thread_.reset();
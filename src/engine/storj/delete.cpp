@@ -10,6 +10,22 @@ enum DeleteStates
 	delete_delete
 };
 
+namespace {
+// Deleting at least this many files at once uses rm-many, which deletes
+// up to batch_size objects concurrently in a single command.
+size_t const batch_threshold = 10;
+size_t const batch_size = 1000;
+
+std::wstring GetObjectName(std::wstring const& file, std::wstring const& id)
+{
+	size_t pos = id.find_last_of('/');
+	if (pos != std::string::npos) {
+		return id.substr(0, pos) + L"/" + file;
+	}
+	return file;
+}
+}
+
 int CStorjDeleteOpData::Send()
 {
 	switch (opState) {
@@ -29,6 +45,34 @@ int CStorjDeleteOpData::Send()
 			return deleteFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
 		}
 
+		if (time_.empty()) {
+			time_ = fz::datetime::now();
+		}
+
+		if (files_.size() >= batch_threshold) {
+			std::wstring cmd = L"rm-many " + bucket_;
+			while (!files_.empty() && batch_.size() < batch_size) {
+				std::wstring const& file = files_.back();
+				std::wstring const& id = fileIds_.back();
+				if (!id.empty()) {
+					engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+					controlSocket_.idCache_.InvalidateFile(path_, file);
+
+					std::wstring objectName = GetObjectName(file, id);
+					cmd += L" " + controlSocket_.QuoteFilename(objectName);
+					batch_.emplace(std::move(objectName), file);
+				}
+				files_.pop_back();
+				fileIds_.pop_back();
+			}
+			if (batch_.empty()) {
+				return FZ_REPLY_CONTINUE;
+			}
+
+			batched_ = true;
+			return controlSocket_.SendCommand(cmd, fz::sprintf(L"rm-many %s (%d objects)", bucket_, batch_.size()));
+		}
+
 		std::wstring const& file = files_.back();
 		std::wstring const& id = fileIds_.back();
 		if (id.empty()) {
@@ -37,30 +81,57 @@ int CStorjDeleteOpData::Send()
 			return FZ_REPLY_CONTINUE;
 		}
 
-		if (time_.empty()) {
-			time_ = fz::datetime::now();
-		}
-
 		engine_.GetDirectoryCache().InvalidateFile(currentServer_, path_, file);
+		controlSocket_.idCache_.InvalidateFile(path_, file);
 
 		//return controlSocket_.SendCommand(L"rm " + bucket_ + L" " + id);
-		std::wstring objectName = id;
-		size_t pos = objectName.find_last_of('/');
-		
-		if (pos != std::string::npos)
-			objectName = objectName.substr(0, pos) + L"/" + file;
-		else
-			objectName = file;
-
-		return controlSocket_.SendCommand(L"rm " + bucket_ + L" " + objectName);
+		return controlSocket_.SendCommand(L"rm " + bucket_ + L" " + GetObjectName(file, id));
 	}
 
 	log(logmsg::debug_warning, L"Unknown opState in CStorjDeleteOpData::Send()");
 	return FZ_REPLY_INTERNALERROR;
 }
 
+void CStorjDeleteOpData::OnDeleted(std::wstring const& key)
+{
+	auto it = batch_.find(key);
+	if (it == batch_.end()) {
+		log(logmsg::debug_warning, L"Got deletion notice for unexpected object %s", key);
+		return;
+	}
+
+	engine_.GetDirectoryCache().RemoveFile(currentServer_, path_, it->second);
+	controlSocket_.idCache_.RemoveFile(path_, it->second);
+	batch_.erase(it);
+
+	auto const now = fz::datetime::now();
+	if (!time_.empty() && (now - time_).get_seconds() >= 1) {
+		controlSocket_.SendDirectoryListingNotification(path_, false);
+		time_ = now;
+		needSendListing_ = false;
+	}
+	else {
+		needSendListing_ = true;
+	}
+}
+
 int CStorjDeleteOpData::ParseResponse()
 {
+	if (batched_) {
+		// Whatever has not been reported as deleted has failed
+		if (controlSocket_.result_ != FZ_REPLY_OK || !batch_.empty()) {
+			deleteFailed_ = true;
+		}
+		batched_ = false;
+		batch_.clear();
+
+		if (!files_.empty()) {
+			return FZ_REPLY_CONTINUE;
+		}
+
+		return deleteFailed_ ? FZ_REPLY_ERROR : FZ_REPLY_OK;
+	}
+
 	if (controlSocket_.result_ != FZ_REPLY_OK) {
 		deleteFailed_ = true;
 	}
@@ -68,6 +139,7 @@ int CStorjDeleteOpData::ParseResponse()
 		std::wstring const& file = files_.back();
 
 		engine_.GetDirectoryCache().RemoveFile(currentServer_, path_, file);
+		controlSocket_.idCache_.RemoveFile(path_, file);
 
 		auto const now = fz::datetime::now();
 		if (!time_.empty() && (now - time_).get_seconds() >= 1) {
@@ -3,6 +3,8 @@
 
 #include "storjcontrolsocket.h"
 
+#include <map>
+
 class CStorjDeleteOpData final : public COpData, public CStorjOpData
 {
 public:
@@ -18,6 +20,9 @@ public:
 	virtual int ParseResponse() override;
 	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
 
+	// Called for each object fzstorj reports as deleted by rm-many
+	void OnDeleted(std::wstring const& key);
+
 	CServerPath path_;
 	std::vector<std::wstring> files_;
 	std::vector<std::wstring> fileIds_;
@@ -31,6 +36,11 @@ public:
 	// Set to true if deletion of at least one file failed
 	bool deleteFailed_{};
 
+	// Objects of the pending rm-many command that have not been
+	// reported as deleted yet, mapping object keys to file names.
+	std::map<std::wstring, std::wstring> batch_;
+	bool batched_{};
+
 	std::wstring bucket_;
 };
 
@@ -6,11 +6,17 @@
 struct storj_message
 {
 	storjEvent type;
-	mutable std::wstring text[4];
+	std::wstring text[4];
 };
 
-struct storj_event_type;
-typedef fz::simple_event<storj_event_type, storj_message> CStorjEvent;
+// Consecutive messages read from fzstorj in one go
+struct storj_message_batch
+{
+	mutable std::vector<storj_message> messages;
+};
+
+struct storj_batch_event_type;
+typedef fz::simple_event<storj_batch_event_type, storj_message_batch> CStorjBatchEvent;
 
 struct storj_terminate_event_type;
 typedef fz::simple_event<storj_terminate_event_type, std::wstring> StorjTerminateEvent;
@@ -88,7 +88,11 @@ int CStorjFileTransferOpData::Send()
 			size_t pos = objectName.find_first_of(bucket_);
 			objectName = objectName.substr(pos + bucket_.size() + 1, objectName.size());
 
-			return controlSocket_.SendCommand(L"get " + bucket_ + L" " + objectName + L" " + controlSocket_.QuoteFilename(localFile_));
+			std::wstring cmd = L"get " + bucket_ + L" " + controlSocket_.QuoteFilename(objectName) + L" " + controlSocket_.QuoteFilename(localFile_);
+			if (engine_.GetOptions().GetOptionVal(OPTION_PREALLOCATE_SPACE)) {
+				cmd += L" 1";
+			}
+			return controlSocket_.SendCommand(cmd);
 		}
 		else {
 			std::wstring path = remotePath_.GetPath();
@@ -99,6 +103,9 @@ int CStorjFileTransferOpData::Send()
 			else {
 				path = path.substr(pos + 1) + L"/";
 			}
+
+			// The object gets a new id
+			controlSocket_.idCache_.InvalidateFile(remotePath_, remoteFile_);
 			return controlSocket_.SendCommand(L"put " + bucket_ + L" " + controlSocket_.QuoteFilename(localFile_) + L" " + controlSocket_.QuoteFilename(path + remoteFile_));
 		}
 
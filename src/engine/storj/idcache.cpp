@@ -0,0 +1,96 @@
+#include <filezilla.h>
+
+#include "idcache.h"
+
+namespace {
+// Ids of buckets never change, those of objects only if they are
+// overwritten by someone else.
+fz::duration const ttl = fz::duration::from_minutes(30);
+}
+
+std::wstring CStorjIdCache::ExtractId(std::wstring const& metaData)
+{
+	std::wstring ret;
+
+	auto begin = metaData.find(L"id:");
+	if (begin != std::wstring::npos) {
+		auto end = metaData.find(' ', begin);
+		if (end == std::wstring::npos) {
+			ret = metaData.substr(begin + 3);
+		}
+		else {
+			ret = metaData.substr(begin + 3, end - begin - 3);
+		}
+	}
+	return ret;
+}
+
+void CStorjIdCache::StoreListing(CDirectoryListing const& listing)
+{
+	if (listing.failed() || listing.get_unsure_flags() || !listing.m_firstListTime) {
+		return;
+	}
+
+	prefix & p = prefixes_[listing.path];
+	p.ids.clear();
+	p.ids.reserve(listing.size());
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		p.ids[entry.name] = ExtractId(*entry.ownerGroup);
+	}
+	p.time = listing.m_firstListTime;
+}
+
+bool CStorjIdCache::IsListed(CServerPath const& path) const
+{
+	auto const it = prefixes_.find(path);
+	return it != prefixes_.cend() && fz::monotonic_clock::now() - it->second.time <= ttl;
+}
+
+CStorjIdCache::result CStorjIdCache::Lookup(CServerPath const& path, std::wstring const& name, std::wstring & id) const
+{
+	if (!IsListed(path)) {
+		return unknown;
+	}
+
+	auto const it = prefixes_.find(path);
+
+	auto const entry = it->second.ids.find(name);
+	if (entry == it->second.ids.cend()) {
+		return missing;
+	}
+	if (entry->second.empty()) {
+		return unknown;
+	}
+
+	id = entry->second;
+	return found;
+}
+
+void CStorjIdCache::InvalidateFile(CServerPath const& path, std::wstring const& name)
+{
+	auto it = prefixes_.find(path);
+	if (it != prefixes_.end()) {
+		it->second.ids[name].clear();
+	}
+}
+
+void CStorjIdCache::RemoveFile(CServerPath const& path, std::wstring const& name)
+{
+	auto it = prefixes_.find(path);
+	if (it != prefixes_.end()) {
+		it->second.ids.erase(name);
+	}
+}
+
+void CStorjIdCache::InvalidatePath(CServerPath const& path)
+{
+	for (auto it = prefixes_.begin(); it != prefixes_.end(); ) {
+		if (it->first == path || path.IsParentOf(it->first, false)) {
+			it = prefixes_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
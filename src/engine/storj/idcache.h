@@ -0,0 +1,51 @@
+#ifndef FILEZILLA_ENGINE_STORJ_IDCACHE_HEADER
+#define FILEZILLA_ENGINE_STORJ_IDCACHE_HEADER
+
+#include <directorylisting.h>
+
+#include <map>
+#include <unordered_map>
+
+// Ids of the buckets and objects found in listings, the buckets being the
+// entries of the root. Resolving a path for each file of a bulk operation
+// thus needs neither the buckets nor the parent prefix listed again, even
+// while the listings in the directory cache are unsure due to the very
+// operation. Entries expire independently of the directory cache.
+class CStorjIdCache final
+{
+public:
+	enum result
+	{
+		unknown, // Listing needed
+		missing,
+		found
+	};
+
+	void StoreListing(CDirectoryListing const& listing);
+
+	result Lookup(CServerPath const& path, std::wstring const& name, std::wstring & id) const;
+
+	// Whether there is a current listing of the path
+	bool IsListed(CServerPath const& path) const;
+
+	// The entry exists, but its id is not known
+	void InvalidateFile(CServerPath const& path, std::wstring const& name);
+	void RemoveFile(CServerPath const& path, std::wstring const& name);
+
+	// Forgets the path and everything below it
+	void InvalidatePath(CServerPath const& path);
+
+	static std::wstring ExtractId(std::wstring const& metaData);
+
+private:
+	struct prefix
+	{
+		// An empty id means the entry exists with an unknown id
+		std::unordered_map<std::wstring, std::wstring> ids;
+		fz::monotonic_clock time;
+	};
+
+	std::map<CServerPath, prefix> prefixes_;
+};
+
+#endif
@@ -2,13 +2,34 @@
 
 #include "event.h"
 #include "input_thread.h"
-#include "storjcontrolsocket.h"
 
+#include <libfilezilla/event_handler.hpp>
 #include <libfilezilla/process.hpp>
 
-CStorjInputThread::CStorjInputThread(CStorjControlSocket& owner, fz::process& proc)
+#include <algorithm>
+
+#include <string.h>
+
+namespace {
+size_t const read_size = 64 * 1024;
+
+// Sanity limit for the size of a single field in framed mode
+uint32_t const max_field_size = 16 * 1024 * 1024;
+
+// Longer lines get truncated
+size_t const max_line_size = 4095;
+
+// Messages are sent to the handler once the process has nothing more to
+// read, or once that many have accumulated
+size_t const max_batch = 256;
+
+size_t const max_pooled = 4;
+}
+
+CStorjInputThread::CStorjInputThread(fz::event_handler & handler, fz::process& proc, bool framed)
 	: process_(proc)
-	, owner_(owner)
+	, handler_(&handler)
+	, framed_(framed)
 {
 }
 
@@ -25,45 +46,99 @@ bool CStorjInputThread::spawn(fz::thread_pool & pool)
 	return thread_.operator bool();
 }
 
-std::wstring CStorjInputThread::ReadLine(std::wstring &error)
+void CStorjInputThread::set_handler(fz::event_handler & handler)
 {
-	int len = 0;
-	const int buffersize = 4096;
-	char buffer[buffersize];
+	fz::scoped_lock l(handler_mutex_);
+	handler_ = &handler;
+}
 
-	while (true) {
+void CStorjInputThread::send_event(fz::event_base * ev)
+{
+	fz::scoped_lock l(handler_mutex_);
+	handler_->send_event(ev);
+}
+
+std::wstring CStorjInputThread::ReadField(std::wstring &error)
+{
+	uint32_t len{};
+	for (int i = 0; i < 4; ++i) {
 		if (!readFromProcess(error, true)) {
 			return std::wstring();
 		}
+		len = (len << 8) | *recv_buffer_.get();
+		recv_buffer_.consume(1);
+	}
+	if (len > max_field_size) {
+		error = L"Field too large";
+		return std::wstring();
+	}
 
-		auto const* p = recv_buffer_.get();
-		size_t i;
-		for (i = 0; i < recv_buffer_.size(); ++i) {
-			unsigned char const c = p[i];
+	std::string field;
+	while (field.size() < len) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
 
-			if (c == '\n') {
-				recv_buffer_.consume(i + 1);
+		size_t const avail = std::min(static_cast<size_t>(len) - field.size(), recv_buffer_.size());
+		if (field.empty() && avail == len) {
+			// Common case, the whole field is already in the buffer
+			std::wstring const ret = fz::to_wstring_from_utf8(reinterpret_cast<char const*>(recv_buffer_.get()), len);
+			recv_buffer_.consume(len);
+			if (len && ret.empty()) {
+				error = L"Failed to convert reply to local character set.";
+			}
+			return ret;
+		}
+		field.append(reinterpret_cast<char const*>(recv_buffer_.get()), avail);
+		recv_buffer_.consume(avail);
+	}
 
-				while (len && buffer[len - 1] == '\r') {
-					--len;
-				}
+	std::wstring const ret = fz::to_wstring_from_utf8(field.c_str(), field.size());
+	if (len && ret.empty()) {
+		error = L"Failed to convert reply to local character set.";
+	}
+	return ret;
+}
 
-				std::wstring const line = owner_.ConvToLocal(buffer, len);
-				if (len && line.empty()) {
-					error = L"Failed to convert reply to local character set.";
-				}
+std::wstring CStorjInputThread::ReadLine(std::wstring &error)
+{
+	if (framing_active_) {
+		return ReadField(error);
+	}
 
-				return line;
-			}
+	line_.clear();
+	while (true) {
+		if (!readFromProcess(error, true)) {
+			return std::wstring();
+		}
 
-			if (len == buffersize - 1) {
-				// Cap string length
+		char const* p = reinterpret_cast<char const*>(recv_buffer_.get());
+		size_t const size = recv_buffer_.size();
+		char const* nl = static_cast<char const*>(memchr(p, '\n', size));
+		size_t const len = nl ? static_cast<size_t>(nl - p) : size;
+
+		if (!nl || !line_.empty()) {
+			line_.append(p, std::min(len, max_line_size - std::min(max_line_size, line_.size())));
+			if (!nl) {
+				recv_buffer_.clear();
 				continue;
 			}
+			p = line_.c_str();
+		}
+
+		// Common case, the line is used straight from the buffer
+		size_t n = nl && line_.empty() ? std::min(len, max_line_size) : line_.size();
+		while (n && p[n - 1] == '\r') {
+			--n;
+		}
 
-			buffer[len++] = c;
+		std::wstring const line = fz::to_wstring_from_utf8(p, n);
+		recv_buffer_.consume(len + 1);
+		if (n && line.empty()) {
+			error = L"Failed to convert reply to local character set.";
 		}
-		recv_buffer_.clear();
+
+		return line;
 	}
 
 	return std::wstring();
@@ -72,7 +147,10 @@ std::wstring CStorjInputThread::ReadLine(std::wstring &error)
 bool CStorjInputThread::readFromProcess(std::wstring & error, bool eof_is_error)
 {
 	if (recv_buffer_.empty()) {
-		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(1024)), 1024);
+		// Don't hold back completed messages while waiting for the process
+		flush();
+
+		int read = process_.read(reinterpret_cast<char *>(recv_buffer_.get(read_size)), read_size);
 		if (read > 0) {
 			recv_buffer_.add(read);
 		}
@@ -114,6 +192,8 @@ void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
 	case storjEvent::Info:
 	case storjEvent::Status:
 	case storjEvent::Transfer:
+	case storjEvent::Deleted:
+	case storjEvent::Cursor:
 		lines = 1;
 		break;
 	case storjEvent::Listentry:
@@ -121,19 +201,49 @@ void CStorjInputThread::processEvent(storjEvent eventType, std::wstring &error)
 		break;
 	};
 
-	auto msg = new CStorjEvent;
-	auto & message = std::get<0>(msg->v_);
+	storj_message message;
 	message.type = eventType;
 	for (int i = 0; i < lines && error.empty(); ++i) {
 		message.text[i] = ReadLine(error);
 	}
 
 	if (!error.empty()) {
-		delete msg;
 		return;
 	}
 
-	owner_.send_event(msg);
+	if (!pending_) {
+		pending_ = std::make_unique<CStorjBatchEvent>();
+
+		fz::scoped_lock l(pool_mutex_);
+		if (!pool_.empty()) {
+			std::get<0>(pending_->v_).messages.swap(pool_.back().messages);
+			pool_.pop_back();
+		}
+	}
+
+	auto & messages = std::get<0>(pending_->v_).messages;
+	messages.push_back(std::move(message));
+	if (messages.size() >= max_batch) {
+		flush();
+	}
+}
+
+void CStorjInputThread::flush()
+{
+	if (pending_) {
+		send_event(pending_.release());
+	}
+}
+
+void CStorjInputThread::recycle(storj_message_batch const& batch)
+{
+	batch.messages.clear();
+
+	fz::scoped_lock l(pool_mutex_);
+	if (pool_.size() < max_pooled) {
+		pool_.emplace_back();
+		pool_.back().messages.swap(batch.messages);
+	}
 }
 
 void CStorjInputThread::entry()
@@ -157,7 +267,12 @@ void CStorjInputThread::entry()
 		storjEvent eventType = static_cast<storjEvent>(readType);
 
 		processEvent(eventType, error);
+
+		// The initial reply is always plain text
+		framing_active_ = framed_;
 	}
 
-	owner_.send_event<StorjTerminateEvent>(error);
+	flush();
+	finished_ = true;
+	send_event(new StorjTerminateEvent(error));
 }
@@ -1,38 +1,74 @@
 #ifndef FILEZILLA_ENGINE_STORJ_INPUT_THREAD_HEADER
 #define FILEZILLA_ENGINE_STORJ_INPUT_THREAD_HEADER
 
-class CStorjControlSocket;
+#include "event.h"
 
 #include <libfilezilla/buffer.hpp>
+#include <libfilezilla/mutex.hpp>
 #include <libfilezilla/thread_pool.hpp>
 
+#include <atomic>
+#include <memory>
+
 namespace fz {
+class event_handler;
 class process;
 }
 
 class CStorjInputThread final
 {
 public:
-	CStorjInputThread(CStorjControlSocket & owner, fz::process& proc);
+	// If framed is set, all messages after the initial reply are expected
+	// to use the length-prefixed binary framing requested through --framed.
+	CStorjInputThread(fz::event_handler & handler, fz::process& proc, bool framed);
 	~CStorjInputThread();
 
 	bool spawn(fz::thread_pool & pool);
 
+	// Events already sent remain with the previous handler
+	void set_handler(fz::event_handler & handler);
+
+	// Set once the process has quit or could not be read from
+	bool finished() const { return finished_; }
+
+	// Hands the storage of a processed batch back to be used for later ones
+	void recycle(storj_message_batch const& batch);
+
 protected:
 
 	bool readFromProcess(std::wstring & error, bool eof_is_error);
 	std::wstring ReadLine(std::wstring &error);
+	std::wstring ReadField(std::wstring &error);
 
 	void entry();
 
 	void processEvent(storjEvent eventType, std::wstring & error);
 
+	void send_event(fz::event_base * ev);
+	void flush();
+
 	fz::process& process_;
-	CStorjControlSocket& owner_;
+
+	fz::mutex handler_mutex_;
+	fz::event_handler * handler_;
+
+	std::atomic<bool> finished_{};
 
 	fz::async_task thread_;
 
 	fz::buffer recv_buffer_;
+
+	// Partial line if a line spans multiple reads
+	std::string line_;
+
+	// Messages not yet sent to the handler
+	std::unique_ptr<CStorjBatchEvent> pending_;
+
+	fz::mutex pool_mutex_;
+	std::vector<storj_message_batch> pool_;
+
+	bool const framed_{};
+	bool framing_active_{};
 };
 
 #endif
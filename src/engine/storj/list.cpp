@@ -3,6 +3,9 @@
 #include "../directorycache.h"
 #include "list.h"
 
+#include <map>
+#include <set>
+
 enum listStates
 {
 	list_init = 0,
@@ -46,6 +49,7 @@ int CStorjListOpData::Send()
 			if (found && !is_outdated &&
 				listing.m_firstListTime >= time_before_locking_)
 			{
+				controlSocket_.idCache_.StoreListing(listing);
 				controlSocket_.SendDirectoryListingNotification(listing.path, false);
 				return FZ_REPLY_OK;
 			}
@@ -63,10 +67,15 @@ int CStorjListOpData::Send()
 				path.clear();
 			}
 			else {
-				path = controlSocket_.QuoteFilename(path.substr(pos + 1) + L"/");
+				path = path.substr(pos + 1) + L"/";
 			}
+			prefix_ = path;
 
-			return controlSocket_.SendCommand(L"list " + bucket_ + L" " + path);
+			std::wstring cmd = (tree_ ? L"list-tree " : L"list ") + bucket_ + L" " + controlSocket_.QuoteFilename(path);
+			if (!cursor_.empty()) {
+				cmd += L" " + controlSocket_.QuoteFilename(cursor_);
+			}
+			return controlSocket_.SendCommand(cmd);
 		}
 	}
 
@@ -78,14 +87,30 @@ int CStorjListOpData::ParseResponse()
 {
 	if (opState == list_list) {
 		if (controlSocket_.result_ != FZ_REPLY_OK) {
+			if (!cursor_.empty() && resumeCount_ < 3 && !(controlSocket_.result_ & FZ_REPLY_DISCONNECTED)) {
+				++resumeCount_;
+				log(logmsg::status, _("Resuming directory listing after %d entries"), cursorEntries_);
+
+				// Entries past the cursor will be sent again
+				entries_.resize(cursorEntries_);
+				return FZ_REPLY_CONTINUE;
+			}
 			return controlSocket_.result_;
 		}
+
+		if (tree_ && !bucket_.empty()) {
+			StoreTree();
+			currentPath_ = path_;
+			return FZ_REPLY_OK;
+		}
+
 		CDirectoryListing listing;
 		listing.path = path_;
 		listing.m_firstListTime = fz::monotonic_clock::now();
 		listing.Assign(std::move(entries_));
 
 		engine_.GetDirectoryCache().Store(listing, currentServer_);
+		controlSocket_.idCache_.StoreListing(listing);
 		controlSocket_.SendDirectoryListingNotification(listing.path, false);
 
 		currentPath_ = path_;
@@ -164,3 +189,116 @@ int CStorjListOpData::ParseEntry(std::wstring && name, std::wstring const& size,
 
 	return FZ_REPLY_WOULDBLOCK;
 }
+
+void CStorjListOpData::OnCursor(std::wstring && cursor)
+{
+	if (opState != list_list) {
+		log(logmsg::debug_warning, L"CStorjListOpData::OnCursor called at improper time: %d", opState);
+		return;
+	}
+
+	cursor_ = std::move(cursor);
+	cursorEntries_ = entries_.size();
+
+	if (tree_ && !bucket_.empty()) {
+		// Names are still relative keys, nothing to show yet
+		return;
+	}
+
+	auto const now = fz::monotonic_clock::now();
+	if (!lastPartialListing_ || (now - lastPartialListing_).get_seconds() >= 1) {
+		lastPartialListing_ = now;
+
+		// Not complete yet, so flag it as unsure to keep others from relying on it
+		CDirectoryListing listing;
+		listing.path = path_;
+		listing.m_firstListTime = now;
+		listing.Assign(std::vector<fz::shared_value<CDirentry>>(entries_));
+		listing.m_flags |= CDirectoryListing::unsure_unknown;
+
+		engine_.GetDirectoryCache().Store(listing, currentServer_);
+		controlSocket_.SendDirectoryListingNotification(listing.path, false);
+	}
+}
+
+void CStorjListOpData::StoreTree()
+{
+	struct directory final
+	{
+		std::vector<fz::shared_value<CDirentry>> entries;
+		std::set<std::wstring> subdirs;
+	};
+
+	// By path relative to path_
+	std::map<std::wstring, directory> directories;
+	directories[std::wstring()];
+
+	// Directories are implied by the keys below them, marker objects only
+	// add the ones that are otherwise empty.
+	auto addDirectory = [&](std::wstring const& parent, std::wstring const& name, fz::datetime const& time) {
+		std::wstring relative = parent.empty() ? name : (parent + L"/" + name);
+		auto & d = directories[parent];
+		if (d.subdirs.insert(name).second) {
+			CDirentry entry;
+			entry.name = name;
+			entry.flags = CDirentry::flag_dir;
+			entry.size = -1;
+			entry.time = time;
+			entry.ownerGroup.get() = L"id:" + prefix_ + relative + L"/";
+			d.entries.emplace_back(std::move(entry));
+		}
+		directories[relative];
+		return relative;
+	};
+
+	for (auto & e : entries_) {
+		std::wstring const& name = e->name;
+
+		std::wstring parent;
+		size_t start = 0;
+		size_t pos;
+		while ((pos = name.find('/', start)) != std::wstring::npos && pos != start) {
+			parent = addDirectory(parent, name.substr(start, pos - start), fz::datetime());
+			start = pos + 1;
+		}
+		if (pos != std::wstring::npos || start == name.size()) {
+			log(logmsg::debug_info, L"Skipping object with empty path segment: %s", name);
+			continue;
+		}
+
+		if (e->is_dir()) {
+			addDirectory(parent, name.substr(start), e->time);
+		}
+		else {
+			if (start) {
+				e.get().name = name.substr(start);
+			}
+			directories[parent].entries.emplace_back(std::move(e));
+		}
+	}
+	entries_.clear();
+
+	log(logmsg::debug_verbose, L"Tree listing of %s contains %d directories", path_.GetPath(), directories.size());
+
+	auto const now = fz::monotonic_clock::now();
+	for (auto & d : directories) {
+		CDirectoryListing listing;
+		listing.path = path_;
+		size_t start = 0;
+		while (start < d.first.size()) {
+			size_t pos = d.first.find('/', start);
+			if (pos == std::wstring::npos) {
+				pos = d.first.size();
+			}
+			listing.path.AddSegment(d.first.substr(start, pos - start));
+			start = pos + 1;
+		}
+		listing.m_firstListTime = now;
+		listing.Assign(std::move(d.second.entries));
+
+		engine_.GetDirectoryCache().Store(listing, currentServer_);
+		controlSocket_.idCache_.StoreListing(listing);
+	}
+
+	controlSocket_.SendDirectoryListingNotification(path_, false);
+}
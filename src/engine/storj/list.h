@@ -6,11 +6,12 @@
 class CStorjListOpData final : public COpData, public CStorjOpData
 {
 public:
-	CStorjListOpData(CStorjControlSocket & controlSocket, CServerPath const& path, std::wstring const& subDir, int)
+	CStorjListOpData(CStorjControlSocket & controlSocket, CServerPath const& path, std::wstring const& subDir, int flags)
 		: COpData(Command::list, L"CStorjListOpData")
 		, CStorjOpData(controlSocket)
 		, path_(path)
 		, subDir_(subDir)
+		, tree_((flags & LIST_FLAG_TREE) != 0)
 	{
 	}
 
@@ -20,18 +21,36 @@ public:
 
 	int ParseEntry(std::wstring && name, std::wstring const& size, std::wstring && id, std::wstring const& created);
 
+	// fzstorj sends a cursor after every page of entries. The listing can be
+	// resumed from the last cursor, and the entries so far are passed on
+	// as partial listing.
+	void OnCursor(std::wstring && cursor);
+
 	std::wstring GetPathId() const { return pathId_; }
 
 private:
+	// Splits the entries of a tree listing, named by their keys relative to
+	// path_, into listings of path_ and each of its subdirectories.
+	void StoreTree();
+
 	CServerPath path_;
 	std::wstring subDir_;
 
+	// Lists all objects below path_ at once if inside a bucket
+	bool tree_{};
+	std::wstring prefix_;
+
 	std::vector<fz::shared_value<CDirentry>> entries_;
 
 	fz::monotonic_clock time_before_locking_;
 
 	std::wstring bucket_;
 	std::wstring pathId_;
+
+	std::wstring cursor_;
+	size_t cursorEntries_{};
+	int resumeCount_{};
+	fz::monotonic_clock lastPartialListing_;
 };
 
 #endif
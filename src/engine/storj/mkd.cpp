@@ -53,6 +53,7 @@ int CStorjMkdirOpData::ParseResponse()
 	case mkd_mkbucket:
 		if (controlSocket_.result_ == FZ_REPLY_OK) {
 			engine_.GetDirectoryCache().UpdateFile(currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), true, CDirectoryCache::dir);
+			controlSocket_.idCache_.InvalidateFile(CServerPath(L"/"), path_.GetFirstSegment());
 			controlSocket_.SendDirectoryListingNotification(CServerPath(L"/"), false);
 		}
 
@@ -70,6 +71,7 @@ int CStorjMkdirOpData::ParseResponse()
 			while (path.SegmentCount() > 1) {
 				CServerPath parent = path.GetParent();
 				engine_.GetDirectoryCache().UpdateFile(currentServer_, parent, path.GetLastSegment(), true, CDirectoryCache::dir);
+				controlSocket_.idCache_.InvalidateFile(parent, path.GetLastSegment());
 				controlSocket_.SendDirectoryListingNotification(parent, false);
 				path = parent;
 			}
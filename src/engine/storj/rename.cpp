@@ -0,0 +1,120 @@
+#include <filezilla.h>
+
+#include "../directorycache.h"
+#include "rename.h"
+
+enum renameStates
+{
+	rename_init = 0,
+	rename_resolve,
+	rename_resolve_target,
+	rename_move
+};
+
+namespace {
+// Key of the object with the given name below path, without the bucket
+std::wstring GetObjectKey(CServerPath const& path, std::wstring const& file)
+{
+	std::wstring key = path.GetPath();
+	auto pos = key.find('/', 1);
+	if (pos == std::string::npos) {
+		return file;
+	}
+	return key.substr(pos + 1) + L"/" + file;
+}
+}
+
+int CStorjRenameOpData::Send()
+{
+	switch (opState) {
+	case rename_init:
+		log(logmsg::status, _("Renaming '%s' to '%s'"), command_.GetFromPath().FormatFilename(command_.GetFromFile()), command_.GetToPath().FormatFilename(command_.GetToFile()));
+
+		if (!command_.GetFromPath().SegmentCount() || !command_.GetToPath().SegmentCount()) {
+			log(logmsg::error, _("Buckets cannot be renamed"));
+			return FZ_REPLY_CRITICALERROR;
+		}
+
+		{
+			// A directory is a prefix shared by any number of objects,
+			// moving it would mean moving each of them.
+			CDirentry entry;
+			bool dirDidExist{};
+			bool matchedCase{};
+			if (engine_.GetDirectoryCache().LookupFile(entry, currentServer_, command_.GetFromPath(), command_.GetFromFile(), dirDidExist, matchedCase) && matchedCase && entry.is_dir()) {
+				log(logmsg::error, _("Renaming directories is not supported"));
+				return FZ_REPLY_CRITICALERROR;
+			}
+		}
+
+		opState = rename_resolve;
+		controlSocket_.Resolve(command_.GetFromPath(), command_.GetFromFile(), bucket_, &fileId_);
+		return FZ_REPLY_CONTINUE;
+	case rename_move:
+		engine_.GetDirectoryCache().InvalidateFile(currentServer_, command_.GetFromPath(), command_.GetFromFile());
+		engine_.GetDirectoryCache().InvalidateFile(currentServer_, command_.GetToPath(), command_.GetToFile());
+		controlSocket_.idCache_.InvalidateFile(command_.GetFromPath(), command_.GetFromFile());
+		controlSocket_.idCache_.InvalidateFile(command_.GetToPath(), command_.GetToFile());
+
+		return controlSocket_.SendCommand(L"mv " + bucket_ + L" " + controlSocket_.QuoteFilename(GetObjectKey(command_.GetFromPath(), command_.GetFromFile())) + L" " +
+			toBucket_ + L" " + controlSocket_.QuoteFilename(GetObjectKey(command_.GetToPath(), command_.GetToFile())));
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CStorjRenameOpData::Send()");
+	return FZ_REPLY_INTERNALERROR;
+}
+
+int CStorjRenameOpData::ParseResponse()
+{
+	if (opState != rename_move) {
+		log(logmsg::debug_warning, L"CStorjRenameOpData::ParseResponse called at improper time: %d", opState);
+		return FZ_REPLY_INTERNALERROR;
+	}
+
+	if (controlSocket_.result_ != FZ_REPLY_OK) {
+		return controlSocket_.result_;
+	}
+
+	CServerPath const& fromPath = command_.GetFromPath();
+	CServerPath const& toPath = command_.GetToPath();
+
+	engine_.GetDirectoryCache().Rename(currentServer_, fromPath, command_.GetFromFile(), toPath, command_.GetToFile());
+	controlSocket_.idCache_.RemoveFile(fromPath, command_.GetFromFile());
+
+	controlSocket_.SendDirectoryListingNotification(fromPath, false);
+	if (fromPath != toPath) {
+		controlSocket_.SendDirectoryListingNotification(toPath, false);
+	}
+
+	return FZ_REPLY_OK;
+}
+
+int CStorjRenameOpData::SubcommandResult(int prevResult, COpData const&)
+{
+	if (prevResult != FZ_REPLY_OK) {
+		return prevResult;
+	}
+
+	switch (opState) {
+	case rename_resolve:
+		if (fileId_.empty()) {
+			log(logmsg::error, _("File not found"));
+			return FZ_REPLY_ERROR;
+		}
+		if (command_.GetToPath().GetFirstSegment() == command_.GetFromPath().GetFirstSegment()) {
+			toBucket_ = bucket_;
+			opState = rename_move;
+		}
+		else {
+			opState = rename_resolve_target;
+			controlSocket_.Resolve(command_.GetToPath(), std::wstring(), toBucket_);
+		}
+		return FZ_REPLY_CONTINUE;
+	case rename_resolve_target:
+		opState = rename_move;
+		return FZ_REPLY_CONTINUE;
+	}
+
+	log(logmsg::debug_warning, L"Unknown opState in CStorjRenameOpData::SubcommandResult()");
+	return FZ_REPLY_INTERNALERROR;
+}
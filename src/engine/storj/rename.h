@@ -0,0 +1,26 @@
+#ifndef FILEZILLA_ENGINE_STORJ_RENAME_HEADER
+#define FILEZILLA_ENGINE_STORJ_RENAME_HEADER
+
+#include "storjcontrolsocket.h"
+
+class CStorjRenameOpData final : public COpData, public CStorjOpData
+{
+public:
+	CStorjRenameOpData(CStorjControlSocket & controlSocket, CRenameCommand const& command)
+		: COpData(Command::rename, L"CStorjRenameOpData")
+		, CStorjOpData(controlSocket)
+		, command_(command)
+	{}
+
+	virtual int Send() override;
+	virtual int ParseResponse() override;
+	virtual int SubcommandResult(int prevResult, COpData const& previousOperation) override;
+
+	CRenameCommand const command_;
+
+	std::wstring bucket_;
+	std::wstring fileId_;
+	std::wstring toBucket_;
+};
+
+#endif
@@ -12,21 +12,32 @@ enum resolveStates
 };
 
 namespace {
-std::wstring ExtractId(std::wstring const& metaData)
+// Prefers the id cache, a listing in the directory cache is only used if
+// the id cache has nothing on the name.
+CStorjIdCache::result LookupId(CStorjIdCache & ids, CDirectoryCache & cache, CServer const& server, CServerPath const& path, std::wstring const& name, std::wstring & id, bool allowUnsure)
 {
-	std::wstring ret;
+	auto res = ids.Lookup(path, name, id);
+	if (res != CStorjIdCache::unknown) {
+		return res;
+	}
 
-	auto begin = metaData.find(L"id:");
-	if (begin != std::wstring::npos) {
-		auto end = metaData.find(' ', begin);
-		if (end == std::wstring::npos) {
-			ret = metaData.substr(begin + 3);
-		}
-		else {
-			ret = metaData.substr(begin + 3, end - begin - 3);
-		}
+	CDirectoryListing listing;
+	bool outdated{};
+	if (!cache.Lookup(listing, server, path, allowUnsure, outdated) || outdated) {
+		return CStorjIdCache::unknown;
+	}
+
+	if (!listing.get_unsure_flags()) {
+		ids.StoreListing(listing);
+		return ids.Lookup(path, name, id);
+	}
+
+	size_t pos = listing.FindFile_CmpCase(name);
+	if (pos == std::wstring::npos) {
+		return CStorjIdCache::missing;
 	}
-	return ret;
+	id = CStorjIdCache::ExtractId(*listing[pos].ownerGroup);
+	return id.empty() ? CStorjIdCache::unknown : CStorjIdCache::found;
 }
 }
 
@@ -52,22 +63,15 @@ int CStorjResolveOpData::Send()
 			return FZ_REPLY_OK;
 		}
 		else {
-			CDirectoryListing buckets;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(buckets, currentServer_, CServerPath(L"/"), false, outdated);
-			if (found && !outdated) {
-				size_t pos = buckets.FindFile_CmpCase(path_.GetFirstSegment());
-				if (pos != std::string::npos) {
-					bucket_ = ExtractId(*buckets[pos].ownerGroup);
-					log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
-					opState = resolve_id;
-					return FZ_REPLY_CONTINUE;
-				}
-				else {
-					log(logmsg::error, _("Bucket not found"));
-					return FZ_REPLY_ERROR;
-				}
+			auto const res = LookupId(controlSocket_.idCache_, engine_.GetDirectoryCache(), currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), bucket_, false);
+			if (res == CStorjIdCache::found) {
+				log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
+				opState = resolve_id;
+				return FZ_REPLY_CONTINUE;
+			}
+			else if (res == CStorjIdCache::missing) {
+				log(logmsg::error, _("Bucket not found"));
+				return FZ_REPLY_ERROR;
 			}
 
 			opState = resolve_waitlistbuckets;
@@ -84,26 +88,13 @@ int CStorjResolveOpData::Send()
 			if (file_.empty()) {
 				return FZ_REPLY_INTERNALERROR;
 			}
-			CDirectoryListing listing;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(listing, currentServer_, path_, ignore_missing_file_, outdated);
-			if (found && !outdated) {
-				size_t pos = listing.FindFile_CmpCase(file_);
-				if (pos != std::string::npos) {
-					*fileId_ = ExtractId(*listing[pos].ownerGroup);
-					if (!fileId_->empty()) {
-						log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file_), *fileId_);
-						return FZ_REPLY_OK;
-					}
-					else {
-						// Must refresh listing
-						opState = resolve_waitlist;
-						controlSocket_.List(path_, std::wstring(), 0);
-						return FZ_REPLY_CONTINUE;
-					}
-				}
 
+			auto const res = LookupId(controlSocket_.idCache_, engine_.GetDirectoryCache(), currentServer_, path_, file_, *fileId_, ignore_missing_file_);
+			if (res == CStorjIdCache::found) {
+				log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file_), *fileId_);
+				return FZ_REPLY_OK;
+			}
+			else if (res == CStorjIdCache::missing) {
 				if (ignore_missing_file_) {
 					return FZ_REPLY_OK;
 				}
@@ -130,20 +121,10 @@ int CStorjResolveOpData::SubcommandResult(int prevResult, COpData const&)
 		if (prevResult != FZ_REPLY_OK) {
 			return prevResult;
 		}
-		else {
-			CDirectoryListing buckets;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(buckets, currentServer_, CServerPath(L"/"), false, outdated);
-			if (found && !outdated) {
-				size_t pos = buckets.FindFile_CmpCase(path_.GetFirstSegment());
-				if (pos != std::string::npos) {
-					bucket_ = ExtractId(*buckets[pos].ownerGroup);
-					log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
-					opState = resolve_id;
-					return FZ_REPLY_CONTINUE;
-				}
-			}
+		else if (controlSocket_.idCache_.Lookup(CServerPath(L"/"), path_.GetFirstSegment(), bucket_) == CStorjIdCache::found) {
+			log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
+			opState = resolve_id;
+			return FZ_REPLY_CONTINUE;
 		}
 		log(logmsg::error, _("Bucket not found"));
 		return FZ_REPLY_ERROR;
@@ -154,21 +135,15 @@ int CStorjResolveOpData::SubcommandResult(int prevResult, COpData const&)
 			}
 			return prevResult;
 		}
-		else {
-			CDirectoryListing listing;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(listing, currentServer_, path_, false, outdated);
-			if (found && !outdated) {
-				size_t pos = listing.FindFile_CmpCase(file_);
-				if (pos != std::string::npos) {
-					*fileId_ = ExtractId(*listing[pos].ownerGroup);
-					log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file_), *fileId_);
-					return FZ_REPLY_OK;
-				}
-				if (ignore_missing_file_) {
-					return FZ_REPLY_OK;
-				}
+		else if (controlSocket_.idCache_.IsListed(path_)) {
+			auto const res = controlSocket_.idCache_.Lookup(path_, file_, *fileId_);
+			if (res == CStorjIdCache::found) {
+				log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file_), *fileId_);
+				return FZ_REPLY_OK;
+			}
+			if (res == CStorjIdCache::unknown || ignore_missing_file_) {
+				// Listed without id
+				return FZ_REPLY_OK;
 			}
 		}
 		log(logmsg::error, _("File not found"));
@@ -198,22 +173,15 @@ int CStorjResolveManyOpData::Send()
 			return FZ_REPLY_INTERNALERROR;
 		}
 		else {
-			CDirectoryListing buckets;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(buckets, currentServer_, CServerPath(L"/"), false, outdated);
-			if (found && !outdated) {
-				size_t pos = buckets.FindFile_CmpCase(path_.GetFirstSegment());
-				if (pos != std::string::npos) {
-					bucket_ = ExtractId(*buckets[pos].ownerGroup);
-					log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
-					opState = resolve_id;
-					return FZ_REPLY_CONTINUE;
-				}
-				else {
-					log(logmsg::error, _("Bucket not found"));
-					return FZ_REPLY_ERROR;
-				}
+			auto const res = LookupId(controlSocket_.idCache_, engine_.GetDirectoryCache(), currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), bucket_, false);
+			if (res == CStorjIdCache::found) {
+				log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
+				opState = resolve_id;
+				return FZ_REPLY_CONTINUE;
+			}
+			else if (res == CStorjIdCache::missing) {
+				log(logmsg::error, _("Bucket not found"));
+				return FZ_REPLY_ERROR;
 			}
 
 			opState = resolve_waitlistbuckets;
@@ -224,27 +192,24 @@ int CStorjResolveManyOpData::Send()
 		break;
 	case resolve_id:
 		{
-			CDirectoryListing listing;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(listing, currentServer_, path_, false, outdated);
-			if (found && !outdated) {
-				for (auto const& file : files_ ) {
-					size_t pos = listing.FindFile_CmpCase(file);
-					if (pos != std::string::npos) {
-						log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file), *listing[pos].ownerGroup);
-						fileIds_.emplace_back(ExtractId(*listing[pos].ownerGroup));
-					}
-					else {
-						fileIds_.emplace_back();
-					}
+			std::vector<std::wstring> ids;
+			ids.reserve(files_.size());
+			for (auto const& file : files_) {
+				std::wstring id;
+				auto const res = LookupId(controlSocket_.idCache_, engine_.GetDirectoryCache(), currentServer_, path_, file, id, false);
+				if (res == CStorjIdCache::unknown) {
+					// One listing covers all of them
+					opState = resolve_waitlist;
+					controlSocket_.List(path_, std::wstring(), 0);
+					return FZ_REPLY_CONTINUE;
 				}
-				return FZ_REPLY_OK;
+				if (res == CStorjIdCache::found) {
+					log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file), id);
+				}
+				ids.emplace_back(std::move(id));
 			}
-
-			opState = resolve_waitlist;
-			controlSocket_.List(path_, std::wstring(), 0);
-			return FZ_REPLY_CONTINUE;
+			fileIds_ = std::move(ids);
+			return FZ_REPLY_OK;
 		}
 		break;
 	}
@@ -261,42 +226,23 @@ int CStorjResolveManyOpData::SubcommandResult(int prevResult, COpData const&)
 
 	switch (opState) {
 	case resolve_waitlistbuckets:
-		{
-			CDirectoryListing buckets;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(buckets, currentServer_, CServerPath(L"/"), false, outdated);
-			if (found && !outdated) {
-				size_t pos = buckets.FindFile_CmpCase(path_.GetFirstSegment());
-				if (pos != std::string::npos) {
-					bucket_ = ExtractId(*buckets[pos].ownerGroup);
-					log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
-					opState = resolve_id;
-					return FZ_REPLY_CONTINUE;
-				}
-			}
+		if (controlSocket_.idCache_.Lookup(CServerPath(L"/"), path_.GetFirstSegment(), bucket_) == CStorjIdCache::found) {
+			log(logmsg::debug_info, L"Directory is in bucket %s", bucket_);
+			opState = resolve_id;
+			return FZ_REPLY_CONTINUE;
 		}
 		log(logmsg::error, _("Bucket not found"));
 		return FZ_REPLY_ERROR;
 	case resolve_waitlist:
-		{
-			CDirectoryListing listing;
-
-			bool outdated{};
-			bool found = engine_.GetDirectoryCache().Lookup(listing, currentServer_, path_, false, outdated);
-			if (found && !outdated) {
-				for (auto const& file : files_ ) {
-					size_t pos = listing.FindFile_CmpCase(file);
-					if (pos != std::string::npos) {
-						log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file), *listing[pos].ownerGroup);
-						fileIds_.emplace_back(ExtractId(*listing[pos].ownerGroup));
-					}
-					else {
-						fileIds_.emplace_back();
-					}
+		if (controlSocket_.idCache_.IsListed(path_)) {
+			for (auto const& file : files_) {
+				std::wstring id;
+				if (controlSocket_.idCache_.Lookup(path_, file, id) == CStorjIdCache::found) {
+					log(logmsg::debug_info, L"File %s has id %s", path_.FormatFilename(file), id);
 				}
-				return FZ_REPLY_OK;
+				fileIds_.emplace_back(std::move(id));
 			}
+			return FZ_REPLY_OK;
 		}
 		log(logmsg::error, _("Files not found"));
 		return FZ_REPLY_ERROR;
@@ -49,6 +49,8 @@ int CStorjRemoveDirOpData::ParseResponse()
 	case rmd_rmbucket:
 		if (controlSocket_.result_ == FZ_REPLY_OK) {
 			engine_.GetDirectoryCache().RemoveDir(currentServer_, CServerPath(L"/"), path_.GetFirstSegment(), CServerPath());
+			controlSocket_.idCache_.RemoveFile(CServerPath(L"/"), path_.GetFirstSegment());
+			controlSocket_.idCache_.InvalidatePath(path_);
 			controlSocket_.SendDirectoryListingNotification(CServerPath(L"/"), false);
 		}
 
@@ -56,6 +58,8 @@ int CStorjRemoveDirOpData::ParseResponse()
 	case rmd_rmdir:
 		if (controlSocket_.result_ == FZ_REPLY_OK) {
 			engine_.GetDirectoryCache().RemoveDir(currentServer_, path_.GetParent(), path_.GetLastSegment(), CServerPath());
+			controlSocket_.idCache_.RemoveFile(path_.GetParent(), path_.GetLastSegment());
+			controlSocket_.idCache_.InvalidatePath(path_);
 			controlSocket_.SendDirectoryListingNotification(path_.GetParent(), false);
 		}
 		return controlSocket_.result_;
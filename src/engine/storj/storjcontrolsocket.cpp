@@ -12,10 +12,12 @@
 #include "mkd.h"
 #include "pathcache.h"
 #include "proxy.h"
+#include "rename.h"
 #include "resolve.h"
 #include "rmd.h"
 #include "servercapabilities.h"
 #include "storjcontrolsocket.h"
+#include "worker_pool.h"
 
 #include <libfilezilla/event_loop.hpp>
 #include <libfilezilla/local_filesys.hpp>
@@ -99,7 +101,29 @@ void CStorjControlSocket::RemoveDir(CServerPath const& path, std::wstring const&
 	Push(std::move(pData));
 }
 
-void CStorjControlSocket::OnStorjEvent(storj_message const& message)
+void CStorjControlSocket::Rename(CRenameCommand const& command)
+{
+	Push(std::make_unique<CStorjRenameOpData>(*this, command));
+}
+
+void CStorjControlSocket::OnStorjBatchEvent(storj_message_batch const& batch)
+{
+	// Handling a message can close the connection, the remainder of the
+	// batch belongs to the old process then.
+	auto * const thread = input_thread_.get();
+	for (auto & message : batch.messages) {
+		if (!thread || input_thread_.get() != thread) {
+			return;
+		}
+		OnStorjEvent(message);
+	}
+
+	if (thread && input_thread_.get() == thread) {
+		thread->recycle(batch);
+	}
+}
+
+void CStorjControlSocket::OnStorjEvent(storj_message & message)
 {
 	if (!currentServer_) {
 		return;
@@ -180,6 +204,22 @@ void CStorjControlSocket::OnStorjEvent(storj_message const& message)
 			engine_.transfer_status_.Update(value);
 		}
 		break;
+	case storjEvent::Cursor:
+		if (operations_.empty() || operations_.back()->opId != Command::list) {
+			log(logmsg::debug_warning, L"storjEvent::Cursor outside list operation, ignoring.");
+		}
+		else {
+			static_cast<CStorjListOpData&>(*operations_.back()).OnCursor(std::move(message.text[0]));
+		}
+		break;
+	case storjEvent::Deleted:
+		if (operations_.empty() || operations_.back()->opId != Command::del) {
+			log(logmsg::debug_warning, L"storjEvent::Deleted outside delete operation, ignoring.");
+		}
+		else {
+			static_cast<CStorjDeleteOpData&>(*operations_.back()).OnDeleted(message.text[0]);
+		}
+		break;
 	default:
 		log(logmsg::debug_warning, L"Message type %d not handled", message.type);
 		break;
@@ -313,18 +353,27 @@ int CStorjControlSocket::ResetOperation(int nErrorCode)
 
 int CStorjControlSocket::DoClose(int nErrorCode)
 {
-	if (process_) {
+	// Without a command in progress the process is ready for the next connection
+	bool const reusable = process_ && input_thread_ && !workerKey_.empty() && operations_.empty() &&
+		!input_thread_->finished() && !(nErrorCode & FZ_REPLY_ERROR);
+
+	if (process_ && !reusable) {
 		process_->kill();
 	}
 
 	if (input_thread_) {
-		input_thread_.reset();
+		if (reusable) {
+			engine_.GetContext().GetStorjWorkerPool().Release(workerKey_, CStorjWorkerPool::worker{std::move(process_), std::move(input_thread_)});
+		}
+		else {
+			input_thread_.reset();
+		}
 
 		auto threadEventsFilter = [&](fz::event_loop::Events::value_type const& ev) -> bool {
 			if (ev.first != this) {
 				return false;
 			}
-			else if (ev.second->derived_type() == CStorjEvent::type() || ev.second->derived_type() == StorjTerminateEvent::type()) {
+			else if (ev.second->derived_type() == CStorjBatchEvent::type() || ev.second->derived_type() == StorjTerminateEvent::type()) {
 				return true;
 			}
 			return false;
@@ -333,6 +382,7 @@ int CStorjControlSocket::DoClose(int nErrorCode)
 		event_loop_.filter_events(threadEventsFilter);
 	}
 	process_.reset();
+	workerKey_.clear();
 	return CControlSocket::DoClose(nErrorCode);
 }
 
@@ -345,8 +395,8 @@ void CStorjControlSocket::Cancel()
 
 void CStorjControlSocket::operator()(fz::event_base const& ev)
 {
-	if (fz::dispatch<CStorjEvent, StorjTerminateEvent>(ev, this,
-		&CStorjControlSocket::OnStorjEvent,
+	if (fz::dispatch<CStorjBatchEvent, StorjTerminateEvent>(ev, this,
+		&CStorjControlSocket::OnStorjBatchEvent,
 		&CStorjControlSocket::OnTerminate)) {
 		return;
 	}
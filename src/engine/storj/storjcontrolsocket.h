@@ -2,6 +2,7 @@
 #define FILEZILLA_ENGINE_STORJCONTROLSOCKET_HEADER
 
 #include "controlsocket.h"
+#include "idcache.h"
 
 namespace fz {
 class process;
@@ -14,6 +15,7 @@ auto const resolve = Command::private1;
 class CStorjInputThread;
 
 struct storj_message;
+struct storj_message_batch;
 class CStorjControlSocket final : public CControlSocket
 {
 public:
@@ -31,7 +33,7 @@ public:
 	virtual void Delete(CServerPath const& path, std::vector<std::wstring>&& files) override;
 	virtual void Mkdir(const CServerPath& path) override;
 	virtual void RemoveDir(CServerPath const& path = CServerPath(), std::wstring const& subDir = std::wstring()) override;
-	/*virtual void Rename(const CRenameCommand& command) override;*/
+	virtual void Rename(CRenameCommand const& command) override;
 	virtual void Cancel() override;
 
 	virtual bool Connected() const override { return input_thread_.operator bool(); }
@@ -57,13 +59,20 @@ protected:
 	std::unique_ptr<fz::process> process_;
 	std::unique_ptr<CStorjInputThread> input_thread_;
 
+	// Identifies the setup of the process, it can be reused by later
+	// connections with the same key once this one is closed.
+	std::wstring workerKey_;
+
 	virtual void operator()(fz::event_base const& ev) override;
-	void OnStorjEvent(storj_message const& message);
+	void OnStorjBatchEvent(storj_message_batch const& batch);
+	void OnStorjEvent(storj_message & message);
 	void OnTerminate(std::wstring const& error);
 
 	int result_{};
 	std::wstring response_;
 
+	CStorjIdCache idCache_;
+
 	friend class CProtocolOpData<CStorjControlSocket>;
 	friend class CStorjConnectOpData;
 	friend class CStorjDeleteOpData;
@@ -71,6 +80,7 @@ protected:
 	friend class CStorjListOpData;
 	friend class CStorjMkdirOpData;
 	friend class CStorjRemoveDirOpData;
+	friend class CStorjRenameOpData;
 	friend class CStorjResolveOpData;
 	friend class CStorjResolveManyOpData;
 };
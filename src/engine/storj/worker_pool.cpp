@@ -0,0 +1,113 @@
+#include <filezilla.h>
+
+#include "event.h"
+#include "input_thread.h"
+#include "worker_pool.h"
+
+#include <libfilezilla/process.hpp>
+
+namespace {
+// Each idle worker holds a process and a thread
+size_t const max_idle = 4;
+fz::duration const max_idle_time = fz::duration::from_minutes(5);
+}
+
+CStorjWorkerPool::CStorjWorkerPool(fz::event_loop & loop)
+	: fz::event_handler(loop)
+{
+}
+
+CStorjWorkerPool::~CStorjWorkerPool()
+{
+	remove_handler();
+
+	for (auto & w : idle_) {
+		Stop(w.worker_);
+	}
+}
+
+CStorjWorkerPool::worker CStorjWorkerPool::Lease(std::wstring const& key, fz::event_handler & handler)
+{
+	fz::scoped_lock l(mutex_);
+
+	Expire();
+
+	worker ret;
+	for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+		if (it->key_ == key) {
+			ret = std::move(it->worker_);
+			idle_.erase(it);
+			ret.input_thread_->set_handler(handler);
+			break;
+		}
+	}
+	return ret;
+}
+
+void CStorjWorkerPool::Release(std::wstring const& key, worker && w)
+{
+	if (!w) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+
+	w.input_thread_->set_handler(*this);
+	idle_.push_back({key, std::move(w), fz::monotonic_clock::now()});
+
+	Expire();
+	if (idle_.size() > max_idle) {
+		Stop(idle_.front().worker_);
+		idle_.erase(idle_.begin());
+	}
+
+	if (!timer_) {
+		timer_ = add_timer(fz::duration::from_minutes(1), false);
+	}
+}
+
+void CStorjWorkerPool::Expire()
+{
+	auto const now = fz::monotonic_clock::now();
+	for (auto it = idle_.begin(); it != idle_.end(); ) {
+		if (it->worker_.input_thread_->finished() || now - it->since_ >= max_idle_time) {
+			Stop(it->worker_);
+			it = idle_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void CStorjWorkerPool::Stop(worker & w)
+{
+	w.process_->kill();
+	w.input_thread_.reset();
+	w.process_.reset();
+}
+
+void CStorjWorkerPool::operator()(fz::event_base const& ev)
+{
+	// Idle workers send nothing but their termination, other events are
+	// leftovers from the connection that released it.
+	fz::dispatch<StorjTerminateEvent, fz::timer_event>(ev, this,
+		&CStorjWorkerPool::OnTerminate,
+		&CStorjWorkerPool::OnTimer);
+}
+
+void CStorjWorkerPool::OnTerminate(std::wstring const&)
+{
+	fz::scoped_lock l(mutex_);
+	Expire();
+}
+
+void CStorjWorkerPool::OnTimer(fz::timer_id)
+{
+	fz::scoped_lock l(mutex_);
+	Expire();
+	if (idle_.empty()) {
+		stop_timer(timer_);
+		timer_ = 0;
+	}
+}
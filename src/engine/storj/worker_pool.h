@@ -0,0 +1,64 @@
+#ifndef FILEZILLA_ENGINE_STORJ_WORKER_POOL_HEADER
+#define FILEZILLA_ENGINE_STORJ_WORKER_POOL_HEADER
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace fz {
+class process;
+}
+
+class CStorjInputThread;
+
+// fzstorj processes of closed connections, kept running for the next
+// connection with the same access. Such a connection needs neither start
+// the process nor open the project again. Workers are keyed by everything
+// that went into setting them up, like credentials and arguments.
+class CStorjWorkerPool final : public fz::event_handler
+{
+public:
+	struct worker final
+	{
+		explicit operator bool() const { return process_ && input_thread_; }
+
+		std::unique_ptr<fz::process> process_;
+		std::unique_ptr<CStorjInputThread> input_thread_;
+	};
+
+	explicit CStorjWorkerPool(fz::event_loop & loop);
+	virtual ~CStorjWorkerPool();
+
+	// Returns an idle worker with the given key, its events going to the
+	// handler from now on. Empty if there is none.
+	worker Lease(std::wstring const& key, fz::event_handler & handler);
+
+	// The worker must not have a command in progress.
+	void Release(std::wstring const& key, worker && w);
+
+private:
+	struct idle_worker final
+	{
+		std::wstring key_;
+		worker worker_;
+		fz::monotonic_clock since_;
+	};
+
+	virtual void operator()(fz::event_base const& ev) override;
+	void OnTerminate(std::wstring const&);
+	void OnTimer(fz::timer_id);
+
+	// Removes workers that quit or idled for too long. Caller needs to hold the mutex
+	void Expire();
+
+	static void Stop(worker & w);
+
+	fz::mutex mutex_;
+	std::vector<idle_worker> idle_;
+	fz::timer_id timer_{};
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <filezilla.h>
+#include "tls_session_cache.h"
+
+#include <libfilezilla/tls_layer.hpp>
+
+namespace {
+// Servers usually accept session tickets for a few hours at most
+fz::duration const max_session_age = fz::duration::from_hours(1);
+
+size_t const max_sessions = 64;
+}
+
+std::vector<uint8_t> CTlsSessionCache::Get(std::wstring const& host, unsigned int port)
+{
+	fz::scoped_lock lock(mutex_);
+
+	auto it = sessions_.find(std::make_tuple(host, port));
+	if (it == sessions_.end()) {
+		return std::vector<uint8_t>();
+	}
+
+	if (fz::monotonic_clock::now() - it->second.time_ >= max_session_age) {
+		sessions_.erase(it);
+		return std::vector<uint8_t>();
+	}
+
+	return it->second.session_;
+}
+
+void CTlsSessionCache::Store(std::wstring const& host, unsigned int port, fz::tls_layer const& tls)
+{
+	auto const state = tls.get_state();
+	if (state != fz::socket_state::connected && state != fz::socket_state::shutting_down && state != fz::socket_state::shut_down) {
+		return;
+	}
+
+	std::vector<uint8_t> session = tls.get_session_parameters();
+	if (session.empty()) {
+		return;
+	}
+
+	fz::scoped_lock lock(mutex_);
+
+	auto const now = fz::monotonic_clock::now();
+
+	auto key = std::make_tuple(host, port);
+	auto it = sessions_.find(key);
+	if (it == sessions_.end()) {
+		if (sessions_.size() >= max_sessions) {
+			auto oldest = sessions_.begin();
+			for (auto cur = sessions_.begin(); cur != sessions_.end(); ++cur) {
+				if (cur->second.time_ < oldest->second.time_) {
+					oldest = cur;
+				}
+			}
+			sessions_.erase(oldest);
+		}
+		it = sessions_.emplace(std::move(key), entry()).first;
+	}
+
+	it->second.session_ = std::move(session);
+	it->second.time_ = now;
+}
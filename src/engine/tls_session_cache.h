@@ -0,0 +1,45 @@
+#ifndef FILEZILLA_ENGINE_TLS_SESSION_CACHE_HEADER
+#define FILEZILLA_ENGINE_TLS_SESSION_CACHE_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace fz {
+class tls_layer;
+}
+
+// Remembers the TLS session of the most recent connection to each server,
+// shared by all engines. New control connections resume it instead of
+// going through a full handshake.
+class CTlsSessionCache final
+{
+public:
+	CTlsSessionCache() = default;
+
+	CTlsSessionCache(CTlsSessionCache const&) = delete;
+	CTlsSessionCache& operator=(CTlsSessionCache const&) = delete;
+
+	// Returns an empty vector if there is no session to resume
+	std::vector<uint8_t> Get(std::wstring const& host, unsigned int port);
+
+	// Stores the session of an established TLS layer
+	void Store(std::wstring const& host, unsigned int port, fz::tls_layer const& tls);
+
+protected:
+	struct entry
+	{
+		std::vector<uint8_t> session_;
+		fz::monotonic_clock time_;
+	};
+
+	fz::mutex mutex_;
+
+	std::map<std::tuple<std::wstring, unsigned int>, entry> sessions_;
+};
+
+#endif
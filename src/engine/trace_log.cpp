@@ -0,0 +1,127 @@
+#include <filezilla.h>
+
+#include "trace_log.h"
+
+namespace {
+void append_le(std::string& out, uint64_t v, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xffu);
+	}
+}
+}
+
+CTraceLog::CTraceLog(fz::thread_pool& pool)
+	: pool_(pool)
+{
+}
+
+CTraceLog::~CTraceLog()
+{
+	fz::scoped_lock l(mutex_);
+	Stop(l);
+}
+
+void CTraceLog::SetFile(fz::native_string const& file)
+{
+	fz::scoped_lock l(mutex_);
+	if (file == filename_) {
+		return;
+	}
+	Stop(l);
+
+	filename_ = file;
+	if (file.empty()) {
+		return;
+	}
+
+	// Cleared on failure so that setting the same file again retries
+	if (!file_.open(file, fz::file::writing, fz::file::empty)) {
+		filename_.clear();
+		return;
+	}
+
+	start_ = fz::monotonic_clock::now();
+	pending_ = "FZTRACE1";
+	append_le(pending_, static_cast<uint64_t>(fz::datetime::now().get_time_t()) * 1000, 8);
+
+	quit_ = false;
+	writer_ = pool_.spawn([this]() { WriterLoop(); });
+	if (!writer_) {
+		file_.close();
+		pending_.clear();
+		filename_.clear();
+		return;
+	}
+	enabled_ = true;
+}
+
+void CTraceLog::Stop(fz::scoped_lock& l)
+{
+	enabled_ = false;
+	if (writer_) {
+		quit_ = true;
+		condition_.signal(l);
+		l.unlock();
+		writer_.join();
+		l.lock();
+		writer_ = fz::async_task();
+	}
+	file_.close();
+	pending_.clear();
+}
+
+void CTraceLog::Record(unsigned int engine_id, unsigned int operation_id, trace_event::type event, int64_t value)
+{
+	if (!enabled()) {
+		return;
+	}
+
+	fz::scoped_lock l(mutex_);
+	if (!enabled_ || pending_.size() >= max_pending_size) {
+		return;
+	}
+
+	bool const was_empty = pending_.empty();
+
+	auto const now = (fz::monotonic_clock::now() - start_).get_microseconds();
+	append_le(pending_, static_cast<uint64_t>(now), 8);
+	append_le(pending_, engine_id, 4);
+	append_le(pending_, operation_id, 4);
+	append_le(pending_, event, 2);
+	append_le(pending_, 0, 6);
+	append_le(pending_, static_cast<uint64_t>(value), 8);
+
+	if (was_empty) {
+		condition_.signal(l);
+	}
+}
+
+void CTraceLog::WriterLoop()
+{
+	std::string data;
+
+	fz::scoped_lock l(mutex_);
+	while (true) {
+		if (pending_.empty()) {
+			if (quit_) {
+				break;
+			}
+			condition_.wait(l);
+			continue;
+		}
+
+		data.swap(pending_);
+		l.unlock();
+
+		bool const ok = file_.write(data.c_str(), static_cast<int64_t>(data.size())) == static_cast<int64_t>(data.size());
+		data.clear();
+
+		l.lock();
+		if (!ok) {
+			// Nothing sensible to do, stop recording
+			enabled_ = false;
+			pending_.clear();
+		}
+	}
+}
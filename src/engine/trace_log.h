@@ -0,0 +1,88 @@
+#ifndef FILEZILLA_ENGINE_TRACE_LOG_HEADER
+#define FILEZILLA_ENGINE_TRACE_LOG_HEADER
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <atomic>
+#include <string>
+
+/*
+ * Optional binary trace of engine events, for replaying a session's
+ * timeline and analyzing latencies offline, see fztracedump.
+ *
+ * File format, all integers little-endian:
+ *   Header: 8 bytes magic "FZTRACE1", u64 wall-clock start time in
+ *   milliseconds since the epoch.
+ *   Followed by fixed-size 32 byte records:
+ *     u64 time in microseconds since the start time
+ *     u32 engine id
+ *     u32 operation id, counted per engine, 0 if outside an operation
+ *     u16 event type
+ *     u16 reserved
+ *     u32 reserved
+ *     i64 event-specific value
+ *
+ * Recording an event only appends to a memory buffer, writing happens on a
+ * background task. If it falls too far behind, events are dropped.
+ */
+namespace trace_event {
+enum type : uint16_t
+{
+	command_start = 1, // value: Command id
+	command_end,       // value: Reply code
+	command_sent,      // value: Length of the command
+	reply_received,    // value: Reply code if known, else length
+	bytes_transferred, // value: Amount of bytes
+	lock_wait,         // value: Lock reason
+	lock_acquired,     // value: Lock reason, -1 if acquired after waiting
+	cache_hit,         // value: Number of entries, once per engine level cache lookup
+	cache_miss,        // value: 0
+	connected          // value: 0, connection established but not yet logged in
+};
+}
+
+class CTraceLog final
+{
+public:
+	explicit CTraceLog(fz::thread_pool& pool);
+	~CTraceLog();
+
+	CTraceLog(CTraceLog const&) = delete;
+	CTraceLog& operator=(CTraceLog const&) = delete;
+
+	// Pass an empty path to stop tracing
+	void SetFile(fz::native_string const& file);
+
+	bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	void Record(unsigned int engine_id, unsigned int operation_id, trace_event::type event, int64_t value);
+
+	static constexpr size_t record_size = 32;
+	static constexpr size_t header_size = 16;
+
+private:
+	void Stop(fz::scoped_lock& l);
+	void WriterLoop();
+
+	fz::thread_pool& pool_;
+
+	fz::mutex mutex_{false};
+	fz::condition condition_;
+
+	fz::file file_;
+	fz::native_string filename_;
+	fz::monotonic_clock start_;
+
+	std::string pending_;
+	bool quit_{};
+	fz::async_task writer_;
+
+	std::atomic<bool> enabled_{};
+
+	static constexpr size_t max_pending_size = 4 * 1024 * 1024;
+};
+
+#endif
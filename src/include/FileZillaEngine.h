@@ -30,6 +30,9 @@ public:
 	bool IsBusy() const;
 	bool IsConnected() const;
 
+	// Unique for the lifetime of the process, also used in the log file
+	unsigned int GetEngineId() const;
+
 	// IsActive returns true only if data has been transferred in the
 	// given direction since the last time IsActive was called with
 	// the same argument.
@@ -61,6 +64,19 @@ public:
 
 	int CacheLookup(CServerPath const& path, CDirectoryListing& listing);
 
+	// One listing per path, listings of paths not in the cache have an
+	// empty path. Fails if none is cached.
+	int CacheLookupMany(std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings);
+
+	// Same for the listings of any server, the engine need not be connected
+	// to it.
+	int CacheLookupMany(CServer const& server, std::vector<CServerPath> const& paths, std::vector<CDirectoryListing>& listings);
+
+	// Cached listings of path and everything below it, see
+	// CDirectoryCache::LookupTree. Fails if anything in the tree needs to
+	// be listed first.
+	int CacheLookupTree(CServerPath const& path, std::wstring const& needle, std::vector<CDirectoryListing>& listings);
+
 private:
 	CFileZillaEnginePrivate* const impl_;
 };
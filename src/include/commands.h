@@ -6,6 +6,8 @@
 
 #include <libfilezilla/uri.hpp>
 
+#include <memory>
+
 // See below for actual commands and their parameters
 
 // Command IDs
@@ -24,6 +26,11 @@ enum class Command
 	chmod,
 	raw,
 	httprequest, // Only used by HTTP protocol
+	uploadbatch, // Only used by SFTP protocol
+	filehash, // Only used by FTP and SFTP protocols
+	copy, // Only used by SFTP protocol
+	batch,
+	fxp, // Only used by FTP protocol
 
 	// Only used internally
 	sleep,
@@ -130,6 +137,7 @@ typedef CBasicCommand<Command::disconnect> CDisconnectCommand;
 #define LIST_FLAG_FALLBACK_CURRENT 4
 #define LIST_FLAG_LINK 8
 #define LIST_FLAG_CLEARCACHE 16
+#define LIST_FLAG_TREE 32
 class CListCommand final : public CCommandHelper<CListCommand, Command::list>
 {
 	// Without a given directory, the current directory will be listed.
@@ -149,6 +157,10 @@ class CListCommand final : public CCommandHelper<CListCommand, Command::list>
 	// LIST_FLAG_LINK is used for symlink discovery. There's unfortunately
 	// no sane way to distinguish between symlinks to files and symlinks to
 	// directories.
+	//
+	// LIST_FLAG_TREE hints that the subdirectories are going to be listed
+	// as well. Protocols able to list a whole subtree at once may do so and
+	// put the listings of all subdirectories into the cache.
 public:
 	explicit CListCommand(int flags = 0);
 	explicit CListCommand(CServerPath path, std::wstring const& subDir = std::wstring(), int flags = 0);
@@ -174,6 +186,12 @@ public:
 	public:
 		bool binary{true};
 		bool fsync{};
+
+		// For segmented downloads, only the segmentSize bytes starting at
+		// segmentOffset are transferred into the existing local file at
+		// the same offset. Negative offset transfers the whole file.
+		int64_t segmentOffset{-1};
+		int64_t segmentSize{-1};
 	};
 
 	// For uploads, set download to false.
@@ -196,6 +214,107 @@ protected:
 	t_transferSettings const m_transferSettings;
 };
 
+// Uploads several small files into one remote directory, overwriting
+// existing files without asking. The result of each file is delivered
+// through an nId_upload_batch notification as soon as it is known; the
+// operation itself only succeeds if all files have been uploaded.
+class CUploadBatchCommand final : public CCommandHelper<CUploadBatchCommand, Command::uploadbatch>
+{
+public:
+	struct file final
+	{
+		std::wstring localFile;
+		std::wstring remoteFile;
+	};
+
+	CUploadBatchCommand(CServerPath const& remotePath, std::vector<file> const& files)
+		: remotePath_(remotePath)
+		, files_(files)
+	{}
+
+	bool valid() const { return !remotePath_.empty() && !files_.empty(); }
+
+	CServerPath const remotePath_;
+	std::vector<file> const files_;
+};
+
+// Asks the server for a checksum of a file. On success, the checksum is
+// delivered through an nId_file_hash notification before the operation
+// completes. The server picks the strongest algorithm it supports.
+class CFileHashCommand final : public CCommandHelper<CFileHashCommand, Command::filehash>
+{
+public:
+	CFileHashCommand(CServerPath const& path, std::wstring const& file)
+		: path_(path)
+		, file_(file)
+	{}
+
+	bool valid() const { return !path_.empty() && !file_.empty(); }
+
+	CServerPath const path_;
+	std::wstring const file_;
+};
+
+// Copies a file on the server itself, the contents are not transferred
+// through the client. Only works if the server supports it, check
+// ProtocolFeature::ServerCopy.
+class CCopyCommand final : public CCommandHelper<CCopyCommand, Command::copy>
+{
+public:
+	CCopyCommand(CServerPath const& fromPath, std::wstring const& fromFile,
+				 CServerPath const& toPath, std::wstring const& toFile)
+		: fromPath_(fromPath)
+		, toPath_(toPath)
+		, fromFile_(fromFile)
+		, toFile_(toFile)
+	{}
+
+	bool valid() const { return !fromPath_.empty() && !toPath_.empty() && !fromFile_.empty() && !toFile_.empty(); }
+
+	CServerPath const fromPath_;
+	CServerPath const toPath_;
+	std::wstring const fromFile_;
+	std::wstring const toFile_;
+};
+
+// One half of a server-to-server transfer of a file, also known as FXP.
+//
+// The engine on the passive side is given no address. It makes its server
+// listen for the data connection, announces the address through an
+// nId_fxp_address notification and then sends the transfer command. The
+// caller hands that address to the engine on the active side, which tells
+// its server to connect to it.
+//
+// Both halves complete on their own, the caller has to cancel the other one
+// if either fails. FZ_REPLY_NOTSUPPORTED is returned if a server refuses to
+// take part, e.g. because it does not allow data connections to or from a
+// third address.
+class CFxpCommand final : public CCommandHelper<CFxpCommand, Command::fxp>
+{
+public:
+	CFxpCommand(CServerPath const& path, std::wstring const& file, bool store, bool binary, std::wstring const& address = std::wstring())
+		: path_(path)
+		, file_(file)
+		, address_(address)
+		, store_(store)
+		, binary_(binary)
+	{}
+
+	bool valid() const { return !path_.empty() && !file_.empty(); }
+
+	bool passive() const { return address_.empty(); }
+
+	CServerPath const path_;
+	std::wstring const file_;
+
+	// In the format of the argument to PORT
+	std::wstring const address_;
+
+	// STOR if set, RETR otherwise
+	bool const store_;
+	bool const binary_;
+};
+
 class CHttpRequestCommand final : public CCommandHelper<CHttpRequestCommand, Command::httprequest>
 {
 public:
@@ -297,16 +416,43 @@ public:
 	// i.e. chmod 755 foo.bar
 	CChmodCommand(CServerPath const& path, std::wstring const& file, std::wstring const& permission);
 
+	// Changes the permissions of several files in the same directory, each
+	// given as pair of filename and permission string. The engine pipelines
+	// the commands if the server allows.
+	CChmodCommand(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files);
+
 	CServerPath GetPath() const { return m_path; }
-	std::wstring GetFile() const { return m_file; }
-	std::wstring GetPermission() const { return m_permission; }
+
+	// Of the first file
+	std::wstring GetFile() const { return m_files.empty() ? std::wstring() : m_files.front().first; }
+	std::wstring GetPermission() const { return m_files.empty() ? std::wstring() : m_files.front().second; }
+
+	std::vector<std::pair<std::wstring, std::wstring>> const& GetFiles() const { return m_files; }
 
 	bool valid() const;
 
 protected:
 	CServerPath const m_path;
-	std::wstring const m_file;
-	std::wstring const m_permission;
+	std::vector<std::pair<std::wstring, std::wstring>> m_files;
+};
+
+// Runs several mkdir, rename and chmod commands as a single operation.
+// Fails if any of them fails, but always runs all of them.
+class CBatchCommand final : public CCommandHelper<CBatchCommand, Command::batch>
+{
+public:
+	static bool CanBatch(CCommand const& command);
+
+	void Add(std::unique_ptr<CCommand> && command);
+
+	std::vector<std::shared_ptr<CCommand const>> const& GetCommands() const { return commands_; }
+	size_t size() const { return commands_.size(); }
+
+	bool valid() const;
+
+protected:
+	// Shared by all copies, commands are immutable once added
+	std::vector<std::shared_ptr<CCommand const>> commands_;
 };
 
 #endif
@@ -7,6 +7,8 @@
 #include <libfilezilla/shared.hpp>
 #include <libfilezilla/time.hpp>
 
+#include <memory>
+#include <string_view>
 #include <unordered_map>
 
 class CDirentry
@@ -69,6 +71,41 @@ public:
 	bool operator==(const CDirentry &op) const;
 };
 
+// Open-addressing hash index over the names of the entries of a listing.
+// Slots only hold the entry index and the hash of its name, lookups compare
+// against the names of the entries themselves. Entries are indexed lazily,
+// only as far as needed to answer a lookup.
+class CDirentryNameIndex final
+{
+public:
+	// Returns the index of the first entry with the given name, std::wstring::npos if there is none.
+	size_t find(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase);
+
+	// Appends the indexes of all entries with the given name in ascending order
+	void find_all(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase, std::vector<size_t> & out);
+
+	// Once all entries are indexed, lookups no longer modify the index
+	bool complete(size_t count) const { return indexed_ == count && count < empty; }
+
+	// Like find and find_all, but only consider the entries indexed so far
+	size_t find_indexed(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase) const;
+	void find_all_indexed(std::vector<fz::shared_value<CDirentry>> const& entries, std::wstring const& name, bool nocase, std::vector<size_t> & out) const;
+
+private:
+	struct slot
+	{
+		uint32_t index{empty};
+		uint32_t hash{};
+	};
+	static constexpr uint32_t empty = uint32_t(-1);
+
+	void insert(uint32_t index, uint32_t hash);
+	void reserve(size_t count);
+
+	std::vector<slot> slots_;
+	size_t indexed_{};
+};
+
 class CDirectoryListing final
 {
 public:
@@ -87,13 +124,22 @@ public:
 	// entry if you do not call ClearFindMap afterwards
 	CDirentry& get(size_t index);
 
+	// The entry itself, for assembling another listing without copying it
+	fz::shared_value<CDirentry> const& GetShared(size_t index) const;
+
 	size_t size() const { return m_entries ? m_entries->size() : 0; }
 
 	void Append(CDirentry&& entry);
 
+	// Appends the entries, updating the flags accordingly
+	void Append(std::vector<fz::shared_value<CDirentry>> const& entries);
+
 	size_t FindFile_CmpCase(std::wstring const& name) const;
 	size_t FindFile_CmpNoCase(std::wstring const& name) const;
 
+	// Indexes of all entries matching the name ignoring case, ascending
+	std::vector<size_t> FindFiles_CmpNoCase(std::wstring const& name) const;
+
 	void ClearFindMap();
 
 	explicit operator bool() const { return !path.empty(); }
@@ -142,15 +188,45 @@ public:
 
 	void GetFilenames(std::vector<std::wstring> &names) const;
 
+	// Contiguous copies of the fields scanned in tight loops, such as when
+	// sorting. Built on first use, dropped whenever the entries may change.
+	struct columns
+	{
+		std::vector<int64_t> size;
+		std::vector<int64_t> time; // See time_key
+		std::vector<uint8_t> flags; // CDirentry::_flags
+	};
+	columns const& GetColumns() const;
+
+	// Keys compare the same way as the fz::datetime they got made from
+	static int64_t time_key(fz::datetime const& time);
+
 protected:
 
 	fz::shared_optional<std::vector<fz::shared_value<CDirentry>>> m_entries;
 
-	mutable fz::shared_optional<std::unordered_multimap<std::wstring, size_t>> m_searchmap_case;
-	mutable fz::shared_optional<std::unordered_multimap<std::wstring, size_t>> m_searchmap_nocase;
+	mutable fz::shared_optional<CDirentryNameIndex> m_searchmap_case;
+	mutable fz::shared_optional<CDirentryNameIndex> m_searchmap_nocase;
+
+	mutable std::shared_ptr<columns const> m_columns;
 };
 
 // Checks if listing2 is a subset of listing1. Compares only filenames.
 bool CheckInclusion(CDirectoryListing const& listing1, CDirectoryListing const& listing2);
 
+// Interns strings like permissions and owner/group, so that identical
+// values of the entries in a listing share a single fz::shared_value.
+// Not thread-safe, meant to live as long as the parse or load of a listing.
+class CStringPool final
+{
+public:
+	fz::shared_value<std::wstring> const& get(std::wstring_view const& v);
+
+	void clear() { pool_.clear(); }
+
+private:
+	// The keys refer to the pooled values, which never get modified.
+	std::unordered_map<std::wstring_view, fz::shared_value<std::wstring>> pool_;
+};
+
 #endif
@@ -2,10 +2,21 @@
 #define FILEZILLA_ENGINE_CONTEXT_HEADER
 
 #include <memory>
+#include <string>
 
+class CActivePortAllocator;
 class CDirectoryCache;
+class CDnsCache;
+class CEngineMetrics;
+class CExternalIPCache;
 class COptionsBase;
 class CPathCache;
+class CProxyHandshakeCache;
+class CServer;
+class CSftpProcessPool;
+class CStorjWorkerPool;
+class CTlsSessionCache;
+class CTraceLog;
 class OpLockManager;
 
 namespace fz {
@@ -23,6 +34,21 @@ public:
 
 	virtual std::wstring toLocal(std::wstring const& encoding, char const* buffer, size_t len) const = 0;
 	virtual std::string toServer(std::wstring const& encoding, wchar_t const* buffer, size_t len) const = 0;
+
+	// Bound to a single encoding, so that it only needs to get looked up
+	// once per connection. Not thread-safe.
+	class converter
+	{
+	public:
+		virtual ~converter() = default;
+
+		virtual std::wstring toLocal(char const* buffer, size_t len) = 0;
+		virtual std::string toServer(wchar_t const* buffer, size_t len) = 0;
+	};
+
+	// Returns nullptr if the encoding is not supported. By default the
+	// returned converter goes through toLocal and toServer.
+	virtual std::unique_ptr<converter> Open(std::wstring const& encoding) const;
 };
 
 // There can be multiple engines, but there can be at most one context
@@ -35,12 +61,47 @@ public:
 	COptionsBase& GetOptions() { return options_; }
 	fz::thread_pool& GetThreadPool();
 	fz::event_loop& GetEventLoop();
+
+	// The loop a new engine should run on. Engines get spread over the loops
+	// configured through OPTION_ENGINE_EVENT_LOOPS, the first one being the
+	// loop returned by GetEventLoop.
+	fz::event_loop& GetEngineEventLoop();
+
+	// Engines take a slot each, the slot picks one of the addresses in
+	// OPTION_SOURCE_ADDRESSES. Returns an empty string if none is configured.
+	size_t GetSourceAddressSlot();
+	std::string GetSourceAddress(size_t slot);
+
 	fz::rate_limiter& GetRateLimiter();
+
+	// Limiter for a connection to the given server, all connections to it
+	// sharing one below the global limiter. Returns nullptr if speed limits
+	// are disabled and the server has no limits of its own, such connections
+	// should go without limiting layer. Changed limit values apply to all
+	// connections using a limiter, but enabling the limits only applies to
+	// connections made afterwards.
+	std::shared_ptr<fz::rate_limiter> GetRateLimiter(CServer const& server);
+
+	// Whether uploads to the server are currently limited, either by the
+	// global limits, including a schedule, or by those of the site.
+	bool LimitsUploads(CServer const& server);
+
 	CDirectoryCache& GetDirectoryCache();
 	CPathCache& GetPathCache();
 	CustomEncodingConverterBase const& GetCustomEncodingConverter() { return customEncodingConverter_; }
 	OpLockManager& GetOpLockManager();
 	fz::tls_system_trust_store& GetTlsSystemTrustStore();
+	CTlsSessionCache& GetTlsSessionCache();
+	CDnsCache& GetDnsCache();
+	CExternalIPCache& GetExternalIPCache();
+	CProxyHandshakeCache& GetProxyHandshakeCache();
+	CTraceLog& GetTraceLog();
+	CEngineMetrics& GetMetrics();
+	CActivePortAllocator& GetActivePortAllocator();
+	CSftpProcessPool& GetSftpProcessPool();
+
+	// Only available if built with Storj support
+	CStorjWorkerPool& GetStorjWorkerPool();
 
 protected:
 	COptionsBase& options_;
@@ -0,0 +1,116 @@
+#ifndef FILEZILLA_ENGINE_METRICS_HEADER
+#define FILEZILLA_ENGINE_METRICS_HEADER
+
+#include "commands.h"
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+enum class engine_phase
+{
+	connect,
+	login,
+	list,
+	transfer,
+	lock_wait,
+	other,
+
+	count
+};
+
+// Per-engine counters for the profiling display. Updated by the engine,
+// read from any thread.
+struct engine_counters final
+{
+	explicit engine_counters(unsigned int id)
+		: engine_id(id)
+	{}
+
+	unsigned int const engine_id;
+
+	// Time spent in each phase, in microseconds
+	std::atomic<int64_t> phase_us[static_cast<size_t>(engine_phase::count)]{};
+
+	// Delay between a command getting queued and the event loop starting it
+	std::atomic<int64_t> loop_lag_us{};
+	std::atomic<int64_t> max_loop_lag_us{};
+
+	// Notifications not yet fetched by the user of the engine
+	std::atomic<int64_t> pending_notifications{};
+};
+
+struct slow_operation final
+{
+	unsigned int engine_id{};
+	Command command{Command::none};
+	int reply{};
+	fz::duration duration;
+	fz::datetime time;
+};
+
+// Running totals over all engines of a context, for exporting to monitoring
+// systems. Fed from the same places as the trace log, but always enabled
+// since each event only costs an atomic increment.
+class CEngineMetrics final
+{
+public:
+	struct snapshot final
+	{
+		int64_t commands{};
+		int64_t failed_commands{};
+		int64_t bytes_transferred{};
+		int64_t cache_hits{};
+		int64_t cache_misses{};
+		int64_t path_cache_hits{};
+		int64_t path_cache_misses{};
+		int64_t path_cache_evictions{};
+		int64_t lock_waits{};
+		int64_t lock_wait_ms{};
+		int64_t connections{}; // Currently open, not a total
+	};
+
+	snapshot Get() const;
+
+	void AddCommand(bool failed);
+	void AddBytes(int64_t bytes) { bytes_.fetch_add(bytes, std::memory_order_relaxed); }
+	void AddCacheLookup(bool hit);
+	void AddPathCacheLookup(bool hit);
+	void AddPathCacheEviction(int64_t count = 1) { path_cache_evictions_.fetch_add(count, std::memory_order_relaxed); }
+	void AddLockWait(fz::duration const& wait);
+
+	void ConnectionOpened() { connections_.fetch_add(1, std::memory_order_relaxed); }
+	void ConnectionClosed() { connections_.fetch_sub(1, std::memory_order_relaxed); }
+
+	std::shared_ptr<engine_counters> AddEngine(unsigned int engine_id);
+	void RemoveEngine(std::shared_ptr<engine_counters> const& counters);
+	std::vector<std::shared_ptr<engine_counters const>> GetEngines() const;
+
+	// Only the most recent operations taking longer than a second are kept
+	void AddSlowOperation(slow_operation const& op);
+	std::vector<slow_operation> GetSlowOperations() const;
+
+private:
+	std::atomic<int64_t> commands_{};
+	std::atomic<int64_t> failed_commands_{};
+	std::atomic<int64_t> bytes_{};
+	std::atomic<int64_t> cache_hits_{};
+	std::atomic<int64_t> cache_misses_{};
+	std::atomic<int64_t> path_cache_hits_{};
+	std::atomic<int64_t> path_cache_misses_{};
+	std::atomic<int64_t> path_cache_evictions_{};
+	std::atomic<int64_t> lock_waits_{};
+	std::atomic<int64_t> lock_wait_ms_{};
+	std::atomic<int64_t> connections_{};
+
+	mutable fz::mutex mutex_{false};
+	std::vector<std::shared_ptr<engine_counters>> engines_;
+	std::deque<slow_operation> slow_operations_;
+};
+
+#endif
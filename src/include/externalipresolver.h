@@ -20,7 +20,9 @@ public:
 	bool Successful() const;
 	std::string GetIP() const;
 
-	void GetExternalIP(std::wstring const& resolver, fz::address_type protocol, bool force = false);
+	// Each call makes a new request, see CExternalIPCache for a shared
+	// and cached result.
+	void GetExternalIP(std::wstring const& resolver, fz::address_type protocol);
 
 protected:
 
@@ -35,6 +37,7 @@ protected:
 	bool m_done{};
 
 	std::string m_data;
+	std::string m_ip;
 
 	std::unique_ptr<fz::socket> socket_;
 
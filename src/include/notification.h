@@ -20,6 +20,7 @@
 // CFileZillaEngine::SetAsyncRequestReply to continue the current operation.
 
 #include "commands.h"
+#include "directorylisting.h"
 #include "local_path.h"
 #include "server.h"
 
@@ -50,7 +51,11 @@ enum NotificationId
 	nId_data,				// for memory downloads, indicates that new data is available.
 	nId_sftp_encryption,	// information about key exchange, encryption algorithms and so on for SFTP
 	nId_local_dir_created,	// local directory has been created
-	nId_serverchange		// With some protocols, actual server identity isn't known until after logon
+	nId_serverchange,		// With some protocols, actual server identity isn't known until after logon
+	nId_listing_progress,	// entries of a primary directory listing that is still being received
+	nId_upload_batch,		// result of a single file of a CUploadBatchCommand
+	nId_file_hash,			// checksum of a remote file as requested by a CFileHashCommand
+	nId_fxp_address			// address the server on the passive side of a CFxpCommand listens on
 };
 
 // Async request IDs
@@ -141,6 +146,66 @@ protected:
 	CServerPath m_path;
 };
 
+// Sent while a primary directory listing is being received. Carries the
+// entries parsed since the previous progress notification. The complete
+// listing still arrives through a CDirectoryListingNotification, the
+// entries in these batches may differ from it in details such as the
+// timezone adjustments.
+class CDirectoryListingProgressNotification final : public CNotificationHelper<nId_listing_progress>
+{
+public:
+	CDirectoryListingProgressNotification(CServerPath const& path, std::vector<fz::shared_value<CDirentry>> && entries);
+
+	CServerPath const& GetPath() const { return path_; }
+	std::vector<fz::shared_value<CDirentry>> const& GetEntries() const { return entries_; }
+
+protected:
+	CServerPath const path_;
+	std::vector<fz::shared_value<CDirentry>> const entries_;
+};
+
+// The file at position index in the files of a CUploadBatchCommand is done
+class CUploadBatchNotification final : public CNotificationHelper<nId_upload_batch>
+{
+public:
+	CUploadBatchNotification(size_t index, bool succeeded)
+		: index_(index)
+		, succeeded_(succeeded)
+	{}
+
+	size_t const index_;
+	bool const succeeded_;
+};
+
+// Algorithm is one of "SHA-512", "SHA-256", "SHA-1", "MD5" and "CRC32",
+// the hash is in lowercase hex.
+class CFileHashNotification final : public CNotificationHelper<nId_file_hash>
+{
+public:
+	CFileHashNotification(CServerPath const& path, std::wstring const& file, std::wstring const& algorithm, std::string const& hash)
+		: path_(path)
+		, file_(file)
+		, algorithm_(algorithm)
+		, hash_(hash)
+	{}
+
+	CServerPath const path_;
+	std::wstring const file_;
+	std::wstring const algorithm_;
+	std::string const hash_;
+};
+
+// The address is in the format of the argument to PORT
+class CFxpAddressNotification final : public CNotificationHelper<nId_fxp_address>
+{
+public:
+	explicit CFxpAddressNotification(std::wstring const& address)
+		: address_(address)
+	{}
+
+	std::wstring const address_;
+};
+
 class CAsyncRequestNotification : public CNotificationHelper<nId_asyncrequest>
 {
 public:
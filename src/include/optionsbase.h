@@ -64,6 +64,10 @@ enum engineOptions
 
 	OPTION_SFTP_KEYFILES,
 	OPTION_SFTP_COMPRESSION,
+	OPTION_SFTP_MAX_WINDOW, // Upper limit of outstanding SFTP download requests, in MiB
+	OPTION_SFTP_MAX_LIST_WINDOW, // Upper limit of outstanding SFTP directory read requests
+	OPTION_SFTP_CONNECTION_SHARING, // Open further SFTP sessions to a site as channels of one SSH connection
+	OPTION_STORJ_CHUNK_SIZE, // Size of the buffers Storj objects are read and written in, in MiB
 
 	OPTION_PROXY_TYPE,
 	OPTION_PROXY_HOST,
@@ -74,6 +78,7 @@ enum engineOptions
 	OPTION_LOGGING_FILE,
 	OPTION_LOGGING_FILE_SIZELIMIT,
 	OPTION_LOGGING_SHOW_DETAILED_LOGS,
+	OPTION_LOGGING_TRACEFILE, // Binary trace of engine events, empty to disable
 
 	OPTION_SIZE_FORMAT,
 	OPTION_SIZE_USETHOUSANDSEP,
@@ -82,6 +87,39 @@ enum engineOptions
 	OPTION_TCP_KEEPALIVE_INTERVAL,
 
 	OPTION_CACHE_TTL,
+	OPTION_CACHE_MEMORY_BUDGET, // Estimated memory used by the directory cache, in MiB
+	OPTION_CACHE_PERSISTENT,
+	OPTION_CACHE_PERSISTENT_DIR,
+
+	OPTION_IOTHREAD_BUFFERSIZE, // Size of each transfer buffer between file and socket, in KiB
+	OPTION_IOTHREAD_BUFFERCOUNT,
+
+	OPTION_HTTP_KEEPALIVE,
+	OPTION_HTTP_PIPELINING, // Only applies to GET and HEAD requests
+
+	OPTION_ENGINE_EVENT_LOOPS, // Number of event loops the engines are spread over, 0 for one per CPU. Takes effect on restart.
+	OPTION_ENGINE_CPU_AFFINITY, // Pin the thread of each engine event loop to its own CPU
+
+	OPTION_CAPABILITIES_TTL, // Seconds learned server capabilities are kept across sessions, 0 to not keep them
+
+	OPTION_ACTIVE_PRELISTEN, // With limited ports, open the listener for the next active mode transfer ahead of time
+	OPTION_FTP_PREPARE_PASSIVE, // Send PASV/EPSV for the next transfer while waiting for the end of the current one
+
+	OPTION_CACHE_SHARED, // Share listed directories with other instances through the persistent cache directory
+
+	OPTION_SOCKET_BUFFER_AUTOTUNE, // Size data connection buffers from latency and throughput instead of OPTION_SOCKET_BUFFERSIZE_*
+	OPTION_TCP_CONGESTION_CONTROL, // Congestion control algorithm for data connections, e.g. bbr. Linux only, empty for the system default
+
+	OPTION_SPEEDLIMIT_SCHEDULE, // Time-of-day speed limits taking the place of OPTION_SPEEDLIMIT_INBOUND/OUTBOUND, see speedlimit_schedule.h
+
+	OPTION_SOURCE_ADDRESSES, // Local addresses to connect from, engines get assigned to them round-robin. Separated by spaces
+
+	OPTION_SFTP_PROCESS_POOL, // Number of fzsftp processes kept started ahead of time for new SFTP connections, 0 to disable
+
+	OPTION_SPARSE_DOWNLOADS, // Leave runs of zeros in binary downloads as holes in the file
+	OPTION_DOWNLOAD_SYNC_INTERVAL, // Flush downloaded data to disk every that many MiB, 0 to leave it to the system
+
+	OPTION_SFTP_ARCHIVE_UPLOADS, // Send SFTP upload batches as a tar stream to tar run on the server, if it allows running commands
 
 	OPTIONS_ENGINE_NUM
 };
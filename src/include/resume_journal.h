@@ -0,0 +1,37 @@
+#ifndef FILEZILLA_ENGINE_RESUME_JOURNAL_HEADER
+#define FILEZILLA_ENGINE_RESUME_JOURNAL_HEADER
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Remembers which ranges of a segmented download have been written, in a
+// small file next to the local file. After an interruption, only the
+// missing ranges need to be downloaded again.
+//
+// Dropping a journal is always safe, the download then starts from scratch.
+// All functions are thread-safe, the segments of a file are transferred by
+// different engines.
+class CResumeJournal final
+{
+public:
+	// Sorted, non-overlapping [begin, end) ranges
+	typedef std::vector<std::pair<int64_t, int64_t>> ranges;
+
+	static std::wstring GetJournalFile(std::wstring const& localFile);
+
+	// Fails if there is no journal, or it does not belong to a local file of
+	// the given size.
+	static bool Load(std::wstring const& localFile, int64_t fileSize, ranges & done);
+
+	// Marks [begin, end) as written. Once the whole file is covered, the
+	// journal is removed.
+	static void AddRange(std::wstring const& localFile, int64_t fileSize, int64_t begin, int64_t end);
+
+	static void Remove(std::wstring const& localFile);
+
+	static ranges GetMissing(ranges const& done, int64_t fileSize);
+};
+
+#endif
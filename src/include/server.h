@@ -101,7 +101,13 @@ enum class ProtocolFeature
 	TemporaryUrl,
 	S3Sse,
 	Security, // Encryption, integrity protection and authentication
-	UnixChmod
+	UnixChmod,
+	SegmentedDownload, // Downloading parts of a file into the middle of the local file
+	UploadBatch, // CUploadBatchCommand
+	FileHash, // CFileHashCommand
+	ServerCopy, // CCopyCommand
+	ServerToServer, // CFxpCommand
+	SourceAddress // Connections can be bound to a local address
 };
 
 enum class CaseSensitivity
@@ -120,7 +126,7 @@ class CServer final
 public:
 
 	// No error checking is done in the constructors
-	CServer() = default;
+	CServer();
 	CServer(ServerProtocol protocol, ServerType type, std::wstring const& host, unsigned int);
 
 	CServer(CServer const&) = default;
@@ -143,6 +149,16 @@ public:
 	int MaximumMultipleConnections() const;
 	bool GetBypassProxy() const;
 
+	// In KiB/s, 0 if unlimited. Shared by all connections to the server,
+	// within the global speed limits.
+	int GetInboundSpeedLimit() const { return m_speedLimits[0]; }
+	int GetOutboundSpeedLimit() const { return m_speedLimits[1]; }
+	void SetSpeedLimits(int inbound, int outbound);
+
+	// Local address to connect from, overrides OPTION_SOURCE_ADDRESSES
+	std::wstring const& GetSourceAddress() const { return m_sourceAddress; }
+	void SetSourceAddress(std::wstring const& address);
+
 	void SetProtocol(ServerProtocol serverProtocol);
 	bool SetHost(std::wstring const& host, unsigned int port);
 
@@ -152,6 +168,10 @@ public:
 	bool operator<(const CServer &op) const;
 	bool operator!=(const CServer &op) const;
 
+	// Of protocol, host, port and user, kept up to date by the setters.
+	// Consistent with operator==, SameResource and SameContent.
+	size_t Hash() const { return hash_; }
+
 	// Returns whether the argument refers to the same resource.
 	// Compares things like protocol and hostname, but excludes things like the name or the timezone offset.
 	bool SameResource(CServer const& other) const;
@@ -214,6 +234,8 @@ protected:
 	int m_timezoneOffset{};
 	PasvMode m_pasvMode{MODE_DEFAULT};
 	int m_maximumMultipleConnections{};
+	int m_speedLimits[2]{};
+	std::wstring m_sourceAddress;
 	CharsetEncoding m_encodingType{ENCODING_AUTO};
 	std::wstring m_customEncoding;
 
@@ -221,8 +243,20 @@ protected:
 	bool m_bypassProxy{};
 
 	std::map<std::string, std::wstring, std::less<>> extraParameters_;
+
+	size_t hash_{};
+
+private:
+	void UpdateHash();
 };
 
+namespace std {
+template<>
+struct hash<CServer>
+{
+	size_t operator()(CServer const& server) const noexcept { return server.Hash(); }
+};
+}
 
 enum class LogonType
 {
@@ -6,14 +6,37 @@
 #include <libfilezilla/optional.hpp>
 #include <libfilezilla/shared.hpp>
 
+#include <map>
+#include <memory>
 #include <vector>
 
+// Segments are stored as a chain from the last segment up to the first,
+// so paths derived from one another share the storage of their common
+// part. Segments are immutable once created.
+class CServerPathSegment final
+{
+public:
+	CServerPathSegment(std::shared_ptr<CServerPathSegment const> const& parent, std::wstring && name);
+
+	std::shared_ptr<CServerPathSegment const> const parent_;
+	std::wstring const name_;
+
+	// 1 for the first segment
+	size_t const depth_;
+
+	// Of this and all parent segments
+	size_t const hash_;
+};
+
 class CServerPathData final
 {
 public:
-	std::vector<std::wstring> m_segments;
+	// Empty if there are no segments
+	std::shared_ptr<CServerPathSegment const> m_last;
 	fz::sparse_optional<std::wstring> m_prefix;
 
+	size_t SegmentCount() const { return m_last ? m_last->depth_ : 0; }
+
 	bool operator==(const CServerPathData& cmp) const;
 };
 
@@ -76,8 +99,21 @@ public:
 
 	size_t SegmentCount() const;
 
+	// index must be less than SegmentCount()
+	std::wstring const& GetSegment(size_t index) const;
+
+	// From the first to the last segment, in linear time. The pointers are
+	// valid for as long as the path is.
+	std::vector<std::wstring const*> GetSegments() const;
+
+	// Consistent with operator==. Constant time, the segments carry the
+	// hash of their chain.
+	size_t Hash() const;
+
 	static CServerPath GetChanged(CServerPath const& oldPath, CServerPath const& newPath, std::wstring const& newSubdir);
 private:
+	friend class CServerPathInterner;
+
 	bool IsSeparator(wchar_t c) const;
 
 	bool DoSetSafePath(std::wstring const& path);
@@ -85,12 +121,10 @@ private:
 
 	ServerType m_type;
 
-	typedef std::vector<std::wstring> tSegmentList;
-	typedef tSegmentList::iterator tSegmentIter;
-	typedef tSegmentList::const_iterator tConstSegmentIter;
+	typedef std::shared_ptr<CServerPathSegment const> tSegmentPtr;
 
-	bool Segmentize(std::wstring const& str, tSegmentList& segments);
-	bool SegmentizeAddSegment(std::wstring & segment, tSegmentList& segments, bool& append);
+	bool Segmentize(std::wstring const& str, tSegmentPtr& last);
+	bool SegmentizeAddSegment(std::wstring & segment, tSegmentPtr& last, bool& append);
 	bool ExtractFile(std::wstring& dir, std::wstring& file);
 
 	static void EscapeSeparators(ServerType type, std::wstring& subdir);
@@ -98,4 +132,25 @@ private:
 	fz::shared_optional<CServerPathData> m_data;
 };
 
+// Lets equal paths, and equal parts of different paths, share their
+// segments even if they have been created independently, for example
+// when loading many paths at once. Interned segments stay alive at least
+// as long as the interner. Not thread-safe, the interned paths are.
+class CServerPathInterner final
+{
+public:
+	CServerPath Intern(CServerPath const& path);
+
+private:
+	std::map<std::pair<CServerPathSegment const*, std::wstring>, std::shared_ptr<CServerPathSegment const>> segments_;
+};
+
+namespace std {
+template<>
+struct hash<CServerPath>
+{
+	size_t operator()(CServerPath const& path) const noexcept { return path.Hash(); }
+};
+}
+
 #endif
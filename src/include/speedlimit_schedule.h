@@ -0,0 +1,40 @@
+#ifndef FILEZILLA_ENGINE_SPEEDLIMIT_SCHEDULE_HEADER
+#define FILEZILLA_ENGINE_SPEEDLIMIT_SCHEDULE_HEADER
+
+#include <libfilezilla/time.hpp>
+
+#include <string>
+#include <vector>
+
+// Time-of-day speed limits, e.g. "mon-fri 08:00-18:00 500/100; sat,sun 10:00-16:00 2000/0"
+//
+// Entries are separated by semicolons. Each consists of optional days, a
+// range of local time and the inbound and outbound limits in KiB/s, 0 meaning
+// unlimited. Ranges may wrap around midnight, their days are those the range
+// starts on. The first matching entry wins. Outside of all entries the
+// regular limits apply.
+class CSpeedLimitSchedule final
+{
+public:
+	// On syntax errors, the schedule is left empty and false is returned.
+	bool Parse(std::wstring const& schedule);
+
+	bool empty() const { return entries_.empty(); }
+
+	// Returns false if no entry covers the given time.
+	bool GetLimits(fz::datetime const& t, int & inbound, int & outbound) const;
+
+private:
+	struct entry final
+	{
+		int days_{0x7f}; // Bit 0 is Sunday
+		int begin_{}; // Minutes since midnight
+		int end_{};
+		int inbound_{};
+		int outbound_{};
+	};
+
+	std::vector<entry> entries_;
+};
+
+#endif
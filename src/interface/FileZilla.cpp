@@ -7,6 +7,7 @@
 #include "Options.h"
 #include "wrapengine.h"
 #include "buildinfo.h"
+#include "filehash.h"
 #include "cmdline.h"
 #include "welcome_dialog.h"
 #include "msgbox.h"
@@ -200,6 +201,13 @@ bool CFileZillaApp::OnInit()
 {
 	AddStartupProfileRecord("CFileZillaApp::OnInit()");
 
+	fz::monotonic_clock stageStart = fz::monotonic_clock::now();
+	auto const endStage = [this, &stageStart](std::string const& name) {
+		auto const now = fz::monotonic_clock::now();
+		AddStartupStage(name, now - stageStart);
+		stageStart = now;
+	};
+
 	// Turn off idle events, we don't need them
 	wxIdleEvent::SetMode(wxIDLE_PROCESS_SPECIFIED);
 
@@ -257,6 +265,8 @@ bool CFileZillaApp::OnInit()
 
 	InitLocale();
 
+	endStage("Settings and locale");
+
 #ifndef _DEBUG
 	const wxString& buildType = CBuildInfo::GetBuildType();
 	if (buildType == _T("nightly")) {
@@ -288,14 +298,23 @@ USE AT OWN RISK"), _T("Important Information"));
 	CheckExistsFzstorj();
 #endif
 
-#ifdef WITH_LIBDBUS
-	CSessionManager::Init();
-#endif
+	{
+		CLocalPath cacheDir = COptions::Get()->GetCacheDirectory();
+		if (!cacheDir.empty()) {
+			CLocalFileHasher::Get().SetCacheFile(cacheDir.GetPath() + L"filehashes");
+			cacheDir.AddSegment(L"dircache");
+			COptions::Get()->SetOption(OPTION_CACHE_PERSISTENT_DIR, cacheDir.GetPath());
+		}
+	}
+
+	endStage("Resources and theme");
 
 	// Load the text wrapping engine
 	m_pWrapEngine = std::make_unique<CWrapEngine>();
 	m_pWrapEngine->LoadCache();
 
+	endStage("Layout cache");
+
 	bool welcome_skip = false;
 #ifdef USE_MAC_SANDBOX
 	OSXSandboxUserdirs::Get().Load();
@@ -317,6 +336,8 @@ USE AT OWN RISK"), _T("Important Information"));
 	frame->Show(true);
 	SetTopWindow(frame);
 
+	endStage("Main window");
+
 	if (!welcome_skip) {
 		CWelcomeDialog::RunDelayed(frame);
 	}
@@ -324,6 +345,12 @@ USE AT OWN RISK"), _T("Important Information"));
 	frame->ProcessCommandLine();
 	frame->PostInitialize();
 
+	endStage("Command line and startup action");
+
+	// Everything not needed to display the main window and to act on the
+	// command line waits until the event loop got to run.
+	CallAfter(&CFileZillaApp::InitDeferred);
+
 	ShowStartupProfile();
 
 	return true;
@@ -334,6 +361,10 @@ int CFileZillaApp::OnExit()
 	CContextManager::Get()->NotifyGlobalHandlers(STATECHANGE_QUITNOW);
 
 	COptions::Get()->SaveIfNeeded();
+	CLocalFileHasher::Get().Save();
+	if (themeProvider_) {
+		themeProvider_->SaveAtlases();
+	}
 
 #ifdef WITH_LIBDBUS
 	CSessionManager::Uninit();
@@ -779,6 +810,27 @@ void CFileZillaApp::ShowStartupProfile()
 	m_startupProfile.clear();
 }
 
+void CFileZillaApp::InitDeferred()
+{
+	auto const start = fz::monotonic_clock::now();
+
+#ifdef WITH_LIBDBUS
+	CSessionManager::Init();
+#endif
+
+	CMainFrame* frame = dynamic_cast<CMainFrame*>(GetTopWindow());
+	if (frame && !frame->IsBeingDeleted()) {
+		frame->DeferredInitialize();
+	}
+
+	AddStartupStage("Deferred initialization", fz::monotonic_clock::now() - start);
+}
+
+void CFileZillaApp::AddStartupStage(std::string const& name, fz::duration const& duration)
+{
+	startupStages_.emplace_back(name, duration);
+}
+
 std::wstring CFileZillaApp::GetSettingsFile(std::wstring const& name) const
 {
 	return COptions::Get()->GetOption(OPTION_DEFAULT_SETTINGSDIR) + name + _T(".xml");
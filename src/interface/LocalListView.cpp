@@ -10,6 +10,7 @@
 #include "file_utils.h"
 #include "infotext.h"
 #include "inputdialog.h"
+#include "local_dir_watcher.h"
 #include <algorithm>
 #include "dndobjects.h"
 #include "Options.h"
@@ -255,6 +256,7 @@ BEGIN_EVENT_TABLE(CLocalListView, CFileListCtrl<CLocalFileData>)
 	// Map both ID_UPLOAD and ID_ADDTOQUEUE to OnMenuUpload, code is identical
 	EVT_MENU(XRCID("ID_UPLOAD"), CLocalListView::OnMenuUpload)
 	EVT_MENU(XRCID("ID_ADDTOQUEUE"), CLocalListView::OnMenuUpload)
+	EVT_MENU(XRCID("ID_UPLOAD_CHANGED"), CLocalListView::OnMenuUpload)
 	EVT_MENU(XRCID("ID_MKDIR"), CLocalListView::OnMenuMkdir)
 	EVT_MENU(XRCID("ID_MKDIR_CHGDIR"), CLocalListView::OnMenuMkdirChgDir)
 	EVT_MENU(XRCID("ID_DELETE"), CLocalListView::OnMenuDelete)
@@ -304,6 +306,8 @@ CLocalListView::CLocalListView(CView* pParent, CState& state, CQueueView *pQueue
 	m_windowTinter = std::make_unique<CWindowTinter>(*GetMainWindow());
 
 	m_pInfoText = new CInfoText(*this);
+
+	watcher_ = std::make_unique<CLocalDirWatcher>([this](std::wstring const& dir, std::vector<std::wstring> const& names) { OnDirChanged(dir, names); });
 }
 
 CLocalListView::~CLocalListView()
@@ -314,12 +318,63 @@ CLocalListView::~CLocalListView()
 #ifdef __WXMSW__
 	volumeEnumeratorThread_.reset();
 #endif
+
+	CancelListing();
+	listingTask_.join();
+}
+
+namespace {
+// Whether the path is listed through local_filesys, as opposed to the
+// drive and share lists on Windows.
+bool IsRegularDir(CLocalPath const& dir)
+{
+#ifdef __WXMSW__
+	std::wstring const& path = dir.GetPath();
+	if (path == L"\\") {
+		return false;
+	}
+	if (path.substr(0, 2) == L"\\\\") {
+		auto pos = path.find('\\', 2);
+		// UNC path without shares
+		return pos != std::wstring::npos && pos + 1 < path.size();
+	}
+#else
+	(void)dir;
+#endif
+	return true;
+}
+
+size_t const first_listing_batch = 500;
+size_t const max_listing_batch = 20000;
+auto const listing_flush_interval = fz::duration::from_milliseconds(100);
+
+size_t const max_listing_snapshots = 10;
+size_t const max_snapshot_entries = 500000;
 }
 
 bool CLocalListView::DisplayDir(CLocalPath const& dirname)
 {
 	CancelLabelEdit();
 
+	bool const wasProgressive = listingPending_ && listingProgressive_;
+	if (m_dir != dirname && !wasProgressive) {
+		StoreSnapshot();
+	}
+	CancelListing();
+
+	bool const regular = IsRegularDir(dirname);
+	if (regular) {
+		watcher_->Set({dirname.GetPath()});
+	}
+	else {
+		watcher_->Set({});
+	}
+	if (regular && m_dir == dirname && !wasProgressive && !m_fileData.empty()) {
+		// Keep showing the current contents until the refreshed listing is complete
+		StartListing(false);
+		return true;
+	}
+
 	std::wstring focused;
 	int focusedItem = -1;
 	std::vector<std::wstring> selectedNames;
@@ -368,94 +423,81 @@ bool CLocalListView::DisplayDir(CLocalPath const& dirname)
 		m_indexMapping.push_back(0);
 	}
 
+	if (!regular) {
 #ifdef __WXMSW__
-	if (m_dir.GetPath() == _T("\\")) {
-		DisplayDrives();
-	}
-	else if (m_dir.GetPath().substr(0, 2) == _T("\\\\")) {
-		auto pos = m_dir.GetPath().find('\\', 2);
-		if (pos != std::wstring::npos && pos + 1 < m_dir.GetPath().size()) {
-			goto regular_dir;
+		if (m_dir.GetPath() == _T("\\")) {
+			DisplayDrives();
+		}
+		else {
+			DisplayShares(m_dir.GetPath());
 		}
-
-		// UNC path without shares
-		DisplayShares(m_dir.GetPath());
-	}
-	else
-#endif
-	{
-#ifdef __WXMSW__
-regular_dir:
 #endif
-		CStateFilterManager const& filter = m_state.GetStateFilterManager();
-		fz::local_filesys local_filesys;
+	}
+	else {
+		SetInfoText(wxString());
 
-		auto result = local_filesys.begin_find_files(fz::to_native(m_dir.GetPath()), false);
-		if (!result) {
-			
-			if (result.error_ == fz::result::noperm) {
-				SetInfoText(_("You do not have permission to list this directory"));
-			}
-			else {
-				SetInfoText(_("Could not list directory contents"));
-			}
+		std::vector<CLocalFileData> snapshot;
+		bool const haveSnapshot = TakeSnapshot(snapshot);
+		m_totals = directory_totals();
+		if (haveSnapshot) {
+			size_t const first = m_fileData.size();
+			m_fileData.reserve(first + snapshot.size());
+			std::move(snapshot.begin(), snapshot.end(), std::back_inserter(m_fileData));
+			FilterEntries(first, m_indexMapping);
+		}
+		else if (focused != L"..") {
+			listingFocus_ = focused;
+			listingEnsureVisible_ = ensureVisible;
+		}
+		UpdateDirectoryContents();
 
-			SetItemCount(1);
-			if (m_pFilelistStatusBar) {
-				m_pFilelistStatusBar->SetDirectoryContents(0, 0, 0, 0, 0);
-			}
+		StartListing(!haveSnapshot);
+	}
 
-			return false;
-		}
+	FinishDisplay(oldItemCount, selectedNames, focused, focusedItem, ensureVisible);
 
-		SetInfoText(wxString());
+	return true;
+}
 
-		int64_t totalSize{};
-		int unknown_sizes = 0;
-		int totalFileCount = 0;
-		int totalDirCount = 0;
-		int hidden = 0;
+void CLocalListView::FilterEntries(size_t first, std::vector<unsigned int> & indexes)
+{
+	CStateFilterManager const& filter = m_state.GetStateFilterManager();
 
-		int num = m_fileData.size();
-		CLocalFileData data;
-		bool wasLink{};
-		fz::local_filesys::type t{};
-		fz::native_string name;
-		while (local_filesys.get_next_file(name, wasLink, t, &data.size, &data.time, &data.attributes)) {
-			data.name = fz::to_wstring(name);
-			data.dir = t == fz::local_filesys::dir;
-			if (name.empty() || data.name.empty()) {
-				wxGetApp().DisplayEncodingWarning();
-				continue;
-			}
+	for (size_t i = first; i < m_fileData.size(); ++i) {
+		CLocalFileData const& data = m_fileData[i];
+		if (data.comparison_flags == fill) {
+			continue;
+		}
+		if (filter.FilenameFiltered(data.name, m_dir.GetPath(), data.dir, data.size, true, data.attributes, data.time)) {
+			++m_totals.hidden;
+			continue;
+		}
 
-			m_fileData.push_back(data);
-			if (!filter.FilenameFiltered(data.name, m_dir.GetPath(), data.dir, data.size, true, data.attributes, data.time)) {
-				if (data.dir) {
-					++totalDirCount;
-				}
-				else {
-					if (data.size != -1) {
-						totalSize += data.size;
-					}
-					else {
-						++unknown_sizes;
-					}
-					++totalFileCount;
-				}
-				m_indexMapping.push_back(num);
+		if (data.dir) {
+			++m_totals.dirs;
+		}
+		else {
+			if (data.size != -1) {
+				m_totals.size += data.size;
 			}
 			else {
-				++hidden;
+				++m_totals.unknown_sizes;
 			}
-			++num;
+			++m_totals.files;
 		}
+		indexes.push_back(static_cast<unsigned int>(i));
+	}
+}
 
-		if (m_pFilelistStatusBar) {
-			m_pFilelistStatusBar->SetDirectoryContents(totalFileCount, totalDirCount, totalSize, unknown_sizes, hidden);
-		}
+void CLocalListView::UpdateDirectoryContents()
+{
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->SetDirectoryContents(m_totals.files, m_totals.dirs, m_totals.size, m_totals.unknown_sizes, m_totals.hidden);
 	}
+}
 
+void CLocalListView::FinishDisplay(int oldItemCount, std::vector<std::wstring> const& selectedNames, std::wstring const& focused, int focusedItem, bool ensureVisible)
+{
 	if (m_dropTarget != -1) {
 		CLocalFileData* data = GetData(m_dropTarget);
 		if (!data || !data->dir) {
@@ -479,8 +521,349 @@ regular_dir:
 	ReselectItems(selectedNames, focused, focusedItem, ensureVisible);
 
 	RefreshListOnly();
+}
 
-	return true;
+void CLocalListView::StartListing(bool progressive)
+{
+	listingPending_ = true;
+	listingProgressive_ = progressive;
+
+	fz::scoped_lock l(listingMutex_);
+	listingPath_ = m_dir.GetPath();
+	if (listingWorkerRunning_) {
+		// Picks up the new path once it notices the cancellation
+		return;
+	}
+
+	listingTask_.join();
+	listingWorkerRunning_ = true;
+	listingTask_ = m_state.pool_.spawn([this]() { ListingWorker(); });
+	if (!listingTask_) {
+		l.unlock();
+		ListingWorker();
+	}
+}
+
+void CLocalListView::CancelListing()
+{
+	listingPending_ = false;
+	listingProgressive_ = false;
+	listingFresh_.clear();
+	listingFocus_.clear();
+	listingEnsureVisible_ = false;
+	listingRefreshFiles_.clear();
+
+	fz::scoped_lock l(listingMutex_);
+	++listingGeneration_;
+	listingPath_.clear();
+	listingEntries_.clear();
+	listingDone_ = false;
+	listingEncodingError_ = false;
+}
+
+void CLocalListView::ListingWorker()
+{
+	fz::scoped_lock lock(listingMutex_);
+	while (!listingPath_.empty()) {
+		std::wstring const path = std::move(listingPath_);
+		listingPath_.clear();
+		uint64_t const generation = listingGeneration_;
+		lock.unlock();
+
+		std::vector<CLocalFileData> entries;
+		bool encodingError{};
+
+		// Hands the entries over, returns false if the listing got cancelled
+		auto const flush = [&](fz::result const* result) {
+			fz::scoped_lock l(listingMutex_);
+			if (generation != listingGeneration_) {
+				return false;
+			}
+			if (!listingNotified_) {
+				listingNotified_ = true;
+				CallAfter(&CLocalListView::OnListingData);
+			}
+			if (listingEntries_.empty()) {
+				listingEntries_.swap(entries);
+			}
+			else {
+				std::move(entries.begin(), entries.end(), std::back_inserter(listingEntries_));
+			}
+			entries.clear();
+			listingEncodingError_ |= encodingError;
+			encodingError = false;
+			if (result) {
+				listingResult_ = *result;
+				listingDone_ = true;
+			}
+			return true;
+		};
+
+		bool cancelled{};
+		fz::local_filesys local_filesys;
+		auto const result = local_filesys.begin_find_files(fz::to_native(path), false);
+		if (result) {
+			size_t batchSize = first_listing_batch;
+			auto lastFlush = fz::monotonic_clock::now();
+
+			CLocalFileData data;
+			bool wasLink{};
+			fz::local_filesys::type t{};
+			fz::native_string name;
+			while (local_filesys.get_next_file(name, wasLink, t, &data.size, &data.time, &data.attributes)) {
+				data.name = fz::to_wstring(name);
+				data.dir = t == fz::local_filesys::dir;
+				if (name.empty() || data.name.empty()) {
+					encodingError = true;
+					continue;
+				}
+				entries.push_back(data);
+
+				if (entries.size() >= batchSize || (!(entries.size() % 64) && fz::monotonic_clock::now() - lastFlush >= listing_flush_interval)) {
+					if (!flush(nullptr)) {
+						cancelled = true;
+						break;
+					}
+					lastFlush = fz::monotonic_clock::now();
+					batchSize = std::min(batchSize * 2, max_listing_batch);
+				}
+			}
+		}
+		if (!cancelled) {
+			flush(&result);
+		}
+
+		lock.lock();
+	}
+	listingWorkerRunning_ = false;
+}
+
+void CLocalListView::OnListingData()
+{
+	std::vector<CLocalFileData> entries;
+	fz::result result;
+	bool done{};
+	bool encodingError{};
+	{
+		fz::scoped_lock l(listingMutex_);
+		listingNotified_ = false;
+		entries.swap(listingEntries_);
+		result = listingResult_;
+		done = listingDone_;
+		listingDone_ = false;
+		encodingError = listingEncodingError_;
+		listingEncodingError_ = false;
+	}
+
+	if (!listingPending_) {
+		return;
+	}
+
+	if (encodingError) {
+		wxGetApp().DisplayEncodingWarning();
+	}
+
+	if (done && !result) {
+		CancelListing();
+		ShowListingError(result);
+		return;
+	}
+
+	if (listingProgressive_) {
+		if (!entries.empty()) {
+			AddListingEntries(std::move(entries));
+		}
+	}
+	else if (listingFresh_.empty()) {
+		listingFresh_.swap(entries);
+	}
+	else {
+		std::move(entries.begin(), entries.end(), std::back_inserter(listingFresh_));
+	}
+
+	if (!done) {
+		return;
+	}
+
+	if (!listingProgressive_) {
+		ShowListing(std::move(listingFresh_));
+	}
+
+	// Files that changed while the listing was in progress
+	auto const refreshFiles = std::move(listingRefreshFiles_);
+	CancelListing();
+	for (auto const& file : refreshFiles) {
+		RefreshFile(file);
+	}
+}
+
+void CLocalListView::AddListingEntries(std::vector<CLocalFileData> && entries)
+{
+	CancelLabelEdit();
+
+	std::wstring focused;
+	int focusedItem = -1;
+	std::vector<std::wstring> const selectedNames = RememberSelectedItems(focused, focusedItem);
+
+	bool ensureVisible{};
+	if (!listingFocus_.empty()) {
+		if (focusedItem == -1 || focused == listingFocus_) {
+			focused = listingFocus_;
+			focusedItem = -1;
+			ensureVisible = listingEnsureVisible_;
+		}
+		else {
+			// User moved on already
+			listingFocus_.clear();
+		}
+	}
+
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->UnselectAll();
+	}
+
+	if (m_dropTarget != -1) {
+		SetItemState(m_dropTarget, 0, wxLIST_STATE_DROPHILITED);
+		m_dropTarget = -1;
+	}
+
+	size_t const first = m_fileData.size();
+	m_fileData.reserve(first + entries.size());
+	for (auto & entry : entries) {
+		if (!listingFocus_.empty() && entry.name == listingFocus_) {
+			listingFocus_.clear();
+		}
+		m_fileData.push_back(std::move(entry));
+	}
+
+	// Sort the new entries on their own and merge them into the existing order
+	std::vector<unsigned int> added;
+	FilterEntries(first, added);
+	std::unique_ptr<CFileListCtrlSortBase> compare = GetSortComparisonObject();
+	std::sort(added.begin(), added.end(), SortPredicate(compare));
+
+	size_t const mid = m_indexMapping.size();
+	m_indexMapping.insert(m_indexMapping.end(), added.begin(), added.end());
+	auto start = m_indexMapping.begin();
+	if (m_hasParent) {
+		++start;
+	}
+	std::inplace_merge(start, m_indexMapping.begin() + mid, m_indexMapping.end(), SortPredicate(compare));
+
+	SetItemCount(m_indexMapping.size());
+	UpdateDirectoryContents();
+
+	ReselectItems(selectedNames, focused, focusedItem, ensureVisible);
+
+	RefreshListOnly();
+}
+
+void CLocalListView::ShowListing(std::vector<CLocalFileData> && entries)
+{
+	CancelLabelEdit();
+
+	std::wstring focused;
+	int focusedItem = -1;
+	std::vector<std::wstring> const selectedNames = RememberSelectedItems(focused, focusedItem);
+
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->UnselectAll();
+	}
+
+	const int oldItemCount = m_indexMapping.size();
+
+	size_t const min = m_hasParent ? 1 : 0;
+	m_fileData.erase(m_fileData.begin() + std::min(min, m_fileData.size()), m_fileData.end());
+	m_indexMapping.clear();
+	if (m_hasParent) {
+		m_indexMapping.push_back(0);
+	}
+
+	SetInfoText(wxString());
+
+	std::move(entries.begin(), entries.end(), std::back_inserter(m_fileData));
+	m_totals = directory_totals();
+	FilterEntries(min, m_indexMapping);
+	UpdateDirectoryContents();
+
+	FinishDisplay(oldItemCount, selectedNames, focused, focusedItem, false);
+}
+
+void CLocalListView::ShowListingError(fz::result const& result)
+{
+	if (IsComparing()) {
+		ExitComparisonMode();
+	}
+	ClearSelection();
+
+	if (result.error_ == fz::result::noperm) {
+		SetInfoText(_("You do not have permission to list this directory"));
+	}
+	else {
+		SetInfoText(_("Could not list directory contents"));
+	}
+
+	if (m_fileData.size() > (m_hasParent ? 1 : 0)) {
+		m_fileData.resize(m_hasParent ? 1 : 0);
+	}
+	m_indexMapping.clear();
+	if (m_hasParent) {
+		m_indexMapping.push_back(0);
+	}
+
+	SetItemCount(1);
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->SetDirectoryContents(0, 0, 0, 0, 0);
+	}
+	RefreshListOnly();
+}
+
+void CLocalListView::StoreSnapshot()
+{
+	if (m_dir.empty() || !IsRegularDir(m_dir)) {
+		return;
+	}
+
+	listing_snapshot snapshot;
+	snapshot.path = m_dir;
+	for (size_t i = m_hasParent ? 1 : 0; i < m_fileData.size(); ++i) {
+		if (m_fileData[i].comparison_flags != fill) {
+			snapshot.entries.push_back(m_fileData[i]);
+			snapshot.entries.back().comparison_flags = normal;
+		}
+	}
+	if (snapshot.entries.size() > max_snapshot_entries) {
+		return;
+	}
+
+	for (auto it = snapshots_.begin(); it != snapshots_.end(); ++it) {
+		if (it->path == m_dir) {
+			snapshotEntries_ -= it->entries.size();
+			snapshots_.erase(it);
+			break;
+		}
+	}
+	while (!snapshots_.empty() && (snapshots_.size() >= max_listing_snapshots || snapshotEntries_ + snapshot.entries.size() > max_snapshot_entries)) {
+		snapshotEntries_ -= snapshots_.back().entries.size();
+		snapshots_.pop_back();
+	}
+
+	snapshotEntries_ += snapshot.entries.size();
+	snapshots_.push_front(std::move(snapshot));
+}
+
+bool CLocalListView::TakeSnapshot(std::vector<CLocalFileData> & entries)
+{
+	for (auto it = snapshots_.begin(); it != snapshots_.end(); ++it) {
+		if (it->path == m_dir) {
+			// Stored again with the current contents once leaving the directory
+			snapshotEntries_ -= it->entries.size();
+			entries = std::move(it->entries);
+			snapshots_.erase(it);
+			return true;
+		}
+	}
+	return false;
 }
 
 // See comment to OnGetItemText
@@ -507,7 +890,13 @@ int CLocalListView::OnGetItemImage(long item) const
 			}
 		}
 
-		icon = pThis->GetIconIndex(data->dir ? iconType::dir : iconType::file, path);
+		bool provisional{};
+		int const index = pThis->GetIconIndex(data->dir ? iconType::dir : iconType::file, path, true, false, &provisional);
+		if (provisional) {
+			// Asked again once the actual icon is known
+			return index;
+		}
+		icon = index;
 	}
 	return icon;
 }
@@ -813,6 +1202,7 @@ void CLocalListView::OnContextMenu(wxContextMenuEvent& event)
 	item = new wxMenuItem(&menu, XRCID("ID_ADDTOQUEUE"), _("&Add files to queue"), _("Add selected files and folders to the transfer queue"));
 	item->SetBitmap(wxArtProvider::GetBitmap(_T("ART_UPLOADADD"), wxART_MENU));
 	menu.Append(item);
+	menu.Append(XRCID("ID_UPLOAD_CHANGED"), _("Upload c&hanged files"), _("Upload selected files and directories, skipping files the server already has with the same size and modification time"));
 	menu.Append(XRCID("ID_ENTER"), _("E&nter directory"), _("Enter selected directory"));
 	
 	menu.AppendSeparator();
@@ -832,6 +1222,7 @@ void CLocalListView::OnContextMenu(wxContextMenuEvent& event)
 	if (!connected) {
 		menu.Enable(XRCID("ID_EDIT"), COptions::Get()->GetOptionVal(OPTION_EDIT_TRACK_LOCAL) == 0);
 		menu.Enable(XRCID("ID_UPLOAD"), false);
+		menu.Enable(XRCID("ID_UPLOAD_CHANGED"), false);
 		menu.Enable(XRCID("ID_ADDTOQUEUE"), false);
 	}
 
@@ -858,6 +1249,7 @@ void CLocalListView::OnContextMenu(wxContextMenuEvent& event)
 	if (!count || fillCount == count) {
 		menu.Delete(XRCID("ID_ENTER"));
 		menu.Enable(XRCID("ID_UPLOAD"), false);
+		menu.Enable(XRCID("ID_UPLOAD_CHANGED"), false);
 		menu.Enable(XRCID("ID_ADDTOQUEUE"), false);
 		menu.Enable(XRCID("ID_DELETE"), false);
 		menu.Enable(XRCID("ID_RENAME"), false);
@@ -877,6 +1269,7 @@ void CLocalListView::OnContextMenu(wxContextMenuEvent& event)
 		menu.Enable(XRCID("ID_EDIT"), false);
 		if (m_state.GetLocalRecursiveOperation() && m_state.GetLocalRecursiveOperation()->IsActive()) {
 			menu.Enable(XRCID("ID_UPLOAD"), false);
+			menu.Enable(XRCID("ID_UPLOAD_CHANGED"), false);
 			menu.Enable(XRCID("ID_ADDTOQUEUE"), false);
 		}
 	}
@@ -896,6 +1289,10 @@ void CLocalListView::OnMenuUpload(wxCommandEvent& event)
 
 	bool queue_only = event.GetId() == XRCID("ID_ADDTOQUEUE");
 
+	// Only the remote listings already in the cache are looked at
+	bool const changed_only = event.GetId() == XRCID("ID_UPLOAD_CHANGED");
+	CLocalRecursiveOperation::listing files;
+
 	auto recursiveOperation = m_state.GetLocalRecursiveOperation();
 	if (!recursiveOperation || recursiveOperation->IsActive()) {
 		wxBell();
@@ -940,12 +1337,27 @@ void CLocalListView::OnMenuUpload(wxCommandEvent& event)
 
 			root.add_dir_to_visit(localPath, remotePath);
 		}
+		else if (changed_only) {
+			auto & file = files.files.emplace_back();
+			file.name = data->name;
+			file.size = data->size;
+			file.time = data->time;
+			files.remotePath = remotePath;
+		}
 		else {
 			m_pQueue->QueueFile(queue_only, false, data->name, wxEmptyString, m_dir, remotePath, site, data->size);
 			added = true;
 		}
 	}
 
+	if (!files.files.empty()) {
+		files.localPath = m_dir;
+		CDirectoryListing remoteListing;
+		bool const cached = m_state.m_pEngine && m_state.m_pEngine->CacheLookup(files.remotePath, remoteListing) == FZ_REPLY_OK;
+		m_pQueue->QueueFiles(queue_only, site, files, cached ? &remoteListing : nullptr);
+		added = true;
+	}
+
 	if (added) {
 		m_pQueue->QueueFile_Finish(!queue_only);
 	}
@@ -953,7 +1365,8 @@ void CLocalListView::OnMenuUpload(wxCommandEvent& event)
 	if (!root.empty()) {
 		recursiveOperation->AddRecursionRoot(std::move(root));
 		CFilterManager filter;
-		recursiveOperation->StartRecursiveOperation(CRecursiveOperation::recursive_transfer, filter.GetActiveFilters(), !queue_only);
+		auto const mode = changed_only ? CRecursiveOperation::recursive_synchronize_upload : CRecursiveOperation::recursive_transfer;
+		recursiveOperation->StartRecursiveOperation(mode, filter.GetActiveFilters(), !queue_only);
 	}
 }
 
@@ -1173,6 +1586,7 @@ bool CLocalListView::OnAcceptRename(const wxListEvent& event)
 	}
 
 	data->name = newname;
+	data->sortKeyMode = -1;
 #ifdef __WXMSW__
 	data->label.clear();
 #endif
@@ -1202,46 +1616,15 @@ void CLocalListView::ApplyCurrentFilter()
 		m_pFilelistStatusBar->UnselectAll();
 	}
 
-	int64_t totalSize{};
-	int unknown_sizes = 0;
-	int totalFileCount = 0;
-	int totalDirCount = 0;
-	int hidden = 0;
-
 	m_indexMapping.clear();
 	if (m_hasParent) {
 		m_indexMapping.push_back(0);
 	}
-	for (unsigned int i = min; i < m_fileData.size(); ++i) {
-		const CLocalFileData& data = m_fileData[i];
-		if (data.comparison_flags == fill) {
-			continue;
-		}
-		if (filter.FilenameFiltered(data.name, m_dir.GetPath(), data.dir, data.size, true, data.attributes, data.time)) {
-			++hidden;
-			continue;
-		}
-
-		if (data.dir) {
-			++totalDirCount;
-		}
-		else {
-			if (data.size != -1) {
-				totalSize += data.size;
-			}
-			else {
-				++unknown_sizes;
-			}
-			++totalFileCount;
-		}
-
-		m_indexMapping.push_back(i);
-	}
+	m_totals = directory_totals();
+	FilterEntries(min, m_indexMapping);
 	SetItemCount(m_indexMapping.size());
 
-	if (m_pFilelistStatusBar) {
-		m_pFilelistStatusBar->SetDirectoryContents(totalFileCount, totalDirCount, totalSize, unknown_sizes, hidden);
-	}
+	UpdateDirectoryContents();
 
 	SortList(-1, -1, false);
 
@@ -1512,11 +1895,20 @@ void CLocalListView::OnBeginDrag(wxListEvent&)
 
 void CLocalListView::RefreshFile(std::wstring const& file)
 {
+	if (listingPending_) {
+		// The listing might already be past the file, refresh it again once done
+		listingRefreshFiles_.insert(file);
+		if (listingProgressive_) {
+			return;
+		}
+	}
+
 	CLocalFileData data;
 
 	bool wasLink;
 	fz::local_filesys::type type = fz::local_filesys::get_file_info(fz::to_native(m_dir.GetPath() + file), wasLink, &data.size, &data.time, &data.attributes);
 	if (type == fz::local_filesys::unknown) {
+		RemoveFile(file);
 		return;
 	}
 
@@ -1659,6 +2051,94 @@ void CLocalListView::RefreshFile(std::wstring const& file)
 	}
 }
 
+void CLocalListView::RemoveFile(std::wstring const& file)
+{
+	unsigned int index = m_hasParent ? 1 : 0;
+	for (; index < m_fileData.size(); ++index) {
+		if (m_fileData[index].name == file && m_fileData[index].comparison_flags != fill) {
+			break;
+		}
+	}
+	if (index >= m_fileData.size()) {
+		return;
+	}
+
+	if (IsComparing()) {
+		// Easier to refresh than to fix the comparison
+		DisplayDir(m_dir);
+		return;
+	}
+
+	CancelLabelEdit();
+
+	CLocalFileData const& data = m_fileData[index];
+
+	auto const pos = std::find(m_indexMapping.begin(), m_indexMapping.end(), index);
+	if (pos != m_indexMapping.end()) {
+		unsigned int const item = pos - m_indexMapping.begin();
+
+		if (m_pFilelistStatusBar) {
+			if (GetItemState(item, wxLIST_STATE_SELECTED) & wxLIST_STATE_SELECTED) {
+				if (data.dir) {
+					m_pFilelistStatusBar->UnselectDirectory();
+				}
+				else {
+					m_pFilelistStatusBar->UnselectFile(data.size);
+				}
+			}
+			if (data.dir) {
+				m_pFilelistStatusBar->RemoveDirectory();
+			}
+			else {
+				m_pFilelistStatusBar->RemoveFile(data.size);
+			}
+		}
+
+		if (m_dropTarget >= static_cast<int>(item)) {
+			SetItemState(m_dropTarget, 0, wxLIST_STATE_DROPHILITED);
+			m_dropTarget = -1;
+		}
+
+		// Move selections
+		for (unsigned int j = item; j + 1 < m_indexMapping.size(); ++j) {
+			int const state = GetItemState(j + 1, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED);
+			if (state != GetItemState(j, wxLIST_STATE_SELECTED | wxLIST_STATE_FOCUSED)) {
+				SetItemState(j, state, wxLIST_STATE_FOCUSED);
+				SetSelection(j, (state & wxLIST_STATE_SELECTED) != 0);
+			}
+		}
+		SetSelection(m_indexMapping.size() - 1, false);
+
+		m_indexMapping.erase(pos);
+	}
+
+	m_fileData.erase(m_fileData.begin() + index);
+	for (auto & mapped : m_indexMapping) {
+		if (mapped > index) {
+			--mapped;
+		}
+	}
+
+	SetItemCount(m_indexMapping.size());
+	RefreshListOnly();
+}
+
+void CLocalListView::OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names)
+{
+	if (dir != m_dir.GetPath()) {
+		return;
+	}
+
+	if (names.empty()) {
+		DisplayDir(m_dir);
+		return;
+	}
+
+	for (auto const& name : names) {
+		RefreshFile(name);
+	}
+}
+
 wxListItemAttr* CLocalListView::OnGetItemAttr(long item) const
 {
 	CLocalListView *pThis = const_cast<CLocalListView *>(this);
@@ -1703,8 +2183,6 @@ void CLocalListView::StartComparison()
 		m_indexMapping.clear();
 	}
 
-	m_comparisonIndex = -1;
-
 	if (m_fileData.empty() || m_fileData.back().comparison_flags != fill) {
 		CLocalFileData data;
 		data.dir = false;
@@ -1715,25 +2193,28 @@ void CLocalListView::StartComparison()
 	}
 }
 
-bool CLocalListView::get_next_file(std::wstring_view & name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date)
+void CLocalListView::GetComparisonEntries(std::vector<entry> & entries)
 {
-	if (++m_comparisonIndex >= (int)m_originalIndexMapping.size()) {
-		return false;
-	}
-
-	const unsigned int index = m_originalIndexMapping[m_comparisonIndex];
-	if (index >= m_fileData.size()) {
-		return false;
+	if (m_originalIndexMapping.empty() && (m_sortDirection || m_sortColumn != 0)) {
+		SortList(0, 0);
 	}
 
-	CLocalFileData const& data = m_fileData[index];
+	auto const& mapping = m_originalIndexMapping.empty() ? m_indexMapping : m_originalIndexMapping;
+	entries.reserve(entries.size() + mapping.size());
+	for (auto const index : mapping) {
+		if (index >= m_fileData.size()) {
+			break;
+		}
 
-	name = data.name;
-	dir = data.dir;
-	size = data.size;
-	date = data.time;
+		CLocalFileData const& data = m_fileData[index];
 
-	return true;
+		auto & e = entries.emplace_back();
+		e.name = data.name;
+		e.dir = data.dir;
+		e.size = data.size;
+		e.date = data.time;
+		e.index = index;
+	}
 }
 
 void CLocalListView::FinishComparison()
@@ -1754,7 +2235,8 @@ void CLocalListView::FinishComparison()
 
 bool CLocalListView::CanStartComparison()
 {
-	return true;
+	// Not before all entries are known
+	return !listingProgressive_;
 }
 
 wxString CLocalListView::GetItemText(int item, unsigned int column)
@@ -1776,7 +2258,7 @@ wxString CLocalListView::GetItemText(int item, unsigned int column)
 			return wxString();
 		}
 		else {
-			return CSizeFormat::Format(data->size);
+			return GetCellText(*data).sizeText;
 		}
 	}
 	else if (column == 2) {
@@ -1795,11 +2277,22 @@ wxString CLocalListView::GetItemText(int item, unsigned int column)
 		return data->fileType;
 	}
 	else if (column == 3) {
-		return CTimeFormat::Format(data->time);
+		return GetCellText(*data).timeText;
 	}
 	return wxString();
 }
 
+CLocalFileData const& CLocalListView::GetCellText(CLocalFileData & data)
+{
+	unsigned int const generation = GetListFormatGeneration();
+	if (data.textGeneration != generation) {
+		data.sizeText = (data.size < 0) ? std::wstring() : CSizeFormat::Format(data.size);
+		data.timeText = CTimeFormat::Format(data.time).ToStdWstring();
+		data.textGeneration = generation;
+	}
+	return data;
+}
+
 void CLocalListView::OnMenuEdit(wxCommandEvent&)
 {
 	Site site;
@@ -4,7 +4,14 @@
 #include "filelistctrl.h"
 #include "state.h"
 
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <list>
+#include <set>
+
 class CInfoText;
+class CLocalDirWatcher;
 class CQueueView;
 class CLocalListViewDropTarget;
 #ifdef __WXMSW__
@@ -41,6 +48,26 @@ protected:
 	bool DisplayDir(CLocalPath const& dirname);
 	void ApplyCurrentFilter();
 
+	// Appends the indexes of the entries in m_fileData starting at first
+	// which pass the filters and adds them to m_totals.
+	void FilterEntries(size_t first, std::vector<unsigned int> & indexes);
+	void UpdateDirectoryContents();
+	void FinishDisplay(int oldItemCount, std::vector<std::wstring> const& selectedNames, std::wstring const& focused, int focusedItem, bool ensureVisible);
+
+	// Directories are listed on a worker. Without a snapshot of the
+	// directory, entries get shown as they arrive. Otherwise the
+	// previous contents stay visible until the new listing is complete.
+	void StartListing(bool progressive);
+	void CancelListing();
+	void ListingWorker();
+	void OnListingData();
+	void AddListingEntries(std::vector<CLocalFileData> && entries);
+	void ShowListing(std::vector<CLocalFileData> && entries);
+	void ShowListingError(fz::result const& result);
+
+	void StoreSnapshot();
+	bool TakeSnapshot(std::vector<CLocalFileData> & entries);
+
 	// Declared const due to design error in wxWidgets.
 	// Won't be fixed since a fix would break backwards compatibility
 	// Both functions use a const_cast<CLocalListView *>(this) and modify
@@ -64,7 +91,7 @@ protected:
 public:
 	virtual bool CanStartComparison();
 	virtual void StartComparison();
-	virtual bool get_next_file(std::wstring_view & name, std::wstring & path, bool &dir, int64_t &size, fz::datetime& date) override;
+	virtual void GetComparisonEntries(std::vector<entry> & entries) override;
 	virtual void FinishComparison();
 
 	virtual bool ItemIsDir(int index) const;
@@ -73,12 +100,20 @@ public:
 protected:
 	virtual wxString GetItemText(int item, unsigned int column);
 
+	// Fills the formatted size and time of the entry if needed
+	CLocalFileData const& GetCellText(CLocalFileData & data);
+
 	bool IsItemValid(unsigned int item) const;
 	CLocalFileData *GetData(unsigned int item);
 
 	virtual std::unique_ptr<CFileListCtrlSortBase> GetSortComparisonObject() override;
 
 	void RefreshFile(std::wstring const& file);
+	void RemoveFile(std::wstring const& file);
+
+	// Changes reported for the displayed directory are applied entry by entry
+	void OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names);
+	std::unique_ptr<CLocalDirWatcher> watcher_;
 
 	virtual void OnNavigationEvent(bool forward);
 
@@ -89,6 +124,44 @@ protected:
 
 	int m_dropTarget{-1};
 
+	struct directory_totals final
+	{
+		int64_t size{};
+		int unknown_sizes{};
+		int files{};
+		int dirs{};
+		int hidden{};
+	};
+	directory_totals m_totals;
+
+	// Guarded by listingMutex_
+	fz::mutex listingMutex_{false};
+	fz::async_task listingTask_;
+	bool listingWorkerRunning_{};
+	uint64_t listingGeneration_{};
+	std::wstring listingPath_; // Next directory to list, empty if none
+	std::vector<CLocalFileData> listingEntries_;
+	fz::result listingResult_;
+	bool listingDone_{};
+	bool listingEncodingError_{};
+	bool listingNotified_{};
+
+	// Listing of m_dir in progress
+	bool listingPending_{};
+	bool listingProgressive_{};
+	std::vector<CLocalFileData> listingFresh_;
+	std::wstring listingFocus_;
+	bool listingEnsureVisible_{};
+	std::set<std::wstring> listingRefreshFiles_;
+
+	struct listing_snapshot final
+	{
+		CLocalPath path;
+		std::vector<CLocalFileData> entries;
+	};
+	std::list<listing_snapshot> snapshots_; // Most recently used first
+	size_t snapshotEntries_{};
+
 	wxString MenuMkdir();
 
 	std::unique_ptr<CWindowTinter> m_windowTinter;
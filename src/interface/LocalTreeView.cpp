@@ -8,6 +8,8 @@
 #include "file_utils.h"
 #include "graphics.h"
 #include "inputdialog.h"
+#include "local_dir_enumerator.h"
+#include "local_dir_watcher.h"
 #include "LocalTreeView.h"
 #include "Options.h"
 #include "queue.h"
@@ -227,6 +229,7 @@ protected:
 
 BEGIN_EVENT_TABLE(CLocalTreeView, wxTreeCtrlEx)
 EVT_TREE_ITEM_EXPANDING(wxID_ANY, CLocalTreeView::OnItemExpanding)
+EVT_TREE_DELETE_ITEM(wxID_ANY, CLocalTreeView::OnItemDeleted)
 #ifdef __WXMSW__
 EVT_TREE_SEL_CHANGING(wxID_ANY, CLocalTreeView::OnSelectionChanging)
 #endif
@@ -269,6 +272,8 @@ CLocalTreeView::CLocalTreeView(wxWindow* parent, wxWindowID id, CState& state, C
 	UpdateSortMode();
 	RegisterOption(OPTION_FILELIST_NAMESORT);
 
+	watcher_ = std::make_unique<CLocalDirWatcher>([this](std::wstring const& dir, std::vector<std::wstring> const& names) { OnDirChanged(dir, names); });
+
 #ifdef __WXMSW__
 	m_pVolumeEnumeratorThread = 0;
 
@@ -300,12 +305,24 @@ CLocalTreeView::~CLocalTreeView()
 #ifdef __WXMSW__
 	delete m_pVolumeEnumeratorThread;
 #endif
+
+	{
+		fz::scoped_lock l(probeMutex_);
+		probePending_.clear();
+		probeQueue_.clear();
+	}
+	probeTask_.join();
+
+	// The deletion events refer to the probe bookkeeping, send them while it still exists
+	DeleteAllItems();
 }
 
 void CLocalTreeView::SetDir(wxString const& localDir)
 {
 	if (m_currentDir == localDir) {
-		RefreshListing();
+		if (!AllWatched()) {
+			RefreshListing();
+		}
 		return;
 	}
 
@@ -457,9 +474,11 @@ bool CLocalTreeView::DisplayDrives(wxTreeItemId parent)
 
 void CLocalTreeView::DisplayDir(wxTreeItemId parent, std::wstring const& dirname, std::wstring const& knownSubdir)
 {
-	fz::local_filesys local_filesys;
+	WatchItem(parent, dirname);
+
+	CLocalDirEnumerator enumerator;
 
-	if (!local_filesys.begin_find_files(fz::to_native(dirname), true)) {
+	if (!enumerator.begin(fz::to_native(dirname), true)) {
 		if (!knownSubdir.empty()) {
 			wxTreeItemId item = GetSubdir(parent, knownSubdir);
 			if (item != wxTreeItemId()) {
@@ -490,6 +509,7 @@ void CLocalTreeView::DisplayDir(wxTreeItemId parent, std::wstring const& dirname
 	--m_setSelection;
 
 	CFilterManager filter;
+	bool const needDetails = filter.LocalFiltersNeedDetails(true);
 
 	bool matchedKnown = false;
 
@@ -501,7 +521,7 @@ void CLocalTreeView::DisplayDir(wxTreeItemId parent, std::wstring const& dirname
 	fz::datetime date;
 
 	wxTreeItemId last;
-	while (local_filesys.get_next_file(file, wasLink, t, 0, &date, &attributes)) {
+	while (enumerator.next(file, wasLink, t)) {
 		std::wstring wfile = fz::to_wstring(file);
 		if (file.empty() || wfile.empty()) {
 			wxGetApp().DisplayEncodingWarning();
@@ -515,6 +535,9 @@ void CLocalTreeView::DisplayDir(wxTreeItemId parent, std::wstring const& dirname
 		if (wfile != knownSubdir)
 #endif
 		{
+			if (needDetails) {
+				enumerator.details(nullptr, &date, &attributes);
+			}
 			if (filter.FilenameFiltered(wfile, dirname, true, size, true, attributes, date)) {
 				continue;
 			}
@@ -550,41 +573,6 @@ void CLocalTreeView::DisplayDir(wxTreeItemId parent, std::wstring const& dirname
 	SortChildren(parent);
 }
 
-std::wstring CLocalTreeView::HasSubdir(std::wstring const& dirname)
-{
-	wxLogNull nullLog;
-
-	CFilterManager filter;
-
-	fz::local_filesys local_filesys;
-	if (!local_filesys.begin_find_files(fz::to_native(dirname), true)) {
-		return std::wstring();
-	}
-
-	fz::native_string file;
-	bool wasLink{};
-	int attributes{};
-	fz::local_filesys::type t{};
-	static int64_t const size(-1);
-	fz::datetime date;
-	while (local_filesys.get_next_file(file, wasLink, t, 0, &date, &attributes)) {
-
-		std::wstring wfile = fz::to_wstring(file);
-		if (file.empty() || wfile.empty()) {
-			wxGetApp().DisplayEncodingWarning();
-			continue;
-		}
-
-		if (filter.FilenameFiltered(wfile, dirname, true, size, true, attributes, date)) {
-			continue;
-		}
-
-		return wfile;
-	}
-
-	return std::wstring();
-}
-
 wxTreeItemId CLocalTreeView::MakeSubdirs(wxTreeItemId parent, std::wstring dirname, wxString subDir)
 {
 	std::wstring segment;
@@ -760,14 +748,18 @@ void CLocalTreeView::RefreshListing()
 #endif
 
 	CFilterManager filter;
+	bool const needDetails = filter.LocalFiltersNeedDetails(true);
+
+	// Directories may have changed since they got probed
+	probeCache_.clear();
 
 	while (!dirsToCheck.empty()) {
 		t_dir dir = dirsToCheck.front();
 		dirsToCheck.pop_front();
 
 		// Step 1: Check if directory exists
-		fz::local_filesys local_filesys;
-		if (!local_filesys.begin_find_files(fz::to_native(dir.dir), true)) {
+		CLocalDirEnumerator enumerator;
+		if (!enumerator.begin(fz::to_native(dir.dir), true)) {
 			// Dir does exist (listed in parent) but may not be accessible.
 			// Recurse into children anyhow, they might be accessible again.
 			wxTreeItemIdValue value;
@@ -789,13 +781,16 @@ void CLocalTreeView::RefreshListing()
 		fz::local_filesys::type t{};
 		int attributes{};
 		fz::datetime date;
-		while (local_filesys.get_next_file(file, was_link, t, 0, &date, &attributes)) {
+		while (enumerator.next(file, was_link, t)) {
 			std::wstring wfile = fz::to_wstring(file);
 			if (file.empty() || wfile.empty()) {
 				wxGetApp().DisplayEncodingWarning();
 				continue;
 			}
 
+			if (needDetails) {
+				enumerator.details(nullptr, &date, &attributes);
+			}
 			if (filter.FilenameFiltered(wfile, dir.dir, true, size, true, attributes, date)) {
 				continue;
 			}
@@ -926,6 +921,7 @@ void CLocalTreeView::OnStateChange(t_statechange_notifications notification, std
 	}
 	else {
 		wxASSERT(notification == STATECHANGE_APPLYFILTER);
+		CancelProbes();
 		RefreshListing();
 	}
 }
@@ -1465,14 +1461,14 @@ bool CLocalTreeView::CheckSubdirStatus(wxTreeItemId& item, std::wstring const& p
 	wxTreeItemIdValue value;
 	wxTreeItemId child = GetFirstChild(item, value);
 
-	static int64_t const size(-1);
-
 #ifdef __WXMAC__
 	// By default, OS X has a list of servers mounted into /net,
 	// listing that directory is slow.
 	if (GetItemParent(item) == GetRootItem() && (path == L"/net" || path == L"/net/")) {
 		CFilterManager filter;
 
+		static int64_t const size(-1);
+
 		const int attributes = S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
 		if (!filter.FilenameFiltered(L"localhost", path, true, size, true, attributes, fz::datetime())) {
 			if (!child) {
@@ -1483,44 +1479,356 @@ bool CLocalTreeView::CheckSubdirStatus(wxTreeItemId& item, std::wstring const& p
 	}
 #endif
 
-	if (child) {
-		if (!GetItemText(child).empty()) {
-			return false;
-		}
+	if (child && !GetItemText(child).empty()) {
+		return false;
+	}
+
+	std::wstring dir = path;
+	if (dir.empty() || dir.back() != fz::local_filesys::path_separator) {
+		dir += fz::local_filesys::path_separator;
+	}
 
+	auto const cached = probeCache_.find(dir);
+	if (cached != probeCache_.end()) {
+		ApplyProbeResult(item, cached->second);
+		return true;
+	}
+
+	std::wstring known;
+	if (child) {
 		CTreeItemData* pData = (CTreeItemData*)GetItemData(child);
 		if (pData) {
-			bool wasLink;
-			int attributes;
-			fz::local_filesys::type type;
-			fz::datetime date;
-			if (!path.empty() && path.back() == fz::local_filesys::path_separator) {
-				type = fz::local_filesys::get_file_info(fz::to_native(path + pData->m_known_subdir), wasLink, 0, &date, &attributes);
-			}
-			else {
-				type = fz::local_filesys::get_file_info(fz::to_native(path + fz::local_filesys::path_separator + pData->m_known_subdir), wasLink, 0, &date, &attributes);
+			known = pData->m_known_subdir;
+		}
+	}
+	ProbeSubdirs(item, dir, known);
+
+	return true;
+}
+
+namespace {
+size_t const max_probe_cache_size = 10000;
+
+// Returns the first visible subdirectory of dir, preferring known if it
+// still exists. The path has to end with a separator.
+template<typename Cancelled>
+std::wstring FindSubdir(std::wstring const& dir, std::wstring const& known, CCompiledFilters const* filters, Cancelled const& cancelled)
+{
+	static int64_t const size(-1);
+
+	bool wasLink{};
+	int attributes{};
+	fz::datetime date;
+
+	if (!known.empty()) {
+		if (fz::local_filesys::get_file_info(fz::to_native(dir + known), wasLink, 0, &date, &attributes) == fz::local_filesys::dir) {
+			if (!filters || !filters->FilenameFiltered(known, dir, true, size, attributes, date)) {
+				return known;
 			}
-			if (type == fz::local_filesys::dir) {
-				CFilterManager filter;
-				if (!filter.FilenameFiltered(pData->m_known_subdir, path, true, size, true, attributes, date)) {
-					return true;
-				}
+		}
+	}
+
+	CLocalDirEnumerator enumerator;
+	if (!enumerator.begin(fz::to_native(dir), true)) {
+		return std::wstring();
+	}
+
+	// Probing mostly only needs the names
+	bool const needDetails = filters && filters->NeedsDetails(true);
+
+	fz::native_string file;
+	fz::local_filesys::type t{};
+	while (!cancelled() && enumerator.next(file, wasLink, t)) {
+		std::wstring wfile = fz::to_wstring(file);
+		if (file.empty() || wfile.empty()) {
+			// The encoding warning is left to DisplayDir once the directory gets expanded
+			continue;
+		}
+
+		if (needDetails) {
+			enumerator.details(nullptr, &date, &attributes);
+		}
+		if (filters && filters->FilenameFiltered(wfile, dir, true, size, attributes, date)) {
+			continue;
+		}
+
+		return wfile;
+	}
+
+	return std::wstring();
+}
+}
+
+void CLocalTreeView::ProbeSubdirs(wxTreeItemId const& item, std::wstring const& path, std::wstring const& known)
+{
+	if (!probeItemPaths_.emplace(item.GetID(), path).second) {
+		return;
+	}
+	auto & items = probeItems_[path];
+	items.push_back(item);
+	if (items.size() > 1) {
+		// Already being probed for another item
+		return;
+	}
+
+	fz::scoped_lock l(probeMutex_);
+	if (!probeFilters_) {
+		probeFilters_ = std::make_shared<CCompiledFilters const>(CFilterManager::GetCompiledLocalFilters());
+	}
+	probePending_[path] = probe_job{known, probeGeneration_};
+	probeQueue_.push_back(path);
+	if (probeWorkerRunning_) {
+		return;
+	}
+
+	probeTask_.join();
+	probeWorkerRunning_ = true;
+	probeTask_ = m_state.pool_.spawn([this]() { ProbeWorker(); });
+	if (!probeTask_) {
+		l.unlock();
+		ProbeWorker();
+	}
+}
+
+void CLocalTreeView::ProbeWorker()
+{
+	fz::scoped_lock lock(probeMutex_);
+	while (!probeQueue_.empty()) {
+		std::wstring path = std::move(probeQueue_.front());
+		probeQueue_.pop_front();
+
+		auto it = probePending_.find(path);
+		if (it == probePending_.end()) {
+			// Item got deleted meanwhile
+			continue;
+		}
+		std::wstring const known = it->second.known;
+		uint64_t const generation = it->second.generation;
+		auto const filters = probeFilters_;
+		lock.unlock();
+
+		auto const cancelled = [&]() {
+			fz::scoped_lock l(probeMutex_);
+			auto const job = probePending_.find(path);
+			return job == probePending_.end() || job->second.generation != generation;
+		};
+		std::wstring sub = FindSubdir(path, known, filters.get(), cancelled);
+
+		lock.lock();
+		it = probePending_.find(path);
+		if (it == probePending_.end() || it->second.generation != generation) {
+			continue;
+		}
+		probePending_.erase(it);
+
+		if (probeResults_.empty()) {
+			CallAfter(&CLocalTreeView::OnProbeResults);
+		}
+		probeResults_.emplace_back(std::move(path), std::move(sub));
+	}
+	probeWorkerRunning_ = false;
+}
+
+void CLocalTreeView::OnProbeResults()
+{
+	std::vector<std::pair<std::wstring, std::wstring>> results;
+	{
+		fz::scoped_lock l(probeMutex_);
+		results.swap(probeResults_);
+	}
+
+	if (probeCache_.size() + results.size() > max_probe_cache_size) {
+		probeCache_.clear();
+	}
+
+	for (auto & result : results) {
+		auto it = probeItems_.find(result.first);
+		if (it != probeItems_.end()) {
+			auto const items = std::move(it->second);
+			probeItems_.erase(it);
+			for (auto const& item : items) {
+				probeItemPaths_.erase(item.GetID());
+				ApplyProbeResult(item, result.second);
 			}
 		}
+		probeCache_[result.first] = std::move(result.second);
+	}
+}
+
+void CLocalTreeView::ApplyProbeResult(wxTreeItemId const& item, std::wstring const& sub)
+{
+	wxTreeItemIdValue value;
+	wxTreeItemId child = GetFirstChild(item, value);
+	if (child && !GetItemText(child).empty()) {
+		// Got expanded meanwhile
+		return;
 	}
 
-	std::wstring sub = HasSubdir(path);
 	if (!sub.empty()) {
-		wxTreeItemId subItem = AppendItem(item, L"");
-		SetItemData(subItem, new CTreeItemData(sub));
+		if (!child) {
+			child = AppendItem(item, L"");
+		}
+		delete GetItemData(child);
+		SetItemData(child, new CTreeItemData(sub));
 	}
 	else if (child) {
 		Delete(child);
 	}
+}
+
+void CLocalTreeView::CancelProbes()
+{
+	probeItems_.clear();
+	probeItemPaths_.clear();
+	probeCache_.clear();
+
+	fz::scoped_lock l(probeMutex_);
+	++probeGeneration_;
+	probeQueue_.clear();
+	probePending_.clear();
+	probeResults_.clear();
+	probeFilters_.reset();
+}
+
+void CLocalTreeView::OnItemDeleted(wxTreeEvent& event)
+{
+	event.Skip();
+
+	if (watchedItems_.erase(event.GetItem().GetID()) && !watchedDirsChanged_) {
+		watchedDirsChanged_ = true;
+		CallAfter(&CLocalTreeView::UpdateWatchedDirs);
+	}
 
+	auto it = probeItemPaths_.find(event.GetItem().GetID());
+	if (it == probeItemPaths_.end()) {
+		return;
+	}
+
+	std::wstring const path = std::move(it->second);
+	probeItemPaths_.erase(it);
+
+	auto items = probeItems_.find(path);
+	if (items == probeItems_.end()) {
+		return;
+	}
+	auto & v = items->second;
+	v.erase(std::remove(v.begin(), v.end(), event.GetItem()), v.end());
+	if (v.empty()) {
+		probeItems_.erase(items);
+
+		fz::scoped_lock l(probeMutex_);
+		probePending_.erase(path);
+	}
+}
+
+void CLocalTreeView::WatchItem(wxTreeItemId const& item, std::wstring const& dir)
+{
+	std::wstring path = dir;
+	if (path.empty() || path.back() != fz::local_filesys::path_separator) {
+		path += fz::local_filesys::path_separator;
+	}
+
+	auto & watched = watchedItems_[item.GetID()];
+	if (watched != path) {
+		watched = std::move(path);
+		if (!watchedDirsChanged_) {
+			// Deferred, whole subtrees can get replaced at once
+			watchedDirsChanged_ = true;
+			CallAfter(&CLocalTreeView::UpdateWatchedDirs);
+		}
+	}
+}
+
+void CLocalTreeView::UpdateWatchedDirs()
+{
+	watchedDirsChanged_ = false;
+
+	std::vector<std::wstring> dirs;
+	dirs.reserve(watchedItems_.size());
+	for (auto const& watched : watchedItems_) {
+		dirs.push_back(watched.second);
+	}
+	watcher_->Set(dirs);
+}
+
+bool CLocalTreeView::AllWatched() const
+{
+	if (watchedDirsChanged_) {
+		return false;
+	}
+	for (auto const& watched : watchedItems_) {
+		if (!watcher_->Watching(watched.second)) {
+			return false;
+		}
+	}
 	return true;
 }
 
+void CLocalTreeView::OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names)
+{
+	if (names.empty()) {
+		RefreshListing();
+		return;
+	}
+
+	std::vector<wxTreeItemId> items;
+	for (auto const& watched : watchedItems_) {
+		if (watched.second == dir) {
+			items.emplace_back(watched.first);
+		}
+	}
+	for (auto const& item : items) {
+		// Might have been removed while updating a previous item
+		if (watchedItems_.find(item.GetID()) != watchedItems_.end()) {
+			UpdateSubdirs(item, dir, names);
+		}
+	}
+}
+
+void CLocalTreeView::UpdateSubdirs(wxTreeItemId const& item, std::wstring const& dir, std::vector<std::wstring> const& names)
+{
+	wxLogNull nullLog;
+
+	CFilterManager filter;
+	static int64_t const size(-1);
+
+	bool inserted{};
+	for (auto const& name : names) {
+		std::wstring const fullName = dir + name;
+
+		bool wasLink{};
+		int attributes{};
+		fz::datetime date;
+		bool const visible = fz::local_filesys::get_file_info(fz::to_native(fullName), wasLink, 0, &date, &attributes) == fz::local_filesys::dir &&
+			!filter.FilenameFiltered(name, dir, true, size, true, attributes, date);
+
+		wxTreeItemId child = GetSubdir(item, name);
+		if (visible && !child) {
+			child = AppendItem(item, name, GetIconIndex(iconType::dir, fullName),
+#ifdef __WXMSW__
+					-1
+#else
+					GetIconIndex(iconType::opened_dir, fullName)
+#endif
+				);
+			CheckSubdirStatus(child, fullName);
+			inserted = true;
+		}
+		else if (!visible && child) {
+			Delete(child);
+		}
+		else if (child) {
+			// Its own subdirectories may have changed as well
+			probeCache_.erase(fullName + fz::local_filesys::path_separator);
+			CheckSubdirStatus(child, fullName);
+		}
+	}
+
+	if (inserted) {
+		SortChildren(item);
+	}
+}
+
 #ifdef __WXMSW__
 void CLocalTreeView::OnDevicechange(WPARAM wParam, LPARAM lParam)
 {
@@ -6,6 +6,14 @@
 #include "state.h"
 #include "treectrlex.h"
 
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <deque>
+#include <map>
+
+class CCompiledFilters;
+class CLocalDirWatcher;
 class CQueueView;
 class CWindowTinter;
 
@@ -49,16 +57,34 @@ protected:
 	wxTreeItemId GetNearestParent(wxString& localDir);
 	wxTreeItemId GetSubdir(wxTreeItemId parent, const wxString& subDir);
 	void DisplayDir(wxTreeItemId parent, std::wstring const& dirname, std::wstring const& knownSubdir = std::wstring());
-	std::wstring HasSubdir(std::wstring const& dirname);
 	wxTreeItemId MakeSubdirs(wxTreeItemId parent, std::wstring dirname, wxString subDir);
 	wxString m_currentDir;
 
 	bool CheckSubdirStatus(wxTreeItemId& item, std::wstring const& path);
 
+	// Whether a directory has visible subdirectories is checked on a
+	// worker, listing directories can be slow. Until the result arrives,
+	// items keep their current expand button.
+	void ProbeSubdirs(wxTreeItemId const& item, std::wstring const& path, std::wstring const& known);
+	void ProbeWorker();
+	void OnProbeResults();
+	void ApplyProbeResult(wxTreeItemId const& item, std::wstring const& sub);
+	void CancelProbes();
+
+	// Listed directories are watched for changes, which get applied to
+	// their children directly. Only if the changes are not known, or some
+	// directory cannot be watched, does a refresh re-read the whole tree.
+	void WatchItem(wxTreeItemId const& item, std::wstring const& dir);
+	void UpdateWatchedDirs();
+	bool AllWatched() const;
+	void OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names);
+	void UpdateSubdirs(wxTreeItemId const& item, std::wstring const& dir, std::vector<std::wstring> const& names);
+
 	wxString MenuMkdir();
 
 	DECLARE_EVENT_TABLE()
 	void OnItemExpanding(wxTreeEvent& event);
+	void OnItemDeleted(wxTreeEvent& event);
 #ifdef __WXMSW__
 	void OnSelectionChanging(wxTreeEvent& event);
 #endif
@@ -93,6 +119,34 @@ protected:
 	wxTreeItemId m_dropHighlight;
 
 	std::unique_ptr<CWindowTinter> m_windowTinter;
+
+	struct probe_job final
+	{
+		std::wstring known;
+		uint64_t generation{};
+	};
+
+	// Guarded by probeMutex_
+	fz::mutex probeMutex_{false};
+	fz::async_task probeTask_;
+	bool probeWorkerRunning_{};
+	uint64_t probeGeneration_{};
+	std::deque<std::wstring> probeQueue_;
+	std::map<std::wstring, probe_job> probePending_;
+	std::vector<std::pair<std::wstring, std::wstring>> probeResults_;
+	std::shared_ptr<CCompiledFilters const> probeFilters_;
+
+	// Items waiting for the probe of their directory
+	std::map<std::wstring, std::vector<wxTreeItemId>> probeItems_;
+	std::map<void*, std::wstring> probeItemPaths_;
+
+	// Probed directories and one of their visible subdirectories, empty
+	// if there is none. Cleared on refresh.
+	std::map<std::wstring, std::wstring> probeCache_;
+
+	std::unique_ptr<CLocalDirWatcher> watcher_;
+	std::map<void*, std::wstring> watchedItems_;
+	bool watchedDirsChanged_{};
 };
 
 #endif
@@ -28,9 +28,11 @@
 #include "loginmanager.h"
 #include "manual_transfer.h"
 #include "menu_bar.h"
+#include "metrics_writer.h"
 #include "netconfwizard.h"
 #include "Options.h"
 #include "power_management.h"
+#include "profiling_dialog.h"
 #include "queue.h"
 #include "quickconnectbar.h"
 #include "remote_recursive_operation.h"
@@ -167,6 +169,7 @@ BEGIN_EVENT_TABLE(CMainFrame, wxNavigationEnabled<wxFrame>)
 #endif
 	EVT_MENU(XRCID("ID_COMPARE_SIZE"), CMainFrame::OnDropdownComparisonMode)
 	EVT_MENU(XRCID("ID_COMPARE_DATE"), CMainFrame::OnDropdownComparisonMode)
+	EVT_MENU(XRCID("ID_COMPARE_CONTENT"), CMainFrame::OnDropdownComparisonMode)
 	EVT_MENU(XRCID("ID_COMPARE_HIDEIDENTICAL"), CMainFrame::OnDropdownComparisonHide)
 	EVT_TOOL(XRCID("ID_TOOLBAR_SYNCHRONIZED_BROWSING"), CMainFrame::OnSyncBrowse)
 #ifdef __WXMAC__
@@ -390,6 +393,8 @@ CMainFrame::CMainFrame()
 
 	m_pQueueView = m_pQueuePane->GetQueueView();
 
+	metricsWriter_ = std::make_unique<CMetricsWriter>(m_engineContext, *m_pQueuePane);
+
 	m_pContextControl->Create(m_pBottomSplitter);
 
 	m_pStateEventHandler = new CMainFrameStateEventHandler(this);
@@ -490,6 +495,8 @@ CMainFrame::~CMainFrame()
 {
 	UnregisterAllOptions();
 
+	metricsWriter_.reset();
+
 	CPowerManagement::Destroy();
 
 	delete m_pStateEventHandler;
@@ -676,6 +683,16 @@ void CMainFrame::OnMenuHandler(wxCommandEvent &event)
 	else if (event.GetId() == XRCID("ID_CLEARCACHE_LAYOUT")) {
 		CWrapEngine::ClearCache();
 	}
+	else if (event.GetId() == XRCID("ID_STARTUP_TIMINGS")) {
+		std::wstring msg;
+		for (auto const& stage : wxGetApp().GetStartupStages()) {
+			msg += fz::sprintf(L"%s: %d ms\n", fz::to_wstring(stage.first), stage.second.get_milliseconds());
+		}
+		wxMessageBoxEx(msg, _T("Startup timings"));
+	}
+	else if (event.GetId() == XRCID("ID_PROFILING")) {
+		CProfilingDialog::Display(this, m_engineContext);
+	}
 	else if (event.GetId() == XRCID("ID_CLEAR_UPDATER")) {
 #if FZ_MANUALUPDATECHECK
 		if (m_pUpdater) {
@@ -887,7 +904,7 @@ void CMainFrame::OnMenuHandler(wxCommandEvent &event)
 
 		const int downloadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
 		const int uploadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
-		if (enable && !downloadLimit && !uploadLimit) {
+		if (enable && !downloadLimit && !uploadLimit && COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty()) {
 			CSpeedLimitsDialog dlg;
 			dlg.Run(this);
 		}
@@ -973,7 +990,7 @@ void CMainFrame::DoOnEngineEvent(CFileZillaEngine* engine)
 		{
 		case nId_logmsg:
 			if (m_pStatusView) {
-				m_pStatusView->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())));
+				m_pStatusView->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())), pState->m_pEngine->GetEngineId());
 			}
 			if (COptions::Get()->GetOptionVal(OPTION_MESSAGELOG_POSITION) == 2 && m_pQueuePane) {
 				m_pQueuePane->Highlight(3);
@@ -996,6 +1013,12 @@ void CMainFrame::DoOnEngineEvent(CFileZillaEngine* engine)
 				}
 			}
 			break;
+		case nId_listing_progress:
+			if (pState->m_pCommandQueue) {
+				auto const& progressNotification = static_cast<CDirectoryListingProgressNotification const&>(*pNotification.get());
+				pState->m_pCommandQueue->ProcessDirectoryListingProgress(progressNotification);
+			}
+			break;
 		case nId_asyncrequest:
 			{
 				auto pAsyncRequest = unique_static_cast<CAsyncRequestNotification>(std::move(pNotification));
@@ -1042,6 +1065,12 @@ void CMainFrame::DoOnEngineEvent(CFileZillaEngine* engine)
 				pState->ChangeServer(notification.newServer_);
 			}
 			break;
+		case nId_file_hash:
+			if (pState->GetComparisonManager()) {
+				auto const& notification = static_cast<CFileHashNotification const&>(*pNotification.get());
+				pState->GetComparisonManager()->ProcessFileHash(notification);
+			}
+			break;
 		default:
 			break;
 		}
@@ -2443,6 +2472,7 @@ void CMainFrame::OnToolbarComparisonDropdown(wxCommandEvent& event)
     menu->AppendSeparator();
 	menu->Append(XRCID("ID_COMPARE_SIZE"), _("Compare file&size"), wxString(), wxITEM_RADIO);
 	menu->Append(XRCID("ID_COMPARE_DATE"), _("Compare &modification time"), wxString(), wxITEM_RADIO);
+	menu->Append(XRCID("ID_COMPARE_CONTENT"), _("Compare file &content"), wxString(), wxITEM_RADIO);
 
     menu->AppendSeparator();
     menu->Append(XRCID("ID_COMPARE_HIDEIDENTICAL"), _("&Hide identical files"), wxString(), wxITEM_CHECK);
@@ -2459,6 +2489,9 @@ void CMainFrame::OnToolbarComparisonDropdown(wxCommandEvent& event)
 	if (mode == 0) {
 		menu->FindItem(XRCID("ID_COMPARE_SIZE"))->Check();
 	}
+	else if (mode == 2) {
+		menu->FindItem(XRCID("ID_COMPARE_CONTENT"))->Check();
+	}
 	else {
 		menu->FindItem(XRCID("ID_COMPARE_DATE"))->Check();
 	}
@@ -2499,7 +2532,13 @@ void CMainFrame::OnDropdownComparisonMode(wxCommandEvent& event)
 	}
 
 	int old_mode = COptions::Get()->GetOptionVal(OPTION_COMPARISONMODE);
-	int new_mode = (event.GetId() == XRCID("ID_COMPARE_SIZE")) ? 0 : 1;
+	int new_mode = 1;
+	if (event.GetId() == XRCID("ID_COMPARE_SIZE")) {
+		new_mode = 0;
+	}
+	else if (event.GetId() == XRCID("ID_COMPARE_CONTENT")) {
+		new_mode = 2;
+	}
 	COptions::Get()->SetOption(OPTION_COMPARISONMODE, new_mode);
 
 	CComparisonManager* pComparisonManager = pState->GetComparisonManager();
@@ -2767,19 +2806,6 @@ void CMainFrame::PostInitialize()
 	NavigateIn(wxNavigationKeyEvent::IsForward);
 #endif
 
-#if FZ_MANUALUPDATECHECK
-	// Need to do this after welcome screen to avoid simultaneous display of multiple dialogs
-	if (!m_pUpdater) {
-		update_dialog_timer_.SetOwner(this);
-		m_pUpdater = new CUpdater(*this, m_engineContext,
-			[this](CActiveNotification const& notification) {
-			UpdateActivityLed(notification.GetDirection());
-		}
-		);
-		m_pUpdater->Init();
-	}
-#endif
-
 	int const startupAction = COptions::Get()->GetOptionVal(OPTION_STARTUP_ACTION);
 	bool startupReconnect = startupAction == 2;
 
@@ -2822,6 +2848,22 @@ void CMainFrame::PostInitialize()
 	}
 }
 
+void CMainFrame::DeferredInitialize()
+{
+#if FZ_MANUALUPDATECHECK
+	// Need to do this after welcome screen to avoid simultaneous display of multiple dialogs
+	if (!m_pUpdater) {
+		update_dialog_timer_.SetOwner(this);
+		m_pUpdater = new CUpdater(*this, m_engineContext,
+			[this](CActiveNotification const& notification) {
+			UpdateActivityLed(notification.GetDirection());
+		}
+		);
+		m_pUpdater->Init();
+	}
+#endif
+}
+
 void CMainFrame::OnMenuNewTab(wxCommandEvent&)
 {
 	if (m_pContextControl) {
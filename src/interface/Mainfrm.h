@@ -21,6 +21,7 @@ class CContextControl;
 class CLed;
 class CMainFrameStateEventHandler;
 class CMenuBar;
+class CMetricsWriter;
 class CQueue;
 class CQueueView;
 class CQuickconnectBar;
@@ -62,6 +63,9 @@ public:
 
 	void PostInitialize();
 
+	// Sets up what is not needed until after startup, such as the updater
+	void DeferredInitialize();
+
 	CContextControl* GetContextControl() { return m_pContextControl; }
 
 	bool ConnectToSite(Site & data, Bookmark const& bookmark, CState* pState = 0);
@@ -93,6 +97,7 @@ private:
 
 	CStatusView* m_pStatusView{};
 	CQueueView* m_pQueueView{};
+	std::unique_ptr<CMetricsWriter> metricsWriter_;
 	CLed* m_pActivityLed[2];
 #if FZ_MANUALUPDATECHECK
 	CUpdater* m_pUpdater{};
@@ -4,6 +4,7 @@
 #include "file_utils.h"
 #include "ipcmutex.h"
 #include "locale_initializer.h"
+#include "options_writer.h"
 #include <option_change_event_handler.h>
 #include "sizeformatting.h"
 
@@ -112,6 +113,10 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "FTP Proxy login sequence", string, L"", normal },
 	{ "SFTP keyfiles", string, L"", platform },
 	{ "SFTP compression", number, L"", normal },
+	{ "SFTP max window", number, L"64", normal },
+	{ "SFTP max list window", number, L"32", normal },
+	{ "SFTP connection sharing", number, L"0", normal },
+	{ "Storj chunk size", number, L"4", normal },
 	{ "Proxy type", number, L"0", normal },
 	{ "Proxy host", string, L"", normal },
 	{ "Proxy port", number, L"0", normal },
@@ -120,11 +125,33 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Logging file", string, L"", platform },
 	{ "Logging filesize limit", number, L"10", normal },
 	{ "Logging show detailed logs", number, L"0", internal },
+	{ "Logging trace file", string, L"", platform },
 	{ "Size format", number, L"0", normal },
 	{ "Size thousands separator", number, L"1", normal },
 	{ "Size decimal places", number, L"1", normal },
 	{ "TCP Keepalive Interval", number, L"15", normal },
 	{ "Cache TTL", number, L"600", normal },
+	{ "Cache memory budget", number, L"256", normal },
+	{ "Persistent directory cache", number, L"0", normal },
+	{ "Persistent directory cache dir", string, L"", internal },
+	{ "IO buffer size", number, L"256", normal },
+	{ "IO buffer count", number, L"8", normal },
+	{ "HTTP keep-alive", number, L"1", normal },
+	{ "HTTP pipelining", number, L"0", normal },
+	{ "Engine event loops", number, L"1", normal },
+	{ "Engine CPU affinity", number, L"0", normal },
+	{ "Capability cache TTL", number, L"604800", normal },
+	{ "Active mode pre-listen", number, L"0", normal },
+	{ "FTP prepare passive", number, L"0", normal },
+	{ "Shared directory cache", number, L"0", normal },
+	{ "Socket buffer autotuning", number, L"0", normal },
+	{ "TCP congestion control", string, L"", normal },
+	{ "Speedlimit schedule", string, L"", normal },
+	{ "Source addresses", string, L"", normal },
+	{ "SFTP process pool", number, L"2", normal },
+	{ "Sparse downloads", number, L"0", normal },
+	{ "Download sync interval", number, L"0", normal },
+	{ "SFTP archive uploads", number, L"0", normal },
 
 	// Interface settings
 	{ "Number of Transfers", number, L"2", normal },
@@ -141,6 +168,8 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Last automatic update version", string, L"", normal },
 	{ "Update Check New Version", string, L"", platform },
 	{ "Update Check Check Beta", number, L"0", normal },
+	{ "Update Check Speed Limit", number, L"1024", normal },
+	{ "Update Check Package", string, L"", platform },
 	{ "Show debug menu", number, L"0", normal },
 	{ "File exists action download", number, L"0", normal },
 	{ "File exists action upload", number, L"0", normal },
@@ -212,6 +241,22 @@ static const t_Option options[OPTIONS_NUM] =
 	{ "Disable update footer", number, L"0", normal },
 	{ "Master password encryptor", string, L"", normal },
 	{ "Tab data", xml, std::wstring(), normal },
+	{ "Segmented downloads", number, L"0", normal }, // Number of segments, 0 or 1 to disable
+	{ "Segmented download min size", number, L"1024", normal }, // In MiB
+	{ "Upload batch files", number, L"32", normal }, // Number of small files uploaded at once, 0 or 1 to disable
+	{ "Upload batch max size", number, L"64", normal }, // In KiB
+	{ "Adaptive concurrency", number, L"0", normal }, // Number of transfers becomes the upper bound
+	{ "Queue scheduling", number, L"0", normal }, // See QueueScheduling
+	{ "Parallel listings", number, L"0", normal }, // Idle queue engines listing ahead in recursive operations, 0 to disable
+	{ "Queue warm connections", number, L"0", normal }, // Connections per site kept or established ahead of demand, 0 to disable
+	{ "Queue lend browsing connection", number, L"0", normal }, // Transfer over the idle browsing connection, handed back on user commands
+	{ "Parallel deletes", number, L"0", normal }, // Idle queue engines deleting files in recursive deletes, 0 to disable
+	{ "Parallel chmods", number, L"0", normal }, // Idle queue engines changing permissions of files in recursive chmods, 0 to disable
+	{ "Finished transfers limit", number, L"10000", normal }, // Files kept in each of the lists of failed and successful transfers, 0 for no limit
+	{ "Prefetch subdirectories", number, L"0", normal }, // Subdirectories of the current remote directory listed ahead by an idle engine, 0 to disable
+	{ "Verify transfers", number, L"0", normal }, // Compare checksums of local and remote file after each transfer if the server supports it
+	{ "Metrics file", string, L"", platform }, // Statistics for monitoring are periodically written to this file, empty to disable
+	{ "Metrics interval", number, L"15", normal }, // In seconds
 
 	// Default/internal options
 	{ "Config Location", string, L"", static_cast<Flags>(default_only|platform) },
@@ -288,6 +333,7 @@ COptions::COptions()
 
 	CInterProcessMutex mutex(MUTEX_OPTIONS);
 	xmlFile_ = std::make_unique<CXmlFile>(dir.GetPath() + L"filezilla.xml");
+	xmlFile_->EnableSnapshot();
 	if (!xmlFile_->Load()) {
 		wxString msg = xmlFile_->GetError() + L"\n\n" + _("For this session the default settings will be used. Any changes to the settings will not be saved.");
 		wxMessageBoxEx(msg, _("Error loading xml file"), wxICON_ERROR);
@@ -295,10 +341,30 @@ COptions::COptions()
 	}
 	else {
 		CreateSettingsXmlElement();
+
+		std::wstring const fileName = xmlFile_->GetFileName();
+		writer_ = std::make_unique<COptionsWriter>(fileName, [this, fileName](std::wstring const& error) {
+			CallAfter([fileName, error]() {
+				wxString msg = wxString::Format(_("Could not write \"%s\":"), fileName);
+				wxMessageBoxEx(msg + _T("\n") + error, _("Error writing xml file"), wxICON_ERROR);
+			});
+		});
 	}
 
 	LoadOptions(nameOptionMap);
 
+	if (writer_) {
+		// Settings changed after the last complete write, e.g. if FileZilla got killed
+		auto const journal = COptionsWriter::ReadJournal(xmlFile_->GetFileName());
+		if (journal.first_child()) {
+			for (auto setting = journal.child("Setting"); setting; setting = setting.next_sibling("Setting")) {
+				LoadOptionFromElement(setting, nameOptionMap, false);
+			}
+			WriteCacheToXml(CreateSettingsXmlElement());
+			ScheduleSave();
+		}
+	}
+
 	changedOptions_.reset();
 }
 
@@ -315,6 +381,9 @@ std::map<std::string, unsigned int> COptions::GetNameOptionMap() const
 
 COptions::~COptions()
 {
+	// Finishes pending writes
+	writer_.reset();
+
 	COptionChangeEventHandler::UnregisterAllHandlers();
 }
 
@@ -324,8 +393,7 @@ int COptions::GetOptionVal(unsigned int nID)
 		return 0;
 	}
 
-	fz::scoped_lock l(m_sync_);
-	return m_optionsCache[nID].numValue;
+	return m_optionsCache[nID].numValue.load(std::memory_order_relaxed);
 }
 
 std::wstring COptions::GetOption(unsigned int nID)
@@ -443,9 +511,11 @@ void COptions::ContinueSetOption(unsigned int nID, T const& value)
 	if (!(options[nID].flags & (internal | default_only))) {
 		SetXmlValue(nID, settings, validated);
 
-		if (!m_save_timer.IsRunning()) {
-			m_save_timer.Start(15000, true);
+		if (writer_ && GetOptionVal(OPTION_DEFAULT_KIOSKMODE) != 2) {
+			// SetXmlValue appends the new element
+			writer_->Journal(settings.last_child());
 		}
+		ScheduleSave();
 	}
 }
 
@@ -586,6 +656,11 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 7;
 		}
 		break;
+	case OPTION_UPDATECHECK_SPEEDLIMIT:
+		if (value < 0) {
+			value = 0;
+		}
+		break;
 	case OPTION_LOGGING_DEBUGLEVEL:
 		if (value < 0 || value > 4) {
 			value = 0;
@@ -601,6 +676,49 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 5;
 		}
 		break;
+	case OPTION_QUEUE_SCHEDULING:
+		if (value < 0 || value > 2) {
+			value = 0;
+		}
+		break;
+	case OPTION_PARALLEL_LISTINGS:
+	case OPTION_PARALLEL_DELETES:
+	case OPTION_PARALLEL_CHMODS:
+	case OPTION_PREFETCH_SUBDIRS:
+		if (value < 0 || value > 10) {
+			value = 0;
+		}
+		break;
+	case OPTION_METRICS_INTERVAL:
+		if (value < 1 || value > 3600) {
+			value = 15;
+		}
+		break;
+	case OPTION_FINISHED_TRANSFERS_LIMIT:
+		if (value < 0) {
+			value = 0;
+		}
+		break;
+	case OPTION_SEGMENTED_DOWNLOADS:
+		if (value < 0 || value > 10) {
+			value = 0;
+		}
+		break;
+	case OPTION_SEGMENTED_DOWNLOAD_MINSIZE:
+		if (value < 1) {
+			value = 1024;
+		}
+		break;
+	case OPTION_UPLOAD_BATCH_FILES:
+		if (value < 0 || value > 256) {
+			value = 32;
+		}
+		break;
+	case OPTION_UPLOAD_BATCH_MAXSIZE:
+		if (value < 1) {
+			value = 64;
+		}
+		break;
 	case OPTION_FILEPANE_LAYOUT:
 		if (value < 0 || value > 3) {
 			value = 0;
@@ -634,7 +752,7 @@ int COptions::Validate(unsigned int nID, int value)
 		}
 		break;
 	case OPTION_COMPARISONMODE:
-		if (value < 0 || value > 0) {
+		if (value < 0 || value > 2) {
 			value = 1;
 		}
 		break;
@@ -683,6 +801,86 @@ int COptions::Validate(unsigned int nID, int value)
 			value = 60 * 60 * 24;
 		}
 		break;
+	case OPTION_SFTP_MAX_WINDOW:
+		if (value < 4) {
+			value = 4;
+		}
+		else if (value > 1024) {
+			value = 1024;
+		}
+		break;
+	case OPTION_SFTP_MAX_LIST_WINDOW:
+		if (value < 4) {
+			value = 4;
+		}
+		else if (value > 256) {
+			value = 256;
+		}
+		break;
+	case OPTION_SFTP_PROCESS_POOL:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 10) {
+			value = 10;
+		}
+		break;
+	case OPTION_DOWNLOAD_SYNC_INTERVAL:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 4096) {
+			value = 4096;
+		}
+		break;
+	case OPTION_STORJ_CHUNK_SIZE:
+		if (value < 1) {
+			value = 1;
+		}
+		else if (value > 64) {
+			value = 64;
+		}
+		break;
+	case OPTION_CACHE_MEMORY_BUDGET:
+		if (value < 16) {
+			value = 16;
+		}
+		else if (value > 65536) {
+			value = 65536;
+		}
+		break;
+	case OPTION_IOTHREAD_BUFFERSIZE:
+		if (value < 16) {
+			value = 16;
+		}
+		else if (value > 16384) {
+			value = 16384;
+		}
+		break;
+	case OPTION_IOTHREAD_BUFFERCOUNT:
+		if (value < 2) {
+			value = 2;
+		}
+		else if (value > 64) {
+			value = 64;
+		}
+		break;
+	case OPTION_ENGINE_EVENT_LOOPS:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 64) {
+			value = 64;
+		}
+		break;
+	case OPTION_CAPABILITIES_TTL:
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value > 60 * 60 * 24 * 30) {
+			value = 60 * 60 * 24 * 30;
+		}
+		break;
 	case OPTION_ICONS_SCALE:
 		if (value < 25) {
 			value = 25;
@@ -751,9 +949,7 @@ void COptions::Import(pugi::xml_node element)
 	}
 	LoadOptions(GetNameOptionMap(), element);
 
-	if (!m_save_timer.IsRunning()) {
-		m_save_timer.Start(15000, true);
-	}
+	ScheduleSave();
 
 	{
 		fz::scoped_lock l(m_sync_);
@@ -870,18 +1066,30 @@ void COptions::OnTimer(wxTimerEvent&)
 	Save();
 }
 
+void COptions::ScheduleSave()
+{
+	// Waits for changes to settle, e.g. while dragging column widths, but
+	// saves no later than 15 seconds after the first unsaved change.
+	auto const now = fz::monotonic_clock::now();
+	if (!m_save_timer.IsRunning()) {
+		firstUnsaved_ = now;
+	}
+	int64_t const remaining = (firstUnsaved_ + fz::duration::from_seconds(15) - now).get_milliseconds();
+	m_save_timer.Start(static_cast<int>(std::clamp(remaining, int64_t(1), int64_t(2000))), true);
+}
+
 void COptions::Save()
 {
 	if (GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
 		return;
 	}
 
-	if (!xmlFile_) {
+	if (!xmlFile_ || !writer_) {
 		return;
 	}
 
-	CInterProcessMutex mutex(MUTEX_OPTIONS);
-	xmlFile_->Save(true);
+	// The copy is cheap compared to writing and syncing the file
+	writer_->Write(xmlFile_->Clone());
 }
 
 bool COptions::Cleanup()
@@ -946,6 +1154,9 @@ void COptions::SaveIfNeeded()
 	if (save) {
 		Save();
 	}
+	if (writer_) {
+		writer_->Flush();
+	}
 }
 
 namespace {
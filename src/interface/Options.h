@@ -6,11 +6,14 @@
 #include <option_change_event_handler.h>
 
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
 
 #include <wx/timer.h>
 
 #include "xmlfunctions.h"
 
+#include <atomic>
+
 enum interfaceOptions
 {
 	OPTION_NUMTRANSFERS = OPTIONS_ENGINE_NUM,
@@ -27,6 +30,8 @@ enum interfaceOptions
 	OPTION_UPDATECHECK_LASTVERSION,
 	OPTION_UPDATECHECK_NEWVERSION,
 	OPTION_UPDATECHECK_CHECKBETA,
+	OPTION_UPDATECHECK_SPEEDLIMIT,
+	OPTION_UPDATECHECK_PACKAGE,
 	OPTION_DEBUG_MENU,
 	OPTION_FILEEXISTS_DOWNLOAD,
 	OPTION_FILEEXISTS_UPLOAD,
@@ -98,6 +103,22 @@ enum interfaceOptions
 	OPTION_DISABLE_UPDATE_FOOTER,
 	OPTION_MASTERPASSWORDENCRYPTOR,
 	OPTION_TAB_DATA,
+	OPTION_SEGMENTED_DOWNLOADS,
+	OPTION_SEGMENTED_DOWNLOAD_MINSIZE,
+	OPTION_UPLOAD_BATCH_FILES,
+	OPTION_UPLOAD_BATCH_MAXSIZE,
+	OPTION_ADAPTIVE_CONCURRENCY,
+	OPTION_QUEUE_SCHEDULING,
+	OPTION_PARALLEL_LISTINGS,
+	OPTION_QUEUE_WARM_CONNECTIONS,
+	OPTION_QUEUE_LEND_BROWSING_CONNECTION,
+	OPTION_PARALLEL_DELETES,
+	OPTION_PARALLEL_CHMODS,
+	OPTION_FINISHED_TRANSFERS_LIMIT,
+	OPTION_PREFETCH_SUBDIRS,
+	OPTION_VERIFY_TRANSFERS,
+	OPTION_METRICS_FILE,
+	OPTION_METRICS_INTERVAL,
 
 	// Default/internal options
 	OPTION_DEFAULT_SETTINGSDIR, // guaranteed to be (back)slash-terminated
@@ -121,7 +142,10 @@ struct t_OptionsCache
 	t_OptionsCache& operator=(pugi::xml_document && v);
 
 	bool from_default;
-	int numValue;
+
+	// Only changed while holding the lock, but read without it. Numeric
+	// options are looked up for every file and buffer.
+	std::atomic<int> numValue{};
 	std::wstring strValue;
 	pugi::xml_document xmlValue;
 };
@@ -129,6 +153,7 @@ struct t_OptionsCache
 std::wstring GetEnv(char const* name);
 
 class CXmlFile;
+class COptionsWriter;
 class COptions final : public wxEvtHandler, public COptionsBase
 {
 public:
@@ -178,17 +203,20 @@ protected:
 	void WriteCacheToXml(pugi::xml_node settings);
 
 	bool Cleanup(); // Removes all unknown elements from the XML
+	void ScheduleSave();
 	void Save();
 
 	void NotifyChangedOptions();
 
 	std::unique_ptr<CXmlFile> xmlFile_;
+	std::unique_ptr<COptionsWriter> writer_;
 
 	t_OptionsCache m_optionsCache[OPTIONS_NUM];
 
 	static COptions* m_theOptions;
 
 	wxTimer m_save_timer;
+	fz::monotonic_clock firstUnsaved_;
 	bool needsCleanup_{};
 
 	DECLARE_EVENT_TABLE()
@@ -23,6 +23,10 @@
 #include "auto_ascii_files.h"
 #include "dragdropmanager.h"
 #include "drop_target_ex.h"
+#include "filehash.h"
+#include "local_hash_worker.h"
+
+#include <resume_journal.h>
 
 #if WITH_LIBDBUS
 #include "../dbus/desktop_notification.h"
@@ -30,6 +34,9 @@
 #include <wx/notifmsg.h>
 #endif
 
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
 #include <wx/dnd.h>
 #include <wx/menu.h>
 #include <wx/progdlg.h>
@@ -40,6 +47,15 @@
 #include <powrprof.h>
 #endif
 
+#include <map>
+
+#include <algorithm>
+
+namespace {
+// Number of files per server loaded at once from a journaled queue
+int const queue_page_size = 1000;
+}
+
 class CQueueViewDropTarget final : public CFileDropTarget<wxListCtrlEx>
 {
 public:
@@ -218,6 +234,10 @@ CQueueView::CQueueView(CQueue* parent, int index, CMainFrame* pMainFrame, CAsync
 		m_pAsyncRequestQueue->SetQueue(this);
 	}
 
+	m_hashWorker = std::make_unique<CLocalHashWorker>(m_pMainFrame->GetEngineContext().GetThreadPool(), [this](uint64_t id, std::string const& hash) {
+		OnLocalHash(id, hash);
+	});
+
 	int action = COptions::Get()->GetOptionVal(OPTION_QUEUE_COMPLETION_ACTION);
 	if (action < 0 || action >= ActionAfterState::Count) {
 		action = 1;
@@ -245,13 +265,22 @@ CQueueView::CQueueView(CQueue* parent, int index, CMainFrame* pMainFrame, CAsync
 #endif
 
 	m_resize_timer.SetOwner(this);
+	m_concurrency_timer.SetOwner(this);
+	m_transferStatusTimer.SetOwner(this);
+	m_journal_timer.SetOwner(this);
+	m_fxp_timer.SetOwner(this);
 }
 
 CQueueView::~CQueueView()
 {
+	m_hashWorker.reset();
 	DeleteEngines();
 
 	m_resize_timer.Stop();
+	m_concurrency_timer.Stop();
+	m_transferStatusTimer.Stop();
+	m_journal_timer.Stop();
+	m_fxp_timer.Stop();
 }
 
 bool CQueueView::QueueFile(bool const queueOnly, bool const download,
@@ -291,6 +320,26 @@ bool CQueueView::QueueFile(bool const queueOnly, bool const download,
 	}
 
 	fileItem->SetPriorityRaw(priority);
+	if (!SpillItem(*pServerItem, fileItem)) {
+		InsertItem(pServerItem, fileItem);
+	}
+
+	return true;
+}
+
+bool CQueueView::QueueFxp(bool const queueOnly, Site const& sourceSite, CServerPath const& sourcePath, std::wstring const& sourceFile,
+	Site const& targetSite, CServerPath const& targetPath, std::wstring const& targetFile, int64_t size)
+{
+	if (!sourceSite.server.HasFeature(ProtocolFeature::ServerToServer) || !targetSite.server.HasFeature(ProtocolFeature::ServerToServer)) {
+		return false;
+	}
+
+	CServerItem* pServerItem = CreateServerItem(targetSite);
+
+	CFxpItem* fileItem = new CFxpItem(pServerItem, queueOnly, sourceSite, sourcePath, sourceFile, targetFile, targetPath, size);
+	fileItem->SetAscii(CAutoAsciiFiles::TransferRemoteAsAscii(sourceFile, sourcePath.GetType()));
+
+	// Not stored, hence never spilled either
 	InsertItem(pServerItem, fileItem);
 
 	return true;
@@ -332,6 +381,7 @@ bool CQueueView::QueueFiles(const bool queueOnly, const CLocalPath& localPath, c
 	std::vector<CRemoteDataObject::t_fileInfo> const& files = dataObject.GetFiles();
 
 	bool const hasDataTypeConcept = dataObject.GetSite().server.HasFeature(ProtocolFeature::DataTypeConcept);
+	CAutoAsciiFiles::matcher const ascii;
 
 	for (auto const& fileInfo : files) {
 		if (fileInfo.dir) {
@@ -347,10 +397,12 @@ bool CQueueView::QueueFiles(const bool queueOnly, const CLocalPath& localPath, c
 			fileInfo.name, (fileInfo.name != localFile) ? localFile : std::wstring(),
 			localPath, dataObject.GetServerPath(), fileInfo.size);
 		if (hasDataTypeConcept) {
-			fileItem->SetAscii(CAutoAsciiFiles::TransferRemoteAsAscii(fileInfo.name, dataObject.GetServerPath().GetType()));
+			fileItem->SetAscii(ascii.TransferRemoteAsAscii(fileInfo.name, dataObject.GetServerPath().GetType()));
 		}
 
-		InsertItem(pServerItem, fileItem);
+		if (!SpillItem(*pServerItem, fileItem)) {
+			InsertItem(pServerItem, fileItem);
+		}
 	}
 
 	QueueFile_Finish(!queueOnly);
@@ -358,7 +410,37 @@ bool CQueueView::QueueFiles(const bool queueOnly, const CLocalPath& localPath, c
 	return true;
 }
 
-bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CLocalRecursiveOperation::listing const& listing)
+namespace {
+bool unchanged_on_server(CDirectoryListing const& remoteListing, CLocalRecursiveOperation::listing::entry const& file, fz::duration const& threshold)
+{
+	size_t const index = remoteListing.FindFile_CmpCase(file.name);
+	if (index == std::string::npos) {
+		return false;
+	}
+
+	CDirentry const& entry = remoteListing[index];
+	if (entry.is_dir() || entry.size < 0 || entry.size != file.size) {
+		return false;
+	}
+	if (entry.time.empty() || file.time.empty()) {
+		return false;
+	}
+
+	// Same tolerance as in directory comparison
+	fz::datetime localDate = file.time;
+	fz::datetime remoteDate = entry.time;
+	int const cmp = localDate.compare(remoteDate);
+	if (cmp < 0) {
+		localDate += threshold;
+	}
+	else if (cmp > 0) {
+		remoteDate += threshold;
+	}
+	return !cmp || cmp == -localDate.compare(remoteDate);
+}
+}
+
+bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CLocalRecursiveOperation::listing const& listing, CDirectoryListing const* remoteListing)
 {
 	CServerItem* pServerItem = CreateServerItem(site);
 
@@ -366,20 +448,30 @@ bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CLocalRecurs
 	if (files.empty() && listing.dirs.empty()) {
 		// Empty directory
 		CFileItem* fileItem = new CFolderItem(pServerItem, queueOnly, listing.remotePath, std::wstring());
-		InsertItem(pServerItem, fileItem);
+		if (!SpillItem(*pServerItem, fileItem)) {
+			InsertItem(pServerItem, fileItem);
+		}
 	}
 	else {
 		bool const hasDataTypeConcept = site.server.HasFeature(ProtocolFeature::DataTypeConcept);
+		fz::duration const threshold = fz::duration::from_minutes(COptions::Get()->GetOptionVal(OPTION_COMPARISON_THRESHOLD));
+		CAutoAsciiFiles::matcher const ascii;
 
 		for (auto const& file : files) {
+			if (remoteListing && unchanged_on_server(*remoteListing, file, threshold)) {
+				continue;
+			}
+
 			CFileItem* fileItem = new CFileItem(pServerItem, queueOnly, false,
 				file.name, std::wstring(),
 				listing.localPath, listing.remotePath, file.size);
 			if (hasDataTypeConcept) {
-				fileItem->SetAscii(CAutoAsciiFiles::TransferLocalAsAscii(file.name, listing.remotePath.GetType()));
+				fileItem->SetAscii(ascii.TransferLocalAsAscii(file.name, listing.remotePath.GetType()));
 			}
 
-			InsertItem(pServerItem, fileItem);
+			if (!SpillItem(*pServerItem, fileItem)) {
+				InsertItem(pServerItem, fileItem);
+			}
 		}
 
 		// We do not look at dirs here, recursion takes care of it.
@@ -388,9 +480,63 @@ bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CLocalRecurs
 	return true;
 }
 
+bool CQueueView::QueueFiles(const bool queueOnly, Site const& site, CRemoteRecursiveOperation::listing const& listing)
+{
+	CServerItem* pServerItem = CreateServerItem(site);
+
+	bool const hasDataTypeConcept = site.server.HasFeature(ProtocolFeature::DataTypeConcept);
+	CAutoAsciiFiles::matcher const ascii;
+
+	for (auto const& file : listing.files) {
+		CFileItem* fileItem = new CFileItem(pServerItem, queueOnly, true,
+			file.name, file.localName,
+			listing.localPath, listing.remotePath, file.size);
+		if (hasDataTypeConcept) {
+			fileItem->SetAscii(ascii.TransferRemoteAsAscii(file.name, listing.remotePath.GetType()));
+		}
+
+		if (!SpillItem(*pServerItem, fileItem)) {
+			InsertItem(pServerItem, fileItem);
+		}
+	}
+
+	return true;
+}
+
 void CQueueView::OnEngineEvent(CFileZillaEngine* engine)
 {
-	CallAfter(&CQueueView::DoOnEngineEvent, engine);
+	fz::scoped_lock l(m_pendingEnginesMutex);
+	if (std::find(m_pendingEngines.cbegin(), m_pendingEngines.cend(), engine) != m_pendingEngines.cend()) {
+		return;
+	}
+	m_pendingEngines.push_back(engine);
+	if (m_pendingEngines.size() == 1) {
+		CallAfter(&CQueueView::DoOnEngineEvents);
+	}
+}
+
+void CQueueView::DoOnEngineEvents()
+{
+	std::vector<CFileZillaEngine*> engines;
+	{
+		fz::scoped_lock l(m_pendingEnginesMutex);
+		engines.swap(m_pendingEngines);
+	}
+
+	m_inEngineBatch = true;
+	for (auto engine : engines) {
+		DoOnEngineEvent(engine);
+	}
+	m_inEngineBatch = false;
+
+	if (m_batchRefreshList) {
+		m_batchRefreshList = false;
+		RefreshListOnly(false);
+	}
+	if (m_batchUpdateStatusLines) {
+		m_batchUpdateStatusLines = false;
+		UpdateStatusLinePositions();
+	}
 }
 
 void CQueueView::DoOnEngineEvent(CFileZillaEngine* engine)
@@ -425,7 +571,7 @@ void CQueueView::ProcessNotification(t_EngineData* pEngineData, std::unique_ptr<
 	switch (pNotification->GetID())
 	{
 	case nId_logmsg:
-		m_pMainFrame->GetStatusView()->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())));
+		m_pMainFrame->GetStatusView()->AddToLog(std::move(static_cast<CLogmsgNotification&>(*pNotification.get())), pEngineData->pEngine->GetEngineId());
 		if (COptions::Get()->GetOptionVal(OPTION_MESSAGELOG_POSITION) == 2) {
 			m_pQueue->Highlight(3);
 		}
@@ -499,6 +645,21 @@ void CQueueView::ProcessNotification(t_EngineData* pEngineData, std::unique_ptr<
 			}
 		}
 		break;
+	case nId_upload_batch:
+		ProcessUploadBatchNotification(*pEngineData, static_cast<CUploadBatchNotification const&>(*pNotification.get()));
+		break;
+	case nId_fxp_address:
+		if (pEngineData->fxpPartner && pEngineData->state == t_EngineData::transfer) {
+			OnFxpAddress(*pEngineData, static_cast<CFxpAddressNotification const&>(*pNotification.get()).address_);
+		}
+		break;
+	case nId_file_hash:
+		if (pEngineData->state == t_EngineData::verify) {
+			auto const& hashNotification = static_cast<CFileHashNotification const&>(*pNotification.get());
+			pEngineData->verifyAlgorithm = hashNotification.algorithm_;
+			pEngineData->verifyHash = hashNotification.hash_;
+		}
+		break;
 	case nId_local_dir_created:
 		{
 			auto const& localDirCreatedNotification = static_cast<CLocalDirCreatedNotification const&>(*pNotification.get());
@@ -526,11 +687,12 @@ void CQueueView::ProcessNotification(t_EngineData* pEngineData, std::unique_ptr<
 
 bool CQueueView::CanStartTransfer(CServerItem const & server_item, t_EngineData *&pEngineData)
 {
+	if (COptions::Get()->GetOptionVal(OPTION_ADAPTIVE_CONCURRENCY) && server_item.m_activeCount >= server_item.m_concurrency.Limit()) {
+		return false;
+	}
+
 	Site const& site = server_item.GetSite();
 	const int max_count = site.server.MaximumMultipleConnections();
-	if (!max_count) {
-		return true;
-	}
 
 	int active_count = server_item.m_activeCount;
 
@@ -543,46 +705,800 @@ bool CQueueView::CanStartTransfer(CServerItem const & server_item, t_EngineData
 		}
 
 		if (browsingSite.server == site.server) {
-			++active_count;
+			// If lent to the queue, the connection is already part of the active count
+			t_EngineData const* lent = GetEngineData(pState->m_pEngine);
+			if (!lent || !lent->active) {
+				++active_count;
+			}
 			browsingStateOnSameServer = pState;
 			break;
 		}
 	}
 
-	if (active_count < max_count) {
+	if (browsingStateOnSameServer && COptions::Get()->GetOptionVal(OPTION_QUEUE_LEND_BROWSING_CONNECTION)) {
+		t_EngineData* lent = LendBrowsingEngine(*browsingStateOnSameServer, site);
+		if (lent) {
+			pEngineData = lent;
+			return true;
+		}
+	}
+
+	if (!max_count || active_count < max_count) {
+		return true;
+	}
+
+	// Max count has been reached
+
+	pEngineData = GetIdleEngine(site, true);
+	if (pEngineData) {
+		// If we got an idle engine connected to this very server, start the
+		// transfer anyhow. Let's not get this connection go to waste.
+		if (pEngineData->lastSite == site && pEngineData->pEngine->IsConnected()) {
+			return true;
+		}
+	}
+
+	if (!browsingStateOnSameServer || active_count > 1) {
+		return false;
+	}
+
+	// At this point the following holds:
+	// max_count is limited to 1, only connection to server is held by the browsing connection
+
+	pEngineData = GetEngineData(browsingStateOnSameServer->m_pEngine);
+	if (pEngineData) {
+		wxASSERT(pEngineData->transient);
+		if (browsingStateOnSameServer->m_pCommandQueue && browsingStateOnSameServer->m_pCommandQueue->HasPendingCommands()) {
+			// The user wants the connection back
+			pEngineData = 0;
+			return false;
+		}
+		return pEngineData->transient && !pEngineData->active;
+	}
+
+	pEngineData = new t_EngineData;
+	pEngineData->transient = true;
+	pEngineData->state = t_EngineData::waitprimary;
+	pEngineData->pEngine = browsingStateOnSameServer->m_pEngine;
+	m_engineData.push_back(pEngineData);
+	return true;
+}
+
+t_EngineData* CQueueView::LendBrowsingEngine(CState& state, Site const& site)
+{
+	CCommandQueue* pCommandQueue = state.m_pCommandQueue;
+	if (!state.m_pEngine || !pCommandQueue || pCommandQueue->HasPendingCommands()) {
+		return 0;
+	}
+
+	t_EngineData* pEngineData = GetEngineData(state.m_pEngine);
+	if (pEngineData) {
+		// Already lent, keep using it until the user needs it
+		if (pEngineData->transient && !pEngineData->active) {
+			return pEngineData;
+		}
+		return 0;
+	}
+
+	if (!state.IsRemoteIdle() || state.m_pEngine->IsBusy() || !state.m_pEngine->IsConnected()) {
+		return 0;
+	}
+
+	// Prefer queue connections already established to the site
+	for (auto const* data : m_engineData) {
+		if (!data->active && !data->transient && data->lastSite == site && data->pEngine->IsConnected()) {
+			return 0;
+		}
+	}
+
+	pEngineData = new t_EngineData;
+	pEngineData->transient = true;
+	pEngineData->state = t_EngineData::waitprimary;
+	pEngineData->pEngine = state.m_pEngine;
+	m_engineData.push_back(pEngineData);
+	return pEngineData;
+}
+
+void CQueueView::ReturnBrowsingEngine(CFileZillaEngine* pEngine)
+{
+	// Not checking the option, it may have been turned off while lent
+	t_EngineData* pEngineData = GetEngineData(pEngine);
+	if (!pEngineData || !pEngineData->transient || !pEngineData->active) {
+		return;
+	}
+
+	if (pEngineData->state == t_EngineData::waitprimary) {
+		ResetEngine(*pEngineData, ResetReason::reset);
+	}
+	else if (!SkipVerification(*pEngineData)) {
+		// Handled as an interruption, the item gets resumed later on
+		pEngine->Cancel();
+	}
+}
+
+bool CQueueView::SplitIntoSegments(CServerItem& serverItem, CFileItem& fileItem)
+{
+	int const count = COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOADS);
+	if (count < 2 || !fileItem.Download() || fileItem.Ascii() || fileItem.IsSegment() || fileItem.m_edit != CEditHandler::none) {
+		return false;
+	}
+
+	if (!serverItem.GetSite().server.HasFeature(ProtocolFeature::SegmentedDownload)) {
+		return false;
+	}
+
+	int64_t const size = fileItem.GetSize();
+	int64_t const minSize = static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_SEGMENTED_DOWNLOAD_MINSIZE)) * 1024 * 1024;
+	if (size < minSize || size < count) {
+		return false;
+	}
+
+	// Existing files go through the usual file exists handling, unless they
+	// are left over from an interrupted segmented download. Then only the
+	// ranges its journal does not list get downloaded.
+	std::wstring const localFile = fileItem.GetLocalPath().GetPath() + fileItem.GetLocalFile();
+	auto const nativeFile = fz::to_native(localFile);
+	CResumeJournal::ranges missing;
+	if (fz::local_filesys::get_file_type(nativeFile) != fz::local_filesys::unknown) {
+		CResumeJournal::ranges done;
+		if (!CResumeJournal::Load(localFile, size, done)) {
+			return false;
+		}
+		missing = CResumeJournal::GetMissing(done, size);
+		if (missing.empty()) {
+			CResumeJournal::Remove(localFile);
+			return false;
+		}
+	}
+	else {
+		CResumeJournal::Remove(localFile);
+
+		// Preallocate the file, each segment then writes its own part of it
+		wxFileName::Mkdir(fileItem.GetLocalPath().GetPath(), 0777, wxPATH_MKDIR_FULL);
+		{
+			fz::file f(nativeFile, fz::file::writing, fz::file::empty);
+			if (!f.opened() || f.seek(size, fz::file::begin) != size || !f.truncate()) {
+				f.close();
+				fz::remove_file(nativeFile);
+				return false;
+			}
+		}
+		missing.emplace_back(0, size);
+	}
+
+	// The segments are spread over the missing ranges by their size
+	int64_t missingSize{};
+	for (auto const& range : missing) {
+		missingSize += range.second - range.first;
+	}
+	std::vector<std::pair<int64_t, int64_t>> parts;
+	for (auto const& range : missing) {
+		int64_t const rangeSize = range.second - range.first;
+		int64_t const n = std::min(rangeSize, std::max(int64_t(1), (rangeSize * count + missingSize / 2) / missingSize));
+		int64_t const partSize = rangeSize / n;
+		for (int64_t i = 0; i < n; ++i) {
+			int64_t const offset = range.first + partSize * i;
+			parts.emplace_back(offset, (i == n - 1) ? (range.second - offset) : partSize);
+		}
+	}
+
+	auto group = std::make_shared<CSegmentGroup>();
+	group->fullSize = size;
+
+	fileItem.SetSegment(group, parts[0].first);
+	UpdateItemSize(&fileItem, parts[0].second);
+
+	std::vector<CFileItem*> segments;
+	for (size_t i = 1; i < parts.size(); ++i) {
+		int64_t const offset = parts[i].first;
+		int64_t const len = parts[i].second;
+
+		auto segment = new CFileItem(&serverItem, fileItem.queued(), true, fileItem.GetSourceFile(),
+			fileItem.GetTargetFile() ? *fileItem.GetTargetFile() : std::wstring(),
+			fileItem.GetLocalPath(), fileItem.GetRemotePath(), len);
+		segment->SetPriorityRaw(fileItem.GetPriority());
+		segment->SetSegment(group, offset);
+		InsertItem(&serverItem, segment);
+		segments.push_back(segment);
+	}
+
+	// Start the segments before any other file
+	for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+		serverItem.MoveToFrontOfList(*it);
+	}
+
+	return true;
+}
+
+bool CQueueView::FinishSegment(CFileItem& item, bool success)
+{
+	CSegmentGroup* group = item.GetSegmentGroup();
+	if (!group) {
+		return true;
+	}
+
+	if (success) {
+		return !group->failed && group->items.size() == 1;
+	}
+	if (group->failed) {
+		return false;
+	}
+
+	// The file is incomplete either way. Retrying it from the failed list
+	// only downloads the ranges the resume journal does not list.
+	group->failed = true;
+	for (auto * other : std::vector<CFileItem*>(group->items)) {
+		if (other != &item && !other->IsActive()) {
+			RemoveItem(other, true);
+		}
+	}
+	return true;
+}
+
+namespace {
+// Files checked at once for existing targets
+size_t const conflict_check_batch = 500;
+
+// The action the async request queue would pick for the file
+CFileExistsNotification::OverwriteAction GetFileExistsAction(CFileItem const& fileItem)
+{
+	CFileExistsNotification::OverwriteAction action = fileItem.m_defaultFileExistsAction;
+	if (action == CFileExistsNotification::unknown) {
+		action = CDefaultFileExistsDlg::GetDefault(fileItem.Download());
+	}
+	if (action == CFileExistsNotification::unknown) {
+		int const option = COptions::Get()->GetOptionVal(fileItem.Download() ? OPTION_FILEEXISTS_DOWNLOAD : OPTION_FILEEXISTS_UPLOAD);
+		if (option <= CFileExistsNotification::unknown || option >= CFileExistsNotification::ACTION_COUNT) {
+			action = CFileExistsNotification::ask;
+		}
+		else {
+			action = static_cast<CFileExistsNotification::OverwriteAction>(option);
+		}
+	}
+	return action;
+}
+}
+
+bool CQueueView::CheckFileConflicts(CServerItem& serverItem, t_EngineData& engineData)
+{
+	// Only files for which the user would get asked
+	std::vector<CFileItem*> downloads;
+	std::vector<CFileItem*> uploads;
+	for (auto * fileItem : serverItem.GetIdleFiles(m_activeMode == 1, conflict_check_batch)) {
+		if (fileItem->conflicts_checked()) {
+			continue;
+		}
+		fileItem->set_conflicts_checked();
+
+		if (fileItem->IsSegment() || fileItem->made_progress() || fileItem->m_edit != CEditHandler::none ||
+			fileItem->m_onetime_action != CFileExistsNotification::unknown)
+		{
+			continue;
+		}
+		if (GetFileExistsAction(*fileItem) != CFileExistsNotification::ask) {
+			continue;
+		}
+
+		if (fileItem->Download()) {
+			if (fz::local_filesys::get_file_type(fz::to_native(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile())) == fz::local_filesys::file) {
+				downloads.push_back(fileItem);
+			}
+		}
+		else {
+			uploads.push_back(fileItem);
+		}
+	}
+
+	// Remote targets are looked up in the directory cache, a single lookup
+	// for all their directories. Files in directories not in the cache get
+	// asked for once started, as before.
+	if (!uploads.empty()) {
+		std::map<CServerPath, size_t> indexes;
+		std::vector<CServerPath> paths;
+		for (auto const* fileItem : uploads) {
+			if (indexes.emplace(fileItem->GetRemotePath(), paths.size()).second) {
+				paths.push_back(fileItem->GetRemotePath());
+			}
+		}
+
+		std::vector<CDirectoryListing> listings;
+		if (!engineData.pEngine || engineData.pEngine->CacheLookupMany(serverItem.GetSite().server, paths, listings) != FZ_REPLY_OK) {
+			listings.clear();
+		}
+
+		auto existing = [&](CFileItem const* fileItem) {
+			if (listings.empty()) {
+				return false;
+			}
+			auto const& listing = listings[indexes[fileItem->GetRemotePath()]];
+			if (listing.path.empty()) {
+				return false;
+			}
+			size_t const index = listing.FindFile_CmpCase(fileItem->GetRemoteFile());
+			return index != std::string::npos && !listing[index].is_dir();
+		};
+		uploads.erase(std::remove_if(uploads.begin(), uploads.end(), [&](CFileItem const* fileItem) { return !existing(fileItem); }), uploads.end());
+	}
+
+	if (downloads.empty() && uploads.empty()) {
+		return false;
+	}
+
+	if (!wxDialogEx::CanShowPopupDialog(m_pMainFrame) || m_pMainFrame->IsIconized()) {
+		return false;
+	}
+
+	int const count = static_cast<int>(downloads.size() + uploads.size());
+	wxString const description = wxString::Format(wxPLURAL("The target of %d file about to be transferred already exists.", "The targets of %d files about to be transferred already exist.", count), count)
+		+ _T("\n") + _("Select the action to take for them. If none is selected, you get asked for each file once it gets transferred.");
+
+	CDefaultFileExistsDlg dlg;
+	if (!dlg.Load(m_pMainFrame, true, description)) {
+		return false;
+	}
+
+	CFileExistsNotification::OverwriteAction downloadAction = CFileExistsNotification::ask;
+	CFileExistsNotification::OverwriteAction uploadAction = CFileExistsNotification::ask;
+	if (!dlg.Run(downloads.empty() ? nullptr : &downloadAction, uploads.empty() ? nullptr : &uploadAction)) {
 		return true;
 	}
 
-	// Max count has been reached
-
-	pEngineData = GetIdleEngine(site, true);
-	if (pEngineData) {
-		// If we got an idle engine connected to this very server, start the
-		// transfer anyhow. Let's not get this connection go to waste.
-		if (pEngineData->lastSite == site && pEngineData->pEngine->IsConnected()) {
-			return true;
+	// The files are idle and no other transfer got started while the dialog
+	// was shown, none of them can have gone away.
+	auto apply = [this](std::vector<CFileItem*> const& files, CFileExistsNotification::OverwriteAction action) {
+		if (action == CFileExistsNotification::unknown || action == CFileExistsNotification::ask) {
+			return;
+		}
+		for (auto * fileItem : files) {
+			fileItem->m_defaultFileExistsAction = action;
+			m_queue_storage.StoreItem(*fileItem);
+		}
+	};
+	apply(downloads, downloadAction);
+	apply(uploads, uploadAction);
+
+	return true;
+}
+
+bool CQueueView::CanBatchUpload(CFileItem const& fileItem) const
+{
+	// The batch is sent in binary mode only
+	if (fileItem.Download() || fileItem.GetType() != QueueItemType::File || fileItem.IsFxp() || fileItem.Ascii() || fileItem.no_batch() ||
+		fileItem.m_edit != CEditHandler::none || fileItem.made_progress() || fileItem.m_errorCount)
+	{
+		return false;
+	}
+
+	int64_t const maxSize = static_cast<int64_t>(COptions::Get()->GetOptionVal(OPTION_UPLOAD_BATCH_MAXSIZE)) * 1024;
+	if (fileItem.GetSize() < 0 || fileItem.GetSize() > maxSize) {
+		return false;
+	}
+
+	// Batched files are overwritten without asking, only batch files for
+	// which asking would not have happened
+	CFileExistsNotification::OverwriteAction action = fileItem.m_defaultFileExistsAction;
+	if (fileItem.m_onetime_action == CFileExistsNotification::overwrite) {
+		action = CFileExistsNotification::overwrite;
+	}
+	if (action == CFileExistsNotification::unknown) {
+		action = CDefaultFileExistsDlg::GetDefault(false);
+	}
+	if (action == CFileExistsNotification::unknown) {
+		action = static_cast<CFileExistsNotification::OverwriteAction>(COptions::Get()->GetOptionVal(OPTION_FILEEXISTS_UPLOAD));
+	}
+	return action == CFileExistsNotification::overwrite;
+}
+
+void CQueueView::CollectUploadBatch(t_EngineData& engineData)
+{
+	int const maxFiles = COptions::Get()->GetOptionVal(OPTION_UPLOAD_BATCH_FILES);
+	if (maxFiles < 2 || !engineData.pItem || !CanBatchUpload(*engineData.pItem)) {
+		return;
+	}
+
+	if (!engineData.lastSite.server.HasFeature(ProtocolFeature::UploadBatch)) {
+		return;
+	}
+
+	CServerItem* pServerItem = static_cast<CServerItem*>(engineData.pItem->GetTopLevelItem());
+	if (!pServerItem) {
+		return;
+	}
+
+	std::vector<CFileItem*> batch{engineData.pItem};
+	while (static_cast<int>(batch.size()) < maxFiles) {
+		// Only the files that would be next anyway, in the same directory
+		CFileItem* item = pServerItem->GetIdleChild(m_activeMode == 1, TransferDirection::upload);
+		if (!item || item->GetRemotePath() != engineData.pItem->GetRemotePath() || !CanBatchUpload(*item)) {
+			break;
+		}
+
+		item->SetActiveInBatch(true);
+		item->m_pEngineData = &engineData;
+		item->SetStatusMessage(CFileItem::Status::transferring);
+		RefreshItem(item);
+		batch.push_back(item);
+	}
+
+	if (batch.size() > 1) {
+		engineData.batch = std::move(batch);
+		engineData.batchResult = 0;
+	}
+}
+
+void CQueueView::ProcessUploadBatchNotification(t_EngineData& engineData, CUploadBatchNotification const& notification)
+{
+	if (notification.index_ >= engineData.batch.size()) {
+		return;
+	}
+
+	CFileItem* item = engineData.batch[notification.index_];
+	if (!item) {
+		return;
+	}
+
+	if (item == engineData.pItem) {
+		// Handled once the whole batch is done
+		engineData.batchResult = notification.succeeded_ ? 1 : -1;
+		return;
+	}
+
+	engineData.batch[notification.index_] = nullptr;
+	if (notification.succeeded_) {
+		ResetBatchItem(*item, ResetReason::success);
+	}
+	else {
+		item->set_no_batch(true);
+		ResetBatchItem(*item, item->pending_remove() ? ResetReason::remove : ResetReason::reset);
+	}
+}
+
+void CQueueView::ResetBatchItem(CFileItem& item, ResetReason reason)
+{
+	wxASSERT(item.IsActive());
+	item.SetActiveInBatch(false);
+	item.m_pEngineData = nullptr;
+
+	CServerItem* pServerItem = static_cast<CServerItem*>(item.GetTopLevelItem());
+
+	if (reason == ResetReason::success) {
+		CQueueViewSuccessful* pQueueViewSuccessful = m_pQueue->GetQueueView_Successful();
+		if (pQueueViewSuccessful->AutoClear()) {
+			RemoveItem(&item, true);
+		}
+		else {
+			Site const site = pServerItem->GetSite();
+
+			RemoveItem(&item, false);
+
+			CServerItem* pNewServerItem = pQueueViewSuccessful->CreateServerItem(site);
+			item.UpdateTime();
+			item.SetParent(pNewServerItem);
+			item.SetStatusMessage(CFileItem::Status::none);
+			pQueueViewSuccessful->InsertItem(pNewServerItem, &item);
+			pQueueViewSuccessful->CommitChanges();
+			pQueueViewSuccessful->LimitHistory();
+		}
+	}
+	else if (reason == ResetReason::remove) {
+		RemoveItem(&item, true);
+	}
+	else {
+		if (!item.queued()) {
+			pServerItem->QueueImmediateFile(&item);
+		}
+		item.SetStatusMessage(CFileItem::Status::none);
+		RefreshItem(&item);
+	}
+}
+
+bool CQueueView::ShouldVerify(t_EngineData const& engineData) const
+{
+	if (!COptions::Get()->GetOptionVal(OPTION_VERIFY_TRANSFERS)) {
+		return false;
+	}
+
+	// Segments do not cover the whole file, for ASCII transfers the contents
+	// differ by design.
+	CFileItem const* item = engineData.pItem;
+	if (!item || item->GetType() != QueueItemType::File || item->IsSegment() || item->IsFxp() || item->Ascii() || engineData.batch.size() > 1) {
+		return false;
+	}
+
+	return CServer::ProtocolHasFeature(engineData.lastSite.server.GetProtocol(), ProtocolFeature::FileHash);
+}
+
+void CQueueView::OnRemoteHash(t_EngineData& engineData, int replyCode)
+{
+	CFileItem* item = engineData.pItem;
+	if (replyCode != FZ_REPLY_OK || !item || engineData.verifyHash.empty() || !CLocalFileHasher::Supported(engineData.verifyAlgorithm)) {
+		// Nothing to compare against, the transfer still succeeded
+		ResetEngine(engineData, ResetReason::success);
+		return;
+	}
+
+	static_cast<CServerItem*>(item->GetTopLevelItem())->m_hashAlgorithm = engineData.verifyAlgorithm;
+
+	engineData.verifyId = ++m_verifyCounter;
+	m_hashWorker->Hash(engineData.verifyId, item->GetLocalPath().GetPath() + item->GetLocalFile(), engineData.verifyAlgorithm);
+}
+
+void CQueueView::OnLocalHash(uint64_t id, std::string const& hash)
+{
+	for (auto * engineData : m_engineData) {
+		if (!engineData->active || engineData->state != t_EngineData::verify || engineData->verifyId != id) {
+			continue;
+		}
+
+		engineData->verifyId = 0;
+		if (!hash.empty() && fz::str_tolower_ascii(hash) != fz::str_tolower_ascii(engineData->verifyHash)) {
+			engineData->pItem->SetStatusMessage(CFileItem::Status::verification_failed);
+			ResetEngine(*engineData, ResetReason::failure);
+		}
+		else {
+			ResetEngine(*engineData, ResetReason::success);
+		}
+		return;
+	}
+}
+
+bool CQueueView::SkipVerification(t_EngineData& engineData)
+{
+	if (engineData.state != t_EngineData::verify || !engineData.verifyId) {
+		return false;
+	}
+
+	engineData.verifyId = 0;
+	ResetEngine(engineData, ResetReason::success);
+	return true;
+}
+
+void CQueueView::StartFxp(t_EngineData& target)
+{
+	CFxpItem & item = static_cast<CFxpItem&>(*target.pItem);
+	Site const& site = item.GetSourceSite();
+
+	// The source engine works for the transfer of the target engine. Being
+	// a connection of its own, it counts against the number of transfers,
+	// which also bounds the number of engines created for it.
+	t_EngineData* source = GetIdleEngine(site);
+	if (!source) {
+		source = new t_EngineData;
+		source->pEngine = new CFileZillaEngine(m_pMainFrame->GetEngineContext(), *this);
+		m_engineData.push_back(source);
+	}
+
+	source->active = true;
+	source->state = t_EngineData::fxpsource;
+	delete source->m_idleDisconnectTimer;
+	source->m_idleDisconnectTimer = 0;
+	m_activeCount++;
+
+	source->fxpPartner = &target;
+	target.fxpPartner = source;
+	source->fxpBusy = false;
+	target.fxpBusy = false;
+	source->fxpReply = -1;
+	target.fxpReply = -1;
+	target.fxpCanceled = false;
+	source->fxpDeadline = fz::monotonic_clock();
+	target.fxpDeadline = fz::monotonic_clock();
+	source->fxpTimedOut = false;
+	target.fxpTimedOut = false;
+
+	if (!source->pEngine->IsConnected()) {
+		source->fxpStep = t_EngineData::fxp_connect;
+	}
+	else if (source->lastSite != site) {
+		source->fxpStep = t_EngineData::fxp_disconnect;
+	}
+	else {
+		source->fxpStep = t_EngineData::fxp_transfer;
+	}
+	source->lastSite = site;
+
+	SendNextFxpCommand(*source);
+}
+
+void CQueueView::SendNextFxpCommand(t_EngineData& source)
+{
+	t_EngineData & target = *source.fxpPartner;
+	CFxpItem & item = static_cast<CFxpItem&>(*target.pItem);
+
+	switch (source.fxpStep) {
+	case t_EngineData::fxp_disconnect:
+		ExecuteFxp(source, CDisconnectCommand());
+		break;
+	case t_EngineData::fxp_connect:
+		ExecuteFxp(source, CConnectCommand(source.lastSite.server, source.lastSite.Handle(), source.lastSite.credentials, false));
+		break;
+	case t_EngineData::fxp_transfer:
+		if (item.m_relay) {
+			// Without an item the source engine cannot ask about overwriting,
+			// each attempt downloads the whole file again.
+			if (wxFileName::FileExists(item.m_relayFile)) {
+				wxRemoveFile(item.m_relayFile);
+			}
+			CFileTransferCommand::t_transferSettings transferSettings;
+			transferSettings.binary = !item.Ascii();
+			ExecuteFxp(source, CFileTransferCommand(item.m_relayFile, item.GetSourcePath(), item.GetSourceFile(), true, transferSettings));
+		}
+		else {
+			// The target goes first, the source gets told the address the
+			// target listens on.
+			source.fxpStep = t_EngineData::fxp_wait;
+			ExecuteFxp(target, CFxpCommand(item.GetRemotePath(), item.GetRemoteFile(), true, !item.Ascii()));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void CQueueView::ExecuteFxp(t_EngineData& engineData, CCommand const& command)
+{
+	int res = engineData.pEngine->Execute(command);
+	wxASSERT((res & FZ_REPLY_BUSY) != FZ_REPLY_BUSY);
+	if (res == FZ_REPLY_WOULDBLOCK) {
+		engineData.fxpBusy = true;
+	}
+	else {
+		OnFxpReply(engineData, res);
+	}
+}
+
+void CQueueView::OnFxpAddress(t_EngineData& target, std::wstring const& address)
+{
+	t_EngineData & source = *target.fxpPartner;
+	if (source.fxpStep != t_EngineData::fxp_wait || source.fxpReply != -1) {
+		return;
+	}
+
+	CFxpItem & item = static_cast<CFxpItem&>(*target.pItem);
+	source.fxpStep = t_EngineData::fxp_transfer;
+	ExecuteFxp(source, CFxpCommand(item.GetSourcePath(), item.GetSourceFile(), false, !item.Ascii(), address));
+}
+
+void CQueueView::OnFxpReply(t_EngineData& engineData, int replyCode)
+{
+	engineData.fxpBusy = false;
+
+	t_EngineData & partner = *engineData.fxpPartner;
+	bool const isSource = engineData.state == t_EngineData::fxpsource;
+
+	if (isSource && engineData.fxpStep == t_EngineData::fxp_disconnect) {
+		engineData.fxpStep = t_EngineData::fxp_connect;
+		SendNextFxpCommand(engineData);
+		return;
+	}
+	if (isSource && engineData.fxpStep == t_EngineData::fxp_connect) {
+		if (replyCode == FZ_REPLY_ALREADYCONNECTED) {
+			engineData.fxpStep = t_EngineData::fxp_disconnect;
+			SendNextFxpCommand(engineData);
+			return;
+		}
+		if (replyCode == FZ_REPLY_OK) {
+			engineData.fxpStep = t_EngineData::fxp_transfer;
+			SendNextFxpCommand(engineData);
+			return;
+		}
+		if (replyCode & FZ_REPLY_PASSWORDFAILED) {
+			CLoginManager::Get().CachedPasswordFailed(engineData.lastSite.server);
+		}
+	}
+
+	if (engineData.fxpTimedOut && (replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED) {
+		replyCode = FZ_REPLY_TIMEOUT;
+	}
+	engineData.fxpDeadline = fz::monotonic_clock();
+	engineData.fxpTimedOut = false;
+
+	engineData.fxpReply = replyCode;
+	if (partner.fxpReply == -1) {
+		if (partner.fxpBusy) {
+			// Wait for the partner, no point in it going on alone
+			if (replyCode != FZ_REPLY_OK) {
+				partner.pEngine->Cancel();
+			}
+			else {
+				// The control connection of the partner is silent during the
+				// transfer, it is not timed out by its engine.
+				int const timeout = COptions::Get()->GetOptionVal(OPTION_TIMEOUT);
+				if (timeout > 0) {
+					partner.fxpDeadline = fz::monotonic_clock::now() + fz::duration::from_seconds(timeout);
+					if (!m_fxp_timer.IsRunning()) {
+						m_fxp_timer.Start(1000);
+					}
+				}
+			}
+			return;
+		}
+		partner.fxpReply = (replyCode == FZ_REPLY_OK) ? FZ_REPLY_OK : FZ_REPLY_CANCELED;
+	}
+
+	FinishFxp(isSource ? partner : engineData);
+}
+
+void CQueueView::FinishFxp(t_EngineData& target)
+{
+	t_EngineData & source = *target.fxpPartner;
+
+	int const targetReply = target.fxpReply;
+	int const sourceReply = source.fxpReply;
+	bool const canceled = target.fxpCanceled;
+
+	target.fxpPartner = nullptr;
+	source.fxpPartner = nullptr;
+	target.fxpReply = -1;
+	source.fxpReply = -1;
+	target.fxpCanceled = false;
+
+	// Stays connected for the next file from that server
+	ResetEngine(source, ResetReason::remove);
+
+	CFxpItem & item = static_cast<CFxpItem&>(*target.pItem);
+	if (canceled || item.pending_remove() || !m_activeMode) {
+		item.SetStatusMessage(CFileItem::Status::interrupted);
+		ResetEngine(target, item.pending_remove() ? ResetReason::remove : ResetReason::reset);
+		return;
+	}
+
+	if (targetReply == FZ_REPLY_OK && sourceReply == FZ_REPLY_OK) {
+		if (!item.m_relay) {
+			ResetEngine(target, ResetReason::success);
+		}
+		else {
+			// Continues with the upload of the relay file
+			item.m_relayDownloaded = true;
+			SendNextCommand(target);
+		}
+		return;
+	}
+
+	if (!item.m_relay &&
+		((targetReply & FZ_REPLY_NOTSUPPORTED) == FZ_REPLY_NOTSUPPORTED || (sourceReply & FZ_REPLY_NOTSUPPORTED) == FZ_REPLY_NOTSUPPORTED))
+	{
+		// Either server refused, go through a local file instead. Does not
+		// count as an error.
+		wxString const relayFile = wxFileName::CreateTempFileName(wxFileName::GetTempDir() + wxFileName::GetPathSeparator() + _T("fzfxp"));
+		if (!relayFile.empty()) {
+			item.m_relay = true;
+			item.m_relayFile = relayFile.ToStdWstring();
+			SendNextCommand(target);
+			return;
 		}
 	}
 
-	if (!browsingStateOnSameServer || active_count > 1) {
-		return false;
+	// Report whatever did not merely get cancelled because of the other side
+	int const replyCode = (targetReply != FZ_REPLY_OK && (targetReply & FZ_REPLY_CANCELED) != FZ_REPLY_CANCELED) ? targetReply : sourceReply;
+	if ((replyCode & FZ_REPLY_TIMEOUT) == FZ_REPLY_TIMEOUT) {
+		item.SetStatusMessage(CFileItem::Status::timeout);
+	}
+	else if (replyCode & FZ_REPLY_DISCONNECTED) {
+		item.SetStatusMessage(CFileItem::Status::disconnected);
+	}
+	else {
+		item.SetStatusMessage(CFileItem::Status::could_not_start);
+	}
+	if (!IncreaseErrorCount(target)) {
+		return;
 	}
 
-	// At this point the following holds:
-	// max_count is limited to 1, only connection to server is held by the browsing connection
-
-	pEngineData = GetEngineData(browsingStateOnSameServer->m_pEngine);
-	if (pEngineData) {
-		wxASSERT(pEngineData->transient);
-		return pEngineData->transient && !pEngineData->active;
+	if (!target.pEngine->IsConnected()) {
+		target.state = t_EngineData::connect;
 	}
+	SendNextCommand(target);
+}
 
-	pEngineData = new t_EngineData;
-	pEngineData->transient = true;
-	pEngineData->state = t_EngineData::waitprimary;
-	pEngineData->pEngine = browsingStateOnSameServer->m_pEngine;
-	m_engineData.push_back(pEngineData);
-	return true;
+void CQueueView::StopFxp(t_EngineData& target)
+{
+	target.fxpCanceled = true;
+	if (target.fxpBusy) {
+		target.pEngine->Cancel();
+	}
+	if (target.fxpPartner->fxpBusy) {
+		target.fxpPartner->pEngine->Cancel();
+	}
 }
 
 bool CQueueView::TryStartNextTransfer()
@@ -629,6 +1545,7 @@ bool CQueueView::TryStartNextTransfer()
 
 	// Find inactive file. Check all servers for
 	// the file with the highest priority
+	auto const scheduling = static_cast<QueueScheduling>(COptions::Get()->GetOptionVal(OPTION_QUEUE_SCHEDULING));
 	for (auto const& currentServerItem : m_serverList) {
 		t_EngineData* pEngineData = 0;
 
@@ -636,7 +1553,7 @@ bool CQueueView::TryStartNextTransfer()
 			continue;
 		}
 
-		CFileItem* newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection);
+		CFileItem* newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection, scheduling);
 
 		while (newFileItem && newFileItem->Download() && newFileItem->GetType() == QueueItemType::Folder) {
 			CLocalPath localPath(newFileItem->GetLocalPath());
@@ -654,7 +1571,7 @@ bool CQueueView::TryStartNextTransfer()
 
 				return true;
 			}
-			newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection);
+			newFileItem = currentServerItem->GetIdleChild(m_activeMode == 1, wantedDirection, scheduling);
 		}
 
 		if (!newFileItem) {
@@ -674,6 +1591,13 @@ bool CQueueView::TryStartNextTransfer()
 		return false;
 	}
 
+	// Unless it is the only transfer, FXP needs room for its source engine as well
+	if (bestMatch.fileItem->IsFxp() && !static_cast<CFxpItem*>(bestMatch.fileItem)->m_relayDownloaded &&
+		m_activeCount && m_activeCount + 2 > COptions::Get()->GetOptionVal(OPTION_NUMTRANSFERS))
+	{
+		return false;
+	}
+
 	// Find idle engine
 	t_EngineData* pEngineData;
 	if (bestMatch.pEngineData) {
@@ -686,6 +1610,16 @@ bool CQueueView::TryStartNextTransfer()
 		}
 	}
 
+	if (!bestMatch.fileItem->conflicts_checked() && CheckFileConflicts(*bestMatch.serverItem, *pEngineData)) {
+		// Start over, the queue may have changed while the user got asked
+		return true;
+	}
+
+	if (SplitIntoSegments(*bestMatch.serverItem, *bestMatch.fileItem)) {
+		// The remaining segments get picked up by the next calls, each on its own engine
+		CommitChanges();
+	}
+
 	// Now we have both inactive engine and file.
 	// Assign the file to the engine.
 
@@ -770,7 +1704,59 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 	// Process reply from the engine
 	int replyCode = notification.nReplyCode;
 
+	if (pEngineData->state == t_EngineData::deletefiles) {
+		// Only report back if the operation is still around
+		for (auto * pState : *CContextManager::Get()->GetAllStates()) {
+			if (pState->GetRemoteRecursiveOperation() == pEngineData->recursiveOwner) {
+				pEngineData->recursiveOwner->ParallelDeleteFinished(pEngineData->recursivePath, std::move(pEngineData->deleteFiles), replyCode);
+				break;
+			}
+		}
+		pEngineData->recursiveOwner = nullptr;
+		pEngineData->recursivePath.clear();
+		pEngineData->deleteFiles.clear();
+		ResetEngine(*pEngineData, ResetReason::remove);
+		return;
+	}
+
+	if (pEngineData->state == t_EngineData::chmodfiles) {
+		for (auto * pState : *CContextManager::Get()->GetAllStates()) {
+			if (pState->GetRemoteRecursiveOperation() == pEngineData->recursiveOwner) {
+				pEngineData->recursiveOwner->ParallelChmodFinished(pEngineData->recursivePath, std::move(pEngineData->chmodFiles), replyCode);
+				break;
+			}
+		}
+		pEngineData->recursiveOwner = nullptr;
+		pEngineData->recursivePath.clear();
+		pEngineData->chmodFiles.clear();
+		ResetEngine(*pEngineData, ResetReason::remove);
+		return;
+	}
+
+	if (pEngineData->state == t_EngineData::fxpsource) {
+		if (pEngineData->fxpPartner) {
+			OnFxpReply(*pEngineData, replyCode);
+		}
+		else {
+			// The transfer got stopped meanwhile
+			pEngineData->fxpBusy = false;
+			ResetEngine(*pEngineData, ResetReason::remove);
+		}
+		return;
+	}
+
+	if (pEngineData->fxpPartner && pEngineData->state == t_EngineData::transfer) {
+		OnFxpReply(*pEngineData, replyCode);
+		return;
+	}
+
 	if ((replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED) {
+		if (pEngineData->state == t_EngineData::verify) {
+			// The transfer itself went through
+			ResetEngine(*pEngineData, ResetReason::success);
+			return;
+		}
+
 		ResetReason reason;
 		if (pEngineData->pItem) {
 			if (pEngineData->pItem->pending_remove()) {
@@ -854,6 +1840,11 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 					return;
 				}
 			}
+			else if (COptions::Get()->GetOptionVal(OPTION_ADAPTIVE_CONCURRENCY)) {
+				// Most likely the server does not accept any more connections
+				auto & serverItem = *static_cast<CServerItem*>(pEngineData->pItem->GetTopLevelItem());
+				serverItem.m_concurrency.Refused(serverItem.m_activeCount - 1);
+			}
 		}
 		break;
 	case t_EngineData::transfer:
@@ -862,9 +1853,31 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 			return;
 		}
 		if (replyCode == FZ_REPLY_OK) {
+			if (!ShouldVerify(*pEngineData)) {
+				ResetEngine(*pEngineData, ResetReason::success);
+				return;
+			}
+
+			// Most likely the server uses the same algorithm as last time, get
+			// the local file hashed while waiting for the server.
+			auto const& algorithm = static_cast<CServerItem*>(pEngineData->pItem->GetTopLevelItem())->m_hashAlgorithm;
+			if (!algorithm.empty()) {
+				m_hashWorker->Hash(0, pEngineData->pItem->GetLocalPath().GetPath() + pEngineData->pItem->GetLocalFile(), algorithm);
+			}
+			pEngineData->state = t_EngineData::verify;
+			break;
+		}
+		if (pEngineData->batchResult > 0) {
+			// Some other file of the batch failed
 			ResetEngine(*pEngineData, ResetReason::success);
 			return;
 		}
+		if (pEngineData->batchResult < 0) {
+			pEngineData->pItem->set_no_batch(true);
+			pEngineData->pItem->SetStatusMessage(CFileItem::Status::none);
+			ResetEngine(*pEngineData, ResetReason::reset);
+			return;
+		}
 		// Increase error count only if item didn't make any progress. This keeps
 		// user interaction at a minimum if connection is unstable.
 
@@ -929,6 +1942,19 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 	case t_EngineData::list:
 		ResetEngine(*pEngineData, ResetReason::remove);
 		return;
+	case t_EngineData::verify:
+		OnRemoteHash(*pEngineData, replyCode);
+		return;
+	case t_EngineData::warmup:
+		if (replyCode != FZ_REPLY_OK) {
+			CServerItem* pServerItem = GetServerItem(pEngineData->lastSite);
+			if (pServerItem) {
+				pServerItem->m_noWarmup = true;
+			}
+		}
+		// Makes the connected engine available to the next transfer
+		ResetEngine(*pEngineData, ResetReason::reset);
+		return;
 	default:
 		return;
 	}
@@ -941,7 +1967,10 @@ void CQueueView::ProcessReply(t_EngineData* pEngineData, COperationNotification
 
 	if (!m_activeMode) {
 		ResetReason reason;
-		if (pEngineData->pItem && pEngineData->pItem->pending_remove()) {
+		if (pEngineData->state == t_EngineData::verify) {
+			reason = ResetReason::success;
+		}
+		else if (pEngineData->pItem && pEngineData->pItem->pending_remove()) {
 			reason = ResetReason::remove;
 		}
 		else {
@@ -960,8 +1989,35 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 		return;
 	}
 
+	if (data.fxpPartner) {
+		// Left without the other side, the source engine goes as well
+		t_EngineData & partner = *data.fxpPartner;
+		data.fxpPartner = nullptr;
+		partner.fxpPartner = nullptr;
+		data.fxpReply = -1;
+		partner.fxpReply = -1;
+		if (partner.state == t_EngineData::fxpsource) {
+			if (partner.fxpBusy) {
+				partner.pEngine->Cancel();
+			}
+			else {
+				ResetEngine(partner, ResetReason::remove);
+			}
+		}
+	}
+
 	m_waitStatusLineUpdate = true;
 
+	// The rest of a batch goes back to the queue, files already done
+	// have been taken care of as soon as the engine reported them.
+	for (size_t i = 1; i < data.batch.size(); ++i) {
+		if (data.batch[i]) {
+			ResetBatchItem(*data.batch[i], data.batch[i]->pending_remove() ? ResetReason::remove : ResetReason::reset);
+		}
+	}
+	data.batch.clear();
+	data.batchResult = 0;
+
 	if (data.pItem) {
 		CServerItem* pServerItem = static_cast<CServerItem*>(data.pItem->GetTopLevelItem());
 		if (pServerItem) {
@@ -978,6 +2034,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 					break;
 				}
 			}
+			UpdateCurrentSpeed();
 			m_allowBackgroundErase = false;
 			data.pStatusLineCtrl->Hide();
 			m_allowBackgroundErase = true;
@@ -1013,6 +2070,10 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 				pFileItem->m_onetime_action = CFileExistsNotification::unknown;
 				pFileItem->set_made_progress(false);
 			}
+
+			if (pFileItem->IsFxp() && reason != ResetReason::reset && reason != ResetReason::retry) {
+				static_cast<CFxpItem*>(pFileItem)->ClearRelay();
+			}
 		}
 
 		wxASSERT(data.pItem->IsActive());
@@ -1033,7 +2094,22 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 			}
 		}
 
-		if (reason == ResetReason::reset) {
+		bool dropSegment{};
+		if (data.pItem->GetType() == QueueItemType::File) {
+			auto & fileItem = *static_cast<CFileItem*>(data.pItem);
+			if (reason == ResetReason::success || reason == ResetReason::failure) {
+				dropSegment = !FinishSegment(fileItem, reason == ResetReason::success);
+			}
+			else if (reason == ResetReason::reset) {
+				// Another segment of the file has already failed
+				dropSegment = fileItem.GetSegmentGroup() && fileItem.GetSegmentGroup()->failed;
+			}
+		}
+
+		if (dropSegment) {
+			RemoveItem(data.pItem, true);
+		}
+		else if (reason == ResetReason::reset) {
 			if (!data.pItem->queued()) {
 				static_cast<CServerItem*>(data.pItem->GetTopLevelItem())->QueueImmediateFile(data.pItem);
 			}
@@ -1046,6 +2122,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 				Site const site = ((CServerItem*)data.pItem->GetTopLevelItem())->GetSite();
 
 				RemoveItem(data.pItem, false);
+				static_cast<CFileItem*>(data.pItem)->LeaveSegmentGroup();
 
 				CQueueViewFailed* pQueueViewFailed = m_pQueue->GetQueueView_Failed();
 				CServerItem* pNewServerItem = pQueueViewFailed->CreateServerItem(site);
@@ -1053,6 +2130,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 				data.pItem->UpdateTime();
 				pQueueViewFailed->InsertItem(pNewServerItem, data.pItem);
 				pQueueViewFailed->CommitChanges();
+				pQueueViewFailed->LimitHistory();
 			}
 		}
 		else if (reason == ResetReason::success) {
@@ -1065,6 +2143,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 					Site const site = ((CServerItem*)data.pItem->GetTopLevelItem())->GetSite();
 
 					RemoveItem(data.pItem, false);
+					static_cast<CFileItem*>(data.pItem)->LeaveSegmentGroup();
 
 					CServerItem* pNewServerItem = pQueueViewSuccessful->CreateServerItem(site);
 					data.pItem->UpdateTime();
@@ -1072,6 +2151,7 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 					data.pItem->SetStatusMessage(CFileItem::Status::none);
 					pQueueViewSuccessful->InsertItem(pNewServerItem, data.pItem);
 					pQueueViewSuccessful->CommitChanges();
+					pQueueViewSuccessful->LimitHistory();
 				}
 			}
 			else {
@@ -1105,6 +2185,9 @@ void CQueueView::ResetEngine(t_EngineData& data, const ResetReason reason)
 	}
 
 	data.state = t_EngineData::none;
+	data.verifyAlgorithm.clear();
+	data.verifyHash.clear();
+	data.verifyId = 0;
 
 	AdvanceQueue();
 
@@ -1135,8 +2218,29 @@ bool CQueueView::RemoveItem(CQueueItem* item, bool destroy, bool updateItemCount
 		}
 	}
 
+	CFileItem* nextSegment{};
+	if (item->GetType() == QueueItemType::File || item->GetType() == QueueItemType::Folder) {
+		CFileItem* pFileItem = static_cast<CFileItem*>(item);
+
+		// The row of a segmented download passes on to the next segment
+		nextSegment = pFileItem->GetNextSegment();
+		if (nextSegment && pFileItem->m_storageId && !nextSegment->m_storageId) {
+			nextSegment->m_storageId = pFileItem->m_storageId;
+			pFileItem->m_storageId = 0;
+		}
+		m_queue_storage.RemoveItem(*pFileItem);
+	}
+	int64_t const serverId = item->GetTopLevelItem()->m_storageId;
+
 	bool didRemoveParent = CQueueViewBase::RemoveItem(item, destroy, updateItemCount, updateSelections, forward);
 
+	if (didRemoveParent && !m_unloadedRows.has(serverId)) {
+		m_queue_storage.RemoveServer(serverId);
+	}
+	else if (nextSegment) {
+		m_queue_storage.StoreItem(*nextSegment);
+	}
+
 	UpdateStatusLinePositions();
 
 	return didRemoveParent;
@@ -1243,10 +2347,43 @@ void CQueueView::SendNextCommand(t_EngineData& engineData)
 			fileItem->SetStatusMessage(CFileItem::Status::transferring);
 			RefreshItem(engineData.pItem);
 
-			CFileTransferCommand::t_transferSettings transferSettings;
-			transferSettings.binary = !fileItem->Ascii();
-			int res = engineData.pEngine->Execute(CFileTransferCommand(fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile(), fileItem->GetRemotePath(),
-												fileItem->GetRemoteFile(), fileItem->Download(), transferSettings));
+			std::wstring localFile = fileItem->GetLocalPath().GetPath() + fileItem->GetLocalFile();
+			if (fileItem->IsFxp()) {
+				CFxpItem & fxpItem = static_cast<CFxpItem&>(*fileItem);
+				if (!fxpItem.m_relayDownloaded) {
+					StartFxp(engineData);
+					return;
+				}
+				localFile = fxpItem.m_relayFile;
+			}
+
+			if (engineData.batch.empty()) {
+				CollectUploadBatch(engineData);
+			}
+			else {
+				// Retrying, leave out the files that are done
+				engineData.batch.erase(std::remove(engineData.batch.begin(), engineData.batch.end(), nullptr), engineData.batch.end());
+				engineData.batchResult = 0;
+			}
+
+			int res;
+			if (engineData.batch.size() > 1) {
+				std::vector<CUploadBatchCommand::file> files;
+				for (auto const* item : engineData.batch) {
+					files.push_back({item->GetLocalPath().GetPath() + item->GetLocalFile(), item->GetRemoteFile()});
+				}
+				res = engineData.pEngine->Execute(CUploadBatchCommand(fileItem->GetRemotePath(), files));
+			}
+			else {
+				CFileTransferCommand::t_transferSettings transferSettings;
+				transferSettings.binary = !fileItem->Ascii();
+				if (fileItem->IsSegment()) {
+					transferSettings.segmentOffset = fileItem->GetSegmentOffset();
+					transferSettings.segmentSize = fileItem->GetSize();
+				}
+				res = engineData.pEngine->Execute(CFileTransferCommand(localFile, fileItem->GetRemotePath(),
+													fileItem->GetRemoteFile(), fileItem->Download(), transferSettings));
+			}
 			wxASSERT((res & FZ_REPLY_BUSY) != FZ_REPLY_BUSY);
 			if (res == FZ_REPLY_WOULDBLOCK) {
 				return;
@@ -1263,6 +2400,22 @@ void CQueueView::SendNextCommand(t_EngineData& engineData)
 			continue;
 		}
 
+		if (engineData.state == t_EngineData::verify) {
+			CFileItem* fileItem = engineData.pItem;
+
+			fileItem->SetStatusMessage(CFileItem::Status::verifying);
+			RefreshItem(engineData.pItem);
+
+			engineData.verifyAlgorithm.clear();
+			engineData.verifyHash.clear();
+			int res = engineData.pEngine->Execute(CFileHashCommand(fileItem->GetRemotePath(), fileItem->GetRemoteFile()));
+			wxASSERT((res & FZ_REPLY_BUSY) != FZ_REPLY_BUSY);
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				OnRemoteHash(engineData, res);
+			}
+			return;
+		}
+
 		if (engineData.state == t_EngineData::mkdir) {
 			CFileItem* fileItem = engineData.pItem;
 
@@ -1342,7 +2495,9 @@ bool CQueueView::SetActive(bool active)
 				if (!pEngineData->pEngine) {
 					continue;
 				}
-				pEngineData->pEngine->Cancel();
+				if (!SkipVerification(*pEngineData)) {
+					pEngineData->pEngine->Cancel();
+				}
 			}
 		}
 
@@ -1400,6 +2555,7 @@ bool CQueueView::Quit()
 	SaveColumnSettings(OPTION_QUEUE_COLUMN_WIDTHS, -1, -1);
 
 	m_resize_timer.Stop();
+	m_concurrency_timer.Stop();
 
 	return true;
 }
@@ -1453,6 +2609,7 @@ bool CQueueView::IncreaseErrorCount(t_EngineData& engineData)
 {
 	++engineData.pItem->m_errorCount;
 	if (engineData.pItem->m_errorCount <= COptions::Get()->GetOptionVal(OPTION_RECONNECTCOUNT)) {
+		m_queue_storage.StoreItem(*engineData.pItem);
 		return true;
 	}
 
@@ -1466,6 +2623,10 @@ void CQueueView::UpdateStatusLinePositions()
 	if (m_waitStatusLineUpdate) {
 		return;
 	}
+	if (m_inEngineBatch) {
+		m_batchUpdateStatusLines = true;
+		return;
+	}
 
 	m_lastTopItem = GetTopItem();
 	int bottomItem = m_lastTopItem + GetCountPerPage();
@@ -1500,6 +2661,68 @@ void CQueueView::UpdateStatusLinePositions()
 	}
 }
 
+void CQueueView::RemoveItems(std::vector<CQueueItem*> const& items, bool destroy)
+{
+	// RemoveItems assumes that the items have already been removed from all engines
+
+	std::unordered_set<CQueueItem*> const removed(items.begin(), items.end());
+	std::map<CQueueItem*, unsigned int> removedPerServer;
+	std::unordered_set<CFileItem*> nextSegments;
+	for (auto * item : items) {
+		CFileItem* pFileItem = static_cast<CFileItem*>(item);
+		if (item->GetType() == QueueItemType::File) {
+			// Update size information
+			int64_t const size = pFileItem->GetSize();
+			if (size < 0) {
+				--m_filesWithUnknownSize;
+				wxASSERT(m_filesWithUnknownSize >= 0);
+			}
+			else if (size > 0) {
+				m_totalQueueSize -= size;
+			}
+		}
+
+		// The row of a segmented download passes on to the next remaining segment
+		CFileItem* nextSegment = pFileItem->GetNextSegment();
+		while (nextSegment && removed.count(nextSegment)) {
+			nextSegment = nextSegment->GetNextSegment();
+		}
+		if (nextSegment) {
+			if (pFileItem->m_storageId && !nextSegment->m_storageId) {
+				nextSegment->m_storageId = pFileItem->m_storageId;
+				pFileItem->m_storageId = 0;
+			}
+			nextSegments.insert(nextSegment);
+		}
+		m_queue_storage.RemoveItem(*pFileItem);
+
+		++removedPerServer[item->GetTopLevelItem()];
+	}
+
+	std::vector<int64_t> removedServers;
+	for (auto const& server : removedPerServer) {
+		if (server.first->GetChildrenCount(false) == server.second) {
+			removedServers.push_back(server.first->m_storageId);
+		}
+	}
+
+	CQueueViewBase::RemoveItems(items, destroy);
+
+	for (auto const serverId : removedServers) {
+		if (!m_unloadedRows.has(serverId)) {
+			m_queue_storage.RemoveServer(serverId);
+		}
+	}
+	for (auto * nextSegment : nextSegments) {
+		if (!removed.count(nextSegment)) {
+			m_queue_storage.StoreItem(*nextSegment);
+		}
+	}
+
+	DisplayQueueSize();
+	UpdateStatusLinePositions();
+}
+
 void CQueueView::CalculateQueueSize()
 {
 	// Collect total queue size
@@ -1535,10 +2758,12 @@ void CQueueView::SaveQueue(bool silent)
 	// just as extra precaution. Better 'save' than sorry.
 	CInterProcessMutex mutex(MUTEX_QUEUE);
 
+	m_journal_timer.Stop();
 	if (!m_queue_storage.SaveQueue(m_serverList) && !silent) {
 		wxString msg = wxString::Format(_("An error occurred saving the transfer queue to \"%s\".\nSome queue items might not have been saved."), m_queue_storage.GetDatabaseFilename());
 		wxMessageBoxEx(msg, _("Error saving queue"), wxICON_ERROR);
 	}
+	m_journal_mutex.reset();
 }
 
 void CQueueView::LoadQueueFromXML()
@@ -1581,12 +2806,31 @@ void CQueueView::LoadQueue()
 
 	LoadQueueFromXML();
 
+	bool const readOnly = COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2;
+
+	// The first instance keeps the database current as its queue changes.
+	// Any other instance leaves the rows alone, they belong to that queue,
+	// and adds its own queue to the database on exit.
+	int journal = -1;
+	if (!readOnly) {
+		m_journal_mutex = std::make_unique<CInterProcessMutex>(MUTEX_QUEUEJOURNAL, false);
+		journal = m_journal_mutex->TryLock();
+		if (journal != 1) {
+			m_journal_mutex.reset();
+		}
+	}
+
 	bool error = false;
 
-	if (!m_queue_storage.BeginTransaction()) {
+	if (!journal) {
+		// Queue is journaled by another instance
+	}
+	else if (!m_queue_storage.BeginTransaction()) {
 		error = true;
 	}
 	else {
+		std::vector<int64_t> emptyServers;
+
 		Site site;
 		int64_t const first_id = m_queue_storage.GetServer(site, true);
 		auto id = first_id;
@@ -1594,16 +2838,38 @@ void CQueueView::LoadQueue()
 			m_insertionStart = -1;
 			m_insertionCount = 0;
 			CServerItem *pServerItem = CreateServerItem(site);
+			if (journal == 1 && !pServerItem->m_storageId) {
+				pServerItem->m_storageId = id;
+			}
 
-			CFileItem* fileItem = 0;
-			int64_t fileId;
-			for (fileId = m_queue_storage.GetFile(&fileItem, id); fileItem; fileId = m_queue_storage.GetFile(&fileItem, 0)) {
-				fileItem->SetParent(pServerItem);
-				fileItem->SetPriority(fileItem->GetPriority());
-				InsertItem(pServerItem, fileItem);
+			bool empty = true;
+			if (journal == 1) {
+				// The rest gets loaded as the queue advances
+				t_unloadedRows rows{site, id, 0};
+				int const read = LoadQueuePage(*pServerItem, rows);
+				if (read < 0) {
+					error = true;
+				}
+				else if (read == queue_page_size) {
+					m_unloadedRows.ranges().push_back(rows);
+				}
+				empty = !read;
 			}
-			if (fileId < 0) {
-				error = true;
+			else {
+				CFileItem* fileItem = 0;
+				int64_t fileId;
+				for (fileId = m_queue_storage.GetFile(&fileItem, id); fileItem; fileId = m_queue_storage.GetFile(&fileItem, 0)) {
+					fileItem->SetParent(pServerItem);
+					fileItem->SetPriority(fileItem->GetPriority());
+					InsertItem(pServerItem, fileItem);
+					empty = false;
+				}
+				if (fileId < 0) {
+					error = true;
+				}
+			}
+			if (empty && (!pServerItem->GetChild(0) || pServerItem->m_storageId != id)) {
+				emptyServers.push_back(id);
 			}
 
 			if (!pServerItem->GetChild(0)) {
@@ -1616,8 +2882,47 @@ void CQueueView::LoadQueue()
 			error = true;
 		}
 
-		if (error || first_id > 0) {
-			if (COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) != 2) {
+		if (journal == 1) {
+			m_queue_storage.StartJournal();
+
+			// Not possible while parts of the queue only exist in the database
+			bool const rewrite = (error || (first_id > 0 && m_serverList.empty())) && m_unloadedRows.empty();
+			if (rewrite) {
+				// Start over with a clean database, also gets rid of rows that could not be read
+				if (!m_queue_storage.Clear()) {
+					error = true;
+				}
+				for (auto * serverItem : m_serverList) {
+					serverItem->m_storageId = 0;
+					auto const& children = serverItem->GetChildren();
+					for (auto it = children.begin() + serverItem->GetRemovedAtFront(); it != children.end(); ++it) {
+						(*it)->m_storageId = 0;
+					}
+				}
+			}
+			else {
+				for (auto const& emptyId : emptyServers) {
+					m_queue_storage.RemoveServer(emptyId);
+				}
+			}
+
+			// Items imported from queue.xml, or all of them after starting over
+			for (auto * serverItem : m_serverList) {
+				m_queue_storage.StoreChildren(*serverItem, true);
+			}
+
+			if (!m_queue_storage.EndTransaction()) {
+				error = true;
+			}
+
+			if (rewrite && !m_queue_storage.Vacuum()) {
+				error = true;
+			}
+
+			m_journal_timer.Start(1000);
+		}
+		else if (error || first_id > 0) {
+			if (!readOnly) {
 				if (!m_queue_storage.Clear()) {
 					error = true;
 				}
@@ -1649,6 +2954,113 @@ void CQueueView::LoadQueue()
 	}
 }
 
+int CQueueView::LoadQueuePage(CServerItem& serverItem, t_unloadedRows & rows)
+{
+	// Items that never left memory must not be loaded a second time
+	std::unordered_set<int64_t> loaded;
+	auto const& children = serverItem.GetChildren();
+	for (auto it = children.begin() + serverItem.GetRemovedAtFront(); it != children.end(); ++it) {
+		if ((*it)->GetType() == QueueItemType::File || (*it)->GetType() == QueueItemType::Folder) {
+			int64_t const id = static_cast<CFileItem*>(*it)->m_storageId;
+			if (id > rows.after) {
+				loaded.insert(id);
+			}
+		}
+	}
+
+	std::vector<std::pair<int64_t, CFileItem*>> files;
+	int const read = m_queue_storage.GetFiles(files, rows.serverId, rows.after, queue_page_size);
+	drop_loaded_rows(files, loaded);
+	for (auto const& file : files) {
+		CFileItem* fileItem = file.second;
+		fileItem->SetParent(&serverItem);
+		fileItem->SetPriority(fileItem->GetPriority());
+		fileItem->m_storageId = file.first;
+		InsertItem(&serverItem, fileItem);
+	}
+
+	return read;
+}
+
+void CQueueView::LoadQueuePages()
+{
+	// Loaded items need to go in one insertion range per server
+	if (m_unloadedRows.empty() || m_insertionStart != -1 || !m_queue_storage.Journaling()) {
+		return;
+	}
+
+	auto & ranges = m_unloadedRows.ranges();
+	for (auto it = ranges.begin(); it != ranges.end(); ) {
+		CServerItem* pServerItem = GetServerItem(it->site);
+		if (pServerItem && pServerItem->GetChildrenCount(false) >= queue_page_size / 2) {
+			++it;
+			continue;
+		}
+
+		bool const created = !pServerItem;
+		pServerItem = CreateServerItem(it->site);
+		if (!pServerItem->m_storageId) {
+			pServerItem->m_storageId = it->serverId;
+		}
+
+		int const read = LoadQueuePage(*pServerItem, *it);
+
+		if (created && !pServerItem->GetChild(0)) {
+			m_itemCount--;
+			m_serverList.pop_back();
+			delete pServerItem;
+			m_insertionStart = -1;
+			m_insertionCount = 0;
+		}
+		CommitChanges();
+
+		if (read != queue_page_size) {
+			it = ranges.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void CQueueView::RemoveUnloadedRows(CServerItem const& serverItem)
+{
+	for (auto const& rows : m_unloadedRows.take_site(serverItem.GetSite())) {
+		m_queue_storage.RemoveFiles(rows.serverId, rows.after);
+
+		// The row of the loaded server item goes once its last child is removed
+		if (rows.serverId != serverItem.m_storageId) {
+			m_queue_storage.RemoveServer(rows.serverId);
+		}
+	}
+}
+
+bool CQueueView::SpillItem(CServerItem& serverItem, CFileItem* pItem)
+{
+	// Files that are to be transferred immediately and edited files have
+	// to stay in memory, so they may get ahead of older unloaded rows.
+	if (!m_queue_storage.Journaling() || !pItem->queued() || pItem->m_edit != CEditHandler::none) {
+		return false;
+	}
+	if (pItem->GetType() != QueueItemType::File && pItem->GetType() != QueueItemType::Folder) {
+		return false;
+	}
+
+	if (!m_unloadedRows.must_spill(serverItem.GetSite(), serverItem.GetChildrenCount(false), 4 * queue_page_size)) {
+		return false;
+	}
+
+	m_queue_storage.StoreItem(*pItem);
+	if (!pItem->m_storageId) {
+		return false;
+	}
+
+	m_unloadedRows.spilled(serverItem.GetSite(), serverItem.m_storageId, pItem->m_storageId);
+
+	delete pItem;
+	return true;
+}
+
 void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 {
 	auto xServer = element.child("Server");
@@ -1705,11 +3117,13 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 					fileItem->SetAscii(!binary);
 					fileItem->SetPriorityRaw(QueuePriority(priority));
 					fileItem->m_errorCount = errorCount;
-					InsertItem(pServerItem, fileItem);
-
 					if (overwrite_action > 0 && overwrite_action < CFileExistsNotification::ACTION_COUNT) {
 						fileItem->m_defaultFileExistsAction = (CFileExistsNotification::OverwriteAction)overwrite_action;
 					}
+
+					if (!SpillItem(*pServerItem, fileItem)) {
+						InsertItem(pServerItem, fileItem);
+					}
 				}
 			}
 			for (auto folder = xServer.child("Folder"); folder; folder = folder.next_sibling("Folder")) {
@@ -1745,7 +3159,9 @@ void CQueueView::ImportQueue(pugi::xml_node element, bool updateSelections)
 				}
 				folderItem->SetPriority(QueuePriority(priority));
 
-				InsertItem(pServerItem, folderItem);
+				if (!SpillItem(*pServerItem, folderItem)) {
+					InsertItem(pServerItem, folderItem);
+				}
 			}
 
 			if (!pServerItem->GetChild(0)) {
@@ -1931,13 +3347,38 @@ void CQueueView::RemoveAll()
 		}
 	}
 
+	if (m_queue_storage.Journaling()) {
+		for (auto const& rows : m_unloadedRows.ranges()) {
+			m_queue_storage.RemoveFiles(rows.serverId, rows.after);
+		}
+
+		// Inactive items get removed. The rows of active items past an
+		// unloaded range are gone as well, they get stored anew below.
+		for (auto * serverItem : m_serverList) {
+			bool const unloaded = m_unloadedRows.has_site(serverItem->GetSite());
+			auto const& children = serverItem->GetChildren();
+			for (auto it = children.begin() + serverItem->GetRemovedAtFront(); it != children.end(); ++it) {
+				if ((*it)->GetType() == QueueItemType::File || (*it)->GetType() == QueueItemType::Folder) {
+					CFileItem* pFileItem = static_cast<CFileItem*>(*it);
+					if (unloaded || !pFileItem->IsActive()) {
+						m_queue_storage.RemoveItem(*pFileItem);
+					}
+				}
+			}
+		}
+		m_unloadedRows.clear();
+	}
+
 	std::vector<CServerItem*> newServerList;
 	m_itemCount = 0;
 	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
 		if ((*iter)->TryRemoveAll()) {
+			m_queue_storage.RemoveServer((*iter)->m_storageId);
 			delete *iter;
 		}
 		else {
+			// Active segments may now be the first remaining ones of their file
+			m_queue_storage.StoreChildren(**iter, true);
 			newServerList.push_back(*iter);
 			m_itemCount += 1 + (*iter)->GetChildrenCount(true);
 		}
@@ -1996,47 +3437,42 @@ void CQueueView::OnRemoveSelected(wxCommandEvent&)
 
 	m_waitStatusLineUpdate = true;
 
-	while (!selectedItems.empty()) {
-		auto selectedItem = selectedItems.front();
-		CQueueItem* pItem = selectedItem.second;
-		selectedItems.pop_front();
-
-		if (pItem->GetType() == QueueItemType::Status) {
-			continue;
+	// Inactive items are removed all at once, active ones once stopped.
+	// Server items get deleted automatically if all children are gone.
+	std::vector<CQueueItem*> inactive;
+	std::vector<CFileItem*> active;
+	auto add = [&](CQueueItem* pItem) {
+		if (pItem->GetType() != QueueItemType::File && pItem->GetType() != QueueItemType::Folder) {
+			return;
 		}
-		else if (pItem->GetType() == QueueItemType::Server) {
-			CServerItem* pServer = (CServerItem*)pItem;
-			StopItem(pServer, false);
-
-			// Server items get deleted automatically if all children are gone
-			continue;
+		CFileItem* pFile = static_cast<CFileItem*>(pItem);
+		if (pFile->IsActive()) {
+			active.push_back(pFile);
 		}
-		else if (pItem->GetType() == QueueItemType::File ||
-				 pItem->GetType() == QueueItemType::Folder)
-		{
-			CFileItem* pFile = (CFileItem*)pItem;
-			if (pFile->IsActive()) {
-				pFile->set_pending_remove(true);
-				StopItem(pFile);
-				continue;
-			}
+		else {
+			inactive.push_back(pFile);
 		}
-
-		CQueueItem* pTopLevelItem = pItem->GetTopLevelItem();
-		if (!pTopLevelItem->GetChild(1)) {
-			// Parent will get deleted
-			// If next selected item is parent, remove it from list
-			if (!selectedItems.empty() && selectedItems.front().second == pTopLevelItem) {
-				selectedItems.pop_front();
+	};
+	for (auto const& selectedItem : selectedItems) {
+		CQueueItem* pItem = selectedItem.second;
+		if (pItem->GetType() == QueueItemType::Server) {
+			CServerItem* pServer = static_cast<CServerItem*>(pItem);
+			RemoveUnloadedRows(*pServer);
+			auto const& children = pServer->GetChildren();
+			for (auto it = children.begin() + pServer->GetRemovedAtFront(); it != children.end(); ++it) {
+				add(*it);
 			}
 		}
+		else {
+			add(pItem);
+		}
+	}
 
-		int topItemIndex = GetItemIndex(pTopLevelItem);
+	RemoveItems(inactive, true);
 
-		// Finding the child position is O(n) in the worst case, making deletion quadratic. However we already know item's displayed position, use it as guide.
-		// Remark: I suppose this could be further improved by using the displayed position directly, but probably isn't worth the effort.
-		bool forward = selectedItem.first < (topItemIndex + static_cast<int>(pTopLevelItem->GetChildrenCount(false)) / 2);
-		RemoveItem(pItem, true, false, false, forward);
+	for (auto * pFile : active) {
+		pFile->set_pending_remove(true);
+		StopItem(pFile);
 	}
 	DisplayNumberQueuedFiles();
 	DisplayQueueSize();
@@ -2070,6 +3506,13 @@ bool CQueueView::StopItem(CFileItem* item)
 		ResetEngine(*item->m_pEngineData, reason);
 		return true;
 	}
+	else if (item->m_pEngineData->fxpPartner) {
+		StopFxp(*item->m_pEngineData);
+		return false;
+	}
+	else if (SkipVerification(*item->m_pEngineData)) {
+		return true;
+	}
 	else {
 		item->m_pEngineData->pEngine->Cancel();
 		return false;
@@ -2078,6 +3521,8 @@ bool CQueueView::StopItem(CFileItem* item)
 
 bool CQueueView::StopItem(CServerItem* pServerItem, bool updateSelections)
 {
+	RemoveUnloadedRows(*pServerItem);
+
 	std::vector<CQueueItem*> const items = pServerItem->GetChildren();
 	int const removedAtFront = pServerItem->GetRemovedAtFront();
 
@@ -2112,8 +3557,13 @@ bool CQueueView::StopItem(CServerItem* pServerItem, bool updateSelections)
 
 void CQueueView::SetDefaultFileExistsAction(CFileExistsNotification::OverwriteAction action, const TransferDirection direction)
 {
-	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter)
+	for (auto iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
 		(*iter)->SetDefaultFileExistsAction(action, direction);
+		m_queue_storage.StoreChildren(**iter);
+	}
+	for (auto const& rows : m_unloadedRows.ranges()) {
+		m_queue_storage.SetFilesExistsAction(rows.serverId, rows.after, action, direction == TransferDirection::download);
+	}
 }
 
 void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
@@ -2215,6 +3665,7 @@ void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
 						break;
 					pFileItem->m_defaultFileExistsAction = uploadAction;
 				}
+				m_queue_storage.StoreItem(*pFileItem);
 			}
 			break;
 		case QueueItemType::Server:
@@ -2224,6 +3675,16 @@ void CQueueView::OnSetDefaultFileExistsAction(wxCommandEvent &)
 					pServerItem->SetDefaultFileExistsAction(downloadAction, TransferDirection::download);
 				if (has_upload)
 					pServerItem->SetDefaultFileExistsAction(uploadAction, TransferDirection::upload);
+				m_queue_storage.StoreChildren(*pServerItem);
+				for (auto const& rows : m_unloadedRows.ranges()) {
+					if (rows.site != pServerItem->GetSite()) {
+						continue;
+					}
+					if (has_download)
+						m_queue_storage.SetFilesExistsAction(rows.serverId, rows.after, downloadAction, true);
+					if (has_upload)
+						m_queue_storage.SetFilesExistsAction(rows.serverId, rows.after, uploadAction, false);
+				}
 			}
 			break;
 		default:
@@ -2279,6 +3740,104 @@ t_EngineData* CQueueView::GetIdleEngine(Site const& site, bool allowTransient)
 }
 
 
+t_EngineData* CQueueView::GetSpareEngine()
+{
+	int transient = 0;
+	for (auto * pEngineData : m_engineData) {
+		if (pEngineData->transient) {
+			++transient;
+		}
+		else if (!pEngineData->active && !pEngineData->pEngine->IsConnected()) {
+			return pEngineData;
+		}
+	}
+
+	const int newEngineCount = COptions::Get()->GetOptionVal(OPTION_NUMTRANSFERS);
+	if (newEngineCount > static_cast<int>(m_engineData.size()) - transient) {
+		t_EngineData* pEngineData = new t_EngineData;
+		pEngineData->pEngine = new CFileZillaEngine(m_pMainFrame->GetEngineContext(), *this);
+		m_engineData.push_back(pEngineData);
+		return pEngineData;
+	}
+
+	return 0;
+}
+
+void CQueueView::WarmUpConnections()
+{
+	int const warm = COptions::Get()->GetOptionVal(OPTION_QUEUE_WARM_CONNECTIONS);
+	if (warm <= 0 || !m_activeMode || m_quit) {
+		return;
+	}
+
+	for (auto * pServerItem : m_serverList) {
+		if (pServerItem->m_noWarmup) {
+			continue;
+		}
+
+		size_t const idle = pServerItem->GetIdleCount(m_activeMode == 1);
+		if (!idle) {
+			continue;
+		}
+		int const target = static_cast<int>(std::min(idle, static_cast<size_t>(warm)));
+
+		Site site = pServerItem->GetSite();
+
+		// Idle engines already connected or connecting to this site
+		int ready = 0;
+		for (auto const* pEngineData : m_engineData) {
+			if (pEngineData->transient || pEngineData->lastSite != site) {
+				continue;
+			}
+			if (pEngineData->active ? pEngineData->state == t_EngineData::warmup : pEngineData->pEngine->IsConnected()) {
+				++ready;
+			}
+		}
+
+		int wanted = target - ready;
+
+		int const max_count = site.server.MaximumMultipleConnections();
+		if (max_count) {
+			int used = pServerItem->m_activeCount + ready;
+			for (auto const* pState : *CContextManager::Get()->GetAllStates()) {
+				if (pState->GetSite() && pState->GetSite().server == site.server) {
+					++used;
+					break;
+				}
+			}
+			wanted = std::min(wanted, max_count - used);
+		}
+		if (wanted <= 0) {
+			continue;
+		}
+
+		// Fills in the stored credentials of the copy used to connect
+		if (!CLoginManager::Get().GetPassword(site, true)) {
+			// Don't prompt for passwords ahead of demand
+			continue;
+		}
+
+		while (wanted-- > 0) {
+			t_EngineData* pEngineData = GetSpareEngine();
+			if (!pEngineData) {
+				return;
+			}
+
+			int res = pEngineData->pEngine->Execute(CConnectCommand(site.server, site.Handle(), site.credentials, false));
+			if (res != FZ_REPLY_WOULDBLOCK) {
+				break;
+			}
+
+			delete pEngineData->m_idleDisconnectTimer;
+			pEngineData->m_idleDisconnectTimer = 0;
+			pEngineData->lastSite = site;
+			pEngineData->active = true;
+			pEngineData->state = t_EngineData::warmup;
+			m_activeCount++;
+		}
+	}
+}
+
 t_EngineData* CQueueView::GetEngineData(CFileZillaEngine const* pEngine)
 {
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
@@ -2363,6 +3922,134 @@ void CQueueView::TryRefreshListings()
 	}
 }
 
+bool CQueueView::PrefetchListing(Site const& site, CServerPath const& path, std::wstring const& subdir, int maxEngines)
+{
+	if (m_quit || !site) {
+		return false;
+	}
+
+	int listing = 0;
+	for (auto const* pEngineData : m_engineData) {
+		if (pEngineData->active && pEngineData->state == t_EngineData::list && pEngineData->lastSite == site) {
+			++listing;
+		}
+	}
+	if (listing >= maxEngines) {
+		return false;
+	}
+
+	t_EngineData* pEngineData = GetIdleEngine(site);
+	if (!pEngineData) {
+		return false;
+	}
+
+	if (!pEngineData->pEngine->IsConnected() || pEngineData->lastSite != site) {
+		return false;
+	}
+
+	CListCommand command(path, subdir, LIST_FLAG_AVOID);
+	int res = pEngineData->pEngine->Execute(command);
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		return false;
+	}
+
+	pEngineData->active = true;
+	pEngineData->state = t_EngineData::list;
+	delete pEngineData->m_idleDisconnectTimer;
+	pEngineData->m_idleDisconnectTimer = 0;
+	m_activeCount++;
+
+	return true;
+}
+
+bool CQueueView::DeleteOnIdleEngine(CRemoteRecursiveOperation & owner, Site const& site, CServerPath const& path, std::vector<std::wstring> const& files, int maxEngines)
+{
+	if (m_quit || !site || files.empty()) {
+		return false;
+	}
+
+	int deleting = 0;
+	for (auto const* pEngineData : m_engineData) {
+		if (pEngineData->active && pEngineData->state == t_EngineData::deletefiles && pEngineData->lastSite == site) {
+			++deleting;
+		}
+	}
+	if (deleting >= maxEngines) {
+		return false;
+	}
+
+	t_EngineData* pEngineData = GetIdleEngine(site);
+	if (!pEngineData) {
+		return false;
+	}
+
+	if (!pEngineData->pEngine->IsConnected() || pEngineData->lastSite != site) {
+		return false;
+	}
+
+	std::vector<std::wstring> commandFiles = files;
+	CDeleteCommand command(path, std::move(commandFiles));
+	int res = pEngineData->pEngine->Execute(command);
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		return false;
+	}
+
+	pEngineData->active = true;
+	pEngineData->state = t_EngineData::deletefiles;
+	pEngineData->recursiveOwner = &owner;
+	pEngineData->recursivePath = path;
+	pEngineData->deleteFiles = files;
+	delete pEngineData->m_idleDisconnectTimer;
+	pEngineData->m_idleDisconnectTimer = 0;
+	m_activeCount++;
+
+	return true;
+}
+
+bool CQueueView::ChmodOnIdleEngine(CRemoteRecursiveOperation & owner, Site const& site, CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> const& files, int maxEngines)
+{
+	if (m_quit || !site || files.empty()) {
+		return false;
+	}
+
+	int changing = 0;
+	for (auto const* pEngineData : m_engineData) {
+		if (pEngineData->active && pEngineData->state == t_EngineData::chmodfiles && pEngineData->lastSite == site) {
+			++changing;
+		}
+	}
+	if (changing >= maxEngines) {
+		return false;
+	}
+
+	t_EngineData* pEngineData = GetIdleEngine(site);
+	if (!pEngineData) {
+		return false;
+	}
+
+	if (!pEngineData->pEngine->IsConnected() || pEngineData->lastSite != site) {
+		return false;
+	}
+
+	std::vector<std::pair<std::wstring, std::wstring>> commandFiles = files;
+	CChmodCommand command(path, std::move(commandFiles));
+	int res = pEngineData->pEngine->Execute(command);
+	if (res != FZ_REPLY_WOULDBLOCK) {
+		return false;
+	}
+
+	pEngineData->active = true;
+	pEngineData->state = t_EngineData::chmodfiles;
+	pEngineData->recursiveOwner = &owner;
+	pEngineData->recursivePath = path;
+	pEngineData->chmodFiles = files;
+	delete pEngineData->m_idleDisconnectTimer;
+	pEngineData->m_idleDisconnectTimer = 0;
+	m_activeCount++;
+
+	return true;
+}
+
 void CQueueView::OnAskPassword()
 {
 	while (!m_waitingForPassword.empty()) {
@@ -2419,6 +4106,7 @@ void CQueueView::UpdateItemSize(CFileItem* pItem, int64_t size)
 	}
 
 	pItem->SetSize(size);
+	m_queue_storage.StoreItem(*pItem);
 
 	DisplayQueueSize();
 }
@@ -2431,15 +4119,37 @@ void CQueueView::AdvanceQueue(bool refresh)
 	}
 
 	insideAdvanceQueue = true;
+
+	LoadQueuePages();
+
 	while (TryStartNextTransfer()) {
 	}
 
-	// Set timer for connected, idle engines
+	WarmUpConnections();
+
+	if (m_activeCount && !m_concurrency_timer.IsRunning() && COptions::Get()->GetOptionVal(OPTION_ADAPTIVE_CONCURRENCY)) {
+		m_concurrency_timer.Start(5000);
+	}
+
+	// Set timer for connected, idle engines, except for those kept
+	// warm for sites with pending files.
+	int const warm = m_activeMode ? COptions::Get()->GetOptionVal(OPTION_QUEUE_WARM_CONNECTIONS) : 0;
+	std::map<CServerItem const*, int> kept;
 	for (unsigned int i = 0; i < m_engineData.size(); ++i) {
 		if (m_engineData[i]->active || m_engineData[i]->transient) {
 			continue;
 		}
 
+		if (warm > 0 && m_engineData[i]->pEngine->IsConnected()) {
+			CServerItem const* pServerItem = GetServerItem(m_engineData[i]->lastSite);
+			if (pServerItem && pServerItem->GetIdleCount(m_activeMode == 1) && kept[pServerItem] < warm) {
+				++kept[pServerItem];
+				delete m_engineData[i]->m_idleDisconnectTimer;
+				m_engineData[i]->m_idleDisconnectTimer = 0;
+				continue;
+			}
+		}
+
 		if (m_engineData[i]->m_idleDisconnectTimer) {
 			if (m_engineData[i]->pEngine->IsConnected()) {
 				continue;
@@ -2459,7 +4169,12 @@ void CQueueView::AdvanceQueue(bool refresh)
 	}
 
 	if (refresh) {
-		RefreshListOnly(false);
+		if (m_inEngineBatch) {
+			m_batchRefreshList = true;
+		}
+		else {
+			RefreshListOnly(false);
+		}
 	}
 
 	insideAdvanceQueue = false;
@@ -2471,6 +4186,10 @@ void CQueueView::InsertItem(CServerItem* pServerItem, CQueueItem* pItem)
 {
 	CQueueViewBase::InsertItem(pServerItem, pItem);
 
+	if ((pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) && !pItem->m_storageId) {
+		m_queue_storage.StoreItem(*static_cast<CFileItem*>(pItem));
+	}
+
 	if (pItem->GetType() == QueueItemType::File) {
 		CFileItem* pFileItem = (CFileItem*)pItem;
 
@@ -2509,6 +4228,27 @@ void CQueueView::OnTimer(wxTimerEvent& event)
 		return;
 	}
 
+	if (id == m_transferStatusTimer.GetId()) {
+		UpdateTransferStatus();
+		return;
+	}
+
+	if (id == m_concurrency_timer.GetId()) {
+		UpdateConcurrency();
+		return;
+	}
+
+	if (id == m_journal_timer.GetId()) {
+		LoadQueuePages();
+		m_queue_storage.Flush();
+		return;
+	}
+
+	if (id == m_fxp_timer.GetId()) {
+		CheckFxpDeadlines();
+		return;
+	}
+
 	for (auto & pData : m_engineData) {
 		if (pData->m_idleDisconnectTimer && !pData->m_idleDisconnectTimer->IsRunning()) {
 			delete pData->m_idleDisconnectTimer;
@@ -2523,6 +4263,59 @@ void CQueueView::OnTimer(wxTimerEvent& event)
 	event.Skip();
 }
 
+void CQueueView::CheckFxpDeadlines()
+{
+	bool waiting{};
+	auto const now = fz::monotonic_clock::now();
+	for (auto & pData : m_engineData) {
+		if (!pData->fxpDeadline || !pData->fxpBusy || pData->fxpTimedOut) {
+			continue;
+		}
+		if (now < pData->fxpDeadline) {
+			waiting = true;
+			continue;
+		}
+		pData->fxpTimedOut = true;
+		pData->pEngine->Cancel();
+	}
+
+	if (!waiting) {
+		m_fxp_timer.Stop();
+	}
+}
+
+void CQueueView::UpdateConcurrency()
+{
+	if (!m_activeCount || !COptions::Get()->GetOptionVal(OPTION_ADAPTIVE_CONCURRENCY)) {
+		m_concurrency_timer.Stop();
+		return;
+	}
+
+	std::map<CQueueItem const*, int64_t> throughput;
+	for (auto pCtrl : m_statusLineList) {
+		wxFileOffset const speed = pCtrl->GetMomentarySpeed();
+		if (speed > 0) {
+			throughput[pCtrl->GetItem()->GetTopLevelItem()] += speed;
+		}
+	}
+
+	int const maxTransfers = COptions::Get()->GetOptionVal(OPTION_NUMTRANSFERS);
+
+	bool raised{};
+	for (auto * serverItem : m_serverList) {
+		int max = maxTransfers;
+		int const serverMax = serverItem->GetSite().server.MaximumMultipleConnections();
+		if (serverMax && serverMax < max) {
+			max = serverMax;
+		}
+		raised |= serverItem->m_concurrency.Sample(throughput[serverItem], serverItem->m_activeCount, max);
+	}
+
+	if (raised) {
+		AdvanceQueue(false);
+	}
+}
+
 void CQueueView::DeleteEngines()
 {
 	for (auto & engineData : m_engineData) {
@@ -2563,6 +4356,10 @@ void CQueueView::OnSetPriority(wxCommandEvent& event)
 	}
 
 
+	// Selected files are reprioritized with a single pass over the file
+	// lists of their server.
+	std::map<CServerItem*, std::unordered_set<CQueueItem*>> files;
+
 	CQueueItem* pSkip = 0;
 	long item = -1;
 	while (-1 != (item = GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED))) {
@@ -2581,7 +4378,28 @@ void CQueueView::OnSetPriority(wxCommandEvent& event)
 			pSkip = 0;
 		}
 
-		pItem->SetPriority(priority);
+		if (pItem->GetType() == QueueItemType::Server) {
+			CServerItem* pServerItem = static_cast<CServerItem*>(pItem);
+			pServerItem->SetPriority(priority);
+			m_queue_storage.StoreChildren(*pServerItem);
+			for (auto const& rows : m_unloadedRows.ranges()) {
+				if (rows.site == pServerItem->GetSite()) {
+					m_queue_storage.SetFilesPriority(rows.serverId, rows.after, priority);
+				}
+			}
+		}
+		else if (pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) {
+			if (static_cast<CFileItem*>(pItem)->GetPriority() != priority) {
+				files[static_cast<CServerItem*>(pItem->GetTopLevelItem())].insert(pItem);
+			}
+		}
+	}
+
+	for (auto & server : files) {
+		server.first->SetChildrenPriority(server.second, priority);
+		for (auto * pItem : server.second) {
+			m_queue_storage.StoreItem(*static_cast<CFileItem*>(pItem));
+		}
 	}
 
 	RefreshListOnly();
@@ -2941,6 +4759,7 @@ void CQueueView::RenameFileInTransfer(CFileZillaEngine *pEngine, const wxString&
 	else {
 		pFile->SetTargetFile(newName.ToStdWstring());
 	}
+	m_queue_storage.StoreItem(*pFile);
 
 	RefreshItem(pFile);
 }
@@ -2977,20 +4796,47 @@ wxFileOffset CQueueView::GetCurrentUploadSpeed()
 wxFileOffset CQueueView::GetCurrentSpeed(bool countDownload, bool countUpload)
 {
 	wxFileOffset totalSpeed = 0;
+	if (countDownload) {
+		totalSpeed += m_currentSpeed[0];
+	}
+	if (countUpload) {
+		totalSpeed += m_currentSpeed[1];
+	}
+
+	return totalSpeed;
+}
+
+void CQueueView::StartTransferStatusUpdates()
+{
+	if (!m_transferStatusTimer.IsRunning()) {
+		m_transferStatusTimer.Start(100);
+	}
+}
 
+void CQueueView::UpdateTransferStatus()
+{
+	bool changed = false;
 	for (auto pCtrl : m_statusLineList) {
-		const CFileItem *pItem = pCtrl->GetItem();
-		bool isDownload = pItem->Download();
+		changed |= pCtrl->UpdateTransferStatus();
+	}
+	if (!changed) {
+		// Restarted by the engines once the transfers make progress again
+		m_transferStatusTimer.Stop();
+	}
 
-		if ((isDownload && countDownload) || (!isDownload && countUpload)) {
-			wxFileOffset speed = pCtrl->GetMomentarySpeed();
-			if (speed > 0) {
-				totalSpeed += speed;
-			}
+	UpdateCurrentSpeed();
+}
+
+void CQueueView::UpdateCurrentSpeed()
+{
+	m_currentSpeed[0] = 0;
+	m_currentSpeed[1] = 0;
+	for (auto pCtrl : m_statusLineList) {
+		wxFileOffset const speed = pCtrl->GetMomentarySpeed();
+		if (speed > 0) {
+			m_currentSpeed[pCtrl->GetItem()->Download() ? 0 : 1] += speed;
 		}
 	}
-
-	return totalSpeed;
 }
 
 void CQueueView::ReleaseExclusiveEngineLock(CFileZillaEngine* pEngine)
@@ -3099,6 +4945,7 @@ void CQueueView::OnStateChange(CState*, t_statechange_notifications notification
 			}
 
 			(*it)->GetCredentials().Protect();
+			m_queue_storage.StoreServer(**it);
 			++it;
 		}
 	}
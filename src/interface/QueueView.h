@@ -7,12 +7,16 @@
 #include <libfilezilla_engine.h>
 #include <option_change_event_handler.h>
 
+#include "queue_paging.h"
 #include "queue_storage.h"
 #include "local_recursive_operation.h"
+#include "remote_recursive_operation.h"
 #include "notification.h"
 
 #include <wx/progdlg.h>
 
+#include <libfilezilla/mutex.hpp>
+
 #include <list>
 #include <set>
 
@@ -72,19 +76,72 @@ struct t_EngineData final
 		list,
 		mkdir,
 		askpassword,
-		waitprimary
+		waitprimary,
+		warmup, // Connecting ahead of demand, without an item
+		deletefiles, // On behalf of a recursive delete, without an item
+		chmodfiles, // On behalf of a recursive chmod, without an item
+		verify, // Comparing checksums after a successful transfer
+		fxpsource // Source side of a CFxpItem transferred by fxpPartner
 	} state;
 
 	CFileItem* pItem;
 	Site lastSite;
 	CStatusLineCtrl* pStatusLineCtrl;
 	wxTimer* m_idleDisconnectTimer;
+
+	// Small uploads sent together with pItem, which is always the first.
+	// Entries are cleared as soon as the engine reports their result.
+	std::vector<CFileItem*> batch;
+
+	// Result the engine reported for pItem during a batch: 1 on success,
+	// -1 on failure, 0 if not reported yet
+	int batchResult{};
+
+	// What is being deleted in state deletefiles or changed in state
+	// chmodfiles, and for whom
+	CRemoteRecursiveOperation* recursiveOwner{};
+	CServerPath recursivePath;
+	std::vector<std::wstring> deleteFiles;
+	std::vector<std::pair<std::wstring, std::wstring>> chmodFiles;
+
+	// Remote checksum in state verify. Once it has been received, the
+	// local file is being hashed under verifyId.
+	std::wstring verifyAlgorithm;
+	std::string verifyHash;
+	uint64_t verifyId{};
+
+	// Links the engine transferring a CFxpItem with the one connected to
+	// its source while both are at it.
+	t_EngineData* fxpPartner{};
+
+	// What the source engine is doing
+	enum FxpStep
+	{
+		fxp_disconnect,
+		fxp_connect,
+		fxp_wait, // For the address of the target in direct mode
+		fxp_transfer
+	} fxpStep{fxp_connect};
+
+	// Whether a command of the server-to-server transfer is outstanding,
+	// and its final reply, -1 while not done.
+	bool fxpBusy{};
+	int fxpReply{-1};
+	bool fxpCanceled{};
+
+	// Once the partner has its final reply, this one has to follow by the
+	// deadline or gets cancelled as timed out.
+	fz::monotonic_clock fxpDeadline;
+	bool fxpTimedOut{};
 };
 
 class CMainFrame;
 class CStatusLineCtrl;
 class CAsyncRequestQueue;
+class CLocalHashWorker;
 class CQueue;
+class CInterProcessMutex;
+class CState;
 #if WITH_LIBDBUS
 class CDesktopNotification;
 #elif defined(__WXGTK__) || defined(__WXMSW__)
@@ -124,11 +181,35 @@ public:
 		QueuePriority priority = QueuePriority::normal);
 
 	void QueueFile_Finish(const bool start); // Need to be called after QueueFile
+
+	// Queues a transfer of a file from one server to another, see CFxpItem
+	bool QueueFxp(bool const queueOnly, Site const& sourceSite, CServerPath const& sourcePath, std::wstring const& sourceFile,
+		Site const& targetSite, CServerPath const& targetPath, std::wstring const& targetFile, int64_t size);
 	bool QueueFiles(const bool queueOnly, CLocalPath const& localPath, const CRemoteDataObject& dataObject);
-	bool QueueFiles(const bool queueOnly, Site const& site, CLocalRecursiveOperation::listing const& listing);
+	// If the remote directory is given, files it already contains with the
+	// same size and modification time are not queued.
+	bool QueueFiles(const bool queueOnly, Site const& site, CLocalRecursiveOperation::listing const& listing, CDirectoryListing const* remoteListing = nullptr);
+	bool QueueFiles(const bool queueOnly, Site const& site, CRemoteRecursiveOperation::listing const& listing);
+
+	// Lists a directory on an idle engine already connected to the site,
+	// so that the listing is in the shared directory cache by the time a
+	// recursive operation gets to it. Returns false if maxEngines engines
+	// are already listing on that site or no engine is available.
+	bool PrefetchListing(Site const& site, CServerPath const& path, std::wstring const& subdir, int maxEngines);
+
+	// Deletes files on an idle engine on behalf of a recursive delete, the
+	// result is reported back through CRemoteRecursiveOperation::ParallelDeleteFinished
+	bool DeleteOnIdleEngine(CRemoteRecursiveOperation & owner, Site const& site, CServerPath const& path, std::vector<std::wstring> const& files, int maxEngines);
+
+	// Same for changing permissions on behalf of a recursive chmod, reported
+	// back through CRemoteRecursiveOperation::ParallelChmodFinished
+	bool ChmodOnIdleEngine(CRemoteRecursiveOperation & owner, Site const& site, CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> const& files, int maxEngines);
 
 	bool empty() const;
 	int IsActive() const { return m_activeMode; }
+
+	int GetActiveCount() const { return m_activeCount; }
+	int64_t GetTotalQueueSize() const { return m_totalQueueSize; }
 	bool SetActive(bool active = true);
 	bool Quit();
 
@@ -149,6 +230,11 @@ public:
 
 	void ProcessNotification(CFileZillaEngine* pEngine, std::unique_ptr<CNotification>&& pNotification);
 
+	// Called by the command queue of a browsing connection lent to the
+	// queue if the user wants to use it. Interrupts the transfer, the
+	// engine is released once it has finished.
+	void ReturnBrowsingEngine(CFileZillaEngine* pEngine);
+
 	void RenameFileInTransfer(CFileZillaEngine *pEngine, const wxString& newName, bool local);
 
 	static std::wstring ReplaceInvalidCharacters(std::wstring const& filename, bool includeQuotesAndBreaks = false);
@@ -163,6 +249,10 @@ public:
 
 	std::shared_ptr<CActionAfterBlocker> GetActionAfterBlocker();
 
+	// Called by the status lines if their transfer status may change,
+	// starts polling the status of all running transfers.
+	void StartTransferStatusUpdates();
+
 protected:
 
 #ifdef __WXMSW__
@@ -174,6 +264,24 @@ protected:
 	void AdvanceQueue(bool refresh = true);
 	bool TryStartNextTransfer();
 
+	// Splits a large download into segments transferred on separate engines
+	bool SplitIntoSegments(CServerItem& serverItem, CFileItem& fileItem);
+
+	// A segmented download is only done once all of its segments are.
+	// Returns false if the finished item is to be dropped rather than be
+	// reported as the whole file.
+	bool FinishSegment(CFileItem& item, bool success);
+
+	// Looks for files about to be transferred whose target already exists,
+	// and asks once what to do with all of them instead of each engine
+	// asking once it gets to the file. Returns true if the user got asked.
+	bool CheckFileConflicts(CServerItem& serverItem, t_EngineData& engineData);
+
+	// Adds the small uploads following engineData.pItem to its batch
+	void CollectUploadBatch(t_EngineData& engineData);
+	bool CanBatchUpload(CFileItem const& fileItem) const;
+	void ProcessUploadBatchNotification(t_EngineData& engineData, CUploadBatchNotification const& notification);
+
 	// Called from TryStartNextTransfer(), checks
 	// whether it is allowed to start another transfer on that server item
 	bool CanStartTransfer(const CServerItem& server_item, t_EngineData *&pEngineData);
@@ -191,9 +299,35 @@ protected:
 	};
 
 	void ResetEngine(t_EngineData& data, const ResetReason reason);
+
+	// For the items in a batch besides the engine's own item
+	void ResetBatchItem(CFileItem& item, ResetReason reason);
+
+	// Whether a successfully transferred item gets its checksum verified
+	bool ShouldVerify(t_EngineData const& engineData) const;
+	void OnRemoteHash(t_EngineData& engineData, int replyCode);
+	void OnLocalHash(uint64_t id, std::string const& hash);
+
+	// If waiting for the local hash, the transfer counts as done without
+	// verification. Returns false if the engine still has to be cancelled.
+	bool SkipVerification(t_EngineData& engineData);
+
+	std::unique_ptr<CLocalHashWorker> m_hashWorker;
+	uint64_t m_verifyCounter{};
+
+	// Server-to-server transfers. The engine of the CFxpItem's server gets
+	// an engine for the source server at its side for each attempt.
+	void StartFxp(t_EngineData& target);
+	void SendNextFxpCommand(t_EngineData& source);
+	void ExecuteFxp(t_EngineData& engineData, CCommand const& command);
+	void OnFxpAddress(t_EngineData& target, std::wstring const& address);
+	void OnFxpReply(t_EngineData& engineData, int replyCode);
+	void FinishFxp(t_EngineData& target);
+	void StopFxp(t_EngineData& target);
 	void DeleteEngines();
 
 	virtual bool RemoveItem(CQueueItem* item, bool destroy, bool updateItemCount = true, bool updateSelections = true, bool forward = true) override;
+	virtual void RemoveItems(std::vector<CQueueItem*> const& items, bool destroy) override;
 
 	// Stops processing of given item
 	// Returns true on success, false if it would block
@@ -226,8 +360,17 @@ protected:
 	bool IsOtherEngineConnected(t_EngineData* pEngineData);
 
 	t_EngineData* GetIdleEngine(Site const& site = Site(), bool allowTransient = false);
+
+	// Connects idle engines to sites with more pending files than
+	// running transfers, up to OPTION_QUEUE_WARM_CONNECTIONS per site.
+	void WarmUpConnections();
+	t_EngineData* GetSpareEngine();
 	t_EngineData* GetEngineData(const CFileZillaEngine* pEngine);
 
+	// Returns a transient engine for the browsing connection if it is
+	// idle and connected to the site, see OPTION_QUEUE_LEND_BROWSING_CONNECTION
+	t_EngineData* LendBrowsingEngine(CState& state, Site const& site);
+
 	std::vector<t_EngineData*> m_engineData;
 	std::list<CStatusLineCtrl*> m_statusLineList;
 
@@ -273,6 +416,15 @@ protected:
 
 	wxTimer m_resize_timer;
 
+	// Samples throughput for adaptive concurrency while transfers are running
+	wxTimer m_concurrency_timer;
+	void UpdateConcurrency();
+
+	// Runs while a half of a server-to-server transfer waits for its final
+	// reply after the other half got its own.
+	wxTimer m_fxp_timer;
+	void CheckFxpDeadlines();
+
 	void ReleaseExclusiveEngineLock(CFileZillaEngine* pEngine);
 
 #if WITH_LIBDBUS
@@ -283,13 +435,57 @@ protected:
 
 	CQueueStorage m_queue_storage;
 
+	// Held while this instance journals its queue to m_queue_storage
+	std::unique_ptr<CInterProcessMutex> m_journal_mutex;
+
+	// Commits the journaled changes in regular intervals
+	wxTimer m_journal_timer;
+
+	// Rows of a journaled queue that are only in the database
+	unloaded_queue_rows<Site> m_unloadedRows;
+	typedef unloaded_queue_rows<Site>::range t_unloadedRows;
+
+	// Returns the number of rows read, -1 on failure. Rows of items that
+	// are still in memory are skipped.
+	int LoadQueuePage(CServerItem& serverItem, t_unloadedRows & rows);
+	void LoadQueuePages();
+
+	// The server's queue is removed, unlike it running empty. Removes its
+	// rows that are only in the database.
+	void RemoveUnloadedRows(CServerItem const& serverItem);
+
+	// Keeps queued files and folders of long server queues only in the
+	// database, as their rows take far less memory than the items. Items
+	// to transfer immediately and edited files are never spilled, they can
+	// run ahead of unloaded rows. Returns true if the item was stored and
+	// deleted.
+	bool SpillItem(CServerItem& serverItem, CFileItem* pItem);
+
 	// Get the current transfer speed.
 	// Unit is byte/s.
 	wxFileOffset GetCurrentSpeed(bool countDownload, bool countUpload);
 
+	// Polls the transfer status of all status lines in one go at a fixed
+	// interval, as long as any of them changes. Also sums up their speeds.
+	wxTimer m_transferStatusTimer;
+	void UpdateTransferStatus();
+	void UpdateCurrentSpeed();
+	wxFileOffset m_currentSpeed[2]{}; // Download and upload
+
 	virtual void OnEngineEvent(CFileZillaEngine* engine) override;
+	void DoOnEngineEvents();
 	void DoOnEngineEvent(CFileZillaEngine* engine);
 
+	// Engines with pending notifications, added to from the engine threads.
+	// All of them are handled in one go, so a burst of finished transfers
+	// starts the next ones right away and the view gets refreshed once
+	// afterwards instead of after each transfer.
+	fz::mutex m_pendingEnginesMutex{false};
+	std::vector<CFileZillaEngine*> m_pendingEngines;
+	bool m_inEngineBatch{};
+	bool m_batchRefreshList{};
+	bool m_batchUpdateStatusLines{};
+
 	void OnAskPassword();
 
 	std::weak_ptr<CActionAfterBlocker> m_actionAfterBlocker;
@@ -294,6 +294,11 @@ protected:
 	CRemoteListView *m_pRemoteListView{};
 };
 
+namespace {
+size_t const fxp_max_targets = 20;
+wxWindowID const ID_FXP_FIRST = wxWindow::NewControlId(fxp_max_targets);
+}
+
 BEGIN_EVENT_TABLE(CRemoteListView, CFileListCtrl<CGenericFileData>)
 	EVT_LIST_ITEM_ACTIVATED(wxID_ANY, CRemoteListView::OnItemActivated)
 	EVT_CONTEXT_MENU(CRemoteListView::OnContextMenu)
@@ -314,6 +319,7 @@ BEGIN_EVENT_TABLE(CRemoteListView, CFileListCtrl<CGenericFileData>)
 	EVT_MENU(XRCID("ID_GETURL"), CRemoteListView::OnMenuGeturl)
 	EVT_MENU(XRCID("ID_GETURL_PASSWORD"), CRemoteListView::OnMenuGeturl)
 	EVT_MENU(XRCID("ID_CONTEXT_REFRESH"), CRemoteListView::OnMenuRefresh)
+	EVT_MENU_RANGE(ID_FXP_FIRST, ID_FXP_FIRST + fxp_max_targets - 1, CRemoteListView::OnMenuFxp)
 END_EVENT_TABLE()
 
 CRemoteListView::CRemoteListView(CView* pParent, CState& state, CQueueView* pQueue)
@@ -322,6 +328,7 @@ CRemoteListView::CRemoteListView(CView* pParent, CState& state, CQueueView* pQue
 	m_parentView(pParent)
 {
 	state.RegisterHandler(this, STATECHANGE_REMOTE_DIR);
+	state.RegisterHandler(this, STATECHANGE_REMOTE_DIR_PARTIAL);
 	state.RegisterHandler(this, STATECHANGE_APPLYFILTER);
 	state.RegisterHandler(this, STATECHANGE_REMOTE_LINKNOTDIR);
 	state.RegisterHandler(this, STATECHANGE_SERVER);
@@ -414,6 +421,7 @@ bool CRemoteListView::IsItemValid(unsigned int item) const
 void CRemoteListView::UpdateDirectoryListing_Added(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
 {
 	size_t const to_add = pDirectoryListing->size() - m_pDirectoryListing->size();
+	UpdateDirectoryListing_Changed(pDirectoryListing);
 	m_pDirectoryListing = pDirectoryListing;
 
 	m_indexMapping[0] = pDirectoryListing->size();
@@ -490,11 +498,119 @@ void CRemoteListView::UpdateDirectoryListing_Added(std::shared_ptr<CDirectoryLis
 	wxASSERT(m_indexMapping.size() <= pDirectoryListing->size() + 1);
 }
 
+void CRemoteListView::AppendDirectoryEntries(CDirectoryListingProgressNotification const* notification)
+{
+	if (!notification) {
+		if (m_incrementalListing) {
+			SetDirectoryListing(m_state.GetRemoteDir());
+		}
+		return;
+	}
+
+	auto const& entries = notification->GetEntries();
+	if (IsComparing() || entries.empty()) {
+		return;
+	}
+
+	if (!m_incrementalListing) {
+		// When refreshing the current directory, keep showing the old
+		// contents until the new listing is complete.
+		if (m_pDirectoryListing && m_pDirectoryListing->path == notification->GetPath()) {
+			return;
+		}
+
+		auto listing = std::make_shared<CDirectoryListing>();
+		listing->path = notification->GetPath();
+		listing->m_flags |= CDirectoryListing::unsure_unknown;
+		SetDirectoryListing(listing);
+		m_incrementalListing = true;
+	}
+	else if (m_pDirectoryListing->path != notification->GetPath()) {
+		return;
+	}
+
+	CancelLabelEdit();
+
+	int focusedItem = -1;
+	std::wstring focused;
+	std::vector<std::wstring> selectedNames;
+	if (GetSelectedItemCount()) {
+		selectedNames = RememberSelectedItems(focused, focusedItem);
+	}
+
+	// The partial listing is owned by this view alone, extend it in place
+	size_t const first = m_pDirectoryListing->size();
+	m_pDirectoryListing->Append(entries);
+
+	m_indexMapping[0] = m_pDirectoryListing->size();
+	size_t const sorted = m_indexMapping.size();
+
+	CGenericFileData last = m_fileData.back();
+	m_fileData.pop_back();
+
+	CFilterManager const& filter = m_state.GetStateFilterManager();
+	std::wstring const path = m_pDirectoryListing->path.GetPath();
+
+	for (size_t i = first; i < m_pDirectoryListing->size(); ++i) {
+		CDirentry const& entry = (*m_pDirectoryListing)[i];
+		CGenericFileData data;
+		if (entry.is_dir()) {
+			data.icon = m_dirIcon;
+#ifndef __WXMSW__
+			if (entry.is_link()) {
+				data.icon += 3;
+			}
+#endif
+		}
+		m_fileData.push_back(data);
+
+		if (filter.FilenameFiltered(entry.name, path, entry.is_dir(), entry.size, false, 0, entry.time)) {
+			continue;
+		}
+
+		if (m_pFilelistStatusBar) {
+			if (entry.is_dir()) {
+				m_pFilelistStatusBar->AddDirectory();
+			}
+			else {
+				m_pFilelistStatusBar->AddFile(entry.size);
+			}
+		}
+
+		m_indexMapping.push_back(i);
+	}
+
+	m_fileData.push_back(last);
+
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->SetHidden(m_pDirectoryListing->size() + 1 - m_indexMapping.size());
+	}
+
+	// Only sort the new items, then merge them into the already sorted ones
+	std::vector<unsigned int>::iterator start = m_indexMapping.begin();
+	if (m_hasParent) {
+		++start;
+	}
+	auto const mid = m_indexMapping.begin() + sorted;
+	std::unique_ptr<CFileListCtrlSortBase> compare = GetSortComparisonObject();
+	std::sort(mid, m_indexMapping.end(), SortPredicate(compare));
+	std::inplace_merge(start, mid, m_indexMapping.end(), SortPredicate(compare));
+
+	SetItemCount(m_indexMapping.size());
+	SetInfoText();
+
+	if (!selectedNames.empty()) {
+		ReselectItems(selectedNames, focused, focusedItem);
+	}
+	RefreshListOnly(false);
+}
+
 void CRemoteListView::UpdateDirectoryListing_Removed(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
 {
 	size_t const countRemoved = m_pDirectoryListing->size() - pDirectoryListing->size();
 	if (!countRemoved) {
-		m_pDirectoryListing = pDirectoryListing;
+		// The unsure flags accumulate, there may have been other changes
+		UpdateDirectoryListing_Changed(pDirectoryListing);
 		return;
 	}
 	wxASSERT(!IsComparing());
@@ -626,6 +742,157 @@ void CRemoteListView::UpdateDirectoryListing_Removed(std::shared_ptr<CDirectoryL
 	SaveSetItemCount(m_indexMapping.size());
 }
 
+void CRemoteListView::UpdateDirectoryListing_Changed(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
+{
+	// Only the entries the old listing has are looked at, appended entries
+	// are up to UpdateDirectoryListing_Added.
+	std::shared_ptr<CDirectoryListing> const oldListing = m_pDirectoryListing;
+	size_t const count = std::min(oldListing->size(), pDirectoryListing->size());
+
+	// Entries that did not change are still shared between the listings
+	std::vector<unsigned int> changed;
+	for (size_t i = 0; i < count; ++i) {
+		if (&(*oldListing)[i] != &(*pDirectoryListing)[i]) {
+			changed.push_back(i);
+		}
+	}
+
+	m_pDirectoryListing = pDirectoryListing;
+	if (changed.empty()) {
+		return;
+	}
+	wxASSERT(!IsComparing());
+
+	enum : unsigned char {
+		mark_changed = 0x1,
+		mark_visible = 0x2,
+		mark_selected = 0x4
+	};
+	std::vector<unsigned char> marks(m_fileData.size());
+	for (auto const i : changed) {
+		marks[i] = mark_changed;
+	}
+
+	// Remember selections by index into the listing, the positions of the items change
+	std::vector<int> selectedItems;
+	if (GetSelectedItemCount()) {
+		int item = -1;
+		while ((item = GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) != -1) {
+			selectedItems.push_back(item);
+			marks[m_indexMapping[item]] |= mark_selected;
+		}
+	}
+	int const focusedItem = GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_FOCUSED);
+	unsigned int focusedIndex{};
+	if (focusedItem >= 0 && static_cast<size_t>(focusedItem) < m_indexMapping.size()) {
+		focusedIndex = m_indexMapping[focusedItem];
+	}
+
+	// Take out the changed entries. The remaining ones are unchanged and stay sorted.
+	std::vector<unsigned int>::iterator start = m_indexMapping.begin();
+	if (m_hasParent) {
+		++start;
+	}
+	m_indexMapping.erase(std::remove_if(start, m_indexMapping.end(), [&marks](unsigned int index) {
+		if (marks[index] & mark_changed) {
+			marks[index] |= mark_visible;
+			return true;
+		}
+		return false;
+	}), m_indexMapping.end());
+
+	CFilterManager const& filter = m_state.GetStateFilterManager();
+	std::wstring const path = m_pDirectoryListing->path.GetPath();
+
+	std::vector<unsigned int> visible;
+	for (auto const i : changed) {
+		CDirentry const& oldEntry = (*oldListing)[i];
+		CDirentry const& entry = (*pDirectoryListing)[i];
+
+		unsigned char const mark = marks[i];
+		if (m_pFilelistStatusBar && (mark & mark_visible)) {
+			if (oldEntry.is_dir()) {
+				if (mark & mark_selected) {
+					m_pFilelistStatusBar->UnselectDirectory();
+				}
+				m_pFilelistStatusBar->RemoveDirectory();
+			}
+			else {
+				if (mark & mark_selected) {
+					m_pFilelistStatusBar->UnselectFile(oldEntry.size);
+				}
+				m_pFilelistStatusBar->RemoveFile(oldEntry.size);
+			}
+		}
+
+		if (filter.FilenameFiltered(entry.name, path, entry.is_dir(), entry.size, false, 0, entry.time)) {
+			continue;
+		}
+		visible.push_back(i);
+
+		if (m_pFilelistStatusBar) {
+			if (entry.is_dir()) {
+				m_pFilelistStatusBar->AddDirectory();
+			}
+			else {
+				m_pFilelistStatusBar->AddFile(entry.size);
+			}
+			if ((mark & (mark_visible | mark_selected)) == (mark_visible | mark_selected)) {
+				if (entry.is_dir()) {
+					m_pFilelistStatusBar->SelectDirectory();
+				}
+				else {
+					m_pFilelistStatusBar->SelectFile(entry.size);
+				}
+			}
+		}
+	}
+
+	// Put the visible ones back at their new positions
+	std::unique_ptr<CFileListCtrlSortBase> compare = GetSortComparisonObject();
+	std::sort(visible.begin(), visible.end(), SortPredicate(compare));
+
+	std::vector<unsigned int> merged;
+	merged.reserve(m_indexMapping.size() + visible.size());
+	start = m_indexMapping.begin();
+	if (m_hasParent) {
+		merged.push_back(*start++);
+	}
+	std::merge(start, m_indexMapping.end(), visible.cbegin(), visible.cend(), std::back_inserter(merged), SortPredicate(compare));
+	m_indexMapping.swap(merged);
+
+	// Move selections and focus along with the entries
+	if (!selectedItems.empty()) {
+		auto selectedIt = selectedItems.cbegin();
+		for (size_t item = 0; item < m_indexMapping.size(); ++item) {
+			bool const wasSelected = selectedIt != selectedItems.cend() && *selectedIt == static_cast<int>(item);
+			if (wasSelected) {
+				++selectedIt;
+			}
+			bool const select = (marks[m_indexMapping[item]] & mark_selected) != 0;
+			if (select != wasSelected) {
+				SetSelection(item, select);
+			}
+		}
+		for (; selectedIt != selectedItems.cend(); ++selectedIt) {
+			SetSelection(*selectedIt, false);
+		}
+	}
+	if (focusedItem >= 0 && (static_cast<size_t>(focusedItem) >= m_indexMapping.size() || m_indexMapping[focusedItem] != focusedIndex)) {
+		SetItemState(focusedItem, 0, wxLIST_STATE_FOCUSED);
+		auto const it = std::find(m_indexMapping.cbegin(), m_indexMapping.cend(), focusedIndex);
+		if (it != m_indexMapping.cend()) {
+			SetItemState(it - m_indexMapping.cbegin(), wxLIST_STATE_FOCUSED, wxLIST_STATE_FOCUSED);
+		}
+	}
+
+	if (m_pFilelistStatusBar) {
+		m_pFilelistStatusBar->SetHidden(m_pDirectoryListing->size() + 1 - m_indexMapping.size());
+	}
+
+	SaveSetItemCount(m_indexMapping.size());
+}
+
 bool CRemoteListView::UpdateDirectoryListing(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
 {
 	assert(!IsComparing());
@@ -641,24 +908,12 @@ bool CRemoteListView::UpdateDirectoryListing(std::shared_ptr<CDirectoryListing>
 	}
 
 	if (!(unsure & ~(CDirectoryListing::unsure_dir_changed | CDirectoryListing::unsure_file_changed))) {
-		if (m_sortColumn != 0 && m_sortColumn != 2) {
-			// If not sorted by file or type, changing file attributes can influence
-			// sort order.
-			return false;
-		}
-
-		if (CFilterManager::HasActiveFilters()) {
-			return false;
-		}
-
 		assert(pDirectoryListing->size() == m_pDirectoryListing->size());
 		if (pDirectoryListing->size() != m_pDirectoryListing->size()) {
 			return false;
 		}
 
-		m_pDirectoryListing = pDirectoryListing;
-
-		// We don't have to do anything
+		UpdateDirectoryListing_Changed(pDirectoryListing);
 		return true;
 	}
 
@@ -679,6 +934,7 @@ bool CRemoteListView::UpdateDirectoryListing(std::shared_ptr<CDirectoryListing>
 void CRemoteListView::SetDirectoryListing(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
 {
 	CancelLabelEdit();
+	m_incrementalListing = false;
 
 	bool reset = false;
 	if (!pDirectoryListing || !m_pDirectoryListing) {
@@ -1262,9 +1518,88 @@ void CRemoteListView::OnContextMenu(wxContextMenuEvent& event)
 
 	menu.Delete(XRCID(wxGetKeyState(WXK_SHIFT) ? "ID_GETURL" : "ID_GETURL_PASSWORD"));
 
+	// Offer the other tabs if files are selected, directories are not
+	// copied between servers.
+	m_fxpTargets.clear();
+	if (m_state.IsRemoteConnected() && m_pDirectoryListing && CServer::ProtocolHasFeature(protocol, ProtocolFeature::ServerToServer)) {
+		bool selectedFile = false;
+		int item = -1;
+		while (!selectedFile && (item = GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) != -1) {
+			int index = GetItemIndex(item);
+			if (item && index != -1 && m_fileData[index].comparison_flags != fill && !(*m_pDirectoryListing)[index].is_dir()) {
+				selectedFile = true;
+			}
+		}
+
+		if (selectedFile) {
+			for (auto * pState : *CContextManager::Get()->GetAllStates()) {
+				if (pState != &m_state && pState->IsRemoteConnected() && !pState->GetRemotePath().empty() &&
+					pState->GetSite().server.HasFeature(ProtocolFeature::ServerToServer) && m_fxpTargets.size() < fxp_max_targets)
+				{
+					m_fxpTargets.push_back(pState);
+				}
+			}
+		}
+	}
+	if (!m_fxpTargets.empty()) {
+		wxMenu* fxpMenu = new wxMenu;
+		for (size_t i = 0; i < m_fxpTargets.size(); ++i) {
+			CState const& state = *m_fxpTargets[i];
+			fxpMenu->Append(ID_FXP_FIRST + static_cast<int>(i), LabelEscape(state.GetSite().Format(ServerFormat::with_optional_port) + L" " + state.GetRemotePath().GetPath()));
+		}
+		menu.Insert(2, wxID_ANY, _("Cop&y to other server"), fxpMenu, _("Transfer the selected files directly to the current directory of another tab"));
+	}
+
 	PopupMenu(&menu);
 }
 
+void CRemoteListView::OnMenuFxp(wxCommandEvent& event)
+{
+	size_t const target = static_cast<size_t>(event.GetId() - ID_FXP_FIRST);
+	if (target >= m_fxpTargets.size() || !m_pDirectoryListing) {
+		return;
+	}
+
+	CState const& targetState = *m_fxpTargets[target];
+	Site const& site = m_state.GetSite();
+	if (!site || !targetState.IsRemoteConnected() || !m_state.IsRemoteConnected()) {
+		wxBell();
+		return;
+	}
+	Site const& targetSite = targetState.GetSite();
+	CServerPath const targetPath = targetState.GetRemotePath();
+
+	bool added = false;
+	long item = -1;
+	for (;;) {
+		item = GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+		if (item == -1) {
+			break;
+		}
+		if (!item) {
+			continue;
+		}
+
+		int index = GetItemIndex(item);
+		if (index == -1 || m_fileData[index].comparison_flags == fill) {
+			continue;
+		}
+
+		CDirentry const& entry = (*m_pDirectoryListing)[index];
+		if (entry.is_dir()) {
+			continue;
+		}
+		if (m_pQueue->QueueFxp(false, site, m_pDirectoryListing->path, entry.name, targetSite, targetPath, std::wstring(), entry.size)) {
+			added = true;
+		}
+	}
+	m_fxpTargets.clear();
+
+	if (added) {
+		m_pQueue->QueueFile_Finish(true);
+	}
+}
+
 void CRemoteListView::OnMenuDownload(wxCommandEvent& event)
 {
 	// Make sure selection is valid
@@ -1869,6 +2204,9 @@ void CRemoteListView::HandleGenericChmod(ChmodUICommand &command)
 	wxASSERT(pRecursiveOperation);
 	recursion_root root(m_pDirectoryListing->path, false);
 
+	// A single command for the whole selection, the engine pipelines it
+	std::vector<std::pair<std::wstring, std::wstring>> files;
+
 	long item = -1;
 	for (;;) {
 		item = GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
@@ -1898,7 +2236,7 @@ void CRemoteListView::HandleGenericChmod(ChmodUICommand &command)
 			bool res = ChmodData::ConvertPermissions(*entry.permissions, newPermissions);
 			std::wstring const newPerms = chmodData->GetPermissions(res ? newPermissions : 0, entry.is_dir());
 
-			m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(m_pDirectoryListing->path, entry.name, newPerms));
+			files.emplace_back(entry.name, newPerms);
 		}
 
 		if (chmodDialog->Recursive() && entry.is_dir()) {
@@ -1906,6 +2244,10 @@ void CRemoteListView::HandleGenericChmod(ChmodUICommand &command)
 		}
 	}
 
+	if (!files.empty()) {
+		m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(m_pDirectoryListing->path, std::move(files)));
+	}
+
 	if (chmodDialog->Recursive()) {
 		chmodDialog.reset();
 		pRecursiveOperation->SetChmodData(std::move(chmodData));
@@ -2181,6 +2523,9 @@ void CRemoteListView::OnStateChange(t_statechange_notifications notification, st
 	if (notification == STATECHANGE_REMOTE_DIR) {
 		SetDirectoryListing(m_state.GetRemoteDir());
 	}
+	else if (notification == STATECHANGE_REMOTE_DIR_PARTIAL) {
+		AppendDirectoryEntries(static_cast<CDirectoryListingProgressNotification const*>(data2));
+	}
 	else if (notification == STATECHANGE_REMOTE_LINKNOTDIR) {
 		wxASSERT(data2);
 		LinkIsNotDir(*(CServerPath*)data2, data);
@@ -2487,8 +2832,6 @@ void CRemoteListView::StartComparison()
 		m_indexMapping.clear();
 	}
 
-	m_comparisonIndex = -1;
-
 	if (m_fileData.empty() || m_fileData.back().comparison_flags != fill) {
 		CGenericFileData data;
 		data.icon = -1;
@@ -2497,32 +2840,35 @@ void CRemoteListView::StartComparison()
 	}
 }
 
-bool CRemoteListView::get_next_file(std::wstring_view & name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date)
+void CRemoteListView::GetComparisonEntries(std::vector<entry> & entries)
 {
-	if (++m_comparisonIndex >= (int)m_originalIndexMapping.size()) {
-		return false;
+	if (m_originalIndexMapping.empty() && (m_sortDirection || m_sortColumn != 0)) {
+		SortList(0, 0);
 	}
 
-	const unsigned int index = m_originalIndexMapping[m_comparisonIndex];
-	if (index >= m_fileData.size()) {
-		return false;
-	}
+	auto const& mapping = m_originalIndexMapping.empty() ? m_indexMapping : m_originalIndexMapping;
+	entries.reserve(entries.size() + mapping.size());
+	for (auto const index : mapping) {
+		if (index >= m_fileData.size()) {
+			break;
+		}
 
-	if (index == m_pDirectoryListing->size()) {
-		name = _T("..");
-		dir = true;
-		size = -1;
-		return true;
-	}
+		auto & e = entries.emplace_back();
+		e.index = index;
 
-	CDirentry const& entry = (*m_pDirectoryListing)[index];
+		if (index == m_pDirectoryListing->size()) {
+			e.name = L"..";
+			e.dir = true;
+			continue;
+		}
 
-	name = entry.name;
-	dir = entry.is_dir();
-	size = entry.size;
-	date = entry.time;
+		CDirentry const& dirent = (*m_pDirectoryListing)[index];
 
-	return true;
+		e.name = dirent.name;
+		e.dir = dirent.is_dir();
+		e.size = dirent.size;
+		e.date = dirent.time;
+	}
 }
 
 void CRemoteListView::FinishComparison()
@@ -2566,6 +2912,19 @@ wxListItemAttr* CRemoteListView::OnGetItemAttr(long item) const
 	}
 }
 
+CGenericFileData const& CRemoteListView::GetCellText(int index)
+{
+	CGenericFileData& data = m_fileData[index];
+	unsigned int const generation = GetListFormatGeneration();
+	if (data.textGeneration != generation) {
+		const CDirentry& entry = (*m_pDirectoryListing)[index];
+		data.sizeText = (entry.is_dir() || entry.size < 0) ? std::wstring() : CSizeFormat::Format(entry.size);
+		data.timeText = CTimeFormat::Format(entry.time).ToStdWstring();
+		data.textGeneration = generation;
+	}
+	return data;
+}
+
 wxString CRemoteListView::GetItemText(int item, unsigned int column)
 {
 	int index = GetItemIndex(item);
@@ -2598,7 +2957,7 @@ wxString CRemoteListView::GetItemText(int item, unsigned int column)
 			return wxString();
 		}
 		else {
-			return CSizeFormat::Format(entry.size);
+			return GetCellText(index).sizeText;
 		}
 	}
 	else if (column == 2) {
@@ -2616,8 +2975,7 @@ wxString CRemoteListView::GetItemText(int item, unsigned int column)
 		return data.fileType;
 	}
 	else if (column == 3) {
-		const CDirentry& entry = (*m_pDirectoryListing)[index];
-		return CTimeFormat::Format(entry.time);
+		return GetCellText(index).timeText;
 	}
 	else if (column == 4) {
 		return *(*m_pDirectoryListing)[index].permissions;
@@ -2630,8 +2988,8 @@ wxString CRemoteListView::GetItemText(int item, unsigned int column)
 
 std::unique_ptr<CFileListCtrlSortBase> CRemoteListView::GetSortComparisonObject()
 {
-	CFileListCtrlSort<CDirectoryListing>::DirSortMode dirSortMode = GetDirSortMode();
-	CFileListCtrlSort<CDirectoryListing>::NameSortMode nameSortMode = GetNameSortMode();
+	CFileListCtrlSortBase::DirSortMode dirSortMode = GetDirSortMode();
+	CFileListCtrlSortBase::NameSortMode nameSortMode = GetNameSortMode();
 
 	CDirectoryListing const& directoryListing = *m_pDirectoryListing;
 	if (!m_sortDirection) {
@@ -21,7 +21,7 @@ public:
 
 	virtual bool CanStartComparison();
 	virtual void StartComparison();
-	virtual bool get_next_file(std::wstring_view & name, std::wstring & path, bool &dir, int64_t &size, fz::datetime& date) override;
+	virtual void GetComparisonEntries(std::vector<entry> & entries) override;
 	virtual void FinishComparison();
 	virtual void OnExitComparisonMode();
 
@@ -43,6 +43,9 @@ public:
 protected:
 	virtual wxString GetItemText(int item, unsigned int column);
 
+	// Fills the formatted size and time of the entry if needed
+	CGenericFileData const& GetCellText(int index);
+
 	// Clears all selections and returns the list of items that were selected
 	std::vector<std::wstring> RememberSelectedItems(std::wstring & focused, int & focusItem);
 
@@ -73,6 +76,12 @@ protected:
 	bool UpdateDirectoryListing(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
 	void UpdateDirectoryListing_Removed(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
 	void UpdateDirectoryListing_Added(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
+	void UpdateDirectoryListing_Changed(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
+
+	// Shows the entries of a listing still being received. Passing null
+	// means the listing got aborted.
+	void AppendDirectoryEntries(CDirectoryListingProgressNotification const* notification);
+	bool m_incrementalListing{};
 
 #ifdef __WXDEBUG__
 	void ValidateIndexMapping();
@@ -85,6 +94,10 @@ protected:
 	// Caller is responsible to check selection is valid!
 	void TransferSelectedFiles(const CLocalPath& local_parent, bool queue_only);
 
+	// Tabs connected to a server the selected files can be copied to
+	// directly, as offered by the last context menu
+	std::vector<CState*> m_fxpTargets;
+
 	void HandleGenericChmod(ChmodUICommand &command);
 
 	// Cache icon for directories, no need to calculate it multiple times
@@ -137,6 +150,7 @@ protected:
 	void OnMenuGeturl(wxCommandEvent& event);
 	void OnMenuRefresh(wxCommandEvent&);
 	void OnMenuNewfile(wxCommandEvent& event);
+	void OnMenuFxp(wxCommandEvent& event);
 };
 
 #endif
@@ -226,6 +226,7 @@ protected:
 
 BEGIN_EVENT_TABLE(CRemoteTreeView, wxTreeCtrlEx)
 EVT_TREE_ITEM_EXPANDING(wxID_ANY, CRemoteTreeView::OnItemExpanding)
+EVT_TREE_DELETE_ITEM(wxID_ANY, CRemoteTreeView::OnItemDeleted)
 EVT_TREE_SEL_CHANGED(wxID_ANY, CRemoteTreeView::OnSelectionChanged)
 EVT_TREE_ITEM_ACTIVATED(wxID_ANY, CRemoteTreeView::OnItemActivated)
 EVT_TREE_BEGIN_DRAG(wxID_ANY, CRemoteTreeView::OnBeginDrag)
@@ -416,6 +417,8 @@ wxTreeItemId CRemoteTreeView::MakeParent(CServerPath path, bool select)
 			}
 		}
 		if (!child) {
+			RemovePendingChild(parent, *iter);
+
 			CDirectoryListing listing;
 
 			if (m_state.m_pEngine->CacheLookup(path, listing) == FZ_REPLY_OK) {
@@ -529,15 +532,25 @@ bool CRemoteTreeView::HasSubdirs(const CDirectoryListing& listing, const CFilter
 	return false;
 }
 
+namespace {
+// Showing a directory adds this many children right away, the rest
+// follows in chunks from the event loop.
+size_t const initial_children = 500;
+size_t const children_chunk = 2000;
+}
+
 void CRemoteTreeView::DisplayItem(wxTreeItemId parent, const CDirectoryListing& listing)
 {
+	m_pendingChildren.erase(parent.GetID());
 	DeleteChildren(parent);
 
 	std::wstring const path = listing.path.GetPath();
 
-	CFilterDialog filter;
+	CFilterManager filter;
 
-	wxTreeItemId last;
+	pending_children pending;
+	pending.parent = parent;
+	pending.path = listing.path;
 	for (size_t i = 0; i < listing.size(); ++i) {
 		auto const& entry = listing[i];
 		if (!entry.is_dir()) {
@@ -548,32 +561,136 @@ void CRemoteTreeView::DisplayItem(wxTreeItemId parent, const CDirectoryListing&
 			continue;
 		}
 
-		std::wstring const& name = entry.name;
-		CServerPath subdir = listing.path;
-		subdir.AddSegment(name);
+		pending.names.push_back(entry.name);
+	}
+	std::sort(pending.names.begin(), pending.names.end(), [&](auto const& lhs, auto const& rhs) { return sortFunction_(lhs, rhs) < 0; });
 
-		CDirectoryListing subListing;
+	AddChildren(pending, initial_children, filter);
+	if (pending.next < pending.names.size()) {
+		m_pendingChildren[parent.GetID()] = std::move(pending);
+		if (!m_pendingScheduled) {
+			m_pendingScheduled = true;
+			CallAfter(&CRemoteTreeView::OnPendingChildren);
+		}
+	}
+}
 
-		if (m_state.m_pEngine->CacheLookup(subdir, subListing) == FZ_REPLY_OK) {
-			wxTreeItemId child = AppendItem(parent, name, 0, 2, 0);
+void CRemoteTreeView::AddChildren(pending_children & pending, size_t count, CFilterManager const& filter)
+{
+	auto const begin = pending.names.cbegin() + pending.next;
+	auto const end = begin + std::min(count, pending.names.size() - pending.next);
+
+	auto const subListings = LookupSubdirs(pending.path, begin, end);
+	for (size_t i = 0; i < subListings.size(); ++i) {
+		std::wstring const& name = *(begin + i);
+		if (!subListings[i].path.empty()) {
+			wxTreeItemId child = AppendItem(pending.parent, name, 0, 2, 0);
 			SetItemImages(child, false);
 
-			if (HasSubdirs(subListing, filter)) {
+			if (HasSubdirs(subListings[i], filter)) {
 				AppendItem(child, L"", -1, -1);
 			}
 		}
 		else {
-			wxTreeItemId child = InsertItem(parent, last, name, 1, 3, 0);
+			wxTreeItemId child = AppendItem(pending.parent, name, 1, 3, 0);
 			SetItemImages(child, true);
 		}
 	}
-	SortChildren(parent);
+	pending.next += subListings.size();
+
+	if (pending.resort && pending.next >= pending.names.size()) {
+		SortChildren(pending.parent);
+	}
+}
+
+void CRemoteTreeView::OnPendingChildren()
+{
+	m_pendingScheduled = false;
+	if (m_pendingChildren.empty()) {
+		return;
+	}
+
+	CFilterManager filter;
+
+	auto it = m_pendingChildren.begin();
+	AddChildren(it->second, children_chunk, filter);
+	if (it->second.next >= it->second.names.size()) {
+		m_pendingChildren.erase(it);
+	}
+
+	if (!m_pendingChildren.empty()) {
+		m_pendingScheduled = true;
+		CallAfter(&CRemoteTreeView::OnPendingChildren);
+	}
+}
+
+void CRemoteTreeView::FlushPendingChildren(wxTreeItemId const& parent)
+{
+	auto it = m_pendingChildren.find(parent.GetID());
+	if (it == m_pendingChildren.end()) {
+		return;
+	}
+
+	CFilterManager filter;
+	AddChildren(it->second, it->second.names.size(), filter);
+	m_pendingChildren.erase(it);
+}
+
+void CRemoteTreeView::RemovePendingChild(wxTreeItemId const& parent, std::wstring const& name)
+{
+	auto it = m_pendingChildren.find(parent.GetID());
+	if (it == m_pendingChildren.end()) {
+		return;
+	}
+
+	auto & pending = it->second;
+	auto pos = std::find(pending.names.begin() + pending.next, pending.names.end(), name);
+	if (pos == pending.names.end()) {
+		return;
+	}
+
+	pending.names.erase(pos);
+	if (pending.next >= pending.names.size()) {
+		m_pendingChildren.erase(it);
+	}
+	else {
+		// The child gets added out of order
+		pending.resort = true;
+	}
+}
+
+std::vector<CDirectoryListing> CRemoteTreeView::LookupSubdirs(CServerPath const& path, std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end)
+{
+	std::vector<CServerPath> paths;
+	paths.reserve(end - begin);
+	for (auto it = begin; it != end; ++it) {
+		paths.push_back(path);
+		paths.back().AddSegment(*it);
+	}
+
+	std::vector<CDirectoryListing> listings;
+	if (m_state.m_pEngine->CacheLookupMany(paths, listings) != FZ_REPLY_OK) {
+		listings.clear();
+		listings.resize(paths.size());
+	}
+	return listings;
+}
+
+void CRemoteTreeView::OnItemDeleted(wxTreeEvent& event)
+{
+	event.Skip();
+	if (!m_pendingChildren.empty()) {
+		m_pendingChildren.erase(event.GetItem().GetID());
+	}
 }
 
 void CRemoteTreeView::RefreshItem(wxTreeItemId parent, const CDirectoryListing& listing, bool will_select_parent)
 {
 	SetItemImages(parent, false);
 
+	// Merging needs all children
+	FlushPendingChildren(parent);
+
 	wxTreeItemIdValue cookie;
 	wxTreeItemId child = GetFirstChild(parent, cookie);
 	if (!child || GetItemText(child).empty()) {
@@ -599,6 +716,8 @@ void CRemoteTreeView::RefreshItem(wxTreeItemId parent, const CDirectoryListing&
 
 	std::sort(dirs.begin(), dirs.end(), [&](auto const& lhs, auto const& rhs) { return sortFunction_(lhs, rhs) < 0; });
 
+	auto const subListings = LookupSubdirs(listing.path, dirs.cbegin(), dirs.cend());
+
 	std::vector<wxTreeItemId> toDelete;
 
 	bool inserted = false;
@@ -614,11 +733,8 @@ void CRemoteTreeView::RefreshItem(wxTreeItemId parent, const CDirectoryListing&
 		int cmp = sortFunction_(std::wstring_view(childName.data(), childName.size()), *iter);
 
 		if (!cmp) {
-			CServerPath childPath = listing.path;
-			childPath.AddSegment(*iter);
-
-			CDirectoryListing subListing;
-			if (m_state.m_pEngine->CacheLookup(childPath, subListing) == FZ_REPLY_OK) {
+			CDirectoryListing const& subListing = subListings[iter - dirs.begin()];
+			if (!subListing.path.empty()) {
 				if (!GetLastChild(child) && HasSubdirs(subListing, filter)) {
 					AppendItem(child, _T(""), -1, -1);
 				}
@@ -644,11 +760,8 @@ void CRemoteTreeView::RefreshItem(wxTreeItemId parent, const CDirectoryListing&
 		}
 		else if (cmp < 0) {
 			// New directory
-			CServerPath childPath = listing.path;
-			childPath.AddSegment(*iter);
-
-			CDirectoryListing subListing;
-			if (m_state.m_pEngine->CacheLookup(childPath, subListing) == FZ_REPLY_OK) {
+			CDirectoryListing const& subListing = subListings[iter - dirs.begin()];
+			if (!subListing.path.empty()) {
 				last = InsertItem(parent, last, *iter, 0, 2, 0);
 				if (last) {
 					SetItemImages(last, false);
@@ -681,11 +794,8 @@ void CRemoteTreeView::RefreshItem(wxTreeItemId parent, const CDirectoryListing&
 		child = GetNextSibling(child);
 	}
 	while (iter != dirs.end()) {
-		CServerPath childPath = listing.path;
-		childPath.AddSegment(*iter);
-
-		CDirectoryListing subListing;
-		if (m_state.m_pEngine->CacheLookup(childPath, subListing) == FZ_REPLY_OK) {
+		CDirectoryListing const& subListing = subListings[iter - dirs.begin()];
+		if (!subListing.path.empty()) {
 			last = InsertItem(parent, last, *iter, 0, 2, 0);
 			if (last) {
 				SetItemImages(last, false);
@@ -7,6 +7,8 @@
 #include "filter.h"
 #include "treectrlex.h"
 
+#include <map>
+
 class CQueueView;
 class CWindowTinter;
 class CRemoteTreeView final : public wxTreeCtrlEx, CSystemImageList, CStateEventHandler, COptionChangeEventHandler
@@ -25,6 +27,29 @@ protected:
 	void DisplayItem(wxTreeItemId parent, const CDirectoryListing& listing);
 	void RefreshItem(wxTreeItemId parent, const CDirectoryListing& listing, bool will_select_parent);
 
+	// Children of large directories are added in chunks from the event
+	// loop, so that expanding them does not block.
+	struct pending_children final
+	{
+		wxTreeItemId parent;
+		CServerPath path;
+		std::vector<std::wstring> names; // Sorted
+		size_t next{};
+		bool resort{};
+	};
+	std::map<void*, pending_children> m_pendingChildren;
+	bool m_pendingScheduled{};
+
+	void AddChildren(pending_children & pending, size_t count, CFilterManager const& filter);
+	void OnPendingChildren();
+	void FlushPendingChildren(wxTreeItemId const& parent);
+
+	// For children that need to be added right away
+	void RemovePendingChild(wxTreeItemId const& parent, std::wstring const& name);
+
+	// Cached listings, if any, of the given subdirectories of path
+	std::vector<CDirectoryListing> LookupSubdirs(CServerPath const& path, std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end);
+
 	void SetItemImages(wxTreeItemId item, bool unknown);
 
 	bool HasSubdirs(const CDirectoryListing& listing, const CFilterManager& filter);
@@ -61,6 +86,7 @@ protected:
 
 	DECLARE_EVENT_TABLE()
 	void OnItemExpanding(wxTreeEvent& event);
+	void OnItemDeleted(wxTreeEvent& event);
 	void OnSelectionChanged(wxTreeEvent& event);
 	void OnItemActivated(wxTreeEvent& event);
 	void OnBeginDrag(wxTreeEvent& event);
@@ -5,11 +5,13 @@
 
 #include <libfilezilla/util.hpp>
 
+#include <wx/clipbrd.h>
 #include <wx/dcclient.h>
 #include <wx/menu.h>
 
-#define MAX_LINECOUNT 1000
-#define LINECOUNT_REMOVAL 10
+#include <algorithm>
+
+#define MAX_LINECOUNT 10000
 
 BEGIN_EVENT_TABLE(CStatusView, wxNavigationEnabled<wxWindow>)
 EVT_SIZE(CStatusView::OnSize)
@@ -17,59 +19,90 @@ EVT_MENU(XRCID("ID_CLEARALL"), CStatusView::OnClear)
 EVT_MENU(XRCID("ID_COPYTOCLIPBOARD"), CStatusView::OnCopy)
 END_EVENT_TABLE()
 
-class CFastTextCtrl final : public wxNavigationEnabled<wxTextCtrl>
+namespace {
+uint64_t const trace_types = logmsg::debug_warning | logmsg::debug_info | logmsg::debug_verbose | logmsg::debug_debug;
+
+struct t_filterCategory
+{
+	char const* id;
+	uint64_t mask;
+};
+
+// Status messages catch everything not covered by the other categories
+t_filterCategory const filterCategories[] = {
+	{ "ID_LOGFILTER_STATUS", ~(uint64_t(logmsg::error) | logmsg::command | logmsg::reply | trace_types | logmsg::listing) },
+	{ "ID_LOGFILTER_ERROR", logmsg::error },
+	{ "ID_LOGFILTER_COMMAND", logmsg::command },
+	{ "ID_LOGFILTER_REPLY", logmsg::reply },
+	{ "ID_LOGFILTER_TRACE", trace_types },
+	{ "ID_LOGFILTER_LISTING", logmsg::listing }
+};
+}
+
+// Virtual list, the status view renders only the lines that are visible
+class CLogListCtrl final : public wxNavigationEnabled<wxListCtrl>
 {
 public:
-	CFastTextCtrl(wxWindow* parent)
+	CLogListCtrl(CStatusView& owner)
+		: owner_(owner)
 	{
-		Create(parent, -1, wxString(), wxDefaultPosition, wxDefaultSize,
-			wxNO_BORDER | wxVSCROLL | wxTE_MULTILINE |
-			wxTE_READONLY | wxTE_RICH | wxTE_RICH2 | wxTE_NOHIDESEL |
-			wxTAB_TRAVERSAL);
+		Create(&owner, -1, wxDefaultPosition, wxDefaultSize,
+			wxNO_BORDER | wxLC_REPORT | wxLC_VIRTUAL | wxLC_NO_HEADER | wxTAB_TRAVERSAL);
 
 		SetBackgroundStyle(wxBG_STYLE_SYSTEM);
 	}
-#ifdef __WXMSW__
-	// wxTextCtrl::Remove is somewhat slow, this is a faster version
-	virtual void Remove(long from, long to)
+
+	virtual wxString OnGetItemText(long item, long column) const override
 	{
-		DoSetSelection(from, to, false);
+		auto const* line = owner_.GetLine(item);
+		if (!line) {
+			return wxString();
+		}
 
-		m_updatesCount = -2; // suppress any update event
-		::SendMessage((HWND)GetHandle(), EM_REPLACESEL, 0, (LPARAM)_T(""));
-	}
+		if (owner_.m_showTimestamps) {
+			if (!column) {
+				if (line->time != owner_.m_lastTime) {
+					owner_.m_lastTime = line->time;
+					owner_.m_lastTimeString = line->time.format(L"%H:%M:%S", fz::datetime::local);
+				}
+				return owner_.m_lastTimeString;
+			}
+			--column;
+		}
 
-	void AppendText(std::wstring const& text, int lineCount, const CHARFORMAT2& cf)
-	{
-		HWND hwnd = (HWND)GetHWND();
+		if (!column) {
+			return owner_.m_attributeCache[line->typeIndex].prefix;
+		}
 
-		CHARRANGE range;
-		range.cpMin = GetLastPosition();
-		range.cpMax = range.cpMin;
-		::SendMessage(hwnd, EM_EXSETSEL, 0, (LPARAM)&range);
-		::SendMessage(hwnd, EM_SETCHARFORMAT, SCF_SELECTION, (LPARAM)&cf);
-		m_updatesCount = -2; // suppress any update event
-		::SendMessage(hwnd, EM_REPLACESEL, 0, reinterpret_cast<LPARAM>(text.c_str()));
-		::SendMessage(hwnd, EM_LINESCROLL, (WPARAM)0, (LPARAM)lineCount);
+		if (owner_.m_rtl) {
+			logmsg::type const messagetype = static_cast<logmsg::type>(1ull << line->typeIndex);
+			if (messagetype == logmsg::command || messagetype == logmsg::reply || messagetype >= logmsg::debug_warning) {
+				// Commands, responses and debug message contain English text,
+				// set LTR reading order for them.
+				wchar_t const LTR_MARK = 0x200e;
+				wchar_t const LTR_EMBED = 0x202A;
+				std::wstring ret;
+				ret.reserve(line->message.size() + 2);
+				ret += LTR_MARK;
+				ret += LTR_EMBED;
+				ret += line->message;
+				return ret;
+			}
+		}
+		return line->message;
 	}
-#endif
 
-#ifndef __WXMAC__
-	void SetDefaultColor(const wxColour& color)
+	virtual wxListItemAttr* OnGetItemAttr(long item) const override
 	{
-		m_defaultStyle.SetTextColour(color);
+		auto const* line = owner_.GetLine(item);
+		if (!line) {
+			return nullptr;
+		}
+		return &owner_.m_attributeCache[line->typeIndex].attr;
 	}
-#endif
 
 	DECLARE_EVENT_TABLE()
 
-	void OnText(wxCommandEvent&)
-	{
-		// Do nothing here.
-		// Having this event handler prevents the event from propagating up the
-		// window hierarchy which saves a few CPU cycles.
-	}
-
 #ifdef __WXMAC__
 	void OnChar(wxKeyEvent& event)
 	{
@@ -81,31 +114,31 @@ public:
 		HandleAsNavigationKey(event);
 	}
 #endif
+
+private:
+	CStatusView& owner_;
 };
 
-BEGIN_EVENT_TABLE(CFastTextCtrl, wxNavigationEnabled<wxTextCtrl>)
-	EVT_TEXT(wxID_ANY, CFastTextCtrl::OnText)
+BEGIN_EVENT_TABLE(CLogListCtrl, wxNavigationEnabled<wxListCtrl>)
 #ifdef __WXMAC__
-	EVT_CHAR_HOOK(CFastTextCtrl::OnChar)
+	EVT_CHAR_HOOK(CLogListCtrl::OnChar)
 #endif
 END_EVENT_TABLE()
 
 
 CStatusView::CStatusView(wxWindow* parent, wxWindowID id)
+	: m_lines(MAX_LINECOUNT)
 {
 	Create(parent, id, wxDefaultPosition, wxDefaultSize, wxSUNKEN_BORDER);
-	m_pTextCtrl = new CFastTextCtrl(this);
+	m_pListCtrl = new CLogListCtrl(*this);
 
 #ifdef __WXMAC__
-	m_pTextCtrl->SetFont(wxSystemSettings::GetFont(wxSYS_DEFAULT_GUI_FONT));
+	m_pListCtrl->SetFont(wxSystemSettings::GetFont(wxSYS_DEFAULT_GUI_FONT));
 #else
-	m_pTextCtrl->SetFont(GetFont());
+	m_pListCtrl->SetFont(GetFont());
 #endif
 
-	m_pTextCtrl->Connect(wxID_ANY, wxEVT_CONTEXT_MENU, wxContextMenuEventHandler(CStatusView::OnContextMenu), 0, this);
-#ifdef __WXMSW__
-	::SendMessage((HWND)m_pTextCtrl->GetHandle(), EM_SETOLECALLBACK, 0, 0);
-#endif
+	m_pListCtrl->Connect(wxID_ANY, wxEVT_CONTEXT_MENU, wxContextMenuEventHandler(CStatusView::OnContextMenu), 0, this);
 
 	InitDefAttr();
 
@@ -122,234 +155,253 @@ CStatusView::~CStatusView()
 
 void CStatusView::OnSize(wxSizeEvent &)
 {
-	if (m_pTextCtrl) {
+	if (m_pListCtrl) {
 		wxSize s = GetClientSize();
-		m_pTextCtrl->SetSize(0, 0, s.GetWidth(), s.GetHeight());
+		m_pListCtrl->SetSize(0, 0, s.GetWidth(), s.GetHeight());
+		UpdateMessageColumn();
 	}
 }
 
-void CStatusView::AddToLog(CLogmsgNotification && notification)
+void CStatusView::AddToLog(CLogmsgNotification && notification, unsigned int engineId)
 {
-	AddToLog(notification.msgType, std::move(notification.msg), std::move(notification.time_));
+	AddToLog(notification.msgType, std::move(notification.msg), notification.time_, engineId);
 }
 
-void CStatusView::AddToLog(logmsg::type messagetype, std::wstring && message, fz::datetime const& time)
+void CStatusView::AddToLog(logmsg::type messagetype, std::wstring && message, fz::datetime const& time, unsigned int engineId)
 {
-	if (!m_shown) {
-		if (m_hiddenLines.size() >= MAX_LINECOUNT) {
-			auto it = m_hiddenLines.begin();
-			it->messagetype = messagetype;
-			it->message = message;
-			it->time = time;
-			m_hiddenLines.splice(m_hiddenLines.end(), m_hiddenLines, it );
-		}
-		else {
-			t_line line;
-			line.messagetype = messagetype;
-			line.message = message;
-			line.time = time;
-			m_hiddenLines.push_back(line);
+	if (message.size() > m_longestMessage) {
+		// Only happens for few lines, no need to measure every line
+		m_longestMessage = message.size();
+		int const width = m_pListCtrl->GetTextExtent(message).GetWidth();
+		if (width > m_messageWidth) {
+			m_messageWidth = width;
 		}
-		return;
 	}
 
-	size_t const messageLength = message.size();
+	uint64_t const seq = m_nextSeq++;
+	t_line & line = m_lines[seq % m_lines.size()];
+	line.message = std::move(message);
+	line.time = time;
+	line.engineId = engineId;
+	line.typeIndex = static_cast<uint8_t>(fz::bitscan(messagetype));
 
-	// This does not clear storage
-	m_formattedMessage.clear();
+	if (m_lineCount < m_lines.size()) {
+		++m_lineCount;
+	}
+	else if (!m_filtered) {
+		++m_pendingDropped;
+	}
 
-	if (m_nLineCount) {
-#ifdef __WXMSW__
-		m_formattedMessage = _T("\r\n");
-#else
-		m_formattedMessage = _T("\n");
-#endif
+	if (m_filtered) {
+		while (!m_visible.empty() && m_visible.front() < OldestSeq()) {
+			m_visible.pop_front();
+			++m_pendingDropped;
+		}
+		if (Matches(line)) {
+			m_visible.push_back(seq);
+		}
 	}
 
-	if (m_nLineCount >= MAX_LINECOUNT) {
-#ifndef __WXGTK__
-		m_pTextCtrl->Freeze();
-#endif //__WXGTK__
-		int oldLength = 0;
-		auto it = m_lineLengths.begin();
-		for (int i = 0; i < LINECOUNT_REMOVAL; ++i) {
-			oldLength += *(it++) + 1;
+	// Coalesce updates of the control if many lines get logged in a row
+	if (m_shown && !m_updatePending) {
+		m_updatePending = true;
+		CallAfter(&CStatusView::UpdateView);
+	}
+}
+
+CStatusView::t_line const* CStatusView::GetLine(long item) const
+{
+	// Map the item as currently shown by the control, lines dropped since
+	// the last update have no item anymore.
+	if (item < 0 || static_cast<size_t>(item) < m_pendingDropped) {
+		return nullptr;
+	}
+	size_t const index = static_cast<size_t>(item) - m_pendingDropped;
+
+	uint64_t seq;
+	if (m_filtered) {
+		if (index >= m_visible.size()) {
+			return nullptr;
 		}
-		m_unusedLineLengths.splice(m_unusedLineLengths.end(), m_lineLengths, m_lineLengths.begin(), it);
-		m_pTextCtrl->Remove(0, oldLength);
+		seq = m_visible[index];
 	}
-#ifdef __WXMAC__
-	if (m_pTextCtrl->GetInsertionPoint() != m_pTextCtrl->GetLastPosition()) {
-		m_pTextCtrl->SetInsertionPointEnd();
+	else {
+		if (index >= m_lineCount) {
+			return nullptr;
+		}
+		seq = OldestSeq() + index;
 	}
-#endif
+	return &m_lines[seq % m_lines.size()];
+}
 
-	uint64_t const cache_index = fz::bitscan(messagetype);
+bool CStatusView::Matches(t_line const& line) const
+{
+	if (!(m_typeFilter & (1ull << line.typeIndex))) {
+		return false;
+	}
+	return !m_engineFilter || line.engineId == m_engineFilter;
+}
 
-	size_t lineLength = m_attributeCache[cache_index].len + messageLength;
+void CStatusView::RebuildVisible()
+{
+	m_visible.clear();
+	if (!m_filtered) {
+		return;
+	}
 
-	if (m_showTimestamps) {
-		if (time != m_lastTime) {
-			m_lastTime = time;
-#ifndef __WXMAC__
-			m_lastTimeString = time.format(_T("%H:%M:%S\t"), fz::datetime::local);
-#else
-			// Tabs on OS X cannot be freely positioned
-			m_lastTimeString = time.format(_T("%H:%M:%S "), fz::datetime::local);
-#endif
+	for (uint64_t seq = OldestSeq(); seq < m_nextSeq; ++seq) {
+		if (Matches(m_lines[seq % m_lines.size()])) {
+			m_visible.push_back(seq);
 		}
-		m_formattedMessage += m_lastTimeString;
-		lineLength += m_lastTimeString.size();
 	}
+}
 
-#ifdef __WXMAC__
-	m_pTextCtrl->SetDefaultStyle(m_attributeCache[cache_index].attr);
-#elif __WXGTK__
-	m_pTextCtrl->SetDefaultColor(m_attributeCache[cache_index].attr.GetTextColour());
-#endif
+void CStatusView::SetFilter(uint64_t typeMask, unsigned int engineId)
+{
+	if (typeMask == m_typeFilter && engineId == m_engineFilter) {
+		return;
+	}
+
+	m_typeFilter = typeMask;
+	m_engineFilter = engineId;
+	m_filtered = m_typeFilter != ~uint64_t() || m_engineFilter;
+	RebuildVisible();
+	ResetView();
+}
+
+void CStatusView::UpdateView()
+{
+	m_updatePending = false;
+	if (!m_shown || !m_pListCtrl) {
+		return;
+	}
 
-	m_formattedMessage += m_attributeCache[cache_index].prefix;
-
-	if (m_rtl) {
-		// Unicode control characters that control reading direction
-		const wxChar LTR_MARK = 0x200e;
-		//const wxChar RTL_MARK = 0x200f;
-		const wxChar LTR_EMBED = 0x202A;
-		//const wxChar RTL_EMBED = 0x202B;
-		//const wxChar POP = 0x202c;
-		//const wxChar LTR_OVERRIDE = 0x202D;
-		//const wxChar RTL_OVERRIDE = 0x202E;
-
-		if (messagetype == logmsg::command || messagetype == logmsg::reply || messagetype >= logmsg::debug_warning) {
-			// Commands, responses and debug message contain English text,
-			// set LTR reading order for them.
-			m_formattedMessage += LTR_MARK;
-			m_formattedMessage += LTR_EMBED;
-			lineLength += 2;
+	size_t const count = m_filtered ? m_visible.size() : m_lineCount;
+	size_t const dropped = std::min(m_pendingDropped, m_shownCount);
+
+	int const perPage = m_pListCtrl->GetCountPerPage();
+	bool const atBottom = !m_shownCount || static_cast<size_t>(m_pListCtrl->GetTopItem() + perPage) >= m_shownCount;
+
+	if (dropped && m_pListCtrl->GetSelectedItemCount()) {
+		// Keep selection on the same lines
+		std::vector<long> selected;
+		for (long item = m_pListCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED); item != -1; item = m_pListCtrl->GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) {
+			selected.push_back(item);
+		}
+		for (auto item : selected) {
+			m_pListCtrl->SetItemState(item, 0, wxLIST_STATE_SELECTED);
+		}
+		m_pendingDropped = 0;
+		for (auto item : selected) {
+			if (static_cast<size_t>(item) >= dropped) {
+				m_pListCtrl->SetItemState(item - static_cast<long>(dropped), wxLIST_STATE_SELECTED, wxLIST_STATE_SELECTED);
+			}
 		}
 	}
+	m_pendingDropped = 0;
+
+	m_shownCount = count;
+	m_pListCtrl->SetItemCount(static_cast<long>(count));
+	UpdateMessageColumn();
 
-	m_formattedMessage += message;
-#if defined(__WXGTK__)
-	// AppendText always calls SetInsertionPointEnd, which is very expensive.
-	// This check however is negligible.
-	if (m_pTextCtrl->GetInsertionPoint() != m_pTextCtrl->GetLastPosition()) {
-		m_pTextCtrl->AppendText(m_formattedMessage);
+	if (atBottom && count) {
+		m_pListCtrl->EnsureVisible(static_cast<long>(count - 1));
 	}
-	else {
-		m_pTextCtrl->WriteText(m_formattedMessage);
-	}
-	#ifdef __WXGTK3__
-		// Some smooth scrolling oddities prevent auto-scrolling. Manuall tell it to scroll.
-		m_pTextCtrl->ShowPosition(m_pTextCtrl->GetInsertionPoint());
-	#endif
-#elif defined(__WXMAC__)
-	m_pTextCtrl->WriteText(m_formattedMessage);
-#else
-	m_pTextCtrl->AppendText(m_formattedMessage, m_nLineCount, m_attributeCache[cache_index].cf);
-#endif
+	if (dropped) {
+		m_pListCtrl->Refresh();
+	}
+}
 
-	if (m_nLineCount >= MAX_LINECOUNT) {
-		m_nLineCount -= LINECOUNT_REMOVAL - 1;
-#ifndef __WXGTK__
-		m_pTextCtrl->Thaw();
-#endif
+void CStatusView::ResetView()
+{
+	m_updatePending = false;
+	m_pendingDropped = 0;
+	if (!m_pListCtrl) {
+		return;
 	}
-	else {
-		m_nLineCount++;
+
+	for (long item = m_pListCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED); item != -1; item = m_pListCtrl->GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) {
+		m_pListCtrl->SetItemState(item, 0, wxLIST_STATE_SELECTED);
 	}
-	if (m_unusedLineLengths.empty()) {
-		m_lineLengths.push_back(lineLength);
+
+	m_shownCount = m_filtered ? m_visible.size() : m_lineCount;
+	m_pListCtrl->SetItemCount(static_cast<long>(m_shownCount));
+	UpdateMessageColumn();
+	if (m_shownCount) {
+		m_pListCtrl->EnsureVisible(static_cast<long>(m_shownCount - 1));
 	}
-	else {
-		m_unusedLineLengths.front() = lineLength;
-		m_lineLengths.splice(m_lineLengths.end(), m_unusedLineLengths, m_unusedLineLengths.begin());
+	m_pListCtrl->Refresh();
+}
+
+void CStatusView::UpdateMessageColumn()
+{
+	int const column = m_showTimestamps ? 2 : 1;
+	if (m_pListCtrl->GetColumnCount() <= column) {
+		return;
+	}
+
+	int width = m_pListCtrl->GetClientSize().GetWidth() - m_fixedWidth;
+	if (width < m_messageWidth + 10) {
+		width = m_messageWidth + 10;
+	}
+	if (m_pListCtrl->GetColumnWidth(column) != width) {
+		m_pListCtrl->SetColumnWidth(column, width);
 	}
 }
 
+std::wstring CStatusView::FormatLine(t_line const& line) const
+{
+	std::wstring ret;
+	if (m_showTimestamps) {
+		ret = line.time.format(L"%H:%M:%S", fz::datetime::local);
+		ret += '\t';
+	}
+	ret += m_attributeCache[line.typeIndex].prefix;
+	ret += '\t';
+	ret += line.message;
+	return ret;
+}
+
 void CStatusView::InitDefAttr()
 {
 	m_showTimestamps = COptions::Get()->GetOptionVal(OPTION_MESSAGELOG_TIMESTAMP) != 0;
-	m_lastTime = fz::datetime::now();
-	m_lastTimeString = m_lastTime.format(_T("%H:%M:%S\t"), fz::datetime::local);
+	m_lastTime = fz::datetime();
+	m_lastTimeString.clear();
 
 	// Measure withs of all types
-	wxClientDC dc(this);
+	wxClientDC dc(m_pListCtrl);
+	dc.SetFont(m_pListCtrl->GetFont());
+
+	int const padding = dc.GetTextExtent(_T("  ")).GetWidth() + 8;
 
 	int timestampWidth = 0;
 	if (m_showTimestamps) {
-		wxCoord width = 0;
-		wxCoord height = 0;
-#ifndef __WXMAC__
-		dc.GetTextExtent(_T("88:88:88 "), &width, &height);
-#else
-		dc.GetTextExtent(_T("88:88:88 "), &width, &height);
-#endif
-		timestampWidth = width;
-	}
-
-	wxCoord width = 0;
-	wxCoord height = 0;
-	dc.GetTextExtent(_("Error:") + _T(" "), &width, &height);
-	int maxPrefixWidth = width;
-	dc.GetTextExtent(_("Command:") + _T(" "), &width, &height);
-	if (width > maxPrefixWidth)
-		maxPrefixWidth = width;
-	dc.GetTextExtent(_("Response:") + _T(" "), &width, &height);
-	if (width > maxPrefixWidth)
-		maxPrefixWidth = width;
-	dc.GetTextExtent(_("Trace:") + _T(" "), &width, &height);
-	if (width > maxPrefixWidth)
-		maxPrefixWidth = width;
-	dc.GetTextExtent(_("Listing:") + _T(" "), &width, &height);
-	if (width > maxPrefixWidth)
-		maxPrefixWidth = width;
-	dc.GetTextExtent(_("Status:") + _T(" "), &width, &height);
-	if (width > maxPrefixWidth)
-		maxPrefixWidth = width;
-
-#ifdef __WXMAC__
-	wxCoord spaceWidth;
-	dc.GetTextExtent(_T(" "), &spaceWidth, &height);
-#endif
+		timestampWidth = dc.GetTextExtent(_T("88:88:88")).GetWidth() + padding;
+	}
 
-	dc.SetMapMode(wxMM_LOMETRIC);
+	int maxPrefixWidth = 0;
+	for (auto const& prefix : { _("Error:"), _("Command:"), _("Response:"), _("Trace:"), _("Listing:"), _("Status:") }) {
+		int const width = dc.GetTextExtent(prefix).GetWidth();
+		if (width > maxPrefixWidth) {
+			maxPrefixWidth = width;
+		}
+	}
+	maxPrefixWidth += padding;
 
-	int maxWidth = dc.DeviceToLogicalX(maxPrefixWidth) + 20;
-	if (timestampWidth != 0) {
-		timestampWidth = dc.DeviceToLogicalX(timestampWidth) + 20;
-		maxWidth += timestampWidth;
+	m_pListCtrl->DeleteAllColumns();
+	int column = 0;
+	if (m_showTimestamps) {
+		m_pListCtrl->InsertColumn(column++, wxString(), wxLIST_FORMAT_LEFT, timestampWidth);
 	}
-	wxArrayInt array;
-#ifndef __WXMAC__
-	if (timestampWidth != 0)
-		array.Add(timestampWidth);
-#endif
-	array.Add(maxWidth);
-	wxTextAttr defAttr;
-	defAttr.SetTabs(array);
-	defAttr.SetLeftIndent(0, maxWidth);
-	m_pTextCtrl->SetDefaultStyle(defAttr);
-#ifdef __WXMSW__
-	m_pTextCtrl->SetStyle(0, 0, defAttr);
-#endif
+	m_pListCtrl->InsertColumn(column++, wxString(), wxLIST_FORMAT_LEFT, maxPrefixWidth);
+	m_pListCtrl->InsertColumn(column, wxString(), wxLIST_FORMAT_LEFT, 100);
+	m_fixedWidth = timestampWidth + maxPrefixWidth;
 
 	const wxColour background = wxSystemSettings::GetColour(wxSYS_COLOUR_LISTBOX);
 	const bool is_dark = background.Red() + background.Green() + background.Blue() < 384;
 
-#ifdef __WXMSW__
-	// Select something for EM_GETCHARFORMAT to work
-	long oldSelectionFrom{-1};
-	long oldSelectionTo{-1};
-	m_pTextCtrl->GetSelection(&oldSelectionFrom, &oldSelectionTo);
-	m_pTextCtrl->SetSelection(m_pTextCtrl->GetInsertionPoint(), m_pTextCtrl->GetInsertionPoint());
-#endif
-
 	for (size_t i = 0; i < sizeof(logmsg::type) * 8; ++i) {
 		t_attributeCache& entry = m_attributeCache[i];
-#ifndef __WXMAC__
-		entry.attr = defAttr;
-#endif
 		switch (1ull << i) {
 		case logmsg::error:
 			entry.prefix = _("Error:").ToStdWstring();
@@ -399,31 +451,11 @@ void CStatusView::InitDefAttr()
 			entry.attr.SetTextColour(wxSystemSettings::GetColour(wxSYS_COLOUR_LISTBOXTEXT));
 			break;
 		}
-
-#ifdef __WXMAC__
-		// Fill with blanks to approach best size
-		dc.GetTextExtent(entry.prefix, &width, &height);
-		wxASSERT(width <= maxPrefixWidth);
-		wxCoord spaces = (maxPrefixWidth - width) / spaceWidth;
-		entry.prefix += std::wstring(spaces, ' ');
-#endif
-		entry.prefix += _T("\t");
-		entry.len = entry.prefix.size();
-
-#ifdef __WXMSW__
-		m_pTextCtrl->SetStyle(m_pTextCtrl->GetInsertionPoint(), m_pTextCtrl->GetInsertionPoint(), entry.attr);
-		entry.cf.cbSize = sizeof(CHARFORMAT2);
-		::SendMessage((HWND)m_pTextCtrl->GetHWND(), EM_GETCHARFORMAT, SCF_SELECTION, (LPARAM)&entry.cf);
-#endif
 	}
 
 	m_rtl = wxTheApp->GetLayoutDirection() == wxLayout_RightToLeft;
 
-#ifdef __WXMSW__
-	if (oldSelectionFrom != -1 && oldSelectionTo != -1) {
-		m_pTextCtrl->SetSelection(oldSelectionFrom, oldSelectionTo);
-	}
-#endif
+	ResetView();
 }
 
 void CStatusView::OnContextMenu(wxContextMenuEvent&)
@@ -433,6 +465,28 @@ void CStatusView::OnContextMenu(wxContextMenuEvent&)
 
 	menu.AppendSeparator();
 	menu.Append(XRCID("ID_SHOW_DETAILED_LOG"), _("&Show detailed log"), wxString(), wxITEM_CHECK);
+
+	wxMenu* filterMenu = new wxMenu;
+	wxString const filterNames[] = { _("&Status messages"), _("&Errors"), _("&Commands"), _("&Responses"), _("&Trace messages"), _("&Directory listings") };
+	for (size_t i = 0; i < sizeof(filterCategories) / sizeof(*filterCategories); ++i) {
+		filterMenu->AppendCheckItem(XRCID(filterCategories[i].id), filterNames[i]);
+		filterMenu->Check(XRCID(filterCategories[i].id), (m_typeFilter & filterCategories[i].mask) != 0);
+	}
+	filterMenu->AppendSeparator();
+	filterMenu->AppendCheckItem(XRCID("ID_LOGFILTER_ENGINE"), _("Only &this connection"));
+
+	// The connection of the focused line, or the one currently filtered for
+	unsigned int engineId = m_engineFilter;
+	if (!engineId) {
+		auto const* line = GetLine(m_pListCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_FOCUSED));
+		if (line) {
+			engineId = line->engineId;
+		}
+	}
+	filterMenu->Check(XRCID("ID_LOGFILTER_ENGINE"), m_engineFilter != 0);
+	filterMenu->Enable(XRCID("ID_LOGFILTER_ENGINE"), engineId != 0);
+	menu.AppendSubMenu(filterMenu, _("&Filter"));
+
 	menu.Append(XRCID("ID_COPYTOCLIPBOARD"), _("&Copy to clipboard"));
 	menu.Append(XRCID("ID_CLEARALL"), _("C&lear all"));
 
@@ -453,60 +507,78 @@ void CStatusView::OnContextMenu(wxContextMenuEvent&)
 	PopupMenu(&menu);
 
 	COptions::Get()->SetOption(OPTION_LOGGING_SHOW_DETAILED_LOGS, menu.IsChecked(XRCID("ID_SHOW_DETAILED_LOG")) ? 1 : 0);
+
+	uint64_t typeMask = ~uint64_t();
+	for (auto const& category : filterCategories) {
+		if (!menu.IsChecked(XRCID(category.id))) {
+			typeMask &= ~category.mask;
+		}
+	}
+	SetFilter(typeMask, menu.IsChecked(XRCID("ID_LOGFILTER_ENGINE")) ? engineId : 0);
 }
 
 void CStatusView::OnClear(wxCommandEvent&)
 {
-	if (m_pTextCtrl) {
-		m_pTextCtrl->Clear();
-	}
-	m_nLineCount = 0;
-	m_lineLengths.clear();
+	m_lineCount = 0;
+	m_visible.clear();
+	m_longestMessage = 0;
+	m_messageWidth = 0;
+	ResetView();
 }
 
 void CStatusView::OnCopy(wxCommandEvent&)
 {
-	if (!m_pTextCtrl) {
+	if (!m_pListCtrl) {
 		return;
 	}
 
-	long from, to;
-	m_pTextCtrl->GetSelection(&from, &to);
-	if (from != to) {
-		m_pTextCtrl->Copy();
+	// Copy the selected lines, or everything if nothing is selected
+	bool const all = !m_pListCtrl->GetSelectedItemCount();
+
+	std::wstring text;
+	for (long item = all ? 0 : m_pListCtrl->GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
+		item != -1 && static_cast<size_t>(item) < m_shownCount;
+		item = all ? item + 1 : m_pListCtrl->GetNextItem(item, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED))
+	{
+		auto const* line = GetLine(item);
+		if (!line) {
+			continue;
+		}
+		if (!text.empty()) {
+#ifdef __WXMSW__
+			text += L"\r\n";
+#else
+			text += '\n';
+#endif
+		}
+		text += FormatLine(*line);
 	}
-	else {
-		m_pTextCtrl->Freeze();
-		m_pTextCtrl->SetSelection(-1, -1);
-		m_pTextCtrl->Copy();
-		m_pTextCtrl->SetSelection(from, to);
-		m_pTextCtrl->Thaw();
+
+	if (text.empty() || !wxTheClipboard->Open()) {
+		return;
 	}
+	wxTheClipboard->SetData(new wxTextDataObject(text));
+	wxTheClipboard->Flush();
+	wxTheClipboard->Close();
 }
 
 void CStatusView::SetFocus()
 {
-	m_pTextCtrl->SetFocus();
+	m_pListCtrl->SetFocus();
 }
 
 bool CStatusView::Show(bool show)
 {
 	m_shown = show;
 
-	if (show && m_pTextCtrl) {
-		if (m_hiddenLines.size() >= MAX_LINECOUNT) {
-			m_pTextCtrl->Clear();
-			m_nLineCount = 0;
-			m_unusedLineLengths.splice(m_unusedLineLengths.end(), m_lineLengths, m_lineLengths.begin(), m_lineLengths.end());
-		}
+	bool const ret = wxWindow::Show(show);
 
-		for (auto & line : m_hiddenLines) {
-			AddToLog(line.messagetype, std::move(line.message), line.time);
-		}
-		m_hiddenLines.clear();
+	// Lines logged while hidden are already in the ring
+	if (show) {
+		ResetView();
 	}
 
-	return wxWindow::Show(show);
+	return ret;
 }
 
 void CStatusView::OnOptionsChanged(changed_options_t const&)
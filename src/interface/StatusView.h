@@ -1,36 +1,39 @@
 #ifndef FILEZILLA_INTERFACE_STATUSVIEW_HEADER
 #define FILEZILLA_INTERFACE_STATUSVIEW_HEADER
 
-#ifdef __WXMSW__
-#include "richedit.h"
-#endif
-
 #include "option_change_event_handler.h"
 
-#include <wx/timer.h>
+#include <wx/listctrl.h>
 
-#include <list>
+#include <deque>
+#include <vector>
 
-class CFastTextCtrl;
+class CLogListCtrl;
 class CStatusView final : public wxNavigationEnabled<wxWindow>, private COptionChangeEventHandler
 {
+	friend class CLogListCtrl;
+
 public:
 	CStatusView(wxWindow* parent, wxWindowID id);
 	virtual ~CStatusView();
 
-	void AddToLog(CLogmsgNotification && pNotification);
-	void AddToLog(logmsg::type messagetype, std::wstring && message, fz::datetime const& time);
+	// engineId identifies the connection the message belongs to, used for filtering
+	void AddToLog(CLogmsgNotification && pNotification, unsigned int engineId = 0);
+	void AddToLog(logmsg::type messagetype, std::wstring && message, fz::datetime const& time, unsigned int engineId = 0);
 
 	void InitDefAttr();
 
+	// Only lines with a type in typeMask and, unless engineId is 0, from
+	// the given engine are displayed.
+	void SetFilter(uint64_t typeMask, unsigned int engineId);
+
 	virtual void SetFocus();
 
 	virtual bool Show(bool show = true);
 
 private:
 
-	int m_nLineCount{};
-	CFastTextCtrl *m_pTextCtrl{};
+	CLogListCtrl *m_pListCtrl{};
 
 	void OnOptionsChanged(changed_options_t const& options);
 
@@ -39,41 +42,60 @@ private:
 	void OnContextMenu(wxContextMenuEvent&);
 	void OnClear(wxCommandEvent& );
 	void OnCopy(wxCommandEvent& );
-	void OnTimer(wxTimerEvent&);
 
-	std::list<int> m_lineLengths;
-	std::list<int> m_unusedLineLengths;
+	// Lines are stored in a fixed-capacity ring and only turned into
+	// text once the list control asks for them. Each line has a
+	// sequence number, it is stored at index seq % capacity.
+	struct t_line
+	{
+		std::wstring message;
+		fz::datetime time;
+		unsigned int engineId{};
+		uint8_t typeIndex{}; // Bit index of the logmsg::type
+	};
+	std::vector<t_line> m_lines;
+	uint64_t m_nextSeq{};
+	size_t m_lineCount{};
+
+	uint64_t OldestSeq() const { return m_nextSeq - m_lineCount; }
+	t_line const* GetLine(long item) const;
+	bool Matches(t_line const& line) const;
+	void RebuildVisible();
+	void UpdateView();
+	void ResetView();
+	void UpdateMessageColumn();
+	std::wstring FormatLine(t_line const& line) const;
+
+	uint64_t m_typeFilter{~uint64_t()};
+	unsigned int m_engineFilter{};
+	bool m_filtered{};
+
+	// Sequence numbers of the lines passing the filter, only maintained if m_filtered
+	std::deque<uint64_t> m_visible;
+
+	// Number of items the list control currently shows and how many of
+	// them got dropped from the front since, until the next UpdateView.
+	size_t m_shownCount{};
+	size_t m_pendingDropped{};
+	bool m_updatePending{};
+
+	int m_fixedWidth{};
+	size_t m_longestMessage{};
+	int m_messageWidth{};
 
 	struct t_attributeCache
 	{
 		std::wstring prefix;
-		size_t len{};
-		wxTextAttr attr;
-#ifdef __WXMSW__
-		CHARFORMAT2 cf{};
-#endif
+		wxListItemAttr attr;
 	} m_attributeCache[sizeof(logmsg::type) * 8];
 
 	bool m_rtl{};
 
 	bool m_shown{};
 
-	// Don't update actual log window if not shown,
-	// do it later when showing the window.
-	struct t_line
-	{
-		logmsg::type messagetype;
-		std::wstring message;
-		fz::datetime time;
-	};
-	std::list<t_line> m_hiddenLines;
-
 	bool m_showTimestamps{};
-	fz::datetime m_lastTime;
-	std::wstring m_lastTimeString;
-
-	// Re-using the same string to format the message in avoids uneeded allocations
-	std::wstring m_formattedMessage;
+	mutable fz::datetime m_lastTime;
+	mutable std::wstring m_lastTimeString;
 };
 
 #endif
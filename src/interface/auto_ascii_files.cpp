@@ -4,6 +4,8 @@
 
 #include <libfilezilla/local_filesys.hpp>
 
+#include <algorithm>
+
 std::vector<std::wstring> CAutoAsciiFiles::ascii_extensions_;
 
 void CAutoAsciiFiles::SettingsChanged()
@@ -37,12 +39,52 @@ void CAutoAsciiFiles::SettingsChanged()
 	if (!ext.empty()) {
 		ascii_extensions_.push_back(ext);
 	}
+
+	for (auto & extension : ascii_extensions_) {
+		extension = fz::str_tolower_ascii(extension);
+	}
+	std::sort(ascii_extensions_.begin(), ascii_extensions_.end());
+	ascii_extensions_.erase(std::unique(ascii_extensions_.begin(), ascii_extensions_.end()), ascii_extensions_.end());
+}
+
+namespace {
+bool less_insensitive_ascii(std::wstring_view const& lhs, std::wstring_view const& rhs)
+{
+	return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](wchar_t a, wchar_t b) {
+		return fz::tolower_ascii(a) < fz::tolower_ascii(b);
+	});
+}
+}
+
+bool CAutoAsciiFiles::IsAsciiExtension(std::wstring_view const& ext)
+{
+	auto it = std::lower_bound(ascii_extensions_.cbegin(), ascii_extensions_.cend(), ext, [](std::wstring const& lhs, std::wstring_view const& rhs) {
+		return less_insensitive_ascii(lhs, rhs);
+	});
+	return it != ascii_extensions_.cend() && !less_insensitive_ascii(ext, *it);
 }
 
 // Defined in RemoteListView.cpp
 std::wstring StripVMSRevision(std::wstring const& name);
 
 bool CAutoAsciiFiles::TransferLocalAsAscii(std::wstring const& local_file, ServerType server_type)
+{
+	return matcher().TransferLocalAsAscii(local_file, server_type);
+}
+
+bool CAutoAsciiFiles::TransferRemoteAsAscii(std::wstring const& remote_file, ServerType server_type)
+{
+	return matcher().TransferRemoteAsAscii(remote_file, server_type);
+}
+
+CAutoAsciiFiles::matcher::matcher()
+	: mode_(COptions::Get()->GetOptionVal(OPTION_ASCIIBINARY))
+	, dotfile_(COptions::Get()->GetOptionVal(OPTION_ASCIIDOTFILE) != 0)
+	, noext_(COptions::Get()->GetOptionVal(OPTION_ASCIINOEXT) != 0)
+{
+}
+
+bool CAutoAsciiFiles::matcher::TransferLocalAsAscii(std::wstring const& local_file, ServerType server_type) const
 {
 	size_t pos = local_file.rfind(fz::local_filesys::path_separator);
 
@@ -53,13 +95,12 @@ bool CAutoAsciiFiles::TransferLocalAsAscii(std::wstring const& local_file, Serve
 	);
 }
 
-bool CAutoAsciiFiles::TransferRemoteAsAscii(std::wstring const& remote_file, ServerType server_type)
+bool CAutoAsciiFiles::matcher::TransferRemoteAsAscii(std::wstring const& remote_file, ServerType server_type) const
 {
-	int mode = COptions::Get()->GetOptionVal(OPTION_ASCIIBINARY);
-	if (mode == 1) {
+	if (mode_ == 1) {
 		return true;
 	}
-	else if (mode == 2) {
+	else if (mode_ == 2) {
 		return false;
 	}
 
@@ -68,20 +109,13 @@ bool CAutoAsciiFiles::TransferRemoteAsAscii(std::wstring const& remote_file, Ser
 	}
 
 	if (!remote_file.empty() && remote_file[0] == '.') {
-		return COptions::Get()->GetOptionVal(OPTION_ASCIIDOTFILE) != 0;
+		return dotfile_;
 	}
 
 	size_t pos = remote_file.rfind('.');
 	if (pos == std::wstring::npos || pos + 1 == remote_file.size()) {
-		return COptions::Get()->GetOptionVal(OPTION_ASCIINOEXT) != 0;
-	}
-	std::wstring ext = remote_file.substr(pos + 1);
-
-	for (auto const& ascii_ext : ascii_extensions_) {
-		if (fz::equal_insensitive_ascii(ext, ascii_ext)) {
-			return true;
-		}
+		return noext_;
 	}
 
-	return false;
+	return IsAsciiExtension(std::wstring_view(remote_file).substr(pos + 1));
 }
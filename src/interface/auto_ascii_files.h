@@ -1,15 +1,35 @@
 #ifndef FILEZILLA_INTERFACE_AUTO_ASCII_FILES_HEADER
 #define FILEZILLA_INTERFACE_AUTO_ASCII_FILES_HEADER
 
+#include <string_view>
+
 class CAutoAsciiFiles final
 {
 public:
+	// Decides the data type of many files in a row, using the options as
+	// they were at construction.
+	class matcher final
+	{
+	public:
+		matcher();
+
+		bool TransferLocalAsAscii(std::wstring const& local_file, ServerType server_type) const;
+		bool TransferRemoteAsAscii(std::wstring const& remote_file, ServerType server_type) const;
+
+	private:
+		int mode_{};
+		bool dotfile_{};
+		bool noext_{};
+	};
+
 	static bool TransferLocalAsAscii(std::wstring const& local_file, ServerType server_type);
 	static bool TransferRemoteAsAscii(std::wstring const& remote_file, ServerType server_type);
 
 	static void SettingsChanged();
 protected:
-	static bool IsAsciiExtension(std::wstring const& ext);
+	static bool IsAsciiExtension(std::wstring_view const& ext);
+
+	// Lowercase and sorted
 	static std::vector<std::wstring> ascii_extensions_;
 };
 
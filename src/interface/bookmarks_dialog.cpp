@@ -172,6 +172,7 @@ void CBookmarksDialog::LoadGlobalBookmarks()
 	CInterProcessMutex mutex(MUTEX_GLOBALBOOKMARKS);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("bookmarks")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
@@ -333,6 +334,7 @@ void CBookmarksDialog::SaveGlobalBookmarks()
 	CInterProcessMutex mutex(MUTEX_GLOBALBOOKMARKS);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("bookmarks")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxString msg = file.GetError() + _T("\n\n") + _("The global bookmarks could not be saved.");
@@ -790,6 +792,7 @@ bool CBookmarksDialog::GetGlobalBookmarks(std::vector<std::wstring> &bookmarks)
 	CInterProcessMutex mutex(MUTEX_GLOBALBOOKMARKS);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("bookmarks")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
@@ -830,6 +833,7 @@ bool CBookmarksDialog::GetBookmark(const wxString &name, wxString &local_dir, CS
 	CInterProcessMutex mutex(MUTEX_GLOBALBOOKMARKS);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("bookmarks")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
@@ -882,6 +886,7 @@ bool CBookmarksDialog::AddBookmark(const wxString &name, const wxString &local_d
 	CInterProcessMutex mutex(MUTEX_GLOBALBOOKMARKS);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("bookmarks")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxString msg = file.GetError() + _T("\n\n") + _("The bookmark could not be added.");
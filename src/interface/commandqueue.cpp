@@ -3,16 +3,27 @@
 #include "Mainfrm.h"
 #include "state.h"
 #include "remote_recursive_operation.h"
+#include "listingcomparison.h"
 #include "loginmanager.h"
+#include "Options.h"
 #include "queue.h"
 #include "RemoteListView.h"
 
 #include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
 
 DEFINE_EVENT_TYPE(fzEVT_GRANTEXCLUSIVEENGINEACCESS)
 
 int CCommandQueue::m_requestIdCounter = 0;
 
+namespace {
+// Remote directories most recently navigated to, used to rank candidates for
+// prefetching.
+size_t const max_visited = 100;
+}
+
 CCommandQueue::CCommandQueue(CFileZillaEngine *pEngine, CMainFrame* pMainFrame, CState& state)
 	: m_pEngine(pEngine)
 	, m_pMainFrame(pMainFrame)
@@ -27,7 +38,7 @@ bool CCommandQueue::Idle(command_origin origin) const
 	}
 
 	if (origin == any) {
-		return m_CommandList.empty();
+		return std::all_of(m_CommandList.begin(), m_CommandList.end(), [](CommandInfo const& c) { return c.origin == prefetch; });
 	}
 
 	return std::find_if(m_CommandList.begin(), m_CommandList.end(), [origin](CommandInfo const& c) { return c.origin == origin; }) == m_CommandList.end();
@@ -41,13 +52,74 @@ void CCommandQueue::ProcessCommand(CCommand *pCommand, CCommandQueue::command_or
 		return;
 	}
 
-	m_CommandList.emplace_back(origin, std::unique_ptr<CCommand>(pCommand));
-	if (m_CommandList.size() == 1) {
+	if (origin != prefetch) {
+		CancelPrefetch();
+	}
+
+	std::unique_ptr<CCommand> command(pCommand);
+	if (Fold(command, origin)) {
+		return;
+	}
+
+	bool const wasIdle = std::all_of(m_CommandList.begin(), m_CommandList.end(), [](CommandInfo const& c) { return c.origin == prefetch; });
+	m_CommandList.emplace_back(origin, std::move(command));
+	if (wasIdle) {
 		m_state.NotifyHandlers(STATECHANGE_REMOTE_IDLE);
+		if (m_exclusiveEngineLock) {
+			// Engine is lent to the queue, ask for it back
+			m_pMainFrame->GetQueue()->ReturnBrowsingEngine(m_pEngine);
+		}
 		ProcessNextCommand();
 	}
 }
 
+bool CCommandQueue::Fold(std::unique_ptr<CCommand> & command, command_origin origin)
+{
+	// The front command may already be running
+	if (m_CommandList.size() < 2) {
+		return false;
+	}
+
+	auto & back = m_CommandList.back();
+	if (back.origin != origin || back.didReconnect) {
+		return false;
+	}
+
+	Command const id = command->GetId();
+	Command const backId = back.command->GetId();
+	if (id == Command::del && backId == Command::del) {
+		auto & prev = static_cast<CDeleteCommand&>(*back.command);
+		auto & next = static_cast<CDeleteCommand&>(*command);
+		if (prev.GetPath() != next.GetPath()) {
+			return false;
+		}
+
+		auto files = prev.ExtractFiles();
+		auto const& more = next.GetFiles();
+		files.insert(files.end(), more.begin(), more.end());
+		back.command = std::make_unique<CDeleteCommand>(next.GetPath(), std::move(files));
+		return true;
+	}
+
+	if (!CBatchCommand::CanBatch(*command)) {
+		return false;
+	}
+
+	if (backId == Command::batch) {
+		static_cast<CBatchCommand&>(*back.command).Add(std::move(command));
+		return true;
+	}
+	if (CBatchCommand::CanBatch(*back.command)) {
+		auto batch = std::make_unique<CBatchCommand>();
+		batch->Add(std::move(back.command));
+		batch->Add(std::move(command));
+		back.command = std::move(batch);
+		return true;
+	}
+
+	return false;
+}
+
 void CCommandQueue::ProcessNextCommand()
 {
 	if (m_inside_commandqueue) {
@@ -97,6 +169,92 @@ void CCommandQueue::ProcessNextCommand()
 		if (!m_state.SuccessfulConnect()) {
 			m_state.SetSite(Site());
 		}
+		else if (!m_exclusiveEngineLock) {
+			StartPrefetch();
+		}
+	}
+}
+
+void CCommandQueue::SchedulePrefetch(CDirectoryListing const& listing)
+{
+	m_prefetch.clear();
+
+	auto visited = std::find(m_visited.begin(), m_visited.end(), listing.path);
+	if (visited != m_visited.end()) {
+		m_visited.erase(visited);
+	}
+	m_visited.push_back(listing.path);
+	if (m_visited.size() > max_visited) {
+		m_visited.pop_front();
+	}
+
+	size_t const count = static_cast<size_t>(COptions::Get()->GetOptionVal(OPTION_PREFETCH_SUBDIRS));
+	if (!count) {
+		return;
+	}
+
+	// Rank of subdirectories visited before, lower is more recent
+	std::map<std::wstring, size_t> recent;
+	size_t rank{};
+	for (auto it = m_visited.rbegin(); it != m_visited.rend(); ++it, ++rank) {
+		if (it->HasParent() && it->GetParent() == listing.path) {
+			recent.emplace(it->GetLastSegment(), rank);
+		}
+	}
+
+	struct candidate {
+		size_t rank;
+		int64_t size;
+		size_t index;
+
+		bool operator<(candidate const& other) const {
+			return std::tie(rank, size, index) < std::tie(other.rank, other.size, other.index);
+		}
+	};
+	std::vector<candidate> candidates;
+	for (size_t i = 0; i < listing.size(); ++i) {
+		CDirentry const& entry = listing[i];
+		if (!entry.is_dir() || entry.is_link()) {
+			continue;
+		}
+		auto it = recent.find(entry.name);
+		candidates.push_back({it != recent.end() ? it->second : max_visited, entry.size < 0 ? std::numeric_limits<int64_t>::max() : entry.size, i});
+	}
+
+	size_t const n = std::min(count, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end());
+	for (size_t i = 0; i < n; ++i) {
+		CServerPath path = listing.path;
+		if (path.AddSegment(listing[candidates[i].index].name)) {
+			m_prefetch.push_back(std::move(path));
+		}
+	}
+}
+
+bool CCommandQueue::StartPrefetch()
+{
+	if (m_prefetch.empty() || m_quit || m_exclusiveEngineRequest || !m_state.IsRemoteConnected()) {
+		return false;
+	}
+
+	CServerPath const path = m_prefetch.front();
+	m_prefetch.pop_front();
+
+	// Already cached listings are not fetched again
+	m_CommandList.emplace_back(prefetch, std::make_unique<CListCommand>(path, std::wstring(), LIST_FLAG_AVOID));
+	ProcessNextCommand();
+	return true;
+}
+
+void CCommandQueue::CancelPrefetch()
+{
+	m_prefetch.clear();
+
+	// Anything else has priority, do not make it wait for the speculative listing
+	if (!m_exclusiveEngineLock && m_pEngine && !m_CommandList.empty() && m_CommandList.front().origin == prefetch) {
+		if (m_pEngine->Cancel() != FZ_REPLY_WOULDBLOCK) {
+			m_CommandList.pop_front();
+		}
 	}
 }
 
@@ -106,6 +264,8 @@ bool CCommandQueue::Cancel()
 		return false;
 	}
 
+	m_prefetch.clear();
+
 	if (m_CommandList.empty()) {
 		return true;
 	}
@@ -158,6 +318,7 @@ void CCommandQueue::ProcessReply(int nReplyCode, Command commandId)
 
 	if (commandId != Command::connect &&
 		commandId != Command::disconnect &&
+		commandInfo.origin != prefetch &&
 		(nReplyCode & FZ_REPLY_CANCELED) != FZ_REPLY_CANCELED)
 	{
 		if (nReplyCode & FZ_REPLY_DISCONNECTED) {
@@ -185,7 +346,7 @@ void CCommandQueue::ProcessReply(int nReplyCode, Command commandId)
 
 			m_state.LinkIsNotDir(pListCommand->GetPath(), pListCommand->GetSubDir());
 		}
-		else {
+		else if (commandInfo.origin != prefetch) {
 			if (commandInfo.origin == recursiveOperation) {
 				// Let the recursive operation handler know if a LIST command failed,
 				// so that it may issue the next command in recursive operations.
@@ -216,6 +377,14 @@ void CCommandQueue::ProcessReply(int nReplyCode, Command commandId)
 		m_state.SetSuccessfulConnect();
 		m_CommandList.pop_front();
 	}
+	else if (commandInfo.command->GetId() == Command::filehash) {
+		m_CommandList.pop_front();
+
+		// Let the comparison know so that it can request the next checksum
+		if (m_state.GetComparisonManager()) {
+			m_state.GetComparisonManager()->FileHashFinished(nReplyCode);
+		}
+	}
 	else {
 		m_CommandList.pop_front();
 	}
@@ -230,6 +399,7 @@ void CCommandQueue::RequestExclusiveEngine(bool requestExclusive)
 	wxASSERT(!m_exclusiveEngineLock || !requestExclusive);
 
 	if (!m_exclusiveEngineRequest && requestExclusive) {
+		CancelPrefetch();
 		m_requestId = ++m_requestIdCounter;
 		if (m_requestId < 0) {
 			m_requestIdCounter = 0;
@@ -290,6 +460,7 @@ void CCommandQueue::ProcessDirectoryListing(CDirectoryListingNotification const&
 {
 	auto const firstListing = std::find_if(m_CommandList.begin(), m_CommandList.end(), [](CommandInfo const& v) { return v.command->GetId() == Command::list; });
 	bool const listingIsRecursive = firstListing != m_CommandList.end() && firstListing->origin == recursiveOperation;
+	bool const listingIsPrefetch = firstListing != m_CommandList.end() && firstListing->origin == prefetch;
 
 	std::shared_ptr<CDirectoryListing> pListing;
 	if (!listingNotification.GetPath().empty()) {
@@ -309,11 +480,24 @@ void CCommandQueue::ProcessDirectoryListing(CDirectoryListingNotification const&
 			m_state.NotifyHandlers(STATECHANGE_REMOTE_DIR_OTHER, std::wstring(), &pListing);
 		}
 	}
-	else {
+	else if (!listingIsPrefetch) {
 		m_state.SetRemoteDir(pListing, listingNotification.Primary());
+		if (listingNotification.Primary() && pListing && !listingNotification.Failed()) {
+			SchedulePrefetch(*pListing);
+		}
 	}
 
 	if (pListing && !listingNotification.Failed() && m_state.GetSite()) {
 		CContextManager::Get()->ProcessDirectoryListing(m_state.GetSite().server, pListing, listingIsRecursive ? 0 : &m_state);
 	}
 }
+
+void CCommandQueue::ProcessDirectoryListingProgress(CDirectoryListingProgressNotification const& notification)
+{
+	auto const firstListing = std::find_if(m_CommandList.begin(), m_CommandList.end(), [](CommandInfo const& v) { return v.command->GetId() == Command::list; });
+	if (firstListing == m_CommandList.end() || firstListing->origin == recursiveOperation) {
+		return;
+	}
+
+	m_state.NotifyHandlers(STATECHANGE_REMOTE_DIR_PARTIAL, std::wstring(), &notification);
+}
@@ -15,13 +15,16 @@ public:
 	{
 		any = -1,
 		normal, // Most user actions
-		recursiveOperation
+		recursiveOperation,
+		comparison, // Checksums for content comparison
+		prefetch // Speculative listings, fill the cache only
 	};
 
 	CCommandQueue(CFileZillaEngine *pEngine, CMainFrame* pMainFrame, CState& state);
 
 	void ProcessCommand(CCommand *pCommand, command_origin origin = normal);
 	void ProcessNextCommand();
+	// Prefetching does not count as being busy
 	bool Idle(command_origin origin = any) const;
 	bool Cancel();
 	bool Quit();
@@ -33,13 +36,27 @@ public:
 	void ReleaseEngine();
 	bool EngineLocked() const { return m_exclusiveEngineLock; }
 
+	// True if commands are waiting, e.g. for the queue to return the engine
+	bool HasPendingCommands() const { return !m_CommandList.empty(); }
+
 	void ProcessDirectoryListing(CDirectoryListingNotification const& listingNotification);
+	void ProcessDirectoryListingProgress(CDirectoryListingProgressNotification const& notification);
 
 protected:
 	void ProcessReply(int nReplyCode, Command commandId);
 
+	// Merges the command into the last queued one if possible, so that
+	// runs of small commands become a single engine operation.
+	bool Fold(std::unique_ptr<CCommand> & command, command_origin origin);
+
 	void GrantExclusiveEngineRequest();
 
+	// Queues the subdirectories of a freshly listed directory for prefetching,
+	// those visited recently and small ones first.
+	void SchedulePrefetch(CDirectoryListing const& listing);
+	bool StartPrefetch();
+	void CancelPrefetch();
+
 	CFileZillaEngine *m_pEngine;
 	CMainFrame* m_pMainFrame;
 	CState& m_state;
@@ -64,6 +81,9 @@ protected:
 	};
 	std::deque<CommandInfo> m_CommandList;
 
+	std::deque<CServerPath> m_prefetch;
+	std::deque<CServerPath> m_visited;
+
 	bool m_quit{};
 };
 
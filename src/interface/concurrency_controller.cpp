@@ -0,0 +1,78 @@
+#include <filezilla.h>
+#include "concurrency_controller.h"
+
+#include <algorithm>
+
+namespace {
+// With samples taken every 5 seconds, this gives transfers 15 seconds to
+// ramp up after a change of the limit.
+int const samples_per_decision = 3;
+
+// Try a higher level again after about two minutes on a plateau
+int const plateau_samples = 24;
+
+fz::duration const refusal_hold = fz::duration::from_minutes(10);
+}
+
+bool CConcurrencyController::Sample(int64_t throughput, int active, int max)
+{
+	if (max < 1) {
+		max = 1;
+	}
+	limit_ = std::clamp(limit_, 1, max);
+
+	if (active < limit_ || active < 1) {
+		// Not saturated, nothing can be learned about the current limit
+		samples_ = 0;
+		return false;
+	}
+
+	// Keyed by the limit, active can briefly exceed it after lowering it
+	auto & smoothed = throughput_[limit_];
+	smoothed = smoothed ? (smoothed * 3 + throughput) / 4 : throughput;
+
+	if (++samples_ < samples_per_decision) {
+		return false;
+	}
+	samples_ = 0;
+
+	int ceiling = max;
+	if (refused_limit_) {
+		if (fz::monotonic_clock::now() < refused_until_) {
+			ceiling = std::min(ceiling, refused_limit_);
+		}
+		else {
+			refused_limit_ = 0;
+		}
+	}
+
+	auto const lower = throughput_.find(limit_ - 1);
+	if (lower != throughput_.end() && smoothed < lower->second - lower->second / 20) {
+		// Worse than with one transfer less
+		--limit_;
+		plateau_ = 0;
+		return false;
+	}
+
+	bool const gained = lower == throughput_.end() || smoothed > lower->second + lower->second / 20;
+	if (!gained && ++plateau_ < plateau_samples / samples_per_decision) {
+		return false;
+	}
+
+	if (limit_ < ceiling) {
+		++limit_;
+		plateau_ = 0;
+		return true;
+	}
+
+	return false;
+}
+
+void CConcurrencyController::Refused(int accepted)
+{
+	refused_limit_ = std::max(1, accepted);
+	refused_until_ = fz::monotonic_clock::now() + refusal_hold;
+	limit_ = std::min(limit_, refused_limit_);
+	samples_ = 0;
+	plateau_ = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef FILEZILLA_INTERFACE_CONCURRENCY_CONTROLLER_HEADER
+#define FILEZILLA_INTERFACE_CONCURRENCY_CONTROLLER_HEADER
+
+#include <libfilezilla/time.hpp>
+
+#include <map>
+
+// Finds the number of parallel transfers to a server with the highest
+// aggregate throughput.
+//
+// While all allowed transfers are busy, the throughput is sampled
+// periodically. Each level of concurrency keeps a smoothed throughput, the
+// limit is raised as long as that keeps rising and lowered again if it goes
+// down. From a plateau, higher levels are tried again from time to time as
+// conditions change. If the server refuses a connection, the limit drops
+// below the number of connections it accepted and stays there for a while.
+class CConcurrencyController final
+{
+public:
+	int Limit() const { return limit_; }
+
+	// Returns true if the limit got raised. max is the configured upper bound.
+	bool Sample(int64_t throughput, int active, int max);
+
+	// The server refused a connection while it accepted the given number of
+	// other connections
+	void Refused(int accepted);
+
+private:
+	int limit_{2};
+
+	// Smoothed throughput at each level of concurrency
+	std::map<int, int64_t> throughput_;
+
+	// Samples taken at the current limit
+	int samples_{};
+
+	// Samples spent on a plateau
+	int plateau_{};
+
+	// No probing above refused_limit_ until refused_until_
+	int refused_limit_{};
+	fz::monotonic_clock refused_until_;
+};
+
+#endif
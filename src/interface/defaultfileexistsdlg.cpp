@@ -3,13 +3,16 @@
 
 CFileExistsNotification::OverwriteAction CDefaultFileExistsDlg::m_defaults[2] = {CFileExistsNotification::unknown, CFileExistsNotification::unknown};
 
-bool CDefaultFileExistsDlg::Load(wxWindow *parent, bool fromQueue)
+bool CDefaultFileExistsDlg::Load(wxWindow *parent, bool fromQueue, wxString const& description)
 {
 	if (!wxDialogEx::Load(parent, _T("ID_DEFAULTFILEEXISTSDLG"))) {
 		return false;
 	}
 
-	if (fromQueue) {
+	if (!description.empty()) {
+		XRCCTRL(*this, "ID_DESCRIPTION", wxStaticText)->SetLabel(description);
+	}
+	else if (fromQueue) {
 		XRCCTRL(*this, "ID_DESCRIPTION", wxStaticText)->SetLabel(_("Select default file exists action only for the currently selected files in the queue."));
 	}
 	else {
@@ -6,7 +6,8 @@
 class CDefaultFileExistsDlg final : protected wxDialogEx
 {
 public:
-	bool Load(wxWindow *parent, bool fromQueue);
+	// If given, description replaces the explanation of the dialog
+	bool Load(wxWindow *parent, bool fromQueue, wxString const& description = wxString());
 
 	static CFileExistsNotification::OverwriteAction GetDefault(bool download);
 	static void SetDefault(bool download, CFileExistsNotification::OverwriteAction action);
@@ -275,12 +275,99 @@ std::unique_ptr<CShellExtensionInterface> CShellExtensionInterface::CreateInitia
 
 #endif
 
+namespace {
+// The payload is prefixed by this magic and a version. Payloads of older
+// versions are XML, they are still accepted.
+char const magic[] = "FZRDO";
+uint8_t const version = 1;
+
+// A file record has at least flags, size and name length
+size_t const min_file_record = 1 + 8 + 4;
+
+uint8_t const flag_dir = 0x1;
+uint8_t const flag_link = 0x2;
+
+void append_le(std::string & out, uint64_t v, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+void append_string(std::string & out, std::string const& s)
+{
+	append_le(out, s.size(), 4);
+	out += s;
+}
+
+class reader final
+{
+public:
+	reader(unsigned char const* p, size_t len)
+		: p_(p), end_(p + len)
+	{}
+
+	bool read(uint64_t & v, size_t bytes)
+	{
+		if (remaining() < bytes) {
+			return false;
+		}
+		v = 0;
+		for (size_t i = 0; i < bytes; ++i) {
+			v |= static_cast<uint64_t>(*p_++) << (i * 8);
+		}
+		return true;
+	}
+
+	bool read(char const*& s, size_t & len)
+	{
+		uint64_t v;
+		if (!read(v, 4) || remaining() < v) {
+			return false;
+		}
+		s = reinterpret_cast<char const*>(p_);
+		len = static_cast<size_t>(v);
+		p_ += len;
+		return true;
+	}
+
+	size_t remaining() const { return static_cast<size_t>(end_ - p_); }
+
+private:
+	unsigned char const* p_;
+	unsigned char const* const end_;
+};
+
+struct string_xml_writer final : public pugi::xml_writer
+{
+	virtual void write(void const* data, size_t size) override {
+		result.append(static_cast<char const*>(data), size);
+	}
+
+	std::string result;
+};
+}
+
 CRemoteDataObject::CRemoteDataObject(Site const& site, const CServerPath& path)
 	: wxDataObjectSimple(wxDataFormat(_T("FileZilla3RemoteDataObject")))
 	, site_(site)
 	, m_path(path)
 	, m_processId(wxGetProcessId())
 {
+	pugi::xml_document document;
+	SetServer(document.append_child("Server"), site_);
+	string_xml_writer server;
+	document.print(server, PUGIXML_TEXT(""), pugi::format_raw, pugi::encoding_utf8);
+
+	data_.append(magic, sizeof(magic) - 1);
+	append_le(data_, version, 1);
+	append_le(data_, static_cast<uint32_t>(m_processId), 4);
+	append_string(data_, server.result);
+	append_string(data_, fz::to_utf8(m_path.GetSafePath()));
+
+	// Set in Finalize
+	countOffset_ = data_.size();
+	append_le(data_, 0, 8);
 }
 
 CRemoteDataObject::CRemoteDataObject()
@@ -293,23 +380,16 @@ size_t CRemoteDataObject::GetDataSize() const
 {
 	wxASSERT(!m_path.empty());
 
-	wxCHECK(m_xmlFile.GetElement(), 0);
-
-	m_expectedSize = m_xmlFile.GetRawDataLength() + 1;
-
-	return m_expectedSize;
+	return data_.size();
 }
 
 bool CRemoteDataObject::GetDataHere(void *buf) const
 {
 	wxASSERT(!m_path.empty());
 
-	wxCHECK(m_xmlFile.GetElement(), false);
+	wxCHECK(countOffset_, false);
 
-	m_xmlFile.GetRawDataHere((char*)buf, m_expectedSize);
-	if (m_expectedSize > 0) {
-		static_cast<char*>(buf)[m_expectedSize - 1] = 0;
-	}
+	memcpy(buf, data_.data(), data_.size());
 
 	const_cast<CRemoteDataObject*>(this)->m_didSendData = true;
 	return true;
@@ -317,41 +397,100 @@ bool CRemoteDataObject::GetDataHere(void *buf) const
 
 void CRemoteDataObject::Finalize()
 {
-	// Convert data into XML
-	auto element = m_xmlFile.CreateEmpty();
-	element = element.append_child("RemoteDataObject");
-
-	AddTextElement(element, "ProcessId", m_processId);
+	wxCHECK_RET(countOffset_, "Finalize called on received data object");
 
-	AddTextElement(element, "Count", m_fileList.size());
+	for (size_t i = 0; i < 8; ++i) {
+		data_[countOffset_ + i] = static_cast<char>((count_ >> (i * 8)) & 0xff);
+	}
+}
 
-	auto xServer = element.append_child("Server");
-	SetServer(xServer, site_);
+bool CRemoteDataObject::SetData(size_t len, const void* buf)
+{
+	auto const* data = static_cast<unsigned char const*>(buf);
+	if (!len) {
+		return false;
+	}
 
-	AddTextElement(element, "Path", m_path.GetSafePath());
+	m_fileList.clear();
 
-	auto files = element.append_child("Files");
-	for (auto const& info : m_fileList) {
-		auto file = files.append_child("File");
-		AddTextElement(file, "Name", info.name);
-		AddTextElement(file, "Dir", info.dir ? 1 : 0);
-		AddTextElement(file, "Size", info.size);
-		AddTextElement(file, "Link", info.link ? 1 : 0);
+	size_t const magicLen = sizeof(magic) - 1;
+	if (len > magicLen && !memcmp(data, magic, magicLen)) {
+		return ParseBinary(data + magicLen, len - magicLen);
 	}
+	return ParseXml(data, len);
 }
 
-bool CRemoteDataObject::SetData(size_t len, const void* buf)
+bool CRemoteDataObject::ParseBinary(unsigned char const* data, size_t len)
 {
-	char* data = (char*)buf;
-	if (!len) {
+	reader r(data, len);
+
+	uint64_t v;
+	if (!r.read(v, 1) || v != version) {
+		return false;
+	}
+
+	if (!r.read(v, 4)) {
+		return false;
+	}
+	m_processId = static_cast<int>(static_cast<uint32_t>(v));
+
+	char const* s;
+	size_t slen;
+	if (!r.read(s, slen)) {
+		return false;
+	}
+	pugi::xml_document document;
+	if (!document.load_buffer(s, slen, pugi::parse_default, pugi::encoding_utf8) || !::GetServer(document.child("Server"), site_)) {
+		return false;
+	}
+
+	if (!r.read(s, slen)) {
+		return false;
+	}
+	std::wstring const path = fz::to_wstring_from_utf8(s, slen);
+	if (path.empty() || !m_path.SetSafePath(path)) {
+		return false;
+	}
+
+	uint64_t count;
+	if (!r.read(count, 8) || count > r.remaining() / min_file_record) {
 		return false;
 	}
+	m_fileList.reserve(static_cast<size_t>(count));
+
+	for (uint64_t i = 0; i < count; ++i) {
+		uint64_t flags;
+		uint64_t size;
+		if (!r.read(flags, 1) || !r.read(size, 8) || !r.read(s, slen)) {
+			return false;
+		}
 
-	if (!m_xmlFile.ParseData(reinterpret_cast<uint8_t const*>(data), len)) {
+		t_fileInfo info;
+		info.name = fz::to_wstring_from_utf8(s, slen);
+		if (info.name.empty()) {
+			return false;
+		}
+		info.dir = flags & flag_dir;
+		info.link = flags & flag_link;
+		info.size = static_cast<int64_t>(size);
+		if (info.size < -1) {
+			return false;
+		}
+
+		m_fileList.push_back(std::move(info));
+	}
+
+	return !r.remaining();
+}
+
+bool CRemoteDataObject::ParseXml(unsigned char const* data, size_t len)
+{
+	CXmlFile xmlFile;
+	if (!xmlFile.ParseData(data, len)) {
 		return false;
 	}
 
-	auto element = m_xmlFile.GetElement();
+	auto element = xmlFile.GetElement();
 	if (!element || !(element = element.child("RemoteDataObject"))) {
 		return false;
 	}
@@ -381,7 +520,6 @@ bool CRemoteDataObject::SetData(size_t len, const void* buf)
 		return false;
 	}
 
-	m_fileList.clear();
 	auto files = element.child("Files");
 	if (!files) {
 		return false;
@@ -415,18 +553,16 @@ bool CRemoteDataObject::SetData(size_t len, const void* buf)
 
 void CRemoteDataObject::Reserve(size_t count)
 {
-	m_fileList.reserve(count);
+	// Rough guess, most names are short
+	data_.reserve(data_.size() + count * (min_file_record + 16));
 }
 
 void CRemoteDataObject::AddFile(std::wstring const& name, bool dir, int64_t size, bool link)
 {
-	t_fileInfo info;
-	info.name = name;
-	info.dir = dir;
-	info.size = size;
-	info.link = link;
-
-	m_fileList.push_back(info);
+	append_le(data_, (dir ? flag_dir : 0) | (link ? flag_link : 0), 1);
+	append_le(data_, static_cast<uint64_t>(size), 8);
+	append_string(data_, fz::to_utf8(name));
+	++count_;
 }
 
 
@@ -62,24 +62,29 @@ public:
 		bool link;
 	};
 
+	// Only filled on the receiving side
 	const std::vector<t_fileInfo>& GetFiles() const { return m_fileList; }
 
+	// Files are serialized as they get added
 	void Reserve(size_t count);
 	void AddFile(std::wstring const& name, bool dir, int64_t size, bool link);
 
 protected:
+	bool ParseBinary(unsigned char const* data, size_t len);
+	bool ParseXml(unsigned char const* data, size_t len);
+
 	Site site_;
 	CServerPath m_path;
 
-	mutable CXmlFile m_xmlFile;
-
 	bool m_didSendData{};
 
 	int m_processId;
 
 	std::vector<t_fileInfo> m_fileList;
 
-	mutable size_t m_expectedSize{};
+	std::string data_;
+	size_t countOffset_{};
+	uint64_t count_{};
 };
 
 #if FZ3_USESHELLEXT
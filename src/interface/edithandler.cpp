@@ -4,6 +4,7 @@
 #include "edithandler.h"
 #include "filezillaapp.h"
 #include "file_utils.h"
+#include "local_dir_watcher.h"
 #include "Options.h"
 #include "queue.h"
 #include "textctrlex.h"
@@ -81,6 +82,8 @@ CEditHandler::CEditHandler()
 	m_timer.SetOwner(this);
 	m_busyTimer.SetOwner(this);
 
+	m_watcher = std::make_unique<CLocalDirWatcher>([this](std::wstring const& dir, std::vector<std::wstring> const& names) { OnDirChanged(dir, names); });
+
 #ifdef __WXMSW__
 	m_lockfile_handle = INVALID_HANDLE_VALUE;
 #else
@@ -88,6 +91,10 @@ CEditHandler::CEditHandler()
 #endif
 }
 
+CEditHandler::~CEditHandler()
+{
+}
+
 CEditHandler* CEditHandler::Create()
 {
 	if (!m_pEditHandler) {
@@ -361,7 +368,8 @@ bool CEditHandler::AddFile(CEditHandler::fileType type, std::wstring const& loca
 		bool const launched = LaunchEditor(local, data);
 
 		if (launched && COptions::Get()->GetOptionVal(OPTION_EDIT_TRACK_LOCAL)) {
-			m_fileDataList[type].emplace_back(std::move(data));
+			Insert(type, std::move(data));
+			SetTimerState();
 		}
 		if (!launched) {
 			wxMessageBoxEx(wxString::Format(_("The file '%s' could not be opened:\nThe associated command failed"), localFile), _("Opening failed"), wxICON_EXCLAMATION);
@@ -369,7 +377,7 @@ bool CEditHandler::AddFile(CEditHandler::fileType type, std::wstring const& loca
 		return launched;
 	}
 	else {
-		m_fileDataList[type].emplace_back(std::move(data));
+		Insert(type, std::move(data));
 
 		std::wstring localFileName;
 		CLocalPath localPath(localFile, &localFileName);
@@ -395,7 +403,7 @@ bool CEditHandler::Remove(std::wstring const& fileName)
 		return false;
 	}
 
-	m_fileDataList[local].erase(iter);
+	Erase(local, iter);
 
 	return true;
 }
@@ -419,7 +427,7 @@ bool CEditHandler::Remove(std::wstring const& fileName, CServerPath const& remot
 		}
 	}
 
-	m_fileDataList[remote].erase(iter);
+	Erase(remote, iter);
 
 	return true;
 }
@@ -443,6 +451,7 @@ bool CEditHandler::RemoveAll(bool force)
 		}
 	}
 	m_fileDataList[remote].swap(keep);
+	Reindex(remote);
 	keep.clear();
 
 	for (auto iter = m_fileDataList[local].begin(); iter != m_fileDataList[local].end(); ++iter) {
@@ -456,6 +465,7 @@ bool CEditHandler::RemoveAll(bool force)
 		}
 	}
 	m_fileDataList[local].swap(keep);
+	Reindex(local);
 
 	return m_fileDataList[local].empty() && m_fileDataList[remote].empty();
 }
@@ -490,32 +500,29 @@ bool CEditHandler::RemoveAll(fileState state, Site const& site)
 		}
 	}
 	m_fileDataList[remote].swap(keep);
+	Reindex(remote);
 
 	return true;
 }
 
 std::list<CEditHandler::t_fileData>::iterator CEditHandler::GetFile(std::wstring const& fileName)
 {
-	std::list<t_fileData>::iterator iter;
-	for (iter = m_fileDataList[local].begin(); iter != m_fileDataList[local].end(); ++iter) {
-		if (iter->localFile == fileName) {
-			break;
-		}
+	auto it = m_fileIndex[local].find(fileName);
+	if (it == m_fileIndex[local].end()) {
+		return m_fileDataList[local].end();
 	}
 
-	return iter;
+	return it->second;
 }
 
 std::list<CEditHandler::t_fileData>::const_iterator CEditHandler::GetFile(std::wstring const& fileName) const
 {
-	std::list<t_fileData>::const_iterator iter;
-	for (iter = m_fileDataList[local].begin(); iter != m_fileDataList[local].end(); ++iter) {
-		if (iter->localFile == fileName) {
-			break;
-		}
+	auto it = m_fileIndex[local].find(fileName);
+	if (it == m_fileIndex[local].end()) {
+		return m_fileDataList[local].end();
 	}
 
-	return iter;
+	return it->second;
 }
 
 std::list<CEditHandler::t_fileData>::iterator CEditHandler::GetFile(std::wstring const& fileName, CServerPath const& remotePath, Site const& site)
@@ -574,14 +581,17 @@ void CEditHandler::FinishTransfer(bool, std::wstring const& fileName)
 	switch (iter->state)
 	{
 	case upload_and_remove:
-		m_fileDataList[local].erase(iter);
+		Erase(local, iter);
 		break;
 	case upload:
 		if (wxFileName::FileExists(fileName)) {
 			iter->state = edit;
+
+			// Changes during the upload were not looked at
+			QueueCheck(local, iter->localFile);
 		}
 		else {
-			m_fileDataList[local].erase(iter);
+			Erase(local, iter);
 		}
 		break;
 	default:
@@ -608,12 +618,12 @@ void CEditHandler::FinishTransfer(bool successful, std::wstring const& fileName,
 				iter->state = removing;
 			}
 			else {
-				m_fileDataList[remote].erase(iter);
+				Erase(remote, iter);
 			}
 		}
 		else {
 			if (!wxFileName::FileExists(iter->localFile)) {
-				m_fileDataList[remote].erase(iter);
+				Erase(remote, iter);
 			}
 			else {
 				iter->state = upload_and_remove_failed;
@@ -623,9 +633,10 @@ void CEditHandler::FinishTransfer(bool successful, std::wstring const& fileName,
 	case upload:
 		if (wxFileName::FileExists(iter->localFile)) {
 			iter->state = edit;
+			QueueCheck(remote, iter->localFile);
 		}
 		else {
-			m_fileDataList[remote].erase(iter);
+			Erase(remote, iter);
 		}
 		break;
 	case download:
@@ -639,7 +650,7 @@ void CEditHandler::FinishTransfer(bool successful, std::wstring const& fileName,
 			iter->state = removing;
 		}
 		else {
-			m_fileDataList[remote].erase(iter);
+			Erase(remote, iter);
 		}
 		break;
 	default:
@@ -689,8 +700,7 @@ bool CEditHandler::LaunchEditor(CEditHandler::fileType type, t_fileData& data)
 
 void CEditHandler::CheckForModifications(bool emitEvent)
 {
-	static bool insideCheckForModifications = false;
-	if (insideCheckForModifications) {
+	if (m_checking) {
 		return;
 	}
 
@@ -699,83 +709,197 @@ void CEditHandler::CheckForModifications(bool emitEvent)
 		return;
 	}
 
-	insideCheckForModifications = true;
+	m_checking = true;
+
+	// A full check covers everything reported by the watcher so far
+	m_changedFiles.clear();
 
+	std::vector<std::pair<fileType, std::wstring>> files;
 	for (int i = 0; i < 2; ++i) {
-checkmodifications_loopbegin:
-		for (auto iter = m_fileDataList[i].begin(); iter != m_fileDataList[i].end(); ++iter) {
-			if (iter->state != edit) {
-				continue;
+		for (auto const& data : m_fileDataList[i]) {
+			if (data.state == edit) {
+				files.emplace_back(fileType(i), data.localFile);
 			}
+		}
+	}
 
-			fz::datetime mtime;
-			bool is_link;
-			if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file) {
-				m_fileDataList[i].erase(iter);
+	for (auto const& file : files) {
+		if (!CheckFile(file.first, file.second)) {
+			m_checking = false;
+			return;
+		}
+	}
 
-				// Evil goto. Imo the next C++ standard needs a comefrom keyword.
-				goto checkmodifications_loopbegin;
-			}
+	FinishCheck();
+}
 
-			if (mtime.empty()) {
-				continue;
-			}
+void CEditHandler::CheckChangedFiles()
+{
+	if (m_checking) {
+		// Picked up once the running check is done
+		return;
+	}
 
-			if (!iter->modificationTime.empty() && !iter->modificationTime.compare(mtime)) {
-				continue;
-			}
+	m_checking = true;
 
-			// File has changed, ask user what to do
+	while (!m_changedFiles.empty()) {
+		auto const file = *m_changedFiles.begin();
+		m_changedFiles.erase(m_changedFiles.begin());
 
-			m_busyTimer.Stop();
-			if (!wxDialogEx::CanShowPopupDialog()) {
-				m_busyTimer.Start(1000, true);
-				insideCheckForModifications = false;
-				return;
+		if (!CheckFile(file.first, file.second)) {
+			// A full check happens once the user can be asked
+			m_changedFiles.clear();
+			m_checking = false;
+			return;
+		}
+	}
+
+	FinishCheck();
+}
+
+void CEditHandler::FinishCheck()
+{
+	SetTimerState();
+
+	m_checking = false;
+
+	// Changes reported while a dialog was shown
+	if (!m_changedFiles.empty()) {
+		wxCommandEvent* evt = new wxCommandEvent(fzEDIT_CHANGEDFILE);
+		evt->SetInt(1);
+		QueueEvent(evt);
+	}
+}
+
+bool CEditHandler::CheckFile(fileType type, std::wstring const& localFile)
+{
+	auto it = m_fileIndex[type].find(localFile);
+	if (it == m_fileIndex[type].end()) {
+		return true;
+	}
+	auto iter = it->second;
+	if (iter->state != edit) {
+		return true;
+	}
+
+	fz::datetime mtime;
+	bool is_link;
+	if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file) {
+		Erase(type, iter);
+		return true;
+	}
+
+	if (mtime.empty()) {
+		return true;
+	}
+
+	if (!iter->modificationTime.empty() && !iter->modificationTime.compare(mtime)) {
+		return true;
+	}
+
+	// File has changed, ask user what to do
+
+	m_busyTimer.Stop();
+	if (!wxDialogEx::CanShowPopupDialog()) {
+		m_busyTimer.Start(1000, true);
+		return false;
+	}
+	wxTopLevelWindow* pTopWindow = (wxTopLevelWindow*)wxTheApp->GetTopWindow();
+	if (pTopWindow && pTopWindow->IsIconized()) {
+		pTopWindow->RequestUserAttention(wxUSER_ATTENTION_INFO);
+		return false;
+	}
+
+	bool remove;
+	int res = DisplayChangeNotification(type, *iter, remove);
+	if (res == -1) {
+		return true;
+	}
+
+	// The dialog runs an event loop, the file may be gone by now
+	it = m_fileIndex[type].find(localFile);
+	if (it == m_fileIndex[type].end()) {
+		return true;
+	}
+	iter = it->second;
+
+	if (res == wxID_YES) {
+		UploadFile(type, iter, remove);
+	}
+	else if (remove) {
+		if (type == remote) {
+			if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file || wxRemoveFile(iter->localFile)) {
+				Erase(type, iter);
 			}
-			wxTopLevelWindow* pTopWindow = (wxTopLevelWindow*)wxTheApp->GetTopWindow();
-			if (pTopWindow && pTopWindow->IsIconized()) {
-				pTopWindow->RequestUserAttention(wxUSER_ATTENTION_INFO);
-				insideCheckForModifications = false;
-				return;
+			else {
+				iter->state = removing;
 			}
+		}
+		else {
+			Erase(type, iter);
+		}
+	}
+	else if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file) {
+		Erase(type, iter);
+	}
+	else {
+		iter->modificationTime = mtime;
+	}
 
-			bool remove;
-			int res = DisplayChangeNotification(CEditHandler::fileType(i), *iter, remove);
-			if (res == -1) {
-				continue;
-			}
+	return true;
+}
 
-			if (res == wxID_YES) {
-				UploadFile(CEditHandler::fileType(i), iter, remove);
-				goto checkmodifications_loopbegin;
-			}
-			else if (remove) {
-				if (i == static_cast<int>(remote)) {
-					if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file || wxRemoveFile(iter->localFile)) {
-						m_fileDataList[i].erase(iter);
-						goto checkmodifications_loopbegin;
-					}
-					iter->state = removing;
-				}
-				else {
-					m_fileDataList[i].erase(iter);
-					goto checkmodifications_loopbegin;
+void CEditHandler::QueueCheck(fileType type, std::wstring const& localFile)
+{
+	if (m_changedFiles.empty() && !m_checking) {
+		wxCommandEvent* evt = new wxCommandEvent(fzEDIT_CHANGEDFILE);
+		evt->SetInt(1);
+		QueueEvent(evt);
+	}
+	m_changedFiles.emplace(type, localFile);
+}
+
+void CEditHandler::OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names)
+{
+	for (int i = 0; i < 2; ++i) {
+		if (names.empty()) {
+			// Unknown changes, check everything in that directory
+			for (auto const& entry : m_fileIndex[i]) {
+				if (!entry.first.compare(0, dir.size(), dir) && entry.first.find(wxFileName::GetPathSeparator(), dir.size()) == std::wstring::npos) {
+					QueueCheck(fileType(i), entry.first);
 				}
 			}
-			else if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, 0, &mtime, 0) != fz::local_filesys::file) {
-				m_fileDataList[i].erase(iter);
-				goto checkmodifications_loopbegin;
-			}
-			else {
-				iter->modificationTime = mtime;
+		}
+		else {
+			for (auto const& name : names) {
+				std::wstring const file = dir + name;
+				if (m_fileIndex[i].find(file) != m_fileIndex[i].end()) {
+					QueueCheck(fileType(i), file);
+				}
 			}
 		}
 	}
+}
 
-	SetTimerState();
+void CEditHandler::Insert(fileType type, t_fileData && data)
+{
+	std::wstring const localFile = data.localFile;
+	m_fileDataList[type].emplace_back(std::move(data));
+	m_fileIndex[type][localFile] = std::prev(m_fileDataList[type].end());
+}
 
-	insideCheckForModifications = false;
+void CEditHandler::Erase(fileType type, std::list<t_fileData>::iterator iter)
+{
+	m_fileIndex[type].erase(iter->localFile);
+	m_fileDataList[type].erase(iter);
+}
+
+void CEditHandler::Reindex(fileType type)
+{
+	m_fileIndex[type].clear();
+	for (auto iter = m_fileDataList[type].begin(); iter != m_fileDataList[type].end(); ++iter) {
+		m_fileIndex[type][iter->localFile] = iter;
+	}
 }
 
 int CEditHandler::DisplayChangeNotification(CEditHandler::fileType type, CEditHandler::t_fileData const& data, bool& remove)
@@ -884,7 +1008,7 @@ bool CEditHandler::UploadFile(fileType type, std::list<t_fileData>::iterator ite
 
 	bool is_link;
 	if (fz::local_filesys::get_file_info(fz::to_native(iter->localFile), is_link, &size, &mtime, 0) != fz::local_filesys::file) {
-		m_fileDataList[type].erase(iter);
+		Erase(type, iter);
 		return false;
 	}
 
@@ -899,7 +1023,7 @@ bool CEditHandler::UploadFile(fileType type, std::list<t_fileData>::iterator ite
 	std::wstring file;
 	CLocalPath localPath(iter->localFile, &file);
 	if (file.empty()) {
-		m_fileDataList[type].erase(iter);
+		Erase(type, iter);
 		return false;
 	}
 
@@ -924,14 +1048,36 @@ void CEditHandler::OnTimerEvent(wxTimerEvent&)
 
 void CEditHandler::SetTimerState()
 {
-	bool editing = GetFileCount(none, edit) != 0;
+	// Changes get reported by the watcher, only files in directories it
+	// cannot watch need to be polled.
+	std::vector<std::wstring> dirs;
+	for (int i = 0; i < 2; ++i) {
+		for (auto const& data : m_fileDataList[i]) {
+			if (data.state != edit) {
+				continue;
+			}
+			size_t const pos = data.localFile.rfind(wxFileName::GetPathSeparator());
+			if (pos != std::wstring::npos) {
+				dirs.push_back(data.localFile.substr(0, pos + 1));
+			}
+		}
+	}
+	m_watcher->Set(dirs);
+
+	bool poll = GetFileCount(none, edit) != 0 && dirs.empty();
+	for (auto const& dir : dirs) {
+		if (!m_watcher->Watching(dir)) {
+			poll = true;
+			break;
+		}
+	}
 
 	if (m_timer.IsRunning()) {
-		if (!editing) {
+		if (!poll) {
 			m_timer.Stop();
 		}
 	}
-	else if (editing) {
+	else if (poll) {
 		m_timer.Start(15000);
 	}
 }
@@ -989,9 +1135,14 @@ std::vector<std::wstring> CEditHandler::GetCustomAssociation(std::wstring_view c
 	return ret;
 }
 
-void CEditHandler::OnChangedFileEvent(wxCommandEvent&)
+void CEditHandler::OnChangedFileEvent(wxCommandEvent& event)
 {
-	CheckForModifications();
+	if (event.GetInt()) {
+		CheckChangedFiles();
+	}
+	else {
+		CheckForModifications();
+	}
 }
 
 std::wstring CEditHandler::GetTemporaryFile(std::wstring name)
@@ -8,6 +8,9 @@
 
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
 
 // Handles all aspects about remote file viewing/editing
 
@@ -25,6 +28,7 @@ enum type
 };
 }
 
+class CLocalDirWatcher;
 class CQueueView;
 class CEditHandler final : protected wxEvtHandler
 {
@@ -127,6 +131,7 @@ protected:
 	bool DoEdit(CEditHandler::fileType type, FileData const& file, CServerPath const& path, Site const& site, wxWindow* parent, size_t fileCount, int & already_editing_action);
 
 	CEditHandler();
+	virtual ~CEditHandler();
 
 	static CEditHandler* m_pEditHandler;
 
@@ -142,6 +147,13 @@ protected:
 
 	std::list<t_fileData> m_fileDataList[2];
 
+	// m_fileDataList by local file. Every change to the lists has to go
+	// through these functions to keep it current.
+	std::unordered_map<std::wstring, std::list<t_fileData>::iterator> m_fileIndex[2];
+	void Insert(fileType type, t_fileData && data);
+	void Erase(fileType type, std::list<t_fileData>::iterator iter);
+	void Reindex(fileType type);
+
 	std::list<t_fileData>::iterator GetFile(std::wstring const& fileName);
 	std::list<t_fileData>::const_iterator GetFile(std::wstring const& fileName) const;
 	std::list<t_fileData>::iterator GetFile(std::wstring const& fileName, CServerPath const& remotePath, Site const& site);
@@ -149,6 +161,20 @@ protected:
 
 	CQueueView* m_pQueue;
 
+	// Watches the directories of the files being edited. The timer only
+	// polls for files the watcher does not cover.
+	std::unique_ptr<CLocalDirWatcher> m_watcher;
+	void OnDirChanged(std::wstring const& dir, std::vector<std::wstring> const& names);
+
+	// Returns false if the user cannot be asked about a changed file right now
+	bool CheckFile(fileType type, std::wstring const& localFile);
+	void CheckChangedFiles();
+	void FinishCheck();
+	void QueueCheck(fileType type, std::wstring const& localFile);
+
+	std::set<std::pair<fileType, std::wstring>> m_changedFiles;
+	bool m_checking{};
+
 	wxTimer m_timer;
 	wxTimer m_busyTimer;
 
@@ -18,6 +18,64 @@ wxCSConv& GetConverter(std::wstring const& encoding)
 
 	return *conv_;
 }
+
+std::wstring ToLocal(wxCSConv & conv, std::vector<wchar_t> & buffer, char const* in, size_t len)
+{
+	std::wstring ret;
+	if (buffer.size() <= len) {
+		buffer.resize(len + 1);
+	}
+
+	size_t written = conv.ToWChar(&buffer[0], buffer.size() - 1, in, len);
+	if (written != wxCONV_FAILED) {
+		ret.assign(&buffer[0], &buffer[written]);
+	}
+	return ret;
+}
+
+std::string ToServer(wxCSConv & conv, std::vector<char> & buffer, wchar_t const* in, size_t len)
+{
+	std::string ret;
+
+	// We assume no encoding needs more than 4 characters per byte.
+	if (buffer.size() <= len * 4) {
+		buffer.resize(len * 4 + 1);
+	}
+
+	// Pro-tip: Never ever look into the wxMBConv internals if you value your sanity.
+	size_t written = conv.FromWChar(&buffer[0], buffer.size() - 1, in, len);
+	if (written != wxCONV_FAILED) {
+		ret.assign(&buffer[0], &buffer[written]);
+	}
+	return ret;
+}
+
+// Owns its conversion state, unlike the thread-local converters it is
+// neither looked up by name nor shared.
+class custom_converter final : public CustomEncodingConverterBase::converter
+{
+public:
+	explicit custom_converter(std::wstring const& encoding)
+		: conv_(encoding)
+	{}
+
+	bool ok() const { return conv_.IsOk(); }
+
+	virtual std::wstring toLocal(char const* buffer, size_t len) override
+	{
+		return ToLocal(conv_, toLocalBuffer_, buffer, len);
+	}
+
+	virtual std::string toServer(wchar_t const* buffer, size_t len) override
+	{
+		return ToServer(conv_, toServerBuffer_, buffer, len);
+	}
+
+private:
+	wxCSConv conv_;
+	std::vector<char> toServerBuffer_;
+	std::vector<wchar_t> toLocalBuffer_;
+};
 }
 
 CustomEncodingConverter const& CustomEncodingConverter::Get()
@@ -28,40 +86,27 @@ CustomEncodingConverter const& CustomEncodingConverter::Get()
 
 std::wstring CustomEncodingConverter::toLocal(std::wstring const& encoding, char const* buffer, size_t len) const
 {
-	std::wstring ret;
-
 	auto & conv = GetConverter(encoding);
 	if (conv.IsOk()) {
-
-		if (toLocalBuffer_.size() <= len) {
-			toLocalBuffer_.resize(len + 1);
-		}
-
-		size_t written = conv.ToWChar(&toLocalBuffer_[0], toLocalBuffer_.size() - 1, buffer, len);
-		if (written != wxCONV_FAILED) { 
-			ret.assign(&toLocalBuffer_[0], &toLocalBuffer_[written]);
-		}
+		return ToLocal(conv, toLocalBuffer_, buffer, len);
 	}
-	return ret;
+	return std::wstring();
 }
 
 std::string CustomEncodingConverter::toServer(std::wstring const& encoding, wchar_t const* buffer, size_t len) const
 {
-	std::string ret;
-
 	auto & conv = GetConverter(encoding);
 	if (conv.IsOk()) {
+		return ToServer(conv, toServerBuffer_, buffer, len);
+	}
+	return std::string();
+}
 
-		// We assume no encoding needs more than 4 characters per byte.
-		if (toServerBuffer_.size() <= len * 4) {
-			toServerBuffer_.resize(len * 4 + 1);
-		}
-
-		// Pro-tip: Never ever look into the wxMBConv internals if you value your sanity.
-		size_t written = conv.FromWChar(&toServerBuffer_[0], toServerBuffer_.size() - 1, buffer, len);
-		if (written != wxCONV_FAILED) {
-			ret.assign(&toServerBuffer_[0], &toServerBuffer_[written]);
-		}
+std::unique_ptr<CustomEncodingConverterBase::converter> CustomEncodingConverter::Open(std::wstring const& encoding) const
+{
+	auto ret = std::make_unique<custom_converter>(encoding);
+	if (!ret->ok()) {
+		return nullptr;
 	}
 	return ret;
 }
@@ -86,9 +86,6 @@ void CExportDialog::Run()
 		}
 	}
 
-	if (queue) {
-		m_pQueueView->WriteToFile(exportRoot);
-	}
 
 	if (filters) {
 		CInterProcessMutex mutex(MUTEX_FILTERS);
@@ -106,5 +103,13 @@ void CExportDialog::Run()
 		}
 	}
 
-	xml.Save(true);
+	if (queue) {
+		// Written last, straight into the file
+		xml.SaveStreaming(true, [this](pugi::xml_writer& writer, unsigned int depth) {
+			m_pQueueView->WriteToFile(writer, depth);
+		});
+	}
+	else {
+		xml.Save(true);
+	}
 }
@@ -0,0 +1,289 @@
+#include <filezilla.h>
+#include "filehash.h"
+
+#include <libfilezilla/encode.hpp>
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/hash.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <optional>
+
+#ifndef FZ_WINDOWS
+#include <sys/stat.h>
+#endif
+#if HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#endif
+
+namespace {
+// Beyond this, the cache is simply discarded
+size_t const max_cache_size = 100000;
+
+// Cache file format, all integers little-endian:
+//   8 bytes magic, then per entry string file, i64 size, i64 modification
+//   time in milliseconds, u64 device, u64 inode, string algorithm, string hash.
+// Strings are u32 length followed by the UTF-8 data.
+char const cache_magic[] = "FZHASH01";
+
+class crc32_accumulator final
+{
+public:
+	crc32_accumulator()
+	{
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) {
+				c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+			}
+			table_[i] = c;
+		}
+	}
+
+	void update(unsigned char const* data, size_t size)
+	{
+		for (size_t i = 0; i < size; ++i) {
+			crc_ = table_[(crc_ ^ data[i]) & 0xff] ^ (crc_ >> 8);
+		}
+	}
+
+	std::vector<uint8_t> digest() const
+	{
+		uint32_t const crc = crc_ ^ 0xffffffffu;
+		return { static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16), static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc) };
+	}
+
+private:
+	uint32_t table_[256];
+	uint32_t crc_{0xffffffffu};
+};
+
+std::optional<fz::hash_algorithm> get_algorithm(std::wstring const& algorithm)
+{
+	if (algorithm == L"SHA-512") {
+		return fz::hash_algorithm::sha512;
+	}
+	if (algorithm == L"SHA-256") {
+		return fz::hash_algorithm::sha256;
+	}
+	if (algorithm == L"SHA-1") {
+		return fz::hash_algorithm::sha1;
+	}
+	if (algorithm == L"MD5") {
+		return fz::hash_algorithm::md5;
+	}
+	return {};
+}
+
+void append_le(std::string & out, uint64_t v, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+void append_string(std::string & out, std::string const& s)
+{
+	append_le(out, s.size(), 4);
+	out += s;
+}
+
+class reader final
+{
+public:
+	explicit reader(std::string const& data)
+		: p_(data.data()), end_(data.data() + data.size())
+	{}
+
+	bool read(uint64_t & v, size_t bytes)
+	{
+		if (static_cast<size_t>(end_ - p_) < bytes) {
+			return false;
+		}
+		v = 0;
+		for (size_t i = 0; i < bytes; ++i) {
+			v |= static_cast<uint64_t>(static_cast<unsigned char>(*p_++)) << (i * 8);
+		}
+		return true;
+	}
+
+	bool read(std::string & s)
+	{
+		uint64_t len;
+		if (!read(len, 4) || static_cast<uint64_t>(end_ - p_) < len) {
+			return false;
+		}
+		s.assign(p_, static_cast<size_t>(len));
+		p_ += len;
+		return true;
+	}
+
+	bool done() const { return p_ == end_; }
+
+private:
+	char const* p_;
+	char const* const end_;
+};
+
+// A file replaced by a different one with the same size and modification
+// time, e.g. by a rename, gets a different inode.
+void get_file_id(std::wstring const& file, uint64_t & device, uint64_t & inode)
+{
+	device = 0;
+	inode = 0;
+#ifndef FZ_WINDOWS
+	struct stat buf;
+	if (!stat(fz::to_native(file).c_str(), &buf)) {
+		device = static_cast<uint64_t>(buf.st_dev);
+		inode = static_cast<uint64_t>(buf.st_ino);
+	}
+#endif
+}
+}
+
+CLocalFileHasher& CLocalFileHasher::Get()
+{
+	static CLocalFileHasher hasher;
+	return hasher;
+}
+
+void CLocalFileHasher::SetCacheFile(std::wstring const& file)
+{
+	fz::scoped_lock l(mutex_);
+	cacheFile_ = file;
+	loaded_ = false;
+}
+
+void CLocalFileHasher::Load()
+{
+	loaded_ = true;
+	if (cacheFile_.empty()) {
+		return;
+	}
+
+	fz::file f(fz::to_native(cacheFile_), fz::file::reading);
+	if (!f.opened()) {
+		return;
+	}
+	int64_t const size = f.size();
+	if (size < 8 || size > 256 * 1024 * 1024) {
+		return;
+	}
+	std::string data;
+	data.resize(static_cast<size_t>(size));
+	if (f.read(&data[0], size) != size || data.compare(0, 8, cache_magic)) {
+		return;
+	}
+	data.erase(0, 8);
+
+	reader r(data);
+	while (!r.done() && cache_.size() < max_cache_size) {
+		std::string file, algorithm, hash;
+		uint64_t fileSize, time, device, inode;
+		if (!r.read(file) || !r.read(fileSize, 8) || !r.read(time, 8) || !r.read(device, 8) || !r.read(inode, 8) ||
+			!r.read(algorithm) || !r.read(hash))
+		{
+			// Entries read so far are fine, they are checked again on use anyhow
+			break;
+		}
+		cache_.emplace(std::make_tuple(fz::to_wstring_from_utf8(file), static_cast<int64_t>(fileSize), static_cast<int64_t>(time), device, inode, fz::to_wstring_from_utf8(algorithm)), std::move(hash));
+	}
+}
+
+void CLocalFileHasher::Save()
+{
+	fz::scoped_lock l(mutex_);
+	if (!modified_ || cacheFile_.empty()) {
+		return;
+	}
+	modified_ = false;
+
+	std::string out = cache_magic;
+	for (auto const& entry : cache_) {
+		auto const& key = entry.first;
+		append_string(out, fz::to_utf8(std::get<0>(key)));
+		append_le(out, static_cast<uint64_t>(std::get<1>(key)), 8);
+		append_le(out, static_cast<uint64_t>(std::get<2>(key)), 8);
+		append_le(out, std::get<3>(key), 8);
+		append_le(out, std::get<4>(key), 8);
+		append_string(out, fz::to_utf8(std::get<5>(key)));
+		append_string(out, entry.second);
+	}
+
+	fz::file f(fz::to_native(cacheFile_), fz::file::writing, fz::file::empty);
+	if (!f.opened() || f.write(out.data(), static_cast<int64_t>(out.size())) != static_cast<int64_t>(out.size())) {
+		f.close();
+		fz::remove_file(fz::to_native(cacheFile_));
+	}
+}
+
+bool CLocalFileHasher::Supported(std::wstring const& algorithm)
+{
+	return algorithm == L"CRC32" || get_algorithm(algorithm);
+}
+
+std::string CLocalFileHasher::Hash(std::wstring const& file, int64_t size, fz::datetime const& date, std::wstring const& algorithm, std::function<bool()> const& cancelled)
+{
+	if (!Supported(algorithm)) {
+		return {};
+	}
+
+	uint64_t device, inode;
+	get_file_id(file, device, inode);
+	int64_t const time = date.empty() ? 0 : (date - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds();
+
+	auto key = std::make_tuple(file, size, time, device, inode, algorithm);
+	{
+		fz::scoped_lock l(mutex_);
+		if (!loaded_) {
+			Load();
+		}
+		auto it = cache_.find(key);
+		if (it != cache_.end()) {
+			return it->second;
+		}
+	}
+
+	fz::file f(fz::to_native(file), fz::file::reading);
+	if (!f.opened()) {
+		return {};
+	}
+#if HAVE_POSIX_FADVISE
+	// The whole file gets read front to back, let the kernel read ahead
+	posix_fadvise(f.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	auto const hashAlgorithm = get_algorithm(algorithm);
+	std::optional<fz::hash_accumulator> acc;
+	crc32_accumulator crc;
+	if (hashAlgorithm) {
+		acc.emplace(*hashAlgorithm);
+	}
+
+	unsigned char buffer[65536];
+	int64_t read;
+	while ((read = f.read(buffer, sizeof(buffer))) > 0) {
+		if (cancelled()) {
+			return {};
+		}
+		if (acc) {
+			acc->update(buffer, static_cast<size_t>(read));
+		}
+		else {
+			crc.update(buffer, static_cast<size_t>(read));
+		}
+	}
+	if (read < 0) {
+		return {};
+	}
+
+	std::string hash = fz::hex_encode<std::string>(acc ? acc->digest() : crc.digest());
+
+	fz::scoped_lock l(mutex_);
+	if (cache_.size() >= max_cache_size) {
+		cache_.clear();
+	}
+	cache_.emplace(std::move(key), hash);
+	modified_ = true;
+
+	return hash;
+}
@@ -0,0 +1,51 @@
+#ifndef FILEZILLA_INTERFACE_FILEHASH_HEADER
+#define FILEZILLA_INTERFACE_FILEHASH_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+
+// Computes checksums of local files to compare them against the checksums
+// reported by servers. Algorithms are named like in CFileHashNotification,
+// hashes are lowercase hex.
+//
+// There is one instance for the whole program so that everything needing a
+// local checksum shares the same cache. If a cache file is set, hashes
+// survive restarts.
+class CLocalFileHasher final
+{
+public:
+	static CLocalFileHasher& Get();
+
+	static bool Supported(std::wstring const& algorithm);
+
+	// The cache file is loaded on first use and written by Save.
+	void SetCacheFile(std::wstring const& file);
+	void Save();
+
+	// Returns an empty string on failure or once cancelled returns true.
+	// As long as size, modification time and inode do not change, a file is
+	// only read once. Can be called from several threads at once.
+	std::string Hash(std::wstring const& file, int64_t size, fz::datetime const& date, std::wstring const& algorithm, std::function<bool()> const& cancelled);
+
+private:
+	CLocalFileHasher() = default;
+
+	void Load();
+
+	// File, size, modification time in milliseconds, device, inode, algorithm
+	typedef std::tuple<std::wstring, int64_t, int64_t, uint64_t, uint64_t, std::wstring> key_type;
+
+	fz::mutex mutex_;
+	std::map<key_type, std::string> cache_;
+
+	std::wstring cacheFile_;
+	bool loaded_{};
+	bool modified_{};
+};
+
+#endif
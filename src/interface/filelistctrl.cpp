@@ -27,6 +27,37 @@ DEFINE_EVENT_TYPE(fz_EVT_DEFERRED_MOUSEEVENT)
 #endif
 #endif
 
+#ifndef FILELISTCTRL_INCLUDE_TEMPLATE_DEFINITION
+namespace {
+class CListFormatWatcher final : public COptionChangeEventHandler
+{
+public:
+	CListFormatWatcher()
+	{
+		RegisterOption(OPTION_SIZE_FORMAT);
+		RegisterOption(OPTION_SIZE_USETHOUSANDSEP);
+		RegisterOption(OPTION_SIZE_DECIMALPLACES);
+		RegisterOption(OPTION_DATE_FORMAT);
+		RegisterOption(OPTION_TIME_FORMAT);
+	}
+
+	virtual void OnOptionsChanged(changed_options_t const&) override
+	{
+		++generation_;
+	}
+
+	// Cached texts start out with 0
+	unsigned int generation_{1};
+};
+}
+
+unsigned int GetListFormatGeneration()
+{
+	static CListFormatWatcher watcher;
+	return watcher.generation_;
+}
+#endif
+
 BEGIN_EVENT_TABLE_TEMPLATE1(CFileListCtrl, wxListCtrlEx, CFileData)
 EVT_LIST_COL_CLICK(wxID_ANY, CFileListCtrl<CFileData>::OnColumnClicked)
 EVT_LIST_COL_RIGHT_CLICK(wxID_ANY, CFileListCtrl<CFileData>::OnColumnRightClicked)
@@ -383,6 +414,7 @@ template<class CFileData> void CFileListCtrl<CFileData>::SortList(int column /*=
 	}
 	std::unique_ptr<CFileListCtrlSortBase> object = GetSortComparisonObject();
 	std::sort(start, m_indexMapping.end(), SortPredicate(object));
+	InvalidatePrefixIndex();
 
 	if (updateSelections) {
 		SortList_UpdateSelections(selected, focused_item, focused_index);
@@ -669,14 +701,13 @@ template<class CFileData> void CFileListCtrl<CFileData>::OnExitComparisonMode()
 	RefreshListOnly();
 }
 
-template<class CFileData> void CFileListCtrl<CFileData>::CompareAddFile(t_fileEntryFlags flags)
+template<class CFileData> void CFileListCtrl<CFileData>::CompareAddFile(unsigned int index, t_fileEntryFlags flags)
 {
 	if (flags == fill) {
 		m_indexMapping.push_back(m_fileData.size() - 1);
 		return;
 	}
 
-	int index = m_originalIndexMapping[m_comparisonIndex];
 	m_fileData[index].comparison_flags = flags;
 
 	m_indexMapping.push_back(index);
@@ -921,6 +952,7 @@ template<class CFileData> void CFileListCtrl<CFileData>::SetItemCount(int count)
 		m_focusItem = -1;
 	}
 	wxListCtrlEx::SetItemCount(count);
+	InvalidatePrefixIndex();
 }
 
 template<class CFileData> void CFileListCtrl<CFileData>::OnProcessFocusChange(wxCommandEvent& event)
@@ -5,6 +5,7 @@
 #include "systemimagelist.h"
 #include "listingcomparison.h"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
@@ -15,15 +16,32 @@ class CFilelistStatusBar;
 class CGtkEventCallbackProxyBase;
 #endif
 
+// Incremented whenever the size, date or time format changes, which makes
+// the formatted texts in CGenericFileData stale.
+unsigned int GetListFormatGeneration();
+
 class CGenericFileData
 {
 public:
 	std::wstring fileType;
 	int icon{-2};
 
+	// Formatted size and time, built on first display. Only valid if
+	// textGeneration equals GetListFormatGeneration(), reset textGeneration
+	// if the size or time change.
+	std::wstring sizeText;
+	std::wstring timeText;
+	unsigned int textGeneration{};
+
 	// t_fileEntryFlags is defined in listingcomparison.h as it will be used for
 	// both local and remote listings
 	CComparableListing::t_fileEntryFlags comparison_flags{CComparableListing::normal};
+
+	// Collation key of the name, built on first use by the sort helpers.
+	// sortKeyMode is the name sort mode it was built for, -1 if none.
+	// Reset sortKeyMode if the name changes.
+	std::wstring sortKey;
+	int sortKeyMode{-1};
 };
 
 class CFileListCtrlSortBase
@@ -81,67 +99,121 @@ public:
 		return str1.compare(str2);
 	}
 
-	static int CmpNatural(std::wstring_view const& str1, std::wstring_view const& str2)
+	// Produces the natural sort key of a name one character at a time.
+	// Numbers sort by value: Leading zeros are dropped and the number of
+	// remaining digits is put in front of them. The leading '0' sorts the
+	// number against other characters the same way a digit would. Equal
+	// numbers are then ordered by the character following them, the end
+	// of the name sorting first, and then by their number of leading zeros.
+	class natural_key_reader final
 	{
-		wchar_t const* p1 = str1.data();
-		wchar_t const* p2 = str2.data();
+	public:
+		explicit natural_key_reader(std::wstring_view const& name)
+			: name_(name)
+		{}
 
-		wchar_t const* const end1 = p1 + str1.size();
-		wchar_t const* const end2 = p2 + str2.size();
-
-		int res = 0;
-		int zeroCount = 0;
-		bool isNumber = false;
-		for (; p1 != end1 && p2 != end2; ++p1, ++p2) {
-			int diff = static_cast<int>(wxTolower(*p1)) - static_cast<int>(wxTolower(*p2));
-			if (isNumber) {
-				if (res == 0) {
-					res = diff;
+		// Returns false at the end of the key
+		bool next(wchar_t & c)
+		{
+			switch (state_) {
+			case state::text:
+				if (i_ >= name_.size()) {
+					return false;
 				}
-				int nbDigits = (wxIsdigit(*p1) ? 1 : 0) + (wxIsdigit(*p2) ? 1 : 0);
-				if (nbDigits == 0 && res == 0) {
-					if (zeroCount) {
-						break;
-					}
-					isNumber = false;
+				if (!wxIsdigit(name_[i_])) {
+					c = static_cast<wchar_t>(wxTolower(name_[i_++]));
+					return true;
 				}
-				else if (nbDigits != 2) {
-					break;
+				begin_ = i_;
+				while (i_ < name_.size() && wxIsdigit(name_[i_])) {
+					++i_;
 				}
-			}
-			else if (wxIsdigit(*p1) && wxIsdigit(*p2)) {
-				zeroCount = 0;
-				for (; *p1 == '0' && (p1 + 1) != end1 && wxIsdigit(*(p1 + 1)); ++p1) {
-					zeroCount++;
+				start_ = begin_;
+				while (start_ + 1 < i_ && name_[start_] == '0') {
+					++start_;
 				}
-				for (; *p2 == '0' && (p2 + 1) != end2 && wxIsdigit(*(p2 + 1)); ++p2) {
-					zeroCount--;
+				digit_ = start_;
+				state_ = state::length;
+				c = L'0';
+				return true;
+			case state::length:
+				state_ = state::digits;
+				c = static_cast<wchar_t>(std::min(i_ - start_, size_t(0xffff)));
+				return true;
+			case state::digits:
+				if (digit_ < i_) {
+					c = name_[digit_++];
+					return true;
 				}
-				res = *p1 - *p2;
-				isNumber = true;
-			}
-			else if (diff) {
-				return diff;
+				state_ = state::zeros;
+				if (i_ < name_.size()) {
+					c = static_cast<wchar_t>(wxTolower(name_[i_++]));
+				}
+				else {
+					c = L'\0';
+				}
+				return true;
+			case state::zeros:
+				state_ = state::text;
+				c = static_cast<wchar_t>(std::min(start_ - begin_, size_t(0xffff)));
+				return true;
 			}
+			return false;
 		}
 
-		if (res == 0 && isNumber) {
-			res = zeroCount;
-		}
+	private:
+		enum class state
+		{
+			text,
+			length,
+			digits,
+			zeros
+		};
+
+		std::wstring_view const name_;
+		size_t i_{};
+		size_t begin_{};
+		size_t start_{};
+		size_t digit_{};
+		state state_{state::text};
+	};
 
-		if (p1 == end1 && p2 == end2) {
-			return res;
-		}
-		if (!isNumber || res == 0) {
-			return (p1 == end1) ? -1 : 1;
+	// Compares the natural sort keys of the names without building them
+	static int CmpNatural(std::wstring_view const& str1, std::wstring_view const& str2)
+	{
+		natural_key_reader r1(str1);
+		natural_key_reader r2(str2);
+		while (true) {
+			wchar_t c1{};
+			wchar_t c2{};
+			bool const more1 = r1.next(c1);
+			bool const more2 = r2.next(c2);
+			if (!more1 || !more2) {
+				return more1 ? 1 : (more2 ? -1 : 0);
+			}
+			if (c1 != c2) {
+				return (c1 < c2) ? -1 : 1;
+			}
 		}
-		if (p1 != end1 && wxIsdigit(*p1)) {
-			return 1;       //more digits
+	}
+
+	// Builds a key such that comparing the keys of two names orders them
+	// the same way as comparing the names in the given mode. Names that
+	// only differ in case have equal keys.
+	static std::wstring MakeSortKey(std::wstring_view const& name, NameSortMode mode)
+	{
+		if (mode != namesort_natural) {
+			return fz::str_tolower(name);
 		}
-		if (p2 != end2 && wxIsdigit(*p2)) {
-			return -1;      //fewer digits
+
+		std::wstring key;
+		key.reserve(name.size() + 8);
+		natural_key_reader r(name);
+		wchar_t c{};
+		while (r.next(c)) {
+			key += c;
 		}
-		return res;         //same length, compare first different digit in the sequence*/
+		return key;
 	}
 
 	typedef int (* CompareFunction)(std::wstring_view const&, std::wstring_view const&);
@@ -180,26 +252,48 @@ inline int DoCmpName(value_type const& data1, value_type const& data2, CFileList
 	}
 }
 
+// Listings with columnar copies of their fields get sorted on those, see
+// CDirectoryListing::GetColumns
+inline CDirectoryListing::columns const* GetSortColumns(CDirectoryListing const& listing)
+{
+	return &listing.GetColumns();
+}
+
 template<typename Listing>
+CDirectoryListing::columns const* GetSortColumns(Listing const&)
+{
+	return nullptr;
+}
+
+template<typename Listing, typename DataEntry>
 class CFileListCtrlSort : public CFileListCtrlSortBase
 {
 public:
 	typedef Listing List;
 	typedef typename Listing::value_type value_type;
 
-	CFileListCtrlSort(Listing const& listing, DirSortMode dirSortMode, NameSortMode nameSortMode)
-		: m_listing(listing), m_dirSortMode(dirSortMode), m_nameSortMode(nameSortMode)
+	CFileListCtrlSort(Listing const& listing, std::vector<DataEntry>& fileData, DirSortMode dirSortMode, NameSortMode nameSortMode)
+		: m_listing(listing), m_fileData(fileData), m_dirSortMode(dirSortMode), m_nameSortMode(nameSortMode)
+		, m_columns(GetSortColumns(listing))
+	{
+	}
+
+	inline bool IsDir(int index) const
 	{
+		if (m_columns) {
+			return (m_columns->flags[index] & CDirentry::flag_dir) != 0;
+		}
+		return m_listing[index].is_dir();
 	}
 
-	inline int CmpDir(value_type const& data1, value_type const& data2) const
+	inline int CmpDir(int a, int b) const
 	{
 		switch (m_dirSortMode)
 		{
 		default:
 		case dirsort_ontop:
-			if (data1.is_dir()) {
-				if (!data2.is_dir()) {
+			if (IsDir(a)) {
+				if (!IsDir(b)) {
 					return -1;
 				}
 				else {
@@ -207,7 +301,7 @@ public:
 				}
 			}
 			else {
-				if (data2.is_dir()) {
+				if (IsDir(b)) {
 					return 1;
 				}
 				else {
@@ -215,8 +309,8 @@ public:
 				}
 			}
 		case dirsort_onbottom:
-			if (data1.is_dir()) {
-				if (!data2.is_dir()) {
+			if (IsDir(a)) {
+				if (!IsDir(b)) {
 					return 1;
 				}
 				else {
@@ -224,7 +318,7 @@ public:
 				}
 			}
 			else {
-				if (data2.is_dir()) {
+				if (IsDir(b)) {
 					return -1;
 				}
 				else {
@@ -236,15 +330,32 @@ public:
 		}
 	}
 
-	template<typename value_type>
-	inline int CmpName(value_type const& data1, value_type const& data2) const
+	// Compares the precomputed keys first, the names themselves only get
+	// compared if the keys are equal.
+	inline int CmpName(int a, int b) const
 	{
-		return DoCmpName(data1, data2, m_nameSortMode);
+		if (m_nameSortMode != namesort_casesensitive) {
+			int res = SortKey(a).compare(SortKey(b));
+			if (res) {
+				return res;
+			}
+		}
+		return DoCmpName(m_listing[a], m_listing[b], m_nameSortMode);
 	}
 
-	inline int CmpSize(const value_type &data1, const value_type &data2) const
+	inline std::wstring const& SortKey(int index) const
 	{
-		int64_t const diff = data1.size - data2.size;
+		DataEntry& data = m_fileData[index];
+		if (data.sortKeyMode != m_nameSortMode) {
+			data.sortKey = MakeSortKey(m_listing[index].name, m_nameSortMode);
+			data.sortKeyMode = m_nameSortMode;
+		}
+		return data.sortKey;
+	}
+
+	inline int CmpSize(int a, int b) const
+	{
+		int64_t const diff = m_columns ? (m_columns->size[a] - m_columns->size[b]) : (m_listing[a].size - m_listing[b].size);
 		if (diff < 0) {
 			return -1;
 		}
@@ -261,8 +372,16 @@ public:
 		return data1.CmpNoCase(data2);
 	}
 
-	inline int CmpTime(const value_type &data1, const value_type &data2) const
+	inline int CmpTime(int a, int b) const
 	{
+		if (m_columns) {
+			int64_t const time1 = m_columns->time[a];
+			int64_t const time2 = m_columns->time[b];
+			return (time1 < time2) ? -1 : ((time1 > time2) ? 1 : 0);
+		}
+
+		value_type const& data1 = m_listing[a];
+		value_type const& data2 = m_listing[b];
 		if (data1.time < data2.time) {
 			return -1;
 		}
@@ -276,9 +395,12 @@ public:
 
 protected:
 	Listing const& m_listing;
+	std::vector<DataEntry>& m_fileData;
 
 	DirSortMode const m_dirSortMode;
 	NameSortMode const m_nameSortMode;
+
+	CDirectoryListing::columns const* const m_columns;
 };
 
 template<class CFileData> class CFileListCtrl;
@@ -298,53 +420,47 @@ public:
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortName : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortName : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
-	CFileListCtrlSortName(Listing const& listing, std::vector<DataEntry>&, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
+	CFileListCtrlSortName(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
 	bool operator()(int a, int b) const
 	{
-		typename Listing::value_type const& data1 = this->m_listing[a];
-		typename Listing::value_type const& data2 = this->m_listing[b];
-
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortSize : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortSize : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
-	CFileListCtrlSortSize(Listing const& listing, std::vector<DataEntry>&, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
+	CFileListCtrlSortSize(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
 	bool operator()(int a, int b) const
 	{
-		typename Listing::value_type const& data1 = this->m_listing[a];
-		typename Listing::value_type const& data2 = this->m_listing[b];
-
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
-		CMP(CmpSize, data1, data2);
+		CMP(CmpSize, a, b);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortType : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortType : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
 	CFileListCtrlSortType(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const pListView)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode), m_pListView(pListView), m_fileData(fileData)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode), m_pListView(pListView)
 	{
 	}
 
@@ -353,10 +469,10 @@ public:
 		typename Listing::value_type const& data1 = this->m_listing[a];
 		typename Listing::value_type const& data2 = this->m_listing[b];
 
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
-		DataEntry &type1 = m_fileData[a];
-		DataEntry &type2 = m_fileData[b];
+		DataEntry &type1 = this->m_fileData[a];
+		DataEntry &type2 = this->m_fileData[b];
 		if (type1.fileType.empty()) {
 			type1.fileType = m_pListView->GetType(data1.name, data1.is_dir());
 		}
@@ -366,42 +482,38 @@ public:
 
 		CMP(CmpStringNoCase, type1.fileType, type2.fileType);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 
 protected:
 	CFileListCtrl<DataEntry>* const m_pListView;
-	std::vector<DataEntry>& m_fileData;
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortTime : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortTime : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
-	CFileListCtrlSortTime(Listing const& listing, std::vector<DataEntry>&, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
+	CFileListCtrlSortTime(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
 	bool operator()(int a, int b) const
 	{
-		typename Listing::value_type const& data1 = this->m_listing[a];
-		typename Listing::value_type const& data2 = this->m_listing[b];
-
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
-		CMP(CmpTime, data1, data2);
+		CMP(CmpTime, a, b);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortPermissions : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortPermissions : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
-	CFileListCtrlSortPermissions(Listing const& listing, std::vector<DataEntry>&, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
+	CFileListCtrlSortPermissions(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
@@ -410,20 +522,20 @@ public:
 		typename Listing::value_type const& data1 = this->m_listing[a];
 		typename Listing::value_type const& data2 = this->m_listing[b];
 
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
 		CMP(CmpStringNoCase, *data1.permissions, *data2.permissions);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortOwnerGroup : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortOwnerGroup : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
-	CFileListCtrlSortOwnerGroup(Listing const& listing, std::vector<DataEntry>&, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
+	CFileListCtrlSortOwnerGroup(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
@@ -432,21 +544,20 @@ public:
 		typename Listing::value_type const& data1 = this->m_listing[a];
 		typename Listing::value_type const& data2 = this->m_listing[b];
 
-		CMP(CmpDir, data1, data2);
+		CMP(CmpDir, a, b);
 
 		CMP(CmpStringNoCase, *data1.ownerGroup, *data2.ownerGroup);
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortPath : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortPath : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
 	CFileListCtrlSortPath(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
-		, m_fileData(fileData)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
@@ -462,18 +573,16 @@ public:
 			return false;
 		}
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
-	std::vector<DataEntry>& m_fileData;
 };
 
 template<typename Listing, typename DataEntry>
-class CFileListCtrlSortNamePath : public CFileListCtrlSort<Listing>
+class CFileListCtrlSortNamePath : public CFileListCtrlSort<Listing, DataEntry>
 {
 public:
 	CFileListCtrlSortNamePath(Listing const& listing, std::vector<DataEntry>& fileData, CFileListCtrlSortBase::DirSortMode dirSortMode, CFileListCtrlSortBase::NameSortMode nameSortMode, CFileListCtrl<DataEntry>* const)
-		: CFileListCtrlSort<Listing>(listing, dirSortMode, nameSortMode)
-		, m_fileData(fileData)
+		: CFileListCtrlSort<Listing, DataEntry>(listing, fileData, dirSortMode, nameSortMode)
 	{
 	}
 
@@ -482,8 +591,8 @@ public:
 		typename Listing::value_type const& data1 = this->m_listing[a];
 		typename Listing::value_type const& data2 = this->m_listing[b];
 
-		CMP(CmpDir, data1, data2);
-		CMP(CmpName, data1, data2);
+		CMP(CmpDir, a, b);
+		CMP(CmpName, a, b);
 
 		if (data1.path < data2.path) {
 			return true;
@@ -492,9 +601,8 @@ public:
 			return false;
 		}
 
-		CMP_LESS(CmpName, data1, data2);
+		CMP_LESS(CmpName, a, b);
 	}
-	std::vector<DataEntry>& m_fileData;
 };
 
 namespace genericTypes {
@@ -551,9 +659,7 @@ protected:
 	virtual void ScrollTopItem(int item);
 	virtual void OnPostScroll();
 	virtual void OnExitComparisonMode();
-	virtual void CompareAddFile(t_fileEntryFlags flags);
-
-	int m_comparisonIndex{-1};
+	virtual void CompareAddFile(unsigned int index, t_fileEntryFlags flags);
 
 	// Remembers which non-fill items are selected if enabling/disabling comparison.
 	// Exploit fact that sort order doesn't change -> O(n)
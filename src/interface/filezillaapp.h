@@ -44,6 +44,12 @@ public:
 	void ShowStartupProfile();
 	void AddStartupProfileRecord(std::string const& msg);
 
+	// Unlike the startup profile, stage timings are always recorded. They
+	// are listed in the debug menu. Subsystems initialized on first use
+	// add their stage once that happens.
+	void AddStartupStage(std::string const& name, fz::duration const& duration);
+	std::vector<std::pair<std::string, fz::duration>> const& GetStartupStages() const { return startupStages_; }
+
 protected:
 	void CheckExistsTool(std::wstring const& tool, std::wstring const& buildRelPath, char const* env, int setting, std::wstring const& description);
 
@@ -52,6 +58,9 @@ protected:
 	bool LoadLocales();
 	int ProcessCommandLine();
 
+	// Runs once the main window got shown
+	void InitDeferred();
+
 	std::unique_ptr<wxLocale> m_pLocale;
 
 	CLocalPath m_resourceDir;
@@ -73,6 +82,8 @@ protected:
 	fz::monotonic_clock m_profile_start;
 	std::vector<std::pair<fz::monotonic_clock, std::string>> m_startupProfile;
 
+	std::vector<std::pair<std::string, fz::duration>> startupStages_;
+
 	std::unique_ptr<CThemeProvider> themeProvider_;
 };
 
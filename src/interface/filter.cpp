@@ -21,6 +21,8 @@ std::vector<CFilter> CFilterManager::m_globalFilters;
 std::vector<CFilterSet> CFilterManager::m_globalFilterSets;
 unsigned int CFilterManager::m_globalCurrentFilterSet = 0;
 bool CFilterManager::m_filters_disabled = false;
+CCompiledFilters CFilterManager::m_compiledLocalFilters;
+CCompiledFilters CFilterManager::m_compiledRemoteFilters;
 
 BEGIN_EVENT_TABLE(CFilterDialog, wxDialogEx)
 EVT_BUTTON(XRCID("wxID_OK"), CFilterDialog::OnOkOrApply)
@@ -216,6 +218,7 @@ void CFilterDialog::OnOkOrApply(wxCommandEvent& event)
 	m_globalFilters = m_filters;
 	m_globalFilterSets = m_filterSets;
 	m_globalCurrentFilterSet = m_currentFilterSet;
+	CompileFilters();
 
 	SaveFilters();
 	m_filters_disabled = false;
@@ -566,21 +569,22 @@ bool CFilterManager::FilenameFiltered(std::wstring const& name, std::wstring con
 		return false;
 	}
 
-	wxASSERT(m_globalCurrentFilterSet < m_globalFilterSets.size());
+	auto const& filters = local ? m_compiledLocalFilters : m_compiledRemoteFilters;
+	return filters.FilenameFiltered(name, path, dir, size, attributes, date);
+}
 
-	CFilterSet const& set = m_globalFilterSets[m_globalCurrentFilterSet];
-	auto const& active = local ? set.local : set.remote;
+bool CFilterManager::LocalFiltersNeedDetails(bool dir) const
+{
+	return !m_filters_disabled && m_compiledLocalFilters.NeedsDetails(dir);
+}
 
-	// Check active filters
-	for (unsigned int i = 0; i < m_globalFilters.size(); ++i) {
-		if (active[i]) {
-			if (FilenameFilteredByFilter(m_globalFilters[i], name, path, dir, size, attributes, date)) {
-				return true;
-			}
-		}
+CCompiledFilters CFilterManager::GetCompiledLocalFilters()
+{
+	if (m_filters_disabled) {
+		return CCompiledFilters();
 	}
 
-	return false;
+	return m_compiledLocalFilters;
 }
 
 bool CFilterManager::FilenameFiltered(std::vector<CFilter> const& filters, std::wstring const& name, std::wstring const& path, bool dir, int64_t size, int attributes, fz::datetime const& date) const
@@ -666,7 +670,10 @@ static bool StringMatch(std::wstring const& subject, CFilterCondition const& con
 	return match;
 }
 
-bool CFilterManager::FilenameFilteredByFilter(CFilter const& filter, std::wstring const& name, std::wstring const& path, bool dir, int64_t size, int attributes, fz::datetime const& date)
+namespace {
+// stringMatch(condition, index) evaluates the name and path conditions
+template<typename Matcher>
+bool FilteredByFilter(CFilter const& filter, Matcher const& stringMatch, bool dir, int64_t size, int attributes, fz::datetime const& date)
 {
 	if (dir && !filter.filterDirs) {
 		return false;
@@ -675,16 +682,15 @@ bool CFilterManager::FilenameFilteredByFilter(CFilter const& filter, std::wstrin
 		return false;
 	}
 
-	for (auto const& condition : filter.filters) {
+	for (size_t i = 0; i < filter.filters.size(); ++i) {
+		auto const& condition = filter.filters[i];
 		bool match = false;
 
 		switch (condition.type)
 		{
 		case filter_name:
-			match = StringMatch(name, condition, filter.matchCase);
-			break;
 		case filter_path:
-			match = StringMatch(path, condition, filter.matchCase);
+			match = stringMatch(condition, i);
 			break;
 		case filter_size:
 			if (size == -1) {
@@ -853,6 +859,143 @@ bool CFilterManager::FilenameFilteredByFilter(CFilter const& filter, std::wstrin
 
 	return false;
 }
+}
+
+bool CFilterManager::FilenameFilteredByFilter(CFilter const& filter, std::wstring const& name, std::wstring const& path, bool dir, int64_t size, int attributes, fz::datetime const& date)
+{
+	auto const stringMatch = [&](CFilterCondition const& condition, size_t) {
+		return StringMatch((condition.type == filter_path) ? path : name, condition, filter.matchCase);
+	};
+	return FilteredByFilter(filter, stringMatch, dir, size, attributes, date);
+}
+
+CCompiledFilters::CCompiledFilters(std::vector<CFilter> const& filters)
+	: filters_(filters)
+{
+	conditionIndexes_.resize(filters_.size());
+	for (size_t f = 0; f < filters_.size(); ++f) {
+		CFilter const& filter = filters_[f];
+		filterFiles_ |= filter.filterFiles;
+		filterDirs_ |= filter.filterDirs;
+
+		auto & indexes = conditionIndexes_[f];
+		indexes.resize(filter.filters.size());
+		for (size_t c = 0; c < filter.filters.size(); ++c) {
+			CFilterCondition const& condition = filter.filters[c];
+			if (condition.type != filter_name && condition.type != filter_path) {
+				fileDetails_ |= filter.filterFiles;
+				dirDetails_ |= filter.filterDirs;
+				continue;
+			}
+
+			bool const path = condition.type == filter_path;
+			string_condition sc;
+			sc.subject = path ? (filter.matchCase ? path_case : path_lower) : (filter.matchCase ? name_case : name_lower);
+			if (condition.condition == 4) {
+				sc.regex = true;
+				CFilterRegex regex;
+				if (regex.compile(condition.strValue, filter.matchCase)) {
+					sc.index = regexes_.size();
+					regexes_.push_back(std::move(regex));
+				}
+				else {
+					sc.subject = path ? path_case : name_case;
+					sc.pRegEx = condition.pRegEx;
+				}
+			}
+			else {
+				sc.index = matchers_[sc.subject].add(filter.matchCase ? condition.strValue : fz::str_tolower(condition.strValue));
+			}
+
+			lowerName_ |= sc.subject == name_lower;
+			lowerPath_ |= sc.subject == path_lower;
+
+			indexes[c] = conditions_.size();
+			conditions_.push_back(std::move(sc));
+		}
+	}
+
+	for (auto & matcher : matchers_) {
+		matcher.compile();
+	}
+}
+
+bool CCompiledFilters::FilenameFiltered(std::wstring const& name, std::wstring const& path, bool dir, int64_t size, int attributes, fz::datetime const& date) const
+{
+	if (dir ? !filterDirs_ : !filterFiles_) {
+		return false;
+	}
+
+	std::wstring lowerName;
+	std::wstring lowerPath;
+	if (lowerName_) {
+		lowerName = fz::str_tolower(name);
+	}
+	if (lowerPath_) {
+		lowerPath = fz::str_tolower(path);
+	}
+	std::wstring_view const subjects[subject_count] = { name, lowerName, path, lowerPath };
+
+	// Per literal pattern: 1 if found anywhere, 2 if found at the start,
+	// 4 if found at the end and 8 if equal to the subject
+	std::vector<uint8_t> found[subject_count];
+	for (int s = 0; s < subject_count; ++s) {
+		CMultiStringMatcher const& matcher = matchers_[s];
+		if (matcher.empty()) {
+			continue;
+		}
+
+		auto & flags = found[s];
+		std::wstring_view const subject = subjects[s];
+		matcher.search(subject, [&](size_t pattern, size_t end) {
+			if (flags.size() <= pattern) {
+				flags.resize(pattern + 1);
+			}
+			uint8_t f = 1;
+			bool const start = end == matcher.pattern(pattern).size();
+			if (start) {
+				f |= 2;
+			}
+			if (end == subject.size()) {
+				f |= start ? (4 | 8) : 4;
+			}
+			flags[pattern] |= f;
+		});
+	}
+
+	for (size_t f = 0; f < filters_.size(); ++f) {
+		auto const stringMatch = [&](CFilterCondition const& condition, size_t c) {
+			string_condition const& sc = conditions_[conditionIndexes_[f][c]];
+			if (sc.regex) {
+				if (sc.pRegEx) {
+					return std::regex_search(subjects[sc.subject].begin(), subjects[sc.subject].end(), *sc.pRegEx);
+				}
+				return regexes_[sc.index].search(subjects[sc.subject]);
+			}
+
+			uint8_t const flags = (sc.index < found[sc.subject].size()) ? found[sc.subject][sc.index] : 0;
+			switch (condition.condition) {
+			case 0:
+				return (flags & 1) != 0;
+			case 1:
+				return (flags & 8) != 0;
+			case 2:
+				return (flags & 2) != 0;
+			case 3:
+				return (flags & 4) != 0;
+			case 5:
+				return (flags & 1) == 0;
+			default:
+				return false;
+			}
+		};
+		if (FilteredByFilter(filters_[f], stringMatch, dir, size, attributes, date)) {
+			return true;
+		}
+	}
+
+	return false;
+}
 
 bool CFilterManager::LoadFilter(pugi::xml_node& element, CFilter& filter)
 {
@@ -930,11 +1073,15 @@ void CFilterManager::LoadFilters()
 	CReentrantInterProcessMutexLocker mutex(MUTEX_FILTERS);
 
 	std::wstring file(wxGetApp().GetSettingsFile(L"filters"));
-	if (fz::local_filesys::get_size(fz::to_native(file)) < 1) {
+	bool const settingsFile = fz::local_filesys::get_size(fz::to_native(file)) >= 1;
+	if (!settingsFile) {
 		file = wxGetApp().GetResourceDir().GetPath() + L"defaultfilters.xml";
 	}
 
 	CXmlFile xml(file);
+	if (settingsFile) {
+		xml.EnableSnapshot();
+	}
 	auto element = xml.Load();
 	LoadFilters(element);
 
@@ -1021,6 +1168,27 @@ void CFilterManager::LoadFilters(pugi::xml_node& element)
 
 		m_globalFilterSets.push_back(set);
 	}
+
+	CompileFilters();
+}
+
+void CFilterManager::CompileFilters()
+{
+	CFilterSet const& set = m_globalFilterSets[m_globalCurrentFilterSet];
+
+	std::vector<CFilter> local;
+	std::vector<CFilter> remote;
+	for (unsigned int i = 0; i < m_globalFilters.size(); ++i) {
+		if (set.local[i]) {
+			local.push_back(m_globalFilters[i]);
+		}
+		if (set.remote[i]) {
+			remote.push_back(m_globalFilters[i]);
+		}
+	}
+
+	m_compiledLocalFilters = CCompiledFilters(local);
+	m_compiledRemoteFilters = CCompiledFilters(remote);
 }
 
 void CFilterManager::SaveFilters()
@@ -1028,6 +1196,7 @@ void CFilterManager::SaveFilters()
 	CReentrantInterProcessMutexLocker mutex(MUTEX_FILTERS);
 
 	CXmlFile xml(wxGetApp().GetSettingsFile(_T("filters")));
+	xml.EnableSnapshot();
 	auto element = xml.Load();
 	if (!element) {
 		wxString msg = xml.GetError() + _T("\n\n") + _("Any changes made to the filters could not be saved.");
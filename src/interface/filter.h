@@ -2,6 +2,7 @@
 #define FILEZILLA_INTERFACE_FILTER_HEADER
 
 #include "dialogex.h"
+#include "filter_matcher.h"
 
 #include <memory>
 #include <regex>
@@ -83,6 +84,69 @@ public:
 
 typedef std::pair<std::vector<CFilter>, std::vector<CFilter>> ActiveFilters;
 
+// Filters prepared for checking many entries against.
+//
+// Names and paths get lowercased once per entry and not for each case-
+// insensitive condition. All literal conditions on the name or the path are
+// checked in a single pass, and regular expressions run as a DFA where
+// possible.
+class CCompiledFilters final
+{
+public:
+	CCompiledFilters() = default;
+	explicit CCompiledFilters(std::vector<CFilter> const& filters);
+
+	bool empty() const { return filters_.empty(); }
+
+	// Whether the filters for files or directories respectively look at
+	// anything but the name and path, i.e. need size, date or attributes.
+	bool NeedsDetails(bool dir) const { return dir ? dirDetails_ : fileDetails_; }
+
+	// Same as CFilterManager::FilenameFiltered
+	bool FilenameFiltered(std::wstring const& name, std::wstring const& path, bool dir, int64_t size, int attributes, fz::datetime const& date) const;
+
+private:
+	enum subject_type {
+		name_case,
+		name_lower,
+		path_case,
+		path_lower,
+		subject_count
+	};
+
+	class string_condition final
+	{
+	public:
+		subject_type subject{};
+
+		// Index into matchers_[subject] or into regexes_
+		size_t index{};
+		bool regex{};
+
+		// Fall back to std::regex if the expression cannot be compiled
+		std::shared_ptr<std::wregex> pRegEx;
+	};
+
+	std::vector<CFilter> filters_;
+
+	// For each condition of each filter, index into conditions_ if it
+	// is a name or path condition
+	std::vector<std::vector<size_t>> conditionIndexes_;
+
+	std::vector<string_condition> conditions_;
+	CMultiStringMatcher matchers_[subject_count];
+	std::vector<CFilterRegex> regexes_;
+
+	bool filterFiles_{};
+	bool filterDirs_{};
+	bool fileDetails_{};
+	bool dirDetails_{};
+
+	// Whether there are case-insensitive conditions on the name or path
+	bool lowerName_{};
+	bool lowerPath_{};
+};
+
 namespace pugi { class xml_node; }
 class CFilterManager
 {
@@ -102,9 +166,16 @@ public:
 
 	ActiveFilters GetActiveFilters();
 
+	// Copy of the compiled active local filters, empty if filtering is
+	// disabled. Unlike the filter manager, the copy can be used on other threads.
+	static CCompiledFilters GetCompiledLocalFilters();
+
 	bool HasActiveLocalFilters() const;
 	bool HasActiveRemoteFilters() const;
 
+	// See CCompiledFilters::NeedsDetails
+	bool LocalFiltersNeedDetails(bool dir) const;
+
 	static void Import(pugi::xml_node& element);
 	static bool LoadFilter(pugi::xml_node& element, CFilter& filter);
 	static void SaveFilter(pugi::xml_node& element, const CFilter& filter);
@@ -114,6 +185,9 @@ protected:
 	static void LoadFilters(pugi::xml_node& element);
 	static void SaveFilters();
 
+	// Prepares the active filters of the current set for FilenameFiltered
+	static void CompileFilters();
+
 	static bool m_loaded;
 
 	static std::vector<CFilter> m_globalFilters;
@@ -122,6 +196,9 @@ protected:
 	static unsigned int m_globalCurrentFilterSet;
 
 	static bool m_filters_disabled;
+
+	static CCompiledFilters m_compiledLocalFilters;
+	static CCompiledFilters m_compiledRemoteFilters;
 };
 
 class CMainFrame;
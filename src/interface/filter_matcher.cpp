@@ -0,0 +1,912 @@
+#include <filezilla.h>
+#include "filter_matcher.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <wchar.h>
+#include <wctype.h>
+
+size_t CMultiStringMatcher::add(std::wstring const& pattern)
+{
+	auto it = std::find(patterns_.begin(), patterns_.end(), pattern);
+	if (it != patterns_.end()) {
+		return static_cast<size_t>(it - patterns_.begin());
+	}
+
+	patterns_.push_back(pattern);
+	return patterns_.size() - 1;
+}
+
+size_t CMultiStringMatcher::child(size_t state, wchar_t c) const
+{
+	auto const& children = nodes_[state].children;
+	auto it = std::lower_bound(children.begin(), children.end(), c, [](std::pair<wchar_t, size_t> const& lhs, wchar_t rhs) { return lhs.first < rhs; });
+	if (it != children.end() && it->first == c) {
+		return it->second;
+	}
+
+	// The root is nobody's child
+	return 0;
+}
+
+size_t CMultiStringMatcher::next(size_t state, wchar_t c) const
+{
+	while (true) {
+		size_t n = child(state, c);
+		if (n || !state) {
+			return n;
+		}
+		state = nodes_[state].fail;
+	}
+}
+
+void CMultiStringMatcher::compile()
+{
+	nodes_.clear();
+	if (patterns_.empty()) {
+		return;
+	}
+
+	nodes_.emplace_back();
+	for (size_t i = 0; i < patterns_.size(); ++i) {
+		size_t state = 0;
+		for (wchar_t const c : patterns_[i]) {
+			size_t n = child(state, c);
+			if (!n) {
+				n = nodes_.size();
+				auto & children = nodes_[state].children;
+				auto it = std::lower_bound(children.begin(), children.end(), c, [](std::pair<wchar_t, size_t> const& lhs, wchar_t rhs) { return lhs.first < rhs; });
+				children.emplace(it, c, n);
+				nodes_.emplace_back();
+			}
+			state = n;
+		}
+		nodes_[state].output = true;
+		nodes_[state].pattern = i;
+	}
+
+	// Breadth first, so that the fail links of all shallower nodes are
+	// known when they are needed
+	std::deque<size_t> queue;
+	for (auto const& c : nodes_[0].children) {
+		queue.push_back(c.second);
+	}
+	while (!queue.empty()) {
+		size_t const state = queue.front();
+		queue.pop_front();
+
+		for (auto const& c : nodes_[state].children) {
+			size_t f = nodes_[state].fail;
+			size_t n = child(f, c.first);
+			while (!n && f) {
+				f = nodes_[f].fail;
+				n = child(f, c.first);
+			}
+
+			node & v = nodes_[c.second];
+			v.fail = n;
+			v.dict = nodes_[n].output ? n : nodes_[n].dict;
+
+			queue.push_back(c.second);
+		}
+	}
+}
+
+namespace {
+uint32_t const max_char = static_cast<uint32_t>(WCHAR_MAX);
+
+// Limits on the size of the expanded expression and of the DFA. Past them,
+// std::regex is used instead.
+size_t const max_nfa_states = 10000;
+size_t const max_dfa_states = 2000;
+size_t const max_dfa_transitions = 1024 * 1024;
+
+typedef std::vector<std::pair<uint32_t, uint32_t>> char_ranges;
+
+void normalize(char_ranges & ranges)
+{
+	std::sort(ranges.begin(), ranges.end());
+
+	char_ranges merged;
+	for (auto const& r : ranges) {
+		if (!merged.empty() && r.first <= merged.back().second + 1) {
+			merged.back().second = std::max(merged.back().second, r.second);
+		}
+		else {
+			merged.push_back(r);
+		}
+	}
+	ranges = std::move(merged);
+}
+
+char_ranges negate(char_ranges const& ranges)
+{
+	char_ranges ret;
+	uint32_t next = 0;
+	for (auto const& r : ranges) {
+		if (r.first > next) {
+			ret.emplace_back(next, r.first - 1);
+		}
+		next = r.second + 1;
+	}
+	if (ranges.empty() || ranges.back().second < max_char) {
+		ret.emplace_back(next, max_char);
+	}
+	return ret;
+}
+
+bool contains(char_ranges const& ranges, uint32_t c)
+{
+	auto it = std::upper_bound(ranges.begin(), ranges.end(), c, [](uint32_t lhs, std::pair<uint32_t, uint32_t> const& rhs) { return lhs < rhs.first; });
+	return it != ranges.begin() && (--it)->second >= c;
+}
+
+uint32_t lower(uint32_t c)
+{
+	return static_cast<uint32_t>(towlower(static_cast<wint_t>(c)));
+}
+
+// Adds the lowercase variants of all characters, subjects get lowercased
+// before matching.
+void fold_case(char_ranges & ranges)
+{
+	char_ranges folded = ranges;
+	for (auto const& r : ranges) {
+		// Past the supplementary multilingual plane, there are no
+		// characters with case
+		uint32_t const last = std::min(r.second, uint32_t(0x1ffff));
+		for (uint32_t c = r.first; c <= last; ++c) {
+			uint32_t const l = lower(c);
+			if (l != c && (l < r.first || l > r.second)) {
+				folded.emplace_back(l, l);
+			}
+		}
+	}
+	ranges = std::move(folded);
+	normalize(ranges);
+}
+
+struct regex_node final
+{
+	enum type {
+		empty,
+		chars,
+		concat,
+		alternate,
+		repeat,
+		begin,
+		end
+	};
+
+	explicit regex_node(type t)
+		: t(t)
+	{}
+
+	type t;
+	char_ranges ranges;
+
+	// Set by negated bracket expressions, ranges then holds the characters
+	// excluded. Case gets folded before negating, so [^a] excludes A too.
+	bool negated{};
+	std::vector<std::unique_ptr<regex_node>> children;
+	int min{};
+	int max{-1};
+};
+
+class regex_parser final
+{
+public:
+	regex_parser(std::wstring const& pattern)
+		: p_(pattern)
+	{}
+
+	std::unique_ptr<regex_node> parse()
+	{
+		auto ret = parse_alternate();
+		if (pos_ != p_.size()) {
+			return nullptr;
+		}
+		return ret;
+	}
+
+private:
+	bool at_end() const { return pos_ >= p_.size(); }
+	wchar_t peek() const { return p_[pos_]; }
+
+	std::unique_ptr<regex_node> parse_alternate()
+	{
+		auto first = parse_concat();
+		if (!first || at_end() || peek() != '|') {
+			return first;
+		}
+
+		auto ret = std::make_unique<regex_node>(regex_node::alternate);
+		ret->children.push_back(std::move(first));
+		while (!at_end() && peek() == '|') {
+			++pos_;
+			auto next = parse_concat();
+			if (!next) {
+				return nullptr;
+			}
+			ret->children.push_back(std::move(next));
+		}
+		return ret;
+	}
+
+	std::unique_ptr<regex_node> parse_concat()
+	{
+		auto ret = std::make_unique<regex_node>(regex_node::concat);
+		while (!at_end() && peek() != '|' && peek() != ')') {
+			auto atom = parse_repeat();
+			if (!atom) {
+				return nullptr;
+			}
+			ret->children.push_back(std::move(atom));
+		}
+		return ret;
+	}
+
+	bool parse_number(int & number)
+	{
+		size_t const start = pos_;
+		number = 0;
+		while (!at_end() && peek() >= '0' && peek() <= '9') {
+			number = number * 10 + (peek() - '0');
+			if (number > 1000) {
+				return false;
+			}
+			++pos_;
+		}
+		return pos_ != start;
+	}
+
+	std::unique_ptr<regex_node> parse_repeat()
+	{
+		auto atom = parse_atom();
+		if (!atom) {
+			return nullptr;
+		}
+
+		while (!at_end()) {
+			int min;
+			int max;
+			wchar_t const c = peek();
+			if (c == '*') {
+				min = 0;
+				max = -1;
+				++pos_;
+			}
+			else if (c == '+') {
+				min = 1;
+				max = -1;
+				++pos_;
+			}
+			else if (c == '?') {
+				min = 0;
+				max = 1;
+				++pos_;
+			}
+			else if (c == '{') {
+				++pos_;
+				if (!parse_number(min)) {
+					return nullptr;
+				}
+				max = min;
+				if (!at_end() && peek() == ',') {
+					++pos_;
+					max = -1;
+					if (!at_end() && peek() != '}' && (!parse_number(max) || max < min)) {
+						return nullptr;
+					}
+				}
+				if (at_end() || peek() != '}') {
+					return nullptr;
+				}
+				++pos_;
+			}
+			else {
+				break;
+			}
+
+			if (atom->t == regex_node::begin || atom->t == regex_node::end) {
+				return nullptr;
+			}
+
+			// Whether a quantifier is lazy makes no difference if all we
+			// need to know is whether there is a match
+			if (!at_end() && peek() == '?') {
+				++pos_;
+			}
+
+			auto r = std::make_unique<regex_node>(regex_node::repeat);
+			r->min = min;
+			r->max = max;
+			r->children.push_back(std::move(atom));
+			atom = std::move(r);
+		}
+
+		return atom;
+	}
+
+	std::unique_ptr<regex_node> chars(char_ranges && ranges)
+	{
+		auto ret = std::make_unique<regex_node>(regex_node::chars);
+		ret->ranges = std::move(ranges);
+		normalize(ret->ranges);
+		return ret;
+	}
+
+	static char_ranges class_digit() { return {{'0', '9'}}; }
+	static char_ranges class_word() { return {{'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'}}; }
+	static char_ranges class_space()
+	{
+		char_ranges ret{{'\t', '\r'}, {' ', ' '}, {0xa0, 0xa0}, {0x1680, 0x1680}, {0x2000, 0x200a}, {0x2028, 0x2029}, {0x202f, 0x202f}, {0x205f, 0x205f}, {0x3000, 0x3000}, {0xfeff, 0xfeff}};
+		ret.erase(std::remove_if(ret.begin(), ret.end(), [](std::pair<uint32_t, uint32_t> const& r) { return r.first > max_char; }), ret.end());
+		return ret;
+	}
+
+	bool parse_hex(size_t digits, uint32_t & value)
+	{
+		value = 0;
+		for (size_t i = 0; i < digits; ++i) {
+			if (at_end()) {
+				return false;
+			}
+			wchar_t const c = peek();
+			int v;
+			if (c >= '0' && c <= '9') {
+				v = c - '0';
+			}
+			else if (c >= 'a' && c <= 'f') {
+				v = c - 'a' + 10;
+			}
+			else if (c >= 'A' && c <= 'F') {
+				v = c - 'A' + 10;
+			}
+			else {
+				return false;
+			}
+			value = value * 16 + v;
+			++pos_;
+		}
+		return value <= max_char;
+	}
+
+	// Parses the escape after the backslash. Sets either a single
+	// character or a class.
+	bool parse_escape(uint32_t & c, char_ranges & cls, bool & is_class, bool in_brackets)
+	{
+		if (at_end()) {
+			return false;
+		}
+
+		is_class = false;
+		wchar_t const e = peek();
+		++pos_;
+		switch (e) {
+		case 'd':
+		case 'D':
+			cls = class_digit();
+			break;
+		case 'w':
+		case 'W':
+			cls = class_word();
+			break;
+		case 's':
+		case 'S':
+			cls = class_space();
+			break;
+		case 't':
+			c = '\t';
+			return true;
+		case 'n':
+			c = '\n';
+			return true;
+		case 'r':
+			c = '\r';
+			return true;
+		case 'f':
+			c = '\f';
+			return true;
+		case 'v':
+			c = '\v';
+			return true;
+		case '0':
+			if (!at_end() && peek() >= '0' && peek() <= '9') {
+				return false;
+			}
+			c = 0;
+			return true;
+		case 'x':
+			return parse_hex(2, c);
+		case 'u':
+			return parse_hex(4, c);
+		case 'b':
+			if (in_brackets) {
+				c = '\b';
+				return true;
+			}
+			return false;
+		default:
+			// Backreferences, word boundaries and the like, or escapes
+			// with a meaning std::regex might not agree upon
+			if ((e >= 'a' && e <= 'z') || (e >= 'A' && e <= 'Z') || (e >= '0' && e <= '9')) {
+				return false;
+			}
+			c = static_cast<uint32_t>(e);
+			return true;
+		}
+
+		is_class = true;
+		normalize(cls);
+		if (e >= 'A' && e <= 'Z') {
+			cls = negate(cls);
+		}
+		return true;
+	}
+
+	std::unique_ptr<regex_node> parse_brackets()
+	{
+		bool negated = false;
+		if (!at_end() && peek() == '^') {
+			negated = true;
+			++pos_;
+		}
+
+		char_ranges ranges;
+		bool first = true;
+		while (true) {
+			if (at_end()) {
+				return nullptr;
+			}
+			if (peek() == ']' && !first) {
+				++pos_;
+				break;
+			}
+			if (peek() == ']') {
+				// ECMAScript [] matches nothing and [^] everything
+				++pos_;
+				if (negated) {
+					return chars({{0, max_char}});
+				}
+				return chars({});
+			}
+			first = false;
+
+			uint32_t lo;
+			if (peek() == '[') {
+				// Collating elements, equivalence classes and character
+				// class names
+				return nullptr;
+			}
+			if (peek() == '\\') {
+				++pos_;
+				char_ranges cls;
+				bool is_class;
+				if (!parse_escape(lo, cls, is_class, true)) {
+					return nullptr;
+				}
+				if (is_class) {
+					ranges.insert(ranges.end(), cls.begin(), cls.end());
+					continue;
+				}
+			}
+			else {
+				lo = static_cast<uint32_t>(peek());
+				++pos_;
+			}
+
+			uint32_t hi = lo;
+			if (pos_ + 1 < p_.size() && peek() == '-' && p_[pos_ + 1] != ']') {
+				++pos_;
+				if (peek() == '\\') {
+					++pos_;
+					char_ranges cls;
+					bool is_class;
+					if (!parse_escape(hi, cls, is_class, true) || is_class) {
+						return nullptr;
+					}
+				}
+				else if (peek() == '[') {
+					return nullptr;
+				}
+				else {
+					hi = static_cast<uint32_t>(peek());
+					++pos_;
+				}
+				if (hi < lo) {
+					return nullptr;
+				}
+			}
+			ranges.emplace_back(lo, hi);
+		}
+
+		auto ret = chars(std::move(ranges));
+		ret->negated = negated;
+		return ret;
+	}
+
+	std::unique_ptr<regex_node> parse_atom()
+	{
+		wchar_t const c = peek();
+		++pos_;
+		switch (c) {
+		case '(':
+			{
+				if (!at_end() && peek() == '?') {
+					if (pos_ + 1 >= p_.size() || p_[pos_ + 1] != ':') {
+						// Lookaheads
+						return nullptr;
+					}
+					pos_ += 2;
+				}
+				auto inner = parse_alternate();
+				if (!inner || at_end() || peek() != ')') {
+					return nullptr;
+				}
+				++pos_;
+				return inner;
+			}
+		case '[':
+			return parse_brackets();
+		case '.':
+			return chars(negate({{'\n', '\n'}, {'\r', '\r'}, {0x2028, 0x2029}}));
+		case '^':
+			return std::make_unique<regex_node>(regex_node::begin);
+		case '$':
+			return std::make_unique<regex_node>(regex_node::end);
+		case '\\':
+			{
+				uint32_t ch;
+				char_ranges cls;
+				bool is_class;
+				if (!parse_escape(ch, cls, is_class, false)) {
+					return nullptr;
+				}
+				if (is_class) {
+					return chars(std::move(cls));
+				}
+				return chars({{ch, ch}});
+			}
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+		case ')':
+			return nullptr;
+		default:
+			return chars({{static_cast<uint32_t>(c), static_cast<uint32_t>(c)}});
+		}
+	}
+
+	std::wstring const& p_;
+	size_t pos_{};
+};
+
+struct nfa_state final
+{
+	enum type {
+		chars,
+		split,
+		begin,
+		end,
+		match
+	};
+
+	type t{};
+	size_t out{};
+	size_t out1{};
+
+	// Index into the character sets
+	size_t set{};
+};
+
+class nfa_builder final
+{
+public:
+	nfa_builder(std::vector<nfa_state> & states, std::vector<char_ranges> & sets, bool matchCase)
+		: states_(states)
+		, sets_(sets)
+		, matchCase_(matchCase)
+	{}
+
+	// Builds the states for node, continuing with next. Returns the first
+	// state, or max_nfa_states if the expression is too large.
+	size_t emit(regex_node const& node, size_t next)
+	{
+		if (states_.size() >= max_nfa_states) {
+			return max_nfa_states;
+		}
+
+		switch (node.t) {
+		case regex_node::empty:
+			return next;
+		case regex_node::chars:
+			{
+				char_ranges ranges = node.ranges;
+				if (!matchCase_) {
+					fold_case(ranges);
+				}
+				if (node.negated) {
+					ranges = negate(ranges);
+				}
+				auto it = std::find(sets_.begin(), sets_.end(), ranges);
+				size_t const set = static_cast<size_t>(it - sets_.begin());
+				if (it == sets_.end()) {
+					sets_.emplace_back(std::move(ranges));
+				}
+				return add(nfa_state::chars, next, 0, set);
+			}
+		case regex_node::concat:
+			for (size_t i = node.children.size(); i > 0 && next != max_nfa_states; --i) {
+				next = emit(*node.children[i - 1], next);
+			}
+			return next;
+		case regex_node::alternate:
+			{
+				size_t start = emit(*node.children.back(), next);
+				for (size_t i = node.children.size() - 1; i > 0 && start != max_nfa_states; --i) {
+					size_t const alt = emit(*node.children[i - 1], next);
+					if (alt == max_nfa_states) {
+						return alt;
+					}
+					start = add(nfa_state::split, alt, start);
+				}
+				return start;
+			}
+		case regex_node::repeat:
+			{
+				regex_node const& child = *node.children.front();
+				size_t cont;
+				if (node.max < 0) {
+					cont = add(nfa_state::split, 0, next);
+					size_t const body = emit(child, cont);
+					if (body == max_nfa_states) {
+						return body;
+					}
+					states_[cont].out = body;
+				}
+				else {
+					cont = next;
+					for (int i = node.min; i < node.max && cont != max_nfa_states; ++i) {
+						size_t const body = emit(child, cont);
+						if (body == max_nfa_states) {
+							return body;
+						}
+						cont = add(nfa_state::split, body, next);
+					}
+				}
+				for (int i = 0; i < node.min && cont != max_nfa_states; ++i) {
+					cont = emit(child, cont);
+				}
+				return cont;
+			}
+		case regex_node::begin:
+			return add(nfa_state::begin, next);
+		case regex_node::end:
+			return add(nfa_state::end, next);
+		}
+
+		return max_nfa_states;
+	}
+
+	size_t add(nfa_state::type t, size_t out = 0, size_t out1 = 0, size_t set = 0)
+	{
+		nfa_state s;
+		s.t = t;
+		s.out = out;
+		s.out1 = out1;
+		s.set = set;
+		states_.push_back(s);
+		return states_.size() - 1;
+	}
+
+private:
+	std::vector<nfa_state> & states_;
+	std::vector<char_ranges> & sets_;
+	bool const matchCase_;
+};
+
+// Adds the states reachable from state without consuming input. Only
+// the states that matter for the DFA are kept: those consuming input, the
+// match state and the end anchors, which get resolved at the end of the
+// subject.
+void closure(std::vector<nfa_state> const& states, size_t state, bool atBegin, std::vector<bool> & seen, std::vector<size_t> & out)
+{
+	std::vector<size_t> stack{state};
+	while (!stack.empty()) {
+		size_t const s = stack.back();
+		stack.pop_back();
+		if (seen[s]) {
+			continue;
+		}
+		seen[s] = true;
+
+		nfa_state const& n = states[s];
+		switch (n.t) {
+		case nfa_state::split:
+			stack.push_back(n.out1);
+			stack.push_back(n.out);
+			break;
+		case nfa_state::begin:
+			if (atBegin) {
+				stack.push_back(n.out);
+			}
+			break;
+		default:
+			out.push_back(s);
+			break;
+		}
+	}
+}
+
+bool accepts_at_end(std::vector<nfa_state> const& states, std::vector<size_t> const& set, bool atBegin)
+{
+	std::vector<bool> seen(states.size());
+	std::vector<size_t> pending = set;
+	while (!pending.empty()) {
+		size_t const s = pending.back();
+		pending.pop_back();
+		if (states[s].t == nfa_state::match) {
+			return true;
+		}
+		if (states[s].t == nfa_state::end) {
+			std::vector<size_t> next;
+			closure(states, states[s].out, atBegin, seen, next);
+			pending.insert(pending.end(), next.begin(), next.end());
+		}
+	}
+	return false;
+}
+}
+
+bool CFilterRegex::compile(std::wstring const& pattern, bool matchCase)
+{
+	boundaries_.clear();
+	transitions_.clear();
+	accept_.clear();
+	acceptAtEnd_.clear();
+
+	regex_parser parser(pattern);
+	auto root = parser.parse();
+	if (!root) {
+		return false;
+	}
+
+	std::vector<nfa_state> states;
+	std::vector<char_ranges> sets;
+	nfa_builder builder(states, sets, matchCase);
+
+	size_t const match = builder.add(nfa_state::match);
+	size_t const start = builder.emit(*root, match);
+	if (start == max_nfa_states) {
+		return false;
+	}
+
+	// Split the characters into classes
+	std::vector<uint32_t> points{0};
+	for (auto const& set : sets) {
+		for (auto const& r : set) {
+			points.push_back(r.first);
+			if (r.second < max_char) {
+				points.push_back(r.second + 1);
+			}
+		}
+	}
+	std::sort(points.begin(), points.end());
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	boundaries_ = points;
+	classes_ = static_cast<uint32_t>(points.size());
+	for (uint32_t c = 0; c < 128; ++c) {
+		ascii_[c] = classify(static_cast<wchar_t>(c));
+	}
+
+	// Which sets contain each class
+	std::vector<std::vector<bool>> setContains(sets.size(), std::vector<bool>(classes_));
+	for (size_t s = 0; s < sets.size(); ++s) {
+		for (uint32_t k = 0; k < classes_; ++k) {
+			setContains[s][k] = contains(sets[s], points[k]);
+		}
+	}
+
+	// Searching means a match can start anywhere, so the states reachable
+	// from the start are part of every state but the first, which is the
+	// only one where ^ matches.
+	std::vector<size_t> restart;
+	{
+		std::vector<bool> seen(states.size());
+		closure(states, start, false, seen, restart);
+	}
+
+	std::vector<std::vector<size_t>> dfaStates;
+	std::map<std::vector<size_t>, uint32_t> ids;
+
+	auto add_state = [&](std::vector<size_t> && set, bool atBegin) -> uint32_t {
+		std::sort(set.begin(), set.end());
+		set.erase(std::unique(set.begin(), set.end()), set.end());
+		if (!atBegin) {
+			auto it = ids.find(set);
+			if (it != ids.end()) {
+				return it->second;
+			}
+		}
+
+		uint32_t const id = static_cast<uint32_t>(dfaStates.size());
+		bool a = false;
+		for (size_t s : set) {
+			if (states[s].t == nfa_state::match) {
+				a = true;
+			}
+		}
+		accept_.push_back(a);
+		acceptAtEnd_.push_back(a || accepts_at_end(states, set, atBegin));
+		if (!atBegin) {
+			ids.emplace(set, id);
+		}
+		dfaStates.emplace_back(std::move(set));
+		return id;
+	};
+
+	{
+		std::vector<size_t> initial;
+		std::vector<bool> seen(states.size());
+		closure(states, start, true, seen, initial);
+		add_state(std::move(initial), true);
+	}
+
+	for (size_t i = 0; i < dfaStates.size(); ++i) {
+		if (dfaStates.size() > max_dfa_states || dfaStates.size() * classes_ > max_dfa_transitions) {
+			boundaries_.clear();
+			transitions_.clear();
+			return false;
+		}
+
+		transitions_.resize((i + 1) * classes_);
+
+		// Copied, adding states can reallocate dfaStates
+		std::vector<size_t> const current = dfaStates[i];
+		for (uint32_t k = 0; k < classes_; ++k) {
+			std::vector<size_t> next = restart;
+			std::vector<bool> seen(states.size());
+			for (size_t s : current) {
+				if (states[s].t == nfa_state::chars && setContains[states[s].set][k]) {
+					closure(states, states[s].out, false, seen, next);
+				}
+			}
+
+			transitions_[i * classes_ + k] = add_state(std::move(next), false);
+		}
+	}
+
+	return true;
+}
+
+uint32_t CFilterRegex::classify(wchar_t c) const
+{
+	auto it = std::upper_bound(boundaries_.begin(), boundaries_.end(), static_cast<uint32_t>(c));
+	return static_cast<uint32_t>(it - boundaries_.begin()) - 1;
+}
+
+bool CFilterRegex::search(std::wstring_view const& subject) const
+{
+	if (transitions_.empty()) {
+		return false;
+	}
+
+	uint32_t state = 0;
+	if (accept_[state]) {
+		return true;
+	}
+	for (wchar_t const c : subject) {
+		uint32_t const k = (static_cast<uint32_t>(c) < 128) ? ascii_[static_cast<uint32_t>(c)] : classify(c);
+		state = transitions_[state * classes_ + k];
+		if (accept_[state]) {
+			return true;
+		}
+	}
+
+	return acceptAtEnd_[state];
+}
@@ -0,0 +1,98 @@
+#ifndef FILEZILLA_INTERFACE_FILTER_MATCHER_HEADER
+#define FILEZILLA_INTERFACE_FILTER_MATCHER_HEADER
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Finds all occurrences of a set of strings in a subject in a single pass,
+// using the Aho-Corasick algorithm.
+class CMultiStringMatcher final
+{
+public:
+	// Returns the index of the pattern, adding the same pattern twice
+	// returns the same index. Patterns must not be empty.
+	size_t add(std::wstring const& pattern);
+
+	// Must be called after adding the last pattern and before searching
+	void compile();
+
+	bool empty() const { return patterns_.empty(); }
+
+	std::wstring const& pattern(size_t index) const { return patterns_[index]; }
+
+	// Calls f(pattern index, end), end being the position just past
+	// the occurrence, for all occurrences in order of their end.
+	template<typename F>
+	void search(std::wstring_view const& subject, F && f) const
+	{
+		if (nodes_.empty()) {
+			return;
+		}
+
+		size_t state = 0;
+		for (size_t i = 0; i < subject.size(); ++i) {
+			state = next(state, subject[i]);
+			for (size_t out = nodes_[state].output ? state : nodes_[state].dict; out; out = nodes_[out].dict) {
+				f(nodes_[out].pattern, i + 1);
+			}
+		}
+	}
+
+private:
+	struct node final
+	{
+		// Sorted by character
+		std::vector<std::pair<wchar_t, size_t>> children;
+		size_t fail{};
+
+		// Nearest node on the fail chain that ends a pattern, 0 if none
+		size_t dict{};
+
+		size_t pattern{};
+		bool output{};
+	};
+
+	size_t child(size_t state, wchar_t c) const;
+	size_t next(size_t state, wchar_t c) const;
+
+	std::vector<std::wstring> patterns_;
+	std::vector<node> nodes_;
+};
+
+// Regular expressions of filter conditions, compiled into a DFA.
+//
+// Only the regular subset of the ECMAScript syntax is supported: literals,
+// ., bracket expressions, the \d, \w and \s classes and their negations,
+// groups, alternation, the ?, *, +, {n}, {n,} and {n,m} quantifiers and the
+// ^ and $ anchors. compile() fails on anything else, such as backreferences
+// or lookarounds, which need std::regex.
+class CFilterRegex final
+{
+public:
+	bool compile(std::wstring const& pattern, bool matchCase);
+
+	// Whether the expression matches anywhere in the subject. Unless the
+	// expression was compiled with matchCase, the subject has to be
+	// lowercase already.
+	bool search(std::wstring_view const& subject) const;
+
+private:
+	uint32_t classify(wchar_t c) const;
+
+	// Characters are mapped onto classes that no part of the expression
+	// distinguishes between, so the transition table only needs a column
+	// per class.
+	std::vector<uint32_t> boundaries_;
+	uint32_t ascii_[128]{};
+	uint32_t classes_{};
+
+	std::vector<uint32_t> transitions_;
+
+	// State 0 is the start state
+	std::vector<bool> accept_;
+	std::vector<bool> acceptAtEnd_;
+};
+
+#endif
@@ -26,7 +26,8 @@ enum t_ipcMutexType
 	MUTEX_GLOBALBOOKMARKS = 9,
 	MUTEX_SEARCHCONDITIONS = 10,
 	MUTEX_MAC_SANDBOX_USERDIRS = 11, // Only used if configured with --enable-mac-sandbox
-	MUTEX_RESERVED = 12
+	MUTEX_RESERVED = 12,
+	MUTEX_QUEUEJOURNAL = 13 // Held by the instance journaling its queue to the queue database
 };
 
 class CInterProcessMutex final
@@ -5,6 +5,8 @@
 #include <wx/renderer.h>
 #include <wx/statbox.h>
 
+#include <algorithm>
+
 #include "Options.h"
 #include "dialogex.h"
 #ifdef __WXMSW__
@@ -90,6 +92,11 @@ void wxListCtrlEx::OnPostScroll()
 {
 }
 
+void wxListCtrlEx::OnSystemIconsChanged()
+{
+	Refresh(false);
+}
+
 void wxListCtrlEx::OnPostScrollEvent(wxCommandEvent&)
 {
 	OnPostScroll();
@@ -351,17 +358,59 @@ wxString wxListCtrlEx::OnGetItemText(long item, long column) const
 	return pThis->GetItemText(item, (unsigned int)m_pVisibleColumnMapping[column]);
 }
 
+void wxListCtrlEx::BuildPrefixIndex()
+{
+	int const count = GetItemCount();
+
+	m_prefixIndex.clear();
+	m_prefixIndex.reserve(count);
+	for (int i = 0; i < count; ++i) {
+		m_prefixIndex.emplace_back(GetItemText(i, 0).Lower().ToStdWstring(), i);
+	}
+	std::sort(m_prefixIndex.begin(), m_prefixIndex.end());
+
+	m_prefixIndexValid = true;
+}
+
+void wxListCtrlEx::InvalidatePrefixIndex()
+{
+	m_prefixIndexValid = false;
+	m_prefixIndex.clear();
+}
+
 int wxListCtrlEx::FindItemWithPrefix(const wxString& searchPrefix, int start)
 {
 	const int count = GetItemCount();
-	for (int i = start; i < (count + start); ++i) {
-		int item = i % count;
-		wxString namePrefix = GetItemText(item, 0).Left(searchPrefix.Length());
-		if (!namePrefix.CmpNoCase(searchPrefix)) {
-			return i % count;
+	if (count <= 0) {
+		return -1;
+	}
+
+	if (!m_prefixIndexValid || m_prefixIndex.size() != static_cast<size_t>(count)) {
+		BuildPrefixIndex();
+	}
+
+	// All names starting with the prefix are adjacent in the index. Of those,
+	// pick the first item at or after start, wrapping around at the end.
+	std::wstring const prefix = searchPrefix.Lower().ToStdWstring();
+	auto it = std::lower_bound(m_prefixIndex.begin(), m_prefixIndex.end(), prefix, [](std::pair<std::wstring, int> const& entry, std::wstring const& p) {
+		return entry.first < p;
+	});
+
+	int next = -1;
+	int first = -1;
+	for (; it != m_prefixIndex.end() && !it->first.compare(0, prefix.size(), prefix); ++it) {
+		int const item = it->second;
+		if (item >= start) {
+			if (next == -1 || item < next) {
+				next = item;
+			}
+		}
+		else if (first == -1 || item < first) {
+			first = item;
 		}
 	}
-	return -1;
+
+	return next != -1 ? next : first;
 }
 
 void wxListCtrlEx::SaveSetItemCount(long count)
@@ -375,6 +424,7 @@ void wxListCtrlEx::SaveSetItemCount(long count)
 	}
 #endif //__WXMSW__
 	SetItemCount(count);
+	InvalidatePrefixIndex();
 }
 
 void wxListCtrlEx::ResetSearchPrefix()
@@ -968,6 +1018,8 @@ void wxListCtrlEx::SetHeaderSortIconIndex(int col, int icon)
 
 void wxListCtrlEx::RefreshListOnly(bool eraseBackground /*=true*/)
 {
+	InvalidatePrefixIndex();
+
 	// See comment in wxGenericListCtrl::Refresh
 	GetMainWindow()->Refresh(eraseBackground);
 }
@@ -35,6 +35,9 @@ public:
 
 	void ShowColumnEditor();
 
+	// Redraws rows showing provisional icons
+	virtual void OnSystemIconsChanged() override;
+
 	void ShowColumn(unsigned int col, bool show);
 
 	// Moves column. Target position includes both hidden
@@ -99,6 +102,9 @@ protected:
 	virtual wxString OnGetItemText(long item, long column) const;
 	void ResetSearchPrefix();
 
+	// Has to be called whenever the names or the order of the items change
+	void InvalidatePrefixIndex();
+
 	// Argument is visible column index
 	int GetHeaderSortIconIndex(int col);
 	void SetHeaderSortIconIndex(int col, int icon);
@@ -133,6 +139,12 @@ private:
 	fz::datetime m_prefixSearch_lastKeyPress;
 	wxString m_prefixSearch_prefix;
 
+	// Lowercased names of the items in the first column with their item
+	// index, sorted by name. Built on first use.
+	void BuildPrefixIndex();
+	std::vector<std::pair<std::wstring, int>> m_prefixIndex;
+	bool m_prefixIndexValid{};
+
 	bool ReadColumnWidths(unsigned int optionId);
 	void SaveColumnWidths(unsigned int optionId);
 
@@ -1,5 +1,6 @@
 #include <filezilla.h>
 #include "listingcomparison.h"
+#include "commandqueue.h"
 #include "filter.h"
 #include "Options.h"
 #include "state.h"
@@ -56,18 +57,30 @@ void CComparableListing::RefreshComparison()
 	}
 
 	if (!CanStartComparison() || !GetOther() || !GetOther()->CanStartComparison()) {
+		// The result would refer to outdated data
+		m_pComparisonManager->CancelComparison();
 		return;
 	}
 
 	m_pComparisonManager->CompareListings();
 }
 
+namespace {
+// Below this many entries, comparing is faster than the round trip to a worker
+size_t const async_comparison_threshold = 20000;
+
+// While checksums are coming in, the listings are compared again at most this often
+fz::duration const hash_refresh_interval = fz::duration::from_seconds(1);
+}
+
 bool CComparisonManager::CompareListings()
 {
 	if (!m_pLeft || !m_pRight) {
 		return false;
 	}
 
+	CancelComparison();
+
 	CFilterManager filters;
 	if (filters.HasActiveFilters() && !filters.HasSameLocalAndRemoteFilters()) {
 		m_state.NotifyHandlers(STATECHANGE_COMPARISON);
@@ -85,51 +98,189 @@ bool CComparisonManager::CompareListings()
 		return true;
 	}
 
-	fz::duration const threshold = fz::duration::from_minutes( COptions::Get()->GetOptionVal(OPTION_COMPARISON_THRESHOLD) );
+	comparison_options options;
+	options.threshold = fz::duration::from_minutes( COptions::Get()->GetOptionVal(OPTION_COMPARISON_THRESHOLD) );
+	options.dirSortMode = COptions::Get()->GetOptionVal(OPTION_FILELIST_DIRSORT);
+	options.mode = m_comparisonMode;
+	options.hideIdentical = m_hideIdentical;
+
+	if (options.mode == 2) {
+		auto const localDir = m_state.GetLocalDir().GetPath();
+		auto const remotePath = m_state.GetRemotePath();
+		if (localDir != localDir_ || remotePath != remotePath_) {
+			StopHashing();
+			contents_.clear();
+			remoteQueue_.clear();
+			hashUnsupported_ = false;
+			localDir_ = localDir;
+			remotePath_ = remotePath;
+		}
+		options.contents = contents_;
+	}
+
+	auto left = std::make_shared<std::vector<CComparableListing::entry>>();
+	auto right = std::make_shared<std::vector<CComparableListing::entry>>();
+	m_pLeft->GetComparisonEntries(*left);
+	m_pRight->GetComparisonEntries(*right);
+
+	if (left->size() + right->size() >= async_comparison_threshold) {
+		fz::scoped_lock l(mutex_);
+		cancel_ = false;
+		task_ = m_state.pool_.spawn([this, left, right, options]() {
+			std::vector<diff_entry> diff;
+			std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> unhashed;
+			if (Compare(*left, *right, options, diff, unhashed)) {
+				{
+					fz::scoped_lock lock(mutex_);
+					result_ = std::move(diff);
+					unhashedResult_ = std::move(unhashed);
+					haveResult_ = true;
+				}
+				CallAfter(&CComparisonManager::OnComparisonDone);
+			}
+		});
+		if (task_) {
+			return true;
+		}
+	}
+
+	std::vector<diff_entry> diff;
+	std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> unhashed;
+	Compare(*left, *right, options, diff, unhashed);
+	ApplyComparison(diff);
+	QueueHashes(unhashed);
 
+	return true;
+}
+
+void CComparisonManager::CancelComparison()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		cancel_ = true;
+	}
+	task_.join();
+
+	result_.clear();
+	unhashedResult_.clear();
+	haveResult_ = false;
+}
+
+void CComparisonManager::OnComparisonDone()
+{
+	std::vector<diff_entry> diff;
+	std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> unhashed;
+	{
+		fz::scoped_lock l(mutex_);
+		if (!haveResult_) {
+			// Cancelled meanwhile
+			return;
+		}
+		diff = std::move(result_);
+		unhashed = std::move(unhashedResult_);
+		haveResult_ = false;
+	}
+	task_.join();
+
+	if (!m_isComparing || !m_pLeft || !m_pRight) {
+		return;
+	}
+
+	ApplyComparison(diff);
+	QueueHashes(unhashed);
+}
+
+void CComparisonManager::ApplyComparison(std::vector<diff_entry> const& diff)
+{
 	m_pLeft->StartComparison();
 	m_pRight->StartComparison();
 
-	std::wstring localPath, remotePath;
-	std::wstring_view localFile, remoteFile;
-	bool localDir = false;
-	bool remoteDir = false;
-	int64_t localSize, remoteSize;
-	fz::datetime localDate, remoteDate;
+	for (auto const& entry : diff) {
+		m_pLeft->CompareAddFile(entry.left, entry.leftFlag);
+		m_pRight->CompareAddFile(entry.right, entry.rightFlag);
+	}
 
-	const int dirSortMode = COptions::Get()->GetOptionVal(OPTION_FILELIST_DIRSORT);
+	m_pRight->FinishComparison();
+	m_pLeft->FinishComparison();
+}
+
+bool CComparisonManager::Compare(std::vector<CComparableListing::entry> const& left, std::vector<CComparableListing::entry> const& right, comparison_options const& options, std::vector<diff_entry> & diff, std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> & unhashed)
+{
+	diff.reserve(std::max(left.size(), right.size()));
+
+	auto add = [&diff](CComparableListing::entry const* local, CComparableListing::t_fileEntryFlags leftFlag, CComparableListing::entry const* remote, CComparableListing::t_fileEntryFlags rightFlag) {
+		diff_entry entry;
+		entry.left = local ? local->index : 0;
+		entry.right = remote ? remote->index : 0;
+		entry.leftFlag = leftFlag;
+		entry.rightFlag = rightFlag;
+		diff.push_back(entry);
+	};
+
+	size_t i = 0;
+	size_t j = 0;
+	size_t steps = 0;
+	while (i < left.size() && j < right.size()) {
+		if (!(++steps % 4096)) {
+			fz::scoped_lock l(mutex_);
+			if (cancel_) {
+				return false;
+			}
+		}
 
-	bool gotLocal = m_pLeft->get_next_file(localFile, localPath, localDir, localSize, localDate);
-	bool gotRemote = m_pRight->get_next_file(remoteFile, remotePath, remoteDir, remoteSize, remoteDate);
+		auto const& local = left[i];
+		auto const& remote = right[j];
 
-	while (gotLocal && gotRemote) {
-		int cmp = CompareFiles(dirSortMode, localPath, localFile, remotePath, remoteFile, localDir, remoteDir);
+		int cmp = CompareFiles(options.dirSortMode, local.path, local.name, remote.path, remote.name, local.dir, remote.dir);
 		if (!cmp) {
-			if (!m_comparisonMode) {
-				const CComparableListing::t_fileEntryFlags flag = (localDir || localSize == remoteSize) ? CComparableListing::normal : CComparableListing::different;
+			if (!options.mode) {
+				const CComparableListing::t_fileEntryFlags flag = (local.dir || local.size == remote.size) ? CComparableListing::normal : CComparableListing::different;
 
-				if (!m_hideIdentical || flag != CComparableListing::normal || localFile == L"..") {
-					m_pLeft->CompareAddFile(flag);
-					m_pRight->CompareAddFile(flag);
+				if (!options.hideIdentical || flag != CComparableListing::normal || local.name == L"..") {
+					add(&local, flag, &remote, flag);
+				}
+			}
+			else if (options.mode == 2) {
+				// Until the checksums are known, files of equal size count as identical
+				CComparableListing::t_fileEntryFlags flag = CComparableListing::normal;
+				if (!local.dir) {
+					if (local.size != remote.size) {
+						flag = CComparableListing::different;
+					}
+					else if (!remote.dir && local.size >= 0) {
+						auto it = options.contents.find(local.name);
+						if (it == options.contents.end() || !it->second.matches(local, remote)) {
+							unhashed.emplace_back(local, remote);
+						}
+						else if (it->second.known() && it->second.localHash != it->second.remoteHash) {
+							flag = CComparableListing::different;
+						}
+					}
+				}
+
+				if (!options.hideIdentical || flag != CComparableListing::normal || local.name == L"..") {
+					add(&local, flag, &remote, flag);
 				}
 			}
 			else {
-				if (localDate.empty() || remoteDate.empty()) {
-					if (!m_hideIdentical || !localDate.empty() || !remoteDate.empty() || localFile == L"..") {
+				if (local.date.empty() || remote.date.empty()) {
+					if (!options.hideIdentical || !local.date.empty() || !remote.date.empty() || local.name == L"..") {
 						const CComparableListing::t_fileEntryFlags flag = CComparableListing::normal;
-						m_pLeft->CompareAddFile(flag);
-						m_pRight->CompareAddFile(flag);
+						add(&local, flag, &remote, flag);
 					}
 				}
 				else {
 					CComparableListing::t_fileEntryFlags localFlag, remoteFlag;
 
+					fz::datetime localDate = local.date;
+					fz::datetime remoteDate = remote.date;
+
 					int dateCmp = localDate.compare(remoteDate);
 					if (dateCmp < 0) {
-						localDate += threshold;
+						localDate += options.threshold;
 					}
 					else if (dateCmp > 0 ) {
-						remoteDate += threshold;
+						remoteDate += options.threshold;
 					}
 					int adjustedDateCmp = localDate.compare(remoteDate);
 					if (dateCmp && dateCmp == -adjustedDateCmp) {
@@ -144,42 +295,32 @@ bool CComparisonManager::CompareListings()
 					else if (dateCmp > 0) {
 						localFlag = CComparableListing::newer;
 					}
-					if (!m_hideIdentical || localFlag != CComparableListing::normal || remoteFlag != CComparableListing::normal || localFile == L"..") {
-						m_pLeft->CompareAddFile(localFlag);
-						m_pRight->CompareAddFile(remoteFlag);
+					if (!options.hideIdentical || localFlag != CComparableListing::normal || remoteFlag != CComparableListing::normal || local.name == L"..") {
+						add(&local, localFlag, &remote, remoteFlag);
 					}
 				}
 			}
-			gotLocal = m_pLeft->get_next_file(localFile, localPath, localDir, localSize, localDate);
-			gotRemote = m_pRight->get_next_file(remoteFile, remotePath, remoteDir, remoteSize, remoteDate);
+			++i;
+			++j;
 			continue;
 		}
 
 		if (cmp < 0) {
-			m_pLeft->CompareAddFile(CComparableListing::lonely);
-			m_pRight->CompareAddFile(CComparableListing::fill);
-			gotLocal = m_pLeft->get_next_file(localFile, localPath, localDir, localSize, localDate);
+			add(&local, CComparableListing::lonely, nullptr, CComparableListing::fill);
+			++i;
 		}
 		else {
-			m_pLeft->CompareAddFile(CComparableListing::fill);
-			m_pRight->CompareAddFile(CComparableListing::lonely);
-			gotRemote = m_pRight->get_next_file(remoteFile, remotePath, remoteDir, remoteSize, remoteDate);
+			add(nullptr, CComparableListing::fill, &remote, CComparableListing::lonely);
+			++j;
 		}
 	}
-	while (gotLocal) {
-		m_pLeft->CompareAddFile(CComparableListing::lonely);
-		m_pRight->CompareAddFile(CComparableListing::fill);
-		gotLocal = m_pLeft->get_next_file(localFile, localPath, localDir, localSize, localDate);
+	for (; i < left.size(); ++i) {
+		add(&left[i], CComparableListing::lonely, nullptr, CComparableListing::fill);
 	}
-	while (gotRemote) {
-		m_pLeft->CompareAddFile(CComparableListing::fill);
-		m_pRight->CompareAddFile(CComparableListing::lonely);
-		gotRemote = m_pRight->get_next_file(remoteFile, remotePath, remoteDir, remoteSize, remoteDate);
+	for (; j < right.size(); ++j) {
+		add(nullptr, CComparableListing::fill, &right[j], CComparableListing::lonely);
 	}
 
-	m_pRight->FinishComparison();
-	m_pLeft->FinishComparison();
-
 	return true;
 }
 
@@ -224,6 +365,12 @@ CComparisonManager::CComparisonManager(CState& state)
 	m_hideIdentical = COptions::Get()->GetOptionVal(OPTION_COMPARE_HIDEIDENTICAL) != 0;
 }
 
+CComparisonManager::~CComparisonManager()
+{
+	CancelComparison();
+	StopHashing();
+}
+
 void CComparisonManager::SetListings(CComparableListing* pLeft, CComparableListing* pRight)
 {
 	wxASSERT((pLeft && pRight) || (!pLeft && !pRight));
@@ -256,6 +403,11 @@ void CComparisonManager::ExitComparisonMode()
 		return;
 	}
 
+	CancelComparison();
+	StopHashing();
+	remoteQueue_.clear();
+	contents_.clear();
+
 	m_isComparing = false;
 	if (m_pLeft) {
 		m_pLeft->OnExitComparisonMode();
@@ -266,3 +418,192 @@ void CComparisonManager::ExitComparisonMode()
 
 	m_state.NotifyHandlers(STATECHANGE_COMPARISON);
 }
+
+bool CComparisonManager::content_entry::matches(CComparableListing::entry const& local, CComparableListing::entry const& remote) const
+{
+	return size == local.size && localDate == local.date && remoteDate == remote.date;
+}
+
+void CComparisonManager::QueueHashes(std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> const& unhashed)
+{
+	if (unhashed.empty() || hashUnsupported_ || !m_state.IsRemoteConnected()) {
+		return;
+	}
+	if (!CServer::ProtocolHasFeature(m_state.GetSite().server.GetProtocol(), ProtocolFeature::FileHash)) {
+		return;
+	}
+
+	for (auto const& [local, remote] : unhashed) {
+		auto & content = contents_[local.name];
+		content = content_entry();
+		content.size = local.size;
+		content.localDate = local.date;
+		content.remoteDate = remote.date;
+		remoteQueue_.push_back(local.name);
+	}
+
+	RequestNextHash();
+}
+
+void CComparisonManager::RequestNextHash()
+{
+	if (!m_state.m_pCommandQueue || !m_state.m_pCommandQueue->Idle(CCommandQueue::comparison)) {
+		return;
+	}
+
+	while (!remoteQueue_.empty() && !hashUnsupported_) {
+		std::wstring name = std::move(remoteQueue_.front());
+		remoteQueue_.pop_front();
+
+		auto it = contents_.find(name);
+		if (it == contents_.end() || !it->second.remoteHash.empty() || it->second.failed) {
+			// Queued more than once
+			continue;
+		}
+
+		m_state.m_pCommandQueue->ProcessCommand(new CFileHashCommand(remotePath_, name), CCommandQueue::comparison);
+		break;
+	}
+}
+
+void CComparisonManager::ProcessFileHash(CFileHashNotification const& notification)
+{
+	if (!m_isComparing || notification.path_ != remotePath_) {
+		return;
+	}
+
+	auto it = contents_.find(notification.file_);
+	if (it == contents_.end()) {
+		return;
+	}
+
+	auto & content = it->second;
+	if (!CLocalFileHasher::Supported(notification.algorithm_)) {
+		content.failed = true;
+		return;
+	}
+
+	content.algorithm = notification.algorithm_;
+	content.remoteHash = notification.hash_;
+	HashLocalFile(it->first, content);
+}
+
+void CComparisonManager::FileHashFinished(int replyCode)
+{
+	if (replyCode == FZ_REPLY_NOTSUPPORTED) {
+		hashUnsupported_ = true;
+		remoteQueue_.clear();
+	}
+
+	RequestNextHash();
+	OnHashDone();
+}
+
+void CComparisonManager::HashLocalFile(std::wstring const& name, content_entry const& content)
+{
+	local_hash request;
+	request.name = name;
+	request.file = localDir_ + name;
+	request.size = content.size;
+	request.date = content.localDate;
+	request.algorithm = content.algorithm;
+
+	fz::scoped_lock l(mutex_);
+	localQueue_.push_back(std::move(request));
+	if (hashWorkerRunning_) {
+		return;
+	}
+
+	hashTask_.join();
+	hashWorkerRunning_ = true;
+	hashTask_ = m_state.pool_.spawn([this]() {
+		fz::scoped_lock lock(mutex_);
+		while (!hashCancel_ && !localQueue_.empty()) {
+			auto request = std::move(localQueue_.front());
+			localQueue_.pop_front();
+			lock.unlock();
+
+			request.hash = CLocalFileHasher::Get().Hash(request.file, request.size, request.date, request.algorithm, [this]() {
+				fz::scoped_lock cancelLock(mutex_);
+				return hashCancel_;
+			});
+
+			lock.lock();
+			if (hashCancel_) {
+				break;
+			}
+			if (localResults_.empty()) {
+				CallAfter(&CComparisonManager::OnLocalHashes);
+			}
+			localResults_.push_back(std::move(request));
+		}
+		hashWorkerRunning_ = false;
+	});
+	if (!hashTask_) {
+		hashWorkerRunning_ = false;
+		localQueue_.clear();
+	}
+}
+
+void CComparisonManager::OnLocalHashes()
+{
+	std::vector<local_hash> results;
+	{
+		fz::scoped_lock l(mutex_);
+		results = std::move(localResults_);
+		localResults_.clear();
+	}
+
+	for (auto & result : results) {
+		auto it = contents_.find(result.name);
+		if (it == contents_.end() || it->second.algorithm != result.algorithm || it->second.size != result.size || it->second.localDate != result.date) {
+			continue;
+		}
+		if (result.hash.empty()) {
+			it->second.failed = true;
+		}
+		else {
+			it->second.localHash = std::move(result.hash);
+		}
+	}
+
+	OnHashDone();
+}
+
+void CComparisonManager::OnHashDone()
+{
+	if (!m_isComparing || m_comparisonMode != 2) {
+		return;
+	}
+
+	bool pending = !remoteQueue_.empty() || (m_state.m_pCommandQueue && !m_state.m_pCommandQueue->Idle(CCommandQueue::comparison));
+	if (!pending) {
+		fz::scoped_lock l(mutex_);
+		pending = hashWorkerRunning_ || !localResults_.empty();
+	}
+
+	auto const now = fz::monotonic_clock::now();
+	if (pending && lastHashRefresh_ && now - lastHashRefresh_ < hash_refresh_interval) {
+		return;
+	}
+	lastHashRefresh_ = now;
+
+	if (m_pLeft && m_pRight && m_pLeft->CanStartComparison() && m_pRight->CanStartComparison()) {
+		CompareListings();
+	}
+}
+
+void CComparisonManager::StopHashing()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		hashCancel_ = true;
+		localQueue_.clear();
+	}
+	hashTask_.join();
+
+	fz::scoped_lock l(mutex_);
+	hashCancel_ = false;
+	hashWorkerRunning_ = false;
+	localResults_.clear();
+}
@@ -1,8 +1,16 @@
 #ifndef FILEZILLA_INTERFACE_LISTINGCOMPARISON_HEADER
 #define FILEZILLA_INTERFACE_LISTINGCOMPARISON_HEADER
 
+#include "filehash.h"
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
 #include <wx/listctrl.h>
 
+#include <deque>
+#include <map>
+
 class CComparisonManager;
 class CComparableListing
 {
@@ -20,10 +28,30 @@ public:
 		lonely = 16
 	};
 
+	class entry final
+	{
+	public:
+		std::wstring name;
+		std::wstring path;
+		int64_t size{-1};
+		fz::datetime date;
+
+		// Passed back to CompareAddFile
+		unsigned int index{};
+		bool dir{};
+	};
+
 	virtual bool CanStartComparison() = 0;
+
+	// Appends the entries to compare, in the order in which comparison
+	// goes through them. May be compared on a worker thread, hence the
+	// copies.
+	virtual void GetComparisonEntries(std::vector<entry> & entries) = 0;
+
+	// Once the comparison is complete, StartComparison is called, followed
+	// by a CompareAddFile for each row to display and FinishComparison.
 	virtual void StartComparison() = 0;
-	virtual bool get_next_file(std::wstring_view & name, std::wstring & path, bool &dir, int64_t &size, fz::datetime& date) = 0;
-	virtual void CompareAddFile(t_fileEntryFlags flags) = 0;
+	virtual void CompareAddFile(unsigned int index, t_fileEntryFlags flags) = 0;
 	virtual void FinishComparison() = 0;
 	virtual void ScrollTopItem(int item) = 0;
 	virtual void OnExitComparisonMode() = 0;
@@ -47,15 +75,22 @@ private:
 	CComparisonManager* m_pComparisonManager;
 };
 
+class CFileHashNotification;
 class CState;
-class CComparisonManager
+class CComparisonManager final : public wxEvtHandler
 {
 public:
 	CComparisonManager(CState& state);
+	virtual ~CComparisonManager();
 
+	// Large listings are compared on a worker thread, the listings get
+	// updated once it is done.
 	bool CompareListings();
 	bool IsComparing() const { return m_isComparing; }
 
+	// Discards the result of a comparison that is still running
+	void CancelComparison();
+
 	void ExitComparisonMode();
 
 	void SetListings(CComparableListing* pLeft, CComparableListing* pRight);
@@ -63,14 +98,110 @@ public:
 	CComparableListing* LeftListing() const { return m_pLeft; }
 	CComparableListing* RightListing() const { return m_pRight; }
 
+	// 0 compares sizes, 1 modification times and 2 the content of files
+	// with equal size. The latter only works for the local and remote
+	// file list of the state and with servers that report checksums.
 	void SetComparisonMode(int mode) { m_comparisonMode = mode; }
 	void SetHideIdentical(bool hideIdentical) { m_hideIdentical = hideIdentical; }
 
+	void ProcessFileHash(CFileHashNotification const& notification);
+	void FileHashFinished(int replyCode);
+
 protected:
-	int CompareFiles(const int dirSortMode, std::wstring_view const& local_path, std::wstring_view const& local, std::wstring_view const& remote_path, std::wstring_view const& remote, bool localDir, bool remoteDir);
+	static int CompareFiles(const int dirSortMode, std::wstring_view const& local_path, std::wstring_view const& local, std::wstring_view const& remote_path, std::wstring_view const& remote, bool localDir, bool remoteDir);
+
+	// Files of equal size in content comparison mode
+	class content_entry final
+	{
+	public:
+		bool matches(CComparableListing::entry const& local, CComparableListing::entry const& remote) const;
+		bool known() const { return !localHash.empty() && !remoteHash.empty(); }
+
+		int64_t size{-1};
+		fz::datetime localDate;
+		fz::datetime remoteDate;
+
+		std::wstring algorithm;
+		std::string localHash;
+		std::string remoteHash;
+		bool failed{};
+	};
+
+	class comparison_options final
+	{
+	public:
+		fz::duration threshold;
+		int dirSortMode{};
+		int mode{};
+		bool hideIdentical{};
+
+		// By name, only for mode 2
+		std::map<std::wstring, content_entry> contents;
+	};
+
+	// A row of the compared listings
+	class diff_entry final
+	{
+	public:
+		unsigned int left{};
+		unsigned int right{};
+		CComparableListing::t_fileEntryFlags leftFlag{};
+		CComparableListing::t_fileEntryFlags rightFlag{};
+	};
+
+	// Merges the two sorted listings. Returns false if cancelled.
+	// In content comparison mode, files of equal size whose checksums have
+	// yet to be requested are added to unhashed.
+	bool Compare(std::vector<CComparableListing::entry> const& left, std::vector<CComparableListing::entry> const& right, comparison_options const& options, std::vector<diff_entry> & diff, std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> & unhashed);
+
+	void ApplyComparison(std::vector<diff_entry> const& diff);
+
+	void OnComparisonDone();
+
+	// Remote checksums are retrieved one at a time to not hold up other
+	// commands. Meanwhile local files get hashed on a worker.
+	void QueueHashes(std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> const& unhashed);
+	void RequestNextHash();
+	void HashLocalFile(std::wstring const& name, content_entry const& content);
+	void OnLocalHashes();
+	void OnHashDone();
+	void StopHashing();
 
 	CState& m_state;
 
+	fz::async_task task_;
+	fz::mutex mutex_;
+	bool cancel_{};
+	bool haveResult_{};
+	std::vector<diff_entry> result_;
+	std::vector<std::pair<CComparableListing::entry, CComparableListing::entry>> unhashedResult_;
+
+	class local_hash final
+	{
+	public:
+		std::wstring name;
+		std::wstring file;
+		int64_t size{-1};
+		fz::datetime date;
+		std::wstring algorithm;
+		std::string hash;
+	};
+
+	fz::async_task hashTask_;
+	bool hashWorkerRunning_{};
+	bool hashCancel_{};
+	std::deque<local_hash> localQueue_;
+	std::vector<local_hash> localResults_;
+
+	// Directories the content entries belong to
+	std::wstring localDir_;
+	CServerPath remotePath_;
+
+	std::map<std::wstring, content_entry> contents_;
+	std::deque<std::wstring> remoteQueue_;
+	bool hashUnsupported_{};
+	fz::monotonic_clock lastHashRefresh_;
+
 	// Left/right, first/second, a/b, doesn't matter
 	CComparableListing* m_pLeft{};
 	CComparableListing* m_pRight{};
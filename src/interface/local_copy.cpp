@@ -0,0 +1,225 @@
+#include <filezilla.h>
+#include "local_copy.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#ifndef FZ_WINDOWS
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+namespace {
+// Copying is mostly bound by the disks, more workers do not help
+size_t const max_workers = 4;
+
+bool copy_data(fz::file & in, fz::file & out)
+{
+	unsigned char buffer[256 * 1024];
+	int64_t read;
+	while ((read = in.read(buffer, sizeof(buffer))) > 0) {
+		if (out.write(buffer, read) != read) {
+			return false;
+		}
+	}
+	return !read;
+}
+
+bool copy_file(std::wstring const& source, std::wstring const& target)
+{
+#ifdef FZ_WINDOWS
+	return CopyFileExW(source.c_str(), target.c_str(), nullptr, nullptr, nullptr, 0) != 0;
+#else
+	auto const nsource = fz::to_native(source);
+	auto const ntarget = fz::to_native(target);
+
+#ifdef __APPLE__
+	// Instant copy-on-write clone on APFS. Fails if the target exists or on
+	// other filesystems, the data then gets copied below.
+	if (!clonefile(nsource.c_str(), ntarget.c_str(), 0)) {
+		return true;
+	}
+#endif
+
+	fz::file in(nsource, fz::file::reading);
+	if (!in.opened()) {
+		return false;
+	}
+	fz::file out(ntarget, fz::file::writing, fz::file::empty);
+	if (!out.opened()) {
+		return false;
+	}
+
+	struct stat buf;
+	if (!fstat(in.fd(), &buf)) {
+		fchmod(out.fd(), buf.st_mode & 07777);
+	}
+
+#if HAVE_COPY_FILE_RANGE
+	// Stays in the kernel, on filesystems like Btrfs or XFS the data does
+	// not get copied at all but shared.
+	bool first = true;
+	while (true) {
+		ssize_t res = copy_file_range(in.fd(), nullptr, out.fd(), nullptr, 1024 * 1024 * 1024, 0);
+		if (!res) {
+			return true;
+		}
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (first && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+				break;
+			}
+			return false;
+		}
+		first = false;
+	}
+#endif
+
+	return copy_data(in, out);
+#endif
+}
+}
+
+CLocalCopier::CLocalCopier(fz::thread_pool & pool, handler_t const& handler)
+	: pool_(pool)
+	, handler_(handler)
+{
+}
+
+CLocalCopier::~CLocalCopier()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		cancel_ = true;
+		condition_.signal(l);
+	}
+	for (auto & worker : workers_) {
+		worker.join();
+	}
+}
+
+bool CLocalCopier::Busy() const
+{
+	fz::scoped_lock l(mutex_);
+	return pending_ != 0;
+}
+
+void CLocalCopier::CopyDirectory(std::wstring const& source, std::wstring const& target)
+{
+	fz::scoped_lock l(mutex_);
+
+	jobs_.push_back({source, target, true});
+	++pending_;
+
+	if (running_) {
+		condition_.signal(l);
+		return;
+	}
+
+	// The previous workers are done, running_ got decremented on their way out
+	for (auto & worker : workers_) {
+		worker.join();
+	}
+	workers_.clear();
+
+	for (size_t i = 0; i < max_workers; ++i) {
+		auto worker = pool_.spawn([this]() { entry(); });
+		if (!worker) {
+			break;
+		}
+		workers_.push_back(std::move(worker));
+		++running_;
+	}
+	if (!running_) {
+		jobs_.clear();
+		pending_ = 0;
+	}
+}
+
+void CLocalCopier::entry()
+{
+	fz::scoped_lock l(mutex_);
+	while (!cancel_ && pending_) {
+		if (jobs_.empty()) {
+			condition_.wait(l);
+			continue;
+		}
+
+		job j = std::move(jobs_.front());
+		jobs_.pop_front();
+		if (!jobs_.empty()) {
+			condition_.signal(l);
+		}
+
+		l.unlock();
+		Process(j);
+		l.lock();
+
+		--pending_;
+	}
+
+	// Pass the wakeup on so that the other workers notice as well
+	condition_.signal(l);
+	if (!--running_ && !cancel_) {
+		CallAfter(&CLocalCopier::OnFinished);
+	}
+}
+
+void CLocalCopier::Process(job const& j)
+{
+	if (!j.dir) {
+		copy_file(j.source, j.target);
+		return;
+	}
+
+	fz::mkdir(fz::to_native(j.target), false);
+
+	fz::local_filesys fs;
+	if (!fs.begin_find_files(fz::to_native(j.source), false)) {
+		return;
+	}
+
+	std::vector<job> jobs;
+
+	bool is_link{};
+	fz::local_filesys::type t{};
+	fz::native_string file;
+	while (fs.get_next_file(file, is_link, t, nullptr, nullptr, nullptr)) {
+		if (file.empty()) {
+			continue;
+		}
+
+		std::wstring const name = fz::to_wstring(file);
+		if (t == fz::local_filesys::dir) {
+			if (is_link) {
+				continue;
+			}
+			jobs.push_back({j.source + name + fz::local_filesys::path_separator, j.target + name + fz::local_filesys::path_separator, true});
+		}
+		else {
+			jobs.push_back({j.source + name, j.target + name, false});
+		}
+	}
+
+	if (!jobs.empty()) {
+		fz::scoped_lock l(mutex_);
+		pending_ += jobs.size();
+		for (auto & newJob : jobs) {
+			jobs_.push_back(std::move(newJob));
+		}
+		condition_.signal(l);
+	}
+}
+
+void CLocalCopier::OnFinished()
+{
+	if (handler_) {
+		handler_();
+	}
+}
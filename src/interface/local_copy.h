@@ -0,0 +1,65 @@
+#ifndef FILEZILLA_INTERFACE_LOCAL_COPY_HEADER
+#define FILEZILLA_INTERFACE_LOCAL_COPY_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <wx/event.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Copies local directory trees in the background. Directories are walked
+// and files copied by a few workers from the thread pool, the handler gets
+// called on the GUI thread once all queued copies are done.
+//
+// Where the platform offers it, copies are offloaded to the kernel or the
+// filesystem: clonefile on macOS, copy_file_range on Linux, which also
+// creates reflinks on filesystems supporting them, and CopyFileEx on Windows.
+class CLocalCopier final : public wxEvtHandler
+{
+public:
+	typedef std::function<void()> handler_t;
+
+	CLocalCopier(fz::thread_pool & pool, handler_t const& handler);
+	virtual ~CLocalCopier();
+
+	CLocalCopier(CLocalCopier const&) = delete;
+	CLocalCopier& operator=(CLocalCopier const&) = delete;
+
+	// Source and target are directories with trailing separator, target
+	// gets created.
+	void CopyDirectory(std::wstring const& source, std::wstring const& target);
+
+	bool Busy() const;
+
+private:
+	struct job final
+	{
+		std::wstring source;
+		std::wstring target;
+		bool dir{};
+	};
+
+	void entry();
+	void Process(job const& j);
+	void OnFinished();
+
+	fz::thread_pool & pool_;
+	handler_t const handler_;
+
+	mutable fz::mutex mutex_{false};
+	fz::condition condition_;
+	std::deque<job> jobs_;
+
+	// Queued jobs plus the ones being processed
+	size_t pending_{};
+	size_t running_{};
+	bool cancel_{};
+
+	std::vector<fz::async_task> workers_;
+};
+
+#endif
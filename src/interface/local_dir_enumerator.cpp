@@ -0,0 +1,242 @@
+#include <filezilla.h>
+#include "local_dir_enumerator.h"
+
+#include <string.h>
+
+#ifndef FZ_WINDOWS
+#include <fcntl.h>
+#endif
+
+CLocalDirEnumerator::~CLocalDirEnumerator()
+{
+	end();
+}
+
+#ifdef FZ_WINDOWS
+
+bool CLocalDirEnumerator::begin(fz::native_string const& path, bool dirsOnly)
+{
+	end();
+
+	if (path.empty()) {
+		return false;
+	}
+
+	dirsOnly_ = dirsOnly;
+	path_ = path;
+	if (path_.back() != '\\' && path_.back() != '/') {
+		path_ += '\\';
+	}
+
+	// Limiting to directories is only a hint, the type is checked anyhow
+	find_ = FindFirstFileExW((path_ + L"*").c_str(), FindExInfoBasic, &data_,
+		dirsOnly ? FindExSearchLimitToDirectories : FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+	if (find_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	pending_ = true;
+
+	return true;
+}
+
+void CLocalDirEnumerator::end()
+{
+	if (find_ != INVALID_HANDLE_VALUE) {
+		FindClose(find_);
+		find_ = INVALID_HANDLE_VALUE;
+	}
+	pending_ = false;
+}
+
+bool CLocalDirEnumerator::next(fz::native_string & name, bool & isLink, fz::local_filesys::type & t)
+{
+	if (find_ == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	for (;;) {
+		if (!pending_ && !FindNextFileW(find_, &data_)) {
+			return false;
+		}
+		pending_ = false;
+
+		if (!data_.cFileName[0] || !wcscmp(data_.cFileName, L".") || !wcscmp(data_.cFileName, L"..")) {
+			continue;
+		}
+
+		linkInfo_ = false;
+		isLink = (data_.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) && data_.dwReserved0 == IO_REPARSE_TAG_SYMLINK;
+		if (isLink) {
+			// The find data describes the link itself
+			bool dummy{};
+			t = fz::local_filesys::get_file_info(path_ + data_.cFileName, dummy, &linkSize_, &linkTime_, &linkAttributes_);
+			linkInfo_ = true;
+		}
+		else {
+			t = (data_.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? fz::local_filesys::dir : fz::local_filesys::file;
+		}
+
+		if (dirsOnly_ && t != fz::local_filesys::dir) {
+			continue;
+		}
+
+		name = data_.cFileName;
+		return true;
+	}
+}
+
+void CLocalDirEnumerator::details(int64_t * size, fz::datetime * time, int * attributes)
+{
+	if (linkInfo_) {
+		if (size) {
+			*size = linkSize_;
+		}
+		if (time) {
+			*time = linkTime_;
+		}
+		if (attributes) {
+			*attributes = linkAttributes_;
+		}
+		return;
+	}
+
+	if (size) {
+		if (data_.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			*size = -1;
+		}
+		else {
+			*size = (static_cast<int64_t>(data_.nFileSizeHigh) << 32) + data_.nFileSizeLow;
+		}
+	}
+	if (time) {
+		*time = fz::datetime(data_.ftLastWriteTime, fz::datetime::milliseconds);
+	}
+	if (attributes) {
+		*attributes = data_.dwFileAttributes;
+	}
+}
+
+#else
+
+bool CLocalDirEnumerator::begin(fz::native_string const& path, bool dirsOnly)
+{
+	end();
+
+	if (path.empty()) {
+		return false;
+	}
+
+	dirsOnly_ = dirsOnly;
+	dir_ = opendir(path.c_str());
+	return dir_ != nullptr;
+}
+
+void CLocalDirEnumerator::end()
+{
+	if (dir_) {
+		closedir(dir_);
+		dir_ = nullptr;
+	}
+}
+
+bool CLocalDirEnumerator::Stat()
+{
+	if (!statState_) {
+		// Follows links, like fz::local_filesys
+		statState_ = fstatat(dirfd(dir_), name_.c_str(), &stat_, 0) ? -1 : 1;
+	}
+	return statState_ == 1;
+}
+
+bool CLocalDirEnumerator::next(fz::native_string & name, bool & isLink, fz::local_filesys::type & t)
+{
+	if (!dir_) {
+		return false;
+	}
+
+	dirent const* entry;
+	while ((entry = readdir(dir_))) {
+		if (!entry->d_name[0] || !strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+			continue;
+		}
+
+		name_ = entry->d_name;
+		statState_ = 0;
+		isLink = false;
+
+#ifdef DT_DIR
+		switch (entry->d_type) {
+		case DT_DIR:
+			t = fz::local_filesys::dir;
+			break;
+		case DT_REG:
+			t = fz::local_filesys::file;
+			break;
+		case DT_LNK:
+			isLink = true;
+			t = Stat() ? (S_ISDIR(stat_.st_mode) ? fz::local_filesys::dir : fz::local_filesys::file) : fz::local_filesys::unknown;
+			break;
+		case DT_UNKNOWN:
+#endif
+		{
+			struct stat buf;
+			if (fstatat(dirfd(dir_), name_.c_str(), &buf, AT_SYMLINK_NOFOLLOW)) {
+				continue;
+			}
+			if (S_ISLNK(buf.st_mode)) {
+				isLink = true;
+				t = Stat() ? (S_ISDIR(stat_.st_mode) ? fz::local_filesys::dir : fz::local_filesys::file) : fz::local_filesys::unknown;
+			}
+			else {
+				stat_ = buf;
+				statState_ = 1;
+				t = S_ISDIR(buf.st_mode) ? fz::local_filesys::dir : fz::local_filesys::file;
+			}
+		}
+#ifdef DT_DIR
+			break;
+		default:
+			// Devices, sockets and the like
+			t = fz::local_filesys::file;
+			break;
+		}
+#endif
+
+		if (dirsOnly_ && t != fz::local_filesys::dir) {
+			continue;
+		}
+
+		name = name_;
+		return true;
+	}
+
+	return false;
+}
+
+void CLocalDirEnumerator::details(int64_t * size, fz::datetime * time, int * attributes)
+{
+	if (!dir_ || !Stat()) {
+		if (size) {
+			*size = -1;
+		}
+		if (time) {
+			*time = fz::datetime();
+		}
+		if (attributes) {
+			*attributes = -1;
+		}
+		return;
+	}
+
+	if (size) {
+		*size = S_ISDIR(stat_.st_mode) ? -1 : static_cast<int64_t>(stat_.st_size);
+	}
+	if (time) {
+		*time = fz::datetime(stat_.st_mtime, fz::datetime::seconds);
+	}
+	if (attributes) {
+		*attributes = stat_.st_mode & 0777;
+	}
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef FILEZILLA_INTERFACE_LOCAL_DIR_ENUMERATOR_HEADER
+#define FILEZILLA_INTERFACE_LOCAL_DIR_ENUMERATOR_HEADER
+
+#include <libfilezilla/local_filesys.hpp>
+
+#ifndef FZ_WINDOWS
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// Enumerates a local directory like fz::local_filesys, but the size,
+// modification time and attributes of an entry are only looked up once
+// asked for through details().
+//
+// On POSIX the type of most entries comes from d_type of readdir, fstatat
+// relative to the directory is only needed for links, on filesystems not
+// filling in d_type and for the details. On Windows FindFirstFileEx with
+// FindExInfoBasic and FIND_FIRST_EX_LARGE_FETCH returns the details along
+// with the names anyhow.
+//
+// As with fz::local_filesys, the type and details of links are those of
+// their target.
+class CLocalDirEnumerator final
+{
+public:
+	CLocalDirEnumerator() = default;
+	~CLocalDirEnumerator();
+
+	CLocalDirEnumerator(CLocalDirEnumerator const&) = delete;
+	CLocalDirEnumerator& operator=(CLocalDirEnumerator const&) = delete;
+
+	// If dirsOnly is set, only directories and links to directories are
+	// returned.
+	bool begin(fz::native_string const& path, bool dirsOnly = false);
+	void end();
+
+	bool next(fz::native_string & name, bool & isLink, fz::local_filesys::type & t);
+
+	// Of the entry last returned by next. Size is -1 for directories.
+	void details(int64_t * size, fz::datetime * time, int * attributes);
+
+private:
+	bool dirsOnly_{};
+
+#ifdef FZ_WINDOWS
+	HANDLE find_{INVALID_HANDLE_VALUE};
+	WIN32_FIND_DATAW data_{};
+	bool pending_{};
+	fz::native_string path_;
+
+	// For links, the details of the target
+	bool linkInfo_{};
+	int64_t linkSize_{-1};
+	fz::datetime linkTime_;
+	int linkAttributes_{};
+#else
+	bool Stat();
+
+	DIR* dir_{};
+	fz::native_string name_;
+	struct stat stat_{};
+
+	// 0 not yet tried, 1 stat_ is set, -1 failed
+	int statState_{};
+#endif
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include <filezilla.h>
+#include "local_dir_watcher.h"
+
+#include <libfilezilla/local_filesys.hpp>
+
+#include <wx/evtloop.h>
+#include <wx/filename.h>
+#if wxUSE_FSWATCHER
+#include <wx/fswatcher.h>
+#endif
+
+namespace {
+// Changes usually come in bursts, e.g. delete followed by create, or a
+// file being written.
+int const notify_delay = 250;
+
+// More changes than this for a single directory get reported as a full
+// refresh, that is cheaper than updating entry by entry.
+size_t const max_pending_names = 1000;
+
+std::wstring with_separator(std::wstring dir)
+{
+	if (dir.empty() || dir.back() != fz::local_filesys::path_separator) {
+		dir += fz::local_filesys::path_separator;
+	}
+	return dir;
+}
+}
+
+CLocalDirWatcher::CLocalDirWatcher(handler_t const& handler)
+	: handler_(handler)
+{
+	timer_.SetOwner(this);
+	Bind(wxEVT_TIMER, &CLocalDirWatcher::OnTimer, this);
+#if wxUSE_FSWATCHER
+	Bind(wxEVT_FSWATCHER, &CLocalDirWatcher::OnEvent, this);
+#endif
+}
+
+CLocalDirWatcher::~CLocalDirWatcher()
+{
+	timer_.Stop();
+}
+
+bool CLocalDirWatcher::Create()
+{
+#if wxUSE_FSWATCHER
+	if (watcher_) {
+		return true;
+	}
+	if (failed_) {
+		return false;
+	}
+
+	// The watcher needs a running event loop
+	if (!wxEventLoopBase::GetActive()) {
+		if (!createPending_) {
+			createPending_ = true;
+			CallAfter([this]() {
+				createPending_ = false;
+				Apply();
+			});
+		}
+		return false;
+	}
+
+	watcher_ = std::make_unique<wxFileSystemWatcher>();
+	watcher_->SetOwner(this);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CLocalDirWatcher::Add(std::wstring const& dir)
+{
+	if (wanted_.insert(with_separator(dir)).second) {
+		Apply();
+	}
+}
+
+void CLocalDirWatcher::Remove(std::wstring const& dir)
+{
+	if (wanted_.erase(with_separator(dir))) {
+		Apply();
+	}
+}
+
+void CLocalDirWatcher::Set(std::vector<std::wstring> const& dirs)
+{
+	std::set<std::wstring> wanted;
+	for (auto const& dir : dirs) {
+		wanted.insert(with_separator(dir));
+	}
+	if (wanted != wanted_) {
+		wanted_ = std::move(wanted);
+		Apply();
+	}
+}
+
+bool CLocalDirWatcher::Watching(std::wstring const& dir) const
+{
+	return watched_.find(with_separator(dir)) != watched_.end();
+}
+
+void CLocalDirWatcher::Apply()
+{
+#if wxUSE_FSWATCHER
+	if (!Create()) {
+		return;
+	}
+
+	wxLogNull nullLog;
+
+	for (auto it = watched_.begin(); it != watched_.end(); ) {
+		if (wanted_.find(*it) == wanted_.end()) {
+			watcher_->Remove(wxFileName::DirName(*it));
+			pending_.erase(*it);
+			it = watched_.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+
+	int const events = wxFSW_EVENT_CREATE | wxFSW_EVENT_DELETE | wxFSW_EVENT_RENAME | wxFSW_EVENT_MODIFY | wxFSW_EVENT_WARNING | wxFSW_EVENT_ERROR;
+	for (auto const& dir : wanted_) {
+		if (watched_.find(dir) == watched_.end() && watcher_->Add(wxFileName::DirName(dir), events)) {
+			watched_.insert(dir);
+		}
+	}
+#endif
+}
+
+void CLocalDirWatcher::Queue(std::wstring const& path)
+{
+	if (path.empty()) {
+		return;
+	}
+
+	bool queued{};
+
+	auto dir = with_separator(path);
+	if (watched_.find(dir) != watched_.end()) {
+		// The directory itself changed
+		pending_[dir].all = true;
+		queued = true;
+	}
+
+	// Entry in its parent
+	dir.pop_back();
+	size_t const pos = dir.rfind(fz::local_filesys::path_separator);
+	if (pos != std::wstring::npos) {
+		std::wstring const name = dir.substr(pos + 1);
+		dir = dir.substr(0, pos + 1);
+		if (!name.empty() && watched_.find(dir) != watched_.end()) {
+			auto & changes = pending_[dir];
+			if (!changes.all) {
+				changes.names.insert(name);
+				if (changes.names.size() > max_pending_names) {
+					changes.names.clear();
+					changes.all = true;
+				}
+			}
+			queued = true;
+		}
+	}
+
+	if (queued && !timer_.IsRunning()) {
+		timer_.Start(notify_delay, true);
+	}
+}
+
+void CLocalDirWatcher::OnEvent(wxFileSystemWatcherEvent& event)
+{
+#if wxUSE_FSWATCHER
+	switch (event.GetChangeType()) {
+	case wxFSW_EVENT_RENAME:
+		Queue(event.GetPath().GetFullPath().ToStdWstring());
+		Queue(event.GetNewPath().GetFullPath().ToStdWstring());
+		break;
+	case wxFSW_EVENT_WARNING:
+	case wxFSW_EVENT_ERROR:
+		// Events got lost, everything might have changed
+		for (auto const& dir : watched_) {
+			pending_[dir].all = true;
+		}
+		if (!watched_.empty() && !timer_.IsRunning()) {
+			timer_.Start(notify_delay, true);
+		}
+		break;
+	default:
+		Queue(event.GetPath().GetFullPath().ToStdWstring());
+		break;
+	}
+#else
+	(void)event;
+#endif
+}
+
+void CLocalDirWatcher::OnTimer(wxTimerEvent&)
+{
+	auto pending = std::move(pending_);
+	pending_.clear();
+
+	std::vector<std::wstring> names;
+	for (auto const& changes : pending) {
+		names.clear();
+		if (!changes.second.all) {
+			names.assign(changes.second.names.begin(), changes.second.names.end());
+		}
+		handler_(changes.first, names);
+	}
+}
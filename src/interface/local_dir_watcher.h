@@ -0,0 +1,71 @@
+#ifndef FILEZILLA_INTERFACE_LOCAL_DIR_WATCHER_HEADER
+#define FILEZILLA_INTERFACE_LOCAL_DIR_WATCHER_HEADER
+
+#include <wx/event.h>
+#include <wx/timer.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class wxFileSystemWatcher;
+class wxFileSystemWatcherEvent;
+
+// Watches a set of local directories, without recursing into them, for
+// changes to the entries they contain. Uses wxFileSystemWatcher, that is
+// inotify on Linux, ReadDirectoryChangesW on Windows and kqueue on BSD and
+// macOS.
+//
+// Changes are coalesced and passed to the handler as the directory, with
+// its trailing separator, and the names of the changed entries. If the
+// changes are not known, e.g. after an overflow, the names are empty and
+// the handler has to refresh the whole directory.
+class CLocalDirWatcher final : public wxEvtHandler
+{
+public:
+	typedef std::function<void(std::wstring const& dir, std::vector<std::wstring> const& names)> handler_t;
+
+	explicit CLocalDirWatcher(handler_t const& handler);
+	virtual ~CLocalDirWatcher();
+
+	CLocalDirWatcher(CLocalDirWatcher const&) = delete;
+	CLocalDirWatcher& operator=(CLocalDirWatcher const&) = delete;
+
+	void Add(std::wstring const& dir);
+	void Remove(std::wstring const& dir);
+	void Set(std::vector<std::wstring> const& dirs);
+
+	// Whether changes to the directory get reported
+	bool Watching(std::wstring const& dir) const;
+
+private:
+	bool Create();
+	void Apply();
+	void Queue(std::wstring const& path);
+	void OnEvent(wxFileSystemWatcherEvent& event);
+	void OnTimer(wxTimerEvent& event);
+
+	handler_t const handler_;
+
+#if wxUSE_FSWATCHER
+	std::unique_ptr<wxFileSystemWatcher> watcher_;
+#endif
+	bool failed_{};
+	bool createPending_{};
+
+	std::set<std::wstring> wanted_;
+	std::set<std::wstring> watched_;
+
+	struct pending_changes final
+	{
+		std::set<std::wstring> names;
+		bool all{};
+	};
+	std::map<std::wstring, pending_changes> pending_;
+	wxTimer timer_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include <filezilla.h>
+#include "local_hash_worker.h"
+#include "filehash.h"
+
+#include <libfilezilla/local_filesys.hpp>
+
+CLocalHashWorker::CLocalHashWorker(fz::thread_pool & pool, handler_t const& handler)
+	: pool_(pool)
+	, handler_(handler)
+{
+}
+
+CLocalHashWorker::~CLocalHashWorker()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		quit_ = true;
+		requests_.clear();
+	}
+	task_.join();
+}
+
+void CLocalHashWorker::Hash(uint64_t id, std::wstring const& file, std::wstring const& algorithm)
+{
+	fz::scoped_lock l(mutex_);
+	requests_.push_back({id, file, algorithm, std::string()});
+	if (running_) {
+		return;
+	}
+
+	task_.join();
+	running_ = true;
+	task_ = pool_.spawn([this]() { entry(); });
+	if (!task_) {
+		running_ = false;
+		requests_.clear();
+	}
+}
+
+void CLocalHashWorker::entry()
+{
+	fz::scoped_lock l(mutex_);
+	while (!quit_ && !requests_.empty()) {
+		auto r = std::move(requests_.front());
+		requests_.pop_front();
+		l.unlock();
+
+		int64_t size{-1};
+		fz::datetime date;
+		bool is_link{};
+		if (fz::local_filesys::get_file_info(fz::to_native(r.file), is_link, &size, &date, nullptr) == fz::local_filesys::file) {
+			r.hash = CLocalFileHasher::Get().Hash(r.file, size, date, r.algorithm, [this]() {
+				fz::scoped_lock cancelLock(mutex_);
+				return quit_;
+			});
+		}
+
+		l.lock();
+		if (r.id && !quit_) {
+			if (results_.empty()) {
+				CallAfter(&CLocalHashWorker::OnResults);
+			}
+			results_.push_back(std::move(r));
+		}
+	}
+	running_ = false;
+}
+
+void CLocalHashWorker::OnResults()
+{
+	std::deque<request> results;
+	{
+		fz::scoped_lock l(mutex_);
+		results.swap(results_);
+	}
+
+	for (auto const& r : results) {
+		handler_(r.id, r.hash);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef FILEZILLA_INTERFACE_LOCAL_HASH_WORKER_HEADER
+#define FILEZILLA_INTERFACE_LOCAL_HASH_WORKER_HEADER
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <wx/event.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+
+// Hashes local files one after another on a thread from the pool, using
+// CLocalFileHasher and its cache. Results are passed to the handler on the
+// GUI thread.
+class CLocalHashWorker final : public wxEvtHandler
+{
+public:
+	// hash is empty if the file could not be read
+	typedef std::function<void(uint64_t id, std::string const& hash)> handler_t;
+
+	CLocalHashWorker(fz::thread_pool & pool, handler_t const& handler);
+	virtual ~CLocalHashWorker();
+
+	CLocalHashWorker(CLocalHashWorker const&) = delete;
+	CLocalHashWorker& operator=(CLocalHashWorker const&) = delete;
+
+	// With an id of 0, the hash only ends up in the cache of CLocalFileHasher
+	// and the handler does not get called.
+	void Hash(uint64_t id, std::wstring const& file, std::wstring const& algorithm);
+
+private:
+	struct request final
+	{
+		uint64_t id{};
+		std::wstring file;
+		std::wstring algorithm;
+		std::string hash;
+	};
+
+	void entry();
+	void OnResults();
+
+	fz::thread_pool & pool_;
+	handler_t const handler_;
+
+	fz::mutex mutex_{false};
+	std::deque<request> requests_;
+	std::deque<request> results_;
+	bool running_{};
+	bool quit_{};
+
+	fz::async_task task_;
+};
+
+#endif
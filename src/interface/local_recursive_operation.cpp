@@ -3,8 +3,41 @@
 
 #include <libfilezilla/local_filesys.hpp>
 
+#include "local_dir_enumerator.h"
 #include "QueueView.h"
 
+#include <algorithm>
+#include <thread>
+
+namespace {
+// Directories in flight per root. Limits how far the workers may run ahead
+// of the oldest directory that is still being listed.
+size_t const max_pending_listings = 256;
+
+size_t worker_count()
+{
+	// More threads than cores still help if listing mostly waits for
+	// the disk or a network share.
+	return std::clamp(static_cast<size_t>(std::thread::hardware_concurrency()), size_t(2), size_t(8));
+}
+
+// The GUI thread takes listings in batches of about this many entries
+size_t const listing_batch_size = 5000;
+
+// Processing a batch is repeated within a single event for this long
+fz::duration const listing_batch_time = fz::duration::from_milliseconds(50);
+
+// Enumeration pauses once this many entries wait for the GUI thread and
+// resumes after they dropped below the low mark.
+size_t const listing_high_mark = 100000;
+size_t const listing_low_mark = 25000;
+
+size_t weight(CLocalRecursiveOperation::listing const& d)
+{
+	return d.files.size() + d.dirs.size() + 1;
+}
+}
+
 BEGIN_EVENT_TABLE(CLocalRecursiveOperation, wxEvtHandler)
 END_EVENT_TABLE()
 
@@ -24,7 +57,15 @@ CLocalRecursiveOperation::CLocalRecursiveOperation(CState& state)
 
 CLocalRecursiveOperation::~CLocalRecursiveOperation()
 {
-	thread_.join();
+	{
+		fz::scoped_lock l(mutex_);
+		recursion_roots_.clear();
+		m_condition.signal(l);
+		m_drained.signal(l);
+	}
+	for (auto & thread : threads_) {
+		thread.join();
+	}
 }
 
 void CLocalRecursiveOperation::AddRecursionRoot(local_recursion_root && root)
@@ -81,16 +122,31 @@ bool CLocalRecursiveOperation::DoStartRecursiveOperation(OperationMode mode, Act
 		m_operationMode = mode;
 
 		m_filters = filters;
+		m_compiledFilters = CCompiledFilters(m_filters.first);
 		m_ignoreLinks = ignore_links;
 
-		thread_ = m_state.pool_.spawn([this] {entry(); });
-		if (!thread_) {
+		m_pendingListings.clear();
+		m_idleWorkers = 0;
+		m_throttledWorkers = 0;
+
+		// The workers wait for the mutex, they cannot have finished before
+		// all of them are counted.
+		size_t const count = worker_count();
+		for (size_t i = 0; i < count; ++i) {
+			auto thread = m_state.pool_.spawn([this] {entry(); });
+			if (!thread) {
+				break;
+			}
+			threads_.emplace_back(std::move(thread));
+		}
+		m_activeWorkers = threads_.size();
+		if (threads_.empty()) {
 			m_operationMode = recursive_none;
 			return false;
 		}
 	}
 
-	if ((mode == CRecursiveOperation::recursive_transfer || mode == CRecursiveOperation::recursive_transfer_flatten) && immediate) {
+	if ((mode == CRecursiveOperation::recursive_transfer || mode == CRecursiveOperation::recursive_transfer_flatten || mode == CRecursiveOperation::recursive_synchronize_upload) && immediate) {
 		m_actionAfterBlocker = m_pQueue->GetActionAfterBlocker();
 	}
 
@@ -113,10 +169,17 @@ void CLocalRecursiveOperation::StopRecursiveOperation()
 		m_processedFiles = 0;
 		m_processedDirectories = 0;
 
+		m_condition.signal(l);
+		m_drained.signal(l);
 	}
 
-	thread_.join();
+	for (auto & thread : threads_) {
+		thread.join();
+	}
+	threads_.clear();
+	m_pendingListings.clear();
 	m_listedDirectories.clear();
+	m_listedEntries = 0;
 
 	m_state.NotifyHandlers(STATECHANGE_LOCAL_RECURSION_STATUS);
 
@@ -143,7 +206,7 @@ void CLocalRecursiveOperation::EnqueueEnumeratedListing(fz::scoped_lock& l, list
 
 		CServerPath remoteSub = d.remotePath;
 		if (!remoteSub.empty()) {
-			if (m_operationMode == recursive_transfer) {
+			if (m_operationMode == recursive_transfer || m_operationMode == recursive_synchronize_upload) {
 				// Non-flatten case
 				remoteSub.AddSegment(entry.name);
 			}
@@ -151,6 +214,7 @@ void CLocalRecursiveOperation::EnqueueEnumeratedListing(fz::scoped_lock& l, list
 		root.add_dir_to_visit(localSub, remoteSub);
 	}
 
+	m_listedEntries += weight(d);
 	m_listedDirectories.emplace_back(std::move(d));
 
 	// Hand off to GUI thread
@@ -161,21 +225,78 @@ void CLocalRecursiveOperation::EnqueueEnumeratedListing(fz::scoped_lock& l, list
 	}
 }
 
+void CLocalRecursiveOperation::FlushPendingListings(fz::scoped_lock& l)
+{
+	while (!m_pendingListings.empty() && !recursion_roots_.empty()) {
+		auto & pending = m_pendingListings.front();
+		if (pending.chunks.empty()) {
+			if (!pending.done) {
+				break;
+			}
+			m_pendingListings.pop_front();
+			continue;
+		}
+
+		listing d = std::move(pending.chunks.front());
+		pending.chunks.pop_front();
+
+		// Adds the subdirectories to the directories to visit
+		EnqueueEnumeratedListing(l, std::move(d));
+		WakeWorker(l);
+	}
+}
+
+void CLocalRecursiveOperation::WakeWorker(fz::scoped_lock& l)
+{
+	// Condition signals only wake a single waiter. Each worker that
+	// finds more to do wakes up the next one.
+	if (m_idleWorkers) {
+		m_condition.signal(l);
+	}
+}
+
+bool CLocalRecursiveOperation::WaitForDrain(fz::scoped_lock& l)
+{
+	while (!recursion_roots_.empty() && m_listedEntries >= listing_high_mark) {
+		++m_throttledWorkers;
+		m_drained.wait(l);
+		--m_throttledWorkers;
+	}
+
+	// Like the workers waiting for directories, pass the wakeup on
+	if (m_throttledWorkers && (recursion_roots_.empty() || m_listedEntries < listing_high_mark)) {
+		m_drained.signal(l);
+	}
+
+	return !recursion_roots_.empty();
+}
+
 void CLocalRecursiveOperation::entry()
 {
 	{
 		fz::scoped_lock l(mutex_);
 
-		auto filters = m_filters.first;
-
-		CFilterManager filterManager;
 		while (!recursion_roots_.empty()) {
+			FlushPendingListings(l);
+			if (!WaitForDrain(l)) {
+				break;
+			}
+
 			listing d;
 
 			{
 				auto& root = recursion_roots_.front();
-				if (root.m_dirsToVisit.empty()) {
-					recursion_roots_.pop_front();
+				if (root.m_dirsToVisit.empty() || m_pendingListings.size() >= max_pending_listings) {
+					if (m_pendingListings.empty()) {
+						// Nothing is being listed that could add directories to visit
+						recursion_roots_.pop_front();
+						WakeWorker(l);
+					}
+					else {
+						++m_idleWorkers;
+						m_condition.wait(l);
+						--m_idleWorkers;
+					}
 					continue;
 				}
 
@@ -184,27 +305,43 @@ void CLocalRecursiveOperation::entry()
 				d.remotePath = dir.remotePath;
 
 				root.m_dirsToVisit.pop_front();
+				if (!root.m_dirsToVisit.empty()) {
+					WakeWorker(l);
+				}
 			}
 
+			auto & pending = m_pendingListings.emplace_back();
+
 			// Do the slow part without holding mutex
 			l.unlock();
 
 			bool sentPartial = false;
-			fz::local_filesys fs;
+			CLocalDirEnumerator fs;
 			fz::native_string localPath = fz::to_native(d.localPath.GetPath());
 
-			if (fs.begin_find_files(localPath)) {
+			// Details of directories are not needed past the filters
+			bool const dirDetails = m_compiledFilters.NeedsDetails(true);
+
+			if (fs.begin(localPath)) {
 				listing::entry entry;
 				bool isLink{};
 				fz::native_string name;
 				fz::local_filesys::type t{};
-				while (fs.get_next_file(name, isLink, t, &entry.size, &entry.time, &entry.attributes)) {
+				while (fs.next(name, isLink, t)) {
 					if (isLink && m_ignoreLinks) {
 						continue;
 					}
+					if (t != fz::local_filesys::dir || dirDetails) {
+						fs.details(&entry.size, &entry.time, &entry.attributes);
+					}
+					else {
+						entry.size = -1;
+						entry.time = fz::datetime();
+						entry.attributes = 0;
+					}
 					entry.name = fz::to_wstring(name);
 
-					if (!filterManager.FilenameFiltered(filters, entry.name, d.localPath.GetPath(), t == fz::local_filesys::dir, entry.size, entry.attributes, entry.time)) {
+					if (!m_compiledFilters.FilenameFiltered(entry.name, d.localPath.GetPath(), t == fz::local_filesys::dir, entry.size, entry.attributes, entry.time)) {
 						if (t == fz::local_filesys::dir) {
 							d.dirs.emplace_back(std::move(entry));
 						}
@@ -226,7 +363,12 @@ void CLocalRecursiveOperation::entry()
 								l.unlock();
 								break;
 							}
-							EnqueueEnumeratedListing(l, std::move(d));
+							pending.chunks.emplace_back(std::move(d));
+							FlushPendingListings(l);
+							if (!WaitForDrain(l)) {
+								l.unlock();
+								break;
+							}
 							l.unlock();
 							d = next;
 						}
@@ -240,11 +382,20 @@ void CLocalRecursiveOperation::entry()
 				break;
 			}
 			if (!sentPartial || !d.files.empty() || !d.dirs.empty()) {
-				EnqueueEnumeratedListing(l, std::move(d));
+				pending.chunks.emplace_back(std::move(d));
 			}
+			pending.done = true;
+		}
+
+		// Let waiting workers notice that there is nothing left
+		WakeWorker(l);
+
+		if (--m_activeWorkers) {
+			return;
 		}
 
 		listing d;
+		m_listedEntries += weight(d);
 		m_listedDirectories.emplace_back(std::move(d));
 	}
 
@@ -257,35 +408,57 @@ void CLocalRecursiveOperation::OnListedDirectory()
 		return;
 	}
 
-	bool const queue = m_operationMode == recursive_transfer || m_operationMode == recursive_transfer_flatten;
+	bool const queue = m_operationMode == recursive_transfer || m_operationMode == recursive_transfer_flatten || m_operationMode == recursive_synchronize_upload;
+	bool const synchronize = m_operationMode == recursive_synchronize_upload;
 
-	listing d;
+	std::vector<listing> batch;
 
 	bool stop = false;
+	bool more = false;
 	int64_t processed = 0;
-	while (processed < 5000) {
+	fz::monotonic_clock const start = fz::monotonic_clock::now();
+	do {
 		{
+			// Take a whole batch at once, many tiny directories would
+			// otherwise mean taking the lock for each of them.
 			fz::scoped_lock l(mutex_);
-			if (m_listedDirectories.empty()) {
-				break;
+			size_t entries = 0;
+			while (!m_listedDirectories.empty() && entries < listing_batch_size) {
+				entries += weight(m_listedDirectories.front());
+				batch.emplace_back(std::move(m_listedDirectories.front()));
+				m_listedDirectories.pop_front();
 			}
+			m_listedEntries -= entries;
+			more = !m_listedDirectories.empty();
 
-			d = std::move(m_listedDirectories.front());
-			m_listedDirectories.pop_front();
+			if (m_throttledWorkers && m_listedEntries < listing_low_mark) {
+				m_drained.signal(l);
+			}
 		}
 
-		if (d.localPath.empty()) {
-			stop = true;
-		}
-		else {
-			if (queue) {
+		for (auto & d : batch) {
+			if (d.localPath.empty()) {
+				stop = true;
+				break;
+			}
+
+			if (synchronize) {
+				// Files the server already has unchanged never become queue items.
+				// Directories that are not cached get queued in full, any
+				// existing files are then dealt with as usual.
+				CDirectoryListing remoteListing;
+				bool const cached = m_state.m_pEngine && m_state.m_pEngine->CacheLookup(d.remotePath, remoteListing) == FZ_REPLY_OK;
+				m_pQueue->QueueFiles(!m_immediate, site_, d, cached ? &remoteListing : nullptr);
+			}
+			else if (queue) {
 				m_pQueue->QueueFiles(!m_immediate, site_, d);
 			}
 			++m_processedDirectories;
 			processed += d.files.size();
 			m_state.NotifyHandlers(STATECHANGE_LOCAL_RECURSION_LISTING, std::wstring(), &d);
 		}
-	}
+		batch.clear();
+	} while (more && !stop && fz::monotonic_clock::now() - start < listing_batch_time);
 
 	if (queue) {
 		m_pQueue->QueueFile_Finish(m_immediate);
@@ -295,10 +468,10 @@ void CLocalRecursiveOperation::OnListedDirectory()
 	if (stop) {
 		StopRecursiveOperation();
 	}
-	else if (processed) {
+	else {
 		m_state.NotifyHandlers(STATECHANGE_LOCAL_RECURSION_STATUS);
 
-		if (processed >= 5000) {
+		if (more) {
 			CallAfter(&CLocalRecursiveOperation::OnListedDirectory);
 		}
 	}
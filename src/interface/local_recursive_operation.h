@@ -68,12 +68,43 @@ protected:
 
 	void EnqueueEnumeratedListing(fz::scoped_lock& l, listing&& d);
 
+	// Hands on the listings of the front root that are complete, in the
+	// order in which their directories have been queued for visiting.
+	void FlushPendingListings(fz::scoped_lock& l);
+	void WakeWorker(fz::scoped_lock& l);
+
+	// Blocks while the GUI thread is behind on processing listings.
+	// Returns false on cancellation.
+	bool WaitForDrain(fz::scoped_lock& l);
+
 	std::deque<local_recursion_root> recursion_roots_;
 
-	fz::async_task thread_;
+	// Directories of the front root that have been taken by a worker.
+	// Elements are only removed from the front once done, so the worker
+	// listing a directory can keep a reference to its element.
+	class pending_listing final
+	{
+	public:
+		std::deque<listing> chunks;
+		bool done{};
+	};
+	std::deque<pending_listing> m_pendingListings;
+
+	std::vector<fz::async_task> threads_;
 	fz::mutex mutex_;
+	fz::condition m_condition;
+	size_t m_activeWorkers{};
+	size_t m_idleWorkers{};
+
+	CCompiledFilters m_compiledFilters;
 
 	std::deque<listing> m_listedDirectories;
+
+	// Files and directories in m_listedDirectories, plus one per listing
+	size_t m_listedEntries{};
+
+	fz::condition m_drained;
+	size_t m_throttledWorkers{};
 	bool m_ignoreLinks{};
 
 	Site site_;
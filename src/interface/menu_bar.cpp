@@ -90,6 +90,7 @@ CMenuBar* CMenuBar::Load(CMainFrame* pMainFrame)
 	comparison->AppendSeparator();
 	comparison->Append(XRCID("ID_COMPARE_SIZE"), _("Compare file&size"), L"", wxITEM_RADIO);
 	comparison->Append(XRCID("ID_COMPARE_DATE"), _("Compare &modification time"), L"", wxITEM_RADIO);
+	comparison->Append(XRCID("ID_COMPARE_CONTENT"), _("Compare file &content"), L"", wxITEM_RADIO);
 	comparison->AppendSeparator();
 	comparison->Append(XRCID("ID_COMPARE_HIDEIDENTICAL"), _("&Hide identical files"), L"", wxITEM_CHECK);
 
@@ -176,6 +177,8 @@ CMenuBar* CMenuBar::Load(CMainFrame* pMainFrame)
 	if (COptions::Get()->GetOptionVal(OPTION_DEBUG_MENU)) {
 		wxMenu * debug = new wxMenu;
 		debug->Append(XRCID("ID_CLEARCACHE_LAYOUT"), _("Clear &layout cache"));
+		debug->Append(XRCID("ID_STARTUP_TIMINGS"), _("&Startup timings"), _("Shows how long the stages of startup took"));
+		debug->Append(XRCID("ID_PROFILING"), _("&Profiling"), _("Shows where the engines spend their time"));
 		debug->Append(XRCID("ID_CIPHERS"), _("&TLS Ciphers"), _("Shows available TLS ciphers"));
 		debug->Append(XRCID("ID_CLEAR_UPDATER"), _("Clear auto&update data"));
 		menubar->Append(debug, _("&Debug"));
@@ -186,11 +189,14 @@ CMenuBar* CMenuBar::Load(CMainFrame* pMainFrame)
 	menubar->Check(XRCID("ID_MENU_SERVER_VIEWHIDDEN"), COptions::Get()->GetOptionVal(OPTION_VIEW_HIDDEN_FILES) ? true : false);
 
 	int mode = COptions::Get()->GetOptionVal(OPTION_COMPARISONMODE);
-	if (mode != 1) {
-		menubar->Check(XRCID("ID_COMPARE_SIZE"), true);
+	if (mode == 1) {
+		menubar->Check(XRCID("ID_COMPARE_DATE"), true);
+	}
+	else if (mode == 2) {
+		menubar->Check(XRCID("ID_COMPARE_CONTENT"), true);
 	}
 	else {
-		menubar->Check(XRCID("ID_COMPARE_DATE"), true);
+		menubar->Check(XRCID("ID_COMPARE_SIZE"), true);
 	}
 
 	menubar->Check(XRCID("ID_COMPARE_HIDEIDENTICAL"), COptions::Get()->GetOptionVal(OPTION_COMPARE_HIDEIDENTICAL) != 0);
@@ -250,6 +256,7 @@ CMenuBar* CMenuBar::Load(CMainFrame* pMainFrame)
 	menubar->RegisterOption(OPTION_SPEEDLIMIT_ENABLE);
 	menubar->RegisterOption(OPTION_SPEEDLIMIT_INBOUND);
 	menubar->RegisterOption(OPTION_SPEEDLIMIT_OUTBOUND);
+	menubar->RegisterOption(OPTION_SPEEDLIMIT_SCHEDULE);
 
 #ifdef FZ_MAC
 	wxMenu* editMenu = nullptr;
@@ -536,11 +543,15 @@ void CMenuBar::OnOptionsChanged(changed_options_t const& options)
 		Check(XRCID("ID_COMPARE_HIDEIDENTICAL"), COptions::Get()->GetOptionVal(OPTION_COMPARE_HIDEIDENTICAL) != 0);
 	}
 	if (options.test(OPTION_COMPARISONMODE)) {
-		if (COptions::Get()->GetOptionVal(OPTION_COMPARISONMODE) != 1) {
-			Check(XRCID("ID_COMPARE_SIZE"), true);
+		int const mode = COptions::Get()->GetOptionVal(OPTION_COMPARISONMODE);
+		if (mode == 1) {
+			Check(XRCID("ID_COMPARE_DATE"), true);
+		}
+		else if (mode == 2) {
+			Check(XRCID("ID_COMPARE_CONTENT"), true);
 		}
 		else {
-			Check(XRCID("ID_COMPARE_DATE"), true);
+			Check(XRCID("ID_COMPARE_SIZE"), true);
 		}
 	}
 	if (options.test(OPTION_MESSAGELOG_POSITION)) {
@@ -552,7 +563,7 @@ void CMenuBar::OnOptionsChanged(changed_options_t const& options)
 			Check(XRCID("ID_VIEW_MESSAGELOG"), COptions::Get()->GetOptionVal(OPTION_SHOW_MESSAGELOG) != 0);
 		}
 	}
-	if (options.test(OPTION_SPEEDLIMIT_ENABLE) || options.test(OPTION_SPEEDLIMIT_INBOUND) || options.test(OPTION_SPEEDLIMIT_OUTBOUND)) {
+	if (options.test(OPTION_SPEEDLIMIT_ENABLE) || options.test(OPTION_SPEEDLIMIT_INBOUND) || options.test(OPTION_SPEEDLIMIT_OUTBOUND) || options.test(OPTION_SPEEDLIMIT_SCHEDULE)) {
 		UpdateSpeedLimitMenuItem();
 	}
 }
@@ -564,7 +575,7 @@ void CMenuBar::UpdateSpeedLimitMenuItem()
 	int downloadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
 	int uploadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
 
-	if (!downloadLimit && !uploadLimit) {
+	if (!downloadLimit && !uploadLimit && COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty()) {
 		enable = false;
 	}
 
@@ -0,0 +1,132 @@
+#include <filezilla.h>
+#include "metrics_writer.h"
+
+#include "Options.h"
+#include "queue.h"
+#include "QueueView.h"
+
+#include <engine_context.h>
+#include <engine_metrics.h>
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <wx/filefn.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+struct metric final
+{
+	char const* name;
+	char const* type;
+	char const* help;
+	std::string value;
+};
+
+std::string format_prometheus(std::vector<metric> const& metrics)
+{
+	std::string ret;
+	for (auto const& m : metrics) {
+		ret += fz::sprintf("# HELP filezilla_%s %s\n# TYPE filezilla_%s %s\nfilezilla_%s %s\n", m.name, m.help, m.name, m.type, m.name, m.value);
+	}
+	return ret;
+}
+
+std::string format_json(std::vector<metric> const& metrics)
+{
+	std::string ret = fz::sprintf("{\"time\":%d", (fz::datetime::now() - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds());
+	for (auto const& m : metrics) {
+		ret += fz::sprintf(",\"%s\":%s", m.name, m.value);
+	}
+	ret += "}\n";
+	return ret;
+}
+}
+
+CMetricsWriter::CMetricsWriter(CFileZillaEngineContext & engineContext, CQueue & queue)
+	: engineContext_(engineContext)
+	, queue_(queue)
+{
+	timer_.SetOwner(this);
+	Bind(wxEVT_TIMER, &CMetricsWriter::OnTimer, this);
+
+	RegisterOption(OPTION_METRICS_FILE);
+	RegisterOption(OPTION_METRICS_INTERVAL);
+
+	Start();
+}
+
+CMetricsWriter::~CMetricsWriter()
+{
+	timer_.Stop();
+}
+
+void CMetricsWriter::OnOptionsChanged(changed_options_t const&)
+{
+	Start();
+}
+
+void CMetricsWriter::Start()
+{
+	file_ = COptions::Get()->GetOption(OPTION_METRICS_FILE);
+	if (file_.empty()) {
+		timer_.Stop();
+		return;
+	}
+
+	timer_.Start(COptions::Get()->GetOptionVal(OPTION_METRICS_INTERVAL) * 1000);
+	Write();
+}
+
+void CMetricsWriter::OnTimer(wxTimerEvent&)
+{
+	Write();
+}
+
+void CMetricsWriter::Write()
+{
+	auto const engine = engineContext_.GetMetrics().Get();
+
+	std::vector<metric> metrics{
+		{"commands_total", "counter", "Engine commands finished.", std::to_string(engine.commands)},
+		{"command_failures_total", "counter", "Engine commands finished with an error.", std::to_string(engine.failed_commands)},
+		{"transferred_bytes_total", "counter", "Bytes transferred in either direction.", std::to_string(engine.bytes_transferred)},
+		{"directory_cache_hits_total", "counter", "Directory listings served from the cache.", std::to_string(engine.cache_hits)},
+		{"directory_cache_misses_total", "counter", "Directory listings not found in the cache.", std::to_string(engine.cache_misses)},
+		{"path_cache_hits_total", "counter", "Directory changes resolved from the path cache.", std::to_string(engine.path_cache_hits)},
+		{"path_cache_misses_total", "counter", "Directory changes not found in the path cache.", std::to_string(engine.path_cache_misses)},
+		{"path_cache_evictions_total", "counter", "Paths dropped from the path cache to stay within its limits.", std::to_string(engine.path_cache_evictions)},
+		{"lock_waits_total", "counter", "Operations that had to wait for another connection's lock.", std::to_string(engine.lock_waits)},
+		{"lock_wait_seconds_total", "counter", "Time spent waiting for locks.", fz::sprintf("%d.%03d", engine.lock_wait_ms / 1000, engine.lock_wait_ms % 1000)},
+		{"connections", "gauge", "Open control connections.", std::to_string(engine.connections)}
+	};
+
+	if (CQueueView* view = queue_.GetQueueView()) {
+		metrics.push_back({"queue_files", "gauge", "Files in the queue.", std::to_string(view->GetFileCount())});
+		metrics.push_back({"queue_bytes", "gauge", "Total size of the queued files of known size.", std::to_string(view->GetTotalQueueSize())});
+		metrics.push_back({"active_transfers", "gauge", "Transfers in progress.", std::to_string(view->GetActiveCount())});
+	}
+	if (auto* view = queue_.GetQueueView_Failed()) {
+		metrics.push_back({"failed_transfers", "gauge", "Files in the list of failed transfers.", std::to_string(view->GetFileCount())});
+	}
+	if (auto* view = queue_.GetQueueView_Successful()) {
+		metrics.push_back({"successful_transfers", "gauge", "Files in the list of successful transfers.", std::to_string(view->GetFileCount())});
+	}
+
+	std::string const out = fz::ends_with(file_, std::wstring(L".json")) ? format_json(metrics) : format_prometheus(metrics);
+
+	std::wstring const tmp = file_ + L".tmp";
+	{
+		fz::file f(fz::to_native(tmp), fz::file::writing, fz::file::empty);
+		if (!f.opened() || f.write(out.data(), static_cast<int64_t>(out.size())) != static_cast<int64_t>(out.size())) {
+			f.close();
+			fz::remove_file(fz::to_native(tmp));
+			return;
+		}
+	}
+	if (!wxRenameFile(tmp, file_, true)) {
+		fz::remove_file(fz::to_native(tmp));
+	}
+}
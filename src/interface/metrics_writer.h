@@ -0,0 +1,43 @@
+#ifndef FILEZILLA_INTERFACE_METRICS_WRITER_HEADER
+#define FILEZILLA_INTERFACE_METRICS_WRITER_HEADER
+
+#include <option_change_event_handler.h>
+
+#include <wx/event.h>
+#include <wx/timer.h>
+
+#include <string>
+
+class CFileZillaEngineContext;
+class CQueue;
+
+// Periodically writes engine and queue statistics to the file set in
+// OPTION_METRICS_FILE, every OPTION_METRICS_INTERVAL seconds. The format is
+// the Prometheus text format, suitable for the textfile collector of
+// node_exporter, or JSON if the file name ends in .json.
+//
+// The file gets replaced as a whole, readers never see a partial update.
+class CMetricsWriter final : public wxEvtHandler, protected COptionChangeEventHandler
+{
+public:
+	CMetricsWriter(CFileZillaEngineContext & engineContext, CQueue & queue);
+	virtual ~CMetricsWriter();
+
+	CMetricsWriter(CMetricsWriter const&) = delete;
+	CMetricsWriter& operator=(CMetricsWriter const&) = delete;
+
+private:
+	virtual void OnOptionsChanged(changed_options_t const& options) override;
+
+	void Start();
+	void Write();
+	void OnTimer(wxTimerEvent& event);
+
+	CFileZillaEngineContext & engineContext_;
+	CQueue & queue_;
+
+	std::wstring file_;
+	wxTimer timer_;
+};
+
+#endif
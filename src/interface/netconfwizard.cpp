@@ -708,7 +708,7 @@ std::wstring CNetConfWizard::GetExternalIPAddress()
 			PrintMessage(fz::sprintf(fztranslate("Retrieving external IP address from %s"), address), 0);
 
 			m_pIPResolver = new CExternalIPResolver(engine_context_.GetThreadPool(), *this);
-			m_pIPResolver->GetExternalIP(address, fz::address_type::ipv4, true);
+			m_pIPResolver->GetExternalIP(address, fz::address_type::ipv4);
 			if (!m_pIPResolver->Done()) {
 				return ret;
 			}
@@ -0,0 +1,192 @@
+#include <filezilla.h>
+#include "options_writer.h"
+#include "xmlfunctions.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+namespace {
+struct string_xml_writer final : public pugi::xml_writer
+{
+	virtual void write(void const* data, size_t size) override {
+		result.append(static_cast<char const*>(data), size);
+	}
+
+	std::string result;
+};
+
+// Journals of a few kilobytes are normal, larger ones are garbage
+int64_t const max_journal_size = 16 * 1024 * 1024;
+}
+
+COptionsWriter::COptionsWriter(std::wstring const& file, error_handler_t const& errorHandler)
+	: journalFile_(GetJournalFile(file))
+	, errorHandler_(errorHandler)
+	, ipcMutex_(MUTEX_OPTIONS, false)
+{
+	thread_.run([this]() { Worker(); });
+}
+
+COptionsWriter::~COptionsWriter()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		quit_ = true;
+		condition_.signal(l);
+	}
+	thread_.join();
+}
+
+std::wstring COptionsWriter::GetJournalFile(std::wstring const& file)
+{
+	return file + L".journal";
+}
+
+void COptionsWriter::Journal(pugi::xml_node setting)
+{
+	string_xml_writer writer;
+	setting.print(writer, PUGIXML_TEXT(""), pugi::format_raw, pugi::encoding_utf8);
+
+	fz::scoped_lock l(mutex_);
+	records_ += std::to_string(writer.result.size());
+	records_ += '\n';
+	records_ += writer.result;
+	records_ += '\n';
+	Notify(l);
+}
+
+void COptionsWriter::Write(std::unique_ptr<CXmlFile> && file)
+{
+	fz::scoped_lock l(mutex_);
+	document_ = std::move(file);
+	covered_ = records_.size();
+	Notify(l);
+}
+
+void COptionsWriter::Notify(fz::scoped_lock & l)
+{
+	if (thread_.joinable()) {
+		condition_.signal(l);
+	}
+	else {
+		// Could not start the thread, write in place then
+		Process(l);
+	}
+}
+
+void COptionsWriter::Flush()
+{
+	fz::scoped_lock l(mutex_);
+	while (busy_ || !records_.empty() || document_) {
+		idle_.wait(l);
+	}
+}
+
+void COptionsWriter::Worker()
+{
+	fz::scoped_lock l(mutex_);
+	while (true) {
+		if (records_.empty() && !document_) {
+			idle_.signal(l);
+			if (quit_) {
+				break;
+			}
+			condition_.wait(l);
+			continue;
+		}
+
+		Process(l);
+	}
+}
+
+void COptionsWriter::Process(fz::scoped_lock & l)
+{
+	busy_ = true;
+	std::string records;
+	std::swap(records, records_);
+	size_t const covered = covered_;
+	covered_ = 0;
+	auto document = std::move(document_);
+	l.unlock();
+
+	Append(records);
+	if (document) {
+		ipcMutex_.Lock();
+		bool const res = document->Save(false);
+		if (res) {
+			// Only what got changed after taking the copy remains
+			fz::remove_file(fz::to_native(journalFile_));
+			Append(records.substr(covered));
+		}
+		ipcMutex_.Unlock();
+
+		if (!res && errorHandler_) {
+			errorHandler_(document->GetError());
+		}
+	}
+
+	l.lock();
+	busy_ = false;
+}
+
+void COptionsWriter::Append(std::string const& records)
+{
+	if (records.empty()) {
+		return;
+	}
+
+	fz::file f(fz::to_native(journalFile_), fz::file::writing, fz::file::existing);
+	if (!f.opened() || f.seek(0, fz::file::end) < 0) {
+		return;
+	}
+	if (f.write(records.data(), static_cast<int64_t>(records.size())) != static_cast<int64_t>(records.size())) {
+		// Partial records at the end get ignored
+		f.close();
+	}
+}
+
+pugi::xml_document COptionsWriter::ReadJournal(std::wstring const& file)
+{
+	pugi::xml_document ret;
+
+	fz::file f(fz::to_native(GetJournalFile(file)), fz::file::reading);
+	if (!f.opened()) {
+		return ret;
+	}
+	int64_t const size = f.size();
+	if (size <= 0 || size > max_journal_size) {
+		return ret;
+	}
+
+	std::string data(static_cast<size_t>(size), 0);
+	if (f.read(data.data(), size) != size) {
+		return ret;
+	}
+
+	// Stops at the first incomplete or damaged record, it got written last
+	size_t pos = 0;
+	while (pos < data.size()) {
+		size_t const lf = data.find('\n', pos);
+		if (lf == std::string::npos || lf == pos) {
+			break;
+		}
+		size_t const len = fz::to_integral<size_t>(data.substr(pos, lf - pos), std::string::npos);
+		if (len == std::string::npos || len >= data.size() - lf - 1 || data[lf + 1 + len] != '\n') {
+			break;
+		}
+
+		pugi::xml_document record;
+		if (!record.load_buffer(data.data() + lf + 1, len, pugi::parse_default, pugi::encoding_utf8)) {
+			break;
+		}
+		auto setting = record.child("Setting");
+		if (!setting) {
+			break;
+		}
+		ret.append_copy(setting);
+
+		pos = lf + 2 + len;
+	}
+
+	return ret;
+}
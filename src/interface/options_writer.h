@@ -0,0 +1,90 @@
+#ifndef FILEZILLA_INTERFACE_OPTIONS_WRITER_HEADER
+#define FILEZILLA_INTERFACE_OPTIONS_WRITER_HEADER
+
+#include "ipcmutex.h"
+
+#ifdef HAVE_LIBPUGIXML
+#include <pugixml.hpp>
+#else
+#include "../pugixml/pugixml.hpp"
+#endif
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class CXmlFile;
+
+// Saves the settings file on a background thread, so that the GUI never
+// waits for the disk. Writes queued before the thread got to them are
+// coalesced, only the latest document gets written.
+//
+// Until the next complete write, each changed setting is also appended to
+// a journal next to the settings file. Appending is cheap and not synced,
+// it covers the settings changed since the last write if FileZilla itself
+// crashes. The journal is removed once the settings file has been written.
+//
+// Journal format: Each record is the size of the serialized <Setting>
+// element in decimal followed by a line feed, the element and a line feed.
+class COptionsWriter final
+{
+public:
+	// Called on the worker thread if the settings file could not be written
+	typedef std::function<void(std::wstring const& error)> error_handler_t;
+
+	COptionsWriter(std::wstring const& file, error_handler_t const& errorHandler);
+
+	// Finishes all queued writes
+	~COptionsWriter();
+
+	COptionsWriter(COptionsWriter const&) = delete;
+	COptionsWriter& operator=(COptionsWriter const&) = delete;
+
+	// Records a changed <Setting> element in the journal
+	void Journal(pugi::xml_node setting);
+
+	// Queues a copy of the document for writing, replacing any not yet
+	// written one.
+	void Write(std::unique_ptr<CXmlFile> && file);
+
+	// Waits until everything queued so far has been written
+	void Flush();
+
+	// The <Setting> elements journaled since the last complete write, in
+	// order. Empty if there is no journal.
+	static pugi::xml_document ReadJournal(std::wstring const& file);
+
+	static std::wstring GetJournalFile(std::wstring const& file);
+
+private:
+	void Worker();
+	void Notify(fz::scoped_lock & l);
+	void Process(fz::scoped_lock & l);
+
+	void Append(std::string const& records);
+
+	std::wstring const journalFile_;
+	error_handler_t const errorHandler_;
+
+	// Created on the GUI thread, only locked and unlocked by the worker
+	CInterProcessMutex ipcMutex_;
+
+	fz::mutex mutex_{false};
+	fz::condition condition_;
+	fz::condition idle_;
+	fz::thread thread_;
+	bool quit_{};
+	bool busy_{};
+
+	// Journal records not yet appended. The first covered_ bytes are
+	// contained in document_.
+	std::string records_;
+	size_t covered_{};
+	std::unique_ptr<CXmlFile> document_;
+};
+
+#endif
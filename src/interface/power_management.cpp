@@ -1,5 +1,6 @@
 #include <filezilla.h>
 #include "power_management.h"
+#include "filezillaapp.h"
 #include "Mainfrm.h"
 #include "Options.h"
 #include "queue.h"
@@ -35,10 +36,6 @@ CPowerManagement::CPowerManagement(CMainFrame* pMainFrame)
 	CContextManager::Get()->RegisterHandler(this, STATECHANGE_REMOTE_IDLE, false);
 
 	m_busy = false;
-
-#ifdef WITH_LIBDBUS
-	m_inhibitor = new CPowerManagementInhibitor();
-#endif
 }
 
 CPowerManagement::~CPowerManagement()
@@ -83,6 +80,11 @@ void CPowerManagement::DoSetBusy()
 #ifdef __WXMSW__
 	SetThreadExecutionState(ES_CONTINUOUS | ES_SYSTEM_REQUIRED);
 #elif defined(WITH_LIBDBUS)
+	if (!m_inhibitor) {
+		auto const start = fz::monotonic_clock::now();
+		m_inhibitor = new CPowerManagementInhibitor();
+		wxGetApp().AddStartupStage("D-Bus power management (on first use)", fz::monotonic_clock::now() - start);
+	}
 	m_inhibitor->RequestBusy();
 #elif defined(__WXMAC__)
 	activity_ = PowerManagmentImpl_SetBusy();
@@ -100,7 +102,9 @@ void CPowerManagement::DoSetIdle()
 #ifdef __WXMSW__
 	SetThreadExecutionState(ES_CONTINUOUS);
 #elif defined(WITH_LIBDBUS)
-	m_inhibitor->RequestIdle();
+	if (m_inhibitor) {
+		m_inhibitor->RequestIdle();
+	}
 #elif defined(__WXMAC__)
 	PowerManagmentImpl_SetIdle(activity_);
 	activity_ = 0;
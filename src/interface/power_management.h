@@ -34,7 +34,8 @@ protected:
 	CMainFrame* m_pMainFrame;
 
 #ifdef WITH_LIBDBUS
-	CPowerManagementInhibitor *m_inhibitor;
+	// Connecting to D-Bus is deferred until first needed
+	CPowerManagementInhibitor *m_inhibitor{};
 #elif defined(__WXMAC__)
 	void const* activity_{};
 #endif
@@ -0,0 +1,179 @@
+#include <filezilla.h>
+#include "profiling_dialog.h"
+
+#include <engine_context.h>
+#include <engine_metrics.h>
+
+#include <libfilezilla/format.hpp>
+
+CProfilingDialog* CProfilingDialog::instance_{};
+
+namespace {
+wchar_t const* phase_name(engine_phase phase)
+{
+	switch (phase) {
+	case engine_phase::connect:
+		return L"Connect";
+	case engine_phase::login:
+		return L"Login";
+	case engine_phase::list:
+		return L"List";
+	case engine_phase::transfer:
+		return L"Transfer";
+	case engine_phase::lock_wait:
+		return L"Lock wait";
+	case engine_phase::other:
+		return L"Other";
+	default:
+		return L"";
+	}
+}
+
+wchar_t const* command_name(Command command)
+{
+	switch (command) {
+	case Command::connect:
+		return L"connect";
+	case Command::disconnect:
+		return L"disconnect";
+	case Command::list:
+		return L"list";
+	case Command::transfer:
+		return L"transfer";
+	case Command::del:
+		return L"delete";
+	case Command::removedir:
+		return L"removedir";
+	case Command::mkdir:
+		return L"mkdir";
+	case Command::rename:
+		return L"rename";
+	case Command::chmod:
+		return L"chmod";
+	case Command::raw:
+		return L"raw";
+	case Command::batch:
+		return L"batch";
+	default:
+		return L"other";
+	}
+}
+
+std::wstring format_time(int64_t us)
+{
+	return fz::sprintf(L"%d.%03d s", us / 1000000, (us / 1000) % 1000);
+}
+}
+
+void CProfilingDialog::Display(wxWindow* parent, CFileZillaEngineContext & engineContext)
+{
+	if (instance_) {
+		instance_->Raise();
+		return;
+	}
+
+	auto * dlg = new CProfilingDialog(engineContext);
+	if (!dlg->Create(parent)) {
+		delete dlg;
+		return;
+	}
+	dlg->Show();
+}
+
+CProfilingDialog::CProfilingDialog(CFileZillaEngineContext & engineContext)
+	: engineContext_(engineContext)
+{
+	instance_ = this;
+}
+
+CProfilingDialog::~CProfilingDialog()
+{
+	instance_ = nullptr;
+}
+
+bool CProfilingDialog::Create(wxWindow* parent)
+{
+	if (!wxDialogEx::Create(parent, -1, _T("Profiling"), wxDefaultPosition, wxDefaultSize, wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER)) {
+		return false;
+	}
+
+	auto& lay = layout();
+	auto * main = lay.createMain(this, 1);
+	main->AddGrowableRow(0);
+
+	text_ = new wxTextCtrl(this, -1, wxString(), wxDefaultPosition, wxDefaultSize, wxTE_MULTILINE | wxTE_READONLY | wxTE_DONTWRAP);
+	text_->SetFont(wxFont(wxFontInfo().Family(wxFONTFAMILY_TELETYPE)));
+	main->Add(text_, lay.grow)->SetMinSize(lay.dlgUnits(300), lay.dlgUnits(200));
+
+	auto * buttons = lay.createButtonSizer(this, main, true);
+	auto close = new wxButton(this, wxID_CANCEL, _("Close"));
+	buttons->AddButton(close);
+	buttons->Realize();
+
+	// Modeless, has to destroy itself
+	Bind(wxEVT_CLOSE_WINDOW, [this](wxCloseEvent&) { Destroy(); });
+	close->Bind(wxEVT_BUTTON, [this](wxCommandEvent&) { Close(); });
+
+	GetSizer()->Fit(this);
+
+	timer_.SetOwner(this);
+	Bind(wxEVT_TIMER, &CProfilingDialog::OnTimer, this);
+	timer_.Start(1000);
+
+	UpdateText();
+
+	return true;
+}
+
+void CProfilingDialog::OnTimer(wxTimerEvent&)
+{
+	UpdateText();
+}
+
+void CProfilingDialog::UpdateText()
+{
+	auto & metrics = engineContext_.GetMetrics();
+
+	std::wstring out;
+
+	auto const totals = metrics.Get();
+	out += fz::sprintf(L"Commands: %d, failed: %d\n", totals.commands, totals.failed_commands);
+	out += fz::sprintf(L"Connections: %d\n", totals.connections);
+	out += fz::sprintf(L"Bytes transferred: %d\n", totals.bytes_transferred);
+	out += fz::sprintf(L"Directory cache: %d hits, %d misses\n", totals.cache_hits, totals.cache_misses);
+	out += fz::sprintf(L"Path cache: %d hits, %d misses, %d evicted\n", totals.path_cache_hits, totals.path_cache_misses, totals.path_cache_evictions);
+	out += fz::sprintf(L"Lock waits: %d, %s\n\n", totals.lock_waits, format_time(totals.lock_wait_ms * 1000));
+
+	out += fz::sprintf(L"%-8s", L"Engine");
+	for (size_t i = 0; i < static_cast<size_t>(engine_phase::count); ++i) {
+		out += fz::sprintf(L"%12s", phase_name(static_cast<engine_phase>(i)));
+	}
+	out += fz::sprintf(L"%12s%12s%8s\n", L"Loop lag", L"Max lag", L"Queue");
+
+	for (auto const& engine : metrics.GetEngines()) {
+		out += fz::sprintf(L"%-8d", engine->engine_id);
+		for (auto const& phase : engine->phase_us) {
+			out += fz::sprintf(L"%12s", format_time(phase.load(std::memory_order_relaxed)));
+		}
+		out += fz::sprintf(L"%12s%12s%8d\n",
+			format_time(engine->loop_lag_us.load(std::memory_order_relaxed)),
+			format_time(engine->max_loop_lag_us.load(std::memory_order_relaxed)),
+			engine->pending_notifications.load(std::memory_order_relaxed));
+	}
+
+	out += L"\nRecent slow operations:\n";
+	auto const slow = metrics.GetSlowOperations();
+	if (slow.empty()) {
+		out += L"None\n";
+	}
+	for (auto it = slow.rbegin(); it != slow.rend(); ++it) {
+		out += fz::sprintf(L"%s  engine %d  %-10s %10s  reply %d\n",
+			it->time.format(L"%H:%M:%S", fz::datetime::local), it->engine_id, command_name(it->command),
+			format_time(it->duration.get_microseconds()), it->reply);
+	}
+
+	// Keep the scroll position if the user is looking at something
+	long const pos = text_->GetInsertionPoint();
+	text_->ChangeValue(out);
+	text_->SetInsertionPoint(std::min(pos, text_->GetLastPosition()));
+}
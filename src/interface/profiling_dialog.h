@@ -0,0 +1,35 @@
+#ifndef FILEZILLA_INTERFACE_PROFILING_DIALOG_HEADER
+#define FILEZILLA_INTERFACE_PROFILING_DIALOG_HEADER
+
+#include "dialogex.h"
+
+#include <wx/timer.h>
+
+class CFileZillaEngineContext;
+
+// Modeless window in the debug menu showing where the engines spend their
+// time, refreshed every second.
+class CProfilingDialog final : public wxDialogEx
+{
+public:
+	// Brings the existing window to front if already shown
+	static void Display(wxWindow* parent, CFileZillaEngineContext & engineContext);
+
+private:
+	CProfilingDialog(CFileZillaEngineContext & engineContext);
+	virtual ~CProfilingDialog();
+
+	bool Create(wxWindow* parent);
+
+	void UpdateText();
+	void OnTimer(wxTimerEvent& event);
+
+	CFileZillaEngineContext & engineContext_;
+
+	wxTextCtrl* text_{};
+	wxTimer timer_;
+
+	static CProfilingDialog* instance_;
+};
+
+#endif
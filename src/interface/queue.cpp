@@ -8,6 +8,10 @@
 #include "themeprovider.h"
 
 #include <wx/filedlg.h>
+#include <wx/filename.h>
+
+#include <algorithm>
+#include <map>
 
 CQueueItem::CQueueItem(CQueueItem* parent)
 	: m_parent(parent)
@@ -39,12 +43,14 @@ void CQueueItem::AddChild(CQueueItem* item)
 	}
 	m_children.push_back(item);
 
+	CQueueItem* child = this;
 	CQueueItem* parent = GetParent();
 	while (parent) {
 		if (parent->GetType() == QueueItemType::Server) {
 			static_cast<CServerItem*>(parent)->m_visibleOffspring += 1 + item->GetChildrenCount(true);
-			static_cast<CServerItem*>(parent)->m_maxCachedIndex = -1;
+			static_cast<CServerItem*>(parent)->UpdateRows(*child);
 		}
+		child = parent;
 		parent = parent->GetParent();
 	}
 }
@@ -170,12 +176,14 @@ bool CQueueItem::RemoveChild(CQueueItem* pItem, bool destroy, bool forward)
 	}
 
 	// Propagate new children count to parent
+	CQueueItem* child = this;
 	CQueueItem* parent = GetParent();
 	while (parent) {
 		if (parent->GetType() == QueueItemType::Server) {
-			static_cast<CServerItem*>(parent)->m_maxCachedIndex = -1;
 			static_cast<CServerItem*>(parent)->m_visibleOffspring -= oldVisibleOffspring - visibleOffspring;
+			static_cast<CServerItem*>(parent)->UpdateRows(*child);
 		}
+		child = parent;
 		parent = parent->GetParent();
 	}
 
@@ -221,6 +229,10 @@ int CQueueItem::GetItemIndex() const
 		return 0;
 	}
 
+	if (pParent->GetType() == QueueItemType::Server) {
+		return 1 + static_cast<CServerItem const*>(pParent)->GetRowOffset(*this);
+	}
+
 	int index = 1;
 	for (std::vector<CQueueItem*>::const_iterator iter = pParent->m_children.begin() + pParent->m_removed_at_front; iter != pParent->m_children.end(); ++iter) {
 		if (*iter == this) {
@@ -253,6 +265,61 @@ CFileItem::CFileItem(CServerItem* parent, bool queued, bool download,
 
 CFileItem::~CFileItem()
 {
+	if (m_segment) {
+		auto & items = m_segment->group->items;
+		items.erase(std::remove(items.begin(), items.end(), this), items.end());
+	}
+}
+
+void CFileItem::SetSegment(std::shared_ptr<CSegmentGroup> const& group, int64_t offset)
+{
+	m_segment = std::make_unique<segment>();
+	m_segment->group = group;
+	m_segment->offset = offset;
+	group->items.push_back(this);
+}
+
+bool CFileItem::SavedAsWholeFile() const
+{
+	return !m_segment || m_segment->group->items.front() == this;
+}
+
+int64_t CFileItem::GetSavedSize() const
+{
+	return m_segment ? m_segment->group->fullSize : m_size;
+}
+
+CFileExistsNotification::OverwriteAction CFileItem::GetSavedFileExistsAction() const
+{
+	// The local file is partially written. Unless the resume journal of the
+	// file lists what is already there, it needs to be downloaded again.
+	return m_segment ? CFileExistsNotification::overwrite : m_defaultFileExistsAction;
+}
+
+void CFileItem::LeaveSegmentGroup()
+{
+	if (!m_segment) {
+		return;
+	}
+
+	auto & items = m_segment->group->items;
+	items.erase(std::remove(items.begin(), items.end(), this), items.end());
+	m_size = m_segment->group->fullSize;
+	m_segment.reset();
+}
+
+CFileItem* CFileItem::GetNextSegment() const
+{
+	if (!m_segment) {
+		return nullptr;
+	}
+
+	auto const& items = m_segment->group->items;
+	auto it = std::find(items.begin(), items.end(), this);
+	if (it == items.end() || ++it == items.end()) {
+		return nullptr;
+	}
+	return *it;
 }
 
 void CFileItem::SetPriority(QueuePriority priority)
@@ -292,9 +359,19 @@ void CFileItem::SetActive(const bool active)
 	}
 }
 
+void CFileItem::SetActiveInBatch(bool active)
+{
+	if (active) {
+		flags |= flag_active;
+	}
+	else {
+		flags &= ~flag_active;
+	}
+}
+
 void CFileItem::SaveItem(pugi::xml_node& element) const
 {
-	if (m_edit != CEditHandler::none || !element) {
+	if (m_edit != CEditHandler::none || !element || !SavedAsWholeFile()) {
 		return;
 	}
 
@@ -304,8 +381,8 @@ void CFileItem::SaveItem(pugi::xml_node& element) const
 	AddTextElement(file, "RemoteFile", GetRemoteFile());
 	AddTextElement(file, "RemotePath", m_remotePath.GetSafePath());
 	AddTextElementUtf8(file, "Download", Download() ? "1" : "0");
-	if (m_size != -1) {
-		AddTextElement(file, "Size", m_size);
+	if (GetSavedSize() != -1) {
+		AddTextElement(file, "Size", GetSavedSize());
 	}
 	if (m_errorCount) {
 		AddTextElement(file, "ErrorCount", m_errorCount);
@@ -314,8 +391,8 @@ void CFileItem::SaveItem(pugi::xml_node& element) const
 		AddTextElement(file, "Priority", static_cast<int>(m_priority));
 	}
 	AddTextElementUtf8(file, "DataType", Ascii() ? "0" : "1");
-	if (m_defaultFileExistsAction != CFileExistsNotification::unknown) {
-		AddTextElement(file, "OverwriteAction", m_defaultFileExistsAction);
+	if (GetSavedFileExistsAction() != CFileExistsNotification::unknown) {
+		AddTextElement(file, "OverwriteAction", GetSavedFileExistsAction());
 	}
 }
 
@@ -360,12 +437,37 @@ wxString const& CFileItem::GetStatusMessage() const
 		_("Could not write to local file"),
 		_("Could not start transfer"),
 		_("Transferring"),
-		_("Creating directory")
+		_("Creating directory"),
+		_("Verifying"),
+		_("Checksum mismatch")
 	};
 
 	return statusTexts[std::underlying_type_t<Status>(m_status)];
 }
 
+CFxpItem::CFxpItem(CServerItem* parent, bool queued, Site const& sourceSite, CServerPath const& sourcePath,
+	std::wstring const& sourceFile, std::wstring const& targetFile, CServerPath const& targetPath, int64_t size)
+	: CFileItem(parent, queued, false, sourceFile, targetFile, CLocalPath(), targetPath, size)
+	, sourceSite_(sourceSite)
+	, sourcePath_(sourcePath)
+{
+}
+
+CFxpItem::~CFxpItem()
+{
+	ClearRelay();
+}
+
+void CFxpItem::ClearRelay()
+{
+	if (!m_relayFile.empty() && wxFileName::FileExists(m_relayFile)) {
+		wxRemoveFile(m_relayFile);
+	}
+	m_relayFile.clear();
+	m_relay = false;
+	m_relayDownloaded = false;
+}
+
 CFolderItem::CFolderItem(CServerItem* parent, bool queued, CLocalPath const& localPath)
 	: CFileItem(parent, queued, true, std::wstring(), std::wstring(), localPath, CServerPath(), -1)
 {
@@ -417,9 +519,27 @@ wxString CServerItem::GetName() const
 
 void CServerItem::AddChild(CQueueItem* pItem)
 {
+	if (m_removed_at_front) {
+		// Gets compacted
+		InvalidateRows();
+	}
 	CQueueItem::AddChild(pItem);
-	m_maxCachedIndex = -1;
 	m_visibleOffspring += 1 + pItem->GetChildrenCount(true);
+
+	size_t const pos = m_children.size() - 1;
+	pItem->m_indexInParent = static_cast<unsigned int>(pos);
+	if (m_rowsValid) {
+		// Appending to a Fenwick tree: the new node covers the range
+		// (pos + 1 - lowbit(pos + 1), pos + 1]
+		size_t const i = pos + 1;
+		int const rows = 1 + static_cast<int>(pItem->GetChildrenCount(true));
+		int node = rows;
+		for (size_t j = i - 1; j > i - (i & (0 - i)); j -= j & (0 - j)) {
+			node += m_rowTree[j];
+		}
+		m_rows.push_back(rows);
+		m_rowTree.push_back(node);
+	}
 	if (pItem->GetType() == QueueItemType::File ||
 		pItem->GetType() == QueueItemType::Folder)
 		AddFileItemToList((CFileItem*)pItem);
@@ -535,8 +655,7 @@ void CServerItem::Sort(int col, bool reverse)
 
 	std::stable_sort(m_children.begin() + m_removed_at_front, m_children.end(), fn);
 
-	m_lookupCache.clear();
-	m_maxCachedIndex = -1;
+	InvalidateRows();
 
 	// Rebuild m_fileList
 	for (size_t i = 0; i < static_cast<size_t>(QueuePriority::count); ++i) {
@@ -562,95 +681,194 @@ CQueueItem* CServerItem::GetChild(unsigned int item, bool recursive)
 		return *iter;
 	}
 
-	if ((int)item <= m_maxCachedIndex) {
-		// Index is cached
-		iter = m_children.begin() + m_removed_at_front;
-		iter += m_lookupCache[item].child;
-		item -= m_lookupCache[item].index;
-		if (!item) {
-			return *iter;
-		}
-		else {
-			return (*iter)->GetChild(item - 1);
+	if (static_cast<int>(item) >= m_visibleOffspring) {
+		return 0;
+	}
+
+	BuildRows();
+
+	// Find the last position with fewer rows than item in front of it
+	size_t const n = m_children.size();
+	size_t step = 1;
+	while (step * 2 <= n) {
+		step *= 2;
+	}
+	size_t pos = 0;
+	int remaining = static_cast<int>(item);
+	for (; step; step /= 2) {
+		if (pos + step <= n && m_rowTree[pos + step] <= remaining) {
+			pos += step;
+			remaining -= m_rowTree[pos];
 		}
 	}
+	if (pos >= n) {
+		return 0;
+	}
 
-	int index;
-	int child;
-	iter = m_children.begin() + m_removed_at_front;
-	if (m_maxCachedIndex == -1) {
-		child = 0;
-		index = 0;
+	CQueueItem* child = m_children[pos];
+	if (!remaining) {
+		return child;
 	}
-	else {
-		// Start with loop with the last cached item index
-		iter += m_lookupCache[m_maxCachedIndex].child + 1;
-		item -= m_maxCachedIndex + 1;
-		index = m_maxCachedIndex + 1;
-		child = m_lookupCache[m_maxCachedIndex].child + 1;
+	return child->GetChild(remaining - 1);
+}
+
+void CServerItem::BuildRows() const
+{
+	if (m_rowsValid) {
+		return;
 	}
 
-	for (; iter != m_children.end(); ++iter, ++child) {
-		if (!item) {
-			return *iter;
+	size_t const n = m_children.size();
+	m_rows.assign(n, 0);
+	m_rowTree.assign(n + 1, 0);
+	for (size_t i = m_removed_at_front; i < n; ++i) {
+		m_children[i]->m_indexInParent = static_cast<unsigned int>(i);
+		m_rows[i] = 1 + static_cast<int>(m_children[i]->GetChildrenCount(true));
+	}
+	for (size_t i = 1; i <= n; ++i) {
+		m_rowTree[i] += m_rows[i - 1];
+		size_t const parent = i + (i & (0 - i));
+		if (parent <= n) {
+			m_rowTree[parent] += m_rowTree[i];
 		}
+	}
 
-		unsigned int count = (*iter)->GetChildrenCount(true);
-		if (item > count) {
-			if (m_maxCachedIndex == -1 && m_lookupCache.size() < (unsigned int)m_visibleOffspring)
-				m_lookupCache.resize(m_visibleOffspring);
-			for (unsigned int k = index; k <= index + count; ++k) {
-				m_lookupCache[k].child = child;
-				m_lookupCache[k].index = index;
-			}
-			m_maxCachedIndex = index + count;
-			item -= count + 1;
-			index += count + 1;
-			continue;
-		}
+	m_rowsValid = true;
+}
 
-		return (*iter)->GetChild(item - 1);
+void CServerItem::SetRows(size_t pos, int rows)
+{
+	int const delta = rows - m_rows[pos];
+	if (!delta) {
+		return;
 	}
-	return 0;
+	m_rows[pos] = rows;
+	for (size_t i = pos + 1; i < m_rowTree.size(); i += i & (0 - i)) {
+		m_rowTree[i] += delta;
+	}
+}
+
+void CServerItem::UpdateRows(CQueueItem const& child)
+{
+	if (!m_rowsValid) {
+		return;
+	}
+
+	size_t const pos = child.m_indexInParent;
+	if (pos >= m_children.size() || m_children[pos] != &child) {
+		InvalidateRows();
+		return;
+	}
+
+	SetRows(pos, 1 + static_cast<int>(child.GetChildrenCount(true)));
+}
+
+int CServerItem::GetRowOffset(CQueueItem const& child) const
+{
+	BuildRows();
+
+	int rows{};
+	for (size_t i = child.m_indexInParent; i; i -= i & (0 - i)) {
+		rows += m_rowTree[i];
+	}
+	return rows;
 }
 
 namespace {
-CFileItem* DoGetIdleChild(std::deque<CFileItem*> const* fileList, TransferDirection direction)
+// Bounds the work per pick on huge queues, sizes are only compared among
+// this many idle files at the front of each list.
+size_t const scheduling_window = 4096;
+
+bool Matches(CFileItem const& item, TransferDirection direction)
+{
+	if (item.IsActive()) {
+		return false;
+	}
+
+	if (direction == TransferDirection::both) {
+		return true;
+	}
+
+	if (direction == TransferDirection::download) {
+		return item.Download();
+	}
+	return !item.Download();
+}
+
+CFileItem* DoGetIdleChild(std::deque<CFileItem*> const* fileList, TransferDirection direction, bool largest, bool smallest)
 {
 	int i = 0;
 	for (i = static_cast<int>(QueuePriority::count) - 1; i >= 0; --i) {
+		CFileItem* best{};
+		size_t seen{};
 		for (auto const& item : fileList[i]) {
-			if (item->IsActive()) {
+			if (!Matches(*item, direction)) {
 				continue;
 			}
 
-			if (direction == TransferDirection::both) {
+			if (item->GetType() == QueueItemType::Folder || (!largest && !smallest)) {
+				// Creating a directory takes no time, get it out of the way
 				return item;
 			}
 
-			if (direction == TransferDirection::download) {
-				if (item->Download()) {
-					return item;
-				}
+			if (!best || (largest && item->GetSize() > best->GetSize()) || (smallest && item->GetSize() < best->GetSize())) {
+				best = item;
 			}
-			else if (!item->Download()) {
-				return item;
+
+			if (++seen >= scheduling_window) {
+				break;
 			}
 		}
+		if (best) {
+			return best;
+		}
 	}
 	return 0;
 }
 }
 
-CFileItem* CServerItem::GetIdleChild(bool immediateOnly, TransferDirection direction)
+CFileItem* CServerItem::GetIdleChild(bool immediateOnly, TransferDirection direction, QueueScheduling scheduling)
 {
-	CFileItem* item = DoGetIdleChild(m_fileList[1], direction);
+	bool largest{};
+	bool smallest{};
+	if (scheduling == QueueScheduling::largest_first) {
+		largest = true;
+	}
+	else if (scheduling == QueueScheduling::mixed) {
+		// Every other transfer started gets a small file
+		if (m_activeCount % 2) {
+			smallest = true;
+		}
+		else {
+			largest = true;
+		}
+	}
+
+	CFileItem* item = DoGetIdleChild(m_fileList[1], direction, largest, smallest);
 	if( !item && !immediateOnly ) {
-		item = DoGetIdleChild(m_fileList[0], direction);
+		item = DoGetIdleChild(m_fileList[0], direction, largest, smallest);
 	}
 	return item;
 }
 
+std::vector<CFileItem*> CServerItem::GetIdleFiles(bool immediateOnly, size_t max) const
+{
+	std::vector<CFileItem*> ret;
+	for (int queued = 1; queued >= (immediateOnly ? 1 : 0); --queued) {
+		for (int i = static_cast<int>(QueuePriority::count) - 1; i >= 0; --i) {
+			for (auto * item : m_fileList[queued][i]) {
+				if (ret.size() >= max) {
+					return ret;
+				}
+				if (!item->IsActive() && item->GetType() == QueueItemType::File) {
+					ret.push_back(item);
+				}
+			}
+		}
+	}
+	return ret;
+}
+
 bool CServerItem::RemoveChild(CQueueItem* pItem, bool destroy, bool forward)
 {
 	if (!pItem) {
@@ -662,9 +880,31 @@ bool CServerItem::RemoveChild(CQueueItem* pItem, bool destroy, bool forward)
 		RemoveFileItemFromList(pFileItem, forward);
 	}
 
+	// The child of this server the item is or is contained in
+	CQueueItem* direct = pItem;
+	while (direct && direct->GetParent() != this) {
+		direct = direct->GetParent();
+	}
+	size_t const pos = direct ? direct->m_indexInParent : 0;
+	size_t const oldSize = m_children.size();
+	size_t const oldFront = m_removed_at_front;
+
 	bool removed = CQueueItem::RemoveChild(pItem, destroy, forward);
 	if (removed) {
-		m_maxCachedIndex = -1;
+		if (!direct || m_children.size() != oldSize || !m_rowsValid) {
+			InvalidateRows();
+		}
+		else if (static_cast<size_t>(m_removed_at_front) != oldFront) {
+			// The children in front of the removed one each moved back by one
+			for (size_t i = pos; i > oldFront; --i) {
+				SetRows(i, m_rows[i - 1]);
+				m_children[i]->m_indexInParent = static_cast<unsigned int>(i);
+			}
+			SetRows(oldFront, 0);
+		}
+		else {
+			UpdateRows(*direct);
+		}
 	}
 
 	wxASSERT(m_visibleOffspring >= static_cast<int>(m_children.size()) - m_removed_at_front);
@@ -673,6 +913,34 @@ bool CServerItem::RemoveChild(CQueueItem* pItem, bool destroy, bool forward)
 	return removed;
 }
 
+void CServerItem::RemoveChildren(std::unordered_set<CQueueItem*> const& items, bool destroy)
+{
+	for (auto & lists : m_fileList) {
+		for (auto & fileList : lists) {
+			fileList.erase(std::remove_if(fileList.begin(), fileList.end(), [&items](CFileItem* pItem) { return items.count(pItem) != 0; }), fileList.end());
+		}
+	}
+
+	std::vector<CQueueItem*> children;
+	children.reserve(m_children.size() - m_removed_at_front);
+	for (auto iter = m_children.begin() + m_removed_at_front; iter != m_children.end(); ++iter) {
+		CQueueItem* pItem = *iter;
+		if (!items.count(pItem)) {
+			children.push_back(pItem);
+			continue;
+		}
+
+		wxASSERT(pItem->GetType() != QueueItemType::File || !static_cast<CFileItem*>(pItem)->IsActive());
+		m_visibleOffspring -= 1 + static_cast<int>(pItem->GetChildrenCount(true));
+		if (destroy) {
+			delete pItem;
+		}
+	}
+	m_children = std::move(children);
+	m_removed_at_front = 0;
+	InvalidateRows();
+}
+
 void CServerItem::QueueImmediateFiles()
 {
 	for (int i = 0; i < static_cast<int>(QueuePriority::count); ++i) {
@@ -750,6 +1018,18 @@ int64_t CServerItem::GetTotalSize(int& filesWithUnknownSize, int& queuedFiles) c
 	return totalSize;
 }
 
+size_t CServerItem::GetIdleCount(bool immediateOnly) const
+{
+	size_t count = 0;
+	for (int i = 0; i < static_cast<int>(QueuePriority::count); ++i) {
+		count += m_fileList[1][i].size();
+		if (!immediateOnly) {
+			count += m_fileList[0][i].size();
+		}
+	}
+	return count;
+}
+
 bool CServerItem::TryRemoveAll()
 {
 	wxASSERT(!GetParent());
@@ -776,7 +1056,7 @@ bool CServerItem::TryRemoveAll()
 	std::swap(m_children, keepChildren);
 	m_removed_at_front = 0;
 
-	m_maxCachedIndex = -1;
+	InvalidateRows();
 
 	wxASSERT(oldVisibleOffspring >= m_visibleOffspring);
 	wxASSERT(m_visibleOffspring >= static_cast<int>(m_children.size()));
@@ -791,7 +1071,7 @@ void CServerItem::DetachChildren()
 
 	m_children.clear();
 	m_visibleOffspring = 0;
-	m_maxCachedIndex = -1;
+	InvalidateRows();
 	m_removed_at_front = 0;
 
 	for (int i = 0; i < 2; ++i) {
@@ -839,6 +1119,46 @@ void CServerItem::SetChildPriority(CFileItem* pItem, QueuePriority oldPriority,
 	wxFAIL;
 }
 
+void CServerItem::SetChildrenPriority(std::unordered_set<CQueueItem*> const& items, QueuePriority priority)
+{
+	for (auto & lists : m_fileList) {
+		std::deque<CFileItem*> moved;
+		for (int i = 0; i < static_cast<int>(QueuePriority::count); ++i) {
+			if (i == static_cast<int>(priority)) {
+				continue;
+			}
+			auto & fileList = lists[i];
+			auto const end = std::stable_partition(fileList.begin(), fileList.end(), [&items](CFileItem* pItem) { return !items.count(pItem); });
+			moved.insert(moved.end(), end, fileList.end());
+			fileList.erase(end, fileList.end());
+		}
+		auto & target = lists[static_cast<int>(priority)];
+		target.insert(target.end(), moved.begin(), moved.end());
+	}
+
+	for (auto * pItem : items) {
+		if (pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder) {
+			static_cast<CFileItem*>(pItem)->SetPriorityRaw(priority);
+		}
+	}
+}
+
+void CServerItem::MoveToFrontOfList(CFileItem* pItem)
+{
+	std::deque<CFileItem*>& fileList = m_fileList[pItem->queued() ? 0 : 1][static_cast<int>(pItem->GetPriority())];
+
+	// Usually called on just added items, search from the back
+	for (auto iter = fileList.rbegin(); iter != fileList.rend(); ++iter) {
+		if (*iter == pItem) {
+			fileList.erase(iter.base() - 1);
+			fileList.push_front(pItem);
+			return;
+		}
+	}
+
+	wxFAIL;
+}
+
 // --------------
 // CQueueViewBase
 // --------------
@@ -954,6 +1274,10 @@ wxString CQueueViewBase::OnGetItemText(CQueueItem* pItem, ColumnId column) const
 			switch (column)
 			{
 			case colLocalName:
+				if (pFileItem->IsFxp()) {
+					CFxpItem const* pFxpItem = static_cast<CFxpItem const*>(pFileItem);
+					return _T("  ") + pFxpItem->GetSourceSite().Format(ServerFormat::with_user_and_optional_port) + _T(" ") + pFxpItem->GetSourcePath().FormatFilename(pFxpItem->GetSourceFile());
+				}
 				return _T("  ") + pFileItem->GetLocalPath().GetPath() + pFileItem->GetLocalFile();
 			case colDirection:
 				if (pFileItem->Download()) {
@@ -1460,6 +1784,57 @@ bool CQueueViewBase::RemoveItem(CQueueItem* pItem, bool destroy, bool updateItem
 	return didRemoveParent;
 }
 
+void CQueueViewBase::RemoveItems(std::vector<CQueueItem*> const& items, bool destroy)
+{
+	if (items.empty()) {
+		return;
+	}
+
+#ifndef __WXMSW__
+	// GetNextItem is O(n) if nothing is selected, GetSelectedItemCount() is O(1)
+	if (GetSelectedItemCount())
+#endif
+	{
+		int item;
+		while ((item = GetNextItem(-1, wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED)) != -1) {
+			SetItemState(item, 0, wxLIST_STATE_SELECTED);
+		}
+	}
+
+	std::map<CServerItem*, std::unordered_set<CQueueItem*>> byServer;
+	for (auto * pItem : items) {
+		wxASSERT(pItem->GetType() == QueueItemType::File || pItem->GetType() == QueueItemType::Folder);
+		wxASSERT(pItem->GetParent() && pItem->GetParent()->GetType() == QueueItemType::Server);
+		if (byServer[static_cast<CServerItem*>(pItem->GetParent())].insert(pItem).second) {
+			--m_fileCount;
+		}
+	}
+	m_fileCountChanged = true;
+
+	std::unordered_set<CServerItem*> emptied;
+	for (auto & server : byServer) {
+		CServerItem* pServerItem = server.first;
+		int const count = pServerItem->GetChildrenCount(true);
+		pServerItem->RemoveChildren(server.second, destroy);
+		m_itemCount -= count - pServerItem->GetChildrenCount(true);
+		if (!pServerItem->GetChildrenCount(false)) {
+			emptied.insert(pServerItem);
+			--m_itemCount;
+		}
+	}
+
+	if (!emptied.empty()) {
+		m_serverList.erase(std::remove_if(m_serverList.begin(), m_serverList.end(), [&emptied](CServerItem* pServerItem) { return emptied.count(pServerItem) != 0; }), m_serverList.end());
+		for (auto * pServerItem : emptied) {
+			delete pServerItem;
+		}
+	}
+
+	DisplayNumberQueuedFiles();
+	SaveSetItemCount(m_itemCount);
+	RefreshListOnly();
+}
+
 void CQueueViewBase::RefreshItem(const CQueueItem* pItem)
 {
 	wxASSERT(pItem);
@@ -1546,16 +1921,39 @@ void CQueueViewBase::OnKeyDown(wxKeyEvent& event)
 	}
 }
 
-void CQueueViewBase::WriteToFile(pugi::xml_node element) const
+void CQueueViewBase::WriteToFile(pugi::xml_writer& writer, unsigned int depth) const
 {
-	auto queue = element.child("Queue");
-	if (!queue) {
-		queue = element.append_child("Queue");
-	}
+	size_t const batch_size = 1000;
 
-	for (std::vector<CServerItem*>::const_iterator iter = m_serverList.begin(); iter != m_serverList.end(); ++iter) {
-		(*iter)->SaveItem(queue);
+	pugi::xml_document document;
+	WriteXmlStartTag(writer, document.append_child("Queue"), depth);
+
+	for (auto const* pServerItem : m_serverList) {
+		document.reset();
+		auto server = document.append_child("Server");
+		SetServer(server, pServerItem->GetSite());
+		WriteXmlStartTag(writer, server, depth + 1);
+		for (auto child = server.first_child(); child; child = child.next_sibling()) {
+			child.print(writer, PUGIXML_TEXT("\t"), pugi::format_default, pugi::encoding_utf8, depth + 2);
+		}
+
+		auto const& children = pServerItem->GetChildren();
+		for (size_t i = pServerItem->GetRemovedAtFront(); i < children.size(); i += batch_size) {
+			document.reset();
+			auto items = document.append_child("Server");
+			size_t const end = std::min(children.size(), i + batch_size);
+			for (size_t j = i; j < end; ++j) {
+				children[j]->SaveItem(items);
+			}
+			for (auto child = items.first_child(); child; child = child.next_sibling()) {
+				child.print(writer, PUGIXML_TEXT("\t"), pugi::format_default, pugi::encoding_utf8, depth + 2);
+			}
+		}
+
+		WriteXmlEndTag(writer, "Server", depth + 1);
 	}
+
+	WriteXmlEndTag(writer, "Queue", depth);
 }
 
 void CQueueViewBase::OnExport(wxCommandEvent&)
@@ -1569,12 +1967,10 @@ void CQueueViewBase::OnExport(wxCommandEvent&)
 	}
 
 	CXmlFile xml(dlg.GetPath().ToStdWstring());
-
-	auto exportRoot = xml.CreateEmpty();
-
-	WriteToFile(exportRoot);
-
-	xml.Save(true);
+	xml.CreateEmpty();
+	xml.SaveStreaming(true, [this](pugi::xml_writer& writer, unsigned int depth) {
+		WriteToFile(writer, depth);
+	});
 }
 
 // ------
@@ -3,9 +3,12 @@
 
 #include "aui_notebook_ex.h"
 #include "listctrlex.h"
+#include "concurrency_controller.h"
 #include "edithandler.h"
 #include <libfilezilla/optional.hpp>
 
+#include <unordered_set>
+
 enum class QueuePriority : unsigned char {
 	lowest,
 	low,
@@ -30,6 +33,20 @@ enum class TransferDirection
 	upload
 };
 
+// Order in which idle files of the same priority get transferred
+enum class QueueScheduling
+{
+	fifo,
+	largest_first,
+
+	// Alternates between the largest and the smallest files, so that big
+	// files start early while the other connections work through the small
+	// ones.
+	mixed,
+
+	count
+};
+
 namespace pugi { class xml_node; }
 class CQueueItem
 {
@@ -59,6 +76,9 @@ public:
 
 	int GetRemovedAtFront() const { return m_removed_at_front; }
 
+	// Row of the item in the queue database, 0 if not journaled
+	int64_t m_storageId{};
+
 protected:
 	CQueueItem(CQueueItem* parent = 0);
 
@@ -75,6 +95,10 @@ private:
 	// Increased instead of calling slow m_children.erase(0),
 	// resetted on insert.
 	int m_removed_at_front{};
+
+	// Position in the parent's m_children, maintained for children of
+	// server items only
+	unsigned int m_indexInParent{};
 };
 
 class CFileItem;
@@ -93,13 +117,23 @@ public:
 	virtual unsigned int GetChildrenCount(bool recursive) const override;
 	virtual CQueueItem* GetChild(unsigned int item, bool recursive = true) override;
 
-	CFileItem* GetIdleChild(bool immadiateOnly, TransferDirection direction);
+	CFileItem* GetIdleChild(bool immadiateOnly, TransferDirection direction, QueueScheduling scheduling = QueueScheduling::fifo);
+
+	// Up to max idle files, those with the highest priority first. Folders
+	// are left out.
+	std::vector<CFileItem*> GetIdleFiles(bool immadiateOnly, size_t max) const;
 
 	virtual bool RemoveChild(CQueueItem* pItem, bool destroy = true, bool forward = true) override; // Removes a child item with is somewhere in the tree of children
 	virtual bool TryRemoveAll() override;
 
+	// Removes the given direct children in a single pass. They must not be active.
+	void RemoveChildren(std::unordered_set<CQueueItem*> const& items, bool destroy);
+
 	int64_t GetTotalSize(int& filesWithUnknownSize, int& queuedFiles) const;
 
+	// Number of files and directories waiting to be transferred
+	size_t GetIdleCount(bool immediateOnly) const;
+
 	void QueueImmediateFiles();
 	void QueueImmediateFile(CFileItem* pItem);
 
@@ -113,8 +147,25 @@ public:
 
 	void SetChildPriority(CFileItem* pItem, QueuePriority oldPriority, QueuePriority newPriority);
 
+	// Like SetPriority on each of the given direct children, in a single pass
+	void SetChildrenPriority(std::unordered_set<CQueueItem*> const& items, QueuePriority priority);
+
+	// Lets the scheduler pick the given idle item before the others of the same priority
+	void MoveToFrontOfList(CFileItem* pItem);
+
 	int m_activeCount;
 
+	// Limits the number of transfers if adaptive concurrency is enabled
+	CConcurrencyController m_concurrency;
+
+	// Set if connecting ahead of demand failed, connections are then
+	// only made for actual transfers.
+	bool m_noWarmup{};
+
+	// Hash algorithm the server used for the last verified transfer, the
+	// local file gets hashed ahead with it while waiting for the server.
+	std::wstring m_hashAlgorithm;
+
 	const std::vector<CQueueItem*>& GetChildren() const { return m_children; }
 
 	void Sort(int col, bool reverse);
@@ -133,18 +184,43 @@ protected:
 	friend class CQueueItem;
 
 	int m_visibleOffspring{}; // Visible offspring over all sublevels
-	int m_maxCachedIndex{-1};
 
-	struct t_cacheItem
-	{
-		int index;
-		int child;
-	};
-	std::vector<t_cacheItem> m_lookupCache;
+	// Maps between rows and children in logarithmic time. A Fenwick tree
+	// over the number of rows each child occupies, including its own,
+	// indexed by position in m_children. Slots removed at the front have
+	// no rows.
+	//
+	// Changes in the number of rows of a child, appending children and
+	// removing them near the front update the tree, anything else leaves
+	// it to be rebuilt on the next lookup.
+	void InvalidateRows() { m_rowsValid = false; }
+	void BuildRows() const;
+	void UpdateRows(CQueueItem const& child);
+	void SetRows(size_t pos, int rows);
+
+	// Number of rows of the children in front of the given one
+	int GetRowOffset(CQueueItem const& child) const;
+
+	mutable std::vector<int> m_rowTree;
+	mutable std::vector<int> m_rows;
+	mutable bool m_rowsValid{};
 };
 
 struct t_EngineData;
 
+// Shared by the items a segmented download has been split into.
+struct CSegmentGroup final
+{
+	int64_t fullSize{};
+
+	// Remaining segments in file order
+	std::vector<CFileItem*> items;
+
+	// Set once a segment failed for good. The failed list then holds the
+	// whole file, the other segments are dropped.
+	bool failed{};
+};
+
 class CFileItem : public CQueueItem
 {
 public:
@@ -192,9 +268,28 @@ public:
 
 	virtual QueueItemType GetType() const override { return QueueItemType::File; }
 
+	// See CFxpItem
+	virtual bool IsFxp() const { return false; }
+
 	bool IsActive() const { return (flags & flag_active) != 0; }
 	virtual void SetActive(bool active);
 
+	// Items uploaded in a batch along with another item are active, but
+	// do not have a status line of their own.
+	void SetActiveInBatch(bool active);
+
+	// Set after the item failed in a batch, it is retried on its own
+	inline bool no_batch() const { return (flags & flag_no_batch) != 0; }
+	inline void set_no_batch(bool no_batch)
+	{
+		if (no_batch) {
+			flags |= flag_no_batch;
+		}
+		else {
+			flags &= ~flag_no_batch;
+		}
+	}
+
 	virtual void SaveItem(pugi::xml_node& element) const override;
 
 	// Removes inactive children, queues active children for removal.
@@ -217,7 +312,9 @@ public:
 		local_file_unwriteable,
 		could_not_start,
 		transferring,
-		creating_dir
+		creating_dir,
+		verifying,
+		verification_failed
 	};
 
 	wxString const& GetStatusMessage() const;
@@ -237,7 +334,9 @@ protected:
 		flag_made_progress = 0x04,
 		flag_queued = 0x08,
 		flag_remove = 0x10,
-		flag_ascii = 0x20
+		flag_ascii = 0x20,
+		flag_no_batch = 0x40,
+		flag_conflicts_checked = 0x80
 	};
 	unsigned char flags{};
 	Status m_status{};
@@ -259,6 +358,31 @@ public:
 
 	bool Ascii() const { return (flags & flag_ascii) != 0; }
 
+	// Set once the target has been checked for existing before the file
+	// got started, see CQueueView::CheckFileConflicts
+	inline bool conflicts_checked() const { return (flags & flag_conflicts_checked) != 0; }
+	inline void set_conflicts_checked() { flags |= flag_conflicts_checked; }
+
+	// Segments of a segmented download only transfer GetSize() bytes
+	// starting at their offset.
+	bool IsSegment() const { return static_cast<bool>(m_segment); }
+	int64_t GetSegmentOffset() const { return m_segment ? m_segment->offset : -1; }
+	void SetSegment(std::shared_ptr<CSegmentGroup> const& group, int64_t offset);
+
+	// When saving the queue, a segmented download is stored once as the
+	// whole file, by the first of its remaining segments.
+	bool SavedAsWholeFile() const;
+	int64_t GetSavedSize() const;
+	CFileExistsNotification::OverwriteAction GetSavedFileExistsAction() const;
+
+	// The remaining segment following this one, if any
+	CFileItem* GetNextSegment() const;
+
+	CSegmentGroup* GetSegmentGroup() const { return m_segment ? m_segment->group.get() : nullptr; }
+
+	// Stands for the whole file again, e.g. in the failed list
+	void LeaveSegmentGroup();
+
 	void SetAscii(bool ascii)
 	{
 		if (ascii) {
@@ -275,6 +399,52 @@ protected:
 	CLocalPath const m_localPath;
 	CServerPath const m_remotePath;
 	int64_t m_size{};
+
+	// Only segments pay for the segment data, the queue can hold millions
+	// of plain items.
+	struct segment final
+	{
+		std::shared_ptr<CSegmentGroup> group;
+		int64_t offset{-1};
+	};
+	std::unique_ptr<segment> m_segment;
+};
+
+// Transfer of a file from another server to the server this item belongs
+// to, the local path is empty. The servers are told to transfer the file
+// directly between themselves. If either refuses, the file is relayed: it
+// gets downloaded into a local temporary file which then gets uploaded.
+//
+// Such items are not kept across sessions.
+class CFxpItem final : public CFileItem
+{
+public:
+	CFxpItem(CServerItem* parent, bool queued, Site const& sourceSite, CServerPath const& sourcePath,
+		std::wstring const& sourceFile, std::wstring const& targetFile, CServerPath const& targetPath, int64_t size);
+	virtual ~CFxpItem();
+
+	virtual bool IsFxp() const override { return true; }
+
+	virtual void SaveItem(pugi::xml_node&) const override {}
+
+	Site const& GetSourceSite() const { return sourceSite_; }
+	CServerPath const& GetSourcePath() const { return sourcePath_; }
+
+	// Set once a direct transfer was refused
+	bool m_relay{};
+
+	// The temporary file when relaying, removed along with the item
+	std::wstring m_relayFile;
+
+	// Set once the relay file holds the complete source file
+	bool m_relayDownloaded{};
+
+	// Removes the relay file, the next attempt starts over directly
+	void ClearRelay();
+
+protected:
+	Site const sourceSite_;
+	CServerPath const sourcePath_;
 };
 
 class CFolderItem final : public CFileItem
@@ -327,6 +497,11 @@ public:
 	virtual void InsertItem(CServerItem* pServerItem, CQueueItem* pItem);
 	virtual bool RemoveItem(CQueueItem* pItem, bool destroy, bool updateItemCount = true, bool updateSelections = true, bool forward = true);
 
+	// Removes many file and folder items at once, each server is visited only
+	// once. Selections are cleared, item counts and the list get updated
+	// at the end. The items must not be active.
+	virtual void RemoveItems(std::vector<CQueueItem*> const& items, bool destroy);
+
 	// Has to be called after adding or removing items. Also updates
 	// item count and selections.
 	virtual void CommitChanges();
@@ -335,7 +510,9 @@ public:
 
 	int GetFileCount() const { return m_fileCount; }
 
-	void WriteToFile(pugi::xml_node element) const;
+	// Writes the queue as Queue element, streaming one batch of items at a
+	// time instead of building the whole element in memory.
+	void WriteToFile(pugi::xml_writer& writer, unsigned int depth) const;
 
 protected:
 
@@ -0,0 +1,91 @@
+#ifndef FILEZILLA_INTERFACE_QUEUE_PAGING_HEADER
+#define FILEZILLA_INTERFACE_QUEUE_PAGING_HEADER
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// With a journaled queue, only the head of each server's queue is
+// loaded on startup. The remaining rows, those with an id past after,
+// get loaded page by page as the loaded part of the queue runs low.
+//
+// The site is only ever compared, so this does not depend on the rest
+// of the interface.
+template<typename SiteKey>
+class unloaded_queue_rows final
+{
+public:
+	struct range final
+	{
+		SiteKey site;
+		int64_t serverId{};
+		int64_t after{};
+	};
+
+	bool empty() const { return ranges_.empty(); }
+	void clear() { ranges_.clear(); }
+
+	std::vector<range>& ranges() { return ranges_; }
+	std::vector<range> const& ranges() const { return ranges_; }
+
+	bool has(int64_t serverId) const
+	{
+		return std::any_of(ranges_.cbegin(), ranges_.cend(), [&](range const& r) { return r.serverId == serverId; });
+	}
+
+	bool has_site(SiteKey const& site) const
+	{
+		return std::any_of(ranges_.cbegin(), ranges_.cend(), [&](range const& r) { return r.site == site; });
+	}
+
+	// The whole queue of the site is being removed, its unloaded rows go as well
+	std::vector<range> take_site(SiteKey const& site)
+	{
+		std::vector<range> ret;
+		auto const it = std::stable_partition(ranges_.begin(), ranges_.end(), [&](range const& r) { return !(r.site == site); });
+		std::move(it, ranges_.end(), std::back_inserter(ret));
+		ranges_.erase(it, ranges_.end());
+		return ret;
+	}
+
+	// Behind rows that are not loaded yet, a new item has to wait for its
+	// turn in the database to keep the queue in order. Long queues in
+	// memory get spilled as well.
+	bool must_spill(SiteKey const& site, size_t children, size_t maxChildren) const
+	{
+		return children >= maxChildren || has_site(site);
+	}
+
+	// An item got stored as the given row and removed from memory. The row
+	// may go to another server row of the same site than the unloaded ones.
+	void spilled(SiteKey const& site, int64_t serverId, int64_t rowId)
+	{
+		if (!has(serverId)) {
+			ranges_.push_back(range{site, serverId, rowId - 1});
+		}
+	}
+
+private:
+	std::vector<range> ranges_;
+};
+
+// Rows journaled after startup may belong to items that never left
+// memory. Removes those rows from a page read from the database and
+// deletes their items, the order of the other rows is kept.
+template<typename Item>
+void drop_loaded_rows(std::vector<std::pair<int64_t, Item*>> & page, std::unordered_set<int64_t> const& loaded)
+{
+	auto const it = std::remove_if(page.begin(), page.end(), [&](std::pair<int64_t, Item*> const& row) {
+		if (loaded.find(row.first) == loaded.end()) {
+			return false;
+		}
+		delete row.second;
+		return true;
+	});
+	page.erase(it, page.end());
+}
+
+#endif
@@ -11,6 +11,11 @@
 
 #define INVALID_DATA -1
 
+namespace {
+// Number of journaled changes after which the running transaction gets committed
+int const journal_batch_size = 1000;
+}
+
 enum class Column_type
 {
 	text,
@@ -53,7 +58,10 @@ namespace server_table_column_names
 		post_login_commands,
 		name,
 		parameters,
-		site_path
+		site_path,
+		speed_limit_inbound,
+		speed_limit_outbound,
+		source_address
 	};
 }
 
@@ -76,7 +84,10 @@ _column server_table_columns[] = {
 	{ "post_login_commands", Column_type::text, 0 },
 	{ "name", Column_type::text, 0 },
 	{ "parameters", Column_type::text, 0 },
-	{ "site_path", Column_type::text, default_null }
+	{ "site_path", Column_type::text, default_null },
+	{ "speed_limit_inbound", Column_type::integer, 0 },
+	{ "speed_limit_outbound", Column_type::integer, 0 },
+	{ "source_address", Column_type::text, default_null }
 };
 
 namespace file_table_column_names
@@ -137,11 +148,23 @@ public:
 
 	sqlite3_stmt* PrepareStatement(std::string const& query);
 	sqlite3_stmt* PrepareInsertStatement(std::string const& name, _column const*, unsigned int count);
+	sqlite3_stmt* PrepareUpdateStatement(std::string const& name, _column const*, unsigned int count, unsigned int first = 1);
 
 	bool SaveServer(CServerItem const& item);
 	bool SaveFile(CFileItem const& item);
 	bool SaveDirectory(CFolderItem const& item);
 
+	bool BindServer(sqlite3_stmt* statement, CServerItem const& item);
+	bool BindFile(sqlite3_stmt* statement, CFileItem const& item);
+	bool BindDirectory(sqlite3_stmt* statement, CFolderItem const& item);
+
+	// Executes a statement that returns no rows and resets it
+	bool Step(sqlite3_stmt* statement);
+
+	// Files being edited and all but the first of the remaining segments
+	// of a segmented download are not saved.
+	static bool Saved(CFileItem const& file);
+
 	int64_t SaveLocalPath(CLocalPath const& path);
 	int64_t SaveRemotePath(CServerPath const& path);
 
@@ -164,13 +187,22 @@ public:
 	int GetColumnInt(sqlite3_stmt* statement, int index, int def = 0);
 
 	int64_t ParseServerFromRow(Site & site);
-	int64_t ParseFileFromRow(CFileItem** pItem);
+	int64_t ParseFileFromRow(sqlite3_stmt* statement, CFileItem** pItem);
 
 	bool MigrateSchema();
 
 	bool BeginTransaction();
 	bool EndTransaction(bool roolback);
 
+	// Journaled changes are written in a transaction that is committed
+	// once journal_batch_size changes have accumulated or on Flush.
+	bool BeginBatch();
+	bool CommitBatch();
+	void Journaled(bool success);
+
+	// Removes the rows of the children of the given server
+	bool RemoveStored(CServerItem & item);
+
 	void Close();
 
 	sqlite3* db_{};
@@ -182,9 +214,32 @@ public:
 
 	sqlite3_stmt* selectServersQuery_{};
 	sqlite3_stmt* selectFilesQuery_{};
+	sqlite3_stmt* selectFilesPageQuery_{};
 	sqlite3_stmt* selectLocalPathQuery_{};
 	sqlite3_stmt* selectRemotePathQuery_{};
 
+	sqlite3_stmt* updateServerQuery_{};
+	sqlite3_stmt* updateFileQuery_{};
+	sqlite3_stmt* deleteServerQuery_{};
+	sqlite3_stmt* deleteServerFilesQuery_{};
+	sqlite3_stmt* deleteFileQuery_{};
+	sqlite3_stmt* deleteFilesAfterQuery_{};
+	sqlite3_stmt* updateFilesPriorityAfterQuery_{};
+	sqlite3_stmt* updateFilesExistsActionAfterQuery_{};
+
+	bool journal_{};
+
+	// Set while the queue is being loaded, the whole load is a single
+	// transaction.
+	bool loading_{};
+
+	bool batch_{};
+	int pending_{};
+
+	// Set if any change could not be written. The journal is then no
+	// longer trusted and the queue gets rewritten on exit.
+	bool journalFailed_{};
+
 	// Caches to speed up saving and loading
 	void ClearCaches();
 
@@ -211,6 +266,7 @@ void CQueueStorage::Impl::ReadLocalPaths()
 			CLocalPath localPath;
 			if (id > 0 && !localPathRaw.empty() && localPath.SetPath(localPathRaw)) {
 				reverseLocalPaths_[id] = localPath;
+				localPaths_[localPath.GetPath()] = id;
 			}
 		}
 	}
@@ -226,6 +282,9 @@ void CQueueStorage::Impl::ReadRemotePaths()
 		return;
 	}
 
+	// Many stored paths share their parents, let them share the segments as well
+	CServerPathInterner interner;
+
 	int res;
 	do {
 		res = sqlite3_step(selectRemotePathQuery_);
@@ -234,7 +293,9 @@ void CQueueStorage::Impl::ReadRemotePaths()
 			std::wstring remotePathRaw = GetColumnText(selectRemotePathQuery_, path_table_column_names::path);
 			CServerPath remotePath;
 			if (id > 0 && !remotePathRaw.empty() && remotePath.SetSafePath(remotePathRaw)) {
+				remotePath = interner.Intern(remotePath);
 				reverseRemotePaths_[id] = remotePath;
+				remotePaths_[remotePath.GetSafePath()] = id;
 			}
 		}
 	}
@@ -295,7 +356,7 @@ bool CQueueStorage::Impl::MigrateSchema()
 	bool ret = sqlite3_exec(db_, "PRAGMA user_version", int_callback, &version, 0) == SQLITE_OK;
 
 	if (ret) {
-		if (version > 5) {
+		if (version > 7) {
 			ret = false;
 		}
 		else if (version > 0) {
@@ -309,9 +370,16 @@ bool CQueueStorage::Impl::MigrateSchema()
 			if (ret && version < 5) {
 				ret = sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN site_path TEXT DEFAULT NULL", 0, 0, 0) == SQLITE_OK;
 			}
+			if (ret && version < 6) {
+				ret = sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN speed_limit_inbound INTEGER", 0, 0, 0) == SQLITE_OK &&
+					sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN speed_limit_outbound INTEGER", 0, 0, 0) == SQLITE_OK;
+			}
+			if (ret && version < 7) {
+				ret = sqlite3_exec(db_, "ALTER TABLE servers ADD COLUMN source_address TEXT DEFAULT NULL", 0, 0, 0) == SQLITE_OK;
+			}
 		}
-		if (ret && version != 5) {
-			ret = sqlite3_exec(db_, "PRAGMA user_version = 5", 0, 0, 0) == SQLITE_OK;
+		if (ret && version != 7) {
+			ret = sqlite3_exec(db_, "PRAGMA user_version = 7", 0, 0, 0) == SQLITE_OK;
 		}
 	}
 
@@ -491,6 +559,29 @@ sqlite3_stmt* CQueueStorage::Impl::PrepareInsertStatement(std::string const& nam
 }
 
 
+sqlite3_stmt* CQueueStorage::Impl::PrepareUpdateStatement(std::string const& name, _column const* columns, unsigned int count, unsigned int first)
+{
+	if (!db_) {
+		return 0;
+	}
+
+	// Parameters are numbered like in the insert statement, columns in
+	// front of first are left unchanged.
+	std::string query = "UPDATE " + name + " SET ";
+	for (unsigned int i = first; i < count; ++i) {
+		if (i > first) {
+			query += ", ";
+		}
+		query += columns[i].name;
+		query += "=?";
+		query += std::to_string(i);
+	}
+	query += " WHERE id=:id";
+
+	return PrepareStatement(query);
+}
+
+
 sqlite3_stmt* CQueueStorage::Impl::PrepareStatement(std::string const& query)
 {
 	sqlite3_stmt* ret = 0;
@@ -547,9 +638,10 @@ bool CQueueStorage::Impl::PrepareStatements()
 			query += file_table_columns[i].name;
 		}
 
-		query += " FROM files WHERE server=:server ORDER BY id ASC";
-
-		if (!(selectFilesQuery_ = PrepareStatement(query))) {
+		if (!(selectFilesQuery_ = PrepareStatement(query + " FROM files WHERE server=:server ORDER BY id ASC"))) {
+			return false;
+		}
+		if (!(selectFilesPageQuery_ = PrepareStatement(query + " FROM files WHERE server=:server AND id>:after ORDER BY id ASC LIMIT :limit"))) {
 			return false;
 		}
 	}
@@ -567,6 +659,24 @@ bool CQueueStorage::Impl::PrepareStatements()
 			return false;
 		}
 	}
+
+	updateServerQuery_ = PrepareUpdateStatement("servers", server_table_columns, sizeof(server_table_columns) / sizeof(_column));
+	// Files of a site may belong to several server rows, a file keeps its row
+	updateFileQuery_ = PrepareUpdateStatement("files", file_table_columns, sizeof(file_table_columns) / sizeof(_column), file_table_column_names::source_file);
+	deleteServerQuery_ = PrepareStatement("DELETE FROM servers WHERE id=:id");
+	deleteServerFilesQuery_ = PrepareStatement("DELETE FROM files WHERE server=:server");
+	deleteFileQuery_ = PrepareStatement("DELETE FROM files WHERE id=:id");
+	deleteFilesAfterQuery_ = PrepareStatement("DELETE FROM files WHERE server=:server AND id>:after");
+	if (!updateServerQuery_ || !updateFileQuery_ || !deleteServerQuery_ || !deleteServerFilesQuery_ || !deleteFileQuery_ || !deleteFilesAfterQuery_) {
+		return false;
+	}
+
+	updateFilesPriorityAfterQuery_ = PrepareStatement("UPDATE files SET priority=:priority WHERE server=:server AND id>:after");
+	updateFilesExistsActionAfterQuery_ = PrepareStatement("UPDATE files SET default_exists_action=:action WHERE server=:server AND id>:after AND download=:download");
+	if (!updateFilesPriorityAfterQuery_ || !updateFilesExistsActionAfterQuery_) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -612,29 +722,29 @@ bool CQueueStorage::Impl::BindNull(sqlite3_stmt* statement, int index)
 }
 
 
-bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
+bool CQueueStorage::Impl::BindServer(sqlite3_stmt* statement, CServerItem const& item)
 {
 	bool kiosk_mode = COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) != 0;
 
 	Site const& site = item.GetSite();
 
-	Bind(insertServerQuery_, server_table_column_names::host, site.server.GetHost());
-	Bind(insertServerQuery_, server_table_column_names::port, static_cast<int>(site.server.GetPort()));
-	Bind(insertServerQuery_, server_table_column_names::protocol, static_cast<int>(site.server.GetProtocol()));
-	Bind(insertServerQuery_, server_table_column_names::type, static_cast<int>(site.server.GetType()));
+	Bind(statement, server_table_column_names::host, site.server.GetHost());
+	Bind(statement, server_table_column_names::port, static_cast<int>(site.server.GetPort()));
+	Bind(statement, server_table_column_names::protocol, static_cast<int>(site.server.GetProtocol()));
+	Bind(statement, server_table_column_names::type, static_cast<int>(site.server.GetType()));
 
 	ProtectedCredentials credentials = site.credentials;
 	credentials.Protect();
 
 	LogonType logonType = credentials.logonType_;
 	if (logonType != LogonType::anonymous) {
-		Bind(insertServerQuery_, server_table_column_names::user, site.server.GetUser());
+		Bind(statement, server_table_column_names::user, site.server.GetUser());
 
 		if (logonType == LogonType::normal || logonType == LogonType::account) {
 			if (kiosk_mode) {
 				logonType = LogonType::ask;
-				BindNull(insertServerQuery_, server_table_column_names::password);
-				BindNull(insertServerQuery_, server_table_column_names::account);
+				BindNull(statement, server_table_column_names::password);
+				BindNull(statement, server_table_column_names::account);
 			}
 			else {
 				std::wstring pw;
@@ -643,33 +753,33 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 					pw += ' ';
 				}
 				pw += credentials.GetPass();
-				Bind(insertServerQuery_, server_table_column_names::password, pw);
+				Bind(statement, server_table_column_names::password, pw);
 
 				if (credentials.account_.empty()) {
-					BindNull(insertServerQuery_, server_table_column_names::account);
+					BindNull(statement, server_table_column_names::account);
 				}
 				else {
-					Bind(insertServerQuery_, server_table_column_names::account, credentials.account_);
+					Bind(statement, server_table_column_names::account, credentials.account_);
 				}
 			}
 		}
 		else {
-			BindNull(insertServerQuery_, server_table_column_names::password);
-			BindNull(insertServerQuery_, server_table_column_names::account);
+			BindNull(statement, server_table_column_names::password);
+			BindNull(statement, server_table_column_names::account);
 		}
 
 		if (credentials.keyFile_.empty()) {
-			BindNull(insertServerQuery_, server_table_column_names::keyfile);
+			BindNull(statement, server_table_column_names::keyfile);
 		}
 		else {
-			Bind(insertServerQuery_, server_table_column_names::keyfile, credentials.keyFile_);
+			Bind(statement, server_table_column_names::keyfile, credentials.keyFile_);
 		}
 	}
 	else {
-		BindNull(insertServerQuery_, server_table_column_names::user);
-		BindNull(insertServerQuery_, server_table_column_names::password);
-		BindNull(insertServerQuery_, server_table_column_names::account);
-		BindNull(insertServerQuery_, server_table_column_names::keyfile);
+		BindNull(statement, server_table_column_names::user);
+		BindNull(statement, server_table_column_names::password);
+		BindNull(statement, server_table_column_names::account);
+		BindNull(statement, server_table_column_names::keyfile);
 	}
 
 	{
@@ -678,36 +788,36 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 			static_assert(static_cast<int64_t>(LogonType::count) < (1ll << 62), "LogonType::count too big");
 			lt |= 1ll << 62;
 		}
-		Bind(insertServerQuery_, server_table_column_names::logontype, lt);
+		Bind(statement, server_table_column_names::logontype, lt);
 	}
 
-	Bind(insertServerQuery_, server_table_column_names::timezone_offset, site.server.GetTimezoneOffset());
+	Bind(statement, server_table_column_names::timezone_offset, site.server.GetTimezoneOffset());
 
 	switch (site.server.GetPasvMode())
 	{
 	case MODE_PASSIVE:
-		Bind(insertServerQuery_, server_table_column_names::transfer_mode, _T("passive"));
+		Bind(statement, server_table_column_names::transfer_mode, _T("passive"));
 		break;
 	case MODE_ACTIVE:
-		Bind(insertServerQuery_, server_table_column_names::transfer_mode, _T("active"));
+		Bind(statement, server_table_column_names::transfer_mode, _T("active"));
 		break;
 	default:
-		Bind(insertServerQuery_, server_table_column_names::transfer_mode, _T("default"));
+		Bind(statement, server_table_column_names::transfer_mode, _T("default"));
 		break;
 	}
-	Bind(insertServerQuery_, server_table_column_names::max_connections, site.server.MaximumMultipleConnections());
+	Bind(statement, server_table_column_names::max_connections, site.server.MaximumMultipleConnections());
 
 	switch (site.server.GetEncodingType())
 	{
 	default:
 	case ENCODING_AUTO:
-		Bind(insertServerQuery_, server_table_column_names::encoding, _T("Auto"));
+		Bind(statement, server_table_column_names::encoding, _T("Auto"));
 		break;
 	case ENCODING_UTF8:
-		Bind(insertServerQuery_, server_table_column_names::encoding, _T("UTF-8"));
+		Bind(statement, server_table_column_names::encoding, _T("UTF-8"));
 		break;
 	case ENCODING_CUSTOM:
-		Bind(insertServerQuery_, server_table_column_names::encoding, site.server.GetCustomEncoding());
+		Bind(statement, server_table_column_names::encoding, site.server.GetCustomEncoding());
 		break;
 	}
 
@@ -721,22 +831,22 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 				}
 				commands += command;
 			}
-			Bind(insertServerQuery_, server_table_column_names::post_login_commands, commands);
+			Bind(statement, server_table_column_names::post_login_commands, commands);
 		}
 		else {
-			BindNull(insertServerQuery_, server_table_column_names::post_login_commands);
+			BindNull(statement, server_table_column_names::post_login_commands);
 		}
 	}
 	else {
-		BindNull(insertServerQuery_, server_table_column_names::post_login_commands);
+		BindNull(statement, server_table_column_names::post_login_commands);
 	}
 
-	Bind(insertServerQuery_, server_table_column_names::bypass_proxy, site.server.GetBypassProxy() ? 1 : 0);
+	Bind(statement, server_table_column_names::bypass_proxy, site.server.GetBypassProxy() ? 1 : 0);
 	if (!site.GetName().empty()) {
-		Bind(insertServerQuery_, server_table_column_names::name, site.GetName());
+		Bind(statement, server_table_column_names::name, site.GetName());
 	}
 	else {
-		BindNull(insertServerQuery_, server_table_column_names::name);
+		BindNull(statement, server_table_column_names::name);
 	}
 
 	auto const& parameters = site.server.GetExtraParameters();
@@ -745,25 +855,37 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 		for (auto const& parameter : parameters) {
 			qs[parameter.first] = fz::to_utf8(parameter.second);
 		}
-		Bind(insertServerQuery_, server_table_column_names::parameters, qs.to_string(false));
+		Bind(statement, server_table_column_names::parameters, qs.to_string(false));
+	}
+	else {
+		BindNull(statement, server_table_column_names::parameters);
 	}
 
 	auto const& site_path = site.SitePath();
 	if (site_path.empty()) {
-		BindNull(insertServerQuery_, server_table_column_names::site_path);
+		BindNull(statement, server_table_column_names::site_path);
 	}
 	else {
-		Bind(insertServerQuery_, server_table_column_names::site_path, site_path);
+		Bind(statement, server_table_column_names::site_path, site_path);
 	}
 
-	int res;
-	do {
-		res = sqlite3_step(insertServerQuery_);
-	} while (res == SQLITE_BUSY);
+	Bind(statement, server_table_column_names::speed_limit_inbound, site.server.GetInboundSpeedLimit());
+	Bind(statement, server_table_column_names::speed_limit_outbound, site.server.GetOutboundSpeedLimit());
+
+	if (site.server.GetSourceAddress().empty()) {
+		BindNull(statement, server_table_column_names::source_address);
+	}
+	else {
+		Bind(statement, server_table_column_names::source_address, site.server.GetSourceAddress());
+	}
+
+	return true;
+}
 
-	sqlite3_reset(insertServerQuery_);
 
-	bool ret = res == SQLITE_DONE;
+bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
+{
+	bool ret = BindServer(insertServerQuery_, item) && Step(insertServerQuery_);
 	if (ret) {
 		sqlite3_int64 serverId = sqlite3_last_insert_rowid(db_);
 		Bind(insertFileQuery_, file_table_column_names::server, static_cast<int64_t>(serverId));
@@ -785,17 +907,23 @@ bool CQueueStorage::Impl::SaveServer(CServerItem const& item)
 
 bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
 {
-	if (file.m_edit != CEditHandler::none) {
+	if (!Saved(file)) {
 		return true;
 	}
 
-	Bind(insertFileQuery_, file_table_column_names::source_file, file.GetSourceFile());
+	return BindFile(insertFileQuery_, file) && Step(insertFileQuery_);
+}
+
+
+bool CQueueStorage::Impl::BindFile(sqlite3_stmt* statement, CFileItem const& file)
+{
+	Bind(statement, file_table_column_names::source_file, file.GetSourceFile());
 	auto const& targetFile = file.GetTargetFile();
 	if (targetFile) {
-		Bind(insertFileQuery_, file_table_column_names::target_file, *targetFile);
+		Bind(statement, file_table_column_names::target_file, *targetFile);
 	}
 	else {
-		BindNull(insertFileQuery_, file_table_column_names::target_file);
+		BindNull(statement, file_table_column_names::target_file);
 	}
 
 	int64_t localPathId = SaveLocalPath(file.GetLocalPath());
@@ -804,52 +932,51 @@ bool CQueueStorage::Impl::SaveFile(CFileItem const& file)
 		return false;
 	}
 
-	Bind(insertFileQuery_, file_table_column_names::local_path, localPathId);
-	Bind(insertFileQuery_, file_table_column_names::remote_path, remotePathId);
+	Bind(statement, file_table_column_names::local_path, localPathId);
+	Bind(statement, file_table_column_names::remote_path, remotePathId);
 
-	Bind(insertFileQuery_, file_table_column_names::download, file.Download() ? 1 : 0);
-	if (file.GetSize() != -1) {
-		Bind(insertFileQuery_, file_table_column_names::size, file.GetSize());
+	Bind(statement, file_table_column_names::download, file.Download() ? 1 : 0);
+	if (file.GetSavedSize() != -1) {
+		Bind(statement, file_table_column_names::size, file.GetSavedSize());
 	}
 	else {
-		BindNull(insertFileQuery_, file_table_column_names::size);
+		BindNull(statement, file_table_column_names::size);
 	}
 	if (file.m_errorCount) {
-		Bind(insertFileQuery_, file_table_column_names::error_count, file.m_errorCount);
+		Bind(statement, file_table_column_names::error_count, file.m_errorCount);
 	}
 	else {
-		BindNull(insertFileQuery_, file_table_column_names::error_count);
+		BindNull(statement, file_table_column_names::error_count);
 	}
-	Bind(insertFileQuery_, file_table_column_names::priority, static_cast<int>(file.GetPriority()));
-	Bind(insertFileQuery_, file_table_column_names::ascii_file, file.Ascii() ? 1 : 0);
+	Bind(statement, file_table_column_names::priority, static_cast<int>(file.GetPriority()));
+	Bind(statement, file_table_column_names::ascii_file, file.Ascii() ? 1 : 0);
 
-	if (file.m_defaultFileExistsAction != CFileExistsNotification::unknown) {
-		Bind(insertFileQuery_, file_table_column_names::default_exists_action, file.m_defaultFileExistsAction);
+	if (file.GetSavedFileExistsAction() != CFileExistsNotification::unknown) {
+		Bind(statement, file_table_column_names::default_exists_action, file.GetSavedFileExistsAction());
 	}
 	else {
-		BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
+		BindNull(statement, file_table_column_names::default_exists_action);
 	}
 
-	int res;
-	do {
-		res = sqlite3_step(insertFileQuery_);
-	} while (res == SQLITE_BUSY);
+	return true;
+}
 
-	sqlite3_reset(insertFileQuery_);
 
-	return res == SQLITE_DONE;
+bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
+{
+	return BindDirectory(insertFileQuery_, directory) && Step(insertFileQuery_);
 }
 
 
-bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
+bool CQueueStorage::Impl::BindDirectory(sqlite3_stmt* statement, CFolderItem const& directory)
 {
 	if (directory.Download()) {
-		BindNull(insertFileQuery_, file_table_column_names::source_file);
+		BindNull(statement, file_table_column_names::source_file);
 	}
 	else {
-		Bind(insertFileQuery_, file_table_column_names::source_file, directory.GetSourceFile());
+		Bind(statement, file_table_column_names::source_file, directory.GetSourceFile());
 	}
-	BindNull(insertFileQuery_, file_table_column_names::target_file);
+	BindNull(statement, file_table_column_names::target_file);
 
 	int64_t localPathId = directory.Download() ? SaveLocalPath(directory.GetLocalPath()) : -1;
 	int64_t remotePathId = directory.Download() ? -1 : SaveRemotePath(directory.GetRemotePath());
@@ -857,33 +984,48 @@ bool CQueueStorage::Impl::SaveDirectory(CFolderItem const& directory)
 		return false;
 	}
 
-	Bind(insertFileQuery_, file_table_column_names::local_path, localPathId);
-	Bind(insertFileQuery_, file_table_column_names::remote_path, remotePathId);
+	Bind(statement, file_table_column_names::local_path, localPathId);
+	Bind(statement, file_table_column_names::remote_path, remotePathId);
 
-	Bind(insertFileQuery_, file_table_column_names::download, directory.Download() ? 1 : 0);
-	BindNull(insertFileQuery_, file_table_column_names::size);
+	Bind(statement, file_table_column_names::download, directory.Download() ? 1 : 0);
+	BindNull(statement, file_table_column_names::size);
 	if (directory.m_errorCount) {
-		Bind(insertFileQuery_, file_table_column_names::error_count, directory.m_errorCount);
+		Bind(statement, file_table_column_names::error_count, directory.m_errorCount);
 	}
 	else {
-		BindNull(insertFileQuery_, file_table_column_names::error_count);
+		BindNull(statement, file_table_column_names::error_count);
 	}
-	Bind(insertFileQuery_, file_table_column_names::priority, static_cast<int>(directory.GetPriority()));
-	BindNull(insertFileQuery_, file_table_column_names::ascii_file);
+	Bind(statement, file_table_column_names::priority, static_cast<int>(directory.GetPriority()));
+	BindNull(statement, file_table_column_names::ascii_file);
 
-	BindNull(insertFileQuery_, file_table_column_names::default_exists_action);
+	BindNull(statement, file_table_column_names::default_exists_action);
 
+	return true;
+}
+
+
+bool CQueueStorage::Impl::Step(sqlite3_stmt* statement)
+{
 	int res;
 	do {
-		res = sqlite3_step(insertFileQuery_);
+		res = sqlite3_step(statement);
 	} while (res == SQLITE_BUSY);
 
-	sqlite3_reset(insertFileQuery_);
+	sqlite3_reset(statement);
 
 	return res == SQLITE_DONE;
 }
 
 
+bool CQueueStorage::Impl::Saved(CFileItem const& file)
+{
+	if (file.GetType() == QueueItemType::Folder) {
+		return true;
+	}
+	return file.m_edit == CEditHandler::none && file.SavedAsWholeFile() && !file.IsFxp();
+}
+
+
 std::wstring CQueueStorage::Impl::GetColumnText(sqlite3_stmt* statement, int index)
 {
 	std::wstring ret;
@@ -1062,22 +1204,26 @@ int64_t CQueueStorage::Impl::ParseServerFromRow(Site & site)
 		site.SetSitePath(site_path);
 	}
 
+	site.server.SetSpeedLimits(GetColumnInt(selectServersQuery_, server_table_column_names::speed_limit_inbound),
+		GetColumnInt(selectServersQuery_, server_table_column_names::speed_limit_outbound));
+	site.server.SetSourceAddress(GetColumnText(selectServersQuery_, server_table_column_names::source_address));
+
 	return GetColumnInt64(selectServersQuery_, server_table_column_names::id);
 }
 
 
-int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
+int64_t CQueueStorage::Impl::ParseFileFromRow(sqlite3_stmt* statement, CFileItem** pItem)
 {
-	std::wstring sourceFile = GetColumnText(selectFilesQuery_, file_table_column_names::source_file);
-	std::wstring targetFile = GetColumnText(selectFilesQuery_, file_table_column_names::target_file);
+	std::wstring sourceFile = GetColumnText(statement, file_table_column_names::source_file);
+	std::wstring targetFile = GetColumnText(statement, file_table_column_names::target_file);
 
-	int64_t localPathId = GetColumnInt64(selectFilesQuery_, file_table_column_names::local_path, false);
-	int64_t remotePathId = GetColumnInt64(selectFilesQuery_, file_table_column_names::remote_path, false);
+	int64_t localPathId = GetColumnInt64(statement, file_table_column_names::local_path, false);
+	int64_t remotePathId = GetColumnInt64(statement, file_table_column_names::remote_path, false);
 
 	CLocalPath const localPath(GetLocalPath(localPathId));
 	CServerPath const remotePath(GetRemotePath(remotePathId));
 
-	bool download = GetColumnInt(selectFilesQuery_, file_table_column_names::download) != 0;
+	bool download = GetColumnInt(statement, file_table_column_names::download) != 0;
 
 	if (localPathId == -1 || remotePathId == -1) {
 		// QueueItemType::Folder
@@ -1095,12 +1241,12 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		}
 	}
 	else {
-		int64_t size = GetColumnInt64(selectFilesQuery_, file_table_column_names::size);
-		unsigned char errorCount = static_cast<unsigned char>(GetColumnInt(selectFilesQuery_, file_table_column_names::error_count));
-		int priority = GetColumnInt(selectFilesQuery_, file_table_column_names::priority, static_cast<int>(QueuePriority::normal));
+		int64_t size = GetColumnInt64(statement, file_table_column_names::size);
+		unsigned char errorCount = static_cast<unsigned char>(GetColumnInt(statement, file_table_column_names::error_count));
+		int priority = GetColumnInt(statement, file_table_column_names::priority, static_cast<int>(QueuePriority::normal));
 
-		bool ascii = GetColumnInt(selectFilesQuery_, file_table_column_names::ascii_file) != 0;
-		int overwrite_action = GetColumnInt(selectFilesQuery_, file_table_column_names::default_exists_action, CFileExistsNotification::unknown);
+		bool ascii = GetColumnInt(statement, file_table_column_names::ascii_file) != 0;
+		int overwrite_action = GetColumnInt(statement, file_table_column_names::default_exists_action, CFileExistsNotification::unknown);
 
 		if (sourceFile.empty() || localPath.empty() ||
 			remotePath.empty() ||
@@ -1121,7 +1267,7 @@ int64_t CQueueStorage::Impl::ParseFileFromRow(CFileItem** pItem)
 		}
 	}
 
-	return GetColumnInt64(selectFilesQuery_, file_table_column_names::id);
+	return GetColumnInt64(statement, file_table_column_names::id);
 }
 
 bool CQueueStorage::Impl::BeginTransaction()
@@ -1140,6 +1286,70 @@ bool CQueueStorage::Impl::EndTransaction(bool rollback)
 }
 
 
+bool CQueueStorage::Impl::BeginBatch()
+{
+	if (!batch_ && !loading_) {
+		if (!BeginTransaction()) {
+			return false;
+		}
+		batch_ = true;
+	}
+	return true;
+}
+
+bool CQueueStorage::Impl::CommitBatch()
+{
+	if (!batch_) {
+		return true;
+	}
+
+	int res = sqlite3_exec(db_, "END TRANSACTION", 0, 0, 0);
+	if (res == SQLITE_BUSY) {
+		// Another instance is reading the database, try again on the next flush
+		return true;
+	}
+
+	batch_ = false;
+	pending_ = 0;
+	if (res != SQLITE_OK) {
+		EndTransaction(true);
+		journalFailed_ = true;
+		return false;
+	}
+
+	return true;
+}
+
+void CQueueStorage::Impl::Journaled(bool success)
+{
+	if (!success) {
+		journalFailed_ = true;
+	}
+	if (++pending_ >= journal_batch_size) {
+		CommitBatch();
+	}
+}
+
+bool CQueueStorage::Impl::RemoveStored(CServerItem & item)
+{
+	bool ret = true;
+
+	auto const& children = item.GetChildren();
+	for (auto it = children.begin() + item.GetRemovedAtFront(); it != children.end(); ++it) {
+		CQueueItem & child = **it;
+		if (child.m_storageId) {
+			ret &= Bind(deleteFileQuery_, 1, child.m_storageId) && Step(deleteFileQuery_);
+			child.m_storageId = 0;
+		}
+	}
+
+	// The server row stays, it may still have files that have not been
+	// loaded. Server rows without files get removed on the next start.
+	item.m_storageId = 0;
+
+	return ret;
+}
+
 void CQueueStorage::Impl::Close()
 {
 	sqlite3_finalize(insertServerQuery_);
@@ -1148,16 +1358,35 @@ void CQueueStorage::Impl::Close()
 	sqlite3_finalize(insertRemotePathQuery_);
 	sqlite3_finalize(selectServersQuery_);
 	sqlite3_finalize(selectFilesQuery_);
+	sqlite3_finalize(selectFilesPageQuery_);
 	sqlite3_finalize(selectLocalPathQuery_);
 	sqlite3_finalize(selectRemotePathQuery_);
+	sqlite3_finalize(updateServerQuery_);
+	sqlite3_finalize(updateFileQuery_);
+	sqlite3_finalize(deleteServerQuery_);
+	sqlite3_finalize(deleteServerFilesQuery_);
+	sqlite3_finalize(deleteFileQuery_);
+	sqlite3_finalize(deleteFilesAfterQuery_);
+	sqlite3_finalize(updateFilesPriorityAfterQuery_);
+	sqlite3_finalize(updateFilesExistsActionAfterQuery_);
 	insertServerQuery_ = 0;
 	insertFileQuery_ = 0;
 	insertLocalPathQuery_ = 0;
 	insertRemotePathQuery_ = 0;
 	selectServersQuery_ = 0;
 	selectFilesQuery_ = 0;
+	selectFilesPageQuery_ = 0;
 	selectLocalPathQuery_ = 0;
 	selectRemotePathQuery_ = 0;
+	updateServerQuery_ = 0;
+	updateFileQuery_ = 0;
+	deleteServerQuery_ = 0;
+	deleteServerFilesQuery_ = 0;
+	deleteFileQuery_ = 0;
+	deleteFilesAfterQuery_ = 0;
+	updateFilesPriorityAfterQuery_ = 0;
+	updateFilesExistsActionAfterQuery_ = 0;
+	journal_ = false;
 	sqlite3_close(db_);
 	db_ = 0;
 }
@@ -1179,17 +1408,37 @@ CQueueStorage::CQueueStorage()
 
 CQueueStorage::~CQueueStorage()
 {
+	d_->CommitBatch();
 	d_->Close();
 	delete d_;
 }
 
 bool CQueueStorage::SaveQueue(std::vector<CServerItem*> const& queue)
 {
+	bool rewrite = false;
+	if (d_->journal_) {
+		// Nothing is journaled past this point
+		d_->journal_ = false;
+		if (d_->CommitBatch() && !d_->batch_ && !d_->journalFailed_) {
+			return true;
+		}
+
+		// The journal cannot be trusted, replace what it wrote
+		if (d_->batch_) {
+			d_->EndTransaction(true);
+			d_->batch_ = false;
+		}
+		rewrite = true;
+	}
+
 	d_->ClearCaches();
 
 	bool ret = true;
 	if (sqlite3_exec(d_->db_, "BEGIN TRANSACTION", 0, 0, 0) == SQLITE_OK) {
 		for (auto const& serverItem : queue) {
+			if (rewrite) {
+				ret &= d_->RemoveStored(*serverItem);
+			}
 			ret &= d_->SaveServer(*serverItem);
 		}
 
@@ -1268,7 +1517,7 @@ int64_t CQueueStorage::GetFile(CFileItem** pItem, int64_t server)
 			while (res == SQLITE_BUSY);
 
 			if (res == SQLITE_ROW) {
-				ret = d_->ParseFileFromRow(pItem);
+				ret = d_->ParseFileFromRow(d_->selectFilesQuery_, pItem);
 				if (ret > 0) {
 					break;
 				}
@@ -1292,6 +1541,95 @@ int64_t CQueueStorage::GetFile(CFileItem** pItem, int64_t server)
 	return ret;
 }
 
+int CQueueStorage::GetFiles(std::vector<std::pair<int64_t, CFileItem*>> & files, int64_t server, int64_t & after, int limit)
+{
+	sqlite3_stmt* statement = d_->selectFilesPageQuery_;
+	if (!statement) {
+		return -1;
+	}
+
+	sqlite3_reset(statement);
+	d_->Bind(statement, 1, server);
+	d_->Bind(statement, 2, after);
+	d_->Bind(statement, 3, limit);
+
+	int rows = 0;
+	for (;;) {
+		int res;
+		do {
+			res = sqlite3_step(statement);
+		}
+		while (res == SQLITE_BUSY);
+
+		if (res == SQLITE_ROW) {
+			++rows;
+			after = d_->GetColumnInt64(statement, file_table_column_names::id);
+
+			CFileItem* item{};
+			int64_t const id = d_->ParseFileFromRow(statement, &item);
+			if (id > 0 && item) {
+				files.emplace_back(id, item);
+			}
+			else {
+				delete item;
+			}
+		}
+		else {
+			sqlite3_reset(statement);
+			return (res == SQLITE_DONE) ? rows : -1;
+		}
+	}
+}
+
+void CQueueStorage::RemoveFiles(int64_t server, int64_t after)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	bool ret = d_->BeginBatch() &&
+		d_->Bind(d_->deleteFilesAfterQuery_, 1, server) &&
+		d_->Bind(d_->deleteFilesAfterQuery_, 2, after) &&
+		d_->Step(d_->deleteFilesAfterQuery_);
+	d_->Journaled(ret);
+}
+
+void CQueueStorage::SetFilesPriority(int64_t server, int64_t after, QueuePriority priority)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	bool ret = d_->BeginBatch() &&
+		d_->Bind(d_->updateFilesPriorityAfterQuery_, 1, static_cast<int>(priority)) &&
+		d_->Bind(d_->updateFilesPriorityAfterQuery_, 2, server) &&
+		d_->Bind(d_->updateFilesPriorityAfterQuery_, 3, after) &&
+		d_->Step(d_->updateFilesPriorityAfterQuery_);
+	d_->Journaled(ret);
+}
+
+void CQueueStorage::SetFilesExistsAction(int64_t server, int64_t after, CFileExistsNotification::OverwriteAction action, bool download)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	sqlite3_stmt* statement = d_->updateFilesExistsActionAfterQuery_;
+	bool ret = d_->BeginBatch();
+	if (action != CFileExistsNotification::unknown) {
+		ret = ret && d_->Bind(statement, 1, static_cast<int>(action));
+	}
+	else {
+		ret = ret && d_->BindNull(statement, 1);
+	}
+	ret = ret &&
+		d_->Bind(statement, 2, server) &&
+		d_->Bind(statement, 3, after) &&
+		d_->Bind(statement, 4, download ? 1 : 0) &&
+		d_->Step(statement);
+	d_->Journaled(ret);
+}
+
 bool CQueueStorage::Clear()
 {
 	if (!d_->db_) {
@@ -1326,14 +1664,157 @@ std::wstring CQueueStorage::GetDatabaseFilename()
 
 bool CQueueStorage::BeginTransaction()
 {
-	return d_->BeginTransaction();
+	d_->CommitBatch();
+	d_->loading_ = d_->BeginTransaction();
+	return d_->loading_;
 }
 
 bool CQueueStorage::EndTransaction(bool rollback)
 {
+	d_->loading_ = false;
+	d_->pending_ = 0;
+
+	// Only needed to load the queue, unless the rest of it gets loaded later
+	if (!d_->journal_) {
+		d_->reverseLocalPaths_.clear();
+		d_->reverseRemotePaths_.clear();
+	}
+
 	return d_->EndTransaction(rollback);
 }
 
+void CQueueStorage::StartJournal()
+{
+	if (d_->deleteFileQuery_) {
+		d_->journal_ = true;
+		d_->journalFailed_ = false;
+	}
+}
+
+bool CQueueStorage::Journaling() const
+{
+	return d_->journal_;
+}
+
+void CQueueStorage::StoreServer(CServerItem & item)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	bool ret = d_->BeginBatch();
+	if (ret) {
+		if (item.m_storageId) {
+			ret = d_->BindServer(d_->updateServerQuery_, item) &&
+				d_->Bind(d_->updateServerQuery_, sqlite3_bind_parameter_index(d_->updateServerQuery_, ":id"), item.m_storageId) &&
+				d_->Step(d_->updateServerQuery_);
+		}
+		else {
+			ret = d_->BindServer(d_->insertServerQuery_, item) && d_->Step(d_->insertServerQuery_);
+			if (ret) {
+				item.m_storageId = sqlite3_last_insert_rowid(d_->db_);
+			}
+		}
+	}
+	d_->Journaled(ret);
+}
+
+void CQueueStorage::StoreItem(CFileItem & item)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	if (!Impl::Saved(item)) {
+		RemoveItem(item);
+		return;
+	}
+
+	CQueueItem* topLevelItem = item.GetTopLevelItem();
+	if (!topLevelItem || topLevelItem->GetType() != QueueItemType::Server) {
+		return;
+	}
+	CServerItem & serverItem = static_cast<CServerItem&>(*topLevelItem);
+	if (!serverItem.m_storageId) {
+		StoreServer(serverItem);
+		if (!serverItem.m_storageId) {
+			return;
+		}
+	}
+
+	bool ret = d_->BeginBatch();
+	if (ret) {
+		sqlite3_stmt* statement = item.m_storageId ? d_->updateFileQuery_ : d_->insertFileQuery_;
+		if (!item.m_storageId) {
+			ret = d_->Bind(statement, file_table_column_names::server, serverItem.m_storageId);
+		}
+		if (item.GetType() == QueueItemType::Folder) {
+			ret = ret && d_->BindDirectory(statement, static_cast<CFolderItem&>(item));
+		}
+		else {
+			ret = ret && d_->BindFile(statement, item);
+		}
+		if (item.m_storageId) {
+			ret = ret && d_->Bind(statement, sqlite3_bind_parameter_index(statement, ":id"), item.m_storageId);
+		}
+		ret = ret && d_->Step(statement);
+		if (ret && !item.m_storageId) {
+			item.m_storageId = sqlite3_last_insert_rowid(d_->db_);
+		}
+	}
+	d_->Journaled(ret);
+}
+
+void CQueueStorage::StoreChildren(CServerItem & item, bool unstoredOnly)
+{
+	if (!d_->journal_) {
+		return;
+	}
+
+	auto const& children = item.GetChildren();
+	for (auto it = children.begin() + item.GetRemovedAtFront(); it != children.end(); ++it) {
+		CQueueItem & child = **it;
+		if (unstoredOnly && child.m_storageId) {
+			continue;
+		}
+		if (child.GetType() == QueueItemType::File || child.GetType() == QueueItemType::Folder) {
+			StoreItem(static_cast<CFileItem&>(child));
+		}
+	}
+}
+
+void CQueueStorage::RemoveItem(CFileItem & item)
+{
+	if (!d_->journal_ || !item.m_storageId) {
+		return;
+	}
+
+	bool ret = d_->BeginBatch() &&
+		d_->Bind(d_->deleteFileQuery_, 1, item.m_storageId) &&
+		d_->Step(d_->deleteFileQuery_);
+	item.m_storageId = 0;
+	d_->Journaled(ret);
+}
+
+void CQueueStorage::RemoveServer(int64_t id)
+{
+	if (!d_->journal_ || id <= 0) {
+		return;
+	}
+
+	bool ret = d_->BeginBatch() &&
+		d_->Bind(d_->deleteServerFilesQuery_, 1, id) &&
+		d_->Step(d_->deleteServerFilesQuery_) &&
+		d_->Bind(d_->deleteServerQuery_, 1, id) &&
+		d_->Step(d_->deleteServerQuery_);
+	d_->Journaled(ret);
+}
+
+bool CQueueStorage::Flush()
+{
+	return d_->CommitBatch();
+}
+
 bool CQueueStorage::Vacuum()
 {
 	return sqlite3_exec(d_->db_, "VACUUM", 0, 0, 0) == SQLITE_OK;
@@ -1,12 +1,15 @@
 #ifndef FILEZILLA_INTERFACE_QUEUE_STORAGE_HEADER
 #define FILEZILLA_INTERFACE_QUEUE_STORAGE_HEADER
 
+#include <utility>
 #include <vector>
 
 class CFileItem;
 class CServerItem;
 class Site;
 
+enum class QueuePriority : unsigned char;
+
 class CQueueStorage final
 {
 	class Impl;
@@ -28,8 +31,40 @@ public:
 
 	bool Vacuum();
 
+	// Writes the queue. If journaling, only commits the pending changes
+	// unless one of them could not be written. Stops the journal.
 	bool SaveQueue(std::vector<CServerItem*> const& queue);
 
+	// Write-behind persistence: once started, changes to the queue are
+	// written as they are made, in batched transactions. The database
+	// then stays current and needs no rewrite on exit.
+	//
+	// Start the journal once the items loaded from the database carry
+	// the ids of their rows.
+	void StartJournal();
+	bool Journaling() const;
+
+	// Writes a new server or file item or updates its row
+	void StoreServer(CServerItem & item);
+	void StoreItem(CFileItem & item);
+	void StoreChildren(CServerItem & item, bool unstoredOnly = false);
+
+	void RemoveItem(CFileItem & item);
+
+	// Also removes the files referring to the server
+	void RemoveServer(int64_t id);
+
+	// Removes the files of the server row with an id larger than after
+	void RemoveFiles(int64_t server, int64_t after);
+
+	// Same selection of files, sets the priority or the default action
+	// for existing files of those in the given direction
+	void SetFilesPriority(int64_t server, int64_t after, QueuePriority priority);
+	void SetFilesExistsAction(int64_t server, int64_t after, CFileExistsNotification::OverwriteAction action, bool download);
+
+	// Commits the journaled changes
+	bool Flush();
+
 	// > 0 = server id
 	//   0 = No server
 	// < 0 = failure.
@@ -37,6 +72,12 @@ public:
 
 	int64_t GetFile(CFileItem** pItem, int64_t server);
 
+	// Reads the next up to limit files of the server row, those with an
+	// id larger than after. Updates after to the last row read. Returns
+	// the number of rows read, including invalid ones that got skipped,
+	// or -1 on failure.
+	int GetFiles(std::vector<std::pair<int64_t, CFileItem*>> & files, int64_t server, int64_t & after, int limit);
+
 	static std::wstring GetDatabaseFilename();
 
 private:
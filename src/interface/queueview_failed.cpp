@@ -2,9 +2,12 @@
 #include "queue.h"
 #include "queueview_failed.h"
 #include "edithandler.h"
+#include "Options.h"
 
 #include <wx/menu.h>
 
+#include <map>
+
 BEGIN_EVENT_TABLE(CQueueViewFailed, CQueueViewBase)
 EVT_CONTEXT_MENU(CQueueViewFailed::OnContextMenu)
 EVT_MENU(XRCID("ID_REMOVEALL"), CQueueViewFailed::OnRemoveAll)
@@ -26,6 +29,42 @@ CQueueViewFailed::CQueueViewFailed(CQueue* parent, int index, const wxString& ti
 {
 }
 
+void CQueueViewFailed::LimitHistory()
+{
+	int const limit = COptions::Get()->GetOptionVal(OPTION_FINISHED_TRANSFERS_LIMIT);
+	if (!limit || m_fileCount <= limit) {
+		return;
+	}
+
+	int remove = m_fileCount - limit;
+	while (remove > 0) {
+		// Each server item has its files in the order they finished
+		CQueueItem* oldest{};
+		for (auto * pServerItem : m_serverList) {
+			for (unsigned int i = 0; i < pServerItem->GetChildrenCount(false); ++i) {
+				CQueueItem* pItem = pServerItem->GetChild(i, false);
+				// Files still known to the edit handler get removed along with it
+				if (pItem->GetType() == QueueItemType::File && static_cast<CFileItem*>(pItem)->m_edit != CEditHandler::none) {
+					continue;
+				}
+				if (!oldest || pItem->GetTime() < oldest->GetTime()) {
+					oldest = pItem;
+				}
+				break;
+			}
+		}
+		if (!oldest) {
+			break;
+		}
+		RemoveItem(oldest, true, false, false);
+		--remove;
+	}
+
+	DisplayNumberQueuedFiles();
+	SaveSetItemCount(m_itemCount);
+	RefreshListOnly();
+}
+
 void CQueueViewFailed::OnContextMenu(wxContextMenuEvent&)
 {
 	wxMenu menu;
@@ -112,12 +151,19 @@ void CQueueViewFailed::OnRemoveSelected(wxCommandEvent&)
 
 	CEditHandler* pEditHandler = CEditHandler::Get();
 
+	// Selected servers take their files with them
+	std::unordered_set<CQueueItem*> removed;
+	std::vector<CQueueItem*> items;
+	auto add = [&](CQueueItem* pItem) {
+		if (removed.insert(pItem).second) {
+			items.push_back(pItem);
+		}
+	};
+
 	while (!selectedItems.empty()) {
 		CQueueItem* pItem = selectedItems.front();
 		selectedItems.pop_front();
 
-		CQueueItem* pTopLevelItem = pItem->GetTopLevelItem();
-
 		if (pItem->GetType() == QueueItemType::Server) {
 			CServerItem* pServerItem = (CServerItem*)pItem;
 			if (pEditHandler && pEditHandler->GetFileCount(CEditHandler::remote, CEditHandler::upload_and_remove_failed, pServerItem->GetSite())) {
@@ -144,18 +190,18 @@ void CQueueViewFailed::OnRemoveSelected(wxCommandEvent&)
 			}
 		}
 
-		if (!pTopLevelItem->GetChild(1)) {
-			// Parent will get deleted
-			// If next selected item is parent, remove it from list
-			if (!selectedItems.empty() && selectedItems.front() == pTopLevelItem) {
-				selectedItems.pop_front();
+		if (pItem->GetType() == QueueItemType::Server) {
+			CServerItem* pServerItem = static_cast<CServerItem*>(pItem);
+			auto const& children = pServerItem->GetChildren();
+			for (auto it = children.begin() + pServerItem->GetRemovedAtFront(); it != children.end(); ++it) {
+				add(*it);
 			}
 		}
-		RemoveItem(pItem, true, false, false);
+		else {
+			add(pItem);
+		}
 	}
-	DisplayNumberQueuedFiles();
-	SaveSetItemCount(m_itemCount);
-	RefreshListOnly();
+	RemoveItems(items, true);
 
 	if (!m_itemCount && m_pQueue->GetQueueView()->GetItemCount()) {
 		m_pQueue->SetSelection(0);
@@ -283,27 +329,40 @@ void CQueueViewFailed::OnRequeueSelected(wxCommandEvent&)
 
 	CQueueView* pQueueView = m_pQueue->GetQueueView();
 
-	while (!selectedItems.empty()) {
-		CQueueItem* pItem = selectedItems.front();
-		selectedItems.pop_front();
-
+	// Individually selected files are taken out of this list all at once,
+	// grouped by their server.
+	std::vector<CQueueItem*> files;
+	std::vector<std::pair<Site, std::vector<CFileItem*>>> groups;
+	std::map<CQueueItem*, size_t> groupIndex;
+	for (auto * pItem : selectedItems) {
 		if (pItem->GetType() == QueueItemType::Server) {
-			CServerItem* pServerItem = (CServerItem*)pItem;
-			failedToRequeueAll |= !RequeueServerItem(pServerItem);
+			continue;
 		}
-		else {
-			CFileItem* pFileItem = (CFileItem*)pItem;
-
-			CServerItem* pOldServerItem = (CServerItem*)pItem->GetTopLevelItem();
-			CServerItem* pServerItem = pQueueView->CreateServerItem(pOldServerItem->GetSite());
-			RemoveItem(pItem, false, false, false);
+		CQueueItem* pOldServerItem = pItem->GetTopLevelItem();
+		auto it = groupIndex.find(pOldServerItem);
+		if (it == groupIndex.end()) {
+			it = groupIndex.emplace(pOldServerItem, groups.size()).first;
+			groups.emplace_back(static_cast<CServerItem*>(pOldServerItem)->GetSite(), std::vector<CFileItem*>());
+		}
+		groups[it->second].second.push_back(static_cast<CFileItem*>(pItem));
+		files.push_back(pItem);
+	}
+	RemoveItems(files, false);
 
+	for (auto const& group : groups) {
+		CServerItem* pServerItem = pQueueView->CreateServerItem(group.first);
+		for (auto * pFileItem : group.second) {
 			failedToRequeueAll |= !RequeueFileItem(pFileItem, pServerItem);
+		}
+		pQueueView->CommitChanges();
+		if (!pServerItem->GetChildrenCount(false)) {
+			pQueueView->RemoveItem(pServerItem, true, true, true);
+		}
+	}
 
-			if (!pServerItem->GetChildrenCount(false)) {
-				pQueueView->CommitChanges();
-				pQueueView->RemoveItem(pServerItem, true, true, true);
-			}
+	for (auto * pItem : selectedItems) {
+		if (pItem->GetType() == QueueItemType::Server) {
+			failedToRequeueAll |= !RequeueServerItem(static_cast<CServerItem*>(pItem));
 		}
 	}
 	m_fileCountChanged = true;
@@ -7,6 +7,10 @@ public:
 	CQueueViewFailed(CQueue* parent, int index);
 	CQueueViewFailed(CQueue* parent, int index, const wxString& title);
 
+	// Drops the oldest files once there are more than OPTION_FINISHED_TRANSFERS_LIMIT.
+	// Call after inserting finished transfers.
+	void LimitHistory();
+
 protected:
 
 	bool RequeueFileItem(CFileItem* pItem, CServerItem* pServerItem);
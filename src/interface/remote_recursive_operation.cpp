@@ -3,12 +3,82 @@
 #include "commandqueue.h"
 #include "chmoddialog.h"
 #include "filter.h"
+#include "local_dir_enumerator.h"
 #include "Options.h"
 #include "queue.h"
 
+#include <libfilezilla/file.hpp>
 #include <libfilezilla/local_filesys.hpp>
 #include <libfilezilla/recursive_remove.hpp>
 
+namespace {
+// Directories to visit kept in memory before the ones furthest from the
+// front get written to a temporary file, and how many are written at once
+size_t const max_frontier_entries = 100000;
+size_t const frontier_chunk = 50000;
+
+enum frontier_flags
+{
+	has_restrict = 0x01,
+	do_visit = 0x02,
+	recurse = 0x04,
+	second_try = 0x08,
+
+	// Interning, consecutive entries mostly are siblings
+	same_parent = 0x10,
+	same_start_dir = 0x20
+};
+
+void append_le(std::string & out, uint64_t v, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+void append_string(std::string & out, std::wstring const& s)
+{
+	std::string const utf8 = fz::to_utf8(s);
+	append_le(out, utf8.size(), 4);
+	out += utf8;
+}
+
+class reader final
+{
+public:
+	explicit reader(std::string const& data)
+		: p_(data.data()), end_(data.data() + data.size())
+	{}
+
+	bool read(uint64_t & v, size_t bytes)
+	{
+		if (static_cast<size_t>(end_ - p_) < bytes) {
+			return false;
+		}
+		v = 0;
+		for (size_t i = 0; i < bytes; ++i) {
+			v |= static_cast<uint64_t>(static_cast<unsigned char>(*p_++)) << (i * 8);
+		}
+		return true;
+	}
+
+	bool read(std::wstring & s)
+	{
+		uint64_t len;
+		if (!read(len, 4) || static_cast<uint64_t>(end_ - p_) < len) {
+			return false;
+		}
+		s = fz::to_wstring_from_utf8(std::string(p_, static_cast<size_t>(len)));
+		p_ += len;
+		return true;
+	}
+
+private:
+	char const* p_;
+	char const* const end_;
+};
+}
+
 recursion_root::recursion_root(CServerPath const& start_dir, bool allow_parent)
 	: m_remoteStartDir(start_dir)
 	, m_allowParent(allow_parent)
@@ -38,6 +108,217 @@ void recursion_root::add_dir_to_visit_restricted(CServerPath const& path, std::w
 	m_dirsToVisit.push_back(dirToVisit);
 }
 
+recursion_root::frontier::frontier(frontier && op)
+	: head_(std::move(op.head_))
+	, chunks_(std::move(op.chunks_))
+	, spilled_(op.spilled_)
+	, fileSize_(op.fileSize_)
+	, tail_(std::move(op.tail_))
+	, file_(std::move(op.file_))
+	, spillFailed_(op.spillFailed_)
+	, lost_(op.lost_)
+{
+	op.chunks_.clear();
+	op.spilled_ = 0;
+	op.file_.clear();
+}
+
+recursion_root::frontier::~frontier()
+{
+	if (!file_.empty()) {
+		fz::remove_file(fz::to_native(file_));
+	}
+}
+
+void recursion_root::frontier::pop_front()
+{
+	head_.pop_front();
+
+	// Keeps head_ only empty if everything is
+	while (head_.empty() && !chunks_.empty()) {
+		Load();
+	}
+	if (head_.empty()) {
+		head_.swap(tail_);
+	}
+}
+
+void recursion_root::frontier::push_front(new_dir const& dir)
+{
+	head_.push_front(dir);
+	if (head_.size() > max_frontier_entries) {
+		Spill();
+	}
+}
+
+void recursion_root::frontier::push_back(new_dir const& dir)
+{
+	if (!chunks_.empty()) {
+		tail_.push_back(dir);
+		return;
+	}
+
+	head_.push_back(dir);
+	if (head_.size() > max_frontier_entries) {
+		Spill();
+	}
+}
+
+void recursion_root::frontier::Spill()
+{
+	if (spillFailed_) {
+		return;
+	}
+
+	if (file_.empty()) {
+		wxString const prefix = wxFileName::GetTempDir() + wxFileName::GetPathSeparator() + _T("fzdirs");
+		file_ = wxFileName::CreateTempFileName(prefix).ToStdWstring();
+		if (file_.empty()) {
+			spillFailed_ = true;
+			return;
+		}
+	}
+
+	size_t const count = std::min(frontier_chunk, head_.size() - 1);
+	auto const begin = head_.end() - count;
+
+	std::string out;
+	CServerPath const* parent{};
+	CServerPath const* startDir{};
+	for (auto it = begin; it != head_.end(); ++it) {
+		new_dir const& dir = *it;
+
+		unsigned int flags{};
+		if (dir.restrict) {
+			flags |= has_restrict;
+		}
+		if (dir.doVisit) {
+			flags |= do_visit;
+		}
+		if (dir.recurse) {
+			flags |= recurse;
+		}
+		if (dir.second_try) {
+			flags |= second_try;
+		}
+		if (parent && *parent == dir.parent) {
+			flags |= same_parent;
+		}
+		if (startDir && *startDir == dir.start_dir) {
+			flags |= same_start_dir;
+		}
+		append_le(out, flags, 1);
+		append_le(out, static_cast<uint64_t>(dir.link), 1);
+
+		if (!(flags & same_parent)) {
+			append_string(out, dir.parent.GetSafePath());
+		}
+		append_string(out, dir.subdir);
+		append_string(out, dir.localDir.GetPath());
+		if (dir.restrict) {
+			append_string(out, *dir.restrict);
+		}
+		if (!(flags & same_start_dir)) {
+			append_string(out, dir.start_dir.GetSafePath());
+		}
+
+		parent = &dir.parent;
+		startDir = &dir.start_dir;
+	}
+
+	int64_t const size = static_cast<int64_t>(out.size());
+	fz::file f(fz::to_native(file_), fz::file::writing, fz::file::existing);
+	if (!f.opened() || f.seek(fileSize_, fz::file::begin) != fileSize_ || f.write(out.data(), size) != size) {
+		// Everything stays in memory
+		spillFailed_ = true;
+		return;
+	}
+
+	chunks_.push_back({fileSize_, count});
+	fileSize_ += size;
+	spilled_ += count;
+	head_.erase(begin, head_.end());
+}
+
+bool recursion_root::frontier::Load()
+{
+	chunk const c = chunks_.back();
+	chunks_.pop_back();
+	spilled_ -= c.count;
+
+	int64_t const size = fileSize_ - c.offset;
+	std::string data;
+	bool ok{};
+	{
+		fz::file f(fz::to_native(file_), fz::file::reading);
+		if (f.opened() && f.seek(c.offset, fz::file::begin) == c.offset) {
+			data.resize(static_cast<size_t>(size));
+			ok = f.read(&data[0], size) == size;
+		}
+	}
+
+	// The chunk is always the last one in the file
+	{
+		fz::file f(fz::to_native(file_), fz::file::writing, fz::file::existing);
+		if (f.opened() && f.seek(c.offset, fz::file::begin) == c.offset) {
+			f.truncate();
+		}
+	}
+	fileSize_ = c.offset;
+
+	reader r(data);
+	CServerPath parent;
+	CServerPath startDir;
+	for (size_t i = 0; i < c.count && ok; ++i) {
+		uint64_t flags{};
+		uint64_t link{};
+		std::wstring s;
+		new_dir dir;
+
+		ok = r.read(flags, 1) && r.read(link, 1);
+		if (ok && !(flags & same_parent)) {
+			ok = r.read(s);
+			parent = CServerPath();
+			if (ok && !s.empty()) {
+				parent.SetSafePath(s);
+			}
+		}
+		ok = ok && r.read(dir.subdir) && r.read(s);
+		if (ok && !s.empty()) {
+			dir.localDir.SetPath(s);
+		}
+		if (ok && (flags & has_restrict)) {
+			ok = r.read(s);
+			dir.restrict = fz::sparse_optional<std::wstring>(s);
+		}
+		if (ok && !(flags & same_start_dir)) {
+			ok = r.read(s);
+			startDir = CServerPath();
+			if (ok && !s.empty()) {
+				startDir.SetSafePath(s);
+			}
+		}
+		if (!ok) {
+			break;
+		}
+
+		dir.parent = parent;
+		dir.start_dir = startDir;
+		dir.link = static_cast<int>(link);
+		dir.doVisit = (flags & do_visit) != 0;
+		dir.recurse = (flags & recurse) != 0;
+		dir.second_try = (flags & second_try) != 0;
+		head_.push_back(std::move(dir));
+	}
+
+	if (!ok) {
+		head_.clear();
+		lost_ += c.count;
+		return false;
+	}
+	return true;
+}
+
 CRemoteRecursiveOperation::CRemoteRecursiveOperation(CState &state)
 	: CRecursiveOperation(state)
 {
@@ -47,13 +328,18 @@ CRemoteRecursiveOperation::CRemoteRecursiveOperation(CState &state)
 
 CRemoteRecursiveOperation::~CRemoteRecursiveOperation()
 {
+	{
+		fz::scoped_lock l(mutex_);
+		cancel_ = true;
+	}
+	thread_.join();
 }
 
 void CRemoteRecursiveOperation::OnStateChange(t_statechange_notifications notification, std::wstring const&, const void* data2)
 {
 	if (notification == STATECHANGE_REMOTE_DIR_OTHER && data2) {
 		std::shared_ptr<CDirectoryListing> const& listing = *reinterpret_cast<std::shared_ptr<CDirectoryListing> const*>(data2);
-		ProcessDirectoryListing(listing.get());
+		ProcessDirectoryListing(listing);
 	}
 	else if (notification == STATECHANGE_REMOTE_LINKNOTDIR) {
 		wxASSERT(data2);
@@ -111,24 +397,49 @@ bool CRemoteRecursiveOperation::NextOperation()
 		return false;
 	}
 
+	if (processing_) {
+		// Continued once the subdirectories of the current listing are known
+		return true;
+	}
+
 	while (!recursion_roots_.empty()) {
 		auto & root = recursion_roots_.front();
 		while (!root.m_dirsToVisit.empty()) {
 			const recursion_root::new_dir& dirToVisit = root.m_dirsToVisit.front();
 			if (m_operationMode == recursive_delete && !dirToVisit.doVisit) {
+				CServerPath path = dirToVisit.parent;
+				if (!path.AddSegment(dirToVisit.subdir) || DeletesPendingBelow(path)) {
+					// Continued in ParallelDeleteFinished
+					waitingForEngines_ = true;
+					return true;
+				}
 				m_state.m_pCommandQueue->ProcessCommand(new CRemoveDirCommand(dirToVisit.parent, dirToVisit.subdir), CCommandQueue::recursiveOperation);
 				root.m_dirsToVisit.pop_front();
 				continue;
 			}
 
-			CListCommand* cmd = new CListCommand(dirToVisit.parent, dirToVisit.subdir, dirToVisit.link ? LIST_FLAG_LINK : 0);
+			CListCommand* cmd = new CListCommand(dirToVisit.parent, dirToVisit.subdir, LIST_FLAG_TREE | (dirToVisit.link ? LIST_FLAG_LINK : 0));
 			m_state.m_pCommandQueue->ProcessCommand(cmd, CCommandQueue::recursiveOperation);
+			PrefetchListings(root);
 			return true;
 		}
 
+		lostDirectories_ += root.m_dirsToVisit.lost();
 		recursion_roots_.pop_front();
 	}
 
+	if (!parallelDeletes_.empty() || !parallelChmods_.empty()) {
+		// Refresh only once the queue engines are done
+		waitingForEngines_ = true;
+		return true;
+	}
+
+	if (lostDirectories_) {
+		int const lost = static_cast<int>(lostDirectories_);
+		lostDirectories_ = 0;
+		wxMessageBoxEx(wxString::Format(wxPLURAL("%d directory could not be read back from a temporary file and was skipped.", "%d directories could not be read back from a temporary file and were skipped.", lost), lost), _("Error"), wxICON_EXCLAMATION);
+	}
+
 	if (m_operationMode == recursive_delete && !m_finalDir.empty()) {
 		// After a deletion we cannot refresh if inside the deleted directories. Navigate user out if it
 		auto curPath = m_state.GetRemotePath();
@@ -144,6 +455,124 @@ bool CRemoteRecursiveOperation::NextOperation()
 	return false;
 }
 
+void CRemoteRecursiveOperation::PrefetchListings(recursion_root & root)
+{
+	int const maxEngines = static_cast<int>(COptions::Get()->GetOptionVal(OPTION_PARALLEL_LISTINGS));
+	if (maxEngines <= 0 || !m_pQueue) {
+		return;
+	}
+
+	Site const& site = m_state.GetSite();
+	if (!site) {
+		return;
+	}
+
+	// Directories get visited in the order of m_dirsToVisit. Listing the
+	// ones coming up next ahead of time leaves that order untouched, the
+	// main engine simply finds them in the cache.
+	size_t const lookahead = std::min(root.m_dirsToVisit.buffered(), static_cast<size_t>(maxEngines) * 2 + 1);
+	for (size_t i = 1; i < lookahead; ++i) {
+		auto const& dir = root.m_dirsToVisit[i];
+		if (!dir.doVisit || dir.link || dir.subdir.empty()) {
+			continue;
+		}
+		if (!prefetched_.emplace(dir.parent, dir.subdir).second) {
+			continue;
+		}
+		if (!m_pQueue->PrefetchListing(site, dir.parent, dir.subdir, maxEngines)) {
+			prefetched_.erase(std::make_pair(dir.parent, dir.subdir));
+			break;
+		}
+	}
+}
+
+void CRemoteRecursiveOperation::Delete(CServerPath const& path, std::vector<std::wstring> && files)
+{
+	int const maxEngines = static_cast<int>(COptions::Get()->GetOptionVal(OPTION_PARALLEL_DELETES));
+	if (maxEngines > 0 && m_pQueue) {
+		Site const& site = m_state.GetSite();
+		if (site && m_pQueue->DeleteOnIdleEngine(*this, site, path, files, maxEngines)) {
+			parallelDeletes_.insert(path);
+			return;
+		}
+	}
+
+	m_state.m_pCommandQueue->ProcessCommand(new CDeleteCommand(path, std::move(files)), CCommandQueue::recursiveOperation);
+}
+
+bool CRemoteRecursiveOperation::DeletesPendingBelow(CServerPath const& path) const
+{
+	for (auto const& deletePath : parallelDeletes_) {
+		if (deletePath == path || deletePath.IsSubdirOf(path, false)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void CRemoteRecursiveOperation::ParallelDeleteFinished(CServerPath const& path, std::vector<std::wstring> && files, int replyCode)
+{
+	auto it = parallelDeletes_.find(path);
+	if (it == parallelDeletes_.end()) {
+		// Operation got stopped in the meantime
+		return;
+	}
+	parallelDeletes_.erase(it);
+
+	if (m_operationMode != recursive_delete) {
+		return;
+	}
+
+	// The queue engine got interrupted, e.g. by the queue getting stopped
+	// or by losing its connection. Other failures would only repeat.
+	if ((replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED || (replyCode & FZ_REPLY_DISCONNECTED)) {
+		m_state.m_pCommandQueue->ProcessCommand(new CDeleteCommand(path, std::move(files)), CCommandQueue::recursiveOperation);
+	}
+
+	if (waitingForEngines_) {
+		waitingForEngines_ = false;
+		NextOperation();
+	}
+}
+
+void CRemoteRecursiveOperation::Chmod(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files)
+{
+	int const maxEngines = static_cast<int>(COptions::Get()->GetOptionVal(OPTION_PARALLEL_CHMODS));
+	if (maxEngines > 0 && m_pQueue) {
+		Site const& site = m_state.GetSite();
+		if (site && m_pQueue->ChmodOnIdleEngine(*this, site, path, files, maxEngines)) {
+			parallelChmods_.insert(path);
+			return;
+		}
+	}
+
+	m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(path, std::move(files)), CCommandQueue::recursiveOperation);
+}
+
+void CRemoteRecursiveOperation::ParallelChmodFinished(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files, int replyCode)
+{
+	auto it = parallelChmods_.find(path);
+	if (it == parallelChmods_.end()) {
+		// Operation got stopped in the meantime
+		return;
+	}
+	parallelChmods_.erase(it);
+
+	if (m_operationMode != recursive_chmod) {
+		return;
+	}
+
+	// As with deletes, only retry if the queue engine got interrupted
+	if ((replyCode & FZ_REPLY_CANCELED) == FZ_REPLY_CANCELED || (replyCode & FZ_REPLY_DISCONNECTED)) {
+		m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(path, std::move(files)), CCommandQueue::recursiveOperation);
+	}
+
+	if (waitingForEngines_) {
+		waitingForEngines_ = false;
+		NextOperation();
+	}
+}
+
 bool CRemoteRecursiveOperation::BelowRecursionRoot(const CServerPath& path, recursion_root::new_dir &dir)
 {
 	if (!dir.start_dir.empty()) {
@@ -177,14 +606,14 @@ bool CRemoteRecursiveOperation::BelowRecursionRoot(const CServerPath& path, recu
 // Defined in RemoteListView.cpp
 std::wstring StripVMSRevision(std::wstring const& name);
 
-void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing* pDirectoryListing)
+void CRemoteRecursiveOperation::ProcessDirectoryListing(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
 {
 	if (!pDirectoryListing) {
 		StopRecursiveOperation();
 		return;
 	}
 
-	if (m_operationMode == recursive_none || recursion_roots_.empty()) {
+	if (m_operationMode == recursive_none || recursion_roots_.empty() || processing_) {
 		return;
 	}
 
@@ -248,33 +677,49 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 		}
 	}
 
-	CFilterManager filter;
+	processing_ = true;
+
+	OperationMode const mode = m_operationMode;
+	bool const stripVMSRevision = pDirectoryListing->path.GetType() == VMS && COptions::Get()->GetOptionVal(OPTION_STRIP_VMS_REVISION);
+	thread_ = m_state.pool_.spawn([this, pDirectoryListing, dir, mode, stripVMSRevision] { entry(pDirectoryListing, dir, mode, stripVMSRevision); });
+	if (!thread_) {
+		entry(pDirectoryListing, dir, mode, stripVMSRevision);
+	}
+}
+
+void CRemoteRecursiveOperation::entry(std::shared_ptr<CDirectoryListing> const& pDirectoryListing, recursion_root::new_dir const& dir, OperationMode mode, bool stripVMSRevision)
+{
+	CCompiledFilters const localFilters(m_filters.first);
+	CCompiledFilters const remoteFilters(m_filters.second);
 
 	// Is operation restricted to a single child?
 	bool const restrict = static_cast<bool>(dir.restrict);
 
-	std::vector<std::wstring> filesToDelete;
-
 	std::wstring const remotePath = pDirectoryListing->path.GetPath();
 
-	if (m_operationMode == recursive_synchronize_download && !dir.localDir.empty()) {
+	if (mode == recursive_synchronize_download && !dir.localDir.empty()) {
 		// Step one in synchronization: Delete local files not on the server
-		fz::local_filesys fs;
-		if (fs.begin_find_files(fz::to_native(dir.localDir.GetPath()))) {
+		CLocalDirEnumerator fs;
+		bool const fileDetails = localFilters.NeedsDetails(false);
+		bool const dirDetails = localFilters.NeedsDetails(true);
+		if (fs.begin(fz::to_native(dir.localDir.GetPath()))) {
 			std::list<fz::native_string> paths_to_delete;
 
 			bool isLink{};
 			fz::native_string name;
 			fz::local_filesys::type t{};
-			int64_t size{};
-			fz::datetime time;
-			int attributes{};
-			while (fs.get_next_file(name, isLink, t, &size, &time, &attributes)) {
+			while (fs.next(name, isLink, t)) {
 				if (isLink) {
 					continue;
 				}
+				int64_t size{-1};
+				fz::datetime time;
+				int attributes{};
+				if (t == fz::local_filesys::dir ? dirDetails : fileDetails) {
+					fs.details(&size, &time, &attributes);
+				}
 				auto const wname = fz::to_wstring(name);
-				if (filter.FilenameFiltered(m_filters.first, wname, dir.localDir.GetPath(), t == fz::local_filesys::dir, size, attributes, time)) {
+				if (localFilters.FilenameFiltered(wname, dir.localDir.GetPath(), t == fz::local_filesys::dir, size, attributes, time)) {
 					continue;
 				}
 
@@ -283,7 +728,7 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 				size_t remoteIndex = pDirectoryListing->FindFile_CmpCase(fz::to_wstring(name));
 				if (remoteIndex != std::string::npos) {
 					CDirentry const& entry = (*pDirectoryListing)[remoteIndex];
-					if (!filter.FilenameFiltered(m_filters.second, entry.name, remotePath, entry.is_dir(), entry.size, 0, entry.time)) {
+					if (!remoteFilters.FilenameFiltered(entry.name, remotePath, entry.is_dir(), entry.size, 0, entry.time)) {
 						// Both local and remote items exist
 
 						if ((t == fz::local_filesys::dir) == entry.is_dir() || entry.is_link()) {
@@ -302,7 +747,12 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 		}
 	}
 
-	bool added = false;
+	processed_listing d;
+	d.directoryListing = pDirectoryListing;
+	d.files.localPath = dir.localDir;
+	d.files.remotePath = pDirectoryListing->path;
+
+	std::vector<recursion_root::new_dir> dirs;
 
 	for (size_t i = pDirectoryListing->size(); i > 0; --i) {
 		const CDirentry& entry = (*pDirectoryListing)[i - 1];
@@ -312,15 +762,15 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 				continue;
 			}
 		}
-		else if (filter.FilenameFiltered(m_filters.second, entry.name, remotePath, entry.is_dir(), entry.size, 0, entry.time)) {
+		else if (remoteFilters.FilenameFiltered(entry.name, remotePath, entry.is_dir(), entry.size, 0, entry.time)) {
 			continue;
 		}
 
 		if (!entry.is_dir()) {
-			++m_processedFiles;
+			++d.processedFiles;
 		}
 
-		if (entry.is_dir() && (!entry.is_link() || m_operationMode != recursive_delete)) {
+		if (entry.is_dir() && (!entry.is_link() || mode != recursive_delete)) {
 			if (dir.recurse) {
 				recursion_root::new_dir dirToVisit;
 				dirToVisit.parent = pDirectoryListing->path;
@@ -328,7 +778,7 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 				dirToVisit.localDir = dir.localDir;
 				dirToVisit.start_dir = dir.start_dir;
 
-				if (m_operationMode == recursive_transfer || m_operationMode == recursive_synchronize_download) {
+				if (mode == recursive_transfer || mode == recursive_synchronize_download) {
 					// Non-flatten case
 					dirToVisit.localDir.AddSegment(CQueueView::ReplaceInvalidCharacters(entry.name));
 				}
@@ -336,58 +786,165 @@ void CRemoteRecursiveOperation::ProcessDirectoryListing(const CDirectoryListing*
 					dirToVisit.link = 1;
 					dirToVisit.recurse = false;
 				}
-				root.m_dirsToVisit.push_front(dirToVisit);
+				dirs.emplace_back(std::move(dirToVisit));
 			}
 		}
 		else {
-			switch (m_operationMode)
+			switch (mode)
 			{
 			case recursive_transfer:
 			case recursive_transfer_flatten:
 			case recursive_synchronize_download:
 				{
+					listing::entry file;
+					file.name = entry.name;
 					std::wstring localFile = CQueueView::ReplaceInvalidCharacters(entry.name);
-					if (pDirectoryListing->path.GetType() == VMS && COptions::Get()->GetOptionVal(OPTION_STRIP_VMS_REVISION)) {
+					if (stripVMSRevision) {
 						localFile = StripVMSRevision(localFile);
 					}
-					m_pQueue->QueueFile(!m_immediate, true,
-						entry.name, (entry.name == localFile) ? std::wstring() : localFile,
-						dir.localDir, pDirectoryListing->path, site, entry.size);
-					added = true;
+					if (localFile != entry.name) {
+						file.localName = std::move(localFile);
+					}
+					file.size = entry.size;
+					d.files.files.emplace_back(std::move(file));
 				}
 				break;
 			case recursive_delete:
-				filesToDelete.push_back(entry.name);
+				d.filesToDelete.push_back(entry.name);
 				break;
 			default:
 				break;
 			}
 		}
 
+		if (mode == recursive_chmod) {
+			d.chmodEntries.push_back(i - 1);
+		}
+
+		// If having prepared 5k items, hand off to main thread.
+		if (d.files.files.size() + d.filesToDelete.size() + d.chmodEntries.size() >= 5000) {
+			processed_listing next;
+			next.directoryListing = d.directoryListing;
+			next.files.localPath = d.files.localPath;
+			next.files.remotePath = d.files.remotePath;
+
+			fz::scoped_lock l(mutex_);
+			if (cancel_) {
+				return;
+			}
+			EnqueueProcessedListing(l, std::move(d));
+			d = std::move(next);
+		}
+	}
+
+	d.dirs = std::move(dirs);
+	d.last = true;
+
+	fz::scoped_lock l(mutex_);
+	if (!cancel_) {
+		EnqueueProcessedListing(l, std::move(d));
+	}
+}
+
+void CRemoteRecursiveOperation::EnqueueProcessedListing(fz::scoped_lock& l, processed_listing&& d)
+{
+	processedListings_.emplace_back(std::move(d));
+
+	// Hand off to GUI thread
+	if (processedListings_.size() == 1) {
+		l.unlock();
+		CallAfter(&CRemoteRecursiveOperation::OnProcessedListing);
+		l.lock();
+	}
+}
+
+void CRemoteRecursiveOperation::OnProcessedListing()
+{
+	if (m_operationMode == recursive_none || recursion_roots_.empty() || !processing_) {
+		return;
+	}
+
+	Site const& site = m_state.GetSite();
+	if (!site) {
+		StopRecursiveOperation();
+		return;
+	}
+
+	bool last = false;
+	bool added = false;
+	size_t processed = 0;
+	while (processed < 5000 && !last) {
+		processed_listing d;
+		{
+			fz::scoped_lock l(mutex_);
+			if (processedListings_.empty()) {
+				break;
+			}
+
+			d = std::move(processedListings_.front());
+			processedListings_.pop_front();
+		}
+
+		m_processedFiles += d.processedFiles;
+		processed += d.processedFiles + d.chmodEntries.size();
+
+		if (!d.files.files.empty()) {
+			m_pQueue->QueueFiles(!m_immediate, site, d.files);
+			added = true;
+		}
+
 		if (m_operationMode == recursive_chmod && chmodData_) {
 			const int applyType = chmodData_->GetApplyType();
-			if (!applyType ||
-				(!entry.is_dir() && applyType == 1) ||
-				(entry.is_dir() && applyType == 2))
-			{
-				char permissions[9];
-				bool res = chmodData_->ConvertPermissions(*entry.permissions, permissions);
-				std::wstring newPerms = chmodData_->GetPermissions(res ? permissions : 0, entry.is_dir());
-				m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(pDirectoryListing->path, entry.name, newPerms), CCommandQueue::recursiveOperation);
+			std::vector<std::pair<std::wstring, std::wstring>> files;
+			std::vector<std::pair<std::wstring, std::wstring>> dirs;
+			for (size_t i : d.chmodEntries) {
+				CDirentry const& entry = (*d.directoryListing)[i];
+				if (!applyType ||
+					(!entry.is_dir() && applyType == 1) ||
+					(entry.is_dir() && applyType == 2))
+				{
+					char permissions[9];
+					bool res = chmodData_->ConvertPermissions(*entry.permissions, permissions);
+					std::wstring newPerms = chmodData_->GetPermissions(res ? permissions : 0, entry.is_dir());
+					(entry.is_dir() ? dirs : files).emplace_back(entry.name, std::move(newPerms));
+				}
+			}
+
+			// Directories stay on the primary engine, ahead of listing them
+			if (!dirs.empty()) {
+				m_state.m_pCommandQueue->ProcessCommand(new CChmodCommand(d.directoryListing->path, std::move(dirs)), CCommandQueue::recursiveOperation);
 			}
+			if (!files.empty()) {
+				Chmod(d.directoryListing->path, std::move(files));
+			}
+		}
+
+		if (m_operationMode == recursive_delete && !d.filesToDelete.empty()) {
+			Delete(d.directoryListing->path, std::move(d.filesToDelete));
+		}
+
+		if (d.last) {
+			auto & root = recursion_roots_.front();
+			for (auto & dirToVisit : d.dirs) {
+				root.m_dirsToVisit.push_front(std::move(dirToVisit));
+			}
+			last = true;
 		}
 	}
 	if (added) {
 		m_pQueue->QueueFile_Finish(m_immediate);
 	}
 
-	if (m_operationMode == recursive_delete && !filesToDelete.empty()) {
-		m_state.m_pCommandQueue->ProcessCommand(new CDeleteCommand(pDirectoryListing->path, std::move(filesToDelete)), CCommandQueue::recursiveOperation);
-	}
-
 	m_state.NotifyHandlers(STATECHANGE_REMOTE_RECURSION_STATUS);
 
-	NextOperation();
+	if (last) {
+		thread_.join();
+		processing_ = false;
+		NextOperation();
+	}
+	else if (processed >= 5000) {
+		CallAfter(&CRemoteRecursiveOperation::OnProcessedListing);
+	}
 }
 
 void CRemoteRecursiveOperation::SetChmodData(std::unique_ptr<ChmodData> && chmodData)
@@ -397,12 +954,26 @@ void CRemoteRecursiveOperation::SetChmodData(std::unique_ptr<ChmodData> && chmod
 
 void CRemoteRecursiveOperation::StopRecursiveOperation()
 {
+	{
+		fz::scoped_lock l(mutex_);
+		cancel_ = true;
+	}
+	thread_.join();
+	processedListings_.clear();
+	processing_ = false;
+	cancel_ = false;
+
 	if (m_operationMode != recursive_none) {
 		m_operationMode = recursive_none;
 		m_state.NotifyHandlers(STATECHANGE_REMOTE_IDLE);
 		m_state.NotifyHandlers(STATECHANGE_REMOTE_RECURSION_STATUS);
 	}
 	recursion_roots_.clear();
+	prefetched_.clear();
+	parallelDeletes_.clear();
+	parallelChmods_.clear();
+	waitingForEngines_ = false;
+	lostDirectories_ = 0;
 
 	chmodData_.reset();
 
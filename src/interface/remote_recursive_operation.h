@@ -2,8 +2,10 @@
 #define FILEZILLA_REMOTE_RECURSIVE_OPERATION_HEADER
 
 #include <set>
+#include <vector>
 #include "recursive_operation.h"
 #include <libfilezilla/optional.hpp>
+#include <libfilezilla/thread_pool.hpp>
 
 class ChmodData;
 
@@ -45,15 +47,90 @@ private:
 		bool second_try{};
 	};
 
+	// The directories still to visit, used like a deque. Past a limit, the
+	// entries furthest from the front are written to a temporary file in
+	// chunks. They are read back once everything before them is done, which
+	// keeps memory bounded on huge trees.
+	class frontier final
+	{
+	public:
+		frontier() = default;
+		frontier(frontier && op);
+		~frontier();
+
+		bool empty() const { return head_.empty() && chunks_.empty() && tail_.empty(); }
+		size_t size() const { return head_.size() + spilled_ + tail_.size(); }
+
+		// Reads back from the temporary file if needed, must not be empty
+		new_dir& front();
+
+		void pop_front();
+		void push_front(new_dir const& dir);
+		void push_back(new_dir const& dir);
+
+		// Entries at the front that are in memory, only those can be
+		// accessed by index.
+		size_t buffered() const { return head_.size(); }
+		new_dir const& operator[](size_t i) const { return head_[i]; }
+
+		// Number of directories skipped as the temporary file could not be
+		// read back
+		size_t lost() const { return lost_; }
+
+	private:
+		void Spill();
+		bool Load();
+
+		std::deque<new_dir> head_;
+
+		struct chunk
+		{
+			int64_t offset{};
+			size_t count{};
+		};
+
+		// The last chunk directly follows head_ and is the one at the end
+		// of the file.
+		std::vector<chunk> chunks_;
+		size_t spilled_{};
+		int64_t fileSize_{};
+
+		// Added at the back while entries are in the file
+		std::deque<new_dir> tail_;
+
+		std::wstring file_;
+		bool spillFailed_{};
+		size_t lost_{};
+	};
+
 	CServerPath m_remoteStartDir;
 	std::set<CServerPath> m_visitedDirs;
-	std::deque<new_dir> m_dirsToVisit;
+	frontier m_dirsToVisit;
 	bool m_allowParent{};
 };
 
-class CRemoteRecursiveOperation final : public CRecursiveOperation
+class CRemoteRecursiveOperation final : public CRecursiveOperation, public wxEvtHandler
 {
 public:
+	// Files of a listed directory to be downloaded
+	class listing final
+	{
+	public:
+		class entry final
+		{
+		public:
+			std::wstring name;
+
+			// Empty if the same as the remote name
+			std::wstring localName;
+			int64_t size{};
+		};
+
+		std::vector<entry> files;
+		CLocalPath localPath;
+		CServerPath remotePath;
+	};
+
 	CRemoteRecursiveOperation(CState& state);
 	virtual ~CRemoteRecursiveOperation();
 
@@ -65,12 +142,20 @@ public:
 
 	virtual void StopRecursiveOperation();
 
+	// Called by the queue once a delete it took on is done
+	void ParallelDeleteFinished(CServerPath const& path, std::vector<std::wstring> && files, int replyCode);
+
+	// Likewise for permission changes
+	void ParallelChmodFinished(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files, int replyCode);
+
 protected:
 	void LinkIsNotDir();
 	void ListingFailed(int error);
 
-	// Processes the directory listing in case of a recursive operation
-	void ProcessDirectoryListing(const CDirectoryListing* pDirectoryListing);
+	// Processes the directory listing in case of a recursive operation.
+	// Filtering the entries and preparing the subdirectories and files
+	// happens on a worker thread, the results get handed back in batches.
+	void ProcessDirectoryListing(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
 
 	bool NextOperation();
 
@@ -78,6 +163,54 @@ protected:
 
 	bool BelowRecursionRoot(const CServerPath& path, recursion_root::new_dir &dir);
 
+	// Lists upcoming directories on idle queue engines, see OPTION_PARALLEL_LISTINGS
+	void PrefetchListings(recursion_root & root);
+	std::set<std::pair<CServerPath, std::wstring>> prefetched_;
+
+	// Deletes the files either on an idle queue engine, see
+	// OPTION_PARALLEL_DELETES, or through the command queue.
+	void Delete(CServerPath const& path, std::vector<std::wstring> && files);
+
+	// A directory is only removed once no delete below it is running any
+	// longer on a queue engine.
+	bool DeletesPendingBelow(CServerPath const& path) const;
+	std::multiset<CServerPath> parallelDeletes_;
+
+	// Reported once the operation is done, see recursion_root::frontier
+	size_t lostDirectories_{};
+
+	// Changes the permissions of files, not directories, either on an idle
+	// queue engine, see OPTION_PARALLEL_CHMODS, or through the command queue.
+	// Pairs of filename and permission.
+	void Chmod(CServerPath const& path, std::vector<std::pair<std::wstring, std::wstring>> && files);
+	std::multiset<CServerPath> parallelChmods_;
+
+	// Set while waiting for deletes or permission changes on queue engines
+	bool waitingForEngines_{};
+
+	class processed_listing final
+	{
+	public:
+		std::shared_ptr<CDirectoryListing> directoryListing;
+
+		listing files;
+		std::vector<std::wstring> filesToDelete;
+
+		// Indexes into the directory listing
+		std::vector<size_t> chmodEntries;
+
+		uint64_t processedFiles{};
+
+		// Subdirectories to visit, in the order they are to be put in front
+		// of the directories to visit. Only set in the last batch.
+		std::vector<recursion_root::new_dir> dirs;
+		bool last{};
+	};
+
+	void entry(std::shared_ptr<CDirectoryListing> const& pDirectoryListing, recursion_root::new_dir const& dir, OperationMode mode, bool stripVMSRevision);
+	void EnqueueProcessedListing(fz::scoped_lock& l, processed_listing&& d);
+	void OnProcessedListing();
+
 	std::deque<recursion_root> recursion_roots_;
 
 	CServerPath m_finalDir;
@@ -85,6 +218,16 @@ protected:
 	// Needed for recursive_chmod
 	std::unique_ptr<ChmodData> chmodData_;
 
+	fz::async_task thread_;
+
+	// Set while a listing is being processed by the worker. Only accessed
+	// from the GUI thread.
+	bool processing_{};
+
+	fz::mutex mutex_;
+	std::deque<processed_listing> processedListings_;
+	bool cancel_{};
+
 	friend class CCommandQueue;
 };
 
@@ -21,6 +21,8 @@
 #include <libfilezilla/uri.hpp>
 #include <libfilezilla/translate.hpp>
 
+#include <numeric>
+
 #include <wx/clipbrd.h>
 #include <wx/dirdlg.h>
 #include <wx/menu.h>
@@ -131,13 +133,13 @@ protected:
 private:
 	virtual bool CanStartComparison() { return m_canStartComparison; }
 	virtual void StartComparison() override;
-	virtual bool get_next_file(std::wstring_view& name, std::wstring& path, bool& dir, int64_t& size, fz::datetime& date) override;
+	virtual void GetComparisonEntries(std::vector<entry> & entries) override;
 	virtual void FinishComparison();
 
 	int m_dirIcon;
 
-	bool get_next_file(std::vector<CLocalSearchFileData> const& fileData, const unsigned int index, std::wstring_view& name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date);
-	bool get_next_file(std::vector<CRemoteSearchFileData> const& fileData, const unsigned int index, std::wstring_view& name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date);
+	bool get_comparison_entry(std::vector<CLocalSearchFileData> const& fileData, const unsigned int index, entry & e);
+	bool get_comparison_entry(std::vector<CRemoteSearchFileData> const& fileData, const unsigned int index, entry & e);
 
 	CSearchDialog::search_mode mode_{};
 
@@ -417,7 +419,12 @@ int CSearchDialogFileList::OnGetItemImage(long item) const
 
 	if (mode_ == CSearchDialog::search_mode::local) {
 		auto const& file = localFileData_[index];
-		icon = pThis->GetIconIndex(iconType::file, file.path.GetPath() + file.name, true);
+		bool provisional{};
+		int const fileIcon = pThis->GetIconIndex(iconType::file, file.path.GetPath() + file.name, true, false, &provisional);
+		if (provisional) {
+			return fileIcon;
+		}
+		icon = fileIcon;
 	}
 	else {
 		icon = pThis->GetIconIndex(iconType::file, remoteFileData_[index].name, false);
@@ -459,8 +466,6 @@ void CSearchDialogFileList::StartComparison()
 		m_indexMapping.clear();
 	}
 
-	m_comparisonIndex = -1;
-
 	if (m_fileData.empty() || m_fileData.back().comparison_flags != fill) {
 		CGenericFileData data;
 		data.icon = -1;
@@ -481,7 +486,7 @@ void CSearchDialogFileList::StartComparison()
 	}
 }
 
-bool CSearchDialogFileList::get_next_file(std::vector<CLocalSearchFileData> const& fileData, const unsigned int index, std::wstring_view & name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date)
+bool CSearchDialogFileList::get_comparison_entry(std::vector<CLocalSearchFileData> const& fileData, const unsigned int index, entry & e)
 {
 	if (index >= fileData.size()) {
 		return false;
@@ -489,8 +494,10 @@ bool CSearchDialogFileList::get_next_file(std::vector<CLocalSearchFileData> cons
 
 	auto const& data = fileData[index];
 
-	name = data.name;
-	path.clear();
+	e.name = data.name;
+	e.index = index;
+
+	std::wstring & path = e.path;
 
 	CLocalPath const& rootPath = m_searchDialog->m_local_search_root;
 	CLocalPath dataPath = data.path;
@@ -508,14 +515,14 @@ bool CSearchDialogFileList::get_next_file(std::vector<CLocalSearchFileData> cons
 		path.pop_back();
 	}
 
-	dir = data.is_dir();
-	size = data.size;
-	date = data.time;
+	e.dir = data.is_dir();
+	e.size = data.size;
+	e.date = data.time;
 
 	return true;
 }
 
-bool CSearchDialogFileList::get_next_file(std::vector<CRemoteSearchFileData> const& fileData, const unsigned int index, std::wstring_view& name, std::wstring & path, bool& dir, int64_t& size, fz::datetime& date)
+bool CSearchDialogFileList::get_comparison_entry(std::vector<CRemoteSearchFileData> const& fileData, const unsigned int index, entry & e)
 {
 	if (index >= fileData.size()) {
 		return false;
@@ -523,8 +530,10 @@ bool CSearchDialogFileList::get_next_file(std::vector<CRemoteSearchFileData> con
 
 	auto const& data = fileData[index];
 
-	name = data.name;
-	path.clear();
+	e.name = data.name;
+	e.index = index;
+
+	std::wstring & path = e.path;
 
 	CServerPath const& rootPath = m_searchDialog->m_remote_search_root;
 	CServerPath dataPath = data.path;
@@ -542,25 +551,26 @@ bool CSearchDialogFileList::get_next_file(std::vector<CRemoteSearchFileData> con
 		path.pop_back();
 	}
 
-	dir = data.is_dir();
-	size = data.size;
-	date = data.time;
+	e.dir = data.is_dir();
+	e.size = data.size;
+	e.date = data.time;
 
 	return true;
 }
 
-bool CSearchDialogFileList::get_next_file(std::wstring_view& name, std::wstring& path, bool& dir, int64_t& size, fz::datetime& date)
+void CSearchDialogFileList::GetComparisonEntries(std::vector<entry> & entries)
 {
-	if (++m_comparisonIndex >= (int)m_originalIndexMapping.size()) {
-		return false;
-	}
-	const unsigned int index = m_originalIndexMapping[m_comparisonIndex];
-
-	if (mode_ == CSearchDialog::search_mode::local) {
-		return get_next_file(localFileData_, index, name, path, dir, size, date);
-	}
-	else {
-		return get_next_file(remoteFileData_, index, name, path, dir, size, date);
+	auto const& mapping = m_originalIndexMapping.empty() ? m_indexMapping : m_originalIndexMapping;
+	entries.reserve(entries.size() + mapping.size());
+	for (auto const index : mapping) {
+		entry e;
+		bool const valid = mode_ == CSearchDialog::search_mode::local
+			? get_comparison_entry(localFileData_, index, e)
+			: get_comparison_entry(remoteFileData_, index, e);
+		if (!valid) {
+			break;
+		}
+		entries.emplace_back(std::move(e));
 	}
 }
 
@@ -628,6 +638,7 @@ CSearchDialog::~CSearchDialog()
 	}
 
 	Stop();
+	StopMatching();
 	delete m_pComparisonManager;
 }
 
@@ -846,8 +857,7 @@ void CSearchDialog::OnStateChange(t_statechange_notifications notification, std:
 				}
 			}
 		}
-		searching_ = false;
-		SetCtrlState();
+		TryFinish();
 	}
 	else if (notification == STATECHANGE_LOCAL_RECURSION_LISTING) {
 		if (mode_ != search_mode::remote) {
@@ -868,11 +878,9 @@ void CSearchDialog::OnStateChange(t_statechange_notifications notification, std:
 				if (!m_state.IsRemoteIdle()) {
 					return;
 				}
-				m_pComparisonManager->CompareListings();
 			}
 
-			searching_ = false;
-			SetCtrlState();
+			TryFinish();
 		}
 	}
 }
@@ -892,136 +900,262 @@ void CSearchDialog::ProcessDirectoryListing(std::shared_ptr<CDirectoryListing> c
 		return;
 	}
 
-	CSearchDialogFileList *results = m_results;
-	if (mode_ == search_mode::comparison) {
-		results = m_remoteResults;
-	}
-
-	int old_count = results->m_fileData.size();
-	int added_count = 0;
+	match_job job;
+	job.remote = listing;
+	QueueMatching(std::move(job));
+}
 
-	std::wstring const path = listing->path.GetPath();
+void CSearchDialog::ProcessDirectoryListing(CLocalRecursiveOperation::listing const& listing)
+{
+	if (!searching_ || mode_ == search_mode::remote) {
+		return;
+	}
 
-	bool const has_selections = results->GetSelectedItemCount() != 0;
+	match_job job;
+	job.local = listing;
+	QueueMatching(std::move(job));
+}
 
-	std::vector<int> added_indexes;
-	if (has_selections) {
-		added_indexes.reserve(listing->size());
+void CSearchDialog::QueueMatching(match_job && job)
+{
+	fz::scoped_lock l(mutex_);
+	jobs_.push_back(std::move(job));
+	if (workerRunning_) {
+		return;
 	}
 
-	std::unique_ptr<CFileListCtrlSortBase> compare = results->GetSortComparisonObject();
-	for (size_t i = 0; i < listing->size(); ++i) {
-		CDirentry const& entry = (*listing)[i];
+	task_.join();
+	workerRunning_ = true;
+	uint64_t const generation = generation_;
+	task_ = m_state.pool_.spawn([this, generation]() {
+		fz::scoped_lock lock(mutex_);
+		while (generation == generation_ && !jobs_.empty()) {
+			match_job current = std::move(jobs_.front());
+			jobs_.pop_front();
+			lock.unlock();
 
-		if (!CFilterManager::FilenameFilteredByFilter(m_search_filter, entry.name, path, entry.is_dir(), entry.size, 0, entry.time)) {
-			continue;
+			std::vector<CLocalSearchFileData> local;
+			std::vector<CRemoteSearchFileData> remote;
+			Match(current, local, remote);
+
+			lock.lock();
+			if (generation != generation_) {
+				break;
+			}
+			if (local.empty() && remote.empty()) {
+				continue;
+			}
+			if (localMatches_.empty() && remoteMatches_.empty()) {
+				CallAfter(&CSearchDialog::OnMatches);
+			}
+			localMatches_.insert(localMatches_.end(), std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+			remoteMatches_.insert(remoteMatches_.end(), std::make_move_iterator(remote.begin()), std::make_move_iterator(remote.end()));
+		}
+		workerRunning_ = false;
+		if (generation == generation_) {
+			// Lets a pending finish through even if nothing matched
+			CallAfter(&CSearchDialog::OnMatches);
 		}
+	});
 
-		CRemoteSearchFileData remoteData;
-		static_cast<CDirentry&>(remoteData) = entry;
-		remoteData.path = listing->path;
-		results->remoteFileData_.push_back(remoteData);
+	if (!task_) {
+		workerRunning_ = false;
+		auto jobs = std::move(jobs_);
+		jobs_.clear();
+		for (auto const& pending : jobs) {
+			Match(pending, localMatches_, remoteMatches_);
+		}
+		CallAfter(&CSearchDialog::OnMatches);
+	}
+}
 
-		CGenericFileData data;
-		data.icon = entry.is_dir() ? m_results->m_dirIcon : -2;
-		results->m_fileData.push_back(data);
+void CSearchDialog::Match(match_job const& job, std::vector<CLocalSearchFileData> & local, std::vector<CRemoteSearchFileData> & remote) const
+{
+	if (job.remote) {
+		CDirectoryListing const& listing = *job.remote;
+		std::wstring const path = listing.path.GetPath();
+		for (size_t i = 0; i < listing.size(); ++i) {
+			CDirentry const& entry = listing[i];
+			if (!m_compiledSearchFilter.FilenameFiltered(entry.name, path, entry.is_dir(), entry.size, 0, entry.time)) {
+				continue;
+			}
 
-		auto insertPos = std::lower_bound(results->m_indexMapping.begin(), results->m_indexMapping.end(), old_count + added_count, SortPredicate(compare));
-		int const added_index = insertPos - results->m_indexMapping.begin();
-		results->m_indexMapping.insert(insertPos, old_count + added_count++);
+			auto & remoteData = remote.emplace_back();
+			static_cast<CDirentry&>(remoteData) = entry;
+			remoteData.path = listing.path;
+		}
+	}
+	else {
+		auto const& listing = job.local;
+		std::wstring const path = listing.localPath.GetPath();
 
-		// Remember inserted index
-		if (has_selections) {
-			auto const added_indexes_insert_pos = std::lower_bound(added_indexes.begin(), added_indexes.end(), added_index);
-			for (auto index = added_indexes_insert_pos; index != added_indexes.end(); ++index) {
-				++(*index);
+		auto const& add_entry = [&](CLocalRecursiveOperation::listing::entry const& entry, bool dir) {
+			if (!m_compiledSearchFilter.FilenameFiltered(entry.name, path, dir, entry.size, entry.attributes, entry.time)) {
+				return;
 			}
-			added_indexes.insert(added_indexes_insert_pos, added_index);
-		}
 
-		if (entry.is_dir()) {
-			results->GetFilelistStatusBar()->AddDirectory();
+			auto & localData = local.emplace_back();
+			static_cast<CLocalRecursiveOperation::listing::entry&>(localData) = entry;
+			localData.path = listing.localPath;
+			localData.dir = dir;
+		};
+
+		for (auto const& file : listing.files) {
+			add_entry(file, false);
 		}
-		else {
-			results->GetFilelistStatusBar()->AddFile(entry.size);
+		for (auto const& dir : listing.dirs) {
+			add_entry(dir, true);
 		}
 	}
-
-	if (added_count) {
-		results->SetItemCount(old_count + added_count);
-		results->UpdateSelections_ItemsAdded(added_indexes);
-		results->RefreshListOnly(false);
-	}
 }
 
-void CSearchDialog::ProcessDirectoryListing(CLocalRecursiveOperation::listing const& listing)
+void CSearchDialog::OnMatches()
 {
-	if (!searching_ || mode_ == search_mode::remote) {
-		return;
+	std::vector<CLocalSearchFileData> local;
+	std::vector<CRemoteSearchFileData> remote;
+	{
+		fz::scoped_lock l(mutex_);
+		local = std::move(localMatches_);
+		localMatches_.clear();
+		remote = std::move(remoteMatches_);
+		remoteMatches_.clear();
 	}
 
-	int old_count = m_results->m_fileData.size();
-	int added_count = 0;
+	if (!local.empty()) {
+		for (auto & localData : local) {
+			CGenericFileData data;
+			data.icon = localData.dir ? m_results->m_dirIcon : -2;
+			m_results->m_fileData.push_back(data);
+			m_results->localFileData_.push_back(std::move(localData));
+		}
+		InsertMatches(*m_results, local.size());
+	}
 
-	std::wstring const path = listing.localPath.GetPath();
+	if (!remote.empty()) {
+		CSearchDialogFileList *results = m_results;
+		if (mode_ == search_mode::comparison) {
+			results = m_remoteResults;
+		}
 
-	bool const has_selections = m_results->GetSelectedItemCount() != 0;
+		for (auto & remoteData : remote) {
+			CGenericFileData data;
+			data.icon = remoteData.is_dir() ? m_results->m_dirIcon : -2;
+			results->m_fileData.push_back(data);
+			results->remoteFileData_.push_back(std::move(remoteData));
+		}
+		InsertMatches(*results, remote.size());
+	}
 
-	std::vector<int> added_indexes;
-	if (has_selections) {
-		added_indexes.reserve(listing.files.size() + listing.dirs.size());
+	if (finishPending_ && MatchingIdle()) {
+		TryFinish();
 	}
+}
 
-	std::unique_ptr<CFileListCtrlSortBase> compare = m_results->GetSortComparisonObject();
+void CSearchDialog::InsertMatches(CSearchDialogFileList & results, size_t count)
+{
+	size_t const total = results.m_fileData.size();
 
-	auto const& add_entry = [&](CLocalRecursiveOperation::listing::entry const& entry, bool dir) {
-		if (!CFilterManager::FilenameFilteredByFilter(m_search_filter, entry.name, path, dir, entry.size, entry.attributes, entry.time)) {
-			return;
-		}
+	std::vector<unsigned int> added(count);
+	std::iota(added.begin(), added.end(), static_cast<unsigned int>(total - count));
 
-		CLocalSearchFileData localData;
-		static_cast<CLocalRecursiveOperation::listing::entry&>(localData) = entry;
-		localData.path = listing.localPath;
-		localData.dir = dir;
-		m_results->localFileData_.push_back(localData);
+	// Sort the batch, then merge it into the already sorted results in a
+	// single pass instead of inserting entry by entry.
+	std::unique_ptr<CFileListCtrlSortBase> compare = results.GetSortComparisonObject();
+	SortPredicate pred(compare);
+	std::sort(added.begin(), added.end(), pred);
 
-		CGenericFileData data;
-		data.icon = dir ? m_results->m_dirIcon : -2;
-		m_results->m_fileData.push_back(data);
+	bool const has_selections = results.GetSelectedItemCount() != 0;
+	std::vector<int> added_indexes;
 
-		auto insertPos = std::lower_bound(m_results->m_indexMapping.begin(), m_results->m_indexMapping.end(), old_count + added_count, SortPredicate(compare));
-		int const added_index = insertPos - m_results->m_indexMapping.begin();
-		m_results->m_indexMapping.insert(insertPos, old_count + added_count++);
+	auto const& mapping = results.m_indexMapping;
+	std::vector<unsigned int> merged;
+	merged.reserve(mapping.size() + count);
 
-		// Remember inserted index
+	auto it = mapping.cbegin();
+	for (auto const index : added) {
+		// Same position as inserting at the lower bound would give
+		while (it != mapping.cend() && pred(*it, index)) {
+			merged.push_back(*it++);
+		}
 		if (has_selections) {
-			auto const added_indexes_insert_pos = std::lower_bound(added_indexes.begin(), added_indexes.end(), added_index);
-			for (auto index = added_indexes_insert_pos; index != added_indexes.end(); ++index) {
-				++(*index);
-			}
-			added_indexes.insert(added_indexes_insert_pos, added_index);
+			added_indexes.push_back(static_cast<int>(merged.size()));
 		}
+		merged.push_back(index);
 
-		if (dir) {
-			m_results->GetFilelistStatusBar()->AddDirectory();
+		if (results.ItemIsDir(index)) {
+			results.GetFilelistStatusBar()->AddDirectory();
 		}
 		else {
-			m_results->GetFilelistStatusBar()->AddFile(entry.size);
+			results.GetFilelistStatusBar()->AddFile(results.ItemGetSize(index));
 		}
-	};
+	}
+	merged.insert(merged.end(), it, mapping.cend());
+	results.m_indexMapping = std::move(merged);
+
+	results.SetItemCount(total);
+	results.UpdateSelections_ItemsAdded(added_indexes);
+	results.RefreshListOnly(false);
+}
+
+bool CSearchDialog::MatchingIdle()
+{
+	fz::scoped_lock l(mutex_);
+	return !workerRunning_ && jobs_.empty() && localMatches_.empty() && remoteMatches_.empty();
+}
+
+void CSearchDialog::StopMatching()
+{
+	{
+		fz::scoped_lock l(mutex_);
+		++generation_;
+		jobs_.clear();
+	}
+	task_.join();
+
+	fz::scoped_lock l(mutex_);
+	workerRunning_ = false;
+	localMatches_.clear();
+	remoteMatches_.clear();
+	finishPending_ = false;
+}
+
+void CSearchDialog::TryFinish()
+{
+	if (!MatchingIdle()) {
+		finishPending_ = true;
+		return;
+	}
+	finishPending_ = false;
 
-	for (auto const& file : listing.files) {
-		add_entry(file, false);
+	if (mode_ == search_mode::comparison) {
+		m_pComparisonManager->CompareListings();
 	}
-	for (auto const& dir : listing.dirs) {
-		add_entry(dir, true);
+
+	searching_ = false;
+	SetCtrlState();
+}
+
+namespace {
+// A string that every matching name has to contain, used to skip the
+// cached listings that cannot have any matches.
+std::wstring required_name_literal(CFilter const& filter)
+{
+	if (filter.matchType != CFilter::all && (filter.matchType != CFilter::any || filter.filters.size() != 1)) {
+		return {};
 	}
 
-	if (added_count) {
-		m_results->SetItemCount(old_count + added_count);
-		m_results->UpdateSelections_ItemsAdded(added_indexes);
-		m_results->RefreshListOnly(false);
+	std::wstring ret;
+	for (auto const& condition : filter.filters) {
+		// Contains, is equal to, begins with and ends with
+		if (condition.type == filter_name && condition.condition >= 0 && condition.condition <= 3) {
+			if (condition.strValue.size() > ret.size()) {
+				ret = condition.strValue;
+			}
+		}
 	}
+
+	return ret;
+}
 }
 
 void CSearchDialog::OnSearch(wxCommandEvent&)
@@ -1084,11 +1218,15 @@ void CSearchDialog::OnSearch(wxCommandEvent&)
 
 	searching_ = true;
 
+	// The worker must not be using the filter while it gets replaced
+	StopMatching();
+
 	bool const matchCase = xrc_call(*this, "ID_CASE", &wxCheckBox::GetValue);
 	m_search_filter = GetFilter(matchCase);
 	m_search_filter.matchCase = matchCase;
 	m_search_filter.filterFiles = xrc_call(*this, "ID_FIND_FILES", &wxCheckBox::GetValue);
 	m_search_filter.filterDirs = xrc_call(*this, "ID_FIND_DIRS", &wxCheckBox::GetValue);
+	m_compiledSearchFilter = CCompiledFilters({m_search_filter});
 
 	m_pComparisonManager->ExitComparisonMode();
 
@@ -1132,11 +1270,29 @@ void CSearchDialog::OnSearch(wxCommandEvent&)
 	}
 
 	if (mode_ != search_mode::local) {
-		recursion_root root(m_remote_search_root, true);
-		root.add_dir_to_visit_restricted(m_remote_search_root, std::wstring(), true);
-		m_state.GetRemoteRecursiveOperation()->AddRecursionRoot(std::move(root));
-		ActiveFilters const filters; // Empty, recurse into everything
-		m_state.GetRemoteRecursiveOperation()->StartRecursiveOperation(CRecursiveOperation::recursive_list, filters, m_remote_search_root);
+		// Trees that have been listed completely before are answered
+		// from the directory cache without listing anything
+		std::vector<CDirectoryListing> cached;
+		if (m_state.m_pEngine && m_state.m_pEngine->CacheLookupTree(m_remote_search_root, required_name_literal(m_search_filter), cached) == FZ_REPLY_OK) {
+			for (auto & listing : cached) {
+				ProcessDirectoryListing(std::make_shared<CDirectoryListing>(std::move(listing)));
+			}
+
+			if (mode_ == search_mode::comparison) {
+				m_remoteResults->m_canStartComparison = true;
+				m_remoteResults->m_originalIndexMapping.clear();
+			}
+			else {
+				TryFinish();
+			}
+		}
+		else {
+			recursion_root root(m_remote_search_root, true);
+			root.add_dir_to_visit_restricted(m_remote_search_root, std::wstring(), true);
+			m_state.GetRemoteRecursiveOperation()->AddRecursionRoot(std::move(root));
+			ActiveFilters const filters; // Empty, recurse into everything
+			m_state.GetRemoteRecursiveOperation()->StartRecursiveOperation(CRecursiveOperation::recursive_list, filters, m_remote_search_root);
+		}
 	}
 
 	SetCtrlState();
@@ -1161,6 +1317,7 @@ void CSearchDialog::Stop()
 		}
 	}
 
+	StopMatching();
 	m_pComparisonManager->ExitComparisonMode();
 
 	searching_ = false;
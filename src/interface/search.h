@@ -5,8 +5,15 @@
 #include "local_recursive_operation.h"
 #include "listingcomparison.h"
 #include "state.h"
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+
+#include <deque>
 #include <set>
 
+class CLocalSearchFileData;
+class CRemoteSearchFileData;
 class CWindowStateManager;
 class CSearchDialogFileList;
 class CQueueView;
@@ -34,6 +41,27 @@ protected:
 	void ProcessDirectoryListing(std::shared_ptr<CDirectoryListing> const& listing);
 	void ProcessDirectoryListing(CLocalRecursiveOperation::listing const& listing);
 
+	// Listings are matched against the search filter on a worker. The
+	// matches get merged into the sorted results in batches.
+	class match_job final
+	{
+	public:
+		std::shared_ptr<CDirectoryListing> remote;
+		CLocalRecursiveOperation::listing local;
+	};
+
+	void QueueMatching(match_job && job);
+	void Match(match_job const& job, std::vector<CLocalSearchFileData> & local, std::vector<CRemoteSearchFileData> & remote) const;
+	void OnMatches();
+	void StopMatching();
+	bool MatchingIdle();
+
+	// Expects the last count entries of the file data to be new
+	void InsertMatches(CSearchDialogFileList & results, size_t count);
+
+	// Done once the recursive operations are finished and all matches are in
+	void TryFinish();
+
 	void SetCtrlState();
 
 	void SaveConditions();
@@ -52,6 +80,7 @@ protected:
 	CWindowStateManager* m_pWindowStateManager{};
 
 	CFilter m_search_filter;
+	CCompiledFilters m_compiledSearchFilter;
 
 	search_mode mode_{};
 	bool searching_{};
@@ -78,6 +107,15 @@ protected:
 
 	std::set<CServerPath> m_visited;
 
+	fz::mutex mutex_;
+	fz::async_task task_;
+	bool workerRunning_{};
+	uint64_t generation_{};
+	std::deque<match_job> jobs_;
+	std::vector<CLocalSearchFileData> localMatches_;
+	std::vector<CRemoteSearchFileData> remoteMatches_;
+	bool finishPending_{};
+
 	CLocalPath m_local_search_root;
 	CServerPath m_remote_search_root;
 
@@ -6,6 +6,8 @@
 #include "../Options.h"
 #include "../textctrlex.h"
 
+#include <libfilezilla/iputils.hpp>
+
 #include <wx/statbox.h>
 
 struct COptionsPageConnection::impl
@@ -13,6 +15,7 @@ struct COptionsPageConnection::impl
 	wxTextCtrlEx* timeout_{};
 	wxTextCtrlEx* tries_{};
 	wxTextCtrlEx* delay_{};
+	wxTextCtrlEx* sourceAddresses_{};
 };
 
 COptionsPageConnection::COptionsPageConnection()
@@ -61,6 +64,14 @@ bool COptionsPageConnection::CreateControls(wxWindow* parent)
 
 		inner->Add(new wxStaticText(box, -1, _("Please note that some servers might ban you if you try to reconnect too often or in too short intervals.")));
 	}
+	{
+		auto [box, inner] = lay.createStatBox(main, _("Source addresses"), 1);
+		inner->AddGrowableCol(0);
+		inner->Add(new wxStaticText(box, -1, _("&Local addresses to connect from, separated by spaces:")));
+		impl_->sourceAddresses_ = new wxTextCtrlEx(box, -1);
+		inner->Add(impl_->sourceAddresses_, lay.grow);
+		inner->Add(new wxStaticText(box, -1, _("Connections get spread over the addresses, e.g. to use several network interfaces at once. Leave empty to let the system choose. Sites can override this in the Site Manager.")));
+	}
 	return true;
 }
 
@@ -69,6 +80,7 @@ bool COptionsPageConnection::LoadPage()
 	impl_->timeout_->ChangeValue(fz::to_wstring(m_pOptions->GetOptionVal(OPTION_TIMEOUT)));
 	impl_->tries_->ChangeValue(fz::to_wstring(m_pOptions->GetOptionVal(OPTION_RECONNECTCOUNT)));
 	impl_->delay_->ChangeValue(fz::to_wstring(m_pOptions->GetOptionVal(OPTION_RECONNECTDELAY)));
+	impl_->sourceAddresses_->ChangeValue(m_pOptions->GetOption(OPTION_SOURCE_ADDRESSES));
 	return true;
 }
 
@@ -77,6 +89,7 @@ bool COptionsPageConnection::SavePage()
 	m_pOptions->SetOption(OPTION_TIMEOUT, impl_->timeout_->GetValue().ToStdWstring());
 	m_pOptions->SetOption(OPTION_RECONNECTCOUNT, impl_->tries_->GetValue().ToStdWstring());
 	m_pOptions->SetOption(OPTION_RECONNECTDELAY, impl_->delay_->GetValue().ToStdWstring());
+	m_pOptions->SetOption(OPTION_SOURCE_ADDRESSES, impl_->sourceAddresses_->GetValue().ToStdWstring());
 	return true;
 }
 
@@ -97,5 +110,11 @@ bool COptionsPageConnection::Validate()
 		return DisplayError(impl_->delay_, _("Delay between failed connection attempts has to be between 1 and 999 seconds."));
 	}
 
+	for (auto const& address : fz::strtok(impl_->sourceAddresses_->GetValue().ToStdWstring(), L" \t,;")) {
+		if (fz::get_address_type(address) == fz::address_type::unknown) {
+			return DisplayError(impl_->sourceAddresses_, wxString::Format(_("'%s' is not a valid IPv4 or IPv6 address."), address));
+		}
+	}
+
 	return true;
 }
@@ -7,6 +7,8 @@
 #include "textctrlex.h"
 #include "wxext/spinctrlex.h"
 
+#include <speedlimit_schedule.h>
+
 #include <wx/statbox.h>
 
 bool COptionsPageTransfer::CreateControls(wxWindow* parent)
@@ -42,12 +44,13 @@ bool COptionsPageTransfer::CreateControls(wxWindow* parent)
 
 	{
 		auto [box, inner] = lay.createStatBox(main, _("Speed limits"), 1);
+		inner->AddGrowableCol(0);
 
 		auto enable = new wxCheckBox(box, XRCID("ID_ENABLE_SPEEDLIMITS"), _("&Enable speed limits"));
 		inner->Add(enable);
 
 		auto innermost = lay.createFlex(2);
-		inner->Add(innermost);
+		inner->Add(innermost, lay.grow);
 		innermost->Add(new wxStaticText(box, -1, _("Download &limit:")), lay.valign);
 		auto row = lay.createFlex(2);
 		innermost->Add(row, lay.valign);
@@ -71,10 +74,18 @@ bool COptionsPageTransfer::CreateControls(wxWindow* parent)
 		choice->AppendString(_("Very high"));
 		innermost->Add(choice, lay.valign);
 
-		enable->Bind(wxEVT_CHECKBOX, [dllimit, ullimit, choice](wxCommandEvent const& ev) {
+		innermost->Add(new wxStaticText(box, -1, _("&Schedule:")), lay.valign);
+		auto schedule = new wxTextCtrlEx(box, XRCID("ID_SPEEDLIMIT_SCHEDULE"));
+		innermost->Add(schedule, lay.valigng);
+		innermost->AddSpacer(0);
+		innermost->Add(new wxStaticText(box, -1, wxString::Format(_("Limits by time of day, taking the place of those above. Example: mon-fri 08:00-18:00 500/100; 22:00-06:00 0/0\nLimits are download/upload in %s/s, 0 for no limit."), CSizeFormat::GetUnitWithBase(CSizeFormat::kilo, 1024))));
+		innermost->AddGrowableCol(1);
+
+		enable->Bind(wxEVT_CHECKBOX, [dllimit, ullimit, choice, schedule](wxCommandEvent const& ev) {
 			dllimit->Enable(ev.IsChecked());
 			ullimit->Enable(ev.IsChecked());
 			choice->Enable(ev.IsChecked());
+			schedule->Enable(ev.IsChecked());
 		});
 	}
 	
@@ -99,8 +110,9 @@ bool COptionsPageTransfer::CreateControls(wxWindow* parent)
 	}
 
 	{
-		auto [box, inner] = lay.createStatBox(main, _("Preallocation"), 1);
+		auto [box, inner] = lay.createStatBox(main, _("File allocation"), 1);
 		inner->Add(new wxCheckBox(box, XRCID("ID_PREALLOCATE"), _("Pre&allocate space before downloading")));
+		inner->Add(new wxCheckBox(box, XRCID("ID_SPARSE"), _("&Keep runs of zeros in downloaded files sparse")));
 	}
 
 	GetSizer()->Fit(this);
@@ -136,12 +148,17 @@ bool COptionsPageTransfer::LoadPage()
 	SetChoice(XRCID("ID_BURSTTOLERANCE"), m_pOptions->GetOptionVal(OPTION_SPEEDLIMIT_BURSTTOLERANCE), failure);
 	XRCCTRL(*this, "ID_BURSTTOLERANCE", wxChoice)->Enable(enable_speedlimits);
 
+	pTextCtrl = XRCCTRL(*this, "ID_SPEEDLIMIT_SCHEDULE", wxTextCtrl);
+	pTextCtrl->ChangeValue(m_pOptions->GetOption(OPTION_SPEEDLIMIT_SCHEDULE));
+	pTextCtrl->Enable(enable_speedlimits);
+
 	pTextCtrl = XRCCTRL(*this, "ID_REPLACE", wxTextCtrl);
 	pTextCtrl->ChangeValue(m_pOptions->GetOption(OPTION_INVALID_CHAR_REPLACE));
 
 	SetCheckFromOption(XRCID("ID_ENABLE_REPLACE"), OPTION_INVALID_CHAR_REPLACE_ENABLE, failure);
 
 	SetCheckFromOption(XRCID("ID_PREALLOCATE"), OPTION_PREALLOCATE_SPACE, failure);
+	SetCheckFromOption(XRCID("ID_SPARSE"), OPTION_SPARSE_DOWNLOADS, failure);
 
 	return !failure;
 }
@@ -157,10 +174,12 @@ bool COptionsPageTransfer::SavePage()
 	SetOptionFromText(XRCID("ID_DOWNLOADLIMIT"), OPTION_SPEEDLIMIT_INBOUND);
 	SetOptionFromText(XRCID("ID_UPLOADLIMIT"), OPTION_SPEEDLIMIT_OUTBOUND);
 	m_pOptions->SetOption(OPTION_SPEEDLIMIT_BURSTTOLERANCE, GetChoice(XRCID("ID_BURSTTOLERANCE")));
+	SetOptionFromText(XRCID("ID_SPEEDLIMIT_SCHEDULE"), OPTION_SPEEDLIMIT_SCHEDULE);
 	SetOptionFromText(XRCID("ID_REPLACE"), OPTION_INVALID_CHAR_REPLACE);
 	SetOptionFromCheck(XRCID("ID_ENABLE_REPLACE"), OPTION_INVALID_CHAR_REPLACE_ENABLE);
 
 	SetOptionFromCheck(XRCID("ID_PREALLOCATE"), OPTION_PREALLOCATE_SPACE);
+	SetOptionFromCheck(XRCID("ID_SPARSE"), OPTION_SPARSE_DOWNLOADS);
 
 	return true;
 }
@@ -202,6 +221,11 @@ bool COptionsPageTransfer::Validate()
 		return DisplayError(pCtrl, wxString::Format(_("Please enter an upload speed limit greater or equal to 0 %s/s."), unit));
 	}
 
+	pCtrl = XRCCTRL(*this, "ID_SPEEDLIMIT_SCHEDULE", wxTextCtrl);
+	if (!CSpeedLimitSchedule().Parse(pCtrl->GetValue().ToStdWstring())) {
+		return DisplayError(pCtrl, _("The speed limit schedule is invalid. Each entry needs optional days, a time range and the limits, e.g. mon-fri 08:00-18:00 500/100"));
+	}
+
 	pCtrl = XRCCTRL(*this, "ID_REPLACE", wxTextCtrl);
 	wxString replace = pCtrl->GetValue();
 #ifdef __WXMSW__
@@ -31,23 +31,44 @@ background_color const background_colors[] = {
 };
 }
 
-std::map<int, std::unique_ptr<Site>> CSiteManager::m_idMap;
+std::map<int, std::shared_ptr<Site const>> CSiteManager::m_idMap;
+std::unique_ptr<CSiteManager::cached_file> CSiteManager::m_ownSites;
+std::unique_ptr<CSiteManager::cached_file> CSiteManager::m_predefinedSites;
 
 bool CSiteManager::Load(CSiteManagerXmlHandler& handler)
 {
-	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
-	auto document = file.Load();
-	if (!document) {
-		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
+	std::wstring error;
+	auto const* file = GetCachedFile(false, error);
+	if (!file) {
+		wxMessageBoxEx(error, _("Error loading xml file"), wxICON_ERROR);
 		return false;
 	}
 
-	auto element = document.child("Servers");
-	if (!element) {
+	if (!file->hasServers) {
 		return false;
 	}
 
-	return Load(element, handler);
+	return Load(file->root, handler);
+}
+
+bool CSiteManager::Load(sites_folder const& folder, CSiteManagerXmlHandler& handler)
+{
+	for (auto const& entry : folder.entries) {
+		if (entry.folder) {
+			if (!handler.AddFolder(entry.folder->name, entry.folder->expanded)) {
+				return false;
+			}
+			Load(*entry.folder, handler);
+			if (!handler.LevelUp()) {
+				return false;
+			}
+		}
+		else {
+			handler.AddSite(std::make_unique<Site>(*entry.site));
+		}
+	}
+
+	return true;
 }
 
 bool CSiteManager::Load(pugi::xml_node element, CSiteManagerXmlHandler& handler)
@@ -132,134 +153,137 @@ std::unique_ptr<Site> CSiteManager::ReadServerElement(pugi::xml_node element)
 	return data;
 }
 
-class CSiteManagerXmlHandler_Menu : public CSiteManagerXmlHandler
+CSiteManager::cached_file const* CSiteManager::GetCachedFile(bool predefined, std::wstring & error)
 {
-public:
-	CSiteManagerXmlHandler_Menu(wxMenu* pMenu, std::map<int, std::unique_ptr<Site>> *idMap, bool predefined)
-		: m_pMenu(pMenu), m_idMap(idMap)
-	{
-		if (predefined) {
-			path = _T("1");
-		}
-		else {
-			path = _T("0");
-		}
-	}
+	auto & cache = predefined ? m_predefinedSites : m_ownSites;
 
-	unsigned int GetInsertIndex(wxMenu* pMenu, const wxString& name)
-	{
-		unsigned int i;
-		for (i = 0; i < pMenu->GetMenuItemCount(); ++i) {
-			const wxMenuItem* const pItem = pMenu->FindItemByPosition(i);
-			if (!pItem) {
-				continue;
-			}
-
-			// Use same sorting as site tree in site manager
-#ifdef __WXMSW__
-			if (pItem->GetItemLabelText().CmpNoCase(name) > 0) {
-				break;
-			}
-#else
-			if (pItem->GetItemLabelText() > name) {
-				break;
-			}
-#endif
+	std::wstring name;
+	if (predefined) {
+		CLocalPath const defaultsDir = wxGetApp().GetDefaultsDir();
+		if (defaultsDir.empty()) {
+			cache.reset();
+			return nullptr;
 		}
+		name = defaultsDir.GetPath() + _T("fzdefaults.xml");
+	}
+	else {
+		name = wxGetApp().GetSettingsFile(_T("sitemanager"));
+	}
 
-		return i;
+	if (cache && cache->file->GetFileName() == name && !cache->file->Modified()) {
+		return cache.get();
 	}
+	cache.reset();
 
-	virtual bool AddFolder(std::wstring const& name, bool)
-	{
-		m_parents.push_back(m_pMenu);
-		m_childNames.push_back(name);
-		m_paths.push_back(path);
-		path += _T("/") + CSiteManager::EscapeSegment(name);
+	auto file = std::make_unique<CXmlFile>(name);
+	if (!predefined) {
+		file->EnableSnapshot();
+	}
+	auto document = file->Load();
+	if (!document) {
+		error = file->GetError();
+		return nullptr;
+	}
 
-		m_pMenu = new wxMenu;
+	auto loaded = std::make_unique<cached_file>();
+	loaded->fromFutureVersion = file->IsFromFutureVersion();
 
-		return true;
+	auto element = document.child("Servers");
+	if (element) {
+		loaded->hasServers = true;
+		BuildFolder(element, loaded->root, std::wstring(1, predefined ? '1' : '0'), *loaded);
 	}
 
-	virtual bool AddSite(std::unique_ptr<Site> data)
-	{
-		std::wstring newName(data->GetName());
-		int i = GetInsertIndex(m_pMenu, newName);
-		newName = LabelEscape(newName);
-		wxMenuItem* pItem = m_pMenu->Insert(i, wxID_ANY, newName);
+	// Everything needed got copied out of the document
+	file->Close();
+	loaded->file = std::move(file);
 
-		data->SetSitePath(path + _T("/") + CSiteManager::EscapeSegment(data->GetName()));
+	cache = std::move(loaded);
+	return cache.get();
+}
 
-		(*m_idMap)[pItem->GetId()] = std::move(data);
+void CSiteManager::BuildFolder(pugi::xml_node element, sites_folder & folder, std::wstring const& path, cached_file & cache)
+{
+	for (auto child = element.first_child(); child; child = child.next_sibling()) {
+		if (!strcmp(child.name(), "Folder")) {
+			std::wstring name = GetTextElement_Trimmed(child);
+			if (name.empty()) {
+				continue;
+			}
 
-		return true;
-	}
+			auto sub = std::make_unique<sites_folder>();
+			sub->name = name.substr(0, 255);
+			sub->expanded = GetTextAttribute(child, "expanded") != _T("0");
+			BuildFolder(child, *sub, path + _T("/") + EscapeSegment(sub->name), cache);
 
-	// Go up a level
-	virtual bool LevelUp()
-	{
-		if (m_parents.empty() || m_childNames.empty()) {
-			return false;
+			folder.hasSites |= sub->hasSites;
+			folder.entries.push_back(folder_entry{std::move(sub), nullptr});
 		}
+		else if (!strcmp(child.name(), "Server")) {
+			std::unique_ptr<Site> data = ReadServerElement(child);
+			if (!data) {
+				continue;
+			}
 
-		wxMenu* pChild = m_pMenu;
-		m_pMenu = m_parents.back();
-		if (pChild->GetMenuItemCount()) {
-			std::wstring name = m_childNames.back();
-			int i = GetInsertIndex(m_pMenu, name);
-			name = LabelEscape(name);
+			std::wstring const sitePath = path + _T("/") + EscapeSegment(data->GetName());
+			data->SetSitePath(sitePath);
+			std::shared_ptr<Site const> site = std::move(data);
+
+			// Like GetElementByPath, the first of several equally named sites wins
+			std::wstring const key = sitePath.substr(1);
+			cache.paths.emplace(key, site_path_entry{site, site->m_default_bookmark});
+			for (auto const& bookmark : site->m_bookmarks) {
+				site_path_entry entry{site, bookmark};
+				entry.bookmark.m_name.clear();
+				cache.paths.emplace(key + _T("/") + EscapeSegment(bookmark.m_name), std::move(entry));
+			}
 
-			wxMenuItem* pItem = new wxMenuItem(m_pMenu, wxID_ANY, name, _T(""), wxITEM_NORMAL, pChild);
-			m_pMenu->Insert(i, pItem);
-		}
-		else {
-			delete pChild;
+			++cache.siteCount;
+			folder.hasSites = true;
+			folder.entries.push_back(folder_entry{nullptr, std::move(site)});
 		}
-		m_childNames.pop_back();
-		m_parents.pop_back();
-
-		path = m_paths.back();
-		m_paths.pop_back();
-
-		return true;
 	}
 
-protected:
-	wxMenu* m_pMenu;
-
-	std::map<int, std::unique_ptr<Site>> *m_idMap;
-
-	std::deque<wxMenu*> m_parents;
-	std::deque<std::wstring> m_childNames;
-
-	std::wstring path;
-	std::deque<std::wstring> m_paths;
-};
-
+	// Use same sorting as site tree in site manager
+	auto const& entries = folder.entries;
+	auto const entryName = [&entries](size_t i) -> std::wstring const& {
+		return entries[i].folder ? entries[i].folder->name : entries[i].site->GetName();
+	};
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (!entries[i].folder || entries[i].folder->hasSites) {
+			folder.menuOrder.push_back(i);
+		}
+	}
+	std::stable_sort(folder.menuOrder.begin(), folder.menuOrder.end(), [&](size_t lhs, size_t rhs) {
+#ifdef __WXMSW__
+		return wxString(entryName(lhs)).CmpNoCase(entryName(rhs)) < 0;
+#else
+		return entryName(lhs) < entryName(rhs);
+#endif
+	});
+}
 
-class CSiteManagerXmlHandler_Stats : public CSiteManagerXmlHandler
+void CSiteManager::InvalidateCache()
 {
-public:
-	virtual bool AddFolder(std::wstring const&, bool)
-	{
-		++directories_;
-		return true;
-	}
+	m_ownSites.reset();
+	m_predefinedSites.reset();
+}
 
-	virtual bool AddSite(std::unique_ptr<Site> site)
-	{
-		if (site) {
-			++sites_;
-			bookmarks_ += site->m_bookmarks.size();
+void CSiteManager::AddToMenu(wxMenu & menu, sites_folder const& folder)
+{
+	for (auto const i : folder.menuOrder) {
+		auto const& entry = folder.entries[i];
+		if (entry.folder) {
+			auto sub = std::make_unique<wxMenu>();
+			AddToMenu(*sub, *entry.folder);
+			menu.AppendSubMenu(sub.release(), LabelEscape(entry.folder->name));
+		}
+		else {
+			wxMenuItem* pItem = menu.Append(wxID_ANY, LabelEscape(entry.site->GetName()));
+			m_idMap[pItem->GetId()] = entry.site;
 		}
-		return true;
 	}
-
-	unsigned int sites_{};
-	unsigned int directories_{};
-	unsigned int bookmarks_{};
-};
+}
 
 std::unique_ptr<wxMenu> CSiteManager::GetSitesMenu()
 {
@@ -269,14 +293,18 @@ std::unique_ptr<wxMenu> CSiteManager::GetSitesMenu()
 	// to the same file or one is reading while the other one writes.
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
-	auto predefinedSites = GetSitesMenu_Predefined(m_idMap);
+	auto predefinedSites = GetSitesMenu_Predefined();
 
-	auto pMenu = std::make_unique<wxMenu>();
-	CSiteManagerXmlHandler_Menu handler(pMenu.get(), &m_idMap, false);
+	std::unique_ptr<wxMenu> pMenu;
 
-	bool res = Load(handler);
-	if (!res || !pMenu->GetMenuItemCount()) {
-		pMenu.reset();
+	std::wstring error;
+	auto const* file = GetCachedFile(false, error);
+	if (!file) {
+		wxMessageBoxEx(error, _("Error loading xml file"), wxICON_ERROR);
+	}
+	else if (file->root.hasSites) {
+		pMenu = std::make_unique<wxMenu>();
+		AddToMenu(*pMenu, file->root);
 	}
 
 	if (pMenu) {
@@ -306,45 +334,16 @@ void CSiteManager::ClearIdMap()
 	m_idMap.clear();
 }
 
-bool CSiteManager::LoadPredefined(CSiteManagerXmlHandler& handler)
+std::unique_ptr<wxMenu> CSiteManager::GetSitesMenu_Predefined()
 {
-	CLocalPath const defaultsDir = wxGetApp().GetDefaultsDir();
-	if (defaultsDir.empty()) {
-		return false;
-	}
-
-	std::wstring const name(defaultsDir.GetPath() + _T("fzdefaults.xml"));
-	CXmlFile file(name);
-
-	auto document = file.Load();
-	if (!document) {
-		return false;
-	}
-
-	auto element = document.child("Servers");
-	if (!element) {
-		return false;
-	}
-
-	if (!Load(element, handler)) {
-		return false;
+	std::wstring error;
+	auto const* file = GetCachedFile(true, error);
+	if (!file || !file->root.hasSites) {
+		return nullptr;
 	}
 
-	return true;
-}
-
-std::unique_ptr<wxMenu> CSiteManager::GetSitesMenu_Predefined(std::map<int, std::unique_ptr<Site>> &idMap)
-{
 	auto pMenu = std::make_unique<wxMenu>();
-	CSiteManagerXmlHandler_Menu handler(pMenu.get(), &idMap, true);
-
-	if (!LoadPredefined(handler)) {
-		return 0;
-	}
-
-	if (!pMenu->GetMenuItemCount()) {
-		return 0;
-	}
+	AddToMenu(*pMenu, file->root);
 
 	return pMenu;
 }
@@ -355,7 +354,7 @@ std::unique_ptr<Site> CSiteManager::GetSiteById(int id)
 
 	std::unique_ptr<Site> pData;
 	if (iter != m_idMap.end()) {
-		pData = std::move(iter->second);
+		pData = std::make_unique<Site>(*iter->second);
 	}
 	ClearIdMap();
 
@@ -450,71 +449,41 @@ std::pair<std::unique_ptr<Site>, Bookmark> CSiteManager::DoGetSiteByPath(std::ws
 
 	sitePath = sitePath.substr(1);
 
+	std::vector<std::wstring> segments;
+	if (!UnescapeSitePath(sitePath, segments) || segments.empty()) {
+		error = _("Site path is malformed.");
+		return ret;
+	}
+
 	// We have to synchronize access to sitemanager.xml so that multiple processed don't write
 	// to the same file or one is reading while the other one writes.
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
-	CXmlFile file;
-	if (c == '0') {
-		file.SetFileName(wxGetApp().GetSettingsFile(_T("sitemanager")));
-	}
-	else {
-		CLocalPath const defaultsDir = wxGetApp().GetDefaultsDir();
-		if (defaultsDir.empty()) {
+	std::wstring loadError;
+	auto const* file = GetCachedFile(c == '1', loadError);
+	if (!file) {
+		if (!loadError.empty()) {
+			wxMessageBoxEx(loadError, _("Error loading xml file"), wxICON_ERROR);
+		}
+		else {
 			error = _("Site does not exist.");
-			return ret;
 		}
-		file.SetFileName(defaultsDir.GetPath() + _T("fzdefaults.xml"));
-	}
-
-	auto document = file.Load();
-	if (!document) {
-		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
 		return ret;
 	}
 
-	auto element = document.child("Servers");
-	if (!element) {
+	if (!file->hasServers) {
 		error = _("Site does not exist.");
 		return ret;
 	}
 
-	std::vector<std::wstring> segments;
-	if (!UnescapeSitePath(sitePath, segments) || segments.empty()) {
-		error = _("Site path is malformed.");
-		return ret;
-	}
-
-	auto child = GetElementByPath(element, segments);
-	if (!child) {
+	auto const it = file->paths.find(BuildPath(c, segments).substr(1));
+	if (it == file->paths.end()) {
 		error = _("Site does not exist.");
 		return ret;
 	}
 
-	pugi::xml_node bookmark;
-	if (!strcmp(child.name(), "Bookmark")) {
-		bookmark = child;
-		child = child.parent();
-		segments.pop_back();
-	}
-
-	ret.first = ReadServerElement(child);
-	if (!ret.first) {
-		error = _("Could not read server item.");
-	}
-	else {
-		if (bookmark) {
-			Bookmark bm;
-			if (ReadBookmarkElement(bm, bookmark)) {
-				ret.second = bm;
-			}
-		}
-		else {
-			ret.second = ret.first->m_default_bookmark;
-		}
-
-		ret.first->SetSitePath(BuildPath(c, segments));
-	}
+	ret.first = std::make_unique<Site>(*it->second.site);
+	ret.second = it->second.bookmark;
 
 	return ret;
 }
@@ -526,6 +495,7 @@ std::wstring CSiteManager::AddServer(Site site)
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
+	file.EnableSnapshot();
 	auto document = file.Load();
 	if (!document) {
 		wxString msg = file.GetError() + _T("\n") + _("The server could not be added.");
@@ -572,6 +542,7 @@ std::wstring CSiteManager::AddServer(Site site)
 	SetServer(xServer, site);
 	AddTextElement(xServer, name);
 
+	InvalidateCache();
 	if (!file.Save(false)) {
 		if (COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
 			return std::wstring();
@@ -635,6 +606,7 @@ bool CSiteManager::AddBookmark(std::wstring sitePath, wxString const& name, wxSt
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
+	file.EnableSnapshot();
 	auto document = file.Load();
 	if (!document) {
 		wxString msg = file.GetError() + _T("\n") + _("The bookmark could not be added.");
@@ -697,6 +669,7 @@ bool CSiteManager::AddBookmark(std::wstring sitePath, wxString const& name, wxSt
 		AddTextElementUtf8(bookmark, "DirectoryComparison", "1");
 	}
 
+	InvalidateCache();
 	if (!file.Save(false)) {
 		if (COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
 			return true;
@@ -723,6 +696,7 @@ bool CSiteManager::ClearBookmarks(std::wstring sitePath)
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
+	file.EnableSnapshot();
 	auto document = file.Load();
 	if (!document) {
 		wxString msg = file.GetError() + _T("\n") + _("The bookmarks could not be cleared.");
@@ -754,6 +728,7 @@ bool CSiteManager::ClearBookmarks(std::wstring sitePath)
 		bookmark = child.child("Bookmark");
 	}
 
+	InvalidateCache();
 	if (!file.Save(false)) {
 		if (COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
 			return true;
@@ -768,10 +743,14 @@ bool CSiteManager::ClearBookmarks(std::wstring sitePath)
 
 bool CSiteManager::HasSites()
 {
-	CSiteManagerXmlHandler_Stats handler;
-	Load(handler);
+	std::wstring error;
+	auto const* file = GetCachedFile(false, error);
+	if (!file) {
+		wxMessageBoxEx(error, _("Error loading xml file"), wxICON_ERROR);
+		return false;
+	}
 
-	return handler.sites_ > 0;
+	return file->siteCount > 0;
 }
 
 wxColour CSiteManager::GetColourFromIndex(int i)
@@ -830,6 +809,7 @@ void CSiteManager::Rewrite(CLoginManager & loginManager, bool on_failure_set_to_
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
+	file.EnableSnapshot();
 	auto document = file.Load();
 	if (!document) {
 		wxMessageBoxEx(file.GetError(), _("Error loading xml file"), wxICON_ERROR);
@@ -843,6 +823,7 @@ void CSiteManager::Rewrite(CLoginManager & loginManager, bool on_failure_set_to_
 
 	Rewrite(loginManager, element, on_failure_set_to_ask);
 
+	InvalidateCache();
 	file.Save(true);
 }
 
@@ -935,6 +916,7 @@ bool CSiteManager::ImportSites(pugi::xml_node sites)
 	CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
+	file.EnableSnapshot();
 	auto element = file.Load();
 	if (!element) {
 		wxString msg = wxString::Format(_("Could not load \"%s\", please make sure the file is valid and can be accessed.\nAny changes made in the Site Manager will not be saved."), file.GetFileName());
@@ -952,6 +934,7 @@ bool CSiteManager::ImportSites(pugi::xml_node sites)
 		return false;
 	}
 
+	InvalidateCache();
 	return file.Save(true);
 }
 
@@ -5,6 +5,8 @@
 
 #include "xmlfunctions.h"
 
+#include <unordered_map>
+
 class CSiteManagerXmlHandler
 {
 public:
@@ -51,7 +53,58 @@ public:
 
 	static bool ImportSites(pugi::xml_node sites);
 
+	// Drops the cached site files, called after writing them
+	static void InvalidateCache();
+
 protected:
+	// The site files are parsed once and kept in memory until they change
+	// on disk.
+	struct sites_folder;
+	struct folder_entry final
+	{
+		std::unique_ptr<sites_folder> folder;
+		std::shared_ptr<Site const> site;
+	};
+	struct sites_folder final
+	{
+		std::wstring name;
+		bool expanded{true};
+		bool hasSites{}; // In it or any of its descendants
+
+		std::vector<folder_entry> entries; // In document order
+
+		// Entries as shown in the sites menu, sorted and without folders lacking sites
+		std::vector<size_t> menuOrder;
+	};
+	struct site_path_entry final
+	{
+		std::shared_ptr<Site const> site;
+		Bookmark bookmark;
+	};
+	struct cached_file final
+	{
+		std::unique_ptr<CXmlFile> file; // Only used to detect modifications, already closed
+		bool hasServers{};
+		bool fromFutureVersion{};
+		size_t siteCount{};
+		sites_folder root;
+
+		// Sites and their bookmarks by their path as built by BuildPath,
+		// without the leading root character.
+		std::unordered_map<std::wstring, site_path_entry> paths;
+	};
+
+	// Callers have to hold MUTEX_SITEMANAGER.
+	// Returns nullptr if the file cannot be loaded, error is left empty if
+	// there is no such file to load in the first place.
+	static cached_file const* GetCachedFile(bool predefined, std::wstring & error);
+	static void BuildFolder(pugi::xml_node element, sites_folder & folder, std::wstring const& path, cached_file & cache);
+	static bool Load(sites_folder const& folder, CSiteManagerXmlHandler& handler);
+	static void AddToMenu(wxMenu & menu, sites_folder const& folder);
+
+	static std::unique_ptr<cached_file> m_ownSites;
+	static std::unique_ptr<cached_file> m_predefinedSites;
+
 	static bool ImportSites(pugi::xml_node sitesToImport, pugi::xml_node existingSites);
 
 	static void Rewrite(CLoginManager & loginManager, pugi::xml_node element, bool on_failure_set_to_ask);
@@ -66,12 +119,10 @@ protected:
 	static pugi::xml_node GetElementByPath(pugi::xml_node node, std::vector<std::wstring> const& segments);
 	static std::wstring BuildPath(wxChar root, std::vector<std::wstring> const& segments);
 
-	static std::map<int, std::unique_ptr<Site>> m_idMap;
-
-	// The map maps event id's to sites
-	static std::unique_ptr<wxMenu> GetSitesMenu_Predefined(std::map<int, std::unique_ptr<Site>> &idMap);
+	// Maps the menu ids to sites
+	static std::map<int, std::shared_ptr<Site const>> m_idMap;
 
-	static bool LoadPredefined(CSiteManagerXmlHandler& handler);
+	static std::unique_ptr<wxMenu> GetSitesMenu_Predefined();
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include "fzputtygen_interface.h"
 #include "Options.h"
 #include "sitemanager.h"
+#include "sizeformatting.h"
 #if ENABLE_STORJ
 #include "storj_key_interface.h"
 #endif
@@ -14,6 +15,7 @@
 
 #include <s3sse.h>
 
+#include <libfilezilla/iputils.hpp>
 #include <libfilezilla/translate.hpp>
 
 #include <wx/dirdlg.h>
@@ -1181,6 +1183,32 @@ TransferSettingsSiteControls::TransferSettingsSiteControls(wxWindow & parent, Di
 	row->Add(spin, lay.valign);
 
 	limit->Bind(wxEVT_CHECKBOX, [spin](wxCommandEvent const& ev){ spin->Enable(ev.IsChecked()); });
+
+	wxString const unit = CSizeFormat::GetUnitWithBase(CSizeFormat::kilo, 1024);
+	auto speed = new wxCheckBox(&parent, XRCID("ID_LIMITSPEED"), _("L&imit transfer speed"));
+	sizer.Add(speed);
+	auto * grid = lay.createFlex(2);
+	sizer.Add(grid, 0, wxLEFT, lay.dlgUnits(10));
+	grid->Add(new wxStaticText(&parent, -1, wxString::Format(_("&Download limit (%s/s):"), unit)), lay.valign);
+	auto * inbound = new wxTextCtrlEx(&parent, XRCID("ID_SPEEDLIMIT_INBOUND"), wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(40), -1));
+	inbound->SetMaxLength(9);
+	grid->Add(inbound, lay.valign);
+	grid->Add(new wxStaticText(&parent, -1, wxString::Format(_("&Upload limit (%s/s):"), unit)), lay.valign);
+	auto * outbound = new wxTextCtrlEx(&parent, XRCID("ID_SPEEDLIMIT_OUTBOUND"), wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(40), -1));
+	outbound->SetMaxLength(9);
+	grid->Add(outbound, lay.valign);
+
+	speed->Bind(wxEVT_CHECKBOX, [inbound, outbound](wxCommandEvent const& ev){
+		inbound->Enable(ev.IsChecked());
+		outbound->Enable(ev.IsChecked());
+	});
+
+	row = lay.createFlex(0, 1);
+	sizer.Add(row);
+	row->Add(new wxStaticText(&parent, XRCID("ID_SOURCEADDRESS_LABEL"), _("So&urce address:")), lay.valign);
+	row->Add(new wxTextCtrlEx(&parent, XRCID("ID_SOURCEADDRESS"), wxString(), wxDefaultPosition, wxSize(lay.dlgUnits(100), -1)), lay.valign);
+
+	sizer.Add(new wxCheckBox(&parent, XRCID("ID_MODEZ"), _("Use MODE &Z compression for listings and text transfers")));
 }
 
 void TransferSettingsSiteControls::SetSite(Site const& site)
@@ -1189,12 +1217,22 @@ void TransferSettingsSiteControls::SetSite(Site const& site)
 	xrc_call(parent_, "ID_TRANSFERMODE_ACTIVE", &wxWindow::Enable, !predefined_);
 	xrc_call(parent_, "ID_TRANSFERMODE_PASSIVE", &wxWindow::Enable, !predefined_);
 	xrc_call(parent_, "ID_LIMITMULTIPLE", &wxWindow::Enable, !predefined_);
+	xrc_call(parent_, "ID_LIMITSPEED", &wxWindow::Enable, !predefined_);
+	xrc_call(parent_, "ID_SOURCEADDRESS", &wxWindow::Enable, !predefined_);
+	xrc_call(parent_, "ID_MODEZ", &wxWindow::Enable, !predefined_);
 
 	if (!site) {
 		xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxRadioButton::SetValue, true);
 		xrc_call(parent_, "ID_LIMITMULTIPLE", &wxCheckBox::SetValue, false);
+		xrc_call(parent_, "ID_MODEZ", &wxCheckBox::SetValue, false);
 		xrc_call(parent_, "ID_MAXMULTIPLE", &wxSpinCtrl::Enable, false);
 		xrc_call<wxSpinCtrl, int>(parent_, "ID_MAXMULTIPLE", &wxSpinCtrl::SetValue, 1);
+		xrc_call(parent_, "ID_LIMITSPEED", &wxCheckBox::SetValue, false);
+		xrc_call(parent_, "ID_SPEEDLIMIT_INBOUND", &wxTextCtrl::Enable, false);
+		xrc_call(parent_, "ID_SPEEDLIMIT_INBOUND", &wxTextCtrl::ChangeValue, wxString());
+		xrc_call(parent_, "ID_SPEEDLIMIT_OUTBOUND", &wxTextCtrl::Enable, false);
+		xrc_call(parent_, "ID_SPEEDLIMIT_OUTBOUND", &wxTextCtrl::ChangeValue, wxString());
+		xrc_call(parent_, "ID_SOURCEADDRESS", &wxTextCtrl::ChangeValue, wxString());
 	}
 	else {
 		if (CServer::ProtocolHasFeature(site.server.GetProtocol(), ProtocolFeature::TransferMode)) {
@@ -1209,6 +1247,7 @@ void TransferSettingsSiteControls::SetSite(Site const& site)
 				xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxRadioButton::SetValue, true);
 			}
 		}
+		xrc_call(parent_, "ID_MODEZ", &wxCheckBox::SetValue, site.server.GetExtraParameter("modez") == L"1");
 
 		int const maxMultiple = site.server.MaximumMultipleConnections();
 		xrc_call(parent_, "ID_LIMITMULTIPLE", &wxCheckBox::SetValue, maxMultiple != 0);
@@ -1221,10 +1260,20 @@ void TransferSettingsSiteControls::SetSite(Site const& site)
 			xrc_call<wxSpinCtrl, int>(parent_, "ID_MAXMULTIPLE", &wxSpinCtrl::SetValue, 1);
 		}
 
+		int const inbound = site.server.GetInboundSpeedLimit();
+		int const outbound = site.server.GetOutboundSpeedLimit();
+		bool const limitSpeed = inbound || outbound;
+		xrc_call(parent_, "ID_LIMITSPEED", &wxCheckBox::SetValue, limitSpeed);
+		xrc_call(parent_, "ID_SPEEDLIMIT_INBOUND", &wxTextCtrl::Enable, !predefined_ && limitSpeed);
+		xrc_call(parent_, "ID_SPEEDLIMIT_INBOUND", &wxTextCtrl::ChangeValue, wxString::Format(L"%d", inbound));
+		xrc_call(parent_, "ID_SPEEDLIMIT_OUTBOUND", &wxTextCtrl::Enable, !predefined_ && limitSpeed);
+		xrc_call(parent_, "ID_SPEEDLIMIT_OUTBOUND", &wxTextCtrl::ChangeValue, wxString::Format(L"%d", outbound));
+
+		xrc_call(parent_, "ID_SOURCEADDRESS", &wxTextCtrl::ChangeValue, site.server.GetSourceAddress());
 	}
 }
 
-bool TransferSettingsSiteControls::UpdateSite(Site & site, bool)
+bool TransferSettingsSiteControls::UpdateSite(Site & site, bool silent)
 {
 	if (CServer::ProtocolHasFeature(site.server.GetProtocol(), ProtocolFeature::TransferMode)) {
 		if (xrc_call(parent_, "ID_TRANSFERMODE_ACTIVE", &wxRadioButton::GetValue)) {
@@ -1236,6 +1285,7 @@ bool TransferSettingsSiteControls::UpdateSite(Site & site, bool)
 		else {
 			site.server.SetPasvMode(MODE_DEFAULT);
 		}
+		site.server.SetExtraParameter("modez", xrc_call(parent_, "ID_MODEZ", &wxCheckBox::GetValue) ? L"1" : std::wstring());
 	}
 	else {
 		site.server.SetPasvMode(MODE_DEFAULT);
@@ -1248,6 +1298,42 @@ bool TransferSettingsSiteControls::UpdateSite(Site & site, bool)
 		site.server.MaximumMultipleConnections(0);
 	}
 
+	if (xrc_call(parent_, "ID_LIMITSPEED", &wxCheckBox::GetValue)) {
+		long inbound{};
+		long outbound{};
+		if (!xrc_call(parent_, "ID_SPEEDLIMIT_INBOUND", &wxTextCtrl::GetValue).ToLong(&inbound) || inbound < 0) {
+			if (!silent) {
+				XRCCTRL(parent_, "ID_SPEEDLIMIT_INBOUND", wxTextCtrl)->SetFocus();
+				wxMessageBoxEx(wxString::Format(_("Please enter a download speed limit greater or equal to 0 %s/s."), CSizeFormat::GetUnitWithBase(CSizeFormat::kilo, 1024)), _("Site Manager - Invalid data"), wxICON_EXCLAMATION, wxGetTopLevelParent(&parent_));
+			}
+			return false;
+		}
+		if (!xrc_call(parent_, "ID_SPEEDLIMIT_OUTBOUND", &wxTextCtrl::GetValue).ToLong(&outbound) || outbound < 0) {
+			if (!silent) {
+				XRCCTRL(parent_, "ID_SPEEDLIMIT_OUTBOUND", wxTextCtrl)->SetFocus();
+				wxMessageBoxEx(wxString::Format(_("Please enter an upload speed limit greater or equal to 0 %s/s."), CSizeFormat::GetUnitWithBase(CSizeFormat::kilo, 1024)), _("Site Manager - Invalid data"), wxICON_EXCLAMATION, wxGetTopLevelParent(&parent_));
+			}
+			return false;
+		}
+		site.server.SetSpeedLimits(static_cast<int>(inbound), static_cast<int>(outbound));
+	}
+	else {
+		site.server.SetSpeedLimits(0, 0);
+	}
+
+	std::wstring sourceAddress;
+	if (CServer::ProtocolHasFeature(site.server.GetProtocol(), ProtocolFeature::SourceAddress)) {
+		sourceAddress = fz::trimmed(xrc_call(parent_, "ID_SOURCEADDRESS", &wxTextCtrl::GetValue).ToStdWstring());
+		if (!sourceAddress.empty() && fz::get_address_type(sourceAddress) == fz::address_type::unknown) {
+			if (!silent) {
+				XRCCTRL(parent_, "ID_SOURCEADDRESS", wxTextCtrl)->SetFocus();
+				wxMessageBoxEx(_("The source address needs to be an IPv4 or IPv6 address of this computer."), _("Site Manager - Invalid data"), wxICON_EXCLAMATION, wxGetTopLevelParent(&parent_));
+			}
+			return false;
+		}
+	}
+	site.server.SetSourceAddress(sourceAddress);
+
 	return true;
 }
 
@@ -1257,6 +1343,10 @@ void TransferSettingsSiteControls::SetControlVisibility(ServerProtocol protocol,
 	xrc_call(parent_, "ID_TRANSFERMODE_DEFAULT", &wxWindow::Show, hasTransferMode);
 	xrc_call(parent_, "ID_TRANSFERMODE_ACTIVE", &wxWindow::Show, hasTransferMode);
 	xrc_call(parent_, "ID_TRANSFERMODE_PASSIVE", &wxWindow::Show, hasTransferMode);
+	xrc_call(parent_, "ID_MODEZ", &wxWindow::Show, hasTransferMode);
+	bool const hasSourceAddress = CServer::ProtocolHasFeature(protocol, ProtocolFeature::SourceAddress);
+	xrc_call(parent_, "ID_SOURCEADDRESS_LABEL", &wxWindow::Show, hasSourceAddress);
+	xrc_call(parent_, "ID_SOURCEADDRESS", &wxWindow::Show, hasSourceAddress);
 	auto* transferModeLabel = XRCCTRL(parent_, "ID_TRANSFERMODE_LABEL", wxStaticText);
 	transferModeLabel->Show(hasTransferMode);
 	transferModeLabel->GetContainingSizer()->CalcMin();
@@ -735,24 +735,23 @@ bool CSiteManagerDialog::Load()
 	tree_->SetItemImage(treeId, 1, wxTreeItemIcon_Expanded);
 	tree_->SetItemImage(treeId, 1, wxTreeItemIcon_SelectedExpanded);
 
-	CXmlFile file(wxGetApp().GetSettingsFile(_T("sitemanager")));
-	auto document = file.Load();
-	if (!document) {
-		wxString msg = file.GetError() + _T("\n") + _("The Site Manager cannot be used unless the file gets repaired.");
+	std::wstring error;
+	auto const* file = CSiteManager::GetCachedFile(false, error);
+	if (!file) {
+		wxString msg = error + _T("\n") + _("The Site Manager cannot be used unless the file gets repaired.");
 		wxMessageBoxEx(msg, _("Error loading xml file"), wxICON_ERROR);
 
 		return false;
 	}
 
-	if (file.IsFromFutureVersion()) {
-		wxString msg = wxString::Format(_("The file '%s' has been created by a more recent version of FileZilla.\nLoading files created by newer versions can result in loss of data.\nDo you want to continue?"), file.GetFileName());
+	if (file->fromFutureVersion) {
+		wxString msg = wxString::Format(_("The file '%s' has been created by a more recent version of FileZilla.\nLoading files created by newer versions can result in loss of data.\nDo you want to continue?"), file->file->GetFileName());
 		if (wxMessageBoxEx(msg, _("Detected newer version of FileZilla"), wxICON_QUESTION | wxYES_NO) != wxYES) {
 			return false;
 		}
 	}
 
-	auto element = document.child("Servers");
-	if (!element) {
+	if (!file->hasServers) {
 		return true;
 	}
 
@@ -770,7 +769,7 @@ bool CSiteManagerDialog::Load()
 	}
 	CSiteManagerXmlHandler_Tree handler(tree_, treeId, lastSelection, false);
 
-	bool res = CSiteManager::Load(element, handler);
+	bool res = CSiteManager::Load(file->root, handler);
 
 	tree_->SortChildren(treeId);
 	tree_->Expand(treeId);
@@ -795,6 +794,7 @@ bool CSiteManagerDialog::Save(pugi::xml_node element, wxTreeItemId treeId)
 		CInterProcessMutex mutex(MUTEX_SITEMANAGER);
 
 		CXmlFile xml(wxGetApp().GetSettingsFile(_T("sitemanager")));
+		xml.EnableSnapshot();
 
 		auto document = xml.Load();
 		if (!document) {
@@ -817,6 +817,7 @@ bool CSiteManagerDialog::Save(pugi::xml_node element, wxTreeItemId treeId)
 
 		bool res = Save(element, m_ownSites);
 
+		CSiteManager::InvalidateCache();
 		if (!xml.Save(false)) {
 			if (COptions::Get()->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
 				return res;
@@ -1498,20 +1499,9 @@ void CSiteManagerDialog::OnCopySite(wxCommandEvent&)
 
 bool CSiteManagerDialog::LoadDefaultSites()
 {
-	CLocalPath const defaultsDir = wxGetApp().GetDefaultsDir();
-	if (defaultsDir.empty()) {
-		return false;
-	}
-
-	CXmlFile file(defaultsDir.GetPath() + _T("fzdefaults.xml"));
-
-	auto document = file.Load();
-	if (!document) {
-		return false;
-	}
-
-	auto element = document.child("Servers");
-	if (!element) {
+	std::wstring error;
+	auto const* file = CSiteManager::GetCachedFile(true, error);
+	if (!file || !file->hasServers) {
 		return false;
 	}
 
@@ -1537,7 +1527,7 @@ bool CSiteManagerDialog::LoadDefaultSites()
 	}
 	CSiteManagerXmlHandler_Tree handler(tree_, m_predefinedSites, lastSelection, true);
 
-	CSiteManager::Load(element, handler);
+	CSiteManager::Load(file->root, handler);
 
 	return true;
 }
@@ -22,7 +22,7 @@ void CSpeedLimitsDialog::Run(wxWindow* parent)
 	int downloadlimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
 	int uploadlimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
 	bool enable = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_ENABLE) != 0;
-	if (!downloadlimit && !uploadlimit)
+	if (!downloadlimit && !uploadlimit && COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty())
 		enable = false;
 
 	XRCCTRL(*this, "ID_ENABLE_SPEEDLIMITS", wxCheckBox)->SetValue(enable);
@@ -77,7 +77,7 @@ void CSpeedLimitsDialog::OnOK(wxCommandEvent&)
 	COptions::Get()->SetOption(OPTION_SPEEDLIMIT_OUTBOUND, upload);
 
 	bool enable = XRCCTRL(*this, "ID_ENABLE_SPEEDLIMITS", wxCheckBox)->GetValue() ? 1 : 0;
-	COptions::Get()->SetOption(OPTION_SPEEDLIMIT_ENABLE, enable && (download || upload));
+	COptions::Get()->SetOption(OPTION_SPEEDLIMIT_ENABLE, enable && (download || upload || !COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty()));
 
 	EndDialog(wxID_OK);
 }
@@ -9,6 +9,7 @@
 #include "local_recursive_operation.h"
 #include "remote_recursive_operation.h"
 #include "listingcomparison.h"
+#include "local_copy.h"
 #include "xrc_helper.h"
 
 #include <libfilezilla/local_filesys.hpp>
@@ -97,6 +98,7 @@ void CContextManager::SetCurrentContext(CState* pState)
 		}
 
 		m_current_context = i;
+		pState->ApplyPendingRemoteDir();
 		NotifyHandlers(GetCurrentContext(), STATECHANGE_CHANGEDCONTEXT, _T(""), 0);
 	}
 }
@@ -206,11 +208,26 @@ void CContextManager::NotifyGlobalHandlers(t_statechange_notifications notificat
 
 void CContextManager::ProcessDirectoryListing(CServer const& server, std::shared_ptr<CDirectoryListing> const& listing, CState const* exempt)
 {
+	CState const* current = GetCurrentContext();
 	for (auto state : m_contexts) {
 		if (state == exempt) {
 			continue;
 		}
-		if (state->GetSite() && state->GetSite().server == server) {
+		if (!state->GetSite() || state->GetSite().server != server) {
+			continue;
+		}
+
+		// Tabs showing a different directory have no use for the listing
+		auto const shown = state->GetRemoteDir();
+		if (!shown || shown->path != listing->path) {
+			continue;
+		}
+
+		// Hidden tabs get updated once activated
+		if (state != current) {
+			state->SetPendingRemoteDir(listing);
+		}
+		else {
 			state->SetRemoteDir(listing, false);
 		}
 	}
@@ -227,11 +244,15 @@ CState::CState(CMainFrame &mainFrame)
 	m_pLocalRecursiveOperation = new CLocalRecursiveOperation(*this);
 	m_pRemoteRecursiveOperation = new CRemoteRecursiveOperation(*this);
 
+	localCopier_ = std::make_unique<CLocalCopier>(pool_, [this]() { RefreshLocal(); });
+
 	m_localDir.SetPath(std::wstring(1, CLocalPath::path_separator));
 }
 
 CState::~CState()
 {
+	localCopier_.reset();
+
 	delete m_pComparisonManager;
 	delete m_pCommandQueue;
 	delete m_pEngine;
@@ -343,8 +364,27 @@ bool CState::SetLocalDir(CLocalPath const& dir, std::wstring *error, bool rememb
 	return true;
 }
 
+void CState::SetPendingRemoteDir(std::shared_ptr<CDirectoryListing> const& pDirectoryListing)
+{
+	m_pPendingDirectoryListing = pDirectoryListing;
+}
+
+void CState::ApplyPendingRemoteDir()
+{
+	if (m_pPendingDirectoryListing) {
+		auto listing = std::move(m_pPendingDirectoryListing);
+		m_pPendingDirectoryListing.reset();
+		SetRemoteDir(listing, false);
+	}
+}
+
 bool CState::SetRemoteDir(std::shared_ptr<CDirectoryListing> const& pDirectoryListing, bool primary)
 {
+	if (primary) {
+		// Whatever is pending is older than this
+		m_pPendingDirectoryListing.reset();
+	}
+
 	if (!pDirectoryListing) {
 		m_changeDirFlags.compare = false;
 		SetSyncBrowse(false);
@@ -947,44 +987,8 @@ bool CState::RecursiveCopy(CLocalPath source, const CLocalPath& target)
 		return false;
 	}
 
-	std::list<std::wstring> dirsToVisit;
-	dirsToVisit.push_back(last_segment + CLocalPath::path_separator);
-
-	fz::native_string const nsource = fz::to_native(source.GetPath());
-
-	// Process any subdirs which still have to be visited
-	while (!dirsToVisit.empty()) {
-		std::wstring dirname = dirsToVisit.front();
-		dirsToVisit.pop_front();
-		wxMkdir(target.GetPath() + dirname);
-
-		fz::local_filesys fs;
-		if (!fs.begin_find_files(nsource + fz::to_native(dirname), false)) {
-			continue;
-		}
-
-		bool is_link{};
-		fz::local_filesys::type t{};
-		fz::native_string file;
-		while (fs.get_next_file(file, is_link, t, 0, 0, 0)) {
-			if (file.empty()) {
-				wxGetApp().DisplayEncodingWarning();
-				continue;
-			}
-
-			if (t == fz::local_filesys::dir) {
-				if (is_link) {
-					continue;
-				}
-
-				std::wstring const subDir = dirname + fz::to_wstring(file) + CLocalPath::path_separator;
-				dirsToVisit.push_back(subDir);
-			}
-			else {
-				wxCopyFile(source.GetPath() + dirname + file, target.GetPath() + dirname + file);
-			}
-		}
-	}
+	std::wstring const dirname = last_segment + CLocalPath::path_separator;
+	localCopier_->CopyDirectory(source.GetPath() + dirname, target.GetPath() + dirname);
 
 	return true;
 }
@@ -1071,6 +1075,9 @@ bool CState::IsLocalIdle(bool ignore_recursive) const
 
 void CState::ListingFailed(int)
 {
+	// Let the views drop entries shown while the listing was received
+	NotifyHandlers(STATECHANGE_REMOTE_DIR_PARTIAL);
+
 	bool const compare = m_changeDirFlags.compare;
 	m_changeDirFlags.compare = false;
 
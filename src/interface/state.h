@@ -14,6 +14,7 @@ enum t_statechange_notifications
 
 	STATECHANGE_REMOTE_DIR,
 	STATECHANGE_REMOTE_DIR_OTHER,
+	STATECHANGE_REMOTE_DIR_PARTIAL, // data2 points to the CDirectoryListingProgressNotification
 	STATECHANGE_REMOTE_RECV,
 	STATECHANGE_REMOTE_SEND,
 	STATECHANGE_REMOTE_LINKNOTDIR,
@@ -60,6 +61,7 @@ class CStateEventHandler;
 class CRemoteDataObject;
 class CRemoteRecursiveOperation;
 class CComparisonManager;
+class CLocalCopier;
 
 class CStateFilterManager final : public CFilterManager
 {
@@ -145,6 +147,11 @@ public:
 
 	bool ChangeRemoteDir(CServerPath const& path, std::wstring const& subdir = std::wstring(), int flags = 0, bool ignore_busy = false, bool compare = false);
 	bool SetRemoteDir(std::shared_ptr<CDirectoryListing> const& pDirectoryListing, bool primary);
+
+	// For listings of the current directory obtained by other tabs while this
+	// tab is not the active one. Only the newest gets applied on activation.
+	void SetPendingRemoteDir(std::shared_ptr<CDirectoryListing> const& pDirectoryListing);
+	void ApplyPendingRemoteDir();
 	std::shared_ptr<CDirectoryListing> GetRemoteDir() const;
 	const CServerPath GetRemotePath() const;
 
@@ -172,7 +179,8 @@ public:
 	void HandleDroppedFiles(wxFileDataObject const* pFileDataObject, CLocalPath const& path, bool copy);
 	bool DownloadDroppedFiles(CRemoteDataObject const* pRemoteDataObject, CLocalPath const& path, bool queueOnly = false);
 
-	static bool RecursiveCopy(CLocalPath source, CLocalPath const& targte);
+	// Runs in the background, the local listing gets refreshed once done
+	bool RecursiveCopy(CLocalPath source, CLocalPath const& target);
 
 	bool IsRemoteConnected() const;
 	bool IsRemoteIdle(bool ignore_recursive = false) const;
@@ -225,6 +233,7 @@ protected:
 
 	CLocalPath m_localDir;
 	std::shared_ptr<CDirectoryListing> m_pDirectoryListing;
+	std::shared_ptr<CDirectoryListing> m_pPendingDirectoryListing;
 
 	Site m_site;
 
@@ -240,6 +249,8 @@ protected:
 	CRemoteRecursiveOperation* m_pRemoteRecursiveOperation;
 
 	CComparisonManager* m_pComparisonManager;
+
+	std::unique_ptr<CLocalCopier> localCopier_;
 	
 	CStateFilterManager m_stateFilterManager;
 	
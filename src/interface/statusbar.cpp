@@ -319,6 +319,7 @@ CStatusBar::CStatusBar(wxTopLevelWindow* pParent)
 	RegisterOption(OPTION_SPEEDLIMIT_ENABLE);
 	RegisterOption(OPTION_SPEEDLIMIT_INBOUND);
 	RegisterOption(OPTION_SPEEDLIMIT_OUTBOUND);
+	RegisterOption(OPTION_SPEEDLIMIT_SCHEDULE);
 
 	// Size format
 	RegisterOption(OPTION_SIZE_FORMAT);
@@ -593,7 +594,8 @@ void CStatusBar::UpdateSpeedLimitsIcon()
 
 	int downloadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_INBOUND);
 	int uploadLimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
-	if (!enable || (!downloadLimit && !uploadLimit)) {
+	bool const scheduled = !COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty();
+	if (!enable || (!downloadLimit && !uploadLimit && !scheduled)) {
 		wxImage img = bmp.ConvertToImage();
 		img = img.ConvertToGreyscale();
 #ifdef __WXMAC__
@@ -619,6 +621,10 @@ void CStatusBar::UpdateSpeedLimitsIcon()
 		else {
 			tooltip += _("Upload limit: none");
 		}
+		if (scheduled) {
+			tooltip += _T("\n");
+			tooltip += _("The limits change by time of day according to the schedule.");
+		}
 	}
 
 	if (!m_pSpeedLimitsIndicator) {
@@ -633,7 +639,7 @@ void CStatusBar::UpdateSpeedLimitsIcon()
 
 void CStatusBar::OnOptionsChanged(changed_options_t const& options)
 {
-	if (options.test(OPTION_SPEEDLIMIT_ENABLE) || options.test(OPTION_SPEEDLIMIT_INBOUND) || options.test(OPTION_SPEEDLIMIT_OUTBOUND)) {
+	if (options.test(OPTION_SPEEDLIMIT_ENABLE) || options.test(OPTION_SPEEDLIMIT_INBOUND) || options.test(OPTION_SPEEDLIMIT_OUTBOUND) || options.test(OPTION_SPEEDLIMIT_SCHEDULE)) {
 		UpdateSpeedLimitsIcon();
 	}
 	if (options.test(OPTION_SIZE_FORMAT) || options.test(OPTION_SIZE_USETHOUSANDSEP) || options.test(OPTION_SIZE_DECIMALPLACES)) {
@@ -666,7 +672,7 @@ void CStatusBar::OnSpeedLimitsEnable(wxCommandEvent&)
 	int uploadlimit = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_OUTBOUND);
 	bool enable = COptions::Get()->GetOptionVal(OPTION_SPEEDLIMIT_ENABLE) == 0;
 	if (enable) {
-		if (!downloadlimit && !uploadlimit) {
+		if (!downloadlimit && !uploadlimit && COptions::Get()->GetOption(OPTION_SPEEDLIMIT_SCHEDULE).empty()) {
 			CSpeedLimitsDialog dlg;
 			dlg.Run(m_pParent);
 		}
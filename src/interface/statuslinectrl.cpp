@@ -7,10 +7,10 @@
 #include "themeprovider.h"
 
 #include <algorithm>
+#include <cmath>
 
 BEGIN_EVENT_TABLE(CStatusLineCtrl, wxWindow)
 EVT_PAINT(CStatusLineCtrl::OnPaint)
-EVT_TIMER(wxID_ANY, CStatusLineCtrl::OnTimer)
 EVT_ERASE_BACKGROUND(CStatusLineCtrl::OnEraseBackground)
 END_EVENT_TABLE()
 
@@ -18,6 +18,8 @@ int CStatusLineCtrl::m_fieldOffsets[4];
 wxCoord CStatusLineCtrl::m_textHeight;
 bool CStatusLineCtrl::m_initialized = false;
 int CStatusLineCtrl::m_barWidth = 102;
+wxFont CStatusLineCtrl::m_charWidthFont;
+std::unordered_map<wchar_t, wxCoord> CStatusLineCtrl::m_charWidths;
 
 CStatusLineCtrl::CStatusLineCtrl(CQueueView* pParent, const t_EngineData* const pEngineData, const wxRect& initialPosition)
 	: m_pParent(pParent)
@@ -32,8 +34,6 @@ CStatusLineCtrl::CStatusLineCtrl(CQueueView* pParent, const t_EngineData* const
 	SetBackgroundStyle(wxBG_STYLE_CUSTOM);
 	SetBackgroundColour(pParent->GetBackgroundColour());
 
-	m_transferStatusTimer.SetOwner(this);
-
 	InitFieldOffsets();
 
 	ClearTransferStatus();
@@ -71,185 +71,228 @@ void CStatusLineCtrl::InitFieldOffsets()
 CStatusLineCtrl::~CStatusLineCtrl()
 {
 	if (!status_.empty() && status_.totalSize >= 0) {
-		if (m_pEngineData && m_pEngineData->pItem) {
+		// During a batch upload the status covers all files of the batch
+		if (m_pEngineData && m_pEngineData->pItem && m_pEngineData->batch.empty()) {
 			m_pEngineData->pItem->SetSize(status_.totalSize);
 		}
 	}
-
-	if (m_transferStatusTimer.IsRunning()) {
-		m_transferStatusTimer.Stop();
-	}
 }
 
 void CStatusLineCtrl::OnPaint(wxPaintEvent&)
 {
 	wxPaintDC dc(this);
 
-	wxRect rect = GetRect();
-
-	int refresh = 0;
-	if (!m_data.IsOk() || rect.GetWidth() != m_data.GetWidth() || rect.GetHeight() != m_data.GetHeight()) {
+	wxSize const size = GetClientSize();
+	if (!m_data.IsOk() || size.GetWidth() != m_data.GetWidth() || size.GetHeight() != m_data.GetHeight()) {
 		m_mdc.reset();
 
 		double sf = dc.GetContentScaleFactor();
-		m_data.CreateScaled(rect.width, rect.height, -1, sf);
+		m_data.CreateScaled(size.GetWidth(), size.GetHeight(), -1, sf);
 
 		m_mdc = std::make_unique<wxMemoryDC>(m_data);
 		// Use same layout direction as the DC which bitmap is drawn on.
 		// This avoids problem with mirrored characters on RTL locales.
 		m_mdc->SetLayoutDirection(dc.GetLayoutDirection());
 
-		refresh = 31;
+		DrawFields(UpdateFields(true));
 	}
 
-	fz::duration elapsed;
-	int left = -1;
-	wxFileOffset rate;
-	wxString bytes_and_rate;
-	int bar_split = -1;
-	int permill = -1;
+	// Changed fields have already been drawn into the bitmap.
+	wxRect const box = GetUpdateRegion().GetBox();
+	dc.Blit(box.x, box.y, box.width, box.height, m_mdc.get(), box.x, box.y);
+}
 
+int CStatusLineCtrl::UpdateFields(bool force)
+{
 	if (status_.empty()) {
-		if (m_previousStatusText != m_statusText) {
-			// Clear background
-			m_mdc->SetFont(GetFont());
-			m_mdc->SetPen(GetBackgroundColour());
-			m_mdc->SetBrush(GetBackgroundColour());
-			m_mdc->SetTextForeground(GetForegroundColour());
-			m_mdc->DrawRectangle(0, 0, rect.GetWidth(), rect.GetHeight());
-			wxCoord h = (rect.GetHeight() - m_textHeight) / 2;
-			m_mdc->DrawText(m_statusText, 50, h);
+		if (force || m_previousStatusText != m_statusText) {
 			m_previousStatusText = m_statusText;
-			refresh = 0;
+			return field_status_text;
 		}
+		return 0;
 	}
-	else {
-		if (!m_previousStatusText.empty()) {
-			m_previousStatusText.clear();
-			refresh = 31;
-		}
 
-		int elapsed_milli_seconds = 0;
-		if (!status_.started.empty()) {
-			elapsed = fz::datetime::now() - status_.started;
-			elapsed_milli_seconds = static_cast<int>(elapsed.get_milliseconds()); // Assume it doesn't overflow
-		}
+	int refresh = 0;
+	if (force || !m_previousStatusText.empty()) {
+		m_previousStatusText.clear();
+		refresh = field_all;
+	}
 
-		if (elapsed_milli_seconds / 1000 != m_last_elapsed_seconds) {
-			refresh |= 1;
-			m_last_elapsed_seconds = elapsed_milli_seconds / 1000;
-		}
+	int elapsed_milli_seconds = 0;
+	if (!status_.started.empty()) {
+		elapsed_milli_seconds = static_cast<int>((fz::datetime::now() - status_.started).get_milliseconds()); // Assume it doesn't overflow
+	}
+
+	if (elapsed_milli_seconds / 1000 != m_last_elapsed_seconds) {
+		refresh |= field_elapsed;
+		m_last_elapsed_seconds = elapsed_milli_seconds / 1000;
+	}
 
-		if (COptions::Get()->GetOptionVal(OPTION_SPEED_DISPLAY)) {
-			rate = GetMomentarySpeed();
+	wxFileOffset rate;
+	if (COptions::Get()->GetOptionVal(OPTION_SPEED_DISPLAY)) {
+		rate = GetMomentarySpeed();
+	}
+	else {
+		rate = GetAverageSpeed(elapsed_milli_seconds);
+	}
+
+	int left = -1;
+	if (status_.totalSize > 0 && elapsed_milli_seconds >= 1000 && rate > 0) {
+		wxFileOffset r = status_.totalSize - status_.currentOffset;
+		left = r / rate + 1;
+		if (r) {
+			++left;
 		}
-		else {
-			rate = GetAverageSpeed(elapsed_milli_seconds);
+
+		if (left < 0) {
+			left = 0;
 		}
+	}
 
-		if (status_.totalSize > 0 && elapsed_milli_seconds >= 1000 && rate > 0) {
-			wxFileOffset r = status_.totalSize - status_.currentOffset;
-			left = r / rate + 1;
-			if (r) {
-				++left;
-			}
+	if (m_last_left != left) {
+		refresh |= field_left;
+		m_last_left = left;
+	}
 
-			if (left < 0) {
-				left = 0;
-			}
+	wxString bytes_and_rate;
+	const wxString bytestr = CSizeFormat::Format(status_.currentOffset, true, CSizeFormat::bytes, COptions::Get()->GetOptionVal(OPTION_SIZE_USETHOUSANDSEP) != 0, 0);
+	if (elapsed_milli_seconds >= 1000 && rate > -1) {
+		CSizeFormat::_format format = static_cast<CSizeFormat::_format>(COptions::Get()->GetOptionVal(OPTION_SIZE_FORMAT));
+		if (format == CSizeFormat::bytes) {
+			format = CSizeFormat::iec;
 		}
+		const wxString ratestr = CSizeFormat::Format(rate, true,
+													 format,
+													 COptions::Get()->GetOptionVal(OPTION_SIZE_USETHOUSANDSEP) != 0,
+													 COptions::Get()->GetOptionVal(OPTION_SIZE_DECIMALPLACES));
+		bytes_and_rate.Printf(_("%s (%s/s)"), bytestr, ratestr );
+	}
+	else {
+		bytes_and_rate.Printf(_("%s (? B/s)"), bytestr);
+	}
+
+	if (m_last_bytes_and_rate != bytes_and_rate) {
+		refresh |= field_bytes_and_rate;
+		m_last_bytes_and_rate = bytes_and_rate;
+	}
 
-		if (m_last_left != left) {
-			refresh |= 2;
-			m_last_left = left;
+	int bar_split = -1;
+	int permill = -1;
+	if (status_.totalSize > 0) {
+		bar_split = static_cast<int>(status_.currentOffset * (m_barWidth - 2) / status_.totalSize);
+		if (bar_split > (m_barWidth - 2)) {
+			bar_split = m_barWidth - 2;
 		}
 
-		const wxString bytestr = CSizeFormat::Format(status_.currentOffset, true, CSizeFormat::bytes, COptions::Get()->GetOptionVal(OPTION_SIZE_USETHOUSANDSEP) != 0, 0);
-		if (elapsed_milli_seconds >= 1000 && rate > -1) {
-			CSizeFormat::_format format = static_cast<CSizeFormat::_format>(COptions::Get()->GetOptionVal(OPTION_SIZE_FORMAT));
-			if (format == CSizeFormat::bytes) {
-				format = CSizeFormat::iec;
-			}
-			const wxString ratestr = CSizeFormat::Format(rate, true,
-														 format,
-														 COptions::Get()->GetOptionVal(OPTION_SIZE_USETHOUSANDSEP) != 0,
-														 COptions::Get()->GetOptionVal(OPTION_SIZE_DECIMALPLACES));
-			bytes_and_rate.Printf(_("%s (%s/s)"), bytestr, ratestr );
+		if (status_.currentOffset > status_.totalSize) {
+			permill = 1001;
 		}
 		else {
-			bytes_and_rate.Printf(_("%s (? B/s)"), bytestr);
+			permill = static_cast<int>(status_.currentOffset * 1000 / status_.totalSize);
 		}
+	}
 
-		if (m_last_bytes_and_rate != bytes_and_rate) {
-			refresh |= 8;
-			m_last_bytes_and_rate = bytes_and_rate;
-		}
+	if (m_last_bar_split != bar_split || m_last_permill != permill) {
+		refresh |= field_bar;
+		m_last_bar_split = bar_split;
+		m_last_permill = permill;
+	}
 
-		if (status_.totalSize > 0) {
-			bar_split = static_cast<int>(status_.currentOffset * (m_barWidth - 2) / status_.totalSize);
-			if (bar_split > (m_barWidth - 2)) {
-				bar_split = m_barWidth - 2;
-			}
-
-			if (status_.currentOffset > status_.totalSize) {
-				permill = 1001;
-			}
-			else {
-				permill = static_cast<int>(status_.currentOffset * 1000 / status_.totalSize);
-			}
-		}
+	return refresh;
+}
 
-		if (m_last_bar_split != bar_split || m_last_permill != permill) {
-			refresh |= 4;
-			m_last_bar_split = bar_split;
-			m_last_permill = permill;
-		}
+void CStatusLineCtrl::DrawFields(int fields)
+{
+	if (!fields || !m_mdc) {
+		return;
 	}
 
-	if (refresh) {
-		m_mdc->SetFont(GetFont());
-		m_mdc->SetPen(GetBackgroundColour());
-		m_mdc->SetBrush(GetBackgroundColour());
-		m_mdc->SetTextForeground(GetForegroundColour());
+	wxSize const size = GetClientSize();
 
-		// Get character height so that we can center the text vertically.
-		wxCoord h = (rect.GetHeight() - m_textHeight) / 2;
+	m_mdc->SetFont(GetFont());
+	m_mdc->SetPen(GetBackgroundColour());
+	m_mdc->SetBrush(GetBackgroundColour());
+	m_mdc->SetTextForeground(GetForegroundColour());
 
-		if (refresh & 1) {
-			m_mdc->DrawRectangle(0, 0, m_fieldOffsets[0], rect.GetHeight() + 1);
-			DrawRightAlignedText(*m_mdc, wxTimeSpan::Milliseconds(elapsed.get_milliseconds()).Format(_("%H:%M:%S elapsed")), m_fieldOffsets[0], h);
-		}
-		if (refresh & 2) {
-			m_mdc->DrawRectangle(m_fieldOffsets[0], 0, m_fieldOffsets[1] - m_fieldOffsets[0], rect.GetHeight() + 1);
-			if (left != -1) {
-				wxTimeSpan timeLeft(0, 0, left);
-				DrawRightAlignedText(*m_mdc, timeLeft.Format(_("%H:%M:%S left")), m_fieldOffsets[1], h);
-			}
-			else {
-				DrawRightAlignedText(*m_mdc, _("--:--:-- left"), m_fieldOffsets[1], h);
-			}
+	// Get character height so that we can center the text vertically.
+	wxCoord h = (size.GetHeight() - m_textHeight) / 2;
+
+	if (fields & field_status_text) {
+		m_mdc->DrawRectangle(0, 0, size.GetWidth(), size.GetHeight());
+		m_mdc->DrawText(m_statusText, 50, h);
+		return;
+	}
+
+	if (fields & field_elapsed) {
+		m_mdc->DrawRectangle(0, 0, m_fieldOffsets[0], size.GetHeight() + 1);
+		DrawRightAlignedText(*m_mdc, wxTimeSpan::Seconds(m_last_elapsed_seconds).Format(_("%H:%M:%S elapsed")), m_fieldOffsets[0], h);
+	}
+	if (fields & field_left) {
+		m_mdc->DrawRectangle(m_fieldOffsets[0], 0, m_fieldOffsets[1] - m_fieldOffsets[0], size.GetHeight() + 1);
+		if (m_last_left != -1) {
+			wxTimeSpan timeLeft(0, 0, m_last_left);
+			DrawRightAlignedText(*m_mdc, timeLeft.Format(_("%H:%M:%S left")), m_fieldOffsets[1], h);
 		}
-		if (refresh & 8) {
-			m_mdc->DrawRectangle(m_fieldOffsets[3], 0, rect.GetWidth() - m_fieldOffsets[3], rect.GetHeight() + 1);
-			m_mdc->DrawText(bytes_and_rate, m_fieldOffsets[3], h);
+		else {
+			DrawRightAlignedText(*m_mdc, _("--:--:-- left"), m_fieldOffsets[1], h);
 		}
-		if (refresh & 16) {
-			m_mdc->DrawRectangle(m_fieldOffsets[1], 0, m_fieldOffsets[2] - m_fieldOffsets[1], rect.GetHeight() + 1);
+	}
+	if (fields & field_bytes_and_rate) {
+		m_mdc->DrawRectangle(m_fieldOffsets[3], 0, size.GetWidth() - m_fieldOffsets[3], size.GetHeight() + 1);
+		m_mdc->DrawText(m_last_bytes_and_rate, m_fieldOffsets[3], h);
+	}
+	if (fields & field_gap) {
+		m_mdc->DrawRectangle(m_fieldOffsets[1], 0, m_fieldOffsets[2] - m_fieldOffsets[1], size.GetHeight() + 1);
+	}
+	if (fields & field_bar) {
+		m_mdc->DrawRectangle(m_fieldOffsets[2], 0, m_fieldOffsets[3] - m_fieldOffsets[2], size.GetHeight() + 1);
+		if (m_last_bar_split != -1) {
+			DrawProgressBar(*m_mdc, m_fieldOffsets[2], 1, size.GetHeight() - 2, m_last_bar_split, m_last_permill);
 		}
-		if (refresh & 4) {
-			m_mdc->DrawRectangle(m_fieldOffsets[2], 0, m_fieldOffsets[3] - m_fieldOffsets[2], rect.GetHeight() + 1);
-			if (bar_split != -1) {
-				DrawProgressBar(*m_mdc, m_fieldOffsets[2], 1, rect.GetHeight() - 2, bar_split, permill);
-			}
+	}
+}
+
+void CStatusLineCtrl::RefreshFields(int fields)
+{
+	if (!fields) {
+		return;
+	}
+	if (fields & field_status_text) {
+		Refresh(false);
+		return;
+	}
+
+	int const height = GetClientSize().GetHeight();
+	int const right = GetClientSize().GetWidth();
+	auto refresh = [&](int field, int left, int end) {
+		if ((fields & field) && end > left) {
+			RefreshRect(wxRect(left, 0, end - left, height), false);
 		}
+	};
+	refresh(field_elapsed, 0, m_fieldOffsets[0]);
+	refresh(field_left, m_fieldOffsets[0], m_fieldOffsets[1]);
+	refresh(field_gap, m_fieldOffsets[1], m_fieldOffsets[2]);
+	refresh(field_bar, m_fieldOffsets[2], m_fieldOffsets[3]);
+	refresh(field_bytes_and_rate, m_fieldOffsets[3], right);
+}
+
+void CStatusLineCtrl::Redraw()
+{
+	if (!m_mdc) {
+		// Everything gets drawn on the first paint
+		Refresh(false);
+		return;
 	}
-	dc.Blit(0, 0, rect.GetWidth(), rect.GetHeight(), m_mdc.get(), 0, 0);
+
+	int const fields = UpdateFields(false);
+	DrawFields(fields);
+	RefreshFields(fields);
 }
 
 void CStatusLineCtrl::ClearTransferStatus()
 {
 	if (!status_.empty() && status_.totalSize >= 0) {
-		if (m_pEngineData && m_pEngineData->pItem) {
+		if (m_pEngineData && m_pEngineData->pItem && m_pEngineData->batch.empty()) {
 			m_pParent->UpdateItemSize(m_pEngineData->pItem, status_.totalSize);
 		}
 	}
@@ -272,14 +315,10 @@ void CStatusLineCtrl::ClearTransferStatus()
 		break;
 	}
 
-	if (m_transferStatusTimer.IsRunning()) {
-		m_transferStatusTimer.Stop();
-	}
-
 	m_past_data_count = 0;
 
 	m_monentary_speed_data = monentary_speed_data();
-	Refresh(false);
+	Redraw();
 }
 
 void CStatusLineCtrl::SetTransferStatus(CTransferStatus const& status)
@@ -291,48 +330,69 @@ void CStatusLineCtrl::SetTransferStatus(CTransferStatus const& status)
 		status_ = status;
 
 		m_lastOffset = status.currentOffset;
+		UpdateMomentarySpeed();
 
-		if (!m_transferStatusTimer.IsRunning()) {
-			m_transferStatusTimer.Start(100);
-		}
-		Refresh(false);
+		m_pParent->StartTransferStatusUpdates();
+		Redraw();
 	}
 }
 
-void CStatusLineCtrl::OnTimer(wxTimerEvent&)
+bool CStatusLineCtrl::UpdateTransferStatus()
 {
 	if (!m_pEngineData || !m_pEngineData->pEngine) {
-		m_transferStatusTimer.Stop();
-		return;
+		return false;
 	}
 
 	bool changed;
 	CTransferStatus status = m_pEngineData->pEngine->GetTransferStatus(changed);
 
 	if (status.empty()) {
-		ClearTransferStatus();
-	}
-	else if (changed) {
-		if (status.madeProgress && !status.list &&
-			m_pEngineData->pItem->GetType() == QueueItemType::File)
-		{
-			CFileItem* pItem = (CFileItem*)m_pEngineData->pItem;
-			pItem->set_made_progress(true);
+		if (!status_.empty()) {
+			ClearTransferStatus();
 		}
-		SetTransferStatus(status);
+		return false;
 	}
-	else {
-		m_transferStatusTimer.Stop();
+	else if (!changed) {
+		return false;
 	}
+
+	if (status.madeProgress && !status.list &&
+		m_pEngineData->pItem->GetType() == QueueItemType::File)
+	{
+		CFileItem* pItem = (CFileItem*)m_pEngineData->pItem;
+		pItem->set_made_progress(true);
+	}
+	SetTransferStatus(status);
+
+	return true;
 }
 
 void CStatusLineCtrl::DrawRightAlignedText(wxDC& dc, wxString const& text, int x, int y)
 {
-	wxCoord w, h;
-	dc.GetTextExtent(text, &w, &h);
-	x -= w;
+	dc.DrawText(text, x - TextWidth(dc, text), y);
+}
 
-	dc.DrawText(text, x, y);
+wxCoord CStatusLineCtrl::TextWidth(wxDC& dc, wxString const& text)
+{
+	// All status lines share the same font and mostly draw digits, measure
+	// each character only once. Kerning is ignored, the fields have slack.
+	if (!m_charWidthFont.IsOk() || m_charWidthFont != dc.GetFont()) {
+		m_charWidthFont = dc.GetFont();
+		m_charWidths.clear();
+	}
+
+	wxCoord width{};
+	for (auto const& c : text) {
+		wchar_t const ch = static_cast<wchar_t>(c.GetValue());
+		auto it = m_charWidths.find(ch);
+		if (it == m_charWidths.end()) {
+			wxCoord w, h;
+			dc.GetTextExtent(wxString(c), &w, &h);
+			it = m_charWidths.emplace(ch, w).first;
+		}
+		width += it->second;
+	}
+	return width;
 }
 
 void CStatusLineCtrl::OnEraseBackground(wxEraseEvent&)
@@ -378,9 +438,7 @@ void CStatusLineCtrl::DrawProgressBar(wxDC& dc, int x, int y, int height, int ba
 		text = wxString::Format(_T("%d.%d%%"), permill / 10, permill % 10);
 	}
 
-	wxCoord w, h;
-	dc.GetTextExtent(text, &w, &h);
-	dc.DrawText(text, x + m_barWidth / 2 - w / 2, y + height / 2 - h / 2);
+	dc.DrawText(text, x + m_barWidth / 2 - TextWidth(dc, text) / 2, y + height / 2 - m_textHeight / 2);
 }
 
 wxFileOffset CStatusLineCtrl::GetAverageSpeed(int elapsed_milli_seconds)
@@ -416,45 +474,50 @@ wxFileOffset CStatusLineCtrl::GetAverageSpeed(int elapsed_milli_seconds)
 
 wxFileOffset CStatusLineCtrl::GetMomentarySpeed()
 {
-	if (status_.empty()) {
+	if (status_.empty() || m_monentary_speed_data.speed < 0) {
 		return -1;
 	}
 
-	if (m_monentary_speed_data.last_offset < 0) {
+	return static_cast<wxFileOffset>(m_monentary_speed_data.speed);
+}
+
+void CStatusLineCtrl::UpdateMomentarySpeed()
+{
+	auto const now = fz::monotonic_clock::now();
+	if (m_monentary_speed_data.last_offset < 0 || !m_monentary_speed_data.last_update) {
+		m_monentary_speed_data.last_update = now;
 		m_monentary_speed_data.last_offset = status_.currentOffset;
-	}
-	
-	if (!m_monentary_speed_data.last_update) {
-		m_monentary_speed_data.last_update = fz::monotonic_clock::now();
-		return -1;
+		return;
 	}
 
-	fz::duration const time_diff = fz::monotonic_clock::now() - m_monentary_speed_data.last_update;
-	if (time_diff.get_seconds() >= 2) {
-		m_monentary_speed_data.last_update = fz::monotonic_clock::now();
-	}
-	else if (m_monentary_speed_data.last_speed >= 0 || !time_diff) {
-		return m_monentary_speed_data.last_speed;
+	int64_t const elapsed = (now - m_monentary_speed_data.last_update).get_milliseconds();
+	if (elapsed < 50) {
+		return;
 	}
-	
+
 	wxFileOffset const fileOffsetDiff = status_.currentOffset - m_monentary_speed_data.last_offset;
+	m_monentary_speed_data.last_update = now;
 	m_monentary_speed_data.last_offset = status_.currentOffset;
-	if (fileOffsetDiff >= 0) {
-		m_monentary_speed_data.last_speed = fileOffsetDiff * 1000 / time_diff.get_milliseconds();
+	if (fileOffsetDiff < 0) {
+		return;
 	}
 
-	return m_monentary_speed_data.last_speed;
+	// Samples are weighted by the time they cover, older ones fade out
+	// with a time constant of two seconds.
+	double const sample = static_cast<double>(fileOffsetDiff) * 1000 / elapsed;
+	if (m_monentary_speed_data.speed < 0) {
+		m_monentary_speed_data.speed = sample;
+	}
+	else {
+		double const weight = 1 - std::exp(-static_cast<double>(elapsed) / 2000);
+		m_monentary_speed_data.speed += weight * (sample - m_monentary_speed_data.speed);
+	}
 }
 
 bool CStatusLineCtrl::Show(bool show)
 {
 	if (show) {
-		if (!m_transferStatusTimer.IsRunning()) {
-			m_transferStatusTimer.Start(100);
-		}
-	}
-	else {
-		m_transferStatusTimer.Stop();
+		m_pParent->StartTransferStatusUpdates();
 	}
 
 	return wxWindow::Show(show);
@@ -1,6 +1,8 @@
 #ifndef FILEZILLA_INTERFACE_STATUSLINECTRL_HEADER
 #define FILEZILLA_INTERFACE_STATUSLINECTRL_HEADER
 
+#include <unordered_map>
+
 class CQueueView;
 class CStatusLineCtrl final : public wxWindow
 {
@@ -15,6 +17,10 @@ public:
 	void SetTransferStatus(CTransferStatus const& status);
 	void ClearTransferStatus();
 
+	// Polls the engine for the current transfer status, called by the queue
+	// for all status lines at once. Returns true if the status has changed.
+	bool UpdateTransferStatus();
+
 	int64_t GetLastOffset() const { return status_.empty() ? m_lastOffset : status_.currentOffset; }
 	int64_t GetTotalSize() const { return status_.empty() ? -1 : status_.totalSize; }
 	wxFileOffset GetAverageSpeed(int elapsed_milli_seconds);
@@ -28,12 +34,33 @@ protected:
 	void DrawRightAlignedText(wxDC& dc, wxString const& text, int x, int y);
 	void DrawProgressBar(wxDC& dc, int x, int y, int height, int bar_split, int permill);
 
+	static wxCoord TextWidth(wxDC& dc, wxString const& text);
+	static wxFont m_charWidthFont;
+	static std::unordered_map<wchar_t, wxCoord> m_charWidths;
+
+	enum : int {
+		field_elapsed = 0x01,
+		field_left = 0x02,
+		field_bar = 0x04,
+		field_bytes_and_rate = 0x08,
+		field_gap = 0x10,
+		field_all = 0x1f,
+		field_status_text = 0x20
+	};
+
+	// Status updates draw the fields that changed into the bitmap and only
+	// invalidate those, painting merely copies from the bitmap.
+	// UpdateFields returns the fields that changed since the last call.
+	int UpdateFields(bool force);
+	void DrawFields(int fields);
+	void RefreshFields(int fields);
+	void Redraw();
+
 	CQueueView* m_pParent;
 	const t_EngineData* m_pEngineData;
 	CTransferStatus status_;
 
 	wxString m_statusText;
-	wxTimer m_transferStatusTimer;
 
 	static int m_fieldOffsets[4];
 	static int m_barWidth;
@@ -53,11 +80,13 @@ protected:
 	} m_past_data[10];
 	int m_past_data_count{};
 
-	//Used by GetMomentarySpeed
+	// Exponentially weighted moving average of the speed, sampled
+	// whenever the status changes. Used by GetMomentarySpeed.
+	void UpdateMomentarySpeed();
 	struct monentary_speed_data {
 		fz::monotonic_clock last_update;
 		wxFileOffset last_offset{-1};
-		wxFileOffset last_speed{-1};
+		double speed{-1};
 	} m_monentary_speed_data;
 
 	//Used to avoid excessive redraws
@@ -72,7 +101,6 @@ protected:
 
 	DECLARE_EVENT_TABLE()
 	void OnPaint(wxPaintEvent& event);
-	void OnTimer(wxTimerEvent& event);
 	void OnEraseBackground(wxEraseEvent& event);
 };
 
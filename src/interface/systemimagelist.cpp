@@ -5,6 +5,13 @@
 #include "themeprovider.h"
 #ifdef __WXMSW__
 #include "shlobj.h"
+
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread.hpp>
+
+#include <deque>
+#include <set>
+#include <tuple>
 #else
 #include <wx/mimetype.h>
 #include "graphics.h"
@@ -37,8 +44,281 @@ static void OverlaySymlink(wxBitmap& bmp)
 }
 #endif
 
+#ifdef __WXMSW__
+namespace {
+int ShellIconIndex(iconType type, wchar_t const* name, bool physical)
+{
+	SHFILEINFO shFinfo{};
+	if (SHGetFileInfo(name,
+		(type != iconType::file) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL,
+		&shFinfo,
+		sizeof(SHFILEINFO),
+		SHGFI_SYSICONINDEX | ((type == iconType::opened_dir) ? SHGFI_OPENICON : 0) | (physical ? 0 : SHGFI_USEFILEATTRIBUTES)))
+	{
+		return shFinfo.iIcon;
+	}
+	return -1;
+}
+
+// Indexes into the system image list are the same for all image lists of
+// the process. Shell lookups of physical files are done on a worker
+// thread, which runs as long as there are image lists.
+//
+// Most physical files have the icon of their extension. Once a few files
+// of an extension had it, others of the same extension are assumed to
+// have it as well, without looking them up. Directories are always
+// looked up, they can have custom icons.
+class CIconResolver final
+{
+public:
+	static CIconResolver& Get()
+	{
+		static CIconResolver resolver;
+		return resolver;
+	}
+
+	void Register(CSystemImageList* list);
+	void Unregister(CSystemImageList* list);
+
+	int GetIconIndex(iconType type, std::wstring const& fileName, bool physical, bool* provisional);
+
+private:
+	typedef std::pair<iconType, std::wstring> key;
+
+	int ByExtension(iconType type, std::wstring const& ext);
+	bool HasExtensionIcon(std::wstring const& ext) const;
+	void Queue(key const& k);
+	int Store(iconType type, std::wstring && path, int icon);
+	void Worker();
+	void OnResults();
+
+	static std::wstring Extension(iconType type, std::wstring const& fileName);
+
+	// GUI thread only
+	std::set<CSystemImageList*> lists_;
+	std::map<key, int> extensions_;
+	std::map<key, int> physical_;
+
+	struct samples final
+	{
+		int agreeing{};
+		bool individual{};
+	};
+	std::map<std::wstring, samples> samples_;
+
+	fz::mutex mutex_{false};
+	fz::condition cond_;
+	fz::thread thread_;
+	bool quit_{};
+	bool notifyPending_{};
+	std::deque<key> queue_;
+	std::set<key> queued_;
+	std::vector<std::tuple<iconType, std::wstring, int>> results_;
+
+	static constexpr int uniform_samples = 3;
+	static constexpr size_t max_queue = 1000;
+	static constexpr size_t max_physical = 50000;
+};
+
+void CIconResolver::Register(CSystemImageList* list)
+{
+	lists_.insert(list);
+}
+
+void CIconResolver::Unregister(CSystemImageList* list)
+{
+	lists_.erase(list);
+	if (!lists_.empty()) {
+		return;
+	}
+
+	{
+		fz::scoped_lock l(mutex_);
+		quit_ = true;
+		queue_.clear();
+		queued_.clear();
+		cond_.signal(l);
+	}
+	thread_.join();
+}
+
+std::wstring CIconResolver::Extension(iconType type, std::wstring const& fileName)
+{
+	if (type != iconType::file) {
+		return std::wstring();
+	}
+
+	std::wstring ext = fz::str_tolower_ascii(GetExtension(fileName));
+	if (ext == L".") {
+		ext.clear();
+	}
+	return ext;
+}
+
+int CIconResolver::ByExtension(iconType type, std::wstring const& ext)
+{
+	auto & icon = extensions_.emplace(key(type, ext), -2).first->second;
+	if (icon == -2) {
+		std::wstring const name = ext.empty() ? std::wstring(L"{B97D3074-1830-4b4a-9D8A-17A38B074052}") : (L"_." + ext);
+		icon = ShellIconIndex(type, name.c_str(), false);
+	}
+	return icon;
+}
+
+bool CIconResolver::HasExtensionIcon(std::wstring const& ext) const
+{
+	auto const it = samples_.find(ext);
+	return it != samples_.cend() && !it->second.individual && it->second.agreeing >= uniform_samples;
+}
+
+int CIconResolver::GetIconIndex(iconType type, std::wstring const& fileName, bool physical, bool* provisional)
+{
+	std::wstring const ext = Extension(type, fileName);
+	int const icon = ByExtension(type, ext);
+	if (!physical || (type == iconType::file && HasExtensionIcon(ext))) {
+		return icon;
+	}
+
+	key k(type, fileName);
+	auto const it = physical_.find(k);
+	if (it != physical_.cend()) {
+		return it->second;
+	}
+
+	if (provisional) {
+		*provisional = true;
+		Queue(k);
+		return icon;
+	}
+
+	if (physical_.size() >= max_physical) {
+		physical_.clear();
+	}
+	return Store(type, std::move(k.second), ShellIconIndex(type, fileName.c_str(), true));
+}
+
+int CIconResolver::Store(iconType type, std::wstring && path, int icon)
+{
+	std::wstring const ext = Extension(type, path);
+	int const extIcon = ByExtension(type, ext);
+	if (icon == -1) {
+		icon = extIcon;
+	}
+
+	if (type == iconType::file) {
+		auto & s = samples_[ext];
+		if (icon == extIcon) {
+			++s.agreeing;
+		}
+		else {
+			s.individual = true;
+		}
+	}
+
+	physical_[key(type, std::move(path))] = icon;
+	return icon;
+}
+
+void CIconResolver::Queue(key const& k)
+{
+	fz::scoped_lock l(mutex_);
+	if (!queued_.insert(k).second) {
+		return;
+	}
+	queue_.push_back(k);
+	if (queue_.size() > max_queue) {
+		// Requested long ago, likely no longer visible. If it still is,
+		// it gets requested again.
+		queued_.erase(queue_.front());
+		queue_.pop_front();
+	}
+
+	if (!thread_.joinable()) {
+		quit_ = false;
+		if (!thread_.run([this]() { Worker(); })) {
+			queued_.clear();
+			queue_.clear();
+			return;
+		}
+	}
+	cond_.signal(l);
+}
+
+void CIconResolver::Worker()
+{
+	HRESULT const hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
+
+	fz::scoped_lock l(mutex_);
+	while (!quit_) {
+		if (queue_.empty()) {
+			cond_.wait(l);
+			continue;
+		}
+
+		// Newest first, those are the ones currently displayed
+		key k = std::move(queue_.back());
+		queue_.pop_back();
+		queued_.erase(k);
+		l.unlock();
+
+		int const icon = ShellIconIndex(k.first, k.second.c_str(), true);
+
+		l.lock();
+		results_.emplace_back(k.first, std::move(k.second), icon);
+		if (!notifyPending_) {
+			notifyPending_ = true;
+			wxTheApp->CallAfter([this]() { OnResults(); });
+		}
+	}
+	l.unlock();
+
+	if (SUCCEEDED(hr)) {
+		CoUninitialize();
+	}
+}
+
+void CIconResolver::OnResults()
+{
+	std::vector<std::tuple<iconType, std::wstring, int>> results;
+	{
+		fz::scoped_lock l(mutex_);
+		results.swap(results_);
+		notifyPending_ = false;
+	}
+	if (results.empty()) {
+		return;
+	}
+
+	if (physical_.size() + results.size() > max_physical) {
+		physical_.clear();
+	}
+
+	for (auto & result : results) {
+		Store(std::get<0>(result), std::move(std::get<1>(result)), std::get<2>(result));
+	}
+
+	for (auto * list : lists_) {
+		list->OnSystemIconsChanged();
+	}
+}
+}
+#else
+namespace {
+// Icons from the MIME database, shared by all image lists. Invalid if
+// there is none for the extension.
+std::map<std::pair<std::wstring, bool>, wxBitmap> mimeIcons;
+size_t imageLists{};
+}
+#endif
+
 CSystemImageList::CSystemImageList(int size)
 {
+#ifdef __WXMSW__
+	CIconResolver::Get().Register(this);
+#else
+	++imageLists;
+#endif
+
 	if (size != -1) {
 		CreateSystemImageList(size);
 	}
@@ -100,6 +380,14 @@ bool CSystemImageList::CreateSystemImageList(int size)
 
 CSystemImageList::~CSystemImageList()
 {
+#ifdef __WXMSW__
+	CIconResolver::Get().Unregister(this);
+#else
+	if (!--imageLists) {
+		mimeIcons.clear();
+	}
+#endif
+
 	if (!m_pImageList) {
 		return;
 	}
@@ -126,8 +414,12 @@ wxBitmap PrepareIcon(wxIcon icon, wxSize size)
 }
 #endif
 
-int CSystemImageList::GetIconIndex(iconType type, std::wstring const& fileName, bool physical, bool symlink)
+int CSystemImageList::GetIconIndex(iconType type, std::wstring const& fileName, bool physical, bool symlink, bool* provisional)
 {
+	if (provisional) {
+		*provisional = false;
+	}
+
 	if (!m_pImageList) {
 		return -1;
 	}
@@ -137,19 +429,7 @@ int CSystemImageList::GetIconIndex(iconType type, std::wstring const& fileName,
 		physical = false;
 	}
 
-	SHFILEINFO shFinfo;
-	memset(&shFinfo, 0, sizeof(SHFILEINFO));
-	if (SHGetFileInfo(!fileName.empty() ? fileName.c_str() : L"{B97D3074-1830-4b4a-9D8A-17A38B074052}",
-		(type != iconType::file) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL,
-		&shFinfo,
-		sizeof(SHFILEINFO),
-		SHGFI_ICON | ((type == iconType::opened_dir) ? SHGFI_OPENICON : 0) | ((physical) ? 0 : SHGFI_USEFILEATTRIBUTES) ) )
-	{
-		int icon = shFinfo.iIcon;
-		// we only need the index from the system image list
-		DestroyIcon(shFinfo.hIcon);
-		return icon;
-	}
+	return CIconResolver::Get().GetIconIndex(type, fileName, physical, provisional);
 #else
 	(void)physical;
 
@@ -171,52 +451,46 @@ int CSystemImageList::GetIconIndex(iconType type, std::wstring const& fileName,
 		return icon;
 	}
 
-	if (symlink) {
-		auto cacheIter = m_iconCache.find(ext);
-		if (cacheIter != m_iconCache.cend()) {
-			return cacheIter->second;
-		}
-	}
-	else {
-		auto cacheIter = m_iconSymlinkCache.find(ext);
-		if (cacheIter != m_iconSymlinkCache.cend()) {
-			return cacheIter->second;
-		}
+	auto & cache = symlink ? m_iconSymlinkCache : m_iconCache;
+	auto cacheIter = cache.find(ext);
+	if (cacheIter != cache.cend()) {
+		return cacheIter->second;
 	}
 
-	wxFileType *pType = wxTheMimeTypesManager->GetFileTypeFromExtension(ext);
-	if (!pType) {
-		m_iconCache[ext] = icon;
-		return icon;
-	}
+	auto mimeIter = mimeIcons.find(std::make_pair(ext, symlink));
+	if (mimeIter == mimeIcons.end()) {
+		wxBitmap bmp;
 
-	wxIconLocation loc;
-	if (pType->GetIcon(&loc) && loc.IsOk()) {
-		wxLogNull nul;
-		wxIcon newIcon(loc);
+		wxFileType *pType = wxTheMimeTypesManager->GetFileTypeFromExtension(ext);
+		if (pType) {
+			wxIconLocation loc;
+			if (pType->GetIcon(&loc) && loc.IsOk()) {
+				wxLogNull nul;
+				wxIcon newIcon(loc);
 
-		if (newIcon.Ok()) {
-			wxBitmap bmp = PrepareIcon(newIcon, CThemeProvider::GetIconSize(iconSizeSmall));
-			if (symlink) {
-				OverlaySymlink(bmp);
-			}
-			int index = m_pImageList->Add(bmp);
-			if (index > 0) {
-				icon = index;
+				if (newIcon.Ok()) {
+					bmp = PrepareIcon(newIcon, CThemeProvider::GetIconSize(iconSizeSmall));
+					if (symlink) {
+						OverlaySymlink(bmp);
+					}
+				}
 			}
+			delete pType;
 		}
-	}
-	delete pType;
 
-	if (symlink) {
-		m_iconCache[ext] = icon;
+		mimeIter = mimeIcons.emplace(std::make_pair(ext, symlink), bmp).first;
 	}
-	else {
-		m_iconSymlinkCache[ext] = icon;
+
+	if (mimeIter->second.IsOk()) {
+		int index = m_pImageList->Add(mimeIter->second);
+		if (index > 0) {
+			icon = index;
+		}
 	}
+
+	cache[ext] = icon;
 	return icon;
 #endif
-	return -1;
 }
 
 #ifdef __WXMSW__
@@ -40,7 +40,15 @@ public:
 
 	wxImageList* GetSystemImageList() { return m_pImageList; }
 
-	int GetIconIndex(iconType type, std::wstring const& fileName = std::wstring(), bool physical = true, bool symlink = false);
+	// Icons are cached by type and extension, shared by all image lists.
+	// On Windows, physical files and directories can have icons of their
+	// own. If provisional is given, those get looked up in the background:
+	// Until their icon is known, the icon of their extension is returned
+	// with *provisional set, and OnSystemIconsChanged gets called once
+	// more icons are known.
+	int GetIconIndex(iconType type, std::wstring const& fileName = std::wstring(), bool physical = true, bool symlink = false, bool* provisional = nullptr);
+
+	virtual void OnSystemIconsChanged() {}
 
 #ifdef __WXMSW__
 	int GetLinkOverlayIndex();
@@ -1,14 +1,18 @@
 #include <filezilla.h>
 #include "themeprovider.h"
+#include "buildinfo.h"
 #include "filezillaapp.h"
 #include "Options.h"
 #include "xmlfunctions.h"
 
 #include <wx/animate.h>
 
+#include <libfilezilla/file.hpp>
 #include <libfilezilla/format.hpp>
 #include <libfilezilla/local_filesys.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <utility>
 
 #ifdef __WXGTK__
@@ -17,6 +21,9 @@
 
 static CThemeProvider* instance = 0;
 
+// Icons per row in the atlases
+static size_t const atlas_columns = 16;
+
 wxSize CTheme::StringToSize(std::wstring const& str)
 {
 	wxSize ret;
@@ -84,6 +91,13 @@ bool CTheme::Load(std::wstring const& theme, std::vector<wxSize> sizes)
 
 wxBitmap const& CTheme::LoadBitmap(std::wstring const& name, wxSize const& size)
 {
+#ifndef __WXMAC__
+	auto & a = atlases_[size];
+	if (!a.loaded_) {
+		LoadAtlas(size, a);
+	}
+#endif
+
 	// First, check for name in cache
 	auto it = cache_.find(name);
 	if (it == cache_.end()) {
@@ -104,7 +118,14 @@ wxBitmap const& CTheme::LoadBitmap(std::wstring const& name, wxSize const& size)
 		return sit->second;
 	}
 
-	return DoLoadBitmap(name, size, it->second);
+	wxBitmap const& bmp = DoLoadBitmap(name, size, it->second);
+#ifndef __WXMAC__
+	if (bmp.IsOk() && !timestamp_.empty()) {
+		a.names_.push_back(name);
+		a.dirty_ = true;
+	}
+#endif
+	return bmp;
 }
 
 wxBitmap const& CTheme::DoLoadBitmap(std::wstring const& name, wxSize const& size, cacheEntry & cache)
@@ -240,6 +261,145 @@ std::vector<wxBitmap> CTheme::GetAllImages(wxSize const& size)
 	return ret;
 }
 
+std::wstring CTheme::GetAtlasFile(wxSize const& size) const
+{
+	if (timestamp_.empty()) {
+		return std::wstring();
+	}
+
+	CLocalPath const cacheDir = COptions::Get()->GetCacheDirectory();
+	if (cacheDir.empty()) {
+		return std::wstring();
+	}
+
+	return cacheDir.GetPath() + fz::sprintf(L"%s_atlas_%dx%d", theme_, size.x, size.y);
+}
+
+void CTheme::LoadAtlas(wxSize const& size, atlas & a)
+{
+	a.loaded_ = true;
+
+	std::wstring const file = GetAtlasFile(size);
+	if (file.empty()) {
+		return;
+	}
+
+	auto const cacheTime = fz::local_filesys::get_modification_time(fz::to_native(file + L".png"));
+	if (cacheTime.empty() || cacheTime < timestamp_) {
+		return;
+	}
+
+	// The index lists the icons in the order they appear in the atlas,
+	// preceded by the version having written it.
+	std::string index;
+	{
+		fz::file f(fz::to_native(file + L".txt"), fz::file::reading);
+		if (!f.opened()) {
+			return;
+		}
+
+		char buffer[4096];
+		int64_t read;
+		while ((read = f.read(buffer, sizeof(buffer))) > 0) {
+			index.append(buffer, static_cast<size_t>(read));
+			if (index.size() > 1024 * 1024) {
+				return;
+			}
+		}
+		if (read < 0) {
+			return;
+		}
+	}
+
+	auto const lines = fz::strtok(index, "\n");
+	if (lines.size() < 2 || lines[0] != fz::to_utf8(CBuildInfo::GetVersion())) {
+		return;
+	}
+
+	wxImage const img(file + L".png", wxBITMAP_TYPE_PNG);
+	if (!img.IsOk()) {
+		return;
+	}
+
+	for (size_t i = 1; i < lines.size(); ++i) {
+		int const x = static_cast<int>((i - 1) % atlas_columns) * size.x;
+		int const y = static_cast<int>((i - 1) / atlas_columns) * size.y;
+		if (x + size.x > img.GetWidth() || y + size.y > img.GetHeight()) {
+			break;
+		}
+
+		std::wstring const name = fz::to_wstring_from_utf8(lines[i]);
+		cache_[name].bitmaps_.insert(std::make_pair(size, wxBitmap(img.GetSubImage(wxRect(x, y, size.x, size.y)))));
+		a.names_.push_back(name);
+	}
+}
+
+void CTheme::SaveAtlas(wxSize const& size, atlas const& a)
+{
+	std::wstring const file = GetAtlasFile(size);
+	if (file.empty() || a.names_.empty()) {
+		return;
+	}
+
+	CLocalPath cacheDir = COptions::Get()->GetCacheDirectory();
+	if (!cacheDir.Create()) {
+		return;
+	}
+
+	// Without index the atlas is ignored, so a partially written one does no harm
+	fz::remove_file(fz::to_native(file + L".txt"));
+
+	size_t const columns = std::min(a.names_.size(), atlas_columns);
+	size_t const rows = (a.names_.size() + columns - 1) / columns;
+	wxImage img(static_cast<int>(columns) * size.x, static_cast<int>(rows) * size.y);
+	img.InitAlpha();
+	memset(img.GetAlpha(), 0, static_cast<size_t>(img.GetWidth()) * img.GetHeight());
+
+	std::string index = fz::to_utf8(CBuildInfo::GetVersion()) + "\n";
+
+	size_t i = 0;
+	for (auto const& name : a.names_) {
+		auto const it = cache_.find(name);
+		if (it == cache_.end()) {
+			continue;
+		}
+		auto const bit = it->second.bitmaps_.find(size);
+		if (bit == it->second.bitmaps_.end() || bit->second.GetSize() != size) {
+			continue;
+		}
+
+		wxImage icon = bit->second.ConvertToImage();
+		if (!icon.HasAlpha()) {
+			icon.InitAlpha();
+		}
+		img.Paste(icon, static_cast<int>(i % atlas_columns) * size.x, static_cast<int>(i / atlas_columns) * size.y);
+		index += fz::to_utf8(name) + "\n";
+		++i;
+	}
+
+	if (!i || !img.SaveFile(file + L".png", wxBITMAP_TYPE_PNG)) {
+		return;
+	}
+
+	fz::file f(fz::to_native(file + L".txt"), fz::file::writing, fz::file::empty);
+	if (!f.opened() || f.write(index.c_str(), static_cast<int64_t>(index.size())) != static_cast<int64_t>(index.size())) {
+		f.close();
+		fz::remove_file(fz::to_native(file + L".txt"));
+	}
+}
+
+void CTheme::SaveAtlases()
+{
+	wxLogNull null;
+
+	for (auto it = atlases_.begin(); it != atlases_.end(); ++it) {
+		if (it->second.dirty_) {
+			SaveAtlas(it->first, it->second);
+			it->second.dirty_ = false;
+		}
+	}
+}
+
 wxAnimation CTheme::LoadAnimation(std::wstring const& name, wxSize const& size)
 {
 	std::wstring path = path_ + fz::sprintf(L"%dx%d/%s.gif", size.x, size.y, name);
@@ -343,6 +503,13 @@ wxBitmap CThemeProvider::CreateBitmap(wxArtID const& id, wxArtClient const& clie
 	return *bmp;
 }
 
+void CThemeProvider::SaveAtlases()
+{
+	for (auto & theme : themes_) {
+		theme.second.SaveAtlases();
+	}
+}
+
 wxAnimation CThemeProvider::CreateAnimation(wxArtID const& id, wxSize const& size)
 {
 	if (id.Left(4) != _T("ART_")) {
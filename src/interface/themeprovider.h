@@ -33,6 +33,9 @@ public:
 	std::wstring get_mail() const { return mail_; }
 
 	std::vector<wxBitmap> GetAllImages(wxSize const& size);
+
+	// Writes the atlases which got new icons since being loaded
+	void SaveAtlases();
 private:
 	struct size_cmp final
 	{
@@ -54,6 +57,20 @@ private:
 
 	wxImage const& LoadImageWithSpecificSize(std::wstring const& file, wxSize const& size, cacheEntry & cache);
 
+	// All icons used in one size, pre-rasterized into a single image in the
+	// cache directory. Loading it takes a single decode instead of loading
+	// and scaling each icon on its own.
+	struct atlas
+	{
+		bool loaded_{};
+		bool dirty_{};
+		std::vector<std::wstring> names_;
+	};
+
+	void LoadAtlas(wxSize const& size, atlas & a);
+	void SaveAtlas(wxSize const& size, atlas const& a);
+	std::wstring GetAtlasFile(wxSize const& size) const;
+
 	std::wstring theme_;
 	std::wstring path_;
 
@@ -66,6 +83,8 @@ private:
 	std::map<wxSize, bool, size_cmp> sizes_;
 
 	std::map<std::wstring, cacheEntry> cache_;
+
+	std::map<wxSize, atlas, size_cmp> atlases_;
 };
 
 class CThemeProvider final : public wxArtProvider, protected COptionChangeEventHandler
@@ -90,6 +109,8 @@ public:
 
 	virtual wxBitmap CreateBitmap(wxArtID const& id, wxArtClient const& client, wxSize const& size);
 
+	void SaveAtlases();
+
 protected:
 
 	virtual void OnOptionsChanged(changed_options_t const& options);
@@ -18,12 +18,18 @@
 #include <libfilezilla/signature.hpp>
 #include <libfilezilla/translate.hpp>
 
+#include <cstring>
 #include <string>
 
 BEGIN_EVENT_TABLE(CUpdater, wxEvtHandler)
 EVT_TIMER(wxID_ANY, CUpdater::OnTimer)
 END_EVENT_TABLE()
 
+namespace {
+// Failed downloads are resumed this often before giving up
+int const max_download_retries = 5;
+}
+
 // BASE-64 encoded DER without the BEGIN/END CERTIFICATE
 static char s_update_cert[] = "\
 MIIFsTCCA5ugAwIBAgIESnXLbzALBgkqhkiG9w0BAQ0wSTELMAkGA1UEBhMCREUx\n\
@@ -103,6 +109,7 @@ void CUpdater::Init()
 
 	update_timer_.SetOwner(this);
 	update_timer_.Start(1000 * 3600);
+	retry_timer_.SetOwner(this);
 
 	if (!instance) {
 		instance = this;
@@ -274,6 +281,9 @@ bool CUpdater::Run(bool manual)
 	local_file_.clear();
 	log_ = fz::sprintf(_("Started update check on %s\n"), t.format(L"%Y-%m-%d %H:%M:%S", fz::datetime::local));
 	manual_ = manual;
+	retries_ = 0;
+	delta_ = false;
+	delta_failed_ = false;
 
 	std::wstring build = CBuildInfo::GetBuildType();
 	if (build.empty())  {
@@ -306,6 +316,56 @@ int CUpdater::Download(std::wstring const& url, std::wstring const& local_file)
 	return ContinueDownload();
 }
 
+UpdaterState CUpdater::StartDownload()
+{
+	std::wstring const temp = GetTempFile();
+
+	delta_ = false;
+	if (!delta_failed_ && fz::local_filesys::get_size(fz::to_native(temp)) <= 0) {
+		std::wstring base;
+		delta const* d = FindDelta(base);
+		if (d) {
+			log_ += fz::sprintf(_("Downloading delta package against %s\n"), base);
+			delta_ = true;
+			if (Download(d->url_, GetDeltaFile()) == FZ_REPLY_WOULDBLOCK) {
+				return UpdaterState::newversion_downloading;
+			}
+			delta_ = false;
+			delta_failed_ = true;
+			pending_commands_.clear();
+		}
+	}
+
+	if (Download(version_information_.available_.url_, temp) != FZ_REPLY_WOULDBLOCK) {
+		return UpdaterState::newversion;
+	}
+	return UpdaterState::newversion_downloading;
+}
+
+UpdaterState CUpdater::RetryDownload()
+{
+	pending_commands_.clear();
+
+	if (delta_) {
+		// Not worth resuming, the full package still works
+		log_ += fztranslate("Could not download the delta package, downloading the full package") + L"\n";
+		delta_ = false;
+		delta_failed_ = true;
+		fz::remove_file(fz::to_native(GetDeltaFile()));
+		return StartDownload();
+	}
+
+	if (retries_ >= max_download_retries) {
+		return UpdaterState::newversion;
+	}
+
+	// The partial file is resumed from where it stopped
+	int const delay = 30 << ++retries_;
+	log_ += fz::sprintf(_("Download failed, resuming in %d seconds\n"), delay);
+	retry_timer_.StartOnce(delay * 1000);
+	return UpdaterState::newversion_downloading;
+}
+
 int CUpdater::Request(fz::uri const& uri)
 {
 	wxASSERT(pending_commands_.empty());
@@ -347,6 +407,14 @@ bool CUpdater::CreateConnectCommand(std::wstring const& url)
 		return false;
 	}
 
+	if (!manual_) {
+		// Automatic downloads run in the background, leave the bandwidth to the user's transfers
+		int const limit = COptions::Get()->GetOptionVal(OPTION_UPDATECHECK_SPEEDLIMIT);
+		if (limit > 0) {
+			s.server.SetSpeedLimits(limit, 0);
+		}
+	}
+
 	pending_commands_.emplace_back(new CConnectCommand(s.server, s.Handle(), s.credentials));
 	return true;
 }
@@ -464,6 +532,7 @@ UpdaterState CUpdater::ProcessFinishedData(bool can_download)
 		if (!local_file.empty() && fz::local_filesys::get_file_type(fz::to_native(local_file)) != fz::local_filesys::unknown) {
 			local_file_ = local_file;
 			log_ += fz::sprintf(_("Local file is %s\n"), local_file);
+			SetPackage(local_file);
 			s = UpdaterState::newversion_ready;
 		}
 		else {
@@ -474,14 +543,16 @@ UpdaterState CUpdater::ProcessFinishedData(bool can_download)
 				s = UpdaterState::newversion;
 			}
 			else {
-				s = UpdaterState::newversion_downloading;
 				auto size = fz::local_filesys::get_size(fz::to_native(temp));
 				if (size >= 0 && size >= version_information_.available_.size_) {
 					s = ProcessFinishedDownload();
 				}
-				else if (!can_download || Download(version_information_.available_.url_, temp) != FZ_REPLY_WOULDBLOCK) {
+				else if (!can_download) {
 					s = UpdaterState::newversion;
 				}
+				else {
+					s = StartDownload();
+				}
 			}
 		}
 	}
@@ -517,13 +588,16 @@ void CUpdater::ProcessOperation(COperationNotification const& operation)
 
 	if (res != FZ_REPLY_OK) {
 		if (state_ != UpdaterState::checking) {
-			s = UpdaterState::newversion;
+			s = RetryDownload();
 		}
 	}
 	else if (state_ == UpdaterState::checking) {
 		COptions::Get()->SetOption(OPTION_UPDATECHECK_LASTVERSION, CBuildInfo::GetVersion());
 		s = ProcessFinishedData(true);
 	}
+	else if (delta_) {
+		s = ProcessFinishedDelta();
+	}
 	else {
 		s = ProcessFinishedDownload();
 	}
@@ -556,11 +630,37 @@ UpdaterState CUpdater::ProcessFinishedDownload()
 		else {
 			local_file_ = local_file;
 			log_ += fz::sprintf(_("Local file is %s\n"), local_file);
+			SetPackage(local_file);
 		}
 	}
 	return s;
 }
 
+UpdaterState CUpdater::ProcessFinishedDelta()
+{
+	delta_ = false;
+
+	std::wstring const delta_file = GetDeltaFile();
+	std::wstring const temp = GetTempFile();
+
+	UpdaterState s = UpdaterState::newversion;
+
+	// The rebuilt package is subject to the same signed checksum as a downloaded one
+	std::wstring base;
+	if (FindDelta(base) && ApplyDelta(base, delta_file, temp)) {
+		s = ProcessFinishedDownload();
+	}
+	fz::remove_file(fz::to_native(delta_file));
+
+	if (s != UpdaterState::newversion_ready) {
+		log_ += fztranslate("Could not apply the delta package, downloading the full package") + L"\n";
+		fz::remove_file(fz::to_native(temp));
+		delta_failed_ = true;
+		s = StartDownload();
+	}
+	return s;
+}
+
 std::wstring CUpdater::GetLocalFile(build const& b, bool allow_existing)
 {
 	std::wstring const fn = GetFilename(b.url_);
@@ -679,6 +779,21 @@ void CUpdater::ParseData()
 			}
 			continue;
 		}
+		else if (type == L"delta") {
+			// Format: delta version url size sha512 hash_of_base_package
+			// Needs no signature, the rebuilt package has to match the signed hash of the full one.
+			if (tokens.size() >= 6 && UpdatableBuild() && fz::equal_insensitive_ascii(tokens[4], std::wstring(L"sha512"))) {
+				delta d;
+				d.version_ = tokens[1];
+				d.url_ = tokens[2];
+				d.size_ = fz::to_integral<int64_t>(tokens[3], -1);
+				d.base_hash_ = fz::str_tolower_ascii(tokens[5]);
+				if (d.size_ > 0 && !GetFilename(d.url_).empty()) {
+					version_information_.deltas_.push_back(d);
+				}
+			}
+			continue;
+		}
 		else if (type == L"eol") {
 #if defined(__WXMSW__) || defined(__WXMAC__)
 			std::string host = fz::to_utf8(CBuildInfo::GetHostname());
@@ -833,8 +948,15 @@ void CUpdater::ParseData()
 	COptions::Get()->SetOption(OPTION_UPDATECHECK_NEWVERSION, raw_version_information_);
 }
 
-void CUpdater::OnTimer(wxTimerEvent&)
+void CUpdater::OnTimer(wxTimerEvent& ev)
 {
+	if (&ev.GetTimer() == &retry_timer_) {
+		if (state_ == UpdaterState::newversion_downloading && pending_commands_.empty()) {
+			SetState(StartDownload());
+		}
+		return;
+	}
+
 	AutoRunIfNeeded();
 }
 
@@ -899,6 +1021,134 @@ std::wstring CUpdater::GetTempFile() const
 	return ret;
 }
 
+std::wstring CUpdater::GetDeltaFile() const
+{
+	std::wstring ret = GetTempFile();
+	if (!ret.empty()) {
+		ret = ret.substr(0, ret.size() - 4) + L".delta";
+	}
+
+	return ret;
+}
+
+delta const* CUpdater::FindDelta(std::wstring & base)
+{
+	// Stored as hash, size and path of the package
+	std::wstring const package = COptions::Get()->GetOption(OPTION_UPDATECHECK_PACKAGE);
+	size_t const pos = package.find(' ');
+	size_t const pos2 = (pos == std::wstring::npos) ? pos : package.find(' ', pos + 1);
+	if (pos2 == std::wstring::npos) {
+		return nullptr;
+	}
+
+	std::wstring const hash = package.substr(0, pos);
+	int64_t const size = fz::to_integral<int64_t>(package.substr(pos + 1, pos2 - pos - 1), -1);
+	if (hash == version_information_.available_.hash_) {
+		return nullptr;
+	}
+
+	for (auto const& d : version_information_.deltas_) {
+		if (d.version_ == version_information_.available_.version_ && d.base_hash_ == hash) {
+			base = package.substr(pos2 + 1);
+			if (VerifyChecksum(base, size, hash)) {
+				return &d;
+			}
+			break;
+		}
+	}
+
+	return nullptr;
+}
+
+namespace {
+bool read_exact(fz::file & f, uint8_t* p, int64_t len)
+{
+	while (len > 0) {
+		int64_t const r = f.read(p, len);
+		if (r <= 0) {
+			return false;
+		}
+		p += r;
+		len -= r;
+	}
+	return true;
+}
+
+bool read_number(fz::file & f, uint64_t & v)
+{
+	uint8_t buf[8];
+	if (!read_exact(f, buf, 8)) {
+		return false;
+	}
+	v = 0;
+	for (auto const c : buf) {
+		v = (v << 8) | c;
+	}
+	return true;
+}
+}
+
+// Delta packages start with the magic "FZDELTA1", followed by records made of
+// a command byte and big-endian 64-bit numbers:
+//   'c' offset length: Copies length bytes at offset of the base package
+//   'a' length data:   Appends the length bytes following the record
+bool CUpdater::ApplyDelta(std::wstring const& base, std::wstring const& delta_file, std::wstring const& target)
+{
+	fz::file b(fz::to_native(base), fz::file::reading);
+	fz::file d(fz::to_native(delta_file), fz::file::reading);
+	fz::file t(fz::to_native(target), fz::file::writing, fz::file::empty);
+	if (!b.opened() || !d.opened() || !t.opened()) {
+		log_ += fz::sprintf(_("Could not open files to apply delta package %s"), delta_file) + L"\n";
+		return false;
+	}
+
+	uint8_t magic[8];
+	if (!read_exact(d, magic, 8) || memcmp(magic, "FZDELTA1", 8)) {
+		log_ += fz::sprintf(_("Invalid delta package %s"), delta_file) + L"\n";
+		return false;
+	}
+
+	int64_t const max_size = version_information_.available_.size_;
+	int64_t written{};
+
+	uint8_t buffer[65536];
+	uint8_t cmd;
+	while (read_exact(d, &cmd, 1)) {
+		uint64_t offset{};
+		uint64_t len{};
+		if ((cmd == 'c' && !read_number(d, offset)) || (cmd != 'c' && cmd != 'a') || !read_number(d, len) ||
+			len > static_cast<uint64_t>(max_size - written))
+		{
+			log_ += fz::sprintf(_("Invalid delta package %s"), delta_file) + L"\n";
+			return false;
+		}
+
+		fz::file & src = (cmd == 'c') ? b : d;
+		if (cmd == 'c' && b.seek(static_cast<int64_t>(offset), fz::file::begin) != static_cast<int64_t>(offset)) {
+			log_ += fz::sprintf(_("Invalid delta package %s"), delta_file) + L"\n";
+			return false;
+		}
+
+		written += static_cast<int64_t>(len);
+		while (len) {
+			int64_t const chunk = std::min(len, static_cast<uint64_t>(sizeof(buffer)));
+			if (!read_exact(src, buffer, chunk) || t.write(buffer, chunk) != chunk) {
+				log_ += fz::sprintf(_("Could not apply delta package %s"), delta_file) + L"\n";
+				return false;
+			}
+			len -= chunk;
+		}
+	}
+
+	return t.fsync();
+}
+
+void CUpdater::SetPackage(std::wstring const& local_file)
+{
+	build const& b = version_information_.available_;
+	COptions::Get()->SetOption(OPTION_UPDATECHECK_PACKAGE, fz::sprintf(L"%s %d %s", b.hash_, b.size_, local_file));
+}
+
 std::wstring CUpdater::GetFilename(std::wstring const& url) const
 {
 	std::wstring ret;
@@ -924,6 +1174,7 @@ void CUpdater::SetState(UpdaterState s)
 
 		if (s != UpdaterState::checking && s != UpdaterState::newversion_downloading) {
 			pending_commands_.clear();
+			retry_timer_.Stop();
 		}
 		build b = version_information_.available_;
 		for (auto const& handler : handlers_) {
@@ -979,7 +1230,7 @@ int64_t CUpdater::BytesDownloaded() const
 		}
 	}
 	else if (state_ == UpdaterState::newversion_downloading) {
-		std::wstring const temp = GetTempFile();
+		std::wstring const temp = delta_ ? GetDeltaFile() : GetTempFile();
 		if (!temp.empty()) {
 			ret = fz::local_filesys::get_size(fz::to_native(temp));
 		}
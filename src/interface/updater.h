@@ -11,6 +11,7 @@
 
 #include <functional>
 #include <list>
+#include <vector>
 
 struct build
 {
@@ -20,6 +21,15 @@ struct build
 	int64_t size_{-1};
 };
 
+// Rebuilds a package out of the one downloaded before
+struct delta
+{
+	std::wstring version_;
+	std::wstring url_;
+	std::wstring base_hash_;
+	int64_t size_{-1};
+};
+
 struct version_information
 {
 	bool empty() const {
@@ -34,6 +44,8 @@ struct version_information
 
 	build available_;
 
+	std::vector<delta> deltas_;
+
 	std::wstring changelog_;
 
 	std::wstring resources_;
@@ -95,6 +107,10 @@ protected:
 	bool LongTimeSinceLastCheck() const;
 
 	int Download(std::wstring const& url, std::wstring const& local_file = std::wstring());
+
+	// Downloads the available build, through a delta package if possible
+	UpdaterState StartDownload();
+	UpdaterState RetryDownload();
 	int Request(fz::uri const& uri);
 	int ContinueDownload();
 
@@ -110,11 +126,18 @@ protected:
 	void ProcessData(CDataNotification& dataNotification);
 	void ParseData();
 	UpdaterState ProcessFinishedDownload();
+	UpdaterState ProcessFinishedDelta();
 	UpdaterState ProcessFinishedData(bool can_download);
 
 	bool VerifyChecksum(std::wstring const& file, int64_t size, std::wstring const& checksum);
 
 	std::wstring GetTempFile() const;
+	std::wstring GetDeltaFile() const;
+
+	// The delta package applicable to the previously downloaded package, if any
+	delta const* FindDelta(std::wstring & base);
+	bool ApplyDelta(std::wstring const& base, std::wstring const& delta_file, std::wstring const& target);
+	void SetPackage(std::wstring const& local_file);
 	std::wstring GetFilename(std::wstring const& url) const;
 	std::wstring GetLocalFile(build const& b, bool allow_existing);
 
@@ -144,6 +167,14 @@ protected:
 
 	wxTimer update_timer_;
 
+	// Failed downloads get resumed after a while
+	wxTimer retry_timer_;
+	int retries_{};
+
+	// Whether the delta package is being downloaded or has already failed
+	bool delta_{};
+	bool delta_failed_{};
+
 	std::deque<std::unique_ptr<CCommand>> pending_commands_;
 
 	std::function<void(CActiveNotification const&)> activityNotificationHandler_;
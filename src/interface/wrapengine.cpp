@@ -412,13 +412,23 @@ int CWrapEngine::WrapRecursive(wxWindow* wnd, wxSizer* sizer, int max)
 					continue;
 
 				wxString str = text->GetLabel();
-				if (!WrapText(text, str, max - wxMax(0, rect.GetLeft()) - rborder - offset))
-				{
+				wrap_key key(str.ToStdWstring(), static_cast<unsigned long>(max - wxMax(0, rect.GetLeft()) - rborder - offset), text->GetFont().GetNativeFontInfoDesc().ToStdWstring());
+				auto it = wrapped_.find(key);
+				if (it != wrapped_.end()) {
+					str = it->second;
+				}
+				else {
+					if (!WrapText(text, str, std::get<1>(key)))
+					{
 #if WRAPDEBUG >= 3
-					plvl printf("Leave: WrapText failed\n");
+						plvl printf("Leave: WrapText failed\n");
 #endif
-					return result | wrap_failed;
+						return result | wrap_failed;
+					}
+					measured_ = true;
+					wrapped_.emplace(key, str.ToStdWstring());
 				}
+				recorded_.emplace_back(std::move(key));
 				text->SetLabel(str);
 				result |= wrap_didwrap;
 
@@ -557,6 +567,8 @@ bool CWrapEngine::WrapRecursive(std::vector<wxWindow*>& windows, double ratio, c
 
 	int maxWidth = GetWidthFromCache(name);
 	if (maxWidth) {
+		recorded_.clear();
+		measured_ = false;
 		for (auto iter = windows.begin(); iter != windows.end(); ++iter) {
 			wxSizer* pSizer = (*iter)->GetSizer();
 			if (!pSizer)
@@ -576,6 +588,10 @@ bool CWrapEngine::WrapRecursive(std::vector<wxWindow*>& windows, double ratio, c
 #endif
 			WRAPASSERT(size.x <= maxWidth);
 		}
+		if (measured_) {
+			// Labels not seen before, e.g. after changing a dialog's contents
+			SetWidthToCache(name, maxWidth);
+		}
 		return true;
 	}
 
@@ -701,6 +717,8 @@ bool CWrapEngine::WrapRecursive(std::vector<wxWindow*>& windows, double ratio, c
 		printf("Performing final wrap with bestwidth %d\n", bestWidth);
 #endif
 
+	recorded_.clear();
+
 	for (auto const& window : all_windows) {
 		wxSizer *pSizer = window->GetSizer();
 
@@ -823,6 +841,7 @@ int CWrapEngine::GetWidthFromCache(const char* name)
 	CInterProcessMutex mutex(MUTEX_LAYOUT);
 
 	CXmlFile xml(wxGetApp().GetSettingsFile(_T("layout")));
+	xml.EnableSnapshot();
 	auto root = xml.Load(true);
 	auto  element = root.child("Layout");
 	if (!element) {
@@ -846,6 +865,18 @@ int CWrapEngine::GetWidthFromCache(const char* name)
 
 	int value = GetAttributeInt(dialog, "width");
 
+	if (value) {
+		for (auto xText = dialog.child("Text"); xText; xText = xText.next_sibling("Text")) {
+			int const max = GetAttributeInt(xText, "max");
+			std::wstring label = GetTextElement(xText, "Label");
+			std::wstring wrapped = GetTextElement(xText, "Wrapped");
+			std::wstring font = GetTextElement(xText, "Font");
+			if (max > 0 && !label.empty() && !wrapped.empty() && !font.empty()) {
+				wrapped_.emplace(wrap_key(std::move(label), static_cast<unsigned long>(max), std::move(font)), std::move(wrapped));
+			}
+		}
+	}
+
 	return value;
 }
 
@@ -864,6 +895,7 @@ void CWrapEngine::SetWidthToCache(const char* name, int width)
 	CInterProcessMutex mutex(MUTEX_LAYOUT);
 
 	CXmlFile xml(wxGetApp().GetSettingsFile(_T("layout")));
+	xml.EnableSnapshot();
 	auto root = xml.Load(true);
 	auto element = root.child("Layout");
 	if (!element) {
@@ -887,6 +919,25 @@ void CWrapEngine::SetWidthToCache(const char* name, int width)
 	}
 
 	SetAttributeInt(dialog, "width", width);
+
+	pugi::xml_node xText;
+	while ((xText = dialog.child("Text"))) {
+		dialog.remove_child(xText);
+	}
+
+	std::sort(recorded_.begin(), recorded_.end());
+	recorded_.erase(std::unique(recorded_.begin(), recorded_.end()), recorded_.end());
+	for (auto const& key : recorded_) {
+		auto const it = wrapped_.find(key);
+		if (it != wrapped_.end()) {
+			xText = dialog.append_child("Text");
+			SetAttributeInt(xText, "max", static_cast<int>(std::get<1>(key)));
+			AddTextElement(xText, "Label", std::get<0>(key));
+			AddTextElement(xText, "Font", std::get<2>(key));
+			AddTextElement(xText, "Wrapped", it->second);
+		}
+	}
+
 	xml.Save(false);
 }
 
@@ -936,6 +987,7 @@ bool CWrapEngine::LoadCache()
 	CInterProcessMutex mutex(MUTEX_LAYOUT);
 
 	CXmlFile xml(wxGetApp().GetSettingsFile(_T("layout")));
+	xml.EnableSnapshot();
 	auto document = xml.Load(true);
 
 	if (!document) {
@@ -1059,6 +1111,15 @@ bool CWrapEngine::LoadCache()
 		SetAttributeInt(fontElement, "height", height);
 	}
 
+	// Wrapped labels are in pixels, they stay valid only on the same DPI
+	int const dpi = wxGetDisplayPPI().y;
+	int const scale = static_cast<int>(pFrame->GetContentScaleFactor() * 100);
+	if (GetAttributeInt(fontElement, "dpi") != dpi || GetAttributeInt(fontElement, "scale") != scale) {
+		cacheValid = false;
+		SetAttributeInt(fontElement, "dpi", dpi);
+		SetAttributeInt(fontElement, "scale", scale);
+	}
+
 	pFrame->Destroy();
 
 	// Get language file
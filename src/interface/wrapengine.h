@@ -1,6 +1,8 @@
 #ifndef FILEZILLA_INTERFACE_WRAPENGINE_HEADER
 #define FILEZILLA_INTERFACE_WRAPENGINE_HEADER
 
+#include <tuple>
+
 class CWrapEngine
 {
 public:
@@ -39,8 +41,21 @@ public:
 protected:
 	void UnwrapRecursive_Wrapped(std::vector<int> const& wrapped, std::vector<wxWindow*> &windows, bool remove_fitting = false);
 
+	// Also stores the labels wrapped in the last pass
 	void SetWidthToCache(const char* name, int width);
 
+	// Unwrapped label, maximum length and the description of the control's
+	// font, the wrapping depends on its metrics
+	typedef std::tuple<std::wstring, unsigned long, std::wstring> wrap_key;
+
+	// Wrapped labels by wrap_key. Loaded along with the width of a dialog,
+	// so reopening it needs no text measurements.
+	std::map<wrap_key, std::wstring> wrapped_;
+
+	// Labels wrapped in the current pass, and whether any had to be measured
+	std::vector<wrap_key> recorded_;
+	bool measured_{};
+
 	std::map<wxChar, unsigned int> m_charWidths;
 
 	bool CanWrapBefore(const wxChar& c);
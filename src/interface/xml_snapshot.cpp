@@ -0,0 +1,333 @@
+#include <filezilla.h>
+#include "xml_snapshot.h"
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/local_filesys.hpp>
+
+#include <cstring>
+#include <vector>
+
+#ifndef FZ_WINDOWS
+#include <sys/mman.h>
+#endif
+
+namespace xml_snapshot {
+
+namespace {
+char const magic[] = "FZXSNAP2";
+size_t const header_size = 48;
+
+// Snapshots of larger files are not taken, they are not settings files
+int64_t const max_size = 256 * 1024 * 1024;
+
+std::wstring snapshot_name(std::wstring const& xmlFile)
+{
+	return xmlFile + L".snapshot";
+}
+
+bool get_file_data(std::wstring const& xmlFile, int64_t & size, int64_t & time)
+{
+	bool isLink{};
+	fz::datetime mtime;
+	if (fz::local_filesys::get_file_info(fz::to_native(xmlFile), isLink, &size, &mtime, nullptr) != fz::local_filesys::file) {
+		return false;
+	}
+	if (mtime.empty() || size <= 0 || size > max_size) {
+		return false;
+	}
+	time = (mtime - fz::datetime(0, fz::datetime::milliseconds)).get_milliseconds();
+	return true;
+}
+
+uint64_t hash(unsigned char const* p, size_t len)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+uint64_t read_le(unsigned char const* p)
+{
+	uint64_t v{};
+	for (size_t i = 0; i < 8; ++i) {
+		v |= static_cast<uint64_t>(p[i]) << (i * 8);
+	}
+	return v;
+}
+
+void append_le(std::string & out, uint64_t v, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i) {
+		out += static_cast<char>((v >> (i * 8)) & 0xff);
+	}
+}
+
+void append_string(std::string & out, char const* s)
+{
+	size_t const len = strlen(s);
+	append_le(out, len, 4);
+	out.append(s, len + 1);
+}
+
+void append_node(std::string & out, pugi::xml_node node)
+{
+	append_le(out, static_cast<uint64_t>(node.type()), 1);
+	append_string(out, node.name());
+	append_string(out, node.value());
+
+	size_t attributes{};
+	for (auto attribute = node.first_attribute(); attribute; attribute = attribute.next_attribute()) {
+		++attributes;
+	}
+	append_le(out, attributes, 4);
+	for (auto attribute = node.first_attribute(); attribute; attribute = attribute.next_attribute()) {
+		append_string(out, attribute.name());
+		append_string(out, attribute.value());
+	}
+
+	for (auto child = node.first_child(); child; child = child.next_sibling()) {
+		append_node(out, child);
+	}
+	append_le(out, 0, 1);
+}
+
+// Read-only view of a whole file
+class mapped_file final
+{
+public:
+	mapped_file(fz::file & f, size_t size)
+	{
+#ifdef FZ_WINDOWS
+		handle_ = CreateFileMapping(f.fd(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (handle_) {
+			data_ = static_cast<unsigned char const*>(MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, size));
+		}
+#else
+		void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, f.fd(), 0);
+		if (p != MAP_FAILED) {
+			data_ = static_cast<unsigned char const*>(p);
+		}
+#endif
+		if (data_) {
+			size_ = size;
+		}
+	}
+
+	~mapped_file()
+	{
+#ifdef FZ_WINDOWS
+		if (data_) {
+			UnmapViewOfFile(data_);
+		}
+		if (handle_) {
+			CloseHandle(handle_);
+		}
+#else
+		if (data_) {
+			munmap(const_cast<unsigned char*>(data_), size_);
+		}
+#endif
+	}
+
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+
+	unsigned char const* data() const { return data_; }
+
+private:
+	unsigned char const* data_{};
+	size_t size_{};
+#ifdef FZ_WINDOWS
+	HANDLE handle_{};
+#endif
+};
+
+class reader final
+{
+public:
+	reader(unsigned char const* p, size_t len)
+		: p_(p), end_(p + len)
+	{}
+
+	bool read(uint64_t & v, size_t bytes)
+	{
+		if (static_cast<size_t>(end_ - p_) < bytes) {
+			return false;
+		}
+		v = 0;
+		for (size_t i = 0; i < bytes; ++i) {
+			v |= static_cast<uint64_t>(*p_++) << (i * 8);
+		}
+		return true;
+	}
+
+	// Strings are null-terminated in the snapshot, they are used in-place
+	bool read(char const*& s)
+	{
+		uint64_t len;
+		if (!read(len, 4) || static_cast<uint64_t>(end_ - p_) <= len || p_[len]) {
+			return false;
+		}
+		s = reinterpret_cast<char const*>(p_);
+		p_ += len + 1;
+		return true;
+	}
+
+	bool done() const { return p_ == end_; }
+
+private:
+	unsigned char const* p_;
+	unsigned char const* const end_;
+};
+
+bool build(reader & r, pugi::xml_document & document)
+{
+	std::vector<pugi::xml_node> parents{document};
+	while (!parents.empty()) {
+		uint64_t type;
+		if (!r.read(type, 1)) {
+			return false;
+		}
+		if (!type) {
+			parents.pop_back();
+			continue;
+		}
+		if (type == pugi::node_document || type > pugi::node_doctype) {
+			return false;
+		}
+
+		char const* name;
+		char const* value;
+		uint64_t attributes;
+		if (!r.read(name) || !r.read(value) || !r.read(attributes, 4)) {
+			return false;
+		}
+
+		auto node = parents.back().append_child(static_cast<pugi::xml_node_type>(type));
+		if (!node) {
+			return false;
+		}
+		if ((*name && !node.set_name(name)) || (*value && !node.set_value(value))) {
+			return false;
+		}
+
+		for (uint64_t i = 0; i < attributes; ++i) {
+			if (!r.read(name) || !r.read(value)) {
+				return false;
+			}
+			node.append_attribute(name).set_value(value);
+		}
+
+		parents.push_back(node);
+	}
+
+	return r.done();
+}
+
+bool hash_file(std::wstring const& xmlFile, int64_t size, uint64_t & h)
+{
+	fz::file f(fz::to_native(xmlFile), fz::file::reading);
+	if (!f.opened() || f.size() != size) {
+		return false;
+	}
+
+	mapped_file mapping(f, static_cast<size_t>(size));
+	if (!mapping.data()) {
+		return false;
+	}
+	h = hash(mapping.data(), static_cast<size_t>(size));
+	return true;
+}
+}
+
+bool load(std::wstring const& xmlFile, pugi::xml_document & document)
+{
+	document.reset();
+
+	int64_t size;
+	int64_t time;
+	if (!get_file_data(xmlFile, size, time)) {
+		return false;
+	}
+
+	fz::file f(fz::to_native(snapshot_name(xmlFile)), fz::file::reading);
+	if (!f.opened()) {
+		return false;
+	}
+	int64_t const snapshotSize = f.size();
+	if (snapshotSize < static_cast<int64_t>(header_size) || snapshotSize > max_size * 2) {
+		return false;
+	}
+
+	mapped_file mapping(f, static_cast<size_t>(snapshotSize));
+	unsigned char const* p = mapping.data();
+	if (!p) {
+		return false;
+	}
+
+	if (memcmp(p, magic, 8) ||
+		read_le(p + 8) != static_cast<uint64_t>(size) ||
+		read_le(p + 16) != static_cast<uint64_t>(time) ||
+		read_le(p + 32) != static_cast<uint64_t>(snapshotSize) - header_size)
+	{
+		return false;
+	}
+
+	uint64_t fileHash;
+	if (!hash_file(xmlFile, size, fileHash) || read_le(p + 24) != fileHash) {
+		return false;
+	}
+
+	unsigned char const* payload = p + header_size;
+	size_t const payloadSize = static_cast<size_t>(snapshotSize) - header_size;
+	if (read_le(p + 40) != hash(payload, payloadSize)) {
+		return false;
+	}
+
+	reader r(payload, payloadSize);
+	if (!build(r, document)) {
+		document.reset();
+		return false;
+	}
+
+	return true;
+}
+
+void store(std::wstring const& xmlFile, pugi::xml_document const& document)
+{
+	std::wstring const name = snapshot_name(xmlFile);
+
+	int64_t size;
+	int64_t time;
+	uint64_t fileHash;
+	if (!get_file_data(xmlFile, size, time) || !hash_file(xmlFile, size, fileHash)) {
+		fz::remove_file(fz::to_native(name));
+		return;
+	}
+
+	std::string payload;
+	for (auto child = document.first_child(); child; child = child.next_sibling()) {
+		append_node(payload, child);
+	}
+	append_le(payload, 0, 1);
+
+	std::string out = magic;
+	append_le(out, static_cast<uint64_t>(size), 8);
+	append_le(out, static_cast<uint64_t>(time), 8);
+	append_le(out, fileHash, 8);
+	append_le(out, payload.size(), 8);
+	append_le(out, hash(reinterpret_cast<unsigned char const*>(payload.data()), payload.size()), 8);
+	out += payload;
+
+	// A partially written snapshot fails the checks on load
+	fz::file f(fz::to_native(name), fz::file::writing, fz::file::empty);
+	if (!f.opened() || f.write(out.data(), static_cast<int64_t>(out.size())) != static_cast<int64_t>(out.size())) {
+		f.close();
+		fz::remove_file(fz::to_native(name));
+	}
+}
+
+}
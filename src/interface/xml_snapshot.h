@@ -0,0 +1,42 @@
+#ifndef FILEZILLA_INTERFACE_XML_SNAPSHOT_HEADER
+#define FILEZILLA_INTERFACE_XML_SNAPSHOT_HEADER
+
+#ifdef HAVE_LIBPUGIXML
+#include <pugixml.hpp>
+#else
+#include "../pugixml/pugixml.hpp"
+#endif
+
+#include <string>
+
+/*
+ * Binary snapshot of an XML document, stored as <file>.snapshot next to
+ * the XML file it was taken from. The XML file remains the source of truth,
+ * the snapshot merely saves tokenizing it again on the next load.
+ *
+ * File format, all integers little-endian:
+ *   Header: 8 bytes magic "FZXSNAP2", u64 size and i64 modification time in
+ *   milliseconds since the epoch of the XML file, u64 FNV-1a hash of the
+ *   XML file, u64 payload size, u64 FNV-1a hash of the payload.
+ *   Payload: The children of the document in document order. Each node is
+ *     u8 pugi::xml_node_type, string name, string value,
+ *     u32 attribute count, attribute names and values as strings,
+ *     the child nodes, u8 0.
+ *   Strings are u32 length followed by the UTF-8 data.
+ *
+ * A snapshot only gets used if size, modification time and hash still
+ * match the XML file and the hash matches the payload. Size and time alone
+ * miss edits within the resolution of the file system's timestamps, or
+ * tools that restore the modification time. Hashing the file is still much
+ * cheaper than parsing it.
+ */
+namespace xml_snapshot {
+
+// Returns false if there is no usable snapshot, document is left empty then.
+bool load(std::wstring const& xmlFile, pugi::xml_document & document);
+
+void store(std::wstring const& xmlFile, pugi::xml_document const& document);
+
+}
+
+#endif
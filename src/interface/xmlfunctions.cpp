@@ -2,6 +2,7 @@
 #include "buildinfo.h"
 #include "xmlfunctions.h"
 #include "xmlutils.h"
+#include "xml_snapshot.h"
 #include "Options.h"
 #include <wx/ffile.h>
 #include <wx/log.h>
@@ -25,6 +26,18 @@ void CXmlFile::SetFileName(std::wstring const& name)
 	m_modificationTime = fz::datetime();
 }
 
+std::unique_ptr<CXmlFile> CXmlFile::Clone() const
+{
+	auto ret = std::make_unique<CXmlFile>();
+	ret->m_fileName = m_fileName;
+	ret->m_rootName = m_rootName;
+	ret->m_useSnapshot = m_useSnapshot;
+	ret->m_modificationTime = m_modificationTime;
+	ret->m_document.reset(m_document);
+	ret->m_element = ret->m_document.child(m_rootName.c_str());
+	return ret;
+}
+
 pugi::xml_node CXmlFile::Load(bool overwriteInvalid)
 {
 	Close();
@@ -34,6 +47,15 @@ pugi::xml_node CXmlFile::Load(bool overwriteInvalid)
 
 	std::wstring redirectedName = GetRedirectedName();
 
+	if (m_useSnapshot && xml_snapshot::load(redirectedName, m_document)) {
+		m_element = m_document.child(m_rootName.c_str());
+		if (m_element) {
+			m_modificationTime = fz::local_filesys::get_modification_time(fz::to_native(redirectedName));
+			return m_element;
+		}
+		Close();
+	}
+
 	GetXmlFile(redirectedName);
 	if (!m_element) {
 		std::wstring err = fz::sprintf(fztranslate("The file '%s' could not be loaded."), m_fileName);
@@ -92,6 +114,7 @@ pugi::xml_node CXmlFile::Load(bool overwriteInvalid)
 	}
 
 	m_modificationTime = fz::local_filesys::get_modification_time(fz::to_native(redirectedName));
+	StoreSnapshot(redirectedName);
 	return m_element;
 }
 
@@ -136,6 +159,28 @@ void CXmlFile::UpdateMetadata()
 	SetTextAttributeUtf8(m_element, "platform", platform);
 }
 
+bool CXmlFile::SaveStreaming(bool printError, streamer_t const& streamer)
+{
+	m_error.clear();
+
+	wxCHECK(!m_fileName.empty(), false);
+	wxCHECK(m_document, false);
+	wxCHECK(!m_useSnapshot, false);
+
+	UpdateMetadata();
+
+	bool res = SaveXmlFile(streamer);
+	m_modificationTime = fz::local_filesys::get_modification_time(fz::to_native(m_fileName));
+
+	if (!res && printError) {
+		assert(!m_error.empty());
+
+		wxString msg = wxString::Format(_("Could not write \"%s\":"), m_fileName);
+		wxMessageBoxEx(msg + _T("\n") + m_error, _("Error writing xml file"), wxICON_ERROR);
+	}
+	return res;
+}
+
 bool CXmlFile::Save(bool printError, bool updateMetadata)
 {
 	m_error.clear();
@@ -149,6 +194,9 @@ bool CXmlFile::Save(bool printError, bool updateMetadata)
 
 	bool res = SaveXmlFile();
 	m_modificationTime = fz::local_filesys::get_modification_time(fz::to_native(m_fileName));
+	if (res) {
+		StoreSnapshot(GetRedirectedName());
+	}
 
 	if (!res && printError) {
 		assert(!m_error.empty());
@@ -202,6 +250,21 @@ bool CXmlFile::GetXmlFile(std::wstring const& file)
 	return true;
 }
 
+void CXmlFile::StoreSnapshot(std::wstring const& redirectedName)
+{
+	if (!m_useSnapshot) {
+		return;
+	}
+
+	// Nothing may be written in this mode
+	COptions* options = COptions::Get();
+	if (options && options->GetOptionVal(OPTION_DEFAULT_KIOSKMODE) == 2) {
+		return;
+	}
+
+	xml_snapshot::store(redirectedName, m_document);
+}
+
 std::wstring CXmlFile::GetRedirectedName() const
 {
 	std::wstring redirectedName = m_fileName;
@@ -218,7 +281,7 @@ std::wstring CXmlFile::GetRedirectedName() const
 	return redirectedName;
 }
 
-bool CXmlFile::SaveXmlFile()
+bool CXmlFile::SaveXmlFile(streamer_t const& streamer)
 {
 	bool exists = false;
 
@@ -248,13 +311,29 @@ bool CXmlFile::SaveXmlFile()
 	struct flushing_xml_writer final : public pugi::xml_writer
 	{
 	public:
-		static bool save(pugi::xml_document const& document, std::wstring const& filename)
+		static bool save(pugi::xml_document const& document, pugi::xml_node root, std::wstring const& filename, streamer_t const& streamer)
 		{
 			flushing_xml_writer writer(filename);
 			if (!writer.file_.opened()) {
 				return false;
 			}
-			document.save(writer);
+			if (!streamer) {
+				document.save(writer);
+			}
+			else {
+				for (auto node = document.first_child(); node; node = node.next_sibling()) {
+					if (node != root) {
+						node.print(writer, PUGIXML_TEXT("\t"), pugi::format_default, pugi::encoding_utf8);
+						continue;
+					}
+					WriteXmlStartTag(writer, root, 0);
+					for (auto child = root.first_child(); child; child = child.next_sibling()) {
+						child.print(writer, PUGIXML_TEXT("\t"), pugi::format_default, pugi::encoding_utf8, 1);
+					}
+					streamer(writer, 1);
+					WriteXmlEndTag(writer, root.name(), 0);
+				}
+			}
 
 			return writer.file_.opened() && writer.file_.fsync();
 		}
@@ -276,7 +355,7 @@ bool CXmlFile::SaveXmlFile()
 		fz::file file_;
 	};
 
-	bool success = flushing_xml_writer::save(m_document, redirectedName.ToStdWstring());
+	bool success = flushing_xml_writer::save(m_document, m_element, redirectedName.ToStdWstring(), streamer);
 	if (!success) {
 		fz::remove_file(fz::to_native(redirectedName));
 		if (exists) {
@@ -294,6 +373,43 @@ bool CXmlFile::SaveXmlFile()
 	return true;
 }
 
+namespace {
+struct string_xml_writer final : public pugi::xml_writer
+{
+	virtual void write(void const* data, size_t size) override {
+		result.append(static_cast<char const*>(data), size);
+	}
+
+	std::string result;
+};
+}
+
+void WriteXmlStartTag(pugi::xml_writer& writer, pugi::xml_node element, unsigned int depth)
+{
+	// Printing an empty copy leaves pugixml to do the escaping
+	pugi::xml_document document;
+	auto copy = document.append_child(element.name());
+	for (auto attribute = element.first_attribute(); attribute; attribute = attribute.next_attribute()) {
+		copy.append_copy(attribute);
+	}
+
+	string_xml_writer out;
+	copy.print(out, PUGIXML_TEXT(""), pugi::format_raw, pugi::encoding_utf8);
+
+	std::string tag = std::string(depth, '\t') + out.result;
+	if (tag.size() >= 2 && tag.compare(tag.size() - 2, 2, "/>") == 0) {
+		tag.resize(tag.size() - 2);
+	}
+	tag += ">\n";
+	writer.write(tag.c_str(), tag.size());
+}
+
+void WriteXmlEndTag(pugi::xml_writer& writer, char const* name, unsigned int depth)
+{
+	std::string const tag = std::string(depth, '\t') + "</" + name + ">\n";
+	writer.write(tag.c_str(), tag.size());
+}
+
 bool GetServer(pugi::xml_node node, Site & site)
 {
 	wxASSERT(node);
@@ -401,6 +517,9 @@ bool GetServer(pugi::xml_node node, Site & site)
 	int maximumMultipleConnections = GetTextElementInt(node, "MaximumMultipleConnections");
 	site.server.MaximumMultipleConnections(maximumMultipleConnections);
 
+	site.server.SetSpeedLimits(GetTextElementInt(node, "SpeedLimitInbound"), GetTextElementInt(node, "SpeedLimitOutbound"));
+	site.server.SetSourceAddress(GetTextElement(node, "SourceAddress"));
+
 	std::string_view encodingType = node.child_value("EncodingType");
 	if (encodingType == "UTF-8") {
 		site.server.SetEncodingType(ENCODING_UTF8);
@@ -522,6 +641,15 @@ void SetServer(pugi::xml_node node, Site const& site)
 	if (site.server.MaximumMultipleConnections()) {
 		AddTextElement(node, "MaximumMultipleConnections", site.server.MaximumMultipleConnections());
 	}
+	if (site.server.GetInboundSpeedLimit()) {
+		AddTextElement(node, "SpeedLimitInbound", site.server.GetInboundSpeedLimit());
+	}
+	if (site.server.GetOutboundSpeedLimit()) {
+		AddTextElement(node, "SpeedLimitOutbound", site.server.GetOutboundSpeedLimit());
+	}
+	if (!site.server.GetSourceAddress().empty()) {
+		AddTextElement(node, "SourceAddress", site.server.GetSourceAddress());
+	}
 
 	if (CServer::ProtocolHasFeature(site.server.GetProtocol(), ProtocolFeature::Charset)) {
 		switch (site.server.GetEncodingType())
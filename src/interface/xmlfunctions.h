@@ -15,6 +15,9 @@
 #include "xmlutils.h"
 #include "serverdata.h"
 
+#include <functional>
+#include <memory>
+
 class CXmlFile final
 {
 public:
@@ -31,6 +34,14 @@ public:
 
 	bool HasFileName() const { return !m_fileName.empty(); }
 
+	// Copy of the document, e.g. to be saved on another thread
+	std::unique_ptr<CXmlFile> Clone() const;
+
+	// Keeps a binary snapshot of the document next to the file, see
+	// xml_snapshot.h. Only meant for the files in the settings directory
+	// read on every start.
+	void EnableSnapshot() { m_useSnapshot = true; }
+
 	// Sets error description on failure
 	pugi::xml_node Load(bool overwriteInvalid = false);
 
@@ -49,10 +60,19 @@ public:
 
 	bool Save(bool printError, bool updateMetadata = true);
 
+	// Like Save, but the streamer appends further elements to the root
+	// element straight into the file, after the children it has in the
+	// document. Lets large sections get saved without building them in
+	// memory first.
+	typedef std::function<void(pugi::xml_writer& writer, unsigned int depth)> streamer_t;
+	bool SaveStreaming(bool printError, streamer_t const& streamer);
+
 	bool IsFromFutureVersion() const;
 protected:
 	std::wstring GetRedirectedName() const;
 
+	void StoreSnapshot(std::wstring const& redirectedName);
+
 	// Opens the specified XML file if it exists or creates a new one otherwise.
 	// Returns 0 on error.
 	bool GetXmlFile(std::wstring const& file);
@@ -61,7 +81,7 @@ protected:
 	void UpdateMetadata();
 
 	// Save the XML document to the given file
-	bool SaveXmlFile();
+	bool SaveXmlFile(streamer_t const& streamer = streamer_t());
 
 	fz::datetime m_modificationTime;
 	std::wstring m_fileName;
@@ -71,6 +91,8 @@ protected:
 	std::wstring m_error;
 
 	std::string m_rootName{"FileZilla3"};
+
+	bool m_useSnapshot{};
 };
 
 // Functions to save and retrieve CServer objects to the XML file
@@ -78,4 +100,9 @@ void SetServer(pugi::xml_node node, Site const& site);
 
 bool GetServer(pugi::xml_node node, Site& site);
 
+// For streamers: Write the opening tag of the element including its
+// attributes, or the closing tag, indented for the given depth.
+void WriteXmlStartTag(pugi::xml_writer& writer, pugi::xml_node element, unsigned int depth);
+void WriteXmlEndTag(pugi::xml_writer& writer, char const* name, unsigned int depth);
+
 #endif
@@ -2,6 +2,45 @@
 #include "misc.h"
 
 bool pending_reply = false;
+bool framed_output = false;
+
+static void fzwrite_uint32(uint32_t v)
+{
+    unsigned char buf[4];
+    PUT_32BIT_MSB_FIRST(buf, v);
+    fwrite(buf, 4, 1, stdout);
+}
+
+static void fzwrite_field(const char* s, size_t len)
+{
+    fzwrite_uint32((uint32_t)len);
+    if (len) {
+        fwrite(s, len, 1, stdout);
+    }
+}
+
+// Writes NUL-terminated str, broken into fields at line breaks
+static void fzwrite_fields(const char* str)
+{
+    const char* s = str;
+    const char* p = str;
+    while (1) {
+        if (!*p || *p == '\n') {
+            size_t len = p - s;
+            if (len && s[len - 1] == '\r') {
+                --len;
+            }
+            if (*p || len) {
+                fzwrite_field(s, len);
+            }
+            if (!*p) {
+                break;
+            }
+            s = p + 1;
+        }
+        p++;
+    }
+}
 
 int fznotify(sftpEventTypes type)
 {
@@ -27,7 +66,13 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         sfree(str);
         va_end(ap);
 
-        fprintf(stdout, "%c\n", (int)type + '0');
+        if (framed_output) {
+            fputc((int)type + '0', stdout);
+            fzwrite_field("", 0);
+        }
+        else {
+            fprintf(stdout, "%c\n", (int)type + '0');
+        }
         fflush(stdout);
 
         return 0;
@@ -38,7 +83,13 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         if (*p == '\r' || *p == '\n') {
             if (p != s) {
                 *p = 0;
-                fprintf(stdout, "%c%s\n", (int)type + '0', s);
+                if (framed_output) {
+                    fputc((int)type + '0', stdout);
+                    fzwrite_field(s, p - s);
+                }
+                else {
+                    fprintf(stdout, "%c%s\n", (int)type + '0', s);
+                }
                 s = p + 1;
             }
             else {
@@ -47,9 +98,13 @@ int fzprintf(sftpEventTypes type, const char* fmt, ...)
         }
         else if (!*p) {
             if (p != s) {
-                *p = 0;
-                fprintf(stdout, "%c%s\n", (int)type + '0', s);
-                s = p + 1;
+                if (framed_output) {
+                    fputc((int)type + '0', stdout);
+                    fzwrite_field(s, p - s);
+                }
+                else {
+                    fprintf(stdout, "%c%s\n", (int)type + '0', s);
+                }
             }
             break;
         }
@@ -95,8 +150,13 @@ int fzprintf_raw_untrusted(sftpEventTypes type, const char* fmt, ...)
     if (type != sftpUnknown) {
         fputc((int)type + '0', stdout);
     }
-    fputs(str, stdout);
-    fputc('\n', stdout);
+    if (framed_output) {
+        fzwrite_field(str, s - str);
+    }
+    else {
+        fputs(str, stdout);
+        fputc('\n', stdout);
+    }
     fflush(stdout);
 
     sfree(str);
@@ -118,7 +178,12 @@ int fzprintf_raw(sftpEventTypes type, const char* fmt, ...)
     str = dupvprintf(fmt, ap);
 
     fputc((char)type + '0', stdout);
-    fputs(str, stdout);
+    if (framed_output) {
+        fzwrite_fields(str);
+    }
+    else {
+        fputs(str, stdout);
+    }
     fflush(stdout);
 
     sfree(str);
@@ -134,8 +199,35 @@ int fznotify1(sftpEventTypes type, int data)
         pending_reply = false;
     }
 
-    fprintf(stdout, "%c%d\n", (int)type + '0', data);
+    if (framed_output) {
+        char buf[12];
+        int len = snprintf(buf, sizeof(buf), "%d", data);
+        fputc((int)type + '0', stdout);
+        fzwrite_field(buf, len);
+    }
+    else {
+        fprintf(stdout, "%c%d\n", (int)type + '0', data);
+    }
     fflush(stdout);
     return 0;
 }
 
+int fzprintf_listentry(const char* longname, uint64_t mtime, const char* name)
+{
+    if (!framed_output) {
+        fzprintf_raw_untrusted(sftpListentry, "%s", longname);
+        fzprintf_raw_untrusted(sftpUnknown, "%"PRIu64, mtime);
+        fzprintf_raw_untrusted(sftpUnknown, "%s", name);
+        return 0;
+    }
+
+    unsigned char buf[8];
+    PUT_64BIT_MSB_FIRST(buf, mtime);
+
+    fputc((int)sftpListentry + '0', stdout);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", longname);
+    fwrite(buf, 8, 1, stdout);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", name);
+    return 0;
+}
+
@@ -1,4 +1,4 @@
-#define FZSFTP_PROTOCOL_VERSION 9
+#define FZSFTP_PROTOCOL_VERSION 11
 
 typedef enum
 {
@@ -28,11 +28,17 @@ typedef enum
     sftpCipherServerToClient,
     sftpMacClientToServer,
     sftpMacServerToClient,
-    sftpHostkey
+    sftpHostkey,
+    sftpListentryAttrs
 } sftpEventTypes;
 
 extern bool pending_reply;
 
+// If set, all messages are written as framed binary messages. Each message
+// is the type character followed by its fields, each field prefixed by its
+// length as 32-bit big-endian integer.
+extern bool framed_output;
+
 int fznotify(sftpEventTypes type);
 
 // Format the string. Each line of the string is prepended by type
@@ -44,3 +50,7 @@ int fzprintf_raw(sftpEventTypes type, const char* p, ...);
 // Format the string, then print the type (if not sftpUnknown) and the string with linebreaks replaced by spaces.
 int fzprintf_raw_untrusted(sftpEventTypes type, const char* p, ...);
 int fznotify1(sftpEventTypes type, int data);
+
+// Prints a directory listing entry. In framed mode mtime is sent as
+// 64-bit big-endian integer.
+int fzprintf_listentry(const char* longname, uint64_t mtime, const char* name);
@@ -13,83 +13,211 @@ char* input_pushback = 0;
 
 #ifndef _WINDOWS
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 char *input_buf = 0;
 int input_buflen = 0, input_bufsize = 0;
 #endif
 
-static int ReadQuotas(int i)
+/*
+ * Block of memory shared with the engine, see --shm. The engine grants
+ * quota by adding to available and we report progress by adding to
+ * transferred, neither needs a message on the pipes. Index 0 of the
+ * arrays is receive, 1 is send.
+ *
+ * The layout must match CSftpSharedBlock::layout in the engine.
+ */
+struct fzsftp_shared_block {
+    uint32_t magic;
+    uint32_t attached;
+    int64_t available[2]; /* -1 if unlimited */
+    int32_t limit[2];
+    int32_t wanted[2]; /* Set by us when out of quota */
+    int64_t transferred;
+};
+
+#define FZSFTP_SHARED_BLOCK_MAGIC 0x465a5351 /* "FZSQ" */
+#define FZSFTP_SHARED_BLOCK_SIZE 64
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FZSFTP_HAVE_SHARED_BLOCK
+#define shared_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define shared_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define shared_exchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define shared_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELEASE)
+#define shared_cas(p, expected, desired) \
+    __atomic_compare_exchange_n((p), (expected), (desired), false, \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+
+static struct fzsftp_shared_block *shared_block = NULL;
+
+bool fz_shared_block_attach(const char *name)
 {
+#ifndef FZSFTP_HAVE_SHARED_BLOCK
+    return false;
+#else
+    void *p;
 #ifdef _WINDOWS
-    HANDLE hin;
-    DWORD savemode, newmode;
+    /* The mapping lives as long as a handle to it is open, so keep ours
+     * until we exit. */
+    HANDLE h = OpenFileMappingA(FILE_MAP_WRITE, FALSE, name);
+    if (!h)
+        return false;
+    p = MapViewOfFile(h, FILE_MAP_WRITE, 0, 0, FZSFTP_SHARED_BLOCK_SIZE);
+    if (!p) {
+        CloseHandle(h);
+        return false;
+    }
+#else
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return false;
+    /* Nobody else needs to open it, don't leave it lying around */
+    shm_unlink(name);
+    p = mmap(NULL, FZSFTP_SHARED_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+#endif
 
-    hin = GetStdHandle(STD_INPUT_HANDLE);
+    shared_block = (struct fzsftp_shared_block *)p;
+    if (shared_load(&shared_block->magic) != FZSFTP_SHARED_BLOCK_MAGIC) {
+        shared_block = NULL;
+        return false;
+    }
+    shared_store(&shared_block->attached, 1);
+    return true;
+#endif
+}
 
-    GetConsoleMode(hin, &savemode);
-    newmode = savemode | ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT;
-    newmode &= ~ENABLE_ECHO_INPUT;
-    SetConsoleMode(hin, newmode);
+bool fz_shared_block_attached(void)
+{
+    return shared_block != NULL;
+}
 
-    while (bytesAvailable[i] == 0)
-    {
-        DWORD read;
-        BOOL r;
-        char buffer[21];
+void fz_report_transfer(int bytes)
+{
+#ifdef FZSFTP_HAVE_SHARED_BLOCK
+    if (shared_block) {
+        if (bytes)
+            shared_add(&shared_block->transferred, (int64_t)bytes);
+        return;
+    }
+#endif
+    fzprintf(sftpTransfer, "%d", bytes);
+}
 
-        r = ReadFile(hin, buffer, 20, &read, 0);
-        if (!r || read == 0) {
-                fzprintf(sftpError, "ReadFile failed in ReadQuotas");
-                cleanup_exit(1);
-        }
-        buffer[read] = 0;
+/* Reads the next line on stdin, which is either a quota command or a
+ * command for later */
+static void ReadInputLine(void)
+{
+#ifdef _WINDOWS
+    DWORD read;
+    BOOL r;
+    char buffer[21];
 
-        if (buffer[0] != '-')
-        {
-                if (input_pushback != 0) {
-                        fzprintf(sftpError, "input_pushback not null!");
-                        cleanup_exit(1);
-                }
-            else {
-                int pos = strcspn(buffer, "\n") + 1;
-                input_pushback = snewn(pos + 1, char);
-                strncpy(input_pushback, buffer, pos);
-                input_pushback[pos] = 0;
+    r = ReadFile(GetStdHandle(STD_INPUT_HANDLE), buffer, 20, &read, 0);
+    if (!r || read == 0) {
+            fzprintf(sftpError, "ReadFile failed in ReadQuotas");
+            cleanup_exit(1);
+    }
+    buffer[read] = 0;
+
+    if (buffer[0] != '-')
+    {
+            if (input_pushback != 0) {
+                    fzprintf(sftpError, "input_pushback not null!");
+                    cleanup_exit(1);
             }
+        else {
+            int pos = strcspn(buffer, "\n") + 1;
+            input_pushback = snewn(pos + 1, char);
+            strncpy(input_pushback, buffer, pos);
+            input_pushback[pos] = 0;
         }
-        else
-            ProcessQuotaCmd(buffer);
     }
-
-    SetConsoleMode(hin, savemode);
+    else
+        ProcessQuotaCmd(buffer);
 #else
     char* line;
-    while (bytesAvailable[i] == 0)
+    int error = 0;
+    line = read_input_line(1, &error);
+    if (line == NULL || error) {
+        fzprintf(sftpError, "read_input_line failed in ReadQuotas");
+        cleanup_exit(1);
+    }
+
+    if (line[0] != '-')
     {
-        int error = 0;
-        line = read_input_line(1, &error);
-        if (line == NULL || error) {
-            fzprintf(sftpError, "read_input_line failed in ReadQuotas");
+        if (input_pushback != 0) {
+            fzprintf(sftpError, "input_pushback not null!");
             cleanup_exit(1);
         }
-
-        if (line[0] != '-')
-        {
-            if (input_pushback != 0) {
-                fzprintf(sftpError, "input_pushback not null!");
-                cleanup_exit(1);
-            }
-            else
-                input_pushback = strndup(line, strcspn(line, "\n") + 1);
-        }
         else
-            ProcessQuotaCmd(line);
-        sfree(line);
+            input_pushback = strndup(line, strcspn(line, "\n") + 1);
     }
+    else
+        ProcessQuotaCmd(line);
+    sfree(line);
 #endif //_WINDOWS
+}
+
+static int ReadQuotas(int i)
+{
+#ifdef _WINDOWS
+    HANDLE hin;
+    DWORD savemode, newmode;
+
+    hin = GetStdHandle(STD_INPUT_HANDLE);
+
+    GetConsoleMode(hin, &savemode);
+    newmode = savemode | ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT;
+    newmode &= ~ENABLE_ECHO_INPUT;
+    SetConsoleMode(hin, newmode);
+#endif
+
+    while (bytesAvailable[i] == 0)
+        ReadInputLine();
+
+#ifdef _WINDOWS
+    SetConsoleMode(hin, savemode);
+#endif
     return 1;
 }
 
+#ifdef FZSFTP_HAVE_SHARED_BLOCK
+/*
+ * Blocks on stdin until the engine has refilled the shared block. When
+ * clearing wanted after a refill, the engine sends "-w" to wake us up.
+ * Commands arriving meanwhile are pushed back as usual.
+ */
+static int RequestSharedQuota(int i, int bytes)
+{
+    int64_t avail;
+
+    while ((avail = shared_load(&shared_block->available[i])) == 0) {
+        /* Only the first request after running dry needs to wake up the
+         * engine, it then refills the block directly. */
+        if (!shared_exchange(&shared_block->wanted[i], 1))
+            fznotify(sftpUsedQuotaRecv + i);
+
+        /* A refill before wanted got set sent no wakeup but is seen
+         * here, any later one finds wanted set. */
+        if ((avail = shared_load(&shared_block->available[i])) != 0)
+            break;
+        ReadInputLine();
+    }
+
+    if (avail < 0 || avail > bytes)
+        return bytes;
+
+    return (int)avail;
+}
+#endif
+
 int RequestQuota(int i, int bytes)
 {
 #ifndef _WINDOWS
@@ -106,6 +234,11 @@ int RequestQuota(int i, int bytes)
     }
 #endif
 
+#ifdef FZSFTP_HAVE_SHARED_BLOCK
+    if (shared_block)
+        return RequestSharedQuota(i, bytes);
+#endif
+
     if (bytesAvailable[i] < -100)
         bytesAvailable[i] = 0;
     else if (bytesAvailable[i] < 0)
@@ -131,6 +264,20 @@ int RequestQuota(int i, int bytes)
 
 void UpdateQuota(int i, int bytes)
 {
+#ifdef FZSFTP_HAVE_SHARED_BLOCK
+    if (shared_block) {
+        /* The engine may add concurrently, so this has to be a CAS loop */
+        int64_t cur = shared_load(&shared_block->available[i]);
+        int64_t next;
+        do {
+            if (cur < 0)
+                return;
+            next = (cur > bytes) ? cur - bytes : 0;
+        } while (!shared_cas(&shared_block->available[i], &cur, next));
+        return;
+    }
+#endif
+
     if (bytesAvailable[i] < 0)
         return;
 
@@ -147,6 +294,10 @@ int ProcessQuotaCmd(const char* line)
     if (line[0] != '-')
         return 0;
 
+    /* Wakeup after the shared block got refilled, see RequestSharedQuota */
+    if (line[1] == 'w')
+        return 0;
+
     if (line[1] == '0')
         direction = 0;
     else if (line[1] == '1')
@@ -352,5 +503,9 @@ int fz_timer_check(_fztimer *timer)
 
 int CurrentSpeedLimit(int direction)
 {
+#ifdef FZSFTP_HAVE_SHARED_BLOCK
+    if (shared_block)
+        return shared_load(&shared_block->limit[direction]);
+#endif
     return limit[direction];
 }
@@ -12,6 +12,14 @@ char* read_input_line(int force, int* error);
 
 int CurrentSpeedLimit(int direction);
 
+/* Maps the block shared with the engine, after which quota and transfer
+ * progress no longer go through stdio. */
+bool fz_shared_block_attach(const char *name);
+bool fz_shared_block_attached(void);
+
+/* Reports bytes written to the local file or acknowledged by the server */
+void fz_report_transfer(int bytes);
+
 #ifdef _WINDOWS
 #include <windows.h>
 typedef FILETIME _fztimer;
@@ -929,6 +929,42 @@ static void mp_mul_add_simple(mp_int *r, mp_int *a, mp_int *b)
     }
 }
 
+/*
+ * Internal routine: square in the trivial O(N^2) way, using each
+ * cross product a_i a_j only once. Sets r <- a^2, r having to be zero
+ * beforehand.
+ */
+static void mp_sqr_simple(mp_int *r, mp_int *a)
+{
+    BignumInt *aend = a->w + a->nw, *rend = r->w + r->nw;
+
+    /* Sum of a_i a_j for i < j, in its position */
+    for (BignumInt *ap = a->w, *rp = r->w + 1;
+         ap < aend && rp < rend; ap++, rp += 2) {
+
+        BignumInt adata = *ap, carry = 0, *rq = rp;
+
+        for (BignumInt *bp = ap + 1; bp < aend && rq < rend; bp++, rq++)
+            BignumMULADD2(carry, *rq, adata, *bp, *rq, carry);
+
+        for (; rq < rend; rq++)
+            BignumADC(*rq, carry, carry, *rq, 0);
+    }
+
+    /* Double that, and add the squares a_i^2 on the diagonal */
+    BignumInt topbit = 0;
+    BignumCarry carry = 0;
+    for (size_t k = 0; k < r->nw; k++) {
+        BignumInt hi, lo;
+        BignumMUL(hi, lo, mp_word(a, k / 2), mp_word(a, k / 2));
+        BignumInt diag = (k & 1) ? hi : lo;
+
+        BignumInt doubled = (r->w[k] << 1) | topbit;
+        topbit = r->w[k] >> (BIGNUM_INT_BITS - 1);
+        BignumADC(r->w[k], carry, doubled, diag, carry);
+    }
+}
+
 #ifndef KARATSUBA_THRESHOLD      /* allow redefinition via -D for testing */
 #define KARATSUBA_THRESHOLD 24
 #endif
@@ -976,12 +1012,22 @@ static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
 
     mp_clear(r);
 
+    /*
+     * Squaring is recognised by the inputs being the same object,
+     * never by their values, so it's no less constant-time. It saves
+     * computing the cross terms twice.
+     */
+    bool square = (a == b);
+
     if (inlen < KARATSUBA_THRESHOLD || a->nw == 0 || b->nw == 0) {
         /*
          * The input numbers are too small to bother optimising. Go
          * straight to the simple primitive approach.
          */
-        mp_mul_add_simple(r, a, b);
+        if (square)
+            mp_sqr_simple(r, a);
+        else
+            mp_mul_add_simple(r, a, b);
         return;
     }
 
@@ -1033,8 +1079,8 @@ static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
 
     /* Recurse to compute a0*b0 and a1*b1, in their correct positions
      * in the output bignum. They can't overlap. */
-    mp_mul_internal(&r0, &a0, &b0, scratch);
-    mp_mul_internal(&r2, &a1, &b1, scratch);
+    mp_mul_internal(&r0, &a0, square ? &a0 : &b0, scratch);
+    mp_mul_internal(&r2, &a1, square ? &a1 : &b1, scratch);
 
     if (r->nw < inlen*2) {
         /*
@@ -1050,7 +1096,8 @@ static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
 
         mp_mul_internal(&s, &a0, &b1, scratch);
         mp_add_into(&r1, &r1, &s);
-        mp_mul_internal(&s, &a1, &b0, scratch);
+        if (!square)
+            mp_mul_internal(&s, &a1, &b0, scratch);
         mp_add_into(&r1, &r1, &s);
         return;
     }
@@ -1063,7 +1110,7 @@ static void mp_mul_internal(mp_int *r, mp_int *a, mp_int *b, mp_int scratch)
 
     /* Their product */
     mp_int product = mp_alloc_from_scratch(&scratch, botlen*2+1);
-    mp_mul_internal(&product, &asum, &bsum, scratch);
+    mp_mul_internal(&product, &asum, square ? &asum : &bsum, scratch);
 
     /* Subtract off the outer terms we already have */
     mp_sub_into(&product, &product, &r0);
@@ -1346,22 +1393,35 @@ static mp_int monty_reduce_internal(MontyContext *mc, mp_int *x, mp_int scratch)
      * congruent to 0 mod r? And the answer is, x * (-m)^{-1} mod r.
      */
 
-    /* x mod r */
-    mp_int x_lo = mp_make_alias(x, 0, mc->rbits);
-
-    /* x * (-m)^{-1}, i.e. the number we want to multiply by m */
-    mp_int k = mp_alloc_from_scratch(&scratch, mc->rw);
-    mp_mul_internal(&k, &x_lo, mc->minus_minv_mod_r, scratch);
-
-    /* m times that, i.e. the number we want to add to x */
-    mp_int mk = mp_alloc_from_scratch(&scratch, mc->pw);
-    mp_mul_internal(&mk, mc->m, &k, scratch);
-
-    /* Add it to x */
-    mp_add_into(&mk, x, &mk);
+    /*
+     * Rather than computing that multiple of m in one go, which would
+     * take two full-size multiplications, we build it up one word at a
+     * time: for each word of x from the bottom, add the multiple of m
+     * that clears that word, which only depends on the word itself and
+     * the bottom word of (-m)^{-1}. That's about as much work as a
+     * single multiplication.
+     */
+    mp_int t = mp_alloc_from_scratch(&scratch, mc->pw);
+    mp_copy_into(&t, x);
+
+    BignumInt minv = mc->minus_minv_mod_r->w[0];
+    BignumInt *mw = mc->m->w;
+    BignumCarry topcarry = 0;
+    for (size_t i = 0; i < mc->rw; i++) {
+        BignumInt k = t.w[i] * minv;
+        BignumInt carry = 0;
+        BignumInt *tp = t.w + i;
+        for (size_t j = 0; j < mc->rw; j++)
+            BignumMULADD2(carry, tp[j], k, mw[j], tp[j], carry);
+
+        /* The carry out of the top word goes into the next iteration's
+         * top word, so the loop never has to propagate further up */
+        BignumADC(tp[mc->rw], topcarry, tp[mc->rw], carry, topcarry);
+    }
+    t.w[2*mc->rw] += topcarry;
 
     /* Reduce mod r, by simply making an alias to the upper words of x */
-    mp_int toret = mp_make_alias(&mk, mc->rw, mk.nw - mc->rw);
+    mp_int toret = mp_make_alias(&t, mc->rw, t.nw - mc->rw);
 
     /*
      * We'll generally be doing this after a multiplication of two
@@ -1380,9 +1440,11 @@ void monty_mul_into(MontyContext *mc, mp_int *r, mp_int *x, mp_int *y)
     assert(x->nw <= mc->rw);
     assert(y->nw <= mc->rw);
 
+    /* The product and its reduction both use the context's scratch
+     * space, so that nothing needs allocating per multiplication */
     mp_int scratch = *mc->scratch;
     mp_int tmp = mp_alloc_from_scratch(&scratch, 2*mc->rw);
-    mp_mul_into(&tmp, x, y);
+    mp_mul_internal(&tmp, x, y, scratch);
     mp_int reduced = monty_reduce_internal(mc, &tmp, scratch);
     mp_copy_into(r, &reduced);
     mp_clear(mc->scratch);
@@ -1451,42 +1513,61 @@ mp_int *monty_export(MontyContext *mc, mp_int *x)
     return toret;
 }
 
-static void monty_reduce(MontyContext *mc, mp_int *x)
-{
-    mp_int reduced = monty_reduce_internal(mc, x, *mc->scratch);
-    mp_copy_into(x, &reduced);
-    mp_clear(mc->scratch);
-}
+/*
+ * monty_pow consumes the exponent in windows of this many bits, with
+ * a table of base^0 up to base^{2^MONTY_POW_WINDOW - 1}. It has to
+ * divide BIGNUM_INT_BITS.
+ */
+#define MONTY_POW_WINDOW 4
+#define MONTY_POW_TABLE_SIZE (1 << MONTY_POW_WINDOW)
 
 mp_int *monty_pow(MontyContext *mc, mp_int *base, mp_int *exponent)
 {
-    /* square builds up powers of the form base^{2^i}. */
-    mp_int *square = mp_copy(base);
-    size_t i = 0;
+    /*
+     * Fixed-window exponentiation: working down from the top of the
+     * exponent, square the accumulator once for each bit of a window
+     * and then multiply in the table entry indexed by that window.
+     * That costs about 1.25 multiplications per exponent bit, instead
+     * of the 2 of doing one multiplication and one squaring per bit.
+     *
+     * To stay constant-time, every window is processed even if it's
+     * zero, and the table entry is fetched by reading all of them and
+     * keeping the wanted one using mp_select_into.
+     */
+    mp_int *table[MONTY_POW_TABLE_SIZE];
+    table[0] = mp_copy(mc->powers_of_r_mod_m[0]);
+    table[1] = mp_make_sized(mc->rw);
+    mp_copy_into(table[1], base);
+
+    for (size_t j = 2; j < MONTY_POW_TABLE_SIZE; j++) {
+        table[j] = mp_make_sized(mc->rw);
+        monty_mul_into(mc, table[j], table[j-1], table[1]);
+    }
 
     /* out accumulates the output value. Starts at 1 (in Montgomery
-     * representation) and we multiply in each base^{2^i}. */
+     * representation). */
     mp_int *out = mp_copy(mc->powers_of_r_mod_m[0]);
+    mp_int *entry = mp_make_sized(mc->rw);
 
-    /* tmp holds each product we compute and reduce. */
-    mp_int *tmp = mp_make_sized(mc->rw * 2);
+    for (size_t i = exponent->nw * BIGNUM_INT_BITS; i > 0;) {
+        i -= MONTY_POW_WINDOW;
 
-    while (true) {
-        mp_mul_into(tmp, out, square);
-        monty_reduce(mc, tmp);
-        mp_select_into(out, out, tmp, mp_get_bit(exponent, i));
+        for (size_t j = 0; j < MONTY_POW_WINDOW; j++)
+            monty_mul_into(mc, out, out, out);
 
-        if (++i >= exponent->nw * BIGNUM_INT_BITS)
-            break;
+        BignumInt window = (exponent->w[i / BIGNUM_INT_BITS] >>
+                            (i % BIGNUM_INT_BITS)) &
+            (MONTY_POW_TABLE_SIZE - 1);
+        for (size_t j = 0; j < MONTY_POW_TABLE_SIZE; j++)
+            mp_select_into(entry, entry, table[j],
+                           1 ^ normalise_to_1(window ^ j));
 
-        mp_mul_into(tmp, square, square);
-        monty_reduce(mc, tmp);
-        mp_copy_into(square, tmp);
+        monty_mul_into(mc, out, out, entry);
     }
 
-    mp_free(square);
-    mp_free(tmp);
-    mp_clear(mc->scratch);
+    for (size_t j = 0; j < MONTY_POW_TABLE_SIZE; j++)
+        mp_free(table[j]);
+    mp_free(entry);
     return out;
 }
 
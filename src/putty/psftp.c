@@ -7,6 +7,7 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <limits.h>
+#include <time.h>
 
 #ifndef _WINDOWS
 #include <locale.h>
@@ -17,6 +18,7 @@
 #include "psftp.h"
 #include "storage.h"
 #include "ssh.h"
+#include "sshchan.h"
 #include "sftp.h"
 
 const char *const appname = "PSFTP";
@@ -274,13 +276,14 @@ static void not_connected(void)
 /* ----------------------------------------------------------------------
  * The meat of the `get' and `put' commands.
  */
-int sftp_get_file(char *fname, char *outfname, bool restart)
+static int sftp_get_file_range(char *fname, char *outfname, bool restart,
+                               bool segment, uint64_t segoffset, uint64_t seglength)
 {
     struct fxp_handle *fh;
     struct sftp_packet *pktin;
     struct sftp_request *req;
     struct fxp_xfer *xfer;
-    uint64_t offset;
+    uint64_t offset, written = 0;
     WFile *file;
     int ret, shown_err = false;
     struct fxp_attrs attrs;
@@ -301,7 +304,9 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
         return 0;
     }
 
-    if (restart) {
+    if (segment) {
+        file = open_segment_wfile(outfname);
+    } else if (restart) {
         file = open_existing_wfile(outfname, NULL);
     } else {
         file = open_new_file(outfname, GET_PERMISSIONS(attrs, -1));
@@ -317,7 +322,21 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
         return 2;
     }
 
-    if (restart) {
+    if (segment) {
+        if (seek_file(file, segoffset, FROM_START) == -1) {
+            close_wfile(file);
+            fzprintf(sftpError, "getrange: cannot seek to %"PRIu64" in %s",
+                   segoffset, outfname);
+            req = fxp_close_send(fh);
+            pktin = sftp_wait_for_reply(req);
+            fxp_close_recv(pktin, req);
+
+            return 0;
+        }
+
+        offset = segoffset;
+        fzprintf(sftpInfo, "getrange: %"PRIu64" bytes at file position %"PRIu64, seglength, offset);
+    } else if (restart) {
         if (seek_file(file, 0 , FROM_END) == -1) {
             close_wfile(file);
             fzprintf(sftpError, "reget: cannot restart %s - file too large",
@@ -345,7 +364,11 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
      * thus put up a progress bar.
      */
     ret = 1;
-    xfer = xfer_download_init(fh, offset);
+    if (segment) {
+        xfer = xfer_download_init_range(fh, offset, offset + seglength);
+    } else {
+        xfer = xfer_download_init(fh, offset);
+    }
     while (!xfer_done(xfer)) {
         void *vbuf;
         int retd, len;
@@ -360,10 +383,11 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
                 shown_err = true;
             }
             if (retd == INT_MIN)        /* pktin not even freed */
-                sfree(pktin);
+                sftp_pkt_free(pktin);
             ret = 0;
         }
 
+        /* The data is written straight from the received packets */
         while (xfer_download_data(xfer, &vbuf, &len)) {
             unsigned char *buf = (unsigned char *)vbuf;
 
@@ -386,11 +410,12 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
                 xfer_set_error(xfer);
             }
             winterval += wpos;
-            sfree(vbuf);
+            written += wpos;
         }
 
-        if (fz_timer_check(&timer)) {
-            fzprintf(sftpTransfer, "%d", winterval);
+        /* Reporting through the shared block is cheap, no need to batch */
+        if (fz_shared_block_attached() || fz_timer_check(&timer)) {
+            fz_report_transfer(winterval);
             winterval = 0;
         }
 
@@ -398,6 +423,16 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
 
     xfer_cleanup(xfer);
 
+    /*
+     * FZ: The local file already has its full size, a segment cut
+     * short by the remote EOF would silently leave a hole of zeros.
+     */
+    if (segment && ret && written < seglength) {
+        fzprintf(sftpError, "getrange: remote file ended after %"PRIu64" of %"PRIu64" bytes",
+                 written, seglength);
+        ret = 0;
+    }
+
     close_wfile(file);
 
     req = fxp_close_send(fh);
@@ -407,6 +442,11 @@ int sftp_get_file(char *fname, char *outfname, bool restart)
     return ret;
 }
 
+int sftp_get_file(char *fname, char *outfname, bool restart)
+{
+    return sftp_get_file_range(fname, outfname, restart, false, 0, 0);
+}
+
 int pending_receive() {
     return ssh_pending_receive(backend);
 }
@@ -564,6 +604,18 @@ int sftp_cmd_quit(struct sftp_command *cmd)
     return -1;
 }
 
+/*
+ * FZ: Quits without keeping the engine waiting. Closing our channel
+ * only ends the connection to the server once no other fzsftp shares
+ * it anymore, until then we keep serving them.
+ */
+int sftp_cmd_linger(struct sftp_command *cmd)
+{
+    pending_reply = false;
+    platform_detach_stdout();
+    return -1;
+}
+
 int sftp_cmd_keyfile(struct sftp_command *cmd)
 {
     if (cmd->nwords != 2) {
@@ -650,6 +702,52 @@ int sftp_cmd_close(struct sftp_command *cmd)
     return 0;
 }
 
+/*
+ * Sends a listing entry along with its attributes, sparing the engine
+ * from parsing the longname. Only done in framed mode and if the type
+ * of the entry is known, else it is sent as plain listing entry.
+ *
+ * Fields: longname, u32 attribute flags, u64 size, u32 uid, u32 gid,
+ * u32 permissions, u64 mtime, all big-endian, then the name.
+ */
+static void fzprintf_listentry_attrs(const char *longname,
+                                     const struct fxp_attrs *attrs,
+                                     const char *name)
+{
+    unsigned char buf[32];
+    uint64_t mtime = 0;
+
+    if (attrs->flags & SSH_FILEXFER_ATTR_ACMODTIME)
+        mtime = attrs->mtime;
+
+    if (!framed_output || !(attrs->flags & SSH_FILEXFER_ATTR_PERMISSIONS)) {
+        fzprintf_listentry(longname, mtime, name);
+        return;
+    }
+
+    PUT_32BIT_MSB_FIRST(buf, attrs->flags);
+    PUT_64BIT_MSB_FIRST(buf + 4, (attrs->flags & SSH_FILEXFER_ATTR_SIZE) ? attrs->size : 0);
+    PUT_32BIT_MSB_FIRST(buf + 12, (attrs->flags & SSH_FILEXFER_ATTR_UIDGID) ? attrs->uid : 0);
+    PUT_32BIT_MSB_FIRST(buf + 16, (attrs->flags & SSH_FILEXFER_ATTR_UIDGID) ? attrs->gid : 0);
+    PUT_32BIT_MSB_FIRST(buf + 20, attrs->permissions);
+    PUT_64BIT_MSB_FIRST(buf + 24, mtime);
+
+    fputc((int)sftpListentryAttrs + '0', stdout);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", longname);
+    fwrite(buf, 32, 1, stdout);
+    fzprintf_raw_untrusted(sftpUnknown, "%s", name);
+}
+
+/*
+ * FZ: Number of outstanding READDIR requests. It starts at
+ * LS_INITIAL_WINDOW and grows by one for each batch that is at least as
+ * large as any before it, up to sftp_max_list_window. That way servers
+ * sending small batches still get listed at close to one batch per
+ * request instead of one per round trip.
+ */
+#define LS_INITIAL_WINDOW 4
+static int sftp_max_list_window = 32;
+
 /*
  * List a directory. If no arguments are given, list pwd; otherwise
  * list the directory given in words[1].
@@ -662,8 +760,8 @@ int sftp_cmd_ls(struct sftp_command *cmd)
     char *cdir;
     struct sftp_packet *pktin;
     struct sftp_request *req;
-    struct sftp_request *reqs[4];
-    int i;
+    struct sftp_request **reqs;
+    int i, window, head, outstanding, maxbatch;
 
     if (!backend) {
         not_connected();
@@ -693,16 +791,22 @@ int sftp_cmd_ls(struct sftp_command *cmd)
         return 0;
     }
 
-    reqs[0] = fxp_readdir_send(dirh);
-    reqs[1] = fxp_readdir_send(dirh);
-    reqs[2] = fxp_readdir_send(dirh);
-    reqs[3] = fxp_readdir_send(dirh);
-    int ri = 0;
+    reqs = snewn(sftp_max_list_window, struct sftp_request *);
+    window = LS_INITIAL_WINDOW;
+    head = 0;
+    outstanding = 0;
+    maxbatch = 0;
+    while (outstanding < window) {
+        reqs[outstanding++] = fxp_readdir_send(dirh);
+    }
+
     while (1) {
+        req = reqs[head];
+        head = (head + 1) % sftp_max_list_window;
+        --outstanding;
 
-        pktin = sftp_wait_for_reply(reqs[ri]);
-        names = fxp_readdir_recv(pktin, reqs[ri]);
-        reqs[ri] = NULL;
+        pktin = sftp_wait_for_reply(req);
+        names = fxp_readdir_recv(pktin, req);
 
         if (names == NULL) {
             if (fxp_error_type() == SSH_FX_EOF)
@@ -716,28 +820,31 @@ int sftp_cmd_ls(struct sftp_command *cmd)
         }
 
         for (i = 0; i < names->nnames; i++) {
-            unsigned long mtime = 0;
-            if (names->names[i].attrs.flags & SSH_FILEXFER_ATTR_ACMODTIME) {
-                mtime = names->names[i].attrs.mtime;
-            }
-            fzprintf_raw_untrusted(sftpListentry, "%s", names->names[i].longname);
-            fzprintf_raw_untrusted(sftpUnknown, "%lu", mtime);
-            fzprintf_raw_untrusted(sftpUnknown, "%s", names->names[i].filename);
+            fzprintf_listentry_attrs(names->names[i].longname,
+                                     &names->names[i].attrs,
+                                     names->names[i].filename);
+        }
+
+        if (names->nnames >= maxbatch) {
+            maxbatch = names->nnames;
+            if (window < sftp_max_list_window)
+                ++window;
         }
 
         fxp_free_names(names);
-        reqs[ri++] = fxp_readdir_send(dirh);
-        ri %= 4;
-    }
-    for (i = 0; i < 4; ++i) {
-        if (reqs[ri]) {
-            pktin = sftp_wait_for_reply(reqs[ri]);
-            sfree(reqs[ri]);
-            sfree(pktin);
+        while (outstanding < window) {
+            reqs[(head + outstanding++) % sftp_max_list_window] =
+                fxp_readdir_send(dirh);
         }
-        ++ri;
-        ri %= 4;
     }
+    while (outstanding) {
+        pktin = sftp_wait_for_reply(reqs[head]);
+        sfree(reqs[head]);
+        sfree(pktin);
+        head = (head + 1) % sftp_max_list_window;
+        --outstanding;
+    }
+    sfree(reqs);
     req = fxp_close_send(dirh);
     pktin = sftp_wait_for_reply(req);
     fxp_close_recv(pktin, req);
@@ -855,6 +962,51 @@ int sftp_cmd_reget(struct sftp_command *cmd)
     return sftp_general_get(cmd, true);
 }
 
+/*
+ * FZ: Download a single segment of a file into an existing local
+ * file at the same offset: getrange <offset> <length> <remote> <local>
+ */
+int sftp_cmd_getrange(struct sftp_command *cmd)
+{
+    char *fname, *origfname, *outfname, *end;
+    uint64_t segoffset, seglength;
+    int ret;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 5) {
+        fzprintf(sftpError, "%s: expects offset, length and filenames", cmd->words[0]);
+        return 0;
+    }
+
+    segoffset = strtoull(cmd->words[1], &end, 10);
+    if (*end || !*cmd->words[1]) {
+        fzprintf(sftpError, "%s: invalid offset", cmd->words[0]);
+        return 0;
+    }
+    seglength = strtoull(cmd->words[2], &end, 10);
+    if (*end || !*cmd->words[2] || !seglength) {
+        fzprintf(sftpError, "%s: invalid length", cmd->words[0]);
+        return 0;
+    }
+
+    origfname = cmd->words[3];
+    outfname = cmd->words[4];
+
+    fname = canonify(origfname, false);
+    if (!fname) {
+        fzprintf(sftpError, "%s: canonify: %s", origfname, fxp_error());
+        return 0;
+    }
+
+    ret = sftp_get_file_range(fname, outfname, false, true, segoffset, seglength);
+    sfree(fname);
+    return ret;
+}
+
 /*
  * Send a file and store it at the remote end. We have three very
  * similar commands here. The basic one is `put'; `reput' differs
@@ -901,6 +1053,653 @@ int sftp_cmd_reput(struct sftp_command *cmd)
     return sftp_general_put(cmd, true);
 }
 
+/*
+ * FZ: Upload a batch of small files. Each file is given as three
+ * words: the modification time to set afterwards (0 to leave it
+ * alone), the local file and the absolute remote file. Up to
+ * MPUT_WINDOW files are in flight at once, so the open of the next
+ * files overlaps with the writes and the close of the current ones
+ * instead of every file costing several round trips in turn.
+ *
+ * A reply "mput <n> OK" or "mput <n> failed" is printed as soon as
+ * the n-th file of the batch, counting from 0, is done.
+ */
+#define MPUT_WINDOW 16
+#define MPUT_FILE_WRITES 4
+#define MPUT_BLOCK (4096*4)
+
+struct mput_file {
+    int index;
+    const char *local, *remote;
+    uint64_t mtime;
+    RFile *file;
+    struct fxp_handle *fh;
+    uint64_t offset;
+    int outstanding;
+    bool eof, err, closing;
+};
+
+enum { MPUT_OPEN, MPUT_WRITE, MPUT_SETSTAT, MPUT_CLOSE };
+
+struct mput_req {
+    struct mput_file *f;
+    int type;
+    int len;
+};
+
+static void mput_register(struct mput_file *f, struct sftp_request *req,
+                          int type, int len)
+{
+    struct mput_req *r = snew(struct mput_req);
+    r->f = f;
+    r->type = type;
+    r->len = len;
+    sftp_register(req);
+    fxp_set_userdata(req, r);
+    f->outstanding++;
+}
+
+static void mput_finish(struct mput_file *f)
+{
+    if (f->file) {
+        close_rfile(f->file);
+        f->file = NULL;
+    }
+    fzprintf(sftpReply, "mput %d %s", f->index, f->err ? "failed" : "OK");
+}
+
+/* Returns false if the file is already done */
+static bool mput_start(struct mput_file *f)
+{
+    struct fxp_attrs attrs;
+    long permissions;
+
+    f->file = open_existing_file(f->local, NULL, NULL, NULL, &permissions);
+    if (!f->file) {
+        fzprintf(sftpError, "local: unable to open %s", f->local);
+        f->err = true;
+        mput_finish(f);
+        return false;
+    }
+
+    attrs.flags = 0;
+    PUT_PERMISSIONS(attrs, permissions);
+    mput_register(f, fxp_open_send(f->remote,
+                                   SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC,
+                                   &attrs), MPUT_OPEN, 0);
+    return true;
+}
+
+static void mput_pump(struct mput_file *f)
+{
+    char buffer[MPUT_BLOCK];
+    int len;
+
+    while (!f->eof && !f->err && f->outstanding < MPUT_FILE_WRITES) {
+        len = read_from_file(f->file, buffer, sizeof(buffer));
+        if (len == -1) {
+            fzprintf(sftpError, "error while reading local file %s", f->local);
+            f->err = true;
+        } else if (len == 0) {
+            f->eof = true;
+        } else {
+            mput_register(f, fxp_write_send(f->fh, buffer, f->offset, len),
+                          MPUT_WRITE, len);
+            f->offset += len;
+        }
+    }
+
+    if ((f->eof || f->err) && !f->outstanding && !f->closing) {
+        /* The setstat and the close go out back to back, no need to
+         * wait for the first before sending the second. */
+        f->closing = true;
+        if (!f->err && f->mtime) {
+            struct fxp_attrs attrs = {0};
+            attrs.flags = SSH_FILEXFER_ATTR_ACMODTIME;
+            attrs.atime = attrs.mtime = f->mtime;
+            mput_register(f, fxp_fsetstat_send(f->fh, attrs), MPUT_SETSTAT, 0);
+        }
+        mput_register(f, fxp_close_send(f->fh), MPUT_CLOSE, 0);
+    }
+}
+
+/* Returns true once the file is done */
+static bool mput_gotpkt(struct mput_req *r, struct sftp_packet *pktin,
+                        struct sftp_request *req)
+{
+    struct mput_file *f = r->f;
+    int type = r->type, len = r->len;
+
+    sfree(r);
+    f->outstanding--;
+
+    switch (type) {
+      case MPUT_OPEN:
+        f->fh = fxp_open_recv(pktin, req);
+        if (!f->fh) {
+            fzprintf(sftpError, "%s: open for write: %s", f->remote, fxp_error());
+            f->err = true;
+            mput_finish(f);
+            return true;
+        }
+        fzprintf(sftpInfo, "local:%s => remote:%s", f->local, f->remote);
+        break;
+      case MPUT_WRITE:
+        if (!fxp_write_recv(pktin, req)) {
+            if (!f->err)
+                fzprintf(sftpError, "error while writing %s: %s", f->remote, fxp_error());
+            f->err = true;
+        } else {
+            fz_report_transfer(len);
+        }
+        break;
+      case MPUT_SETSTAT:
+        if (!fxp_fsetstat_recv(pktin, req)) {
+            fzprintf(sftpError, "set attrs for %s: %s", f->remote, fxp_error());
+            f->err = true;
+        }
+        break;
+      case MPUT_CLOSE:
+        if (!fxp_close_recv(pktin, req)) {
+            if (!f->err)
+                fzprintf(sftpError, "error while writing %s: %s", f->remote, fxp_error());
+            f->err = true;
+        }
+        break;
+    }
+
+    if (f->closing) {
+        if (f->outstanding)
+            return false;
+        mput_finish(f);
+        return true;
+    }
+
+    mput_pump(f);
+    return false;
+}
+
+static int sftp_cmd_mput(struct sftp_command *cmd)
+{
+    struct mput_file *files;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    struct mput_req *r;
+    struct mput_file *f;
+    int count, next = 0, active = 0, failed = 0;
+    int i;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords < 4 || (cmd->nwords - 1) % 3) {
+        fzprintf(sftpError, "mput: expects modification time, source and target filename for each file");
+        return 0;
+    }
+
+    count = (int)((cmd->nwords - 1) / 3);
+    files = snewn(count, struct mput_file);
+    for (i = 0; i < count; i++) {
+        const char *p = cmd->words[1 + i * 3];
+
+        f = &files[i];
+        memset(f, 0, sizeof(*f));
+        f->index = i;
+        f->local = cmd->words[2 + i * 3];
+        f->remote = cmd->words[3 + i * 3];
+
+        while (*p) {
+            char c = *p++;
+            if (c < '0' || c > '9') {
+                fzprintf(sftpError, "mput: not a valid time");
+                sfree(files);
+                return 0;
+            }
+            f->mtime = f->mtime * 10 + (c - '0');
+        }
+
+        /* Remote names are not canonified, that would cost a round trip each */
+        if (f->remote[0] != '/') {
+            fzprintf(sftpError, "mput: %s is not an absolute path", f->remote);
+            sfree(files);
+            return 0;
+        }
+    }
+
+    while (next < count || active) {
+        while (next < count && active < MPUT_WINDOW) {
+            if (mput_start(&files[next]))
+                active++;
+            else
+                failed++;
+            next++;
+        }
+        if (!active)
+            break;
+
+        pktin = sftp_recv();
+        if (!pktin) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet from server");
+        }
+        req = sftp_find_request(pktin);
+        r = req ? (struct mput_req *)fxp_get_userdata(req) : NULL;
+        if (!r) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
+
+        f = r->f;
+        if (mput_gotpkt(r, pktin, req)) {
+            if (f->err)
+                failed++;
+            active--;
+        }
+    }
+
+    sfree(files);
+
+    return failed ? 0 : 1;
+}
+
+/*
+ * FZ: Upload a batch of small files as a tar archive, streamed to tar
+ * run through an exec channel next to the SFTP one. The first word is
+ * the remote directory, followed by the modification time, the local
+ * file and the remote name of each file, as for mput. Remote names
+ * must not contain slashes and fit into a tar header.
+ *
+ * The replies are those of mput with "tput" instead, they are only
+ * known once tar has exited. If the server does not let tar run, no
+ * reply is printed for any file, so the caller can fall back to mput.
+ */
+#define TPUT_BLOCK 512
+
+struct tputchan {
+    SshChannel *sc;
+    bool opened, open_failed, replied, started, closed;
+    int exitcode;
+    Channel chan;
+};
+
+static void tputchan_free(Channel *chan)
+{
+    /* Freed by sftp_cmd_tput once it sees the channel is gone */
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->closed = true;
+}
+
+static void tputchan_open_confirmation(Channel *chan)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->opened = true;
+}
+
+static void tputchan_open_failed(Channel *chan, const char *errtext)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    fzprintf(sftpVerbose, "tput: unable to open channel: %s", errtext);
+    tc->open_failed = true;
+}
+
+static size_t tputchan_send(Channel *chan, bool is_stderr,
+                            const void *data, size_t len)
+{
+    /* Only error messages are expected */
+    if (len > 1000)
+        len = 1000;
+    fzprintf(sftpVerbose, "tar: %.*s", (int)len, (const char *)data);
+    return 0;
+}
+
+static void tputchan_send_eof(Channel *chan)
+{
+}
+
+static void tputchan_set_input_wanted(Channel *chan, bool wanted)
+{
+}
+
+static char *tputchan_log_close_msg(Channel *chan)
+{
+    return dupstr("Archive upload channel closed");
+}
+
+static bool tputchan_rcvd_exit_status(Channel *chan, int status)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->exitcode = status;
+    return true;
+}
+
+static bool tputchan_rcvd_exit_signal(
+    Channel *chan, ptrlen signame, bool core_dumped, ptrlen msg)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->exitcode = 128;
+    return true;
+}
+
+static bool tputchan_rcvd_exit_signal_numeric(
+    Channel *chan, int signum, bool core_dumped, ptrlen msg)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->exitcode = 128 + signum;
+    return true;
+}
+
+static void tputchan_request_response(Channel *chan, bool success)
+{
+    struct tputchan *tc = container_of(chan, struct tputchan, chan);
+    tc->replied = true;
+    tc->started = success;
+}
+
+static const struct ChannelVtable tputchan_channelvt = {
+    tputchan_free,
+    tputchan_open_confirmation,
+    tputchan_open_failed,
+    tputchan_send,
+    tputchan_send_eof,
+    tputchan_set_input_wanted,
+    tputchan_log_close_msg,
+    chan_default_want_close,
+    tputchan_rcvd_exit_status,
+    tputchan_rcvd_exit_signal,
+    tputchan_rcvd_exit_signal_numeric,
+    chan_no_run_shell,
+    chan_no_run_command,
+    chan_no_run_subsystem,
+    chan_no_enable_x11_forwarding,
+    chan_no_enable_agent_forwarding,
+    chan_no_allocate_pty,
+    chan_no_set_env,
+    chan_no_send_break,
+    chan_no_send_signal,
+    chan_no_change_window_size,
+    tputchan_request_response,
+};
+
+/* Runs the event loop until *flag or the channel is gone */
+static bool tput_wait(struct tputchan *tc, const bool *flag)
+{
+    while (!*flag && !tc->closed) {
+        if (backend_exitcode(backend) >= 0 || ssh_sftp_loop_iteration() < 0)
+            return false;
+    }
+    return *flag;
+}
+
+/* Keeps no more than SSH_MAX_BACKLOG buffered for the channel */
+static bool tput_write(struct tputchan *tc, const void *data, size_t len)
+{
+    size_t backlog;
+
+    if (tc->closed)
+        return false;
+    backlog = sshfwd_write(tc->sc, data, len);
+    while (backlog > SSH_MAX_BACKLOG) {
+        if (backend_exitcode(backend) >= 0 || ssh_sftp_loop_iteration() < 0 ||
+            tc->closed)
+            return false;
+        backlog = sshfwd_write(tc->sc, "", 0);
+    }
+    return true;
+}
+
+static void tput_header(unsigned char *h, const char *name, uint64_t size,
+                        uint64_t mtime, long perms)
+{
+    unsigned int sum = 0;
+    int i;
+
+    memset(h, 0, TPUT_BLOCK);
+    memcpy(h, name, strlen(name));
+    snprintf((char *)h + 100, 8, "%07lo", (unsigned long)(perms & 0777));
+    snprintf((char *)h + 108, 8, "%07o", 0);
+    snprintf((char *)h + 116, 8, "%07o", 0);
+    snprintf((char *)h + 124, 12, "%011llo", (unsigned long long)size);
+    snprintf((char *)h + 136, 12, "%011llo", (unsigned long long)mtime);
+    memset(h + 148, ' ', 8);
+    h[156] = '0';
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+
+    for (i = 0; i < TPUT_BLOCK; i++)
+        sum += h[i];
+    snprintf((char *)h + 148, 7, "%06o", sum);
+    h[155] = ' ';
+}
+
+/* Returns false if the file could not be sent. sent is cleared if the
+ * archive cannot be continued, e.g. after a read error past the header. */
+static bool tput_file(struct tputchan *tc, struct mput_file *f, bool *sent)
+{
+    unsigned char header[TPUT_BLOCK];
+    char buffer[MPUT_BLOCK];
+    uint64_t size, left;
+    long perms;
+    int len;
+
+    *sent = false;
+    f->file = open_existing_file(f->local, &size, NULL, NULL, &perms);
+    if (!f->file) {
+        fzprintf(sftpError, "local: unable to open %s", f->local);
+        *sent = true;
+        return false;
+    }
+    /* The size field of the header holds 11 octal digits */
+    if (size >= (1ULL << 33)) {
+        fzprintf(sftpError, "tput: %s is too large", f->local);
+        close_rfile(f->file);
+        f->file = NULL;
+        *sent = true;
+        return false;
+    }
+
+    tput_header(header, f->remote, size,
+                f->mtime ? f->mtime : (uint64_t)time(NULL),
+                perms >= 0 ? perms : 0644);
+    if (!tput_write(tc, header, sizeof(header))) {
+        close_rfile(f->file);
+        f->file = NULL;
+        return false;
+    }
+
+    /* The archive has to hold exactly as much data as the header says.
+     * If the file cannot be read that far, the archive is abandoned
+     * rather than letting tar extract a file with a hole in it. */
+    left = size;
+    while (left) {
+        len = left < sizeof(buffer) ? (int)left : (int)sizeof(buffer);
+        len = read_from_file(f->file, buffer, len);
+        if (len <= 0) {
+            fzprintf(sftpError, "error while reading local file %s, aborting tput", f->local);
+            close_rfile(f->file);
+            f->file = NULL;
+            return false;
+        }
+        if (!tput_write(tc, buffer, len)) {
+            close_rfile(f->file);
+            f->file = NULL;
+            return false;
+        }
+        fz_report_transfer(len);
+        left -= len;
+    }
+    close_rfile(f->file);
+    f->file = NULL;
+
+    if (size % TPUT_BLOCK) {
+        memset(buffer, 0, TPUT_BLOCK);
+        if (!tput_write(tc, buffer, TPUT_BLOCK - size % TPUT_BLOCK))
+            return false;
+    }
+
+    *sent = true;
+    return true;
+}
+
+static int sftp_cmd_tput(struct sftp_command *cmd)
+{
+    struct mput_file *files;
+    struct tputchan *tc;
+    ConnectionLayer *cl;
+    const char *dir;
+    char *quoted, *command;
+    unsigned char trailer[TPUT_BLOCK * 2];
+    int count, failed = 0;
+    bool complete = true;
+    int i;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords < 5 || (cmd->nwords - 2) % 3) {
+        fzprintf(sftpError, "tput: expects remote directory, modification time, source and target name for each file");
+        return 0;
+    }
+
+    dir = cmd->words[1];
+    if (dir[0] != '/') {
+        fzprintf(sftpError, "tput: %s is not an absolute path", dir);
+        return 0;
+    }
+
+    count = (int)((cmd->nwords - 2) / 3);
+    files = snewn(count, struct mput_file);
+    for (i = 0; i < count; i++) {
+        const char *p = cmd->words[2 + i * 3];
+        struct mput_file *f = &files[i];
+
+        memset(f, 0, sizeof(*f));
+        f->index = i;
+        f->local = cmd->words[3 + i * 3];
+        f->remote = cmd->words[4 + i * 3];
+
+        while (*p) {
+            char c = *p++;
+            if (c < '0' || c > '9') {
+                fzprintf(sftpError, "tput: not a valid time");
+                sfree(files);
+                return 0;
+            }
+            f->mtime = f->mtime * 10 + (c - '0');
+        }
+
+        if (!*f->remote || strchr(f->remote, '/') || strlen(f->remote) > 100 ||
+            !strcmp(f->remote, ".") || !strcmp(f->remote, "..")) {
+            fzprintf(sftpError, "tput: %s is not a valid name", f->remote);
+            sfree(files);
+            return 0;
+        }
+    }
+
+    cl = ssh_get_connection_layer(backend);
+    if (!cl) {
+        fzprintf(sftpError, "tput: unavailable");
+        sfree(files);
+        return 0;
+    }
+
+    tc = snew(struct tputchan);
+    memset(tc, 0, sizeof(*tc));
+    tc->exitcode = -1;
+    tc->chan.vt = &tputchan_channelvt;
+    tc->chan.initial_fixed_window_size = 0;
+    tc->sc = ssh_session_open(cl, &tc->chan);
+
+    if (!tput_wait(tc, &tc->opened)) {
+        fzprintf(sftpError, "tput: unavailable, the server did not open a channel");
+        if (tc->closed)
+            sfree(tc);
+        sfree(files);
+        return 0;
+    }
+
+    /* Single quotes protect everything but single quotes */
+    {
+        strbuf *sb = strbuf_new();
+        const char *p;
+        put_byte(sb, '\'');
+        for (p = dir; *p; p++) {
+            if (*p == '\'')
+                put_datapl(sb, PTRLEN_LITERAL("'\\''"));
+            else
+                put_byte(sb, *p);
+        }
+        put_byte(sb, '\'');
+        quoted = strbuf_to_str(sb);
+    }
+    command = dupprintf("cd %s && exec tar -x -f -", quoted);
+    sfree(quoted);
+    fzprintf(sftpVerbose, "Running %s", command);
+    sshfwd_start_command(tc->sc, true, command);
+    sfree(command);
+
+    if (!tput_wait(tc, &tc->replied) || !tc->started) {
+        fzprintf(sftpError, "tput: unavailable, the server does not allow running commands");
+        if (!tc->closed) {
+            sshfwd_initiate_close(tc->sc, NULL);
+            tput_wait(tc, &tc->closed);
+        }
+        if (tc->closed)
+            sfree(tc);
+        sfree(files);
+        return 0;
+    }
+
+    for (i = 0; i < count && complete; i++) {
+        bool sent;
+        if (!tput_file(tc, &files[i], &sent))
+            files[i].err = true;
+        complete = sent;
+    }
+    for (; i < count; i++)
+        files[i].err = true;
+
+    memset(trailer, 0, sizeof(trailer));
+    if (complete)
+        complete = tput_write(tc, trailer, sizeof(trailer));
+    if (!tc->closed)
+        sshfwd_write_eof(tc->sc);
+
+    /* The exit status arrives before the channel gets closed */
+    if (!tput_wait(tc, &tc->closed)) {
+        fzprintf(sftpError, "tput: connection lost");
+        sfree(files);
+        return 0;
+    }
+
+    if (tc->exitcode == 126 || tc->exitcode == 127) {
+        fzprintf(sftpError, "tput: unavailable, tar could not be run");
+        sfree(tc);
+        sfree(files);
+        return 0;
+    }
+    if (tc->exitcode != 0) {
+        fzprintf(sftpError, "tput: tar exited with code %d", tc->exitcode);
+    }
+
+    for (i = 0; i < count; i++) {
+        bool err = files[i].err || !complete || tc->exitcode != 0;
+        if (err)
+            failed++;
+        fzprintf(sftpReply, "tput %d %s", i, err ? "failed" : "OK");
+    }
+
+    sfree(tc);
+    sfree(files);
+
+    return failed ? 0 : 1;
+}
+
 int sftp_cmd_mkdir(struct sftp_command *cmd)
 {
     char *dir;
@@ -1404,6 +2203,388 @@ static int sftp_cmd_mtime(struct sftp_command *cmd)
     return 1;
 }
 
+/*
+ * FZ: Print the checksum of a remote file as "<algorithm> <hex hash>",
+ * with the algorithm named as in the FTP HASH command.
+ */
+static int sftp_cmd_checkfile(struct sftp_command *cmd)
+{
+    static const struct {
+        const char *sftp_name, *name;
+    } algorithms[] = {
+        { "sha512", "SHA-512" },
+        { "sha256", "SHA-256" },
+        { "sha1", "SHA-1" },
+        { "md5", "MD5" },
+        { "crc32", "CRC32" },
+    };
+
+    char *filename, *cname, *algorithm = NULL, *hex;
+    unsigned char *hash = NULL;
+    size_t hashlen = 0, i;
+    const char *name = NULL;
+    bool result;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 2) {
+        fzprintf(sftpError, "checkfile: expects exactly one filename as argument");
+        return 0;
+    }
+
+    filename = cmd->words[1];
+
+    cname = canonify(filename, false);
+    if (!cname) {
+        fzprintf(sftpError, "%s: canonify: %s", filename, fxp_error());
+        return 0;
+    }
+
+    req = fxp_checkfile_send(cname, "sha512,sha256,sha1,md5,crc32");
+    pktin = sftp_wait_for_reply(req);
+    result = fxp_checkfile_recv(pktin, req, &algorithm, &hash, &hashlen);
+    if (!result && fxp_error_type() == SSH_FX_OP_UNSUPPORTED) {
+        /* Some servers only implement the handle variant */
+        struct fxp_handle *fh;
+        req = fxp_open_send(cname, SSH_FXF_READ, NULL);
+        pktin = sftp_wait_for_reply(req);
+        fh = fxp_open_recv(pktin, req);
+        if (fh) {
+            req = fxp_checkfile_handle_send(fh, "sha512,sha256,sha1,md5,crc32");
+            pktin = sftp_wait_for_reply(req);
+            result = fxp_checkfile_recv(pktin, req, &algorithm, &hash, &hashlen);
+
+            req = fxp_close_send(fh);
+            pktin = sftp_wait_for_reply(req);
+            fxp_close_recv(pktin, req);
+        }
+    }
+    if (!result) {
+        fzprintf(sftpError, "check-file for %s: %s", cname, fxp_error());
+        sfree(cname);
+        return 0;
+    }
+    sfree(cname);
+
+    for (i = 0; i < lenof(algorithms); ++i) {
+        if (!strcmp(algorithm, algorithms[i].sftp_name)) {
+            name = algorithms[i].name;
+            break;
+        }
+    }
+    if (!name) {
+        fzprintf(sftpError, "check-file: unsupported algorithm %s", algorithm);
+        sfree(algorithm);
+        sfree(hash);
+        return 0;
+    }
+
+    hex = snewn(hashlen * 2 + 1, char);
+    for (i = 0; i < hashlen; ++i) {
+        sprintf(hex + i * 2, "%02x", hash[i]);
+    }
+
+    fzprintf(sftpReply, "%s %s", name, hex);
+
+    sfree(hex);
+    sfree(algorithm);
+    sfree(hash);
+    return 1;
+}
+
+/*
+ * FZ: Copy a file on the server without transferring its contents
+ * through the client, using the "copy-data" extension.
+ */
+static int sftp_cmd_copy(struct sftp_command *cmd)
+{
+    char *srcfname, *dstfname;
+    struct fxp_handle *src, *dst;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    bool result;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords != 3) {
+        fzprintf(sftpError, "copy: expects a source and a target filename");
+        return 0;
+    }
+
+    if (!fxp_has_extension("copy-data")) {
+        fzprintf(sftpError, "copy: server does not support copy-data");
+        return 0;
+    }
+
+    srcfname = canonify(cmd->words[1], false);
+    if (!srcfname) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[1], fxp_error());
+        return 0;
+    }
+    dstfname = canonify(cmd->words[2], false);
+    if (!dstfname) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[2], fxp_error());
+        sfree(srcfname);
+        return 0;
+    }
+
+    req = fxp_open_send(srcfname, SSH_FXF_READ, NULL);
+    pktin = sftp_wait_for_reply(req);
+    src = fxp_open_recv(pktin, req);
+    if (!src) {
+        fzprintf(sftpError, "%s: open for read: %s", srcfname, fxp_error());
+        sfree(srcfname);
+        sfree(dstfname);
+        return 0;
+    }
+
+    req = fxp_open_send(dstfname, SSH_FXF_WRITE | SSH_FXF_CREAT | SSH_FXF_TRUNC,
+                        NULL);
+    pktin = sftp_wait_for_reply(req);
+    dst = fxp_open_recv(pktin, req);
+    if (!dst) {
+        fzprintf(sftpError, "%s: open for write: %s", dstfname, fxp_error());
+        req = fxp_close_send(src);
+        pktin = sftp_wait_for_reply(req);
+        fxp_close_recv(pktin, req);
+        sfree(srcfname);
+        sfree(dstfname);
+        return 0;
+    }
+
+    req = fxp_copydata_send(src, 0, 0, dst, 0);
+    pktin = sftp_wait_for_reply(req);
+    result = fxp_copydata_recv(pktin, req);
+    if (!result)
+        fzprintf(sftpError, "copy %s to %s: %s", srcfname, dstfname, fxp_error());
+
+    req = fxp_close_send(src);
+    pktin = sftp_wait_for_reply(req);
+    fxp_close_recv(pktin, req);
+
+    req = fxp_close_send(dst);
+    pktin = sftp_wait_for_reply(req);
+    if (!fxp_close_recv(pktin, req) && result) {
+        fzprintf(sftpError, "%s: close: %s", dstfname, fxp_error());
+        result = false;
+    }
+
+    sfree(srcfname);
+    sfree(dstfname);
+
+    return result ? 1 : 0;
+}
+
+/*
+ * FZ: Look up many files in one directory at once. Up to MSTAT_WINDOW
+ * stat requests are kept outstanding instead of waiting for each reply
+ * in turn. A listing entry is printed for every file that exists, in
+ * the order the replies arrive; files that don't exist are skipped.
+ * Any other stat error fails the command once all replies are in, as
+ * the file's existence is unknown.
+ */
+#define MSTAT_WINDOW 64
+
+static void mstat_print_entry(const char *name, const struct fxp_attrs *attrs)
+{
+    char perms[11];
+    unsigned long mode = 0;
+    uint64_t size = 0;
+    unsigned long uid = 0, gid = 0;
+    char *longname;
+    int i;
+
+    if (attrs->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+        mode = attrs->permissions;
+    if (attrs->flags & SSH_FILEXFER_ATTR_SIZE)
+        size = attrs->size;
+    if (attrs->flags & SSH_FILEXFER_ATTR_UIDGID) {
+        uid = attrs->uid;
+        gid = attrs->gid;
+    }
+
+    /* Same shape as the longname in a directory listing, the engine
+     * takes name and mtime from the separate fields. */
+    switch (mode & 0170000) {
+      case 0040000: perms[0] = 'd'; break;
+      case 0120000: perms[0] = 'l'; break;
+      default: perms[0] = '-'; break;
+    }
+    for (i = 0; i < 9; i++)
+        perms[i + 1] = (mode & (0400 >> i)) ? "rwxrwxrwx"[i] : '-';
+    perms[10] = 0;
+
+    longname = dupprintf("%s 1 %lu %lu %"PRIu64" Jan  1  1970 %s",
+                         perms, uid, gid, size, name);
+    fzprintf_listentry_attrs(longname, attrs, name);
+    sfree(longname);
+}
+
+static int sftp_cmd_mstat(struct sftp_command *cmd)
+{
+    char *cdir;
+    const char *slash;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    int next = 2, outstanding = 0, ret = 1;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords < 3) {
+        fzprintf(sftpError, "mstat: expects a directory and at least one filename as arguments");
+        return 0;
+    }
+
+    /* Only canonify the directory, that's a round trip of its own */
+    cdir = canonify(cmd->words[1], false);
+    if (!cdir) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[1], fxp_error());
+        return 0;
+    }
+    slash = (*cdir && cdir[strlen(cdir) - 1] == '/') ? "" : "/";
+
+    while (next < cmd->nwords || outstanding) {
+        struct fxp_attrs attrs = {0};
+        int index;
+
+        while (next < cmd->nwords && outstanding < MSTAT_WINDOW) {
+            char *fullname = dupcat(cdir, slash, cmd->words[next]);
+            sftp_register(req = fxp_stat_send(fullname));
+            /* Word index, offset by one so it's never NULL */
+            fxp_set_userdata(req, (void *)(intptr_t)(next + 1));
+            sfree(fullname);
+            ++next;
+            ++outstanding;
+        }
+
+        pktin = sftp_recv();
+        if (!pktin) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet from server");
+        }
+        req = sftp_find_request(pktin);
+        if (!req || !fxp_get_userdata(req)) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
+        index = (int)(intptr_t)fxp_get_userdata(req) - 1;
+        --outstanding;
+
+        if (fxp_stat_recv(pktin, req, &attrs))
+            mstat_print_entry(cmd->words[index], &attrs);
+        else if (fxp_error_type() != SSH_FX_NO_SUCH_FILE) {
+            fzprintf(sftpError, "stat %s: %s", cmd->words[index], fxp_error());
+            ret = 0;
+        }
+    }
+
+    sfree(cdir);
+
+    return ret;
+}
+
+/*
+ * FZ: Change the permissions of many files in one directory at once,
+ * given as pairs of numeric mode and filename. As with mstat, up to
+ * MCHMOD_WINDOW setstat requests are kept outstanding. Unlike chmod,
+ * the old permissions aren't fetched first, numeric modes don't need
+ * them.
+ */
+#define MCHMOD_WINDOW 64
+
+static int sftp_cmd_mchmod(struct sftp_command *cmd)
+{
+    char *cdir;
+    const char *slash;
+    struct sftp_packet *pktin;
+    struct sftp_request *req;
+    int next = 2, outstanding = 0, ret = 1;
+
+    if (!backend) {
+        not_connected();
+        return 0;
+    }
+
+    if (cmd->nwords < 4 || cmd->nwords % 2) {
+        fzprintf(sftpError, "mchmod: expects a directory and at least one pair of mode and filename as arguments");
+        return 0;
+    }
+
+    for (next = 2; next < cmd->nwords; next += 2) {
+        const char *mode = cmd->words[next];
+        if (!*mode || mode[strspn(mode, "01234567")]) {
+            fzprintf(sftpError, "mchmod: file modes should contain digits 0-7 only");
+            return 0;
+        }
+    }
+
+    cdir = canonify(cmd->words[1], false);
+    if (!cdir) {
+        fzprintf(sftpError, "%s: canonify: %s", cmd->words[1], fxp_error());
+        return 0;
+    }
+    slash = (*cdir && cdir[strlen(cdir) - 1] == '/') ? "" : "/";
+
+    next = 2;
+    while (next < cmd->nwords || outstanding) {
+        int index;
+
+        while (next < cmd->nwords && outstanding < MCHMOD_WINDOW) {
+            struct fxp_attrs attrs = {0};
+            unsigned mode = 0;
+            char *fullname = dupcat(cdir, slash, cmd->words[next + 1]);
+
+            sscanf(cmd->words[next], "%o", &mode);
+            attrs.flags = SSH_FILEXFER_ATTR_PERMISSIONS;
+            attrs.permissions = mode & 07777;
+
+            sftp_register(req = fxp_setstat_send(fullname, attrs));
+            /* Word index of the filename, never NULL */
+            fxp_set_userdata(req, (void *)(intptr_t)(next + 1));
+            sfree(fullname);
+            next += 2;
+            ++outstanding;
+        }
+
+        pktin = sftp_recv();
+        if (!pktin) {
+            seat_connection_fatal(
+                psftp_seat, "did not receive SFTP response packet from server");
+        }
+        req = sftp_find_request(pktin);
+        if (!req || !fxp_get_userdata(req)) {
+            seat_connection_fatal(
+                psftp_seat,
+                "unable to understand SFTP response packet from server: %s",
+                fxp_error());
+        }
+        index = (int)(intptr_t)fxp_get_userdata(req);
+        --outstanding;
+
+        if (!fxp_setstat_recv(pktin, req)) {
+            fzprintf(sftpError, "set attrs for %s: %s", cmd->words[index], fxp_error());
+            ret = 0;
+        }
+    }
+
+    sfree(cdir);
+
+    return ret;
+}
+
 static int sftp_cmd_open(struct sftp_command *cmd)
 {
     int portnumber;
@@ -1452,6 +2633,9 @@ static struct sftp_cmd_lookup {
     {
         "cd", sftp_cmd_cd
     },
+    {
+        "checkfile", sftp_cmd_checkfile
+    },
     {
         "chmod", sftp_cmd_chmod
     },
@@ -1461,6 +2645,9 @@ static struct sftp_cmd_lookup {
     {
         "close", sftp_cmd_close
     },
+    {
+        "copy", sftp_cmd_copy
+    },
     {
         "del", sftp_cmd_rm
     },
@@ -1473,16 +2660,31 @@ static struct sftp_cmd_lookup {
     {
         "get", sftp_cmd_get
     },
+    {
+        "getrange", sftp_cmd_getrange
+    },
     {
         "keyfile", sftp_cmd_keyfile
     },
+    {
+        "linger", sftp_cmd_linger
+    },
 
     {
         "ls", sftp_cmd_ls
     },
+    {
+        "mchmod", sftp_cmd_mchmod
+    },
     {
         "mkdir", sftp_cmd_mkdir
     },
+    {
+        "mput", sftp_cmd_mput
+    },
+    {
+        "mstat", sftp_cmd_mstat
+    },
     {
         "mtime", sftp_cmd_mtime
     },
@@ -1515,6 +2717,9 @@ static struct sftp_cmd_lookup {
     },
     {
         "rmdir", sftp_cmd_rmdir
+    },
+    {
+        "tput", sftp_cmd_tput
     }
 };
 
@@ -1757,6 +2962,15 @@ void agent_schedule_callback(void (*callback)(void *, void *, int),
  */
 static bufchain received_data;
 static BinarySink *stderr_bs;
+
+/*
+ * FZ: While sftp_recvdata is waiting with nothing buffered, incoming
+ * data is copied straight to its destination, usually the buffer of
+ * an SFTP packet, rather than going through received_data first.
+ */
+static char *recv_target;
+static size_t recv_target_len;
+
 static size_t psftp_output(
     Seat *seat, bool is_stderr, const void *data, size_t len)
 {
@@ -1769,6 +2983,15 @@ static size_t psftp_output(
         return 0;
     }
 
+    if (recv_target_len) {
+        size_t n = len < recv_target_len ? len : recv_target_len;
+        memcpy(recv_target, data, n);
+        recv_target += n;
+        recv_target_len -= n;
+        data = (const char *)data + n;
+        len -= n;
+    }
+
     bufchain_add(&received_data, data, len);
     return 0;
 }
@@ -1789,16 +3012,19 @@ static bool psftp_eof(Seat *seat)
 
 bool sftp_recvdata(char *buf, size_t len)
 {
-    while (len > 0) {
-        while (bufchain_size(&received_data) == 0) {
-            if (backend_exitcode(backend) >= 0 ||
-                ssh_sftp_loop_iteration() < 0)
-                return false;          /* doom */
+    size_t got = bufchain_fetch_consume_up_to(&received_data, buf, len);
+    if (got == len)
+        return true;
+
+    /* received_data is empty now, so the order of the data is kept */
+    recv_target = buf + got;
+    recv_target_len = len - got;
+    while (recv_target_len > 0) {
+        if (backend_exitcode(backend) >= 0 ||
+            ssh_sftp_loop_iteration() < 0) {
+            recv_target_len = 0;
+            return false;              /* doom */
         }
-
-        size_t got = bufchain_fetch_consume_up_to(&received_data, buf, len);
-        buf += got;
-        len -= got;
     }
 
     return true;
@@ -2122,8 +3348,10 @@ int psftp_init_utf8_locale()
 }
 #endif
 
-const bool share_can_be_downstream = false; // FZ: We're standalone
-const bool share_can_be_upstream = false;
+// FZ: Only used if sharing is enabled through -share. Any fzsftp instance
+// can become the upstream for the other engines connected to the same site.
+const bool share_can_be_downstream = true;
+const bool share_can_be_upstream = true;
 
 static stdio_sink stderr_ss;
 static StripCtrlChars *stderr_scc;
@@ -2217,6 +3445,22 @@ int psftp_main(int argc, char *argv[])
         } else if (strcmp(argv[i], "-V") == 0 ||
                    strcmp(argv[i], "--version") == 0) {
             version();
+        } else if (strcmp(argv[i], "--framed") == 0) {
+            framed_output = true;
+        } else if (strcmp(argv[i], "--window") == 0 && i + 1 < argc) {
+            /* FZ: Maximum download request window in MiB */
+            int window = atoi(argv[++i]);
+            if (window >= 4 && window <= 1024)
+                sftp_max_window = window * 1048576;
+        } else if (strcmp(argv[i], "--list-window") == 0 && i + 1 < argc) {
+            /* FZ: Maximum number of outstanding READDIR requests */
+            int window = atoi(argv[++i]);
+            if (window >= LS_INITIAL_WINDOW && window <= 256)
+                sftp_max_list_window = window;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            /* FZ: Falls back to quota through stdio if this fails */
+            if (!fz_shared_block_attach(argv[++i]))
+                fzprintf(sftpVerbose, "Could not attach to shared memory block");
         } else if (strcmp(argv[i], "--") == 0) {
             i++;
             break;
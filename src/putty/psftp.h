@@ -32,6 +32,12 @@ void get_file_times(char *filename, unsigned long *mtime,
  */
 int ssh_sftp_loop_iteration(void);
 
+/*
+ * FZ: Points standard output at the null device, so the engine reading
+ * it sees its end while this process itself carries on.
+ */
+void platform_detach_stdout(void);
+
 /*
  * Read a command line for PSFTP from standard input. Caller must
  * free.
@@ -95,6 +101,9 @@ RFile *open_existing_file(const char *name, uint64_t *size,
                           unsigned long *mtime, unsigned long *atime,
                           long *perms);
 WFile *open_existing_wfile(const char *name, uint64_t *size);
+/* Opens an existing file for writing at arbitrary offsets, sharing it
+ * with other writers of different ranges of the same file. */
+WFile *open_segment_wfile(const char *name);
 /* Returns <0 on error, 0 on eof, or number of bytes read, as usual */
 int read_from_file(RFile *f, void *buffer, int length);
 /* Closes and frees the RFile */
@@ -8,13 +8,11 @@
 #include <assert.h>
 #include <limits.h>
 
+#include "putty.h"
 #include "misc.h"
 #include "tree234.h"
 #include "sftp.h"
 
-#include "fzprintf.h"
-#include "fzsftp.h"
-
 static char *fxp_error_message = NULL;
 static int fxp_errtype;
 
@@ -268,6 +266,21 @@ int fxp_error_type(void)
     return fxp_errtype;
 }
 
+/*
+ * FZ: Names of the extensions the server advertised in FXP_VERSION.
+ */
+static char **fxp_extensions;
+static size_t fxp_nextensions, fxp_extensions_size;
+
+bool fxp_has_extension(const char *name)
+{
+    size_t i;
+    for (i = 0; i < fxp_nextensions; i++)
+        if (!strcmp(fxp_extensions[i], name))
+            return true;
+    return false;
+}
+
 /*
  * Perform exchange of init/version packets. Return 0 on failure.
  */
@@ -303,11 +316,19 @@ bool fxp_init(void)
         return false;
     }
     /*
-     * In principle, this packet might also contain extension-
-     * string pairs. We should work through them and look for any
-     * we recognise. In practice we don't currently do so because
-     * we know we don't recognise _any_.
+     * FZ: Remember the names of the advertised extension-string
+     * pairs, the data part is not needed by any we use.
      */
+    while (fxp_nextensions)
+        sfree(fxp_extensions[--fxp_nextensions]);
+    while (get_avail(pktin)) {
+        ptrlen name = get_string(pktin);
+        get_string(pktin);
+        if (get_err(pktin))
+            break;
+        sgrowarray(fxp_extensions, fxp_extensions_size, fxp_nextensions);
+        fxp_extensions[fxp_nextensions++] = mkstr(name);
+    }
     sftp_pkt_free(pktin);
 
     return true;
@@ -627,6 +648,112 @@ bool fxp_fstat_recv(struct sftp_packet *pktin, struct sftp_request *req,
     }
 }
 
+struct sftp_request *fxp_checkfile_send(const char *fname,
+                                        const char *algorithms)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "check-file-name");
+    put_stringz(pktout, fname);
+    put_stringz(pktout, algorithms);
+    put_uint64(pktout, 0); /* start offset */
+    put_uint64(pktout, 0); /* length, 0 for the whole file */
+    put_uint32(pktout, 0); /* block size, 0 for a single hash */
+    sftp_send(pktout);
+
+    return req;
+}
+
+struct sftp_request *fxp_checkfile_handle_send(struct fxp_handle *handle,
+                                               const char *algorithms)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "check-file-handle");
+    put_string(pktout, handle->hstring, handle->hlen);
+    put_stringz(pktout, algorithms);
+    put_uint64(pktout, 0);
+    put_uint64(pktout, 0);
+    put_uint32(pktout, 0);
+    sftp_send(pktout);
+
+    return req;
+}
+
+bool fxp_checkfile_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                        char **algorithm, unsigned char **hash,
+                        size_t *hashlen)
+{
+    ptrlen name, data;
+
+    sfree(req);
+    if (pktin->type != SSH_FXP_EXTENDED_REPLY) {
+        fxp_got_status(pktin);
+        sftp_pkt_free(pktin);
+        return false;
+    }
+
+    /*
+     * Older drafts of the extension prefix the reply with the name
+     * "check-file".
+     */
+    name = get_string(pktin);
+    if (ptrlen_eq_string(name, "check-file"))
+        name = get_string(pktin);
+    data = get_data(pktin, get_avail(pktin));
+    if (get_err(pktin) || !name.len || !data.len) {
+        fxp_internal_error("malformed check-file reply");
+        sftp_pkt_free(pktin);
+        return false;
+    }
+
+    *algorithm = mkstr(name);
+    *hashlen = data.len;
+    *hash = snewn(data.len, unsigned char);
+    memcpy(*hash, data.ptr, data.len);
+    sftp_pkt_free(pktin);
+    return true;
+}
+
+/*
+ * FZ: Server-side copy through the "copy-data" extension.
+ */
+struct sftp_request *fxp_copydata_send(struct fxp_handle *readhandle,
+                                       uint64_t readoffset, uint64_t length,
+                                       struct fxp_handle *writehandle,
+                                       uint64_t writeoffset)
+{
+    struct sftp_request *req = sftp_alloc_request();
+    struct sftp_packet *pktout;
+
+    pktout = sftp_pkt_init(SSH_FXP_EXTENDED);
+    put_uint32(pktout, req->id);
+    put_stringz(pktout, "copy-data");
+    put_string(pktout, readhandle->hstring, readhandle->hlen);
+    put_uint64(pktout, readoffset);
+    put_uint64(pktout, length);
+    put_string(pktout, writehandle->hstring, writehandle->hlen);
+    put_uint64(pktout, writeoffset);
+    sftp_send(pktout);
+
+    return req;
+}
+
+bool fxp_copydata_recv(struct sftp_packet *pktin, struct sftp_request *req)
+{
+    int id;
+    sfree(req);
+    id = fxp_got_status(pktin);
+    sftp_pkt_free(pktin);
+    return id == 1;
+}
+
 /*
  * Set the attributes of a file.
  */
@@ -702,27 +829,35 @@ struct sftp_request *fxp_read_send(struct fxp_handle *handle,
 
 int fxp_read_recv(struct sftp_packet *pktin, struct sftp_request *req,
                   char *buffer, int len)
+{
+    ptrlen data;
+    int ret = fxp_read_recv_inplace(pktin, req, &data, len);
+    if (ret >= 0) {
+        memcpy(buffer, data.ptr, data.len);
+        sftp_pkt_free(pktin);
+    }
+    return ret;
+}
+
+int fxp_read_recv_inplace(struct sftp_packet *pktin, struct sftp_request *req,
+                          ptrlen *data, int len)
 {
     sfree(req);
     if (pktin->type == SSH_FXP_DATA) {
-        ptrlen data;
-
-        data = get_string(pktin);
+        *data = get_string(pktin);
         if (get_err(pktin)) {
             fxp_internal_error("READ returned malformed SSH_FXP_DATA packet");
             sftp_pkt_free(pktin);
             return -1;
         }
 
-        if (data.len > len) {
+        if (data->len > len) {
             fxp_internal_error("READ returned more bytes than requested");
             sftp_pkt_free(pktin);
             return -1;
         }
 
-        memcpy(buffer, data.ptr, data.len);
-        sftp_pkt_free(pktin);
-        return data.len;
+        return data->len;
     } else {
         fxp_got_status(pktin);
         sftp_pkt_free(pktin);
@@ -894,20 +1029,41 @@ void fxp_set_userdata(struct sftp_request *req, void *data)
  */
 
 struct req {
-    char *buffer;
+    /* FZ: Received data is used in place in its packet */
+    struct sftp_packet *pkt;
+    const void *data;
     int len, retlen, complete;
     uint64_t offset;
+    unsigned long sent;
     struct req *next, *prev;
 };
 
+/*
+ * FZ: The window of outstanding read requests starts at
+ * XFER_INITIAL_WINDOW and adapts to twice the measured bandwidth-delay
+ * product, capped at sftp_max_window.
+ */
+#define XFER_INITIAL_WINDOW (1048576*4)
+int sftp_max_window = 1048576*64;
+
 struct fxp_xfer {
     uint64_t offset, furthestdata, filesize;
+    /* FZ: Downloads stop requesting data at this offset */
+    uint64_t endoffset;
     int req_totalsize, req_maxsize;
     bool eof, err;
     struct fxp_handle *fh;
     struct req *head, *tail;
+    /* FZ: Packet of the data last returned by xfer_download_data */
+    struct sftp_packet *handed_out;
     _fztimer send_timer;
     int sent_interval;
+
+    /* Lowest observed request round trip time in ms, 0 if unknown */
+    unsigned long min_rtt;
+    /* Data received since the start of the current measurement interval */
+    uint64_t interval_bytes;
+    unsigned long interval_start;
 };
 
 static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
@@ -917,17 +1073,60 @@ static struct fxp_xfer *xfer_init(struct fxp_handle *fh, uint64_t offset)
     xfer->fh = fh;
     xfer->offset = offset;
     xfer->head = xfer->tail = NULL;
+    xfer->handed_out = NULL;
     xfer->req_totalsize = 0;
-    xfer->req_maxsize = 1048576*4;
+    xfer->req_maxsize = XFER_INITIAL_WINDOW;
+    if (xfer->req_maxsize > sftp_max_window)
+        xfer->req_maxsize = sftp_max_window;
     xfer->err = false;
     xfer->filesize = UINT64_MAX;
+    xfer->endoffset = UINT64_MAX;
     xfer->furthestdata = 0;
     fz_timer_init(&xfer->send_timer);
     xfer->sent_interval = 0;
+    xfer->min_rtt = 0;
+    xfer->interval_bytes = 0;
+    xfer->interval_start = GETTICKCOUNT();
 
     return xfer;
 }
 
+/*
+ * FZ: Update the window from a completed read request. The minimum
+ * round trip time approximates the path latency, as later requests
+ * also wait for the ones queued before them.
+ */
+static void xfer_update_window(struct fxp_xfer *xfer, struct req *rr)
+{
+    unsigned long now = GETTICKCOUNT();
+    unsigned long rtt = now - rr->sent;
+    unsigned long elapsed;
+    uint64_t target;
+
+    if (!rtt)
+        rtt = 1;
+    if (!xfer->min_rtt || rtt < xfer->min_rtt)
+        xfer->min_rtt = rtt;
+
+    if (rr->retlen > 0)
+        xfer->interval_bytes += rr->retlen;
+
+    /* Measure over at least a few round trips to smooth out bursts */
+    elapsed = now - xfer->interval_start;
+    if (elapsed < 100 || elapsed < xfer->min_rtt * 4)
+        return;
+
+    target = xfer->interval_bytes * xfer->min_rtt / elapsed * 2;
+    if (target < XFER_INITIAL_WINDOW)
+        target = XFER_INITIAL_WINDOW;
+    if (target > (uint64_t)sftp_max_window)
+        target = sftp_max_window;
+    xfer->req_maxsize = (int)target;
+
+    xfer->interval_bytes = 0;
+    xfer->interval_start = now;
+}
+
 bool xfer_done(struct fxp_xfer *xfer)
 {
     /*
@@ -961,12 +1160,18 @@ void xfer_download_queue(struct fxp_xfer *xfer)
         rr->next = NULL;
 
         rr->len = 32768;
-        rr->buffer = snewn(rr->len, char);
+        if (xfer->endoffset - xfer->offset < (uint64_t)rr->len)
+            rr->len = (int)(xfer->endoffset - xfer->offset);
+        rr->pkt = NULL;
+        rr->data = NULL;
+        rr->sent = GETTICKCOUNT();
         sftp_register(req = fxp_read_send(xfer->fh, rr->offset, rr->len));
         fxp_set_userdata(req, rr);
 
         xfer->offset += rr->len;
         xfer->req_totalsize += rr->len;
+        if (xfer->offset >= xfer->endoffset)
+            xfer->eof = true;
 
 #ifdef DEBUG_DOWNLOAD
         printf("queueing read request %p at %"PRIu64"\n", rr, rr->offset);
@@ -975,10 +1180,20 @@ void xfer_download_queue(struct fxp_xfer *xfer)
 }
 
 struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset)
+{
+    return xfer_download_init_range(fh, offset, UINT64_MAX);
+}
+
+/*
+ * FZ: Like xfer_download_init, but only requests the data before
+ * endoffset. Used to download a single segment of a file.
+ */
+struct fxp_xfer *xfer_download_init_range(struct fxp_handle *fh, uint64_t offset, uint64_t endoffset)
 {
     struct fxp_xfer *xfer = xfer_init(fh, offset);
 
-    xfer->eof = false;
+    xfer->endoffset = endoffset;
+    xfer->eof = offset >= endoffset;
     xfer_download_queue(xfer);
 
     return xfer;
@@ -992,6 +1207,7 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 {
     struct sftp_request *rreq;
     struct req *rr;
+    ptrlen data;
 
     rreq = sftp_find_request(pktin);
     if (!rreq)
@@ -1001,7 +1217,11 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
         fxp_internal_error("request ID is not part of the current download");
         return INT_MIN;                /* this packet isn't ours */
     }
-    rr->retlen = fxp_read_recv(pktin, rreq, rr->buffer, rr->len);
+    rr->retlen = fxp_read_recv_inplace(pktin, rreq, &data, rr->len);
+    if (rr->retlen >= 0) {
+        rr->pkt = pktin;
+        rr->data = data.ptr;
+    }
 #ifdef DEBUG_DOWNLOAD
     printf("read request %p has returned [%d]\n", rr, rr->retlen);
 #endif
@@ -1021,6 +1241,7 @@ int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
     }
 
     rr->complete = 1;
+    xfer_update_window(xfer, rr);
 
     /*
      * Special case: if we have received fewer bytes than we
@@ -1072,19 +1293,28 @@ void xfer_set_error(struct fxp_xfer *xfer)
 
 bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
 {
-    void *retbuf = NULL;
+    const void *retbuf = NULL;
     int retlen = 0;
+    bool found = false;
+
+    if (xfer->handed_out) {
+        sftp_pkt_free(xfer->handed_out);
+        xfer->handed_out = NULL;
+    }
 
     /*
      * Discard anything at the head of the rr queue with complete <
      * 0; return the first thing with complete > 0.
      */
-    while (xfer->head && xfer->head->complete && !retbuf) {
+    while (xfer->head && xfer->head->complete && !found) {
         struct req *rr = xfer->head;
 
         if (rr->complete > 0) {
-            retbuf = rr->buffer;
+            found = true;
+            retbuf = rr->data;
             retlen = rr->retlen;
+            xfer->handed_out = rr->pkt;
+            rr->pkt = NULL;
 #ifdef DEBUG_DOWNLOAD
             printf("handing back data from read request %p\n", rr);
 #endif
@@ -1100,11 +1330,13 @@ bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len)
         else
             xfer->tail = NULL;
         xfer->req_totalsize -= rr->len;
+        if (rr->pkt)
+            sftp_pkt_free(rr->pkt);
         sfree(rr);
     }
 
-    if (retbuf) {
-        *buf = retbuf;
+    if (found) {
+        *buf = (void *)retbuf;
         *len = retlen;
         return true;
     } else
@@ -1152,7 +1384,8 @@ void xfer_upload_data(struct fxp_xfer *xfer, char *buffer, int len)
     rr->next = NULL;
 
     rr->len = len;
-    rr->buffer = NULL;
+    rr->pkt = NULL;
+    rr->data = NULL;
     sftp_register(req = fxp_write_send(xfer->fh, buffer, rr->offset, len));
     fxp_set_userdata(req, rr);
 
@@ -1203,9 +1436,9 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
         xfer->tail = prev;
     xfer->req_totalsize -= rr->len;
     xfer->sent_interval += rr->len;
-    if (fz_timer_check(&xfer->send_timer)) {
+    if (fz_shared_block_attached() || fz_timer_check(&xfer->send_timer)) {
 	/* The data we sent is the data we earlier read from file */
-        fzprintf(sftpTransfer, "%d", xfer->sent_interval);
+        fz_report_transfer(xfer->sent_interval);
         xfer->sent_interval = 0;
     }
     sfree(rr);
@@ -1219,15 +1452,18 @@ int xfer_upload_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin)
 void xfer_cleanup(struct fxp_xfer *xfer)
 {
     if (xfer->sent_interval > 0) {
-        fzprintf(sftpTransfer, "%d", xfer->sent_interval);
+        fz_report_transfer(xfer->sent_interval);
     }
 
     struct req *rr;
     while (xfer->head) {
         rr = xfer->head;
         xfer->head = xfer->head->next;
-        sfree(rr->buffer);
+        if (rr->pkt)
+            sftp_pkt_free(rr->pkt);
         sfree(rr);
     }
+    if (xfer->handed_out)
+        sftp_pkt_free(xfer->handed_out);
     sfree(xfer);
 }
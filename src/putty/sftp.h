@@ -168,6 +168,12 @@ int fxp_error_type(void);
  */
 bool fxp_init(void);
 
+/*
+ * FZ: Whether the server advertised the named extension in its
+ * FXP_VERSION packet.
+ */
+bool fxp_has_extension(const char *name);
+
 /*
  * Canonify a pathname. Concatenate the two given path elements
  * with a separating slash, unless the second is NULL.
@@ -233,6 +239,34 @@ struct sftp_request *fxp_fstat_send(struct fxp_handle *handle);
 bool fxp_fstat_recv(struct sftp_packet *pktin, struct sftp_request *req,
                     struct fxp_attrs *attrs);
 
+/*
+ * FZ: Ask the server for the checksum of a whole file through the
+ * "check-file-name" extension. algorithms is a comma separated list in
+ * order of preference. On success, the used algorithm and the raw hash
+ * are returned, both to be freed by the caller.
+ */
+struct sftp_request *fxp_checkfile_send(const char *fname,
+                                        const char *algorithms);
+bool fxp_checkfile_recv(struct sftp_packet *pktin, struct sftp_request *req,
+                        char **algorithm, unsigned char **hash,
+                        size_t *hashlen);
+/*
+ * FZ: Same through "check-file-handle", for servers that only implement
+ * that variant. The reply is read with fxp_checkfile_recv.
+ */
+struct sftp_request *fxp_checkfile_handle_send(struct fxp_handle *handle,
+                                               const char *algorithms);
+
+/*
+ * FZ: Let the server copy length bytes, 0 meaning up to EOF, from one
+ * open file to another through the "copy-data" extension.
+ */
+struct sftp_request *fxp_copydata_send(struct fxp_handle *readhandle,
+                                       uint64_t readoffset, uint64_t length,
+                                       struct fxp_handle *writehandle,
+                                       uint64_t writeoffset);
+bool fxp_copydata_recv(struct sftp_packet *pktin, struct sftp_request *req);
+
 /*
  * Set file attributes.
  */
@@ -250,6 +284,10 @@ struct sftp_request *fxp_read_send(struct fxp_handle *handle,
                                    uint64_t offset, int len);
 int fxp_read_recv(struct sftp_packet *pktin, struct sftp_request *req,
                   char *buffer, int len);
+/* FZ: Like fxp_read_recv, but leaves the data in pktin. If the return
+ * value is not negative, the caller keeps pktin and data points into it. */
+int fxp_read_recv_inplace(struct sftp_packet *pktin, struct sftp_request *req,
+                          ptrlen *data, int len);
 
 /*
  * Write to a file.
@@ -298,9 +336,15 @@ struct sftp_packet *sftp_recv(void);
 
 struct fxp_xfer;
 
+/* FZ: Upper limit in bytes for the outstanding read requests of a download */
+extern int sftp_max_window;
+
 struct fxp_xfer *xfer_download_init(struct fxp_handle *fh, uint64_t offset);
+struct fxp_xfer *xfer_download_init_range(struct fxp_handle *fh, uint64_t offset, uint64_t endoffset);
 void xfer_download_queue(struct fxp_xfer *xfer);
 int xfer_download_gotpkt(struct fxp_xfer *xfer, struct sftp_packet *pktin);
+/* FZ: The returned data stays valid until the next call of
+ * xfer_download_data or xfer_cleanup, it must not be freed. */
 bool xfer_download_data(struct fxp_xfer *xfer, void **buf, int *len);
 
 struct fxp_xfer *xfer_upload_init(struct fxp_handle *fh, uint64_t offset);
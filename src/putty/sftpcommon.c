@@ -102,10 +102,28 @@ bool BinarySource_get_fxp_attrs(BinarySource *src, struct fxp_attrs *attrs)
     return true;
 }
 
+/*
+ * FZ: Received packets get their data buffer from a small pool of
+ * buffers sized for the SSH_FXP_DATA reply to a full 32k read, which
+ * is what nearly all packets of a download are. Downloads keep the
+ * data in the packet until it has been written to the file, so
+ * without the pool every read would cost a large allocation.
+ */
+#define SFTP_PKT_POOL_BUFLEN (32768 + 256)
+#define SFTP_PKT_POOL_MAX 16
+
+static char *sftp_pkt_pool[SFTP_PKT_POOL_MAX];
+static size_t sftp_pkt_pool_count;
+
 void sftp_pkt_free(struct sftp_packet *pkt)
 {
-    if (pkt->data)
-        sfree(pkt->data);
+    if (pkt->data) {
+        if (pkt->maxlen == SFTP_PKT_POOL_BUFLEN &&
+            sftp_pkt_pool_count < SFTP_PKT_POOL_MAX)
+            sftp_pkt_pool[sftp_pkt_pool_count++] = pkt->data;
+        else
+            sfree(pkt->data);
+    }
     sfree(pkt);
 }
 
@@ -125,8 +143,17 @@ struct sftp_packet *sftp_recv_prepare(unsigned length)
 
     pkt = snew(struct sftp_packet);
     pkt->savedpos = 0;
-    pkt->length = pkt->maxlen = length;
-    pkt->data = snewn(pkt->length, char);
+    pkt->length = length;
+    if (length <= SFTP_PKT_POOL_BUFLEN) {
+        pkt->maxlen = SFTP_PKT_POOL_BUFLEN;
+        if (sftp_pkt_pool_count)
+            pkt->data = sftp_pkt_pool[--sftp_pkt_pool_count];
+        else
+            pkt->data = snewn(pkt->maxlen, char);
+    } else {
+        pkt->maxlen = length;
+        pkt->data = snewn(pkt->length, char);
+    }
 
     return pkt;
 }
@@ -750,6 +750,8 @@ static const char *connect_to_host(
         ssh->fullhostname = NULL;
         *realhost = dupstr(host);      /* best we can do */
 
+        fzprintf(sftpStatus, "Reusing a shared connection to this server");
+
         if ((flags & FLAG_VERBOSE) || (flags & FLAG_INTERACTIVE)) {
             /* In an interactive session, or in verbose mode, announce
              * in the console window that we're a sharing downstream,
@@ -1212,3 +1214,9 @@ size_t ssh_pending_receive(Backend *be)
     int r = recv_peek(ssh->s, tmp, 64);
     return r > 0 ? r : 0;
 }
+
+ConnectionLayer *ssh_get_connection_layer(Backend *be)
+{
+    Ssh *ssh = container_of(be, Ssh, backend);
+    return ssh ? ssh->cl : NULL;
+}
@@ -60,6 +60,7 @@ typedef struct PktIn {
     int type;
     unsigned long sequence; /* SSH-2 incoming sequence number */
     PacketQueueNode qnode;  /* for linking this packet on to a queue */
+    bool from_slab;         /* block goes back to the slab when freed */
     BinarySource_IMPLEMENTATION;
 } PktIn;
 
@@ -164,6 +165,11 @@ int ssh2_censor_packet(
 PktOut *ssh_new_packet(void);
 void ssh_free_pktout(PktOut *pkt);
 
+/* Allocates an incoming packet with datalen bytes of storage
+ * following the structure, to be found with snew_plus_get_aux */
+PktIn *ssh_new_pktin(size_t datalen);
+void ssh_free_pktin(PktIn *pktin);
+
 Socket *ssh_connection_sharing_init(
     const char *host, int port, Conf *conf, LogContext *logctx,
     Plug *sshplug, ssh_sharing_state **state);
@@ -628,6 +634,8 @@ struct ssh_cipheralg {
     unsigned int flags;
 #define SSH_CIPHER_IS_CBC       1
 #define SSH_CIPHER_SEPARATE_LENGTH      2
+/* FZ: Counter mode, the IV is a big-endian block counter */
+#define SSH_CIPHER_IS_SDCTR     4
     const char *text_name;
     /* If set, this takes priority over other MAC. */
     const ssh2_macalg *required_mac;
@@ -930,7 +938,11 @@ extern const ssh_hashalg ssh_sha256;
 extern const ssh_hashalg ssh_sha256_hw;
 extern const ssh_hashalg ssh_sha256_sw;
 extern const ssh_hashalg ssh_sha384;
+extern const ssh_hashalg ssh_sha384_hw;
+extern const ssh_hashalg ssh_sha384_sw;
 extern const ssh_hashalg ssh_sha512;
+extern const ssh_hashalg ssh_sha512_hw;
+extern const ssh_hashalg ssh_sha512_sw;
 extern const ssh_kexes ssh_diffiehellman_group1;
 extern const ssh_kexes ssh_diffiehellman_group14;
 extern const ssh_kexes ssh_diffiehellman_gex;
@@ -964,8 +976,28 @@ extern const ssh_compression_alg ssh_zlib;
  */
 bool platform_aes_hw_available(void);
 bool platform_sha256_hw_available(void);
+bool platform_sha512_hw_available(void);
 bool platform_sha1_hw_available(void);
 
+/*
+ * FZ: Pool of worker threads, implemented per platform. ssh2bpp uses
+ * it to verify and decrypt runs of incoming packets on several cores.
+ *
+ * parallel_pool_new returns NULL if there is no point in a pool, e.g.
+ * on a single core machine. max_lanes includes the calling thread.
+ * parallel_pool_run calls fn for every i < n, spread over the worker
+ * threads and the calling thread, and returns once all calls have
+ * returned. lane identifies the thread making the call and is less
+ * than parallel_pool_lanes(), so fn can keep per-lane state.
+ */
+typedef struct ParallelPool ParallelPool;
+typedef void (*parallel_fn_t)(void *ctx, unsigned lane, size_t i);
+ParallelPool *parallel_pool_new(unsigned max_lanes);
+unsigned parallel_pool_lanes(ParallelPool *pool);
+void parallel_pool_run(ParallelPool *pool, parallel_fn_t fn, void *ctx,
+                       size_t n);
+void parallel_pool_free(ParallelPool *pool);
+
 /*
  * PuTTY version number formatted as an SSH version string.
  */
@@ -1572,3 +1604,6 @@ bool ssh_transient_hostkey_cache_has(
 bool ssh_transient_hostkey_cache_non_empty(ssh_transient_hostkey_cache *thc);
 
 size_t ssh_pending_receive(Backend *be);
+
+/* FZ: For opening channels besides the main one, NULL until connected */
+ConnectionLayer *ssh_get_connection_layer(Backend *be);
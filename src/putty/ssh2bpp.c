@@ -17,6 +17,46 @@ struct ssh2_bpp_direction {
     const ssh_compression_alg *pending_compression;
 };
 
+/*
+ * FZ: With an SDCTR cipher and an ETM MAC, the length of each incoming
+ * packet is in the clear and the counter value at its start follows
+ * from the lengths of the packets before it. So once a run of whole
+ * packets has been received, they can all be verified and decrypted
+ * independently of each other. That gets done on a worker pool, with
+ * one set of cipher and MAC instances per lane, and the packets are
+ * then handed on in their original order.
+ */
+#define SSH2_BPP_MAX_LANES 4
+#define SSH2_BPP_BATCH_MAX 32
+#define SSH2_BPP_MAX_CTR_BLOCK 16
+
+struct ssh2_bpp_lane {
+    ssh_cipher *cipher;
+    ssh2_mac *mac;
+};
+
+struct ssh2_bpp_batch_packet {
+    PktIn *pktin;
+    long len;
+    unsigned long sequence;
+    unsigned char iv[SSH2_BPP_MAX_CTR_BLOCK];
+    bool mac_ok;
+};
+
+struct ssh2_bpp_parallel {
+    ParallelPool *pool;
+    bool pool_tried;
+
+    /* Set up for each set of incoming keys that qualifies */
+    struct ssh2_bpp_lane *lanes;
+    unsigned nlanes;
+    bool active;
+    unsigned char ctr[SSH2_BPP_MAX_CTR_BLOCK]; /* for the next packet */
+
+    struct ssh2_bpp_batch_packet batch[SSH2_BPP_BATCH_MAX];
+    int count, pos;
+};
+
 struct ssh2_bpp_state {
     int crState;
     long len, pad, payload, packetlen, maclen, length, maxlen;
@@ -29,6 +69,7 @@ struct ssh2_bpp_state {
     bool cbc_ignore_workaround;
 
     struct ssh2_bpp_direction in, out;
+    struct ssh2_bpp_parallel par;
     /* comp and decomp logically belong in the per-direction
      * substructure, except that they have different types */
     ssh_decompressor *in_decomp;
@@ -42,6 +83,7 @@ struct ssh2_bpp_state {
 };
 
 static void ssh2_bpp_free(BinaryPacketProtocol *bpp);
+static void ssh2_bpp_parallel_discard(struct ssh2_bpp_state *s);
 static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp);
 static void ssh2_bpp_handle_output(BinaryPacketProtocol *bpp);
 static PktOut *ssh2_bpp_new_pktout(int type);
@@ -90,6 +132,15 @@ static void ssh2_bpp_free_outgoing_crypto(struct ssh2_bpp_state *s)
 static void ssh2_bpp_free_incoming_crypto(struct ssh2_bpp_state *s)
 {
     /* As above, take care to free in.mac before in.cipher */
+    for (unsigned i = 0; i < s->par.nlanes; i++) {
+        ssh2_mac_free(s->par.lanes[i].mac);
+        ssh_cipher_free(s->par.lanes[i].cipher);
+    }
+    sfree(s->par.lanes);
+    s->par.lanes = NULL;
+    s->par.nlanes = 0;
+    s->par.active = false;
+
     if (s->in.mac)
         ssh2_mac_free(s->in.mac);
     if (s->in.cipher)
@@ -104,7 +155,10 @@ static void ssh2_bpp_free(BinaryPacketProtocol *bpp)
     sfree(s->buf);
     ssh2_bpp_free_outgoing_crypto(s);
     ssh2_bpp_free_incoming_crypto(s);
-    sfree(s->pktin);
+    ssh_free_pktin(s->pktin);
+    ssh2_bpp_parallel_discard(s);
+    if (s->par.pool)
+        parallel_pool_free(s->par.pool);
     sfree(s);
 }
 
@@ -172,6 +226,140 @@ void ssh2_bpp_new_outgoing_crypto(
     }
 }
 
+static void ssh2_bpp_setup_parallel(
+    struct ssh2_bpp_state *s,
+    const ssh_cipheralg *cipher, const void *ckey, const void *iv,
+    const ssh2_macalg *mac, const void *mac_key)
+{
+    BinaryPacketProtocol *bpp = &s->bpp; /* for bpp_logevent */
+
+    if (!(cipher->flags & SSH_CIPHER_IS_SDCTR) ||
+        cipher->blksize > SSH2_BPP_MAX_CTR_BLOCK)
+        return;
+
+    if (!s->par.pool_tried) {
+        s->par.pool = parallel_pool_new(SSH2_BPP_MAX_LANES);
+        s->par.pool_tried = true;
+    }
+    if (!s->par.pool)
+        return;
+
+    s->par.nlanes = parallel_pool_lanes(s->par.pool);
+    s->par.lanes = snewn(s->par.nlanes, struct ssh2_bpp_lane);
+    for (unsigned i = 0; i < s->par.nlanes; i++) {
+        struct ssh2_bpp_lane *lane = &s->par.lanes[i];
+        lane->cipher = ssh_cipher_new(cipher);
+        ssh_cipher_setkey(lane->cipher, ckey);
+        lane->mac = ssh2_mac_new(mac, lane->cipher);
+        ssh2_mac_setkey(lane->mac, make_ptrlen(mac_key, mac->keylen));
+    }
+    memcpy(s->par.ctr, iv, cipher->blksize);
+    s->par.active = true;
+
+    bpp_logevent("Processing inbound packets on %u threads",
+                 s->par.nlanes);
+}
+
+/* Adds n to the big-endian counter ctr of len bytes */
+static void ssh2_bpp_ctr_add(unsigned char *ctr, size_t len, unsigned long n)
+{
+    unsigned long carry = n;
+    for (size_t i = len; i-- > 0 && carry;) {
+        carry += ctr[i];
+        ctr[i] = carry & 0xFF;
+        carry >>= 8;
+    }
+}
+
+/*
+ * Moves as many complete packets as are buffered in in_raw into the
+ * batch, assigning each its sequence number and initial counter.
+ * Returns the number of packets, which is 0 if not even one has
+ * arrived in full yet, or -1 if the first one has a garbled length.
+ * A garbled length further on just ends the batch, so the error is
+ * reported once the packets before it have been handled.
+ */
+static int ssh2_bpp_parallel_fill(struct ssh2_bpp_state *s)
+{
+    struct ssh2_bpp_parallel *par = &s->par;
+
+    par->count = par->pos = 0;
+    while (par->count < SSH2_BPP_BATCH_MAX &&
+           bufchain_size(s->bpp.in_raw) >= 4) {
+        unsigned char lenbuf[4];
+        bufchain_fetch(s->bpp.in_raw, lenbuf, 4);
+        long len = toint(GET_32BIT_MSB_FIRST(lenbuf));
+        if (len < 0 || len > (long)OUR_V2_PACKETLIMIT ||
+            len % s->cipherblk != 0) {
+            if (!par->count)
+                par->count = -1;
+            break;
+        }
+
+        size_t total = 4 + len + s->maclen;
+        if (bufchain_size(s->bpp.in_raw) < total)
+            break;
+
+        struct ssh2_bpp_batch_packet *p = &par->batch[par->count];
+        p->pktin = ssh_new_pktin(total);
+        bufchain_fetch_consume(s->bpp.in_raw,
+                               snew_plus_get_aux(p->pktin), total);
+        p->len = len;
+        p->sequence = s->in.sequence + par->count;
+        memcpy(p->iv, par->ctr, s->cipherblk);
+        ssh2_bpp_ctr_add(par->ctr, s->cipherblk, len / s->cipherblk);
+        par->count++;
+    }
+
+    return par->count;
+}
+
+static void ssh2_bpp_parallel_packet(void *vctx, unsigned lane, size_t i)
+{
+    struct ssh2_bpp_state *s = (struct ssh2_bpp_state *)vctx;
+    struct ssh2_bpp_lane *l = &s->par.lanes[lane];
+    struct ssh2_bpp_batch_packet *p = &s->par.batch[i];
+    unsigned char *data = snew_plus_get_aux(p->pktin);
+
+    /* Same order of checks as the serial ETM code below */
+    p->mac_ok = ssh2_mac_verify(l->mac, data, p->len + 4, p->sequence);
+    if (p->mac_ok) {
+        ssh_cipher_setiv(l->cipher, p->iv);
+        ssh_cipher_decrypt(l->cipher, data + 4, p->len);
+    }
+}
+
+static void ssh2_bpp_parallel_run(struct ssh2_bpp_state *s)
+{
+    if (s->par.count == 1)
+        ssh2_bpp_parallel_packet(s, 0, 0);
+    else
+        parallel_pool_run(s->par.pool, ssh2_bpp_parallel_packet, s,
+                          s->par.count);
+}
+
+/* Drops the rest of the batch, and with it the parallel mode, on error */
+static void ssh2_bpp_parallel_discard(struct ssh2_bpp_state *s)
+{
+    for (int i = s->par.pos; i < s->par.count; i++)
+        ssh_free_pktin(s->par.batch[i].pktin);
+    s->par.count = s->par.pos = 0;
+    s->par.active = false;
+}
+
+/*
+ * Called on receipt of KEXINIT. Packets under the next set of keys
+ * can't arrive before our reply to the KEXINIT has been sent, so the
+ * current batch is still entirely under these keys, but no more
+ * batches are formed: the serial code takes over again, with the
+ * counter where the batches left it, and stops at NEWKEYS as usual.
+ */
+static void ssh2_bpp_parallel_stop(struct ssh2_bpp_state *s)
+{
+    s->par.active = false;
+    ssh_cipher_setiv(s->in.cipher, s->par.ctr);
+}
+
 void ssh2_bpp_new_incoming_crypto(
     BinaryPacketProtocol *bpp,
     const ssh_cipheralg *cipher, const void *ckey, const void *iv,
@@ -211,6 +399,9 @@ void ssh2_bpp_new_incoming_crypto(
         s->in.mac = NULL;
     }
 
+    if (cipher && mac && etm_mode)
+        ssh2_bpp_setup_parallel(s, cipher, ckey, iv, mac, mac_key);
+
     if (delayed_compression && !s->seen_userauth_success) {
         s->in.pending_compression = compression;
         s->in_decomp = NULL;
@@ -296,7 +487,38 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             s->cipherblk = 8;
         s->maclen = s->in.mac ? ssh2_mac_alg(s->in.mac)->len : 0;
 
-        if (s->in.cipher &&
+        if (s->par.active && s->par.pos == s->par.count) {
+            crMaybeWaitUntilV(ssh2_bpp_parallel_fill(s) ||
+                              s->bpp.input_eof);
+            if (s->par.count < 0) {
+                ssh2_bpp_parallel_discard(s);
+                ssh_sw_abort(s->bpp.ssh,
+                             "Incoming packet length field was garbled");
+                crStopV;
+            }
+            if (!s->par.count)
+                goto eof;
+            ssh_check_frozen(s->bpp.ssh);
+
+            ssh2_bpp_parallel_run(s);
+        }
+
+        if (s->par.pos < s->par.count) {
+            struct ssh2_bpp_batch_packet *p = &s->par.batch[s->par.pos++];
+            s->pktin = p->pktin;
+            p->pktin = NULL;
+            s->data = snew_plus_get_aux(s->pktin);
+            s->len = p->len;
+            s->packetlen = s->len + 4;
+            s->maxlen = s->packetlen + s->maclen;
+            assert(p->sequence == s->in.sequence);
+
+            if (!p->mac_ok) {
+                ssh2_bpp_parallel_discard(s);
+                ssh_sw_abort(s->bpp.ssh, "Incorrect MAC received on packet");
+                crStopV;
+            }
+        } else if (s->in.cipher &&
             (ssh_cipher_alg(s->in.cipher)->flags & SSH_CIPHER_IS_CBC) &&
             s->in.mac && !s->in.etm_mode) {
             /*
@@ -363,10 +585,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Now transfer the data into an output packet.
              */
-            s->pktin = snew_plus(PktIn, s->maxlen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(s->maxlen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, s->maxlen);
         } else if (s->in.mac && s->in.etm_mode) {
@@ -413,10 +632,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Allocate the packet to return, now we know its length.
              */
-            s->pktin = snew_plus(PktIn, OUR_V2_PACKETLIMIT + s->maclen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(OUR_V2_PACKETLIMIT + s->maclen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, 4);
 
@@ -478,10 +694,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
              * Allocate the packet to return, now we know its length.
              */
             s->maxlen = s->packetlen + s->maclen;
-            s->pktin = snew_plus(PktIn, s->maxlen);
-            s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
-            s->pktin->type = 0;
-            s->pktin->qnode.on_free_queue = false;
+            s->pktin = ssh_new_pktin(s->maxlen);
             s->data = snew_plus_get_aux(s->pktin);
             memcpy(s->data, s->buf, s->cipherblk);
 
@@ -540,12 +753,13 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
                     PktIn *old_pktin = s->pktin;
 
                     s->maxlen = newlen + 5;
-                    s->pktin = snew_plus(PktIn, s->maxlen);
-                    *s->pktin = *old_pktin; /* structure copy */
+                    s->pktin = ssh_new_pktin(s->maxlen);
+                    s->pktin->sequence = old_pktin->sequence;
                     s->data = snew_plus_get_aux(s->pktin);
 
-                    smemclr(old_pktin, s->packetlen + s->maclen);
-                    sfree(old_pktin);
+                    smemclr(snew_plus_get_aux(old_pktin),
+                            s->packetlen + s->maclen);
+                    ssh_free_pktin(old_pktin);
                 }
                 s->length = 5 + newlen;
                 memcpy(s->data + 5, newpayload, newlen);
@@ -588,7 +802,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
         }
 
         if (ssh2_bpp_check_unimplemented(&s->bpp, s->pktin)) {
-            sfree(s->pktin);
+            ssh_free_pktin(s->pktin);
             s->pktin = NULL;
             continue;
         }
@@ -600,7 +814,20 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             int type = s->pktin->type;
             s->pktin = NULL;
 
+            if (type == SSH2_MSG_KEXINIT && s->par.active)
+                ssh2_bpp_parallel_stop(s);
+
             if (type == SSH2_MSG_NEWKEYS) {
+                if (s->par.pos < s->par.count) {
+                    /* Only possible with a peer that doesn't wait for
+                     * our side of the key exchange, see
+                     * ssh2_bpp_parallel_stop */
+                    ssh2_bpp_parallel_discard(s);
+                    ssh_sw_abort(s->bpp.ssh, "Received packets under new "
+                                 "keys before completing key exchange");
+                    crStopV;
+                }
+
                 /*
                  * Mild layer violation: in this situation we must
                  * suspend processing of the input byte stream until
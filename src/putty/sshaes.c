@@ -140,7 +140,8 @@ struct aes_extra {
                   keylen, "AES-" #keylen " CBC", _encrypt, _decrypt,    \
                   setiv_cbc, SSH_CIPHER_IS_CBC)                         \
     VTABLES_INNER(aes ## keylen ## _sdctr, "aes" #keylen "-ctr",        \
-                  keylen, "AES-" #keylen " SDCTR",,, setiv_sdctr, 0)
+                  keylen, "AES-" #keylen " SDCTR",,, setiv_sdctr,       \
+                  SSH_CIPHER_IS_SDCTR)
 
 VTABLES(128)
 VTABLES(192)
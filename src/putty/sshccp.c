@@ -6,6 +6,7 @@
  *
  * ChaCha20 spec:
  *  http://cr.yp.to/chacha/chacha-20080128.pdf
+ *  (the cipher itself is nettle's; see below)
  *
  * Salsa20 spec:
  *  http://cr.yp.to/snuffle/spec.pdf
@@ -32,153 +33,197 @@
 #include "ssh.h"
 #include "mpint_i.h"
 
+#include <nettle/chacha.h>
+#include <nettle/version.h>
+
 #ifndef INLINE
 #define INLINE
 #endif
 
-/* ChaCha20 implementation, only supporting 256-bit keys */
-
-/* State for each ChaCha20 instance */
-struct chacha20 {
-    /* Current context, usually with the count incremented
-     * 0-3 are the static constant
-     * 4-11 are the key
-     * 12-13 are the counter
-     * 14-15 are the IV */
-    uint32_t state[16];
-    /* The output of the state above ready to xor */
-    unsigned char current[64];
-    /* The index of the above currently used to allow a true streaming cipher */
-    int currentIndex;
-};
+/*
+ * ChaCha20 itself comes from nettle, which we already link against for
+ * AES-GCM. Its chacha_crypt() has SIMD cores (SSE2 on x86, NEON on Arm,
+ * AltiVec on POWER) that process several blocks per call, which is
+ * much faster than a one-block-at-a-time C implementation for the
+ * bulk of an SFTP transfer.
+ *
+ * nettle's ChaCha20 takes a 64-bit nonce and a 64-bit block counter,
+ * exactly as OpenSSH uses it. Calls need not be a multiple of the
+ * block size, but keystream left over at the end of a call is
+ * discarded, so each packet must be processed by a single call (which
+ * is how ssh2bpp.c drives us).
+ */
 
-static INLINE void chacha20_round(struct chacha20 *ctx)
+/* Set the nonce and skip block 0, which is reserved for the Poly1305 key */
+static void chacha20_iv_skip_key_block(struct chacha_ctx *ctx,
+                                       const unsigned char *iv)
 {
-    int i;
-    uint32_t copy[16];
-
-    /* Take a copy */
-    memcpy(copy, ctx->state, sizeof(copy));
-
-    /* A circular rotation for a 32bit number */
-#define rotl(x, shift) x = ((x << shift) | (x >> (32 - shift)))
-
-    /* What to do for each quarter round operation */
-#define qrop(a, b, c, d)                        \
-    copy[a] += copy[b];                         \
-    copy[c] ^= copy[a];                         \
-    rotl(copy[c], d)
-
-    /* A quarter round */
-#define quarter(a, b, c, d)                     \
-    qrop(a, b, d, 16);                          \
-    qrop(c, d, b, 12);                          \
-    qrop(a, b, d, 8);                           \
-    qrop(c, d, b, 7)
-
-    /* Do 20 rounds, in pairs because every other is different */
-    for (i = 0; i < 20; i += 2) {
-        /* A round */
-        quarter(0, 4, 8, 12);
-        quarter(1, 5, 9, 13);
-        quarter(2, 6, 10, 14);
-        quarter(3, 7, 11, 15);
-        /* Another slightly different round */
-        quarter(0, 5, 10, 15);
-        quarter(1, 6, 11, 12);
-        quarter(2, 7, 8, 13);
-        quarter(3, 4, 9, 14);
+    chacha_set_nonce(ctx, iv);
+#if NETTLE_VERSION_MAJOR > 3 || \
+    (NETTLE_VERSION_MAJOR == 3 && NETTLE_VERSION_MINOR >= 7)
+    {
+        static const unsigned char counter[CHACHA_COUNTER_SIZE] = { 1 };
+        chacha_set_counter(ctx, counter);
+    }
+#else
+    {
+        unsigned char discard[CHACHA_BLOCK_SIZE];
+        memset(discard, 0, sizeof(discard));
+        chacha_crypt(ctx, sizeof(discard), discard, discard);
+        smemclr(discard, sizeof(discard));
     }
+#endif
+}
 
-    /* Dump the macros, don't need them littering */
-#undef rotl
-#undef qrop
-#undef quarter
+/* Poly1305 implementation (no AES, nonce is not encrypted) */
 
-    /* Add the initial state */
-    for (i = 0; i < 16; ++i) {
-        copy[i] += ctx->state[i];
-    }
+#if defined __SIZEOF_INT128__ && !defined _FORCE_SOFTWARE_POLY1305
 
-    /* Update the content of the xor buffer */
-    for (i = 0; i < 16; ++i) {
-        ctx->current[i * 4 + 0] = copy[i] >> 0;
-        ctx->current[i * 4 + 1] = copy[i] >> 8;
-        ctx->current[i * 4 + 2] = copy[i] >> 16;
-        ctx->current[i * 4 + 3] = copy[i] >> 24;
-    }
-    /* State full, reset pointer to beginning */
-    ctx->currentIndex = 0;
-    smemclr(copy, sizeof(copy));
-
-    /* Increment round counter */
-    ++ctx->state[12];
-    /* Check for overflow, not done in one line so the 32 bits are chopped by the type */
-    if (!(uint32_t)(ctx->state[12])) {
-        ++ctx->state[13];
-    }
-}
+/*
+ * With a 64x64->128 bit multiply available, use three limbs of
+ * 44/44/42 bits (as in poly1305-donna). Each block then costs nine
+ * wide multiplies with the carries deferred to the end, and the input
+ * is loaded with two 64-bit reads instead of byte by byte.
+ */
+
+typedef unsigned __int128 poly1305_u128;
+
+#define POLY1305_MASK44 ((uint64_t)0xfffffffffff)
+#define POLY1305_MASK42 ((uint64_t)0x3ffffffffff)
+
+struct poly1305 {
+    unsigned char nonce[16];
+    uint64_t r[3];
+    uint64_t s[2]; /* r[1] and r[2] premultiplied by 20 */
+    uint64_t h[3];
+
+    /* Buffer in case we get less that a multiple of 16 bytes */
+    unsigned char buffer[16];
+    int bufferIndex;
+};
 
-/* Initialise context with 256bit key */
-static void chacha20_key(struct chacha20 *ctx, const unsigned char *key)
+static void poly1305_init(struct poly1305 *ctx)
 {
-    static const char constant[16] = "expand 32-byte k";
-
-    /* Add the fixed string to the start of the state */
-    ctx->state[0] = GET_32BIT_LSB_FIRST(constant + 0);
-    ctx->state[1] = GET_32BIT_LSB_FIRST(constant + 4);
-    ctx->state[2] = GET_32BIT_LSB_FIRST(constant + 8);
-    ctx->state[3] = GET_32BIT_LSB_FIRST(constant + 12);
-
-    /* Add the key */
-    ctx->state[4]  = GET_32BIT_LSB_FIRST(key + 0);
-    ctx->state[5]  = GET_32BIT_LSB_FIRST(key + 4);
-    ctx->state[6]  = GET_32BIT_LSB_FIRST(key + 8);
-    ctx->state[7]  = GET_32BIT_LSB_FIRST(key + 12);
-    ctx->state[8]  = GET_32BIT_LSB_FIRST(key + 16);
-    ctx->state[9]  = GET_32BIT_LSB_FIRST(key + 20);
-    ctx->state[10] = GET_32BIT_LSB_FIRST(key + 24);
-    ctx->state[11] = GET_32BIT_LSB_FIRST(key + 28);
-
-    /* New key, dump context */
-    ctx->currentIndex = 64;
+    memset(ctx->nonce, 0, 16);
+    ctx->bufferIndex = 0;
+    ctx->h[0] = ctx->h[1] = ctx->h[2] = 0;
 }
 
-static void chacha20_iv(struct chacha20 *ctx, const unsigned char *iv)
+static void poly1305_key(struct poly1305 *ctx, ptrlen key)
 {
-    ctx->state[12] = 0;
-    ctx->state[13] = 0;
-    ctx->state[14] = GET_32BIT_MSB_FIRST(iv);
-    ctx->state[15] = GET_32BIT_MSB_FIRST(iv + 4);
+    assert(key.len == 32);             /* Takes a 256 bit key */
 
-    /* New IV, dump context */
-    ctx->currentIndex = 64;
+    const unsigned char *k = (const unsigned char *)key.ptr;
+    uint64_t t0 = GET_64BIT_LSB_FIRST(k);
+    uint64_t t1 = GET_64BIT_LSB_FIRST(k + 8);
+
+    /* Split into limbs, clamping r as the spec requires on the way */
+    ctx->r[0] = t0 & 0xffc0fffffff;
+    ctx->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    ctx->r[2] = (t1 >> 24) & 0x00ffffffc0f;
+
+    /* 2^130 = 5 (mod p), and the limbs overlap by a factor of 4 */
+    ctx->s[0] = ctx->r[1] * (5 << 2);
+    ctx->s[1] = ctx->r[2] * (5 << 2);
+
+    /* Use second 128 bits as the nonce */
+    memcpy(ctx->nonce, k + 16, 16);
 }
 
-static void chacha20_encrypt(struct chacha20 *ctx, unsigned char *blk, int len)
+/* Feed up to 16 bytes (should only be less for the last chunk) */
+static void poly1305_feed_chunk(struct poly1305 *ctx,
+                                const unsigned char *chunk, int len)
 {
-    while (len) {
-        /* If we don't have any state left, then cycle to the next */
-        if (ctx->currentIndex >= 64) {
-            chacha20_round(ctx);
-        }
-
-        /* Do the xor while there's some state left and some plaintext left */
-        while (ctx->currentIndex < 64 && len) {
-            *blk++ ^= ctx->current[ctx->currentIndex++];
-            --len;
-        }
+    unsigned char padded[16];
+    uint64_t hibit = (uint64_t)1 << 40;
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    uint64_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2];
+    uint64_t s1 = ctx->s[0], s2 = ctx->s[1];
+    uint64_t t0, t1, c;
+    poly1305_u128 d0, d1, d2;
+
+    if (len < 16) {
+        /* Short final chunk: the 2^(8*len) bit goes in place of the
+         * byte after the data, rather than at 2^128 */
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, chunk, len);
+        padded[len] = 1;
+        chunk = padded;
+        hibit = 0;
     }
+
+    t0 = GET_64BIT_LSB_FIRST(chunk);
+    t1 = GET_64BIT_LSB_FIRST(chunk + 8);
+
+    h0 += t0 & POLY1305_MASK44;
+    h1 += ((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44;
+    h2 += ((t1 >> 24) & POLY1305_MASK42) | hibit;
+
+    d0 = (poly1305_u128)h0 * r0 + (poly1305_u128)h1 * s2 +
+        (poly1305_u128)h2 * s1;
+    d1 = (poly1305_u128)h0 * r1 + (poly1305_u128)h1 * r0 +
+        (poly1305_u128)h2 * s2;
+    d2 = (poly1305_u128)h0 * r2 + (poly1305_u128)h1 * r1 +
+        (poly1305_u128)h2 * r0;
+
+    /* Partial reduction mod 2^130-5 */
+    c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & POLY1305_MASK44;
+    d1 += c;
+    c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & POLY1305_MASK44;
+    d2 += c;
+    c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & POLY1305_MASK42;
+    h0 += c * 5;
+    c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += c;
+
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+
+    if (chunk == padded)
+        smemclr(padded, sizeof(padded));
 }
 
-/* Decrypt is encrypt... It's xor against a PRNG... */
-static INLINE void chacha20_decrypt(struct chacha20 *ctx,
-                                    unsigned char *blk, int len)
+/* Fully reduce h, add the nonce and write out the 16 byte MAC */
+static void poly1305_output(struct poly1305 *ctx, unsigned char *mac)
 {
-    chacha20_encrypt(ctx, blk, len);
+    uint64_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2];
+    uint64_t g0, g1, g2, c, t0, t1;
+
+    c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+    h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += c;
+
+    /* Compute h + -p, and select it in constant time if it's >= 0 */
+    g0 = h0 + 5; c = g0 >> 44; g0 &= POLY1305_MASK44;
+    g1 = h1 + c; c = g1 >> 44; g1 &= POLY1305_MASK44;
+    g2 = h2 + c - ((uint64_t)1 << 42);
+
+    c = (g2 >> 63) - 1;
+    g0 &= c; g1 &= c; g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    /* h = h + nonce, mod 2^128 */
+    t0 = GET_64BIT_LSB_FIRST(ctx->nonce);
+    t1 = GET_64BIT_LSB_FIRST(ctx->nonce + 8);
+
+    h0 += t0 & POLY1305_MASK44; c = h0 >> 44; h0 &= POLY1305_MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44) + c;
+    c = h1 >> 44; h1 &= POLY1305_MASK44;
+    h2 += ((t1 >> 24) & POLY1305_MASK42) + c; h2 &= POLY1305_MASK42;
+
+    PUT_64BIT_LSB_FIRST(mac, h0 | (h1 << 44));
+    PUT_64BIT_LSB_FIRST(mac + 8, (h1 >> 20) | (h2 << 24));
 }
 
-/* Poly1305 implementation (no AES, nonce is not encrypted) */
+#else /* no 128-bit multiply: fall back to the generic bigval code */
 
 #define NWORDS ((130 + BIGNUM_INT_BITS-1) / BIGNUM_INT_BITS)
 typedef struct bigval {
@@ -808,6 +853,19 @@ static void poly1305_feed_chunk(struct poly1305 *ctx,
     bigval_mul_mod_p(&ctx->h, &c, &ctx->r);
 }
 
+/* Fully reduce h, add the nonce and write out the 16 byte MAC */
+static void poly1305_output(struct poly1305 *ctx, unsigned char *mac)
+{
+    bigval tmp;
+
+    bigval_import_le(&tmp, ctx->nonce, 16);
+    bigval_final_reduce(&ctx->h);
+    bigval_add(&tmp, &tmp, &ctx->h);
+    bigval_export_le(&tmp, mac, 16);
+}
+
+#endif
+
 static void poly1305_feed(struct poly1305 *ctx,
                           const unsigned char *buf, int len)
 {
@@ -841,26 +899,22 @@ static void poly1305_feed(struct poly1305 *ctx,
 /* Finalise and populate buffer with 16 byte with MAC */
 static void poly1305_finalise(struct poly1305 *ctx, unsigned char *mac)
 {
-    bigval tmp;
-
     if (ctx->bufferIndex) {
         poly1305_feed_chunk(ctx, ctx->buffer, ctx->bufferIndex);
     }
 
-    bigval_import_le(&tmp, ctx->nonce, 16);
-    bigval_final_reduce(&ctx->h);
-    bigval_add(&tmp, &tmp, &ctx->h);
-    bigval_export_le(&tmp, mac, 16);
+    poly1305_output(ctx, mac);
 }
 
 /* SSH-2 wrapper */
 
 struct ccp_context {
-    struct chacha20 a_cipher; /* Used for length */
-    struct chacha20 b_cipher; /* Used for content */
+    struct chacha_ctx a_cipher; /* Used for length */
+    struct chacha_ctx b_cipher; /* Used for content */
 
     /* Cache of the first 4 bytes because they are the sequence number */
-    /* Kept in 8 bytes with the top as zero to allow easy passing to setiv */
+    /* Kept in 8 bytes with the top as zero to allow easy passing to
+     * chacha_set_nonce */
     int mac_initialised; /* Where we have got to in filling mac_iv */
     unsigned char mac_iv[8];
 
@@ -906,24 +960,26 @@ static void poly_BinarySink_write(BinarySink *bs, const void *blkv, size_t len)
 
     /* First 4 bytes are the IV */
     while (ctx->mac_initialised < 4 && len) {
-        ctx->mac_iv[7 - ctx->mac_initialised] = *blk++;
+        ctx->mac_iv[4 + ctx->mac_initialised] = *blk++;
         ++ctx->mac_initialised;
         --len;
     }
 
     /* Initialise the IV if needed */
     if (ctx->mac_initialised == 4) {
-        chacha20_iv(&ctx->b_cipher, ctx->mac_iv);
+        unsigned char keyblock[CHACHA_BLOCK_SIZE];
+
+        chacha_set_nonce(&ctx->b_cipher, ctx->mac_iv);
         ++ctx->mac_initialised;  /* Don't do it again */
 
-        /* Do first rotation */
-        chacha20_round(&ctx->b_cipher);
+        /* Block 0 of the keystream is the poly key; generating it
+         * leaves the counter at 1, ready for the content */
+        memset(keyblock, 0, sizeof(keyblock));
+        chacha_crypt(&ctx->b_cipher, sizeof(keyblock), keyblock, keyblock);
 
         /* Set the poly key */
-        poly1305_key(&ctx->mac, make_ptrlen(ctx->b_cipher.current, 32));
-
-        /* Set the first round as used */
-        ctx->b_cipher.currentIndex = 64;
+        poly1305_key(&ctx->mac, make_ptrlen(keyblock, 32));
+        smemclr(keyblock, sizeof(keyblock));
     }
 
     /* Update the MAC with anything left */
@@ -981,21 +1037,22 @@ static void ccp_key(ssh_cipher *cipher, const void *vkey)
     const unsigned char *key = (const unsigned char *)vkey;
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
     /* Initialise the a_cipher (for decrypting lengths) with the first 256 bits */
-    chacha20_key(&ctx->a_cipher, key + 32);
+    chacha_set_key(&ctx->a_cipher, key + 32);
     /* Initialise the b_cipher (for content and MAC) with the second 256 bits */
-    chacha20_key(&ctx->b_cipher, key);
+    chacha_set_key(&ctx->b_cipher, key);
 }
 
 static void ccp_encrypt(ssh_cipher *cipher, void *blk, int len)
 {
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
-    chacha20_encrypt(&ctx->b_cipher, blk, len);
+    chacha_crypt(&ctx->b_cipher, len, blk, blk);
 }
 
 static void ccp_decrypt(ssh_cipher *cipher, void *blk, int len)
 {
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
-    chacha20_decrypt(&ctx->b_cipher, blk, len);
+    /* Decrypt is encrypt... It's xor against a PRNG... */
+    chacha_crypt(&ctx->b_cipher, len, blk, blk);
 }
 
 static void ccp_length_op(struct ccp_context *ctx, void *blk, int len,
@@ -1006,12 +1063,11 @@ static void ccp_length_op(struct ccp_context *ctx, void *blk, int len,
      * According to RFC 4253 (section 6.4), the packet sequence number wraps
      * at 2^32, so its 32 high-order bits will always be zero.
      */
-    PUT_32BIT_LSB_FIRST(iv, 0);
-    PUT_32BIT_LSB_FIRST(iv + 4, seq);
-    chacha20_iv(&ctx->a_cipher, iv);
-    chacha20_iv(&ctx->b_cipher, iv);
-    /* Reset content block count to 1, as the first is the key for Poly1305 */
-    ++ctx->b_cipher.state[12];
+    PUT_32BIT_MSB_FIRST(iv, 0);
+    PUT_32BIT_MSB_FIRST(iv + 4, seq);
+    chacha_set_nonce(&ctx->a_cipher, iv);
+    /* Content block count starts at 1, as the first is the key for Poly1305 */
+    chacha20_iv_skip_key_block(&ctx->b_cipher, iv);
     smemclr(iv, sizeof(iv));
 }
 
@@ -1020,7 +1076,7 @@ static void ccp_encrypt_length(ssh_cipher *cipher, void *blk, int len,
 {
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
     ccp_length_op(ctx, blk, len, seq);
-    chacha20_encrypt(&ctx->a_cipher, blk, len);
+    chacha_crypt(&ctx->a_cipher, len, blk, blk);
 }
 
 static void ccp_decrypt_length(ssh_cipher *cipher, void *blk, int len,
@@ -1028,7 +1084,7 @@ static void ccp_decrypt_length(ssh_cipher *cipher, void *blk, int len,
 {
     struct ccp_context *ctx = container_of(cipher, struct ccp_context, ciph);
     ccp_length_op(ctx, blk, len, seq);
-    chacha20_decrypt(&ctx->a_cipher, blk, len);
+    chacha_crypt(&ctx->a_cipher, len, blk, blk);
 }
 
 const ssh_cipheralg ssh2_chacha20_poly1305 = {
@@ -64,7 +64,7 @@ static void pktin_free_queue_callback(void *vctx)
         PacketQueueNode *node = pktin_freeq_head.next;
         PktIn *pktin = container_of(node, PktIn, qnode);
         pktin_freeq_head.next = node->next;
-        sfree(pktin);
+        ssh_free_pktin(pktin);
     }
 
     pktin_freeq_head.prev = &pktin_freeq_head;
@@ -277,6 +277,56 @@ void ssh_free_pktout(PktOut *pkt)
     sfree(pkt);
 }
 
+/*
+ * Incoming packets come from a slab of blocks of a single size, big
+ * enough for any packet the BPP accepts before decompression,
+ * including the MAC. During a bulk transfer packets go through at a
+ * high rate, so freed blocks are kept on a free list for reuse
+ * instead of going back to the heap. The list is bounded, so a burst
+ * of queued packets doesn't keep its memory afterwards.
+ */
+#define PKTIN_SLAB_DATALEN (OUR_V2_PACKETLIMIT + 4 + 64)
+#define PKTIN_SLAB_MAXFREE 16
+
+static PacketQueueNode *pktin_slab_free;
+static size_t pktin_slab_nfree;
+
+PktIn *ssh_new_pktin(size_t datalen)
+{
+    PktIn *pktin;
+
+    if (datalen > PKTIN_SLAB_DATALEN) {
+        pktin = snew_plus(PktIn, datalen);
+        pktin->from_slab = false;
+    } else if (pktin_slab_free) {
+        pktin = container_of(pktin_slab_free, PktIn, qnode);
+        pktin_slab_free = pktin_slab_free->next;
+        pktin_slab_nfree--;
+    } else {
+        pktin = snew_plus(PktIn, PKTIN_SLAB_DATALEN);
+        pktin->from_slab = true;
+    }
+
+    pktin->type = 0;
+    pktin->qnode.prev = pktin->qnode.next = NULL;
+    pktin->qnode.on_free_queue = false;
+    return pktin;
+}
+
+void ssh_free_pktin(PktIn *pktin)
+{
+    if (!pktin)
+        return;
+
+    if (pktin->from_slab && pktin_slab_nfree < PKTIN_SLAB_MAXFREE) {
+        pktin->qnode.next = pktin_slab_free;
+        pktin_slab_free = &pktin->qnode;
+        pktin_slab_nfree++;
+    } else {
+        sfree(pktin);
+    }
+}
+
 /* ----------------------------------------------------------------------
  * Implement zombiechan_new() and its trivial vtable.
  */
@@ -874,7 +874,8 @@ static void des3_sdctr_encrypt_decrypt(ssh_cipher *ciph, void *vdata, int len)
 const ssh_cipheralg ssh_3des_ssh2_ctr = {
     des3_sdctr_new, des3_sdctr_free, des3_sdctr_setiv, des3_sdctr_setkey,
     des3_sdctr_encrypt_decrypt, des3_sdctr_encrypt_decrypt,
-    NULL, NULL, "3des-ctr", 8, 168, 24, 0, "triple-DES SDCTR", NULL
+    NULL, NULL, "3des-ctr", 8, 168, 24, SSH_CIPHER_IS_SDCTR,
+    "triple-DES SDCTR", NULL
 };
 
 static const ssh_cipheralg *const des3_list[] = {
@@ -1240,6 +1240,296 @@ const ssh_keyalg ssh_ecdsa_nistp521 = {
     0, /* no supported flags */
 };
 
+/* ----------------------------------------------------------------------
+ * X25519 with arithmetic specialised to the field of Curve25519.
+ *
+ * The general Montgomery curve code works with mp_int, which is
+ * sized at run time and goes through Montgomery multiplication for
+ * every field operation. Key exchange with Curve25519 is common
+ * enough to have its own fixed-size version, with field elements in
+ * five 51-bit limbs as in Bernstein's curve25519-donna. It needs
+ * 64x64->128 bit multiplication, so it is only used if the compiler
+ * provides a 128-bit integer type.
+ *
+ * Like the general code this is constant-time: the ladder runs for
+ * all 255 bits and the only data-dependent operation is the
+ * conditional swap, done with masks.
+ */
+
+#ifdef __SIZEOF_INT128__
+
+#define X25519_BYTES 32
+
+typedef uint64_t x25519_fe[5];
+typedef __uint128_t x25519_wide;
+
+#define X25519_LIMB_MASK ((((uint64_t)1) << 51) - 1)
+
+static void x25519_fe_from_bytes(x25519_fe h, const uint8_t *s)
+{
+    /* The top bit is ignored, as RFC 7748 section 5 requires */
+    h[0] = GET_64BIT_LSB_FIRST(s) & X25519_LIMB_MASK;
+    h[1] = (GET_64BIT_LSB_FIRST(s + 6) >> 3) & X25519_LIMB_MASK;
+    h[2] = (GET_64BIT_LSB_FIRST(s + 12) >> 6) & X25519_LIMB_MASK;
+    h[3] = (GET_64BIT_LSB_FIRST(s + 19) >> 1) & X25519_LIMB_MASK;
+    h[4] = (GET_64BIT_LSB_FIRST(s + 24) >> 12) & X25519_LIMB_MASK;
+}
+
+/* Carries each limb into the next, the top one wrapping round
+ * multiplied by 19, since 2^255 = 19 mod p */
+static inline void x25519_fe_carry(uint64_t *t)
+{
+    t[1] += t[0] >> 51; t[0] &= X25519_LIMB_MASK;
+    t[2] += t[1] >> 51; t[1] &= X25519_LIMB_MASK;
+    t[3] += t[2] >> 51; t[2] &= X25519_LIMB_MASK;
+    t[4] += t[3] >> 51; t[3] &= X25519_LIMB_MASK;
+    t[0] += 19 * (t[4] >> 51); t[4] &= X25519_LIMB_MASK;
+}
+
+static void x25519_fe_to_bytes(uint8_t *s, const x25519_fe h)
+{
+    uint64_t t[5];
+    memcpy(t, h, sizeof(t));
+
+    /* Now 0 <= t < 2^255, with every limb below 2^51 */
+    x25519_fe_carry(t);
+    x25519_fe_carry(t);
+
+    /*
+     * Subtract p if t >= p. Adding 19 carries out of the top exactly
+     * if it does; then add 2^255 - 19 and drop the top bit again,
+     * which leaves t - p or t as appropriate.
+     */
+    t[0] += 19;
+    x25519_fe_carry(t);
+    t[0] += X25519_LIMB_MASK + 1 - 19;
+    t[1] += X25519_LIMB_MASK;
+    t[2] += X25519_LIMB_MASK;
+    t[3] += X25519_LIMB_MASK;
+    t[4] += X25519_LIMB_MASK;
+    t[1] += t[0] >> 51; t[0] &= X25519_LIMB_MASK;
+    t[2] += t[1] >> 51; t[1] &= X25519_LIMB_MASK;
+    t[3] += t[2] >> 51; t[2] &= X25519_LIMB_MASK;
+    t[4] += t[3] >> 51; t[3] &= X25519_LIMB_MASK;
+    t[4] &= X25519_LIMB_MASK;
+
+    PUT_64BIT_LSB_FIRST(s, t[0] | (t[1] << 51));
+    PUT_64BIT_LSB_FIRST(s + 8, (t[1] >> 13) | (t[2] << 38));
+    PUT_64BIT_LSB_FIRST(s + 16, (t[2] >> 26) | (t[3] << 25));
+    PUT_64BIT_LSB_FIRST(s + 24, (t[3] >> 39) | (t[4] << 12));
+
+    smemclr(t, sizeof(t));
+}
+
+static inline void x25519_fe_add(x25519_fe h, const x25519_fe f,
+                                 const x25519_fe g)
+{
+    for (size_t i = 0; i < 5; i++)
+        h[i] = f[i] + g[i];
+}
+
+/* Adds 2p first, so that no limb can go negative */
+static inline void x25519_fe_sub(x25519_fe h, const x25519_fe f,
+                                 const x25519_fe g)
+{
+    h[0] = f[0] + 2 * (X25519_LIMB_MASK - 18) - g[0];
+    for (size_t i = 1; i < 5; i++)
+        h[i] = f[i] + 2 * X25519_LIMB_MASK - g[i];
+}
+
+/* Reduces the five 128-bit column sums of a product into h */
+static inline void x25519_fe_reduce(x25519_fe h, x25519_wide *r)
+{
+    uint64_t c;
+    c = (uint64_t)(r[0] >> 51); h[0] = (uint64_t)r[0] & X25519_LIMB_MASK;
+    r[1] += c;
+    c = (uint64_t)(r[1] >> 51); h[1] = (uint64_t)r[1] & X25519_LIMB_MASK;
+    r[2] += c;
+    c = (uint64_t)(r[2] >> 51); h[2] = (uint64_t)r[2] & X25519_LIMB_MASK;
+    r[3] += c;
+    c = (uint64_t)(r[3] >> 51); h[3] = (uint64_t)r[3] & X25519_LIMB_MASK;
+    r[4] += c;
+    c = (uint64_t)(r[4] >> 51); h[4] = (uint64_t)r[4] & X25519_LIMB_MASK;
+    h[0] += c * 19;
+    h[1] += h[0] >> 51; h[0] &= X25519_LIMB_MASK;
+}
+
+static void x25519_fe_mul(x25519_fe h, const x25519_fe f, const x25519_fe g)
+{
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2;
+    uint64_t g3_19 = 19 * g3, g4_19 = 19 * g4;
+    x25519_wide r[5];
+
+    r[0] = (x25519_wide)f0 * g0 + (x25519_wide)f1 * g4_19 +
+        (x25519_wide)f2 * g3_19 + (x25519_wide)f3 * g2_19 +
+        (x25519_wide)f4 * g1_19;
+    r[1] = (x25519_wide)f0 * g1 + (x25519_wide)f1 * g0 +
+        (x25519_wide)f2 * g4_19 + (x25519_wide)f3 * g3_19 +
+        (x25519_wide)f4 * g2_19;
+    r[2] = (x25519_wide)f0 * g2 + (x25519_wide)f1 * g1 +
+        (x25519_wide)f2 * g0 + (x25519_wide)f3 * g4_19 +
+        (x25519_wide)f4 * g3_19;
+    r[3] = (x25519_wide)f0 * g3 + (x25519_wide)f1 * g2 +
+        (x25519_wide)f2 * g1 + (x25519_wide)f3 * g0 +
+        (x25519_wide)f4 * g4_19;
+    r[4] = (x25519_wide)f0 * g4 + (x25519_wide)f1 * g3 +
+        (x25519_wide)f2 * g2 + (x25519_wide)f3 * g1 +
+        (x25519_wide)f4 * g0;
+
+    x25519_fe_reduce(h, r);
+}
+
+static void x25519_fe_sqr(x25519_fe h, const x25519_fe f)
+{
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1, f2_38 = 38 * f2;
+    uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4, f4_38 = 2 * f4_19;
+    x25519_wide r[5];
+
+    r[0] = (x25519_wide)f0 * f0 + (x25519_wide)f4_38 * f1 +
+        (x25519_wide)f2_38 * f3;
+    r[1] = (x25519_wide)f0_2 * f1 + (x25519_wide)f4_38 * f2 +
+        (x25519_wide)f3_19 * f3;
+    r[2] = (x25519_wide)f0_2 * f2 + (x25519_wide)f1 * f1 +
+        (x25519_wide)f4_38 * f3;
+    r[3] = (x25519_wide)f0_2 * f3 + (x25519_wide)f1_2 * f2 +
+        (x25519_wide)f4_19 * f4;
+    r[4] = (x25519_wide)f0_2 * f4 + (x25519_wide)f1_2 * f3 +
+        (x25519_wide)f2 * f2;
+
+    x25519_fe_reduce(h, r);
+}
+
+static void x25519_fe_sqr_n(x25519_fe h, const x25519_fe f, unsigned n)
+{
+    x25519_fe_sqr(h, f);
+    while (--n)
+        x25519_fe_sqr(h, h);
+}
+
+/* h = z^(p-2) = z^-1, by the usual addition chain */
+static void x25519_fe_invert(x25519_fe h, const x25519_fe z)
+{
+    x25519_fe z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    x25519_fe_sqr(z2, z);
+    x25519_fe_sqr_n(t, z2, 2);
+    x25519_fe_mul(z9, t, z);
+    x25519_fe_mul(z11, z9, z2);
+    x25519_fe_sqr(t, z11);
+    x25519_fe_mul(z2_5_0, t, z9);
+    x25519_fe_sqr_n(t, z2_5_0, 5);
+    x25519_fe_mul(z2_10_0, t, z2_5_0);
+    x25519_fe_sqr_n(t, z2_10_0, 10);
+    x25519_fe_mul(z2_20_0, t, z2_10_0);
+    x25519_fe_sqr_n(t, z2_20_0, 20);
+    x25519_fe_mul(t, t, z2_20_0);
+    x25519_fe_sqr_n(t, t, 10);
+    x25519_fe_mul(z2_50_0, t, z2_10_0);
+    x25519_fe_sqr_n(t, z2_50_0, 50);
+    x25519_fe_mul(z2_100_0, t, z2_50_0);
+    x25519_fe_sqr_n(t, z2_100_0, 100);
+    x25519_fe_mul(t, t, z2_100_0);
+    x25519_fe_sqr_n(t, t, 50);
+    x25519_fe_mul(t, t, z2_50_0);
+    x25519_fe_sqr_n(t, t, 5);
+    x25519_fe_mul(h, t, z11);
+
+    smemclr(z2, sizeof(z2));
+    smemclr(z9, sizeof(z9));
+    smemclr(z11, sizeof(z11));
+    smemclr(z2_5_0, sizeof(z2_5_0));
+    smemclr(z2_10_0, sizeof(z2_10_0));
+    smemclr(z2_20_0, sizeof(z2_20_0));
+    smemclr(z2_50_0, sizeof(z2_50_0));
+    smemclr(z2_100_0, sizeof(z2_100_0));
+    smemclr(t, sizeof(t));
+}
+
+static inline void x25519_fe_cond_swap(x25519_fe f, x25519_fe g,
+                                       unsigned swap)
+{
+    uint64_t mask = -(uint64_t)(swap & 1);
+    for (size_t i = 0; i < 5; i++) {
+        uint64_t t = mask & (f[i] ^ g[i]);
+        f[i] ^= t;
+        g[i] ^= t;
+    }
+}
+
+/*
+ * Writes the u-coordinate of n times the point with u-coordinate u,
+ * using the ladder given in RFC 7748 section 5. The scalar is
+ * expected to be clamped already.
+ */
+static void x25519_multiply(uint8_t *out, mp_int *n, const uint8_t *u)
+{
+    static const x25519_fe one = { 1 }, a24 = { 121665 };
+    x25519_fe x1, x2, z2, x3, z3;
+    x25519_fe a, aa, b, bb, e, c, d, da, cb, t;
+    unsigned swap = 0;
+
+    x25519_fe_from_bytes(x1, u);
+    memcpy(x2, one, sizeof(x2));
+    memset(z2, 0, sizeof(z2));
+    memcpy(x3, x1, sizeof(x3));
+    memcpy(z3, one, sizeof(z3));
+
+    for (size_t bitindex = 255; bitindex-- > 0 ;) {
+        unsigned nbit = mp_get_bit(n, bitindex);
+        swap ^= nbit;
+        x25519_fe_cond_swap(x2, x3, swap);
+        x25519_fe_cond_swap(z2, z3, swap);
+        swap = nbit;
+
+        x25519_fe_add(a, x2, z2);
+        x25519_fe_sqr(aa, a);
+        x25519_fe_sub(b, x2, z2);
+        x25519_fe_sqr(bb, b);
+        x25519_fe_sub(e, aa, bb);
+        x25519_fe_add(c, x3, z3);
+        x25519_fe_sub(d, x3, z3);
+        x25519_fe_mul(da, d, a);
+        x25519_fe_mul(cb, c, b);
+
+        x25519_fe_add(t, da, cb);
+        x25519_fe_sqr(x3, t);
+        x25519_fe_sub(t, da, cb);
+        x25519_fe_sqr(t, t);
+        x25519_fe_mul(z3, x1, t);
+        x25519_fe_mul(x2, aa, bb);
+        x25519_fe_mul(t, a24, e);
+        x25519_fe_add(t, aa, t);
+        x25519_fe_mul(z2, e, t);
+    }
+    x25519_fe_cond_swap(x2, x3, swap);
+    x25519_fe_cond_swap(z2, z3, swap);
+
+    x25519_fe_invert(z2, z2);
+    x25519_fe_mul(x2, x2, z2);
+    x25519_fe_to_bytes(out, x2);
+
+    smemclr(x1, sizeof(x1));
+    smemclr(x2, sizeof(x2));
+    smemclr(z2, sizeof(z2));
+    smemclr(x3, sizeof(x3));
+    smemclr(z3, sizeof(z3));
+    smemclr(a, sizeof(a));
+    smemclr(aa, sizeof(aa));
+    smemclr(b, sizeof(b));
+    smemclr(bb, sizeof(bb));
+    smemclr(e, sizeof(e));
+    smemclr(c, sizeof(c));
+    smemclr(d, sizeof(d));
+    smemclr(da, sizeof(da));
+    smemclr(cb, sizeof(cb));
+    smemclr(t, sizeof(t));
+}
+
+#endif /* __SIZEOF_INT128__ */
+
 /* ----------------------------------------------------------------------
  * Exposed ECDH interface
  */
@@ -1259,6 +1549,9 @@ struct ecdh_key {
     union {
         WeierstrassPoint *w_public;
         MontgomeryPoint *m_public;
+#ifdef __SIZEOF_INT128__
+        uint8_t x25519_public[X25519_BYTES];
+#endif
     };
 };
 
@@ -1278,7 +1571,7 @@ static void ssh_ecdhkex_w_setup(ecdh_key *dh)
     dh->w_public = ecc_weierstrass_multiply(dh->curve->w.G, dh->private);
 }
 
-static void ssh_ecdhkex_m_setup(ecdh_key *dh)
+static void ssh_ecdhkex_m_make_private(ecdh_key *dh)
 {
     strbuf *bytes = strbuf_new_nm();
     random_read(strbuf_append(bytes, dh->curve->fieldBytes),
@@ -1296,9 +1589,15 @@ static void ssh_ecdhkex_m_setup(ecdh_key *dh)
         mp_set_bit(dh->private, bit, 0);
 
     strbuf_free(bytes);
+}
 
+#ifndef __SIZEOF_INT128__
+static void ssh_ecdhkex_m_setup(ecdh_key *dh)
+{
+    ssh_ecdhkex_m_make_private(dh);
     dh->m_public = ecc_montgomery_multiply(dh->curve->m.G, dh->private);
 }
+#endif
 
 ecdh_key *ssh_ecdhkex_newkey(const ssh_kex *kex)
 {
@@ -1317,6 +1616,7 @@ static void ssh_ecdhkex_w_getpublic(ecdh_key *dh, BinarySink *bs)
     put_wpoint(bs, dh->w_public, dh->curve, true);
 }
 
+#ifndef __SIZEOF_INT128__
 static void ssh_ecdhkex_m_getpublic(ecdh_key *dh, BinarySink *bs)
 {
     mp_int *x;
@@ -1325,6 +1625,7 @@ static void ssh_ecdhkex_m_getpublic(ecdh_key *dh, BinarySink *bs)
         put_byte(bs, mp_get_byte(x, i));
     mp_free(x);
 }
+#endif
 
 void ssh_ecdhkex_getpublic(ecdh_key *dh, BinarySink *bs)
 {
@@ -1354,6 +1655,7 @@ static mp_int *ssh_ecdhkex_w_getkey(ecdh_key *dh, ptrlen remoteKey)
     return x;
 }
 
+#ifndef __SIZEOF_INT128__
 static mp_int *ssh_ecdhkex_m_getkey(ecdh_key *dh, ptrlen remoteKey)
 {
     mp_int *remote_x = mp_from_bytes_le(remoteKey);
@@ -1414,6 +1716,53 @@ static mp_int *ssh_ecdhkex_m_getkey(ecdh_key *dh, ptrlen remoteKey)
 
     return x;
 }
+#else
+
+/* The fixed-size versions of the above for Curve25519 */
+
+static void ssh_ecdhkex_x25519_setup(ecdh_key *dh)
+{
+    static const uint8_t base_point[X25519_BYTES] = { 9 };
+
+    ssh_ecdhkex_m_make_private(dh);
+    x25519_multiply(dh->x25519_public, dh->private, base_point);
+}
+
+static void ssh_ecdhkex_x25519_getpublic(ecdh_key *dh, BinarySink *bs)
+{
+    put_data(bs, dh->x25519_public, X25519_BYTES);
+}
+
+static mp_int *ssh_ecdhkex_x25519_getkey(ecdh_key *dh, ptrlen remoteKey)
+{
+    /* Same treatment of the remote value as ssh_ecdhkex_m_getkey */
+    mp_int *remote_x = mp_from_bytes_le(remoteKey);
+    mp_reduce_mod_2to(remote_x, dh->curve->fieldBits);
+    if (mp_eq_integer(remote_x, 0)) {
+        mp_free(remote_x);
+        return NULL;
+    }
+
+    uint8_t u[X25519_BYTES], shared[X25519_BYTES];
+    for (size_t i = 0; i < X25519_BYTES; ++i)
+        u[i] = mp_get_byte(remote_x, i);
+    mp_free(remote_x);
+
+    x25519_multiply(shared, dh->private, u);
+
+    /* The little-endian bytes taken as a big-endian number, see the
+     * comment in ssh_ecdhkex_m_getkey */
+    mp_int *x = mp_from_bytes_be(make_ptrlen(shared, X25519_BYTES));
+    smemclr(shared, sizeof(shared));
+    return x;
+}
+
+static void ssh_ecdhkex_x25519_cleanup(ecdh_key *dh)
+{
+    smemclr(dh->x25519_public, sizeof(dh->x25519_public));
+}
+
+#endif /* __SIZEOF_INT128__ */
 
 mp_int *ssh_ecdhkex_getkey(ecdh_key *dh, ptrlen remoteKey)
 {
@@ -1425,10 +1774,12 @@ static void ssh_ecdhkex_w_cleanup(ecdh_key *dh)
     ecc_weierstrass_point_free(dh->w_public);
 }
 
+#ifndef __SIZEOF_INT128__
 static void ssh_ecdhkex_m_cleanup(ecdh_key *dh)
 {
     ecc_montgomery_point_free(dh->m_public);
 }
+#endif
 
 void ssh_ecdhkex_freekey(ecdh_key *dh)
 {
@@ -1439,10 +1790,17 @@ void ssh_ecdhkex_freekey(ecdh_key *dh)
 
 static const struct eckex_extra kex_extra_curve25519 = {
     ec_curve25519,
+#ifdef __SIZEOF_INT128__
+    ssh_ecdhkex_x25519_setup,
+    ssh_ecdhkex_x25519_cleanup,
+    ssh_ecdhkex_x25519_getpublic,
+    ssh_ecdhkex_x25519_getkey,
+#else
     ssh_ecdhkex_m_setup,
     ssh_ecdhkex_m_cleanup,
     ssh_ecdhkex_m_getpublic,
     ssh_ecdhkex_m_getkey,
+#endif
 };
 const ssh_kex ssh_ec_kex_curve25519 = {
     "curve25519-sha256@libssh.org", NULL, KEXTYPE_ECDH,
@@ -6,364 +6,934 @@
  * Modifications made for SHA-384 also
  */
 
-#include <assert.h>
 #include "ssh.h"
+#include <assert.h>
+
+/*
+ * Start by deciding whether we can support hardware SHA at all.
+ */
+#define HW_SHA512_NONE 0
+#define HW_SHA512_AVX2 1
+#define HW_SHA512_NEON 2
+
+/*
+ * x86 has no instructions dedicated to SHA-512 in the CPUs this code
+ * targets, but AVX2 can compute the message schedule of two blocks at
+ * once, leaving only the rounds themselves to scalar code.
+ */
+#ifdef _FORCE_SHA512_AVX2
+#   define HW_SHA512 HW_SHA512_AVX2
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<immintrin.h>) &&       \
+    (defined(__x86_64__) || defined(__i386))
+#       define HW_SHA512 HW_SHA512_AVX2
+#   endif
+#elif defined(__GNUC__)
+#    if (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+        (defined(__x86_64__) || defined(__i386))
+#       define HW_SHA512 HW_SHA512_AVX2
+#    endif
+#elif defined (_MSC_VER)
+#   if (defined(_M_X64) || defined(_M_IX86)) && _MSC_VER >= 1800
+#      define HW_SHA512 HW_SHA512_AVX2
+#   endif
+#endif
+
+#ifdef _FORCE_SHA512_NEON
+#   define HW_SHA512 HW_SHA512_NEON
+#elif defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    /* Arm can potentially support both endiannesses, but this code
+     * hasn't been tested on anything but little. If anyone wants to
+     * run big-endian, they'll need to fix it first. */
+#elif defined __ARM_FEATURE_SHA512
+    /* If the Armv8.2 SHA-512 extension is available already, we can
+     * support NEON SHA-512 without having to enable anything by hand */
+#   define HW_SHA512 HW_SHA512_NEON
+#elif defined(__clang__)
+#   if __has_attribute(target) && __has_include(<arm_neon.h>) &&       \
+    (defined(__aarch64__))
+        /* clang can enable the SHA-512 extension in AArch64 using
+         * __attribute__((target)) */
+#       define HW_SHA512 HW_SHA512_NEON
+#       define USE_CLANG_ATTR_TARGET_AARCH64
+#   endif
+#endif
+    /* Visual Studio's AArch64 header doesn't declare the SHA-512
+     * intrinsics as of VS2019, so there is no NEON version for it. */
+
+#if defined _FORCE_SOFTWARE_SHA || !defined HW_SHA512
+#   undef HW_SHA512
+#   define HW_SHA512 HW_SHA512_NONE
+#endif
+
+/*
+ * The actual query function that asks if hardware acceleration is
+ * available.
+ */
+static bool sha512_hw_available(void);
+
+/*
+ * The top-level selection function, caching the results of
+ * sha512_hw_available() so it only has to run once.
+ */
+static bool sha512_hw_available_cached(void)
+{
+    static bool initialised = false;
+    static bool hw_available;
+    if (!initialised) {
+        hw_available = sha512_hw_available();
+        initialised = true;
+    }
+    return hw_available;
+}
+
+static ssh_hash *sha512_select(const ssh_hashalg *alg)
+{
+    const ssh_hashalg *real_alg =
+        sha512_hw_available_cached() ? &ssh_sha512_hw : &ssh_sha512_sw;
+
+    return ssh_hash_new(real_alg);
+}
+
+static ssh_hash *sha384_select(const ssh_hashalg *alg)
+{
+    const ssh_hashalg *real_alg =
+        sha512_hw_available_cached() ? &ssh_sha384_hw : &ssh_sha384_sw;
 
-#define BLKSIZE 128
+    return ssh_hash_new(real_alg);
+}
+
+const ssh_hashalg ssh_sha512 = {
+    sha512_select, NULL, NULL, NULL,
+    64, 128, HASHALG_NAMES_ANNOTATED("SHA-512", "dummy selector vtable"),
+};
+
+const ssh_hashalg ssh_sha384 = {
+    sha384_select, NULL, NULL, NULL,
+    48, 128, HASHALG_NAMES_ANNOTATED("SHA-384", "dummy selector vtable"),
+};
 
-typedef struct {
-    uint64_t h[8];
-    unsigned char block[BLKSIZE];
-    int blkused;
+/* ----------------------------------------------------------------------
+ * Definitions likely to be helpful to multiple implementations.
+ */
+
+static const uint64_t sha512_initial_state[] = {
+    0x6a09e667f3bcc908ULL,
+    0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL,
+    0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL,
+    0x5be0cd19137e2179ULL,
+};
+
+static const uint64_t sha384_initial_state[] = {
+    0xcbbb9d5dc1059ed8ULL,
+    0x629a292a367cd507ULL,
+    0x9159015a3070dd17ULL,
+    0x152fecd8f70e5939ULL,
+    0x67332667ffc00b31ULL,
+    0x8eb44a8768581511ULL,
+    0xdb0c2e0d64f98fa7ULL,
+    0x47b5481dbefa4fa4ULL,
+};
+
+/* SHA-384 only differs from SHA-512 in initial state and output length */
+static inline const uint64_t *sha512_initial_state_for(const ssh_hashalg *alg)
+{
+    return alg->hlen == 48 ? sha384_initial_state : sha512_initial_state;
+}
+
+static const uint64_t sha512_round_constants[] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+    0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+    0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+    0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+    0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+    0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+    0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+    0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+    0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+    0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+    0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+#define SHA512_ROUNDS 80
+#define SHA512_BLOCK_SIZE 128
+
+typedef struct sha512_block sha512_block;
+struct sha512_block {
+    uint8_t block[SHA512_BLOCK_SIZE];
+    size_t used;
     uint64_t lenhi, lenlo;
-    BinarySink_IMPLEMENTATION;
-} SHA512_State;
+};
+
+static inline void sha512_block_setup(sha512_block *blk)
+{
+    blk->used = 0;
+    blk->lenhi = blk->lenlo = 0;
+}
+
+/* Accounts for data hashed without going through the block buffer */
+static inline void sha512_block_count(sha512_block *blk, size_t len)
+{
+    blk->lenlo += len;
+    blk->lenhi += (blk->lenlo < len);
+}
+
+static inline bool sha512_block_write(
+    sha512_block *blk, const void **vdata, size_t *len)
+{
+    size_t blkleft = sizeof(blk->block) - blk->used;
+    size_t chunk = *len < blkleft ? *len : blkleft;
+
+    const uint8_t *p = *vdata;
+    memcpy(blk->block + blk->used, p, chunk);
+    *vdata = p + chunk;
+    *len -= chunk;
+    blk->used += chunk;
+    sha512_block_count(blk, chunk);
+
+    if (blk->used == sizeof(blk->block)) {
+        blk->used = 0;
+        return true;
+    }
+
+    return false;
+}
+
+static inline void sha512_block_pad(sha512_block *blk, BinarySink *bs)
+{
+    uint64_t final_lenhi = (blk->lenhi << 3) | (blk->lenlo >> 61);
+    uint64_t final_lenlo = blk->lenlo << 3;
+    size_t pad = 1 + (127 & (111 - blk->used));
+
+    put_byte(bs, 0x80);
+    for (size_t i = 1; i < pad; i++)
+        put_byte(bs, 0);
+    put_uint64(bs, final_lenhi);
+    put_uint64(bs, final_lenlo);
+
+    assert(blk->used == 0 && "Should have exactly hit a block boundary");
+}
+
+static inline uint64_t ror(uint64_t x, unsigned y)
+{
+    return (x << (63 & -y)) | (x >> (63 & y));
+}
+
+static inline uint64_t Ch(uint64_t ctrl, uint64_t if1, uint64_t if0)
+{
+    return if0 ^ (ctrl & (if1 ^ if0));
+}
+
+static inline uint64_t Maj(uint64_t x, uint64_t y, uint64_t z)
+{
+    return (x & y) | (z & (x | y));
+}
+
+static inline uint64_t Sigma_0(uint64_t x)
+{
+    return ror(x,28) ^ ror(x,34) ^ ror(x,39);
+}
+
+static inline uint64_t Sigma_1(uint64_t x)
+{
+    return ror(x,14) ^ ror(x,18) ^ ror(x,41);
+}
+
+static inline uint64_t sigma_0(uint64_t x)
+{
+    return ror(x,1) ^ ror(x,8) ^ (x >> 7);
+}
+
+static inline uint64_t sigma_1(uint64_t x)
+{
+    return ror(x,19) ^ ror(x,61) ^ (x >> 6);
+}
 
 /*
- * Arithmetic implementations. Note that AND, XOR and NOT can
- * overlap destination with one source, but the others can't.
+ * One round, given the sum of the round constant and the message
+ * schedule word, which implementations computing the schedule in
+ * vector registers can prepare in bulk.
  */
-#define add(r,x,y) ( r = (x) + (y) )
-#define rorB(r,x,y) ( r = ((x) >> (y)) | ((x) << (64-(y))) )
-#define rorL(r,x,y) ( r = ((x) >> (y)) | ((x) << (64-(y))) )
-#define shrB(r,x,y) ( r = (x) >> (y) )
-#define shrL(r,x,y) ( r = (x) >> (y) )
-#define and(r,x,y) ( r = (x) & (y) )
-#define xor(r,x,y) ( r = (x) ^ (y) )
-#define not(r,x) ( r = ~(x) )
-#define INIT(h,l) ((((uint64_t)(h)) << 32) | (l))
-#define BUILD(r,h,l) ( r = ((((uint64_t)(h)) << 32) | (l)) )
-#define EXTRACT(h,l,r) ( h = (r) >> 32, l = (r) & 0xFFFFFFFFU )
+static inline void sha512_round(
+    uint64_t round_input,
+    uint64_t *a, uint64_t *b, uint64_t *c, uint64_t *d,
+    uint64_t *e, uint64_t *f, uint64_t *g, uint64_t *h)
+{
+    uint64_t t1 = *h + Sigma_1(*e) + Ch(*e,*f,*g) + round_input;
+
+    uint64_t t2 = Sigma_0(*a) + Maj(*a,*b,*c);
+
+    *d += t1;
+    *h = t1 + t2;
+}
 
 /* ----------------------------------------------------------------------
- * Core SHA512 algorithm: processes 16-doubleword blocks into a
- * message digest.
+ * Software implementation of SHA-512.
  */
 
-#define Ch(r,t,x,y,z) ( not(t,x), and(r,t,z), and(t,x,y), xor(r,r,t) )
-#define Maj(r,t,x,y,z) ( and(r,x,y), and(t,x,z), xor(r,r,t), \
-                         and(t,y,z), xor(r,r,t) )
-#define bigsigma0(r,t,x) ( rorL(r,x,28), rorB(t,x,34), xor(r,r,t), \
-                           rorB(t,x,39), xor(r,r,t) )
-#define bigsigma1(r,t,x) ( rorL(r,x,14), rorL(t,x,18), xor(r,r,t), \
-                           rorB(t,x,41), xor(r,r,t) )
-#define smallsigma0(r,t,x) ( rorL(r,x,1), rorL(t,x,8), xor(r,r,t), \
-                             shrL(t,x,7), xor(r,r,t) )
-#define smallsigma1(r,t,x) ( rorL(r,x,19), rorB(t,x,61), xor(r,r,t), \
-                             shrL(t,x,6), xor(r,r,t) )
-
-static void SHA512_Core_Init(SHA512_State *s) {
-    static const uint64_t iv[] = {
-        INIT(0x6a09e667, 0xf3bcc908),
-        INIT(0xbb67ae85, 0x84caa73b),
-        INIT(0x3c6ef372, 0xfe94f82b),
-        INIT(0xa54ff53a, 0x5f1d36f1),
-        INIT(0x510e527f, 0xade682d1),
-        INIT(0x9b05688c, 0x2b3e6c1f),
-        INIT(0x1f83d9ab, 0xfb41bd6b),
-        INIT(0x5be0cd19, 0x137e2179),
-    };
-    int i;
-    for (i = 0; i < 8; i++)
-        s->h[i] = iv[i];
-}
-
-static void SHA384_Core_Init(SHA512_State *s) {
-    static const uint64_t iv[] = {
-        INIT(0xcbbb9d5d, 0xc1059ed8),
-        INIT(0x629a292a, 0x367cd507),
-        INIT(0x9159015a, 0x3070dd17),
-        INIT(0x152fecd8, 0xf70e5939),
-        INIT(0x67332667, 0xffc00b31),
-        INIT(0x8eb44a87, 0x68581511),
-        INIT(0xdb0c2e0d, 0x64f98fa7),
-        INIT(0x47b5481d, 0xbefa4fa4),
-    };
-    int i;
-    for (i = 0; i < 8; i++)
-        s->h[i] = iv[i];
-}
-
-static void SHA512_Block(SHA512_State *s, uint64_t *block) {
-    uint64_t w[80];
+static void sha512_sw_block(uint64_t *core, const uint8_t *block)
+{
+    uint64_t w[SHA512_ROUNDS];
     uint64_t a,b,c,d,e,f,g,h;
-    static const uint64_t k[] = {
-        INIT(0x428a2f98, 0xd728ae22), INIT(0x71374491, 0x23ef65cd),
-        INIT(0xb5c0fbcf, 0xec4d3b2f), INIT(0xe9b5dba5, 0x8189dbbc),
-        INIT(0x3956c25b, 0xf348b538), INIT(0x59f111f1, 0xb605d019),
-        INIT(0x923f82a4, 0xaf194f9b), INIT(0xab1c5ed5, 0xda6d8118),
-        INIT(0xd807aa98, 0xa3030242), INIT(0x12835b01, 0x45706fbe),
-        INIT(0x243185be, 0x4ee4b28c), INIT(0x550c7dc3, 0xd5ffb4e2),
-        INIT(0x72be5d74, 0xf27b896f), INIT(0x80deb1fe, 0x3b1696b1),
-        INIT(0x9bdc06a7, 0x25c71235), INIT(0xc19bf174, 0xcf692694),
-        INIT(0xe49b69c1, 0x9ef14ad2), INIT(0xefbe4786, 0x384f25e3),
-        INIT(0x0fc19dc6, 0x8b8cd5b5), INIT(0x240ca1cc, 0x77ac9c65),
-        INIT(0x2de92c6f, 0x592b0275), INIT(0x4a7484aa, 0x6ea6e483),
-        INIT(0x5cb0a9dc, 0xbd41fbd4), INIT(0x76f988da, 0x831153b5),
-        INIT(0x983e5152, 0xee66dfab), INIT(0xa831c66d, 0x2db43210),
-        INIT(0xb00327c8, 0x98fb213f), INIT(0xbf597fc7, 0xbeef0ee4),
-        INIT(0xc6e00bf3, 0x3da88fc2), INIT(0xd5a79147, 0x930aa725),
-        INIT(0x06ca6351, 0xe003826f), INIT(0x14292967, 0x0a0e6e70),
-        INIT(0x27b70a85, 0x46d22ffc), INIT(0x2e1b2138, 0x5c26c926),
-        INIT(0x4d2c6dfc, 0x5ac42aed), INIT(0x53380d13, 0x9d95b3df),
-        INIT(0x650a7354, 0x8baf63de), INIT(0x766a0abb, 0x3c77b2a8),
-        INIT(0x81c2c92e, 0x47edaee6), INIT(0x92722c85, 0x1482353b),
-        INIT(0xa2bfe8a1, 0x4cf10364), INIT(0xa81a664b, 0xbc423001),
-        INIT(0xc24b8b70, 0xd0f89791), INIT(0xc76c51a3, 0x0654be30),
-        INIT(0xd192e819, 0xd6ef5218), INIT(0xd6990624, 0x5565a910),
-        INIT(0xf40e3585, 0x5771202a), INIT(0x106aa070, 0x32bbd1b8),
-        INIT(0x19a4c116, 0xb8d2d0c8), INIT(0x1e376c08, 0x5141ab53),
-        INIT(0x2748774c, 0xdf8eeb99), INIT(0x34b0bcb5, 0xe19b48a8),
-        INIT(0x391c0cb3, 0xc5c95a63), INIT(0x4ed8aa4a, 0xe3418acb),
-        INIT(0x5b9cca4f, 0x7763e373), INIT(0x682e6ff3, 0xd6b2b8a3),
-        INIT(0x748f82ee, 0x5defb2fc), INIT(0x78a5636f, 0x43172f60),
-        INIT(0x84c87814, 0xa1f0ab72), INIT(0x8cc70208, 0x1a6439ec),
-        INIT(0x90befffa, 0x23631e28), INIT(0xa4506ceb, 0xde82bde9),
-        INIT(0xbef9a3f7, 0xb2c67915), INIT(0xc67178f2, 0xe372532b),
-        INIT(0xca273ece, 0xea26619c), INIT(0xd186b8c7, 0x21c0c207),
-        INIT(0xeada7dd6, 0xcde0eb1e), INIT(0xf57d4f7f, 0xee6ed178),
-        INIT(0x06f067aa, 0x72176fba), INIT(0x0a637dc5, 0xa2c898a6),
-        INIT(0x113f9804, 0xbef90dae), INIT(0x1b710b35, 0x131c471b),
-        INIT(0x28db77f5, 0x23047d84), INIT(0x32caab7b, 0x40c72493),
-        INIT(0x3c9ebe0a, 0x15c9bebc), INIT(0x431d67c4, 0x9c100d4c),
-        INIT(0x4cc5d4be, 0xcb3e42b6), INIT(0x597f299c, 0xfc657e2a),
-        INIT(0x5fcb6fab, 0x3ad6faec), INIT(0x6c44198c, 0x4a475817),
-    };
-
-    int t;
-
-    for (t = 0; t < 16; t++)
-        w[t] = block[t];
-
-    for (t = 16; t < 80; t++) {
-        uint64_t p, q, r, tmp;
-        smallsigma1(p, tmp, w[t-2]);
-        smallsigma0(q, tmp, w[t-15]);
-        add(r, p, q);
-        add(p, r, w[t-7]);
-        add(w[t], p, w[t-16]);
-    }
 
-    a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
-    e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
-
-    for (t = 0; t < 80; t+=8) {
-        uint64_t tmp, p, q, r;
-
-#define ROUND(j,a,b,c,d,e,f,g,h) \
-        bigsigma1(p, tmp, e); \
-        Ch(q, tmp, e, f, g); \
-        add(r, p, q); \
-        add(p, r, k[j]) ; \
-        add(q, p, w[j]); \
-        add(r, q, h); \
-        bigsigma0(p, tmp, a); \
-        Maj(tmp, q, a, b, c); \
-        add(q, tmp, p); \
-        add(p, r, d); \
-        d = p; \
-        add(h, q, r);
-
-        ROUND(t+0, a,b,c,d,e,f,g,h);
-        ROUND(t+1, h,a,b,c,d,e,f,g);
-        ROUND(t+2, g,h,a,b,c,d,e,f);
-        ROUND(t+3, f,g,h,a,b,c,d,e);
-        ROUND(t+4, e,f,g,h,a,b,c,d);
-        ROUND(t+5, d,e,f,g,h,a,b,c);
-        ROUND(t+6, c,d,e,f,g,h,a,b);
-        ROUND(t+7, b,c,d,e,f,g,h,a);
+    for (size_t t = 0; t < 16; t++)
+        w[t] = GET_64BIT_MSB_FIRST(block + 8*t);
+
+    for (size_t t = 16; t < SHA512_ROUNDS; t++)
+        w[t] = sigma_1(w[t-2]) + w[t-7] + sigma_0(w[t-15]) + w[t-16];
+
+    a = core[0]; b = core[1]; c = core[2]; d = core[3];
+    e = core[4]; f = core[5]; g = core[6]; h = core[7];
+
+    for (size_t t = 0; t < SHA512_ROUNDS; t += 8) {
+        const uint64_t *k = sha512_round_constants + t;
+        sha512_round(k[0] + w[t+0], &a,&b,&c,&d,&e,&f,&g,&h);
+        sha512_round(k[1] + w[t+1], &h,&a,&b,&c,&d,&e,&f,&g);
+        sha512_round(k[2] + w[t+2], &g,&h,&a,&b,&c,&d,&e,&f);
+        sha512_round(k[3] + w[t+3], &f,&g,&h,&a,&b,&c,&d,&e);
+        sha512_round(k[4] + w[t+4], &e,&f,&g,&h,&a,&b,&c,&d);
+        sha512_round(k[5] + w[t+5], &d,&e,&f,&g,&h,&a,&b,&c);
+        sha512_round(k[6] + w[t+6], &c,&d,&e,&f,&g,&h,&a,&b);
+        sha512_round(k[7] + w[t+7], &b,&c,&d,&e,&f,&g,&h,&a);
     }
 
-    {
-        uint64_t tmp;
-#define UPDATE(state, local) ( tmp = state, add(state, tmp, local) )
-        UPDATE(s->h[0], a); UPDATE(s->h[1], b);
-        UPDATE(s->h[2], c); UPDATE(s->h[3], d);
-        UPDATE(s->h[4], e); UPDATE(s->h[5], f);
-        UPDATE(s->h[6], g); UPDATE(s->h[7], h);
-    }
+    core[0] += a; core[1] += b; core[2] += c; core[3] += d;
+    core[4] += e; core[5] += f; core[6] += g; core[7] += h;
+
+    smemclr(w, sizeof(w));
 }
 
+typedef struct sha512_sw {
+    uint64_t core[8];
+    sha512_block blk;
+    BinarySink_IMPLEMENTATION;
+    ssh_hash hash;
+} sha512_sw;
+
+static void sha512_sw_write(BinarySink *bs, const void *vp, size_t len);
+
+static ssh_hash *sha512_sw_new(const ssh_hashalg *alg)
+{
+    sha512_sw *s = snew(sha512_sw);
+
+    memcpy(s->core, sha512_initial_state_for(alg), sizeof(s->core));
+
+    sha512_block_setup(&s->blk);
+
+    s->hash.vt = alg;
+    BinarySink_INIT(s, sha512_sw_write);
+    BinarySink_DELEGATE_INIT(&s->hash, s);
+    return &s->hash;
+}
+
+static ssh_hash *sha512_sw_copy(ssh_hash *hash)
+{
+    sha512_sw *s = container_of(hash, sha512_sw, hash);
+    sha512_sw *copy = snew(sha512_sw);
+
+    memcpy(copy, s, sizeof(*copy));
+    BinarySink_COPIED(copy);
+    BinarySink_DELEGATE_INIT(&copy->hash, copy);
+
+    return &copy->hash;
+}
+
+static void sha512_sw_free(ssh_hash *hash)
+{
+    sha512_sw *s = container_of(hash, sha512_sw, hash);
+
+    smemclr(s, sizeof(*s));
+    sfree(s);
+}
+
+static void sha512_sw_write(BinarySink *bs, const void *vp, size_t len)
+{
+    sha512_sw *s = BinarySink_DOWNCAST(bs, sha512_sw);
+
+    while (len > 0)
+        if (sha512_block_write(&s->blk, &vp, &len))
+            sha512_sw_block(s->core, s->blk.block);
+}
+
+static void sha512_sw_final(ssh_hash *hash, uint8_t *digest)
+{
+    sha512_sw *s = container_of(hash, sha512_sw, hash);
+
+    sha512_block_pad(&s->blk, BinarySink_UPCAST(s));
+    for (size_t i = 0; i < hash->vt->hlen / 8; i++)
+        PUT_64BIT_MSB_FIRST(digest + 8*i, s->core[i]);
+    sha512_sw_free(hash);
+}
+
+const ssh_hashalg ssh_sha512_sw = {
+    sha512_sw_new, sha512_sw_copy, sha512_sw_final, sha512_sw_free,
+    64, 128, HASHALG_NAMES_ANNOTATED("SHA-512", "unaccelerated"),
+};
+
+const ssh_hashalg ssh_sha384_sw = {
+    sha512_sw_new, sha512_sw_copy, sha512_sw_final, sha512_sw_free,
+    48, 128, HASHALG_NAMES_ANNOTATED("SHA-384", "unaccelerated"),
+};
+
 /* ----------------------------------------------------------------------
- * Outer SHA512 algorithm: take an arbitrary length byte string,
- * convert it into 16-doubleword blocks with the prescribed padding
- * at the end, and pass those blocks to the core SHA512 algorithm.
+ * Implementation of SHA-512 computing the message schedule with AVX2.
  */
 
-static void SHA512_BinarySink_write(BinarySink *bs,
-                                    const void *p, size_t len);
+#if HW_SHA512 == HW_SHA512_AVX2
 
-void SHA512_Init(SHA512_State *s) {
-    SHA512_Core_Init(s);
-    s->blkused = 0;
-    s->lenhi = s->lenlo = 0;
-    BinarySink_INIT(s, SHA512_BinarySink_write);
+/*
+ * Set target architecture for Clang and GCC
+ */
+#if defined(__clang__) || defined(__GNUC__)
+#    define FUNC_ISA __attribute__ ((target("avx2,bmi2")))
+#if !defined(__clang__)
+#    pragma GCC target("avx2")
+#    pragma GCC target("bmi2")
+#endif
+#else
+#    define FUNC_ISA
+#endif
+
+#include <immintrin.h>
+
+#if defined(__clang__) || defined(__GNUC__)
+#include <cpuid.h>
+#define GET_CPU_ID_0(out)                               \
+    __cpuid(0, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_1(out)                               \
+    __cpuid(1, (out)[0], (out)[1], (out)[2], (out)[3])
+#define GET_CPU_ID_7(out)                                       \
+    __cpuid_count(7, 0, (out)[0], (out)[1], (out)[2], (out)[3])
+static inline uint64_t get_xcr0(void)
+{
+    unsigned int lo, hi;
+    __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+#define GET_CPU_ID_0(out) __cpuid(out, 0)
+#define GET_CPU_ID_1(out) __cpuid(out, 1)
+#define GET_CPU_ID_7(out) __cpuidex(out, 7, 0)
+#define get_xcr0() _xgetbv(0)
+#endif
+
+static bool sha512_hw_available(void)
+{
+    unsigned int CPUInfo[4];
+    GET_CPU_ID_0(CPUInfo);
+    if (CPUInfo[0] < 7)
+        return false;
+
+    /* The OS has to save the upper halves of the YMM registers */
+    GET_CPU_ID_1(CPUInfo);
+    if (!(CPUInfo[2] & (1 << 27)) || !(CPUInfo[2] & (1 << 28)))
+        return false; /* Check OSXSAVE and AVX */
+    if ((get_xcr0() & 6) != 6)
+        return false;
+
+    GET_CPU_ID_7(CPUInfo);
+    return (CPUInfo[1] & (1 << 5)) && /* Check AVX2 */
+        (CPUInfo[1] & (1 << 8)); /* Check BMI2 */
 }
 
-void SHA384_Init(SHA512_State *s) {
-    SHA384_Core_Init(s);
-    s->blkused = 0;
-    s->lenhi = s->lenlo = 0;
-    BinarySink_INIT(s, SHA512_BinarySink_write);
+#define SHA512_AVX2_ROR(x, n)                                   \
+    _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+
+FUNC_ISA
+static inline __m256i sha512_avx2_sigma_0(__m256i x)
+{
+    return _mm256_xor_si256(
+        _mm256_xor_si256(SHA512_AVX2_ROR(x, 1), SHA512_AVX2_ROR(x, 8)),
+        _mm256_srli_epi64(x, 7));
 }
 
-static void SHA512_BinarySink_write(BinarySink *bs,
-                                    const void *p, size_t len)
+FUNC_ISA
+static inline __m256i sha512_avx2_sigma_1(__m256i x)
 {
-    SHA512_State *s = BinarySink_DOWNCAST(bs, SHA512_State);
-    unsigned char *q = (unsigned char *)p;
-    uint64_t wordblock[16];
-    int i;
+    return _mm256_xor_si256(
+        _mm256_xor_si256(SHA512_AVX2_ROR(x, 19), SHA512_AVX2_ROR(x, 61)),
+        _mm256_srli_epi64(x, 6));
+}
 
-    /*
-     * Update the length field.
-     */
-    s->lenlo += len;
-    s->lenhi += (s->lenlo < len);
-
-    if (s->blkused && s->blkused+len < BLKSIZE) {
-        /*
-         * Trivial case: just add to the block.
-         */
-        memcpy(s->block + s->blkused, q, len);
-        s->blkused += len;
-    } else {
-        /*
-         * We must complete and process at least one block.
-         */
-        while (s->blkused + len >= BLKSIZE) {
-            memcpy(s->block + s->blkused, q, BLKSIZE - s->blkused);
-            q += BLKSIZE - s->blkused;
-            len -= BLKSIZE - s->blkused;
-            /* Now process the block. Gather bytes big-endian into words */
-            for (i = 0; i < 16; i++)
-                wordblock[i] = GET_64BIT_MSB_FIRST(s->block + i*8);
-            SHA512_Block(s, wordblock);
-            s->blkused = 0;
-        }
-        memcpy(s->block, q, len);
-        s->blkused = len;
+/*
+ * Computes the message schedule of two blocks, with the round
+ * constants already added. Each vector holds two consecutive schedule
+ * words of the first block in its low 128-bit lane and the same two
+ * words of the second block in its high lane. Since the byte shifts
+ * of AVX2 work within lanes, both blocks are processed by the same
+ * instructions without ever mixing.
+ *
+ * Afterwards, wk[t/2][t%2] is the input to round t of the first
+ * block, wk[t/2][2 + t%2] that of the second one.
+ */
+FUNC_ISA
+static inline void sha512_avx2_schedule(
+    uint64_t (*wk)[4], const uint8_t *p0, const uint8_t *p1)
+{
+    __m256i x[SHA512_ROUNDS / 2];
+    const __m256i bswap = _mm256_setr_epi8(
+        7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+        7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+
+    for (size_t i = 0; i < 8; i++) {
+        __m256i in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *)(p0 + 16*i))),
+            _mm_loadu_si128((const __m128i *)(p1 + 16*i)), 1);
+        x[i] = _mm256_shuffle_epi8(in, bswap);
+    }
+
+    for (size_t i = 8; i < SHA512_ROUNDS / 2; i++) {
+        /* w[t-15],w[t-14] and w[t-7],w[t-6] straddle two vectors */
+        __m256i w15 = _mm256_alignr_epi8(x[i-7], x[i-8], 8);
+        __m256i w7 = _mm256_alignr_epi8(x[i-3], x[i-4], 8);
+        x[i] = _mm256_add_epi64(
+            _mm256_add_epi64(sha512_avx2_sigma_1(x[i-1]), w7),
+            _mm256_add_epi64(sha512_avx2_sigma_0(w15), x[i-8]));
+    }
+
+    for (size_t i = 0; i < SHA512_ROUNDS / 2; i++) {
+        __m128i k = _mm_loadu_si128(
+            (const __m128i *)(sha512_round_constants + 2*i));
+        __m256i kk = _mm256_inserti128_si256(_mm256_castsi128_si256(k), k, 1);
+        _mm256_storeu_si256((__m256i *)wk[i], _mm256_add_epi64(x[i], kk));
     }
+
+    smemclr(x, sizeof(x));
 }
 
-void SHA512_Final(SHA512_State *s, unsigned char *digest) {
-    int i;
-    int pad;
-    unsigned char c[BLKSIZE];
-    uint64_t lenhi, lenlo;
+FUNC_ISA
+static inline void sha512_avx2_rounds(
+    uint64_t *core, const uint64_t (*wk)[4], unsigned lane)
+{
+    uint64_t a,b,c,d,e,f,g,h;
 
-    if (s->blkused >= BLKSIZE-16)
-        pad = (BLKSIZE-16) + BLKSIZE - s->blkused;
-    else
-        pad = (BLKSIZE-16) - s->blkused;
+    a = core[0]; b = core[1]; c = core[2]; d = core[3];
+    e = core[4]; f = core[5]; g = core[6]; h = core[7];
+
+    for (size_t i = 0; i < SHA512_ROUNDS / 2; i += 4) {
+        const uint64_t *w0 = wk[i] + 2*lane, *w1 = wk[i+1] + 2*lane;
+        const uint64_t *w2 = wk[i+2] + 2*lane, *w3 = wk[i+3] + 2*lane;
+        sha512_round(w0[0], &a,&b,&c,&d,&e,&f,&g,&h);
+        sha512_round(w0[1], &h,&a,&b,&c,&d,&e,&f,&g);
+        sha512_round(w1[0], &g,&h,&a,&b,&c,&d,&e,&f);
+        sha512_round(w1[1], &f,&g,&h,&a,&b,&c,&d,&e);
+        sha512_round(w2[0], &e,&f,&g,&h,&a,&b,&c,&d);
+        sha512_round(w2[1], &d,&e,&f,&g,&h,&a,&b,&c);
+        sha512_round(w3[0], &c,&d,&e,&f,&g,&h,&a,&b);
+        sha512_round(w3[1], &b,&c,&d,&e,&f,&g,&h,&a);
+    }
 
-    lenhi = (s->lenhi << 3) | (s->lenlo >> (32-3));
-    lenlo = (s->lenlo << 3);
+    core[0] += a; core[1] += b; core[2] += c; core[3] += d;
+    core[4] += e; core[5] += f; core[6] += g; core[7] += h;
+}
 
-    memset(c, 0, pad);
-    c[0] = 0x80;
-    put_data(s, &c, pad);
+/* Hashes two consecutive blocks, p0 first */
+FUNC_ISA
+static void sha512_avx2_block2(
+    uint64_t *core, const uint8_t *p0, const uint8_t *p1)
+{
+    uint64_t wk[SHA512_ROUNDS / 2][4];
 
-    put_uint64(s, lenhi);
-    put_uint64(s, lenlo);
+    sha512_avx2_schedule(wk, p0, p1);
+    sha512_avx2_rounds(core, wk, 0);
+    sha512_avx2_rounds(core, wk, 1);
 
-    for (i = 0; i < 8; i++)
-        PUT_64BIT_MSB_FIRST(digest + i*8, s->h[i]);
+    smemclr(wk, sizeof(wk));
 }
 
-void SHA384_Final(SHA512_State *s, unsigned char *digest) {
-    unsigned char biggerDigest[512 / 8];
-    SHA512_Final(s, biggerDigest);
-    memcpy(digest, biggerDigest, 384 / 8);
+/* A single block still goes through the vector schedule, in one lane */
+FUNC_ISA
+static void sha512_avx2_block(uint64_t *core, const uint8_t *p)
+{
+    uint64_t wk[SHA512_ROUNDS / 2][4];
+
+    sha512_avx2_schedule(wk, p, p);
+    sha512_avx2_rounds(core, wk, 0);
+
+    smemclr(wk, sizeof(wk));
 }
 
-void SHA512_Simple(const void *p, int len, unsigned char *output) {
-    SHA512_State s;
+typedef struct sha512_avx2 {
+    uint64_t core[8];
+    sha512_block blk;
+    BinarySink_IMPLEMENTATION;
+    ssh_hash hash;
+} sha512_avx2;
+
+static void sha512_avx2_write(BinarySink *bs, const void *vp, size_t len);
+
+static ssh_hash *sha512_avx2_new(const ssh_hashalg *alg)
+{
+    if (!sha512_hw_available_cached())
+        return NULL;
+
+    sha512_avx2 *s = snew(sha512_avx2);
 
-    SHA512_Init(&s);
-    put_data(&s, p, len);
-    SHA512_Final(&s, output);
-    smemclr(&s, sizeof(s));
+    memcpy(s->core, sha512_initial_state_for(alg), sizeof(s->core));
+
+    sha512_block_setup(&s->blk);
+
+    s->hash.vt = alg;
+    BinarySink_INIT(s, sha512_avx2_write);
+    BinarySink_DELEGATE_INIT(&s->hash, s);
+    return &s->hash;
 }
 
-void SHA384_Simple(const void *p, int len, unsigned char *output) {
-    SHA512_State s;
+static ssh_hash *sha512_avx2_copy(ssh_hash *hash)
+{
+    sha512_avx2 *s = container_of(hash, sha512_avx2, hash);
+    sha512_avx2 *copy = snew(sha512_avx2);
+
+    memcpy(copy, s, sizeof(*copy));
+    BinarySink_COPIED(copy);
+    BinarySink_DELEGATE_INIT(&copy->hash, copy);
 
-    SHA384_Init(&s);
-    put_data(&s, p, len);
-    SHA384_Final(&s, output);
-    smemclr(&s, sizeof(s));
+    return &copy->hash;
 }
 
+static void sha512_avx2_free(ssh_hash *hash)
+{
+    sha512_avx2 *s = container_of(hash, sha512_avx2, hash);
+
+    smemclr(s, sizeof(*s));
+    sfree(s);
+}
+
+static void sha512_avx2_write(BinarySink *bs, const void *vp, size_t len)
+{
+    sha512_avx2 *s = BinarySink_DOWNCAST(bs, sha512_avx2);
+
+    while (len > 0) {
+        if (!s->blk.used && len >= 2 * SHA512_BLOCK_SIZE) {
+            /* Whole pairs of blocks are hashed straight from the input */
+            const uint8_t *p = vp;
+            sha512_avx2_block2(s->core, p, p + SHA512_BLOCK_SIZE);
+            sha512_block_count(&s->blk, 2 * SHA512_BLOCK_SIZE);
+            vp = p + 2 * SHA512_BLOCK_SIZE;
+            len -= 2 * SHA512_BLOCK_SIZE;
+        } else if (sha512_block_write(&s->blk, &vp, &len)) {
+            sha512_avx2_block(s->core, s->blk.block);
+        }
+    }
+}
+
+static void sha512_avx2_final(ssh_hash *hash, uint8_t *digest)
+{
+    sha512_avx2 *s = container_of(hash, sha512_avx2, hash);
+
+    sha512_block_pad(&s->blk, BinarySink_UPCAST(s));
+    for (size_t i = 0; i < hash->vt->hlen / 8; i++)
+        PUT_64BIT_MSB_FIRST(digest + 8*i, s->core[i]);
+    sha512_avx2_free(hash);
+}
+
+const ssh_hashalg ssh_sha512_hw = {
+    sha512_avx2_new, sha512_avx2_copy, sha512_avx2_final, sha512_avx2_free,
+    64, 128, HASHALG_NAMES_ANNOTATED("SHA-512", "AVX2 accelerated"),
+};
+
+const ssh_hashalg ssh_sha384_hw = {
+    sha512_avx2_new, sha512_avx2_copy, sha512_avx2_final, sha512_avx2_free,
+    48, 128, HASHALG_NAMES_ANNOTATED("SHA-384", "AVX2 accelerated"),
+};
+
+/* ----------------------------------------------------------------------
+ * Hardware-accelerated implementation of SHA-512 using the Armv8.2
+ * SHA-512 extension.
+ */
+
+#elif HW_SHA512 == HW_SHA512_NEON
+
 /*
- * Thin abstraction for things where hashes are pluggable.
+ * Manually set the target architecture, if we decided above that we
+ * need to.
  */
+#ifdef USE_CLANG_ATTR_TARGET_AARCH64
+/*
+ * A spot of cheating: redefine some ACLE feature macros before
+ * including arm_neon.h. Otherwise we won't get the SHA intrinsics
+ * defined by that header, because it will be looking at the settings
+ * for the whole translation unit rather than the ones we're going to
+ * put on some particular functions using __attribute__((target)).
+ */
+#define __ARM_NEON 1
+#define __ARM_FEATURE_CRYPTO 1
+#define __ARM_FEATURE_SHA512 1
+#define FUNC_ISA __attribute__ ((target("neon,sha3")))
+#endif /* USE_CLANG_ATTR_TARGET_AARCH64 */
 
-struct sha512_hash {
-    SHA512_State state;
-    ssh_hash hash;
+#ifndef FUNC_ISA
+#define FUNC_ISA
+#endif
+
+#include <arm_neon.h>
+
+static bool sha512_hw_available(void)
+{
+    /*
+     * For Arm, we delegate to a per-platform detection function (see
+     * explanation in sshaes.c).
+     */
+    return platform_sha512_hw_available();
+}
+
+/*
+ * The state is kept in four vectors, each holding two consecutive
+ * words with the earlier one in the low half.
+ */
+typedef struct sha512_neon_core sha512_neon_core;
+struct sha512_neon_core {
+    uint64x2_t ab, cd, ef, gh;
 };
 
-static ssh_hash *sha512_new(const ssh_hashalg *alg)
+FUNC_ISA
+static inline uint64x2_t sha512_neon_load_input(const uint8_t *p)
+{
+    return vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(p)));
+}
+
+/*
+ * Computes two new schedule words from the vectors 8, 7, 4, 3 and 1
+ * positions back. vsha512su1q_u64 wants w[t-7],w[t-6], which straddle
+ * two vectors, so these get combined with vextq_u64 first.
+ */
+FUNC_ISA
+static inline uint64x2_t sha512_neon_schedule_update(
+    uint64x2_t m8, uint64x2_t m7, uint64x2_t m4, uint64x2_t m3, uint64x2_t m1)
+{
+    return vsha512su1q_u64(vsha512su0q_u64(m8, m7), m1, vextq_u64(m4, m3, 1));
+}
+
+/*
+ * Two rounds. vsha512hq_u64 does the Sigma_1 and Ch halves and
+ * vsha512h2q_u64 the Sigma_0 and Maj halves, producing the new gh;
+ * the intermediate value gets added to cd. Both instructions expect
+ * some of their inputs misaligned by one word relative to the way the
+ * state is stored, including the round input, whose words have to be
+ * the other way round.
+ */
+FUNC_ISA
+static inline void sha512_neon_round2(
+    unsigned round_index, uint64x2_t schedule_words,
+    uint64x2_t *ab, uint64x2_t *cd, uint64x2_t *ef, uint64x2_t *gh)
+{
+    uint64x2_t round_constants = vld1q_u64(
+        sha512_round_constants + round_index);
+    uint64x2_t initial_sum = vaddq_u64(schedule_words, round_constants);
+    uint64x2_t swapped_initial_sum = vextq_u64(initial_sum, initial_sum, 1);
+    uint64x2_t sum = vaddq_u64(swapped_initial_sum, *gh);
+
+    uint64x2_t de = vextq_u64(*cd, *ef, 1);
+    uint64x2_t fg = vextq_u64(*ef, *gh, 1);
+
+    uint64x2_t intermed = vsha512hq_u64(sum, fg, de);
+    *gh = vsha512h2q_u64(intermed, *cd, *ab);
+    *cd = vaddq_u64(*cd, intermed);
+}
+
+FUNC_ISA
+static inline void sha512_neon_block(sha512_neon_core *core, const uint8_t *p)
 {
-    struct sha512_hash *h = snew(struct sha512_hash);
-    SHA512_Init(&h->state);
-    h->hash.vt = alg;
-    BinarySink_DELEGATE_INIT(&h->hash, &h->state);
-    return &h->hash;
+    uint64x2_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    uint64x2_t ab = core->ab, cd = core->cd, ef = core->ef, gh = core->gh;
+
+    s0 = sha512_neon_load_input(p + 16*0);
+    sha512_neon_round2(0, s0, &ab, &cd, &ef, &gh);
+    s1 = sha512_neon_load_input(p + 16*1);
+    sha512_neon_round2(2, s1, &gh, &ab, &cd, &ef);
+    s2 = sha512_neon_load_input(p + 16*2);
+    sha512_neon_round2(4, s2, &ef, &gh, &ab, &cd);
+    s3 = sha512_neon_load_input(p + 16*3);
+    sha512_neon_round2(6, s3, &cd, &ef, &gh, &ab);
+    s4 = sha512_neon_load_input(p + 16*4);
+    sha512_neon_round2(8, s4, &ab, &cd, &ef, &gh);
+    s5 = sha512_neon_load_input(p + 16*5);
+    sha512_neon_round2(10, s5, &gh, &ab, &cd, &ef);
+    s6 = sha512_neon_load_input(p + 16*6);
+    sha512_neon_round2(12, s6, &ef, &gh, &ab, &cd);
+    s7 = sha512_neon_load_input(p + 16*7);
+    sha512_neon_round2(14, s7, &cd, &ef, &gh, &ab);
+
+    for (unsigned round = 16; round < SHA512_ROUNDS; round += 16) {
+        s0 = sha512_neon_schedule_update(s0, s1, s4, s5, s7);
+        sha512_neon_round2(round + 0, s0, &ab, &cd, &ef, &gh);
+        s1 = sha512_neon_schedule_update(s1, s2, s5, s6, s0);
+        sha512_neon_round2(round + 2, s1, &gh, &ab, &cd, &ef);
+        s2 = sha512_neon_schedule_update(s2, s3, s6, s7, s1);
+        sha512_neon_round2(round + 4, s2, &ef, &gh, &ab, &cd);
+        s3 = sha512_neon_schedule_update(s3, s4, s7, s0, s2);
+        sha512_neon_round2(round + 6, s3, &cd, &ef, &gh, &ab);
+        s4 = sha512_neon_schedule_update(s4, s5, s0, s1, s3);
+        sha512_neon_round2(round + 8, s4, &ab, &cd, &ef, &gh);
+        s5 = sha512_neon_schedule_update(s5, s6, s1, s2, s4);
+        sha512_neon_round2(round + 10, s5, &gh, &ab, &cd, &ef);
+        s6 = sha512_neon_schedule_update(s6, s7, s2, s3, s5);
+        sha512_neon_round2(round + 12, s6, &ef, &gh, &ab, &cd);
+        s7 = sha512_neon_schedule_update(s7, s0, s3, s4, s6);
+        sha512_neon_round2(round + 14, s7, &cd, &ef, &gh, &ab);
+    }
+
+    core->ab = vaddq_u64(core->ab, ab);
+    core->cd = vaddq_u64(core->cd, cd);
+    core->ef = vaddq_u64(core->ef, ef);
+    core->gh = vaddq_u64(core->gh, gh);
 }
 
-static ssh_hash *sha512_copy(ssh_hash *hashold)
+typedef struct sha512_neon {
+    sha512_neon_core core;
+    sha512_block blk;
+    BinarySink_IMPLEMENTATION;
+    ssh_hash hash;
+} sha512_neon;
+
+static void sha512_neon_write(BinarySink *bs, const void *vp, size_t len);
+
+static ssh_hash *sha512_neon_new(const ssh_hashalg *alg)
 {
-    struct sha512_hash *hold, *hnew;
-    ssh_hash *hashnew = sha512_new(hashold->vt);
+    if (!sha512_hw_available_cached())
+        return NULL;
 
-    hold = container_of(hashold, struct sha512_hash, hash);
-    hnew = container_of(hashnew, struct sha512_hash, hash);
+    sha512_neon *s = snew(sha512_neon);
 
-    hnew->state = hold->state;
-    BinarySink_COPIED(&hnew->state);
+    const uint64_t *iv = sha512_initial_state_for(alg);
+    s->core.ab = vld1q_u64(iv);
+    s->core.cd = vld1q_u64(iv + 2);
+    s->core.ef = vld1q_u64(iv + 4);
+    s->core.gh = vld1q_u64(iv + 6);
 
-    return hashnew;
+    sha512_block_setup(&s->blk);
+
+    s->hash.vt = alg;
+    BinarySink_INIT(s, sha512_neon_write);
+    BinarySink_DELEGATE_INIT(&s->hash, s);
+    return &s->hash;
 }
 
-static void sha512_free(ssh_hash *hash)
+static ssh_hash *sha512_neon_copy(ssh_hash *hash)
 {
-    struct sha512_hash *h = container_of(hash, struct sha512_hash, hash);
+    sha512_neon *s = container_of(hash, sha512_neon, hash);
+    sha512_neon *copy = snew(sha512_neon);
+
+    *copy = *s; /* structure copy */
 
-    smemclr(h, sizeof(*h));
-    sfree(h);
+    BinarySink_COPIED(copy);
+    BinarySink_DELEGATE_INIT(&copy->hash, copy);
+
+    return &copy->hash;
 }
 
-static void sha512_final(ssh_hash *hash, unsigned char *output)
+static void sha512_neon_free(ssh_hash *hash)
 {
-    struct sha512_hash *h = container_of(hash, struct sha512_hash, hash);
-    SHA512_Final(&h->state, output);
-    sha512_free(hash);
+    sha512_neon *s = container_of(hash, sha512_neon, hash);
+    smemclr(s, sizeof(*s));
+    sfree(s);
 }
 
-const ssh_hashalg ssh_sha512 = {
-    sha512_new, sha512_copy, sha512_final, sha512_free,
-    64, BLKSIZE, HASHALG_NAMES_BARE("SHA-512"),
+static void sha512_neon_write(BinarySink *bs, const void *vp, size_t len)
+{
+    sha512_neon *s = BinarySink_DOWNCAST(bs, sha512_neon);
+
+    while (len > 0)
+        if (sha512_block_write(&s->blk, &vp, &len))
+            sha512_neon_block(&s->core, s->blk.block);
+}
+
+static void sha512_neon_final(ssh_hash *hash, uint8_t *digest)
+{
+    sha512_neon *s = container_of(hash, sha512_neon, hash);
+    uint8_t buf[64];
+
+    sha512_block_pad(&s->blk, BinarySink_UPCAST(s));
+    vst1q_u8(buf,      vrev64q_u8(vreinterpretq_u8_u64(s->core.ab)));
+    vst1q_u8(buf + 16, vrev64q_u8(vreinterpretq_u8_u64(s->core.cd)));
+    vst1q_u8(buf + 32, vrev64q_u8(vreinterpretq_u8_u64(s->core.ef)));
+    vst1q_u8(buf + 48, vrev64q_u8(vreinterpretq_u8_u64(s->core.gh)));
+    memcpy(digest, buf, hash->vt->hlen);
+    smemclr(buf, sizeof(buf));
+    sha512_neon_free(hash);
+}
+
+const ssh_hashalg ssh_sha512_hw = {
+    sha512_neon_new, sha512_neon_copy, sha512_neon_final, sha512_neon_free,
+    64, 128, HASHALG_NAMES_ANNOTATED("SHA-512", "NEON accelerated"),
+};
+
+const ssh_hashalg ssh_sha384_hw = {
+    sha512_neon_new, sha512_neon_copy, sha512_neon_final, sha512_neon_free,
+    48, 128, HASHALG_NAMES_ANNOTATED("SHA-384", "NEON accelerated"),
 };
 
-static ssh_hash *sha384_new(const ssh_hashalg *alg)
+/* ----------------------------------------------------------------------
+ * Stub functions if we have no hardware-accelerated SHA-512. In this
+ * case, sha512_hw_new returns NULL (though it should also never be
+ * selected by sha512_select, so the only thing that should even be
+ * _able_ to call it is testcrypt). As a result, the remaining vtable
+ * functions should never be called at all.
+ */
+
+#elif HW_SHA512 == HW_SHA512_NONE
+
+static bool sha512_hw_available(void)
 {
-    struct sha512_hash *h = snew(struct sha512_hash);
-    SHA384_Init(&h->state);
-    h->hash.vt = alg;
-    BinarySink_DELEGATE_INIT(&h->hash, &h->state);
-    return &h->hash;
+    return false;
 }
 
-static void sha384_final(ssh_hash *hash, unsigned char *output)
+static ssh_hash *sha512_stub_new(const ssh_hashalg *alg)
 {
-    struct sha512_hash *h = container_of(hash, struct sha512_hash, hash);
-    SHA384_Final(&h->state, output);
-    sha512_free(hash);
+    return NULL;
 }
 
-const ssh_hashalg ssh_sha384 = {
-    sha384_new, sha512_copy, sha384_final, sha512_free,
-    48, BLKSIZE, HASHALG_NAMES_BARE("SHA-384"),
+#define STUB_BODY { unreachable("Should never be called"); }
+
+static ssh_hash *sha512_stub_copy(ssh_hash *hash) STUB_BODY
+static void sha512_stub_free(ssh_hash *hash) STUB_BODY
+static void sha512_stub_final(ssh_hash *hash, uint8_t *digest) STUB_BODY
+
+const ssh_hashalg ssh_sha512_hw = {
+    sha512_stub_new, sha512_stub_copy, sha512_stub_final, sha512_stub_free,
+    64, 128, HASHALG_NAMES_ANNOTATED(
+        "SHA-512", "!NONEXISTENT ACCELERATED VERSION!"),
 };
+
+const ssh_hashalg ssh_sha384_hw = {
+    sha512_stub_new, sha512_stub_copy, sha512_stub_final, sha512_stub_free,
+    48, 128, HASHALG_NAMES_ANNOTATED(
+        "SHA-384", "!NONEXISTENT ACCELERATED VERSION!"),
+};
+
+#endif /* HW_SHA512 */
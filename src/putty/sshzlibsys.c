@@ -0,0 +1,199 @@
+/*
+ * FZ: Zlib (RFC1950 / RFC1951) compression for SSH using the system
+ * zlib (or zlib-ng in compatibility mode) instead of sshzlib.c.
+ *
+ * sshzlib.c only ever emits static Huffman blocks and its LZ77 matcher
+ * is tuned for size rather than speed, so on fast links compression
+ * costs more than it saves. zlib builds dynamic trees and is a lot
+ * faster at the same time.
+ *
+ * Each packet is terminated by a sync flush, after which the stream is
+ * byte aligned at a block boundary and the peer can decompress all of
+ * it. Both directions keep their state across packets, as the protocol
+ * requires.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <zlib.h>
+
+#include "putty.h"
+#include "ssh.h"
+
+/*
+ * Level 6 is zlib's own default. Higher levels mostly cost time for
+ * little gain on the text-heavy data where compression pays off.
+ */
+#define SSH_ZLIB_LEVEL 6
+
+#define SSH_ZLIB_CHUNK 16384
+
+struct ssh_syszlib_compressor {
+    z_stream zs;
+    ssh_compressor sc;
+};
+
+struct ssh_syszlib_decompressor {
+    z_stream zs;
+    ssh_decompressor dc;
+};
+
+static voidpf syszlib_alloc(voidpf opaque, uInt items, uInt size)
+{
+    return safemalloc(items, size, 0);
+}
+
+static void syszlib_free(voidpf opaque, voidpf address)
+{
+    sfree(address);
+}
+
+static ssh_compressor *syszlib_compress_init(void)
+{
+    struct ssh_syszlib_compressor *comp =
+        snew(struct ssh_syszlib_compressor);
+
+    memset(&comp->zs, 0, sizeof(comp->zs));
+    comp->zs.zalloc = syszlib_alloc;
+    comp->zs.zfree = syszlib_free;
+    if (deflateInit(&comp->zs, SSH_ZLIB_LEVEL) != Z_OK) {
+        modalfatalbox("zlib: unable to initialise compression: %s",
+                      comp->zs.msg ? comp->zs.msg : "unknown error");
+    }
+
+    comp->sc.vt = &ssh_zlib;
+    return &comp->sc;
+}
+
+static void syszlib_compress_cleanup(ssh_compressor *sc)
+{
+    struct ssh_syszlib_compressor *comp =
+        container_of(sc, struct ssh_syszlib_compressor, sc);
+
+    deflateEnd(&comp->zs);
+    sfree(comp);
+}
+
+static void syszlib_compress_block(ssh_compressor *sc,
+                                   const unsigned char *block, int len,
+                                   unsigned char **outblock, int *outlen,
+                                   int minlen)
+{
+    struct ssh_syszlib_compressor *comp =
+        container_of(sc, struct ssh_syszlib_compressor, sc);
+    strbuf *out = strbuf_new_nm();
+    int ret;
+
+    comp->zs.next_in = (Bytef *)block;
+    comp->zs.avail_in = len;
+
+    /*
+     * With Z_SYNC_FLUSH, deflate is done once it leaves some of the
+     * output buffer unused.
+     */
+    do {
+        unsigned char *p = strbuf_append(out, SSH_ZLIB_CHUNK);
+        comp->zs.next_out = p;
+        comp->zs.avail_out = SSH_ZLIB_CHUNK;
+        ret = deflate(&comp->zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            modalfatalbox("zlib: compression failed: %s",
+                          comp->zs.msg ? comp->zs.msg : "unknown error");
+        }
+        out->len -= comp->zs.avail_out;
+    } while (comp->zs.avail_out == 0);
+
+    assert(comp->zs.avail_in == 0);
+
+    /*
+     * If asked to pad the data to a given length, append empty stored
+     * blocks (BFINAL=0, BTYPE=00, LEN=0, NLEN=0xFFFF). After a sync
+     * flush the stream is byte aligned, so they don't disturb the
+     * deflate state for the next packet.
+     */
+    while (out->len < minlen) {
+        static const unsigned char empty_block[5] = {
+            0x00, 0x00, 0x00, 0xFF, 0xFF
+        };
+        put_data(out, empty_block, sizeof(empty_block));
+    }
+
+    *outlen = out->len;
+    *outblock = (unsigned char *)strbuf_to_str(out);
+}
+
+static ssh_decompressor *syszlib_decompress_init(void)
+{
+    struct ssh_syszlib_decompressor *dcomp =
+        snew(struct ssh_syszlib_decompressor);
+
+    memset(&dcomp->zs, 0, sizeof(dcomp->zs));
+    dcomp->zs.zalloc = syszlib_alloc;
+    dcomp->zs.zfree = syszlib_free;
+    if (inflateInit(&dcomp->zs) != Z_OK) {
+        modalfatalbox("zlib: unable to initialise decompression: %s",
+                      dcomp->zs.msg ? dcomp->zs.msg : "unknown error");
+    }
+
+    dcomp->dc.vt = &ssh_zlib;
+    return &dcomp->dc;
+}
+
+static void syszlib_decompress_cleanup(ssh_decompressor *dc)
+{
+    struct ssh_syszlib_decompressor *dcomp =
+        container_of(dc, struct ssh_syszlib_decompressor, dc);
+
+    inflateEnd(&dcomp->zs);
+    sfree(dcomp);
+}
+
+static bool syszlib_decompress_block(ssh_decompressor *dc,
+                                     const unsigned char *block, int len,
+                                     unsigned char **outblock, int *outlen)
+{
+    struct ssh_syszlib_decompressor *dcomp =
+        container_of(dc, struct ssh_syszlib_decompressor, dc);
+    strbuf *out = strbuf_new_nm();
+    int ret;
+
+    dcomp->zs.next_in = (Bytef *)block;
+    dcomp->zs.avail_in = len;
+
+    do {
+        unsigned char *p = strbuf_append(out, SSH_ZLIB_CHUNK);
+        dcomp->zs.next_out = p;
+        dcomp->zs.avail_out = SSH_ZLIB_CHUNK;
+        ret = inflate(&dcomp->zs, Z_SYNC_FLUSH);
+        out->len -= dcomp->zs.avail_out;
+
+        /* Z_BUF_ERROR only means no progress was possible, i.e. all
+         * input has been consumed and all output produced. The end of
+         * the stream is never legitimately reached, the peer only
+         * flushes. */
+        if (ret == Z_BUF_ERROR)
+            break;
+        if (ret != Z_OK) {
+            strbuf_free(out);
+            return false;
+        }
+    } while (dcomp->zs.avail_in || !dcomp->zs.avail_out);
+
+    *outlen = out->len;
+    *outblock = (unsigned char *)strbuf_to_str(out);
+    return true;
+}
+
+const ssh_compression_alg ssh_zlib = {
+    "zlib",
+    "zlib@openssh.com", /* delayed version */
+    syszlib_compress_init,
+    syszlib_compress_cleanup,
+    syszlib_compress_block,
+    syszlib_decompress_init,
+    syszlib_decompress_cleanup,
+    syszlib_decompress_block,
+    "zlib (RFC1950)"
+};
@@ -0,0 +1,148 @@
+/*
+ * uxparallel.c: Unix implementation of the worker pool used to
+ * process incoming packets on more than one core.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "putty.h"
+#include "ssh.h"
+
+struct ParallelPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond, done_cond;
+
+    pthread_t *threads;
+    unsigned nthreads;
+    bool quit;
+
+    /* The current run, started whenever generation changes */
+    unsigned long generation;
+    parallel_fn_t fn;
+    void *ctx;
+    size_t next, n, unfinished;
+};
+
+/*
+ * Hands out the remaining tasks of the current run to the calling
+ * thread, one at a time. Called and returns with the mutex held.
+ */
+static void parallel_pool_work(ParallelPool *pool, unsigned lane)
+{
+    while (pool->next < pool->n) {
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->mutex);
+        pool->fn(pool->ctx, lane, i);
+        pthread_mutex_lock(&pool->mutex);
+        if (!--pool->unfinished)
+            pthread_cond_signal(&pool->done_cond);
+    }
+}
+
+struct parallel_worker {
+    ParallelPool *pool;
+    unsigned lane;
+};
+
+static void *parallel_pool_thread(void *vctx)
+{
+    struct parallel_worker *worker = (struct parallel_worker *)vctx;
+    ParallelPool *pool = worker->pool;
+    unsigned lane = worker->lane;
+    sfree(worker);
+
+    pthread_mutex_lock(&pool->mutex);
+    unsigned long seen = pool->generation;
+    while (true) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        parallel_pool_work(pool, lane);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+ParallelPool *parallel_pool_new(unsigned max_lanes)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 2 || max_lanes < 2)
+        return NULL;
+
+    unsigned lanes = (unsigned long)cpus < max_lanes ? cpus : max_lanes;
+
+    ParallelPool *pool = snew(ParallelPool);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pool->threads = snewn(lanes - 1, pthread_t);
+    pool->nthreads = 0;
+    pool->quit = false;
+    pool->generation = 0;
+    pool->fn = NULL;
+    pool->ctx = NULL;
+    pool->next = pool->n = pool->unfinished = 0;
+
+    /* Lane 0 is the thread calling parallel_pool_run */
+    for (unsigned i = 1; i < lanes; i++) {
+        struct parallel_worker *worker = snew(struct parallel_worker);
+        worker->pool = pool;
+        worker->lane = i;
+        if (pthread_create(&pool->threads[pool->nthreads], NULL,
+                           parallel_pool_thread, worker)) {
+            sfree(worker);
+            break;
+        }
+        pool->nthreads++;
+    }
+
+    if (!pool->nthreads) {
+        parallel_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+unsigned parallel_pool_lanes(ParallelPool *pool)
+{
+    return pool->nthreads + 1;
+}
+
+void parallel_pool_run(ParallelPool *pool, parallel_fn_t fn, void *ctx,
+                       size_t n)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->next = 0;
+    pool->n = pool->unfinished = n;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    parallel_pool_work(pool, 0);
+    while (pool->unfinished)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void parallel_pool_free(ParallelPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    sfree(pool->threads);
+    sfree(pool);
+}
@@ -225,6 +225,22 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     return ret;
 }
 
+WFile *open_segment_wfile(const char *name)
+{
+    int fd;
+    WFile *ret;
+
+    fd = open(name, O_WRONLY);
+    if (fd < 0)
+        return NULL;
+
+    ret = snew(WFile);
+    ret->fd = fd;
+    ret->name = dupstr(name);
+
+    return ret;
+}
+
 int write_to_file(WFile *f, void *buffer, int length)
 {
     char *p = (char *)buffer;
@@ -638,6 +654,20 @@ void frontend_net_error_pending(void) {}
 
 void platform_psftp_pre_conn_setup(void) {}
 
+void platform_detach_stdout(void)
+{
+    int fd;
+
+    fflush(stdout);
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    } else {
+        close(STDOUT_FILENO);
+    }
+}
+
 const bool buildinfo_gtk_relevant = false;
 
 /*
@@ -29,6 +29,15 @@ bool platform_sha256_hw_available(void)
 #endif
 }
 
+bool platform_sha512_hw_available(void)
+{
+#if defined HWCAP_SHA512
+    return getauxval(AT_HWCAP) & HWCAP_SHA512;
+#else
+    return false;
+#endif
+}
+
 bool platform_sha1_hw_available(void)
 {
 #if defined HWCAP_SHA1
@@ -52,6 +61,11 @@ bool platform_sha256_hw_available(void)
     return false;
 }
 
+bool platform_sha512_hw_available(void)
+{
+    return false;
+}
+
 bool platform_sha1_hw_available(void)
 {
     return false;
@@ -261,6 +261,15 @@ bool platform_sha256_hw_available(void)
     return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
 }
 
+bool platform_sha512_hw_available(void)
+{
+#ifdef PF_ARM_SHA512_INSTRUCTIONS_AVAILABLE
+    return IsProcessorFeaturePresent(PF_ARM_SHA512_INSTRUCTIONS_AVAILABLE);
+#else
+    return false;
+#endif
+}
+
 bool platform_sha1_hw_available(void)
 {
     return IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE);
@@ -0,0 +1,149 @@
+/*
+ * winparallel.c: Windows implementation of the worker pool used to
+ * process incoming packets on more than one core.
+ */
+
+#include "putty.h"
+#include "ssh.h"
+
+struct ParallelPool {
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE work_cond, done_cond;
+
+    HANDLE *threads;
+    unsigned nthreads;
+    bool quit;
+
+    /* The current run, started whenever generation changes */
+    unsigned long generation;
+    parallel_fn_t fn;
+    void *ctx;
+    size_t next, n, unfinished;
+};
+
+/*
+ * Hands out the remaining tasks of the current run to the calling
+ * thread, one at a time. Called and returns with the lock held.
+ */
+static void parallel_pool_work(ParallelPool *pool, unsigned lane)
+{
+    while (pool->next < pool->n) {
+        size_t i = pool->next++;
+        LeaveCriticalSection(&pool->lock);
+        pool->fn(pool->ctx, lane, i);
+        EnterCriticalSection(&pool->lock);
+        if (!--pool->unfinished)
+            WakeConditionVariable(&pool->done_cond);
+    }
+}
+
+struct parallel_worker {
+    ParallelPool *pool;
+    unsigned lane;
+};
+
+static DWORD WINAPI parallel_pool_thread(void *vctx)
+{
+    struct parallel_worker *worker = (struct parallel_worker *)vctx;
+    ParallelPool *pool = worker->pool;
+    unsigned lane = worker->lane;
+    sfree(worker);
+
+    EnterCriticalSection(&pool->lock);
+    unsigned long seen = pool->generation;
+    while (true) {
+        while (!pool->quit && pool->generation == seen)
+            SleepConditionVariableCS(&pool->work_cond, &pool->lock,
+                                     INFINITE);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        parallel_pool_work(pool, lane);
+    }
+    LeaveCriticalSection(&pool->lock);
+
+    return 0;
+}
+
+ParallelPool *parallel_pool_new(unsigned max_lanes)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (info.dwNumberOfProcessors < 2 || max_lanes < 2)
+        return NULL;
+
+    unsigned lanes = info.dwNumberOfProcessors < max_lanes ?
+        info.dwNumberOfProcessors : max_lanes;
+
+    ParallelPool *pool = snew(ParallelPool);
+    InitializeCriticalSection(&pool->lock);
+    InitializeConditionVariable(&pool->work_cond);
+    InitializeConditionVariable(&pool->done_cond);
+    pool->threads = snewn(lanes - 1, HANDLE);
+    pool->nthreads = 0;
+    pool->quit = false;
+    pool->generation = 0;
+    pool->fn = NULL;
+    pool->ctx = NULL;
+    pool->next = pool->n = pool->unfinished = 0;
+
+    /* Lane 0 is the thread calling parallel_pool_run */
+    for (unsigned i = 1; i < lanes; i++) {
+        struct parallel_worker *worker = snew(struct parallel_worker);
+        worker->pool = pool;
+        worker->lane = i;
+        HANDLE thread = CreateThread(NULL, 0, parallel_pool_thread,
+                                     worker, 0, NULL);
+        if (!thread) {
+            sfree(worker);
+            break;
+        }
+        pool->threads[pool->nthreads++] = thread;
+    }
+
+    if (!pool->nthreads) {
+        parallel_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+unsigned parallel_pool_lanes(ParallelPool *pool)
+{
+    return pool->nthreads + 1;
+}
+
+void parallel_pool_run(ParallelPool *pool, parallel_fn_t fn, void *ctx,
+                       size_t n)
+{
+    EnterCriticalSection(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->next = 0;
+    pool->n = pool->unfinished = n;
+    pool->generation++;
+    WakeAllConditionVariable(&pool->work_cond);
+
+    parallel_pool_work(pool, 0);
+    while (pool->unfinished)
+        SleepConditionVariableCS(&pool->done_cond, &pool->lock, INFINITE);
+    LeaveCriticalSection(&pool->lock);
+}
+
+void parallel_pool_free(ParallelPool *pool)
+{
+    EnterCriticalSection(&pool->lock);
+    pool->quit = true;
+    WakeAllConditionVariable(&pool->work_cond);
+    LeaveCriticalSection(&pool->lock);
+
+    for (unsigned i = 0; i < pool->nthreads; i++) {
+        WaitForSingleObject(pool->threads[i], INFINITE);
+        CloseHandle(pool->threads[i]);
+    }
+
+    DeleteCriticalSection(&pool->lock);
+    sfree(pool->threads);
+    sfree(pool);
+}
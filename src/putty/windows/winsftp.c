@@ -211,6 +211,27 @@ WFile *open_existing_wfile(const char *name, uint64_t *size)
     return ret;
 }
 
+WFile *open_segment_wfile(const char *name)
+{
+    HANDLE h;
+    WFile *ret;
+
+    wchar_t* wname = utf8_to_wide(name);
+    if (!wname)
+        return NULL;
+
+    h = CreateFileW(wname, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                    OPEN_EXISTING, 0, 0);
+    sfree(wname);
+    if (h == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    ret = snew(WFile);
+    ret->h = h;
+
+    return ret;
+}
+
 int write_to_file(WFile *f, void *buffer, int length)
 {
     DWORD written;
@@ -759,7 +780,7 @@ static DWORD WINAPI command_read_thread(void *param)
     return 0;
 }
 
-char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
+static char *get_cmdline(const char *prompt, bool no_fds_ok)
 {
     int ret;
     struct command_read_ctx actx, *ctx = &actx;
@@ -805,6 +826,19 @@ char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
     return ctx->line;
 }
 
+char *ssh_sftp_get_cmdline(const char *prompt, bool no_fds_ok)
+{
+    while (1) {
+        char *line = get_cmdline(prompt, no_fds_ok);
+        if (!line || line[0] != '-')
+            return line;
+
+        /* FZ: Quota commands and wakeups arriving after a transfer */
+        ProcessQuotaCmd(line);
+        sfree(line);
+    }
+}
+
 void platform_psftp_pre_conn_setup(void)
 {
     if (restricted_acl) {
@@ -812,6 +846,14 @@ void platform_psftp_pre_conn_setup(void)
     }
 }
 
+void platform_detach_stdout(void)
+{
+    fflush(stdout);
+    if (!freopen("NUL", "w", stdout)) {
+        CloseHandle(GetStdHandle(STD_OUTPUT_HANDLE));
+    }
+}
+
 /* ----------------------------------------------------------------------
  * Main program. Parse arguments etc.
  */
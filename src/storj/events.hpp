@@ -16,11 +16,13 @@ enum class storjEvent {
 	Transfer,
 	UsedQuotaRecv,
 	UsedQuotaSend,
+	Deleted,
+	Cursor,
 
 	count
 };
 
-#define FZSTORJ_PROTOCOL_VERSION 1
+#define FZSTORJ_PROTOCOL_VERSION 4
 
 #endif
 
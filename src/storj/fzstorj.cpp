@@ -1,20 +1,65 @@
 #include <stdio.h>
 #include <fstream>
 #include <ctime>
+#include <csignal>
+#include <cstdlib>
 
 #include "events.hpp"
 
+#include <libfilezilla/file.hpp>
 #include <libfilezilla/format.hpp>
 #include <libfilezilla/mutex.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
 
 typedef bool _Bool;
 #include "libuplinkc.h"
 #include "require.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <new>
+#include <string_view>
+#include <vector>
 
 fz::mutex output_mutex;
 
+// Cancelling a transfer terminates fzstorj. While a multipart upload is
+// in progress, termination is deferred until the upload got aborted so
+// that its parts do not linger on the satellite.
+std::atomic<bool> multipart_active{false};
+std::atomic<bool> cancelled{false};
+
+#ifndef _WIN32
+extern "C" void on_terminate(int sig)
+{
+	if (!multipart_active) {
+		signal(sig, SIG_DFL);
+		raise(sig);
+		return;
+	}
+	cancelled = true;
+}
+#endif
+
+// If set, messages are written as type character followed by the
+// message fields, each prefixed by its length as 32-bit big-endian integer.
+bool framed_output = false;
+
+void fzwrite_field(std::string_view const& field)
+{
+	uint32_t const len = static_cast<uint32_t>(field.size());
+	unsigned char const prefix[4] = {
+		static_cast<unsigned char>(len >> 24),
+		static_cast<unsigned char>(len >> 16),
+		static_cast<unsigned char>(len >> 8),
+		static_cast<unsigned char>(len)
+	};
+	fwrite(prefix, 4, 1, stdout);
+	fwrite(field.data(), field.size(), 1, stdout);
+}
+
 void fzprintf(storjEvent event)
 {
 	fz::scoped_lock l(output_mutex);
@@ -32,9 +77,23 @@ void fzprintf(storjEvent event, Args &&... args)
 	fputc('0' + static_cast<int>(event), stdout);
 
 	std::string s = fz::sprintf(std::forward<Args>(args)...);
-	fwrite(s.c_str(), s.size(), 1, stdout);
+	if (framed_output) {
+		// Multi-line messages become one field per line
+		std::string_view v = s;
+		while (true) {
+			size_t pos = v.find('\n');
+			fzwrite_field(v.substr(0, pos));
+			if (pos == std::string_view::npos) {
+				break;
+			}
+			v = v.substr(pos + 1);
+		}
+	}
+	else {
+		fwrite(s.c_str(), s.size(), 1, stdout);
 
-	fputc('\n', stdout);
+		fputc('\n', stdout);
+	}
 	fflush(stdout);
 }
 
@@ -135,17 +194,27 @@ extern "C" void fv_listBuckets(Project *project)
 	free_bucket_iterator(it);
 }
 
-extern "C" void fv_listObjects(Project *project, std::string bucket, std::string prefix)
+// After this many listing entries, the key of the last one is sent as
+// cursor from which an interrupted listing can be resumed.
+int const list_page_size = 1000;
+
+// With recursive set, all objects below the prefix are listed in one go,
+// the names sent are their keys relative to the prefix.
+//
+// Only the system metadata is requested, the listing entries do not contain
+// anything else. Custom metadata of an object can be fetched using
+// fv_statObject.
+extern "C" void fv_listObjects(Project *project, std::string bucket, std::string prefix, std::string cursor = std::string(), bool recursive = false)
 {			
 	if(!(prefix.empty()))
 		prefix = prefix + "/";
 	
 	ListObjectsOptions options = {
 		prefix : const_cast<char*>(prefix.c_str()),
-		cursor : "",
-		recursive: false, 
+		cursor : const_cast<char*>(cursor.c_str()),
+		recursive: recursive,
 		system : true,
-		custom : true,
+		custom : false,
 	};
 
 	ObjectIterator *it = list_objects(project, const_cast<char*>(bucket.c_str()), &options);
@@ -175,8 +244,12 @@ extern "C" void fv_listObjects(Project *project, std::string bucket, std::string
 			fzprintf(storjEvent::Listentry, "%s\n%d\nid:%s%s\n%s", objectName, object->system.content_length, prefix, objectName, lc_a1_dateTime);
 		}
 				
-		free_object(object);
 		count++;
+		if (!(count % list_page_size)) {
+			fzprintf(storjEvent::Cursor, "%s", object->key);
+		}
+
+		free_object(object);
 	}
 			
 	Error *err = object_iterator_err(it);
@@ -189,7 +262,241 @@ extern "C" void fv_listObjects(Project *project, std::string bucket, std::string
 	free_object_iterator(it);
 }
 
-extern "C" void fv_downloadObject(Project *project, std::string bucket, std::string id, std::string file)
+// Sends the custom metadata of a single object, one Info message per entry
+extern "C" void fv_statObject(Project *project, std::string const& bucket, std::string const& id)
+{
+	ObjectResult object_result = stat_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()));
+	if (object_result.error) {
+		fzprintf(storjEvent::Error, "stat failed: %s", object_result.error->message);
+		free_object_result(object_result);
+		return;
+	}
+
+	CustomMetadata const& custom = object_result.object->custom;
+	for (size_t i = 0; i < custom.count; ++i) {
+		std::string key(custom.entries[i].key, custom.entries[i].key_length);
+		std::string value(custom.entries[i].value, custom.entries[i].value_length);
+		fz::replace_substrings(key, "\n", " ");
+		fz::replace_substrings(value, "\n", " ");
+		fzprintf(storjEvent::Info, "%s: %s", key, value);
+	}
+	free_object_result(object_result);
+}
+
+// Objects are read and written in chunks of this size, set through --chunk-size in MiB
+size_t transfer_chunk_size = 4 * 1024 * 1024;
+
+std::align_val_t const transfer_buffer_alignment{4096};
+
+// Returns the transfer buffer of the calling thread. It is reused by all
+// transfers on that thread and only reallocated if the chunk size changes.
+char* transfer_buffer()
+{
+	struct buffer final
+	{
+		~buffer()
+		{
+			if (data_) {
+				operator delete[](data_, transfer_buffer_alignment);
+			}
+		}
+
+		char* data_{};
+		size_t size_{};
+	};
+	thread_local buffer b;
+
+	if (b.size_ != transfer_chunk_size) {
+		if (b.data_) {
+			operator delete[](b.data_, transfer_buffer_alignment);
+		}
+		b.data_ = static_cast<char*>(operator new[](transfer_chunk_size, transfer_buffer_alignment));
+		b.size_ = transfer_chunk_size;
+	}
+	return b.data_;
+}
+
+fz::duration const progress_interval = fz::duration::from_milliseconds(100);
+
+// Accumulates transferred bytes and sends them as Transfer event at most
+// every progress_interval, the remainder is sent on destruction.
+class progress_reporter final
+{
+public:
+	progress_reporter() = default;
+	progress_reporter(progress_reporter const&) = delete;
+	progress_reporter& operator=(progress_reporter const&) = delete;
+
+	~progress_reporter()
+	{
+		flush();
+	}
+
+	void add(uint64_t bytes)
+	{
+		pending_ += bytes;
+
+		auto const now = fz::monotonic_clock::now();
+		if (!last_ || now - last_ >= progress_interval) {
+			last_ = now;
+			flush();
+		}
+	}
+
+	void flush()
+	{
+		if (pending_) {
+			fzprintf(storjEvent::Transfer, "%u", pending_);
+			pending_ = 0;
+		}
+	}
+
+private:
+	uint64_t pending_{};
+	fz::monotonic_clock last_;
+};
+
+// Objects at least this large are downloaded in several byte ranges at the
+// same time, each range being written directly at its offset.
+int64_t const segmented_download_threshold = 64 * 1024 * 1024;
+int64_t const segmented_download_segments = 4;
+
+// Reads the range through the given download if there is one, it has to
+// start at the offset. The download gets closed either way.
+bool fv_downloadRange(Project *project, std::string const& bucket, std::string const& id, std::string const& file, int64_t offset, int64_t length, std::string & error, Download *download = nullptr)
+{
+	fz::file f(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::writing, fz::file::existing);
+	bool success = f.opened();
+	if (!success) {
+		error = "could not open local file";
+	}
+	else if (f.seek(offset, fz::file::begin) != offset) {
+		error = fz::sprintf("could not seek to offset %d in local file", offset);
+		success = false;
+	}
+	if (!success) {
+		if (download) {
+			Error *close_error = close_download(download);
+			if (close_error) {
+				free_error(close_error);
+			}
+		}
+		return false;
+	}
+
+	DownloadResult download_result{};
+	if (!download) {
+		DownloadOptions options = {
+			offset : offset,
+			length : length,
+		};
+
+		download_result = download_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()), &options);
+		if (download_result.error) {
+			error = fz::sprintf("download of range at %d starting failed: %s", offset, download_result.error->message);
+			free_download_result(download_result);
+			return false;
+		}
+		download = download_result.download;
+	}
+
+	char *buffer = transfer_buffer();
+	progress_reporter progress;
+
+	int64_t remaining = length;
+	while (remaining > 0) {
+		ReadResult result = download_read(download, buffer, std::min(static_cast<int64_t>(transfer_chunk_size), remaining));
+		if (result.bytes_read) {
+			if (f.write(buffer, result.bytes_read) != static_cast<int64_t>(result.bytes_read)) {
+				error = "writing to local file failed";
+				free_read_result(result);
+				success = false;
+				break;
+			}
+			remaining -= result.bytes_read;
+			progress.add(result.bytes_read);
+		}
+
+		if (result.error) {
+			if (result.error->code != EOF || remaining > 0) {
+				error = fz::sprintf("download of range at %d failed to read: %s", offset, result.error->message);
+				success = false;
+			}
+			free_read_result(result);
+			break;
+		}
+		free_read_result(result);
+	}
+
+	Error *close_error = close_download(download);
+	if (close_error) {
+		if (success) {
+			error = fz::sprintf("download failed to close: %s", close_error->message);
+			success = false;
+		}
+		free_error(close_error);
+	}
+
+	if (download_result.download) {
+		free_download_result(download_result);
+	}
+	return success;
+}
+
+// The first range is read through the download of the whole object, which
+// is closed once it has been read.
+void fv_downloadObjectSegmented(Project *project, std::string const& bucket, std::string const& id, std::string const& file, bool preallocate, int64_t size, Download *first)
+{
+	{
+		fz::file f(fz::to_native(fz::to_wstring_from_utf8(file)), fz::file::writing, fz::file::empty);
+		if (!f.opened()) {
+			fzprintf(storjEvent::Error, "could not open local file for writing");
+			Error *close_error = close_download(first);
+			if (close_error) {
+				free_error(close_error);
+			}
+			return;
+		}
+		if (preallocate) {
+			// Try to preallocate the file in order to reduce fragmentation
+			if (f.seek(size, fz::file::begin) == size) {
+				f.truncate();
+			}
+		}
+	}
+
+	int64_t const segment_size = (size + segmented_download_segments - 1) / segmented_download_segments;
+
+	fz::mutex error_mutex;
+	std::string error;
+
+	{
+		fz::thread_pool pool;
+		std::vector<fz::async_task> tasks;
+		for (int64_t offset = 0; offset < size; offset += segment_size) {
+			int64_t const length = std::min(segment_size, size - offset);
+			Download *download = offset ? nullptr : first;
+			tasks.emplace_back(pool.spawn([&, offset, length, download]() {
+				std::string range_error;
+				if (!fv_downloadRange(project, bucket, id, file, offset, length, range_error, download)) {
+					fz::scoped_lock l(error_mutex);
+					if (error.empty()) {
+						error = range_error;
+					}
+				}
+			}));
+		}
+		for (auto & task : tasks) {
+			task.join();
+		}
+	}
+
+	if (!error.empty()) {
+		fzprintf(storjEvent::Error, "%s", error);
+	}
+}
+
+extern "C" void fv_downloadObject(Project *project, std::string bucket, std::string id, std::string file, bool preallocate)
 {
 	DownloadResult download_result = download_object(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(id.c_str()), NULL);
     if (download_result.error) {
@@ -198,21 +505,35 @@ extern "C" void fv_downloadObject(Project *project, std::string bucket, std::str
         return;
     }
 
-	size_t buffer_size = 32768;
-    char *buffer = static_cast<char*>(malloc(buffer_size));
+	// The download already knows the size of the object, no need to stat it
+	int64_t size = -1;
+	ObjectResult info = download_info(download_result.download);
+	if (!info.error && info.object) {
+		size = info.object->system.content_length;
+	}
+	free_object_result(info);
+
+	if (size >= segmented_download_threshold) {
+		fv_downloadObjectSegmented(project, bucket, id, file, preallocate, size, download_result.download);
+		free_download_result(download_result);
+		return;
+	}
+
+	char *buffer = transfer_buffer();
 	std::ofstream outfile (file, std::ofstream::binary);
 
     Download *download = download_result.download;
 	
 	size_t downloaded_total = 0;
+	progress_reporter progress;
     
     while (true) {
-        ReadResult result = download_read(download, buffer, buffer_size);
+        ReadResult result = download_read(download, buffer, transfer_chunk_size);
         downloaded_total += result.bytes_read;
 		
 		outfile.write(buffer, result.bytes_read);
 				
-		fzprintf(storjEvent::Transfer, "%u", result.bytes_read);
+		progress.add(result.bytes_read);
 
         if (result.error) {
             if (result.error->code == EOF) {
@@ -235,6 +556,160 @@ extern "C" void fv_downloadObject(Project *project, std::string bucket, std::str
     free_download_result(download_result);
 }
 
+// Files at least this large are uploaded as multipart uploads, with
+// several parts being uploaded at the same time.
+size_t const multipart_threshold = 64 * 1024 * 1024;
+size_t const multipart_part_size = 64 * 1024 * 1024;
+size_t const multipart_concurrency = 4;
+
+bool fv_uploadPart(Project *project, std::string const& bucket, std::string const& key, std::string const& upload_id, std::string const& file, uint32_t part_number, size_t offset, size_t length, std::string & error)
+{
+	std::ifstream is(file, std::ifstream::binary);
+	is.seekg(offset, is.beg);
+	if (!is) {
+		error = fz::sprintf("could not seek to offset %u in local file", offset);
+		return false;
+	}
+
+	PartUploadResult part_result = upload_part(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()), part_number);
+	if (part_result.error) {
+		error = fz::sprintf("starting part %u failed: %s", part_number, part_result.error->message);
+		free_part_upload_result(part_result);
+		return false;
+	}
+
+	PartUpload *part = part_result.part_upload;
+
+	char *buffer = transfer_buffer();
+	progress_reporter progress;
+
+	size_t uploaded = 0;
+	while (uploaded < length) {
+		is.read(buffer, std::min(transfer_chunk_size, length - uploaded));
+		size_t const read = static_cast<size_t>(is.gcount());
+		if (!read) {
+			error = fz::sprintf("reading local file failed at offset %u", offset + uploaded);
+			free_part_upload_result(part_result);
+			return false;
+		}
+
+		size_t written = 0;
+		while (written < read) {
+			if (cancelled) {
+				error = "upload cancelled";
+				free_part_upload_result(part_result);
+				return false;
+			}
+			WriteResult result = part_upload_write(part, buffer + written, read - written);
+			if (result.error) {
+				error = fz::sprintf("uploading part %u failed: %s", part_number, result.error->message);
+				free_write_result(result);
+				free_part_upload_result(part_result);
+				return false;
+			}
+			written += result.bytes_written;
+			progress.add(result.bytes_written);
+			free_write_result(result);
+		}
+		uploaded += read;
+	}
+
+	Error *commit_err = part_upload_commit(part);
+	if (commit_err) {
+		error = fz::sprintf("committing part %u failed: %s", part_number, commit_err->message);
+		free_error(commit_err);
+		free_part_upload_result(part_result);
+		return false;
+	}
+
+	free_part_upload_result(part_result);
+	return true;
+}
+
+void fv_uploadObjectMultipart(Project *project, std::string const& bucket, std::string const& key, std::string const& file, size_t length)
+{
+	UploadInfoResult info_result = begin_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), NULL);
+	if (info_result.error) {
+		fzprintf(storjEvent::Error, "starting multipart upload failed: %s", info_result.error->message);
+		free_upload_info_result(info_result);
+		return;
+	}
+	std::string const upload_id = info_result.info->upload_id;
+	free_upload_info_result(info_result);
+
+	auto const abort = [&]() {
+		Error *abort_err = abort_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()));
+		if (abort_err) {
+			free_error(abort_err);
+		}
+	};
+	multipart_active = true;
+
+	size_t const parts = (length + multipart_part_size - 1) / multipart_part_size;
+	std::atomic<size_t> next_part{0};
+
+	fz::mutex error_mutex;
+	std::string error;
+
+	auto worker = [&]() {
+		while (true) {
+			{
+				fz::scoped_lock l(error_mutex);
+				if (!error.empty() || cancelled) {
+					return;
+				}
+			}
+
+			size_t const part = next_part++;
+			if (part >= parts) {
+				return;
+			}
+
+			size_t const offset = part * multipart_part_size;
+			size_t const part_length = std::min(multipart_part_size, length - offset);
+
+			std::string part_error;
+			if (!fv_uploadPart(project, bucket, key, upload_id, file, static_cast<uint32_t>(part + 1), offset, part_length, part_error)) {
+				fz::scoped_lock l(error_mutex);
+				if (error.empty()) {
+					error = part_error;
+				}
+				return;
+			}
+		}
+	};
+
+	{
+		fz::thread_pool pool;
+		std::vector<fz::async_task> tasks;
+		for (size_t i = 0; i < std::min(multipart_concurrency, parts); ++i) {
+			tasks.emplace_back(pool.spawn(worker));
+		}
+		for (auto & task : tasks) {
+			task.join();
+		}
+	}
+
+	if (!error.empty() || cancelled) {
+		abort();
+		if (cancelled) {
+			// Nobody is listening anymore
+			std::_Exit(1);
+		}
+		multipart_active = false;
+		fzprintf(storjEvent::Error, "multipart upload failed: %s", error);
+		return;
+	}
+
+	CommitUploadResult commit_result = commit_upload(project, const_cast<char*>(bucket.c_str()), const_cast<char*>(key.c_str()), const_cast<char*>(upload_id.c_str()), NULL);
+	if (commit_result.error) {
+		abort();
+		fzprintf(storjEvent::Error, "committing multipart upload failed: %s", commit_result.error->message);
+	}
+	free_commit_upload_result(commit_result);
+	multipart_active = false;
+}
+
 extern "C" void fv_uploadObject(Project *project, std::string bucket, std::string prefix, std::string file, std::string objectName)
 {
 	std::string object_key = bucket;
@@ -248,8 +723,13 @@ extern "C" void fv_uploadObject(Project *project, std::string bucket, std::strin
 	size_t length = is.tellg();
     is.seekg (0, is.beg);
 
-	size_t buffer_size = 32768;
-    char *buffer = static_cast<char*>(malloc(buffer_size));
+	if (length >= multipart_threshold) {
+		is.close();
+		fv_uploadObjectMultipart(project, object_key, objectName, file, length);
+		return;
+	}
+
+	char *buffer = transfer_buffer();
     
     UploadResult upload_result = upload_object(project, const_cast<char*>(object_key.c_str()), const_cast<char*>(objectName.c_str()), NULL);
     
@@ -259,13 +739,14 @@ extern "C" void fv_uploadObject(Project *project, std::string bucket, std::strin
     Upload *upload = upload_result.upload;
 
     size_t uploaded_total = 0;
+	progress_reporter progress;
 
 	while (uploaded_total < length) {
-		is.read (buffer, buffer_size);
+		is.read (buffer, transfer_chunk_size);
 		WriteResult result = upload_write(upload, buffer, is.gcount());
         uploaded_total += result.bytes_written;
         
-		fzprintf(storjEvent::Transfer, "%u", result.bytes_written);
+		progress.add(result.bytes_written);
 
 		require_noerror(result.error);
         require(result.bytes_written > 0);
@@ -288,6 +769,57 @@ extern "C" void fv_deleteObject(Project *project, std::string bucketName, std::s
 	free_object_result(object_result);
 }
 
+// Number of objects deleted at the same time by rm-many
+size_t const delete_concurrency = 8;
+
+void fv_deleteObjects(Project *project, std::string const& bucketName, std::vector<std::string> const& objectKeys)
+{
+	std::atomic<size_t> next{0};
+
+	auto worker = [&]() {
+		while (true) {
+			size_t const i = next++;
+			if (i >= objectKeys.size()) {
+				return;
+			}
+
+			std::string const& objectKey = objectKeys[i];
+			ObjectResult object_result = delete_object(project, const_cast<char*>(bucketName.c_str()), const_cast<char*>(objectKey.c_str()));
+			if (object_result.error) {
+				fzprintf(storjEvent::ErrorMsg, "failed to delete object %s: %s", objectKey, object_result.error->message);
+			}
+			else {
+				fzprintf(storjEvent::Deleted, "%s", objectKey);
+			}
+			free_object_result(object_result);
+		}
+	};
+
+	fz::thread_pool pool;
+	std::vector<fz::async_task> tasks;
+	for (size_t i = 0; i < std::min(delete_concurrency, objectKeys.size()); ++i) {
+		tasks.emplace_back(pool.spawn(worker));
+	}
+	for (auto & task : tasks) {
+		task.join();
+	}
+}
+
+// Server-side, the data of the object is neither downloaded nor uploaded again
+bool fv_moveObject(Project *project, std::string const& bucketName, std::string const& objectKey, std::string const& newBucketName, std::string const& newObjectKey)
+{
+	Error *error = move_object(project, const_cast<char*>(bucketName.c_str()), const_cast<char*>(objectKey.c_str()),
+		const_cast<char*>(newBucketName.c_str()), const_cast<char*>(newObjectKey.c_str()), NULL);
+	if (error) {
+		fzprintf(storjEvent::Error, "failed to move object %s: %s", objectKey, error->message);
+		free_error(error);
+		return false;
+	}
+
+	fzprintf(storjEvent::Status, "moved object %s to %s", objectKey, newObjectKey);
+	return true;
+}
+
 extern "C" void fv_createBucket(Project *project, std::string bucketName)
 {
 	BucketResult bucket_result = ensure_bucket(project, const_cast<char*>(bucketName.c_str()));
@@ -315,10 +847,26 @@ extern "C" void fv_deleteBucket(Project *project, std::string bucketName)
 
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+#ifndef _WIN32
+	signal(SIGTERM, on_terminate);
+#endif
+
 	fzprintf(storjEvent::Reply, "fzStorj started, protocol_version=%d", FZSTORJ_PROTOCOL_VERSION);
 
+	for (int i = 1; i < argc; ++i) {
+		if (std::string_view(argv[i]) == "--framed") {
+			framed_output = true;
+		}
+		else if (std::string_view(argv[i]) == "--chunk-size" && i + 1 < argc) {
+			size_t const mib = fz::to_integral<size_t>(std::string(argv[++i]));
+			if (mib >= 1 && mib <= 64) {
+				transfer_chunk_size = mib * 1024 * 1024;
+			}
+		}
+	}
+
 	std::string ls_satelliteURL;
 	std::string ls_apiKey;
 	std::string ls_encryptionPassPhrase;
@@ -328,31 +876,61 @@ int main()
         user_agent : "FileZilla",
     };
 	
-	auto fv_openStorjProject = [&]() -> ProjectResult {
+	// The opened project is kept around and reused by all following
+	// commands as long as the access credentials do not change.
+	ProjectResult project_result{};
+	Project *project = nullptr;
+	std::string project_access;
+
+	auto fv_closeStorjProject = [&]() {
+		if (project) {
+			Error *close_error = close_project(project);
+			if (close_error) {
+				free_error(close_error);
+			}
+			free_project_result(project_result);
+			project_result = ProjectResult{};
+			project = nullptr;
+		}
+		project_access.clear();
+	};
+
+	auto fv_openStorjProject = [&]() -> Project* {
+		std::string const access = ls_satelliteURL + '\0' + ls_apiKey + '\0' + ls_encryptionPassPhrase + '\0' + ls_serializedAccessGrantKey;
+		if (project) {
+			if (access == project_access) {
+				return project;
+			}
+			fv_closeStorjProject();
+		}
+
 		AccessResult access_result;
 		if(!(ls_apiKey.empty())) {
 			access_result = config_request_access_with_passphrase(config, const_cast<char*>(ls_satelliteURL.c_str()), const_cast<char*>(ls_apiKey.c_str()), const_cast<char*>(ls_encryptionPassPhrase.c_str()));
-			if (access_result.error) {
-				fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
-				free_access_result(access_result);
-			}
 		}
 		else {
 			access_result = parse_access(const_cast<char*>(ls_serializedAccessGrantKey.c_str()));
-			if (access_result.error) {
-				fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
-				free_access_result(access_result);
-			}
 		}
-		
-		ProjectResult project_result = config_open_project(config, access_result.access);
-		if (project_result.error) {
-			fzprintf(storjEvent::Error, "failed to open project: %s", project_result.error->message);
-			free_project_result(project_result);
+		if (access_result.error) {
+			fzprintf(storjEvent::Error, "failed to parse access: %s", access_result.error->message);
+			free_access_result(access_result);
+			return nullptr;
+		}
+
+		ProjectResult opened = config_open_project(config, access_result.access);
+		free_access_result(access_result);
+		if (opened.error) {
+			fzprintf(storjEvent::Error, "failed to open project: %s", opened.error->message);
+			free_project_result(opened);
+			return nullptr;
 		}
-		return project_result;
+
+		project_result = opened;
+		project = opened.project;
+		project_access = access;
+		return project;
 	};
-	
+
 	int ret = 0;
 	while (true) {
 		std::string command;
@@ -408,37 +986,26 @@ int main()
 			fzprintf(storjEvent::Done);
 		}
 		else if (command == "list-buckets") {
-			ProjectResult project_result = fv_openStorjProject();
-			fv_listBuckets(project_result.project);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_listBuckets(project);
 			
 			fzprintf(storjEvent::Done);
 		}
 		else if (command == "list") {
-			
-			if (arg.empty()) {
+			std::string bucket = next_argument(arg);
+			std::string prefix = next_argument(arg);
+			std::string cursor = next_argument(arg);
+
+			if (bucket.empty() || !arg.empty()) {
 				fzprintf(storjEvent::Error, "Bad arguments");
 				continue;
 			}
 
-			std::string bucket, prefix;
-
-			size_t pos = arg.find(' ');
-			if (pos == std::string::npos) {
-				bucket = arg;
-			}
-			else {
-				bucket = arg.substr(0, pos);
-
-				prefix = arg.substr(pos + 1);
-
-				if (prefix.size() >= 2 && prefix.front() == '"' && prefix.back() == '"') {
-					prefix = fz::replaced_substrings(prefix.substr(1, prefix.size() - 2), "\"\"", "\"");
-				}
-
-				if (!prefix.empty() && prefix.back() != '/') {
-					fzprintf(storjEvent::Error, "Bad arguments");
-					continue;
-				}
+			if (!prefix.empty() && prefix.back() != '/') {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
 			}
 			
 			if (!prefix.empty()) {
@@ -449,30 +1016,69 @@ int main()
 				}
 			}
 
-			ProjectResult project_result = fv_openStorjProject();			
-			fv_listObjects(project_result.project, bucket, prefix);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_listObjects(project, bucket, prefix, cursor);
 			
 			fzprintf(storjEvent::Done);			
 		}
-		else if (command == "get") {
-			size_t pos = arg.find(' ');
-			if (pos == std::string::npos) {
+		else if (command == "list-tree") {
+			std::string bucket = next_argument(arg);
+			std::string prefix = next_argument(arg);
+			std::string cursor = next_argument(arg);
+
+			if (bucket.empty() || !arg.empty()) {
 				fzprintf(storjEvent::Error, "Bad arguments");
 				continue;
 			}
-			std::string bucket = arg.substr(0, pos);
-			std::string others = arg.substr(pos + 1, arg.size());
-			size_t pos2 = others.find_first_of(' "');
 
-			auto id = others.substr(0, pos2 - 1);
-			auto file = others.substr(pos2, others.size());
+			if (!prefix.empty() && prefix.back() != '/') {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
+			}
+			if (!prefix.empty()) {
+				prefix.pop_back();
+			}
 
-			if (file.size() >= 3 && file.front() == '"' && file.back() == '"') {
-				file = fz::replaced_substrings(file.substr(1, file.size() - 2), "\"\"", "\"");
+			if (!fv_openStorjProject()) {
+				continue;
 			}
+			fv_listObjects(project, bucket, prefix, cursor, true);
 
-			ProjectResult project_result = fv_openStorjProject();
-			fv_downloadObject(project_result.project, bucket, id, file);
+			fzprintf(storjEvent::Done);
+		}
+		else if (command == "stat") {
+			std::string bucket = next_argument(arg);
+			std::string id = next_argument(arg);
+
+			if (bucket.empty() || id.empty() || !arg.empty()) {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
+			}
+
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_statObject(project, bucket, id);
+
+			fzprintf(storjEvent::Done);
+		}
+		else if (command == "get") {
+			std::string bucket = next_argument(arg);
+			std::string id = next_argument(arg);
+			std::string file = next_argument(arg);
+			std::string preallocate = next_argument(arg);
+
+			if (bucket.empty() || id.empty() || file.empty() || !arg.empty()) {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
+			}
+
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_downloadObject(project, bucket, id, file, preallocate == "1");
 			
 			fzprintf(storjEvent::Done);			
 		}
@@ -501,11 +1107,13 @@ int main()
 				objectName = remote_name;
 			}
 
-			ProjectResult project_result = fv_openStorjProject();
-			fv_uploadObject(project_result.project, bucket, prefix, file, objectName);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_uploadObject(project, bucket, prefix, file, objectName);
 
 			// refresh
-			fv_listObjects(project_result.project, bucket, prefix);
+			fv_listObjects(project, bucket, prefix);
 
 			fzprintf(storjEvent::Done);
 		}
@@ -532,15 +1140,59 @@ int main()
 				prefix = objectKey.substr(0, pos);
 			}	
 			
-			ProjectResult project_result = fv_openStorjProject();
-			fv_deleteObject(project_result.project, bucketName, objectKey);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_deleteObject(project, bucketName, objectKey);
 
 			// refresh
-			project_result = fv_openStorjProject();
-			fv_listObjects(project_result.project, bucketName, prefix);
+			fv_listObjects(project, bucketName, prefix);
 			
 			fzprintf(storjEvent::Done);	
 		}
+		else if (command == "rm-many") {
+			std::string bucketName = next_argument(arg);
+
+			std::vector<std::string> objectKeys;
+			while (!arg.empty()) {
+				std::string objectKey = next_argument(arg);
+				if (objectKey.empty()) {
+					break;
+				}
+				objectKeys.emplace_back(std::move(objectKey));
+			}
+
+			if (bucketName.empty() || objectKeys.empty() || !arg.empty()) {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
+			}
+
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_deleteObjects(project, bucketName, objectKeys);
+
+			fzprintf(storjEvent::Done);
+		}
+		else if (command == "mv") {
+			std::string bucketName = next_argument(arg);
+			std::string objectKey = next_argument(arg);
+			std::string newBucketName = next_argument(arg);
+			std::string newObjectKey = next_argument(arg);
+			if (bucketName.empty() || objectKey.empty() || newBucketName.empty() || newObjectKey.empty() || !arg.empty()) {
+				fzprintf(storjEvent::Error, "Bad arguments");
+				continue;
+			}
+
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			if (!fv_moveObject(project, bucketName, objectKey, newBucketName, newObjectKey)) {
+				continue;
+			}
+
+			fzprintf(storjEvent::Done);
+		}
 		else if (command == "mkbucket") {
 			std::string bucketName = next_argument(arg);
 			if (bucketName.empty()) {
@@ -548,22 +1200,26 @@ int main()
 				continue;
 			}
 			
-			ProjectResult project_result = fv_openStorjProject();
-			fv_createBucket(project_result.project, bucketName);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_createBucket(project, bucketName);
 						
 			// refresh
-			fv_listBuckets(project_result.project);
+			fv_listBuckets(project);
 			
 			fzprintf(storjEvent::Done);		
 		}
 		else if (command == "rmbucket") {
 			std::string bucketName = arg;
 					
-			ProjectResult project_result = fv_openStorjProject();
-			fv_deleteBucket(project_result.project, bucketName);
+			if (!fv_openStorjProject()) {
+				continue;
+			}
+			fv_deleteBucket(project, bucketName);
 			
 			// refresh
-			fv_listBuckets(project_result.project);
+			fv_listBuckets(project);
 	
 			fzprintf(storjEvent::Done);
 		}
@@ -573,5 +1229,7 @@ int main()
 
 	}
 
+	fv_closeStorjProject();
+
 	return ret;
 }
\ No newline at end of file
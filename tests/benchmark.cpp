@@ -0,0 +1,692 @@
+#include <libfilezilla_engine.h>
+#include <directorycache.h>
+#include <directorylistingparser.h>
+#include <iothread.h>
+#include <../interface/filter_matcher.h>
+
+#include <libfilezilla/event_handler.hpp>
+#include <libfilezilla/event_loop.hpp>
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/format.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/thread_pool.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Microbenchmarks of the engine's hot paths.
+ *
+ * Run with --help for the options. All input is generated from fixed seeds,
+ * so runs with the same options measure the same work. With --json, the
+ * results are printed in a form suitable for comparing against a baseline.
+ */
+
+namespace {
+
+struct run_result
+{
+	uint64_t ops{};
+	uint64_t bytes{};
+	bool failed{};
+};
+
+// Prepares the input outside of the timing and returns the measured part
+typedef std::function<std::function<run_result()>()> benchmark_setup;
+
+struct benchmark
+{
+	std::string name;
+	benchmark_setup setup;
+};
+
+struct options
+{
+	bool json{};
+	std::string filter;
+	int repetitions{5};
+	double scale{1};
+};
+
+options opts;
+
+size_t scaled(size_t n)
+{
+	return std::max(size_t(1), static_cast<size_t>(n * opts.scale));
+}
+
+// Listing parser
+// --------------
+
+enum class listing_format
+{
+	ls,
+	dos,
+	mlsd,
+	vms
+};
+
+std::string make_listing(listing_format format, size_t lines)
+{
+	std::mt19937 rng(1);
+	std::string data;
+	data.reserve(lines * 80);
+	for (size_t i = 0; i < lines; ++i) {
+		unsigned int const size = rng() % 100000000;
+		unsigned int const day = rng() % 28 + 1;
+		unsigned int const hour = rng() % 24;
+		unsigned int const minute = rng() % 60;
+		switch (format) {
+		case listing_format::ls:
+			data += fz::sprintf("-rw-r--r--   1 user     group    %10u Jan %2u %02u:%02u file%07u.txt\r\n", size, day, hour, minute, i);
+			break;
+		case listing_format::dos:
+			data += fz::sprintf("01-%02u-20  %02u:%02uPM %20u file%07u.txt\r\n", day, hour % 12 + 1, minute, size, i);
+			break;
+		case listing_format::mlsd:
+			data += fz::sprintf("type=file;size=%u;modify=202001%02u%02u%02u00;perm=adfrw; file%07u.txt\r\n", size, day, hour, minute, i);
+			break;
+		case listing_format::vms:
+			data += fz::sprintf("FILE%07u.TXT;1  %u %u-JAN-2020 %02u:%02u [root,root] (RWE,RWE,RE,RE)\r\n", i, size % 1000 + 1, day, hour, minute);
+			break;
+		}
+	}
+	return data;
+}
+
+benchmark_setup parser_benchmark(listing_format format, ServerType type)
+{
+	return [format, type]() {
+		size_t const lines = scaled(1000000);
+		auto data = std::make_shared<std::string>(make_listing(format, lines));
+
+		return [data, lines, type]() {
+			run_result r;
+
+			CServer server;
+			server.SetType(type);
+			CDirectoryListingParser parser(0, server);
+
+			// Fed in chunks like the data arrives from the transfer socket
+			size_t const chunk = 64 * 1024;
+			for (size_t pos = 0; pos < data->size(); pos += chunk) {
+				size_t const len = std::min(chunk, data->size() - pos);
+				char* p = new char[len];
+				memcpy(p, data->c_str() + pos, len);
+				if (!parser.AddData(p, static_cast<int>(len))) {
+					r.failed = true;
+					return r;
+				}
+			}
+
+			CDirectoryListing listing = parser.Parse(CServerPath(L"/"));
+			r.failed = listing.size() != lines;
+			r.ops = lines;
+			r.bytes = data->size();
+			return r;
+		};
+	};
+}
+
+// Directory cache
+// ---------------
+
+benchmark_setup cache_benchmark(unsigned int threads)
+{
+	return [threads]() {
+		auto cache = std::make_shared<CDirectoryCache>();
+		CServer const server(FTP, DEFAULT, L"example.com", 21);
+
+		size_t const dirs = 1000;
+		size_t const entries = 200;
+		fz::datetime const now = fz::datetime::now();
+		for (size_t d = 0; d < dirs; ++d) {
+			std::vector<fz::shared_value<CDirentry>> list;
+			for (size_t e = 0; e < entries; ++e) {
+				CDirentry entry;
+				entry.name = fz::sprintf(L"file%04u", e);
+				entry.size = e;
+				entry.time = now;
+				list.emplace_back(std::move(entry));
+			}
+			CDirectoryListing listing;
+			listing.path = CServerPath(fz::sprintf(L"/dir%04u", d));
+			listing.m_firstListTime = fz::monotonic_clock::now();
+			listing.Assign(std::move(list));
+			cache->Store(listing, server);
+		}
+
+		size_t const lookups = scaled(200000);
+
+		return [cache, server, threads, dirs, entries, lookups]() {
+			std::vector<std::thread> workers;
+			std::vector<char> failed(threads);
+			for (unsigned int t = 0; t < threads; ++t) {
+				workers.emplace_back([&, t]() {
+					std::mt19937 rng(t + 1);
+					for (size_t i = 0; i < lookups; ++i) {
+						CServerPath const path(fz::sprintf(L"/dir%04u", rng() % dirs));
+						if (i % 2) {
+							CDirectoryListing listing;
+							bool outdated{};
+							if (!cache->Lookup(listing, server, path, false, outdated) || listing.size() != entries) {
+								failed[t] = true;
+							}
+						}
+						else {
+							CDirentry entry;
+							bool dirDidExist{};
+							bool matchedCase{};
+							if (!cache->LookupFile(entry, server, path, fz::sprintf(L"file%04u", rng() % entries), dirDidExist, matchedCase)) {
+								failed[t] = true;
+							}
+						}
+					}
+				});
+			}
+			for (auto & worker : workers) {
+				worker.join();
+			}
+
+			run_result r;
+			r.ops = lookups * threads;
+			r.failed = std::find(failed.begin(), failed.end(), true) != failed.end();
+			return r;
+		};
+	};
+}
+
+// CServerPath
+// -----------
+
+std::vector<std::wstring> make_paths(size_t count)
+{
+	std::mt19937 rng(2);
+	std::vector<std::wstring> paths;
+	paths.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		std::wstring path;
+		size_t const depth = rng() % 8 + 1;
+		for (size_t d = 0; d < depth; ++d) {
+			path += fz::sprintf(L"/segment%u", rng() % 20);
+		}
+		paths.push_back(std::move(path));
+	}
+	return paths;
+}
+
+std::vector<CServerPath> to_server_paths(std::vector<std::wstring> const& strings)
+{
+	std::vector<CServerPath> paths;
+	paths.reserve(strings.size());
+	for (auto const& s : strings) {
+		paths.emplace_back(s);
+	}
+	return paths;
+}
+
+benchmark_setup serverpath_parse()
+{
+	return []() {
+		auto strings = std::make_shared<std::vector<std::wstring>>(make_paths(scaled(200000)));
+		return [strings]() {
+			run_result r;
+			for (auto const& s : *strings) {
+				CServerPath path(s);
+				r.failed |= path.empty();
+			}
+			r.ops = strings->size();
+			return r;
+		};
+	};
+}
+
+benchmark_setup serverpath_getpath()
+{
+	return []() {
+		auto paths = std::make_shared<std::vector<CServerPath>>(to_server_paths(make_paths(scaled(200000))));
+		return [paths]() {
+			run_result r;
+			size_t total{};
+			for (auto const& path : *paths) {
+				total += path.GetPath().size();
+			}
+			r.failed = !total;
+			r.ops = paths->size();
+			return r;
+		};
+	};
+}
+
+benchmark_setup serverpath_segments()
+{
+	return []() {
+		auto paths = std::make_shared<std::vector<CServerPath>>(to_server_paths(make_paths(scaled(200000))));
+		return [paths]() {
+			run_result r;
+			for (auto const& path : *paths) {
+				CServerPath child = path;
+				child.AddSegment(L"child");
+				CServerPath const parent = child.GetParent();
+				r.failed |= parent != path;
+			}
+			r.ops = paths->size();
+			return r;
+		};
+	};
+}
+
+benchmark_setup serverpath_changepath()
+{
+	return []() {
+		auto paths = std::make_shared<std::vector<CServerPath>>(to_server_paths(make_paths(scaled(200000))));
+		return [paths]() {
+			run_result r;
+			for (auto const& path : *paths) {
+				CServerPath changed = path;
+				r.failed |= !changed.ChangePath(L"../sub/dir");
+			}
+			r.ops = paths->size();
+			return r;
+		};
+	};
+}
+
+benchmark_setup serverpath_isparentof()
+{
+	return []() {
+		auto paths = std::make_shared<std::vector<CServerPath>>(to_server_paths(make_paths(scaled(200000))));
+		return [paths]() {
+			run_result r;
+			size_t parents{};
+			for (size_t i = 1; i < paths->size(); ++i) {
+				if ((*paths)[i - 1].IsParentOf((*paths)[i], false)) {
+					++parents;
+				}
+			}
+			(void)parents;
+			r.ops = paths->size() - 1;
+			return r;
+		};
+	};
+}
+
+benchmark_setup serverpath_sort()
+{
+	return []() {
+		auto paths = std::make_shared<std::vector<CServerPath>>(to_server_paths(make_paths(scaled(200000))));
+		return [paths]() {
+			run_result r;
+			auto sorted = *paths;
+			uint64_t comparisons{};
+			std::sort(sorted.begin(), sorted.end(), [&comparisons](CServerPath const& lhs, CServerPath const& rhs) {
+				++comparisons;
+				return lhs < rhs;
+			});
+			r.ops = comparisons;
+			return r;
+		};
+	};
+}
+
+// Filters
+// -------
+
+std::vector<std::wstring> make_names(size_t count)
+{
+	static wchar_t const* const extensions[] = { L".txt", L".jpg", L".png", L".tmp", L".bak", L".tar.gz", L".cpp", L".h" };
+	std::mt19937 rng(3);
+	std::vector<std::wstring> names;
+	names.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		names.push_back(fz::sprintf(L"name%u_%u%s", rng() % 100000, i, extensions[rng() % (sizeof(extensions) / sizeof(*extensions))]));
+	}
+	return names;
+}
+
+benchmark_setup filter_literal()
+{
+	return []() {
+		auto matcher = std::make_shared<CMultiStringMatcher>();
+		for (unsigned int i = 0; i < 30; ++i) {
+			matcher->add(fz::sprintf(L"name%u_", i * 997));
+		}
+		matcher->add(L".tmp");
+		matcher->add(L".bak");
+		matcher->add(L"~");
+		matcher->compile();
+
+		auto names = std::make_shared<std::vector<std::wstring>>(make_names(scaled(1000000)));
+		return [matcher, names]() {
+			run_result r;
+			size_t hits{};
+			for (auto const& name : *names) {
+				matcher->search(name, [&hits](size_t, size_t) { ++hits; });
+			}
+			r.failed = !hits;
+			r.ops = names->size();
+			return r;
+		};
+	};
+}
+
+benchmark_setup filter_regex()
+{
+	return []() {
+		auto regexes = std::make_shared<std::vector<CFilterRegex>>();
+		for (auto const* pattern : { L"\\.(jpg|png|gif)$", L"^name\\d{3}_", L"[0-9]+\\.tmp$", L"(a|b)*c" }) {
+			CFilterRegex regex;
+			if (!regex.compile(pattern, false)) {
+				return std::function<run_result()>([]() { run_result r; r.failed = true; return r; });
+			}
+			regexes->push_back(std::move(regex));
+		}
+
+		auto names = std::make_shared<std::vector<std::wstring>>(make_names(scaled(1000000)));
+		return std::function<run_result()>([regexes, names]() {
+			run_result r;
+			size_t hits{};
+			for (auto const& name : *names) {
+				for (auto const& regex : *regexes) {
+					if (regex.search(name)) {
+						++hits;
+					}
+				}
+			}
+			r.failed = !hits;
+			r.ops = names->size();
+			return r;
+		});
+	};
+}
+
+// CIOThread
+// ---------
+
+class io_waiter final : public fz::event_handler
+{
+public:
+	explicit io_waiter(fz::event_loop & loop)
+		: fz::event_handler(loop)
+	{}
+
+	virtual ~io_waiter()
+	{
+		remove_handler();
+	}
+
+	void wait()
+	{
+		fz::scoped_lock l(mutex_);
+		while (!signalled_) {
+			condition_.wait(l);
+		}
+		signalled_ = false;
+	}
+
+private:
+	virtual void operator()(fz::event_base const&) override
+	{
+		fz::scoped_lock l(mutex_);
+		signalled_ = true;
+		condition_.signal(l);
+	}
+
+	fz::mutex mutex_;
+	fz::condition condition_;
+	bool signalled_{};
+};
+
+fz::native_string const iothread_file = fzT("fzbenchmark.tmp");
+
+struct iothread_context
+{
+	fz::thread_pool pool;
+	fz::event_loop loop{pool};
+};
+
+benchmark_setup iothread_benchmark(bool read)
+{
+	return [read]() {
+		auto ctx = std::make_shared<iothread_context>();
+		int64_t const size = static_cast<int64_t>(scaled(256)) * 1024 * 1024;
+
+		auto write = [ctx, size]() {
+			run_result r;
+			io_waiter waiter(ctx->loop);
+			auto file = std::make_unique<fz::file>(iothread_file, fz::file::writing, fz::file::empty);
+			CIOThread io;
+			io.SetEventHandler(&waiter);
+			if (!*file || !io.Create(ctx->pool, std::move(file), false, true)) {
+				r.failed = true;
+				return r;
+			}
+
+			int64_t left = size;
+			for (;;) {
+				char* buffer{};
+				int res = io.GetNextWriteBuffer(&buffer);
+				if (res == IO_Again) {
+					waiter.wait();
+					continue;
+				}
+				if (res < 0) {
+					r.failed = true;
+					io.Destroy();
+					break;
+				}
+				if (left <= res) {
+					r.failed = !io.Finalize(static_cast<int>(left));
+					break;
+				}
+				memset(buffer, 'x', res);
+				left -= res;
+			}
+			r.bytes = size;
+			r.ops = size / io.GetBufferSize();
+			return r;
+		};
+
+		if (!read) {
+			return std::function<run_result()>(write);
+		}
+
+		if (write().failed) {
+			return std::function<run_result()>([]() { run_result r; r.failed = true; return r; });
+		}
+
+		return std::function<run_result()>([ctx, size]() {
+			run_result r;
+			io_waiter waiter(ctx->loop);
+			auto file = std::make_unique<fz::file>(iothread_file, fz::file::reading);
+			CIOThread io;
+			io.SetEventHandler(&waiter);
+			if (!*file || !io.Create(ctx->pool, std::move(file), true, true)) {
+				r.failed = true;
+				return r;
+			}
+
+			int64_t total{};
+			for (;;) {
+				char* buffer{};
+				int res = io.GetNextReadBuffer(&buffer);
+				if (res == IO_Again) {
+					waiter.wait();
+					continue;
+				}
+				if (res == IO_Success) {
+					break;
+				}
+				if (res < 0) {
+					r.failed = true;
+					break;
+				}
+				total += res;
+				++r.ops;
+			}
+			io.Destroy();
+			r.failed |= total != size;
+			r.bytes = total;
+			return r;
+		});
+	};
+}
+
+// Runner
+// ------
+
+std::vector<benchmark> all_benchmarks()
+{
+	std::vector<benchmark> benchmarks;
+	benchmarks.push_back({"parser/unix", parser_benchmark(listing_format::ls, DEFAULT)});
+	benchmarks.push_back({"parser/dos", parser_benchmark(listing_format::dos, DEFAULT)});
+	benchmarks.push_back({"parser/mlsd", parser_benchmark(listing_format::mlsd, DEFAULT)});
+	benchmarks.push_back({"parser/vms", parser_benchmark(listing_format::vms, VMS)});
+	for (unsigned int threads : { 1, 2, 4, 8 }) {
+		benchmarks.push_back({fz::sprintf("directorycache/lookup/threads:%u", threads), cache_benchmark(threads)});
+	}
+	benchmarks.push_back({"serverpath/parse", serverpath_parse()});
+	benchmarks.push_back({"serverpath/getpath", serverpath_getpath()});
+	benchmarks.push_back({"serverpath/addsegment_getparent", serverpath_segments()});
+	benchmarks.push_back({"serverpath/changepath", serverpath_changepath()});
+	benchmarks.push_back({"serverpath/isparentof", serverpath_isparentof()});
+	benchmarks.push_back({"serverpath/sort", serverpath_sort()});
+	benchmarks.push_back({"filter/literal", filter_literal()});
+	benchmarks.push_back({"filter/regex", filter_regex()});
+	benchmarks.push_back({"iothread/write", iothread_benchmark(false)});
+	benchmarks.push_back({"iothread/read", iothread_benchmark(true)});
+	return benchmarks;
+}
+
+struct measurement
+{
+	std::string name;
+	run_result result;
+	std::vector<double> seconds;
+	bool failed{};
+};
+
+measurement run(benchmark const& b)
+{
+	measurement m;
+	m.name = b.name;
+
+	auto timed = b.setup();
+	for (int i = 0; i < opts.repetitions; ++i) {
+		auto const start = fz::monotonic_clock::now();
+		run_result const r = timed();
+		auto const stop = fz::monotonic_clock::now();
+
+		m.seconds.push_back((stop - start).get_microseconds() / 1000000.0);
+		m.result = r;
+		m.failed |= r.failed;
+	}
+	return m;
+}
+
+double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	size_t const n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+double per_op_ns(double seconds, uint64_t ops)
+{
+	return ops ? seconds * 1e9 / ops : 0;
+}
+
+void print_text(measurement const& m)
+{
+	double const best = *std::min_element(m.seconds.begin(), m.seconds.end());
+	double const med = median(m.seconds);
+	printf("%-36s %12.1f ns/op (median %12.1f)", m.name.c_str(), per_op_ns(best, m.result.ops), per_op_ns(med, m.result.ops));
+	if (m.result.bytes && best > 0) {
+		printf(" %10.1f MiB/s", m.result.bytes / best / 1024 / 1024);
+	}
+	if (m.failed) {
+		printf(" FAILED");
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+void print_json(std::vector<measurement> const& measurements)
+{
+	printf("{\n  \"repetitions\": %d,\n  \"scale\": %g,\n  \"benchmarks\": [", opts.repetitions, opts.scale);
+	for (size_t i = 0; i < measurements.size(); ++i) {
+		auto const& m = measurements[i];
+		double const best = *std::min_element(m.seconds.begin(), m.seconds.end());
+		printf("%s    {\"name\": \"%s\", \"ops\": %llu, \"bytes\": %llu, \"best_ns_per_op\": %.3f, \"median_ns_per_op\": %.3f, \"failed\": %s, \"seconds\": [",
+			i ? ",\n" : "\n", m.name.c_str(), static_cast<unsigned long long>(m.result.ops), static_cast<unsigned long long>(m.result.bytes),
+			per_op_ns(best, m.result.ops), per_op_ns(median(m.seconds), m.result.ops), m.failed ? "true" : "false");
+		for (size_t j = 0; j < m.seconds.size(); ++j) {
+			printf("%s%.6f", j ? ", " : "", m.seconds[j]);
+		}
+		printf("]}");
+	}
+	printf("\n  ]\n}\n");
+}
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		if (arg == "--json") {
+			opts.json = true;
+		}
+		else if (arg == "--filter" && i + 1 < argc) {
+			opts.filter = argv[++i];
+		}
+		else if (arg == "--repetitions" && i + 1 < argc) {
+			opts.repetitions = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--scale" && i + 1 < argc) {
+			opts.scale = atof(argv[++i]);
+			if (opts.scale <= 0) {
+				opts.scale = 1;
+			}
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--json] [--filter substring] [--repetitions n] [--scale factor]\n"
+				"  --json         Print results as JSON\n"
+				"  --filter       Only run benchmarks with the substring in their name\n"
+				"  --repetitions  Timed runs per benchmark, default 5\n"
+				"  --scale        Multiplies the input sizes, default 1\n";
+			return 1;
+		}
+	}
+
+	std::vector<measurement> measurements;
+	bool failed{};
+	for (auto const& b : all_benchmarks()) {
+		if (!opts.filter.empty() && b.name.find(opts.filter) == std::string::npos) {
+			continue;
+		}
+
+		measurements.push_back(run(b));
+		failed |= measurements.back().failed;
+		if (!opts.json) {
+			print_text(measurements.back());
+		}
+	}
+
+	fz::remove_file(iothread_file);
+
+	if (opts.json) {
+		print_json(measurements);
+	}
+
+	return failed ? 1 : 0;
+}
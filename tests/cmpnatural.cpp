@@ -23,6 +23,7 @@ class CNaturalSortTest final : public CppUnit::TestFixture
 	CPPUNIT_TEST(testSeq);
 	CPPUNIT_TEST(testPair);
 	CPPUNIT_TEST(testFractional);
+	CPPUNIT_TEST(testSortKey);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -37,6 +38,7 @@ public:
 	void testSeq();
 	void testPair();
 	void testFractional();
+	void testSortKey();
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(CNaturalSortTest);
@@ -140,3 +142,47 @@ void CNaturalSortTest::testFractional()
 	CPPUNIT_ASSERT(CFileListCtrlSortBase::CmpNatural(_T("1.1"), _T("1.3")) < 0);
 	CPPUNIT_ASSERT(CFileListCtrlSortBase::CmpNatural(_T("1.3"), _T("1.15")) < 0);
 }
+
+namespace {
+int sign(int v)
+{
+	return (v > 0) - (v < 0);
+}
+
+int CmpKeys(std::wstring const& a, std::wstring const& b)
+{
+	auto const mode = CFileListCtrlSortBase::namesort_natural;
+	return sign(CFileListCtrlSortBase::MakeSortKey(a, mode).compare(CFileListCtrlSortBase::MakeSortKey(b, mode)));
+}
+}
+
+void CNaturalSortTest::testSortKey()
+{
+	// Comparing the keys agrees with comparing the names
+	std::vector<std::wstring> const names{
+		L"", L"x", L"a", L"A", L"B", L"b", L"ab", L"affasfac", L"afFasFAc",
+		L"0", L"1", L"2", L"02", L"3", L"10", L"15", L"17", L"25", L"021", L"2100", L"02005", L"010",
+		L"abc1xx", L"abc2xx", L"abc1bb", L"abc2aa", L"abc2", L"10abc", L"10def", L"10abc2", L"10abc3", L"1abc", L"1def",
+		L"a0", L"a1", L"a1a", L"a1b", L"a2", L"a10", L"a20",
+		L"x2-g8", L"x2-y7", L"x2-y08", L"x8-y8",
+		L"1.001", L"1.002", L"1.010", L"1.1", L"1.3", L"1.15",
+		L"x09.y", L"x9.y", L"x09.z", L"x9.z", L"x09", L"x9"
+	};
+	for (auto const& a : names) {
+		for (auto const& b : names) {
+			int const expected = sign(CFileListCtrlSortBase::CmpNatural(a, b));
+			int const actual = CmpKeys(a, b);
+			CPPUNIT_ASSERT_MESSAGE(fz::to_string(a + L" <> " + b), actual == expected);
+		}
+	}
+
+	CPPUNIT_ASSERT(CmpKeys(L"09", L"09!") < 0);
+	CPPUNIT_ASSERT(CmpKeys(L"09!", L"9x") < 0);
+	CPPUNIT_ASSERT(CmpKeys(L"09", L"9x") < 0);
+
+	// Names ending in a number are ordered consistently against names
+	// continuing after the same number with fewer leading zeros
+	CPPUNIT_ASSERT(CFileListCtrlSortBase::CmpNatural(L"09", L"09!") < 0);
+	CPPUNIT_ASSERT(CFileListCtrlSortBase::CmpNatural(L"09!", L"9x") < 0);
+	CPPUNIT_ASSERT(CFileListCtrlSortBase::CmpNatural(L"09", L"9x") < 0);
+}
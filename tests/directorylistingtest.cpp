@@ -0,0 +1,153 @@
+#include <filezilla.h>
+#include <directorylisting.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+/*
+ * This testsuite asserts the correctness of the name lookups of the
+ * CDirectoryListing class, which are answered by a lazily built index.
+ */
+
+class CDirectoryListingTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CDirectoryListingTest);
+	CPPUNIT_TEST(testFindCase);
+	CPPUNIT_TEST(testFindNoCase);
+	CPPUNIT_TEST(testFindAllNoCase);
+	CPPUNIT_TEST(testLazy);
+	CPPUNIT_TEST(testShared);
+	CPPUNIT_TEST(testModified);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testFindCase();
+	void testFindNoCase();
+	void testFindAllNoCase();
+	void testLazy();
+	void testShared();
+	void testModified();
+
+private:
+	static CDirectoryListing make(std::vector<std::wstring> const& names);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CDirectoryListingTest);
+
+CDirectoryListing CDirectoryListingTest::make(std::vector<std::wstring> const& names)
+{
+	CDirectoryListing listing;
+	listing.path = CServerPath(L"/");
+	for (auto const& name : names) {
+		CDirentry entry;
+		entry.name = name;
+		entry.size = 0;
+		entry.flags = 0;
+		listing.Append(std::move(entry));
+	}
+	return listing;
+}
+
+void CDirectoryListingTest::testFindCase()
+{
+	CDirectoryListing const empty;
+	CPPUNIT_ASSERT(empty.FindFile_CmpCase(L"a") == std::wstring::npos);
+
+	CDirectoryListing const listing = make({L"foo", L"Foo", L"bar", L"foo", L"BAR"});
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpCase(L"foo"));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), listing.FindFile_CmpCase(L"Foo"));
+	CPPUNIT_ASSERT_EQUAL(size_t(2), listing.FindFile_CmpCase(L"bar"));
+	CPPUNIT_ASSERT_EQUAL(size_t(4), listing.FindFile_CmpCase(L"BAR"));
+	CPPUNIT_ASSERT(listing.FindFile_CmpCase(L"FOO") == std::wstring::npos);
+	CPPUNIT_ASSERT(listing.FindFile_CmpCase(L"") == std::wstring::npos);
+
+	// Same results from the complete index
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpCase(L"foo"));
+	CPPUNIT_ASSERT_EQUAL(size_t(4), listing.FindFile_CmpCase(L"BAR"));
+}
+
+void CDirectoryListingTest::testFindNoCase()
+{
+	CDirectoryListing const listing = make({L"README", L"readme", L"Makefile", L"a.TXT"});
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpNoCase(L"readme"));
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpNoCase(L"ReadMe"));
+	CPPUNIT_ASSERT_EQUAL(size_t(2), listing.FindFile_CmpNoCase(L"MAKEFILE"));
+	CPPUNIT_ASSERT_EQUAL(size_t(3), listing.FindFile_CmpNoCase(L"a.txt"));
+	CPPUNIT_ASSERT(listing.FindFile_CmpNoCase(L"readme.txt") == std::wstring::npos);
+}
+
+void CDirectoryListingTest::testFindAllNoCase()
+{
+	CDirectoryListing const listing = make({L"x", L"a", L"A", L"b", L"a", L"B"});
+	CPPUNIT_ASSERT(listing.FindFiles_CmpNoCase(L"a") == std::vector<size_t>({1, 2, 4}));
+	CPPUNIT_ASSERT(listing.FindFiles_CmpNoCase(L"B") == std::vector<size_t>({3, 5}));
+	CPPUNIT_ASSERT(listing.FindFiles_CmpNoCase(L"c").empty());
+
+	CDirectoryListing const empty;
+	CPPUNIT_ASSERT(empty.FindFiles_CmpNoCase(L"a").empty());
+}
+
+void CDirectoryListingTest::testLazy()
+{
+	std::vector<std::wstring> names;
+	for (int i = 0; i < 1000; ++i) {
+		names.push_back(L"file" + std::to_wstring(i));
+	}
+	CDirectoryListing const listing = make(names);
+
+	// Each lookup indexes only up to the entry found, later ones must still
+	// find the earlier entries as well as the later ones.
+	CPPUNIT_ASSERT_EQUAL(size_t(10), listing.FindFile_CmpCase(L"file10"));
+	CPPUNIT_ASSERT_EQUAL(size_t(5), listing.FindFile_CmpCase(L"file5"));
+	CPPUNIT_ASSERT_EQUAL(size_t(500), listing.FindFile_CmpCase(L"file500"));
+	CPPUNIT_ASSERT_EQUAL(size_t(10), listing.FindFile_CmpNoCase(L"FILE10"));
+	CPPUNIT_ASSERT(listing.FindFiles_CmpNoCase(L"File999") == std::vector<size_t>({999}));
+	CPPUNIT_ASSERT(listing.FindFile_CmpCase(L"file1000") == std::wstring::npos);
+
+	for (size_t i = 0; i < names.size(); ++i) {
+		CPPUNIT_ASSERT_EQUAL(i, listing.FindFile_CmpCase(names[i]));
+		CPPUNIT_ASSERT_EQUAL(i, listing.FindFile_CmpNoCase(names[i]));
+	}
+}
+
+void CDirectoryListingTest::testShared()
+{
+	CDirectoryListing listing = make({L"a", L"b", L"c"});
+	CPPUNIT_ASSERT_EQUAL(size_t(2), listing.FindFile_CmpCase(L"c"));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), listing.FindFile_CmpNoCase(L"B"));
+
+	// The copy shares the complete index
+	CDirectoryListing copy = listing;
+	CPPUNIT_ASSERT_EQUAL(size_t(0), copy.FindFile_CmpCase(L"a"));
+	CPPUNIT_ASSERT_EQUAL(size_t(2), copy.FindFile_CmpNoCase(L"C"));
+
+	// Extending one of them must not affect the other
+	CDirentry entry;
+	entry.name = L"d";
+	entry.size = 0;
+	entry.flags = 0;
+	copy.Append(std::move(entry));
+	CPPUNIT_ASSERT_EQUAL(size_t(3), copy.FindFile_CmpCase(L"d"));
+	CPPUNIT_ASSERT(copy.FindFiles_CmpNoCase(L"D") == std::vector<size_t>({3}));
+	CPPUNIT_ASSERT(listing.FindFile_CmpCase(L"d") == std::wstring::npos);
+	CPPUNIT_ASSERT(listing.FindFiles_CmpNoCase(L"d").empty());
+	CPPUNIT_ASSERT_EQUAL(size_t(2), listing.FindFile_CmpCase(L"c"));
+}
+
+void CDirectoryListingTest::testModified()
+{
+	CDirectoryListing listing = make({L"a", L"b", L"a"});
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpCase(L"a"));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), listing.FindFile_CmpCase(L"b"));
+
+	CPPUNIT_ASSERT(listing.RemoveEntry(0));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), listing.FindFile_CmpCase(L"a"));
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpCase(L"b"));
+
+	listing.get(0).name = L"B2";
+	listing.ClearFindMap();
+	CPPUNIT_ASSERT(listing.FindFile_CmpCase(L"b") == std::wstring::npos);
+	CPPUNIT_ASSERT_EQUAL(size_t(0), listing.FindFile_CmpNoCase(L"b2"));
+}
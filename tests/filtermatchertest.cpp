@@ -0,0 +1,109 @@
+#include <filezilla.h>
+#include <../interface/filter_matcher.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <regex>
+
+#include <wctype.h>
+
+/*
+ * This testsuite asserts that the regular expressions of filter conditions
+ * match the same subjects as std::regex, which they replace.
+ */
+
+class CFilterRegexTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CFilterRegexTest);
+	CPPUNIT_TEST(testMatchCase);
+	CPPUNIT_TEST(testIgnoreCase);
+	CPPUNIT_TEST(testNegated);
+	CPPUNIT_TEST(testUnsupported);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testMatchCase();
+	void testIgnoreCase();
+	void testNegated();
+	void testUnsupported();
+
+private:
+	void compare(std::vector<std::wstring> const& patterns, bool matchCase);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CFilterRegexTest);
+
+namespace {
+std::vector<std::wstring> const subjects{
+	L"", L"a", L"A", L"b", L"B", L"x", L"X", L"_", L"9", L".",
+	L"xyz", L"xYz", L"XaZ", L"abc", L"ABC", L"dDd", L"Q1", L"abHH", L"CDeg", L"cdXY",
+	L"file.txt", L"FILE.TXT", L"a.b", L"readme", L"README.md", L"backup-2020.tar.gz",
+	L"ä", L"Ä", L"a b", L"tab\tbed"
+};
+}
+
+void CFilterRegexTest::compare(std::vector<std::wstring> const& patterns, bool matchCase)
+{
+	for (auto const& pattern : patterns) {
+		CFilterRegex regex;
+		CPPUNIT_ASSERT_MESSAGE(fz::to_string(pattern), regex.compile(pattern, matchCase));
+
+		auto flags = std::regex_constants::ECMAScript;
+		if (!matchCase) {
+			flags |= std::regex_constants::icase;
+		}
+		std::wregex const reference(pattern, flags);
+
+		for (auto const& subject : subjects) {
+			// Subjects are lowercased by the caller unless matching case
+			std::wstring s = subject;
+			if (!matchCase) {
+				for (auto & c : s) {
+					c = static_cast<wchar_t>(towlower(static_cast<wint_t>(c)));
+				}
+			}
+
+			bool const expected = std::regex_search(subject, reference);
+			CPPUNIT_ASSERT_MESSAGE(fz::to_string(pattern + L" ~ " + subject), regex.search(s) == expected);
+		}
+	}
+}
+
+void CFilterRegexTest::testMatchCase()
+{
+	compare({
+		L"a", L"^a$", L"abc", L"^[A-C]+$", L"[a-f0-9]{3}", L"\\.txt$", L".+\\.TXT$",
+		L"^(ab|cd)e*$", L"x?y+z*", L"^\\d+$", L"\\w\\W", L"\\s", L"^.{2,4}$", L"(?:ab)+"
+	}, true);
+}
+
+void CFilterRegexTest::testIgnoreCase()
+{
+	compare({
+		L"a", L"^a$", L"abc", L"^[A-C]+$", L"[A-F0-9]{3}", L"\\.txt$", L".+\\.TXT$",
+		L"^(AB|cd)E*$", L"README", L"^[a-z]+$", L"\\w\\W", L"^.{2,4}$"
+	}, false);
+}
+
+void CFilterRegexTest::testNegated()
+{
+	std::vector<std::wstring> const patterns{
+		L"[^a]", L"^[^x]+$", L"[^a-c]", L"[^A-Z]", L"^[^\\d]+$", L"^[^_a-z]", L"x[^y]z",
+		L"^(ab|cd)[^e-g]*$", L"[^\\W]", L"\\W", L"[^]", L"[]", L"^[^.]*$", L"^[^A-Fa]+$"
+	};
+	compare(patterns, true);
+	compare(patterns, false);
+}
+
+void CFilterRegexTest::testUnsupported()
+{
+	// Left to std::regex
+	CFilterRegex regex;
+	CPPUNIT_ASSERT(!regex.compile(L"(a)\\1", true));
+	CPPUNIT_ASSERT(!regex.compile(L"a(?=b)", true));
+	CPPUNIT_ASSERT(!regex.compile(L"\\bword", true));
+	CPPUNIT_ASSERT(!regex.compile(L"[[:alpha:]]", true));
+}
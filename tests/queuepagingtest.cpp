@@ -0,0 +1,173 @@
+#include <filezilla.h>
+#include <../interface/queue_paging.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <string>
+
+/*
+ * This testsuite asserts that the rows of a journaled queue which only
+ * exist in the database get loaded in order and exactly once.
+ */
+
+class CQueuePagingTest final : public CppUnit::TestFixture
+{
+	CPPUNIT_TEST_SUITE(CQueuePagingTest);
+	CPPUNIT_TEST(testSpill);
+	CPPUNIT_TEST(testTakeSite);
+	CPPUNIT_TEST(testDropLoaded);
+	CPPUNIT_TEST(testPaging);
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void setUp() {}
+	void tearDown() {}
+
+	void testSpill();
+	void testTakeSite();
+	void testDropLoaded();
+	void testPaging();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CQueuePagingTest);
+
+namespace {
+typedef std::vector<std::pair<int64_t, int*>> page_t;
+
+std::vector<int64_t> ids(page_t const& page)
+{
+	std::vector<int64_t> ret;
+	for (auto const& row : page) {
+		ret.push_back(row.first);
+		CPPUNIT_ASSERT_EQUAL(row.first, static_cast<int64_t>(*row.second));
+	}
+	return ret;
+}
+
+void free_page(page_t & page)
+{
+	for (auto & row : page) {
+		delete row.second;
+	}
+	page.clear();
+}
+
+// Like CQueueStorage::GetFiles on a table holding the given row ids
+int get_page(std::vector<int64_t> const& table, page_t & page, int64_t & after, int limit)
+{
+	int read{};
+	for (auto const id : table) {
+		if (id > after && read < limit) {
+			page.emplace_back(id, new int(static_cast<int>(id)));
+			after = id;
+			++read;
+		}
+	}
+	return read;
+}
+}
+
+void CQueuePagingTest::testSpill()
+{
+	unloaded_queue_rows<std::string> rows;
+	CPPUNIT_ASSERT(rows.empty());
+	CPPUNIT_ASSERT(!rows.must_spill("a", 10, 100));
+	CPPUNIT_ASSERT(rows.must_spill("a", 100, 100));
+
+	rows.spilled("a", 1, 50);
+	CPPUNIT_ASSERT(!rows.empty());
+	CPPUNIT_ASSERT(rows.has(1));
+	CPPUNIT_ASSERT(!rows.has(2));
+	CPPUNIT_ASSERT(rows.has_site("a"));
+	CPPUNIT_ASSERT(!rows.has_site("b"));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), rows.ranges().size());
+	CPPUNIT_ASSERT_EQUAL(int64_t(49), rows.ranges()[0].after);
+
+	// Once rows are unloaded, even a short queue has to spill to keep its order
+	CPPUNIT_ASSERT(rows.must_spill("a", 0, 100));
+	CPPUNIT_ASSERT(!rows.must_spill("b", 0, 100));
+
+	// Later rows are covered by the existing range
+	rows.spilled("a", 1, 51);
+	CPPUNIT_ASSERT_EQUAL(size_t(1), rows.ranges().size());
+	CPPUNIT_ASSERT_EQUAL(int64_t(49), rows.ranges()[0].after);
+
+	// Another server row of the same site gets its own range
+	rows.spilled("a", 2, 60);
+	CPPUNIT_ASSERT_EQUAL(size_t(2), rows.ranges().size());
+	CPPUNIT_ASSERT(rows.has(2));
+	CPPUNIT_ASSERT_EQUAL(int64_t(59), rows.ranges()[1].after);
+
+	rows.clear();
+	CPPUNIT_ASSERT(rows.empty());
+	CPPUNIT_ASSERT(!rows.has_site("a"));
+}
+
+void CQueuePagingTest::testTakeSite()
+{
+	unloaded_queue_rows<std::string> rows;
+	rows.spilled("a", 1, 10);
+	rows.spilled("b", 2, 20);
+	rows.spilled("a", 3, 30);
+
+	auto const taken = rows.take_site("a");
+	CPPUNIT_ASSERT_EQUAL(size_t(2), taken.size());
+	CPPUNIT_ASSERT_EQUAL(int64_t(1), taken[0].serverId);
+	CPPUNIT_ASSERT_EQUAL(int64_t(9), taken[0].after);
+	CPPUNIT_ASSERT_EQUAL(int64_t(3), taken[1].serverId);
+	CPPUNIT_ASSERT_EQUAL(int64_t(29), taken[1].after);
+
+	// A removed site no longer makes new items spill
+	CPPUNIT_ASSERT(!rows.has_site("a"));
+	CPPUNIT_ASSERT(!rows.must_spill("a", 0, 100));
+	CPPUNIT_ASSERT(rows.has(2));
+	CPPUNIT_ASSERT_EQUAL(size_t(1), rows.ranges().size());
+
+	CPPUNIT_ASSERT(rows.take_site("c").empty());
+	CPPUNIT_ASSERT_EQUAL(size_t(1), rows.ranges().size());
+}
+
+void CQueuePagingTest::testDropLoaded()
+{
+	page_t page;
+	int64_t after{3};
+	CPPUNIT_ASSERT_EQUAL(5, get_page({1, 2, 3, 4, 5, 6, 7, 8}, page, after, 10));
+
+	drop_loaded_rows(page, {5, 7, 9});
+	CPPUNIT_ASSERT(ids(page) == std::vector<int64_t>({4, 6, 8}));
+
+	drop_loaded_rows(page, {});
+	CPPUNIT_ASSERT(ids(page) == std::vector<int64_t>({4, 6, 8}));
+	free_page(page);
+}
+
+void CQueuePagingTest::testPaging()
+{
+	// Rows 1 to 3 got loaded on startup. Row 9 was journaled later for an
+	// item that stayed in memory.
+	std::vector<int64_t> const table{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+	std::unordered_set<int64_t> const loaded{9};
+	int const page_size = 3;
+
+	unloaded_queue_rows<std::string> rows;
+	rows.ranges().push_back({"a", 1, 3});
+
+	std::vector<int64_t> order;
+	while (!rows.empty()) {
+		auto & range = rows.ranges().front();
+
+		page_t page;
+		int const read = get_page(table, page, range.after, page_size);
+		drop_loaded_rows(page, loaded);
+		for (auto const id : ids(page)) {
+			order.push_back(id);
+		}
+		free_page(page);
+
+		if (read != page_size) {
+			rows.ranges().erase(rows.ranges().begin());
+		}
+	}
+
+	CPPUNIT_ASSERT(order == std::vector<int64_t>({4, 5, 6, 7, 8, 10}));
+}
@@ -17,6 +17,7 @@ class CServerPathTest final : public CppUnit::TestFixture
 	CPPUNIT_TEST(testGetCommonParent);
 	CPPUNIT_TEST(testFormatFilename);
 	CPPUNIT_TEST(testChangePath);
+	CPPUNIT_TEST(testGetSegments);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -30,6 +31,7 @@ public:
 	void testGetCommonParent();
 	void testFormatFilename();
 	void testChangePath();
+	void testGetSegments();
 
 protected:
 };
@@ -687,3 +689,22 @@ void CServerPathTest::testChangePath()
 	}
 
 }
+
+void CServerPathTest::testGetSegments()
+{
+	CPPUNIT_ASSERT(CServerPath().GetSegments().empty());
+	CPPUNIT_ASSERT(CServerPath(L"/").GetSegments().empty());
+
+	const CServerPath unix1(L"/foo/bar/baz");
+	auto const segments = unix1.GetSegments();
+	CPPUNIT_ASSERT_EQUAL(unix1.SegmentCount(), segments.size());
+	for (size_t i = 0; i < segments.size(); ++i) {
+		CPPUNIT_ASSERT(*segments[i] == unix1.GetSegment(i));
+	}
+	CPPUNIT_ASSERT(*segments[0] == L"foo" && *segments[2] == L"baz");
+
+	const CServerPath dos1(L"c:\\bar\\baz", DOS);
+	auto const dosSegments = dos1.GetSegments();
+	CPPUNIT_ASSERT_EQUAL(dos1.SegmentCount(), dosSegments.size());
+	CPPUNIT_ASSERT(*dosSegments.back() == L"baz");
+}
@@ -0,0 +1,711 @@
+#include <libfilezilla_engine.h>
+#include <engine_context.h>
+#include <headless_options.h>
+
+#include <libfilezilla/file.hpp>
+#include <libfilezilla/format.hpp>
+#include <libfilezilla/local_filesys.hpp>
+#include <libfilezilla/mutex.hpp>
+#include <libfilezilla/time.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef FZ_WINDOWS
+#include <sys/resource.h>
+#endif
+
+/*
+ * Benchmark of the real transfer paths, driving CFileZillaEngine against a
+ * server on the loopback interface.
+ *
+ * The server has to be started beforehand, e.g. vsftpd or proftpd for FTP
+ * and FTPS or a second sshd instance for SFTP, with a user allowed to write
+ * to --remote-dir. SFTP needs fzsftp, point FZ_FZSFTP to it. Everything
+ * below --remote-dir gets removed again unless --keep is given.
+ *
+ * HTTP cannot upload. Run with --keep against an FTP or SFTP server first
+ * and serve its --remote-dir over HTTP, e.g. with python3 -m http.server,
+ * the HTTP run then only downloads.
+ *
+ * Workloads:
+ *   large    One large file, uploaded and downloaded
+ *   small    Many 1 KiB files, uploaded and downloaded
+ *   listing  Repeated listings of a deep directory tree
+ *   mixed    Uploads and downloads of mixed sizes at the same time
+ *
+ * Reported are throughput, files or listings per second, CPU time per GiB
+ * and latency percentiles per file or listing. CPU time includes that of
+ * fzsftp, engines get disconnected after each workload so the child
+ * processes get accounted for.
+ */
+
+namespace {
+
+struct options
+{
+	bool json{};
+	bool keep{};
+	std::string filter;
+	double scale{1};
+	size_t engines{4};
+	CServer server;
+	Credentials credentials;
+	CServerPath remoteDir{L"/fzbench", UNIX};
+	std::wstring localDir{L"fzbench"};
+};
+
+options opts;
+
+size_t scaled(size_t n)
+{
+	return std::max(size_t(1), static_cast<size_t>(n * opts.scale));
+}
+
+bool can_upload()
+{
+	return opts.server.GetProtocol() != HTTP && opts.server.GetProtocol() != HTTPS;
+}
+
+double cpu_seconds(bool children)
+{
+#ifdef FZ_WINDOWS
+	if (children) {
+		return 0;
+	}
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+		return 0;
+	}
+	auto const to_seconds = [](FILETIME const& t) {
+		return ((static_cast<uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) / 10000000.0;
+	};
+	return to_seconds(kernel) + to_seconds(user);
+#else
+	rusage usage{};
+	getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+#endif
+}
+
+// Runs commands synchronously on its own engine, async requests get
+// answered without asking: Existing files are overwritten and the server
+// is trusted, it is a local test server after all.
+class driver final : public EngineNotificationHandler
+{
+public:
+	explicit driver(CFileZillaEngineContext & context)
+		: engine_(context, *this)
+	{}
+
+	int Run(CCommand const& command)
+	{
+		int res = engine_.Execute(command);
+		while (res == FZ_REPLY_WOULDBLOCK) {
+			{
+				fz::scoped_lock l(mutex_);
+				while (!signalled_) {
+					cond_.wait(l);
+				}
+				signalled_ = false;
+			}
+
+			// Always drain all notifications, there is no further event
+			// for the ones left behind.
+			while (auto notification = engine_.GetNextNotification()) {
+				if (notification->GetID() == nId_operation) {
+					res = static_cast<COperationNotification const&>(*notification).nReplyCode;
+				}
+				else if (notification->GetID() == nId_asyncrequest) {
+					Reply(std::unique_ptr<CAsyncRequestNotification>(static_cast<CAsyncRequestNotification*>(notification.release())));
+				}
+			}
+		}
+		return res;
+	}
+
+	bool Connect()
+	{
+		if (engine_.IsConnected()) {
+			return true;
+		}
+		return Run(CConnectCommand(opts.server, ServerHandle(), opts.credentials)) == FZ_REPLY_OK;
+	}
+
+	void Disconnect()
+	{
+		if (engine_.IsConnected()) {
+			Run(CDisconnectCommand());
+		}
+	}
+
+private:
+	virtual void OnEngineEvent(CFileZillaEngine*) override
+	{
+		fz::scoped_lock l(mutex_);
+		signalled_ = true;
+		cond_.signal(l);
+	}
+
+	void Reply(std::unique_ptr<CAsyncRequestNotification> && request)
+	{
+		switch (request->GetRequestID()) {
+		case reqId_fileexists:
+			static_cast<CFileExistsNotification&>(*request).overwriteAction = CFileExistsNotification::overwrite;
+			break;
+		case reqId_hostkey:
+		case reqId_hostkeyChanged:
+			static_cast<CHostKeyNotification&>(*request).m_trust = true;
+			break;
+		case reqId_certificate:
+			static_cast<CCertificateNotification&>(*request).trusted_ = true;
+			break;
+		case reqId_insecure_connection:
+			static_cast<CInsecureConnectionNotification&>(*request).allow_ = true;
+			break;
+		default:
+			break;
+		}
+		engine_.SetAsyncRequestReply(std::move(request));
+	}
+
+	// Declared first, the engine may still signal while being destroyed
+	fz::mutex mutex_;
+	fz::condition cond_;
+	bool signalled_{};
+
+	CFileZillaEngine engine_;
+};
+
+struct measurement
+{
+	std::string name;
+	uint64_t ops{};
+	uint64_t bytes{};
+	double seconds{};
+	double cpu{};
+	std::vector<double> latencies; // milliseconds
+	bool failed{};
+};
+
+// Returns the transferred bytes, -1 on failure
+typedef std::function<int64_t(driver & d, size_t engine)> job;
+
+// Each engine takes the next job as soon as it is done with the previous one
+measurement run_jobs(std::string const& name, std::vector<std::unique_ptr<driver>> & drivers, std::vector<job> const& jobs, size_t engines)
+{
+	measurement m;
+	m.name = name;
+	m.ops = jobs.size();
+
+	engines = std::min(engines, drivers.size());
+	double const childrenStart = cpu_seconds(true);
+	for (size_t i = 0; i < engines; ++i) {
+		if (!drivers[i]->Connect()) {
+			fprintf(stderr, "%s: Could not connect to the server\n", name.c_str());
+			m.failed = true;
+			return m;
+		}
+	}
+
+	std::atomic<size_t> next{};
+	std::atomic<uint64_t> bytes{};
+	std::atomic<bool> failed{};
+	std::vector<std::vector<double>> latencies(engines);
+
+	double const selfStart = cpu_seconds(false);
+	auto const start = fz::monotonic_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < engines; ++i) {
+		threads.emplace_back([&, i]() {
+			for (size_t j = next++; j < jobs.size(); j = next++) {
+				auto const jobStart = fz::monotonic_clock::now();
+				int64_t const res = jobs[j](*drivers[i], i);
+				latencies[i].push_back((fz::monotonic_clock::now() - jobStart).get_microseconds() / 1000.0);
+				if (res < 0) {
+					failed = true;
+				}
+				else {
+					bytes += static_cast<uint64_t>(res);
+				}
+			}
+		});
+	}
+	for (auto & t : threads) {
+		t.join();
+	}
+
+	m.seconds = (fz::monotonic_clock::now() - start).get_microseconds() / 1000000.0;
+	m.cpu = cpu_seconds(false) - selfStart;
+
+	// Child processes only get accounted for once they have exited
+	for (size_t i = 0; i < engines; ++i) {
+		drivers[i]->Disconnect();
+	}
+	m.cpu += cpu_seconds(true) - childrenStart;
+
+	m.bytes = bytes;
+	m.failed = failed;
+	for (auto const& l : latencies) {
+		m.latencies.insert(m.latencies.end(), l.begin(), l.end());
+	}
+	std::sort(m.latencies.begin(), m.latencies.end());
+	return m;
+}
+
+// Setup and cleanup, not measured
+bool run_untimed(std::vector<std::unique_ptr<driver>> & drivers, std::vector<job> const& jobs)
+{
+	return !run_jobs("setup", drivers, jobs, drivers.size()).failed;
+}
+
+std::wstring local_file(std::wstring const& name)
+{
+	return opts.localDir + fz::local_filesys::path_separator + name;
+}
+
+bool create_local_file(std::wstring const& name, int64_t size)
+{
+	fz::file f(fz::to_native(local_file(name)), fz::file::writing, fz::file::empty);
+	if (!f.opened()) {
+		fprintf(stderr, "Could not create %s\n", fz::to_string(local_file(name)).c_str());
+		return false;
+	}
+
+	std::mt19937 rng(42);
+	std::vector<char> buf(1024 * 1024);
+	for (auto & c : buf) {
+		c = static_cast<char>(rng());
+	}
+	while (size > 0) {
+		int64_t const chunk = std::min(size, static_cast<int64_t>(buf.size()));
+		if (f.write(buf.data(), chunk) != chunk) {
+			return false;
+		}
+		size -= chunk;
+	}
+	return true;
+}
+
+CServerPath remote_dir(std::wstring const& sub = std::wstring())
+{
+	CServerPath path = opts.remoteDir;
+	if (!sub.empty()) {
+		path.AddSegment(sub);
+	}
+	return path;
+}
+
+job mkdir_job(CServerPath const& path)
+{
+	// Fails if it already exists, that is fine
+	return [path](driver & d, size_t) {
+		d.Run(CMkdirCommand(path));
+		return int64_t();
+	};
+}
+
+job transfer_job(std::wstring const& local, CServerPath const& path, std::wstring const& remote, bool download, int64_t size)
+{
+	return [=](driver & d, size_t engine) {
+		// Concurrent downloads must not share the local file
+		std::wstring const target = download ? local + fz::to_wstring(engine) : local;
+		CFileTransferCommand::t_transferSettings settings;
+		int const res = d.Run(CFileTransferCommand(target, path, remote, download, settings));
+		return res == FZ_REPLY_OK ? size : int64_t(-1);
+	};
+}
+
+job delete_job(CServerPath const& path, std::vector<std::wstring> names)
+{
+	return [=](driver & d, size_t) {
+		std::vector<std::wstring> files = names;
+		d.Run(CDeleteCommand(path, std::move(files)));
+		return int64_t();
+	};
+}
+
+job rmdir_job(CServerPath const& path)
+{
+	return [path](driver & d, size_t) {
+		d.Run(CRemoveDirCommand(path.GetParent(), path.GetLastSegment()));
+		return int64_t();
+	};
+}
+
+// Deletion in batches, a single command with all files would take forever
+// to report progress on slow servers.
+std::vector<job> cleanup_jobs(CServerPath const& path, std::vector<std::wstring> const& names)
+{
+	std::vector<job> jobs;
+	for (size_t i = 0; i < names.size(); i += 1000) {
+		jobs.push_back(delete_job(path, std::vector<std::wstring>(names.begin() + i, names.begin() + std::min(names.size(), i + 1000))));
+	}
+	return jobs;
+}
+
+void cleanup(std::vector<std::unique_ptr<driver>> & drivers, std::vector<job> const& files, std::vector<CServerPath> const& dirs)
+{
+	if (opts.keep || !can_upload()) {
+		return;
+	}
+	run_untimed(drivers, files);
+	for (auto const& dir : dirs) {
+		run_untimed(drivers, {rmdir_job(dir)});
+	}
+}
+
+// Workloads
+// ---------
+
+std::vector<measurement> large_file(std::vector<std::unique_ptr<driver>> & drivers)
+{
+	int64_t const size = static_cast<int64_t>(scaled(256)) * 1024 * 1024;
+	std::vector<measurement> ret;
+	if (!create_local_file(L"large.bin", size)) {
+		return ret;
+	}
+
+	CServerPath const path = remote_dir();
+	if (can_upload()) {
+		run_untimed(drivers, {mkdir_job(path)});
+		ret.push_back(run_jobs("large/upload", drivers, {transfer_job(local_file(L"large.bin"), path, L"large.bin", false, size)}, 1));
+	}
+	ret.push_back(run_jobs("large/download", drivers, {transfer_job(local_file(L"large.down"), path, L"large.bin", true, size)}, 1));
+
+	cleanup(drivers, {delete_job(path, {L"large.bin"})}, {});
+	fz::remove_file(fz::to_native(local_file(L"large.bin")));
+	fz::remove_file(fz::to_native(local_file(L"large.down0")));
+	return ret;
+}
+
+std::vector<measurement> small_files(std::vector<std::unique_ptr<driver>> & drivers)
+{
+	int64_t const size = 1024;
+	size_t const count = scaled(100000);
+	std::vector<measurement> ret;
+	if (!create_local_file(L"small.bin", size)) {
+		return ret;
+	}
+
+	CServerPath const path = remote_dir(L"small");
+	std::vector<std::wstring> names;
+	std::vector<job> uploads;
+	std::vector<job> downloads;
+	for (size_t i = 0; i < count; ++i) {
+		names.push_back(fz::sprintf(L"f%06d", i));
+		uploads.push_back(transfer_job(local_file(L"small.bin"), path, names.back(), false, size));
+		downloads.push_back(transfer_job(local_file(L"small.down"), path, names.back(), true, size));
+	}
+
+	if (can_upload()) {
+		run_untimed(drivers, {mkdir_job(remote_dir()), mkdir_job(path)});
+		ret.push_back(run_jobs("small/upload", drivers, uploads, opts.engines));
+	}
+	ret.push_back(run_jobs("small/download", drivers, downloads, opts.engines));
+
+	cleanup(drivers, cleanup_jobs(path, names), {path});
+	fz::remove_file(fz::to_native(local_file(L"small.bin")));
+	for (size_t i = 0; i < opts.engines; ++i) {
+		fz::remove_file(fz::to_native(local_file(L"small.down" + fz::to_wstring(i))));
+	}
+	return ret;
+}
+
+std::vector<measurement> deep_listing(std::vector<std::unique_ptr<driver>> & drivers)
+{
+	size_t const depth = 20;
+	size_t const entries = scaled(200);
+	std::vector<measurement> ret;
+	if (!can_upload() || !create_local_file(L"empty.bin", 0)) {
+		return ret;
+	}
+
+	std::vector<CServerPath> dirs;
+	std::vector<job> mkdirs{mkdir_job(remote_dir())};
+	CServerPath path = remote_dir();
+	for (size_t i = 0; i < depth; ++i) {
+		path.AddSegment(fz::sprintf(L"d%02d", i));
+		dirs.push_back(path);
+		mkdirs.push_back(mkdir_job(path));
+	}
+
+	std::vector<std::wstring> names;
+	for (size_t i = 0; i < entries; ++i) {
+		names.push_back(fz::sprintf(L"e%05d", i));
+	}
+
+	std::vector<job> uploads;
+	std::vector<job> deletes;
+	std::vector<job> lists;
+	for (auto const& dir : dirs) {
+		for (auto const& name : names) {
+			uploads.push_back(transfer_job(local_file(L"empty.bin"), dir, name, false, 0));
+		}
+		auto const batch = cleanup_jobs(dir, names);
+		deletes.insert(deletes.end(), batch.begin(), batch.end());
+	}
+	for (int repetition = 0; repetition < 5; ++repetition) {
+		for (auto const& dir : dirs) {
+			lists.push_back([dir](driver & d, size_t) {
+				return d.Run(CListCommand(dir, std::wstring(), LIST_FLAG_REFRESH)) == FZ_REPLY_OK ? int64_t() : int64_t(-1);
+			});
+		}
+	}
+
+	// Directories one after another, parents first
+	for (auto const& mkdir : mkdirs) {
+		run_untimed(drivers, {mkdir});
+	}
+	run_untimed(drivers, uploads);
+	ret.push_back(run_jobs("listing/deep", drivers, lists, opts.engines));
+
+	std::reverse(dirs.begin(), dirs.end());
+	cleanup(drivers, deletes, dirs);
+	fz::remove_file(fz::to_native(local_file(L"empty.bin")));
+	return ret;
+}
+
+std::vector<measurement> mixed_queue(std::vector<std::unique_ptr<driver>> & drivers)
+{
+	size_t const count = scaled(1000);
+	int64_t const sizes[] = {16 * 1024, 1024 * 1024, 32 * 1024 * 1024};
+	std::vector<measurement> ret;
+	if (!can_upload()) {
+		return ret;
+	}
+	for (size_t i = 0; i < 3; ++i) {
+		if (!create_local_file(fz::sprintf(L"mixed%d.bin", i), sizes[i])) {
+			return ret;
+		}
+	}
+
+	// 80% small, 18% medium and 2% large files
+	std::mt19937 rng(42);
+	CServerPath const path = remote_dir(L"mixed");
+	std::vector<std::wstring> names;
+	std::vector<job> setup;
+	std::vector<job> jobs;
+	for (size_t i = 0; i < count; ++i) {
+		unsigned int const r = rng() % 100;
+		size_t const type = r < 80 ? 0 : (r < 98 ? 1 : 2);
+		names.push_back(fz::sprintf(L"m%05d", i));
+		auto upload = transfer_job(local_file(fz::sprintf(L"mixed%d.bin", type)), path, names.back(), false, sizes[type]);
+		if (i % 2) {
+			jobs.push_back(upload);
+		}
+		else {
+			// Uploaded beforehand, downloaded while the others get uploaded
+			setup.push_back(upload);
+			jobs.push_back(transfer_job(local_file(L"mixed.down"), path, names.back(), true, sizes[type]));
+		}
+	}
+
+	run_untimed(drivers, {mkdir_job(remote_dir()), mkdir_job(path)});
+	run_untimed(drivers, setup);
+	ret.push_back(run_jobs("mixed", drivers, jobs, opts.engines));
+
+	cleanup(drivers, cleanup_jobs(path, names), {path});
+	for (size_t i = 0; i < 3; ++i) {
+		fz::remove_file(fz::to_native(local_file(fz::sprintf(L"mixed%d.bin", i))));
+	}
+	for (size_t i = 0; i < opts.engines; ++i) {
+		fz::remove_file(fz::to_native(local_file(L"mixed.down" + fz::to_wstring(i))));
+	}
+	return ret;
+}
+
+// Output
+// ------
+
+double percentile(std::vector<double> const& sorted, double p)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t const index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+	return sorted[index];
+}
+
+double mib_per_second(measurement const& m)
+{
+	return m.seconds > 0 ? m.bytes / m.seconds / 1024 / 1024 : 0;
+}
+
+double ops_per_second(measurement const& m)
+{
+	return m.seconds > 0 ? m.ops / m.seconds : 0;
+}
+
+double cpu_per_gib(measurement const& m)
+{
+	return m.bytes ? m.cpu * 1024 * 1024 * 1024 / m.bytes : 0;
+}
+
+void print_text(measurement const& m)
+{
+	printf("%-16s %10.1f MiB/s %10.1f ops/s %8.2f CPU s/GiB   latency ms p50 %8.2f p90 %8.2f p99 %8.2f max %8.2f%s\n",
+		m.name.c_str(), mib_per_second(m), ops_per_second(m), cpu_per_gib(m),
+		percentile(m.latencies, 0.5), percentile(m.latencies, 0.9), percentile(m.latencies, 0.99),
+		m.latencies.empty() ? 0 : m.latencies.back(), m.failed ? " FAILED" : "");
+	fflush(stdout);
+}
+
+void print_json(std::vector<measurement> const& measurements)
+{
+	printf("{\n  \"protocol\": \"%s\",\n  \"engines\": %zu,\n  \"scale\": %g,\n  \"workloads\": [",
+		fz::to_string(CServer::GetProtocolName(opts.server.GetProtocol())).c_str(), opts.engines, opts.scale);
+	for (size_t i = 0; i < measurements.size(); ++i) {
+		auto const& m = measurements[i];
+		printf("%s    {\"name\": \"%s\", \"ops\": %llu, \"bytes\": %llu, \"seconds\": %.6f, \"mib_per_second\": %.3f, \"ops_per_second\": %.3f, "
+			"\"cpu_seconds\": %.3f, \"cpu_seconds_per_gib\": %.3f, \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, \"failed\": %s}",
+			i ? ",\n" : "\n", m.name.c_str(), static_cast<unsigned long long>(m.ops), static_cast<unsigned long long>(m.bytes), m.seconds,
+			mib_per_second(m), ops_per_second(m), m.cpu, cpu_per_gib(m),
+			percentile(m.latencies, 0.5), percentile(m.latencies, 0.9), percentile(m.latencies, 0.99),
+			m.latencies.empty() ? 0 : m.latencies.back(), m.failed ? "true" : "false");
+	}
+	printf("\n  ]\n}\n");
+}
+
+struct workload
+{
+	std::string name;
+	std::function<std::vector<measurement>(std::vector<std::unique_ptr<driver>> &)> run;
+};
+}
+
+int main(int argc, char* argv[])
+{
+	std::wstring protocol = L"ftp";
+	std::wstring host = L"127.0.0.1";
+	unsigned int port{};
+	std::wstring user;
+	std::wstring pass;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string const arg = argv[i];
+		if (arg == "--json") {
+			opts.json = true;
+		}
+		else if (arg == "--keep") {
+			opts.keep = true;
+		}
+		else if (arg == "--filter" && i + 1 < argc) {
+			opts.filter = argv[++i];
+		}
+		else if (arg == "--scale" && i + 1 < argc) {
+			opts.scale = atof(argv[++i]);
+			if (opts.scale <= 0) {
+				opts.scale = 1;
+			}
+		}
+		else if (arg == "--engines" && i + 1 < argc) {
+			opts.engines = static_cast<size_t>(std::max(1, atoi(argv[++i])));
+		}
+		else if (arg == "--protocol" && i + 1 < argc) {
+			protocol = fz::to_wstring(argv[++i]);
+		}
+		else if (arg == "--host" && i + 1 < argc) {
+			host = fz::to_wstring(argv[++i]);
+		}
+		else if (arg == "--port" && i + 1 < argc) {
+			port = static_cast<unsigned int>(atoi(argv[++i]));
+		}
+		else if (arg == "--user" && i + 1 < argc) {
+			user = fz::to_wstring(argv[++i]);
+		}
+		else if (arg == "--pass" && i + 1 < argc) {
+			pass = fz::to_wstring(argv[++i]);
+		}
+		else if (arg == "--remote-dir" && i + 1 < argc) {
+			opts.remoteDir = CServerPath(fz::to_wstring(argv[++i]), UNIX);
+		}
+		else if (arg == "--local-dir" && i + 1 < argc) {
+			opts.localDir = fz::to_wstring(argv[++i]);
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--json] [--filter substring] [--scale factor] [--engines n] [--keep]\n"
+				"       [--protocol ftp|ftps|ftpes|sftp|http|https] [--host host] [--port port] [--user user] [--pass pass]\n"
+				"       [--remote-dir path] [--local-dir path]\n"
+				"  --json        Print results as JSON\n"
+				"  --filter      Only run workloads with the substring in their name\n"
+				"  --scale       Multiplies the sizes and file counts, default 1\n"
+				"  --engines     Engines transferring in parallel, default 4\n"
+				"  --keep        Leave the remote files in place, e.g. for an HTTP run\n"
+				"  --remote-dir  Directory on the server for the test files, default /fzbench\n"
+				"  --local-dir   Local directory for the test files, default ./fzbench\n";
+			return 1;
+		}
+	}
+
+	ServerProtocol const serverProtocol = CServer::GetProtocolFromPrefix(protocol);
+	if (serverProtocol == UNKNOWN || !opts.server.SetHost(host, port ? port : CServer::GetDefaultPort(serverProtocol))) {
+		std::cerr << "Invalid protocol or host\n";
+		return 1;
+	}
+	opts.server.SetProtocol(serverProtocol);
+	if (!user.empty()) {
+		opts.server.SetUser(user);
+		opts.credentials.logonType_ = LogonType::normal;
+		opts.credentials.SetPass(pass);
+	}
+	if (!opts.remoteDir.HasParent()) {
+		std::cerr << "The remote directory must not be the root directory\n";
+		return 1;
+	}
+
+	fz::mkdir(fz::to_native(opts.localDir), true);
+
+	CHeadlessOptions engineOptions;
+	CHeadlessEncodingConverter converter;
+	CFileZillaEngineContext context(engineOptions, converter);
+
+	std::vector<std::unique_ptr<driver>> drivers;
+	for (size_t i = 0; i < opts.engines; ++i) {
+		drivers.push_back(std::make_unique<driver>(context));
+	}
+
+	std::vector<workload> const workloads{
+		{"large", large_file},
+		{"small", small_files},
+		{"listing", deep_listing},
+		{"mixed", mixed_queue}
+	};
+
+	std::vector<measurement> measurements;
+	bool failed{};
+	for (auto const& w : workloads) {
+		if (!opts.filter.empty() && w.name.find(opts.filter) == std::string::npos) {
+			continue;
+		}
+
+		for (auto & m : w.run(drivers)) {
+			failed |= m.failed;
+			if (!opts.json) {
+				print_text(m);
+			}
+			measurements.push_back(std::move(m));
+		}
+	}
+
+	// Engines need to go before the context
+	drivers.clear();
+
+	if (opts.json) {
+		print_json(measurements);
+	}
+
+	return failed ? 1 : 0;
+}